@@ -104,6 +104,52 @@ public:
 	void saveM(const std::string &filename, size_t W) const;
 };
 
+/// Bag of words vector stored as sorted arrays, for fast scoring.
+/// It is built from a BowVector, which remains the vector the vocabulary
+/// and the databases work with
+class FlatBowVector
+{
+public:
+
+	/**
+	 * Empty vector
+	 */
+	FlatBowVector(void);
+
+	/**
+	 * Copies the words of a bow vector
+	 * @param v
+	 */
+	explicit FlatBowVector(const BowVector &v);
+
+	/**
+	 * Replaces the words with those of a bow vector
+	 * @param v
+	 */
+	void assign(const BowVector &v);
+
+	/**
+	 * Removes all the words
+	 */
+	void clear();
+
+	/**
+	 * Returns the number of words
+	 */
+	inline size_t size() const { return ids.size(); }
+
+	/**
+	 * Returns whether there are no words
+	 */
+	inline bool empty() const { return ids.empty(); }
+
+	/// Word ids, in increasing order
+	std::vector<WordId> ids;
+
+	/// Value of each word
+	std::vector<WordValue> values;
+};
+
 } // namespace DBoW2
 
 #endif
@@ -15,6 +15,7 @@
 #include <string>
 
 #include "dbow2/FClass.h"
+#include "dbow2/Hamming.h"
 
 namespace DBoW2 {
 
@@ -44,7 +45,7 @@ public:
    * @param b
    * @return distance
    */
-  static int distance(const TDescriptor &a, const TDescriptor &b);
+  static inline int distance(const TDescriptor &a, const TDescriptor &b);
 
   /**
    * Returns a string version of the descriptor
@@ -73,6 +74,15 @@ public:
 
 };
 
+// --------------------------------------------------------------------------
+
+// Defined here so that the vocabulary descent can inline it
+inline int FORB::distance(const FORB::TDescriptor &a,
+  const FORB::TDescriptor &b)
+{
+  return Hamming::distance(a.ptr<unsigned char>(), b.ptr<unsigned char>());
+}
+
 } // namespace DBoW2
 
 #endif
@@ -50,6 +50,125 @@ public:
     
 };
 
+/// Vector of nodes with indexes of local features, stored flat: node ids in
+/// a sorted array and the feature indexes of all the nodes in one buffer,
+/// in compressed sparse rows. Building it does not allocate per node
+class FlatFeatureVector
+{
+public:
+
+  /**
+   * Empty vector
+   */
+  FlatFeatureVector(void);
+
+  /**
+   * Copies the nodes and features of a feature vector
+   * @param fv
+   */
+  explicit FlatFeatureVector(const FeatureVector &fv);
+
+  /**
+   * Replaces the nodes and features with those of a feature vector
+   * @param fv
+   */
+  void assign(const FeatureVector &fv);
+
+  /**
+   * Replaces the nodes and features with pairs of node id and feature index.
+   * The features of each node are kept in increasing index, as
+   * FeatureVector::addFeature does when features are added in order
+   * @param features (in/out) pairs, sorted by the call
+   */
+  void assign(std::vector<std::pair<NodeId, unsigned int> > &features);
+
+  /**
+   * Removes all the nodes
+   */
+  void clear();
+
+  /**
+   * Exchanges the contents with another vector
+   * @param fv
+   */
+  void swap(FlatFeatureVector &fv);
+
+  /**
+   * Returns the number of nodes
+   */
+  inline size_t size() const { return nodes.size(); }
+
+  /**
+   * Returns whether there are no nodes
+   */
+  inline bool empty() const { return nodes.empty(); }
+
+  /**
+   * Returns the first feature index of the i-th node
+   * @param i node position
+   */
+  inline const unsigned int* featuresBegin(size_t i) const
+    { return &features[0] + offsets[i]; }
+
+  /**
+   * Returns the number of features of the i-th node
+   * @param i node position
+   */
+  inline unsigned int featureCount(size_t i) const
+    { return offsets[i+1] - offsets[i]; }
+
+  /// Node ids, in increasing order
+  std::vector<NodeId> nodes;
+
+  /// Position in features of the first index of each node, plus the total
+  std::vector<unsigned int> offsets;
+
+  /// Feature indexes of all the nodes
+  std::vector<unsigned int> features;
+};
+
+/// Walks the nodes two flat feature vectors have in common, in increasing
+/// node id, as the matching by vocabulary nodes does
+class CommonNodes
+{
+public:
+
+  /**
+   * Starts before the first common node
+   * @param a
+   * @param b
+   */
+  CommonNodes(const FlatFeatureVector &a, const FlatFeatureVector &b);
+
+  /**
+   * Moves to the next common node
+   * @return false when there are no more
+   */
+  bool next();
+
+  /// Id of the current node
+  inline NodeId node() const { return m_a.nodes[m_i]; }
+
+  /// Features of the current node in the first vector
+  inline const unsigned int* features1() const
+    { return m_a.featuresBegin(m_i); }
+  inline unsigned int size1() const { return m_a.featureCount(m_i); }
+
+  /// Features of the current node in the second vector
+  inline const unsigned int* features2() const
+    { return m_b.featuresBegin(m_j); }
+  inline unsigned int size2() const { return m_b.featureCount(m_j); }
+
+private:
+
+  const FlatFeatureVector &m_a;
+  const FlatFeatureVector &m_b;
+
+  /// Positions of the current node, m_started is false before the first one
+  size_t m_i, m_j;
+  bool m_started;
+};
+
 } // namespace DBoW2
 
 #endif
@@ -0,0 +1,391 @@
+/**
+ * File: Hamming.h
+ * Description: hamming distance between 256 bit binary descriptors
+ * License: see the LICENSE.txt file
+ *
+ * The fastest available bit count is selected when compiling:
+ * hardware POPCNT or AVX2 (vpshufb) on x86, vcnt on ARM NEON, and the
+ * parallel bit count from
+ * http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetParallel
+ * otherwise. All of them return exactly the same distances.
+ *
+ * Descriptors are compared either as bytes (rows of a descriptor matrix)
+ * or as Descriptor256 values, which hold one descriptor without a header.
+ *
+ */
+
+#ifndef __D_T_HAMMING__
+#define __D_T_HAMMING__
+
+#include <cstddef>
+#include <cstring>
+#include <climits>
+#include <stdint.h>
+
+#if defined(__AVX2__) || defined(__POPCNT__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace DBoW2 {
+
+/// A 256 bit binary descriptor held by value. It is 32 byte aligned, so
+/// it never straddles a cache line, and copying it allocates nothing
+struct Descriptor256
+{
+  uint64_t w[4];
+
+  inline const unsigned char* bytes() const
+  {
+    return reinterpret_cast<const unsigned char*>(w);
+  }
+
+  inline unsigned char* bytes()
+  {
+    return reinterpret_cast<unsigned char*>(w);
+  }
+
+  /**
+   * Copies a descriptor from memory that does not need to be aligned
+   * @param p 32 bytes
+   */
+  static inline Descriptor256 fromBytes(const unsigned char *p)
+  {
+    Descriptor256 d;
+    memcpy(d.w, p, sizeof(d.w));
+    return d;
+  }
+
+  inline bool operator==(const Descriptor256 &b) const
+  {
+    return w[0] == b.w[0] && w[1] == b.w[1] && w[2] == b.w[2] && w[3] == b.w[3];
+  }
+} __attribute__((aligned(32)));
+
+/// Hamming distance of 32 byte (256 bit) descriptors, as used by ORB
+class Hamming
+{
+public:
+
+  /// Descriptor length (in bytes)
+  static const int L = 32;
+
+  /**
+   * Calculates the distance between two descriptors
+   * @param a first descriptor, L bytes
+   * @param b second descriptor, L bytes
+   * @return number of different bits
+   */
+  static inline int distance(const unsigned char *a, const unsigned char *b);
+
+  /**
+   * Calculates the distance between the first 8 bytes of two descriptors.
+   * It is a lower bound of the full distance, to reject candidates cheaply
+   * @param a first descriptor, at least 8 bytes
+   * @param b second descriptor, at least 8 bytes
+   * @return number of different bits among the first 64
+   */
+  static inline int distance64(const unsigned char *a, const unsigned char *b);
+
+  /**
+   * Versions of distance and distance64 for descriptor values, the words
+   * of a are read directly
+   * @param a first descriptor
+   * @param b second descriptor, a value or L bytes
+   * @return number of different bits
+   */
+  static inline int distance(const Descriptor256 &a, const Descriptor256 &b);
+  static inline int distance(const Descriptor256 &a, const unsigned char *b);
+  static inline int distance64(const Descriptor256 &a, const unsigned char *b);
+
+  /**
+   * Finds the two nearest candidates to a query descriptor.
+   * Candidates are rows of a descriptor matrix, selected by their indices.
+   * Ties are resolved in favour of the first candidate, as a sequential
+   * search with strict comparisons would do.
+   * @param query descriptor, L bytes
+   * @param base pointer to the first row of the candidate descriptors
+   * @param step bytes between consecutive rows
+   * @param indices rows to test
+   * @param n number of indices
+   * @param best_pos (out) position in indices of the best candidate, -1 if n is 0
+   * @param second_dist (out) distance of the second best candidate, INT_MAX if none
+   * @return distance of the best candidate, INT_MAX if n is 0
+   */
+  static inline int bestTwo(const unsigned char *query,
+    const unsigned char *base, size_t step,
+    const size_t *indices, size_t n,
+    int &best_pos, int &second_dist);
+
+  /**
+   * Finds the nearest of n candidates stored next to each other.
+   * Ties are resolved in favour of the first candidate
+   * @param query descriptor, L bytes
+   * @param candidates n contiguous descriptors of L bytes
+   * @param n number of candidates, at least 1
+   * @param best_pos (out) position of the best candidate
+   * @return distance of the best candidate
+   */
+  static inline int nearest(const unsigned char *query,
+    const unsigned char *candidates, size_t n, size_t &best_pos);
+
+  /**
+   * Calculates the distances from a query to n candidates stored next to
+   * each other
+   * @param query descriptor, L bytes
+   * @param candidates n contiguous descriptors of L bytes
+   * @param n number of candidates
+   * @param dists (out) n distances, in the order of the candidates
+   */
+  static inline void distances(const unsigned char *query,
+    const unsigned char *candidates, size_t n, int *dists);
+
+  /**
+   * Calculates the distances between all the pairs of two sets of
+   * descriptors stored next to each other
+   * @param queries nq contiguous descriptors of L bytes
+   * @param nq number of queries
+   * @param candidates nc contiguous descriptors of L bytes
+   * @param nc number of candidates
+   * @param dists (out) nq x nc distances, row major (one row per query)
+   */
+  static inline void distanceMatrix(const unsigned char *queries, size_t nq,
+    const unsigned char *candidates, size_t nc, int *dists);
+
+protected:
+
+#if defined(__AVX2__)
+  static inline int distance(__m256i q, const unsigned char *b);
+#endif
+
+};
+
+// --------------------------------------------------------------------------
+
+#if defined(__AVX2__)
+
+inline int Hamming::distance(__m256i q, const unsigned char *b)
+{
+  // Nibble lookup table of bit counts, then horizontal byte sums
+  const __m256i lut = _mm256_setr_epi8(
+    0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+    0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+
+  const __m256i x = _mm256_xor_si256(q,
+    _mm256_loadu_si256((const __m256i*)b));
+  const __m256i lo = _mm256_and_si256(x, low_mask);
+  const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask);
+  const __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo),
+    _mm256_shuffle_epi8(lut, hi));
+  const __m256i sum = _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+
+  return (int)(_mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1) +
+    _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3));
+}
+
+#endif
+
+// --------------------------------------------------------------------------
+
+inline int Hamming::distance(const unsigned char *a, const unsigned char *b)
+{
+#if defined(__POPCNT__) && defined(__x86_64__)
+
+  // four hardware popcounts are cheaper than a vector count for a single pair
+  uint64_t va[4], vb[4];
+  memcpy(va, a, L);
+  memcpy(vb, b, L);
+
+  return (int)(_mm_popcnt_u64(va[0] ^ vb[0]) + _mm_popcnt_u64(va[1] ^ vb[1]) +
+    _mm_popcnt_u64(va[2] ^ vb[2]) + _mm_popcnt_u64(va[3] ^ vb[3]));
+
+#elif defined(__AVX2__)
+
+  return distance(_mm256_loadu_si256((const __m256i*)a), b);
+
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+
+  const uint8x16_t c0 = vcntq_u8(veorq_u8(vld1q_u8(a), vld1q_u8(b)));
+  const uint8x16_t c1 = vcntq_u8(veorq_u8(vld1q_u8(a+16), vld1q_u8(b+16)));
+  const uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vaddq_u8(c0, c1))));
+
+  return (int)(vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+
+#else
+
+  uint32_t va[8], vb[8];
+  memcpy(va, a, L);
+  memcpy(vb, b, L);
+
+  int dist = 0;
+  for(int i = 0; i < 8; ++i)
+  {
+    uint32_t v = va[i] ^ vb[i];
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    dist += (((v + (v >> 4)) & 0xF0F0F0F) * 0x1010101) >> 24;
+  }
+
+  return dist;
+
+#endif
+}
+
+// --------------------------------------------------------------------------
+
+inline int Hamming::distance64(const unsigned char *a, const unsigned char *b)
+{
+  uint64_t va, vb;
+  memcpy(&va, a, 8);
+  memcpy(&vb, b, 8);
+
+#if defined(__POPCNT__) && defined(__x86_64__)
+  return (int)_mm_popcnt_u64(va ^ vb);
+#else
+  uint64_t v = va ^ vb;
+  v = v - ((v >> 1) & 0x5555555555555555ULL);
+  v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+  return (int)((((v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL) * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// --------------------------------------------------------------------------
+
+inline int Hamming::distance(const Descriptor256 &a, const Descriptor256 &b)
+{
+#if defined(__POPCNT__) && defined(__x86_64__)
+  return (int)(_mm_popcnt_u64(a.w[0] ^ b.w[0]) + _mm_popcnt_u64(a.w[1] ^ b.w[1]) +
+    _mm_popcnt_u64(a.w[2] ^ b.w[2]) + _mm_popcnt_u64(a.w[3] ^ b.w[3]));
+#elif defined(__AVX2__)
+  return distance(_mm256_load_si256((const __m256i*)a.w), b.bytes());
+#else
+  return distance(a.bytes(), b.bytes());
+#endif
+}
+
+// --------------------------------------------------------------------------
+
+inline int Hamming::distance(const Descriptor256 &a, const unsigned char *b)
+{
+#if defined(__POPCNT__) && defined(__x86_64__)
+  uint64_t vb[4];
+  memcpy(vb, b, L);
+  return (int)(_mm_popcnt_u64(a.w[0] ^ vb[0]) + _mm_popcnt_u64(a.w[1] ^ vb[1]) +
+    _mm_popcnt_u64(a.w[2] ^ vb[2]) + _mm_popcnt_u64(a.w[3] ^ vb[3]));
+#elif defined(__AVX2__)
+  return distance(_mm256_load_si256((const __m256i*)a.w), b);
+#else
+  return distance(a.bytes(), b);
+#endif
+}
+
+// --------------------------------------------------------------------------
+
+inline int Hamming::distance64(const Descriptor256 &a, const unsigned char *b)
+{
+  return distance64(a.bytes(), b);
+}
+
+// --------------------------------------------------------------------------
+
+inline int Hamming::bestTwo(const unsigned char *query,
+  const unsigned char *base, size_t step,
+  const size_t *indices, size_t n,
+  int &best_pos, int &second_dist)
+{
+  int best_dist = INT_MAX;
+  best_pos = -1;
+  second_dist = INT_MAX;
+
+#if defined(__AVX2__)
+  // the query stays in a register for all the candidates
+  const __m256i q = _mm256_loadu_si256((const __m256i*)query);
+#endif
+
+  for(size_t i = 0; i < n; ++i)
+  {
+    const unsigned char *candidate = base + indices[i] * step;
+
+#if defined(__AVX2__)
+    const int d = distance(q, candidate);
+#else
+    const int d = distance(query, candidate);
+#endif
+
+    if(d < best_dist)
+    {
+      second_dist = best_dist;
+      best_dist = d;
+      best_pos = (int)i;
+    }
+    else if(d < second_dist)
+    {
+      second_dist = d;
+    }
+  }
+
+  return best_dist;
+}
+
+// --------------------------------------------------------------------------
+
+inline int Hamming::nearest(const unsigned char *query,
+  const unsigned char *candidates, size_t n, size_t &best_pos)
+{
+#if defined(__AVX2__)
+  const __m256i q = _mm256_loadu_si256((const __m256i*)query);
+  int best_dist = distance(q, candidates);
+#else
+  int best_dist = distance(query, candidates);
+#endif
+  best_pos = 0;
+
+  for(size_t i = 1; i < n; ++i)
+  {
+#if defined(__AVX2__)
+    const int d = distance(q, candidates + i * L);
+#else
+    const int d = distance(query, candidates + i * L);
+#endif
+    if(d < best_dist)
+    {
+      best_dist = d;
+      best_pos = i;
+    }
+  }
+
+  return best_dist;
+}
+
+// --------------------------------------------------------------------------
+
+inline void Hamming::distances(const unsigned char *query,
+  const unsigned char *candidates, size_t n, int *dists)
+{
+#if defined(__AVX2__)
+  const __m256i q = _mm256_loadu_si256((const __m256i*)query);
+  for(size_t i = 0; i < n; ++i)
+    dists[i] = distance(q, candidates + i * L);
+#else
+  for(size_t i = 0; i < n; ++i)
+    dists[i] = distance(query, candidates + i * L);
+#endif
+}
+
+// --------------------------------------------------------------------------
+
+inline void Hamming::distanceMatrix(const unsigned char *queries, size_t nq,
+  const unsigned char *candidates, size_t nc, int *dists)
+{
+  // candidates of a vocabulary node fit in L1, they are streamed once per query
+  for(size_t i = 0; i < nq; ++i)
+    distances(queries + i * L, candidates, nc, dists + i * nc);
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW2
+
+#endif
@@ -27,6 +27,15 @@ public:
    */
   virtual double score(const BowVector &v, const BowVector &w) const = 0;
 
+  /**
+   * Computes the same score on flat vectors, by intersecting their sorted
+   * word ids
+   * @param v
+   * @param w
+   * @return score
+   */
+  virtual double score(const FlatBowVector &v, const FlatBowVector &w) const = 0;
+
   /**
    * Returns whether a vector must be normalized before scoring according
    * to the scoring scheme
@@ -59,6 +68,14 @@ public:
      */ \
     virtual double score(const BowVector &v, const BowVector &w) const; \
     \
+    /** \
+     * Computes score between two flat vectors \
+     * @param v \
+     * @param w \
+     * @return score between v and w \
+     */ \
+    virtual double score(const FlatBowVector &v, const FlatBowVector &w) const; \
+    \
     /** \
      * Says if a vector must be normalized according to the scoring function \
      * @param norm (out) if true, norm to use
@@ -19,9 +19,16 @@
 #include <algorithm>
 #include <opencv/cv.h>
 
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "dbow2/FeatureVector.h"
 #include "dbow2/BowVector.h"
 #include "dbow2/ScoringObject.h"
+#include "dbow2/Hamming.h"
 #include <limits>
 
 #include "dutils/Random.h"
@@ -30,6 +37,48 @@ using namespace std;
 
 namespace DBoW2 {
 
+/**
+ * Returns the bytes of a descriptor that can be compared with Hamming,
+ * NULL for other descriptor types
+ */
+template<class TDescriptor>
+inline const unsigned char* hammingBytes(const TDescriptor &)
+{
+  return NULL;
+}
+
+inline const unsigned char* hammingBytes(const cv::Mat &d)
+{
+  if(d.type() == CV_8U && d.rows == 1 && d.cols == Hamming::L &&
+    d.isContinuous())
+    return d.data;
+  return NULL;
+}
+
+/**
+ * Runs the rows of a descriptor matrix transform on the threads of the host
+ * application, in place of the OpenMP threads given to setTransformThreads
+ */
+class TransformRunner
+{
+public:
+  /// Transforms the rows [begin, end)
+  class Rows
+  {
+  public:
+    virtual ~Rows() {}
+    virtual void operator()(int begin, int end) const = 0;
+  };
+
+  virtual ~TransformRunner() {}
+
+  /**
+   * Calls rows over [0, n), split in at most tasks ranges, and returns once
+   * they are all done
+   */
+  virtual void run(int n, int tasks, const Rows &rows) = 0;
+};
+
 /// @param TDescriptor class of descriptor
 /// @param F class of descriptor functions
 template<class TDescriptor, class F>
@@ -120,6 +169,13 @@ public:
    */
   virtual inline bool empty() const;
 
+  /**
+   * Returns an estimate of the memory held by the vocabulary: the tree,
+   * the node descriptors (or the mapped file holding them) and the flat tree
+   * @return bytes
+   */
+  size_t memoryBytes() const;
+
   /**
    * Transforms a set of descriptores into a bow vector
    * @param features
@@ -138,6 +194,42 @@ public:
   virtual void transform(const std::vector<TDescriptor>& features,
     BowVector &v, FeatureVector &fv, int levelsup) const;
 
+  /**
+   * Transforms the rows of a descriptor matrix into a bow vector and a
+   * feature vector, as the vector version does. The descents of the rows
+   * are split among the threads given to setTransformThreads (with OpenMP,
+   * or as tasks of the runner if one is given) and merged in row order, so
+   * the result does not depend on the threads.
+   * TDescriptor must be cv::Mat
+   * @param features one descriptor per row
+   * @param v (out) bow vector
+   * @param fv (out) feature vector of nodes and feature indexes
+   * @param levelsup levels to go up the vocabulary tree to get the node index
+   * @param runner if given, runs the rows instead of OpenMP
+   */
+  virtual void transform(const cv::Mat &features,
+    BowVector &v, FeatureVector &fv, int levelsup,
+    TransformRunner *runner = NULL) const;
+
+  /**
+   * Same as the descriptor matrix version, with a flat feature vector
+   * @param features one descriptor per row
+   * @param v (out) bow vector
+   * @param fv (out) flat feature vector of nodes and feature indexes
+   * @param levelsup levels to go up the vocabulary tree to get the node index
+   * @param runner if given, runs the rows instead of OpenMP
+   */
+  virtual void transform(const cv::Mat &features,
+    BowVector &v, FlatFeatureVector &fv, int levelsup,
+    TransformRunner *runner = NULL) const;
+
+  /**
+   * Sets the threads used to transform a descriptor matrix, or the tasks
+   * when it is given a runner
+   * @param n number of threads, 1 to transform serially
+   */
+  inline void setTransformThreads(int n) { m_transform_threads = n > 1 ? n : 1; }
+
   /**
    * Transforms a single feature into a word (without weight)
    * @param feature
@@ -153,6 +245,15 @@ public:
    * @note the vectors must be already sorted and normalized if necessary
    */
   inline double score(const BowVector &a, const BowVector &b) const;
+
+  /**
+   * Returns the score of two flat vectors, same as with the BowVectors they
+   * were built from
+   * @param a vector
+   * @param b vector
+   * @return score between vectors
+   */
+  inline double score(const FlatBowVector &a, const FlatBowVector &b) const;
   
   /**
    * Returns the id of the node that is "levelsup" levels from the word given
@@ -254,6 +355,23 @@ public:
    */  
   virtual void load(const cv::FileStorage &fs, 
     const std::string &name = "vocabulary");
+
+  /**
+   * Saves the vocabulary into a compact binary file: a flat node array with
+   * the children, weights and packed descriptors.
+   * TDescriptor must be a single row cv::Mat, as in FORB
+   * @param filename
+   */
+  void saveToBinaryFile(const std::string &filename) const;
+
+  /**
+   * Loads the vocabulary from a binary file written by saveToBinaryFile.
+   * The file is mapped read-only and the node descriptors point into the
+   * mapping, which is shared by the processes loading the same file and
+   * stays mapped until the vocabulary is destroyed or loaded again
+   * @param filename
+   */
+  void loadFromBinaryFile(const std::string &filename);
   
   /** 
    * Stops those words whose weight is below minWeight.
@@ -269,6 +387,17 @@ public:
    */
   virtual int stopWords(double minWeight);
 
+  /**
+   * Removes the levels of the tree below L, the nodes of level L become the
+   * words. Without the training data, the idf weight of a new word is
+   * estimated as if the words it merges never appeared in the same image:
+   * its frequency is the sum of theirs, and stopped words count as present
+   * in every image. Other weightings keep their weight of 1.
+   * Vocabularies not deeper than L are not changed
+   * @param L depth levels of the truncated tree
+   */
+  void truncate(int L);
+
 protected:
 
   /// Pointer to descriptor
@@ -342,6 +471,65 @@ protected:
    * @param id (out) word id
    */
   virtual void transform(const TDescriptor &feature, WordId &id) const;
+
+  /**
+   * Descends the flat tree with the bytes of a Hamming descriptor.
+   * The flat tree must not be empty
+   * @param query Hamming::L descriptor bytes
+   * @param word_id (out) word id
+   * @param weight (out) word weight
+   * @param nid (out) if given, id of the node "levelsup" levels up
+   * @param levelsup
+   */
+  void transformFlat(const unsigned char *query, WordId &word_id,
+    WordValue &weight, NodeId *nid, int levelsup) const;
+
+  /**
+   * Computes the bow vector of the rows of a descriptor matrix, and the node
+   * of each row, for the feature vector versions of transform
+   * @param features one descriptor per row
+   * @param v (out) bow vector
+   * @param nids (out) node "levelsup" levels up of each row
+   * @param weights (out) weight of the word of each row, 0 if stopped
+   * @param levelsup
+   * @param runner if given, runs the rows instead of OpenMP
+   */
+  void transformRows(const cv::Mat &features, BowVector &v,
+    vector<NodeId> &nids, vector<WordValue> &weights, int levelsup,
+    TransformRunner *runner) const;
+
+  /// Words of a range of rows, for transformRows
+  class RowRange : public TransformRunner::Rows
+  {
+  public:
+    RowRange(const TemplatedVocabulary *voc, const cv::Mat &features,
+      vector<WordId> &ids, vector<WordValue> &weights, vector<NodeId> &nids,
+      int levelsup, bool flat):
+      m_voc(voc), m_features(features), m_ids(ids), m_weights(weights),
+      m_nids(nids), m_levelsup(levelsup), m_flat(flat) {}
+
+    virtual void operator()(int begin, int end) const
+    {
+      for(int i = begin; i < end; ++i)
+      {
+        if(m_flat)
+          m_voc->transformFlat(m_features.ptr<unsigned char>(i), m_ids[i],
+            m_weights[i], &m_nids[i], m_levelsup);
+        else
+          m_voc->transform(m_features.row(i), m_ids[i], m_weights[i],
+            &m_nids[i], m_levelsup);
+      }
+    }
+
+  protected:
+    const TemplatedVocabulary *m_voc;
+    const cv::Mat &m_features;
+    vector<WordId> &m_ids;
+    vector<WordValue> &m_weights;
+    vector<NodeId> &m_nids;
+    int m_levelsup;
+    bool m_flat;
+  };
       
   /**
    * Creates a level in the tree, under the parent, by running kmeans with
@@ -382,6 +570,18 @@ protected:
    * @param features
    */
   void setNodeWeights(const vector<vector<TDescriptor> > &features);
+
+  /**
+   * Unmaps the binary file the descriptors point into, if any.
+   * The nodes must have been cleared before
+   */
+  void releaseMapping();
+
+  /**
+   * Builds the flat tree used by transform from the nodes. It is left
+   * empty if the descriptors are not Hamming descriptors
+   */
+  void createFlatTree();
   
 protected:
 
@@ -406,6 +606,24 @@ protected:
   /// Words of the vocabulary (tree leaves)
   /// this condition holds: m_words[wid]->word_id == wid
   std::vector<Node*> m_words;
+
+  /// Flat tree, in breadth first order: the children of a node take
+  /// contiguous slots, so their descriptors are next to each other.
+  /// For each slot, its node id and the first slot and number of its children
+  std::vector<NodeId> m_flat_node;
+  std::vector<unsigned int> m_flat_first;
+  std::vector<unsigned int> m_flat_count;
+  /// Hamming::L descriptor bytes of each slot
+  std::vector<unsigned char> m_flat_descriptors;
+  /// Slots of the children of the root
+  unsigned int m_flat_root_count;
+
+  /// Threads used to transform a descriptor matrix
+  int m_transform_threads;
+
+  /// Mapped binary file the node descriptors point into (NULL if none)
+  void *m_mapped_data;
+  size_t m_mapped_size;
   
 };
 
@@ -415,7 +633,8 @@ template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
   (int k, int L, WeightingType weighting, ScoringType scoring)
   : m_k(k), m_L(L), m_weighting(weighting), m_scoring(scoring),
-  m_scoring_object(NULL)
+  m_scoring_object(NULL), m_mapped_data(NULL), m_mapped_size(0), m_flat_root_count(0),
+  m_transform_threads(1)
 {
   createScoringObject();
 }
@@ -424,7 +643,9 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const std::string &filename): m_scoring_object(NULL)
+  (const std::string &filename): m_scoring_object(NULL),
+  m_mapped_data(NULL), m_mapped_size(0), m_flat_root_count(0),
+  m_transform_threads(1)
 {
   load(filename);
 }
@@ -433,7 +654,9 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const char *filename): m_scoring_object(NULL)
+  (const char *filename): m_scoring_object(NULL),
+  m_mapped_data(NULL), m_mapped_size(0), m_flat_root_count(0),
+  m_transform_threads(1)
 {
   load(filename);
 }
@@ -497,7 +720,8 @@ void TemplatedVocabulary<TDescriptor,F>::setWeightingType(WeightingType type)
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary(
   const TemplatedVocabulary<TDescriptor, F> &voc)
-  : m_scoring_object(NULL)
+  : m_scoring_object(NULL), m_mapped_data(NULL), m_mapped_size(0), m_flat_root_count(0),
+  m_transform_threads(1)
 {
   *this = voc;
 }
@@ -508,6 +732,62 @@ template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::~TemplatedVocabulary()
 {
   //delete m_scoring_object;
+  m_nodes.clear();
+  m_words.clear();
+  releaseMapping();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::createFlatTree()
+{
+  m_flat_node.clear();
+  m_flat_first.clear();
+  m_flat_count.clear();
+  m_flat_descriptors.clear();
+  m_flat_root_count = 0;
+
+  if(m_nodes.size() < 2) return;
+
+  for(size_t i = 1; i < m_nodes.size(); ++i)
+    if(hammingBytes(m_nodes[i].descriptor) == NULL) return;
+
+  const size_t n = m_nodes.size() - 1; // the root has no slot
+  m_flat_node.reserve(n);
+  m_flat_first.resize(n, 0);
+  m_flat_count.resize(n, 0);
+  m_flat_descriptors.resize(n * Hamming::L);
+
+  // slots are given level by level, the children of a slot after all the
+  // slots given before
+  const vector<NodeId> &root_children = m_nodes[0].children;
+  m_flat_node.insert(m_flat_node.end(), root_children.begin(),
+    root_children.end());
+  m_flat_root_count = root_children.size();
+
+  for(size_t slot = 0; slot < m_flat_node.size(); ++slot)
+  {
+    const Node &node = m_nodes[m_flat_node[slot]];
+    memcpy(&m_flat_descriptors[slot * Hamming::L],
+      hammingBytes(node.descriptor), Hamming::L);
+
+    m_flat_first[slot] = m_flat_node.size();
+    m_flat_count[slot] = node.children.size();
+    m_flat_node.insert(m_flat_node.end(), node.children.begin(),
+      node.children.end());
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::releaseMapping()
+{
+  if(m_mapped_data != NULL)
+    munmap(m_mapped_data, m_mapped_size);
+  m_mapped_data = NULL;
+  m_mapped_size = 0;
 }
 
 // --------------------------------------------------------------------------
@@ -521,14 +801,25 @@ TemplatedVocabulary<TDescriptor,F>::operator=
   this->m_L = voc.m_L;
   this->m_scoring = voc.m_scoring;
   this->m_weighting = voc.m_weighting;
+  this->m_transform_threads = voc.m_transform_threads;
 
   this->createScoringObject();
   
   this->m_nodes.clear();
   this->m_words.clear();
+  this->releaseMapping();
   
   this->m_nodes = voc.m_nodes;
   this->createWords();
+  this->createFlatTree();
+
+  // descriptors in the mapping of voc are only valid as long as voc
+  if(voc.m_mapped_data != NULL)
+  {
+    typename vector<Node>::iterator nit;
+    for(nit = this->m_nodes.begin(); nit != this->m_nodes.end(); ++nit)
+      nit->descriptor = nit->descriptor.clone();
+  }
   
   return *this;
 }
@@ -541,6 +832,7 @@ void TemplatedVocabulary<TDescriptor,F>::create(
 {
   m_nodes.clear();
   m_words.clear();
+  releaseMapping();
   
   // expected_nodes = Sum_{i=0..L} ( k^i )
 	int expected_nodes = 
@@ -564,6 +856,8 @@ void TemplatedVocabulary<TDescriptor,F>::create(
 
   // and set the weight of each node of the tree
   setNodeWeights(training_features);
+
+  createFlatTree();
   
 }
 
@@ -994,6 +1288,27 @@ inline bool TemplatedVocabulary<TDescriptor,F>::empty() const
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+size_t TemplatedVocabulary<TDescriptor,F>::memoryBytes() const
+{
+  size_t bytes = m_nodes.capacity() * sizeof(Node) +
+    m_words.capacity() * sizeof(Node*);
+  for(size_t i = 0; i < m_nodes.size(); ++i)
+    bytes += m_nodes[i].children.capacity() * sizeof(NodeId);
+
+  if(m_mapped_data != NULL)
+    bytes += m_mapped_size;
+  else
+    bytes += m_nodes.size() * F::L;
+
+  bytes += m_flat_node.capacity() * sizeof(NodeId) +
+    (m_flat_first.capacity() + m_flat_count.capacity()) * sizeof(unsigned int) +
+    m_flat_descriptors.capacity();
+  return bytes;
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 float TemplatedVocabulary<TDescriptor,F>::getEffectiveLevels() const
 {
@@ -1185,6 +1500,15 @@ inline double TemplatedVocabulary<TDescriptor,F>::score
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F> 
+inline double TemplatedVocabulary<TDescriptor,F>::score
+  (const FlatBowVector &v1, const FlatBowVector &v2) const
+{
+  return m_scoring_object->score(v1, v2);
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::transform
   (const TDescriptor &feature, WordId &id) const
@@ -1199,14 +1523,21 @@ template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature, 
   WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
 { 
-  // propagate the feature down the tree
-  vector<NodeId> nodes;
-  typename vector<NodeId>::const_iterator nit;
-
   // level at which the node must be stored in nid, if given
   const int nid_level = m_L - levelsup;
   if(nid_level <= 0 && nid != NULL) *nid = 0; // root
 
+  const unsigned char *query = hammingBytes(feature);
+  if(!m_flat_node.empty() && query != NULL)
+  {
+    transformFlat(query, word_id, weight, nid, levelsup);
+    return;
+  }
+
+  // propagate the feature down the tree
+  vector<NodeId> nodes;
+  typename vector<NodeId>::const_iterator nit;
+
   NodeId final_id = 0; // root
   int current_level = 0;
 
@@ -1241,6 +1572,150 @@ void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature,
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transformFlat(
+  const unsigned char *query, WordId &word_id, WordValue &weight,
+  NodeId *nid, int levelsup) const
+{
+  // level at which the node must be stored in nid, if given
+  const int nid_level = m_L - levelsup;
+  if(nid_level <= 0 && nid != NULL) *nid = 0; // root
+
+  // descend the flat tree, one batch of contiguous descriptors per level
+  unsigned int first = 0;
+  unsigned int count = m_flat_root_count;
+  NodeId final_id = 0;
+  int current_level = 0;
+
+  do
+  {
+    ++current_level;
+    size_t pos;
+    Hamming::nearest(query, &m_flat_descriptors[first * Hamming::L],
+      count, pos);
+    const unsigned int slot = first + pos;
+    final_id = m_flat_node[slot];
+
+    if(nid != NULL && current_level == nid_level)
+      *nid = final_id;
+
+    first = m_flat_first[slot];
+    count = m_flat_count[slot];
+  } while(count > 0);
+
+  word_id = m_nodes[final_id].word_id;
+  weight = m_nodes[final_id].weight;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F> 
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const cv::Mat &features, BowVector &v, FeatureVector &fv, int levelsup,
+  TransformRunner *runner) const
+{
+  fv.clear();
+
+  vector<NodeId> nids;
+  vector<WordValue> weights;
+  transformRows(features, v, nids, weights, levelsup, runner);
+
+  for(size_t i = 0; i < weights.size(); ++i)
+  {
+    if(weights[i] > 0) // not stopped
+      fv.addFeature(nids[i], i);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F> 
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const cv::Mat &features, BowVector &v, FlatFeatureVector &fv, 
+  int levelsup, TransformRunner *runner) const
+{
+  vector<NodeId> nids;
+  vector<WordValue> weights;
+  transformRows(features, v, nids, weights, levelsup, runner);
+
+  vector<pair<NodeId, unsigned int> > pairs;
+  pairs.reserve(weights.size());
+  for(size_t i = 0; i < weights.size(); ++i)
+  {
+    if(weights[i] > 0) // not stopped
+      pairs.push_back(make_pair(nids[i], (unsigned int)i));
+  }
+
+  fv.assign(pairs);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F> 
+void TemplatedVocabulary<TDescriptor,F>::transformRows(
+  const cv::Mat &features, BowVector &v, vector<NodeId> &nids,
+  vector<WordValue> &weights, int levelsup, TransformRunner *runner) const
+{
+  v.clear();
+  nids.clear();
+  weights.clear();
+
+  if(empty()) // safe for subclasses
+  {
+    return;
+  }
+
+  // words of all the rows first, each row is independent
+  const int n = features.rows;
+  vector<WordId> ids(n);
+  weights.resize(n);
+  nids.resize(n);
+
+  const bool flat = !m_flat_node.empty() && features.type() == CV_8U &&
+    features.cols == Hamming::L;
+
+  RowRange rows(this, features, ids, weights, nids, levelsup, flat);
+  if(runner && m_transform_threads > 1)
+  {
+    runner->run(n, m_transform_threads, rows);
+  }
+  else
+  {
+    #pragma omp parallel for schedule(static) num_threads(m_transform_threads) if(m_transform_threads > 1)
+    for(int i = 0; i < n; ++i)
+      rows(i, i + 1);
+  }
+
+  // then merged in row order, as the vector version does
+  LNorm norm;
+  bool must = m_scoring_object->mustNormalize(norm);
+
+  const bool tf = (m_weighting == TF || m_weighting == TF_IDF);
+  for(int i = 0; i < n; ++i)
+  {
+    if(weights[i] > 0) // not stopped
+    {
+      // the weight is the idf value if TF_IDF or IDF, 1 if TF or BINARY
+      if(tf)
+        v.addWeight(ids[i], weights[i]);
+      else
+        v.addIfNotExist(ids[i], weights[i]);
+    }
+  }
+
+  if(tf && !v.empty() && !must)
+  {
+    // unnecessary when normalizing
+    const double nd = v.size();
+    for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++)
+      vit->second /= nd;
+  }
+
+  if(must) v.normalize(norm);
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 NodeId TemplatedVocabulary<TDescriptor,F>::getParentNode
   (WordId wid, int levelsup) const
@@ -1315,6 +1790,69 @@ int TemplatedVocabulary<TDescriptor,F>::stopWords(double minWeight)
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::truncate(int L)
+{
+  if(L < 1 || L >= m_L || m_nodes.empty()) return;
+
+  const bool idf = (m_weighting == IDF || m_weighting == TF_IDF);
+
+  // frequency (Ni/N) of each node, the sum of the frequencies of its words
+  vector<double> freq(m_nodes.size(), 0);
+  for(size_t i = 0; i < m_words.size(); ++i)
+  {
+    const double f = idf ? exp(-(double)m_words[i]->weight) : 1;
+    for(NodeId nid = m_words[i]->id; nid != 0; nid = m_nodes[nid].parent)
+      freq[nid] += f;
+  }
+
+  // new tree in breadth first order, down to level L
+  vector<Node> nodes;
+  vector<NodeId> old_ids(1, 0);
+  vector<int> levels(1, 0);
+  nodes.reserve(m_nodes.size());
+  nodes.push_back(m_nodes[0]);
+  nodes[0].children.clear();
+
+  for(size_t i = 0; i < nodes.size(); ++i)
+  {
+    if(levels[i] == L) continue;
+
+    const vector<NodeId> &children = m_nodes[old_ids[i]].children;
+    for(size_t c = 0; c < children.size(); ++c)
+    {
+      Node node = m_nodes[children[c]];
+      node.id = nodes.size();
+      node.parent = i;
+      node.children.clear();
+
+      nodes[i].children.push_back(node.id);
+      nodes.push_back(node);
+      old_ids.push_back(children[c]);
+      levels.push_back(levels[i] + 1);
+    }
+  }
+
+  for(size_t i = 1; i < nodes.size(); ++i)
+  {
+    if(!nodes[i].isLeaf()) continue;
+
+    const double f = freq[old_ids[i]];
+    if(idf)
+      nodes[i].weight = f > 0 && f < 1 ? -log(f) : 0;
+    else
+      nodes[i].weight = 1;
+  }
+
+  // the descriptors of a mapped vocabulary still point into the mapping
+  m_nodes.swap(nodes);
+  m_L = L;
+  createWords();
+  createFlatTree();
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::save(const std::string &filename) const
 {
@@ -1440,6 +1978,7 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
 {
   m_words.clear();
   m_nodes.clear();
+  releaseMapping();
   
   cv::FileNode fvoc = fs[name];
   
@@ -1484,6 +2023,218 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+
+  createFlatTree();
+}
+
+// --------------------------------------------------------------------------
+
+// Binary format, in host byte order:
+//   header: tag, version, k, L, scoringType, weightingType, number of nodes
+//     (root included), number of words, descriptor type, descriptor bytes
+//   uint32 child count of each node
+//   uint32 children of each node, concatenated in node order
+//   uint32 node id of each word
+//   padding to 8 bytes
+//   double weight of each node
+//   descriptor bytes of each node, packed (zero for the root)
+
+/// Binary vocabulary files start with this tag and format version
+static const uint32_t BINARY_VOCABULARY_TAG = 0x32574244; // "DBW2"
+static const uint32_t BINARY_VOCABULARY_VERSION = 1;
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::saveToBinaryFile(
+  const std::string &filename) const
+{
+  std::ofstream f(filename.c_str(), std::ios::binary | std::ios::trunc);
+  if(!f.is_open()) throw string("Could not open file ") + filename;
+
+  int32_t desc_type = CV_8U;
+  uint32_t desc_bytes = 0;
+  if(m_nodes.size() > 1)
+  {
+    desc_type = m_nodes[1].descriptor.type();
+    desc_bytes = m_nodes[1].descriptor.cols * m_nodes[1].descriptor.elemSize();
+  }
+
+  uint32_t header[10];
+  header[0] = BINARY_VOCABULARY_TAG;
+  header[1] = BINARY_VOCABULARY_VERSION;
+  header[2] = m_k;
+  header[3] = m_L;
+  header[4] = m_scoring;
+  header[5] = m_weighting;
+  header[6] = m_nodes.size();
+  header[7] = m_words.size();
+  header[8] = desc_type;
+  header[9] = desc_bytes;
+  f.write((const char*)header, sizeof(header));
+
+  vector<uint32_t> counts, children;
+  counts.reserve(m_nodes.size());
+  children.reserve(m_nodes.size());
+  for(size_t i = 0; i < m_nodes.size(); ++i)
+  {
+    counts.push_back(m_nodes[i].children.size());
+    children.insert(children.end(), m_nodes[i].children.begin(),
+      m_nodes[i].children.end());
+  }
+  if(!counts.empty())
+    f.write((const char*)&counts[0], counts.size()*sizeof(uint32_t));
+  if(!children.empty())
+    f.write((const char*)&children[0], children.size()*sizeof(uint32_t));
+
+  vector<uint32_t> words(m_words.size());
+  for(size_t i = 0; i < m_words.size(); ++i)
+    words[i] = m_words[i]->id;
+  if(!words.empty())
+    f.write((const char*)&words[0], words.size()*sizeof(uint32_t));
+
+  const char zeros[8] = {0};
+  f.write(zeros, (8 - (size_t)f.tellp() % 8) % 8);
+
+  vector<double> weights(m_nodes.size());
+  for(size_t i = 0; i < m_nodes.size(); ++i)
+    weights[i] = m_nodes[i].weight;
+  if(!weights.empty())
+    f.write((const char*)&weights[0], weights.size()*sizeof(double));
+
+  vector<char> empty(desc_bytes, 0);
+  for(size_t i = 0; i < m_nodes.size(); ++i)
+  {
+    const TDescriptor &d = m_nodes[i].descriptor;
+    if(d.empty())
+      f.write(&empty[0], desc_bytes);
+    else
+    {
+      if(d.rows != 1 || d.type() != desc_type ||
+        d.cols * d.elemSize() != desc_bytes)
+        throw string("Inconsistent descriptors saving ") + filename;
+      f.write((const char*)d.data, desc_bytes);
+    }
+  }
+
+  f.close();
+  if(f.fail()) throw string("Could not write file ") + filename;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::loadFromBinaryFile(
+  const std::string &filename)
+{
+  m_words.clear();
+  m_nodes.clear();
+  releaseMapping();
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd < 0) throw string("Could not open file ") + filename;
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size < (off_t)(10*sizeof(uint32_t)))
+  {
+    close(fd);
+    throw string("Could not read file ") + filename;
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) throw string("Could not map file ") + filename;
+  m_mapped_data = data;
+  m_mapped_size = st.st_size;
+
+  const char *base = (const char*)data;
+  const uint32_t *header = (const uint32_t*)base;
+  const size_t n_nodes = header[6];
+  const size_t n_words = header[7];
+  const int desc_type = header[8];
+  const size_t desc_bytes = header[9];
+
+  // offsets of the arrays, checked against the file size before use
+  size_t offset = 10*sizeof(uint32_t);
+  const size_t counts_offset = offset;
+  offset += n_nodes*sizeof(uint32_t);
+  const size_t children_offset = offset;
+  offset += (n_nodes > 0 ? n_nodes - 1 : 0)*sizeof(uint32_t);
+  const size_t words_offset = offset;
+  offset += n_words*sizeof(uint32_t);
+  offset += (8 - offset % 8) % 8;
+  const size_t weights_offset = offset;
+  offset += n_nodes*sizeof(double);
+  const size_t desc_offset = offset;
+  offset += n_nodes*desc_bytes;
+
+  if(header[0] != BINARY_VOCABULARY_TAG ||
+    header[1] != BINARY_VOCABULARY_VERSION || n_nodes == 0 ||
+    (n_nodes > 1 && (desc_bytes == 0 ||
+    desc_bytes % CV_ELEM_SIZE(desc_type) != 0)) || offset > m_mapped_size)
+  {
+    releaseMapping();
+    throw string("Invalid binary vocabulary ") + filename;
+  }
+
+  m_k = header[2];
+  m_L = header[3];
+  m_scoring = (ScoringType)header[4];
+  m_weighting = (WeightingType)header[5];
+
+  createScoringObject();
+
+  const uint32_t *counts = (const uint32_t*)(base + counts_offset);
+  const uint32_t *children = (const uint32_t*)(base + children_offset);
+  const uint32_t *words = (const uint32_t*)(base + words_offset);
+  const double *weights = (const double*)(base + weights_offset);
+  const char *descriptors = base + desc_offset;
+
+  m_nodes.resize(n_nodes);
+  size_t next_child = 0;
+  for(size_t i = 0; i < n_nodes; ++i)
+  {
+    Node &node = m_nodes[i];
+    node.id = i;
+    node.weight = weights[i];
+
+    if(next_child + counts[i] > n_nodes - 1)
+    {
+      m_nodes.clear();
+      releaseMapping();
+      throw string("Invalid binary vocabulary ") + filename;
+    }
+    node.children.assign(children + next_child,
+      children + next_child + counts[i]);
+    next_child += counts[i];
+    for(size_t c = 0; c < node.children.size(); ++c)
+    {
+      if(node.children[c] >= n_nodes)
+      {
+        m_nodes.clear();
+        releaseMapping();
+        throw string("Invalid binary vocabulary ") + filename;
+      }
+      m_nodes[node.children[c]].parent = i;
+    }
+
+    // descriptors are used in place from the mapping
+    if(i > 0)
+      node.descriptor = cv::Mat(1, desc_bytes / CV_ELEM_SIZE(desc_type),
+        desc_type, const_cast<char*>(descriptors + i*desc_bytes));
+  }
+
+  m_words.resize(n_words);
+  for(size_t i = 0; i < n_words; ++i)
+  {
+    if(words[i] >= n_nodes)
+    {
+      m_words.clear();
+      m_nodes.clear();
+      releaseMapping();
+      throw string("Invalid binary vocabulary ") + filename;
+    }
+    m_nodes[words[i]].word_id = i;
+    m_words[i] = &m_nodes[words[i]];
+  }
+
+  createFlatTree();
 }
 
 // --------------------------------------------------------------------------
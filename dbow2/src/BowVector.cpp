@@ -126,5 +126,42 @@ void BowVector::saveM(const std::string &filename, size_t W) const
 
 // --------------------------------------------------------------------------
 
+FlatBowVector::FlatBowVector(void)
+{
+}
+
+// --------------------------------------------------------------------------
+
+FlatBowVector::FlatBowVector(const BowVector &v)
+{
+  assign(v);
+}
+
+// --------------------------------------------------------------------------
+
+void FlatBowVector::assign(const BowVector &v)
+{
+  ids.resize(v.size());
+  values.resize(v.size());
+  
+  size_t i = 0;
+  BowVector::const_iterator vit;
+  for(vit = v.begin(); vit != v.end(); ++vit, ++i)
+  {
+    ids[i] = vit->first;
+    values[i] = vit->second;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+void FlatBowVector::clear()
+{
+  ids.clear();
+  values.clear();
+}
+
+// --------------------------------------------------------------------------
+
 } // namespace DBoW2
 
@@ -78,30 +78,6 @@ void FORB::meanValue(const std::vector<FORB::pDescriptor> &descriptors,
 
 // --------------------------------------------------------------------------
   
-int FORB::distance(const FORB::TDescriptor &a,
-  const FORB::TDescriptor &b)
-{
-  // Bit set count operation from
-  // http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetParallel
-
-  const int *pa = a.ptr<int32_t>();
-  const int *pb = b.ptr<int32_t>();
-
-  int dist=0;
-
-  for(int i=0; i<8; i++, pa++, pb++)
-  {
-      unsigned  int v = *pa ^ *pb;
-      v = v - ((v >> 1) & 0x55555555);
-      v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
-      dist += (((v + (v >> 4)) & 0xF0F0F0F) * 0x1010101) >> 24;
-  }
-
-  return dist;
-}
-
-// --------------------------------------------------------------------------
-  
 std::string FORB::toString(const FORB::TDescriptor &a)
 {
   stringstream ss;
@@ -11,6 +11,7 @@
 #include <map>
 #include <vector>
 #include <iostream>
+#include <algorithm>
 
 namespace DBoW2 {
 
@@ -82,4 +83,118 @@ std::ostream& operator<<(std::ostream &out,
 
 // ---------------------------------------------------------------------------
 
+FlatFeatureVector::FlatFeatureVector(void)
+{
+}
+
+// ---------------------------------------------------------------------------
+
+FlatFeatureVector::FlatFeatureVector(const FeatureVector &fv)
+{
+  assign(fv);
+}
+
+// ---------------------------------------------------------------------------
+
+void FlatFeatureVector::assign(const FeatureVector &fv)
+{
+  clear();
+  
+  nodes.reserve(fv.size());
+  offsets.reserve(fv.size() + 1);
+  offsets.push_back(0);
+  
+  FeatureVector::const_iterator vit;
+  for(vit = fv.begin(); vit != fv.end(); ++vit)
+  {
+    nodes.push_back(vit->first);
+    features.insert(features.end(), vit->second.begin(), vit->second.end());
+    offsets.push_back(features.size());
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+void FlatFeatureVector::assign(
+  std::vector<std::pair<NodeId, unsigned int> > &pairs)
+{
+  clear();
+  
+  std::sort(pairs.begin(), pairs.end());
+  
+  features.resize(pairs.size());
+  offsets.push_back(0);
+  
+  for(size_t i = 0; i < pairs.size(); ++i)
+  {
+    if(i > 0 && pairs[i].first != pairs[i-1].first)
+      offsets.push_back(i);
+    if(i == 0 || pairs[i].first != pairs[i-1].first)
+      nodes.push_back(pairs[i].first);
+    features[i] = pairs[i].second;
+  }
+  
+  if(!pairs.empty()) offsets.push_back(pairs.size());
+}
+
+// ---------------------------------------------------------------------------
+
+void FlatFeatureVector::clear()
+{
+  nodes.clear();
+  offsets.clear();
+  features.clear();
+}
+
+// ---------------------------------------------------------------------------
+
+void FlatFeatureVector::swap(FlatFeatureVector &fv)
+{
+  nodes.swap(fv.nodes);
+  offsets.swap(fv.offsets);
+  features.swap(fv.features);
+}
+
+// ---------------------------------------------------------------------------
+
+CommonNodes::CommonNodes(const FlatFeatureVector &a, 
+  const FlatFeatureVector &b)
+  : m_a(a), m_b(b), m_i(0), m_j(0), m_started(false)
+{
+}
+
+// ---------------------------------------------------------------------------
+
+bool CommonNodes::next()
+{
+  if(m_started)
+  {
+    ++m_i;
+    ++m_j;
+  }
+  m_started = true;
+  
+  const size_t na = m_a.nodes.size();
+  const size_t nb = m_b.nodes.size();
+  
+  while(m_i < na && m_j < nb)
+  {
+    const NodeId ida = m_a.nodes[m_i];
+    const NodeId idb = m_b.nodes[m_j];
+    
+    if(ida == idb)
+      return true;
+    else if(ida < idb)
+      m_i = std::lower_bound(m_a.nodes.begin() + m_i, m_a.nodes.end(), idb)
+        - m_a.nodes.begin();
+    else
+      m_j = std::lower_bound(m_b.nodes.begin() + m_j, m_b.nodes.end(), ida)
+        - m_b.nodes.begin();
+  }
+  
+  return false;
+}
+
+// ---------------------------------------------------------------------------
+
 } // namespace DBoW2
@@ -8,6 +8,7 @@
  */
 
 #include <cfloat>
+#include <algorithm>
 #include "dbow2/TemplatedVocabulary.h"
 #include "dbow2/BowVector.h"
 
@@ -17,6 +18,208 @@ using namespace DBoW2;
 // epsilon value (this is needed by the KL method)
 const double GeneralScoring::LOG_EPS = log(DBL_EPSILON); // FLT_EPSILON
 
+// ---------------------------------------------------------------------------
+
+// The word ids of flat vectors are intersected 4 by 4 with SIMD when the
+// target supports it, unless DBOW2_NO_SIMD is defined
+#if !defined(DBOW2_NO_SIMD)
+#if defined(__SSE2__)
+#define DBOW2_SIMD_SSE2
+#include <emmintrin.h>
+#elif (defined(__ARM_NEON__) || defined(__ARM_NEON)) && defined(__aarch64__)
+#define DBOW2_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace {
+
+/// Vectors whose sizes differ more than this are intersected by galloping
+/// over the largest one
+const size_t GALLOP_RATIO = 32;
+
+/// Calls op with the values swapped, so it gets (v_i, w_i) when galloping
+/// over v
+template<class Op>
+struct Swapped
+{
+  Swapped(Op &o): op(o) {}
+  inline void operator()(WordValue wi, WordValue vi) { op(vi, wi); }
+  Op &op;
+};
+
+/**
+ * Calls op(s_i, l_i) for each word in both vectors, in increasing word
+ * order, searching each word of the small vector in the large one
+ * @param s small vector
+ * @param l large vector
+ * @param op
+ */
+template<class Op>
+void gallop(const FlatBowVector &s, const FlatBowVector &l, Op &op)
+{
+  const std::vector<WordId> &lids = l.ids;
+  const size_t nl = lids.size();
+  size_t j = 0;
+  
+  for(size_t i = 0; i < s.size() && j < nl; ++i)
+  {
+    const WordId id = s.ids[i];
+    
+    // exponential search for the first id >= id, from the last position
+    size_t step = 1;
+    while(j + step < nl && lids[j + step] < id) step *= 2;
+    
+    const size_t last = std::min(j + step + 1, nl);
+    j = std::lower_bound(lids.begin() + j + step/2, lids.begin() + last, id)
+      - lids.begin();
+    
+    if(j < nl && lids[j] == id)
+    {
+      op(s.values[i], l.values[j]);
+      ++j;
+    }
+  }
+}
+
+/**
+ * Calls op(v_i, w_i) for each word in both vectors, in increasing word
+ * order, so that the sums are the same as those of the merge on BowVectors
+ * @param v
+ * @param w
+ * @param op
+ */
+template<class Op>
+void intersect(const FlatBowVector &v, const FlatBowVector &w, Op &op)
+{
+  const size_t nv = v.size();
+  const size_t nw = w.size();
+  
+  if(nv * GALLOP_RATIO < nw)
+  {
+    gallop(v, w, op);
+    return;
+  }
+  else if(nw * GALLOP_RATIO < nv)
+  {
+    Swapped<Op> swapped(op);
+    gallop(w, v, swapped);
+    return;
+  }
+  
+  size_t i = 0, j = 0;
+  
+#if defined(DBOW2_SIMD_SSE2) || defined(DBOW2_SIMD_NEON)
+  // Blocks of 4 ids of v are compared with the 4 rotations of a block of w,
+  // the block with the smallest last id is then skipped
+  while(i + 4 <= nv && j + 4 <= nw)
+  {
+#if defined(DBOW2_SIMD_SSE2)
+    const __m128i a = _mm_loadu_si128((const __m128i*)&v.ids[i]);
+    const __m128i b = _mm_loadu_si128((const __m128i*)&w.ids[j]);
+    const __m128i eq = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi32(a, b),
+        _mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, _MM_SHUFFLE(0,3,2,1)))),
+      _mm_or_si128(
+        _mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, _MM_SHUFFLE(1,0,3,2))),
+        _mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, _MM_SHUFFLE(2,1,0,3)))));
+    const int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+#else
+    const uint32x4_t a = vld1q_u32(&v.ids[i]);
+    const uint32x4_t b = vld1q_u32(&w.ids[j]);
+    const uint32x4_t eq = vorrq_u32(
+      vorrq_u32(vceqq_u32(a, b), vceqq_u32(a, vextq_u32(b, b, 1))),
+      vorrq_u32(vceqq_u32(a, vextq_u32(b, b, 2)), vceqq_u32(a, vextq_u32(b, b, 3))));
+    const uint32x4_t bits = { 1, 2, 4, 8 };
+    const int mask = vaddvq_u32(vandq_u32(eq, bits));
+#endif
+    
+    if(mask)
+    {
+      for(int k = 0; k < 4; ++k)
+      {
+        if(!(mask & (1 << k))) continue;
+        
+        const WordId id = v.ids[i + k];
+        size_t l = j;
+        while(w.ids[l] != id) ++l;
+        op(v.values[i + k], w.values[l]);
+      }
+    }
+    
+    const WordId vlast = v.ids[i + 3];
+    const WordId wlast = w.ids[j + 3];
+    if(vlast <= wlast) i += 4;
+    if(wlast <= vlast) j += 4;
+  }
+#endif
+
+  // remaining ids
+  while(i < nv && j < nw)
+  {
+    if(v.ids[i] == w.ids[j])
+    {
+      op(v.values[i], w.values[j]);
+      ++i;
+      ++j;
+    }
+    else if(v.ids[i] < w.ids[j])
+      ++i;
+    else
+      ++j;
+  }
+}
+
+/// Sum of |v_i - w_i| - |v_i| - |w_i|
+struct L1Sum
+{
+  L1Sum(): score(0) {}
+  inline void operator()(WordValue vi, WordValue wi)
+    { score += fabs(vi - wi) - fabs(vi) - fabs(wi); }
+  double score;
+};
+
+/// Sum of v_i * w_i
+struct ProductSum
+{
+  ProductSum(): score(0) {}
+  inline void operator()(WordValue vi, WordValue wi) { score += vi * wi; }
+  double score;
+};
+
+/// Sum of v_i * w_i / (v_i + w_i)
+struct ChiSquareSum
+{
+  ChiSquareSum(): score(0) {}
+  inline void operator()(WordValue vi, WordValue wi)
+    { if(vi + wi != 0.0) score += vi * wi / (vi + wi); }
+  double score;
+};
+
+/// Sum of the KL terms of the common words, minus the term they would have
+/// if only in v
+struct KLSum
+{
+  KLSum(): score(0) {}
+  inline void operator()(WordValue vi, WordValue wi)
+  {
+    if(vi != 0 && wi != 0) score += vi * log(vi/wi);
+    if(vi != 0) score -= vi * (log(vi) - GeneralScoring::LOG_EPS);
+  }
+  double score;
+};
+
+/// Sum of sqrt(v_i * w_i)
+struct BhattacharyyaSum
+{
+  BhattacharyyaSum(): score(0) {}
+  inline void operator()(WordValue vi, WordValue wi)
+    { score += sqrt(vi * wi); }
+  double score;
+};
+
+} // namespace
+
 // ---------------------------------------------------------------------------
 // ---------------------------------------------------------------------------
 
@@ -313,3 +516,84 @@ double DotProductScoring::score(const BowVector &v1,
 // ---------------------------------------------------------------------------
 // ---------------------------------------------------------------------------
 
+double L1Scoring::score(const FlatBowVector &v1, const FlatBowVector &v2) const
+{
+  L1Sum sum;
+  intersect(v1, v2, sum);
+  
+  // same scaling as with BowVectors
+  return -sum.score/2.0; // [0..1]
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+double L2Scoring::score(const FlatBowVector &v1, const FlatBowVector &v2) const
+{
+  ProductSum sum;
+  intersect(v1, v2, sum);
+  
+  if(sum.score >= 1) // rounding errors
+    return 1.0;
+  else
+    return 1.0 - sqrt(1.0 - sum.score); // [0..1]
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+double ChiSquareScoring::score(const FlatBowVector &v1, 
+  const FlatBowVector &v2) const
+{
+  ChiSquareSum sum;
+  intersect(v1, v2, sum);
+  
+  // this takes the -4 into account
+  return 2. * sum.score; // [0..1]
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+double KLScoring::score(const FlatBowVector &v1, const FlatBowVector &v2) const
+{
+  // all the items of v, as if none was in w
+  double score = 0;
+  for(size_t i = 0; i < v1.size(); ++i)
+    if(v1.values[i] != 0)
+      score += v1.values[i] * (log(v1.values[i]) - LOG_EPS);
+  
+  // corrected for the common ones
+  KLSum sum;
+  intersect(v1, v2, sum);
+  
+  return score + sum.score; // cannot be scaled
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+double BhattacharyyaScoring::score(const FlatBowVector &v1, 
+  const FlatBowVector &v2) const
+{
+  BhattacharyyaSum sum;
+  intersect(v1, v2, sum);
+  
+  return sum.score; // already scaled
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+double DotProductScoring::score(const FlatBowVector &v1, 
+  const FlatBowVector &v2) const
+{
+  ProductSum sum;
+  intersect(v1, v2, sum);
+  
+  return sum.score; // cannot scale
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
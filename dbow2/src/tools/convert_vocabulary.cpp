@@ -0,0 +1,65 @@
+/**
+ * File: convert_vocabulary.cpp
+ * Date: October 2026
+ * Description: converts a YAML ORB vocabulary into the binary format
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+
+#include "dbow2/FORB.h"
+#include "dbow2/TemplatedVocabulary.h"
+
+using namespace std;
+
+typedef DBoW2::TemplatedVocabulary<DBoW2::FORB::TDescriptor, DBoW2::FORB>
+  ORBVocabulary;
+
+int main(int argc, char **argv)
+{
+  if(argc != 3)
+  {
+    cerr << "Usage: convert_vocabulary vocabulary.yml vocabulary.bin" << endl;
+    return 1;
+  }
+
+  try
+  {
+    ORBVocabulary voc;
+    cout << "Loading " << argv[1] << endl;
+    voc.load(string(argv[1]));
+    cout << voc << endl;
+
+    cout << "Saving " << argv[2] << endl;
+    voc.saveToBinaryFile(argv[2]);
+
+    // check that the binary file gives back the same vocabulary
+    ORBVocabulary check;
+    check.loadFromBinaryFile(argv[2]);
+    if(check.size() != voc.size() ||
+      check.getBranchingFactor() != voc.getBranchingFactor() ||
+      check.getDepthLevels() != voc.getDepthLevels())
+    {
+      cerr << "The binary vocabulary does not match" << endl;
+      return 1;
+    }
+    for(unsigned int i = 0; i < voc.size(); ++i)
+    {
+      if(DBoW2::FORB::distance(voc.getWord(i), check.getWord(i)) != 0 ||
+        voc.getWordWeight(i) != check.getWordWeight(i))
+      {
+        cerr << "The binary vocabulary does not match at word " << i << endl;
+        return 1;
+      }
+    }
+  }
+  catch(const string &error)
+  {
+    cerr << error << endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,73 @@
+/**
+ * File: truncate_vocabulary.cpp
+ * Date: October 2026
+ * Description: derives a smaller vocabulary tier by truncating the levels
+ *   of a larger one
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+#include "dbow2/FORB.h"
+#include "dbow2/TemplatedVocabulary.h"
+
+using namespace std;
+
+typedef DBoW2::TemplatedVocabulary<DBoW2::FORB::TDescriptor, DBoW2::FORB>
+  ORBVocabulary;
+
+static bool isBinary(const string &filename)
+{
+  return filename.size() > 4 &&
+    filename.compare(filename.size() - 4, 4, ".bin") == 0;
+}
+
+int main(int argc, char **argv)
+{
+  if(argc != 4)
+  {
+    cerr << "Usage: truncate_vocabulary vocabulary.(yml|bin) L "
+      "truncated.(yml|bin)" << endl;
+    return 1;
+  }
+
+  const string input = argv[1];
+  const int L = atoi(argv[2]);
+  const string output = argv[3];
+
+  try
+  {
+    ORBVocabulary voc;
+    cout << "Loading " << input << endl;
+    if(isBinary(input))
+      voc.loadFromBinaryFile(input);
+    else
+      voc.load(input);
+    cout << voc << endl;
+
+    if(L < 1 || L >= voc.getDepthLevels())
+    {
+      cerr << "L must be between 1 and " << voc.getDepthLevels() - 1 << endl;
+      return 1;
+    }
+
+    voc.truncate(L);
+    cout << voc << endl;
+
+    cout << "Saving " << output << endl;
+    if(isBinary(output))
+      voc.saveToBinaryFile(output);
+    else
+      voc.save(output);
+  }
+  catch(const string &error)
+  {
+    cerr << error << endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -3,7 +3,7 @@
 
 /* #undef G2O_HAVE_OPENGL */
 /* #undef G2O_OPENGL_FOUND */
-/* #undef G2O_OPENMP */
+#define G2O_OPENMP 1
 #define G2O_SHARED_LIBS 1
 /* #undef G2O_LGPL_SHARED_LIBS */
 
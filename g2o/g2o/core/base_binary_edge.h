@@ -29,6 +29,7 @@
 
 #include <iostream>
 #include <limits>
+#include <algorithm>
 
 #include "base_edge.h"
 #include "robust_kernel.h"
@@ -80,6 +81,10 @@ namespace g2o {
       /**
        * Linearizes the oplus operator in the vertex, and stores
        * the result in temporary variables _jacobianOplusXi and _jacobianOplusXj
+       *
+       * With G2O_OPENMP the numeric Jacobian perturbs the vertices while holding their
+       * locks. Edges sharing a vertex can be linearized in parallel as long as all of
+       * them are numeric, an analytic Jacobian reads the estimate without the lock.
        */
       virtual void linearizeOplus();
 
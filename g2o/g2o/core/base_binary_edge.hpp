@@ -66,56 +66,52 @@ void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::constructQuadraticForm()
   bool toNotFixed = !(to->fixed());
 
   if (fromNotFixed || toNotFixed) {
-#ifdef G2O_OPENMP
-    from->lockQuadraticForm();
-    to->lockQuadraticForm();
-#endif
+    // the products are computed outside of the vertex locks, only the
+    // accumulation is serialized. Edges sharing a vertex (e.g. all the
+    // observations of a keyframe) can then be linearized in parallel
     const InformationType& omega = _information;
     Matrix<double, D, 1> omega_r = - omega * _error;
-    if (this->robustKernel() == 0) {
-      if (fromNotFixed) {
-        Matrix<double, VertexXiType::Dimension, D> AtO = A.transpose() * omega;
-        from->b().noalias() += A.transpose() * omega_r;
-        from->A().noalias() += AtO*A;
-        if (toNotFixed ) {
-          if (_hessianRowMajor) // we have to write to the block as transposed
-            _hessianTransposed.noalias() += B.transpose() * AtO.transpose();
-          else
-            _hessian.noalias() += AtO * B;
-        }
-      } 
-      if (toNotFixed) {
-        to->b().noalias() += B.transpose() * omega_r;
-        to->A().noalias() += B.transpose() * omega * B;
-      }
-    } else { // robust (weighted) error according to some kernel
+    InformationType weightedOmega = omega;
+    if (this->robustKernel()) { // robust (weighted) error according to some kernel
       double error = this->chi2();
       Eigen::Vector3d rho;
       this->robustKernel()->robustify(error, rho);
-      InformationType weightedOmega = this->robustInformation(rho);
-      //std::cout << PVAR(rho.transpose()) << std::endl;
-      //std::cout << PVAR(weightedOmega) << std::endl;
-
+      weightedOmega = this->robustInformation(rho);
       omega_r *= rho[1];
-      if (fromNotFixed) {
-        from->b().noalias() += A.transpose() * omega_r;
-        from->A().noalias() += A.transpose() * weightedOmega * A;
-        if (toNotFixed ) {
-          if (_hessianRowMajor) // we have to write to the block as transposed
-            _hessianTransposed.noalias() += B.transpose() * weightedOmega * A;
-          else
-            _hessian.noalias() += A.transpose() * weightedOmega * B;
-        }
-      } 
+    }
+
+    if (fromNotFixed) {
+      Matrix<double, Di, D> AtO = A.transpose() * weightedOmega;
+      Matrix<double, Di, Di> fromA = AtO * A;
+      Matrix<double, Di, 1> fromB = A.transpose() * omega_r;
+#ifdef G2O_OPENMP
+      from->lockQuadraticForm();
+#endif
+      from->b().noalias() += fromB;
+      from->A().noalias() += fromA;
+      // the off-diagonal block may be shared by parallel edges, it follows the from lock
       if (toNotFixed) {
-        to->b().noalias() += B.transpose() * omega_r;
-        to->A().noalias() += B.transpose() * weightedOmega * B;
+        if (_hessianRowMajor) // we have to write to the block as transposed
+          _hessianTransposed.noalias() += B.transpose() * AtO.transpose();
+        else
+          _hessian.noalias() += AtO * B;
       }
+#ifdef G2O_OPENMP
+      from->unlockQuadraticForm();
+#endif
     }
+    if (toNotFixed) {
+      Matrix<double, Dj, Dj> toA = B.transpose() * weightedOmega * B;
+      Matrix<double, Dj, 1> toB = B.transpose() * omega_r;
 #ifdef G2O_OPENMP
-    to->unlockQuadraticForm();
-    from->unlockQuadraticForm();
+      to->lockQuadraticForm();
 #endif
+      to->b().noalias() += toB;
+      to->A().noalias() += toA;
+#ifdef G2O_OPENMP
+      to->unlockQuadraticForm();
+#endif
+    }
   }
 }
 
@@ -140,8 +136,13 @@ void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::linearizeOplus()
     return;
 
 #ifdef G2O_OPENMP
-  vi->lockQuadraticForm();
-  vj->lockQuadraticForm();
+  // lock in address order, other edges may hold the same vertices swapped
+  OptimizableGraph::Vertex* firstLock = vi;
+  OptimizableGraph::Vertex* secondLock = vj;
+  if (secondLock < firstLock)
+    std::swap(firstLock, secondLock);
+  firstLock->lockQuadraticForm();
+  secondLock->lockQuadraticForm();
 #endif
 
   const double delta = 1e-9;
@@ -199,8 +200,8 @@ void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::linearizeOplus()
 
   _error = errorBeforeNumeric;
 #ifdef G2O_OPENMP
-  vj->unlockQuadraticForm();
-  vi->unlockQuadraticForm();
+  secondLock->unlockQuadraticForm();
+  firstLock->unlockQuadraticForm();
 #endif
 }
 
@@ -50,21 +50,26 @@ void BaseUnaryEdge<D, E, VertexXiType>::constructQuadraticForm()
 
   bool istatus = !from->fixed();
   if (istatus) {
-#ifdef G2O_OPENMP
-    from->lockQuadraticForm();
-#endif
+    Matrix<double, VertexXiType::Dimension, VertexXiType::Dimension> fromA;
+    Matrix<double, VertexXiType::Dimension, 1> fromB;
     if (this->robustKernel()) {
       double error = this->chi2();
       Eigen::Vector3d rho;
       this->robustKernel()->robustify(error, rho);
       InformationType weightedOmega = this->robustInformation(rho);
 
-      from->b().noalias() -= rho[1] * A.transpose() * omega * _error;
-      from->A().noalias() += A.transpose() * weightedOmega * A;
+      fromB.noalias() = - rho[1] * A.transpose() * omega * _error;
+      fromA.noalias() = A.transpose() * weightedOmega * A;
     } else {
-      from->b().noalias() -= A.transpose() * omega * _error;
-      from->A().noalias() += A.transpose() * omega * A;
+      fromB.noalias() = - A.transpose() * omega * _error;
+      fromA.noalias() = A.transpose() * omega * A;
     }
+    // only the accumulation is serialized, see BaseBinaryEdge
+#ifdef G2O_OPENMP
+    from->lockQuadraticForm();
+#endif
+    from->b().noalias() += fromB;
+    from->A().noalias() += fromA;
 #ifdef G2O_OPENMP
     from->unlockQuadraticForm();
 #endif
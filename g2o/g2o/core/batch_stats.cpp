@@ -30,7 +30,7 @@
 namespace g2o {
   using namespace std;
 
-  G2OBatchStatistics* G2OBatchStatistics::_globalStats=0;
+  __thread G2OBatchStatistics* G2OBatchStatistics::_globalStats=0;
 
   #ifndef PTHING
   #define PTHING(s) \
@@ -73,7 +73,8 @@ namespace g2o {
     static G2OBatchStatistics* globalStats() {return _globalStats;}
     static void setGlobalStats(G2OBatchStatistics* b);
     protected:
-    static G2OBatchStatistics* _globalStats;
+    // one per thread, optimizers running in different threads keep their own statistics
+    static __thread G2OBatchStatistics* _globalStats;
   };
 
   G2O_CORE_API std::ostream& operator<<(std::ostream&, const G2OBatchStatistics&);
@@ -32,6 +32,7 @@
 #include "sparse_block_matrix.h"
 #include "sparse_block_matrix_diagonal.h"
 #include "openmp_mutex.h"
+#include "parallel_runner.h"
 #include "../../config.h"
 
 namespace g2o {
@@ -134,6 +135,16 @@ namespace g2o {
 
       LinearSolver<PoseMatrixType>* linearSolver() const { return _linearSolver;}
 
+      /**
+       * solve the reduced camera system with conjugate gradients, preconditioned by its block diagonal,
+       * instead of the linear solver. The Schur complement is never formed, each product goes through
+       * Hpp, Hpl and the inverse landmark blocks. Has to be set before the structure is built.
+       * maxIterations <= 0 allows as many iterations as pose blocks, the iterations stop when the
+       * residual is below tolerance times the right hand side.
+       */
+      void setImplicitSchur(bool implicit, int maxIterations = 0, double tolerance = 1e-6);
+      bool implicitSchur() const { return _implicitSchur;}
+
       virtual void setWriteDebug(bool writeDebug);
       virtual bool writeDebug() const {return _linearSolver->writeDebug();}
 
@@ -147,6 +158,24 @@ namespace g2o {
 
       void deallocate();
 
+      //! conjugate gradients on the Schur complement, writes the pose part of _x
+      bool solveImplicitSchur();
+
+      //! dest = S * src, with S the Schur complement of the landmarks
+      void multiplySchur(Eigen::VectorXd& dest, const Eigen::VectorXd& src, Eigen::VectorXd& landmarkTmp, Eigen::VectorXd& poseTmp);
+
+      //! dest = Minv * src, with M the block diagonal of the Schur complement
+      void applySchurPreconditioner(Eigen::VectorXd& dest, const Eigen::VectorXd& src) const;
+
+      //! the landmark part of _x from the pose part, with _DInvSchur already computed
+      void solveLandmarks();
+
+      //! loop bodies run by parallelFor, over landmarks or active edges [begin, end)
+      void marginalizeLandmarks(int begin, int end, int slot);
+      void invertLandmarks(int begin, int end, int slot);
+      void accumulateSchurPreconditioner(int begin, int end, int slot);
+      void linearizeEdges(int begin, int end, int slot);
+
       SparseBlockMatrix<PoseMatrixType>* _Hpp;
       SparseBlockMatrix<LandmarkMatrixType>* _Hll;
       SparseBlockMatrix<PoseLandmarkMatrixType>* _Hpl;
@@ -168,6 +197,12 @@ namespace g2o {
 
       bool _doSchur;
 
+      bool _implicitSchur;
+      int _pcgMaxIterations;
+      double _pcgTolerance;
+      //! inverse of the diagonal blocks of the Schur complement
+      std::vector<PoseMatrixType, Eigen::aligned_allocator<PoseMatrixType> > _schurPreconditioner;
+
       double* _coefficients;
       double* _bschur;
 
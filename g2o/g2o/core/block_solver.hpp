@@ -59,6 +59,17 @@ BlockSolver<Traits>::BlockSolver(LinearSolverType* linearSolver) :
   _sizePoses=0;
   _sizeLandmarks=0;
   _doSchur=true;
+  _implicitSchur=false;
+  _pcgMaxIterations=0;
+  _pcgTolerance=1e-6;
+}
+
+template <typename Traits>
+void BlockSolver<Traits>::setImplicitSchur(bool implicit, int maxIterations, double tolerance)
+{
+  _implicitSchur = implicit;
+  _pcgMaxIterations = maxIterations;
+  _pcgTolerance = tolerance;
 }
 
 template <typename Traits>
@@ -79,12 +90,15 @@ void BlockSolver<Traits>::resize(int* blockPoseIndices, int numPoseBlocks,
 
   _Hpp=new PoseHessianType(blockPoseIndices, blockPoseIndices, numPoseBlocks, numPoseBlocks);
   if (_doSchur) {
-    _Hschur=new PoseHessianType(blockPoseIndices, blockPoseIndices, numPoseBlocks, numPoseBlocks);
+    // the implicit Schur complement only needs its block diagonal
+    if (! _implicitSchur) {
+      _Hschur=new PoseHessianType(blockPoseIndices, blockPoseIndices, numPoseBlocks, numPoseBlocks);
+      _HschurTransposedCCS = new SparseBlockMatrixCCS<PoseMatrixType>(_Hschur->colBlockIndices(), _Hschur->rowBlockIndices());
+    }
     _Hll=new LandmarkHessianType(blockLandmarkIndices, blockLandmarkIndices, numLandmarkBlocks, numLandmarkBlocks);
     _DInvSchur = new SparseBlockMatrixDiagonal<LandmarkMatrixType>(_Hll->colBlockIndices());
     _Hpl=new PoseLandmarkHessianType(blockPoseIndices, blockLandmarkIndices, numPoseBlocks, numLandmarkBlocks);
     _HplCCS = new SparseBlockMatrixCCS<PoseLandmarkMatrixType>(_Hpl->rowBlockIndices(), _Hpl->colBlockIndices());
-    _HschurTransposedCCS = new SparseBlockMatrixCCS<PoseMatrixType>(_Hschur->colBlockIndices(), _Hschur->rowBlockIndices());
 #ifdef G2O_OPENMP
     _coefficientsMutex.resize(numPoseBlocks);
 #endif
@@ -196,7 +210,7 @@ bool BlockSolver<Traits>::buildStructure(bool zeroBlocks)
 
   // temporary structures for building the pattern of the Schur complement
   SparseBlockMatrixHashMap<PoseMatrixType>* schurMatrixLookup = 0;
-  if (_doSchur) {
+  if (_Hschur) {
     schurMatrixLookup = new SparseBlockMatrixHashMap<PoseMatrixType>(_Hschur->rowBlockIndices(), _Hschur->colBlockIndices());
     schurMatrixLookup->blockCols().resize(_Hschur->blockCols().size());
   }
@@ -259,17 +273,20 @@ bool BlockSolver<Traits>::buildStructure(bool zeroBlocks)
   _DInvSchur->diagonal().resize(landmarkIdx);
   _Hpl->fillSparseBlockMatrixCCS(*_HplCCS);
 
+  if (_implicitSchur)
+    return true;
+
   for (size_t i = 0; i < _optimizer->indexMapping().size(); ++i) {
     OptimizableGraph::Vertex* v = _optimizer->indexMapping()[i];
     if (v->marginalized()){
-      const HyperGraph::EdgeSet& vedges=v->edges();
-      for (HyperGraph::EdgeSet::const_iterator it1=vedges.begin(); it1!=vedges.end(); ++it1){
+      const OptimizableGraph::EdgeContainer& vedges=v->edgeList();
+      for (OptimizableGraph::EdgeContainer::const_iterator it1=vedges.begin(); it1!=vedges.end(); ++it1){
         for (size_t i=0; i<(*it1)->vertices().size(); ++i)
         {
           OptimizableGraph::Vertex* v1= (OptimizableGraph::Vertex*) (*it1)->vertex(i);
           if (v1->hessianIndex()==-1 || v1==v)
             continue;
-          for  (HyperGraph::EdgeSet::const_iterator it2=vedges.begin(); it2!=vedges.end(); ++it2){
+          for  (OptimizableGraph::EdgeContainer::const_iterator it2=vedges.begin(); it2!=vedges.end(); ++it2){
             for (size_t j=0; j<(*it2)->vertices().size(); ++j)
             {
               OptimizableGraph::Vertex* v2= (OptimizableGraph::Vertex*) (*it2)->vertex(j);
@@ -366,6 +383,13 @@ bool BlockSolver<Traits>::solve(){
 
   // schur thing
 
+  if (_implicitSchur) {
+    if (! solveImplicitSchur())
+      return false;
+    solveLandmarks();
+    return true;
+  }
+
   // backup the coefficient matrix
   double t=get_monotonic_time();
 
@@ -375,61 +399,7 @@ bool BlockSolver<Traits>::solve(){
 
   //_DInvSchur->clear();
   memset (_coefficients, 0, _sizePoses*sizeof(double));
-# ifdef G2O_OPENMP
-# pragma omp parallel for default (shared) schedule(dynamic, 10)
-# endif
-  for (int landmarkIndex = 0; landmarkIndex < static_cast<int>(_Hll->blockCols().size()); ++landmarkIndex) {
-    const typename SparseBlockMatrix<LandmarkMatrixType>::IntBlockMap& marginalizeColumn = _Hll->blockCols()[landmarkIndex];
-    assert(marginalizeColumn.size() == 1 && "more than one block in _Hll column");
-
-    // calculate inverse block for the landmark
-    const LandmarkMatrixType * D = marginalizeColumn.begin()->second;
-    assert (D && D->rows()==D->cols() && "Error in landmark matrix");
-    LandmarkMatrixType& Dinv = _DInvSchur->diagonal()[landmarkIndex];
-    Dinv = D->inverse();
-
-    LandmarkVectorType  db(D->rows());
-    for (int j=0; j<D->rows(); ++j) {
-      db[j]=_b[_Hll->rowBaseOfBlock(landmarkIndex) + _sizePoses + j];
-    }
-    db=Dinv*db;
-
-    assert((size_t)landmarkIndex < _HplCCS->blockCols().size() && "Index out of bounds");
-    const typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn& landmarkColumn = _HplCCS->blockCols()[landmarkIndex];
-
-    for (typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn::const_iterator it_outer = landmarkColumn.begin();
-        it_outer != landmarkColumn.end(); ++it_outer) {
-      int i1 = it_outer->row;
-
-      const PoseLandmarkMatrixType* Bi = it_outer->block;
-      assert(Bi);
-
-      PoseLandmarkMatrixType BDinv = (*Bi)*(Dinv);
-      assert(_HplCCS->rowBaseOfBlock(i1) < _sizePoses && "Index out of bounds");
-      typename PoseVectorType::MapType Bb(&_coefficients[_HplCCS->rowBaseOfBlock(i1)], Bi->rows());
-#    ifdef G2O_OPENMP
-      ScopedOpenMPMutex mutexLock(&_coefficientsMutex[i1]);
-#    endif
-      Bb.noalias() += (*Bi)*db;
-
-      assert(i1 >= 0 && i1 < static_cast<int>(_HschurTransposedCCS->blockCols().size()) && "Index out of bounds");
-      typename SparseBlockMatrixCCS<PoseMatrixType>::SparseColumn::iterator targetColumnIt = _HschurTransposedCCS->blockCols()[i1].begin();
-
-      typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::RowBlock aux(i1, 0);
-      typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn::const_iterator it_inner = lower_bound(landmarkColumn.begin(), landmarkColumn.end(), aux);
-      for (; it_inner != landmarkColumn.end(); ++it_inner) {
-        int i2 = it_inner->row;
-        const PoseLandmarkMatrixType* Bj = it_inner->block;
-        assert(Bj); 
-        while (targetColumnIt->row < i2 /*&& targetColumnIt != _HschurTransposedCCS->blockCols()[i1].end()*/)
-          ++targetColumnIt;
-        assert(targetColumnIt != _HschurTransposedCCS->blockCols()[i1].end() && targetColumnIt->row == i2 && "invalid iterator, something wrong with the matrix structure");
-        PoseMatrixType* Hi1i2 = targetColumnIt->block;//_Hschur->block(i1,i2);
-        assert(Hi1i2);
-        (*Hi1i2).noalias() -= BDinv*Bj->transpose();
-      }
-    }
-  }
+  parallelFor(_optimizer->parallelRunner(), static_cast<int>(_Hll->blockCols().size()), 0, 10, this, &BlockSolver<Traits>::marginalizeLandmarks);
   //cerr << "Solve [marginalize] = " <<  get_monotonic_time()-t << endl;
 
   // _bschur = _b for calling solver, and not touching _b
@@ -456,6 +426,13 @@ bool BlockSolver<Traits>::solve(){
   if (! solvedPoses)
     return false;
 
+  solveLandmarks();
+  return true;
+}
+
+template <typename Traits>
+void BlockSolver<Traits>::solveLandmarks()
+{
   // _x contains the solution for the poses, now applying it to the landmarks to get the new part of the
   // solution;
   double* xp = _x;
@@ -481,8 +458,113 @@ bool BlockSolver<Traits>::solve(){
   _DInvSchur->multiply(xl,cl);
   //_DInvSchur->rightMultiply(xl,cl);
   //cerr << "Solve [landmark delta] = " <<  get_monotonic_time()-t << endl;
+}
 
-  return true;
+template <typename Traits>
+void BlockSolver<Traits>::multiplySchur(Eigen::VectorXd& dest, const Eigen::VectorXd& src, Eigen::VectorXd& landmarkTmp, Eigen::VectorXd& poseTmp)
+{
+  // dest = Hpp * src - Hpl * Dinv * Hpl^T * src
+  dest.setZero();
+  double* d = dest.data();
+  _Hpp->multiplySymmetricUpperTriangle(d, src.data());
+
+  poseTmp.setZero();
+  landmarkTmp.setZero();
+  double* l = landmarkTmp.data();
+  _HplCCS->rightMultiply(l, src.data());
+  double* dl = _coefficients + _sizePoses;
+  memset(dl, 0, _sizeLandmarks*sizeof(double));
+  _DInvSchur->multiply(dl, l);
+  double* p = poseTmp.data();
+  _Hpl->multiply(p, dl);
+  dest -= poseTmp;
+}
+
+template <typename Traits>
+void BlockSolver<Traits>::applySchurPreconditioner(Eigen::VectorXd& dest, const Eigen::VectorXd& src) const
+{
+  for (int i = 0; i < _numPoses; ++i) {
+    const int base = _Hpp->rowBaseOfBlock(i);
+    const int dim = _Hpp->rowsOfBlock(i);
+    dest.segment(base, dim) = _schurPreconditioner[i] * src.segment(base, dim);
+  }
+}
+
+template <typename Traits>
+bool BlockSolver<Traits>::solveImplicitSchur()
+{
+  double t=get_monotonic_time();
+
+  // inverse of the landmark blocks, with the damping of this step
+  parallelFor(_optimizer->parallelRunner(), static_cast<int>(_Hll->blockCols().size()), 0, 10, this, &BlockSolver<Traits>::invertLandmarks);
+
+  // block diagonal of the Schur complement: Hpp_ii minus the landmark terms of each pose
+  _schurPreconditioner.resize(_numPoses);
+  for (int i = 0; i < _numPoses; ++i)
+    _schurPreconditioner[i] = *_Hpp->block(i,i);
+  parallelFor(_optimizer->parallelRunner(), static_cast<int>(_HplCCS->blockCols().size()), 0, 10, this, &BlockSolver<Traits>::accumulateSchurPreconditioner);
+# ifdef G2O_OPENMP
+# pragma omp parallel for default (shared) if (_numPoses > 100 && ! _optimizer->parallelRunner())
+# endif
+  for (int i = 0; i < _numPoses; ++i) {
+    PoseMatrixType M = _schurPreconditioner[i];
+    _schurPreconditioner[i] = M.inverse();
+  }
+
+  // right hand side: bp - Hpl * Dinv * bl
+  Eigen::VectorXd landmarkTmp(_sizeLandmarks);
+  Eigen::VectorXd poseTmp(_sizePoses);
+  Eigen::Map<Eigen::VectorXd> bl(_b + _sizePoses, _sizeLandmarks);
+  double* dl = _coefficients + _sizePoses;
+  memset(dl, 0, _sizeLandmarks*sizeof(double));
+  _DInvSchur->multiply(dl, bl.data());
+  poseTmp.setZero();
+  double* p = poseTmp.data();
+  _Hpl->multiply(p, dl);
+  Eigen::VectorXd r = Eigen::Map<Eigen::VectorXd>(_b, _sizePoses) - poseTmp;
+
+  Eigen::Map<Eigen::VectorXd> x(_x, _sizePoses);
+  x.setZero();
+
+  Eigen::VectorXd z(_sizePoses);
+  Eigen::VectorXd q(_sizePoses);
+
+  const double bNorm = r.norm();
+  const int maxIterations = _pcgMaxIterations > 0 ? _pcgMaxIterations : (std::max)(_numPoses, 1);
+  int iteration = 0;
+  if (bNorm > 0) {
+    applySchurPreconditioner(z, r);
+    Eigen::VectorXd d = z;
+    double rz = r.dot(z);
+    for (; iteration < maxIterations; ++iteration) {
+      multiplySchur(q, d, landmarkTmp, poseTmp);
+      const double dq = d.dot(q);
+      if (! (dq > 0))
+        break;
+      const double alpha = rz / dq;
+      x += alpha * d;
+      r -= alpha * q;
+      if (r.norm() <= _pcgTolerance * bNorm) {
+        ++iteration;
+        break;
+      }
+      applySchurPreconditioner(z, r);
+      const double rzNew = r.dot(z);
+      d = z + (rzNew / rz) * d;
+      rz = rzNew;
+    }
+  }
+
+  G2OBatchStatistics* globalStats = G2OBatchStatistics::globalStats();
+  if (globalStats) {
+    globalStats->timeLinearSolver = get_monotonic_time() - t;
+    globalStats->iterationsLinearSolver = iteration;
+    globalStats->hessianPoseDimension = _Hpp->cols();
+    globalStats->hessianLandmarkDimension = _Hll->cols();
+    globalStats->hessianDimension = globalStats->hessianPoseDimension + globalStats->hessianLandmarkDimension;
+  }
+
+  return g2o_isfinite(x.squaredNorm());
 }
 
 
@@ -499,34 +581,99 @@ bool BlockSolver<Traits>::computeMarginals(SparseBlockMatrix<MatrixXd>& spinv, c
 }
 
 template <typename Traits>
-bool BlockSolver<Traits>::buildSystem()
+void BlockSolver<Traits>::marginalizeLandmarks(int begin, int end, int)
 {
-  // clear b vector
-# ifdef G2O_OPENMP
-# pragma omp parallel for default (shared) if (_optimizer->indexMapping().size() > 1000)
-# endif
-  for (int i = 0; i < static_cast<int>(_optimizer->indexMapping().size()); ++i) {
-    OptimizableGraph::Vertex* v=_optimizer->indexMapping()[i];
-    assert(v);
-    v->clearQuadraticForm();
+  for (int landmarkIndex = begin; landmarkIndex < end; ++landmarkIndex) {
+    const typename SparseBlockMatrix<LandmarkMatrixType>::IntBlockMap& marginalizeColumn = _Hll->blockCols()[landmarkIndex];
+    assert(marginalizeColumn.size() == 1 && "more than one block in _Hll column");
+
+    // calculate inverse block for the landmark
+    const LandmarkMatrixType * D = marginalizeColumn.begin()->second;
+    assert (D && D->rows()==D->cols() && "Error in landmark matrix");
+    LandmarkMatrixType& Dinv = _DInvSchur->diagonal()[landmarkIndex];
+    Dinv = D->inverse();
+
+    LandmarkVectorType  db(D->rows());
+    for (int j=0; j<D->rows(); ++j) {
+      db[j]=_b[_Hll->rowBaseOfBlock(landmarkIndex) + _sizePoses + j];
+    }
+    db=Dinv*db;
+
+    assert((size_t)landmarkIndex < _HplCCS->blockCols().size() && "Index out of bounds");
+    const typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn& landmarkColumn = _HplCCS->blockCols()[landmarkIndex];
+
+    for (typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn::const_iterator it_outer = landmarkColumn.begin();
+        it_outer != landmarkColumn.end(); ++it_outer) {
+      int i1 = it_outer->row;
+
+      const PoseLandmarkMatrixType* Bi = it_outer->block;
+      assert(Bi);
+
+      PoseLandmarkMatrixType BDinv = (*Bi)*(Dinv);
+      assert(_HplCCS->rowBaseOfBlock(i1) < _sizePoses && "Index out of bounds");
+      typename PoseVectorType::MapType Bb(&_coefficients[_HplCCS->rowBaseOfBlock(i1)], Bi->rows());
+#    ifdef G2O_OPENMP
+      ScopedOpenMPMutex mutexLock(&_coefficientsMutex[i1]);
+#    endif
+      Bb.noalias() += (*Bi)*db;
+
+      assert(i1 >= 0 && i1 < static_cast<int>(_HschurTransposedCCS->blockCols().size()) && "Index out of bounds");
+      typename SparseBlockMatrixCCS<PoseMatrixType>::SparseColumn::iterator targetColumnIt = _HschurTransposedCCS->blockCols()[i1].begin();
+
+      typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::RowBlock aux(i1, 0);
+      typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn::const_iterator it_inner = lower_bound(landmarkColumn.begin(), landmarkColumn.end(), aux);
+      for (; it_inner != landmarkColumn.end(); ++it_inner) {
+        int i2 = it_inner->row;
+        const PoseLandmarkMatrixType* Bj = it_inner->block;
+        assert(Bj); 
+        while (targetColumnIt->row < i2 /*&& targetColumnIt != _HschurTransposedCCS->blockCols()[i1].end()*/)
+          ++targetColumnIt;
+        assert(targetColumnIt != _HschurTransposedCCS->blockCols()[i1].end() && targetColumnIt->row == i2 && "invalid iterator, something wrong with the matrix structure");
+        PoseMatrixType* Hi1i2 = targetColumnIt->block;//_Hschur->block(i1,i2);
+        assert(Hi1i2);
+        (*Hi1i2).noalias() -= BDinv*Bj->transpose();
+      }
+    }
   }
-  _Hpp->clear();
-  if (_doSchur) {
-    _Hll->clear();
-    _Hpl->clear();
+}
+
+template <typename Traits>
+void BlockSolver<Traits>::invertLandmarks(int begin, int end, int)
+{
+  for (int landmarkIndex = begin; landmarkIndex < end; ++landmarkIndex) {
+    const LandmarkMatrixType* D = _Hll->blockCols()[landmarkIndex].begin()->second;
+    _DInvSchur->diagonal()[landmarkIndex] = D->inverse();
   }
+}
 
-  // resetting the terms for the pairwise constraints
-  // built up the current system by storing the Hessian blocks in the edges and vertices
-# ifndef G2O_OPENMP
+template <typename Traits>
+void BlockSolver<Traits>::accumulateSchurPreconditioner(int begin, int end, int)
+{
+  for (int landmarkIndex = begin; landmarkIndex < end; ++landmarkIndex) {
+    const LandmarkMatrixType& Dinv = _DInvSchur->diagonal()[landmarkIndex];
+    const typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn& landmarkColumn = _HplCCS->blockCols()[landmarkIndex];
+    for (typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn::const_iterator it = landmarkColumn.begin(); it != landmarkColumn.end(); ++it) {
+      const PoseLandmarkMatrixType* Bi = it->block;
+      PoseMatrixType BDinvBt = (*Bi) * Dinv * Bi->transpose();
+#    ifdef G2O_OPENMP
+      ScopedOpenMPMutex mutexLock(&_coefficientsMutex[it->row]);
+#    endif
+      _schurPreconditioner[it->row] -= BDinvBt;
+    }
+  }
+}
+
+template <typename Traits>
+void BlockSolver<Traits>::linearizeEdges(int begin, int end, int slot)
+{
+# ifdef G2O_OPENMP
+  JacobianWorkspace& jacobianWorkspace = _optimizer->jacobianWorkspace().threadWorkspace(slot);
+# else
   // no threading, we do not need to copy the workspace
+  (void) slot;
   JacobianWorkspace& jacobianWorkspace = _optimizer->jacobianWorkspace();
-# else
-  // if running with threads need to produce copies of the workspace for each thread
-  JacobianWorkspace jacobianWorkspace = _optimizer->jacobianWorkspace();
-# pragma omp parallel for default (shared) firstprivate(jacobianWorkspace) if (_optimizer->activeEdges().size() > 100)
 # endif
-  for (int k = 0; k < static_cast<int>(_optimizer->activeEdges().size()); ++k) {
+  for (int k = begin; k < end; ++k) {
     OptimizableGraph::Edge* e = _optimizer->activeEdges()[k];
     e->linearizeOplus(jacobianWorkspace); // jacobian of the nodes' oplus (manifold)
     e->constructQuadraticForm();
@@ -543,10 +690,38 @@ bool BlockSolver<Traits>::buildSystem()
     }
 #  endif
   }
+}
+
+template <typename Traits>
+bool BlockSolver<Traits>::buildSystem()
+{
+  // clear b vector
+# ifdef G2O_OPENMP
+# pragma omp parallel for default (shared) if (_optimizer->indexMapping().size() > 1000 && ! _optimizer->parallelRunner())
+# endif
+  for (int i = 0; i < static_cast<int>(_optimizer->indexMapping().size()); ++i) {
+    OptimizableGraph::Vertex* v=_optimizer->indexMapping()[i];
+    assert(v);
+    v->clearQuadraticForm();
+  }
+  _Hpp->clear();
+  if (_doSchur) {
+    _Hll->clear();
+    _Hpl->clear();
+  }
+
+  // resetting the terms for the pairwise constraints
+  // built up the current system by storing the Hessian blocks in the edges and vertices
+  // with threads each one linearizes into its own copy of the workspace, kept by the optimizer between iterations
+# ifdef G2O_OPENMP
+  ParallelRunner* runner = _optimizer->parallelRunner();
+  _optimizer->jacobianWorkspace().allocateThreads(runner ? runner->slots() : 0);
+# endif
+  parallelFor(_optimizer->parallelRunner(), static_cast<int>(_optimizer->activeEdges().size()), 101, 32, this, &BlockSolver<Traits>::linearizeEdges);
 
   // flush the current system in a sparse block matrix
 # ifdef G2O_OPENMP
-# pragma omp parallel for default (shared) if (_optimizer->indexMapping().size() > 1000)
+# pragma omp parallel for default (shared) if (_optimizer->indexMapping().size() > 1000 && ! _optimizer->parallelRunner())
 # endif
   for (int i = 0; i < static_cast<int>(_optimizer->indexMapping().size()); ++i) {
     OptimizableGraph::Vertex* v=_optimizer->indexMapping()[i];
@@ -568,7 +743,7 @@ bool BlockSolver<Traits>::setLambda(double lambda, bool backup)
     _diagonalBackupLandmark.resize(_numLandmarks);
   }
 # ifdef G2O_OPENMP
-# pragma omp parallel for default (shared) if (_numPoses > 100)
+# pragma omp parallel for default (shared) if (_numPoses > 100 && ! _optimizer->parallelRunner())
 # endif
   for (int i = 0; i < _numPoses; ++i) {
     PoseMatrixType *b=_Hpp->block(i,i);
@@ -577,7 +752,7 @@ bool BlockSolver<Traits>::setLambda(double lambda, bool backup)
     b->diagonal().array() += lambda;
   }
 # ifdef G2O_OPENMP
-# pragma omp parallel for default (shared) if (_numLandmarks > 100)
+# pragma omp parallel for default (shared) if (_numLandmarks > 100 && ! _optimizer->parallelRunner())
 # endif
   for (int i = 0; i < _numLandmarks; ++i) {
     LandmarkMatrixType *b=_Hll->block(i,i);
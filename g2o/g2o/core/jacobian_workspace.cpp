@@ -29,6 +29,11 @@
 #include <cmath>
 
 #include "optimizable_graph.h"
+#include "../../config.h"
+
+#ifdef G2O_OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
@@ -41,6 +46,8 @@ JacobianWorkspace::JacobianWorkspace() :
 
 JacobianWorkspace::~JacobianWorkspace()
 {
+  for (size_t i = 0; i < _threadWorkspaces.size(); ++i)
+    delete _threadWorkspaces[i];
 }
 
 bool JacobianWorkspace::allocate()
@@ -53,9 +60,38 @@ bool JacobianWorkspace::allocate()
     it->resize(_maxDimension);
     it->setZero();
   }
+  // the thread copies follow the new size the next time they are needed
+  for (size_t i = 0; i < _threadWorkspaces.size(); ++i) {
+    _threadWorkspaces[i]->_maxNumVertices = _maxNumVertices;
+    _threadWorkspaces[i]->_maxDimension = _maxDimension;
+    _threadWorkspaces[i]->allocate();
+  }
   return true;
 }
 
+void JacobianWorkspace::allocateThreads(int numThreads)
+{
+#ifdef G2O_OPENMP
+  if (numThreads <= 0)
+    numThreads = omp_get_max_threads();
+#else
+  numThreads = 1;
+#endif
+  size_t numCopies = numThreads > 1 ? numThreads - 1 : 0;
+  // the thread count may also change between optimizations
+  while (_threadWorkspaces.size() > numCopies) {
+    delete _threadWorkspaces.back();
+    _threadWorkspaces.pop_back();
+  }
+  while (_threadWorkspaces.size() < numCopies) {
+    JacobianWorkspace* copy = new JacobianWorkspace();
+    copy->_maxNumVertices = _maxNumVertices;
+    copy->_maxDimension = _maxDimension;
+    copy->allocate();
+    _threadWorkspaces.push_back(copy);
+  }
+}
+
 void JacobianWorkspace::updateSize(const HyperGraph::Edge* e_)
 {
   const OptimizableGraph::Edge* e = static_cast<const OptimizableGraph::Edge*>(e_);
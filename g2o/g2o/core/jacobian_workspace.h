@@ -47,6 +47,9 @@ namespace g2o {
    * for computing the Jacobian of the error functions.
    * Before calling linearizeOplus on an edge, the workspace needs to be allocated
    * by calling allocate().
+   *
+   * For edges linearized in parallel, allocateThreads() keeps one copy of the
+   * workspace for each thread, returned by threadWorkspace().
    */
   class G2O_CORE_API JacobianWorkspace
   {
@@ -77,6 +80,21 @@ namespace g2o {
        */
       void updateSize(int numVertices, int dimension);
 
+      /**
+       * make sure there is a copy of the workspace for each of numThreads threads (0 - the OpenMP
+       * threads), it has to be called outside of the parallel region. The copies are kept until the size changes.
+       */
+      void allocateThreads(int numThreads = 0);
+
+      /**
+       * return the workspace of a thread (OpenMP thread or slot of a ParallelRunner), thread 0 uses this one
+       */
+      JacobianWorkspace& threadWorkspace(int thread)
+      {
+        assert(thread >= 0 && (size_t)thread <= _threadWorkspaces.size() && "Thread workspace not allocated");
+        return thread == 0 ? *this : *_threadWorkspaces[thread - 1];
+      }
+
       /**
        * return the workspace for a vertex in an edge
        */
@@ -90,6 +108,12 @@ namespace g2o {
       WorkspaceVector _workspace;   ///< the memory pre-allocated for computing the Jacobians
       int _maxNumVertices;          ///< the maximum number of vertices connected by a hyper-edge
       int _maxDimension;            ///< the maximum dimension (number of elements) for a Jacobian
+      std::vector<JacobianWorkspace*> _threadWorkspaces; ///< copies for the OpenMP threads but the first one
+
+    private:
+      // the thread copies are owned
+      JacobianWorkspace(const JacobianWorkspace&);
+      JacobianWorkspace& operator=(const JacobianWorkspace&);
   };
 
 } // end namespace
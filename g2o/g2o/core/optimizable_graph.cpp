@@ -62,7 +62,7 @@ namespace g2o {
 
   OptimizableGraph::Vertex::Vertex() :
     HyperGraph::Vertex(),
-    _graph(0), _userData(0), _hessianIndex(-1), _fixed(false), _marginalized(false),
+    _graph(0), _userData(0), _hessianIndex(-1), _graphIndex(-1), _fixed(false), _marginalized(false),
     _colInHessian(-1), _cacheContainer(0)
   {
   }
@@ -131,7 +131,7 @@ namespace g2o {
 
   OptimizableGraph::Edge::Edge() :
     HyperGraph::Edge(),
-    _dimension(-1), _level(0), _robustKernel(0)
+    _dimension(-1), _level(0), _robustKernel(0), _graphIndex(-1)
   {
   }
 
@@ -258,7 +258,17 @@ namespace g2o {
     if (userData)
       ov->setUserData(userData);
     ov->_graph=this;
-    return HyperGraph::addVertex(v);
+    if (! HyperGraph::addVertex(v))
+      return false;
+    if (_freeVertexSlots.empty()) {
+      ov->_graphIndex = _vertexSlots.size();
+      _vertexSlots.push_back(ov);
+    } else {
+      ov->_graphIndex = _freeVertexSlots.back();
+      _freeVertexSlots.pop_back();
+      _vertexSlots[ov->_graphIndex] = ov;
+    }
+    return true;
   }
 
   bool OptimizableGraph::addEdge(HyperGraph::Edge* e_)
@@ -271,6 +281,20 @@ namespace g2o {
     if (! eresult)
       return false;
     e->_internalId = _nextEdgeId++;
+    if (_freeEdgeSlots.empty()) {
+      e->_graphIndex = _edgeSlots.size();
+      _edgeSlots.push_back(e);
+    } else {
+      e->_graphIndex = _freeEdgeSlots.back();
+      _freeEdgeSlots.pop_back();
+      _edgeSlots[e->_graphIndex] = e;
+    }
+    for (size_t i = 0; i < e->vertices().size(); ++i) {
+      OptimizableGraph::Vertex* v = static_cast<OptimizableGraph::Vertex*>(e->vertices()[i]);
+      // a vertex connected twice by the edge lists it once, as in its edge set
+      if (std::find(e->vertices().begin(), e->vertices().begin() + i, v) == e->vertices().begin() + i)
+        v->_edgeList.push_back(e);
+    }
     if (! e->resolveParameters()){
       cerr << __FUNCTION__ << ": FATAL, cannot resolve parameters for edge " << e << endl;
       return false;
@@ -284,6 +308,48 @@ namespace g2o {
     return true;
   }
 
+  bool OptimizableGraph::removeVertex(HyperGraph::Vertex* v_)
+  {
+    OptimizableGraph::Vertex* v = static_cast<OptimizableGraph::Vertex*>(v_);
+    if (vertex(v->id()) != v)
+      return false;
+    int index = v->_graphIndex;
+    // the edges are removed through removeEdge(), which releases their slots
+    if (! HyperGraph::removeVertex(v))
+      return false;
+    _vertexSlots[index] = 0;
+    _freeVertexSlots.push_back(index);
+    return true;
+  }
+
+  bool OptimizableGraph::removeEdge(HyperGraph::Edge* e_)
+  {
+    OptimizableGraph::Edge* e = static_cast<OptimizableGraph::Edge*>(e_);
+    int index = e->_graphIndex;
+    if (index < 0 || index >= (int)_edgeSlots.size() || _edgeSlots[index] != e)
+      return false;
+    for (size_t i = 0; i < e->vertices().size(); ++i) {
+      OptimizableGraph::Vertex* v = static_cast<OptimizableGraph::Vertex*>(e->vertices()[i]);
+      EdgeContainer::iterator it = std::find(v->_edgeList.begin(), v->_edgeList.end(), e);
+      if (it != v->_edgeList.end()) {
+        *it = v->_edgeList.back();
+        v->_edgeList.pop_back();
+      }
+    }
+    _edgeSlots[index] = 0;
+    _freeEdgeSlots.push_back(index);
+    return HyperGraph::removeEdge(e);
+  }
+
+  void OptimizableGraph::clear()
+  {
+    _vertexSlots.clear();
+    _edgeSlots.clear();
+    _freeVertexSlots.clear();
+    _freeEdgeSlots.clear();
+    HyperGraph::clear();
+  }
+
   int OptimizableGraph::optimize(int /*iterations*/, bool /*online*/) {return 0;}
 
 double OptimizableGraph::chi2() const
@@ -685,6 +751,7 @@ void OptimizableGraph::addGraph(OptimizableGraph* g){
       continue;
     OptimizableGraph::Vertex* v2=v->clone();
     v2->edges().clear();
+    v2->_edgeList.clear();
     v2->setHessianIndex(-1);
     addVertex(v2);
   }
@@ -327,6 +327,12 @@ namespace g2o {
 
         OptimizableGraph* graph() {return _graph;}
 
+        //! stable handle of the vertex in the slots of its graph, -1 if not in a graph
+        int graphIndex() const { return _graphIndex;}
+
+        //! the edges of this vertex in a contiguous array, same content as edges() in no particular order
+        const EdgeContainer& edgeList() const { return _edgeList;}
+
         /**
          * lock for the block of the hessian and the b vector associated with this vertex, to avoid
          * race-conditions if multi-threaded.
@@ -349,6 +355,8 @@ namespace g2o {
         OptimizableGraph* _graph;
         Data* _userData;
         int _hessianIndex;
+        int _graphIndex;
+        EdgeContainer _edgeList;
         bool _fixed;
         bool _marginalized;
         int _dimension;
@@ -483,6 +491,9 @@ namespace g2o {
         //! the internal ID of the edge
         long long internalId() const { return _internalId;}
 
+        //! stable handle of the edge in the slots of its graph, -1 if not in a graph
+        int graphIndex() const { return _graphIndex;}
+
         OptimizableGraph* graph();
         const OptimizableGraph* graph() const;
 
@@ -499,6 +510,7 @@ namespace g2o {
         int _level;
         RobustKernel* _robustKernel;
         long long _internalId;
+        int _graphIndex;
 
         std::vector<int> _cacheIds;
 
@@ -552,6 +564,22 @@ namespace g2o {
      */
     virtual bool addEdge(HyperGraph::Edge* e);
 
+    //! removes a vertex and its edges, their slots are released
+    virtual bool removeVertex(HyperGraph::Vertex* v);
+    //! removes an edge, its slot is released
+    virtual bool removeEdge(HyperGraph::Edge* e);
+
+    //! clears the graph and the slots
+    virtual void clear();
+
+    /**
+     * the vertices and edges of the graph in contiguous arrays, indexed by their graphIndex().
+     * The slot of a removed element is 0 until a new element takes it, the handles of the
+     * elements in the graph never change.
+     */
+    const VertexContainer& vertexSlots() const { return _vertexSlots;}
+    const EdgeContainer& edgeSlots() const { return _edgeSlots;}
+
     //! returns the chi2 of the current configuration
     double chi2() const;
 
@@ -678,6 +706,12 @@ namespace g2o {
 
     ParameterContainer _parameters;
     JacobianWorkspace _jacobianWorkspace;
+
+    // flat storage of the vertices and edges, and the slots released by removals
+    VertexContainer _vertexSlots;
+    EdgeContainer _edgeSlots;
+    std::vector<int> _freeVertexSlots;
+    std::vector<int> _freeEdgeSlots;
   };
   
   /**
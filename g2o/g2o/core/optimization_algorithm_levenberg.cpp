@@ -49,6 +49,9 @@ namespace g2o {
     _goodStepLowerScale = 1./3.;
     _userLambdaInit = _properties.makeProperty<Property<double> >("initialLambda", 0.);
     _maxTrialsAfterFailure = _properties.makeProperty<Property<int> >("maxTrialsAfterFailure", 10);
+    _minRelativeDecrease = _properties.makeProperty<Property<double> >("minRelativeDecrease", 1e-3);
+    _maxStallIterations = _properties.makeProperty<Property<int> >("maxStallIterations", 3);
+    _minUpdate = _properties.makeProperty<Property<double> >("minUpdate", 0.);
     _ni=2.;
     _levenbergIterations = 0;
     _nBad = 0;
@@ -97,6 +100,7 @@ namespace g2o {
     }
 
     double rho=0;
+    double maxUpdate=0;
     int& qmax = _levenbergIterations;
     qmax = 0;
     do {
@@ -140,6 +144,11 @@ namespace g2o {
         _ni = 2;
         currentChi=tempChi;
         _optimizer->discardTop();
+        if (_minUpdate->value() > 0) {
+          maxUpdate = 0;
+          for (size_t j=0; j < _solver->vectorSize(); j++)
+            maxUpdate = (std::max)(maxUpdate, fabs(_solver->x()[j]));
+        }
       } else {
         _currentLambda*=_ni;
         _ni*=2;
@@ -152,14 +161,18 @@ namespace g2o {
       return Terminate;
 
     //Stop criterium (Raul)
-    if((iniChi-currentChi)*1e3<iniChi)
+    if((iniChi-currentChi)<_minRelativeDecrease->value()*iniChi)
         _nBad++;
     else
         _nBad=0;
 
-    if(_nBad>=3)
+    if(_nBad>=_maxStallIterations->value())
         return Terminate;
 
+    // the accepted step no longer moves the estimate, further iterations would not either
+    if (_minUpdate->value() > 0 && maxUpdate < _minUpdate->value())
+      return Terminate;
+
     return OK;
   }
 
@@ -198,6 +211,21 @@ namespace g2o {
     _userLambdaInit->setValue(lambda);
   }
 
+  void OptimizationAlgorithmLevenberg::setMinRelativeDecrease(double decrease)
+  {
+    _minRelativeDecrease->setValue(decrease);
+  }
+
+  void OptimizationAlgorithmLevenberg::setMaxStallIterations(int iterations)
+  {
+    _maxStallIterations->setValue(iterations);
+  }
+
+  void OptimizationAlgorithmLevenberg::setMinUpdate(double update)
+  {
+    _minUpdate->setValue(update);
+  }
+
   void OptimizationAlgorithmLevenberg::printVerbose(std::ostream& os) const
   {
     os
@@ -66,6 +66,18 @@ namespace g2o {
       //! return the number of levenberg iterations performed in the last round
       int levenbergIteration() { return _levenbergIterations;}
 
+      //! relative decrease of the robust chi^2 below which an iteration made no progress
+      double minRelativeDecrease() const { return _minRelativeDecrease->value();}
+      void setMinRelativeDecrease(double decrease);
+
+      //! iterations in a row without progress before terminating
+      int maxStallIterations() const { return _maxStallIterations->value();}
+      void setMaxStallIterations(int iterations);
+
+      //! terminate as soon as no element of an accepted update is above it, 0 disables the test
+      double minUpdate() const { return _minUpdate->value();}
+      void setMinUpdate(double update);
+
     protected:
       // Levenberg parameters
       Property<int>* _maxTrialsAfterFailure;
@@ -78,6 +90,9 @@ namespace g2o {
       int _levenbergIterations;   ///< the numer of levenberg iterations performed to accept the last step
       //RAUL
       int _nBad;
+      Property<double>* _minRelativeDecrease;
+      Property<int>* _maxStallIterations;
+      Property<double>* _minUpdate;
 
       /**
        * helper for Levenberg, this function computes the initial damping factor, if the user did not
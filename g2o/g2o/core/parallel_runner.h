@@ -0,0 +1,109 @@
+// g2o - General Graph Optimization
+// Copyright (C) 2011 R. Kuemmerle, G. Grisetti, W. Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef G2O_PARALLEL_RUNNER_H
+#define G2O_PARALLEL_RUNNER_H
+
+#include "openmp_mutex.h"
+
+namespace g2o {
+
+  /**
+   * \brief runs the parallel loops of the optimizer on the threads of the host application
+   *
+   * Set with SparseOptimizer::setParallelRunner, the loops then run on it instead of on an
+   * OpenMP team. The loops that accumulate into shared blocks still rely on the OpenMP locks,
+   * so without G2O_OPENMP the runner is not used and every loop runs serially.
+   */
+  class ParallelRunner
+  {
+    public:
+      /**
+       * \brief iterations [begin, end) of a loop, slot selects the scratch space of the caller
+       */
+      class Body
+      {
+        public:
+          virtual ~Body() {}
+          virtual void operator()(int begin, int end, int slot) const = 0;
+      };
+
+      virtual ~ParallelRunner() {}
+
+      //! number of slots run() passes to the body, from 0 to slots()-1, at least 1
+      virtual int slots() const = 0;
+
+      /**
+       * calls body over [0, n) in chunks of at most grain iterations and returns once all are done.
+       * A slot is never used by two chunks at the same time
+       */
+      virtual void run(int n, int grain, const Body& body) = 0;
+  };
+
+  /**
+   * \brief loop body calling a method of an object
+   */
+  template <class T>
+  class ParallelMethod : public ParallelRunner::Body
+  {
+    public:
+      typedef void (T::*Method)(int begin, int end, int slot);
+      ParallelMethod(T* object, Method method) : _object(object), _method(method) {}
+      virtual void operator()(int begin, int end, int slot) const { (_object->*_method)(begin, end, slot);}
+    protected:
+      T* _object;
+      Method _method;
+  };
+
+  /**
+   * calls (object->*method)(begin, end, slot) over [0, n): on the runner if there is one, on an OpenMP
+   * team (schedule(dynamic, grain), slot is the thread number) if there is none, serially if n is below minParallel
+   */
+  template <class T>
+  void parallelFor(ParallelRunner* runner, int n, int minParallel, int grain, T* object, void (T::*method)(int, int, int))
+  {
+    if (n <= 0)
+      return;
+#ifdef G2O_OPENMP
+    if (runner) {
+      if (n >= minParallel && runner->slots() > 1)
+        runner->run(n, grain, ParallelMethod<T>(object, method));
+      else
+        (object->*method)(0, n, 0);
+      return;
+    }
+#   pragma omp parallel for default (shared) schedule(dynamic, grain) if (n >= minParallel)
+    for (int i = 0; i < n; ++i)
+      (object->*method)(i, i + 1, omp_get_thread_num());
+#else
+    (void) runner; (void) minParallel; (void) grain;
+    (object->*method)(0, n, 0);
+#endif
+  }
+
+} // end namespace
+
+#endif
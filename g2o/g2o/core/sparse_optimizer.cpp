@@ -48,7 +48,7 @@ namespace g2o{
 
 
   SparseOptimizer::SparseOptimizer() :
-    _forceStopFlag(0), _verbose(false), _algorithm(0), _computeBatchStatistics(false)
+    _forceStopFlag(0), _verbose(false), _algorithm(0), _computeBatchStatistics(false), _parallelRunner(0)
   {
     _graphActions.resize(AT_NUM_ELEMENTS);
   }
@@ -67,13 +67,7 @@ namespace g2o{
         (*(*it))(this);
     }
 
-#   ifdef G2O_OPENMP
-#   pragma omp parallel for default (shared) if (_activeEdges.size() > 50)
-#   endif
-    for (int k = 0; k < static_cast<int>(_activeEdges.size()); ++k) {
-      OptimizableGraph::Edge* e = _activeEdges[k];
-      e->computeError();
-    }
+    parallelFor(_parallelRunner, static_cast<int>(_activeEdges.size()), 51, 64, this, &SparseOptimizer::computeErrorRange);
 
 #  ifndef NDEBUG
     for (int k = 0; k < static_cast<int>(_activeEdges.size()); ++k) {
@@ -87,6 +81,14 @@ namespace g2o{
 
   }
 
+  void SparseOptimizer::computeErrorRange(int begin, int end, int)
+  {
+    for (int k = begin; k < end; ++k) {
+      OptimizableGraph::Edge* e = _activeEdges[k];
+      e->computeError();
+    }
+  }
+
   double SparseOptimizer::activeChi2( ) const
   {
     double chi = 0.0;
@@ -118,18 +120,17 @@ namespace g2o{
       return 0;
 
     int maxDim=0;
-    for (HyperGraph::VertexIDMap::iterator it=vertices().begin(); it!=vertices().end(); ++it){
-      OptimizableGraph::Vertex* v=static_cast<OptimizableGraph::Vertex*>(it->second); 
-      maxDim=std::max(maxDim,v->dimension());
+    for (VertexContainer::const_iterator it=_vertexSlots.begin(); it!=_vertexSlots.end(); ++it){
+      if (*it)
+        maxDim=std::max(maxDim,(*it)->dimension());
     }
     
+    // lowest id of the largest dimension, whatever the order of the slots
     OptimizableGraph::Vertex* rut=0;
-    for (HyperGraph::VertexIDMap::iterator it=vertices().begin(); it!=vertices().end(); ++it){
-      OptimizableGraph::Vertex* v=static_cast<OptimizableGraph::Vertex*>(it->second);
-      if (v->dimension()==maxDim){
+    for (VertexContainer::const_iterator it=_vertexSlots.begin(); it!=_vertexSlots.end(); ++it){
+      OptimizableGraph::Vertex* v=*it;
+      if (v && v->dimension()==maxDim && (!rut || v->id()<rut->id()))
         rut=v;
-        break;
-      }
     }
     return rut;
   }
@@ -140,21 +141,21 @@ namespace g2o{
       return false;
 
     int maxDim=0;
-    for (HyperGraph::VertexIDMap::iterator it=vertices().begin(); it!=vertices().end(); ++it){
-      OptimizableGraph::Vertex* v=static_cast<OptimizableGraph::Vertex*>(it->second); 
-      maxDim = std::max(maxDim,v->dimension());
+    for (VertexContainer::const_iterator it=_vertexSlots.begin(); it!=_vertexSlots.end(); ++it){
+      if (*it)
+        maxDim = std::max(maxDim,(*it)->dimension());
     }
 
-    for (HyperGraph::VertexIDMap::iterator it=vertices().begin(); it!=vertices().end(); ++it){
-      OptimizableGraph::Vertex* v=static_cast<OptimizableGraph::Vertex*>(it->second);
-      if (v->dimension() == maxDim) {
+    for (VertexContainer::const_iterator it=_vertexSlots.begin(); it!=_vertexSlots.end(); ++it){
+      OptimizableGraph::Vertex* v=*it;
+      if (v && v->dimension() == maxDim) {
         // test for fixed vertex
         if (v->fixed()) {
           return false;
         }
         // test for full dimension prior
-        for (HyperGraph::EdgeSet::const_iterator eit = v->edges().begin(); eit != v->edges().end(); ++eit) {
-          OptimizableGraph::Edge* e = static_cast<OptimizableGraph::Edge*>(*eit);
+        for (EdgeContainer::const_iterator eit = v->edgeList().begin(); eit != v->edgeList().end(); ++eit) {
+          OptimizableGraph::Edge* e = *eit;
           if (e->vertices().size() == 1 && e->dimension() == maxDim)
             return false;
         }
@@ -196,11 +197,56 @@ namespace g2o{
     }
   }
 
+  // test for NANs in the current estimate if we are debugging
+  static void checkEstimate(OptimizableGraph::Vertex* v)
+  {
+#  ifndef NDEBUG
+    int estimateDim = v->estimateDimension();
+    if (estimateDim > 0) {
+      Eigen::VectorXd estimateData(estimateDim);
+      if (v->getEstimateData(estimateData.data()) == true) {
+        int k;
+        bool hasNan = arrayHasNaN(estimateData.data(), estimateDim, &k);
+        if (hasNan)
+          cerr << __PRETTY_FUNCTION__ << ": Vertex " << v->id() << " contains a nan entry at index " << k << endl;
+      }
+    }
+#  else
+    (void) v;
+#  endif
+  }
+
   bool SparseOptimizer::initializeOptimization(int level){
-    HyperGraph::VertexSet vset;
-    for (VertexIDMap::iterator it=vertices().begin(); it!=vertices().end(); ++it)
-      vset.insert(it->second);
-    return initializeOptimization(vset,level);
+    if (edges().size() == 0) {
+      cerr << __PRETTY_FUNCTION__ << ": Attempt to initialize an empty graph" << endl;
+      return false;
+    }
+    bool workspaceAllocated = _jacobianWorkspace.allocate(); (void) workspaceAllocated;
+    assert(workspaceAllocated && "Error while allocating memory for the Jacobians");
+    clearIndexMapping();
+    _activeVertices.clear();
+    _activeEdges.clear();
+    _activeEdges.reserve(edges().size());
+    // the whole graph: every edge of the level is active, and so are its vertices
+    vector<char> activeVertex(_vertexSlots.size(), 0);
+    for (EdgeContainer::const_iterator it=_edgeSlots.begin(); it!=_edgeSlots.end(); ++it){
+      OptimizableGraph::Edge* e=*it;
+      if (!e || (level >= 0 && e->level() != level) || e->allVerticesFixed())
+        continue;
+      _activeEdges.push_back(e);
+      for (vector<HyperGraph::Vertex*>::const_iterator vit = e->vertices().begin(); vit != e->vertices().end(); ++vit)
+        activeVertex[static_cast<OptimizableGraph::Vertex*>(*vit)->graphIndex()] = 1;
+    }
+    _activeVertices.reserve(vertices().size());
+    for (size_t i=0; i<_vertexSlots.size(); ++i){
+      if (activeVertex[i]) {
+        _activeVertices.push_back(_vertexSlots[i]);
+        checkEstimate(_vertexSlots[i]);
+      }
+    }
+
+    sortVectorContainers();
+    return buildIndexMapping(_activeVertices);
   }
 
   bool SparseOptimizer::initializeOptimization(HyperGraph::VertexSet& vset, int level){
@@ -214,25 +260,36 @@ namespace g2o{
     _activeVertices.clear();
     _activeVertices.reserve(vset.size());
     _activeEdges.clear();
-    set<Edge*> auxEdgeSet; // temporary structure to avoid duplicates
+    // membership of the set and edges already taken, by graph index, instead of lookups in node based sets
+    vector<char> inSet(_vertexSlots.size(), 0);
+    for (HyperGraph::VertexSet::iterator it=vset.begin(); it!=vset.end(); ++it){
+      int index = static_cast<OptimizableGraph::Vertex*>(*it)->graphIndex();
+      if (index >= 0)
+        inSet[index] = 1;
+    }
+    vector<char> edgeTaken(_edgeSlots.size(), 0);
     for (HyperGraph::VertexSet::iterator it=vset.begin(); it!=vset.end(); ++it){
       OptimizableGraph::Vertex* v= (OptimizableGraph::Vertex*) *it;
-      const OptimizableGraph::EdgeSet& vEdges=v->edges();
+      const EdgeContainer& vEdges=v->edgeList();
       // count if there are edges in that level. If not remove from the pool
       int levelEdges=0;
-      for (OptimizableGraph::EdgeSet::const_iterator it=vEdges.begin(); it!=vEdges.end(); ++it){
-        OptimizableGraph::Edge* e=reinterpret_cast<OptimizableGraph::Edge*>(*it);
+      for (EdgeContainer::const_iterator it=vEdges.begin(); it!=vEdges.end(); ++it){
+        OptimizableGraph::Edge* e=*it;
         if (level < 0 || e->level() == level) {
 
           bool allVerticesOK = true;
           for (vector<HyperGraph::Vertex*>::const_iterator vit = e->vertices().begin(); vit != e->vertices().end(); ++vit) {
-            if (vset.find(*vit) == vset.end()) {
+            int index = static_cast<OptimizableGraph::Vertex*>(*vit)->graphIndex();
+            if (index < 0 || !inSet[index]) {
               allVerticesOK = false;
               break;
             }
           }
           if (allVerticesOK && !e->allVerticesFixed()) {
-            auxEdgeSet.insert(e);
+            if (!edgeTaken[e->graphIndex()]) {
+              edgeTaken[e->graphIndex()] = 1;
+              _activeEdges.push_back(e);
+            }
             levelEdges++;
           }
 
@@ -240,28 +297,10 @@ namespace g2o{
       }
       if (levelEdges){
         _activeVertices.push_back(v);
-
-        // test for NANs in the current estimate if we are debugging
-#      ifndef NDEBUG
-        int estimateDim = v->estimateDimension();
-        if (estimateDim > 0) {
-          Eigen::VectorXd estimateData(estimateDim);
-          if (v->getEstimateData(estimateData.data()) == true) {
-            int k;
-            bool hasNan = arrayHasNaN(estimateData.data(), estimateDim, &k);
-            if (hasNan)
-              cerr << __PRETTY_FUNCTION__ << ": Vertex " << v->id() << " contains a nan entry at index " << k << endl;
-          }
-        }
-#      endif
-
+        checkEstimate(v);
       }
     }
 
-    _activeEdges.reserve(auxEdgeSet.size());
-    for (set<Edge*>::iterator it = auxEdgeSet.begin(); it != auxEdgeSet.end(); ++it)
-      _activeEdges.push_back(*it);
-
     sortVectorContainers();
     return buildIndexMapping(_activeVertices);
   }
@@ -273,27 +312,28 @@ namespace g2o{
     _activeVertices.clear();
     _activeEdges.clear();
     _activeEdges.reserve(eset.size());
-    set<Vertex*> auxVertexSet; // temporary structure to avoid duplicates
+    vector<char> vertexTaken(_vertexSlots.size(), 0); // by graph index, to avoid duplicates
     for (HyperGraph::EdgeSet::iterator it=eset.begin(); it!=eset.end(); ++it){
       OptimizableGraph::Edge* e=(OptimizableGraph::Edge*)(*it);
       for (vector<HyperGraph::Vertex*>::const_iterator vit = e->vertices().begin(); vit != e->vertices().end(); ++vit) {
-        auxVertexSet.insert(static_cast<OptimizableGraph::Vertex*>(*vit));
+        OptimizableGraph::Vertex* v = static_cast<OptimizableGraph::Vertex*>(*vit);
+        assert(v->graphIndex() >= 0 && "Vertex of the edge set not in the graph");
+        if (!vertexTaken[v->graphIndex()]) {
+          vertexTaken[v->graphIndex()] = 1;
+          _activeVertices.push_back(v);
+        }
       }
       _activeEdges.push_back(reinterpret_cast<OptimizableGraph::Edge*>(*it));
     }
 
-    _activeVertices.reserve(auxVertexSet.size());
-    for (set<Vertex*>::iterator it = auxVertexSet.begin(); it != auxVertexSet.end(); ++it)
-      _activeVertices.push_back(*it);
-
     sortVectorContainers();
     return buildIndexMapping(_activeVertices);
   }
 
   void SparseOptimizer::setToOrigin(){
-    for (VertexIDMap::iterator it=vertices().begin(); it!=vertices().end(); ++it) {
-      OptimizableGraph::Vertex* v = static_cast<OptimizableGraph::Vertex*>(it->second);
-      v->setToOrigin();
+    for (VertexContainer::iterator it=_vertexSlots.begin(); it!=_vertexSlots.end(); ++it) {
+      if (*it)
+        (*it)->setToOrigin();
     }
   }
 
@@ -583,7 +623,7 @@ namespace g2o{
       clearIndexMapping();
       _ivMap.clear();
     }
-    return HyperGraph::removeVertex(v);
+    return OptimizableGraph::removeVertex(v);
   }
 
   bool SparseOptimizer::addComputeErrorAction(HyperGraphAction* action)
@@ -33,6 +33,7 @@
 #include "sparse_block_matrix.h"
 #include "g2o_core_api.h"
 #include "batch_stats.h"
+#include "parallel_runner.h"
 
 #include <map>
 
@@ -279,6 +280,13 @@ namespace g2o {
     
     bool computeBatchStatistics() const { return _computeBatchStatistics;}
 
+    /**
+     * runs the parallel loops of the optimization on runner instead of on an OpenMP team (NULL - OpenMP).
+     * The runner is not owned and has to outlive the optimizer
+     */
+    void setParallelRunner(ParallelRunner* runner) { _parallelRunner = runner;}
+    ParallelRunner* parallelRunner() const { return _parallelRunner;}
+
     /**** callbacks ****/
     //! add an action to be executed before the error vectors are computed
     bool addComputeErrorAction(HyperGraphAction* action);
@@ -307,6 +315,11 @@ namespace g2o {
 
     BatchStatisticsContainer _batchStatistics;   ///< global statistics of the optimizer, e.g., timing, num-non-zeros
     bool _computeBatchStatistics;
+
+    ParallelRunner* _parallelRunner;
+
+    //! computes the errors of the active edges [begin, end)
+    void computeErrorRange(int begin, int end, int slot);
   };
 } // end namespace
 
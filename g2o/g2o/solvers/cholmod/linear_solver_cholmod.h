@@ -35,6 +35,9 @@
 
 #include <cholmod.h>
 
+#include <algorithm>
+#include <vector>
+
 namespace g2o {
 
 /**
@@ -83,6 +86,8 @@ class LinearSolverCholmod : public LinearSolverCCS<MatrixType>
       _blockOrdering = false;
       _cholmodSparse = new CholmodExt();
       _cholmodFactor = 0;
+      _reuseSymbolic = true;
+      _patternChanged = false;
       cholmod_start(&_cholmodCommon);
 
       // setup ordering strategy
@@ -106,6 +111,11 @@ class LinearSolverCholmod : public LinearSolverCCS<MatrixType>
     virtual bool init()
     {
       if (_cholmodFactor != 0) {
+        if (_reuseSymbolic) {
+          // keep the ordering and the symbolic factor until the pattern is known to have changed
+          _patternChanged = true;
+          return true;
+        }
         cholmod_free_factor(&_cholmodFactor, &_cholmodCommon);
         _cholmodFactor = 0;
       }
@@ -115,12 +125,9 @@ class LinearSolverCholmod : public LinearSolverCCS<MatrixType>
     bool solve(const SparseBlockMatrix<MatrixType>& A, double* x, double* b)
     {
       //cerr << __PRETTY_FUNCTION__ << " using cholmod" << endl;
-      fillCholmodExt(A, _cholmodFactor != 0); // _cholmodFactor used as bool, if not existing will copy the whole structure, otherwise only the values
-
-      if (_cholmodFactor == 0) {
-        computeSymbolicDecomposition(A);
-        assert(_cholmodFactor != 0 && "Symbolic cholesky failed");
-      }
+      prepareFactor(A);
+      if (_cholmodFactor == 0)
+        return false;
       double t=get_monotonic_time();
 
       // setting up b for calling cholmod
@@ -156,12 +163,9 @@ class LinearSolverCholmod : public LinearSolverCCS<MatrixType>
     bool solveBlocks(double**& blocks, const SparseBlockMatrix<MatrixType>& A)
     {
       //cerr << __PRETTY_FUNCTION__ << " using cholmod" << endl;
-      fillCholmodExt(A, _cholmodFactor != 0); // _cholmodFactor used as bool, if not existing will copy the whole structure, otherwise only the values
-
-      if (_cholmodFactor == 0) {
-        computeSymbolicDecomposition(A);
-        assert(_cholmodFactor && "Symbolic cholesky failed");
-      }
+      prepareFactor(A);
+      if (_cholmodFactor == 0)
+        return false;
 
       if (! blocks){
         blocks=new double*[A.rows()];
@@ -183,6 +187,7 @@ class LinearSolverCholmod : public LinearSolverCCS<MatrixType>
         return false;
       }
       assert(_cholmodFactor->is_ll && !_cholmodFactor->is_super && _cholmodFactor->is_monotonic && "Cholesky factor has wrong format");
+      _symbolicP.clear(); // the factor no longer has the requested type, analyze again next time
 
       // invert the permutation
       int* p = (int*)_cholmodFactor->Perm;
@@ -207,12 +212,9 @@ class LinearSolverCholmod : public LinearSolverCCS<MatrixType>
     virtual bool solvePattern(SparseBlockMatrix<MatrixXd>& spinv, const std::vector<std::pair<int, int> >& blockIndices, const SparseBlockMatrix<MatrixType>& A)
     {
       //cerr << __PRETTY_FUNCTION__ << " using cholmod" << endl;
-      fillCholmodExt(A, _cholmodFactor != 0); // _cholmodFactor used as bool, if not existing will copy the whole structure, otherwise only the values
-
-      if (_cholmodFactor == 0) {
-        computeSymbolicDecomposition(A);
-        assert(_cholmodFactor && "Symbolic cholesky failed");
-      }
+      prepareFactor(A);
+      if (_cholmodFactor == 0)
+        return false;
 
       cholmod_factorize(_cholmodSparse, _cholmodFactor, &_cholmodCommon);
       if (_cholmodCommon.status == CHOLMOD_NOT_POSDEF)
@@ -224,6 +226,7 @@ class LinearSolverCholmod : public LinearSolverCCS<MatrixType>
         return false;
       }
       assert(_cholmodFactor->is_ll && !_cholmodFactor->is_super && _cholmodFactor->is_monotonic && "Cholesky factor has wrong format");
+      _symbolicP.clear(); // the factor no longer has the requested type, analyze again next time
 
       // invert the permutation
       int* p = (int*)_cholmodFactor->Perm;
@@ -249,6 +252,22 @@ class LinearSolverCholmod : public LinearSolverCCS<MatrixType>
     bool blockOrdering() const { return _blockOrdering;}
     void setBlockOrdering(bool blockOrdering) { _blockOrdering = blockOrdering;}
 
+    //! CHOLMOD_SIMPLICIAL, CHOLMOD_SUPERNODAL or CHOLMOD_AUTO (default) factorization.
+    //! The supernodal one runs on dense BLAS/LAPACK kernels and uses as many threads as the BLAS linked in
+    int supernodal() const { return _cholmodCommon.supernodal;}
+    void setSupernodal(int supernodal)
+    {
+      if (supernodal != _cholmodCommon.supernodal) {
+        freeFactor();
+        _patternChanged = false;
+      }
+      _cholmodCommon.supernodal = supernodal;
+    }
+
+    //! keep the ordering and symbolic factor across optimizations while the sparsity pattern does not change
+    bool reuseSymbolic() const { return _reuseSymbolic;}
+    void setReuseSymbolic(bool reuseSymbolic) { _reuseSymbolic = reuseSymbolic;}
+
     //! write a debug dump of the system matrix if it is not SPD in solve
     virtual bool writeDebug() const { return _writeDebug;}
     virtual void setWriteDebug(bool b) { _writeDebug = b;}
@@ -267,6 +286,51 @@ class LinearSolverCholmod : public LinearSolverCCS<MatrixType>
     MatrixStructure _matrixStructure;
     VectorXi _scalarPermutation, _blockPermutation;
     bool _writeDebug;
+    bool _reuseSymbolic;
+    bool _patternChanged;
+    std::vector<int> _symbolicP, _symbolicI; //!< pattern the symbolic factor was computed for
+
+    void freeFactor()
+    {
+      if (_cholmodFactor != 0) {
+        cholmod_free_factor(&_cholmodFactor, &_cholmodCommon);
+        _cholmodFactor = 0;
+      }
+    }
+
+    //! fill the matrix and make sure there is a symbolic factor matching its pattern
+    void prepareFactor(const SparseBlockMatrix<MatrixType>& A)
+    {
+      if (_cholmodFactor != 0 && _patternChanged) {
+        // the structure is rebuilt after init(), compare it with the one the factor was analyzed for
+        fillCholmodExt(A, false);
+        _patternChanged = false;
+        if (! samePattern())
+          freeFactor();
+      } else {
+        fillCholmodExt(A, _cholmodFactor != 0); // _cholmodFactor used as bool, if not existing will copy the whole structure, otherwise only the values
+      }
+
+      if (_cholmodFactor == 0) {
+        computeSymbolicDecomposition(A);
+        assert(_cholmodFactor != 0 && "Symbolic cholesky failed");
+        if (_reuseSymbolic && _cholmodFactor != 0) {
+          const int* p = (const int*)_cholmodSparse->p;
+          const int* i = (const int*)_cholmodSparse->i;
+          _symbolicP.assign(p, p + _cholmodSparse->ncol + 1);
+          _symbolicI.assign(i, i + p[_cholmodSparse->ncol]);
+        }
+      }
+    }
+
+    bool samePattern() const
+    {
+      const int* p = (const int*)_cholmodSparse->p;
+      const int* i = (const int*)_cholmodSparse->i;
+      if (_symbolicP.size() != _cholmodSparse->ncol + 1 || _symbolicP.back() != p[_cholmodSparse->ncol])
+        return false;
+      return std::equal(_symbolicP.begin(), _symbolicP.end(), p) && std::equal(_symbolicI.begin(), _symbolicI.end(), i);
+    }
 
     void computeSymbolicDecomposition(const SparseBlockMatrix<MatrixType>& A)
     {
@@ -204,47 +204,109 @@ namespace g2o {
   }
 
 
-//  void EdgeSim3ProjectXYZ::linearizeOplus()
-//  {
-//    VertexSim3Expmap * vj = static_cast<VertexSim3Expmap *>(_vertices[1]);
-//    Sim3 T = vj->estimate();
-
-//    VertexPointXYZ* vi = static_cast<VertexPointXYZ*>(_vertices[0]);
-//    Vector3d xyz = vi->estimate();
-//    Vector3d xyz_trans = T.map(xyz);
-
-//    double x = xyz_trans[0];
-//    double y = xyz_trans[1];
-//    double z = xyz_trans[2];
-//    double z_2 = z*z;
-
-//    Matrix<double,2,3> tmp;
-//    tmp(0,0) = _focal_length(0);
-//    tmp(0,1) = 0;
-//    tmp(0,2) = -x/z*_focal_length(0);
-
-//    tmp(1,0) = 0;
-//    tmp(1,1) = _focal_length(1);
-//    tmp(1,2) = -y/z*_focal_length(1);
-
-//    _jacobianOplusXi =  -1./z * tmp * T.rotation().toRotationMatrix();
-
-//    _jacobianOplusXj(0,0) =  x*y/z_2 * _focal_length(0);
-//    _jacobianOplusXj(0,1) = -(1+(x*x/z_2)) *_focal_length(0);
-//    _jacobianOplusXj(0,2) = y/z *_focal_length(0);
-//    _jacobianOplusXj(0,3) = -1./z *_focal_length(0);
-//    _jacobianOplusXj(0,4) = 0;
-//    _jacobianOplusXj(0,5) = x/z_2 *_focal_length(0);
-//    _jacobianOplusXj(0,6) = 0; // scale is ignored
-
-
-//    _jacobianOplusXj(1,0) = (1+y*y/z_2) *_focal_length(1);
-//    _jacobianOplusXj(1,1) = -x*y/z_2 *_focal_length(1);
-//    _jacobianOplusXj(1,2) = -x/z *_focal_length(1);
-//    _jacobianOplusXj(1,3) = 0;
-//    _jacobianOplusXj(1,4) = -1./z *_focal_length(1);
-//    _jacobianOplusXj(1,5) = y/z_2 *_focal_length(1);
-//    _jacobianOplusXj(1,6) = 0; // scale is ignored
-//  }
+  namespace {
+
+    // Adjoint of a Sim3 on the (omega, upsilon, sigma) tangent space: log(S*exp(x)*S^-1) = Ad(S)*x
+    Matrix7d adjoint(const Sim3& S)
+    {
+      const Matrix3d R = S.rotation().toRotationMatrix();
+      const Vector3d& t = S.translation();
+      Matrix7d Ad = Matrix7d::Zero();
+      Ad.block<3,3>(0,0) = R;
+      Ad.block<3,3>(3,0) = skew(t)*R;
+      Ad.block<3,3>(3,3) = S.scale()*R;
+      Ad.block<3,1>(3,6) = -t;
+      Ad(6,6) = 1;
+      return Ad;
+    }
+
+    // Inverse of the left Jacobian at e, up to second order: log(exp(x)*exp(e)) = e + Jinv*x
+    // The essential graph errors are small, the third order term is below the numeric differentiation error
+    Matrix7d leftJacobianInverse(const Vector7d& e)
+    {
+      const Vector3d omega = e.head<3>();
+      const Vector3d upsilon = e.segment<3>(3);
+      Matrix7d ad = Matrix7d::Zero();
+      ad.block<3,3>(0,0) = skew(omega);
+      ad.block<3,3>(3,0) = skew(upsilon);
+      ad.block<3,3>(3,3) = skew(omega) + e[6]*Matrix3d::Identity();
+      ad.block<3,1>(3,6) = -upsilon;
+      return Matrix7d::Identity() - 0.5*ad + (1./12.)*ad*ad;
+    }
+
+    // Jacobian of the pixel of a point in camera coordinates
+    Matrix<double,2,3> projectJacobian(const Vector3d& xyz, const Vector2d& focal)
+    {
+      const double invz = 1./xyz[2];
+      Matrix<double,2,3> J;
+      J << focal[0]*invz, 0, -focal[0]*xyz[0]*invz*invz,
+           0, focal[1]*invz, -focal[1]*xyz[1]*invz*invz;
+      return J;
+    }
+
+  } // end anonymous namespace
+
+  void EdgeSim3::linearizeOplus()
+  {
+    const VertexSim3Expmap* v1 = static_cast<const VertexSim3Expmap*>(_vertices[0]);
+    const VertexSim3Expmap* v2 = static_cast<const VertexSim3Expmap*>(_vertices[1]);
+
+    // both vertices are updated on the left, exp(d)*S
+    // C*exp(d1)*S1*S2^-1 = exp(Ad(C)*d1)*E and C*S1*(exp(d2)*S2)^-1 = exp(-Ad(E)*d2)*E
+    const Sim3 E = _measurement*v1->estimate()*v2->estimate().inverse();
+    const Matrix7d Jinv = leftJacobianInverse(E.log());
+
+    if (!v1->fixed()) {
+      _jacobianOplusXi = Jinv*adjoint(_measurement);
+      if (v1->_fix_scale)
+        _jacobianOplusXi.col(6).setZero();
+    }
+    if (!v2->fixed()) {
+      _jacobianOplusXj = -Jinv*adjoint(E);
+      if (v2->_fix_scale)
+        _jacobianOplusXj.col(6).setZero();
+    }
+  }
+
+  void EdgeSim3ProjectXYZ::linearizeOplus()
+  {
+    const VertexSim3Expmap* vj = static_cast<const VertexSim3Expmap*>(_vertices[1]);
+    const VertexSBAPointXYZ* vi = static_cast<const VertexSBAPointXYZ*>(_vertices[0]);
+    const Sim3& S = vj->estimate();
+
+    const Vector3d xyz = S.map(vi->estimate());
+    const Matrix<double,2,3> Jproj = -projectJacobian(xyz, vj->_focal_length1);
+
+    if (!vi->fixed())
+      _jacobianOplusXi = Jproj*S.scale()*S.rotation().toRotationMatrix();
+
+    if (!vj->fixed()) {
+      // exp(d)*S moves the point by omega x xyz + upsilon + sigma*xyz
+      _jacobianOplusXj.block<2,3>(0,0) = -Jproj*skew(xyz);
+      _jacobianOplusXj.block<2,3>(0,3) = Jproj;
+      _jacobianOplusXj.col(6) = vj->_fix_scale ? Vector2d::Zero() : Vector2d(Jproj*xyz);
+    }
+  }
+
+  void EdgeInverseSim3ProjectXYZ::linearizeOplus()
+  {
+    const VertexSim3Expmap* vj = static_cast<const VertexSim3Expmap*>(_vertices[1]);
+    const VertexSBAPointXYZ* vi = static_cast<const VertexSBAPointXYZ*>(_vertices[0]);
+    const Sim3 Sinv = vj->estimate().inverse();
+    const Vector3d& xyzw = vi->estimate();
+
+    const Vector3d xyz = Sinv.map(xyzw);
+    const Matrix<double,2,3> JprojA = -projectJacobian(xyz, vj->_focal_length2)*Sinv.scale()*Sinv.rotation().toRotationMatrix();
+
+    if (!vi->fixed())
+      _jacobianOplusXi = JprojA;
+
+    if (!vj->fixed()) {
+      // (exp(d)*S)^-1 = S^-1*exp(-d), the point is first moved by -(omega x xyzw + upsilon + sigma*xyzw)
+      _jacobianOplusXj.block<2,3>(0,0) = JprojA*skew(xyzw);
+      _jacobianOplusXj.block<2,3>(0,3) = -JprojA;
+      _jacobianOplusXj.col(6) = vj->_fix_scale ? Vector2d::Zero() : Vector2d(-JprojA*xyzw);
+    }
+  }
 
 } // end namespace
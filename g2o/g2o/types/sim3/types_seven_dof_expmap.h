@@ -113,6 +113,8 @@ namespace g2o {
       _error = error_.log();
     }
 
+    virtual void linearizeOplus();
+
     virtual double initialEstimatePossible(const OptimizableGraph::VertexSet& , OptimizableGraph::Vertex* ) { return 1.;}
     virtual void initialEstimate(const OptimizableGraph::VertexSet& from, OptimizableGraph::Vertex* /*to*/)
     {
@@ -144,7 +146,7 @@ class EdgeSim3ProjectXYZ : public  BaseBinaryEdge<2, Vector2d,  VertexSBAPointXY
       _error = obs-v1->cam_map1(project(v1->estimate().map(v2->estimate())));
     }
 
-   // virtual void linearizeOplus();
+    virtual void linearizeOplus();
 
 };
 
@@ -166,7 +168,7 @@ class EdgeInverseSim3ProjectXYZ : public  BaseBinaryEdge<2, Vector2d,  VertexSBA
       _error = obs-v1->cam_map2(project(v1->estimate().inverse().map(v2->estimate())));
     }
 
-   // virtual void linearizeOplus();
+    virtual void linearizeOplus();
 
 };
 
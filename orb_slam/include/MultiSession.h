@@ -0,0 +1,87 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef MULTISESSION_H
+#define MULTISESSION_H
+
+#include "System.h"
+#include "types/ORBVocabulary.h"
+#include "threads/SharedWorkers.h"
+
+#include <boost/thread.hpp>
+
+#include <string>
+#include <vector>
+
+
+namespace ORB_SLAM
+{
+
+// Several independent pipelines in one process, one per camera. Each session has its own settings, map database,
+// journal, tracking thread, topics and tf frames (under the namespace of its name), and saves its results to generated/<name>
+// They share the vocabulary, loaded once, the workers of the TaskPool and a few workers that run the Relocalization,
+// LocalMapping, LoopClosing and MapMerging steps of all of them (MultiSession.Workers in the settings of the first
+// session). Session.Priority in the settings of a session demotes its steps and pool tasks against those of the others.
+// The publishers of all the sessions are refreshed from one thread
+class MultiSession
+{
+public:
+    MultiSession(const std::string &strVocFile);
+    ~MultiSession();
+
+    // Before Init. Absolute paths, the maps of the session are restored from strMapFile and saved back (empty - not saved)
+    void AddSession(const std::string &strName, const std::string &strSettingsFile, const std::string &strMapFile="");
+
+    // Loads the vocabulary and initializes each session, false if one failed
+    bool Init();
+
+    // Starts the threads of each session and the shared workers, each tracking thread subscribes to the camera topic of its settings
+    void Start();
+
+    // Refreshes the publishers of all the sessions at the fastest camera rate, until ROS shuts down or Shutdown is called
+    void RunPublishers();
+
+    // Ends RunPublishers and the shared workers and shuts each session down, then saves the reports of the process
+    void Shutdown();
+
+    size_t Sessions();
+    System* GetSession(size_t i);
+
+protected:
+
+    std::string mstrVocFile;
+    ORBVocabulary mVocabulary;
+
+    SharedWorkers mWorkers;
+    int mnWorkers;
+
+    std::vector<std::string> mvNames;
+    std::vector<std::string> mvSettingsFiles;
+    std::vector<System*> mvpSessions;
+
+    boost::mutex mMutexShutdown;
+    bool mbShutdownRequested;
+    bool mbShutdown;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MULTISESSION_H
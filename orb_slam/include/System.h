@@ -0,0 +1,200 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYSTEM_H
+#define SYSTEM_H
+
+#include "types/ORBVocabulary.h"
+#include "types/MapDatabase.h"
+
+#include "util/FpsCounter.h"
+#include "util/TrajectoryRecorder.h"
+#include "util/KeyFrameRecorder.h"
+#include "util/ThreadConfig.h"
+
+#include <ros/ros.h>
+
+#include <opencv2/core/core.hpp>
+
+#include <boost/thread.hpp>
+
+#include <string>
+
+
+namespace ORB_SLAM
+{
+
+class Tracking;
+class Relocalization;
+class LocalMapping;
+class LoopClosing;
+class MapMerging;
+class MapRefiner;
+class FramePublisher;
+class MapPublisher;
+class StatsPublisher;
+class CloudPublisher;
+class MapLink;
+class MapJournal;
+class SharedWorkers;
+
+// The whole pipeline: vocabulary, map database, the five threads and the publishers
+// Shared by the standalone node and the nodelet. From your own capture loop (liborb_slam):
+// Init, StartMonocular, TrackMonocular for each image, Shutdown
+class System
+{
+public:
+    // Absolute paths, the maps are restored from strMapFile if it exists and saved back on Shutdown (empty - not saved)
+    System(const std::string &strVocFile, const std::string &strSettingsFile, const std::string &strMapFile="");
+    ~System();
+
+    // Session of a multi-session host (see MultiSession), called before Init. The vocabulary is the host's,
+    // the topics, services and tf frames are under strName and the results are saved to generated/strName
+    // Relocalization, LocalMapping, LoopClosing and MapMerging run on pWorkers instead of threads of their own
+    void SetSession(const std::string &strName, ORBVocabulary* pVocabulary, SharedWorkers* pWorkers=NULL);
+
+    // Loads the settings, the vocabulary and the maps and builds the pipeline, false on error
+    bool Init();
+
+    // Starts the threads. Without a node handle the tracking thread subscribes and spins the global queue,
+    // with one the images are received on it and its owner handles the callbacks
+    void Start(ros::NodeHandle* pNH=NULL);
+
+    // Starts the threads for TrackMonocular, no image topic is subscribed
+    // The publishers are not run, call RunPublishers from a thread of your own to get them
+    void StartMonocular();
+
+    // Tracks an image in the calling thread and returns the camera pose Tcw, empty if it was not tracked
+    // Color images are converted to grayscale. With a frame queue (Tracking.FrameQueueSize) tracking
+    // runs behind, and the pose returned is the one of the last frame tracked
+    cv::Mat TrackMonocular(const cv::Mat &im, const double &timestamp);
+
+    // Refreshes the publishers at the camera rate until ROS shuts down or Shutdown is called
+    void RunPublishers();
+
+    // Refreshes each publisher once, for a thread that runs the publishers of several sessions
+    // nEpochId: the registration of that thread with the EpochReclaimer. False once Shutdown was requested
+    bool RefreshPublishers(int nEpochId);
+
+    // Camera rate, from the settings
+    float GetFps();
+
+    // Ends RunPublishers, finishes the threads at their safe points, optionally runs a final global BA,
+    // and saves the trajectories, the tracking latency and the maps
+    // Threads not finished within System.ShutdownTimeout are left running, the results are still saved
+    void Shutdown();
+
+    Tracking* GetTracker();
+    MapDatabase* GetMapDatabase();
+
+    // Loads strVocFile into vocabulary, binary ones are mapped in place and YAML ones parsed, false on error
+    static bool LoadVocabulary(ORBVocabulary &vocabulary, const std::string &strVocFile);
+
+    // Reports of the whole process (tracking latency, allocations, trace and lock contention), saved to strDir
+    static void SaveProcessReports(const std::string &strDir);
+
+protected:
+
+    // Relocalization, LocalMapping, LoopClosing, MapMerging and MapRefiner, and the map link of a split deployment
+    // The robot runs Relocalization and LocalMapping, the server LocalMapping, LoopClosing, MapMerging and MapRefiner
+    void StartWorkers(ros::NodeHandle* pNH);
+
+    // Requests all the threads to finish and joins them, false if one did not finish in time
+    bool FinishThreads();
+
+    void SaveResults();
+
+    // Thread of a vocabulary loaded in the background (Vocabulary.Async), tells the map database when it is done
+    void LoadVocabularyAsync();
+
+    // Each tracked frame, placed with the current pose of its reference keyframe
+    // One file per map, as the keyframe trajectories
+    void SaveFrameTrajectories(const std::vector<TrajectoryRecorder::FramePose> &vPoses, const std::string &strDir);
+
+    std::string mstrVocFile;
+    std::string mstrSettingsFile;
+    std::string mstrMapFile;
+
+    // Name of the session in a multi-session host, empty when it runs alone
+    std::string mstrSession;
+    // Folder of the results, generated/ or generated/<session>/
+    std::string mstrGeneratedDir;
+    // Namespace of the topics and services
+    ros::NodeHandle mNH;
+    // Prefix of the tf frame ids, "<session>/" in a multi-session host
+    std::string mstrFramePrefix;
+    // Workers of the host that run the background threads, NULL when each has its own
+    SharedWorkers* mpSharedWorkers;
+
+    // Camera rate, at which the publishers are refreshed
+    float mfFps;
+
+    // Seconds to wait for each thread on shutdown, and iterations of the final global BA (0 - none)
+    float mfShutdownTimeout;
+    int mnFinalBAIterations;
+
+    FpsCounter mFpsCounter;
+    TrajectoryRecorder mTrajectoryRecorder;
+    KeyFrameRecorder mKeyFrameRecorder;
+    // Own vocabulary, unless the host shares its own
+    ORBVocabulary mVocabulary;
+    ORBVocabulary* mpVocabulary;
+    MapDatabase* mpMapDB;
+    // Log of the changes to the maps, the process-wide one unless the session has its own
+    MapJournal* mpJournal;
+
+    Tracking* mpTracker;
+    Relocalization* mpRelocalizer;
+    LocalMapping* mpLocalMapper;
+    LoopClosing* mpLoopCloser;
+    MapMerging* mpMapMerger;
+    MapRefiner* mpMapRefiner;
+
+    // Split deployment (System.Role), NULL when everything runs here
+    MapLink* mpMapLink;
+
+    FramePublisher* mpFramePublisher;
+    MapPublisher* mpMapPublisher;
+    StatsPublisher* mpStatsPublisher;
+    CloudPublisher* mpCloudPublisher;
+
+    std::vector<boost::thread*> mvpThreads;
+    // Cores and priorities of the worker threads, applied by each thread as it starts
+    ThreadConfig mRelocalizationConfig;
+    ThreadConfig mLocalMappingConfig;
+    ThreadConfig mLoopClosingConfig;
+    ThreadConfig mMapMergingConfig;
+    // Tracking subscribed on a node handle, it is unsubscribed on shutdown
+    bool mbSubscribed;
+    // All the threads finished, the pipeline can be deleted
+    bool mbFinished;
+    // Only started with a node handle, the node runs the publishers on its main thread
+    boost::thread* mpPublisherThread;
+    // Loads the vocabulary while tracking starts, NULL when it was loaded by Init
+    boost::thread* mpVocabularyThread;
+
+    boost::mutex mMutexShutdown;
+    bool mbShutdownRequested;
+    bool mbShutdown;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SYSTEM_H
@@ -0,0 +1,81 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CLOUDPUBLISHER_H
+#define CLOUDPUBLISHER_H
+
+#include "types/MapDatabase.h"
+
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <map>
+#include <vector>
+
+
+namespace ORB_SLAM
+{
+
+// Publishes the points of every map as one sensor_msgs/PointCloud2 for downstream consumers
+// Each point is packed as float32 x, y, z and uint32 map id, observations and point id
+class CloudPublisher
+{
+public:
+    // strFramePrefix: prefix of the tf frame ids, "<session>/" in a multi-session host
+    CloudPublisher(MapDatabase* pMap, float fRate, const ros::NodeHandle &nh=ros::NodeHandle(), const std::string &strFramePrefix="");
+
+    // Publishes at most at the rate, and only with subscribers
+    void Refresh();
+
+    // Forgets the packed maps
+    void Reset();
+
+protected:
+
+    void PublishCloud();
+
+    // Packs the snapshot of a map, done again only when its version changes
+    // Returns the version of the snapshot packed
+    unsigned long PackMap(Map* pMap, std::vector<unsigned char> &data);
+
+    struct PackedMap
+    {
+        unsigned long nVersion;
+        std::vector<unsigned char> data;
+    };
+
+    MapDatabase* mpMap;
+
+    ros::NodeHandle mNH;
+    ros::Publisher mCloudPub;
+
+    float mfPeriod;
+    ros::WallTime mLastPublished;
+
+    // Keyed by Map::mnId, maps that left the database are dropped
+    std::map<unsigned long, PackedMap> mPackedMaps;
+
+    // Reused between publications
+    sensor_msgs::PointCloud2 mCloud;
+};
+
+} //namespace ORB_SLAM
+
+#endif // CLOUDPUBLISHER_H
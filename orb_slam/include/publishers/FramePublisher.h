@@ -31,11 +31,14 @@
 #include "util/FpsCounter.h"
 
 #include <ros/ros.h>
+#include <image_transport/image_transport.h>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/features2d/features2d.hpp>
 
 #include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/atomic.hpp>
 
 
 namespace ORB_SLAM
@@ -43,46 +46,104 @@ namespace ORB_SLAM
 
 class Tracking;
 
+// Debug view of the tracking, drawn and published by its own thread
+// Published through image_transport, so ORB_SLAM/Frame/compressed carries it as JPEG
 class FramePublisher
 {
 public:
-    FramePublisher(FpsCounter* pfps);    
-
+    // fScale: the view is drawn on the image resized by that factor (0 or 1 - full resolution)
+    // nJpegQuality: quality of the compressed transport from 1 to 100 (0 - plugin default)
+    // nh: namespace of the topic, the one of a session in a multi-session host
+    FramePublisher(FpsCounter* pfps, float fScale=1, int nJpegQuality=0, const ros::NodeHandle &nh=ros::NodeHandle());
+    ~FramePublisher();
+
+    // Captures the tracked frame, nothing is copied without subscribers or above the rate cap
+    // Never blocks Tracking, the capture is dropped if the publisher is taking the last one
     void Update(Tracking *pTracker);
 
+    // Hands the last capture to the drawing thread, with the map counts of the text bar
     void Refresh();
     
     void Reset();
 
     void SetMapDB(MapDatabase *pMap);
 
+    // Frames captured per second at most (0 - every tracked frame)
+    void SetMaxRate(float fMaxRate);
+
 protected:
 
+    // State of the tracked frame needed to draw it
+    // It holds no map object, the drawing thread never touches the maps
+    struct Capture
+    {
+        Capture();
+        void swap(Capture &other);
+        void clear();
+
+        // Shared with the tracked frame, DrawFrame copies it before drawing
+        cv::Mat im;
+        boost::shared_ptr<const void> pImOwner;
+        vector<cv::KeyPoint> vCurrentKeys;
+        // Matched to a good map point and not an outlier when captured
+        vector<bool> vbTracked;
+        vector<cv::KeyPoint> vIniKeys;
+        vector<int> vIniMatches;
+        int nState;
+    };
+
+    // Counts of the maps shown in the text bar, read by Refresh
+    struct MapInfo
+    {
+        MapInfo();
+
+        int nKFs;
+        int nMPs;
+        int nMaps;
+        int nAllMaps;
+        int nMapId;
+    };
+
+    // Drawing thread
+    void Run();
+
     cv::Mat DrawFrame();
 
     void PublishFrame();
 
     void DrawTextInfo(cv::Mat &im, int nState, cv::Mat &imText);
 
-    cv::Mat mIm;
-    vector<cv::KeyPoint> mvCurrentKeys;
-
-    vector<bool> mvbOutliers;
+    // Double buffer: Tracking fills the back one and swaps it in, the drawing thread swaps it out to draw
+    // The vectors keep their capacity across swaps, so steady captures do not allocate
+    Capture mBack;  // Tracking only
+    Capture mFront; // Under mMutex
+    Capture mDraw;  // Drawing thread only
+    MapInfo mFrontInfo; // Under mMutex
+    MapInfo mDrawInfo;  // Drawing thread only
 
-    vector<MapPoint*> mvpMatchedMapPoints;
-    vector<MapPoint*> lastFrameMapPoints;
-    
     int mnTracked;
-    vector<cv::KeyPoint> mvIniKeys;
-    vector<int> mvIniMatches;
+
+    float mfScale;
 
     ros::NodeHandle mNH;
-    ros::Publisher mImagePub;
+    image_transport::ImageTransport mImageTransport;
+    image_transport::Publisher mImagePub;
 
-    int mState;
+    // Refreshed by the publisher, read by Tracking to skip the capture
+    boost::atomic<bool> mbSubscribed;
+
+    // Rate cap, the next capture time is only used by Tracking
+    double mdMinPeriod;
+    double mdNextCapture;
 
     bool mbUpdated;
 
+    // Set by Refresh for the drawing thread, under mMutex
+    bool mbDrawRequested;
+    bool mbFinishRequested;
+    boost::condition_variable mCondDraw;
+    boost::thread* mptDraw;
+
     MapDatabase* mpMap;
 
     boost::mutex mMutex;
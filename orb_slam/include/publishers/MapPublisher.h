@@ -29,6 +29,10 @@
 #include "types/MapDatabase.h"
 #include "types/MapPoint.h"
 #include "types/KeyFrame.h"
+#include "types/MapSnapshot.h"
+
+#include <map>
+#include <stdint.h>
 
 namespace ORB_SLAM
 {
@@ -36,13 +40,27 @@ namespace ORB_SLAM
 class MapPublisher
 {
 public:
-    MapPublisher(MapDatabase* pMap);
+    // nh: namespace of the topics, the one of a session in a multi-session host
+    // strFramePrefix: prefix of the tf frame ids, "<session>/" in a multi-session host
+    MapPublisher(MapDatabase* pMap, const ros::NodeHandle &nh=ros::NodeHandle(), const string &strFramePrefix="");
 
     MapDatabase* mpMap;
 
     void Refresh();
     void PublishMapPoints();
     void PublishKeyFrames();
+
+    // Delta publishing (0 - disabled, every update republishes all the maps)
+    // Points and keyframes are grouped by id in chunks of that size, one marker per chunk
+    // and map, and only the chunks that changed since they were last sent are published
+    void SetChunkSize(int nChunkSize);
+
+    // Level of detail (0 - no limit), set before the first refresh
+    // nMaxKeyFrames, nMaxPoints: drawing budget per map, a stable subset by id is drawn beyond it
+    // nMinObservations: points seen by fewer keyframes are left out
+    // nMaxCovisibilityEdges: strongest covisibility edges drawn per keyframe
+    // fDetailRadius: everything is drawn within that distance of the camera, in the current map
+    void SetDetail(int nMaxKeyFrames, int nMaxPoints, int nMinObservations, int nMaxCovisibilityEdges, float fDetailRadius);
     void PublishCurrentCamera(const cv::Mat &Tcw);
     void SetCurrentCameraPose(const cv::Mat &Tcw);
     
@@ -50,6 +68,36 @@ public:
 
 private:
 
+    // What is drawn of a map, computed from its snapshot on each update
+    // The strides are powers of two, so the subset drawn only shrinks when a map doubles
+    // and the chunks that are not touched keep their signature
+    struct DetailLevel
+    {
+        long unsigned int nKeyFrameStride;
+        long unsigned int nPointStride;
+        // Full detail region, none if the radius is 0
+        float center[3];
+        float fRadius2;
+    };
+
+    DetailLevel ComputeDetail(const MapSnapshot &snapshot, bool bCurrent);
+    bool isKeyFrameDrawn(const DetailLevel &detail, const MapSnapshot::KeyFrameState &kf);
+    bool isPointDrawn(const DetailLevel &detail, const MapSnapshot::MapPointState &mp);
+    // Closest drawn keyframe up the spanning tree, the spanning tree edges skip the ones left out
+    const MapSnapshot::KeyFrameState* DrawnParent(const DetailLevel &detail, const MapSnapshot &snapshot,
+                                                  const MapSnapshot::KeyFrameState &kf);
+
+    // Signature of each chunk last sent, by kind and chunk index
+    typedef std::map<std::pair<int,long unsigned int>, uint64_t> ChunkSignatures;
+    typedef std::map<std::pair<int,long unsigned int>, visualization_msgs::Marker> ChunkMarkers;
+
+    void PublishDelta();
+    // Chunk markers and signatures of a map, namespaces are prefixed when published to the array
+    void BuildChunks(const MapSnapshot &snapshot, const DetailLevel &detail, ChunkMarkers &markers, ChunkSignatures &signatures);
+    // Appends the changed chunks, and deletions of the chunks that are gone, then remembers what was sent
+    void DiffChunks(const ChunkMarkers &markers, const ChunkSignatures &signatures, const std::string &prefix,
+                    ChunkSignatures &sent, std::vector<visualization_msgs::Marker> &out);
+
     cv::Mat GetCurrentCameraPose();
     bool isCamUpdated();
     void ResetCamFlag();
@@ -82,6 +130,21 @@ private:
     float fCameraSize;
     float fPointSize;
 
+    // Delta publishing, the chunks sent for each map (by Map::mnId) and for the current map topic
+    int mnChunkSize;
+    std::map<unsigned long, ChunkSignatures> mSentChunks;
+    ChunkSignatures mSentCurrentChunks;
+
+    // Level of detail
+    int mnMaxKeyFrames;
+    int mnMaxPoints;
+    int mnMinObservations;
+    int mnMaxCovisibilityEdges;
+    float mfDetailRadius;
+    // Camera center snapped to a grid of half the detail radius, the region moves by whole cells
+    float mDetailCenter[3];
+    bool mbDetailCenter;
+
     cv::Mat mCameraPose;
     bool mbCameraUpdated;
 
@@ -0,0 +1,109 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATSPUBLISHER_H
+#define STATSPUBLISHER_H
+
+#include "util/LatencyStats.h"
+#include "util/Metrics.h"
+
+#include <ros/ros.h>
+#include <std_srvs/Trigger.h>
+
+
+namespace ORB_SLAM
+{
+
+class LocalMapping;
+class LoopClosing;
+class MapMerging;
+class MapDatabase;
+
+// Publishes the per-stage tracking latency and the keyframe queues on the ROS diagnostics topic
+// With a map database, also the memory held by each category of map data, per map and in total,
+// periodically and on request through the ORB_SLAM/MemoryReport service (std_srvs/Trigger)
+// With tracing, the ORB_SLAM/DumpTrace service (std_srvs/Trigger) saves the trace of all the threads
+// The operational counters and gauges can be pushed to statsd and written for the Prometheus textfile collector
+class StatsPublisher
+{
+public:
+    StatsPublisher(float fps, float period=1.0f, const ros::NodeHandle &nh=ros::NodeHandle());
+    ~StatsPublisher();
+
+    // Threads whose keyframe queues are reported
+    void SetThreads(LocalMapping* pLocalMapper, LoopClosing* pLoopCloser, MapMerging* pMapMerger);
+
+    // Maps whose memory is reported, every fMemoryPeriod seconds (0 for on request only)
+    void SetMapDatabase(MapDatabase* pMapDB, float fMemoryPeriod);
+
+    // Saves the trace to filename on request
+    void SetTraceFile(const std::string &filename);
+
+    // Exports the metrics once per period, to a statsd daemon if host is not empty
+    // and to a Prometheus text file if filename is not empty
+    void SetMetricsExport(const std::string &host, int port, const std::string &prefix, const std::string &filename);
+
+    // Publishes the samples gathered since the last publication, once per period
+    void Refresh();
+
+protected:
+
+    void PublishStats();
+
+    // Walks all the maps, so it runs far less often than the latency stats
+    // The calling thread must be registered with the EpochReclaimer
+    void PublishMemory(std::string &report);
+
+    // Counters since the last export and the gauges of the maps and queues
+    void ExportMetrics();
+
+    bool MemoryReportService(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res);
+
+    bool DumpTraceService(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res);
+
+    ros::NodeHandle mNH;
+    ros::Publisher mDiagnosticsPub;
+
+    // Time between frames, the budget of the whole tracking
+    float mfFramePeriod;
+
+    float mfPeriod;
+    ros::WallTime mLastPublished;
+
+    MapDatabase* mpMapDB;
+    float mfMemoryPeriod;
+    ros::WallTime mLastMemoryPublished;
+    ros::ServiceServer mMemoryReportSrv;
+
+    std::string mstrTraceFile;
+    ros::ServiceServer mDumpTraceSrv;
+
+    StatsdClient* mpStatsd;
+    std::string mstrPrometheusFile;
+    boost::uint64_t mvLastCounters[Metrics::N_COUNTERS];
+
+    LocalMapping* mpLocalMapper;
+    LoopClosing* mpLoopCloser;
+    MapMerging* mpMapMerger;
+};
+
+} //namespace ORB_SLAM
+
+#endif // STATSPUBLISHER_H
@@ -25,13 +25,19 @@
 #include "types/Map.h"
 #include "types/MapDatabase.h"
 #include "types/KeyFrameDatabase.h"
+#include "types/MapPointFusion.h"
 
 #include "threads/OrbThread.h"
 #include "threads/LoopClosing.h"
 #include "threads/MapMerging.h"
 #include "threads/Tracking.h"
 
+#include "util/SpscQueue.h"
+#include "util/LocalBundleAdjuster.h"
+#include "util/MapSparsifier.h"
+
 #include <boost/thread.hpp>
+#include <ros/time.h>
 
 namespace ORB_SLAM
 {
@@ -41,11 +47,17 @@ class LoopClosing;
 class MapMerging;
 class MapDatabase;
 class Map;
+class MapLink;
+class KeyFrameRecorder;
 
 class LocalMapping: public OrbThread
 {
 public:
-    LocalMapping(MapDatabase* pMap);
+    // nMaxBatch: keyframes processed before a local BA that new keyframes do not interrupt,
+    // Tracking may insert keyframes while it runs (0 - the BA waits for an empty queue)
+    // fStageBudget: seconds for triangulation and for fusion while keyframes are waiting (0 - unbounded)
+    LocalMapping(MapDatabase* pMap, int nThreads = 1, int nMaxBatch = 0, float fStageBudget = 0);
+    ~LocalMapping();
 
     void SetLoopCloser(LoopClosing* pLoopCloser);
     
@@ -53,12 +65,44 @@ public:
 
     void SetTracker(Tracking* pTracker);
 
+    // Split deployment: the robot sends its keyframes and applies the updates of the server,
+    // the server maps the keyframes received
+    void SetMapLink(MapLink* pMapLink);
+
+    // Records the keyframes inserted, for a replay of the back-end (NULL - none)
+    void SetKeyFrameRecorder(KeyFrameRecorder* pRecorder);
+
+    // Server: keyframes received for maps owned by different workers are mapped concurrently (1 - one at a time)
+    // Each map is owned by one worker, by its id, so the workers never touch the same map. Maps are only
+    // merged while Local Mapping is stopped, the workers drop what they kept of the maps they lost on release
+    // Set before the thread runs
+    void SetWorkers(int nWorkers);
+
     void Run();
 
     void InsertKeyFrame(KeyFrame* pKF);
 
     bool AcceptKeyFrames();
     void SetAcceptKeyFrames(bool flag);
+
+    // Keyframes waiting to be processed
+    int KeyframesInQueue();
+    int KeyframeQueueHighWater();
+
+    // Seconds until the keyframes waiting and the one being mapped are done, and to map one more keyframe,
+    // predicted from the smoothed time of the recent keyframes and their local BA (-1 - unknown or overdue)
+    float PredictIdleTime();
+    float PredictKeyFrameTime();
+
+    // Memory held by the graph of the incremental local BA
+    size_t LocalBAMemoryBytes();
+
+    // Budget of keyframes and points per cell of space, enforced while idle every SPARSIFY_PERIOD keyframes
+    void SetSparsification(float fCellSize, int nMaxKeyFrames, int nMaxPoints);
+
+    // Keyframes from one local BA of the whole window to the next, the ones in between only relinearize what changed
+    // (1 - always the whole window)
+    void SetLocalBAFullPeriod(int nPeriod);
     
     // Override super, clear local vars
     void Release();
@@ -67,33 +111,133 @@ public:
     void InterruptBA();
 
 protected:
+    // Override super, drops the local BA window of the previous map
+    void SwitchMap();
+
+    // Override super, recent points may have been culled by other threads
+    void PurgeBadPointers();
+
+    // Override super, processes one queued keyframe
+    bool Step();
+    void Released();
 
     bool CheckNewKeyFrames();
+
+    // Server: the worker owning a map, this one for the first
+    LocalMapping* GetWorker(Map* pMap);
+
+    // Server: receives keyframes until one belongs to a worker already given one, which waits for the next step
+    // Several keyframes are mapped concurrently, a single one is queued as usual
+    void ReceiveKeyFrames();
+
+    // Server: maps the keyframes, each by the worker owning its map, then hands them on in order
+    void MapConcurrently(const std::vector<KeyFrame*> &vpKFs);
+
+    // Worker: the stages of a keyframe up to keyframe culling, with an uninterrupted local BA
+    void MapKeyFrame(KeyFrame* pKF);
+
     void ProcessNewKeyFrame();
     void CreateNewMapPoints();
 
+    // A point triangulated between the current keyframe and a neighbor, not yet in the map
+    struct TriangulatedPoint
+    {
+        size_t idx1;
+        size_t idx2;
+        Eigen::Vector3f x3D;
+    };
+
+    // Matches the current keyframe with one neighbor and triangulates, the map is not modified
+    void TriangulateNeighbor(KeyFrame* pKF2, std::vector<TriangulatedPoint> &vPoints);
+
+    // Takes the next free neighbor until all are triangulated
+    void TriangulateNeighbors();
+
+    // Creates the points of one neighbor, keypoints matched meanwhile are skipped
+    void AddTriangulatedPoints(KeyFrame* pKF2, const std::vector<TriangulatedPoint> &vPoints);
+
     void MapPointCulling();
     void SearchInNeighbors();
 
+    // Takes the next free target keyframe until all are searched, the map is not modified
+    void SearchFuseTargets();
+
+    // Adds or replaces the matches found in one keyframe, points fused meanwhile are skipped
+    void ApplyFuseMatches(KeyFrame* pKF, const std::vector<MapPoint*> &vpMatched, MapPointFusion &fusion);
+
     void KeyFrameCulling();
 
+    // Runs the sparsifier if it is due and no keyframe is waiting, a new keyframe interrupts it
+    void Sparsify();
+
+    // Stage time budget, neighbors are not taken any more once it expires with keyframes waiting
+    void StartStage();
+    bool StageExpired();
+
     cv::Mat ComputeF12(KeyFrame* &pKF1, KeyFrame* &pKF2);
 
     cv::Mat SkewSymmetricMatrix(const cv::Mat &v);
 
-    std::list<KeyFrame*> mlNewKeyFrames;
+    // Keyframes from Tracking
+    SpscQueue<KeyFrame*> mqNewKeyFrames;
 
     KeyFrame* mpCurrentKeyFrame;
 
     std::list<MapPoint*> mlpRecentAddedMapPoints;
 
-    boost::mutex mMutexNewKFs;    
+    // Local BA graph kept between keyframes
+    LocalBundleAdjuster mLocalBA;
+
+    // Neighbors matched and triangulated concurrently in CreateNewMapPoints, and searched for fusion in SearchInNeighbors
+    int mnThreads;
+    const std::vector<KeyFrame*>* mpvpNeighKFs;
+    std::vector<std::vector<TriangulatedPoint> > mvvTriangulated;
+    const std::vector<MapPoint*>* mpvpFuseCandidates;
+    std::vector<std::vector<MapPoint*> > mvvFuseMatches;
+    int mnNextNeighbor;
+    boost::mutex mMutexNeighbor;
+
+
+    // Keyframes processed since the last local BA, the BA is forced once there are nMaxBatch
+    int mnMaxBatch;
+    int mnBatched;
+    bool mbForcedBA;
+
+    float mfStageBudget;
+    ros::WallTime mStageDeadline;
 
     bool mbAbortBA;
 
+    // Stage of the keyframe being mapped and when it started, with the smoothed time of each stage
+    // The BA time is only measured when it was not interrupted
+    enum eStage{
+        IDLE=0,
+        PROCESSING,
+        OPTIMIZING
+    };
+    static const float TIME_SMOOTHING;
+    void SetStage(eStage stage);
+    eStage mStage;
+    ros::WallTime mStageStart;
+    float mfProcessTime;
+    float mfBATime;
+    boost::mutex mMutexStage;
+
+    static const int SPARSIFY_PERIOD;
+    MapSparsifier mSparsifier;
+    int mnSinceSparsify;
+
     bool mbAcceptKeyFrames;
     boost::mutex mMutexAccept;
 
+    MapLink* mpMapLink;
+
+    KeyFrameRecorder* mpKeyFrameRecorder;
+
+    // Server: the other workers, never run as threads, and the keyframe received for a busy worker
+    std::vector<LocalMapping*> mvpWorkers;
+    KeyFrame* mpDeferredKF;
+
 };
 
 } //namespace ORB_SLAM
@@ -26,11 +26,18 @@
 #include "types/MapDatabase.h"
 #include "types/ORBVocabulary.h"
 #include "types/KeyFrameDatabase.h"
+#include "types/MapPointFusion.h"
 
 #include "threads/OrbThread.h"
 #include "threads/LocalMapping.h"
 #include "threads/Tracking.h"
 
+#include "util/SpscQueue.h"
+#include "util/Sim3Verifier.h"
+#include "util/CovisibilityGroup.h"
+#include "util/MapContexts.h"
+#include "util/LoopScheduler.h"
+
 #include <boost/thread.hpp>
 #include <g2o/types/sim3/types_seven_dof_expmap.h>
 
@@ -40,18 +47,22 @@ namespace ORB_SLAM
 class Tracking;
 class LocalMapping;
 class KeyFrameDatabase;
+struct BundleAdjustmentResult;
 
 class LoopClosing : public OrbThread 
 {
 public:
 
-    typedef pair<set<KeyFrame*>,int> ConsistentGroup;    
+    typedef pair<CovisibilityGroup,int> ConsistentGroup;    
     typedef map<KeyFrame*,g2o::Sim3,std::less<KeyFrame*>,
         Eigen::aligned_allocator<std::pair<const KeyFrame*, g2o::Sim3> > > KeyFrameAndPose;
 
 public:
 
-    LoopClosing(MapDatabase *pMap);
+    // bConcurrentCorrection: Local Mapping only stops to fuse the loop and to apply the essential graph,
+    // it keeps running while the graph is optimized
+    // nGlobalBAIterations: iterations of a global BA run on a background thread after each loop (0 - none)
+    LoopClosing(MapDatabase *pMap, int nThreads = 1, bool bConcurrentCorrection = false, int nGlobalBAIterations = 0);
     
     void Run();
     
@@ -61,10 +72,38 @@ public:
 
     void InsertKeyFrame(KeyFrame *pKF);
 
+    // Keyframes waiting to be processed
+    int KeyframesInQueue();
+    int KeyframeQueueHighWater();
+
+    // Coalescing and throttling of the queries, see LoopScheduler (0 - every keyframe is queried)
+    // Set before the thread runs
+    void SetScheduling(float fMaxLatency, float fMaxDuty);
+
+    // Writes the results of a global BA of a map that is not tracked, run by another thread (MapRefiner)
+    // Serialized with the global BA of the loops. Discarded, returning false, if the map was erased or became current
+    bool CommitGlobalBA(Map* pMap, BundleAdjustmentResult &result);
+
+    // Interrupts the global BA, its results are discarded. Run does it when it returns
+    void StopGlobalBA();
+
 protected:
+    // Override super, parks the detector state of the previous map
+    void SwitchMap();
+
+    // Override super, the loop points are only valid within one iteration
+    void PurgeBadPointers();
+
+    // Override super, looks for a loop at one queued keyframe
+    bool Step();
 
     bool CheckNewKeyFrames();
 
+    // Takes the queued keyframes, the one to query is set as the current keyframe
+    // The ones the scheduler skips are handled as keyframes too close to the last loop
+    bool NextKeyFrame();
+    void SkipKeyFrame(KeyFrame* pKF);
+
     bool DetectLoop();
 
     bool ComputeSim3();
@@ -73,9 +112,24 @@ protected:
 
     void CorrectLoop();
 
-    std::list<KeyFrame*> mlpLoopKeyFrameQueue;
-
-    boost::mutex mMutexLoopQueue;
+    // Parallel passes of the correction, worker nWorker takes every nWorkers-th corrected keyframe
+    // Each MapPoint is corrected by the first keyframe that sees it, assigned before the pass
+    void CorrectMapPoints(int nWorker, int nWorkers);
+    // The search only reads the map, the matches are applied afterwards in the keyframe order
+    void SearchFuseTargets(int nWorker, int nWorkers);
+    void ApplyFuseMatches(KeyFrame* pKF, const std::vector<MapPoint*> &vpMatched, MapPointFusion &fusion);
+
+    // Global BA of the map of the last loop, on its own thread at idle priority (in the caller when synchronous)
+    // Its results are applied with Local Mapping stopped, keyframes and points added meanwhile
+    // follow their parent and reference keyframe in the spanning tree
+    void StartGlobalBA(Map* pMap);
+    void RunGlobalBA(Map* pMap);
+    // Applies the results with Map Merging and Local Mapping stopped, mMutexGBA must be held
+    // Threads already stopped by someone else, such as the tracking while lost, are left stopped
+    void ApplyGlobalBA(Map* pMap, BundleAdjustmentResult &result);
+
+    // Keyframes from Local Mapping
+    SpscQueue<KeyFrame*> mqLoopKeyFrameQueue;
 
     std::vector<float> mvfLevelSigmaSquare;
 
@@ -85,16 +139,38 @@ protected:
     // Loop detector variables
     KeyFrame* mpCurrentKF;
     KeyFrame* mpMatchedKF;
-    std::vector<ConsistentGroup> mvConsistentGroups;
     std::vector<KeyFrame*> mvpEnoughConsistentCandidates;
     std::vector<KeyFrame*> mvpCurrentConnectedKFs;
     std::vector<MapPoint*> mvpCurrentMatchedPoints;
     std::vector<MapPoint*> mvpLoopMapPoints;
+
+    // Verification of the consistent candidates
+    Sim3Verifier mSim3Verifier;
+
+    LoopScheduler mScheduler;
+
+    // Shared with the workers of the correction
+    int mnThreads;
+    std::vector<KeyFrame*> mvpCorrectedKFs;
+    const KeyFrameAndPose* mpCorrectedSim3;
+    const KeyFrameAndPose* mpNonCorrectedSim3;
+    std::vector<std::vector<MapPoint*> > mvvpCorrectedPoints;
+    std::vector<std::vector<MapPoint*> > mvvFuseMatches;
+
     cv::Mat mScw;
     g2o::Sim3 mg2oScw;
     double mScale_cw;
 
-    long unsigned int mLastLoopKFid;
+    // Consistency groups and last loop of the map of the queried keyframe, the other maps are parked
+    LoopDetectorState mDetectorState;
+    MapContexts<LoopDetectorState> mParkedStates;
+
+    bool mbConcurrentCorrection;
+
+    int mnGlobalBAIterations;
+    boost::thread* mpThreadGBA;
+    bool mbStopGBA;
+    boost::mutex mMutexGBA;
 
 };
 
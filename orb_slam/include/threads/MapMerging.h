@@ -29,6 +29,11 @@
 #include "threads/LoopClosing.h"
 #include "threads/Tracking.h"
 
+#include "util/SpscQueue.h"
+#include "util/Sim3Verifier.h"
+#include "util/CovisibilityGroup.h"
+#include "util/MapContexts.h"
+
 #include <boost/thread.hpp>
 #include <g2o/types/sim3/types_seven_dof_expmap.h>
 
@@ -44,53 +49,106 @@ class MapMerging: public OrbThread
 {
 public:
 
-    typedef pair<set<KeyFrame*>,int> ConsistentGroup;    
+    typedef pair<CovisibilityGroup,int> ConsistentGroup;    
     typedef map<KeyFrame*,g2o::Sim3,std::less<KeyFrame*>,
         Eigen::aligned_allocator<std::pair<const KeyFrame*, g2o::Sim3> > > KeyFrameAndPose;
     
 public:
-    MapMerging(MapDatabase *mapDB);
+    MapMerging(MapDatabase *mapDB, int nThreads = 1);
     
     void Run();
     
-    void InsertKeyFrame(KeyFrame *pKF);
+    // The candidates in the other maps of a keyframe queried by Loop Closing, which runs one query for both
+    // The keyframes are handed over even without candidates, to break the consistency of the groups
+    void InsertCandidates(KeyFrame *pKF, const std::vector<KeyFrame*> &vpCandidates);
+
+    // Keyframes waiting to be processed
+    int KeyframesInQueue();
+    int KeyframeQueueHighWater();
     
     void Release();
     
     void ResetIfRequested();
   
 protected:
+    // Override super, parks the detector state of the previous map
+    void SwitchMap();
+
+    // Override super, the loop points are only valid within one iteration
+    void PurgeBadPointers();
+
+    // Override super, looks for a merge at one queued keyframe
+    bool Step();
 
     bool CheckNewKeyFrames();
 
+    // Takes the next queued keyframe as the current keyframe, with its candidates
+    bool NextKeyFrame();
+
     bool DetectLoop();
 
     bool ComputeSim3();
 
-    void CorrectLoop();
-    
-    void SearchAndFuse(KeyFrameAndPose &CorrectedPosesMap);
+    // Transform the matched map into the current map coordinates and search duplicated points
+    // Works from a snapshot while the other threads keep running, nothing is written to the maps
+    bool PrepareMerge();
+
+    // Apply the prepared merge while Local Mapping is stopped, false if the maps changed meanwhile
+    bool CommitMerge();
 
-    std::list<KeyFrame*> mlpLoopKeyFrameQueue;
-    boost::mutex mMutexLoopQueue;
+    void SearchAndFuse();
+
+    // Worker nWorker searches every nWorkers-th keyframe connected to the current one
+    void SearchFuseTargets(int nWorker, int nWorkers);
+
+    // Keyframe queried by Loop Closing and its candidates in the other maps
+    struct MergeQuery
+    {
+        KeyFrame* pKF;
+        std::vector<KeyFrame*> vpCandidates;
+    };
+
+    // Queries from Loop Closing
+    SpscQueue<MergeQuery> mqLoopKeyFrameQueue;
     
     // Loop detector parameters
     float mnCovisibilityConsistencyTh;
 
     // Loop detector variables
     KeyFrame* mpCurrentKF;
+    std::vector<KeyFrame*> mvpQueryCandidates;
     KeyFrame* mpMatchedKF;
-    std::vector<ConsistentGroup> mvConsistentGroups;
     std::vector<KeyFrame*> mvpEnoughConsistentCandidates;
     std::vector<KeyFrame*> mvpCurrentConnectedKFs;
     std::vector<MapPoint*> mvpCurrentMatchedPoints;
     std::vector<MapPoint*> mvpLoopMapPoints;
+
+    // Verification of the consistent candidates
+    Sim3Verifier mSim3Verifier;
+
+    int mnThreads;
+    // Matches of each connected keyframe, filled by the workers
+    std::vector<std::vector<MapPoint*> > mvvFuseMatches;
+
+    // Maps of the candidates being verified and merged, kept resident
+    std::vector<Map*> mvpPinnedMaps;
+
     cv::Mat mScw;
     g2o::Sim3 mpMatchedgScm;
     g2o::Sim3 mg2oScw;
     double mScale_cw;
 
-    long unsigned int mLastLoopKFid;
+    // Consistency groups and last loop of the map of the queried keyframe, the other maps are parked
+    LoopDetectorState mDetectorState;
+    MapContexts<LoopDetectorState> mParkedStates;
+
+    // Prepared merge, the matched map (w2) moves into the current one (w1)
+    Map* mpMergeSource;
+    Map* mpMergeTarget;
+    g2o::Sim3 mg2oSw1w2;
+    std::map<KeyFrame*,cv::Mat> mMergedPoses;
+    std::map<MapPoint*,cv::Mat> mMergedPositions;
+    std::vector<std::pair<KeyFrame*,std::vector<MapPoint*> > > mvFusedMatches;
 
 };
 } //namespace ORB_SLAM
@@ -0,0 +1,92 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef MAPREFINER_H
+#define MAPREFINER_H
+
+#include "threads/OrbThread.h"
+
+#include <ros/ros.h>
+#include <std_srvs/Trigger.h>
+
+#include <boost/thread.hpp>
+
+#include <map>
+#include <vector>
+
+namespace ORB_SLAM
+{
+
+class Map;
+
+// Global BA of the maps that are not tracked, so the dormant maps are refined before they are merged or saved
+// A pass runs on request (ORB_SLAM/RefineMaps service, std_srvs/Trigger) or, if idle refinement is on, while
+// tracking is lost and relocalizing. The maps changed since their last refinement are optimized concurrently,
+// one per worker thread at idle priority, and each result is committed through Loop Closing, serialized with
+// its own global BA. A result is discarded if its map was erased, merged or became the current one meanwhile
+class MapRefiner : public OrbThread
+{
+public:
+    // nThreads: maps optimized at once, nIterations: iterations of each BA
+    // bIdle: refine while the tracking relocalizes, not only on request
+    MapRefiner(MapDatabase* pMap, int nThreads, int nIterations, bool bIdle);
+
+    void Run();
+
+    // The dormant maps are refined at the next pass
+    void RequestRefinement();
+
+    // Advertises the ORB_SLAM/RefineMaps service on nh
+    void Advertise(ros::NodeHandle &nh);
+
+protected:
+
+    // Override super, runs a pass if one is due and waits for its workers
+    bool Step();
+
+    // Dormant maps changed since their last refinement
+    void SelectMaps(std::vector<Map*> &vpMaps);
+
+    // Worker nWorker optimizes and commits every nWorkers-th map
+    void RefineMaps(const std::vector<Map*> &vpMaps, int nWorker, int nWorkers);
+
+    bool RefineMapsService(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res);
+
+    int mnThreads;
+    int mnIterations;
+    bool mbIdle;
+
+    boost::mutex mMutexRequest;
+    bool mbRequested;
+
+    // Interrupts the running optimizations, on finish
+    bool mbStopBA;
+
+    // Version of each map when it was last refined, by map id
+    boost::mutex mMutexVersions;
+    std::map<long unsigned int,unsigned long> mRefinedVersions;
+
+    ros::ServiceServer mRefineMapsSrv;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPREFINER_H
@@ -36,12 +36,14 @@ class LocalMapping;
 class LoopClosing;
 class MapMerging;
 class MapDatabase;
+class SharedWorkers;
 
 class OrbThread
 {
     public:
 
         OrbThread(MapDatabase* pMap);
+        virtual ~OrbThread();
         
         // Set the links to other threads
         void SetThreads(LocalMapping* pLocalMapper, LoopClosing* pLoopCloser, MapMerging* pMapMerger, Relocalization* pRelocalizer, Tracking* pTracker);
@@ -53,6 +55,9 @@ class OrbThread
         // Thread Syncing
         void RequestStop();
         void RequestReset();
+        // The current map changed (relocalization in another map): unlike a reset, the work queued for the
+        // previous map is kept and finished in it, and the state the thread keeps per map is parked
+        void RequestMapSwitch();
         void Stop();
         void Release();
         
@@ -60,12 +65,40 @@ class OrbThread
         bool isStopped();
         bool stopRequested();
 
+        // Blocks until the thread has stopped (or ros shuts down)
+        void WaitUntilStopped();
+
+        // Wakes the thread up, called when there is new work for it
+        void Wake();
+
+        // Asks Run to return at its next safe point, a stopped thread returns too
+        void RequestFinish();
+        bool isFinishRequested();
+
+        // Synchronous mode, for reproducible runs: Run is not started, one driver thread calls RunStep
+        // of each thread in a fixed order. Set before the threads are used
+        virtual void SetSynchronous(bool bSynchronous);
+        bool isSynchronous();
+
+        // Shared mode, for the sessions of a multi-session host: Run is not started, the workers call RunStep
+        // A thread waiting for this one to stop runs its steps itself when no worker is running it
+        // Set before the threads are used
+        void SetSharedWorkers(SharedWorkers* pWorkers);
+
+        // One iteration of Run in the calling thread, synchronous or shared mode only
+        // A stopped thread stays stopped until released, as in WaitWhileStopped. Returns whether there was work
+        bool RunStep();
+
     protected:
     
         // Thread reseting
         virtual void ResetIfRequested();
         boost::mutex mMutexReset;
         bool mbResetRequested;
+        bool mbMapSwitchRequested;
+
+        // Called by ResetIfRequested, with mMutexReset held, when a map switch was requested and no reset
+        virtual void SwitchMap() {}
 
         // Our map db
         MapDatabase* mapDB;
@@ -77,10 +110,51 @@ class OrbThread
         Relocalization* mpRelocalizer;
         Tracking* mpTracker;
         
+        // Blocks until Wake is called, returns at once if it was called since the last wait
+        // The timeout only bounds how late a shutdown is noticed
+        void WaitForWork();
+
+        // Blocks while the thread is stopped, until it is released
+        // The thread stays quiescent meanwhile
+        void WaitWhileStopped();
+
+        // Run loops while ROS is up and no finish was requested
+        bool isRunning();
+
+        // One iteration of Run, without its stop and its wait for work. Returns whether there was work
+        virtual bool Step() { return false; }
+
+        // Called by Run when the thread is released after a stop
+        virtual void Released() {}
+
+        // Called between iterations: drops the bad map objects kept from the last one
+        // and tells the EpochReclaimer that no other pointer is held
+        void Quiescent();
+        virtual void PurgeBadPointers() {}
+
+        // Our id in the EpochReclaimer
+        int mnEpochId;
+
         // Thread syncing vars
+        // mCondStop is notified with mMutexStop held when the stop state changes
         boost::mutex mMutexStop;
+        boost::condition_variable mCondStop;
         bool mbStopped;
         bool mbStopRequested;
+        bool mbFinishRequested;
+
+        // Wake up signal
+        boost::mutex mMutexWake;
+        boost::condition_variable mCondWake;
+        bool mbWakeRequested;
+
+        // Nobody is ever inside a step when another thread waits for this one, so a stop is honored at once
+        // mbSyncStopped tells RunStep that the thread stopped and waits to be released
+        bool mbSynchronous;
+        bool mbSyncStopped;
+
+        // Workers that run the steps in shared mode, NULL otherwise
+        SharedWorkers* mpSharedWorkers;
 
 };
 
@@ -25,6 +25,8 @@
 #include "types/Map.h"
 #include "types/MapDatabase.h"
 
+#include "util/PnPVerifier.h"
+
 #include <boost/thread.hpp>
 
 namespace ORB_SLAM
@@ -33,34 +35,75 @@ namespace ORB_SLAM
 class Tracking;
 class MapDatabase;
 
+// Relocalisation service of Tracking. Lost, it submits its frames here without waiting: the thread tries them
+// one at a time, and a stale attempt gives way to a newer, sharper frame
+// Each frame is first tried against the covisible neighborhood of the keyframe tracking was lost at, which is
+// where a short loss almost always recovers, and only then against the global cross-map index
+// Forced relocalisations run synchronously in the tracking thread through Relocalize, with its own verifier
 class Relocalization: public OrbThread
 {
     public:
     
-        Relocalization(MapDatabase *mapDB);
+        Relocalization(MapDatabase *mapDB, int nThreads = 1);
 
         void Run();
-        
-        bool isAcceptingFrames();
-        void AddFrame(Frame* newFrame);
+
+        // Kept as the next frame to try if it is at least as sharp as the one waiting, or that one is stale
+        // The attempt running on a stale frame is cancelled for it. Only the kept frames are copied
+        void Submit(const Frame &F);
+
+        // Seconds an attempt of the thread may take (0 - no limit)
+        void SetBudget(float fBudget);
+
+        // Keyframes of the local neighborhood tried before the global index
+        void SetLocalWindow(int nKeyFrames);
+
+        // Keyframe the tracking was lost at, the center of the local neighborhood (NULL - global index only)
+        // Kept until the next loss
+        void SetLocalHint(KeyFrame* pKF);
+
+        // Tries the candidates, or those of the global cross-map index if none are given, under a time budget
+        // (0 - no limit). Returns the index of the accepted candidate or -1, the frame then has its pose
+        // The maps of the candidates found in the index are pinned while verified, and on success until the
+        // caller unpins them. Can be called from any thread with its own verifier
+        int Relocalize(Frame* pFrame, std::vector<KeyFrame*> &vpCandidates, PnPVerifier &verifier, float fBudget,
+                       std::vector<Map*> &vpPinnedMaps);
         
         bool relocalizeIfSuccessfull();
 
         void ResetIfRequested();
     
     protected:
+
+        // Override super, the frames waiting for relocalisation may match culled points
+        void PurgeBadPointers();
+
+        // Override super, tries the frame waiting for relocalisation
+        bool Step();
     
         void Relocalisation();
+
+        // Covisible neighborhood of the local hint, nearest first, empty without a hint or once its map is erased
+        void LocalCandidates(std::vector<KeyFrame*> &vpCandidates);
         
         bool isSuccess();
         
-        void setAcceptingFrames(bool val);
-        
-        boost::mutex mMutexAcceptFrames;
-        bool acceptingFrames;
-        
         boost::mutex mMutexFrame;
+        // Frame waiting for an attempt and the frame being tried, owned
+        Frame* mpNextFrame;
         Frame* mCurrentFrame;
+        bool mbAttempting;
+        float mfBudget;
+
+        // Center and size of the local neighborhood, the hint is guarded by mMutexFrame
+        KeyFrame* mpLocalHint;
+        int mnLocalWindow;
+
+        // Verification of the relocalisation candidates
+        PnPVerifier mPnPVerifier;
+
+        // Maps of the candidates being verified, kept resident until they are released
+        std::vector<Map*> mvpPinnedMaps;
 
         boost::mutex mMutexSuccessCheck;
         bool isSuccessfull;
@@ -0,0 +1,91 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef RIGCAMERA_H
+#define RIGCAMERA_H
+
+#include "types/Camera.h"
+#include "types/Frame.h"
+#include "types/ORBVocabulary.h"
+#include "util/ORBextractor.h"
+
+#include <string>
+#include <sensor_msgs/Image.h>
+#include <image_transport/image_transport.h>
+#include <boost/thread.hpp>
+
+namespace ORB_SLAM
+{
+
+// Another camera of a rig, besides the one Tracking subscribes to
+// Its images are extracted in its own thread, concurrently with the other cameras, and the tracking
+// takes the latest frame to search the local map in it and estimate the rig pose with it
+class RigCamera
+{
+public:
+    // Takes ownership of the camera and the extractor
+    RigCamera(Camera* pCamera, ORBextractor* pExtractor, ORBVocabulary* pVocabulary, const std::string &strTopic, bool bRGB);
+    ~RigCamera();
+
+    // Subscribes to the images and starts the extraction thread
+    void Subscribe(image_transport::ImageTransport &it, const std::string &strTransport, int nQueueSize);
+    void Unsubscribe();
+
+    // Tracks an image given directly instead of through the topic, extracted in the calling thread
+    void AddImage(const cv::Mat &image, const double &timeStamp);
+
+    // Latest extracted frame if taken at most maxDelay seconds from timeStamp, else NULL. The caller owns it
+    Frame* TakeFrame(const double &timeStamp, const double &maxDelay);
+
+    Camera* GetCamera() {return mpCamera;}
+    const std::string& GetTopic() const {return mstrTopic;}
+
+    // Frames replaced before the tracking took them
+    unsigned int FramesDropped();
+
+protected:
+    void GrabImage(const sensor_msgs::ImageConstPtr& msg);
+    void Run();
+
+    // Extracts the image and keeps it as latest frame
+    void Extract(cv::Mat &im, const double &timeStamp);
+
+    Camera* mpCamera;
+    ORBextractor* mpORBextractor;
+    ORBVocabulary* mpORBVocabulary;
+    std::string mstrTopic;
+    bool mbRGB;
+
+    image_transport::Subscriber mImageSub;
+    boost::thread* mpThread;
+
+    // Last image received and last frame extracted
+    boost::mutex mMutex;
+    boost::condition_variable mCond;
+    sensor_msgs::ImageConstPtr mpImage;
+    Frame* mpFrame;
+    unsigned int mnFramesDropped;
+    bool mbStop;
+};
+
+} //namespace ORB_SLAM
+
+#endif // RIGCAMERA_H
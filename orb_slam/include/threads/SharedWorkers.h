@@ -0,0 +1,83 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SHAREDWORKERS_H
+#define SHAREDWORKERS_H
+
+#include <boost/thread.hpp>
+
+#include <vector>
+
+namespace ORB_SLAM
+{
+
+class OrbThread;
+
+// A few workers that run the steps of the background threads of all the sessions of a multi-session host,
+// so the threads do not scale with the sessions. A worker takes the threads in turn, each one with the pool
+// demotion of its session, and sleeps when a round over all of them found no work
+class SharedWorkers
+{
+public:
+    SharedWorkers();
+    ~SharedWorkers();
+
+    // Before Start, the thread is set to shared mode
+    void Add(OrbThread* pThread, int nDemotion);
+
+    void Start(int nWorkers);
+
+    // The workers return after their current step. The threads are left to the callers of StepIfIdle
+    void Finish();
+
+    // Called by the threads when they get work
+    void Wake();
+
+    // Runs a step of pThread in the calling thread, unless a worker is running it. Returns whether it ran
+    bool StepIfIdle(OrbThread* pThread);
+
+protected:
+
+    struct Entry
+    {
+        OrbThread* pThread;
+        int nDemotion;
+        bool bBusy;
+    };
+
+    void RunWorker();
+
+    // Runs a step of the claimed entry i with the demotion of its session, returns whether there was work
+    bool Step(size_t i);
+
+    boost::mutex mMutex;
+    boost::condition_variable mCondWake;
+    std::vector<Entry> mvEntries;
+    size_t mnNext;
+    bool mbWakeRequested;
+    bool mbFinishRequested;
+
+    std::vector<boost::thread*> mvpThreads;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SHAREDWORKERS_H
@@ -21,12 +21,16 @@
 #ifndef TRACKING_H
 #define TRACKING_H
 
+// The headless build compiles the publishers out, they are passed as NULL
+#ifndef ORB_SLAM_HEADLESS
 #include "publishers/FramePublisher.h"
 #include "publishers/MapPublisher.h"
+#endif
 
 #include "types/Map.h"
 #include "types/MapDatabase.h"
 #include "types/Frame.h"
+#include "types/Camera.h"
 #include "types/ORBVocabulary.h"
 #include "types/KeyFrameDatabase.h"
 
@@ -37,21 +41,50 @@
 #include "threads/Relocalization.h"
 
 #include "util/ORBextractor.h"
+#include "util/FeatureBudget.h"
+#include "util/LoadShedder.h"
+#include "util/KeyFramePolicy.h"
+#include "util/FrustumCuller.h"
+#include "util/FlowTracker.h"
+#include "util/SparseImageAligner.h"
+#include "util/ImuIntegrator.h"
+#include "util/PosePredictor.h"
+#include "util/PositionPrior.h"
+#include "util/ImageQuality.h"
+#include "util/StationaryDetector.h"
 #include "util/Initializer.h"
+#include "util/PoseSolver.h"
+#include "util/PnPVerifier.h"
 #include "util/FpsCounter.h"
+#include "util/ThreadConfig.h"
+#include "util/TrajectoryRecorder.h"
 
+#include <list>
 #include <opencv2/core/core.hpp>
 #include <opencv2/features2d/features2d.hpp>
 #include <sensor_msgs/Image.h>
 #include <sensor_msgs/image_encodings.h>
+#include <sensor_msgs/Imu.h>
+#include <sensor_msgs/RegionOfInterest.h>
+#include <nav_msgs/Odometry.h>
+#include <std_srvs/SetBool.h>
+#include <std_srvs/Trigger.h>
 #include <tf/transform_broadcaster.h>
+#include <image_transport/image_transport.h>
+#include <ros/callback_queue.h>
+#include <ros/spinner.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <orb_slam/TrackedPose.h>
+#include <boost/atomic.hpp>
 
 
 namespace ORB_SLAM
 {
 
 class FramePublisher;
+class MapPublisher;
 class MapDatabase;
+class RigCamera;
 class Map;
 class LocalMapping;
 class LoopClosing;
@@ -62,7 +95,10 @@ class Tracking: public OrbThread
 {  
 
 public:
-    Tracking(FramePublisher* pFramePublisher, MapPublisher* pMapPublisher, MapDatabase* pMap, FpsCounter* pfps, string strSettingPath);
+    // nh: namespace of the outputs and of the services, the one of a session in a multi-session host
+    // strFramePrefix: prefix of the tf frame ids, "<session>/" in a multi-session host
+    Tracking(FramePublisher* pFramePublisher, MapPublisher* pMapPublisher, MapDatabase* pMap, FpsCounter* pfps, string strSettingPath,
+             const ros::NodeHandle &nh=ros::NodeHandle(), const string &strFramePrefix="");
 
     enum eTrackingState{
         SYSTEM_NOT_READY=-1,
@@ -72,12 +108,53 @@ public:
         WORKING=3
     };
 
+    // What to do when the frame queue is full
+    enum eDropPolicy{
+        DROP_OLDEST=0,
+        DROP_NEWEST=1,
+        BLOCK=2
+    };
+
     // This is the main function of the Tracking Thread
+    // Subscribes on the global node handle and spins the image queue
     void Run();
 
+    // Subscribes to the images and advertises the services in the namespace of nh
+    // The images and the control plane (services, ROI and position prior) have their own callback queues
+    // and threads, so a service call never delays a frame. The owner of nh spins nothing of Tracking
+    void Subscribe(ros::NodeHandle &nh);
+    void Unsubscribe();
+
+    // Tracking stage when pipelined, tracks the frames extracted in the callback
+    void RunTracking();
+
+    // Tracks an image given directly instead of through the image topic (offline benchmark)
+    // Color images are converted to grayscale, grayscale images are shared
+    void TrackImage(const cv::Mat &image, const double &timeStamp);
+
+    // Frames extracted and waiting for the tracking stage
+    int FramesInQueue();
+
+    // Whether the tracking stage runs in its own thread, see RunTracking
+    bool isPipelined();
+
+    // Override super: not pipelined and with a fixed feature budget, so nothing depends on the time taken
+    void SetSynchronous(bool bSynchronous);
+
+    // Camera pose Tcw of the last tracked frame, empty if it was not tracked
+    cv::Mat GetLastPose();
+
+    // Receives the pose of each tracked frame relative to its reference keyframe (NULL - not recorded)
+    void SetTrajectoryRecorder(TrajectoryRecorder* pRecorder);
+
     void ForceRelocalisation();
     void ForceInlineRelocalisation();
 
+    // Localization only: the maps are frozen, no keyframe is inserted and the mapping threads stay stopped
+    // When lost, tracking only relocalizes and never starts a new map
+    void SetLocalizationOnly(bool bLocalizationOnly);
+    bool LocalizationOnly();
+
     eTrackingState mState;
     eTrackingState mLastProcessedState;
         
@@ -103,25 +180,70 @@ public:
     void SetRelocalisationFrame(Frame* frame);
 
 protected:
+    // Run spins the image queue itself, otherwise it gets its own thread
+    void Subscribe(ros::NodeHandle &nh, bool bImageSpinner);
+
     void GrabImage(const sensor_msgs::ImageConstPtr& msg);
+    void GrabImu(const sensor_msgs::ImuConstPtr& msg);
+    // Position of the robot from odometry or GNSS, only the position is used
+    void GrabPositionPrior(const nav_msgs::OdometryConstPtr& msg);
+    void GrabDepth(const sensor_msgs::ImageConstPtr& msg);
+    // Region of interest of the extraction on ORB_SLAM/Roi, zero size for the whole image
+    void GrabRoi(const sensor_msgs::RegionOfInterestConstPtr& msg);
+    bool LocalizationOnlyService(std_srvs::SetBool::Request &req, std_srvs::SetBool::Response &res);
+    // Rereads the tuning parameters of the settings file, applied by the tracking thread before the next frame
+    bool ReloadSettingsService(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res);
+    void GrabFrame(cv::Mat &im, const double &timeStamp, const boost::shared_ptr<const void> &imageOwner);
+    void Track();
+
+    // Override super, the frames and the local map are kept across frames
+    void PurgeBadPointers();
+
+    // Frame queue between the extraction and tracking stages
+    void AddFrame(Frame* pFrame);
+    Frame* NextFrame();
 
     void FirstInitialization();
     void Initialize();
     void CreateInitialMap(cv::Mat &Rcw, cv::Mat &tcw);
+    // Depth input: the map is created from the current frame alone, its keypoints with depth are the map points
+    void InitializeFromDepth();
+    void CreateInitialMapFromDepth();
 
     void Reset();
     bool RelocalisationInline();
 
     bool TrackPreviousFrame();
     bool TrackWithMotionModel();
+    // Constant velocity from the last tracked frame over the frames lost since, with wider windows
+    bool TrackCoasting();
+    // Direct alignment of the image with the last frame from the motion model prediction (or the last pose),
+    // then a projection search of a few pixels
+    bool TrackWithDirectAlignment();
+    // Pose of the current frame from the last one: the motion model, with the rotation measured by the gyroscope
+    // if the IMU covers the frames. Returns whether the IMU was used
+    bool PredictPose(cv::Mat &Tcw);
+    // Pose of a frame tracked with optical flow from the last frame, from its tracked points alone
+    bool TrackFlow();
+    // The flow lost the map, the current frame is extracted after all and tracked as usual
+    void ExtractFlowFrame();
+    // Whether the next frame can be tracked with optical flow, see Tracking.Flow
+    bool FlowNextFrame(bool bFlowTracked);
+    // A keyframe is likely on the next frame (see NeedNewKeyFrame), it needs features at full resolution
+    bool KeyFrameLikely();
 
     void UpdateReference();
     void UpdateReferencePoints();
-    void UpdateReferenceKeyFrames();
+    // Returns true if a bad match of the current frame was dropped
+    bool UpdateReferenceKeyFrames();
 
     bool TrackLocalMap();
     void SearchReferencePointsInFrustum();
 
+    // Takes the frames of the other cameras of the rig and searches the local map in them
+    void SearchRigFrames();
+    void ClearRigFrames();
+
     bool NeedNewKeyFrame();
     void CreateNewKeyFrame();
     
@@ -129,21 +251,88 @@ protected:
     
     void PublishTopics();
 
+    // Sends a camera pose on tf and ORB_SLAM/Pose, returns it as a transform
+    tf::Transform PublishPose(const cv::Mat &Tcw);
+
+    // Timer of the control queue, sends the pose predicted for now on ORB_SLAM/PredictedPose
+    void PublishPrediction(const ros::TimerEvent &event);
+
+    // Whether the motion of the frame just tracked is below mfStationaryMaxMotion
+    bool isStill();
+
+    // Seconds the last tracked frame took, extraction included (the slowest stage when pipelined)
+    float FrameTime(float trackTime);
+
+    // Feed the feature budget controller with the last tracked frame
+    void UpdateFeatureBudget(float trackTime);
+
     //ORB
     ORBextractor* mpORBextractor;
     ORBextractor* mpIniORBextractor;
+    // Static mask and backend of the tracking extractor, given again to an extractor rebuilt by a reload
+    cv::Mat mStaticMask;
+    bool mbGpuExtraction;
+    // Extractors replaced by a reload, frames may still refer to them
+    std::vector<ORBextractor*> mvpRetiredExtractors;
+    // Scale pyramid of the image being extracted, shared by the two extractors
+    ImagePyramid mPyramid;
+
+    // Adaptive number of features of the tracking extractor (NULL - disabled)
+    FeatureBudget* mpFeatureBudget;
+    // Seconds spent extracting the features of the last frame
+    float mfExtractTime;
+
+    // Frames skipped on purpose when tracking is slower than the camera (NULL - disabled)
+    // The frame after a keyframe, and every frame while not working, is always tracked
+    LoadShedder* mpLoadShedder;
+    boost::atomic<bool> mbKeepNextFrame;
+
+    // Images of a camera that does not move are skipped, but for one per verification period (NULL - disabled)
+    // The last pose is published again for each of them. Motion is near zero when the rotation and the
+    // translation at the median depth of the reference keyframe move the image less than mfStationaryMaxMotion pixels
+    StationaryDetector* mpStationaryDetector;
+    float mfStationaryMaxMotion;
 
     //BoW
     ORBVocabulary* mpORBVocabulary;
 
     // Initalization
     Initializer* mpInitializer;
+    int mnInitIterations;
+
+    // Features of the initial frame matched in the previous frame are searched in a window of mfInitTrackWindow
+    // pixels around that match, the lost ones in the wide window. Features lost for more than mnInitMaxLost
+    // frames are searched wide once every mnInitMaxLost frames, staggered (0 - always the wide window)
+    float mfInitTrackWindow;
+    int mnInitMaxLost;
+    // Frames since each feature of the initial frame was last matched, and the window of each search
+    std::vector<int> mvnIniLost;
+    std::vector<float> mvIniWindowSizes;
+    int mnIniFrames;
+    void InitializationWindows();
 
     //Local Map
     KeyFrame* mpReferenceKF;
     std::vector<KeyFrame*> mvpLocalKeyFrames;
     std::vector<MapPoint*> mvpLocalMapPoints;
 
+    // Batch visibility test of the local map points, and their projection in the frame being tracked
+    FrustumCuller mFrustumCuller;
+    LocalMapProjection mLocalMapProjection;
+
+    // Motion-only BA of the current frame
+    PoseSolver mPoseSolver;
+
+    // Verification of the inline relocalisation candidates
+    PnPVerifier mPnPVerifier;
+
+    // The local map above is served again while these still match, see UpdateReference
+    Map* mpLocalMapOwner;
+    std::vector<KeyFrame*> mvpLocalMapKeyFrames;
+    std::vector<KeyFrame::MapPointList> mvpLocalMapLists;
+    long unsigned int mnLocalMapBuildFrameId;
+    long unsigned int mnLocalMapLastFrameId;
+
     //Publishers
     FramePublisher* mpFramePublisher;
     MapPublisher* mpMapPublisher;
@@ -151,14 +340,23 @@ protected:
     //Local Map for init
     Map* localMap;
 
-    //Calibration matrix
-    cv::Mat mK;
-    cv::Mat mDistCoef;
+    // Calibration of the camera, the first one of the rig
+    Camera* mpCamera;
+
+    // Other cameras of the rig, their frames tracked with the current frame and their inliers
+    std::vector<RigCamera*> mvpRigCameras;
+    std::vector<Frame*> mvpRigFrames;
+    float mfRigMaxDelay;
+    int mnRigInliers;
 
     //New KeyFrame rules (according to fps)
     int mMinFrames;
     int mMaxFrames;
 
+    //Keyframes inserted ahead of the tracked ratio, and BA interruptions avoided, from the trend and the
+    //predicted local mapping time (NULL - disabled)
+    KeyFramePolicy* mpKeyFramePolicy;
+
     //Current matches in frame
     int mnMatchesInliers;
 
@@ -182,18 +380,165 @@ protected:
     bool mbForceRelocalisation;
     bool mbForceRelocalisationInline;
 
+    //Localization only mode, requested and as applied to the mapping threads by the tracking thread
+    boost::mutex mMutexLocalizationOnly;
+    bool mbLocalizationOnly;
+    bool mbMappingStopped;
+
+    //Stops or releases the mapping threads to follow the mode, and requests a relocalisation if lost
+    void UpdateLocalizationOnly();
+
+    //Settings reload requested through ORB_SLAM/ReloadSettings, applied at the start of a frame
+    //ORBextractor.nFeatures/fastTh are changed in place, a new nLevels or scaleFactor rebuilds the tracking
+    //extractor, UseMotionModel and Camera.fps (keyframe spacing) are taken as they are
+    std::string mstrSettingPath;
+    boost::mutex mMutexReload;
+    bool mbReloadRequested;
+    void ReloadSettings();
+
     //Motion Model
     bool mbMotionModel;
     cv::Mat mVelocity;
 
+    //Coasting: frames tracking may fail before the map is given up, projection retries and window of the first one
+    //While coasting the last tracked frame stays in mLastFrame
+    int mnCoastFrames;
+    int mnCoastRetries;
+    float mfCoastWindow;
+    int mnCoastedFrames;
+
+    //Sparse direct alignment as the prior of the projection search (NULL - disabled), and the search window after it
+    SparseImageAligner* mpImageAligner;
+    float mfDirectWindow;
+
+    //Gyroscope preintegration as the rotation prior of the motion model (NULL - disabled), and the search window
+    //of the projection when it is used. The IMU topic has its own callback queue and thread, so the measurements
+    //keep coming while a frame is tracked
+    ImuIntegrator* mpImuIntegrator;
+    float mfImuWindow;
+    string mstrImuTopic;
+    ros::CallbackQueue mImuQueue;
+    boost::shared_ptr<ros::AsyncSpinner> mpImuSpinner;
+    ros::Subscriber mImuSub;
+
+    //The image callbacks (images, depth and the rig cameras) are spun by Run on the tracking thread, or by
+    //mpImageSpinner when subscribed from outside. The control plane is spun by its own thread
+    ros::CallbackQueue mImageQueue;
+    boost::shared_ptr<ros::AsyncSpinner> mpImageSpinner;
+    ros::CallbackQueue mControlQueue;
+    boost::shared_ptr<ros::AsyncSpinner> mpControlSpinner;
+
+    //Pose extrapolated past the last tracked frame for latency compensation (NULL - disabled), published by a timer
+    //of the control queue at its own rate, each tracked frame corrects it
+    PosePredictor* mpPosePredictor;
+    float mfPredictionRate;
+    ros::Timer mPredictionTimer;
+    ros::Publisher mPredictedPosePub;
+    unsigned int mnPredictedSeq;
+
+    //Coarse position of each frame from an external source (NULL - disabled), it tags the keyframes and the
+    //relocalization queries so that place recognition skips the keyframes too far away
+    PositionPrior* mpPositionPrior;
+    string mstrPositionPriorTopic;
+    ros::Subscriber mPositionPriorSub;
+
+    //Optical flow between keyframes (NULL - disabled): frames are extracted on a cadence, when the flow loses
+    //too many points and when a keyframe is likely, the others follow the points of the last frame
+    FlowTracker* mpFlowTracker;
+    int mnFlowMaxFrames;
+    float mfFlowMinRatio;
+    int mnFlowMinInliers;
+    //Whether the current frame was tracked with flow and the next will be, frames since the last extracted one
+    //and the inliers of that one
+    bool mbFlowFrame;
+    bool mbFlowNext;
+    int mnFlowFrames;
+    int mnFlowStartInliers;
+
+    //Downscaled tracking (0 - disabled): while working, frames are extracted from this pyramid level on, unless a
+    //keyframe is likely. A downscaled frame that needs a keyframe leaves it to the next frame, extracted in full
+    int mnDownscaleLevels;
+    bool mbDownscaleNext;
+
     //Color order (true RGB, false BGR, ignored if grayscale)
     bool mbRGB;
 
+    //Share grayscale ROS image buffers instead of copying them
+    bool mbZeroCopyInput;
+
+    //Image input topic, image_transport plugin and subscriber queue size
+    string mstrImageTopic;
+    string mstrImageTransport;
+    int mnImageQueueSize;
+
+    //Blurred and dark images are skipped before extraction (NULL - disabled)
+    ImageQuality* mpImageQuality;
+
+    //Seconds a forced relocalisation may take in this thread (0 - no limit)
+    float mfRelocInlineBudget;
+
+    //Depth input registered to the image (empty - monocular), the depth of a frame is the last depth image
+    //taken at most mfDepthMaxDelay apart, in meters (16 bit images are divided by mfDepthFactor)
+    //A map needs mnDepthMinPoints keypoints with depth
+    string mstrDepthTopic;
+    float mfDepthFactor;
+    float mfDepthMaxDelay;
+    int mnDepthMinPoints;
+    boost::mutex mMutexDepth;
+    cv::Mat mDepth;
+    double mDepthTimeStamp;
+    image_transport::Subscriber mDepthSub;
+
+    //Input and services, from Subscribe to Unsubscribe
+    boost::shared_ptr<image_transport::ImageTransport> mpImageTransport;
+    image_transport::Subscriber mImageSub;
+    ros::ServiceServer mLocalizationOnlySrv;
+    ros::ServiceServer mReloadSettingsSrv;
+    ros::Subscriber mRoiSub;
+    boost::thread* mpTrackingStage;
+
+    // Cores and priority of the thread tracking the pose, the callback thread or the tracking stage
+    // Applied by Track on the first frame
+    ThreadConfig mThreadConfig;
+    bool mbThreadConfigured;
+
     // Transfor broadcaster (for visualization in rviz)
     tf::TransformBroadcaster mTfBr;
+    // tf frames of the map and of the camera, ORB_SLAM/World and ORB_SLAM/Camera under the frame prefix
+    string mstrWorldFrame;
+    string mstrCameraFrame;
+
+    // Namespace given on construction, Run subscribes on it
+    ros::NodeHandle mNH;
+
+    // Camera pose in the world, the only output of the headless build besides tf
+    ros::Publisher mPosePub;
+
+    // Copy of the pose of the last tracked frame, for GetLastPose
+    boost::mutex mMutexLastPose;
+    cv::Mat mLastPose;
+
+    TrajectoryRecorder* mpTrajectoryRecorder;
+
+    // Pose of each tracked frame with its image stamp, for latency and drop monitoring
+    ros::Publisher mTrackedPosePub;
+    unsigned int mnTrackedSeq;
+
+    // Images lost before tracking, gaps in the image sequence numbers and frame queue drops
+    boost::atomic<unsigned int> mnFramesDropped;
+    unsigned int mnLastImageSeq;
+    bool mbImageSeqValid;
     
     // Our fps counter
     FpsCounter* fps_counter;
+
+    // Pipelined tracking
+    std::list<Frame*> mlpFrameQueue;
+    int mnFrameQueueSize;
+    int mnDropPolicy;
+    bool mbExtractWorking;
+    boost::mutex mMutexFrameQueue;
+    boost::condition_variable mCondFrameQueue;
 };
 
 } //namespace ORB_SLAM
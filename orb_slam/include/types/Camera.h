@@ -0,0 +1,88 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <string>
+#include <opencv2/core/core.hpp>
+
+#include "util/UndistortionMap.h"
+
+namespace ORB_SLAM
+{
+
+// Calibration of a camera: intrinsics, k1,k2,p1,p2 distortion and its pose in the rig
+// The first camera defines the rig, the pose of the rig is the pose of the frames of the first camera
+// Frames point to the camera that took them, cameras live as long as the tracking
+class Camera
+{
+public:
+    // Reads <prefix>fx, fy, cx, cy, k1, k2, p1, p2, width, height, UndistortStep, GridCols and GridRows,
+    // and <prefix>Tcr (4x4) if present. The grid follows ORBextractor.nFeatures unless set
+    Camera(const cv::FileStorage &fSettings, const std::string &prefix, int nId);
+
+    // Prepares the undistortion table, image bounds and grid for images of that size
+    // Called by the thread building the frames of this camera before each frame, cheap once prepared
+    void SetImageSize(int width, int height);
+
+    bool IsDistorted() const {return mDistCoef.at<float>(0)!=0.0;}
+
+    // Index in the rig, 0 for the first camera
+    int mnId;
+
+    // Calibration Matrix and k1,k2,p1,p2 Distortion Parameters
+    cv::Mat mK;
+    cv::Mat mDistCoef;
+    float fx, fy, cx, cy;
+
+    // Pose of the camera relative to the first camera of the rig (identity for the first camera)
+    cv::Mat mTcr;
+
+    // Keypoints are undistorted from a table solved every mnUndistortStep pixels
+    UndistortionMap mUndistortionMap;
+    int mnUndistortStep;
+
+    // Undistorted image bounds and grid cell scale for the image size
+    int mnWidth, mnHeight;
+    int mnMinX, mnMaxX, mnMinY, mnMaxY;
+    float mfGridElementWidthInv, mfGridElementHeightInv;
+
+    // Cells of the feature grid of the frames, sized for the image and the features extracted (see GridSize)
+    int mnGridCols, mnGridRows;
+
+protected:
+
+    // Cells for an image of that size: as many per feature as the reference grid, FRAME_GRID_COLS x FRAME_GRID_ROWS
+    // for 640x480 and REFERENCE_FEATURES, shaped as the image and no smaller than MIN_CELL_SIZE pixels
+    void GridSize(int width, int height, int &nCols, int &nRows) const;
+
+    static const int REFERENCE_FEATURES;
+    static const float MIN_CELL_SIZE;
+
+    // Features extracted per image, and the grid set in the settings (0 - derived)
+    int mnFeatures;
+    int mnFixedGridCols, mnFixedGridRows;
+};
+
+} //namespace ORB_SLAM
+
+#endif // CAMERA_H
@@ -0,0 +1,93 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ESSENTIALGRAPH_H
+#define ESSENTIALGRAPH_H
+
+#include <vector>
+#include <map>
+
+#include <boost/thread/mutex.hpp>
+
+namespace ORB_SLAM
+{
+
+class KeyFrame;
+
+// Edges of the essential graph of a map: the spanning tree, the loop edges and the covisibility links
+// of at least MIN_WEIGHT shared points. The keyframes update it as their links change, so a loop
+// correction reads the edges instead of walking the covisibility graph of every keyframe
+class EssentialGraph
+{
+public:
+    enum EdgeType
+    {
+        SPANNING_TREE=1,
+        LOOP=2,
+        COVISIBILITY=4
+    };
+
+    static const int MIN_WEIGHT = 100;
+
+    struct Edge
+    {
+        // pKF1 is the newest keyframe of the two
+        KeyFrame* pKF1;
+        KeyFrame* pKF2;
+        // EdgeType flags, an edge of several types is listed once
+        int nTypes;
+    };
+
+    EssentialGraph();
+
+    // The edges are read from the keyframes on the next GetEdges, for maps whose links were not followed
+    void Invalidate();
+
+    // Called by the keyframes when their links change
+    void SetWeight(KeyFrame* pKF1, KeyFrame* pKF2, int weight);
+    void SetParent(KeyFrame* pKF, KeyFrame* pOldParent, KeyFrame* pParent);
+    void AddLoopEdge(KeyFrame* pKF1, KeyFrame* pKF2);
+
+    // A keyframe added to the map brings its current links, erasing it drops them
+    void AddKeyFrame(KeyFrame* pKF);
+    void EraseKeyFrame(KeyFrame* pKF);
+
+    // All the edges, rebuilt from vpKFs (the keyframes of the map) if the graph was invalidated
+    void GetEdges(const std::vector<KeyFrame*> &vpKFs, std::vector<Edge> &vEdges);
+
+    void clear();
+
+protected:
+    // mMutex must be held
+    void SetType(KeyFrame* pKF1, KeyFrame* pKF2, int nType, bool bSet);
+    void AddLinks(KeyFrame* pKF, KeyFrame* pParent, const std::vector<KeyFrame*> &vpLoopKFs,
+                  const std::vector<KeyFrame*> &vpCovisibleKFs);
+
+    // Both directions of each edge, with their types
+    std::map<KeyFrame*,std::map<KeyFrame*,int> > mAdjacency;
+    bool mbValid;
+    // Counts the updates, to detect the ones made while an invalidated graph is read back
+    unsigned long mnChanges;
+    boost::mutex mMutex;
+};
+
+} //namespace ORB_SLAM
+
+#endif // ESSENTIALGRAPH_H
@@ -0,0 +1,65 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FEATUREGRID_H
+#define FEATUREGRID_H
+
+#include <vector>
+#include <cstddef>
+
+namespace ORB_SLAM
+{
+
+// Keypoint indices assigned to the cells of a grid over the image
+// Stored in compressed sparse row layout: one array with the indices sorted by cell,
+// and the offset at which each cell starts (the cell of column x and row y is x*rows+y)
+class FeatureGrid
+{
+    friend class MapSerializer;
+
+public:
+    FeatureGrid();
+
+    // Builds the grid from the cell of each keypoint, -1 if the keypoint is outside the grid
+    // Indices keep their order inside each cell
+    void Build(const int nCols, const int nRows, const std::vector<int> &vKeyCells);
+
+    void swap(FeatureGrid &grid);
+
+    int Cols() const {return mnCols;}
+    int Rows() const {return mnRows;}
+
+    std::size_t HeapBytes() const {return (mvCellStart.capacity()+mvIndices.capacity())*sizeof(std::size_t);}
+
+    // Indices in the cell are [CellBegin, CellEnd)
+    const std::size_t* CellBegin(const int x, const int y) const {return mvIndices.empty() ? NULL : &mvIndices[0]+mvCellStart[x*mnRows+y];}
+    const std::size_t* CellEnd(const int x, const int y) const {return mvIndices.empty() ? NULL : &mvIndices[0]+mvCellStart[x*mnRows+y+1];}
+
+protected:
+    int mnCols;
+    int mnRows;
+
+    std::vector<std::size_t> mvCellStart;
+    std::vector<std::size_t> mvIndices;
+};
+
+} //namespace ORB_SLAM
+
+#endif // FEATUREGRID_H
@@ -24,6 +24,7 @@
 #include "types/MapPoint.h"
 #include "types/ORBVocabulary.h"
 #include "types/KeyFrame.h"
+#include "types/FeatureGrid.h"
 
 #include "util/ORBextractor.h"
 
@@ -31,39 +32,62 @@
 #include "dbow2/FeatureVector.h"
 
 #include <opencv2/opencv.hpp>
+#include <Eigen/Core>
+#include <boost/shared_ptr.hpp>
 
 namespace ORB_SLAM
 {
+// Feature grid of a 640x480 image with 1000 features, the grids of the cameras are scaled from it (see Camera)
 #define FRAME_GRID_ROWS 48
 #define FRAME_GRID_COLS 64
 
 class Tracking;
 class MapPoint;
+class Camera;
 class KeyFrame;
 class KeyFrameDatabase;
+class FlowTracker;
+class DescriptorIndex;
 
 class Frame
 {
 public:
     Frame();
     Frame(const Frame &frame);
-    Frame(cv::Mat &im, const double &timeStamp, ORBextractor* extractor, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef);
+    // The camera must be prepared for the image size (Camera::SetImageSize)
+    // Frames of the first camera of the rig are numbered, the others take the id of the frame they are tracked with
+    Frame(cv::Mat &im, const double &timeStamp, ORBextractor* extractor, ORBVocabulary* voc, const Camera* pCamera,
+          const boost::shared_ptr<const void> &imageOwner=boost::shared_ptr<const void>());
+    // Nothing is extracted: the keypoints of the previous frame matched to map points are tracked into the image
+    // with optical flow, and keep their map point, descriptor and level. Enough for the pose, not for a keyframe
+    Frame(cv::Mat &im, const double &timeStamp, const Frame &previous, FlowTracker* pFlowTracker,
+          const boost::shared_ptr<const void> &imageOwner=boost::shared_ptr<const void>());
+
+    // Exchanges the contents of two frames without copying or allocating
+    // Used to hand a frame on instead of copying it
+    void swap(Frame &frame);
 
     ORBVocabulary* mpORBvocabulary;
     ORBextractor* mpORBextractor;
 
-    // Frame image
+    // Frame image, it is never modified so copies of the frame share it
     cv::Mat im;
 
+    // Keeps alive the buffer im points to when it is not owned by im (e.g. a ROS message)
+    boost::shared_ptr<const void> mpImageOwner;
+
     // Frame timestamp
     double mTimeStamp;
 
-    // Calibration Matrix and k1,k2,p1,p2 Distortion Parameters
+    // Camera that took the frame
+    const Camera* mpCamera;
+
+    // Calibration Matrix and k1,k2,p1,p2 Distortion Parameters, those of the camera
     cv::Mat mK;
-    static float fx;
-    static float fy;
-    static float cx;
-    static float cy;
+    float fx;
+    float fy;
+    float cx;
+    float cy;
     cv::Mat mDistCoef;
 
     // Number of KeyPoints
@@ -75,21 +99,28 @@ public:
 
     // Bag of Words Vector structures
     DBoW2::BowVector mBowVec;
-    DBoW2::FeatureVector mFeatVec;
+    DBoW2::FlatFeatureVector mFeatVec;
 
     // ORB descriptor, each row associated to a keypoint
     cv::Mat mDescriptors;
 
+    // Multi-index hash of mDescriptors for the wide window searches, built on first use and shared by the copies
+    const DescriptorIndex& GetDescriptorIndex();
+
     // MapPoints associated to keypoints, NULL pointer if not association
     std::vector<MapPoint*> mvpMapPoints;
 
     // Flag to identify outlier associations
     std::vector<bool> mvbOutlier;
 
+    // Depth of each keypoint in meters from a registered depth image, -1 where it has none
+    // Empty unless AssignDepth was called
+    std::vector<float> mvDepth;
+
     // Keypoints are assigned to cells in a grid to reduce matching complexity when projecting MapPoints
     float mfGridElementWidthInv;
     float mfGridElementHeightInv;
-    std::vector<std::size_t> mGrid[FRAME_GRID_COLS][FRAME_GRID_ROWS];
+    FeatureGrid mGrid;
 
     // Camera Pose
     cv::Mat mTcw;
@@ -102,41 +133,68 @@ public:
 
     void ComputeBoW();
 
+    // Samples a depth image registered to the frame image (CV_32F, meters) at the keypoints, returns how many have depth
+    // The depth image may be of another resolution than the frame image
+    int AssignDepth(const cv::Mat &depth);
+
     void UpdatePoseMatrices();
 
-    // Check if a MapPoint is in the frustum of the camera and also fills variables of the MapPoint to be used by the tracking
-    bool isInFrustum(MapPoint* pMP, float viewingCosLimit);
+    // Drops the matches to culled MapPoints, so the frame can be kept past a quiescent point
+    void DiscardBadMapPoints();
+
+    // Pose matrices computed by UpdatePoseMatrices()
+    const Eigen::Matrix3f& GetRotation() const {return mRcw;}
+    const Eigen::Vector3f& GetTranslation() const {return mtcw;}
+    const Eigen::Vector3f& GetCameraCenter() const {return mOw;}
 
-    // Compute the cell of a keypoint (return false if outside the grid)
+    // Check if a MapPoint is in the frustum of the camera, and gives its projection, predicted scale level and viewing cosine
+    bool isInFrustum(MapPoint* pMP, float viewingCosLimit, float &u, float &v, int &nPredictedLevel, float &viewCos);
+
+    // Compute the cell of a keypoint in the grid of the camera (return false if outside the grid)
     bool PosInGrid(cv::KeyPoint &kp, int &posX, int &posY);
 
+    // Builds mGrid from the undistorted keypoints
+    void AssignFeaturesToGrid();
+
     vector<size_t> GetFeaturesInArea(const float &x, const float  &y, const float  &r, const int minLevel=-1, const int maxLevel=-1) const;
 
+    // Same as above, the indices are written into vIndices (cleared first) so its memory can be reused
+    void GetFeaturesInArea(const float &x, const float  &y, const float  &r, vector<size_t> &vIndices, const int minLevel=-1, const int maxLevel=-1) const;
+
     // Scale Pyramid Info
+    // The finest levels are not extracted in a downscaled frame, its keypoints are from mnFirstLevel on
     int mnScaleLevels;
+    int mnFirstLevel;
     float mfScaleFactor;
     vector<float> mvScaleFactors;
     vector<float> mvLevelSigma2;
     vector<float> mvInvLevelSigma2;
 
-    // Undistorted Image Bounds (computed once)
-    static int mnMinX;
-    static int mnMaxX;
-    static int mnMinY;
-    static int mnMaxY;
+    // Undistorted Image Bounds, those of the camera
+    int mnMinX;
+    int mnMaxX;
+    int mnMinY;
+    int mnMaxY;
 
-    static bool mbInitialComputations;
+    // Sharpness of the image measured before extraction (see ImageQuality), -1 if not measured
+    float mfSharpness;
+
+    // Coarse position from the external prior at the time of the frame (see PositionPrior), set by Tracking
+    // Without one mbPositionPrior is false
+    bool mbPositionPrior;
+    cv::Point3f mPositionPrior;
 
 
 private:
 
     void UndistortKeyPoints();
-    void ComputeImageBounds();
+
+    boost::shared_ptr<const DescriptorIndex> mpDescriptorIndex;
 
     // Call UpdatePoseMatrices(), before using
-    cv::Mat mOw;
-    cv::Mat mRcw;
-    cv::Mat mtcw;
+    Eigen::Vector3f mOw;
+    Eigen::Matrix3f mRcw;
+    Eigen::Vector3f mtcw;
 };
 
 }// namespace ORB_SLAM
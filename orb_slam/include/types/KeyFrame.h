@@ -30,7 +30,15 @@
 #include "dbow2/BowVector.h"
 #include "dbow2/FeatureVector.h"
 
+#include "util/SeqLock.h"
+#include "util/MemoryStats.h"
+#include "util/KeyPointArray.h"
+
+#include <Eigen/Core>
+#include <iosfwd>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
 
 
 namespace ORB_SLAM
@@ -42,8 +50,41 @@ class Frame;
 class KeyFrameDatabase;
 class DatabaseResult;
 
+// Fixed-size copy of a keyframe pose, published on every SetPose
+struct PoseSnapshot
+{
+    float R[9];     // Rcw, row major
+    float t[3];     // tcw
+    float Ow[3];    // camera center in world coordinates
+
+    // Pc = Rcw*Pw + tcw
+    inline void WorldToCamera(const float *pw, float *pc) const
+    {
+        for(int i=0; i<3; i++)
+            pc[i] = R[3*i]*pw[0] + R[3*i+1]*pw[1] + R[3*i+2]*pw[2] + t[i];
+    }
+
+    // Pw = Rcw'*Pc + Ow
+    inline void CameraToWorld(const float *pc, float *pw) const
+    {
+        for(int i=0; i<3; i++)
+            pw[i] = R[i]*pc[0] + R[3+i]*pc[1] + R[6+i]*pc[2] + Ow[i];
+    }
+
+    // Fixed-size views over the same storage
+    inline Eigen::Map<const Eigen::Matrix<float,3,3,Eigen::RowMajor> > Rcw() const
+    {
+        return Eigen::Map<const Eigen::Matrix<float,3,3,Eigen::RowMajor> >(R);
+    }
+    inline Eigen::Map<const Eigen::Vector3f> tcw() const {return Eigen::Map<const Eigen::Vector3f>(t);}
+    inline Eigen::Map<const Eigen::Vector3f> Center() const {return Eigen::Map<const Eigen::Vector3f>(Ow);}
+};
+
 class KeyFrame
 {
+    // Saves and restores the whole keyframe, see MapSerializer
+    friend class MapSerializer;
+
 public:
     KeyFrame(Frame &F, Map* pMap, KeyFrameDatabase* pKFDB);
     
@@ -54,20 +95,37 @@ public:
     // Pose functions
     void SetPose(const cv::Mat &Rcw,const cv::Mat &tcw);
     void SetPose(const cv::Mat &Tcw);
+    void SetPose(const Eigen::Matrix3f &Rcw, const Eigen::Vector3f &tcw);
     cv::Mat GetPose();
     cv::Mat GetPoseInverse();
     cv::Mat GetCameraCenter();
     cv::Mat GetRotation();
     cv::Mat GetTranslation();
 
+    // Lock-free, allocation-free pose access, returns the pose version
+    unsigned long GetPoseSnapshot(PoseSnapshot &pose) const;
+    unsigned long GetPoseVersion() const;
+
+    // Changes with the pose and with the graph edges, so publishers send only changed keyframes
+    unsigned long GetRevision() const;
+
     // Calibration
     cv::Mat GetProjectionMatrix();
     cv::Mat GetCalibrationMatrix() const;
 
     // Bag of Words Representation
     void ComputeBoW();
-    DBoW2::FeatureVector GetFeatureVector();
+    DBoW2::FlatFeatureVector GetFeatureVector();
+    void GetFeatureVector(DBoW2::FlatFeatureVector &featVec);
     DBoW2::BowVector GetBowVector();
+    // Sorted arrays copy of the bag of words, for scoring. It is built again on first use
+    // after the bag of words is computed, loaded or released
+    void GetFlatBowVector(DBoW2::FlatBowVector &vFlatBow);
+
+    // Immutable copies, shared by all the readers until the container changes. Getting one does not copy
+    // the container unless it changed since the last one, hold it instead of copying in the loops
+    typedef boost::shared_ptr<const std::vector<KeyFrame*> > KeyFrameList;
+    typedef boost::shared_ptr<const std::vector<MapPoint*> > MapPointList;
 
     // Covisibility graph functions
     void AddConnection(KeyFrame* pKF, const int &weight);
@@ -76,10 +134,18 @@ public:
     void UpdateBestCovisibles();
     std::set<KeyFrame *> GetConnectedKeyFrames();
     std::vector<KeyFrame* > GetVectorCovisibleKeyFrames();
+    // Covisible keyframes ordered by weight, as GetVectorCovisibleKeyFrames
+    KeyFrameList GetCovisibleList();
     std::vector<KeyFrame*> GetBestCovisibilityKeyFrames(const int &N);
     std::vector<KeyFrame*> GetCovisiblesByWeight(const int &w);
     int GetWeight(KeyFrame* pKF);
 
+    // Map points shared with pKF changed by delta, called by MapPoint as its observations change
+    // UpdateConnections builds the graph from these counts instead of walking the map points
+    void ChangeCovisibility(KeyFrame* pKF, int delta);
+    // Several changes under one lock, see MapPointFusion
+    void ChangeCovisibility(const std::map<KeyFrame*,int> &deltas);
+
     // Spanning tree functions
     void AddChild(KeyFrame* pKF);
     void EraseChild(KeyFrame* pKF);
@@ -96,25 +162,54 @@ public:
     void AddMapPoint(MapPoint* pMP, const size_t &idx);
     void EraseMapPointMatch(const size_t &idx);
     void EraseMapPointMatch(MapPoint* pMP);
+    // Clears the matches at the indexes that still hold their point, in one locked pass
+    void EraseMapPointMatches(const std::vector<std::pair<size_t,MapPoint*> > &vMatches);
     void ReplaceMapPointMatch(const size_t &idx, MapPoint* pMP);
     std::set<MapPoint*> GetMapPoints();
     std::vector<MapPoint*> GetMapPointMatches();
-    int TrackedMapPoints();
+    void GetMapPointMatches(std::vector<MapPoint*> &vpMatches);
+    MapPointList GetMapPointMatchList();
+    // Points of the keypoints from nMinLevel on, those a frame extracted from that level can match
+    int TrackedMapPoints(int nMinLevel=0);
     MapPoint* GetMapPoint(const size_t &idx);
 
     // KeyPoint functions
-    cv::KeyPoint GetKeyPointUn(const size_t &idx) const;
-    cv::Mat GetDescriptor(const size_t &idx);
+    // Undistorted position, orientation and scale level, read from the compact arrays by matching and projection
+    cv::Point2f GetKeyPointPosUn(const size_t &idx) const;
+    float GetKeyPointAngle(const size_t &idx) const;
     int GetKeyPointScaleLevel(const size_t &idx) const;
+    // Arrays of all the keypoints, the positions are there while the payload is in memory
+    const KeyPointArray& GetKeyPointArray() const;
+    // cv::KeyPoint rebuilt from the arrays, for the visualization and the code working on whole keypoints
+    cv::KeyPoint GetKeyPointUn(const size_t &idx) const;
     std::vector<cv::KeyPoint> GetKeyPoints() const;
     std::vector<cv::KeyPoint> GetKeyPointsUn() const;
+    // Descriptors are shared, not copied: their data is replaced but never modified in place
+    // The matrix keeps them alive while it is held, even if the payload is released meanwhile, so its rows
+    // can be read through ptr<uchar>(idx) without locking or allocating. Take it once, outside the matching loops
     cv::Mat GetDescriptors();
     std::vector<size_t> GetFeaturesInArea(const float &x, const float  &y, const float  &r) const;
+    void GetFeaturesInArea(const float &x, const float  &y, const float  &r, std::vector<size_t> &vIndices) const;
 
-    // Image
+    // Image, as stored by the image policy: a copy of the kept or downsampled image, the JPEG image
+    // decoded on each call, or empty if dropped
     cv::Mat GetImage();
     bool IsInImage(const float &x, const float &y) const;
 
+    // What keyframes keep of their image, the pipeline only reads it after creation for visualization
+    enum eImagePolicy{
+        IMAGE_KEEP=0,
+        IMAGE_DROP=1,
+        IMAGE_DOWNSAMPLE=2,
+        IMAGE_JPEG=3
+    };
+
+    // Applies to the keyframes created afterwards. Downsampled images are scaled by 1/fScale, JPEG quality is 0-100
+    static void SetImagePolicy(eImagePolicy policy, float fScale, int nQuality);
+
+    // Encodes the image with the JPEG policy, called by Local Mapping so that tracking does not pay for it
+    void CompressImage();
+
     // Activate/deactivate erasable flags
     void SetNotErase();
     void SetErase();
@@ -123,6 +218,28 @@ public:
     void SetBadFlag();
     bool isBad();
 
+    // Frees the image, descriptors and BoW of a culled keyframe, called by the EpochReclaimer
+    void ReleaseData();
+
+    // Paging of the image, keypoints, descriptors and feature vector while its map is inactive
+    // The BoW vector, grid, pose and graph stay resident. Called through Map, which only pages
+    // out keyframes that no thread is using
+    void WritePayload(std::ostream &f);
+    bool ReadPayload(std::istream &f);
+    void ReleasePayload();
+
+    // Compact paging: once the payload is written, the features with a map point are kept in memory with their
+    // position, angle and vocabulary node, and their descriptor coded against its vocabulary word (ResidualCode)
+    // The rest of the payload is released
+    // ExpandPayload rebuilds them at their indices for relocalization and merge queries, which only match
+    // features with a map point, the other features are left blank. ReadPayload drops them
+    void CompactPayload();
+    void ExpandPayload();
+    // Bytes held by the paged data
+    size_t PayloadBytes();
+    // Adds the bytes held by the keyframe to each category
+    void AccountMemory(MemoryStats &stats);
+
     // Scale functions
     float inline GetScaleFactor(int nLevel=1) const{
         return mvScaleFactors[nLevel];}
@@ -137,16 +254,25 @@ public:
     int inline GetScaleLevels() const{
         return mnScaleLevels;}
 
-    // Median MapPoint depth
+    // Median MapPoint depth (the q-quantile), -1 without points
+    // Cached until the pose or the matches change
     float ComputeSceneMedianDepth(int q = 2);
 
 public:
     static long unsigned int nNextId;
+
+    static eImagePolicy mImagePolicy;
+    static float mfImageScale;
+    static int mnImageQuality;
     long unsigned int mnId;
     long unsigned int mnFrameId;
 
     double mTimeStamp;
 
+    // Coarse position from the external prior of the frame (see Frame::mPositionPrior)
+    bool mbPositionPrior;
+    cv::Point3f mPositionPrior;
+
     // Grid (to speed up feature matching)
     int mnGridCols;
     int mnGridRows;
@@ -154,21 +280,12 @@ public:
     float mfGridElementHeightInv;
 
     // Variables used by the tracking
-    long unsigned int mnTrackReferenceForFrame;
     long unsigned int mnFuseTargetForKF;
 
     // Variables used by the local mapping
     long unsigned int mnBALocalForKF;
     long unsigned int mnBAFixedForKF;
 
-    // Variables used by the keyframe database
-    long unsigned int mnLoopQuery;
-    int mnLoopWords;
-    float mLoopScore;
-    long unsigned int mnRelocQuery;
-    int mnRelocWords;
-    float mRelocScore;
-
     // Calibration parameters
     float fx, fy, cx, cy;
 
@@ -186,12 +303,27 @@ public:
 
 protected:
 
+    // Empty keyframe, filled by the MapSerializer when a map is loaded
+    KeyFrame();
+
+    // Publishes the pose to the snapshot, called with mMutexPose held
+    void PublishPose();
+
+    // Stores the keypoints as extracted and undistorted in the compact arrays
+    // The scale levels are kept when the payload is paged out
+    void StoreKeyPoints(const std::vector<cv::KeyPoint> &vKeys, const std::vector<cv::KeyPoint> &vKeysUn);
+
     // SE3 Pose and camera center
-    cv::Mat Tcw;
-    cv::Mat Ow;
+    Eigen::Matrix3f mRcw;
+    Eigen::Vector3f mtcw;
+    Eigen::Vector3f mOw;
 
-    // Original image, undistorted image bounds, and calibration matrix
+    // Copy of the pose for readers, written under mMutexPose
+    SeqLock<PoseSnapshot> mPoseSnapshot;
+
+    // Image as stored by the policy (see GetImage), JPEG bytes if compressed, undistorted image bounds, and calibration matrix
     cv::Mat im;
+    std::vector<uchar> mvImageJpeg;
     int mnMinX;
     int mnMinY;
     int mnMaxX;
@@ -199,30 +331,48 @@ protected:
     cv::Mat mK;
 
     // KeyPoints, Descriptors, MapPoints vectors (all associated by an index)
-    std::vector<cv::KeyPoint> mvKeys;
-    std::vector<cv::KeyPoint> mvKeysUn;
+    KeyPointArray mKeys;
     cv::Mat mDescriptors;
     std::vector<MapPoint*> mvpMapPoints;
 
     // BoW
     KeyFrameDatabase* mpKeyFrameDB;
     ORBVocabulary* mpORBvocabulary;
-    DBoW2::FeatureVector mFeatVec;
+    DBoW2::FlatFeatureVector mFeatVec;
 
 
     // Grid over the image to speed up feature matching
-    std::vector< std::vector <std::vector<size_t> > > mGrid;
+    FeatureGrid mGrid;
+
+    // Features kept by CompactPayload, their descriptor codes follow each other in mvCompactCodes
+    struct CompactFeature
+    {
+        unsigned int idx;
+        unsigned int node;
+        unsigned int word;
+        float x;
+        float y;
+        float angle;
+    };
+    std::vector<CompactFeature> mvCompactFeatures;
+    std::vector<unsigned char> mvCompactCodes;
 
     std::map<KeyFrame*,int> mConnectedKeyFrameWeights;
     std::vector<KeyFrame*> mvpOrderedConnectedKeyFrames;
     std::vector<int> mvOrderedWeights;
 
+    // Live number of map points shared with each keyframe
+    std::map<KeyFrame*,int> mCovisibilityCounts;
+
     // Spanning Tree and Loop Edges
     bool mbFirstConnection;
     KeyFrame* mpParent;
     std::set<KeyFrame*> mspChildrens;
     std::set<KeyFrame*> mspLoopEdges;
 
+    // Bumped on each change of the covisibility graph, spanning tree or loop edges
+    boost::atomic<unsigned long> mnGraphRevision;
+
     // Erase flags
     bool mbNotErase;
     bool mbToBeErased;
@@ -236,11 +386,30 @@ protected:
 
     Map* mpMap;
 
-    boost::mutex mMutexMap;
-    boost::mutex mMutexPose;
-    boost::mutex mMutexConnections;
-    boost::mutex mMutexFeatures;
+    // Readers take shared locks, writers unique ones
+    boost::shared_mutex mMutexMap;
+    boost::shared_mutex mMutexPose;
+    boost::shared_mutex mMutexConnections;
+    boost::shared_mutex mMutexFeatures;
     boost::mutex mMutexImage;
+    boost::mutex mMutexCovisibility;
+
+    // Lists handed to the readers, reset by the writers (holding the unique lock of their container)
+    // and built again by the first reader, under mMutexLists as readers share the container lock
+    KeyFrameList mpCovisibleList;
+    MapPointList mpMapPointMatchList;
+    boost::mutex mMutexLists;
+
+    // Flat bag of words, built under mMutexFlatBow while readers share mMutexFeatures
+    DBoW2::FlatBowVector mFlatBowVec;
+    boost::mutex mMutexFlatBow;
+
+    // Scene depth of ComputeSceneMedianDepth, with the match list and pose version it was computed from
+    MapPointList mpDepthMatchList;
+    unsigned long mnDepthPoseVersion;
+    int mnDepthQuantile;
+    float mfSceneDepth;
+    boost::mutex mMutexSceneDepth;
 };
 
 } //namespace ORB_SLAM
@@ -24,14 +24,20 @@
 #include <vector>
 #include <list>
 #include <set>
+#include <map>
 
 #include "types/KeyFrame.h"
 #include "types/Frame.h"
 #include "types/ORBVocabulary.h"
+#include "dbow2/BowVector.h"
+#include "util/MemoryStats.h"
 
 #include <ros/ros.h>
 
 #include <boost/thread.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/atomic.hpp>
+#include <boost/unordered_map.hpp>
 
 
 namespace ORB_SLAM
@@ -39,36 +45,146 @@ namespace ORB_SLAM
 
 class KeyFrame;
 class Frame;
+class Map;
 
 
 class KeyFrameDatabase
 {
 public:
 
-  KeyFrameDatabase(const ORBVocabulary &voc);
+  // Adds and erases are also applied to the global database, if any
+  // The global database indexes every word of the vocabulary. A map database only holds the words of its
+  // keyframes, so creating one is cheap and its memory grows with its keyframes
+  KeyFrameDatabase(const ORBVocabulary &voc, KeyFrameDatabase* pGlobalDB = NULL);
 
+  ~KeyFrameDatabase();
+
+  // Does not wait for the queries, the keyframe is indexed before the next query or erase
   void add(KeyFrame* pKF);
 
   void erase(KeyFrame* pKF);
 
   void clear();
 
+  // Queries are re-entrant, any number of them can run at the same time
+  // Keyframes of erased maps and of the ignored map are not candidates
   // Loop Detection
-  std::vector<KeyFrame*> DetectLoopCandidates(KeyFrame* pKF, float minScore);
+  std::vector<KeyFrame*> DetectLoopCandidates(KeyFrame* pKF, float minScore, Map* pIgnoreMap = NULL);
+
+  // Loop and merge detection with one search of the inverted file: the candidates in pLoopMap and those
+  // in the other maps, each ranked as by its own query
+  void DetectLoopCandidates(KeyFrame* pKF, float minScore, Map* pLoopMap,
+                            std::vector<KeyFrame*> &vpLoopCandidates, std::vector<KeyFrame*> &vpMergeCandidates);
 
   // Relocalisation
-  std::vector<KeyFrame*> DetectRelocalisationCandidates(Frame* F);
+  std::vector<KeyFrame*> DetectRelocalisationCandidates(Frame* F, Map* pIgnoreMap = NULL);
+
+  // BoW similarity of two keyframes, vBow1 being the flat bag of words of pKF1
+  // Scores are cached by keyframe ids until either keyframe is erased. The cache of the global database,
+  // if any, is the one used, so loop closing, map merging and the loop queries share the scores
+  float Score(KeyFrame* pKF1, const DBoW2::FlatBowVector &vBow1, KeyFrame* pKF2);
+
+  // Two stage retrieval: the keyframes are first ranked by their bags of nodes nLevelsUp levels up the
+  // vocabulary tree, and only the nShortlist best are scored with their words (0 - disabled)
+  // The stage is skipped while the database holds fewer keyframes than the shortlist
+  // The coarse index is rebuilt from the keyframes already indexed
+  void SetShortlist(int nShortlist, int nLevelsUp);
+
+  // Queries skip the keyframes whose position prior is farther than fRadius from that of the query (0 - disabled)
+  // Keyframes and queries without a position prior are not filtered (see PositionPrior)
+  void SetPriorRadius(float fRadius);
+
+  // Adds the bytes held by the inverted file, the slots and the score cache
+  void AccountMemory(MemoryStats &stats);
 
 protected:
 
+  // Entry of the inverted file, the slot of a keyframe and the weight of the word in it
+  struct Posting
+  {
+    unsigned int slot;
+    DBoW2::WordValue weight;
+  };
+
+  // Keyframe added and not yet in the inverted file
+  struct PendingKeyFrame
+  {
+    KeyFrame* pKF;
+    PendingKeyFrame* pNext;
+  };
+
+  // Moves the pending keyframes into the inverted file, the index must be locked exclusively
+  void ApplyPending();
+  void Insert(KeyFrame* pKF);
+  void InsertCoarse(unsigned int slot, KeyFrame* pKF);
+
+  // Bag of nodes mnCoarseLevelsUp levels up, the weight of a node is the sum of the weights of its words
+  void CoarseBow(const DBoW2::BowVector &vBow, std::map<DBoW2::NodeId,DBoW2::WordValue> &mCoarseBow) const;
+
+  // Slots of the keyframes with the best coarse scores, the index must be locked
+  void Shortlist(const DBoW2::BowVector &vBow, const std::vector<unsigned char> &vbFar,
+                 std::vector<unsigned int> &vSlots) const;
+
+  // Flags the slots too far from the position prior, empty if nothing is filtered. The index must be locked
+  void FarSlots(const cv::Point3f* pPrior, std::vector<unsigned char> &vbFar) const;
+
+  // Postings of a word, NULL if no keyframe has it
+  const std::vector<Posting>* FindPostings(DBoW2::WordId wordId) const;
+
+  // Keyframes sharing words with the query and near its position prior (NULL - anywhere), in the order they are first found
+  // With their number of shared words and, for the L1 score, the score accumulated from the postings
+  // Returns false if the scores have to be computed from the bags of words
+  // With a shortlist, only the shortlisted keyframes are returned, scored with their flat bags of words
+  // The scratch state is local to the query, nothing is written into the keyframes
+  bool Gather(const DBoW2::BowVector &vBow, const cv::Point3f* pPrior, std::vector<KeyFrame*> &vpKFs,
+              std::vector<int> &vnWords, std::vector<float> &vScores);
+
+  // Loop candidates among the gathered keyframes left, those scoring above minScore and accumulated by covisibility
+  std::vector<KeyFrame*> SelectLoopCandidates(KeyFrame* pKF, float minScore, const std::vector<KeyFrame*> &vpKFsSharingWords,
+                                              const std::vector<int> &vnCommonWords, const std::vector<float> &vScores,
+                                              bool bScored);
+
+  // Drops the postings of the erased keyframes and renumbers the slots
+  void Compact();
+
+  // Drops the cached scores of a keyframe
+  void EraseScores(KeyFrame* pKF);
+
   // Associated vocabulary
   const ORBVocabulary* mpVoc;
 
-  // Inverted file
-  std::vector<list<KeyFrame*> > mvInvertedFile;
+  // Database indexing the keyframes of all the maps
+  KeyFrameDatabase* mpGlobalDB;
+
+  // Inverted file, contiguous postings per word
+  // Indexed by word in the global database (dense), hashed by word in the map databases (sparse)
+  bool mbSparse;
+  std::vector<std::vector<Posting> > mvInvertedFile;
+  boost::unordered_map<DBoW2::WordId,std::vector<Posting> > mSparseInvertedFile;
+
+  // Coarse index, postings of the nodes mnCoarseLevelsUp levels up from the words, empty while disabled
+  int mnShortlist;
+  int mnCoarseLevelsUp;
+  boost::unordered_map<DBoW2::NodeId,std::vector<Posting> > mCoarseInvertedFile;
+
+  // Radius around the position prior of a query, 0 if disabled
+  float mfPriorRadius;
+
+  // Keyframe of each slot, NULL once erased (tombstone)
+  std::vector<KeyFrame*> mvpSlotKeyFrames;
+  std::map<KeyFrame*,unsigned int> mmSlots;
+  unsigned int mnTombstones;
+
+  // Keyframes added since the last update of the index, most recent first
+  boost::atomic<PendingKeyFrame*> mpPending;
+
+  // Queries share the index, updates lock it exclusively
+  boost::shared_mutex mMutex;
 
-  // Mutex
-  boost::mutex mMutex;
+  // Cached scores, stored under both orders of the keyframe ids
+  typedef std::pair<long unsigned int,long unsigned int> ScoreKey;
+  std::map<ScoreKey,float> mmScores;
+  boost::mutex mMutexScores;
 };
 
 } //namespace ORB_SLAM
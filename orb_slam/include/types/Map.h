@@ -24,9 +24,16 @@
 #include "types/MapPoint.h"
 #include "types/KeyFrame.h"
 #include "types/KeyFrameDatabase.h"
+#include "types/MapSnapshot.h"
+#include "types/EssentialGraph.h"
+#include "util/ObjectPool.h"
+#include "util/SlotTable.h"
+#include "util/SpatialIndex.h"
 
 #include <set>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
 #include <opencv2/core/core.hpp>
 
 
@@ -37,23 +44,42 @@ namespace ORB_SLAM
 class MapPoint;
 class KeyFrame;
 class KeyFrameDatabase;
+class MapSnapshot;
+class MapJournal;
 
 class Map
 {
 public:
+    typedef SlotTable<MapPoint>::Snapshot MapPointSnapshot;
+    typedef SlotTable<KeyFrame>::Snapshot KeyFrameSnapshot;
+
     Map();
     ~Map();
 
+    static long unsigned int nNextId;
+    long unsigned int mnId;
+
     void AddKeyFrame(KeyFrame* pKF);
     void AddMapPoint(MapPoint* pMP);
     void EraseMapPoint(MapPoint* pMP);
+    // Same as EraseMapPoint for each point, under one lock of the map
+    void EraseMapPoints(const std::vector<MapPoint*> &vpMPs);
     void EraseKeyFrame(KeyFrame* pKF);
+    // Erasing retires the object to the EpochReclaimer, map points are freed and culled
+    // keyframes release their image and descriptors once no thread can be using them
+    // Detaching only drops it from this map, used when it moves to another one
+    void DetachMapPoint(MapPoint* pMP);
+    void DetachKeyFrame(KeyFrame* pKF);
     void SetCurrentCameraPose(cv::Mat Tcw);
     void SetReferenceKeyFrames(const std::vector<KeyFrame*> &vpKFs);
     void SetReferenceMapPoints(const std::vector<MapPoint*> &vpMPs);
 
     std::vector<KeyFrame*> GetAllKeyFrames();
     std::vector<MapPoint*> GetAllMapPoints();
+    // Views of all the keyframes and points, in id order, taken without copying them
+    // They may include objects set bad after the snapshot was taken
+    KeyFrameSnapshot GetKeyFrameSnapshot();
+    MapPointSnapshot GetMapPointSnapshot();
     cv::Mat GetCameraPose();
     std::vector<KeyFrame*> GetReferenceKeyFrames();
     std::vector<MapPoint*> GetReferenceMapPoints();
@@ -64,31 +90,102 @@ public:
     void SetFlagAfterBA();
     bool isMapUpdated();
     void ResetUpdated();
+
+    // Incremented when a keyframe or a map point is added or erased, after each bundle adjustment
+    // and around updates. Tracking compares it to decide if its local map is still valid
+    unsigned long GetVersion() const;
+
+    // Bracket writes to many poses and positions, such as a loop correction or the BA results
+    // Snapshots are not taken in between, readers keep the last consistent one
+    void BeginUpdate();
+    void EndUpdate();
+
+    // Copy of the map at the current version, shared by all the readers of that version
+    // Built by the first reader after a change, writers are never blocked by it
+    boost::shared_ptr<const MapSnapshot> GetSnapshot();
     
     bool getErased();
     void setErased(bool b);
 
     unsigned int GetMaxKFid();
+
+    // Writes the pose of each good keyframe, sorted by id
+    // One line per keyframe: timestamp tx ty tz qx qy qz qw
+    bool SaveKeyFrameTrajectory(const std::string &filename);
     
+    // Paging of the keyframe payloads (image, keypoints, descriptors and feature vector) to disk
+    // Poses, the graph, the map points and the BoW postings stay resident, so queries still find the keyframes
+    // A pinned map is faulted in and is not paged out until every pin is released
+    // Compact: the features with a map point stay in memory (see KeyFrame::CompactPayload), a query pin
+    // (bQuery) only expands them, without reading the page file. A full pin or PageIn reads it
+    void Pin(bool bQuery=false);
+    void Unpin();
+    bool PageOut(const std::string &filename, bool bCompact=false);
+    bool PageIn();
+    bool isPagedOut();
+    // Bytes held by the keyframe payloads, what paging the map out frees
+    size_t PayloadBytes();
+    // Stamp of the last pin, lower is less recently used
+    unsigned long LastUsed();
+
+    // Adds the bytes held by the keyframes, the points and the keyframe database of the map
+    // Walks the whole map, meant for periodic reports
+    void AccountMemory(MemoryStats &stats);
+
     boost::mutex mMutexKeyFrameDB;
     void SetKeyFrameDB(KeyFrameDatabase* mpKeyFrameDB);
     KeyFrameDatabase* GetKeyFrameDatabase();
 
+    // Log the erasures are written to, the one of the map database that created the map
+    void SetJournal(MapJournal* pJournal);
+
+    // Map points by position, kept up to date as points are added, moved and erased
+    SpatialIndex* GetSpatialIndex();
+
+    // Spanning tree, loop and strong covisibility edges, kept up to date as the keyframes link
+    EssentialGraph* GetEssentialGraph();
+
     void clear();
 
 protected:
-    std::set<MapPoint*> mspMapPoints;
-    std::set<KeyFrame*> mspKeyFrames;
+    SlotTable<MapPoint> mMapPoints;
+    SlotTable<KeyFrame> mKeyFrames;
+    SpatialIndex mSpatialIndex;
+    EssentialGraph mEssentialGraph;
 
-    std::vector<MapPoint*> mvpReferenceMapPoints;
+    // Handles, the points may be freed while they are still referenced here
+    std::vector<PoolHandle<MapPoint> > mvReferenceMapPoints;
 
     unsigned int mnMaxKFid;
     
     KeyFrameDatabase* mpKeyFrameDB;
 
+    MapJournal* mpJournal;
+
     boost::mutex mMutexMap;
     bool mbMapUpdated;
+    boost::atomic<unsigned long> mnVersion;
+    int mnUpdating;
+
+    // Last snapshot, mMutexSnapshot serialises the readers building it
+    boost::mutex mMutexSnapshot;
+    boost::shared_ptr<const MapSnapshot> mpSnapshot;
     bool isErased;
+
+    // Reads the paged payloads back, mMutexPaging must be held
+    bool FaultIn();
+
+    // Paging state, mMutexPaging is held while the page file is written or read
+    boost::mutex mMutexPaging;
+    int mnPins;
+    bool mbPagedOut;
+    // Paged out compact, and expanded for a query since
+    bool mbCompact;
+    bool mbExpanded;
+    unsigned long mnLastUsed;
+    std::string mPageFile;
+    std::vector<KeyFrame*> mvpPagedKeyFrames;
+    static boost::atomic<unsigned long> nUseClock;
 };
 
 } //namespace ORB_SLAM
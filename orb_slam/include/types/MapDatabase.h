@@ -21,14 +21,20 @@
 #include <vector>
 #include <list>
 #include <set>
+#include <string>
 
 #include "types/MapPoint.h"
 #include "types/Map.h"
 #include "types/KeyFrame.h"
 #include "types/Frame.h"
 #include "types/ORBVocabulary.h"
+#include "types/KeyFrameDatabase.h"
+
+#include "util/MappedFile.h"
+#include "util/MemoryStats.h"
 
 #include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace ORB_SLAM
 {
@@ -37,13 +43,17 @@ class MapPoint;
 class Map;
 class KeyFrame;
 class Frame;
+class MapJournal;
 
 class MapDatabase
 {
 public:
 
-    // Constructor
-    MapDatabase(ORBVocabulary* vocab);
+    // Immutable list of the maps, adding or removing a map replaces it instead of changing it
+    typedef boost::shared_ptr<const std::vector<Map*> > MapList;
+
+    // Constructor, the vocabulary can still be loading (see setVocabLoaded)
+    MapDatabase(ORBVocabulary* vocab, bool bVocabLoaded=true);
     
     // Returns a complete map object
     // This will be loaded with the vocab we have
@@ -76,26 +86,117 @@ public:
     // Gets the vocab object
     ORBVocabulary* getVocab();
 
-    // Gets all maps
+    // The vocabulary loaded in the background, false if its loading failed
+    // Nothing is converted to BoW nor added to the keyframe databases until then
+    void setVocabLoaded(bool bLoaded);
+    bool isVocabLoaded();
+
+    // Blocks until the vocabulary is loaded, false if its loading failed
+    bool waitForVocab();
+
+    // Gets all maps, as a copy
     std::vector<Map*> getAll();
+
+    // Gets all maps, consistent while other threads add or remove maps
+    // Iterating it does not allocate nor lock
+    MapList getMaps();
+
+    // Incremented each time a map is added or removed
+    unsigned long getVersion();
     
     // Returns the older of the two maps
     Map* getOldest(Map* m1, Map* m2);
 
+    // Keyframe payloads kept in memory (0 for no limit) and the directory the paged out maps go to
+    // bCompact: the paged out maps keep the features with a map point in memory for the queries
+    void setMemoryBudget(std::size_t nBytes, const std::string &pageDir, bool bCompact=false);
+
+    // Pages out the least recently used inactive maps until the resident payloads fit in the budget
+    // Erased maps go first, the current map is pinned and never paged out
+    void enforceMemoryBudget();
+
+    // Pins the maps of the keyframes for a query, paged out maps are faulted in or, if compact, expanded
+    // unpinMaps releases them
+    void pinMaps(const std::vector<KeyFrame*> &vpKFs, std::vector<Map*> &vpPinned);
+    void unpinMaps(std::vector<Map*> &vpPinned);
+
+    // Place recognition over the keyframes of all the maps, a single query ranks the candidates of every map
+    // Keyframes of erased maps and of the ignored map are not candidates
+    std::vector<KeyFrame*> DetectLoopCandidates(KeyFrame* pKF, float minScore, Map* pIgnoreMap);
+    // One query for loop closing and map merging, candidates in pLoopMap and in the other maps
+    // (see KeyFrameDatabase::DetectLoopCandidates)
+    void DetectLoopCandidates(KeyFrame* pKF, float minScore, Map* pLoopMap,
+                              std::vector<KeyFrame*> &vpLoopCandidates, std::vector<KeyFrame*> &vpMergeCandidates);
+    std::vector<KeyFrame*> DetectRelocalisationCandidates(Frame* F);
+
+    // Coarse to fine retrieval in the shared keyframe database and in those of the maps created after
+    // (see KeyFrameDatabase::SetShortlist)
+    void setShortlist(int nShortlist, int nLevelsUp);
+
+    // Radius of the position prior filter of the keyframe databases (see KeyFrameDatabase::SetPriorRadius)
+    void setPriorRadius(float fRadius);
+
+    // Log of the changes to the maps, given to the maps created after (MapJournal::Global() unless set)
+    // The sessions of a multi-session host each have their own
+    void setJournal(MapJournal* pJournal);
+    MapJournal* getJournal();
+
+    // BoW similarity of two keyframes, cached in the shared keyframe database (see KeyFrameDatabase::Score)
+    float Score(KeyFrame* pKF1, const DBoW2::FlatBowVector &vBow1, KeyFrame* pKF2);
+
+    // Bytes held by each map, and their total with the shared keyframe database and the vocabulary
+    // Walks every map in place, the caller must be registered with the EpochReclaimer
+    void accountMemory(std::vector<std::pair<long unsigned int,MemoryStats> > &vMapStats, MemoryStats &total);
+
+    // Keeps a loaded map file mapped as long as the database, its keyframes and points use it in place
+    void addMappedFile(const boost::shared_ptr<MappedFile> &pFile);
+
 protected:
 
+    // Removes the map at that position, mapMutex must be held
+    void removeAt(std::size_t i);
+
     // The ID of the current map
     unsigned int currentMapID;
     
     // Vocabulary
     ORBVocabulary* vocab;
 
-    // List of all maps we have
-    std::vector<Map*> maps;
+    // State of the vocabulary loading, guarded by vocMutex
+    enum eVocabState{
+        VOCAB_LOADING=0,
+        VOCAB_LOADED=1,
+        VOCAB_FAILED=2
+    };
+    eVocabState vocabState;
+    boost::condition_variable vocabLoaded;
+
+    // List of all maps we have, replaced on each change
+    MapList maps;
+    unsigned long version;
 
     // Mutex
     boost::mutex mapMutex;
     boost::mutex vocMutex;
+    boost::mutex pagingMutex;
+
+    // Keyframes of all the maps, the keyframe database of each map adds to it
+    KeyFrameDatabase mKeyFrameDB;
+
+    // Coarse to fine retrieval of the keyframe databases, guarded by vocMutex
+    int shortlist;
+    int shortlistLevelsUp;
+    float priorRadius;
+
+    MapJournal* journal;
+
+    // Memory budget of the keyframe payloads, in bytes
+    std::size_t memoryBudget;
+    std::string pageDir;
+    bool compactPaging;
+
+    // Mapped map files, guarded by vocMutex
+    std::vector<boost::shared_ptr<MappedFile> > mappedFiles;
 
 };
 
@@ -23,10 +23,19 @@
 
 #include "types/KeyFrame.h"
 #include "types/Map.h"
+#include "util/SmallVector.h"
+#include "util/DescriptorMedoid.h"
+#include "util/MemoryStats.h"
+#include "util/LockProfiler.h"
+#include "dbow2/Hamming.h"
 
 #include <opencv2/core/core.hpp>
+#include <Eigen/Core>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
 
 namespace ORB_SLAM
 {
@@ -37,23 +46,75 @@ class Map;
 
 class MapPoint
 {
+    // Saves and restores the whole point, see MapSerializer
+    friend class MapSerializer;
+    // Moves observations in batches, see MapPointFusion
+    friend class MapPointFusion;
+
 public:
+    // Keyframe observing the point and index of the keypoint in it
+    typedef std::pair<KeyFrame*,size_t> Observation;
+    // Most points are seen by a few keyframes, those lists are kept without heap allocations
+    typedef SmallVector<Observation,8> ObservationList;
+
     MapPoint(const cv::Mat &Pos, KeyFrame* pRefKF, Map* pMap);
 
+    // MapPoints live in an ObjectPool, culled ones go back to it after the grace period
+    static void* operator new(size_t size);
+    static void operator delete(void* p);
+
     void SetWorldPos(const cv::Mat &Pos);
+    void SetWorldPos(const Eigen::Vector3f &Pos);
     cv::Mat GetWorldPos();
+    Eigen::Vector3f GetWorldPosEigen();
+
+    // Bumped on each change of the position, so publishers send only changed points
+    unsigned long GetRevision() const;
 
     Map* getMap();
     void setMap(Map* m);
 
     cv::Mat GetNormal();
+    Eigen::Vector3f GetNormalEigen();
     KeyFrame* GetReferenceKeyFrame();
 
-    std::map<KeyFrame*,size_t> GetObservations();
+    ObservationList GetObservations();
     int Observations();
 
+    // Calls visitor(pKF,idx) for each observation under a shared lock, without copying them
+    // The visitor must not call back into this point
+    template<class Visitor>
+    void VisitObservations(Visitor &visitor)
+    {
+        PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
+        for(ObservationList::const_iterator it=mObservations.begin(), itend=mObservations.end(); it!=itend; it++)
+            visitor(it->first,it->second);
+    }
+
+    // Visitor counting the keyframes that observe the visited points, except pSkipKF
+    struct KeyFrameCounter
+    {
+        KeyFrameCounter(std::map<KeyFrame*,int> &counter, KeyFrame* pSkipKF=NULL):
+            mCounter(counter), mpSkipKF(pSkipKF)
+        {}
+
+        void operator()(KeyFrame* pKF, size_t)
+        {
+            if(pKF!=mpSkipKF)
+                mCounter[pKF]++;
+        }
+
+        std::map<KeyFrame*,int> &mCounter;
+        KeyFrame* mpSkipKF;
+    };
+
+    // Keyframes observing the point at the given scale level or a finer one, without copying the observations
+    int ObservationsUpToLevel(int nLevel);
+
     void AddObservation(KeyFrame* pKF,size_t idx);
     void EraseObservation(KeyFrame* pKF);
+    // Erases the observations of several keyframes under one lock
+    void EraseObservations(const std::vector<KeyFrame*> &vpKFs);
 
     int GetIndexInKeyFrame(KeyFrame* pKF);
     bool IsInKeyFrame(KeyFrame* pKF);
@@ -61,6 +122,10 @@ public:
     void SetBadFlag();
     bool isBad();
 
+    // Adds the bytes held by the point to each category, and to the bad ones if it is bad
+    void AccountMemory(MemoryStats &stats);
+
+    // Single replacement, a MapPointFusion replaces several at once
     void Replace(MapPoint* pMP);
 
     void IncreaseVisible();
@@ -69,27 +134,31 @@ public:
 
     void ComputeDistinctiveDescriptors();
 
-    cv::Mat GetDescriptor();
+    // Copied by value, no buffer is shared or allocated
+    DBoW2::Descriptor256 GetDescriptor();
 
     void UpdateNormalAndDepth();
 
+    // Camera centers of keyframes, read once for a batch of points and sorted by keyframe
+    typedef std::vector<std::pair<KeyFrame*,Eigen::Vector3f> > KeyFrameCenters;
+    static void SnapshotCenters(const std::vector<KeyFrame*> &vpKFs, KeyFrameCenters &centers);
+
+    // SetWorldPos and UpdateNormalAndDepth with one copy of the observations
+    // The observers in centers are not asked for their pose
+    void SetWorldPosAndNormal(const Eigen::Vector3f &Pos, const KeyFrameCenters &centers);
+
     float GetMinDistanceInvariance();
     float GetMaxDistanceInvariance();
 
+    // Position, normal and scale invariance distances read under a single lock
+    void GetFrustumData(Eigen::Vector3f &Pos, Eigen::Vector3f &Normal, float &minDist, float &maxDist);
+
 public:
     long unsigned int mnId;
-    static long unsigned int nNextId;
+    // Points are created concurrently by the Local Mapping workers
+    static boost::atomic<long unsigned int> nNextId;
     long int mnFirstKFid;
 
-    // Variables used by the tracking
-    float mTrackProjX;
-    float mTrackProjY;
-    bool mbTrackInView;
-    int mnTrackScaleLevel;
-    float mTrackViewCos;
-    long unsigned int mnTrackReferenceForFrame;
-    long unsigned int mnLastFrameSeen;
-
     // Variables used by local mapping
     long unsigned int mnBALocalForKF;
     long unsigned int mnFuseCandidateForKF;
@@ -102,23 +171,45 @@ public:
 protected:    
 
      // Position in absolute coordinates
-     cv::Mat mWorldPos;
+     Eigen::Vector3f mWorldPos;
 
      // Keyframes observing the point and associated index in keyframe
-     std::map<KeyFrame*,size_t> mObservations;
+     ObservationList mObservations;
+     ObservationList::iterator FindObservation(KeyFrame* pKF);
+
+     // Keep the covisibility counts of the keyframes in step with the observations
+     // pKF gains or loses delta shared points with each keyframe of obs, both ways
+     static void ChangeCovisibility(const ObservationList &obs, KeyFrame* pKF, int delta);
+     // Each pair of keyframes of obs loses one shared point
+     static void ClearCovisibility(const ObservationList &obs);
+
+     // Observations by scale level of the keypoint, updated with mObservations
+     std::vector<int> mvnLevelObservations;
+     void CountLevelObservations();
+
+     // Mean viewing direction and depth range seen from the observations at Pos
+     void ComputeNormalAndDepth(const ObservationList &observations, KeyFrame* pRefKF, const Eigen::Vector3f &Pos,
+                                const KeyFrameCenters* pCenters, Eigen::Vector3f &normal, float &fMinDistance, float &fMaxDistance);
 
      // Mean viewing direction
-     cv::Mat mNormalVector;
+     Eigen::Vector3f mNormalVector;
 
      // Best descriptor to fast matching
-     cv::Mat mDescriptor;
+     DBoW2::Descriptor256 mDescriptor;
+
+     // Descriptors of the observations as of the last ComputeDistinctiveDescriptors
+     DescriptorMedoid mDescriptorMedoid;
+     ObservationList mDescriptorObservations;
 
      // Reference KeyFrame
      KeyFrame* mpRefKF;
 
-     // Tracking counters
-     int mnVisible;
-     int mnFound;
+     // Tracking counters, incremented by several threads without locking
+     boost::atomic<int> mnVisible;
+     boost::atomic<int> mnFound;
+
+     // Position changes
+     boost::atomic<unsigned long> mnRevision;
 
      // Bad flag (we do not currently erase MapPoint from memory)
      bool mbBad;
@@ -129,11 +220,13 @@ protected:
 
      Map* mpMap;
 
-     boost::mutex mMutexPos;
-     boost::mutex mMutexMap;
-     boost::mutex mMutexFeatures;
-     boost::mutex mMutexIsBad;
-     boost::mutex mMutexDescriptor;
+     // Readers take shared locks so tracking never waits on other readers
+     boost::shared_mutex mMutexPos;
+     boost::shared_mutex mMutexMap;
+     boost::shared_mutex mMutexFeatures;
+     boost::shared_mutex mMutexIsBad;
+     boost::shared_mutex mMutexDescriptor;
+     boost::mutex mMutexDescriptorCache;
 };
 
 } //namespace ORB_SLAM
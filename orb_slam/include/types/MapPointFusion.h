@@ -0,0 +1,73 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef MAPPOINTFUSION_H
+#define MAPPOINTFUSION_H
+
+#include <map>
+#include <set>
+#include <vector>
+
+namespace ORB_SLAM
+{
+
+class KeyFrame;
+class MapPoint;
+
+// Replaces duplicated map points in batches, for the fuse and loop correction steps
+// Observations and keyframe slots are moved at once, so the checks of the caller between two
+// replacements see the same state as with MapPoint::Replace. The covisibility counts are
+// accumulated and applied with one lock per affected keyframe, and the descriptor of each
+// surviving point is recomputed once, on Commit
+class MapPointFusion
+{
+public:
+    MapPointFusion();
+
+    // pOld is set bad and its observations go to pNew, as pOld->Replace(pNew)
+    void Replace(MapPoint* pOld, MapPoint* pNew);
+
+    // New measurement of pMP, as pMP->AddObservation(pKF,idx) and pKF->AddMapPoint(pMP,idx)
+    void Add(MapPoint* pMP, KeyFrame* pKF, size_t idx);
+
+    // Applies the covisibility changes, recomputes the descriptors of the surviving points
+    // and erases the replaced ones from their maps. Must be called before the batch goes away
+    void Commit();
+
+    // Points replaced since the batch was created
+    int Replaced() const;
+
+protected:
+
+    void ChangeCovisibility(KeyFrame* pKF1, KeyFrame* pKF2, int delta);
+
+    // Pending change of the shared points, by keyframe and then by covisible keyframe
+    std::map<KeyFrame*,std::map<KeyFrame*,int> > mCovisibility;
+
+    std::set<MapPoint*> mspSurvivors;
+    std::vector<MapPoint*> mvpReplaced;
+
+    int mnReplaced;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPPOINTFUSION_H
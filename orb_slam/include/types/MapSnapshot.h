@@ -0,0 +1,79 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPSNAPSHOT_H
+#define MAPSNAPSHOT_H
+
+#include "types/KeyFrame.h"
+
+#include <vector>
+
+namespace ORB_SLAM
+{
+
+class Map;
+
+// Immutable copy of the good keyframes and points of a map, taken at one map version
+// Readers share it through Map::GetSnapshot and never touch the live objects
+class MapSnapshot
+{
+public:
+
+    struct KeyFrameState
+    {
+        long unsigned int nId;
+        // KeyFrame::GetRevision when copied
+        unsigned long nRevision;
+        double timeStamp;
+        PoseSnapshot pose;
+        // Ids of the spanning tree parent (or the keyframe itself for the root),
+        // of the covisibles with a weight of at least 100, and of the loop edges
+        long unsigned int nParentId;
+        std::vector<long unsigned int> vCovisibleIds;
+        std::vector<long unsigned int> vLoopEdgeIds;
+    };
+
+    struct MapPointState
+    {
+        long unsigned int nId;
+        // MapPoint::GetRevision when copied
+        unsigned long nRevision;
+        float pos[3];
+        // Keyframes observing the point
+        int nObs;
+    };
+
+    // Copies the map, built by Map::GetSnapshot
+    MapSnapshot(Map* pMap, unsigned long nVersion);
+
+    // Keyframe with that id, NULL if it is not in the snapshot
+    const KeyFrameState* FindKeyFrame(long unsigned int nId) const;
+
+    // Map version the snapshot was taken at
+    unsigned long mnVersion;
+
+    // Both sorted by id
+    std::vector<KeyFrameState> mvKeyFrames;
+    std::vector<MapPointState> mvMapPoints;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPSNAPSHOT_H
@@ -25,12 +25,21 @@
 #include "dbow2/FORB.h"
 #include "dbow2/TemplatedVocabulary.h"
 
+#include <algorithm>
+
 namespace ORB_SLAM
 {
 
 typedef DBoW2::TemplatedVocabulary<DBoW2::FORB::TDescriptor, DBoW2::FORB>
   ORBVocabulary;
 
+// Levels up from the words to the nodes of the feature vectors (direct index)
+// The nodes stay at the second level whatever the tier, as 4 levels up in the 6 level vocabulary
+inline int FeatureVectorLevelsUp(const ORBVocabulary &voc)
+{
+    return std::max(voc.getDepthLevels()-2,0);
+}
+
 } //namespace ORB_SLAM
 
 #endif // ORBVOCABULARY_H
@@ -0,0 +1,61 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef ALIGNEDALLOCATOR_H
+#define ALIGNEDALLOCATOR_H
+
+#include <cstddef>
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM
+{
+
+// Matrix allocator of 64-byte aligned buffers, a cache line and the widest SIMD load
+// Buffers of HUGE_PAGE_SIZE or more are mapped on a huge page boundary and advised as transparent huge pages,
+// so that a pyramid or a large descriptor matrix spans a few TLB entries
+// Set it on a matrix before it is created (mat.allocator = AlignedAllocator::Get()), the matrix keeps it when
+// it is created again, its views share the buffer and copies into other matrices use their own allocator
+class AlignedAllocator: public cv::MatAllocator
+{
+public:
+    static AlignedAllocator* Get();
+
+    static const size_t ALIGNMENT = 64;
+    static const size_t HUGE_PAGE_SIZE = 2*1024*1024;
+
+    // Raw buffers, Free takes a pointer returned by Allocate
+    static void* Allocate(size_t nBytes);
+    static void Free(void* pData);
+
+#if CV_MAJOR_VERSION>=3
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags,
+                           cv::UMatUsageFlags usageFlags) const;
+    bool allocate(cv::UMatData* data, int accessFlags, cv::UMatUsageFlags usageFlags) const;
+    void deallocate(cv::UMatData* data) const;
+#else
+    void allocate(int dims, const int* sizes, int type, int*& refcount, uchar*& datastart, uchar*& data, size_t* step);
+    void deallocate(int* refcount, uchar* datastart, uchar* data);
+#endif
+};
+
+} //namespace ORB_SLAM
+
+#endif // ALIGNEDALLOCATOR_H
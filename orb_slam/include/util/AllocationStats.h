@@ -0,0 +1,127 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef ALLOCATIONSTATS_H
+#define ALLOCATIONSTATS_H
+
+#include <vector>
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace ORB_SLAM
+{
+
+// Heap allocations per stage of the pipeline, attributed to the innermost stage entered by the allocating thread
+// Built with ORB_SLAM_ALLOC_STATS, which interposes malloc, calloc, realloc and posix_memalign (glibc only),
+// so operator new, the OpenCV and the Eigen allocations are counted too. The hook only takes effect for
+// the executables linked against the library, not for a library loaded later like the nodelet
+// Each thread counts into its own counters without locking, the reports add them up
+class AllocationStats
+{
+public:
+    enum eStage{
+        FRAME=0,
+        TRACK,
+        TRACK_LOCAL_MAP,
+        PROCESS_NEW_KEYFRAME,
+        MAP_POINT_CULLING,
+        CREATE_NEW_MAP_POINTS,
+        SEARCH_IN_NEIGHBORS,
+        KEYFRAME_CULLING,
+        POSE_OPTIMIZATION,
+        LOCAL_BUNDLE_ADJUSTMENT,
+        BUNDLE_ADJUSTMENT,
+        ESSENTIAL_GRAPH,
+        OPTIMIZE_SIM3,
+        N_STAGES
+    };
+
+    // Allocations of a stage, and the times it was entered
+    struct Counts
+    {
+        Counts(): nCalls(0), nAllocations(0), nBytes(0) {}
+
+        unsigned long long nCalls;
+        unsigned long long nAllocations;
+        unsigned long long nBytes;
+    };
+
+    static AllocationStats* Global();
+
+    // Built with ORB_SLAM_ALLOC_STATS
+    static bool isEnabled();
+
+    static const char* StageName(int stage);
+
+    // The calling thread enters a stage, returns the stage to restore on leaving it
+    static int Enter(int stage);
+    static void Leave(int previous);
+
+    // Counts since the last call, the window is restarted
+    Counts TakeWindow(int stage);
+
+    // Counts of the whole run
+    Counts GetTotal(int stage);
+
+    // Calls, allocations and bytes of each stage over the whole run, and per call
+    bool SaveCSV(const std::string &filename);
+
+    // Written by its thread only, outlive their threads so that their counts are kept
+    struct ThreadCounters
+    {
+        boost::atomic<unsigned long long> nCalls[N_STAGES];
+        boost::atomic<unsigned long long> nAllocations[N_STAGES];
+        boost::atomic<unsigned long long> nBytes[N_STAGES];
+    };
+
+protected:
+    AllocationStats();
+
+    ThreadCounters* Register();
+
+    boost::mutex mMutexThreads;
+    std::vector<ThreadCounters*> mvpThreads;
+    Counts mvWindowStart[N_STAGES];
+};
+
+// Attributes the allocations from construction to destruction to a stage
+class AllocationScope
+{
+public:
+    AllocationScope(int stage): mnPrevious(AllocationStats::Enter(stage)) {}
+    ~AllocationScope(){AllocationStats::Leave(mnPrevious);}
+
+protected:
+    int mnPrevious;
+};
+
+} //namespace ORB_SLAM
+
+#ifdef ORB_SLAM_ALLOC_STATS
+#define ALLOC_CONCAT_(a,b) a##b
+#define ALLOC_CONCAT(a,b) ALLOC_CONCAT_(a,b)
+#define ALLOC_SCOPE(stage) ORB_SLAM::AllocationScope ALLOC_CONCAT(allocScope,__LINE__)(ORB_SLAM::AllocationStats::stage)
+#else
+#define ALLOC_SCOPE(stage)
+#endif
+
+#endif // ALLOCATIONSTATS_H
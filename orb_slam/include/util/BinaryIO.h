@@ -0,0 +1,117 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BINARYIO_H
+#define BINARYIO_H
+
+#include <iostream>
+#include <vector>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "dbow2/BowVector.h"
+#include "dbow2/FeatureVector.h"
+
+namespace ORB_SLAM
+{
+
+// Compact binary encoding of the types stored by the maps
+// Values are written in host byte order, the files are read back on the same platform
+// Readers return false once the stream fails, the value is left empty
+class BinaryIO
+{
+public:
+    template<typename T>
+    static void WritePod(std::ostream &f, const T &v)
+    {
+        f.write(reinterpret_cast<const char*>(&v),sizeof(T));
+    }
+
+    template<typename T>
+    static bool ReadPod(std::istream &f, T &v)
+    {
+        f.read(reinterpret_cast<char*>(&v),sizeof(T));
+        return f.good();
+    }
+
+    template<typename T>
+    static void WritePodVector(std::ostream &f, const std::vector<T> &v)
+    {
+        const uint32_t n = v.size();
+        WritePod(f,n);
+        if(n>0)
+            f.write(reinterpret_cast<const char*>(&v[0]),n*sizeof(T));
+    }
+
+    template<typename T>
+    static bool ReadPodVector(std::istream &f, std::vector<T> &v)
+    {
+        uint32_t n;
+        v.clear();
+        if(!ReadPod(f,n))
+            return false;
+        v.resize(n);
+        if(n>0)
+            f.read(reinterpret_cast<char*>(&v[0]),n*sizeof(T));
+        if(!f.good())
+        {
+            v.clear();
+            return false;
+        }
+        return true;
+    }
+
+    static void Write(std::ostream &f, const cv::Mat &m);
+    static bool Read(std::istream &f, cv::Mat &m);
+
+    // Matrix whose data starts at a multiple of ALIGNMENT bytes from the start of the stream,
+    // so that a mapping of the file can be used in place
+    static const std::size_t ALIGNMENT = 16;
+    static void WriteAligned(std::ostream &f, const cv::Mat &m);
+    // With pBase, the start of a mapping of the stream, the data is not copied: m points into
+    // the mapping, read-only, and is only valid while the mapping is
+    static bool ReadAligned(std::istream &f, cv::Mat &m, const char* pBase=NULL);
+
+    static void Write(std::ostream &f, const std::vector<cv::KeyPoint> &vKeys);
+    static bool Read(std::istream &f, std::vector<cv::KeyPoint> &vKeys);
+
+    // Unsigned integers in groups of 7 bits, values below 128 take one byte
+    static void WriteVarint(std::ostream &f, uint64_t v);
+    static bool ReadVarint(std::istream &f, uint64_t &v);
+
+    // Keypoints quantized to 1/8 pixel from an origin, the angle to 1/65536 of a turn, and the octave
+    // Falls back to floats for coordinates too far from the origin. The size is restored from the octave
+    // with vScaleFactors as the extractor sets it, the response is not kept
+    static void WriteQuantized(std::ostream &f, const std::vector<cv::KeyPoint> &vKeys, float x0, float y0);
+    static bool ReadQuantized(std::istream &f, std::vector<cv::KeyPoint> &vKeys, float x0, float y0,
+                              const std::vector<float> &vScaleFactors);
+
+    static void Write(std::ostream &f, const DBoW2::BowVector &v);
+    static bool Read(std::istream &f, DBoW2::BowVector &v);
+
+    // Same layout as a DBoW2::FeatureVector: nodes, then the id, size and feature indexes of each node
+    static void Write(std::ostream &f, const DBoW2::FlatFeatureVector &v);
+    static bool Read(std::istream &f, DBoW2::FlatFeatureVector &v);
+};
+
+} //namespace ORB_SLAM
+
+#endif // BINARYIO_H
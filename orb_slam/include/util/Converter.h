@@ -27,6 +27,8 @@
 #include <g2o/types/sba/types_six_dof_expmap.h>
 #include <g2o/types/sim3/types_seven_dof_expmap.h>
 
+#include "dbow2/Hamming.h"
+
 namespace ORB_SLAM
 {
 
@@ -35,6 +37,10 @@ class Converter
 public:
     static std::vector<cv::Mat> toDescriptorVector(const cv::Mat &Descriptors);
 
+    // Descriptor values from and to a 1x32 CV_8U row, the matrix is copied
+    static DBoW2::Descriptor256 toDescriptor256(const cv::Mat &row);
+    static cv::Mat toCvMat(const DBoW2::Descriptor256 &d);
+
     static g2o::SE3Quat toSE3Quat(const cv::Mat &cvT);
 
     static cv::Mat toCvMat(const g2o::SE3Quat &SE3);
@@ -44,12 +50,21 @@ public:
     static cv::Mat toCvMat(const Eigen::Matrix<double,3,1> &m);
     static cv::Mat toCvSE3(const Eigen::Matrix<double,3,3> &R, const Eigen::Matrix<double,3,1> &t);
 
+    // Single precision, used by the fixed-size math in the core types
+    static cv::Mat toCvMat(const Eigen::Matrix3f &m);
+    static cv::Mat toCvMat(const Eigen::Vector3f &m);
+
     static Eigen::Matrix<double,3,1> toVector3d(const cv::Mat &cvVector);
     static Eigen::Matrix<double,3,1> toVector3d(const cv::Point3f &cvPoint);
     static Eigen::Matrix<double,2,1> toVector2d(const cv::Mat &cvVector);
     static Eigen::Matrix<double,3,3> toMatrix3d(const cv::Mat &cvMat3);
+    static Eigen::Vector3f toVector3f(const cv::Mat &cvVector);
+    static Eigen::Matrix3f toMatrix3f(const cv::Mat &cvMat3);
 
     static std::vector<float> toQuaternion(const cv::Mat &M);
+
+    // Appends "timestamp tx ty tz qx qy qz qw" and a new line, the camera pose in the world
+    static void appendTrajectoryLine(std::string &buffer, double timeStamp, const Eigen::Matrix3f &Rwc, const Eigen::Vector3f &twc);
 };
 
 }// namespace ORB_SLAM
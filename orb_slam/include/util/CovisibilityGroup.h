@@ -0,0 +1,78 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef COVISIBILITYGROUP_H
+#define COVISIBILITYGROUP_H
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+class KeyFrame;
+
+// Keyframes around a loop candidate (the candidate and its covisible keyframes), for the consistency
+// check of the loop and merge detectors
+// Kept as a sorted array, so testing two groups for a shared keyframe is a merge walk of two arrays
+// instead of a lookup in a node based set per keyframe, and copying a group is a single allocation
+class CovisibilityGroup
+{
+public:
+    CovisibilityGroup();
+
+    // The candidate and the keyframes connected to it in the covisibility graph, whatever the weight
+    explicit CovisibilityGroup(KeyFrame* pKF);
+
+    // True if both groups hold at least a keyframe in common
+    bool Intersects(const CovisibilityGroup &other) const;
+
+    bool count(KeyFrame* pKF) const;
+    size_t size() const { return mvpKeyFrames.size(); }
+    bool empty() const { return mvpKeyFrames.empty(); }
+    const std::vector<KeyFrame*>& KeyFrames() const { return mvpKeyFrames; }
+
+protected:
+
+    // Sorted and unique
+    std::vector<KeyFrame*> mvpKeyFrames;
+};
+
+// What a loop or merge detector keeps between queries of one map: the groups of the last candidates with
+// the number of consecutive queries they were consistent over, and the keyframe of the last loop
+struct LoopDetectorState
+{
+    std::vector<std::pair<CovisibilityGroup,int> > vConsistentGroups;
+    long unsigned int nLastLoopKFid;
+
+    LoopDetectorState(): nLastLoopKFid(0) {}
+
+    void swap(LoopDetectorState &other)
+    {
+        vConsistentGroups.swap(other.vConsistentGroups);
+        std::swap(nLastLoopKFid,other.nLastLoopKFid);
+    }
+};
+
+} //namespace ORB_SLAM
+
+#endif // COVISIBILITYGROUP_H
@@ -0,0 +1,73 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DESCRIPTORINDEX_H
+#define DESCRIPTORINDEX_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM
+{
+
+// Multi-index hashing of the 256-bit ORB descriptors of a frame (Norouzi et al. 2012), for the searches whose windows
+// cover a large part of the image. The descriptor is split into 16 substrings of 16 bits, each with its own hash table
+// A query returns the features that match one of its substrings exactly or up to one bit
+// Two descriptors within distance d differ on average in d/16 bits per substring. On random descriptors the matches
+// within 40 bits are always found, 95% of those at TH_LOW (50), two thirds at 64 and few beyond 80: the lookup trades
+// the recall of the weak matches for not visiting every feature of the window
+// The index is read only once built, queries may run concurrently
+class DescriptorIndex
+{
+public:
+    static const int SUBSTRINGS = 16;
+
+    // Descriptors: one 32 byte row per feature
+    DescriptorIndex(const cv::Mat &Descriptors);
+
+    // Features whose descriptor shares a substring with d up to one bit, sorted and without repetitions
+    void Query(const unsigned char* d, std::vector<size_t> &vIndices) const;
+
+    size_t Size() const {return mN;}
+
+protected:
+
+    static uint16_t Substring(const unsigned char* d, int s) {return (uint16_t)(d[2*s] | (d[2*s+1]<<8));}
+    size_t Bucket(uint16_t key) const {return ((uint32_t)key*2654435761u)>>mnShift;}
+
+    // Appends the features with substring s equal to key
+    void Lookup(int s, uint16_t key, std::vector<size_t> &vIndices) const;
+
+    size_t mN;
+    int mnShift;
+    size_t mnBuckets;
+
+    // Per substring: the key of each feature, and the features grouped by bucket (offsets into the entries)
+    std::vector<uint16_t> mvKeys[SUBSTRINGS];
+    std::vector<uint32_t> mvOffsets[SUBSTRINGS];
+    std::vector<uint32_t> mvEntries[SUBSTRINGS];
+};
+
+} //namespace ORB_SLAM
+
+#endif // DESCRIPTORINDEX_H
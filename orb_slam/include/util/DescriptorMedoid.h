@@ -0,0 +1,70 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESCRIPTORMEDOID_H
+#define DESCRIPTORMEDOID_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+namespace ORB_SLAM
+{
+
+// ORB descriptors of the observations of a map point, to choose the one with
+// the least median distance to the rest
+// Each descriptor keeps its distances to all of them sorted, so adding or removing one
+// computes only its N distances, and the medians are read without sorting
+class DescriptorMedoid
+{
+public:
+    // Descriptor length in bytes
+    static const size_t L = 32;
+
+    size_t size() const {return mvDistances.size();}
+
+    // Storage of the descriptors, distances and scratch
+    size_t HeapBytes() const;
+
+    void Add(const unsigned char* pDescriptor);
+    void Remove(size_t i);
+    void Clear();
+
+    const unsigned char* Descriptor(size_t i) const {return &mvDescriptors[i*L];}
+
+    // Descriptor whose median distance to the rest (itself included) is the smallest,
+    // the first one on ties, -1 if empty
+    int Best() const;
+
+protected:
+
+    // Descriptors stored next to each other, for batch distances
+    std::vector<unsigned char> mvDescriptors;
+
+    // Sorted distances from each descriptor to every one
+    std::vector<std::vector<uint16_t> > mvDistances;
+
+    // Scratch for the distances to the added or removed descriptor
+    std::vector<int> mvNewDistances;
+};
+
+} //namespace ORB_SLAM
+
+#endif // DESCRIPTORMEDOID_H
@@ -0,0 +1,77 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EPOCHRECLAIMER_H
+#define EPOCHRECLAIMER_H
+
+#include <vector>
+#include <deque>
+#include <boost/thread/mutex.hpp>
+
+namespace ORB_SLAM
+{
+
+// Deferred reclamation of objects other threads may still be using
+// Every thread that reads map objects registers and calls Quiescent at a point where it
+// holds no pointer it has not checked since. A retired object is reclaimed once every
+// registered thread has been quiescent twice, so nobody can still be dereferencing it
+class EpochReclaimer
+{
+public:
+    typedef void (*Deleter)(void*);
+
+    EpochReclaimer();
+
+    // Objects still pending are not reclaimed, the maps own whatever is left at exit
+    static EpochReclaimer* Global();
+
+    int Register();
+    void Unregister(int id);
+
+    // The thread holds no unchecked pointer to a map object
+    void Quiescent(int id);
+
+    // p is reclaimed with deleter after the grace period
+    void Retire(void* p, Deleter deleter);
+
+    size_t Pending();
+
+protected:
+
+    struct Retired
+    {
+        void* p;
+        Deleter deleter;
+        unsigned long nEpoch;
+    };
+
+    // Called with mMutex held, moves the expired objects to vExpired
+    void Advance(std::vector<Retired> &vExpired);
+
+    boost::mutex mMutex;
+    unsigned long mnEpoch;
+    std::vector<unsigned long> mvnAnnounced;
+    std::vector<bool> mvbRegistered;
+    std::deque<Retired> mdRetired;
+};
+
+} //namespace ORB_SLAM
+
+#endif // EPOCHRECLAIMER_H
@@ -0,0 +1,73 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FEATUREBUDGET_H
+#define FEATUREBUDGET_H
+
+namespace ORB_SLAM
+{
+
+// Closed loop controller of the ORB extractor parameters
+// Each tracked frame it adjusts the number of features and the FAST threshold
+// to hold a target tracking time, and only spends features when tracking needs them
+class FeatureBudget
+{
+public:
+    FeatureBudget(int nFeatures, int fastTh, int nMinFeatures, int nMaxFeatures, int nMinFastTh, int nMaxFastTh,
+                  float targetTime, int nTargetInliers, int nMaxMappingQueue);
+
+    // Update with the measurements of the last tracked frame
+    // time: seconds spent on the frame, nKeys: features extracted,
+    // nInliers: inliers after tracking the local map, nMappingQueue: keyframes waiting in local mapping
+    // Returns true if the parameters changed
+    bool Update(float time, int nKeys, int nInliers, int nMappingQueue);
+
+    int GetFeatures() const {return mnFeatures;}
+    int GetFastThreshold() const {return mnFastTh;}
+
+protected:
+
+    static const float TIME_SMOOTHING;
+
+    // Current output
+    int mnFeatures;
+    int mnFastTh;
+
+    // Configured FAST threshold, restored when features are plentiful
+    int mnNominalFastTh;
+
+    // Limits
+    int mnMinFeatures;
+    int mnMaxFeatures;
+    int mnMinFastTh;
+    int mnMaxFastTh;
+
+    // Targets
+    float mfTargetTime;
+    int mnTargetInliers;
+    int mnMaxMappingQueue;
+
+    // Smoothed tracking time, negative until the first update
+    float mfTime;
+};
+
+} //namespace ORB_SLAM
+
+#endif // FEATUREBUDGET_H
@@ -0,0 +1,67 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FLOWTRACKER_H
+#define FLOWTRACKER_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+namespace ORB_SLAM
+{
+
+class Frame;
+
+// Pyramidal Lucas-Kanade tracking of the keypoints of a frame matched to map points, into the next image
+// Used by Tracking between keyframes, so that the frames that only need a pose are not extracted
+// Each point is tracked forward and back, those that do not come back to where they started are dropped
+// The pyramid of the image tracked into is kept, it is the previous image of the next call
+class FlowTracker
+{
+public:
+    // nWindow: side of the search window at each level, nLevels: pyramid levels above the image
+    // fMaxError: distance in pixels allowed between a keypoint and its forward-backward track
+    FlowTracker(int nWindow, int nLevels, float fMaxError);
+
+    // vKeys gets the tracked keypoints, with the size, angle and level of the keypoint of the previous frame
+    // vIndices gets the index in the previous frame of each tracked keypoint
+    void Track(const Frame &previous, const cv::Mat &im, double timeStamp, std::vector<cv::KeyPoint> &vKeys, std::vector<int> &vIndices);
+
+protected:
+    cv::Size mWindow;
+    int mnLevels;
+    float mfMaxError;
+
+    // Pyramid of the last image tracked into. Zero copy images do not own their buffer, so the timestamp is kept too
+    cv::Mat mPyramidImage;
+    double mPyramidTimeStamp;
+    std::vector<cv::Mat> mvPyramid;
+
+    // Buffers reused between frames
+    std::vector<cv::Mat> mvPreviousPyramid;
+    std::vector<cv::Point2f> mvPoints, mvTracked, mvBack;
+    std::vector<unsigned char> mvStatus, mvBackStatus;
+    std::vector<float> mvError;
+};
+
+} //namespace ORB_SLAM
+
+#endif // FLOWTRACKER_H
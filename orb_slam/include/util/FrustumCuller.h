@@ -0,0 +1,85 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRUSTUMCULLER_H
+#define FRUSTUMCULLER_H
+
+#include <vector>
+#include <Eigen/Core>
+
+namespace ORB_SLAM
+{
+
+class Frame;
+class MapPoint;
+
+// Projection of the local map in a frame, one entry per point in the order of the local map
+// Owned by the tracking, so that projecting the local map does not write into the shared map points
+struct LocalMapProjection
+{
+    std::vector<unsigned char> vbInView;
+    std::vector<float> vProjX, vProjY;
+    std::vector<int> vScaleLevel;
+    std::vector<float> vViewCos;
+};
+
+// Batch version of Frame::isInFrustum for the local map
+// The points are gathered into a structure of arrays and tested four at a time with SIMD,
+// then the projection of the visible ones is filled exactly as isInFrustum does
+// The buffers are kept between frames, so a culler should be reused
+class FrustumCuller
+{
+public:
+    FrustumCuller();
+
+    // Returns the number of points in the frustum, the visible counter of those is increased
+    // Points that are bad or in vpMatched (the matches already found for the frame) are left out of view
+    // The pose matrices of the frame must be up to date (Frame::UpdatePoseMatrices)
+    int Cull(const Frame &F, const std::vector<MapPoint*> &vpMapPoints, const std::vector<MapPoint*> &vpMatched,
+             const float viewingCosLimit, LocalMapProjection &proj);
+
+protected:
+
+    // Copies position, normal and distance limits of the candidate points
+    void Gather(const std::vector<MapPoint*> &vpMapPoints, const std::vector<MapPoint*> &vpMatched);
+
+    // Computes projection, distance and viewing cosine, and whether each point passes
+    void Test(const Frame &F, const float viewingCosLimit);
+
+    // Candidates gathered from the local map and their index in it
+    std::vector<MapPoint*> mvpPoints;
+    std::vector<size_t> mvSlots;
+
+    // Matches already found, sorted to be searched
+    std::vector<MapPoint*> mvpMatched;
+
+    // Structure of arrays, one entry per candidate
+    std::vector<float> mvX, mvY, mvZ;
+    std::vector<float> mvNx, mvNy, mvNz;
+    std::vector<float> mvMinDist, mvMaxDist;
+
+    // Results of the test
+    std::vector<float> mvU, mvV, mvDist, mvViewCos;
+    std::vector<unsigned char> mvbInView;
+};
+
+} //namespace ORB_SLAM
+
+#endif // FRUSTUMCULLER_H
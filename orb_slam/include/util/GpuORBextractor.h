@@ -0,0 +1,70 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GPUORBEXTRACTOR_H
+#define GPUORBEXTRACTOR_H
+
+#include "util/ORBextractor.h"
+
+#ifdef ORB_SLAM_GPU
+#include <opencv2/gpu/gpu.hpp>
+#endif
+
+namespace ORB_SLAM
+{
+
+// ORB extraction with the CUDA implementation of the OpenCV gpu module (pyramid, FAST, non-maximum suppression,
+// orientation and rBRIEF). The sampling pattern, orientation and smoothing are those of ORBextractor, so the
+// descriptors are the ones the vocabulary was trained on. Keypoints of a level are retained by score instead
+// of being distributed on a grid.
+// Without ORB_SLAM_GPU, or without a CUDA device, Extract fails and the ORBextractor falls back on the CPU
+class GpuORBextractor : public ExtractorBackend
+{
+public:
+    GpuORBextractor();
+    ~GpuORBextractor();
+
+    // Built with ORB_SLAM_GPU and a CUDA device present
+    static bool Available();
+
+    bool Extract(const cv::Mat &image, const cv::Mat &mask, int nfeatures, float scaleFactor, int nlevels, int fastTh,
+                 std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors);
+
+protected:
+
+#ifdef ORB_SLAM_GPU
+    // Rebuilt when the parameters change
+    cv::gpu::ORB_GPU* mpORB;
+    int mnFeatures;
+    float mfScaleFactor;
+    int mnLevels;
+
+    // The image is copied to page-locked memory so the upload is a single DMA transfer
+    cv::gpu::CudaMem mPinnedImage;
+    cv::gpu::CudaMem mPinnedMask;
+    cv::gpu::GpuMat mImage;
+    cv::gpu::GpuMat mMask;
+    cv::gpu::GpuMat mDescriptors;
+#endif
+};
+
+} //namespace ORB_SLAM
+
+#endif // GPUORBEXTRACTOR_H
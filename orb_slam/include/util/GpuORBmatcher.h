@@ -0,0 +1,82 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef GPUORBMATCHER_H
+#define GPUORBMATCHER_H
+
+#include "util/ORBmatcher.h"
+
+#include <boost/thread/mutex.hpp>
+
+namespace ORB_SLAM
+{
+
+// Descriptor distances of the windowed searches with a CUDA kernel, one block per window.
+// The descriptor matrices stay on the device while they are searched again: the frame being initialized
+// against, and the two frames of the tracking from the previous frame, are uploaded once.
+// Without ORB_SLAM_GPU, or without a CUDA device, Distances fails and the matcher stays on the CPU
+class GpuORBmatcher : public MatcherBackend
+{
+public:
+    GpuORBmatcher();
+    ~GpuORBmatcher();
+
+    // Built with ORB_SLAM_GPU and a CUDA device present
+    static bool Available();
+
+    bool Distances(const cv::Mat &Queries, const std::vector<int> &vQueries,
+                   const cv::Mat &Candidates, const std::vector<size_t> &vCandidates,
+                   const std::vector<size_t> &vOffsets, std::vector<int> &vDists);
+
+protected:
+
+#ifdef ORB_SLAM_GPU
+    // Device copy of a descriptor matrix. The header is kept so the data can not be freed and its address
+    // reused by another matrix while the copy is cached
+    struct DeviceDescriptors
+    {
+        cv::Mat Host;
+        unsigned int* pDevice;
+        size_t capacity;
+    };
+
+    bool Upload(const cv::Mat &Descriptors, DeviceDescriptors &cache);
+
+    // Searches of all the threads share the device buffers
+    boost::mutex mMutex;
+
+    DeviceDescriptors mCache[2];
+
+    // Windows, staged in page-locked memory and their device copies
+    unsigned int* mpHostWindows;
+    unsigned int* mpDeviceWindows;
+    size_t mnHostWindowsCapacity;
+    size_t mnDeviceWindowsCapacity;
+    int* mpHostDists;
+    int* mpDeviceDists;
+    size_t mnHostDistsCapacity;
+    size_t mnDeviceDistsCapacity;
+#endif
+};
+
+} //namespace ORB_SLAM
+
+#endif // GPUORBMATCHER_H
@@ -0,0 +1,99 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGEPYRAMID_H
+#define IMAGEPYRAMID_H
+
+#include <vector>
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM
+{
+
+// Scale pyramid of an image, each level resized from the previous one and surrounded by a border
+// (reflected for the image, zero for the mask) so that patches near the edge can be read
+// The buffers are allocated once and reused while the image size stays the same
+// All the levels share one aligned block (see AlignedAllocator), each level on rows of its own starting on a cache line
+// A pyramid can be shared by several extractors: it is built once per image for the same parameters
+// With bBlur each level also gets its 7x7 Gaussian blur (sigma 2), the image the descriptors are computed on.
+// Each level is resized row by row from the previous one and blurred while its rows are still in cache, a
+// single pass over memory instead of a resize and a separate blur
+class ImagePyramid
+{
+public:
+    ImagePyramid();
+
+    // Builds the levels unless they are already built from this image with these parameters
+    // vInvScales: size of each level relative to the image, 1 for the first
+    // Images that do not own their buffer (e.g. a shared ROS message) are always built
+    // Returns true if the levels were built
+    bool Build(const cv::Mat &image, const cv::Mat &mask, const std::vector<float> &vInvScales, int border,
+               bool bBlur=false);
+
+    int GetLevels() const {return mvLevels.size();}
+    float GetInvScale(int level) const {return mvInvScales[level];}
+
+    // Level without its border, the border is valid memory around it. The mask is empty without one
+    const cv::Mat& GetLevel(int level) const {return mvLevels[level];}
+    const cv::Mat& GetMask(int level) const {return mvMasks[level];}
+    // Blurred level, empty unless built with bBlur. Its border is not filled
+    const cv::Mat& GetBlurred(int level) const {return mvBlurred[level];}
+
+protected:
+
+    // Fills the rows of a level: resized from the previous level (except the first) and blurred if requested
+    void BuildLevel(int level, bool bBlur);
+    // Horizontal pass of the resize, row y of the previous level into dst
+    void ResizeRow(const cv::Mat &src, int y, uint16_t* dst);
+
+    // The image the levels were built from, held so that its buffer cannot be reused by another image
+    cv::Mat mSource;
+    bool mbCached;
+    std::vector<float> mvInvScales;
+    int mnBorder;
+
+    // Blocks of the levels and of their masks
+    cv::Mat mArena;
+    cv::Mat mMaskArena;
+
+    // Bordered buffers, views into the blocks, and the views of the levels inside them
+    std::vector<cv::Mat> mvBuffers;
+    std::vector<cv::Mat> mvMaskBuffers;
+    std::vector<cv::Mat> mvLevels;
+    std::vector<cv::Mat> mvMasks;
+
+    // Blurred levels, laid out as the levels in their own block
+    bool mbBlurred;
+    cv::Mat mBlurredArena;
+    std::vector<cv::Mat> mvBlurred;
+
+    // Scratch of the fused pass, kept across images: column offsets and weights of the resize, its two
+    // source rows interpolated horizontally, the padded row and the last 8 rows of the horizontal blur
+    std::vector<int> mvXOffsets;
+    std::vector<uint16_t> mvXWeights;
+    std::vector<uint16_t> mvResizeRows;
+    std::vector<uchar> mvPaddedRow;
+    std::vector<uint16_t> mvBlurRows;
+};
+
+} //namespace ORB_SLAM
+
+#endif // IMAGEPYRAMID_H
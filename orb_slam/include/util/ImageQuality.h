@@ -0,0 +1,67 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGEQUALITY_H
+#define IMAGEQUALITY_H
+
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM
+{
+
+// Cheap quality estimate of an image before its features are extracted
+// The sharpness is the variance of the Laplacian of the image downscaled to a fixed width, the brightness its mean
+// Blur is judged against the recent frames, so the threshold follows the texture of the scene
+class ImageQuality
+{
+public:
+    // nWidth: width the image is downscaled to, fMinRatio: sharpness against the recent average a frame needs,
+    // fMinBrightness: mean intensity a frame needs, nMaxSkipped: frames skipped in a row before one is taken anyway
+    ImageQuality(int nWidth, float fMinRatio, float fMinBrightness, int nMaxSkipped);
+
+    // Sharpness and mean brightness of a grayscale image
+    float Measure(const cv::Mat &im, float &brightness);
+
+    // Whether the image is worth extracting, its sharpness is returned in any case
+    // Called once per image, it updates the recent average
+    bool Accept(const cv::Mat &im, float &sharpness);
+
+    // Images skipped since the start
+    unsigned int Skipped() const {return mnSkippedTotal;}
+
+protected:
+    int mnWidth;
+    float mfMinRatio;
+    float mfMinBrightness;
+    int mnMaxSkipped;
+
+    // Moving average of the sharpness, 0 before the first image
+    float mfAverage;
+    int mnSkipped;
+    unsigned int mnSkippedTotal;
+
+    // Buffers kept between images
+    cv::Mat mSmall;
+    cv::Mat mLaplacian;
+};
+
+} //namespace ORB_SLAM
+
+#endif // IMAGEQUALITY_H
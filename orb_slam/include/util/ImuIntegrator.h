@@ -0,0 +1,69 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMUINTEGRATOR_H
+#define IMUINTEGRATOR_H
+
+#include <deque>
+#include <Eigen/Core>
+#include <boost/thread.hpp>
+
+namespace ORB_SLAM
+{
+
+// Gyroscope measurements between frames, preintegrated on SO(3) into the rotation of the camera between them
+// The measurements come from the IMU callback, the predictions are asked by Tracking
+// Monocular tracking has no metric scale nor gravity direction to put the accelerometer to use,
+// so only the rotation is predicted, the translation is left to the motion model
+class ImuIntegrator
+{
+public:
+    // Rcb: rotation of the camera from the IMU, gyroBias: subtracted from the measurements
+    // maxGap: seconds the last measurement is extrapolated when the frame is newer
+    ImuIntegrator(const Eigen::Matrix3d &Rcb, const Eigen::Vector3d &gyroBias, double maxGap);
+
+    // Angular velocity in rad/s in the IMU frame, measurements come in time order
+    void AddMeasurement(double timestamp, const Eigen::Vector3d &gyro);
+
+    // Rotation of the camera at t1 relative to the camera at t0 (Rc1c0, so that Rc1w = Rc1c0*Rc0w)
+    // Returns false if the measurements do not cover the interval
+    bool PredictRotation(double t0, double t1, Eigen::Matrix3d &Rc1c0);
+
+    // Drops the measurements no longer needed to integrate from t
+    void Discard(double t);
+
+protected:
+    struct Measurement
+    {
+        double t;
+        Eigen::Vector3d gyro;
+    };
+
+    Eigen::Matrix3d mRcb;
+    Eigen::Vector3d mGyroBias;
+    double mfMaxGap;
+
+    boost::mutex mMutex;
+    std::deque<Measurement> mdMeasurements;
+};
+
+} //namespace ORB_SLAM
+
+#endif // IMUINTEGRATOR_H
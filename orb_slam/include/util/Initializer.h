@@ -22,7 +22,9 @@
 #define INITIALIZER_H
 
 #include <opencv2/opencv.hpp>
+#include <boost/atomic.hpp>
 #include "types/Frame.h"
+#include "util/ProsacSampler.h"
 
 
 namespace ORB_SLAM
@@ -42,6 +44,14 @@ public:
     bool Initialize(const Frame &CurrentFrame, const vector<int> &vMatches12,
                     cv::Mat &R21, cv::Mat &t21, vector<cv::Point3f> &vP3D, vector<bool> &vbTriangulated);
 
+    // RANSAC iterations of each model search
+    int GetIterations();
+
+    // Seconds spent by the last Initialize, in each model search and in total
+    double GetTimeHomography();
+    double GetTimeFundamental();
+    double GetTimeTotal();
+
 
 private:
 
@@ -61,19 +71,36 @@ private:
     bool ReconstructH(vector<bool> &vbMatchesInliers, cv::Mat &H21, cv::Mat &K,
                       cv::Mat &R21, cv::Mat &t21, vector<cv::Point3f> &vP3D, vector<bool> &vbTriangulated, float minParallax, int minTriangulated);
 
-    void Triangulate(const cv::KeyPoint &kp1, const cv::KeyPoint &kp2, const cv::Mat &P1, const cv::Mat &P2, cv::Mat &x3D);
-
     void Normalize(const vector<cv::KeyPoint> &vKeys, vector<cv::Point2f> &vNormalizedPoints, cv::Mat &T);
 
-    int CheckRT(const cv::Mat &R, const cv::Mat &t, const vector<cv::KeyPoint> &vKeys1, const vector<cv::KeyPoint> &vKeys2,
-                       const vector<Match> &vMatches12, vector<bool> &vbInliers,
-                       const cv::Mat &K, vector<cv::Point3f> &vP3D, float th2, vector<bool> &vbGood, float &parallax);
+    // Motion hypothesis of a reconstruction and the structure it triangulates
+    // The buffers are kept from one reconstruction to the next
+    struct Hypothesis
+    {
+        cv::Mat R, t;
+        vector<cv::Point3f> vP3D;
+        vector<bool> vbGood;
+        vector<float> vCosParallax;
+        float parallax;
+        int nGood;
+        // Not all the matches were checked, the hypothesis could not compete with the leading one
+        // and nGood is a lower bound
+        bool bDropped;
+    };
+
+    // Checks the first nHypotheses of mvHypotheses on the inlier matches, concurrently
+    void CheckHypotheses(vector<bool> &vbMatchesInliers, int nHypotheses, const cv::Mat &K);
+
+    // Triangulates the inlier matches with the motion of the hypothesis, counts those in front of both cameras
+    // with a low reprojection error. Stops once it cannot reach DOMINANCE of the leading hypothesis
+    void CheckRT(Hypothesis &h, const cv::Mat &K, float th2);
 
     void DecomposeE(const cv::Mat &E, cv::Mat &R1, cv::Mat &R2, cv::Mat &t);
 
 
-    // Keypoints from Reference Frame (Frame 1)
+    // Keypoints and descriptors from Reference Frame (Frame 1)
     vector<cv::KeyPoint> mvKeys1;
+    cv::Mat mDescriptors1;
 
     // Keypoints from Current Frame (Frame 2)
     vector<cv::KeyPoint> mvKeys2;
@@ -91,8 +118,35 @@ private:
     // Ransac max iterations
     int mMaxIterations;
 
-    // Ransac sets
-    vector<vector<size_t> > mvSets;   
+    // Ransac sets, drawn from the matches with the lowest descriptor distance first
+    vector<vector<size_t> > mvSets;
+    ProsacSampler mSampler;
+
+    // Probability of drawing an all-inlier set that ends a model search early
+    static const double RANSAC_PROBABILITY;
+
+    // Coordinates of the matched keypoints, in the order of mvMatches12
+    vector<float> mvU1, mvV1, mvU2, mvV2;
+
+    // Squared errors in the first and second image of the hypothesis being scored
+    // Each model search has its own buffers, as both run at the same time
+    vector<float> mvErrH1, mvErrH2;
+    vector<float> mvErrF1, mvErrF2;
+
+    // Timing of the last Initialize
+    double mTimeH, mTimeF, mTimeTotal;
+
+    // Hypotheses of the reconstruction, 8 from a homography and 4 from a fundamental matrix
+    vector<Hypothesis> mvHypotheses;
+
+    // Inlier matches of the model being reconstructed
+    vector<Match> mvInlierMatches;
+
+    // Most points any hypothesis has triangulated so far
+    boost::atomic<int> mnLeadingGood;
+
+    // A hypothesis with less than this share of the points of the best one neither wins nor makes the choice ambiguous
+    static const float DOMINANCE;
 
 };
 
@@ -0,0 +1,86 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KERNELBENCHMARK_H
+#define KERNELBENCHMARK_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <ros/time.h>
+
+namespace ORB_SLAM
+{
+
+// Times small kernels, one case at a time:
+//
+//   bench.Begin("ORBmatcher::DescriptorDistance");
+//   while(bench.KeepRunning())
+//       bench.Keep(ORBmatcher::DescriptorDistance(a,b));
+//
+// The loop runs until it took at least the minimum time, the clock is read after 1, 2, 4... iterations
+// so its cost is spread over the batch. Whatever is set up before Begin() is not timed
+class KernelBenchmark
+{
+public:
+    struct Result
+    {
+        std::string name;
+        unsigned long nIterations;
+        double nsPerOp;
+    };
+
+    KernelBenchmark(double minTime=0.5);
+
+    void Begin(const std::string &name);
+    bool KeepRunning();
+
+    // Keeps the result of the kernel alive so the compiler can not drop the call
+    void Keep(double value) {mfSink = mfSink + value;}
+
+    const std::vector<Result>& GetResults() const {return mvResults;}
+
+    // name,iterations,ns_per_op
+    void SaveCSV(const std::string &filename) const;
+
+    // Reads a CSV saved by a previous run to compare with, false if it can not be read
+    bool LoadBaseline(const std::string &filename);
+
+    // Prints every case, with the ratio to the baseline if there is one
+    // Cases slower than the baseline by more than fTolerance are flagged, returns how many
+    int Report(double fTolerance=0.1) const;
+
+protected:
+    double mfMinTime;
+
+    std::string mCurrentName;
+    unsigned long mnIterations;
+    unsigned long mnNextCheck;
+    ros::WallTime mStart;
+
+    std::vector<Result> mvResults;
+    std::map<std::string,double> mBaseline;
+
+    volatile double mfSink;
+};
+
+} //namespace ORB_SLAM
+
+#endif // KERNELBENCHMARK_H
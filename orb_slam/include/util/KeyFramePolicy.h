@@ -0,0 +1,74 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef KEYFRAMEPOLICY_H
+#define KEYFRAMEPOLICY_H
+
+namespace ORB_SLAM
+{
+
+// Keyframe insertion that anticipates local mapping
+// The ratio of the inliers of each frame to the points tracked in the reference keyframe is smoothed, with its slope.
+// While local mapping is idle, a keyframe is inserted ahead of the ratio threshold if at the current trend the
+// ratio would cross it before local mapping is done with the keyframe inserted now.
+// While local mapping is busy, a needed keyframe waits for it if it is predicted to be done within a few frames,
+// instead of interrupting its BA
+// Only used by the tracking thread
+class KeyFramePolicy
+{
+public:
+    // fThreshold: tracked ratio under which a keyframe is needed
+    // fMaxWait: frame periods a needed keyframe may wait for local mapping
+    KeyFramePolicy(float fThreshold, float fMaxWait);
+
+    // Tracked ratio of a frame, a new reference keyframe restarts the trend
+    void Update(double timeStamp, long unsigned int nReferenceId, float fRatio);
+
+    // The ratio crosses the threshold within fHorizon seconds at the current trend (fHorizon<0 - unknown)
+    bool Anticipate(float fHorizon) const;
+
+    // Local mapping is done within the wait allowed (fMappingDelay<0 - unknown)
+    bool Wait(float fMappingDelay) const;
+
+protected:
+
+    static const float SMOOTHING;
+
+    // Frames of the same reference before the trend is used
+    static const int MIN_SAMPLES;
+
+    float mfThreshold;
+    float mfMaxWait;
+
+    // Smoothed ratio and its slope per second
+    float mfRatio;
+    float mfSlope;
+    int mnSamples;
+    long unsigned int mnReferenceId;
+
+    // Smoothed interval between frames, negative until measured
+    float mfPeriod;
+    double mLastTimeStamp;
+};
+
+} //namespace ORB_SLAM
+
+#endif // KEYFRAMEPOLICY_H
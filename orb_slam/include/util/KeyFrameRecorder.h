@@ -0,0 +1,114 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef KEYFRAMERECORDER_H
+#define KEYFRAMERECORDER_H
+
+#include "util/MapSerializer.h"
+
+#include <ros/time.h>
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+
+namespace ORB_SLAM
+{
+
+class MapDatabase;
+class Map;
+class KeyFrame;
+class MapPoint;
+
+// Stream of the keyframes handed to Local Mapping, to replay the back-end without the front-end (see replay.cc)
+// Each record is the keyframe in the MapSerializer format, with its map, the time it was inserted and its matches.
+// A point is recorded in full (its position) with the first keyframe that matches it, later ones refer to its id
+// The record is serialized on the inserting thread, so it is the keyframe as Tracking made it, a writer thread
+// appends it to the file. Nothing is dropped, a replay needs every keyframe
+class KeyFrameRecorder
+{
+public:
+    KeyFrameRecorder();
+    ~KeyFrameRecorder();
+
+    // Truncates the file and starts the writer thread
+    bool Open(const std::string &filename, unsigned int nWords);
+
+    // Called by LocalMapping::InsertKeyFrame, before the keyframe is queued
+    void Record(KeyFrame* pKF);
+
+    // Writes what is queued, flushes and stops the writer thread
+    void Close();
+
+    // Keyframes recorded since Open
+    unsigned long Recorded();
+
+protected:
+
+    void RunWriter();
+
+    std::ofstream mFile;
+    ros::WallTime mStart;
+
+    // Points recorded in full, by id
+    std::set<unsigned long> msRecordedPoints;
+    unsigned long mnRecorded;
+
+    boost::mutex mMutex;
+    boost::condition_variable mcvQueued;
+    std::deque<std::string> mqRecords;
+    bool mbClosing;
+    boost::thread* mpWriter;
+};
+
+// Reads a keyframe stream back into a map database, one keyframe at a time, as Tracking would hand it over
+// Keyframes keep their recorded ids. Points get new ids, as those triangulated by the replay take the recorded ones:
+// a point first matched by a keyframe starts at its recorded position with that keyframe as its only observation
+class KeyFrameReplayer
+{
+public:
+    explicit KeyFrameReplayer(MapDatabase* pMapDB);
+
+    bool Open(const std::string &filename);
+
+    // Next keyframe, in the map of its record (made current), and the seconds after the start it was inserted at
+    // Its matches are set, Local Mapping adds their observations. NULL at the end of the stream or if malformed
+    KeyFrame* Next(double &time);
+
+protected:
+
+    // The map of a recorded map, created with its first keyframe
+    Map* GetMap(unsigned long nRecordedMapId);
+
+    MapDatabase* mpMapDB;
+    std::ifstream mFile;
+    uint32_t mnVersion;
+
+    std::map<unsigned long,Map*> mMaps;
+    MapSerializer::MapPointIndex mPoints;
+};
+
+} //namespace ORB_SLAM
+
+#endif // KEYFRAMERECORDER_H
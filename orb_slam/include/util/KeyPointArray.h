@@ -0,0 +1,109 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef KEYPOINTARRAY_H
+#define KEYPOINTARRAY_H
+
+#include <vector>
+#include <cstddef>
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+namespace ORB_SLAM
+{
+
+// Keypoints of a keyframe as a structure of arrays: undistorted position, orientation and scale level
+// The distorted positions are only stored if they differ, the size, response and class of cv::KeyPoint are dropped
+// The matching and projection loops read the arrays they need, cv::KeyPoint is rebuilt for the visualization
+// The arrays of a keyframe loaded from a mapped map file are used in place (see MapSerializer)
+class KeyPointArray
+{
+public:
+    KeyPointArray();
+
+    // Keypoints as extracted (vKeys) and undistorted (vKeysUn)
+    void Assign(const std::vector<cv::KeyPoint> &vKeys, const std::vector<cv::KeyPoint> &vKeysUn);
+
+    // Arrays of N keypoints, pRawX and pRawY are NULL if the distorted positions are the undistorted ones
+    // With bInPlace they are not copied and must outlive this array, as the mapping of a map file does
+    void Assign(size_t N, const float* pX, const float* pY, const float* pAngle, const unsigned char* pOctave,
+                const float* pRawX, const float* pRawY, bool bInPlace);
+
+    size_t size() const {return mN;}
+
+    // The positions may be released while the scale levels stay, see ReleasePositions
+    bool HasPositions() const {return mpX!=NULL;}
+
+    float X(size_t i) const {return mpX[i];}
+    float Y(size_t i) const {return mpY[i];}
+    cv::Point2f Pt(size_t i) const {return cv::Point2f(mpX[i],mpY[i]);}
+    float Angle(size_t i) const {return mpAngle[i];}
+    int Octave(size_t i) const {return mpOctave[i];}
+
+    bool Distorted() const {return mpRawX!=NULL;}
+    cv::Point2f RawPt(size_t i) const {return mpRawX ? cv::Point2f(mpRawX[i],mpRawY[i]) : Pt(i);}
+
+    // cv::KeyPoint of the undistorted or distorted position, its size from the scale factors of the levels
+    cv::KeyPoint KeyPointUn(size_t i, const std::vector<float> &vScaleFactors) const;
+    cv::KeyPoint KeyPointDistorted(size_t i, const std::vector<float> &vScaleFactors) const;
+    void GetKeyPointsUn(std::vector<cv::KeyPoint> &vKeysUn, const std::vector<float> &vScaleFactors) const;
+    void GetKeyPoints(std::vector<cv::KeyPoint> &vKeys, const std::vector<float> &vScaleFactors) const;
+
+    // Sets the undistorted position and orientation of keypoint i, used to restore a compacted keyframe
+    // Positions must be allocated first with AllocatePositions
+    void AllocatePositions();
+    void SetPosition(size_t i, float x, float y, float angle)
+    {
+        mvX[i] = x;
+        mvY[i] = y;
+        mvAngle[i] = angle;
+    }
+
+    // Frees the positions and orientations, the scale levels stay for the observations
+    void ReleasePositions();
+
+    // Arrays used in place are not counted
+    size_t HeapBytes() const;
+
+protected:
+    size_t mN;
+
+    // The arrays, in the vectors below or in place
+    const float *mpX, *mpY;
+    const float* mpAngle;
+    const unsigned char* mpOctave;
+    // Distorted positions, NULL if equal to the undistorted ones
+    const float *mpRawX, *mpRawY;
+
+    std::vector<float> mvX, mvY;
+    std::vector<float> mvAngle;
+    std::vector<unsigned char> mvOctave;
+    std::vector<float> mvRawX, mvRawY;
+
+private:
+    // The pointers would be those of the copied arrays
+    KeyPointArray(const KeyPointArray&);
+    KeyPointArray& operator=(const KeyPointArray&);
+};
+
+} //namespace ORB_SLAM
+
+#endif // KEYPOINTARRAY_H
@@ -0,0 +1,115 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LATENCYSTATS_H
+#define LATENCYSTATS_H
+
+#include <vector>
+#include <string>
+#include <ros/time.h>
+#include <boost/thread/mutex.hpp>
+
+namespace ORB_SLAM
+{
+
+// Histogram of durations with logarithmic bins
+// Bins grow 5% from 1us to 10s, so percentiles are within 5% of the true value
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void Add(double seconds);
+    void Merge(const LatencyHistogram &other);
+    void Clear();
+
+    // p in [0,1], returns seconds
+    double Percentile(double p) const;
+
+    unsigned long Count() const {return mnCount;}
+    double Mean() const {return mnCount ? mfSum/mnCount : 0;}
+    double Max() const {return mfMax;}
+
+protected:
+    std::vector<unsigned long> mvBins;
+    unsigned long mnCount;
+    double mfSum;
+    double mfMax;
+};
+
+// Per-stage latency of the tracking pipeline
+// Shared by all the threads, adding a sample takes one short lock
+class LatencyStats
+{
+public:
+    enum eStage{
+        FRAME=0,
+        UNDISTORT_KEYPOINTS,
+        TRACK,
+        TRACK_MOTION_MODEL,
+        TRACK_PREVIOUS_FRAME,
+        TRACK_LOCAL_MAP,
+        SEARCH_LOCAL_POINTS,
+        POSE_OPTIMIZATION,
+        NEED_NEW_KEYFRAME,
+        CREATE_NEW_KEYFRAME,
+        TRACK_FLOW,
+        TRACK_DIRECT_ALIGNMENT,
+        N_STAGES
+    };
+
+    static LatencyStats* Global();
+
+    static const char* StageName(int stage);
+
+    void Add(int stage, double seconds);
+
+    // Samples since the last call, the window is restarted
+    LatencyHistogram TakeWindow(int stage);
+
+    // Samples of the whole run
+    LatencyHistogram GetTotal(int stage);
+
+    // Writes the percentiles of the whole run, in milliseconds
+    bool SaveCSV(const std::string &filename);
+
+protected:
+    LatencyStats();
+
+    LatencyHistogram mvWindow[N_STAGES];
+    LatencyHistogram mvTotal[N_STAGES];
+    boost::mutex mMutexStats;
+};
+
+// Adds the time from construction to destruction to a stage
+class ScopedTimer
+{
+public:
+    ScopedTimer(int stage): mnStage(stage), mStart(ros::WallTime::now()) {}
+    ~ScopedTimer(){LatencyStats::Global()->Add(mnStage,(ros::WallTime::now()-mStart).toSec());}
+
+protected:
+    int mnStage;
+    ros::WallTime mStart;
+};
+
+} //namespace ORB_SLAM
+
+#endif // LATENCYSTATS_H
@@ -0,0 +1,77 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOADSHEDDER_H
+#define LOADSHEDDER_H
+
+#include <boost/thread.hpp>
+
+namespace ORB_SLAM
+{
+
+// Overload policy of the tracking: when a frame takes longer to process than the camera period allows,
+// frames are skipped on purpose and evenly, instead of whichever the subscriber queue drops
+// The share of frames tracked follows the smoothed processing time over the smoothed interval between images:
+// a small overload skips every k-th frame, a large one tracks one frame in k
+// Images arrive on the callback thread while the processing time may be measured by the tracking stage
+class LoadShedder
+{
+public:
+    // fTargetLoad: share of the camera period the processing of the tracked frames may take
+    // nMaxStride: at least one frame in nMaxStride is tracked
+    LoadShedder(float fTargetLoad, int nMaxStride);
+
+    // Called for every image before extraction, returns true if it is skipped
+    // bKeep: the frame is tracked whatever the load (e.g. right after a keyframe)
+    bool Shed(double timeStamp, bool bKeep);
+
+    // Seconds spent processing the last tracked frame
+    void Update(float time);
+
+    // Share of the images tracked, 1 without overload
+    float GetTrackedRatio();
+
+    // Images skipped since the start
+    unsigned int GetShed();
+
+protected:
+
+    static const float SMOOTHING;
+
+    boost::mutex mMutex;
+
+    float mfTargetLoad;
+    float mfMinRatio;
+
+    // Smoothed processing time and interval between images, negative until measured
+    float mfTime;
+    float mfPeriod;
+    double mLastTimeStamp;
+
+    // Share of the images tracked, and the credit of the images skipped so far
+    float mfRatio;
+    float mfCredit;
+
+    unsigned int mnShed;
+};
+
+} //namespace ORB_SLAM
+
+#endif // LOADSHEDDER_H
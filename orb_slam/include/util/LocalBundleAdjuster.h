@@ -0,0 +1,145 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOCALBUNDLEADJUSTER_H
+#define LOCALBUNDLEADJUSTER_H
+
+#include <map>
+#include <vector>
+#include <set>
+#include <utility>
+#include <boost/atomic.hpp>
+
+#include "g2o/core/sparse_optimizer.h"
+#include "g2o/core/optimization_algorithm_levenberg.h"
+#include "g2o/types/sba/types_six_dof_expmap.h"
+
+namespace ORB_SLAM
+{
+
+class Map;
+class KeyFrame;
+class MapPoint;
+
+// Incremental version of Optimizer::LocalBundleAdjustment
+// The g2o graph is kept between keyframes and only edited where the local window changed, and the
+// whole window is optimized every run, as the batch version does
+// Partial runs can be enabled in between full ones: they only relinearize the variables affected by
+// the change, new or moved vertices, the ones whose observations changed, and their neighbours. The
+// rest of the window stays fixed at its previous estimate, and it is freed again when a neighbour
+// moves more than the relinearization threshold. This is not an incremental factorization, the
+// system of the free variables is still factorized from scratch, it only gets smaller
+// The graph holds map pointers, so it must only be used from one thread and DiscardBad
+// called before culled objects can be reclaimed
+class LocalBundleAdjuster
+{
+public:
+    LocalBundleAdjuster();
+
+    // Local BA around the keyframe, same window and outlier rejection as Optimizer::LocalBundleAdjustment
+    void Optimize(KeyFrame* pKF, bool* pbStopFlag=NULL);
+
+    // Drops the whole graph, the next keyframe builds it again
+    void Reset();
+
+    // Runs from one optimization of the whole window to the next, the ones in between are partial
+    // (1 - every run optimizes the whole window)
+    void SetFullPeriod(int nPeriod);
+    int GetFullPeriod() const {return mnFullPeriod;}
+
+    // Drops the graph nodes of bad keyframes and points
+    void DiscardBad();
+
+    // Estimate of the memory held by the graph, updated by DiscardBad and Reset
+    // Can be read from any thread
+    size_t MemoryBytes() const {return mnMemoryBytes.load(boost::memory_order_relaxed);}
+
+protected:
+
+    struct Observation
+    {
+        g2o::EdgeSE3ProjectXYZ* pEdge;
+        size_t nIndex;
+        unsigned long nRun;
+    };
+
+    typedef std::pair<MapPoint*,KeyFrame*> ObservationKey;
+    typedef std::map<ObservationKey,Observation> ObservationMap;
+    typedef std::set<g2o::OptimizableGraph::Vertex*> VertexSet;
+
+    // Create the vertex or read again its estimate, as loop closure or global BA may have moved it
+    // New vertices are added to sTouched, moved ones to sMoved
+    g2o::VertexSE3Expmap* SyncKeyFrame(KeyFrame* pKF, VertexSet &sTouched, VertexSet &sMoved);
+    g2o::VertexSBAPointXYZ* SyncMapPoint(MapPoint* pMP, VertexSet &sTouched, VertexSet &sMoved);
+
+    g2o::EdgeSE3ProjectXYZ* AddObservation(MapPoint* pMP, KeyFrame* pKF, size_t idx);
+    void RemoveObservation(ObservationMap::iterator it);
+
+    // Frees the local neighbours of the vertices, returns true if any was added
+    bool Spread(const VertexSet &sFrom, const VertexSet &sLocal, VertexSet &sFree);
+
+    // Fixes everything but the free vertices and prepares the edges touching them
+    void Activate(const VertexSet &sFree);
+
+    // Optimizes the active edges. The block structure and symbolic factorization of the previous run
+    // are kept if the same vertices are free and nothing was added to the graph since: removed edges
+    // only leave zero blocks behind
+    void Run(int nIterations);
+
+    // Erases the observations of the active edges that are outliers after the optimization
+    void RejectOutliers();
+
+    // Free vertices that moved more than the threshold from the map estimate
+    void Moved(const VertexSet &sFree, VertexSet &sMoved);
+
+    // Writes back the optimized estimates of the free vertices
+    void Recover(const VertexSet &sFree);
+
+    void UpdateMemoryBytes();
+
+    g2o::SparseOptimizer mOptimizer;
+    g2o::OptimizationAlgorithmLevenberg* mpAlgorithm;
+
+    Map* mpMap;
+
+    std::map<KeyFrame*,g2o::VertexSE3Expmap*> mmKeyFrames;
+    std::map<MapPoint*,g2o::VertexSBAPointXYZ*> mmMapPoints;
+    ObservationMap mmObservations;
+
+    // Runs since the graph was built and since the last time the whole window was optimized
+    unsigned long mnRun;
+    unsigned long mnLastFullRun;
+
+    // With partial runs, a full relinearization every few keyframes bounds the error of the fixed variables
+    int mnFullPeriod;
+
+    // Movement above which a variable and its neighbours are relinearized
+    double mRelinearizeThreshold;
+
+    boost::atomic<size_t> mnMemoryBytes;
+
+    // Free vertices of the last run in Hessian order, the structure is only valid while nothing is added
+    std::vector<g2o::OptimizableGraph::Vertex*> mvpStructure;
+    bool mbStructureValid;
+};
+
+} //namespace ORB_SLAM
+
+#endif // LOCALBUNDLEADJUSTER_H
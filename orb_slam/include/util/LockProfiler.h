@@ -0,0 +1,145 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOCKPROFILER_H
+#define LOCKPROFILER_H
+
+#include <vector>
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "util/Trace.h"
+
+namespace ORB_SLAM
+{
+
+// Acquisitions, wait and hold time of one lock site, updated without locking
+struct LockSite
+{
+    std::string file;
+    int line;
+    std::string function;
+    std::string mutex;
+
+    boost::atomic<unsigned long> nAcquired;
+    boost::atomic<unsigned long> nContended;
+    boost::atomic<unsigned long long> nWaitNs;
+    boost::atomic<unsigned long long> nMaxWaitNs;
+    boost::atomic<unsigned long long> nHoldNs;
+    boost::atomic<unsigned long long> nMaxHoldNs;
+
+    void Add(bool bContended, unsigned long long waitNs, unsigned long long holdNs);
+};
+
+// Contention of the mutexes of the map and the threads, per site where they are locked
+// Sites are declared with PROFILED_LOCK, which is a plain lock unless built with ORB_SLAM_LOCK_PROFILING
+class LockProfiler
+{
+public:
+    static LockProfiler* Global();
+
+    // Built with ORB_SLAM_LOCK_PROFILING
+    static bool isEnabled();
+
+    // Called once per site, the first time it is reached
+    LockSite* Site(const char* file, int line, const char* function, const char* mutex);
+
+    // One line per site, sorted by total wait: acquisitions, contended ones, wait and hold times in microseconds
+    // The totals of each mutex over all its sites are written after
+    bool SaveCSV(const std::string &filename);
+
+    // Sites with the longest total wait, for the log at shutdown
+    std::string Report(int nTop=10);
+
+    // Counters of a site, or of a mutex over its sites, copied for the reports
+    struct Row
+    {
+        std::string name;
+        unsigned long nAcquired;
+        unsigned long nContended;
+        unsigned long long nWaitNs;
+        unsigned long long nMaxWaitNs;
+        unsigned long long nHoldNs;
+        unsigned long long nMaxHoldNs;
+    };
+
+protected:
+    LockProfiler();
+    ~LockProfiler();
+
+    // Sites and the totals of each mutex over its sites, sorted by total wait
+    void GetRows(std::vector<Row> &vSites, std::vector<Row> &vMutexes);
+
+    boost::mutex mMutexSites;
+    std::vector<LockSite*> mvpSites;
+};
+
+// A Lock (boost::unique_lock, boost::shared_lock...) that adds its wait and hold time to a site
+// The mutex is tried first, only acquisitions that had to wait count as contended
+template<class Lock>
+class ProfiledLock: public Lock
+{
+public:
+    ProfiledLock(typename Lock::mutex_type &mutex, LockSite* pSite):
+        Lock(mutex,boost::defer_lock), mpSite(pSite), mbContended(false), mnWaitNs(0)
+    {
+        if(!Lock::try_lock())
+        {
+            mbContended = true;
+            const unsigned long long start = Tracer::Now();
+            Lock::lock();
+            mAcquired = Tracer::Now();
+            mnWaitNs = mAcquired-start;
+        }
+        else
+            mAcquired = Tracer::Now();
+    }
+
+    ~ProfiledLock()
+    {
+        if(Lock::owns_lock())
+            mpSite->Add(mbContended,mnWaitNs,Tracer::Now()-mAcquired);
+    }
+
+protected:
+    LockSite* mpSite;
+    bool mbContended;
+    unsigned long long mnWaitNs;
+    unsigned long long mAcquired;
+};
+
+} //namespace ORB_SLAM
+
+// Declares name as a Lock of mutex, profiled as a site of its own with ORB_SLAM_LOCK_PROFILING:
+//   PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexPos);
+#ifdef ORB_SLAM_LOCK_PROFILING
+#define PROFILED_LOCK_CONCAT_(a,b) a##b
+#define PROFILED_LOCK_CONCAT(a,b) PROFILED_LOCK_CONCAT_(a,b)
+#define PROFILED_LOCK(Lock, name, mutex) \
+    static ORB_SLAM::LockSite* PROFILED_LOCK_CONCAT(lockSite,__LINE__) = \
+        ORB_SLAM::LockProfiler::Global()->Site(__FILE__,__LINE__,__FUNCTION__,#mutex); \
+    ORB_SLAM::ProfiledLock<Lock > name(mutex,PROFILED_LOCK_CONCAT(lockSite,__LINE__))
+#else
+#define PROFILED_LOCK(Lock, name, mutex) Lock name(mutex)
+#endif
+
+#endif // LOCKPROFILER_H
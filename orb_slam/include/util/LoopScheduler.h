@@ -0,0 +1,92 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOOPSCHEDULER_H
+#define LOOPSCHEDULER_H
+
+#include <ros/ros.h>
+#include <opencv2/core/core.hpp>
+#include "dbow2/BowVector.h"
+
+namespace ORB_SLAM
+{
+
+class KeyFrame;
+class MapDatabase;
+
+// Picks the keyframes a loop detector queries, so that it keeps up with the keyframe rate
+// The keyframes handed over while a query runs are coalesced: only the most distinctive one waits,
+// by its BoW dissimilarity and its distance to the last queried keyframe, the others are skipped
+// Queries are spaced out so that they take at most a share of the time, slower queries under CPU
+// pressure make the spacing longer. A keyframe never waits longer than the latency bound
+// for its decision, it is then queried at once
+class LoopScheduler
+{
+public:
+    LoopScheduler(MapDatabase* pMapDB);
+
+    // fMaxLatency: seconds a keyframe may wait (0 - every keyframe is queried, as it arrives)
+    // fMaxDuty: share of the time spent in queries (0 - not throttled)
+    void SetLimits(float fMaxLatency, float fMaxDuty);
+    bool isEnabled() const;
+
+    // A keyframe handed over by Local Mapping. Returns the keyframe to skip, the new one or the one
+    // waiting, or NULL. The one waiting is kept from being erased until it is queried or skipped
+    KeyFrame* Add(KeyFrame* pKF);
+
+    bool isPending() const;
+
+    // The keyframe to query now, NULL if there is none or the queries are throttled
+    KeyFrame* Next();
+
+    // The query of the keyframe returned by Next ended
+    void Done();
+
+    // Drops the keyframe waiting, returned to be skipped
+    KeyFrame* Clear();
+
+protected:
+    // Higher is more worth a query
+    float Distinctiveness(KeyFrame* pKF);
+
+    MapDatabase* mpMapDB;
+    float mfMaxLatency;
+    float mfMaxDuty;
+
+    KeyFrame* mpPendingKF;
+    ros::WallTime mPendingSince;
+    float mfPendingScore;
+
+    // Last queried keyframe, copied as it may be culled meanwhile
+    bool mbLastQueried;
+    DBoW2::FlatBowVector mLastBowVec;
+    cv::Mat mLastCenter;
+    float mfLastDepth;
+
+    bool mbQuerying;
+    ros::WallTime mQueryStart;
+    ros::WallTime mQueryEnd;
+    // Moving average of the query time
+    double mfQueryTime;
+};
+
+} //namespace ORB_SLAM
+
+#endif // LOOPSCHEDULER_H
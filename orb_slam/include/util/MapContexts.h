@@ -0,0 +1,104 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef MAPCONTEXTS_H
+#define MAPCONTEXTS_H
+
+#include <map>
+
+#include "types/Map.h"
+#include "types/MapDatabase.h"
+
+namespace ORB_SLAM
+{
+
+// State of a thread that belongs to one map (e.g. the consistency of the loop candidates), kept per map
+// The thread works on the active state, selecting another map parks it with its map and takes back the
+// state parked for the new one, so a map switch is a swap instead of a reset
+// T needs a default constructor and swap(T&), parked states are keyed by Map::mnId, never reused
+template<class T>
+class MapContexts
+{
+public:
+    MapContexts():
+        mbActive(false), mnActiveId(0)
+    {}
+
+    // Makes the state of pMap the active one
+    void Select(Map* pMap, T &active)
+    {
+        if(!pMap || (mbActive && pMap->mnId==mnActiveId))
+            return;
+
+        if(mbActive)
+            mmParked[mnActiveId].swap(active);
+
+        typename std::map<long unsigned int,T>::iterator it = mmParked.find(pMap->mnId);
+        if(it!=mmParked.end())
+        {
+            active.swap(it->second);
+            mmParked.erase(it);
+        }
+        else
+            T().swap(active);
+
+        mbActive = true;
+        mnActiveId = pMap->mnId;
+    }
+
+    // Drops the states parked for the maps erased or removed (e.g. merged into another)
+    void Prune(MapDatabase* pMapDB)
+    {
+        if(mmParked.empty())
+            return;
+
+        MapDatabase::MapList pMaps = pMapDB->getMaps();
+        typename std::map<long unsigned int,T>::iterator it = mmParked.begin();
+        while(it!=mmParked.end())
+        {
+            bool bAlive = false;
+            for(size_t i=0; i<pMaps->size() && !bAlive; i++)
+                bAlive = pMaps->at(i)->mnId==it->first && !pMaps->at(i)->getErased();
+            if(bAlive)
+                it++;
+            else
+                mmParked.erase(it++);
+        }
+    }
+
+    // Forgets every map, the active state is left to the caller
+    void Clear()
+    {
+        mmParked.clear();
+        mbActive = false;
+    }
+
+protected:
+
+    std::map<long unsigned int,T> mmParked;
+
+    bool mbActive;
+    long unsigned int mnActiveId;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPCONTEXTS_H
@@ -0,0 +1,162 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef MAPJOURNAL_H
+#define MAPJOURNAL_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <iostream>
+#include <stdint.h>
+
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+
+namespace ORB_SLAM
+{
+
+class MapDatabase;
+class Map;
+class KeyFrame;
+class MapPoint;
+
+// Write-ahead log of the changes to the maps between two saves of the map file, so that a crash
+// only loses the last sync period instead of the whole session
+// The threads changing the maps serialize a record of each change: the keyframes mapped with their new points
+// and the poses of their local window, the poses of a whole map after a loop correction or a global BA,
+// the keyframes and points culled, the maps erased and merged. A writer thread appends the records and syncs
+// them to disk once per sync period. Once per compaction period, and after each merge, it saves the map file
+// and starts the log over
+// The log names the map file it follows by its size and modification time, a log of another map file is ignored
+// Replaying a record twice leaves the maps as replaying it once, the records written while the map file
+// was saved may already be in it
+class MapJournal
+{
+public:
+    MapJournal();
+    ~MapJournal();
+
+    static MapJournal* Global();
+
+    // Replays the log left by a previous run on top of the maps loaded from strMapFile, saves them if
+    // anything was replayed, then starts a new log and the writer thread
+    // fSyncPeriod: seconds between syncs, fCompactPeriod: seconds between saves of the map file
+    bool Open(MapDatabase* pMapDB, const std::string &strMapFile, float fSyncPeriod, float fCompactPeriod);
+
+    // Writes and syncs what is queued, then stops the writer thread
+    // The map file saved at shutdown supersedes the log
+    void Close();
+
+    bool isOpen() const;
+
+    // Local Mapping is done with the keyframe: the keyframe, its matches, the points it created,
+    // and the poses of its covisible keyframes and points after the local BA
+    void KeyFrameMapped(KeyFrame* pKF);
+
+    // Poses of all the keyframes and points of the map, after a loop correction or a global BA
+    void MapAdjusted(Map* pMap);
+
+    // The keyframes and points of pSource moved to pTarget. The map file is saved at the next sync
+    void MapsMerged(Map* pSource, Map* pTarget);
+
+    // Called by the maps, the ids are written in one record at the next sync
+    void KeyFrameErased(KeyFrame* pKF);
+    void MapPointErased(MapPoint* pMP);
+    void MapPointsErased(const std::vector<MapPoint*> &vpMPs);
+    void MapErased(Map* pMap);
+
+    // Records replayed by the last Open
+    unsigned long Replayed() const;
+
+protected:
+
+    enum eRecordType
+    {
+        RECORD_MAPS=0,
+        RECORD_KEYFRAME=1,
+        RECORD_POSES=2,
+        RECORD_ERASED=3,
+        RECORD_MAP_ERASED=4,
+        RECORD_MERGED=5
+    };
+
+    // Whether a match of a keyframe record refers to a point already logged or carries it in full
+    static const uint8_t POINT_KNOWN;
+    static const uint8_t POINT_NEW;
+
+    struct Replay;
+
+    // Type and payload size precede the payload of each record
+    void Queue(uint8_t type, const std::string &payload);
+
+    // Poses of the keyframes, then positions of the points
+    static void WritePoses(std::ostream &f, const std::vector<KeyFrame*> &vpKFs, const std::vector<MapPoint*> &vpMPs);
+
+    // Size and modification time of the map file, zero if it does not exist
+    static void MapFileStamp(const std::string &filename, uint64_t &nSize, int64_t &nTime);
+
+    // Applies the records of the log if it follows the current map file, returns how many
+    unsigned long ReplayLog();
+    bool ReplayRecord(Replay &replay, uint8_t type, const char* pData, size_t nSize);
+    bool ReplayPoses(Replay &replay, std::istream &f);
+
+    // Replaces the log by an empty one following the current map file, starting with the maps record
+    bool StartLog();
+
+    // Saves the map file, then starts the log over
+    bool Compact();
+
+    void RunWriter();
+
+    // Appends the queued records and the erased ids, then syncs. Returns false if the log could not be written
+    bool Flush();
+
+    MapDatabase* mpMapDB;
+    std::string mstrMapFile;
+    std::string mstrFilename;
+    int mFd;
+
+    float mfSyncPeriod;
+    float mfCompactPeriod;
+
+    boost::atomic<bool> mbOpen;
+
+    // Records queued and erased ids, guarded by mMutexQueue
+    boost::mutex mMutexQueue;
+    boost::condition_variable mcvClose;
+    std::vector<std::string> mvPending;
+    std::vector<uint64_t> mvErasedKeyFrames;
+    std::vector<uint64_t> mvErasedMapPoints;
+    bool mbClosing;
+    bool mbCompactRequested;
+
+    // Points written in full since the log started, guarded by mMutexQueue
+    std::set<unsigned long> msLoggedPoints;
+
+    unsigned long mnReplayed;
+
+    boost::thread* mpWriter;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPJOURNAL_H
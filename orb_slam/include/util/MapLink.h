@@ -0,0 +1,194 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPLINK_H
+#define MAPLINK_H
+
+#include "util/MapSerializer.h"
+
+#include <orb_slam/MapPacket.h>
+
+#include <ros/ros.h>
+#include <ros/callback_queue.h>
+
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ORB_SLAM
+{
+
+class MapDatabase;
+class Map;
+class KeyFrame;
+class MapPoint;
+class LocalMapping;
+
+// Split deployment (System.Role): tracking and a small local map on the robot, mapping,
+// loop closing and map merging on a server
+// The robot sends each new keyframe with the points it matched (ORB_SLAM/KeyFrames). After
+// processing it the server sends back the poses and points of its covisible window, numbered by
+// an increasing version (ORB_SLAM/MapUpdates). Keyframes and points use the MapSerializer format
+// Both sides keep the ids of the other one, keyframes and points are matched through tables of the remote ids
+// A server takes the keyframes of several robots, each with its own MapLink.AgentId, into one MapDatabase.
+// Each agent has its own queue, served in turn, its own maps and its own updates. Their maps are merged by
+// MapMerging once place recognition over the shared keyframe database links them
+// Everything but the receiving callback runs in the LocalMapping thread
+class MapLink
+{
+public:
+    enum eRole
+    {
+        ROBOT=1,
+        SERVER=2
+    };
+
+    // nWindow: covisible keyframes sent with each update
+    // nLocalKeyFrames: keyframes the robot keeps, older ones are culled
+    // bCompression: packets are deflated with zlib when it makes them smaller
+    // bSendBoW: keyframes carry their BoW vectors, otherwise the server recomputes them
+    // nAgentId: id of the robot among the robots of the server
+    MapLink(MapDatabase* pMapDB, eRole role, int nWindow, int nLocalKeyFrames, bool bCompression, bool bSendBoW,
+            uint32_t nAgentId=0);
+    ~MapLink();
+
+    eRole GetRole();
+
+    // Woken when a packet arrives
+    void SetLocalMapper(LocalMapping* pLocalMapper);
+
+    // Advertises and subscribes the link topics, received packets are handled on a spinner of their own
+    void Start(ros::NodeHandle &nh);
+    void Stop();
+
+    // Packets received and not handled yet
+    bool HasPending();
+
+    // Robot: sends a keyframe once it is in the map, points without a server id are sent in full
+    void SendKeyFrame(KeyFrame* pKF);
+
+    // Robot: applies the updates received, older versions than the last applied are dropped
+    void ApplyUpdates();
+
+    // Server: reads the next keyframe received into the map of its robot map, NULL if none
+    // The agents with keyframes waiting take turns. The keyframe gets a server id and its points are linked,
+    // it is processed by LocalMapping as one from Tracking
+    KeyFrame* ReceiveKeyFrame();
+
+    // Server: sends the window of a processed keyframe and the keyframes culled since the last update
+    // to the agent of the keyframe. Keyframes of other agents in the window are left out
+    void SendUpdate(KeyFrame* pKF);
+
+    // Drops the culled keyframes and points from the tables
+    void PurgeBadPointers();
+
+protected:
+
+    void GrabPacket(const orb_slam::MapPacketConstPtr &msg);
+
+    // Server: what the server knows of one robot
+    struct Agent
+    {
+        Agent(): nVersion(0), nReceived(0) {}
+
+        ros::Publisher pub;
+
+        // Keyframes by robot id and the robot id of each one
+        MapSerializer::KeyFrameIndex keyFrames;
+        std::map<KeyFrame*,unsigned long> robotKeyFrameIds;
+        // Points received from the robot by robot id, and the robot id of each one
+        MapSerializer::MapPointIndex robotPoints;
+        std::map<MapPoint*,unsigned long> robotPointIds;
+        // Maps by robot map id, the last keyframe received in each one
+        std::map<unsigned long,Map*> maps;
+        std::map<unsigned long,KeyFrame*> lastKeyFrames;
+        // Robot ids of the keyframes culled since the last update, and the last version sent
+        std::vector<unsigned long> vErasedKeyFrames;
+        uint64_t nVersion;
+        unsigned long nReceived;
+    };
+
+    // Update topic of an agent
+    static std::string UpdateTopic(uint32_t nAgentId);
+
+    // Publishes the bytes of a packet, deflated if that saves space
+    void Publish(ros::Publisher &pub, const std::string &data, uint32_t nAgentId, uint64_t nVersion);
+
+    // Bytes of a received packet, inflated into vBuffer if needed. False if the packet is malformed
+    static bool Unpack(const orb_slam::MapPacket &msg, std::vector<uint8_t> &vBuffer, const char* &pData, size_t &nSize);
+
+    // Robot: one update, false if the packet is malformed
+    bool ApplyUpdate(const orb_slam::MapPacket &msg);
+
+    // Robot: culls the keyframes sent before the last nLocalKeyFrames
+    void TrimLocalMap();
+
+    // Server: the agent, advertising its update topic the first time
+    Agent &GetAgent(uint32_t nAgentId);
+
+    // Server: the map receiving the keyframes of a robot map, created with its first keyframe
+    Map* GetServerMap(Agent &agent, uint32_t nAgentId, unsigned long nRobotMapId);
+
+    MapDatabase* mpMapDB;
+    eRole mRole;
+    int mnWindow;
+    int mnLocalKeyFrames;
+    bool mbCompression;
+    bool mbSendBoW;
+    uint32_t mnAgentId;
+    LocalMapping* mpLocalMapper;
+
+    ros::NodeHandle mNH;
+    ros::Publisher mPub;
+    ros::Subscriber mSub;
+    ros::CallbackQueue mQueue;
+    boost::shared_ptr<ros::AsyncSpinner> mpSpinner;
+
+    // Received by the callback, handled by LocalMapping. The server queues them by agent
+    boost::mutex mMutexPackets;
+    std::deque<orb_slam::MapPacketConstPtr> mqPackets;
+    std::map<uint32_t,std::deque<orb_slam::MapPacketConstPtr> > mAgentPackets;
+    // Server: the agent served last
+    uint32_t mnLastAgent;
+
+    // Robot: keyframes sent by id
+    MapSerializer::KeyFrameIndex mKeyFrames;
+
+    // Robot: points by server id, the server id of each point, and the points sent in full by robot id
+    MapSerializer::MapPointIndex mServerPoints;
+    std::map<MapPoint*,unsigned long> mServerIds;
+    MapSerializer::MapPointIndex mSentPoints;
+    // Robot: keyframes sent, oldest first, and the last version applied
+    std::deque<KeyFrame*> mlpSentKeyFrames;
+    uint64_t mnAppliedVersion;
+
+    // Server: points by the id they were sent with, the robots, and the agent of each keyframe received
+    MapSerializer::MapPointIndex mUpdatedPoints;
+    std::map<uint32_t,Agent> mAgents;
+    std::map<KeyFrame*,uint32_t> mKeyFrameAgents;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPLINK_H
@@ -0,0 +1,93 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPSERIALIZER_H
+#define MAPSERIALIZER_H
+
+#include <string>
+#include <iostream>
+#include <map>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM
+{
+
+class MapDatabase;
+class Map;
+class KeyFrame;
+class MapPoint;
+class KeyPointArray;
+
+// Versioned binary file of all the maps of a MapDatabase
+// Stores the keyframes (poses, calibration, keypoints, descriptors, BoW and feature vectors),
+// the map points with their observations, the covisibility graph, spanning tree and loop edges
+// Keyframe images are not stored. Erased maps are skipped
+// The keypoint arrays and descriptor matrices of the keyframes are aligned in the file so that a loaded map uses
+// them in place from a read-only mapping, shared by the processes loading the same file. The mutable state is copied,
+// the map points included: their positions and descriptors are values of the point, changed by the optimizations
+class MapSerializer
+{
+    // The map link sends keyframes and points between the robot and the server in the same format
+    friend class MapLink;
+    // The map journal logs them between two saves of the file
+    friend class MapJournal;
+
+public:
+    // Format of the keyframes and points written
+    static const uint32_t FORMAT_VERSION;
+
+    // Writes to a temporary file first, the previous file is only replaced once it is complete
+    static bool Save(MapDatabase* pMapDB, const std::string &filename);
+
+    // Adds the maps of the file to the database, which is unchanged if the file can not be read
+    // The keyframe databases are rebuilt from the stored BoW vectors
+    // Files that can not be mapped are read in full instead
+    static bool Load(MapDatabase* pMapDB, const std::string &filename);
+
+protected:
+    typedef std::map<unsigned long, KeyFrame*> KeyFrameIndex;
+    typedef std::map<unsigned long, MapPoint*> MapPointIndex;
+
+    // Compact keyframe: quantized keypoints, raw descriptors and pose, the grid is rebuilt when read
+    // Without bBoW the BoW vectors are left out, ComputeBoW recomputes them on the reading side
+    // With bAligned the keypoints are aligned arrays instead, as in map files, used in place when read from a mapping
+    static void WriteKeyFrame(std::ostream &f, KeyFrame* pKF, bool bBoW=true, bool bAligned=false);
+    static void WriteMapPoint(std::ostream &f, MapPoint* pMP);
+    static void WriteLinks(std::ostream &f, KeyFrame* pKF);
+
+    // Descriptors of the current format, used in place if pBase is the start of a mapping of the stream
+    static bool ReadDescriptors(std::istream &f, cv::Mat &descriptors, uint32_t nVersion, const char* pBase);
+
+    // Positions, orientations and octaves as aligned arrays, used in place if pBase is the start of a mapping of the stream
+    static void WriteKeyPointArrays(std::ostream &f, const KeyPointArray &keys);
+    static bool ReadKeyPointArrays(std::istream &f, KeyPointArray &keys, const char* pBase);
+
+    static KeyFrame* ReadKeyFrame(std::istream &f, Map* pMap, MapDatabase* pMapDB, uint32_t nVersion, const char* pBase);
+    // Returns false if the stream failed, pMP is NULL if none of its keyframes was stored
+    static bool ReadMapPoint(std::istream &f, Map* pMap, const KeyFrameIndex &keyFrames, MapPoint* &pMP,
+                             uint32_t nVersion, const char* pBase);
+    static bool ReadLinks(std::istream &f, KeyFrame* pKF, const KeyFrameIndex &keyFrames, const MapPointIndex &mapPoints);
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPSERIALIZER_H
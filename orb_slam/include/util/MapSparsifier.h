@@ -0,0 +1,98 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPSPARSIFIER_H
+#define MAPSPARSIFIER_H
+
+#include <vector>
+
+namespace ORB_SLAM
+{
+
+class Map;
+class KeyFrame;
+class MapPoint;
+
+// Keeps a long lived map within a budget of keyframes and points per cell of space
+// Keyframes are hashed by their camera center and points by their position. In the cells over budget
+// the keyframes and points of least value are retired, so revisiting a place does not grow the map
+class MapSparsifier
+{
+public:
+    // fCellSize: cell edge in map units (0 - disabled)
+    // nMaxKeyFrames, nMaxPoints: budget of each cell (0 - unbounded)
+    MapSparsifier(float fCellSize=0, int nMaxKeyFrames=0, int nMaxPoints=0);
+
+    bool isEnabled() const {return mfCellSize>0 && (mnMaxKeyFrames>0 || mnMaxPoints>0);}
+
+    // One pass over the map. The last RECENT_KEYFRAMES keyframes, their new points, the first keyframe
+    // and keyframes with loop edges are never retired. Returns early when *pbAbort is set
+    // Must be called from the thread that culls the map, as KeyFrameCulling
+    void Run(Map* pMap, bool* pbAbort=0);
+
+    int GetRetiredKeyFrames() const {return mnRetiredKeyFrames;}
+    int GetRetiredPoints() const {return mnRetiredPoints;}
+
+protected:
+
+    static const int RECENT_KEYFRAMES;
+
+    struct KeyFrameScore
+    {
+        KeyFrame* pKF;
+        float value;
+    };
+
+    struct PointScore
+    {
+        MapPoint* pMP;
+        float value;
+    };
+
+    // Retires the keyframes of least value until the cell is within budget
+    void SparsifyKeyFrames(std::vector<KeyFrame*> &vpCell, bool* pbAbort);
+
+    // Value of each keyframe of the cell, the sum of
+    // coverage: fraction of its points observed by at most two keyframes, lost with it
+    // uniqueness: 1 - fraction of its points seen by three other keyframes at the same or a finer scale
+    // place: fraction of its words no other keyframe of the cell has, what it adds to place recognition
+    void ScoreKeyFrames(const std::vector<KeyFrame*> &vpCell, std::vector<KeyFrameScore> &vScores);
+
+    // Retires the points of least value until the cell is within budget
+    // The value is the number of observations plus the ratio of frames that found the point when it was visible
+    void SparsifyPoints(std::vector<MapPoint*> &vpCell);
+
+    long long CellKey(const float* pos) const;
+
+    float mfCellSize;
+    int mnMaxKeyFrames;
+    int mnMaxPoints;
+
+    // Keyframes and points first seen after this keyframe are in the window of tracking and local mapping
+    long unsigned int mnMaxRetiredKFid;
+
+    // Totals over all the passes
+    int mnRetiredKeyFrames;
+    int mnRetiredPoints;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPSPARSIFIER_H
@@ -0,0 +1,67 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <streambuf>
+#include <cstddef>
+
+namespace ORB_SLAM
+{
+
+// Read-only mapping of a whole file, its pages are shared with the other processes mapping it
+// Data stays valid until the mapping is closed, even if the file is replaced meanwhile
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool Open(const std::string &filename);
+    void Close();
+
+    const char* Data() const {return mpData;}
+    std::size_t Size() const {return mnSize;}
+
+protected:
+    const char* mpData;
+    std::size_t mnSize;
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+// Stream buffer reading a memory range in place, so an istream can parse a mapped file
+class MemoryStreamBuf: public std::streambuf
+{
+public:
+    MemoryStreamBuf(const char* pData, std::size_t nSize);
+
+protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which);
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,94 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef MEMORYSTATS_H
+#define MEMORYSTATS_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM
+{
+
+// Bytes held by each kind of map data, added up by the objects holding them
+// Estimates: container storage is counted by capacity, tree nodes with the usual
+// red-black node overhead, and allocator overhead is left out
+class MemoryStats
+{
+public:
+    enum eCategory{
+        KEYFRAME_OBJECTS=0,
+        KEYFRAME_IMAGES,
+        KEYFRAME_KEYPOINTS,
+        KEYFRAME_DESCRIPTORS,
+        KEYFRAME_BOW,
+        KEYFRAME_GRAPH,
+        MAPPOINT_OBJECTS,
+        MAPPOINT_OBSERVATIONS,
+        MAPPOINT_DESCRIPTORS,
+        KEYFRAME_DATABASE,
+        VOCABULARY,
+        LOCAL_BA,
+        MAPPOINT_INDEX,
+        N_CATEGORIES
+    };
+
+    MemoryStats();
+
+    static const char* CategoryName(int category);
+
+    void Add(int category, size_t nBytes) {mvBytes[category] += nBytes;}
+    size_t Get(int category) const {return mvBytes[category];}
+    size_t Total() const;
+
+    MemoryStats& operator+=(const MemoryStats &other);
+
+    // One line per category, in MB
+    std::string ToString() const;
+
+    // Heap storage of the common containers
+    template<class T>
+    static size_t VectorBytes(const std::vector<T> &v) {return v.capacity()*sizeof(T);}
+    template<class C>
+    static size_t TreeBytes(const C &c) {return c.size()*(sizeof(typename C::value_type)+4*sizeof(void*));}
+    template<class C>
+    static size_t HashBytes(const C &c) {return c.bucket_count()*sizeof(void*)+c.size()*(sizeof(typename C::value_type)+2*sizeof(void*));}
+    static size_t MatBytes(const cv::Mat &m) {return m.total()*m.elemSize();}
+
+public:
+    // Objects counted
+    size_t mnKeyFrames;
+    size_t mnMapPoints;
+
+    // Points still in a map after being set bad, and the bytes they hold (included in the categories)
+    // They are only freed when erased from the map, a growing count is a leak
+    size_t mnBadMapPoints;
+    size_t mnBadMapPointBytes;
+
+protected:
+    size_t mvBytes[N_CATEGORIES];
+};
+
+} //namespace ORB_SLAM
+
+#endif // MEMORYSTATS_H
@@ -0,0 +1,118 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+namespace ORB_SLAM
+{
+
+// Operational counters of the pipeline, exported by the StatsPublisher
+// Each counter is a relaxed atomic, adding to it costs about as much as an increment
+class Metrics
+{
+public:
+    enum eCounter{
+        FRAMES_TRACKED=0,
+        FRAMES_DROPPED,
+        FRAMES_SHED,
+        FRAMES_STATIONARY,
+        FRAMES_REJECTED,
+        TRACKING_STATE_CHANGES,
+        TRACKING_LOST,
+        KEYFRAMES_CREATED,
+        KEYFRAMES_ANTICIPATED,
+        KEYFRAMES_MAPPED,
+        LOCAL_BA_INTERRUPTED,
+        LOOPS_DETECTED,
+        LOOPS_CORRECTED,
+        LOOP_QUERIES_SKIPPED,
+        MERGES_DETECTED,
+        MERGES_DONE,
+        MERGE_QUERIES_SKIPPED,
+        MAPS_REFINED,
+        RELOCALIZATION_ATTEMPTS,
+        RELOCALIZATION_SUCCESSES,
+        RELOCALIZATION_LOCAL_SUCCESSES,
+        OPTIMIZATIONS,
+        OPTIMIZER_ITERATIONS,
+        OPTIMIZER_MICROSECONDS,
+        N_COUNTERS
+    };
+
+    static Metrics* Global();
+
+    // Snake case name, used as the exported metric name
+    static const char* CounterName(int counter);
+
+    void Add(int counter, boost::uint64_t n=1) {mvCounters[counter].fetch_add(n,boost::memory_order_relaxed);}
+
+    // Total since the start
+    boost::uint64_t Get(int counter) const {return mvCounters[counter].load(boost::memory_order_relaxed);}
+
+protected:
+    Metrics();
+
+    boost::atomic<boost::uint64_t> mvCounters[N_COUNTERS];
+};
+
+// Adds the microseconds from construction to destruction to a counter
+class MetricsTimer
+{
+public:
+    MetricsTimer(int counter);
+    ~MetricsTimer();
+
+protected:
+    int mnCounter;
+    boost::uint64_t mnStart;
+};
+
+// Sends metrics to a statsd daemon over UDP, counters as increments since the last push and gauges as values
+// Lines are packed in datagrams below the usual MTU. Sending never blocks, lost datagrams are not retried
+class StatsdClient
+{
+public:
+    StatsdClient(const std::string &host, int port, const std::string &prefix);
+    ~StatsdClient();
+
+    bool IsOpen() const {return mnSocket>=0;}
+
+    void Counter(const std::string &name, boost::uint64_t delta);
+    void Gauge(const std::string &name, double value);
+
+    // Sends the lines added since the last flush
+    void Flush();
+
+protected:
+    void AddLine(const std::string &line);
+
+    int mnSocket;
+    std::string mstrPrefix;
+    std::string mBuffer;
+};
+
+} //namespace ORB_SLAM
+
+#endif // METRICS_H
@@ -24,18 +24,32 @@
 #include <vector>
 #include <list>
 #include <opencv/cv.h>
+#include <boost/thread/mutex.hpp>
+
+#include "util/ImagePyramid.h"
 
 
 namespace ORB_SLAM
 {
 
+// Another implementation of the extraction, e.g. on another device
+// It gets the current parameters of the ORBextractor and returns false to leave the image to the CPU
+class ExtractorBackend
+{
+public:
+    virtual ~ExtractorBackend(){}
+
+    virtual bool Extract(const cv::Mat &image, const cv::Mat &mask, int nfeatures, float scaleFactor, int nlevels, int fastTh,
+                         std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors) = 0;
+};
+
 class ORBextractor
 {
 public:
     
     enum {HARRIS_SCORE=0, FAST_SCORE=1 };
 
-    ORBextractor(int nfeatures = 1000, float scaleFactor = 1.2f, int nlevels = 8, int scoreType=FAST_SCORE, int fastTh = 20);
+    ORBextractor(int nfeatures = 1000, float scaleFactor = 1.2f, int nlevels = 8, int scoreType=FAST_SCORE, int fastTh = 20, int nThreads = 1);
 
     ~ORBextractor(){}
 
@@ -50,11 +64,71 @@ public:
     float inline GetScaleFactor(){
         return scaleFactor;}
 
+    int inline GetThreads(){
+        return nThreads;}
+
+    // Change the number of features and the FAST threshold
+    // Thread safe, the new values are used from the next image on
+    void SetParameters(int nfeatures, int fastTh);
+
+    int GetFeatures();
+    int GetFastThreshold();
+
+    // Finest pyramid level extracted, the finer ones and their share of the features are skipped (0 - full resolution)
+    // The image is tracked at a lower resolution while keypoints keep the octave and coordinates of the full pyramid
+    // Not thread safe, set it from the thread extracting before the image
+    void SetFirstLevel(int level);
+    int inline GetFirstLevel(){
+        return firstLevel;}
+
+    // Keypoints of each level from a single FAST pass distributed with a quadtree, instead of a FAST pass per cell
+    // of a grid with a retry at a lower threshold (false - grid)
+    // Not thread safe, set it before the first image
+    void SetQuadTree(bool bQuadTree){
+        mbQuadTree = bQuadTree;}
+    bool inline GetQuadTree(){
+        return mbQuadTree;}
+
+    // Static mask of the image (CV_8U, non zero where features may be), e.g. to leave out the vehicle or an overlay
+    // It is scaled to every level and eroded so that no keypoint patch overlaps a masked pixel
+    // Fully masked cells are skipped and their features go to the other cells. Ignored for images of another size
+    // Not thread safe, set it before the first image
+    void SetStaticMask(const cv::Mat &mask);
+
+    // Region of interest of the image, empty for the whole image. Applied with the mask, keypoint patches lie inside
+    // Thread safe, the new region is used from the next image on
+    void SetRoi(const cv::Rect &roi);
+    cv::Rect GetRoi();
+
+    // Images are handed to the backend first, NULL to extract on the CPU only. The backend is not owned
+    // and is called from the thread calling operator()
+    void SetBackend(ExtractorBackend* pBackend){
+        mpBackend = pBackend;}
+
+    // Pyramid shared with other extractors and readers of the same images, NULL for a pyramid of its own
+    // It is built once per image for extractors of the same scales, and read only by the thread calling operator()
+    void SetPyramid(ImagePyramid* pPyramid){
+        mpPyramid = pPyramid ? pPyramid : &mPyramid;}
+
 
 protected:
 
+    void ComputeFeaturesPerLevel();
+    void ApplyParameters();
+
     void ComputePyramid(cv::Mat image, cv::Mat Mask=cv::Mat());
+    // Pixels of a level where keypoints may be, from the static mask, the mask of the image and the region of interest
+    // Empty if nothing is masked
+    cv::Mat ComputeLevelMask(int level);
     void ComputeKeyPoints(std::vector<std::vector<cv::KeyPoint> >& allKeypoints);
+    void ComputeKeyPointsLevel(int level, std::vector<cv::KeyPoint>& keypoints);
+    void ComputeKeyPointsQuadTree(int level, std::vector<cv::KeyPoint>& keypoints);
+
+    // Keypoints, orientation and descriptors of a single pyramid level
+    void ExtractLevel(int level, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors);
+    // Worker loop, takes levels until all of them are processed
+    void ExtractLevels(std::vector<std::vector<cv::KeyPoint> >* pAllKeypoints, std::vector<cv::Mat>* pAllDescriptors,
+                       int* pNextLevel, boost::mutex* pMutexLevel);
 
     std::vector<cv::Point> pattern;
 
@@ -63,6 +137,22 @@ protected:
     int nlevels;
     int scoreType;
     int fastTh;
+    int nThreads;
+    int firstLevel;
+    bool mbQuadTree;
+
+    // Requested by SetParameters, applied at the start of the next extraction
+    int mnRequestedFeatures;
+    int mnRequestedFastTh;
+    cv::Rect mRequestedRoi;
+    boost::mutex mMutexParameters;
+
+    // Static mask of each level, eroded by the patch radius (empty - none), and whether it applies to the current image
+    std::vector<cv::Mat> mvStaticMask;
+    bool mbStaticMask;
+
+    // Region of interest of the current image, empty for the whole image
+    cv::Rect mRoi;
 
     std::vector<int> mnFeaturesPerLevel;
 
@@ -71,8 +161,11 @@ protected:
     std::vector<float> mvScaleFactor;
     std::vector<float> mvInvScaleFactor;
 
-    std::vector<cv::Mat> mvImagePyramid;
-    std::vector<cv::Mat> mvMaskPyramid;
+    // Pyramid in use, mPyramid unless a shared one is set
+    ImagePyramid mPyramid;
+    ImagePyramid* mpPyramid;
+
+    ExtractorBackend* mpBackend;
 
 };
 
@@ -29,23 +29,60 @@
 #include "types/MapPoint.h"
 #include "types/KeyFrame.h"
 #include "types/Frame.h"
+#include "util/FrustumCuller.h"
+
+#include "dbow2/Hamming.h"
+#include "dbow2/FeatureVector.h"
 
 
 namespace ORB_SLAM
 {
 
+// Computes the descriptor distances of the windowed searches off the CPU. Window w pairs row vQueries[w] of Queries
+// with rows vCandidates[vOffsets[w]..vOffsets[w+1]) of Candidates, vDists receives one distance per candidate.
+// Shared by the matchers of all the threads. When Distances fails the matcher computes them on the CPU
+class MatcherBackend
+{
+public:
+    virtual ~MatcherBackend(){}
+
+    virtual bool Distances(const cv::Mat &Queries, const std::vector<int> &vQueries,
+                           const cv::Mat &Candidates, const std::vector<size_t> &vCandidates,
+                           const std::vector<size_t> &vOffsets, std::vector<int> &vDists)=0;
+};
+
 class ORBmatcher
 {    
 public:
 
+    // Matchers are cheap to construct, the buffers of the searches live in the Workspace of the
+    // constructing thread, so a matcher must only be used by that thread.
+    // Output vectors are filled in place, callers keeping them across calls avoid allocations
     ORBmatcher(float nnratio=0.6, bool checkOri=true);
 
     // Computes the Hamming distance between two ORB descriptors
-    static int DescriptorDistance(const cv::Mat &a, const cv::Mat &b);
+    static inline int DescriptorDistance(const cv::Mat &a, const cv::Mat &b){
+        return DBoW2::Hamming::distance(a.ptr<uchar>(), b.ptr<uchar>());}
+    static inline int DescriptorDistance(const uchar* a, const uchar* b){
+        return DBoW2::Hamming::distance(a, b);}
+    static inline int DescriptorDistance(const DBoW2::Descriptor256 &a, const uchar* b){
+        return DBoW2::Hamming::distance(a, b);}
 
     // Search matches between Frame keypoints and projected MapPoints. Returns number of matches
-    // Used to track the local map (Tracking)
-    int SearchByProjection(Frame &F, const std::vector<MapPoint*> &vpMapPoints, const float th=3);
+    // Used to track the local map (Tracking), proj is the projection of vpMapPoints given by FrustumCuller::Cull
+    // Candidates out of the search radius, or whose first 64 descriptor bits already rule them out,
+    // are rejected before the full distance. The counts of the last search are kept in GetProjectionStats()
+    int SearchByProjection(Frame &F, const std::vector<MapPoint*> &vpMapPoints, const LocalMapProjection &proj, const float th=3);
+
+    struct ProjectionStats
+    {
+        int nPoints;        // MapPoints searched
+        int nCandidates;    // free keypoints in their windows
+        int nOutOfRadius;   // rejected by the distance to the projection
+        int nPrefiltered;   // rejected by the 64 bit lower bound
+        int nCompared;      // full descriptor distances computed
+    };
+    const ProjectionStats& GetProjectionStats() const {return mProjectionStats;}
 
     // Project MapPoints tracked in last frame into the current frame and search matches.
     // Used to track from previous frame (Tracking)
@@ -65,6 +102,16 @@ public:
     int SearchByBoW(KeyFrame *pKF, Frame &F, std::vector<MapPoint*> &vpMapPointMatches);
     int SearchByBoW(KeyFrame *pKF1, KeyFrame* pKF2, std::vector<MapPoint*> &vpMatches12);
 
+    // Searches with a window per feature (WindowSearch, SearchByProjection between frames and SearchForInitialization)
+    // compute their distances on the backend once the windows hold nMinCandidates candidates. Takes ownership
+    // of the backend, set it before matching starts. The matches are the ones of the CPU
+    static void SetBackend(MatcherBackend* pBackend, size_t nMinCandidates);
+
+    // Windows of WindowSearch and SearchForInitialization of fMinWindow pixels or more take their candidates from
+    // the descriptor index of the frame searched (see DescriptorIndex) instead of its grid, then keep those inside
+    // (0 - never). Set it before matching starts
+    static void SetDescriptorIndex(float fMinWindow);
+
     // Search MapPoints tracked in Frame1 in Frame2 in a window centered at their position in Frame1
     int WindowSearch(Frame &F1, Frame &F2, int windowSize, std::vector<MapPoint *> &vpMapPointMatches2, int minOctave=-1, int maxOctave=INT_MAX);
     // Refined matching when we have a guess of Frame 2 pose
@@ -72,6 +119,10 @@ public:
 
     // Matching for the Map Initialization
     int SearchForInitialization(Frame &F1, Frame &F2, std::vector<cv::Point2f> &vbPrevMatched, std::vector<int> &vnMatches12, int windowSize=10);
+    // Same with a window per feature of Frame1 around vbPrevMatched, vWindowSizes[i1] pixels or none if 0
+    // The initialization tracks the previous matches with small windows and searches wide only for the lost ones
+    int SearchForInitialization(Frame &F1, Frame &F2, std::vector<cv::Point2f> &vbPrevMatched, std::vector<int> &vnMatches12,
+                                const std::vector<float> &vWindowSizes);
 
     // Matching to triangulate new MapPoints. Check Epipolar Constraint
     int SearchForTriangulation(KeyFrame *pKF1, KeyFrame* pKF2, cv::Mat F12,
@@ -84,26 +135,87 @@ public:
     // Project MapPoints into KeyFrame and search for duplicated MapPoints.
     int Fuse(KeyFrame* pKF, std::vector<MapPoint *> &vpMapPoints, float th=2.5);
 
+    // Same search without modifying the map, vpMatched[i] is the MapPoint matched to keypoint i (or NULL).
+    // A keypoint matched by several MapPoints keeps the most similar one.
+    int Fuse(KeyFrame* pKF, const std::vector<MapPoint*> &vpMapPoints, float th, std::vector<MapPoint*> &vpMatched);
+
     // Project MapPoints into KeyFrame using a given Sim3 and search for duplicated MapPoints.
     int Fuse(KeyFrame* pKF, cv::Mat Scw, const std::vector<MapPoint*> &vpPoints, float th=2.5);
 
+    // Same search without modifying the map, vpMatched[i] is the MapPoint matched to keypoint i (or NULL).
+    int Fuse(KeyFrame* pKF, cv::Mat Scw, const std::vector<MapPoint*> &vpPoints, float th, std::vector<MapPoint*> &vpMatched);
+
 public:
 
     static const int TH_LOW;
     static const int TH_HIGH;
-    static const int HISTO_LENGTH;
+    static const int HISTO_LENGTH = 30;
+
+    // Temporary buffers of the searches, one per thread. They keep their capacity between calls
+    // so that matching does not allocate once they have grown to the size of a frame
+    struct Workspace
+    {
+        std::vector<int> vRotHist[HISTO_LENGTH];
+        std::vector<size_t> vIndices;
+        std::vector<int> vnMatches1, vnMatches2, vnDist;
+        std::vector<bool> vbMatched1, vbMatched2;
+        std::vector<MapPoint*> vpMapPoints1, vpMapPoints2, vpFound;
+        DBoW2::FlatFeatureVector featVec1, featVec2;
+        // Features of a vocabulary node compared by SearchByBoW, their packed descriptors and distances
+        std::vector<unsigned int> vNodeRows1, vNodeRows2;
+        std::vector<uchar> vPacked1, vPacked2;
+        std::vector<int> vNodeDists;
+        // Windows of a windowed search: query row, offsets of its candidates, candidate rows and distances
+        std::vector<int> vWindowQueries;
+        std::vector<size_t> vWindowOffsets;
+        std::vector<size_t> vWindowCandidates;
+        std::vector<int> vWindowDists;
+        // Window size of each feature of SearchForInitialization
+        std::vector<float> vWindowSizes;
+
+        void ClearWindows();
+        void AddWindow(int query, const std::vector<size_t> &vCandidates);
+
+        // Empties the rotation histogram and returns its bins
+        std::vector<int>* ClearRotHist();
+    };
+
+    // Workspace of the calling thread
+    static Workspace& GetWorkspace();
 
 
 protected:
 
-    bool CheckDistEpipolarLine(const cv::KeyPoint &kp1, const cv::KeyPoint &kp2, const cv::Mat &F12, const KeyFrame *pKF);
+    bool CheckDistEpipolarLine(const cv::Point2f &pt1, const cv::Point2f &pt2, int octave2, const cv::Mat &F12, const KeyFrame *pKF);
 
     float RadiusByViewingCos(const float &viewCos);
 
+    // Projects a MapPoint with the keyframe pose and returns the most similar keypoint in the radius, or -1
+    // DescriptorsKF are the descriptors of the keyframe, taken once by the caller
+    int FuseSearch(KeyFrame* pKF, const PoseSnapshot &pose, const std::vector<float> &vfScaleFactors,
+                   const cv::Mat &DescriptorsKF, MapPoint* pMP, float th, std::vector<size_t> &vIndices, int &bestDist);
+
     void ComputeThreeMaxima(std::vector<int>* histo, const int L, int &ind1, int &ind2, int &ind3);
 
+    // Distances between rows vRows1 of Descriptors1 and rows vRows2 of Descriptors2 into the workspace
+    // vNodeDists, one row per vRows1 entry. The rows are packed next to each other for the Hamming kernel
+    void NodeDistances(const cv::Mat &Descriptors1, const std::vector<unsigned int> &vRows1,
+                       const cv::Mat &Descriptors2, const std::vector<unsigned int> &vRows2);
+
+    // Features of F in the window of radius r around x,y at the levels, as Frame::GetFeaturesInArea
+    // Wide windows go through the descriptor index of F with the descriptor d of the query
+    void FeaturesInWindow(Frame &F, const uchar* d, float x, float y, float r, int minLevel, int maxLevel,
+                          std::vector<size_t> &vIndices);
+
+    // Distances of the workspace windows on the backend, NULL when they are left to the caller
+    const int* WindowDistances(const cv::Mat &Queries, const cv::Mat &Candidates);
+
     float mfNNratio;
     bool mbCheckOrientation;
+
+    Workspace* mpWorkspace;
+
+    ProjectionStats mProjectionStats;
 };
 
 }// namespace ORB_SLAM
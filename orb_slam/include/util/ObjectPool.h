@@ -0,0 +1,168 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include <vector>
+#include <cstddef>
+#include <new>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "util/AlignedAllocator.h"
+
+namespace ORB_SLAM
+{
+
+// Fixed-size slots for one class, allocated in chunks and reused through a free list
+// Chunks are only returned to the system when the pool is destroyed, so the header
+// of a freed slot stays readable and its generation tells handles the object is gone
+template<class T>
+class ObjectPool
+{
+public:
+    ObjectPool(size_t nSlotsPerChunk = 1024):
+        mnSlotsPerChunk(nSlotsPerChunk), mpFree(NULL), mnInUse(0) {}
+
+    ~ObjectPool()
+    {
+        for(size_t i=0; i<mvpChunks.size(); i++)
+            AlignedAllocator::Free(mvpChunks[i]);
+    }
+
+    // One pool per class, shared by all the threads
+    static ObjectPool* Global()
+    {
+        static ObjectPool pool;
+        return &pool;
+    }
+
+    void* Allocate()
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        if(!mpFree)
+            Grow();
+        Slot* pSlot = mpFree;
+        mpFree = pSlot->pNext;
+        mnInUse++;
+        return reinterpret_cast<char*>(pSlot)+HeaderSize();
+    }
+
+    // The generation of the slot changes, so handles to the old object become invalid
+    void Free(void* p)
+    {
+        if(!p)
+            return;
+        Slot* pSlot = SlotOf(p);
+        pSlot->nGeneration.fetch_add(1, boost::memory_order_release);
+        boost::mutex::scoped_lock lock(mMutex);
+        pSlot->pNext = mpFree;
+        mpFree = pSlot;
+        mnInUse--;
+    }
+
+    // Generation of the slot holding p, p must have been allocated by a pool of T
+    static unsigned long Generation(const T* p)
+    {
+        return SlotOf(p)->nGeneration.load(boost::memory_order_acquire);
+    }
+
+    size_t InUse()
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        return mnInUse;
+    }
+
+    size_t Capacity()
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        return mvpChunks.size()*mnSlotsPerChunk;
+    }
+
+protected:
+
+    struct Slot
+    {
+        boost::atomic<unsigned long> nGeneration;
+        Slot* pNext;
+    };
+
+    // Header and object sizes rounded so that every object is 16 byte aligned, or more if T asks for it
+    // (e.g. a 32 byte aligned descriptor member)
+    static size_t Alignment() {return __alignof__(T)>16 ? __alignof__(T) : 16;}
+    static size_t HeaderSize() {return (sizeof(Slot)+Alignment()-1) & ~(Alignment()-1);}
+    static size_t SlotSize() {return HeaderSize() + ((sizeof(T)+Alignment()-1) & ~(Alignment()-1));}
+
+    static Slot* SlotOf(const void* p)
+    {
+        return reinterpret_cast<Slot*>(const_cast<char*>(static_cast<const char*>(p))-HeaderSize());
+    }
+
+    // Called with mMutex held
+    void Grow()
+    {
+        char* pChunk = static_cast<char*>(AlignedAllocator::Allocate(SlotSize()*mnSlotsPerChunk));
+        mvpChunks.push_back(pChunk);
+        for(size_t i=mnSlotsPerChunk; i>0; i--)
+        {
+            Slot* pSlot = new (pChunk+(i-1)*SlotSize()) Slot;
+            pSlot->nGeneration.store(0, boost::memory_order_relaxed);
+            pSlot->pNext = mpFree;
+            mpFree = pSlot;
+        }
+    }
+
+    const size_t mnSlotsPerChunk;
+    std::vector<char*> mvpChunks;
+    Slot* mpFree;
+    size_t mnInUse;
+    boost::mutex mMutex;
+
+private:
+    ObjectPool(const ObjectPool&);
+    ObjectPool& operator=(const ObjectPool&);
+};
+
+// Pointer to a pooled object that knows whether the object has been freed since
+// Get returns NULL once the slot was freed, even if it holds a new object by now
+template<class T>
+class PoolHandle
+{
+public:
+    PoolHandle(): mp(NULL), mnGeneration(0) {}
+
+    explicit PoolHandle(T* p): mp(p), mnGeneration(p ? ObjectPool<T>::Generation(p) : 0) {}
+
+    T* Get() const
+    {
+        if(mp && ObjectPool<T>::Generation(mp)==mnGeneration)
+            return mp;
+        return NULL;
+    }
+
+protected:
+    T* mp;
+    unsigned long mnGeneration;
+};
+
+} //namespace ORB_SLAM
+
+#endif // OBJECTPOOL_H
@@ -28,18 +28,78 @@
 
 #include "threads/LoopClosing.h"
 
+#include "util/TaskPool.h"
+
 #include <g2o/types/sim3/types_seven_dof_expmap.h>
 
+namespace g2o
+{
+class SparseOptimizer;
+class OptimizationAlgorithmLevenberg;
+}
+
 namespace ORB_SLAM
 {
 
 class LoopClosing;
 
+// When the Levenberg iterations stop before the iteration count, for the g2o optimizations and PoseSolver
+// The chi2 is the robust one, the kernels are taken into account
+struct LevenbergSettings
+{
+    LevenbergSettings() : fMinDecrease(1e-3), nStallIterations(3), fMinUpdate(0), bStatistics(false), nIterativeKeyFrames(0),
+                          bSinglePrecision(false), fTileSize(0), nTiledKeyFrames(0) {}
+
+    // Relative decrease of the chi2 below which an iteration made no progress
+    double fMinDecrease;
+    // Iterations in a row without progress before stopping
+    int nStallIterations;
+    // Stops as soon as no element of an accepted update is above it (0 - disabled)
+    double fMinUpdate;
+    // Debug log of the iterations, chi2 and time of each optimization
+    bool bStatistics;
+    // Global BA of maps with at least these keyframes solves with PCG instead of Cholmod (0 - never)
+    int nIterativeKeyFrames;
+    // Tracking pose optimization builds its normal equations in float, twice the SIMD width
+    // The g2o optimizations are double only
+    bool bSinglePrecision;
+    // Essential graph of maps with at least nTiledKeyFrames keyframes (0 - never): the map is cut into cubic tiles
+    // of fTileSize map units by the camera centers, only the tiles the loop runs through are optimized,
+    // held by the keyframes linked to them from other tiles. The rest of the map is left as it is
+    float fTileSize;
+    int nTiledKeyFrames;
+};
+
+// Result of an essential graph optimization, indexed by keyframe id
+// Keyframes and points are moved from the poses optimized from (vScw) to the optimized ones (vCorrectedScw)
+struct EssentialGraphCorrection
+{
+    std::vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vScw;
+    std::vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vCorrectedScw;
+    std::vector<bool> vbOptimized;
+};
+
+// Estimates of a bundle adjustment, to be written to the map later
+struct BundleAdjustmentResult
+{
+    std::map<KeyFrame*,cv::Mat> mKeyFramePoses;
+    std::map<MapPoint*,cv::Mat> mPointPositions;
+};
+
 class Optimizer
 {
 public:
-    void static BundleAdjustment(const std::vector<KeyFrame*> &vpKF, const std::vector<MapPoint*> &vpMP, int nIterations = 5, bool *pbStopFlag=NULL);
-    void static GlobalBundleAdjustemnt(Map* pMap, int nIterations=5, bool *pbStopFlag=NULL);
+    // bIterative solves the reduced camera system by block-Jacobi PCG without forming it, instead of a Cholmod
+    // factorization. Less memory and time on large maps, slower convergence on small ones
+    void static BundleAdjustment(const std::vector<KeyFrame*> &vpKF, const std::vector<MapPoint*> &vpMP, int nIterations = 5, bool *pbStopFlag=NULL,
+                                 bool bIterative=false);
+    // Keeps the estimates in result instead of writing them, the map is only read
+    void static BundleAdjustment(const std::vector<KeyFrame*> &vpKF, const std::vector<MapPoint*> &vpMP, BundleAdjustmentResult &result,
+                                 int nIterations = 5, bool *pbStopFlag=NULL, bool bIterative=false);
+    void static GlobalBundleAdjustemnt(Map* pMap, int nIterations=5, bool *pbStopFlag=NULL, bool bIterative=false);
+
+    // Whether a global BA over nKFs keyframes should be iterative, see LevenbergSettings
+    static bool UseIterative(size_t nKFs);
     void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag=NULL);
     int static PoseOptimization(Frame* pFrame);
 
@@ -48,8 +108,44 @@ public:
                                        LoopClosing::KeyFrameAndPose &CorrectedSim3,
                                        std::map<KeyFrame*, set<KeyFrame*> > &LoopConnections);
 
+    // The same optimization in two steps, the map may change in between
+    // The optimization only reads the map, keyframes added meanwhile are left out of the graph
+    void static OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
+                                       LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
+                                       LoopClosing::KeyFrameAndPose &CorrectedSim3,
+                                       std::map<KeyFrame*, set<KeyFrame*> > &LoopConnections,
+                                       EssentialGraphCorrection &correction);
+    // Each keyframe and point is moved by the correction of its keyframe, or for keyframes out of the graph,
+    // of their closest ancestor in the spanning tree. Changes made after the optimization are kept
+    void static ApplyEssentialGraph(Map* pMap, KeyFrame* pCurKF, const EssentialGraphCorrection &correction);
+
 
     static int OptimizeSim3(KeyFrame* pKF1, KeyFrame* pKF2, std::vector<MapPoint *> &vpMatches1, g2o::Sim3 &g2oS12, float th2 = 10);
+
+    // Set once at startup, before the optimizing threads run
+    void static SetLevenbergSettings(const LevenbergSettings &settings);
+    static const LevenbergSettings& GetLevenbergSettings();
+
+    // Write-back of the optimized points, their poses set before: in chunks on the pool, with the camera centers
+    // of vpKFs read once for all of them. Bad points are skipped
+    void static UpdateMapPoints(const std::vector<MapPoint*> &vpMPs, const std::vector<Eigen::Vector3f> &vPos,
+                                const std::vector<KeyFrame*> &vpKFs, TaskPool::Priority priority);
+
+    // Chi2 and depth test of the projection edges after an optimization, in chunks on the pool
+    // vbOutlier[i] is set for the edges over the 95% chi2 threshold or behind the camera, NULL edges are skipped
+    void static ScreenEdges(const std::vector<g2o::EdgeSE3ProjectXYZ*> &vpEdges, std::vector<unsigned char> &vbOutlier,
+                            TaskPool::Priority priority);
+
+    // Erases the observations of the outliers, (keyframe, point) pairs: the matches of each keyframe
+    // and the observations of each point in one locked pass
+    void static EraseOutliers(std::vector<std::pair<KeyFrame*,MapPoint*> > &vOutliers);
+
+    // Applies the settings to an optimizer and its algorithm, its parallel loops run on the pool with the given priority
+    void static Configure(g2o::SparseOptimizer &optimizer, g2o::OptimizationAlgorithmLevenberg* pAlgorithm,
+                          TaskPool::Priority priority);
+
+    // Logs the statistics of the last optimize() call, which did nIterations, if they are on
+    void static Report(const g2o::SparseOptimizer &optimizer, const char* name, int nIterations);
 };
 
 } //namespace ORB_SLAM
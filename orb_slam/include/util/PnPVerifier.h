@@ -0,0 +1,118 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PNPVERIFIER_H
+#define PNPVERIFIER_H
+
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <opencv2/core/core.hpp>
+
+#include "util/PoseSolver.h"
+#include "util/TaskPool.h"
+
+namespace ORB_SLAM
+{
+
+class Frame;
+class KeyFrame;
+class MapPoint;
+
+// Geometric verification of relocalisation candidates, shared by Tracking and Relocalization
+// Each candidate is matched by BoW, then P4P RANSAC hypotheses are refined by motion-only BA and guided matching
+// Candidates are ranked by BoW score, so the most similar keyframes are tried first
+// With several threads the candidates are verified concurrently, each worker on its own copy of the frame,
+// and all workers stop at the first accepted one
+// The calling thread is one of the workers, a verifier should not be shared between threads
+class PnPVerifier
+{
+public:
+    // priority: of the workers on the shared TaskPool, Tracking relocalises ahead of the Relocalization thread
+    PnPVerifier(int nThreads = 1, TaskPool::Priority priority = TaskPool::RELOCALIZATION);
+
+    // Sorts the candidates by BoW score and returns the index of the accepted one or -1
+    // On success the frame has the pose, the map point matches and the outliers of the accepted hypothesis
+    // The verification gives up after fBudget seconds (0 - no limit) or once cancelled
+    int Verify(Frame* pFrame, std::vector<KeyFrame*> &vpCandidates, float fBudget = 0);
+
+    // Called from any thread, the running verification gives up at its next round of iterations
+    // A cancelled verifier gives up at once until it is cancelled with false
+    void Cancel(bool bCancel = true);
+
+    void SetThreads(int nThreads);
+
+    int inline GetThreads(){
+        return mnThreads;}
+
+    void SetPriority(TaskPool::Priority priority);
+
+protected:
+
+    // Most similar candidates first, the order is kept between equal scores
+    void Rank(Frame* pFrame, std::vector<KeyFrame*> &vpCandidates);
+
+    // Alternates the RANSAC iterations of all the candidates, as done originally
+    int VerifySequential();
+
+    // Takes the next free candidate until all are processed or one is accepted
+    void VerifyCandidates();
+
+    // Runs the RANSAC of one candidate until it is exhausted or any candidate is accepted
+    void VerifyCandidate(int nCandidate, Frame &F, PoseSolver &solver);
+
+    // Refines a RANSAC hypothesis in the frame, returns true if it has enough inliers
+    bool Refine(Frame &F, KeyFrame* pKF, const std::vector<MapPoint*> &vpMatches, const std::vector<bool> &vbInliers,
+                const cv::Mat &Tcw, PoseSolver &solver);
+
+    // Stores the result of the frame if no other candidate was accepted before
+    void Accept(int nCandidate, const Frame &F);
+
+    bool Accepted();
+
+    // Accepted, cancelled or out of time
+    bool Finished();
+
+    int mnThreads;
+    TaskPool::Priority mPriority;
+
+    // Motion-only BA of the sequential verification
+    PoseSolver mPoseSolver;
+
+    // State of the current verification
+    Frame* mpFrame;
+    const std::vector<KeyFrame*>* mpvpCandidates;
+    int mnNextCandidate;
+    boost::mutex mMutexCandidate;
+
+    boost::atomic<bool> mbCancelled;
+    // Wall time the verification gives up at (0 - no limit)
+    double mfDeadline;
+
+    int mnAccepted;
+    cv::Mat mTcw;
+    std::vector<MapPoint*> mvpMapPoints;
+    std::vector<bool> mvbOutlier;
+    boost::mutex mMutexAccepted;
+};
+
+} //namespace ORB_SLAM
+
+#endif // PNPVERIFIER_H
@@ -22,9 +22,11 @@
 #ifndef PNPSOLVER_H
 #define PNPSOLVER_H
 
-#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <Eigen/Core>
 #include "types/MapPoint.h"
 #include "types/Frame.h"
+#include "util/ProsacSampler.h"
 
 namespace ORB_SLAM
 {
@@ -38,16 +40,28 @@ class PnPsolver {
   void SetRansacParameters(double probability = 0.99, int minInliers = 8 , int maxIterations = 300, int minSet = 4, float epsilon = 0.4,
                            float th2 = 5.991);
 
+  // Reject the hypotheses early with a sequential probability ratio test (Matas and Chum)
+  // The test stops checking a hypothesis once it is very unlikely to have the expected inlier ratio
+  void SetSPRT(bool bEnable);
+
   cv::Mat find(vector<bool> &vbInliers, int &nInliers);
 
   cv::Mat iterate(int nIterations, bool &bNoMore, vector<bool> &vbInliers, int &nInliers);
 
  private:
 
-  void CheckInliers();
+  // Counts the inliers of the current estimation
+  // Preemptive checks stop once the hypothesis cannot be accepted and return false
+  bool CheckInliers(bool bPreemptive);
   bool Refine();
 
-  // Functions from the original EPnP code
+  // Squared reprojection errors of the correspondences [i, iend) with the current estimation
+  void ComputeErrors(int i, const int iend);
+
+  // Decision threshold of the SPRT, from the expected inlier ratio
+  void ComputeSPRTThreshold();
+
+  // Functions from the original EPnP code, with fixed-size Eigen matrices
   void set_maximum_number_of_correspondences(const int n);
   void reset_correspondences(void);
   void add_correspondence(const double X, const double Y, const double Z,
@@ -55,45 +69,36 @@ class PnPsolver {
 
   double compute_pose(double R[3][3], double T[3]);
 
-  void relative_error(double & rot_err, double & transl_err,
-              const double Rtrue[3][3], const double ttrue[3],
-              const double Rest[3][3],  const double test[3]);
-
-  void print_pose(const double R[3][3], const double t[3]);
   double reprojection_error(const double R[3][3], const double t[3]);
 
   void choose_control_points(void);
   void compute_barycentric_coordinates(void);
-  void fill_M(CvMat * M, const int row, const double * alphas, const double u, const double v);
-  void compute_ccs(const double * betas, const double * ut);
+  void compute_ccs(const double * betas, const Eigen::Matrix<double,12,4> &V);
   void compute_pcs(void);
 
   void solve_for_sign(void);
 
-  void find_betas_approx_1(const CvMat * L_6x10, const CvMat * Rho, double * betas);
-  void find_betas_approx_2(const CvMat * L_6x10, const CvMat * Rho, double * betas);
-  void find_betas_approx_3(const CvMat * L_6x10, const CvMat * Rho, double * betas);
-  void qr_solve(CvMat * A, CvMat * b, CvMat * X);
+  void find_betas_approx_1(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho, double * betas);
+  void find_betas_approx_2(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho, double * betas);
+  void find_betas_approx_3(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho, double * betas);
 
   double dot(const double * v1, const double * v2);
   double dist2(const double * p1, const double * p2);
 
-  void compute_rho(double * rho);
-  void compute_L_6x10(const double * ut, double * l_6x10);
+  void compute_rho(Eigen::Matrix<double,6,1> &rho);
+  void compute_L_6x10(const Eigen::Matrix<double,12,4> &V, Eigen::Matrix<double,6,10> &L_6x10);
 
-  void gauss_newton(const CvMat * L_6x10, const CvMat * Rho, double current_betas[4]);
-  void compute_A_and_b_gauss_newton(const double * l_6x10, const double * rho,
-				    double cb[4], CvMat * A, CvMat * b);
+  void gauss_newton(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho, double current_betas[4]);
+  void compute_A_and_b_gauss_newton(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho,
+                                    const double cb[4], Eigen::Matrix<double,6,4> &A, Eigen::Matrix<double,6,1> &b);
 
-  double compute_R_and_t(const double * ut, const double * betas,
-			 double R[3][3], double t[3]);
+  double compute_R_and_t(const Eigen::Matrix<double,12,4> &V, const double * betas,
+                         double R[3][3], double t[3]);
 
   void estimate_R_and_t(double R[3][3], double t[3]);
 
   void copy_R_and_t(const double R_dst[3][3], const double t_dst[3],
-		    double R_src[3][3], double t_src[3]);
-
-  void mat_to_quat(const double R[3][3], double q[4]);
+                    double R_src[3][3], double t_src[3]);
 
 
   double uc, vc, fu, fv;
@@ -103,24 +108,26 @@ class PnPsolver {
   int number_of_correspondences;
 
   double cws[4][3], ccs[4][3];
-  double cws_determinant;
 
   vector<MapPoint*> mvpMapPointMatches;
 
+  // Correspondences as a structure of arrays, in random order so that a partial check is a random subset
   // 2D Points
-  vector<cv::Point2f> mvP2D;
+  vector<float> mvU, mvV;
   vector<float> mvSigma2;
 
   // 3D Points
-  vector<cv::Point3f> mvP3Dw;
+  vector<float> mvX, mvY, mvZ;
 
   // Index in Frame
   vector<size_t> mvKeyPointIndices;
 
+  // Squared reprojection errors of the current estimation
+  vector<float> mvError2;
+
   // Current Estimation
   double mRi[3][3];
   double mti[3];
-  cv::Mat mTcwi;
   vector<bool> mvbInliersi;
   int mnInliersi;
 
@@ -138,8 +145,10 @@ class PnPsolver {
   // Number of Correspondences
   int N;
 
-  // Indices for random selection [0 .. N-1]
-  vector<size_t> mvAllIndices;
+  // Descriptor distance of each correspondence, the minimal sets are drawn from the closest first
+  vector<int> mvDistances;
+  ProsacSampler mSampler;
+  vector<size_t> mvSet;
 
   // RANSAC probability
   double mRansacProb;
@@ -162,6 +171,13 @@ class PnPsolver {
   // Max square error associated with scale level. Max error = th*th*sigma(level)*sigma(level)
   vector<float> mvMaxError;
 
+  // SPRT, log likelihood ratio of an inlier and an outlier, and log of the decision threshold
+  bool mbSPRT;
+  double mSPRTDelta;
+  double mSPRTLogInlier;
+  double mSPRTLogOutlier;
+  double mSPRTLogThreshold;
+
 };
 
 } //namespace ORB_SLAM
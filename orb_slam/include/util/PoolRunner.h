@@ -0,0 +1,54 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef POOLRUNNER_H
+#define POOLRUNNER_H
+
+#include "util/TaskPool.h"
+#include "g2o/core/parallel_runner.h"
+#include "dbow2/TemplatedVocabulary.h"
+
+namespace ORB_SLAM
+{
+
+// Runs the parallel loops of g2o and DBoW2 as tasks of the pool instead of their OpenMP threads, so bundle
+// adjustment and the BoW transform share the cores with the rest of the kernels
+class PoolRunner : public g2o::ParallelRunner, public DBoW2::TransformRunner
+{
+public:
+    // One runner per priority, for the lifetime of the process
+    static PoolRunner* Get(TaskPool::Priority priority);
+
+    // As many slots as the pool has workers, the task with slot 0 runs in the caller
+    virtual int slots() const;
+    virtual void run(int n, int grain, const g2o::ParallelRunner::Body &body);
+
+    virtual void run(int n, int nTasks, const DBoW2::TransformRunner::Rows &rows);
+
+protected:
+    PoolRunner(TaskPool::Priority priority);
+
+    TaskPool::Priority mPriority;
+};
+
+} //namespace ORB_SLAM
+
+#endif // POOLRUNNER_H
@@ -0,0 +1,74 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef POSEPREDICTOR_H
+#define POSEPREDICTOR_H
+
+#include <opencv2/core/core.hpp>
+#include <boost/thread.hpp>
+
+#include <g2o/types/sba/types_six_dof_expmap.h>
+
+namespace ORB_SLAM
+{
+
+class ImuIntegrator;
+
+// Camera pose extrapolated to any time after the last tracked frame, to compensate the latency of tracking
+// The motion between the last two tracked frames is held as a constant velocity on SE(3), as the motion
+// model of the tracking does, and the gyroscope gives the rotation when it covers the interval
+// Each tracked frame corrects the prediction, the tracking corrects it while a timer asks for predictions
+class PosePredictor
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // fMaxHorizon: seconds past the last tracked frame a pose is predicted, frames further apart give no velocity
+    // pImu: gyroscope preintegration of the tracking (NULL - the rotation follows the velocity)
+    PosePredictor(float fMaxHorizon, ImuIntegrator* pImu);
+
+    // Pose of a tracked frame and its timestamp
+    void Correct(double timestamp, const cv::Mat &Tcw);
+
+    // Tracking lost, nothing is predicted until the next tracked frame
+    void Reset();
+
+    // Pose at time t, false if no frame was tracked within the horizon
+    // timestamp: time of the frame the prediction starts from
+    bool Predict(double t, cv::Mat &Tcw, double &timestamp);
+
+protected:
+
+    float mfMaxHorizon;
+    ImuIntegrator* mpImu;
+
+    boost::mutex mMutex;
+
+    // Last tracked frame, and the twist from the one before it per second (zero if unknown)
+    bool mbValid;
+    double mTimeStamp;
+    g2o::SE3Quat mTcw;
+    g2o::Vector6d mTwist;
+};
+
+} //namespace ORB_SLAM
+
+#endif // POSEPREDICTOR_H
@@ -0,0 +1,98 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef POSESOLVER_H
+#define POSESOLVER_H
+
+#include <vector>
+#include <Eigen/Core>
+#include <g2o/types/slam3d/se3quat.h>
+
+namespace ORB_SLAM
+{
+
+class Frame;
+
+// Motion-only bundle adjustment, the same problem as Optimizer::PoseOptimization without the g2o graph
+// The 6x6 normal equations are built in place and solved with the same Levenberg steps,
+// Huber kernel and four rounds of outlier rejection, so mvbOutlier gets the same meaning
+// The point data is kept in a structure of arrays and projected four at a time with SIMD
+// The buffers are kept between calls, so a solver should be reused and not shared between threads
+class PoseSolver
+{
+public:
+    PoseSolver();
+
+    // Optimizes the frame pose and flags the outliers, returns the number of inliers
+    int Optimize(Frame* pFrame);
+
+    // Same for a rig: the frames of the other cameras observe through their camera pose in the rig
+    // (Camera::mTcr) and only the pose of pFrame is optimized. Their poses are set from it at the end
+    // Returns the inliers of all the frames
+    int Optimize(Frame* pFrame, const std::vector<Frame*> &vpRigFrames);
+
+protected:
+
+    // Copies the observations and point positions of the frame matches, the first frame goes first
+    void Gather(Frame* pFrame, const int nFrame);
+
+    // Computes camera coordinates, residuals and chi2 at the pose, returns the robust chi2
+    double Evaluate(const g2o::SE3Quat &Tcw);
+
+    // Normal equations at the last evaluated pose, accumulated in double or float
+    // (see LevenbergSettings::bSinglePrecision). The step is always solved in double
+    template<typename T>
+    void Linearize(Eigen::Matrix<T,6,6> &H, Eigen::Matrix<T,6,1> &b);
+
+    // Levenberg iterations as done by g2o::OptimizationAlgorithmLevenberg, with the same stopping rule
+    // Returns true if it stopped before nIterations
+    bool Levenberg(g2o::SE3Quat &Tcw, const int nIterations);
+
+    // Calibration of the first frame
+    float mfx, mfy, mfcx, mfcy;
+
+    // Frames of the last optimization, the first one is the optimized one
+    std::vector<Frame*> mvpFrames;
+
+    // Calibration and pose in the rig (Tcr) of each frame
+    std::vector<float> mvFx, mvFy, mvCx, mvCy;
+    std::vector<Eigen::Matrix3f> mvRcr;
+    std::vector<Eigen::Vector3f> mvtcr;
+
+    // Observations of the first frame, they come first and are evaluated with SIMD
+    size_t mnFirstFrame;
+
+    // Frame and index of the keypoint of each observation
+    std::vector<int> mvnFrame;
+    std::vector<size_t> mvnIndex;
+
+    // Structure of arrays, one entry per observation
+    std::vector<float> mvX, mvY, mvZ;
+    std::vector<float> mvObsU, mvObsV;
+    std::vector<float> mvInvSigma2, mvInformation;
+
+    // Results of the evaluation, coordinates in the camera of the observation
+    std::vector<float> mvXc, mvYc, mvZc;
+    std::vector<float> mvErrU, mvErrV, mvChi2;
+};
+
+} //namespace ORB_SLAM
+
+#endif // POSESOLVER_H
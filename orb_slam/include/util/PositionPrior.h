@@ -0,0 +1,63 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef POSITIONPRIOR_H
+#define POSITIONPRIOR_H
+
+#include <deque>
+#include <opencv2/core/core.hpp>
+#include <boost/thread.hpp>
+
+namespace ORB_SLAM
+{
+
+// Coarse positions of the robot from an external source (wheel odometry, GNSS), in the fixed frame of that source
+// The positions come from their callback, the frames are tagged with them by Tracking
+// Place recognition uses them to skip the keyframes too far from the query (see KeyFrameDatabase::SetPriorRadius),
+// so the frame must be the same in every session, and the position need only be good to the radius
+class PositionPrior
+{
+public:
+    // maxGap: seconds between two positions they are interpolated over, and the last one is held
+    PositionPrior(double maxGap);
+
+    // Positions come in time order
+    void AddPosition(double timestamp, const cv::Point3f &position);
+
+    // Position at t, false if none is close enough in time
+    bool GetPosition(double t, cv::Point3f &position);
+
+protected:
+    struct Sample
+    {
+        double t;
+        cv::Point3f position;
+    };
+
+    double mfMaxGap;
+
+    boost::mutex mMutex;
+    std::deque<Sample> mdSamples;
+};
+
+} //namespace ORB_SLAM
+
+#endif // POSITIONPRIOR_H
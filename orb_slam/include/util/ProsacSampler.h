@@ -0,0 +1,70 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef PROSACSAMPLER_H
+#define PROSACSAMPLER_H
+
+#include <vector>
+#include <cstddef>
+
+namespace ORB_SLAM
+{
+
+// Progressive sampling of the minimal sets of a RANSAC (PROSAC, Chum and Matas 2005)
+// The correspondences are ranked by quality (e.g. descriptor distance) and the sets are drawn from
+// the best ones first: each set holds the newest correspondence of a growing prefix of the ranking
+// and the rest from before it. The prefix grows as uniform sampling would have drawn it, so the
+// sampler ends as plain RANSAC over all the correspondences after nGrowthMax sets
+class ProsacSampler
+{
+public:
+    ProsacSampler();
+
+    // vQuality: one value per correspondence, lower is better. m: size of the minimal set
+    void Reset(const std::vector<int> &vQuality, int m, int nGrowthMax = 20000);
+
+    // Indices of the correspondences of the next minimal set, m distinct ones
+    void Sample(std::vector<size_t> &vSet);
+    void Sample(size_t* pSet);
+
+    // Iterations for a probability of drawing an all-inlier set of m, with an inlier ratio epsilon
+    // Capped at nMaxIterations, at least 1
+    static int RansacIterations(double probability, double epsilon, int m, int nMaxIterations);
+
+protected:
+
+    // Correspondences from the best to the worst, and positions in it for the partial shuffles
+    std::vector<size_t> mvOrder;
+    std::vector<size_t> mvPositions;
+
+    int mN;
+    int mm;
+
+    // Sets drawn, size of the prefix sampled from, and the growth function of the prefix
+    int mt;
+    int mn;
+    double mTn;
+    int mTnPrime;
+};
+
+} //namespace ORB_SLAM
+
+#endif // PROSACSAMPLER_H
@@ -0,0 +1,48 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef RESIDUALCODE_H
+#define RESIDUALCODE_H
+
+#include <vector>
+#include <cstddef>
+
+namespace ORB_SLAM
+{
+
+// Lossless code of an ORB descriptor against the vocabulary word it was assigned to
+// The bits in which they differ are few, so the code stores how many there are and the gaps between
+// them (Rice coded), or the descriptor itself when that would not be shorter
+namespace ResidualCode
+{
+    // Descriptor length in bytes
+    const size_t L = 32;
+
+    // Appends the code of the descriptor to vCode
+    void Encode(const unsigned char* pDescriptor, const unsigned char* pWord, std::vector<unsigned char> &vCode);
+
+    // Decodes the code at pCode into pDescriptor, returns where the next code starts
+    const unsigned char* Decode(const unsigned char* pCode, const unsigned char* pWord, unsigned char* pDescriptor);
+}
+
+} //namespace ORB_SLAM
+
+#endif // RESIDUALCODE_H
@@ -0,0 +1,92 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace ORB_SLAM
+{
+
+// Sequence lock around a small trivially copyable value
+// Readers never block the writer and never allocate, they retry if a write overlapped their copy
+// Writers must be serialised by the caller, e.g. with the mutex that already guards the value
+template<class T>
+class SeqLock
+{
+public:
+    SeqLock(): mnSequence(0) {}
+
+    explicit SeqLock(const T &value): mnSequence(0), mValue(value) {}
+
+    // Writer: publishes a new value
+    void Store(const T &value)
+    {
+        const unsigned long seq = mnSequence.load(boost::memory_order_relaxed);
+        // An odd sequence marks a write in progress
+        mnSequence.store(seq+1, boost::memory_order_relaxed);
+        boost::atomic_thread_fence(boost::memory_order_release);
+        mValue = value;
+        mnSequence.store(seq+2, boost::memory_order_release);
+    }
+
+    // Reader: copies a consistent value and returns its version
+    unsigned long Load(T &value) const
+    {
+        while(true)
+        {
+            const unsigned long seq1 = mnSequence.load(boost::memory_order_acquire);
+            if(seq1 & 1)
+            {
+                boost::this_thread::yield();
+                continue;
+            }
+            value = mValue;
+            boost::atomic_thread_fence(boost::memory_order_acquire);
+            const unsigned long seq2 = mnSequence.load(boost::memory_order_relaxed);
+            if(seq1==seq2)
+                return seq1/2;
+        }
+    }
+
+    T Load() const
+    {
+        T value;
+        Load(value);
+        return value;
+    }
+
+    // Number of values stored so far, readers can use it to skip unchanged values
+    unsigned long Version() const {return mnSequence.load(boost::memory_order_acquire)/2;}
+
+protected:
+    boost::atomic<unsigned long> mnSequence;
+    T mValue;
+
+    // Not copyable
+    SeqLock(const SeqLock&);
+    SeqLock& operator=(const SeqLock&);
+};
+
+} //namespace ORB_SLAM
+
+#endif // SEQLOCK_H
@@ -23,12 +23,18 @@
 
 #include <opencv2/opencv.hpp>
 #include <vector>
+#include <Eigen/Core>
 
 #include "types/KeyFrame.h"
+#include "util/ProsacSampler.h"
 
 namespace ORB_SLAM
 {
 
+// RANSAC of the similarity between two keyframes from matched map points
+// The points are kept as a structure of arrays in the frame of each camera, the minimal solver (Horn)
+// uses fixed-size Eigen matrices, and the inliers are counted reprojecting four matches at a time with SIMD
+// Nothing is allocated per iteration
 class Sim3Solver
 {
 public:
@@ -48,16 +54,12 @@ public:
 
 protected:
 
-    bool Refine();
-
-    void centroid(cv::Mat &P, cv::Mat &Pr, cv::Mat &C);
-
-    void computeT(cv::Mat &P1, cv::Mat &P2);
+    // Horn 1987, closed-form solution of absolute orientation using unit quaternions
+    // Columns of P1 and P2 are the three sampled points in each camera
+    void computeT(const Eigen::Matrix3f &P1, const Eigen::Matrix3f &P2);
 
     void CheckInliers();
 
-    void Project(const std::vector<cv::Mat> &vP3Dw, std::vector<cv::Mat> &vP2D, cv::Mat Tcw, cv::Mat K);
-    void FromCameraToImage(const std::vector<cv::Mat> &vP3Dc, std::vector<cv::Mat> &vP2D, cv::Mat K);
 
 
 protected:
@@ -66,49 +68,42 @@ protected:
     KeyFrame* mpKF1;
     KeyFrame* mpKF2;
 
-    std::vector<cv::Mat> mvX3Dc1;
-    std::vector<cv::Mat> mvX3Dc2;
     std::vector<MapPoint*> mvpMapPoints1;
     std::vector<MapPoint*> mvpMapPoints2;
     std::vector<MapPoint*> mvpMatches12;
     std::vector<size_t> mvnIndices1;
-    std::vector<size_t> mvSigmaSquare1;
-    std::vector<size_t> mvSigmaSquare2;
-    std::vector<size_t> mvnMaxError1;
-    std::vector<size_t> mvnMaxError2;
+
+    // Structure of arrays, one entry per match: the points in the frame of each camera,
+    // their projection in its image and the maximum squared reprojection error there
+    std::vector<float> mvX1, mvY1, mvZ1;
+    std::vector<float> mvX2, mvY2, mvZ2;
+    std::vector<float> mvU1, mvV1;
+    std::vector<float> mvU2, mvV2;
+    std::vector<float> mvMaxError1;
+    std::vector<float> mvMaxError2;
 
     int N;
     int mN1;
 
     // Current Estimation
-    cv::Mat mR12i;
-    cv::Mat mt12i;
+    Eigen::Matrix3f mR12i;
+    Eigen::Vector3f mt12i;
     float ms12i;
-    cv::Mat mT12i;
-    cv::Mat mT21i;
-    std::vector<bool> mvbInliersi;
+    std::vector<unsigned char> mvbInliersi;
     int mnInliersi;
 
     // Current Ransac State
     int mnIterations;
-    std::vector<bool> mvbBestInliers;
+    std::vector<unsigned char> mvbBestInliers;
     int mnBestInliers;
     cv::Mat mBestT12;
     cv::Mat mBestRotation;
     cv::Mat mBestTranslation;
     float mBestScale;
 
-    // Refined
-    cv::Mat mRefinedT12;
-    std::vector<bool> mvbRefinedInliers;
-    int mnRefinedInliers;
-
-    // Indices for random selection
-    std::vector<size_t> mvAllIndices;
-
-    // Projections
-    std::vector<cv::Mat> mvP1im1;
-    std::vector<cv::Mat> mvP2im2;
+    // Descriptor distance between the keypoints of each match, the minimal sets are drawn from the closest first
+    std::vector<int> mvDistances;
+    ProsacSampler mSampler;
 
     // RANSAC probability
     double mRansacProb;
@@ -119,13 +114,9 @@ protected:
     // RANSAC max iterations
     int mRansacMaxIts;
 
-    // Threshold inlier/outlier. e = dist(Pi,T_ij*Pj)^2 < 5.991*mSigma2
-    float mTh;
-    float mSigma2;
-
     // Calibration
-    cv::Mat mK1;
-    cv::Mat mK2;
+    float fx1, fy1, cx1, cy1;
+    float fx2, fy2, cx2, cy2;
 
 };
 
@@ -0,0 +1,88 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIM3VERIFIER_H
+#define SIM3VERIFIER_H
+
+#include <vector>
+#include <boost/thread.hpp>
+#include <opencv2/core/core.hpp>
+#include <g2o/types/sim3/types_seven_dof_expmap.h>
+
+namespace ORB_SLAM
+{
+
+class KeyFrame;
+class MapPoint;
+
+// Geometric verification of loop candidates, shared by Loop Closing and Map Merging
+// Each candidate is matched by BoW, then RANSAC Sim3 hypotheses are refined by guided matching and optimization
+// With several threads the candidates are verified concurrently and all workers stop at the first accepted one
+// The calling thread is one of the workers, a verifier should not be shared between threads
+class Sim3Verifier
+{
+public:
+    Sim3Verifier(int nThreads = 1);
+
+    // Returns the index of the accepted candidate or -1, with the Sim3 from it to the current keyframe
+    // and the map points of the candidate matched to each keypoint of the current keyframe
+    int Verify(KeyFrame* pCurrentKF, const std::vector<KeyFrame*> &vpCandidates,
+               g2o::Sim3 &gScm, std::vector<MapPoint*> &vpMatchedPoints);
+
+    int inline GetThreads(){
+        return mnThreads;}
+
+protected:
+
+    // Alternates the RANSAC iterations of all the candidates, as done originally
+    int VerifySequential();
+
+    // Takes the next free candidate until all are processed or one is accepted
+    void VerifyCandidates();
+
+    // Runs the RANSAC of one candidate until it is exhausted or any candidate is accepted
+    void VerifyCandidate(int nCandidate);
+
+    // Refines a RANSAC hypothesis, returns true if it has enough inliers
+    bool Refine(KeyFrame* pKF, const std::vector<MapPoint*> &vpMatches, const std::vector<bool> &vbInliers,
+                const cv::Mat &R, const cv::Mat &t, const float s, g2o::Sim3 &gScm, std::vector<MapPoint*> &vpRefined);
+
+    // Stores the result if no other candidate was accepted before
+    void Accept(int nCandidate, const g2o::Sim3 &gScm, const std::vector<MapPoint*> &vpMatches);
+
+    bool Accepted();
+
+    int mnThreads;
+
+    // State of the current verification
+    KeyFrame* mpCurrentKF;
+    const std::vector<KeyFrame*>* mpvpCandidates;
+    int mnNextCandidate;
+    boost::mutex mMutexCandidate;
+
+    int mnAccepted;
+    g2o::Sim3 mgScm;
+    std::vector<MapPoint*> mvpMatchedPoints;
+    boost::mutex mMutexAccepted;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SIM3VERIFIER_H
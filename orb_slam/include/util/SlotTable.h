@@ -0,0 +1,204 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SLOTTABLE_H
+#define SLOTTABLE_H
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <boost/shared_ptr.hpp>
+
+namespace ORB_SLAM
+{
+
+// Set of objects indexed by their mnId, which must be unique, in pages of PAGE_SIZE slots
+// Erasing leaves a tombstone (NULL) in the slot, pages without objects are dropped
+// Pages are shared with the snapshots and copied on the first write after one was taken,
+// so a snapshot costs one pointer per page and later writes never change it
+// The table is not synchronised, the owner keeps it under its own mutex
+template<class T>
+class SlotTable
+{
+public:
+    enum {PAGE_BITS = 10, PAGE_SIZE = 1<<PAGE_BITS};
+
+    struct Page
+    {
+        Page(): nCount(0) {std::fill(vpSlots, vpSlots+PAGE_SIZE, static_cast<T*>(NULL));}
+        T* vpSlots[PAGE_SIZE];
+        size_t nCount;
+    };
+    typedef boost::shared_ptr<Page> PagePtr;
+
+    // Immutable view of the table, iterates the objects in id order
+    // The objects themselves are live, the EpochReclaimer keeps them valid while in use
+    class Snapshot
+    {
+    public:
+        class const_iterator
+        {
+        public:
+            const_iterator(): mpPages(NULL), mnIndex(0) {}
+
+            T* operator*() const {return (*mpPages)[mnIndex>>PAGE_BITS]->vpSlots[mnIndex&(PAGE_SIZE-1)];}
+
+            const_iterator& operator++()
+            {
+                mnIndex++;
+                Skip();
+                return *this;
+            }
+
+            const_iterator operator++(int)
+            {
+                const_iterator it(*this);
+                ++(*this);
+                return it;
+            }
+
+            bool operator==(const const_iterator &it) const {return mnIndex==it.mnIndex;}
+            bool operator!=(const const_iterator &it) const {return mnIndex!=it.mnIndex;}
+
+        protected:
+            friend class Snapshot;
+
+            const_iterator(const std::vector<PagePtr>* pPages, size_t nIndex): mpPages(pPages), mnIndex(nIndex) {Skip();}
+
+            // Moves to the next slot holding an object, jumps over the dropped pages
+            void Skip()
+            {
+                const size_t nEnd = mpPages->size()*PAGE_SIZE;
+                while(mnIndex<nEnd)
+                {
+                    const PagePtr &pPage = (*mpPages)[mnIndex>>PAGE_BITS];
+                    if(!pPage)
+                        mnIndex = ((mnIndex>>PAGE_BITS)+1)<<PAGE_BITS;
+                    else if(!pPage->vpSlots[mnIndex&(PAGE_SIZE-1)])
+                        mnIndex++;
+                    else
+                        return;
+                }
+            }
+
+            const std::vector<PagePtr>* mpPages;
+            size_t mnIndex;
+        };
+
+        Snapshot(): mnSize(0) {}
+
+        const_iterator begin() const {return const_iterator(&mvPages,0);}
+        const_iterator end() const {return const_iterator(&mvPages,mvPages.size()*PAGE_SIZE);}
+
+        size_t size() const {return mnSize;}
+        bool empty() const {return mnSize==0;}
+
+        std::vector<T*> ToVector() const
+        {
+            std::vector<T*> vp;
+            vp.reserve(mnSize);
+            for(const_iterator it=begin(), itend=end(); it!=itend; it++)
+                vp.push_back(*it);
+            return vp;
+        }
+
+    protected:
+        friend class SlotTable;
+        std::vector<PagePtr> mvPages;
+        size_t mnSize;
+    };
+
+    SlotTable(): mnSize(0) {}
+
+    // False if the object was already in the table
+    bool Insert(T* p)
+    {
+        const size_t nPage = p->mnId>>PAGE_BITS;
+        if(nPage>=mvPages.size())
+            mvPages.resize(nPage+1);
+        T* &pSlot = Writable(nPage)->vpSlots[p->mnId&(PAGE_SIZE-1)];
+        if(pSlot==p)
+            return false;
+        if(!pSlot)
+        {
+            mvPages[nPage]->nCount++;
+            mnSize++;
+        }
+        pSlot = p;
+        return true;
+    }
+
+    // False if the object was not in the table
+    bool Erase(T* p)
+    {
+        if(!Contains(p))
+            return false;
+        const size_t nPage = p->mnId>>PAGE_BITS;
+        Page* pPage = Writable(nPage);
+        pPage->vpSlots[p->mnId&(PAGE_SIZE-1)] = static_cast<T*>(NULL);
+        pPage->nCount--;
+        mnSize--;
+        if(pPage->nCount==0)
+            mvPages[nPage].reset();
+        return true;
+    }
+
+    bool Contains(const T* p) const
+    {
+        const size_t nPage = p->mnId>>PAGE_BITS;
+        return nPage<mvPages.size() && mvPages[nPage] && mvPages[nPage]->vpSlots[p->mnId&(PAGE_SIZE-1)]==p;
+    }
+
+    size_t Size() const {return mnSize;}
+
+    Snapshot GetSnapshot() const
+    {
+        Snapshot snapshot;
+        snapshot.mvPages = mvPages;
+        snapshot.mnSize = mnSize;
+        return snapshot;
+    }
+
+    void Clear()
+    {
+        mvPages.clear();
+        mnSize = 0;
+    }
+
+protected:
+
+    // Page nPage owned by the table only, created or copied if needed
+    Page* Writable(size_t nPage)
+    {
+        PagePtr &pPage = mvPages[nPage];
+        if(!pPage)
+            pPage.reset(new Page());
+        else if(!pPage.unique())
+            pPage.reset(new Page(*pPage));
+        return pPage.get();
+    }
+
+    std::vector<PagePtr> mvPages;
+    size_t mnSize;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SLOTTABLE_H
@@ -0,0 +1,128 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SMALLVECTOR_H
+#define SMALLVECTOR_H
+
+#include <cstddef>
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+// Vector of plain data types with room for N items inside the object
+// The heap is only used past N items, so short lists are copied without allocating
+// Erase keeps the order of the remaining items
+template<class T, size_t N>
+class SmallVector
+{
+public:
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    SmallVector():
+        mpData(mInline), mnSize(0), mnCapacity(N)
+    {}
+
+    SmallVector(const SmallVector &other):
+        mpData(mInline), mnSize(0), mnCapacity(N)
+    {
+        Assign(other);
+    }
+
+    ~SmallVector()
+    {
+        if(mpData!=mInline)
+            delete[] mpData;
+    }
+
+    SmallVector& operator=(const SmallVector &other)
+    {
+        if(this!=&other)
+            Assign(other);
+        return *this;
+    }
+
+    size_t size() const {return mnSize;}
+    bool empty() const {return mnSize==0;}
+
+    // Storage allocated past the inline items
+    size_t HeapBytes() const {return mpData!=mInline ? mnCapacity*sizeof(T) : 0;}
+
+    iterator begin() {return mpData;}
+    iterator end() {return mpData+mnSize;}
+    const_iterator begin() const {return mpData;}
+    const_iterator end() const {return mpData+mnSize;}
+
+    T& operator[](size_t i) {return mpData[i];}
+    const T& operator[](size_t i) const {return mpData[i];}
+
+    void push_back(const T &item)
+    {
+        if(mnSize==mnCapacity)
+            Grow(2*mnCapacity);
+        mpData[mnSize++] = item;
+    }
+
+    iterator erase(iterator it)
+    {
+        std::copy(it+1,end(),it);
+        mnSize--;
+        return it;
+    }
+
+    // The heap storage, if any, is kept for reuse
+    void clear() {mnSize=0;}
+
+    void reserve(size_t n)
+    {
+        if(n>mnCapacity)
+            Grow(n);
+    }
+
+protected:
+
+    void Grow(size_t n)
+    {
+        T* pData = new T[n];
+        std::copy(mpData,mpData+mnSize,pData);
+        if(mpData!=mInline)
+            delete[] mpData;
+        mpData = pData;
+        mnCapacity = n;
+    }
+
+    void Assign(const SmallVector &other)
+    {
+        mnSize = 0;
+        reserve(other.mnSize);
+        std::copy(other.begin(),other.end(),mpData);
+        mnSize = other.mnSize;
+    }
+
+    T mInline[N];
+    T* mpData;
+    size_t mnSize;
+    size_t mnCapacity;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SMALLVECTOR_H
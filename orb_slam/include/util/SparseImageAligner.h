@@ -0,0 +1,93 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPARSEIMAGEALIGNER_H
+#define SPARSEIMAGEALIGNER_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+namespace ORB_SLAM
+{
+
+class Frame;
+
+// Pose of a new image relative to the last frame by sparse direct alignment, as a prior for the projection search
+// The photometric error of small patches around the keypoints of the last frame matched to map points is minimized,
+// from the coarsest level of an image pyramid (factor 2) to the finest one used. Inverse compositional Gauss-Newton:
+// the Jacobians are those of the last frame, computed once per level. Distortion is applied to the warped points but
+// left out of the Jacobians, the result is refined by the matching anyway
+// The pyramid of the aligned image is kept, it is the reference of the next call
+class SparseImageAligner
+{
+public:
+    // Levels from nMaxLevel down to nMinLevel (0 - full resolution), at most nIterations each
+    // fHuber: intensity residual above which the residuals are downweighted
+    SparseImageAligner(int nMaxLevel, int nMinLevel, int nIterations, float fHuber);
+
+    // Tcw: the predicted pose of current (only its image and timestamp are used), refined in place
+    // Returns false, leaving Tcw as it was, if too few points could be aligned
+    bool Align(const Frame &reference, const Frame &current, cv::Mat &Tcw);
+
+protected:
+    typedef Eigen::Matrix<double,6,1> Vector6d;
+    typedef Eigen::Matrix<double,6,6> Matrix6d;
+
+    void BuildPyramid(const cv::Mat &im, std::vector<cv::Mat> &vPyramid);
+
+    // Patches and Jacobians of the reference points at a level
+    void PrecomputeReference(int level);
+
+    // Mean weighted squared error of the warped patches and the normal equations, nValid gets the patches used
+    double ComputeResiduals(const Eigen::Matrix3d &Rcr, const Eigen::Vector3d &tcr, int level, Matrix6d &H, Vector6d &b, int &nValid);
+
+    // Pixel of a point in the camera, distorted as in the image
+    Eigen::Vector2d Project(const Eigen::Vector3d &Pc) const;
+
+    int mnMaxLevel;
+    int mnMinLevel;
+    int mnIterations;
+    float mfHuber;
+
+    // Calibration of the frames aligned
+    double fx, fy, cx, cy;
+    double k1, k2, p1, p2;
+
+    // Pyramid of the last image aligned, see FlowTracker
+    cv::Mat mPyramidImage;
+    double mPyramidTimeStamp;
+    std::vector<cv::Mat> mvPyramid;
+    std::vector<cv::Mat> mvRefPyramid;
+
+    // Reference points in the camera of the reference, their keypoints in the image
+    std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d> > mvPoints;
+    std::vector<cv::Point2f> mvRefPixels;
+
+    // Per point and level: patch intensities and Jacobians, whether the patch is inside the image
+    std::vector<float> mvRefPatches;
+    std::vector<Vector6d, Eigen::aligned_allocator<Vector6d> > mvJacobians;
+    std::vector<bool> mvbRefValid;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SPARSEIMAGEALIGNER_H
@@ -0,0 +1,98 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <vector>
+#include <Eigen/Core>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "util/MemoryStats.h"
+
+namespace ORB_SLAM
+{
+
+class MapPoint;
+class Camera;
+
+// Map points hashed by the voxel of their position, for queries by region that do not go through covisibility
+// Each entry keeps the position of the point as of its last update, queries do not lock the points
+// Queries share the index, updates lock it exclusively
+class SpatialIndex
+{
+public:
+    // Voxel edge in map units. The monocular initialization sets the median scene depth to 1
+    SpatialIndex(float fVoxelSize=0.25f);
+
+    void Insert(MapPoint* pMP, const Eigen::Vector3f &pos);
+    // Does nothing if the point is not indexed
+    void Move(MapPoint* pMP, const Eigen::Vector3f &pos);
+    void Erase(MapPoint* pMP);
+    void Clear();
+
+    size_t Size();
+
+    // Points inside the axis aligned box [min,max]
+    void QueryBox(const Eigen::Vector3f &min, const Eigen::Vector3f &max, std::vector<MapPoint*> &vpPoints);
+
+    // Points within radius of center
+    void QueryRadius(const Eigen::Vector3f &center, float radius, std::vector<MapPoint*> &vpPoints);
+
+    // Points in front of the camera at pose Rcw,tcw, up to maxDepth, that project inside its undistorted image bounds
+    void QueryFrustum(const Eigen::Matrix3f &Rcw, const Eigen::Vector3f &tcw, const Camera &camera, float maxDepth,
+                      std::vector<MapPoint*> &vpPoints);
+
+    // Adds the bytes held by the voxels and the point table
+    void AccountMemory(MemoryStats &stats);
+
+protected:
+    typedef long long VoxelKey;
+
+    struct Entry
+    {
+        MapPoint* pMP;
+        float pos[3];
+    };
+
+    VoxelKey Key(int x, int y, int z) const;
+    VoxelKey Key(const Eigen::Vector3f &pos) const;
+    void Cell(const Eigen::Vector3f &pos, int &x, int &y, int &z) const;
+
+    // Updates the position of an indexed point, moving it to its new voxel. The index must be locked
+    void Relocate(boost::unordered_map<MapPoint*,VoxelKey>::iterator pit, const Eigen::Vector3f &pos);
+
+    // Entries inside the box, from the voxels it overlaps or, if there are fewer, from every voxel
+    // The index must be locked
+    void GatherBox(const Eigen::Vector3f &min, const Eigen::Vector3f &max, std::vector<Entry> &vEntries);
+
+    float mfVoxelSize;
+    float mfInvVoxelSize;
+
+    boost::unordered_map<VoxelKey,std::vector<Entry> > mVoxels;
+    boost::unordered_map<MapPoint*,VoxelKey> mPointVoxels;
+
+    boost::shared_mutex mMutex;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SPATIALINDEX_H
@@ -0,0 +1,147 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <boost/atomic.hpp>
+
+namespace ORB_SLAM
+{
+
+// Bounded lock-free queue for one producer thread and one consumer thread
+// Push is only called by the producer and Pop by the consumer, the rest can be called from any thread
+// The capacity is rounded up to a power of two
+template<class T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity):
+        mnHead(0), mnTail(0), mnDiscard(0), mnHighWater(0)
+    {
+        size_t n = 1;
+        while(n<capacity)
+            n <<= 1;
+        mvBuffer.resize(n);
+        mnMask = n-1;
+    }
+
+    // Producer: returns false if the queue is full
+    bool Push(const T &item)
+    {
+        const size_t head = mnHead.load(boost::memory_order_relaxed);
+        const size_t tail = mnTail.load(boost::memory_order_acquire);
+        if(head-tail>mnMask)
+            return false;
+
+        mvBuffer[head & mnMask] = item;
+        mnHead.store(head+1, boost::memory_order_release);
+
+        // Only the producer writes the high-water mark
+        if(head+1-tail>mnHighWater.load(boost::memory_order_relaxed))
+            mnHighWater.store(head+1-tail, boost::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer: returns false if the queue is empty
+    bool Pop(T &item)
+    {
+        const size_t tail = SkipDiscarded();
+        const size_t head = mnHead.load(boost::memory_order_acquire);
+        if(tail==head)
+            return false;
+
+        item = mvBuffer[tail & mnMask];
+        mnTail.store(tail+1, boost::memory_order_release);
+        return true;
+    }
+
+    // Consumer: copies the items waiting, oldest first, without taking them
+    // The items pushed are not written again until they are popped, so the consumer can read them in place
+    void GetQueued(std::vector<T> &items)
+    {
+        const size_t tail = SkipDiscarded();
+        const size_t head = mnHead.load(boost::memory_order_acquire);
+        items.clear();
+        items.reserve(head-tail);
+        for(size_t i=tail; i!=head; i++)
+            items.push_back(mvBuffer[i & mnMask]);
+    }
+
+    // Drops the items pushed so far, the consumer skips them on its next Pop
+    void DiscardQueued()
+    {
+        mnDiscard.store(mnHead.load(boost::memory_order_acquire), boost::memory_order_release);
+    }
+
+    bool Empty() const
+    {
+        return Size()==0;
+    }
+
+    // Items waiting, exact from the producer or the consumer, a snapshot from other threads
+    size_t Size() const
+    {
+        const size_t tail = std::max(mnTail.load(boost::memory_order_acquire), mnDiscard.load(boost::memory_order_acquire));
+        const size_t head = mnHead.load(boost::memory_order_acquire);
+        return head>tail ? head-tail : 0;
+    }
+
+    size_t Capacity() const {return mnMask+1;}
+
+    // Largest number of items that have been waiting at once
+    size_t HighWater() const {return mnHighWater.load(boost::memory_order_relaxed);}
+
+protected:
+
+    // Consumer: moves the tail past the discarded items
+    size_t SkipDiscarded()
+    {
+        size_t tail = mnTail.load(boost::memory_order_relaxed);
+        const size_t discard = mnDiscard.load(boost::memory_order_acquire);
+        if(discard>tail)
+        {
+            tail = discard;
+            mnTail.store(tail, boost::memory_order_release);
+        }
+        return tail;
+    }
+
+    std::vector<T> mvBuffer;
+    size_t mnMask;
+
+    // Head is written by the producer, tail by the consumer
+    // Both only grow, positions in the buffer are taken modulo the capacity
+    boost::atomic<size_t> mnHead;
+    boost::atomic<size_t> mnTail;
+    boost::atomic<size_t> mnDiscard;
+    boost::atomic<size_t> mnHighWater;
+
+    // Not copyable
+    SpscQueue(const SpscQueue&);
+    SpscQueue& operator=(const SpscQueue&);
+};
+
+} //namespace ORB_SLAM
+
+#endif // SPSCQUEUE_H
@@ -0,0 +1,82 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef STATIONARYDETECTOR_H
+#define STATIONARYDETECTOR_H
+
+#include <opencv2/core/core.hpp>
+#include <boost/thread.hpp>
+
+namespace ORB_SLAM
+{
+
+// Detects a camera that does not move, so that its nearly identical images are not all tracked
+// Each image is downscaled to a fixed width and compared with the last tracked one by their mean absolute
+// difference. After enough tracked frames in a row that look the same and whose motion was near zero,
+// the camera is stationary: the images that still look the same are skipped and the last pose is kept,
+// but one is tracked every verification period. An image that differs, or a tracked frame that moved, ends it
+// Images arrive on the callback thread while the motion is given by the tracking stage
+class StationaryDetector
+{
+public:
+    // nWidth: width the images are downscaled to, fMaxDifference: mean absolute difference in gray levels
+    // below which two images are the same, nMinFrames: still frames before the camera is stationary,
+    // fVerifyPeriod: seconds between the frames tracked while stationary
+    StationaryDetector(int nWidth, float fMaxDifference, int nMinFrames, float fVerifyPeriod);
+
+    // Called for every grayscale image before extraction, returns true if it is skipped
+    // bKeep: the frame is tracked whatever the image (e.g. right after a keyframe)
+    bool Skip(const cv::Mat &im, double timeStamp, bool bKeep);
+
+    // Called after each tracked frame, whether it was tracked with a motion near zero
+    void Update(bool bStill);
+
+    bool isStationary();
+
+    // Images skipped since the start
+    unsigned int GetSkipped();
+
+protected:
+
+    boost::mutex mMutex;
+
+    int mnWidth;
+    float mfMaxDifference;
+    int mnMinFrames;
+    float mfVerifyPeriod;
+
+    // Downscaled image of the last tracked frame, and the one of the image being compared
+    cv::Mat mReference;
+    cv::Mat mSmall;
+    double mReferenceTimeStamp;
+
+    // The last image passed on looked as its reference
+    bool mbSame;
+
+    // Still frames tracked in a row
+    int mnStillFrames;
+
+    unsigned int mnSkipped;
+};
+
+} //namespace ORB_SLAM
+
+#endif // STATIONARYDETECTOR_H
@@ -0,0 +1,134 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYNTHETICMAP_H
+#define SYNTHETICMAP_H
+
+#include <vector>
+#include <utility>
+#include <opencv2/core/core.hpp>
+#include <Eigen/Core>
+
+#include "types/ORBVocabulary.h"
+
+namespace ORB_SLAM
+{
+
+class Camera;
+class Map;
+class MapDatabase;
+class KeyFrame;
+
+// Maps of a synthetic scene, to time what grows with the map beyond the sequences at hand
+// The scene is a ring of landmarks, each with its own descriptor. Each map is a session going around the ring
+// one or more times, its keyframes look outwards and observe the landmarks they see through the camera.
+// The objects are the real ones: keyframes with keypoints, descriptors and BoW vectors, map points with
+// their observations, the covisibility graph, spanning tree and loop edges, built as Local Mapping does
+// - Covisibility: each landmark is observed by up to nCovisible keyframes per lap, the closest ones that see it
+// - Loops: every lap after the first reobserves the landmarks of the previous ones, and its first keyframe
+//   has a loop edge with the first keyframe of the previous lap
+// - Sub-maps: the sessions see the same landmarks from slightly different keyframes, so they can be merged
+class SyntheticMap
+{
+public:
+    struct Parameters
+    {
+        Parameters();
+
+        // Per map
+        int nKeyFrames;
+        // New landmarks seen by each keyframe of the first lap
+        int nPointsPerKeyFrame;
+        // Keypoints per keyframe, those not matched to a map point have random descriptors
+        int nFeatures;
+        int nCovisible;
+        // Extra laps around the ring
+        int nLoops;
+        int nMaps;
+
+        float fRadius;
+        float fMinDepth;
+        float fMaxDepth;
+        // Keypoint noise in pixels at the first level, and descriptor bits flipped per observation at most
+        float fPixelNoise;
+        int nFlippedBits;
+
+        unsigned int nSeed;
+    };
+
+    // Keypoints get the scale levels of an extractor with these settings
+    SyntheticMap(ORBVocabulary* pVocabulary, const Camera* pCamera, int nLevels, float fScaleFactor, const Parameters &params);
+
+    // Adds the maps to the database, the last one becomes the current map
+    // vLoops gets the pairs of keyframes with a loop edge, the later keyframe first
+    void Generate(MapDatabase* pMapDB, std::vector<std::pair<KeyFrame*,KeyFrame*> > &vLoops);
+
+protected:
+    struct Landmark
+    {
+        Eigen::Vector3f pos;
+        float fSize;
+        cv::Mat descriptor;
+    };
+
+    struct Slot
+    {
+        int nLandmark;
+        float u, v;
+        int level;
+    };
+
+    struct View
+    {
+        Eigen::Matrix3f Rcw;
+        Eigen::Vector3f tcw;
+        std::vector<Slot> vSlots;
+    };
+
+    void GenerateLandmarks();
+    Map* GenerateMap(MapDatabase* pMapDB, int nMap, std::vector<std::pair<KeyFrame*,KeyFrame*> > &vLoops);
+
+    // Keyframe poses of a session, on the ring
+    void PlaceViews(int nMap, std::vector<View> &vViews);
+
+    // Adds the observation if the landmark projects inside the image of the view and it has room left
+    bool Observe(View &view, int nLandmark);
+
+    // Keyframe with the keypoints of its slots, then random ones up to nFeatures
+    KeyFrame* CreateKeyFrame(const View &view, Map* pMap, double timestamp);
+
+    ORBVocabulary* mpVocabulary;
+    const Camera* mpCamera;
+    int mnLevels;
+    float mfScaleFactor;
+    std::vector<float> mvScaleFactors;
+    std::vector<float> mvLevelSigma2;
+    std::vector<float> mvInvLevelSigma2;
+
+    Parameters mParams;
+    int mnViewsPerLap;
+
+    cv::RNG mRng;
+    std::vector<Landmark> mvLandmarks;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SYNTHETICMAP_H
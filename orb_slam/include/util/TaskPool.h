@@ -0,0 +1,157 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <vector>
+#include <deque>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace ORB_SLAM
+{
+
+class TaskGroup;
+
+// Workers shared by the parallel kernels of all the threads, so together they use the cores without oversubscribing them
+// Each worker has a queue per priority. Tasks submitted from a worker go to its own queue and are taken last in first out,
+// idle workers steal the oldest tasks from the others. Workers always take the most urgent task they can find
+class TaskPool
+{
+public:
+    enum Priority
+    {
+        TRACKING=0,
+        LOCAL_MAPPING,
+        LOOP_CLOSING,
+        RELOCALIZATION,
+        VISUALIZATION,
+        N_PRIORITIES
+    };
+
+    TaskPool();
+    // Joins the workers, no task group may be waiting
+    ~TaskPool();
+
+    static TaskPool* Global();
+
+    // Workers are started with the first task, one per core unless set before (0 - one per core)
+    void SetThreads(int nThreads);
+    int GetThreads();
+
+    // Inline, tasks are not submitted and run in the waiting caller in the order they were added
+    // Kernels that split their work among their tasks then give the same results in every run
+    void SetInline(bool bInline);
+    bool isInline();
+
+    // Sessions of a multi-session host share the pool. The groups of the calling thread are queued nLevels less urgent
+    // than their priority, and so are the groups nested in their tasks (0 - as given)
+    static void SetThreadDemotion(int nLevels);
+    static int GetThreadDemotion();
+    static Priority Demote(Priority priority);
+
+protected:
+    friend class TaskGroup;
+
+    struct Task
+    {
+        boost::function<void()> function;
+        TaskGroup* pGroup;
+        // Demotion of the thread that submitted it, the thread running it takes it meanwhile
+        int nDemotion;
+        // Set by whoever runs the task, the worker that took it or the waiting group
+        boost::atomic<bool> claimed;
+    };
+
+    struct Worker
+    {
+        boost::mutex mutex;
+        std::deque<boost::shared_ptr<Task> > queues[N_PRIORITIES];
+        boost::thread* pThread;
+    };
+
+    void Submit(const boost::shared_ptr<Task> &pTask, Priority priority);
+
+    // Runs the task unless it was claimed already
+    static void Execute(const boost::shared_ptr<Task> &pTask);
+
+    void Start();
+    void RunWorker(int id);
+    bool TakeTask(int id, boost::shared_ptr<Task> &pTask);
+
+    int mnThreads;
+    bool mbStarted;
+    bool mbInline;
+    boost::mutex mMutexStart;
+
+    std::vector<Worker*> mvpWorkers;
+    boost::thread_specific_ptr<int> mWorkerId;
+    boost::atomic<unsigned int> mnNextWorker;
+
+    // Tasks in the queues, claimed ones included until they are taken
+    boost::atomic<int> mnQueued;
+    boost::mutex mMutexSleep;
+    boost::condition_variable mWakeUp;
+    bool mbStop;
+};
+
+// Tasks run on the pool by one caller, which waits for all of them, as a boost::thread_group:
+//
+//   TaskGroup workers(TaskPool::LOCAL_MAPPING);
+//   for(int i=0; i<nWorkers-1; i++)
+//       workers.Run(boost::bind(&LocalMapping::TriangulateNeighbors,this));
+//   TriangulateNeighbors();
+//   workers.Wait();
+//
+// While waiting, the caller runs the tasks no worker has taken yet, so groups can be nested and
+// a busy pool does not delay the caller longer than running the tasks itself
+class TaskGroup
+{
+public:
+    TaskGroup(TaskPool::Priority priority, TaskPool* pPool=TaskPool::Global());
+    ~TaskGroup();
+
+    void Run(const boost::function<void()> &function);
+    void Wait();
+
+protected:
+    friend class TaskPool;
+
+    void Finished();
+
+    TaskPool* mpPool;
+    TaskPool::Priority mPriority;
+
+    std::vector<boost::shared_ptr<TaskPool::Task> > mvpTasks;
+
+    boost::mutex mMutex;
+    boost::condition_variable mDone;
+    int mnPending;
+};
+
+} //namespace ORB_SLAM
+
+#endif // TASKPOOL_H
@@ -0,0 +1,71 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADCONFIG_H
+#define THREADCONFIG_H
+
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM
+{
+
+// Scheduling of one of the SLAM threads, read from the settings of its section:
+//   <Name>.Cores: "2,3" or "4-7", cores the thread may run on ("" - any)
+//   <Name>.RealTimePriority: SCHED_FIFO priority from 1 to 99 (0 - normal scheduling)
+//   <Name>.Nice: nice value of the thread under normal scheduling
+//   <Name>.LockMemory: lock the pages of the process in memory with mlockall, so the thread never faults them in
+// and, shared by all the threads of a session of a multi-session host:
+//   Session.Priority: levels the pool tasks of the thread are demoted by (0 - as urgent as the other sessions')
+// Applied from within the thread, which logs what it got. Failures are logged and the rest is still applied
+class ThreadConfig
+{
+public:
+    ThreadConfig();
+    ThreadConfig(const cv::FileStorage &fSettings, const std::string &name);
+
+    bool isDefault() const;
+
+    // Configures the calling thread, returns false if something could not be applied
+    bool Apply() const;
+
+    // Entry point of a configured thread, applies config and runs function
+    static void Run(const ThreadConfig &config, const boost::function<void()> &function);
+
+    // Cores, scheduling policy and nice value the calling thread actually has
+    static std::string DescribeCurrent();
+
+    std::string mName;
+    std::vector<int> mvCores;
+    int mnRealTimePriority;
+    int mnNice;
+    bool mbLockMemory;
+    int mnPoolDemotion;
+
+protected:
+    // Parses "0,2,4-7", false on syntax errors
+    static bool ParseCores(const std::string &str, std::vector<int> &vCores);
+};
+
+} //namespace ORB_SLAM
+
+#endif // THREADCONFIG_H
@@ -0,0 +1,118 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <vector>
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace ORB_SLAM
+{
+
+// Timeline of spans across all the threads, saved as Chrome trace JSON (chrome://tracing or ui.perfetto.dev)
+// Each thread records into its own ring buffer without locking, keeping its latest spans
+// Spans are marked with TRACE_SCOPE("Class::Stage"), the name must be a string literal
+// Built only with ORB_SLAM_TRACE, and recording only once enabled: a disabled span costs one relaxed load
+class Tracer
+{
+public:
+    static Tracer* Global();
+
+    // Starts recording, each thread keeps its last nEvents spans. The size is fixed by the first call
+    void Enable(size_t nEvents=65536);
+    void Disable();
+    static bool isEnabled() {return sbEnabled.load(boost::memory_order_relaxed);}
+
+    // Monotonic clock in nanoseconds
+    static unsigned long long Now();
+
+    void Record(const char* name, unsigned long long begin, unsigned long long end);
+
+    // Names the calling thread in the trace
+    void SetThreadName(const std::string &name);
+
+    // Threads keep recording while it is saved, spans overwritten meanwhile are left out
+    bool SaveChromeJSON(const std::string &filename);
+
+protected:
+    Tracer();
+    ~Tracer();
+
+    struct Event
+    {
+        const char* name;
+        unsigned long long begin;
+        unsigned long long end;
+    };
+
+    // Written by its thread only. Buffers outlive their threads, so their spans are still saved
+    struct ThreadBuffer
+    {
+        int id;
+        std::string name;
+        std::vector<Event> vEvents;
+        boost::atomic<unsigned long> nWritten;
+    };
+
+    ThreadBuffer* GetBuffer();
+
+    // Cleanup of the thread specific pointer, the buffers are owned by the tracer
+    static void KeepBuffer(ThreadBuffer* pBuffer);
+
+    static boost::atomic<bool> sbEnabled;
+
+    size_t mnEvents;
+    boost::thread_specific_ptr<ThreadBuffer> mBuffer;
+    std::vector<ThreadBuffer*> mvpBuffers;
+    boost::mutex mMutexBuffers;
+};
+
+// Records the time from construction to destruction as a span
+class TraceScope
+{
+public:
+    TraceScope(const char* name):
+        mName(Tracer::isEnabled() ? name : 0), mBegin(mName ? Tracer::Now() : 0) {}
+    ~TraceScope()
+    {
+        if(mName)
+            Tracer::Global()->Record(mName,mBegin,Tracer::Now());
+    }
+
+protected:
+    const char* mName;
+    unsigned long long mBegin;
+};
+
+} //namespace ORB_SLAM
+
+#ifdef ORB_SLAM_TRACE
+#define TRACE_CONCAT_(a,b) a##b
+#define TRACE_CONCAT(a,b) TRACE_CONCAT_(a,b)
+#define TRACE_SCOPE(name) ORB_SLAM::TraceScope TRACE_CONCAT(traceScope,__LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
+
+#endif // TRACE_H
@@ -0,0 +1,87 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRAJECTORYEVALUATION_H
+#define TRAJECTORYEVALUATION_H
+
+#include <vector>
+#include <string>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+namespace ORB_SLAM
+{
+
+// Accuracy of an estimated trajectory against the ground truth of a sequence
+// The estimate is aligned to the ground truth with a similarity (Umeyama), a monocular map has an arbitrary scale
+// ATE: error of the camera centers after the alignment
+// RPE: error of the motion between poses some time apart, its translation scaled by the alignment
+class TrajectoryEvaluation
+{
+public:
+    struct StampedPose
+    {
+        double timestamp;
+        // Rotation and center of the camera in the world
+        Eigen::Quaterniond q;
+        Eigen::Vector3d t;
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+    typedef std::vector<StampedPose,Eigen::aligned_allocator<StampedPose> > Trajectory;
+
+    struct Result
+    {
+        // Estimated poses associated with a ground truth pose
+        int nPoses;
+        double scale;
+        // Meters
+        double ateRmse;
+        double ateMean;
+        double ateMedian;
+        double ateMax;
+        // Pose pairs, translation in meters and rotation in degrees
+        int nPairs;
+        double rpeTransRmse;
+        double rpeRotRmse;
+    };
+
+    // TUM: "timestamp tx ty tz qx qy qz qw" lines
+    static bool LoadTUM(const std::string &filename, Trajectory &trajectory);
+
+    // EuRoC: "timestamp [ns],px,py,pz,qw,qx,qy,qz,..." lines, the pose of the body and not of the camera
+    // The offset between them shows as a small error, the same for every run
+    static bool LoadEuRoC(const std::string &filename, Trajectory &trajectory);
+
+    // KITTI: one line per image with the 12 values of Twc, stamped with the times of the images
+    static bool LoadKITTI(const std::string &filename, const std::vector<double> &vTimestamps, Trajectory &trajectory);
+
+    // Each estimated pose is associated with the nearest ground truth pose within fMaxDifference seconds
+    // Relative errors are taken between poses at least fDelta seconds apart
+    // False if fewer than 3 poses are associated
+    static bool Evaluate(const Trajectory &estimate, const Trajectory &groundTruth, Result &result,
+                         double fMaxDifference=0.02, double fDelta=1.0);
+};
+
+} //namespace ORB_SLAM
+
+#endif // TRAJECTORYEVALUATION_H
@@ -0,0 +1,94 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRAJECTORYRECORDER_H
+#define TRAJECTORYRECORDER_H
+
+#include "util/SpscQueue.h"
+
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace ORB_SLAM
+{
+
+// Records the pose of each tracked frame relative to its reference keyframe
+// Tracking pushes the records to a lock-free ring and a writer thread appends them to a file,
+// so tracking never waits on the disk. At export they are read back and placed with the
+// optimized pose of their keyframe
+class TrajectoryRecorder
+{
+public:
+
+    // Rotations are row major. The pose at tracking time is kept for when the keyframe is culled
+    struct FramePose
+    {
+        double timeStamp;
+        uint64_t nMapId;
+        uint64_t nRefKFId;
+        float Rcr[9];
+        float tcr[3];
+        float Rcw[9];
+        float tcw[3];
+    };
+
+    explicit TrajectoryRecorder(size_t capacity=1024);
+    ~TrajectoryRecorder();
+
+    // Truncates the file and starts the writer thread
+    bool Open(const std::string &filename);
+
+    // Tracking thread: queues the record, it is dropped if the writer fell a whole ring behind
+    void Record(const FramePose &pose);
+
+    // Writes what is queued, flushes and stops the writer thread
+    void Close();
+
+    // After Close, the records written, in tracking order
+    bool ReadAll(std::vector<FramePose> &vPoses);
+
+    // Records lost because the ring was full
+    size_t Dropped() const;
+
+protected:
+
+    void RunWriter();
+
+    // Writes the queued records, returns how many
+    size_t Drain();
+
+    std::string mstrFilename;
+    std::ofstream mFile;
+    std::vector<char> mvFileBuffer;
+
+    SpscQueue<FramePose> mqPoses;
+    boost::atomic<size_t> mnDropped;
+
+    boost::atomic<bool> mbClosing;
+    boost::thread* mpWriter;
+};
+
+} //namespace ORB_SLAM
+
+#endif // TRAJECTORYRECORDER_H
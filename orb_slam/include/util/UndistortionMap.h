@@ -0,0 +1,73 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef UNDISTORTIONMAP_H
+#define UNDISTORTIONMAP_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+namespace ORB_SLAM
+{
+
+// Undistorted position of the image pixels for a fixed calibration
+// cv::undistortPoints is run once on a lattice of nodes every step pixels, keypoints are then
+// undistorted by bilinear interpolation between the four surrounding nodes instead of the iterative solver
+class UndistortionMap
+{
+public:
+    UndistortionMap();
+
+    // Solves the lattice for images of width x height
+    void Build(const cv::Mat &K, const cv::Mat &DistCoef, int width, int height, int step);
+
+    // Built for images of that size
+    bool IsBuilt(int width, int height) const {return !mvNodes.empty() && width==mnWidth && height==mnHeight;}
+
+    cv::Point2f Undistort(float x, float y) const;
+
+    // Same keypoints with undistorted coordinates, vKeysUn is resized
+    void Undistort(const std::vector<cv::KeyPoint> &vKeys, std::vector<cv::KeyPoint> &vKeysUn) const;
+
+    // Bounds of the undistorted image, from the corners solved exactly
+    int GetMinX() const {return mnMinX;}
+    int GetMaxX() const {return mnMaxX;}
+    int GetMinY() const {return mnMinY;}
+    int GetMaxY() const {return mnMaxY;}
+
+protected:
+
+    int mnWidth;
+    int mnHeight;
+    float mfInvStep;
+
+    // Lattice of mnCols x mnRows nodes, row major, covering the image up to its far border
+    int mnCols;
+    int mnRows;
+    std::vector<cv::Point2f> mvNodes;
+
+    int mnMinX, mnMaxX, mnMinY, mnMaxY;
+};
+
+} //namespace ORB_SLAM
+
+#endif // UNDISTORTIONMAP_H
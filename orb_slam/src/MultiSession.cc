@@ -0,0 +1,155 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "MultiSession.h"
+
+#include "util/EpochReclaimer.h"
+
+#include <ros/package.h>
+#include <opencv2/core/core.hpp>
+
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+MultiSession::MultiSession(const std::string &strVocFile):
+    mstrVocFile(strVocFile), mnWorkers(2), mbShutdownRequested(false), mbShutdown(false)
+{
+}
+
+MultiSession::~MultiSession()
+{
+    Shutdown();
+
+    for(size_t i=0; i<mvpSessions.size(); i++)
+        delete mvpSessions[i];
+}
+
+void MultiSession::AddSession(const std::string &strName, const std::string &strSettingsFile, const std::string &strMapFile)
+{
+    System* pSession = new System(mstrVocFile, strSettingsFile, strMapFile);
+    pSession->SetSession(strName, &mVocabulary, &mWorkers);
+    mvNames.push_back(strName);
+    mvSettingsFiles.push_back(strSettingsFile);
+    mvpSessions.push_back(pSession);
+}
+
+bool MultiSession::Init()
+{
+    if(mvpSessions.empty())
+    {
+        ROS_ERROR("ORB-SLAM - No session to run.");
+        return false;
+    }
+
+    // One vocabulary for all, the BoW conversion threads and the shared workers are those of the first session
+    cv::FileStorage fsSettings(mvSettingsFiles[0].c_str(), cv::FileStorage::READ);
+    if(fsSettings.isOpened())
+    {
+        int nVocThreads = fsSettings["Vocabulary.nThreads"];
+        mVocabulary.setTransformThreads(nVocThreads);
+        if(!fsSettings["MultiSession.Workers"].empty())
+            mnWorkers = std::max((int)fsSettings["MultiSession.Workers"],1);
+    }
+    if(!System::LoadVocabulary(mVocabulary, mstrVocFile))
+        return false;
+
+    for(size_t i=0; i<mvpSessions.size(); i++)
+    {
+        if(!mvpSessions[i]->Init())
+        {
+            ROS_ERROR("ORB-SLAM - Session %s could not be initialized.", mvNames[i].c_str());
+            return false;
+        }
+        ROS_INFO("ORB-SLAM - Session %s ready.", mvNames[i].c_str());
+    }
+    return true;
+}
+
+void MultiSession::Start()
+{
+    for(size_t i=0; i<mvpSessions.size(); i++)
+        mvpSessions[i]->Start();
+
+    // After the sessions, which add their threads
+    mWorkers.Start(mnWorkers);
+    ROS_INFO("ORB-SLAM - %d workers shared by %d sessions.", mnWorkers, (int)mvpSessions.size());
+}
+
+void MultiSession::RunPublishers()
+{
+    // The publishers read map objects, culled ones are not reclaimed while they draw
+    int nEpochId = EpochReclaimer::Global()->Register();
+
+    float fps = 0;
+    for(size_t i=0; i<mvpSessions.size(); i++)
+        fps = std::max(fps, mvpSessions[i]->GetFps());
+
+    ros::Rate r(fps);
+    while(ros::ok())
+    {
+        {
+            boost::mutex::scoped_lock lock(mMutexShutdown);
+            if(mbShutdownRequested)
+                break;
+        }
+
+        for(size_t i=0; i<mvpSessions.size(); i++)
+            mvpSessions[i]->RefreshPublishers(nEpochId);
+
+        r.sleep();
+    }
+
+    EpochReclaimer::Global()->Unregister(nEpochId);
+}
+
+void MultiSession::Shutdown()
+{
+    {
+        boost::mutex::scoped_lock lock(mMutexShutdown);
+        if(mbShutdown)
+            return;
+        mbShutdownRequested = true;
+        mbShutdown = true;
+    }
+
+    // A session waiting for another thread to stop runs it itself from now on
+    mWorkers.Finish();
+
+    for(size_t i=0; i<mvpSessions.size(); i++)
+        mvpSessions[i]->Shutdown();
+
+    // After the sessions, which clear their own folders
+    System::SaveProcessReports(ros::package::getPath("orb_slam")+"/generated/");
+}
+
+size_t MultiSession::Sessions()
+{
+    return mvpSessions.size();
+}
+
+System* MultiSession::GetSession(size_t i)
+{
+    return mvpSessions[i];
+}
+
+} //namespace ORB_SLAM
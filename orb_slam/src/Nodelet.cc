@@ -0,0 +1,81 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "System.h"
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <ros/package.h>
+
+#include <boost/scoped_ptr.hpp>
+
+namespace ORB_SLAM
+{
+
+// The pipeline as a nodelet, loaded in the manager of the camera driver the images are passed by pointer
+// Parameters: ~vocabulary, ~settings and ~map (optional), absolute or relative to the package directory
+class SystemNodelet : public nodelet::Nodelet
+{
+public:
+    virtual ~SystemNodelet()
+    {
+        if(mpSystem)
+            mpSystem->Shutdown();
+    }
+
+protected:
+    virtual void onInit()
+    {
+        ros::NodeHandle &nh = getMTNodeHandle();
+        ros::NodeHandle &pnh = getPrivateNodeHandle();
+
+        std::string strVocFile, strSettingsFile, strMapFile;
+        if(!pnh.getParam("vocabulary",strVocFile) || !pnh.getParam("settings",strSettingsFile))
+        {
+            NODELET_ERROR("Parameters ~vocabulary and ~settings are required.");
+            return;
+        }
+        pnh.getParam("map",strMapFile);
+
+        mpSystem.reset(new System(ResolvePath(strVocFile), ResolvePath(strSettingsFile),
+                                  strMapFile.empty() ? strMapFile : ResolvePath(strMapFile)));
+        if(!mpSystem->Init())
+        {
+            mpSystem.reset();
+            return;
+        }
+
+        // The image callbacks run in the manager threads
+        mpSystem->Start(&nh);
+    }
+
+    static std::string ResolvePath(const std::string &strPath)
+    {
+        if(!strPath.empty() && strPath[0]=='/')
+            return strPath;
+        return ros::package::getPath("orb_slam")+"/"+strPath;
+    }
+
+    boost::scoped_ptr<System> mpSystem;
+};
+
+} //namespace ORB_SLAM
+
+PLUGINLIB_EXPORT_CLASS(ORB_SLAM::SystemNodelet, nodelet::Nodelet)
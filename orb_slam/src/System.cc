@@ -0,0 +1,834 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "System.h"
+
+#include "types/Map.h"
+#include "types/MapSnapshot.h"
+
+#include "threads/Tracking.h"
+#include "threads/Relocalization.h"
+#include "threads/MapMerging.h"
+#include "threads/MapRefiner.h"
+#include "threads/LocalMapping.h"
+#include "threads/LoopClosing.h"
+#include "threads/SharedWorkers.h"
+
+#ifndef ORB_SLAM_HEADLESS
+#include "publishers/FramePublisher.h"
+#include "publishers/MapPublisher.h"
+#endif
+#include "publishers/StatsPublisher.h"
+#include "publishers/CloudPublisher.h"
+
+#include "util/LatencyStats.h"
+#include "util/AllocationStats.h"
+#include "util/TaskPool.h"
+#include "util/Trace.h"
+#include "util/LockProfiler.h"
+#include "util/EpochReclaimer.h"
+#include "util/MapSerializer.h"
+#include "util/MapJournal.h"
+#include "util/Optimizer.h"
+#include "util/Converter.h"
+#include "util/MapLink.h"
+
+#include <ros/package.h>
+#include <boost/filesystem.hpp>
+#include <boost/bind.hpp>
+
+#include <opencv2/core/core.hpp>
+
+#include <sstream>
+#include <fstream>
+
+namespace ORB_SLAM
+{
+
+System::System(const std::string &strVocFile, const std::string &strSettingsFile, const std::string &strMapFile):
+    mstrVocFile(strVocFile), mstrSettingsFile(strSettingsFile), mstrMapFile(strMapFile),
+    mstrGeneratedDir(ros::package::getPath("orb_slam")+"/generated/"), mfFps(30),
+    mfShutdownTimeout(5), mnFinalBAIterations(0), mpVocabulary(&mVocabulary), mpSharedWorkers(NULL), mpMapDB(NULL), mpJournal(NULL),
+    mpTracker(NULL), mpRelocalizer(NULL), mpLocalMapper(NULL), mpLoopCloser(NULL), mpMapMerger(NULL), mpMapRefiner(NULL), mpMapLink(NULL),
+    mpFramePublisher(NULL), mpMapPublisher(NULL), mpStatsPublisher(NULL), mpCloudPublisher(NULL),
+    mbSubscribed(false), mbFinished(false), mpPublisherThread(NULL), mpVocabularyThread(NULL), mbShutdownRequested(false),
+    mbShutdown(false)
+{
+}
+
+System::~System()
+{
+    Shutdown();
+
+    // A thread still running may use any of them, they are left to the process exit
+    if(!mbFinished)
+        return;
+
+    for(size_t i=0; i<mvpThreads.size(); i++)
+        delete mvpThreads[i];
+    delete mpCloudPublisher;
+    delete mpStatsPublisher;
+    delete mpMapLink;
+    delete mpMapRefiner;
+    delete mpMapMerger;
+    delete mpLoopCloser;
+    delete mpLocalMapper;
+    delete mpRelocalizer;
+    delete mpTracker;
+#ifndef ORB_SLAM_HEADLESS
+    delete mpMapPublisher;
+    delete mpFramePublisher;
+#endif
+    if(mpJournal!=MapJournal::Global())
+        delete mpJournal;
+    delete mpMapDB;
+}
+
+void System::SetSession(const std::string &strName, ORBVocabulary* pVocabulary, SharedWorkers* pWorkers)
+{
+    mstrSession = strName;
+    mstrGeneratedDir = ros::package::getPath("orb_slam")+"/generated/"+strName+"/";
+    mNH = ros::NodeHandle(strName);
+    mstrFramePrefix = strName+"/";
+    mpVocabulary = pVocabulary;
+    mpSharedWorkers = pWorkers;
+}
+
+bool System::Init()
+{
+    // Load Settings and Check
+    cv::FileStorage fsSettings(mstrSettingsFile.c_str(), cv::FileStorage::READ);
+    if(!fsSettings.isOpened())
+    {
+        ROS_ERROR("Wrong path to settings. Path must be absolute or relative to ORB_SLAM package directory.");
+        return false;
+    }
+
+#ifndef ORB_SLAM_HEADLESS
+    //Create Frame Publisher for image_view
+    mpFramePublisher = new FramePublisher(&mFpsCounter, fsSettings["FramePublisher.Scale"], fsSettings["FramePublisher.JpegQuality"], mNH);
+    mpFramePublisher->SetMaxRate(fsSettings["FramePublisher.MaxRate"]);
+#endif
+
+    //Threads used to convert the descriptors of a frame or keyframe to BoW, a shared vocabulary is set by its host
+    const bool bSharedVoc = mpVocabulary!=&mVocabulary;
+    if(!bSharedVoc)
+    {
+        int nVocThreads = fsSettings["Vocabulary.nThreads"];
+        mVocabulary.setTransformThreads(nVocThreads);
+    }
+
+    //Load ORB Vocabulary and create the map database
+    //In the background tracking extracts and initializes meanwhile, the restored maps need it at once
+    int nAsyncVoc = fsSettings["Vocabulary.Async"];
+    const bool bMapFile = !mstrMapFile.empty() && boost::filesystem::exists(mstrMapFile);
+    //The log of the changes since the map file was saved is replayed at once too
+    //Each session of a host logs to a journal of its own, next to its map file
+    int nJournal = fsSettings["MapDatabase.Journal"];
+    const bool bJournal = nJournal && !mstrMapFile.empty();
+    if(bSharedVoc)
+    {
+        //Loaded by the host before any session
+        mpMapDB = new MapDatabase(mpVocabulary);
+    }
+    else if(nAsyncVoc && !bMapFile && !bJournal)
+    {
+        if(!boost::filesystem::exists(mstrVocFile))
+        {
+            ROS_ERROR("Wrong path to vocabulary. Path must be absolute or relative to ORB_SLAM package directory.");
+            return false;
+        }
+        mpMapDB = new MapDatabase(&mVocabulary, false);
+        mpVocabularyThread = new boost::thread(&System::LoadVocabularyAsync, this);
+    }
+    else
+    {
+        if(!LoadVocabulary(mVocabulary, mstrVocFile))
+            return false;
+        mpMapDB = new MapDatabase(&mVocabulary);
+    }
+    mpJournal = mstrSession.empty() ? MapJournal::Global() : new MapJournal;
+    mpMapDB->setJournal(mpJournal);
+
+#ifndef ORB_SLAM_HEADLESS
+    mpFramePublisher->SetMapDB(mpMapDB);
+
+    //Create Map Publisher for Rviz
+    mpMapPublisher = new MapPublisher(mpMapDB, mNH, mstrFramePrefix);
+    mpMapPublisher->SetChunkSize(fsSettings["MapPublisher.nChunkSize"]);
+    mpMapPublisher->SetDetail(fsSettings["MapPublisher.nMaxKeyFrames"], fsSettings["MapPublisher.nMaxPoints"],
+                              fsSettings["MapPublisher.nMinObservations"], fsSettings["MapPublisher.nMaxCovisibilityEdges"],
+                              fsSettings["MapPublisher.DetailRadius"]);
+#endif
+
+    //Page out the inactive maps once the keyframes use more memory than the budget
+    int nMemoryBudgetMB = fsSettings["MapDatabase.nMemoryBudgetMB"];
+    if(nMemoryBudgetMB>0)
+    {
+        std::string strPageDir = mstrGeneratedDir+"pages";
+        boost::filesystem::create_directories(strPageDir);
+        int nCompactPaging = fsSettings["MapDatabase.CompactPaging"];
+        mpMapDB->setMemoryBudget((size_t)nMemoryBudgetMB*1024*1024, strPageDir, nCompactPaging);
+    }
+
+    //Rank the keyframes on a coarse level of the vocabulary, only the shortlist is scored with the words
+    int nShortlist = fsSettings["MapDatabase.Shortlist"];
+    if(nShortlist>0)
+    {
+        int nShortlistLevelsUp = fsSettings["MapDatabase.ShortlistLevelsUp"];
+        if(nShortlistLevelsUp<=0)
+            nShortlistLevelsUp = 2;
+        mpMapDB->setShortlist(nShortlist, nShortlistLevelsUp);
+    }
+
+    //Place recognition only looks near the position prior of the query, if any
+    mpMapDB->setPriorRadius(fsSettings["PositionPrior.Radius"]);
+
+    //Restore the maps of a previous run, they are saved back to the same file on shutdown
+    bool bMapLoaded = false;
+    if(bMapFile)
+    {
+        ros::WallTime tLoad = ros::WallTime::now();
+        bMapLoaded = MapSerializer::Load(mpMapDB, mstrMapFile);
+        if(bMapLoaded)
+            ROS_INFO("Maps loaded in %.2f s!", (ros::WallTime::now()-tLoad).toSec());
+        else
+            ROS_ERROR("Unable to load the maps, starting with an empty map database.");
+    }
+
+    //Replay the changes logged after the map file was saved, and log the next ones
+    if(bJournal)
+    {
+        ros::WallTime tReplay = ros::WallTime::now();
+        if(mpJournal->Open(mpMapDB, mstrMapFile, fsSettings["MapDatabase.JournalSyncPeriod"],
+                           fsSettings["MapDatabase.JournalCompactPeriod"]))
+        {
+            if(mpJournal->Replayed()>0)
+                ROS_INFO("Map journal replayed in %.2f s!", (ros::WallTime::now()-tReplay).toSec());
+        }
+        else
+            ROS_WARN("Unable to open the map journal, the maps are only saved on shutdown.");
+    }
+
+    //Threads used to verify loop and merge candidates
+    int nLoopThreads = fsSettings["LoopClosing.nThreads"];
+    if(nLoopThreads<1)
+        nLoopThreads=1;
+
+    //Keep Local Mapping running while the essential graph of a loop is optimized
+    int nConcurrentLoopCorrection = fsSettings["LoopClosing.Concurrent"];
+
+    //Global BA of the map after each loop, on a background thread
+    int nGlobalBAIterations = fsSettings["LoopClosing.GlobalBAIterations"];
+
+    //Bound on the wait of a keyframe for its loop and merge queries, and share of the time spent in them
+    float fLoopMaxLatency = fsSettings["LoopClosing.MaxLatency"];
+    float fLoopMaxDuty = fsSettings["LoopClosing.MaxDuty"];
+
+    //Workers shared by the parallel kernels of all the threads, started with the first task
+    TaskPool::Global()->SetThreads(fsSettings["System.nPoolThreads"]);
+
+    //Threads used to verify relocalisation candidates
+    int nRelocThreads = fsSettings["Relocalization.nThreads"];
+    if(nRelocThreads<1)
+        nRelocThreads=1;
+
+    //Threads used to match and triangulate the neighbors of a new keyframe
+    int nMappingThreads = fsSettings["LocalMapping.nThreads"];
+    if(nMappingThreads<1)
+        nMappingThreads=1;
+
+    //Keyframes batched into one local BA, and time given to triangulation and fusion while keyframes wait
+    int nMappingBatch = fsSettings["LocalMapping.nMaxBatch"];
+    float fMappingStageBudget = fsSettings["LocalMapping.StageBudget"];
+
+    //Keyframes and points kept per cell of space in a long lived map
+    float fSparsifyCellSize = fsSettings["LocalMapping.SparsifyCellSize"];
+    int nSparsifyKeyFrames = fsSettings["LocalMapping.SparsifyMaxKeyFrames"];
+    int nSparsifyPoints = fsSettings["LocalMapping.SparsifyMaxPoints"];
+
+    //Keyframes between local BAs of the whole window
+    int nLocalBAFullPeriod = fsSettings["LocalMapping.LocalBAFullPeriod"];
+
+    //Global BA of the dormant maps, on request and optionally while relocalizing
+    int nRefineThreads = fsSettings["MapRefinement.nThreads"];
+    if(nRefineThreads<1)
+        nRefineThreads=2;
+    int nRefineIterations = fsSettings["MapRefinement.Iterations"];
+    if(nRefineIterations<1)
+        nRefineIterations=10;
+    int nRefineIdle = fsSettings["MapRefinement.Idle"];
+
+    //Initialize the Tracking Thread, Local Mapping Thread and Loop Closing Thread
+    mpTracker = new Tracking(mpFramePublisher, mpMapPublisher, mpMapDB, &mFpsCounter, mstrSettingsFile, mNH, mstrFramePrefix);
+    mpRelocalizer = new Relocalization(mpMapDB, nRelocThreads);
+    mpRelocalizer->SetBudget(fsSettings["Relocalization.Budget"]);
+    int nRelocLocalKFs = fsSettings["Relocalization.LocalKeyFrames"];
+    mpRelocalizer->SetLocalWindow(nRelocLocalKFs>0 ? nRelocLocalKFs : 30);
+    mpLocalMapper = new LocalMapping(mpMapDB, nMappingThreads, nMappingBatch, fMappingStageBudget);
+    mpLocalMapper->SetSparsification(fSparsifyCellSize, nSparsifyKeyFrames, nSparsifyPoints);
+    mpLocalMapper->SetLocalBAFullPeriod(nLocalBAFullPeriod);
+    mpLoopCloser = new LoopClosing(mpMapDB, nLoopThreads, nConcurrentLoopCorrection!=0, nGlobalBAIterations);
+    mpMapMerger = new MapMerging(mpMapDB, nLoopThreads);
+    mpMapRefiner = new MapRefiner(mpMapDB, nRefineThreads, nRefineIterations, nRefineIdle!=0);
+    mpLoopCloser->SetScheduling(fLoopMaxLatency, fLoopMaxDuty);
+
+    //Record the pose of every tracked frame, written by a thread of the recorder
+    boost::filesystem::create_directories(mstrGeneratedDir);
+    if(mTrajectoryRecorder.Open(mstrGeneratedDir+"FramePoses.bin"))
+        mpTracker->SetTrajectoryRecorder(&mTrajectoryRecorder);
+    else
+        ROS_WARN("Unable to record the frame trajectory.");
+
+    //Record the keyframes handed to Local Mapping, to replay the back-end on its own
+    std::string strKeyFrameStream = fsSettings["System.KeyFrameStream"];
+    if(!strKeyFrameStream.empty())
+    {
+        if(strKeyFrameStream[0]!='/')
+            strKeyFrameStream = ros::package::getPath("orb_slam")+"/"+strKeyFrameStream;
+        if(mKeyFrameRecorder.Open(strKeyFrameStream, mpVocabulary->size()))
+            mpLocalMapper->SetKeyFrameRecorder(&mKeyFrameRecorder);
+        else
+            ROS_WARN("Unable to record the keyframes to %s.", strKeyFrameStream.c_str());
+    }
+
+    //Set pointers between threads
+    mpTracker->SetThreads(mpLocalMapper, mpLoopCloser, mpMapMerger, mpRelocalizer, mpTracker);
+    mpRelocalizer->SetThreads(mpLocalMapper, mpLoopCloser, mpMapMerger, mpRelocalizer, mpTracker);
+    mpLocalMapper->SetThreads(mpLocalMapper, mpLoopCloser, mpMapMerger, mpRelocalizer, mpTracker);
+    mpLoopCloser->SetThreads(mpLocalMapper, mpLoopCloser, mpMapMerger, mpRelocalizer, mpTracker);
+    mpMapMerger->SetThreads(mpLocalMapper, mpLoopCloser, mpMapMerger, mpRelocalizer, mpTracker);
+    mpMapRefiner->SetThreads(mpLocalMapper, mpLoopCloser, mpMapMerger, mpRelocalizer, mpTracker);
+
+    //Split deployment: tracking and a small local map on the robot, the mapping threads on a server
+    int nRole = fsSettings["System.Role"];
+    if(nRole==MapLink::ROBOT || nRole==MapLink::SERVER)
+    {
+        int nLinkWindow = fsSettings["MapLink.Window"];
+        if(nLinkWindow<=0)
+            nLinkWindow = 10;
+        int nLocalKeyFrames = fsSettings["MapLink.LocalKeyFrames"];
+        if(nLocalKeyFrames<=0)
+            nLocalKeyFrames = 30;
+        const bool bCompression = (int)fsSettings["MapLink.Compression"]!=0;
+        const bool bRecomputeBoW = (int)fsSettings["MapLink.RecomputeBoW"]!=0;
+        int nAgentId = fsSettings["MapLink.AgentId"];
+        if(nAgentId<0)
+            nAgentId = 0;
+        mpMapLink = new MapLink(mpMapDB, static_cast<MapLink::eRole>(nRole), nLinkWindow, nLocalKeyFrames, bCompression, !bRecomputeBoW,
+                                nAgentId);
+        mpMapLink->SetLocalMapper(mpLocalMapper);
+        mpLocalMapper->SetMapLink(mpMapLink);
+        if(nRole==MapLink::SERVER)
+            mpLocalMapper->SetWorkers(fsSettings["MapLink.MappingWorkers"]);
+        ROS_INFO("Split deployment, running as the %s.", nRole==MapLink::ROBOT ? "robot" : "server");
+    }
+
+    //With restored maps, tracking starts by relocalizing in them
+    if(bMapLoaded)
+        mpTracker->ForceRelocalisation();
+
+    //Cores and priorities of the worker threads, Tracking reads its own
+    mRelocalizationConfig = ThreadConfig(fsSettings,"Relocalization");
+    mLocalMappingConfig = ThreadConfig(fsSettings,"LocalMapping");
+    mLoopClosingConfig = ThreadConfig(fsSettings,"LoopClosing");
+    mMapMergingConfig = ThreadConfig(fsSettings,"MapMerging");
+
+    //Shutdown: time given to each thread to finish, and the final global BA
+    float fShutdownTimeout = fsSettings["System.ShutdownTimeout"];
+    if(fShutdownTimeout>0)
+        mfShutdownTimeout = fShutdownTimeout;
+    mnFinalBAIterations = fsSettings["System.FinalBAIterations"];
+
+    //The publishers are refreshed at the camera rate
+    mfFps = fsSettings["Camera.fps"];
+    if(mfFps==0)
+        mfFps=30;
+
+    //Create Stats Publisher for the tracking latency
+    mpStatsPublisher = new StatsPublisher(mfFps, 1.0f, mNH);
+    mpStatsPublisher->SetThreads(mpLocalMapper, mpLoopCloser, mpMapMerger);
+
+    //Memory held by the maps, reported periodically and on request
+    float fMemoryPeriod = fsSettings["Stats.MemoryPeriod"];
+    mpStatsPublisher->SetMapDatabase(mpMapDB, fMemoryPeriod);
+
+    //Operational counters, pushed to statsd and written for the Prometheus textfile collector
+    std::string strStatsdHost = fsSettings["Stats.StatsdHost"];
+    int nStatsdPort = fsSettings["Stats.StatsdPort"];
+    std::string strStatsdPrefix = fsSettings["Stats.StatsdPrefix"];
+    std::string strPrometheusFile = fsSettings["Stats.PrometheusFile"];
+    mpStatsPublisher->SetMetricsExport(strStatsdHost, nStatsdPort>0 ? nStatsdPort : 8125,
+                                       strStatsdPrefix.empty() ? "orb_slam" : strStatsdPrefix, strPrometheusFile);
+
+    //Timeline of all the threads, saved on request and at shutdown
+    int nTrace = fsSettings["System.Trace"];
+    if(nTrace)
+    {
+        int nTraceEvents = fsSettings["System.TraceEvents"];
+        Tracer::Global()->Enable(nTraceEvents>0 ? nTraceEvents : 65536);
+        mpStatsPublisher->SetTraceFile(ros::package::getPath("orb_slam")+"/generated/Trace.json");
+    }
+
+    //Create Cloud Publisher of the map points for downstream consumers, also in the headless build
+    float fCloudRate = fsSettings["CloudPublisher.Rate"];
+    mpCloudPublisher = new CloudPublisher(mpMapDB, fCloudRate, mNH, mstrFramePrefix);
+
+    return true;
+}
+
+void System::Start(ros::NodeHandle* pNH)
+{
+    // Start threads for all, the server only maps the keyframes of the robot
+    const bool bTracking = !mpMapLink || mpMapLink->GetRole()!=MapLink::SERVER;
+    if(pNH && bTracking)
+    {
+        mpTracker->Subscribe(*pNH);
+        mbSubscribed = true;
+    }
+    else if(bTracking)
+        mvpThreads.push_back(new boost::thread(&Tracking::Run,mpTracker));
+    StartWorkers(pNH);
+
+    // Nobody spins for us with a node handle, the publishers get their own thread
+    if(pNH)
+        mpPublisherThread = new boost::thread(&System::RunPublishers,this);
+}
+
+void System::StartMonocular()
+{
+    // Pipelined, the images are extracted in TrackMonocular and tracked in this thread
+    if(mpTracker->isPipelined())
+        mvpThreads.push_back(new boost::thread(&Tracking::RunTracking,mpTracker));
+    StartWorkers(NULL);
+}
+
+void System::StartWorkers(ros::NodeHandle* pNH)
+{
+    const bool bRobot = mpMapLink && mpMapLink->GetRole()==MapLink::ROBOT;
+    const bool bServer = mpMapLink && mpMapLink->GetRole()==MapLink::SERVER;
+
+    // On the workers of the host, their cores and scheduling settings do not apply, the session priority does
+    if(mpSharedWorkers)
+    {
+        if(!bServer)
+            mpSharedWorkers->Add(mpRelocalizer,mRelocalizationConfig.mnPoolDemotion);
+        mpSharedWorkers->Add(mpLocalMapper,mLocalMappingConfig.mnPoolDemotion);
+        if(!bRobot)
+        {
+            mpSharedWorkers->Add(mpLoopCloser,mLoopClosingConfig.mnPoolDemotion);
+            mpSharedWorkers->Add(mpMapMerger,mMapMergingConfig.mnPoolDemotion);
+        }
+    }
+    else
+    {
+        if(!bServer)
+            mvpThreads.push_back(new boost::thread(&ThreadConfig::Run,mRelocalizationConfig,
+                                                   boost::function<void()>(boost::bind(&Relocalization::Run,mpRelocalizer))));
+        mvpThreads.push_back(new boost::thread(&ThreadConfig::Run,mLocalMappingConfig,
+                                               boost::function<void()>(boost::bind(&LocalMapping::Run,mpLocalMapper))));
+        if(!bRobot)
+        {
+            mvpThreads.push_back(new boost::thread(&ThreadConfig::Run,mLoopClosingConfig,
+                                                   boost::function<void()>(boost::bind(&LoopClosing::Run,mpLoopCloser))));
+            mvpThreads.push_back(new boost::thread(&ThreadConfig::Run,mMapMergingConfig,
+                                                   boost::function<void()>(boost::bind(&MapMerging::Run,mpMapMerger))));
+        }
+    }
+    if(!bRobot)
+    {
+        // Only waits for requests, the optimizations run on threads of their own at idle priority
+        mvpThreads.push_back(new boost::thread(&MapRefiner::Run,mpMapRefiner));
+        mpMapRefiner->Advertise(pNH ? *pNH : mNH);
+        mpMapRefiner->Release();
+    }
+
+    if(mpMapLink)
+    {
+        mpMapLink->Start(pNH ? *pNH : mNH);
+    }
+
+    // Nothing tracks on the server to release the mapping threads once there is a map
+    if(bServer)
+    {
+        mpLocalMapper->Release();
+        mpLoopCloser->Release();
+        mpMapMerger->Release();
+    }
+}
+
+cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
+{
+    mpTracker->TrackImage(im,timestamp);
+    return mpTracker->GetLastPose();
+}
+
+bool System::LoadVocabulary(ORBVocabulary &vocabulary, const std::string &strVocFile)
+{
+    ros::WallTime tLoad = ros::WallTime::now();
+
+    //Binary vocabularies (.bin, see dbow2 convert_vocabulary) are mapped in place, YAML ones are parsed
+    if(boost::filesystem::extension(strVocFile)==".bin")
+    {
+        try
+        {
+            vocabulary.loadFromBinaryFile(strVocFile);
+        }
+        catch(const std::string &error)
+        {
+            ROS_ERROR("Wrong path to vocabulary. Path must be absolute or relative to ORB_SLAM package directory. %s", error.c_str());
+            return false;
+        }
+    }
+    else
+    {
+        std::cout << std::endl << "Loading ORB Vocabulary. This could take a while." << std::endl;
+        cv::FileStorage fsVoc(strVocFile.c_str(), cv::FileStorage::READ);
+        if(!fsVoc.isOpened())
+        {
+            ROS_ERROR("Wrong path to vocabulary. Path must be absolute or relative to ORB_SLAM package directory.");
+            return false;
+        }
+        vocabulary.load(fsVoc);
+    }
+    ROS_INFO("Vocabulary loaded in %.2f s: %u words, k=%d, L=%d", (ros::WallTime::now()-tLoad).toSec(), vocabulary.size(),
+             vocabulary.getBranchingFactor(), vocabulary.getDepthLevels());
+    return true;
+}
+
+void System::LoadVocabularyAsync()
+{
+    const bool bLoaded = LoadVocabulary(mVocabulary, mstrVocFile);
+    mpMapDB->setVocabLoaded(bLoaded);
+    //Without it there is no mapping nor relocalization, the node is stopped as if Init failed
+    if(!bLoaded)
+        ros::shutdown();
+}
+
+void System::RunPublishers()
+{
+    // The publishers read map objects, culled ones are not reclaimed while they draw
+    int nEpochId = EpochReclaimer::Global()->Register();
+
+    ros::Rate r1(mfFps);
+    while(ros::ok() && RefreshPublishers(nEpochId))
+    {
+        // Sleep at our fps
+        r1.sleep();
+    }
+
+    EpochReclaimer::Global()->Unregister(nEpochId);
+}
+
+bool System::RefreshPublishers(int nEpochId)
+{
+    {
+        boost::mutex::scoped_lock lock(mMutexShutdown);
+        if(mbShutdownRequested)
+            return false;
+    }
+
+    // Call each publisher to update
+    mpStatsPublisher->Refresh();
+    mpCloudPublisher->Refresh();
+#ifndef ORB_SLAM_HEADLESS
+    mpFramePublisher->Refresh();
+    mpMapPublisher->Refresh();
+#endif
+    EpochReclaimer::Global()->Quiescent(nEpochId);
+    // If tracking needs to delete a map
+    // Check if a stop is requested
+    if(mpTracker->publishersStopRequested())
+    {
+        ros::Rate r2(200);
+        while(mpTracker->publishersStopRequested() && ros::ok())
+        {
+            mpTracker->publishersSetStop(true);
+            r2.sleep();
+        }
+#ifndef ORB_SLAM_HEADLESS
+        // Clear out all old data
+        mpFramePublisher->Reset();
+        mpMapPublisher->Reset();
+#endif
+        mpCloudPublisher->Reset();
+    }
+    // Show that we are running
+    mpTracker->publishersSetStop(false);
+    return true;
+}
+
+float System::GetFps()
+{
+    return mfFps;
+}
+
+void System::Shutdown()
+{
+    {
+        boost::mutex::scoped_lock lock(mMutexShutdown);
+        if(mbShutdown)
+            return;
+        mbShutdownRequested = true;
+        mbShutdown = true;
+    }
+
+    if(mpPublisherThread)
+    {
+        mpPublisherThread->join();
+        delete mpPublisherThread;
+        mpPublisherThread = NULL;
+    }
+
+    // Nothing was built if Init failed
+    if(!mpMapDB)
+        return;
+
+    // The vocabulary loading is not interruptible, the threads waiting for it are released when it ends
+    if(mpVocabularyThread)
+    {
+        mpVocabularyThread->join();
+        delete mpVocabularyThread;
+        mpVocabularyThread = NULL;
+    }
+
+    ros::WallTime tShutdown = ros::WallTime::now();
+    mbFinished = FinishThreads();
+
+    // Nothing else touches the maps now, unless a thread did not finish
+    if(mnFinalBAIterations>0)
+    {
+        if(mbFinished)
+        {
+            MapDatabase::MapList pMaps = mpMapDB->getMaps();
+            for(size_t i=0; i<pMaps->size(); i++)
+            {
+                Map* pMap = pMaps->at(i);
+                if(pMap->getErased() || pMap->KeyFramesInMap()<2)
+                    continue;
+                // Paged out keyframes are faulted in for the BA
+                pMap->Pin();
+                Optimizer::GlobalBundleAdjustemnt(pMap,mnFinalBAIterations,NULL,Optimizer::UseIterative(pMap->KeyFramesInMap()));
+                pMap->Unpin();
+            }
+            ROS_INFO("Final global BA done in %.2f s", (ros::WallTime::now()-tShutdown).toSec());
+        }
+        else
+            ROS_WARN("Skipping the final global BA, not all the threads finished.");
+    }
+
+    SaveResults();
+    ROS_INFO("Shutdown in %.2f s", (ros::WallTime::now()-tShutdown).toSec());
+}
+
+bool System::FinishThreads()
+{
+    if(mbSubscribed)
+    {
+        mpTracker->Unsubscribe();
+        mbSubscribed = false;
+    }
+    if(mpMapLink)
+        mpMapLink->Stop();
+
+    // Each one returns at its next safe point, a running local BA is aborted
+    mpTracker->RequestFinish();
+    mpRelocalizer->RequestFinish();
+    mpLocalMapper->RequestFinish();
+    mpLocalMapper->InterruptBA();
+    mpLoopCloser->RequestFinish();
+    mpMapMerger->RequestFinish();
+    mpMapRefiner->RequestFinish();
+
+    // The host stopped its workers before, Run is not there to stop the global BA
+    if(mpSharedWorkers)
+        mpLoopCloser->StopGlobalBA();
+
+    const boost::posix_time::time_duration timeout = boost::posix_time::milliseconds((long)(mfShutdownTimeout*1000));
+    bool bFinished = true;
+    for(size_t i=0; i<mvpThreads.size(); i++)
+    {
+        if(!mvpThreads[i]->timed_join(timeout))
+        {
+            ROS_WARN("A thread did not finish within %.1f s, leaving it running.", mfShutdownTimeout);
+            bFinished = false;
+        }
+    }
+    return bFinished;
+}
+
+void System::SaveResults()
+{
+    // Nice new line
+    std::cout << std::endl;
+
+    // The frame records live in the generated folder, read them back before it is cleared
+    mTrajectoryRecorder.Close();
+    if(mKeyFrameRecorder.Recorded()>0)
+    {
+        mKeyFrameRecorder.Close();
+        ROS_INFO("%lu keyframes recorded for replay.", mKeyFrameRecorder.Recorded());
+    }
+    std::vector<TrajectoryRecorder::FramePose> vFramePoses;
+    mTrajectoryRecorder.ReadAll(vFramePoses);
+    if(mTrajectoryRecorder.Dropped()>0)
+        ROS_WARN("%d frame poses were dropped by the trajectory recorder.", (int)mTrajectoryRecorder.Dropped());
+
+    // Create our directory if needed, and clear the old generated folder
+    boost::filesystem::path path = mstrGeneratedDir;
+    boost::filesystem::create_directories(path);
+    for (boost::filesystem::directory_iterator end_dir_it, it(path); it!=end_dir_it; ++it) {
+        boost::filesystem::remove_all(it->path());
+    }
+
+    // The host of the sessions saves the reports of the process once they are all done
+    if(mstrSession.empty())
+        SaveProcessReports(mstrGeneratedDir);
+
+    // Save keyframe poses at the end of the execution
+    MapDatabase::MapList pMaps = mpMapDB->getMaps();
+    for (std::size_t i = 0; i < pMaps->size(); ++i) {
+        // Check if erased
+        if(pMaps->at(i)->getErased())
+            continue;
+        // Export information
+        std::ostringstream oss;
+        oss << mstrGeneratedDir << "KeyFrameTrajectory_" << i << ".txt";
+        std::cout << "Saving Data:   " << oss.str() << std::endl;
+        // Timestamp: t
+        // Position: x, y, z
+        // Quaternions: q0, q1, q2, q3
+        if(!pMaps->at(i)->SaveKeyFrameTrajectory(oss.str()))
+            std::cout << "Error saving keyframe trajectory!" << std::endl;
+    }
+
+    // Save the pose of every tracked frame
+    SaveFrameTrajectories(vFramePoses, mstrGeneratedDir);
+
+    // Save the maps for the next run, they supersede the journal
+    mpJournal->Close();
+    if(!mstrMapFile.empty())
+    {
+        std::cout << "Saving Data:   " << mstrMapFile << std::endl;
+        if(!MapSerializer::Save(mpMapDB, mstrMapFile))
+            std::cout << "Error saving maps!" << std::endl;
+    }
+}
+
+void System::SaveFrameTrajectories(const std::vector<TrajectoryRecorder::FramePose> &vPoses, const std::string &strDir)
+{
+    typedef Eigen::Map<const Eigen::Matrix<float,3,3,Eigen::RowMajor> > MapMatrix3f;
+    typedef Eigen::Map<const Eigen::Vector3f> MapVector3f;
+
+    MapDatabase::MapList pMaps = mpMapDB->getMaps();
+    for(size_t i=0; i<pMaps->size(); i++)
+    {
+        Map* pMap = pMaps->at(i);
+        if(pMap->getErased())
+            continue;
+
+        // Merged maps keep the ids of their keyframes, the frames follow them through the reference
+        boost::shared_ptr<const MapSnapshot> pSnapshot = pMap->GetSnapshot();
+
+        std::string buffer;
+        for(size_t j=0; j<vPoses.size(); j++)
+        {
+            const TrajectoryRecorder::FramePose &pose = vPoses[j];
+            const MapSnapshot::KeyFrameState* pRefKF = pSnapshot->FindKeyFrame(pose.nRefKFId);
+
+            Eigen::Matrix3f Rcw;
+            Eigen::Vector3f tcw;
+            if(pRefKF)
+            {
+                // Tcw = Tcr*Trw, with the optimized pose of the keyframe
+                const MapMatrix3f Rcr(pose.Rcr);
+                Rcw = Rcr*pRefKF->pose.Rcw();
+                tcw = Rcr*pRefKF->pose.tcw()+MapVector3f(pose.tcr);
+            }
+            else if(pose.nMapId==pMap->mnId)
+            {
+                // The reference was culled, the pose at tracking time is kept
+                Rcw = MapMatrix3f(pose.Rcw);
+                tcw = MapVector3f(pose.tcw);
+            }
+            else
+                continue;
+
+            const Eigen::Matrix3f Rwc = Rcw.transpose();
+            Converter::appendTrajectoryLine(buffer, pose.timeStamp, Rwc, -Rwc*tcw);
+        }
+
+        if(buffer.empty())
+            continue;
+
+        std::ostringstream oss;
+        oss << strDir << "FrameTrajectory_" << i << ".txt";
+        std::cout << "Saving Data:   " << oss.str() << std::endl;
+        std::ofstream f(oss.str().c_str(), std::ios::binary);
+        f.write(buffer.data(), buffer.size());
+        if(f.fail())
+            std::cout << "Error saving frame trajectory!" << std::endl;
+    }
+}
+
+void System::SaveProcessReports(const std::string &strDir)
+{
+    // Save the tracking latency of the whole run
+    std::cout << "Saving Data:   " << strDir << "TrackingLatency.csv" << std::endl;
+    if(!LatencyStats::Global()->SaveCSV(strDir+"TrackingLatency.csv"))
+        std::cout << "Error saving tracking latency!" << std::endl;
+
+    // Save the allocations per stage of the whole run
+    if(AllocationStats::isEnabled())
+    {
+        std::cout << "Saving Data:   " << strDir << "Allocations.csv" << std::endl;
+        if(!AllocationStats::Global()->SaveCSV(strDir+"Allocations.csv"))
+            std::cout << "Error saving the allocations!" << std::endl;
+    }
+
+    // Save the timeline of the threads
+    if(Tracer::isEnabled())
+    {
+        std::cout << "Saving Data:   " << strDir << "Trace.json" << std::endl;
+        if(!Tracer::Global()->SaveChromeJSON(strDir+"Trace.json"))
+            std::cout << "Error saving the trace!" << std::endl;
+    }
+
+    // Save the lock contention of the whole run
+    if(LockProfiler::isEnabled())
+    {
+        ROS_INFO("%s", LockProfiler::Global()->Report().c_str());
+        std::cout << "Saving Data:   " << strDir << "LockProfile.csv" << std::endl;
+        if(!LockProfiler::Global()->SaveCSV(strDir+"LockProfile.csv"))
+            std::cout << "Error saving the lock profile!" << std::endl;
+    }
+}
+
+Tracking* System::GetTracker()
+{
+    return mpTracker;
+}
+
+MapDatabase* System::GetMapDatabase()
+{
+    return mpMapDB;
+}
+
+} //namespace ORB_SLAM
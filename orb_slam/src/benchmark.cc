@@ -0,0 +1,1081 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Offline benchmark of the full pipeline
+// Reads an image sequence (TUM, KITTI, EuRoC folders or a rosbag) and feeds it to Tracking
+// with Local Mapping, Loop Closing and Map Merging running as usual.
+// Modes:
+// - lockstep: each image waits until the mapping threads are idle, reproducible between runs
+// - fast: images are fed as fast as Tracking takes them
+// - deterministic: no thread is started, after each image Relocalization, Local Mapping, Loop Closing and
+//   Map Merging are stepped in this order until they have nothing left to do. The parallel kernels run
+//   their tasks in order in this thread, the feature budget does not adapt. Two runs take the same decisions,
+//   so their profiles and maps (KeyFrameTrajectory_*.txt) can be compared
+// - kernels: lockstep, then the core kernels are timed on synthetic inputs and on the map (Kernels.csv)
+//   A Kernels.csv of a previous run given as baseline is compared with, the slower kernels are flagged
+// With OpenMP, local and global BA of the largest map are timed at the end with 1, 2, 4... threads
+// With the ground truth of the sequence, the keyframe trajectory of each map is aligned to it and its
+// ATE and RPE are reported next to the latency and memory of the frames tracked in that map (Accuracy.csv)
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <ros/ros.h>
+#include <ros/package.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <cv_bridge/cv_bridge.h>
+#include <sensor_msgs/Image.h>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "types/Map.h"
+#include "types/MapDatabase.h"
+#include "types/ORBVocabulary.h"
+#include "types/Camera.h"
+#include "types/KeyFrameDatabase.h"
+
+#include "threads/Tracking.h"
+#include "threads/Relocalization.h"
+#include "threads/MapMerging.h"
+#include "threads/LocalMapping.h"
+#include "threads/LoopClosing.h"
+
+#ifndef ORB_SLAM_HEADLESS
+#include "publishers/FramePublisher.h"
+#include "publishers/MapPublisher.h"
+#endif
+
+#include "util/FpsCounter.h"
+#include "util/LatencyStats.h"
+#include "util/AllocationStats.h"
+#include "util/Optimizer.h"
+#include "util/EpochReclaimer.h"
+#include "util/Converter.h"
+#include "util/ORBmatcher.h"
+#include "util/FrustumCuller.h"
+#include "util/PnPsolver.h"
+#include "util/Sim3Solver.h"
+#include "util/Initializer.h"
+#include "util/KernelBenchmark.h"
+#include "util/TaskPool.h"
+#include "util/TrajectoryEvaluation.h"
+#include "util/MemoryStats.h"
+
+
+using namespace std;
+
+
+// An image of the sequence, loaded from a file or taken from a bag
+struct SequenceImage
+{
+    double timestamp;
+    string filename;
+    sensor_msgs::ImageConstPtr msg;
+};
+
+// Absolute paths are used as they are, relative paths are relative to the package directory
+static string ResolvePath(const string &path)
+{
+    if(!path.empty() && path[0]=='/')
+        return path;
+    return ros::package::getPath("orb_slam")+"/"+path;
+}
+
+static bool EndsWith(const string &s, const string &suffix)
+{
+    return s.size()>=suffix.size() && s.compare(s.size()-suffix.size(),suffix.size(),suffix)==0;
+}
+
+// Resident and peak memory of the process in kB, from /proc/self/status
+static void ReadMemory(long &rss, long &peak)
+{
+    rss = 0;
+    peak = 0;
+    ifstream f("/proc/self/status");
+    string line;
+    while(getline(f,line))
+    {
+        if(line.compare(0,6,"VmRSS:")==0)
+            rss = atol(line.c_str()+6);
+        else if(line.compare(0,6,"VmHWM:")==0)
+            peak = atol(line.c_str()+6);
+    }
+}
+
+// TUM RGB-D: rgb.txt with "timestamp filename" lines
+static bool LoadTUM(const string &path, vector<SequenceImage> &vImages)
+{
+    ifstream f((path+"/rgb.txt").c_str());
+    if(!f.is_open())
+        return false;
+    string line;
+    while(getline(f,line))
+    {
+        if(line.empty() || line[0]=='#')
+            continue;
+        stringstream ss(line);
+        SequenceImage image;
+        string filename;
+        ss >> image.timestamp >> filename;
+        image.filename = path+"/"+filename;
+        vImages.push_back(image);
+    }
+    return true;
+}
+
+// KITTI odometry: times.txt in seconds and image_0/%06d.png
+static bool LoadKITTI(const string &path, vector<SequenceImage> &vImages)
+{
+    ifstream f((path+"/times.txt").c_str());
+    if(!f.is_open())
+        return false;
+    string line;
+    while(getline(f,line))
+    {
+        if(line.empty())
+            continue;
+        stringstream ss(line);
+        SequenceImage image;
+        ss >> image.timestamp;
+        char filename[32];
+        sprintf(filename,"/image_0/%06d.png",(int)vImages.size());
+        image.filename = path+filename;
+        vImages.push_back(image);
+    }
+    return true;
+}
+
+// EuRoC MAV: cam0/data.csv with "timestamp [ns],filename" lines and cam0/data/
+static bool LoadEuRoC(const string &path, vector<SequenceImage> &vImages)
+{
+    string cam = path+"/cam0";
+    if(!boost::filesystem::exists(cam))
+        cam = path+"/mav0/cam0";
+    ifstream f((cam+"/data.csv").c_str());
+    if(!f.is_open())
+        return false;
+    string line;
+    while(getline(f,line))
+    {
+        if(line.empty() || line[0]=='#')
+            continue;
+        const size_t comma = line.find(',');
+        if(comma==string::npos)
+            continue;
+        SequenceImage image;
+        image.timestamp = atof(line.substr(0,comma).c_str())*1e-9;
+        string filename = line.substr(comma+1);
+        // Strip the windows line ending of some releases
+        if(!filename.empty() && filename[filename.size()-1]=='\r')
+            filename.erase(filename.size()-1);
+        image.filename = cam+"/data/"+filename;
+        vImages.push_back(image);
+    }
+    return true;
+}
+
+// Images of one topic of a rosbag, kept in memory
+static bool LoadBag(const string &path, const string &topic, vector<SequenceImage> &vImages)
+{
+    rosbag::Bag bag;
+    try
+    {
+        bag.open(path, rosbag::bagmode::Read);
+    }
+    catch (rosbag::BagException& e)
+    {
+        ROS_ERROR("rosbag exception: %s", e.what());
+        return false;
+    }
+
+    rosbag::View view(bag, rosbag::TopicQuery(topic));
+    BOOST_FOREACH(rosbag::MessageInstance const m, view)
+    {
+        sensor_msgs::ImageConstPtr msg = m.instantiate<sensor_msgs::Image>();
+        if(msg == NULL)
+            continue;
+        SequenceImage image;
+        image.timestamp = msg->header.stamp.toSec();
+        image.msg = msg;
+        vImages.push_back(image);
+    }
+    bag.close();
+    return true;
+}
+
+// Ground truth of the sequence, found next to the images unless a file is given
+// TUM groundtruth.txt, EuRoC state_groundtruth_estimate0/data.csv, KITTI poses.txt (one line per image)
+static bool LoadGroundTruth(const string &path, const string &format, const string &filename,
+                            const vector<SequenceImage> &vImages, ORB_SLAM::TrajectoryEvaluation::Trajectory &groundTruth)
+{
+    string file = filename;
+    if(file.empty())
+    {
+        if(format=="tum")
+            file = path+"/groundtruth.txt";
+        else if(format=="kitti")
+            file = path+"/poses.txt";
+        else if(format=="euroc")
+            file = boost::filesystem::exists(path+"/mav0") ? path+"/mav0/state_groundtruth_estimate0/data.csv"
+                                                           : path+"/state_groundtruth_estimate0/data.csv";
+        if(!boost::filesystem::exists(file))
+            return false;
+    }
+
+    if(format=="kitti")
+    {
+        vector<double> vTimestamps(vImages.size());
+        for(size_t i=0; i<vImages.size(); i++)
+            vTimestamps[i] = vImages[i].timestamp;
+        return ORB_SLAM::TrajectoryEvaluation::LoadKITTI(file,vTimestamps,groundTruth);
+    }
+    if(EndsWith(file,".csv"))
+        return ORB_SLAM::TrajectoryEvaluation::LoadEuRoC(file,groundTruth);
+    return ORB_SLAM::TrajectoryEvaluation::LoadTUM(file,groundTruth);
+}
+
+// Poses of the keyframes of a map, as saved in KeyFrameTrajectory_*.txt
+static void KeyFrameTrajectory(ORB_SLAM::Map* pMap, ORB_SLAM::TrajectoryEvaluation::Trajectory &trajectory)
+{
+    vector<ORB_SLAM::KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        if(vpKFs[i]->isBad())
+            continue;
+        ORB_SLAM::TrajectoryEvaluation::StampedPose pose;
+        pose.timestamp = vpKFs[i]->mTimeStamp;
+        pose.q = Eigen::Quaterniond(ORB_SLAM::Converter::toMatrix3d(vpKFs[i]->GetRotation().t()));
+        pose.t = ORB_SLAM::Converter::toVector3d(vpKFs[i]->GetCameraCenter());
+        trajectory.push_back(pose);
+    }
+}
+
+// Frames tracked while a map was the current one
+struct MapSegment
+{
+    ORB_SLAM::LatencyHistogram latency;
+    long peakRss;
+
+    MapSegment(): peakRss(0) {}
+};
+
+static cv::Mat ReadImage(const SequenceImage &image)
+{
+    if(image.msg)
+    {
+        try
+        {
+            return cv_bridge::toCvCopy(image.msg, "mono8")->image;
+        }
+        catch (cv_bridge::Exception& e)
+        {
+            ROS_ERROR("cv_bridge exception: %s", e.what());
+            return cv::Mat();
+        }
+    }
+    return cv::imread(image.filename, CV_LOAD_IMAGE_GRAYSCALE);
+}
+
+// The mapping threads have nothing left to do with the keyframes inserted so far
+static bool MappingIdle(ORB_SLAM::Tracking &Tracker, ORB_SLAM::LocalMapping &LocalMapper, ORB_SLAM::LoopClosing &LoopCloser)
+{
+    if(Tracker.FramesInQueue()>0)
+        return false;
+    if(LocalMapper.isStopped())
+        return true;
+    return LocalMapper.KeyframesInQueue()==0 && LocalMapper.AcceptKeyFrames() && LoopCloser.KeyframesInQueue()==0;
+}
+
+
+// Back-end steps after an image in the deterministic mode, in a fixed order until no thread has work left
+// Each keyframe goes through Local Mapping, then Loop Closing and Map Merging before the next one
+static void StepBackEnd(ORB_SLAM::Relocalization &Relocalizer, ORB_SLAM::LocalMapping &LocalMapper,
+                        ORB_SLAM::LoopClosing &LoopCloser, ORB_SLAM::MapMerging &MapMerger)
+{
+    Relocalizer.RunStep();
+
+    bool bWork = true;
+    while(bWork && ros::ok())
+    {
+        bWork = LocalMapper.RunStep();
+        bWork = LoopCloser.RunStep() || bWork;
+        bWork = MapMerger.RunStep() || bWork;
+    }
+}
+
+
+#ifdef _OPENMP
+// Largest difference between two BA results over the same keyframes and points
+static double MaxDifference(const ORB_SLAM::BundleAdjustmentResult &a, const ORB_SLAM::BundleAdjustmentResult &b)
+{
+    double diff = 0;
+    for(map<ORB_SLAM::KeyFrame*,cv::Mat>::const_iterator it=a.mKeyFramePoses.begin(); it!=a.mKeyFramePoses.end(); it++)
+    {
+        map<ORB_SLAM::KeyFrame*,cv::Mat>::const_iterator jt = b.mKeyFramePoses.find(it->first);
+        if(jt!=b.mKeyFramePoses.end())
+            diff = max(diff,cv::norm(it->second,jt->second,cv::NORM_INF));
+    }
+    for(map<ORB_SLAM::MapPoint*,cv::Mat>::const_iterator it=a.mPointPositions.begin(); it!=a.mPointPositions.end(); it++)
+    {
+        map<ORB_SLAM::MapPoint*,cv::Mat>::const_iterator jt = b.mPointPositions.find(it->first);
+        if(jt!=b.mPointPositions.end())
+            diff = max(diff,cv::norm(it->second,jt->second,cv::NORM_INF));
+    }
+    return diff;
+}
+
+// Times g2o with 1, 2, 4... threads on the window of the last keyframe (local BA) and on the whole map (global BA)
+// The estimates are kept aside, the map is only read. Each run is compared with the single thread one:
+// the threads add into the Hessian in a different order, so only round-off differences are expected
+static void BundleAdjustmentScaling(ORB_SLAM::Map* pMap, const string &strOutput)
+{
+    ORB_SLAM::EpochReclaimer* pReclaimer = ORB_SLAM::EpochReclaimer::Global();
+    const int nEpochId = pReclaimer->Register();
+
+    vector<ORB_SLAM::KeyFrame*> vpAllKFs = pMap->GetAllKeyFrames();
+    vector<ORB_SLAM::MapPoint*> vpAllMPs = pMap->GetAllMapPoints();
+
+    ORB_SLAM::KeyFrame* pLastKF = NULL;
+    for(size_t i=0; i<vpAllKFs.size(); i++)
+        if(!vpAllKFs[i]->isBad() && (!pLastKF || vpAllKFs[i]->mnId>pLastKF->mnId))
+            pLastKF = vpAllKFs[i];
+    if(!pLastKF)
+    {
+        pReclaimer->Unregister(nEpochId);
+        return;
+    }
+
+    vector<ORB_SLAM::KeyFrame*> vpLocalKFs = pLastKF->GetVectorCovisibleKeyFrames();
+    vpLocalKFs.push_back(pLastKF);
+    set<ORB_SLAM::MapPoint*> sLocalMPs;
+    for(size_t i=0; i<vpLocalKFs.size(); i++)
+    {
+        vector<ORB_SLAM::MapPoint*> vpMPs = vpLocalKFs[i]->GetMapPointMatches();
+        for(size_t j=0; j<vpMPs.size(); j++)
+            if(vpMPs[j] && !vpMPs[j]->isBad())
+                sLocalMPs.insert(vpMPs[j]);
+    }
+    vector<ORB_SLAM::MapPoint*> vpLocalMPs(sLocalMPs.begin(),sLocalMPs.end());
+
+    ofstream f((strOutput+"/BAScaling.csv").c_str());
+    f << "problem,keyframes,mappoints,threads,time_ms,max_difference" << endl;
+
+    cout << "- BA scaling (" << vpLocalKFs.size() << " / " << vpAllKFs.size() << " keyframes):" << endl;
+
+    const int nMaxThreads = omp_get_max_threads();
+    for(int bGlobal=0; bGlobal<2; bGlobal++)
+    {
+        const vector<ORB_SLAM::KeyFrame*> &vpKFs = bGlobal ? vpAllKFs : vpLocalKFs;
+        const vector<ORB_SLAM::MapPoint*> &vpMPs = bGlobal ? vpAllMPs : vpLocalMPs;
+        const char* name = bGlobal ? "global" : "local";
+
+        ORB_SLAM::BundleAdjustmentResult reference;
+        for(int nThreads=1; ; nThreads = min(2*nThreads,nMaxThreads))
+        {
+            omp_set_num_threads(nThreads);
+            ORB_SLAM::BundleAdjustmentResult result;
+            ros::WallTime t = ros::WallTime::now();
+            ORB_SLAM::Optimizer::BundleAdjustment(vpKFs,vpMPs,result,10);
+            const double time = (ros::WallTime::now()-t).toSec();
+            if(nThreads==1)
+                reference = result;
+            const double diff = MaxDifference(reference,result);
+
+            f << name << "," << vpKFs.size() << "," << vpMPs.size() << "," << nThreads << "," << time*1000 << "," << diff << endl;
+            cout << "  " << name << " BA, " << nThreads << " threads: " << time*1000 << " ms, max difference " << diff << endl;
+
+            if(nThreads==nMaxThreads)
+                break;
+        }
+    }
+    omp_set_num_threads(nMaxThreads);
+
+    pReclaimer->Unregister(nEpochId);
+}
+#endif
+
+// Builds a frame of the sequence, with its bag of words
+static ORB_SLAM::Frame MakeFrame(cv::Mat im, double timestamp, ORB_SLAM::ORBextractor* pExtractor, ORB_SLAM::ORBVocabulary* pVocabulary,
+                                 ORB_SLAM::Camera* pCamera)
+{
+    pCamera->SetImageSize(im.cols,im.rows);
+    ORB_SLAM::Frame F(im,timestamp,pExtractor,pVocabulary,pCamera);
+    F.ComputeBoW();
+    return F;
+}
+
+// Map points of a keyframe and its covisible keyframes
+static vector<ORB_SLAM::MapPoint*> LocalMapPoints(ORB_SLAM::KeyFrame* pKF)
+{
+    vector<ORB_SLAM::KeyFrame*> vpLocalKFs = pKF->GetVectorCovisibleKeyFrames();
+    vpLocalKFs.push_back(pKF);
+    set<ORB_SLAM::MapPoint*> sLocalMPs;
+    for(size_t i=0; i<vpLocalKFs.size(); i++)
+    {
+        vector<ORB_SLAM::MapPoint*> vpMPs = vpLocalKFs[i]->GetMapPointMatches();
+        for(size_t j=0; j<vpMPs.size(); j++)
+            if(vpMPs[j] && !vpMPs[j]->isBad())
+                sLocalMPs.insert(vpMPs[j]);
+    }
+    return vector<ORB_SLAM::MapPoint*>(sLocalMPs.begin(),sLocalMPs.end());
+}
+
+static g2o::Sim3 KeyFrameSim3(ORB_SLAM::KeyFrame* pKF)
+{
+    cv::Mat Tcw = pKF->GetPose();
+    return g2o::Sim3(ORB_SLAM::Converter::toMatrix3d(Tcw.rowRange(0,3).colRange(0,3)),
+                     ORB_SLAM::Converter::toVector3d(Tcw.rowRange(0,3).col(3)),1.0);
+}
+
+// Times the core kernels, once the sequence has been processed
+// Synthetic inputs come from a fixed seed. Real inputs are images of the sequence, the last frames of the tracking
+// and the last keyframes of the map it tracked in. The mapping threads are idle, the kernels that write the map
+// (local BA, applying an identity essential graph correction) leave it as it was up to round-off
+// Results go to Kernels.csv, compared with strBaseline (a Kernels.csv of another run) if given
+static void KernelBenchmarks(ORB_SLAM::Map* pMap, ORB_SLAM::Tracking &Tracker, ORB_SLAM::ORBVocabulary* pVocabulary,
+                             const cv::FileStorage &fsSettings, const vector<SequenceImage> &vImages,
+                             const string &strOutput, const string &strBaseline)
+{
+    ORB_SLAM::EpochReclaimer* pReclaimer = ORB_SLAM::EpochReclaimer::Global();
+    const int nEpochId = pReclaimer->Register();
+
+    ORB_SLAM::KernelBenchmark bench;
+
+    // Same extractor as the tracking
+    int nFeatures = fsSettings["ORBextractor.nFeatures"];
+    float fScaleFactor = fsSettings["ORBextractor.scaleFactor"];
+    int nLevels = fsSettings["ORBextractor.nLevels"];
+    int fastTh = fsSettings["ORBextractor.fastTh"];
+    int Score = fsSettings["ORBextractor.nScoreType"];
+    int nThreads = fsSettings["ORBextractor.nThreads"];
+    if(nThreads<1)
+        nThreads=1;
+    ORB_SLAM::ORBextractor extractor(nFeatures,fScaleFactor,nLevels,Score,fastTh,nThreads);
+    ORB_SLAM::Camera camera(fsSettings,"Camera.",0);
+
+    // Synthetic inputs: a fixed seed image of overlapping boxes (plenty of corners) and random descriptors
+    cv::RNG rng(12345);
+    cv::Mat imSynthetic(480,640,CV_8U,cv::Scalar(128));
+    for(int i=0; i<400; i++)
+    {
+        cv::Point p1(rng.uniform(0,640),rng.uniform(0,480));
+        cv::Point p2(p1.x+rng.uniform(8,80),p1.y+rng.uniform(8,80));
+        cv::rectangle(imSynthetic,p1,p2,cv::Scalar(rng.uniform(0,256)),CV_FILLED);
+    }
+    cv::Mat SyntheticDescriptors(1000,32,CV_8U);
+    rng.fill(SyntheticDescriptors,cv::RNG::UNIFORM,0,256);
+
+    vector<cv::KeyPoint> vKeys;
+    cv::Mat Descriptors;
+
+    bench.Begin("ORBextractor::operator() synthetic 640x480");
+    while(bench.KeepRunning())
+    {
+        extractor(imSynthetic,cv::Mat(),vKeys,Descriptors);
+        bench.Keep(vKeys.size());
+    }
+
+    bench.Begin("ORBmatcher::DescriptorDistance x1000 synthetic");
+    while(bench.KeepRunning())
+    {
+        int dist = 0;
+        for(int i=0; i<SyntheticDescriptors.rows; i++)
+            dist += ORB_SLAM::ORBmatcher::DescriptorDistance(SyntheticDescriptors.row(i),SyntheticDescriptors.row(SyntheticDescriptors.rows-1-i));
+        bench.Keep(dist);
+    }
+
+    DBoW2::BowVector BowVec, BowVec2;
+    DBoW2::FlatFeatureVector FeatVec;
+
+    bench.Begin("TemplatedVocabulary::transform synthetic 1000");
+    while(bench.KeepRunning())
+    {
+        pVocabulary->transform(SyntheticDescriptors,BowVec,FeatVec,ORB_SLAM::FeatureVectorLevelsUp(*pVocabulary));
+        bench.Keep(BowVec.size());
+    }
+
+    // Real images: one in the middle of the sequence, and the first ones for the initialization
+    cv::Mat imReal = ReadImage(vImages[vImages.size()/2]);
+    if(!imReal.empty())
+    {
+        bench.Begin("ORBextractor::operator() sequence image");
+        while(bench.KeepRunning())
+        {
+            extractor(imReal,cv::Mat(),vKeys,Descriptors);
+            bench.Keep(vKeys.size());
+        }
+
+        bench.Begin("TemplatedVocabulary::transform sequence image");
+        while(bench.KeepRunning())
+        {
+            pVocabulary->transform(Descriptors,BowVec,FeatVec,ORB_SLAM::FeatureVectorLevelsUp(*pVocabulary));
+            bench.Keep(BowVec.size());
+        }
+    }
+
+    cv::Mat imIni1 = ReadImage(vImages[0]);
+    cv::Mat imIni2 = ReadImage(vImages[min<size_t>(10,vImages.size()-1)]);
+    if(!imIni1.empty() && !imIni2.empty())
+    {
+        ORB_SLAM::Frame F1 = MakeFrame(imIni1,vImages[0].timestamp,&extractor,pVocabulary,&camera);
+        ORB_SLAM::Frame F2 = MakeFrame(imIni2,vImages[min<size_t>(10,vImages.size()-1)].timestamp,&extractor,pVocabulary,&camera);
+
+        vector<cv::Point2f> vPrevMatched(F1.mvKeysUn.size());
+        for(size_t i=0; i<F1.mvKeysUn.size(); i++)
+            vPrevMatched[i] = F1.mvKeysUn[i].pt;
+
+        ORB_SLAM::ORBmatcher matcher(0.9,true);
+        vector<cv::Point2f> vbPrevMatched;
+        vector<int> vnMatches12;
+
+        bench.Begin("ORBmatcher::SearchForInitialization");
+        while(bench.KeepRunning())
+        {
+            vbPrevMatched = vPrevMatched;
+            bench.Keep(matcher.SearchForInitialization(F1,F2,vbPrevMatched,vnMatches12,100));
+        }
+
+        ORB_SLAM::Initializer initializer(F1,1.0,200);
+        cv::Mat R21, t21;
+        vector<cv::Point3f> vP3D;
+        vector<bool> vbTriangulated;
+
+        bench.Begin("Initializer::Initialize");
+        while(bench.KeepRunning())
+            bench.Keep(initializer.Initialize(F2,vnMatches12,R21,t21,vP3D,vbTriangulated));
+    }
+
+    // Real map: the last keyframe and its best covisible one
+    ORB_SLAM::KeyFrame* pKF = NULL;
+    ORB_SLAM::KeyFrame* pFirstKF = NULL;
+    vector<ORB_SLAM::KeyFrame*> vpAllKFs = pMap->GetAllKeyFrames();
+    for(size_t i=0; i<vpAllKFs.size(); i++)
+    {
+        if(vpAllKFs[i]->isBad())
+            continue;
+        if(!pKF || vpAllKFs[i]->mnId>pKF->mnId)
+            pKF = vpAllKFs[i];
+        if(!pFirstKF || vpAllKFs[i]->mnId<pFirstKF->mnId)
+            pFirstKF = vpAllKFs[i];
+    }
+    vector<ORB_SLAM::KeyFrame*> vpBest = pKF ? pKF->GetBestCovisibilityKeyFrames(1) : vector<ORB_SLAM::KeyFrame*>();
+    ORB_SLAM::KeyFrame* pKF2 = vpBest.empty() ? NULL : vpBest[0];
+
+    if(pKF && pKF2)
+    {
+        ORB_SLAM::ORBmatcher matcher(0.75,true);
+
+        DBoW2::BowVector BowVec1 = pKF->GetBowVector();
+        BowVec2 = pKF2->GetBowVector();
+        DBoW2::FlatBowVector FlatBowVec1, FlatBowVec2;
+        pKF->GetFlatBowVector(FlatBowVec1);
+        pKF2->GetFlatBowVector(FlatBowVec2);
+
+        bench.Begin("TemplatedVocabulary::score");
+        while(bench.KeepRunning())
+            bench.Keep(pVocabulary->score(BowVec1,BowVec2));
+
+        bench.Begin("TemplatedVocabulary::score flat");
+        while(bench.KeepRunning())
+            bench.Keep(pVocabulary->score(FlatBowVec1,FlatBowVec2));
+
+        // Minimum score of the covisible keyframes, as the loop detection does
+        vector<ORB_SLAM::KeyFrame*> vpConnectedKFs = pKF->GetVectorCovisibleKeyFrames();
+        float minScore = 1;
+        for(size_t i=0; i<vpConnectedKFs.size(); i++)
+            if(!vpConnectedKFs[i]->isBad())
+            {
+                DBoW2::FlatBowVector FlatBowVec;
+                vpConnectedKFs[i]->GetFlatBowVector(FlatBowVec);
+                minScore = min(minScore,(float)pVocabulary->score(FlatBowVec1,FlatBowVec));
+            }
+
+        bench.Begin("KeyFrameDatabase::DetectLoopCandidates");
+        while(bench.KeepRunning())
+            bench.Keep(pMap->GetKeyFrameDatabase()->DetectLoopCandidates(pKF,minScore).size());
+
+        vector<ORB_SLAM::MapPoint*> vpMatches12;
+        bench.Begin("ORBmatcher::SearchByBoW keyframe-keyframe");
+        while(bench.KeepRunning())
+            bench.Keep(matcher.SearchByBoW(pKF,pKF2,vpMatches12));
+
+        vector<bool> vbInliers;
+        int nInliers;
+        bool bNoMore;
+
+        // The solver is built in each iteration, as the loop detection does for each candidate
+        bench.Begin("Sim3Solver::iterate 5, with setup");
+        while(bench.KeepRunning())
+        {
+            ORB_SLAM::Sim3Solver solver(pKF,pKF2,vpMatches12);
+            solver.SetRansacParameters(0.99,20,300);
+            bench.Keep(solver.iterate(5,bNoMore,vbInliers,nInliers).empty());
+        }
+
+        cv::Mat Scw = pKF->GetPose();
+        vector<ORB_SLAM::MapPoint*> vpPoints = LocalMapPoints(pKF2);
+        vector<ORB_SLAM::MapPoint*> vpMatched;
+        bench.Begin("ORBmatcher::SearchByProjection keyframe Sim3");
+        while(bench.KeepRunning())
+        {
+            vpMatched.assign(pKF->GetMapPointMatches().size(),static_cast<ORB_SLAM::MapPoint*>(NULL));
+            bench.Keep(matcher.SearchByProjection(pKF,Scw,vpPoints,vpMatched,10));
+        }
+
+        g2o::Sim3 gS12;
+        vector<ORB_SLAM::MapPoint*> vpSim3Matches;
+        bench.Begin("Optimizer::OptimizeSim3");
+        while(bench.KeepRunning())
+        {
+            vpSim3Matches = vpMatches12;
+            gS12 = KeyFrameSim3(pKF)*KeyFrameSim3(pKF2).inverse();
+            bench.Keep(ORB_SLAM::Optimizer::OptimizeSim3(pKF,pKF2,vpSim3Matches,gS12,10));
+        }
+
+        // Last frames of the tracking, matched to the keyframes
+        ORB_SLAM::Frame CurrentFrame(Tracker.mCurrentFrame);
+        ORB_SLAM::Frame LastFrame(Tracker.mLastFrame);
+        if(!CurrentFrame.mTcw.empty() && !LastFrame.mTcw.empty() && CurrentFrame.N>0)
+        {
+            if(CurrentFrame.mBowVec.empty())
+                CurrentFrame.ComputeBoW();
+            CurrentFrame.UpdatePoseMatrices();
+
+            vector<ORB_SLAM::MapPoint*> vpMapPointMatches;
+            bench.Begin("ORBmatcher::SearchByBoW keyframe-frame");
+            while(bench.KeepRunning())
+                bench.Keep(matcher.SearchByBoW(pKF,CurrentFrame,vpMapPointMatches));
+
+            bench.Begin("PnPsolver::iterate 5, with setup");
+            while(bench.KeepRunning())
+            {
+                ORB_SLAM::PnPsolver solver(CurrentFrame,vpMapPointMatches);
+                solver.SetRansacParameters(0.99,10,300,4,0.5,5.991);
+                bench.Keep(solver.iterate(5,bNoMore,vbInliers,nInliers).empty());
+            }
+
+            // The searches write their matches into the frame, it is cleared in each iteration
+            ORB_SLAM::ORBmatcher trackMatcher(0.9,true);
+            bench.Begin("ORBmatcher::SearchByProjection frame-last frame");
+            while(bench.KeepRunning())
+            {
+                fill(CurrentFrame.mvpMapPoints.begin(),CurrentFrame.mvpMapPoints.end(),static_cast<ORB_SLAM::MapPoint*>(NULL));
+                bench.Keep(trackMatcher.SearchByProjection(CurrentFrame,LastFrame,15));
+            }
+
+            vector<ORB_SLAM::MapPoint*> vpWindowMatches;
+            bench.Begin("ORBmatcher::SearchByProjection last frame-frame window");
+            while(bench.KeepRunning())
+                bench.Keep(trackMatcher.SearchByProjection(LastFrame,CurrentFrame,15,vpWindowMatches));
+
+            const set<ORB_SLAM::MapPoint*> sAlreadyFound;
+            bench.Begin("ORBmatcher::SearchByProjection frame-keyframe");
+            while(bench.KeepRunning())
+            {
+                fill(CurrentFrame.mvpMapPoints.begin(),CurrentFrame.mvpMapPoints.end(),static_cast<ORB_SLAM::MapPoint*>(NULL));
+                bench.Keep(matcher.SearchByProjection(CurrentFrame,pKF,sAlreadyFound,10,100));
+            }
+
+            vector<ORB_SLAM::MapPoint*> vpLocalMPs = LocalMapPoints(pKF);
+            ORB_SLAM::FrustumCuller culler;
+            ORB_SLAM::LocalMapProjection proj;
+            fill(CurrentFrame.mvpMapPoints.begin(),CurrentFrame.mvpMapPoints.end(),static_cast<ORB_SLAM::MapPoint*>(NULL));
+            culler.Cull(CurrentFrame,vpLocalMPs,CurrentFrame.mvpMapPoints,0.5,proj);
+            ORB_SLAM::ORBmatcher localMatcher(0.8);
+            bench.Begin("ORBmatcher::SearchByProjection frame-local map");
+            while(bench.KeepRunning())
+            {
+                fill(CurrentFrame.mvpMapPoints.begin(),CurrentFrame.mvpMapPoints.end(),static_cast<ORB_SLAM::MapPoint*>(NULL));
+                bench.Keep(localMatcher.SearchByProjection(CurrentFrame,vpLocalMPs,proj,1));
+            }
+
+            // Optimized from the pose it converged to, the outliers are reset by each call
+            bench.Begin("Optimizer::PoseOptimization");
+            while(bench.KeepRunning())
+                bench.Keep(ORB_SLAM::Optimizer::PoseOptimization(&CurrentFrame));
+        }
+
+        bench.Begin("Optimizer::LocalBundleAdjustment");
+        while(bench.KeepRunning())
+            ORB_SLAM::Optimizer::LocalBundleAdjustment(pKF);
+
+        vector<ORB_SLAM::MapPoint*> vpAllMPs = pMap->GetAllMapPoints();
+        for(int bIterative=0; bIterative<2; bIterative++)
+        {
+            bench.Begin(bIterative ? "Optimizer::BundleAdjustment global, iterative" : "Optimizer::BundleAdjustment global");
+            while(bench.KeepRunning())
+            {
+                ORB_SLAM::BundleAdjustmentResult result;
+                ORB_SLAM::Optimizer::BundleAdjustment(vpAllKFs,vpAllMPs,result,10,NULL,bIterative);
+                bench.Keep(result.mKeyFramePoses.size());
+            }
+        }
+
+        // A loop of the last keyframe to the first one, with no correction
+        if(pFirstKF!=pKF)
+        {
+            ORB_SLAM::LoopClosing::KeyFrameAndPose NonCorrectedSim3, CorrectedSim3;
+            NonCorrectedSim3[pKF] = CorrectedSim3[pKF] = KeyFrameSim3(pKF);
+            for(size_t i=0; i<vpConnectedKFs.size(); i++)
+                if(!vpConnectedKFs[i]->isBad())
+                    NonCorrectedSim3[vpConnectedKFs[i]] = CorrectedSim3[vpConnectedKFs[i]] = KeyFrameSim3(vpConnectedKFs[i]);
+            map<ORB_SLAM::KeyFrame*, set<ORB_SLAM::KeyFrame*> > LoopConnections;
+            LoopConnections[pKF].insert(pFirstKF);
+
+            ORB_SLAM::EssentialGraphCorrection correction;
+            bench.Begin("Optimizer::OptimizeEssentialGraph");
+            while(bench.KeepRunning())
+                ORB_SLAM::Optimizer::OptimizeEssentialGraph(pMap,pFirstKF,pKF,NonCorrectedSim3,CorrectedSim3,LoopConnections,correction);
+
+            bench.Begin("Optimizer::ApplyEssentialGraph");
+            while(bench.KeepRunning())
+                ORB_SLAM::Optimizer::ApplyEssentialGraph(pMap,pKF,correction);
+        }
+    }
+
+    pReclaimer->Unregister(nEpochId);
+
+    if(!strBaseline.empty() && !bench.LoadBaseline(strBaseline))
+        ROS_ERROR("Could not read the baseline %s", strBaseline.c_str());
+
+    cout << endl << "- Kernels:" << endl;
+    const int nSlower = bench.Report();
+    if(nSlower>0)
+        cout << "- " << nSlower << " kernels slower than the baseline" << endl;
+    bench.SaveCSV(strOutput+"/Kernels.csv");
+}
+
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "ORB_SLAM_Benchmark");
+    ros::start();
+
+    if(argc < 4)
+    {
+        ROS_ERROR("Usage: rosrun orb_slam orb_slam_benchmark path_to_vocabulary path_to_settings path_to_sequence"
+                   [tum|kitti|euroc|bag] [lockstep|fast|deterministic|kernels] [image_topic] [output_directory] [baseline_kernels_csv]"
+                  " [ground_truth]");
+        ros::shutdown();
+        return 1;
+    }
+
+    const string strSequence = argv[3];
+    string strFormat = argc>4 ? argv[4] : "";
+    const string strMode = argc>5 ? argv[5] : "lockstep";
+    const string strTopic = argc>6 ? argv[6] : "/camera/image_raw";
+    const string strOutput = ResolvePath(argc>7 ? argv[7] : "generated/benchmark");
+    const string strBaseline = argc>8 && argv[8][0] ? ResolvePath(argv[8]) : "";
+    const string strGroundTruth = argc>9 ? ResolvePath(argv[9]) : "";
+
+    const bool bDeterministic = strMode=="deterministic";
+    const bool bLockStep = strMode!="fast" && !bDeterministic;
+    const bool bKernels = strMode=="kernels";
+
+    // Guess the layout of the sequence if not given
+    if(strFormat.empty())
+    {
+        if(EndsWith(strSequence,".bag"))
+            strFormat = "bag";
+        else if(boost::filesystem::exists(strSequence+"/rgb.txt"))
+            strFormat = "tum";
+        else if(boost::filesystem::exists(strSequence+"/times.txt"))
+            strFormat = "kitti";
+        else
+            strFormat = "euroc";
+    }
+
+    vector<SequenceImage> vImages;
+    bool bLoaded = false;
+    if(strFormat=="tum")
+        bLoaded = LoadTUM(strSequence,vImages);
+    else if(strFormat=="kitti")
+        bLoaded = LoadKITTI(strSequence,vImages);
+    else if(strFormat=="euroc")
+        bLoaded = LoadEuRoC(strSequence,vImages);
+    else if(strFormat=="bag")
+        bLoaded = LoadBag(strSequence,strTopic,vImages);
+
+    if(!bLoaded || vImages.empty())
+    {
+        ROS_ERROR("Could not read a %s sequence from %s", strFormat.c_str(), strSequence.c_str());
+        ros::shutdown();
+        return 1;
+    }
+
+    // Load Settings and Check
+    string strSettingsFile = ResolvePath(argv[2]);
+    cv::FileStorage fsSettings(strSettingsFile.c_str(), cv::FileStorage::READ);
+    if(!fsSettings.isOpened())
+    {
+        ROS_ERROR("Wrong path to settings.");
+        ros::shutdown();
+        return 1;
+    }
+
+    //Load ORB Vocabulary
+    string strVocFile = ResolvePath(argv[1]);
+    cout << endl << "Loading ORB Vocabulary. This could take a while." << endl;
+    cv::FileStorage fsVoc(strVocFile.c_str(), cv::FileStorage::READ);
+    if(!fsVoc.isOpened())
+    {
+        ROS_ERROR("Wrong path to vocabulary.");
+        ros::shutdown();
+        return 1;
+    }
+    ORB_SLAM::ORBVocabulary Vocabulary;
+    Vocabulary.load(fsVoc);
+    ROS_INFO("Vocabulary loaded!");
+
+    // Same setup as the live node
+    FpsCounter fps_counter;
+    ORB_SLAM::MapDatabase WorldDB(&Vocabulary);
+#ifndef ORB_SLAM_HEADLESS
+    ORB_SLAM::FramePublisher FramePub(&fps_counter);
+    FramePub.SetMapDB(&WorldDB);
+    ORB_SLAM::MapPublisher MapPub(&WorldDB);
+    ORB_SLAM::FramePublisher* pFramePub = &FramePub;
+    ORB_SLAM::MapPublisher* pMapPub = &MapPub;
+#else
+    ORB_SLAM::FramePublisher* pFramePub = NULL;
+    ORB_SLAM::MapPublisher* pMapPub = NULL;
+#endif
+
+    ORB_SLAM::Tracking Tracker(pFramePub, pMapPub, &WorldDB, &fps_counter, strSettingsFile);
+    ORB_SLAM::Relocalization Relocalizer(&WorldDB);
+    ORB_SLAM::LocalMapping LocalMapper(&WorldDB);
+    ORB_SLAM::LoopClosing LoopCloser(&WorldDB);
+    ORB_SLAM::MapMerging MapMerger(&WorldDB);
+
+    Tracker.SetThreads(&LocalMapper, &LoopCloser, &MapMerger, &Relocalizer, &Tracker);
+    Relocalizer.SetThreads(&LocalMapper, &LoopCloser, &MapMerger, &Relocalizer, &Tracker);
+    LocalMapper.SetThreads(&LocalMapper, &LoopCloser, &MapMerger, &Relocalizer, &Tracker);
+    LoopCloser.SetThreads(&LocalMapper, &LoopCloser, &MapMerger, &Relocalizer, &Tracker);
+    MapMerger.SetThreads(&LocalMapper, &LoopCloser, &MapMerger, &Relocalizer, &Tracker);
+
+    // Images are fed from this thread instead of the image topic
+    boost::thread_group backEnd;
+    if(bDeterministic)
+    {
+        Tracker.SetSynchronous(true);
+        Relocalizer.SetSynchronous(true);
+        LocalMapper.SetSynchronous(true);
+        LoopCloser.SetSynchronous(true);
+        MapMerger.SetSynchronous(true);
+        ORB_SLAM::TaskPool::Global()->SetInline(true);
+#ifdef _OPENMP
+        omp_set_num_threads(1);
+#endif
+    }
+    else
+    {
+        backEnd.create_thread(boost::bind(&ORB_SLAM::Relocalization::Run,&Relocalizer));
+        backEnd.create_thread(boost::bind(&ORB_SLAM::LocalMapping::Run,&LocalMapper));
+        backEnd.create_thread(boost::bind(&ORB_SLAM::LoopClosing::Run,&LoopCloser));
+        backEnd.create_thread(boost::bind(&ORB_SLAM::MapMerging::Run,&MapMerger));
+    }
+
+    // Pipelined tracking, extraction runs in this thread
+    boost::thread* pTrackingStage = NULL;
+    if(Tracker.isPipelined())
+        pTrackingStage = new boost::thread(&ORB_SLAM::Tracking::RunTracking,&Tracker);
+
+    boost::filesystem::create_directories(strOutput);
+    ofstream fFrames((strOutput+"/FrameLatency.csv").c_str());
+    fFrames << "frame,timestamp,latency_ms,state,keyframes,mappoints,rss_kb" << endl;
+    fFrames << fixed;
+
+    cout << endl << "Benchmark: " << vImages.size() << " images (" << strFormat << "), mode: "
+         << (bKernels ? "kernels" : bDeterministic ? "deterministic" : bLockStep ? "lockstep" : "fast") << endl;
+
+    ORB_SLAM::LatencyHistogram latency;
+    map<long unsigned int,MapSegment> segments;
+    ros::WallTime tStart = ros::WallTime::now();
+
+    for(size_t ni=0; ni<vImages.size() && ros::ok(); ni++)
+    {
+        cv::Mat im = ReadImage(vImages[ni]);
+        if(im.empty())
+        {
+            ROS_ERROR("Failed to load image %d", (int)ni);
+            continue;
+        }
+
+        ros::WallTime tFrame = ros::WallTime::now();
+        Tracker.TrackImage(im,vImages[ni].timestamp);
+        const double frameTime = (ros::WallTime::now()-tFrame).toSec();
+        latency.Add(frameTime);
+
+        if(bDeterministic)
+            StepBackEnd(Relocalizer,LocalMapper,LoopCloser,MapMerger);
+        else if(bLockStep)
+        {
+            ros::WallRate r(1000);
+            while(!MappingIdle(Tracker,LocalMapper,LoopCloser) && ros::ok())
+                r.sleep();
+        }
+
+        int nKFs = 0, nMPs = 0;
+        long rss, peak;
+        ReadMemory(rss,peak);
+        if(WorldDB.getCurrent() != NULL)
+        {
+            nKFs = WorldDB.getCurrent()->KeyFramesInMap();
+            nMPs = WorldDB.getCurrent()->MapPointsInMap();
+
+            MapSegment &segment = segments[WorldDB.getCurrent()->mnId];
+            segment.latency.Add(frameTime);
+            segment.peakRss = max(segment.peakRss,rss);
+        }
+
+        fFrames << ni << "," << setprecision(6) << vImages[ni].timestamp << "," << setprecision(3) << frameTime*1000
+                << "," << Tracker.mState << "," << nKFs << "," << nMPs << "," << rss << endl;
+    }
+
+    // Let the mapping threads finish with the last keyframes
+    if(!bDeterministic)
+    {
+        ros::WallRate r(1000);
+        while(!MappingIdle(Tracker,LocalMapper,LoopCloser) && ros::ok())
+            r.sleep();
+    }
+
+    const double totalTime = (ros::WallTime::now()-tStart).toSec();
+    fFrames.close();
+
+    cout << endl << "Benchmark Results: " << endl;
+    cout << "- Images: " << latency.Count() << endl;
+    cout << "- Total time: " << totalTime << " s (" << latency.Count()/totalTime << " fps)" << endl;
+    cout << "- Latency p50/p95/p99/max: " << latency.Percentile(0.5)*1000 << " / " << latency.Percentile(0.95)*1000
+         << " / " << latency.Percentile(0.99)*1000 << " / " << latency.Max()*1000 << " ms" << endl;
+
+    // Save the stage latency and the keyframe poses of every map
+    ORB_SLAM::LatencyStats::Global()->SaveCSV(strOutput+"/TrackingLatency.csv");
+    if(ORB_SLAM::AllocationStats::isEnabled())
+        ORB_SLAM::AllocationStats::Global()->SaveCSV(strOutput+"/Allocations.csv");
+
+    ORB_SLAM::MapDatabase::MapList pMaps = WorldDB.getMaps();
+    for (std::size_t i = 0; i < pMaps->size(); ++i) {
+        if(pMaps->at(i)->getErased())
+            continue;
+        cout << "- Map " << i << ": " << pMaps->at(i)->KeyFramesInMap() << " keyframes, "
+             << pMaps->at(i)->MapPointsInMap() << " map points" << endl;
+        std::ostringstream oss;
+        oss << strOutput << "/KeyFrameTrajectory_" << i << ".txt";
+        pMaps->at(i)->SaveKeyFrameTrajectory(oss.str());
+    }
+
+    // Accuracy of each map next to its cost
+    ORB_SLAM::TrajectoryEvaluation::Trajectory groundTruth;
+    if(LoadGroundTruth(strSequence,strFormat,strGroundTruth,vImages,groundTruth))
+    {
+        ofstream fAccuracy((strOutput+"/Accuracy.csv").c_str());
+        fAccuracy << "map,keyframes,map_points,frames,latency_mean_ms,latency_p95_ms,peak_rss_mb,map_mb,"
+                     "poses,scale,ate_rmse_m,ate_mean_m,ate_median_m,ate_max_m,rpe_pairs,rpe_trans_rmse_m,rpe_rot_rmse_deg" << endl;
+
+        cout << "- Accuracy (" << groundTruth.size() << " ground truth poses):" << endl;
+        cout << setw(5) << "map" << setw(8) << "KFs" << setw(8) << "frames" << setw(10) << "mean ms" << setw(10) << "p95 ms"
+             << setw(10) << "map MB" << setw(8) << "scale" << setw(11) << "ATE rmse" << setw(11) << "ATE max"
+             << setw(11) << "RPE t" << setw(11) << "RPE deg" << endl;
+
+        for(size_t i=0; i<pMaps->size(); i++)
+        {
+            ORB_SLAM::Map* pMap = pMaps->at(i);
+            if(pMap->getErased())
+                continue;
+
+            ORB_SLAM::TrajectoryEvaluation::Trajectory estimate;
+            KeyFrameTrajectory(pMap,estimate);
+            ORB_SLAM::TrajectoryEvaluation::Result result;
+            const bool bEvaluated = ORB_SLAM::TrajectoryEvaluation::Evaluate(estimate,groundTruth,result);
+
+            const MapSegment &segment = segments[pMap->mnId];
+            ORB_SLAM::MemoryStats memory;
+            pMap->AccountMemory(memory);
+            const double mapMB = memory.Total()/(1024.0*1024.0);
+
+            fAccuracy << i << "," << pMap->KeyFramesInMap() << "," << pMap->MapPointsInMap() << "," << segment.latency.Count()
+                      << "," << segment.latency.Mean()*1000 << "," << segment.latency.Percentile(0.95)*1000
+                      << "," << segment.peakRss/1024.0 << "," << mapMB << "," << result.nPoses;
+            if(bEvaluated)
+                fAccuracy << "," << result.scale << "," << result.ateRmse << "," << result.ateMean << "," << result.ateMedian
+                          << "," << result.ateMax << "," << result.nPairs << "," << result.rpeTransRmse << "," << result.rpeRotRmse;
+            else
+                fAccuracy << ",,,,,,,,";
+            fAccuracy << endl;
+
+            cout << setw(5) << i << setw(8) << pMap->KeyFramesInMap() << setw(8) << segment.latency.Count()
+                 << setprecision(2) << fixed << setw(10) << segment.latency.Mean()*1000
+                 << setw(10) << segment.latency.Percentile(0.95)*1000 << setw(10) << mapMB;
+            if(bEvaluated)
+                cout << setprecision(3) << setw(8) << result.scale << setw(11) << result.ateRmse << setw(11) << result.ateMax
+                     << setw(11) << result.rpeTransRmse << setw(11) << result.rpeRotRmse;
+            else
+                cout << "   too few poses associated with the ground truth";
+            cout << endl;
+        }
+        cout.unsetf(ios::fixed);
+        cout << setprecision(6);
+    }
+    else if(!strGroundTruth.empty())
+        ROS_ERROR("Could not read the ground truth %s", strGroundTruth.c_str());
+
+#ifdef _OPENMP
+    ORB_SLAM::Map* pLargest = NULL;
+    for (std::size_t i = 0; i < pMaps->size(); ++i)
+        if(!pMaps->at(i)->getErased() && (!pLargest || pMaps->at(i)->KeyFramesInMap()>pLargest->KeyFramesInMap()))
+            pLargest = pMaps->at(i);
+    if(pLargest && ros::ok())
+        BundleAdjustmentScaling(pLargest,strOutput);
+#endif
+
+    if(bKernels && WorldDB.getCurrent() && ros::ok())
+        KernelBenchmarks(WorldDB.getCurrent(),Tracker,&Vocabulary,fsSettings,vImages,strOutput,strBaseline);
+
+    long rss, peak;
+    ReadMemory(rss,peak);
+    cout << "- Memory: " << rss/1024 << " MB (peak " << peak/1024 << " MB)" << endl;
+    cout << "- Output: " << strOutput << endl;
+
+    ros::shutdown();
+
+    if(pTrackingStage)
+    {
+        pTrackingStage->join();
+        delete pTrackingStage;
+    }
+
+    return 0;
+}
@@ -0,0 +1,336 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Scalability of the map on synthetic maps (see SyntheticMap), beyond the sequences at hand
+// For each size the maps are generated from scratch, then on the current map are timed:
+// - the loop query of Loop Closing (its keyframe database) and the merge query of Map Merging (the other maps),
+//   averaged over up to 100 keyframes
+// - the essential graph optimization of its last loop, with no correction, and a global BA. Both only read the map
+// - publishing all the maps, unless headless
+// and the memory of the maps is accounted. Results go to MapScaling.csv, MapScaling.gp plots them with gnuplot
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+#include <set>
+#include <map>
+#include <ros/ros.h>
+#include <ros/package.h>
+#include <boost/filesystem.hpp>
+
+#include <opencv2/core/core.hpp>
+
+#include "types/Map.h"
+#include "types/MapDatabase.h"
+#include "types/ORBVocabulary.h"
+#include "types/Camera.h"
+#include "types/KeyFrame.h"
+#include "types/KeyFrameDatabase.h"
+#include "types/MapPoint.h"
+
+#ifndef ORB_SLAM_HEADLESS
+#include "publishers/MapPublisher.h"
+#endif
+
+#include "util/Optimizer.h"
+#include "util/EpochReclaimer.h"
+#include "util/Converter.h"
+#include "util/MemoryStats.h"
+#include "util/SyntheticMap.h"
+
+
+using namespace std;
+
+// Keyframes whose queries are timed per size
+static const size_t N_QUERIES = 100;
+
+// Absolute paths are used as they are, relative paths are relative to the package directory
+static string ResolvePath(const string &path)
+{
+    if(!path.empty() && path[0]=='/')
+        return path;
+    return ros::package::getPath("orb_slam")+"/"+path;
+}
+
+// Resident memory of the process in kB, from /proc/self/status
+static long ReadResidentMemory()
+{
+    ifstream f("/proc/self/status");
+    string line;
+    while(getline(f,line))
+    {
+        if(line.compare(0,6,"VmRSS:")==0)
+            return atol(line.c_str()+6);
+    }
+    return 0;
+}
+
+// "250,500,1000"
+static vector<int> ParseSizes(const string &s)
+{
+    vector<int> vSizes;
+    stringstream ss(s);
+    string item;
+    while(getline(ss,item,','))
+    {
+        const int n = atoi(item.c_str());
+        if(n>1)
+            vSizes.push_back(n);
+    }
+    return vSizes;
+}
+
+static g2o::Sim3 KeyFrameSim3(ORB_SLAM::KeyFrame* pKF)
+{
+    cv::Mat Tcw = pKF->GetPose();
+    return g2o::Sim3(ORB_SLAM::Converter::toMatrix3d(Tcw.rowRange(0,3).colRange(0,3)),
+                     ORB_SLAM::Converter::toVector3d(Tcw.rowRange(0,3).col(3)),1.0);
+}
+
+// Lowest BoW score to a covisible keyframe, as Loop Closing and Map Merging compute it
+static float MinScore(ORB_SLAM::MapDatabase* pMapDB, ORB_SLAM::KeyFrame* pKF)
+{
+    vector<ORB_SLAM::KeyFrame*> vpConnectedKeyFrames = pKF->GetVectorCovisibleKeyFrames();
+    DBoW2::FlatBowVector BowVec;
+    pKF->GetFlatBowVector(BowVec);
+    float minScore = 1;
+    for(size_t i=0; i<vpConnectedKeyFrames.size(); i++)
+    {
+        if(vpConnectedKeyFrames[i]->isBad())
+            continue;
+        minScore = min(minScore,pMapDB->Score(pKF,BowVec,vpConnectedKeyFrames[i]));
+    }
+    return minScore;
+}
+
+// Gnuplot script of MapScaling.csv, one plot per cost
+static void SaveGnuplot(const string &strOutput)
+{
+    ofstream f((strOutput+"/MapScaling.gp").c_str());
+    f << "# gnuplot MapScaling.gp, writes MapScaling.png" << endl;
+    f << "set terminal pngcairo size 1200,900" << endl;
+    f << "set output 'MapScaling.png'" << endl;
+    f << "set datafile separator ','" << endl;
+    f << "set key autotitle columnhead left top" << endl;
+    f << "set xlabel 'keyframes per map'" << endl;
+    f << "set grid" << endl;
+    f << "set multiplot layout 2,2" << endl;
+    f << "set ylabel 'ms'" << endl;
+    f << "set title 'Queries'" << endl;
+    f << "plot 'MapScaling.csv' using 1:7 with linespoints, '' using 1:8 with linespoints" << endl;
+    f << "set title 'Optimization'" << endl;
+    f << "plot 'MapScaling.csv' using 1:9 with linespoints, '' using 1:10 with linespoints" << endl;
+    f << "set title 'Generation and publishing'" << endl;
+    f << "plot 'MapScaling.csv' using 1:($6*1000) title 'generate_ms' with linespoints, '' using 1:11 with linespoints" << endl;
+    f << "set ylabel 'MB'" << endl;
+    f << "set title 'Memory'" << endl;
+    f << "plot 'MapScaling.csv' using 1:12 with linespoints, '' using 1:13 with linespoints" << endl;
+    f << "unset multiplot" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "ORB_SLAM_MapScaling");
+    ros::start();
+
+    if(argc < 3)
+    {
+        ROS_ERROR("Usage: rosrun orb_slam orb_slam_mapscaling path_to_vocabulary path_to_settings"
+                  " [keyframes,keyframes,...] [maps] [loops] [covisibility] [points_per_keyframe] [output_directory]");
+        ros::shutdown();
+        return 1;
+    }
+
+    const vector<int> vSizes = ParseSizes(argc>3 ? argv[3] : "250,500,1000,2000,4000");
+    ORB_SLAM::SyntheticMap::Parameters params;
+    if(argc>4)
+        params.nMaps = atoi(argv[4]);
+    if(argc>5)
+        params.nLoops = atoi(argv[5]);
+    if(argc>6)
+        params.nCovisible = atoi(argv[6]);
+    if(argc>7)
+        params.nPointsPerKeyFrame = atoi(argv[7]);
+    const string strOutput = ResolvePath(argc>8 ? argv[8] : "generated/mapscaling");
+
+    // Load Settings and Check
+    string strSettingsFile = ResolvePath(argv[2]);
+    cv::FileStorage fsSettings(strSettingsFile.c_str(), cv::FileStorage::READ);
+    if(!fsSettings.isOpened())
+    {
+        ROS_ERROR("Wrong path to settings.");
+        ros::shutdown();
+        return 1;
+    }
+
+    //Load ORB Vocabulary
+    string strVocFile = ResolvePath(argv[1]);
+    cout << endl << "Loading ORB Vocabulary. This could take a while." << endl;
+    cv::FileStorage fsVoc(strVocFile.c_str(), cv::FileStorage::READ);
+    if(!fsVoc.isOpened())
+    {
+        ROS_ERROR("Wrong path to vocabulary.");
+        ros::shutdown();
+        return 1;
+    }
+    ORB_SLAM::ORBVocabulary Vocabulary;
+    Vocabulary.load(fsVoc);
+    ROS_INFO("Vocabulary loaded!");
+
+    // Keyframes as the extractor of the settings would make them
+    ORB_SLAM::Camera camera(fsSettings,"Camera.",0);
+    if(camera.mnWidth==0)
+        camera.SetImageSize(640,480);
+    const int nLevels = fsSettings["ORBextractor.nLevels"];
+    const float fScaleFactor = fsSettings["ORBextractor.scaleFactor"];
+    const int nFeatures = fsSettings["ORBextractor.nFeatures"];
+    if(nFeatures>0)
+        params.nFeatures = nFeatures;
+
+    boost::filesystem::create_directories(strOutput);
+    ofstream f((strOutput+"/MapScaling.csv").c_str());
+    f << "keyframes,maps,total_keyframes,mappoints,observations,generate_s,loop_query_ms,merge_query_ms,"
+         "essential_graph_ms,global_ba_ms,publish_ms,map_mb,rss_mb" << endl;
+
+    ORB_SLAM::EpochReclaimer* pReclaimer = ORB_SLAM::EpochReclaimer::Global();
+    const int nEpochId = pReclaimer->Register();
+
+    cout << endl << "- Map scaling (" << params.nMaps << " maps, " << params.nLoops << " loops, " << params.nCovisible
+         << " covisible, " << params.nPointsPerKeyFrame << " points per keyframe):" << endl;
+
+    for(size_t s=0; s<vSizes.size(); s++)
+    {
+        params.nKeyFrames = vSizes[s];
+        ORB_SLAM::MapDatabase* pMapDB = new ORB_SLAM::MapDatabase(&Vocabulary);
+
+        ros::WallTime t = ros::WallTime::now();
+        ORB_SLAM::SyntheticMap generator(&Vocabulary,&camera,nLevels,fScaleFactor,params);
+        vector<pair<ORB_SLAM::KeyFrame*,ORB_SLAM::KeyFrame*> > vLoops;
+        generator.Generate(pMapDB,vLoops);
+        const double tGenerate = (ros::WallTime::now()-t).toSec();
+
+        ORB_SLAM::Map* pMap = pMapDB->getCurrent();
+        vector<ORB_SLAM::KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+        vector<ORB_SLAM::MapPoint*> vpMPs = pMap->GetAllMapPoints();
+        size_t nObservations = 0;
+        for(size_t i=0; i<vpMPs.size(); i++)
+            nObservations += vpMPs[i]->Observations();
+        size_t nTotalKFs = 0;
+        vector<ORB_SLAM::Map*> vpMaps = pMapDB->getAll();
+        for(size_t i=0; i<vpMaps.size(); i++)
+            nTotalKFs += vpMaps[i]->KeyFramesInMap();
+
+        // Queries of keyframes spread over the map, each with the score threshold of its own neighbours
+        const size_t nStep = max(vpKFs.size()/N_QUERIES,(size_t)1);
+        double tLoopQuery = 0, tMergeQuery = 0;
+        int nQueries = 0;
+        for(size_t i=0; i<vpKFs.size(); i+=nStep)
+        {
+            ORB_SLAM::KeyFrame* pKF = vpKFs[i];
+            const float minScore = MinScore(pMapDB,pKF);
+
+            t = ros::WallTime::now();
+            pMap->GetKeyFrameDatabase()->DetectLoopCandidates(pKF,minScore);
+            tLoopQuery += (ros::WallTime::now()-t).toSec();
+
+            t = ros::WallTime::now();
+            pMapDB->DetectLoopCandidates(pKF,minScore,pMap);
+            tMergeQuery += (ros::WallTime::now()-t).toSec();
+            nQueries++;
+        }
+        tLoopQuery /= max(nQueries,1);
+        tMergeQuery /= max(nQueries,1);
+
+        // The last loop of the current map, with no correction
+        double tEssentialGraph = 0;
+        for(size_t i=vLoops.size(); i-->0; )
+        {
+            ORB_SLAM::KeyFrame* pKF = vLoops[i].first;
+            ORB_SLAM::KeyFrame* pLoopKF = vLoops[i].second;
+            if(pKF->getMap()!=pMap)
+                continue;
+
+            ORB_SLAM::LoopClosing::KeyFrameAndPose NonCorrectedSim3, CorrectedSim3;
+            NonCorrectedSim3[pKF] = CorrectedSim3[pKF] = KeyFrameSim3(pKF);
+            vector<ORB_SLAM::KeyFrame*> vpConnectedKFs = pKF->GetVectorCovisibleKeyFrames();
+            for(size_t j=0; j<vpConnectedKFs.size(); j++)
+                NonCorrectedSim3[vpConnectedKFs[j]] = CorrectedSim3[vpConnectedKFs[j]] = KeyFrameSim3(vpConnectedKFs[j]);
+            map<ORB_SLAM::KeyFrame*, set<ORB_SLAM::KeyFrame*> > LoopConnections;
+            LoopConnections[pKF].insert(pLoopKF);
+
+            ORB_SLAM::EssentialGraphCorrection correction;
+            t = ros::WallTime::now();
+            ORB_SLAM::Optimizer::OptimizeEssentialGraph(pMap,pLoopKF,pKF,NonCorrectedSim3,CorrectedSim3,LoopConnections,correction);
+            tEssentialGraph = (ros::WallTime::now()-t).toSec();
+            break;
+        }
+
+        ORB_SLAM::BundleAdjustmentResult result;
+        t = ros::WallTime::now();
+        ORB_SLAM::Optimizer::BundleAdjustment(vpKFs,vpMPs,result,5,NULL,ORB_SLAM::Optimizer::UseIterative(vpKFs.size()));
+        const double tGlobalBA = (ros::WallTime::now()-t).toSec();
+
+        double tPublish = 0;
+#ifndef ORB_SLAM_HEADLESS
+        {
+            ORB_SLAM::MapPublisher MapPub(pMapDB);
+            t = ros::WallTime::now();
+            MapPub.PublishMapPoints();
+            MapPub.PublishKeyFrames();
+            tPublish = (ros::WallTime::now()-t).toSec();
+        }
+#endif
+
+        vector<pair<long unsigned int,ORB_SLAM::MemoryStats> > vMapStats;
+        ORB_SLAM::MemoryStats total;
+        pMapDB->accountMemory(vMapStats,total);
+        const double mapMB = total.Total()/(1024.0*1024.0);
+        const double rssMB = ReadResidentMemory()/1024.0;
+
+        f << params.nKeyFrames << "," << params.nMaps << "," << nTotalKFs << "," << vpMPs.size() << "," << nObservations << ","
+          << tGenerate << "," << tLoopQuery*1000 << "," << tMergeQuery*1000 << "," << tEssentialGraph*1000 << ","
+          << tGlobalBA*1000 << "," << tPublish*1000 << "," << mapMB << "," << rssMB << endl;
+        cout << "  " << params.nKeyFrames << " keyframes, " << vpMPs.size() << " points: generated in " << tGenerate << " s, loop query "
+             << tLoopQuery*1000 << " ms, merge query " << tMergeQuery*1000 << " ms, essential graph " << tEssentialGraph*1000
+             << " ms, global BA " << tGlobalBA*1000 << " ms, publish " << tPublish*1000 << " ms, " << mapMB << " MB maps, "
+             << rssMB << " MB resident" << endl;
+
+        // The maps do not own their keyframe databases
+        for(size_t i=0; i<vpMaps.size(); i++)
+        {
+            ORB_SLAM::KeyFrameDatabase* pKFDB = vpMaps[i]->GetKeyFrameDatabase();
+            pMapDB->eraseMap(vpMaps[i]);
+            delete pKFDB;
+        }
+        delete pMapDB;
+        pReclaimer->Quiescent(nEpochId);
+    }
+
+    pReclaimer->Unregister(nEpochId);
+
+    SaveGnuplot(strOutput);
+    cout << "- Output: " << strOutput << endl;
+
+    ros::shutdown();
+
+    return 0;
+}
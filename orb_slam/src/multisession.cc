@@ -0,0 +1,98 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Several cameras served by one process, each by an independent session (see MultiSession)
+// Each session is given as name:settings[:map], its topics are advertised under /<name> and it tracks the
+// camera topic of its settings (Camera.Topic)
+
+#include <iostream>
+#include <ros/ros.h>
+#include <ros/package.h>
+
+#include "MultiSession.h"
+
+
+
+using namespace std;
+
+// Absolute paths are used as they are, relative paths are relative to the package directory
+static string ResolvePath(const string &path)
+{
+    if(!path.empty() && path[0]=='/')
+        return path;
+    return ros::package::getPath("orb_slam")+"/"+path;
+}
+
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "ORB_SLAM");
+    ros::start();
+
+    cout << endl << "ORB-SLAM Copyright (C) 2014 Raul Mur-Artal" << endl <<
+            "This program comes with ABSOLUTELY NO WARRANTY;" << endl  <<
+            "This is free software, and you are welcome to redistribute it" << endl <<
+            "under certain conditions. See LICENSE.txt." << endl;
+
+    if(argc < 3)
+    {
+        ROS_ERROR("Usage: rosrun orb_slam orb_slam_multisession path_to_vocabulary name:path_to_settings[:path_to_map] ... (absolute or relative to package directory)");
+        ros::shutdown();
+        return 1;
+    }
+
+    ORB_SLAM::MultiSession host(ResolvePath(argv[1]));
+    for(int i=2; i<argc; i++)
+    {
+        const string session(argv[i]);
+        const size_t nName = session.find(':');
+        if(nName==string::npos || nName==0)
+        {
+            ROS_ERROR("Session \"%s\" is not name:path_to_settings[:path_to_map].", session.c_str());
+            ros::shutdown();
+            return 1;
+        }
+        const size_t nSettings = session.find(':',nName+1);
+        const string strName = session.substr(0,nName);
+        const string strSettingsFile = session.substr(nName+1,nSettings==string::npos ? string::npos : nSettings-nName-1);
+        const string strMapFile = nSettings==string::npos ? string() : session.substr(nSettings+1);
+        host.AddSession(strName, ResolvePath(strSettingsFile), strMapFile.empty() ? strMapFile : ResolvePath(strMapFile));
+    }
+
+    if(!host.Init())
+    {
+        ros::shutdown();
+        return 1;
+    }
+
+    // Each tracking thread spins the image callbacks of its session, the services of the publishers and the
+    // map refiners are on the global queue
+    ros::AsyncSpinner spinner(1);
+    spinner.start();
+    host.Start();
+
+    //This "main" thread publishes the frames and the maps of all the sessions
+    host.RunPublishers();
+
+    host.Shutdown();
+    ros::shutdown();
+
+	return 0;
+}
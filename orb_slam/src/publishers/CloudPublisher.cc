@@ -0,0 +1,152 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "publishers/CloudPublisher.h"
+#include "types/Map.h"
+#include "types/MapSnapshot.h"
+
+#include <cstring>
+#include <cstddef>
+
+namespace ORB_SLAM
+{
+
+// Layout of one point in the cloud
+struct PackedPoint
+{
+    float x, y, z;
+    uint32_t nMapId;
+    uint32_t nObs;
+    uint32_t nId;
+};
+
+static sensor_msgs::PointField MakeField(const std::string &name, uint32_t offset, uint8_t datatype)
+{
+    sensor_msgs::PointField field;
+    field.name = name;
+    field.offset = offset;
+    field.datatype = datatype;
+    field.count = 1;
+    return field;
+}
+
+CloudPublisher::CloudPublisher(MapDatabase* pMap, float fRate, const ros::NodeHandle &nh, const std::string &strFramePrefix):
+    mpMap(pMap), mNH(nh), mfPeriod(fRate>0 ? 1.0f/fRate : 0), mLastPublished(ros::WallTime::now())
+{
+    mCloudPub = mNH.advertise<sensor_msgs::PointCloud2>("ORB_SLAM/Cloud",1);
+
+    mCloud.header.frame_id = strFramePrefix+"ORB_SLAM/World";
+    mCloud.height = 1;
+    mCloud.is_bigendian = false;
+    mCloud.is_dense = true;
+    mCloud.point_step = sizeof(PackedPoint);
+    mCloud.fields.push_back(MakeField("x",offsetof(PackedPoint,x),sensor_msgs::PointField::FLOAT32));
+    mCloud.fields.push_back(MakeField("y",offsetof(PackedPoint,y),sensor_msgs::PointField::FLOAT32));
+    mCloud.fields.push_back(MakeField("z",offsetof(PackedPoint,z),sensor_msgs::PointField::FLOAT32));
+    mCloud.fields.push_back(MakeField("map_id",offsetof(PackedPoint,nMapId),sensor_msgs::PointField::UINT32));
+    mCloud.fields.push_back(MakeField("observations",offsetof(PackedPoint,nObs),sensor_msgs::PointField::UINT32));
+    mCloud.fields.push_back(MakeField("id",offsetof(PackedPoint,nId),sensor_msgs::PointField::UINT32));
+}
+
+void CloudPublisher::Refresh()
+{
+    if(mCloudPub.getNumSubscribers()==0)
+        return;
+
+    if((ros::WallTime::now()-mLastPublished).toSec()>=mfPeriod)
+    {
+        PublishCloud();
+        mLastPublished = ros::WallTime::now();
+    }
+}
+
+void CloudPublisher::Reset()
+{
+    mPackedMaps.clear();
+}
+
+unsigned long CloudPublisher::PackMap(Map* pMap, std::vector<unsigned char> &data)
+{
+    // The snapshot is shared with the other readers, the live points are not touched
+    boost::shared_ptr<const MapSnapshot> pSnapshot = pMap->GetSnapshot();
+    const std::vector<MapSnapshot::MapPointState> &vPoints = pSnapshot->mvMapPoints;
+
+    data.resize(vPoints.size()*sizeof(PackedPoint));
+    for(size_t i=0; i<vPoints.size(); i++)
+    {
+        PackedPoint point;
+        point.x = vPoints[i].pos[0];
+        point.y = vPoints[i].pos[1];
+        point.z = vPoints[i].pos[2];
+        point.nMapId = pMap->mnId;
+        point.nObs = vPoints[i].nObs;
+        point.nId = vPoints[i].nId;
+        memcpy(&data[i*sizeof(PackedPoint)],&point,sizeof(PackedPoint));
+    }
+    return pSnapshot->mnVersion;
+}
+
+void CloudPublisher::PublishCloud()
+{
+    // One consistent list of the maps for the whole pass
+    MapDatabase::MapList pMaps = mpMap->getMaps();
+
+    // Only the maps that changed since the last publication are packed again
+    std::map<unsigned long, PackedMap> packedMaps;
+    size_t nBytes = 0;
+    for(size_t j=0; j<pMaps->size(); j++)
+    {
+        Map* pMap = pMaps->at(j);
+        if(pMap->getErased())
+            continue;
+
+        PackedMap &packed = packedMaps[pMap->mnId];
+        std::map<unsigned long, PackedMap>::iterator mit = mPackedMaps.find(pMap->mnId);
+        const unsigned long nVersion = pMap->GetVersion();
+        if(mit!=mPackedMaps.end() && mit->second.nVersion==nVersion)
+        {
+            packed.nVersion = nVersion;
+            packed.data.swap(mit->second.data);
+        }
+        else
+        {
+            packed.nVersion = PackMap(pMap,packed.data);
+        }
+        nBytes += packed.data.size();
+    }
+    mPackedMaps.swap(packedMaps);
+
+    mCloud.data.resize(nBytes);
+    size_t offset = 0;
+    for(std::map<unsigned long, PackedMap>::const_iterator mit=mPackedMaps.begin(); mit!=mPackedMaps.end(); mit++)
+    {
+        if(!mit->second.data.empty())
+            memcpy(&mCloud.data[offset],&mit->second.data[0],mit->second.data.size());
+        offset += mit->second.data.size();
+    }
+
+    mCloud.header.stamp = ros::Time::now();
+    mCloud.width = nBytes/sizeof(PackedPoint);
+    mCloud.row_step = nBytes;
+
+    mCloudPub.publish(mCloud);
+}
+
+} //namespace ORB_SLAM
@@ -24,25 +24,94 @@
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
 #include <boost/thread.hpp>
 #include <ros/ros.h>
+#include <algorithm>
 #include <cv_bridge/cv_bridge.h>
 
 namespace ORB_SLAM
 {
 
-FramePublisher::FramePublisher(FpsCounter* pfps)
+FramePublisher::Capture::Capture():
+    nState(Tracking::SYSTEM_NOT_READY)
 {
-    mState=Tracking::SYSTEM_NOT_READY;
-    mIm = cv::Mat(480,640,CV_8UC3, cv::Scalar(0,0,0));
-    mbUpdated = true;
+}
+
+void FramePublisher::Capture::swap(Capture &other)
+{
+    std::swap(im, other.im);
+    pImOwner.swap(other.pImOwner);
+    vCurrentKeys.swap(other.vCurrentKeys);
+    vbTracked.swap(other.vbTracked);
+    vIniKeys.swap(other.vIniKeys);
+    vIniMatches.swap(other.vIniMatches);
+    std::swap(nState, other.nState);
+}
+
+void FramePublisher::Capture::clear()
+{
+    vCurrentKeys.clear();
+    vbTracked.clear();
+    vIniKeys.clear();
+    vIniMatches.clear();
+}
+
+FramePublisher::MapInfo::MapInfo():
+    nKFs(0), nMPs(0), nMaps(0), nAllMaps(0), nMapId(0)
+{
+}
+
+FramePublisher::FramePublisher(FpsCounter* pfps, float fScale, int nJpegQuality, const ros::NodeHandle &nh):
+    mnTracked(0), mfScale(fScale>0 && fScale<1 ? fScale : 1), mNH(nh), mImageTransport(mNH), mbSubscribed(false),
+    mdMinPeriod(0), mdNextCapture(0), mbDrawRequested(false), mbFinishRequested(false), mpMap(NULL)
+{
+    mDraw.im = cv::Mat(480,640,CV_8UC3, cv::Scalar(0,0,0));
+    mbUpdated = false;
     
     fps_counter = pfps;
-    
-    mImagePub = mNH.advertise<sensor_msgs::Image>("ORB_SLAM/Frame",10,true);
 
+    // The compressed transport reads its configuration when the topic is advertised
+    if(nJpegQuality>0)
+        mNH.setParam("ORB_SLAM/Frame/compressed/jpeg_quality", std::min(nJpegQuality,100));
+    mImagePub = mImageTransport.advertise("ORB_SLAM/Frame",10,true);
+
+    mptDraw = new boost::thread(&FramePublisher::Run,this);
+}
+
+FramePublisher::~FramePublisher()
+{
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mbFinishRequested = true;
+    }
+    mCondDraw.notify_one();
+    mptDraw->join();
+    delete mptDraw;
+}
+
+void FramePublisher::Run()
+{
+    // Latched, late subscribers still see the loading message
     PublishFrame();
+
+    while(true)
+    {
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            while(!mbDrawRequested && !mbFinishRequested)
+                mCondDraw.wait(lock);
+            if(mbFinishRequested)
+                break;
+            mDraw.swap(mFront);
+            mDrawInfo = mFrontInfo;
+            mbUpdated = false;
+            mbDrawRequested = false;
+        }
+
+        PublishFrame();
+    }
 }
 
 void FramePublisher::SetMapDB(MapDatabase *pMap)
@@ -50,62 +119,77 @@ void FramePublisher::SetMapDB(MapDatabase *pMap)
     mpMap = pMap;
 }
 
+void FramePublisher::SetMaxRate(float fMaxRate)
+{
+    mdMinPeriod = fMaxRate>0 ? 1.0/fMaxRate : 0;
+}
+
 void FramePublisher::Refresh()
 {
-    if(mbUpdated)
+    // Without subscribers Tracking stops capturing, and nothing is drawn
+    mbSubscribed = mImagePub.getNumSubscribers()>0;
+    if(!mbSubscribed)
+        return;
+
     {
-        PublishFrame();
-        mbUpdated = false;
+        boost::mutex::scoped_lock lock(mMutex);
+        if(!mbUpdated || mbDrawRequested)
+            return;
+    }
+
+    // The maps are read here, where the publishers keep them from being reclaimed
+    MapInfo info;
+    if(mpMap && mpMap->getCurrent() != NULL)
+    {
+        info.nKFs = mpMap->getCurrent()->KeyFramesInMap();
+        info.nMPs = mpMap->getCurrent()->MapPointsInMap();
+        info.nMapId = mpMap->getCurrentID();
+        // Get total number of maps
+        MapDatabase::MapList pMaps = mpMap->getMaps();
+        info.nAllMaps = pMaps->size();
+        // Count how many non-erased maps
+        for(size_t j=0; j < pMaps->size(); j++)
+            if(!pMaps->at(j)->getErased())
+                info.nMaps++;
     }
+
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mFrontInfo = info;
+        mbDrawRequested = true;
+    }
+    mCondDraw.notify_one();
 }
 
 void FramePublisher::Reset()
 {
+    // Tracking waits for the publishers while they reset, the back buffer is not in use
+    // The draw buffer holds no map object, the drawing thread keeps it
     boost::mutex::scoped_lock lock(mMutex);
-    mvCurrentKeys.clear();
-    mvbOutliers.clear();
-    mvpMatchedMapPoints.clear();
-    lastFrameMapPoints.clear();
-    mvIniKeys.clear();
-    mvIniMatches.clear();
+    mBack.clear();
+    mFront.clear();
+    mbUpdated = false;
+    mbDrawRequested = false;
 }
 
 cv::Mat FramePublisher::DrawFrame()
 {
+    // The draw buffer is only used by this thread, the image is copied or resized to draw over it
     cv::Mat im;
-    vector<cv::KeyPoint> vIniKeys; // Initialization: KeyPoints in reference frame
-    vector<int> vMatches; // Initialization: correspondences with reference keypoints
-    vector<cv::KeyPoint> vCurrentKeys; // KeyPoints in current frame
-    
-    vector<MapPoint*> vMatchedMapPoints; // Tracked MapPoints in current frame
-    
-    int state; // Tracking state
-    
-    //Copy variable to be used within scoped mutex
-    {
-        boost::mutex::scoped_lock lock(mMutex);
-        state=mState;
-        if(mState==Tracking::SYSTEM_NOT_READY)
-            mState=Tracking::NO_IMAGES_YET;
+    if(mfScale<1)
+        cv::resize(mDraw.im, im, cv::Size(), mfScale, mfScale, cv::INTER_AREA);
+    else
+        mDraw.im.copyTo(im);
+    const float s = mfScale;
 
-        mIm.copyTo(im);
+    const vector<cv::KeyPoint> &vIniKeys = mDraw.vIniKeys; // Initialization: KeyPoints in reference frame
+    const vector<int> &vMatches = mDraw.vIniMatches; // Initialization: correspondences with reference keypoints
+    const vector<cv::KeyPoint> &vCurrentKeys = mDraw.vCurrentKeys; // KeyPoints in current frame
+    const vector<bool> &vbTracked = mDraw.vbTracked; // Tracked MapPoints in current frame
 
-        if(mState==Tracking::NOT_INITIALIZED)
-        {            
-            vIniKeys = mvIniKeys;
-        }
-        else if(mState==Tracking::INITIALIZING)
-        {
-            vCurrentKeys = mvCurrentKeys;
-            vIniKeys = mvIniKeys;
-            vMatches = mvIniMatches;
-        }
-        else if(mState==Tracking::WORKING)
-        {
-            vCurrentKeys = mvCurrentKeys;
-            vMatchedMapPoints = mvpMatchedMapPoints;
-        }
-    } // destroy scoped mutex -> release
+    int state = mDraw.nState; // Tracking state
+    if(mDraw.nState==Tracking::SYSTEM_NOT_READY)
+        mDraw.nState=Tracking::NO_IMAGES_YET;
 
     if(im.channels()<3)
         cvtColor(im,im,CV_GRAY2BGR);
@@ -117,7 +201,7 @@ cv::Mat FramePublisher::DrawFrame()
         {
             if(vMatches[i]>=0)
             {
-                cv::line(im,vIniKeys[i].pt,vCurrentKeys[vMatches[i]].pt,
+                cv::line(im,vIniKeys[i].pt*s,vCurrentKeys[vMatches[i]].pt*s,
                         cv::Scalar(0,255,0));
             }
         }
@@ -125,25 +209,23 @@ cv::Mat FramePublisher::DrawFrame()
     else if(state==Tracking::WORKING) //TRACKING
     {
         mnTracked=0;
-        const float r = 5;
+        const float r = std::max(5*s,2.0f);
 
         // Loop through each mappoint to display matching orb 2D point
-        for(unsigned int i=0;i<vMatchedMapPoints.size();i++)
+        for(unsigned int i=0;i<vbTracked.size();i++)
         {
-            // Ensure we are a valid mappoint
-            if(vMatchedMapPoints[i]==NULL || vMatchedMapPoints[i]->isBad())
-                continue;
-            // If not an outlier, display
-            if(!mvbOutliers[i])
+            // Matched to a good mappoint and not an outlier, display
+            if(vbTracked[i])
             {
+                const cv::Point2f pt = vCurrentKeys[i].pt*s;
                 cv::Point2f pt1,pt2;
-                pt1.x=vCurrentKeys[i].pt.x-r;
-                pt1.y=vCurrentKeys[i].pt.y-r;
-                pt2.x=vCurrentKeys[i].pt.x+r;
-                pt2.y=vCurrentKeys[i].pt.y+r;
+                pt1.x=pt.x-r;
+                pt1.y=pt.y-r;
+                pt2.x=pt.x+r;
+                pt2.y=pt.y+r;
                 // Draw
                 cv::rectangle(im,pt1,pt2,cv::Scalar(0,255,0));
-                cv::circle(im,vCurrentKeys[i].pt,2,cv::Scalar(0,255,0),-1);
+                cv::circle(im,pt,2,cv::Scalar(0,255,0),-1);
                 mnTracked++;
             }
         }
@@ -159,12 +241,11 @@ void FramePublisher::PublishFrame()
 {
     cv::Mat im = DrawFrame();
     cv_bridge::CvImage rosImage;
-    rosImage.image = im.clone();
+    rosImage.image = im;
     rosImage.header.stamp = ros::Time::now();
     rosImage.encoding = "bgr8";
 
     mImagePub.publish(rosImage.toImageMsg());
-    ros::spinOnce();
 }
 
 void FramePublisher::DrawTextInfo(cv::Mat &im, int nState, cv::Mat &imText)
@@ -188,20 +269,9 @@ void FramePublisher::DrawTextInfo(cv::Mat &im, int nState, cv::Mat &imText)
     }
     else if(nState==Tracking::WORKING)
     {
-        int nKFs=0, nMPs=0, size_cu=0, size_all=0, id=0;
-        if(mpMap->getCurrent() != NULL) {
-            nKFs = mpMap->getCurrent()->KeyFramesInMap();
-            nMPs = mpMap->getCurrent()->MapPointsInMap();
-            id = mpMap->getCurrentID();
-            // Get total number of maps
-            size_all = mpMap->getAll().size();
-            // Count how many non-erased maps
-            for(size_t j=0; j < mpMap->getAll().size(); j++)
-                if(!mpMap->getAll().at(j)->getErased())
-                    size_cu++;
-        }
-        s1 << "Fps: " << fps_counter->get() << " , Maps: " << size_cu << " (" << size_all << ") , MapID: " << id;
-        s2 << "KFs: " << nKFs << " , MPs: " << nMPs << " , Tracked: " << mnTracked;
+        const MapInfo &info = mDrawInfo;
+        s1 << "Fps: " << fps_counter->get() << " , Maps: " << info.nMaps << " (" << info.nAllMaps << ") , MapID: " << info.nMapId;
+        s2 << "KFs: " << info.nKFs << " , MPs: " << info.nMPs << " , Tracked: " << mnTracked;
     }
     else if(nState==Tracking::SYSTEM_NOT_READY)
     {
@@ -210,7 +280,7 @@ void FramePublisher::DrawTextInfo(cv::Mat &im, int nState, cv::Mat &imText)
     }
 
     int baseline=0;
-    int fontscale=2;
+    const double fontscale=std::max(2.0*mfScale,1.0);
     cv::Size textSize = cv::getTextSize(s2.str(),cv::FONT_HERSHEY_PLAIN,fontscale,1,&baseline);
 
     // Create our text and black bottom bar
@@ -226,21 +296,50 @@ void FramePublisher::DrawTextInfo(cv::Mat &im, int nState, cv::Mat &imText)
 
 void FramePublisher::Update(Tracking *pTracker)
 {
-    boost::mutex::scoped_lock lock(mMutex);
-    pTracker->mCurrentFrame.im.copyTo(mIm);
-    mvCurrentKeys=pTracker->mCurrentFrame.mvKeys;
-    mvpMatchedMapPoints=pTracker->mCurrentFrame.mvpMapPoints;
-    mvbOutliers = pTracker->mCurrentFrame.mvbOutlier;
+    if(!mbSubscribed)
+        return;
+
+    if(mdMinPeriod>0)
+    {
+        const double t = ros::WallTime::now().toSec();
+        if(t<mdNextCapture)
+            return;
+        mdNextCapture = t+mdMinPeriod;
+    }
+
+    // Fill the back buffer without holding the lock, assign reuses its capacity
+    mBack.im = pTracker->mCurrentFrame.im;
+    mBack.pImOwner = pTracker->mCurrentFrame.mpImageOwner;
+    mBack.vCurrentKeys = pTracker->mCurrentFrame.mvKeys;
+    // Resolved now, the drawing thread does not read the map points
+    const vector<MapPoint*> &vpMapPoints = pTracker->mCurrentFrame.mvpMapPoints;
+    const vector<bool> &vbOutliers = pTracker->mCurrentFrame.mvbOutlier;
+    mBack.vbTracked.resize(vpMapPoints.size());
+    for(size_t i=0; i<vpMapPoints.size(); i++)
+        mBack.vbTracked[i] = vpMapPoints[i] && !vpMapPoints[i]->isBad() && !vbOutliers[i];
 
     if(pTracker->mLastProcessedState==Tracking::INITIALIZING)
     {
-        mvIniKeys=pTracker->mInitialFrame.mvKeys;
-        mvIniMatches=pTracker->mvIniMatches;
+        mBack.vIniKeys = pTracker->mInitialFrame.mvKeys;
+        mBack.vIniMatches = pTracker->mvIniMatches;
+    }
+    else
+    {
+        mBack.vIniKeys.clear();
+        mBack.vIniMatches.clear();
     }
 
-    mState=static_cast<int>(pTracker->mLastProcessedState);
+    mBack.nState = static_cast<int>(pTracker->mLastProcessedState);
 
-    mbUpdated=true;
+    // The publisher only holds the lock to swap, if it does drop this capture
+    boost::mutex::scoped_try_lock lock(mMutex);
+    if(!lock.owns_lock())
+        return;
+    mFront.swap(mBack);
+    mbUpdated = true;
+    // Release the image of the previous capture now, not on the next frame
+    mBack.im.release();
+    mBack.pImOwner.reset();
 }
 
 } //namespace ORB_SLAM
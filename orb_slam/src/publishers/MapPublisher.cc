@@ -22,15 +22,58 @@
 
 #include "types/MapPoint.h"
 #include "types/KeyFrame.h"
+#include "types/MapSnapshot.h"
+
+#include <cmath>
+#include <set>
+#include <sstream>
 
 namespace ORB_SLAM
 {
 
 
-MapPublisher::MapPublisher(MapDatabase* pMap):mpMap(pMap), mbCameraUpdated(false)
+// Ids of the chunk markers start after the ids of the whole map markers of the current map topic
+static const int CHUNK_ID_OFFSET = 10;
+
+// Chunk kinds, the keyframes, covisibility graph and spanning tree share the keyframe chunks
+enum eChunkKind
+{
+    POINTS_CHUNK=0,
+    KEYFRAMES_CHUNK=1,
+    COVISIBILITY_CHUNK=2,
+    MST_CHUNK=3
+};
+
+// Order independent combination of the ids and revisions of a chunk
+static uint64_t Mix(uint64_t a, uint64_t b)
+{
+    uint64_t h = (a+0x9E3779B97F4A7C15ULL)*0xBF58476D1CE4E5B9ULL;
+    h ^= (b+(h>>31))*0x94D049BB133111EBULL;
+    return h^(h>>29);
+}
+
+static geometry_msgs::Point ToPoint(const float* p)
+{
+    geometry_msgs::Point msg;
+    msg.x=p[0];
+    msg.y=p[1];
+    msg.z=p[2];
+    return msg;
+}
+
+static bool isInRegion(const float* center, float fRadius2, const float* p)
+{
+    const float dx = p[0]-center[0];
+    const float dy = p[1]-center[1];
+    const float dz = p[2]-center[2];
+    return dx*dx+dy*dy+dz*dz<fRadius2;
+}
+
+MapPublisher::MapPublisher(MapDatabase* pMap, const ros::NodeHandle &nodeHandle, const string &strFramePrefix):mpMap(pMap), nh(nodeHandle), mbCameraUpdated(false), mnChunkSize(0),
+    mnMaxKeyFrames(0), mnMaxPoints(0), mnMinObservations(0), mnMaxCovisibilityEdges(0), mfDetailRadius(0), mbDetailCenter(false)
 {
     // Set our key variables
-    MAP_FRAME_ID = new string("/ORB_SLAM/World");
+    MAP_FRAME_ID = new string("/"+strFramePrefix+"ORB_SLAM/World");
     POINTS_NAMESPACE = new string("MapPoints");
     KEYFRAMES_NAMESPACE = new string("KeyFrames");
     GRAPH_NAMESPACE = new string("Graph");
@@ -137,15 +180,31 @@ void MapPublisher::Refresh()
        cv::Mat Tcw = GetCurrentCameraPose();
        PublishCurrentCamera(Tcw);
        ResetCamFlag();
+
+       if(mfDetailRadius>0 && !Tcw.empty())
+       {
+           cv::Mat Ow = -Tcw.rowRange(0,3).colRange(0,3).t()*Tcw.rowRange(0,3).col(3);
+           const float fCell = 0.5f*mfDetailRadius;
+           for(int i=0; i<3; i++)
+               mDetailCenter[i] = fCell*std::floor(Ow.at<float>(i)/fCell+0.5f);
+           mbDetailCenter = true;
+       }
     }
     if(mpMap->getCurrent() != NULL && mpMap->getCurrent()->isMapUpdated())
     {
-        // Send a clear command
-        mDelete_All.markers[0].header.stamp = ros::Time::now();
-        publisher_all.publish(mDelete_All);
-    
-        PublishMapPoints();   
-        PublishKeyFrames();
+        if(mnChunkSize>0)
+        {
+            PublishDelta();
+        }
+        else
+        {
+            // Send a clear command
+            mDelete_All.markers[0].header.stamp = ros::Time::now();
+            publisher_all.publish(mDelete_All);
+
+            PublishMapPoints();
+            PublishKeyFrames();
+        }
         
         // Update our reset flag if needed
         if(mpMap->getCurrent() != NULL)
@@ -153,6 +212,335 @@ void MapPublisher::Refresh()
     } 
 }
 
+void MapPublisher::SetChunkSize(int nChunkSize)
+{
+    mnChunkSize = nChunkSize>0 ? nChunkSize : 0;
+}
+
+void MapPublisher::SetDetail(int nMaxKeyFrames, int nMaxPoints, int nMinObservations, int nMaxCovisibilityEdges, float fDetailRadius)
+{
+    mnMaxKeyFrames = nMaxKeyFrames>0 ? nMaxKeyFrames : 0;
+    mnMaxPoints = nMaxPoints>0 ? nMaxPoints : 0;
+    mnMinObservations = nMinObservations>0 ? nMinObservations : 0;
+    mnMaxCovisibilityEdges = nMaxCovisibilityEdges>0 ? nMaxCovisibilityEdges : 0;
+    mfDetailRadius = fDetailRadius>0 ? fDetailRadius : 0;
+}
+
+MapPublisher::DetailLevel MapPublisher::ComputeDetail(const MapSnapshot &snapshot, bool bCurrent)
+{
+    DetailLevel detail;
+    detail.nKeyFrameStride = 1;
+    while(mnMaxKeyFrames>0 && snapshot.mvKeyFrames.size()>detail.nKeyFrameStride*mnMaxKeyFrames)
+        detail.nKeyFrameStride *= 2;
+    detail.nPointStride = 1;
+    while(mnMaxPoints>0 && snapshot.mvMapPoints.size()>detail.nPointStride*mnMaxPoints)
+        detail.nPointStride *= 2;
+
+    detail.fRadius2 = 0;
+    if(bCurrent && mbDetailCenter)
+    {
+        for(int i=0; i<3; i++)
+            detail.center[i] = mDetailCenter[i];
+        detail.fRadius2 = mfDetailRadius*mfDetailRadius;
+    }
+    return detail;
+}
+
+bool MapPublisher::isKeyFrameDrawn(const DetailLevel &detail, const MapSnapshot::KeyFrameState &kf)
+{
+    if(detail.fRadius2>0 && isInRegion(detail.center, detail.fRadius2, kf.pose.Ow))
+        return true;
+    return kf.nId%detail.nKeyFrameStride==0;
+}
+
+bool MapPublisher::isPointDrawn(const DetailLevel &detail, const MapSnapshot::MapPointState &mp)
+{
+    if(detail.fRadius2>0 && isInRegion(detail.center, detail.fRadius2, mp.pos))
+        return true;
+    if(mp.nObs<mnMinObservations)
+        return false;
+    return mp.nId%detail.nPointStride==0;
+}
+
+const MapSnapshot::KeyFrameState* MapPublisher::DrawnParent(const DetailLevel &detail, const MapSnapshot &snapshot,
+                                                            const MapSnapshot::KeyFrameState &kf)
+{
+    // The walk is bounded, a long run of keyframes left out is bridged by a single edge
+    const MapSnapshot::KeyFrameState* pParent = &kf;
+    for(long unsigned int n=0; n<4*detail.nKeyFrameStride; n++)
+    {
+        if(pParent->nParentId==pParent->nId)
+            break;
+        const MapSnapshot::KeyFrameState* pNext = snapshot.FindKeyFrame(pParent->nParentId);
+        if(!pNext)
+            break;
+        pParent = pNext;
+        if(isKeyFrameDrawn(detail,*pParent))
+            break;
+    }
+    return pParent!=&kf ? pParent : NULL;
+}
+
+void MapPublisher::PublishDelta()
+{
+    MapDatabase::MapList pMaps = mpMap->getMaps();
+    Map* pCurrentMap = mpMap->getCurrent();
+
+    visualization_msgs::MarkerArray delta;
+    std::vector<visualization_msgs::Marker> vCurrent;
+    std::set<unsigned long> sMapIds;
+
+    for(size_t j=0; j<pMaps->size(); j++)
+    {
+        Map* pMap = pMaps->at(j);
+        if(pMap->getErased())
+            continue;
+        sMapIds.insert(pMap->mnId);
+
+        ChunkMarkers markers;
+        ChunkSignatures signatures;
+        boost::shared_ptr<const MapSnapshot> pSnapshot = pMap->GetSnapshot();
+        BuildChunks(*pSnapshot, ComputeDetail(*pSnapshot, pMap==pCurrentMap), markers, signatures);
+
+        std::ostringstream oss;
+        oss << pMap->mnId << " ";
+        DiffChunks(markers, signatures, oss.str(), mSentChunks[pMap->mnId], delta.markers);
+
+        // Switching maps replaces all the chunks of the current map topic
+        if(pMap == pCurrentMap)
+            DiffChunks(markers, signatures, "", mSentCurrentChunks, vCurrent);
+    }
+    if(pCurrentMap == NULL)
+        DiffChunks(ChunkMarkers(), ChunkSignatures(), "", mSentCurrentChunks, vCurrent);
+
+    // Maps erased or removed since they were sent
+    for(std::map<unsigned long, ChunkSignatures>::iterator mit=mSentChunks.begin(); mit!=mSentChunks.end();)
+    {
+        if(sMapIds.count(mit->first))
+        {
+            mit++;
+            continue;
+        }
+        std::ostringstream oss;
+        oss << mit->first << " ";
+        DiffChunks(ChunkMarkers(), ChunkSignatures(), oss.str(), mit->second, delta.markers);
+        mSentChunks.erase(mit++);
+    }
+
+    // The reference points change every frame, they are small and always sent
+    mReferencePoints_Curr.points.clear();
+    if(pCurrentMap != NULL)
+    {
+        vector<MapPoint*> vpRefMPs = pCurrentMap->GetReferenceMapPoints();
+        for(size_t i=0, iend=vpRefMPs.size(); i<iend; i++)
+        {
+            if(!vpRefMPs[i])
+                continue;
+            const Eigen::Vector3f pos = vpRefMPs[i]->GetWorldPosEigen();
+            mReferencePoints_Curr.points.push_back(ToPoint(pos.data()));
+        }
+    }
+    mReferencePoints_Curr.header.stamp = ros::Time::now();
+    publisher_cur.publish(mReferencePoints_Curr);
+
+    for(size_t i=0; i<vCurrent.size(); i++)
+        publisher_cur.publish(vCurrent[i]);
+    if(!delta.markers.empty())
+        publisher_all.publish(delta);
+}
+
+void MapPublisher::BuildChunks(const MapSnapshot &snapshot, const DetailLevel &detail, ChunkMarkers &markers, ChunkSignatures &signatures)
+{
+    const ros::Time now = ros::Time::now();
+
+    for(vector<MapSnapshot::MapPointState>::const_iterator mit=snapshot.mvMapPoints.begin(), mend=snapshot.mvMapPoints.end(); mit!=mend; mit++)
+    {
+        if(!isPointDrawn(detail,*mit))
+            continue;
+        const std::pair<int,long unsigned int> key(POINTS_CHUNK, mit->nId/mnChunkSize);
+        ChunkMarkers::iterator cit = markers.find(key);
+        if(cit == markers.end())
+        {
+            visualization_msgs::Marker marker = mPoints_Curr;
+            marker.points.clear();
+            marker.id = CHUNK_ID_OFFSET+key.second;
+            marker.header.stamp = now;
+            cit = markers.insert(std::make_pair(key,marker)).first;
+            signatures[key] = 0;
+        }
+        cit->second.points.push_back(ToPoint(mit->pos));
+        signatures[key] ^= Mix(mit->nId, mit->nRevision);
+    }
+
+    const float d = fCameraSize;
+
+    //Camera is a pyramid. Define in camera coordinate system
+    const float p1[3] = {d, d*0.8f, d*0.5f};
+    const float p2[3] = {d, -d*0.8f, d*0.5f};
+    const float p3[3] = {-d, -d*0.8f, d*0.5f};
+    const float p4[3] = {-d, d*0.8f, d*0.5f};
+
+    for(size_t i=0, iend=snapshot.mvKeyFrames.size(); i<iend; i++)
+    {
+        const MapSnapshot::KeyFrameState &kf = snapshot.mvKeyFrames[i];
+        if(!isKeyFrameDrawn(detail,kf))
+            continue;
+        const long unsigned int nChunk = kf.nId/mnChunkSize;
+        const std::pair<int,long unsigned int> kfKey(KEYFRAMES_CHUNK, nChunk);
+        const std::pair<int,long unsigned int> covKey(COVISIBILITY_CHUNK, nChunk);
+        const std::pair<int,long unsigned int> mstKey(MST_CHUNK, nChunk);
+        if(!markers.count(kfKey))
+        {
+            visualization_msgs::Marker marker = mKeyFrames_Curr;
+            marker.points.clear();
+            marker.id = CHUNK_ID_OFFSET+nChunk;
+            marker.header.stamp = now;
+            markers[kfKey] = marker;
+
+            marker = mCovisibilityGraph_Curr;
+            marker.points.clear();
+            marker.id = CHUNK_ID_OFFSET+2*nChunk;
+            marker.header.stamp = now;
+            markers[covKey] = marker;
+
+            marker = mMST_Curr;
+            marker.points.clear();
+            marker.id = CHUNK_ID_OFFSET+2*nChunk+1;
+            marker.header.stamp = now;
+            markers[mstKey] = marker;
+
+            signatures[kfKey] = 0;
+        }
+        // The edges move with the keyframes at both ends
+        uint64_t &signature = signatures[kfKey];
+        signature ^= Mix(kf.nId, kf.nRevision);
+
+        const PoseSnapshot &pose = kf.pose;
+        float p1w[3], p2w[3], p3w[3], p4w[3];
+        pose.CameraToWorld(p1,p1w);
+        pose.CameraToWorld(p2,p2w);
+        pose.CameraToWorld(p3,p3w);
+        pose.CameraToWorld(p4,p4w);
+
+        const geometry_msgs::Point msgs_o = ToPoint(pose.Ow);
+        const geometry_msgs::Point msgs_p1 = ToPoint(p1w);
+        const geometry_msgs::Point msgs_p2 = ToPoint(p2w);
+        const geometry_msgs::Point msgs_p3 = ToPoint(p3w);
+        const geometry_msgs::Point msgs_p4 = ToPoint(p4w);
+
+        std::vector<geometry_msgs::Point> &vKF = markers[kfKey].points;
+        vKF.push_back(msgs_o);
+        vKF.push_back(msgs_p1);
+        vKF.push_back(msgs_o);
+        vKF.push_back(msgs_p2);
+        vKF.push_back(msgs_o);
+        vKF.push_back(msgs_p3);
+        vKF.push_back(msgs_o);
+        vKF.push_back(msgs_p4);
+        vKF.push_back(msgs_p1);
+        vKF.push_back(msgs_p2);
+        vKF.push_back(msgs_p2);
+        vKF.push_back(msgs_p3);
+        vKF.push_back(msgs_p3);
+        vKF.push_back(msgs_p4);
+        vKF.push_back(msgs_p4);
+        vKF.push_back(msgs_p1);
+
+        // Covisibility Graph, the strongest edges first
+        // An edge between two drawn keyframes is drawn from the older one
+        std::vector<geometry_msgs::Point> &vCov = markers[covKey].points;
+        int nEdges = 0;
+        for(vector<long unsigned int>::const_iterator vit=kf.vCovisibleIds.begin(), vend=kf.vCovisibleIds.end(); vit!=vend; vit++)
+        {
+            if(mnMaxCovisibilityEdges>0 && nEdges>=mnMaxCovisibilityEdges)
+                break;
+            const MapSnapshot::KeyFrameState* pKF2 = snapshot.FindKeyFrame(*vit);
+            if(!pKF2)
+                continue;
+            nEdges++;
+            if(pKF2->nId<kf.nId && isKeyFrameDrawn(detail,*pKF2))
+                continue;
+            vCov.push_back(msgs_o);
+            vCov.push_back(ToPoint(pKF2->pose.Ow));
+            signature ^= Mix(Mix(kf.nId,pKF2->nId), pKF2->nRevision);
+        }
+
+        // MST and loop edges
+        std::vector<geometry_msgs::Point> &vMST = markers[mstKey].points;
+        const MapSnapshot::KeyFrameState* pParent = DrawnParent(detail, snapshot, kf);
+        if(pParent)
+        {
+            vMST.push_back(msgs_o);
+            vMST.push_back(ToPoint(pParent->pose.Ow));
+            signature ^= Mix(Mix(kf.nId,pParent->nId)+1, pParent->nRevision);
+        }
+        for(vector<long unsigned int>::const_iterator sit=kf.vLoopEdgeIds.begin(), send=kf.vLoopEdgeIds.end(); sit!=send; sit++)
+        {
+            const MapSnapshot::KeyFrameState* pLoopKF = snapshot.FindKeyFrame(*sit);
+            if(!pLoopKF || (pLoopKF->nId<kf.nId && isKeyFrameDrawn(detail,*pLoopKF)))
+                continue;
+            vMST.push_back(msgs_o);
+            vMST.push_back(ToPoint(pLoopKF->pose.Ow));
+            signature ^= Mix(Mix(kf.nId,pLoopKF->nId)+2, pLoopKF->nRevision);
+        }
+    }
+
+    // The graph chunks change with their keyframe chunk
+    for(ChunkSignatures::iterator sit=signatures.begin(), send=signatures.end(); sit!=send; sit++)
+    {
+        if(sit->first.first != KEYFRAMES_CHUNK)
+            continue;
+        signatures[std::make_pair((int)COVISIBILITY_CHUNK, sit->first.second)] = sit->second;
+        signatures[std::make_pair((int)MST_CHUNK, sit->first.second)] = sit->second;
+    }
+}
+
+void MapPublisher::DiffChunks(const ChunkMarkers &markers, const ChunkSignatures &signatures, const std::string &prefix,
+                              ChunkSignatures &sent, std::vector<visualization_msgs::Marker> &out)
+{
+    const ros::Time now = ros::Time::now();
+
+    // Chunks that are gone
+    for(ChunkSignatures::iterator sit=sent.begin(); sit!=sent.end();)
+    {
+        if(signatures.count(sit->first))
+        {
+            sit++;
+            continue;
+        }
+        visualization_msgs::Marker marker;
+        if(sit->first.first == POINTS_CHUNK)
+            marker = mPoints_Curr;
+        else if(sit->first.first == KEYFRAMES_CHUNK)
+            marker = mKeyFrames_Curr;
+        else
+            marker = mCovisibilityGraph_Curr;
+        marker.points.clear();
+        marker.ns = prefix+marker.ns;
+        if(sit->first.first == COVISIBILITY_CHUNK)
+            marker.id = CHUNK_ID_OFFSET+2*sit->first.second;
+        else if(sit->first.first == MST_CHUNK)
+            marker.id = CHUNK_ID_OFFSET+2*sit->first.second+1;
+        else
+            marker.id = CHUNK_ID_OFFSET+sit->first.second;
+        marker.action = visualization_msgs::Marker::DELETE;
+        marker.header.stamp = now;
+        out.push_back(marker);
+        sent.erase(sit++);
+    }
+
+    // Chunks that are new or changed
+    for(ChunkSignatures::const_iterator sit=signatures.begin(), send=signatures.end(); sit!=send; sit++)
+    {
+        ChunkSignatures::iterator pit = sent.find(sit->first);
+        if(pit != sent.end() && pit->second == sit->second)
+            continue;
+        sent[sit->first] = sit->second;
+        out.push_back(markers.find(sit->first)->second);
+        out.back().ns = prefix+out.back().ns;
+    }
+}
+
 void MapPublisher::PublishMapPoints()
 {
     // Clear our old current map
@@ -162,22 +550,29 @@ void MapPublisher::PublishMapPoints()
     mPoints_All.markers.clear();
     mReferencePoints_All.markers.clear();
     // Resize our arrays
-    size_t size = mpMap->getAll().size();
+    // One consistent list of the maps for the whole pass
+    MapDatabase::MapList pMaps = mpMap->getMaps();
+    Map* pCurrentMap = mpMap->getCurrent();
+    size_t size = pMaps->size();
     mPoints_All.markers.resize(size);
     mReferencePoints_All.markers.resize(size);
     
     // Loop through each map so we can render
-    for(size_t j=0; j < mpMap->getAll().size(); j++)
+    for(size_t j=0; j < pMaps->size(); j++)
     {
         // Ensure we are  not erased
-        if(mpMap->getAll().at(j)->getErased())
+        if(pMaps->at(j)->getErased())
             continue;
 
         // Get our mappoints for the map
-        vector<MapPoint*> vpMPs = mpMap->getMap(j)->GetAllMapPoints();
-        vector<MapPoint*> vpRefMPs = mpMap->getMap(j)->GetReferenceMapPoints();
+        // Consistent copy of the map, the reference points change every frame and are read live
+        boost::shared_ptr<const MapSnapshot> pSnapshot = pMaps->at(j)->GetSnapshot();
+        const DetailLevel detail = ComputeDetail(*pSnapshot, pMaps->at(j)==pCurrentMap);
+        vector<MapPoint*> vpRefMPs = pMaps->at(j)->GetReferenceMapPoints();
         // Create a set so we can compare counts
-        set<MapPoint*> spRefMPs(vpRefMPs.begin(), vpRefMPs.end());
+        set<long unsigned int> sRefIds;
+        for(size_t i=0, iend=vpRefMPs.size(); i<iend; i++)
+            sRefIds.insert(vpRefMPs[i]->mnId);
         
         // Create namespace
         std::ostringstream oss;
@@ -211,19 +606,18 @@ void MapPublisher::PublishMapPoints()
         mReferencePoints_All.markers[j].header.stamp = ros::Time::now();
 
         // Loop through mappoints of current map
-        for(size_t i=0, iend=vpMPs.size(); i<iend;i++)
+        for(vector<MapSnapshot::MapPointState>::const_iterator mit=pSnapshot->mvMapPoints.begin(), mend=pSnapshot->mvMapPoints.end(); mit!=mend; mit++)
         {
-            // Check to make sure the mappoint has not been deleted
-            if(!vpMPs[i] || spRefMPs.count(vpMPs[i]))
+            // Reference points are drawn below
+            if(sRefIds.count(mit->nId) || !isPointDrawn(detail,*mit))
                 continue;
             geometry_msgs::Point p;
-            cv::Mat pos = vpMPs[i]->GetWorldPos();
-            p.x=pos.at<float>(0);
-            p.y=pos.at<float>(1);
-            p.z=pos.at<float>(2);
+            p.x=mit->pos[0];
+            p.y=mit->pos[1];
+            p.z=mit->pos[2];
             
             // Add to our current map
-            if(mpMap->getMap(j) == mpMap->getCurrent())
+            if(pMaps->at(j) == pCurrentMap)
             {
                 mPoints_Curr.points.push_back(p);
             }
@@ -243,7 +637,7 @@ void MapPublisher::PublishMapPoints()
             p.z=pos.at<float>(2);
 
             // Add to our current map
-            if(mpMap->getMap(j) == mpMap->getCurrent())
+            if(pMaps->at(j) == pCurrentMap)
             {
                 mReferencePoints_Curr.points.push_back(p);
             }
@@ -277,29 +671,33 @@ void MapPublisher::PublishKeyFrames()
     mCovisibilityGraph_All.markers.clear();
     mMST_All.markers.clear();
     // Resize our arrays
-    size_t size = mpMap->getAll().size();
+    // One consistent list of the maps for the whole pass
+    MapDatabase::MapList pMaps = mpMap->getMaps();
+    Map* pCurrentMap = mpMap->getCurrent();
+    size_t size = pMaps->size();
     mKeyFrames_All.markers.resize(size);
     mCovisibilityGraph_All.markers.resize(size);
     mMST_All.markers.resize(size);
     
     // Loop through each map so we can render
-    for(size_t j=0; j < mpMap->getAll().size(); j++)
+    for(size_t j=0; j < pMaps->size(); j++)
     {
         // Ensure we are erased
-        if(mpMap->getAll().at(j)->getErased())
+        if(pMaps->at(j)->getErased())
             continue;
 
         // Get our keyframes for the map
-        vector<KeyFrame*> vpKFs = mpMap->getMap(j)->GetAllKeyFrames();
+        // Consistent copy of the map, shared with the other readers
+        boost::shared_ptr<const MapSnapshot> pSnapshot = pMaps->at(j)->GetSnapshot();
+        const DetailLevel detail = ComputeDetail(*pSnapshot, pMaps->at(j)==pCurrentMap);
 
         float d = fCameraSize;
 
         //Camera is a pyramid. Define in camera coordinate system
-        cv::Mat o = (cv::Mat_<float>(4,1) << 0, 0, 0, 1);
-        cv::Mat p1 = (cv::Mat_<float>(4,1) << d, d*0.8, d*0.5, 1);
-        cv::Mat p2 = (cv::Mat_<float>(4,1) << d, -d*0.8, d*0.5, 1);
-        cv::Mat p3 = (cv::Mat_<float>(4,1) << -d, -d*0.8, d*0.5, 1);
-        cv::Mat p4 = (cv::Mat_<float>(4,1) << -d, d*0.8, d*0.5, 1);
+        const float p1[3] = {d, d*0.8f, d*0.5f};
+        const float p2[3] = {d, -d*0.8f, d*0.5f};
+        const float p3[3] = {-d, -d*0.8f, d*0.5f};
+        const float p4[3] = {-d, d*0.8f, d*0.5f};
         
         // Create namespace
         std::ostringstream oss;
@@ -349,39 +747,37 @@ void MapPublisher::PublishKeyFrames()
         mCovisibilityGraph_All.markers[j].header.stamp = ros::Time::now();
         mMST_All.markers[j].header.stamp = ros::Time::now();
 
-        for(size_t i=0, iend=vpKFs.size() ;i<iend; i++)
+        for(size_t i=0, iend=pSnapshot->mvKeyFrames.size(); i<iend; i++)
         {
-            // Skip keyframes that are bad
-            if(vpKFs[i] == NULL || vpKFs[i]->isBad())
+            const MapSnapshot::KeyFrameState &kf = pSnapshot->mvKeyFrames[i];
+            if(!isKeyFrameDrawn(detail,kf))
                 continue;
-
-            cv::Mat Tcw = vpKFs[i]->GetPose();
-            cv::Mat Twc = Tcw.inv();
-            cv::Mat ow = vpKFs[i]->GetCameraCenter();
-            cv::Mat p1w = Twc*p1;
-            cv::Mat p2w = Twc*p2;
-            cv::Mat p3w = Twc*p3;
-            cv::Mat p4w = Twc*p4;
+            const PoseSnapshot &pose = kf.pose;
+            float p1w[3], p2w[3], p3w[3], p4w[3];
+            pose.CameraToWorld(p1,p1w);
+            pose.CameraToWorld(p2,p2w);
+            pose.CameraToWorld(p3,p3w);
+            pose.CameraToWorld(p4,p4w);
 
             geometry_msgs::Point msgs_o,msgs_p1, msgs_p2, msgs_p3, msgs_p4;
-            msgs_o.x=ow.at<float>(0);
-            msgs_o.y=ow.at<float>(1);
-            msgs_o.z=ow.at<float>(2);
-            msgs_p1.x=p1w.at<float>(0);
-            msgs_p1.y=p1w.at<float>(1);
-            msgs_p1.z=p1w.at<float>(2);
-            msgs_p2.x=p2w.at<float>(0);
-            msgs_p2.y=p2w.at<float>(1);
-            msgs_p2.z=p2w.at<float>(2);
-            msgs_p3.x=p3w.at<float>(0);
-            msgs_p3.y=p3w.at<float>(1);
-            msgs_p3.z=p3w.at<float>(2);
-            msgs_p4.x=p4w.at<float>(0);
-            msgs_p4.y=p4w.at<float>(1);
-            msgs_p4.z=p4w.at<float>(2);
+            msgs_o.x=pose.Ow[0];
+            msgs_o.y=pose.Ow[1];
+            msgs_o.z=pose.Ow[2];
+            msgs_p1.x=p1w[0];
+            msgs_p1.y=p1w[1];
+            msgs_p1.z=p1w[2];
+            msgs_p2.x=p2w[0];
+            msgs_p2.y=p2w[1];
+            msgs_p2.z=p2w[2];
+            msgs_p3.x=p3w[0];
+            msgs_p3.y=p3w[1];
+            msgs_p3.z=p3w[2];
+            msgs_p4.x=p4w[0];
+            msgs_p4.y=p4w[1];
+            msgs_p4.z=p4w[2];
             
             // Add to our current map
-            if(mpMap->getMap(j) == mpMap->getCurrent())
+            if(pMaps->at(j) == pCurrentMap)
             {
                 mKeyFrames_Curr.points.push_back(msgs_o);
                 mKeyFrames_Curr.points.push_back(msgs_p1);
@@ -419,22 +815,25 @@ void MapPublisher::PublishKeyFrames()
             mKeyFrames_All.markers[j].points.push_back(msgs_p1);
 
             // Covisibility Graph
-            vector<KeyFrame*> vCovKFs = vpKFs[i]->GetCovisiblesByWeight(100);
-            if(!vCovKFs.empty())
+            if(!kf.vCovisibleIds.empty())
             {
-                for(vector<KeyFrame*>::iterator vit=vCovKFs.begin(), vend=vCovKFs.end(); vit!=vend; vit++)
+                int nEdges = 0;
+                for(vector<long unsigned int>::const_iterator vit=kf.vCovisibleIds.begin(), vend=kf.vCovisibleIds.end(); vit!=vend; vit++)
                 {
-                    if((*vit) == NULL || (*vit)->isBad())
+                    if(mnMaxCovisibilityEdges>0 && nEdges>=mnMaxCovisibilityEdges)
+                        break;
+                    const MapSnapshot::KeyFrameState* pKF2 = pSnapshot->FindKeyFrame(*vit);
+                    if(!pKF2)
                         continue;
-                    if((*vit)->mnId<vpKFs[i]->mnId)
+                    nEdges++;
+                    if(pKF2->nId<kf.nId && isKeyFrameDrawn(detail,*pKF2))
                         continue;
-                    cv::Mat Ow2 = (*vit)->GetCameraCenter();
                     geometry_msgs::Point msgs_o2;
-                    msgs_o2.x=Ow2.at<float>(0);
-                    msgs_o2.y=Ow2.at<float>(1);
-                    msgs_o2.z=Ow2.at<float>(2);
+                    msgs_o2.x=pKF2->pose.Ow[0];
+                    msgs_o2.y=pKF2->pose.Ow[1];
+                    msgs_o2.z=pKF2->pose.Ow[2];
                      // Add to our current map
-                    if(mpMap->getAll().at(j) == mpMap->getCurrent())
+                    if(pMaps->at(j) == pCurrentMap)
                     {
                         mCovisibilityGraph_Curr.points.push_back(msgs_o);
                         mCovisibilityGraph_Curr.points.push_back(msgs_o2);
@@ -446,16 +845,15 @@ void MapPublisher::PublishKeyFrames()
             }
 
             // MST
-            KeyFrame* pParent = vpKFs[i]->GetParent();
+            const MapSnapshot::KeyFrameState* pParent = DrawnParent(detail, *pSnapshot, kf);
             if(pParent)
             {
-                cv::Mat Owp = pParent->GetCameraCenter();
                 geometry_msgs::Point msgs_op;
-                msgs_op.x=Owp.at<float>(0);
-                msgs_op.y=Owp.at<float>(1);
-                msgs_op.z=Owp.at<float>(2);
+                msgs_op.x=pParent->pose.Ow[0];
+                msgs_op.y=pParent->pose.Ow[1];
+                msgs_op.z=pParent->pose.Ow[2];
                 // Add to our current map
-                if(mpMap->getMap(j) == mpMap->getCurrent())
+                if(pMaps->at(j) == pCurrentMap)
                 {
                     mMST_Curr.points.push_back(msgs_o);
                     mMST_Curr.points.push_back(msgs_op);
@@ -464,16 +862,15 @@ void MapPublisher::PublishKeyFrames()
                 mMST_All.markers[j].points.push_back(msgs_o);
                 mMST_All.markers[j].points.push_back(msgs_op);
             }
-            set<KeyFrame*> sLoopKFs = vpKFs[i]->GetLoopEdges();
-            for(set<KeyFrame*>::iterator sit=sLoopKFs.begin(), send=sLoopKFs.end(); sit!=send; sit++)
+            for(vector<long unsigned int>::const_iterator sit=kf.vLoopEdgeIds.begin(), send=kf.vLoopEdgeIds.end(); sit!=send; sit++)
             {            
-                if((*sit)->mnId<vpKFs[i]->mnId)
+                const MapSnapshot::KeyFrameState* pLoopKF = pSnapshot->FindKeyFrame(*sit);
+                if(!pLoopKF || (pLoopKF->nId<kf.nId && isKeyFrameDrawn(detail,*pLoopKF)))
                     continue;
-                cv::Mat Owl = (*sit)->GetCameraCenter();
                 geometry_msgs::Point msgs_ol;
-                msgs_ol.x=Owl.at<float>(0);
-                msgs_ol.y=Owl.at<float>(1);
-                msgs_ol.z=Owl.at<float>(2);
+                msgs_ol.x=pLoopKF->pose.Ow[0];
+                msgs_ol.y=pLoopKF->pose.Ow[1];
+                msgs_ol.z=pLoopKF->pose.Ow[2];
                 mMST_Curr.points.push_back(msgs_o);
                 mMST_Curr.points.push_back(msgs_ol);
             }
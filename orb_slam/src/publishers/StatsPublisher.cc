@@ -0,0 +1,363 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "publishers/StatsPublisher.h"
+#include "threads/LocalMapping.h"
+#include "threads/LoopClosing.h"
+#include "threads/MapMerging.h"
+#include "types/MapDatabase.h"
+#include "util/AllocationStats.h"
+#include "util/EpochReclaimer.h"
+#include "util/ObjectPool.h"
+#include "util/Trace.h"
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+
+namespace ORB_SLAM
+{
+
+static diagnostic_msgs::KeyValue MakeKeyValue(const std::string &key, double value)
+{
+    diagnostic_msgs::KeyValue kv;
+    kv.key = key;
+    std::ostringstream oss;
+    oss << value;
+    kv.value = oss.str();
+    return kv;
+}
+
+StatsPublisher::StatsPublisher(float fps, float period, const ros::NodeHandle &nh):
+    mNH(nh), mfFramePeriod(1.0f/fps), mfPeriod(period), mLastPublished(ros::WallTime::now()),
+    mpMapDB(NULL), mfMemoryPeriod(0), mLastMemoryPublished(ros::WallTime::now()),
+    mpStatsd(NULL), mpLocalMapper(NULL), mpLoopCloser(NULL), mpMapMerger(NULL)
+{
+    mDiagnosticsPub = mNH.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics",10);
+    for(int i=0; i<Metrics::N_COUNTERS; i++)
+        mvLastCounters[i] = 0;
+}
+
+StatsPublisher::~StatsPublisher()
+{
+    delete mpStatsd;
+}
+
+void StatsPublisher::SetThreads(LocalMapping* pLocalMapper, LoopClosing* pLoopCloser, MapMerging* pMapMerger)
+{
+    mpLocalMapper = pLocalMapper;
+    mpLoopCloser = pLoopCloser;
+    mpMapMerger = pMapMerger;
+}
+
+void StatsPublisher::SetMapDatabase(MapDatabase* pMapDB, float fMemoryPeriod)
+{
+    mpMapDB = pMapDB;
+    mfMemoryPeriod = fMemoryPeriod;
+    mMemoryReportSrv = mNH.advertiseService("ORB_SLAM/MemoryReport", &StatsPublisher::MemoryReportService, this);
+}
+
+void StatsPublisher::SetTraceFile(const std::string &filename)
+{
+    mstrTraceFile = filename;
+    mDumpTraceSrv = mNH.advertiseService("ORB_SLAM/DumpTrace", &StatsPublisher::DumpTraceService, this);
+}
+
+void StatsPublisher::SetMetricsExport(const std::string &host, int port, const std::string &prefix, const std::string &filename)
+{
+    if(!host.empty())
+    {
+        mpStatsd = new StatsdClient(host,port,prefix);
+        if(!mpStatsd->IsOpen())
+        {
+            ROS_WARN("ORB-SLAM - Unable to reach statsd at %s:%d, metrics not pushed", host.c_str(), port);
+            delete mpStatsd;
+            mpStatsd = NULL;
+        }
+    }
+    mstrPrometheusFile = filename;
+}
+
+void StatsPublisher::Refresh()
+{
+    if((ros::WallTime::now()-mLastPublished).toSec()>=mfPeriod)
+    {
+        PublishStats();
+        if(mpStatsd || !mstrPrometheusFile.empty())
+            ExportMetrics();
+        mLastPublished = ros::WallTime::now();
+    }
+
+    if(mpMapDB && mfMemoryPeriod>0 && (ros::WallTime::now()-mLastMemoryPublished).toSec()>=mfMemoryPeriod)
+    {
+        std::string report;
+        PublishMemory(report);
+        mLastMemoryPublished = ros::WallTime::now();
+    }
+}
+
+void StatsPublisher::PublishStats()
+{
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time::now();
+
+    for(int i=0; i<LatencyStats::N_STAGES; i++)
+    {
+        const LatencyHistogram window = LatencyStats::Global()->TakeWindow(i);
+
+        diagnostic_msgs::DiagnosticStatus status;
+        status.name = std::string("ORB_SLAM/Latency/")+LatencyStats::StageName(i);
+        status.hardware_id = "orb_slam";
+
+        const double p95 = window.Percentile(0.95);
+        if(window.Count()==0)
+        {
+            status.level = diagnostic_msgs::DiagnosticStatus::OK;
+            status.message = "No samples";
+        }
+        else if(i==LatencyStats::TRACK && p95>mfFramePeriod)
+        {
+            // Tracking does not keep up with the camera
+            status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+            status.message = "p95 above the frame period";
+        }
+        else
+        {
+            status.level = diagnostic_msgs::DiagnosticStatus::OK;
+            status.message = "OK";
+        }
+
+        status.values.push_back(MakeKeyValue("count",window.Count()));
+        status.values.push_back(MakeKeyValue("mean_ms",window.Mean()*1000));
+        status.values.push_back(MakeKeyValue("p50_ms",window.Percentile(0.5)*1000));
+        status.values.push_back(MakeKeyValue("p95_ms",p95*1000));
+        status.values.push_back(MakeKeyValue("p99_ms",window.Percentile(0.99)*1000));
+        status.values.push_back(MakeKeyValue("max_ms",window.Max()*1000));
+        // Share of the frame period taken by the stage at p95
+        status.values.push_back(MakeKeyValue("p95_frame_budget",p95/mfFramePeriod));
+
+        msg.status.push_back(status);
+    }
+
+    // Heap allocations of the same stages, per call in the window
+    for(int i=0; AllocationStats::isEnabled() && i<AllocationStats::N_STAGES; i++)
+    {
+        const AllocationStats::Counts window = AllocationStats::Global()->TakeWindow(i);
+
+        diagnostic_msgs::DiagnosticStatus status;
+        status.name = std::string("ORB_SLAM/Allocations/")+AllocationStats::StageName(i);
+        status.hardware_id = "orb_slam";
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.message = window.nCalls==0 ? "No samples" : (window.nAllocations==0 ? "Allocation free" : "OK");
+
+        const double nCalls = window.nCalls>0 ? window.nCalls : 1;
+        status.values.push_back(MakeKeyValue("calls",window.nCalls));
+        status.values.push_back(MakeKeyValue("allocations",window.nAllocations));
+        status.values.push_back(MakeKeyValue("bytes",window.nBytes));
+        status.values.push_back(MakeKeyValue("allocations_per_call",window.nAllocations/nCalls));
+        status.values.push_back(MakeKeyValue("bytes_per_call",window.nBytes/nCalls));
+
+        msg.status.push_back(status);
+    }
+
+    // Keyframe queues between the threads: current depth and high-water mark
+    if(mpLocalMapper && mpLoopCloser && mpMapMerger)
+    {
+        diagnostic_msgs::DiagnosticStatus status;
+        status.name = "ORB_SLAM/KeyFrameQueues";
+        status.hardware_id = "orb_slam";
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.message = "OK";
+        status.values.push_back(MakeKeyValue("local_mapping_depth",mpLocalMapper->KeyframesInQueue()));
+        status.values.push_back(MakeKeyValue("local_mapping_high_water",mpLocalMapper->KeyframeQueueHighWater()));
+        status.values.push_back(MakeKeyValue("loop_closing_depth",mpLoopCloser->KeyframesInQueue()));
+        status.values.push_back(MakeKeyValue("loop_closing_high_water",mpLoopCloser->KeyframeQueueHighWater()));
+        status.values.push_back(MakeKeyValue("map_merging_depth",mpMapMerger->KeyframesInQueue()));
+        status.values.push_back(MakeKeyValue("map_merging_high_water",mpMapMerger->KeyframeQueueHighWater()));
+        msg.status.push_back(status);
+    }
+
+    mDiagnosticsPub.publish(msg);
+}
+
+void StatsPublisher::ExportMetrics()
+{
+    // Gauges, the keyframes and points of the paged out maps are not counted
+    std::vector<std::pair<std::string,double> > vGauges;
+    if(mpMapDB)
+    {
+        MapDatabase::MapList maps = mpMapDB->getMaps();
+        vGauges.push_back(std::make_pair(std::string("maps"),(double)maps->size()));
+        for(size_t i=0; i<maps->size(); i++)
+        {
+            Map* pMap = (*maps)[i];
+            std::ostringstream oss;
+            oss << pMap->mnId;
+            vGauges.push_back(std::make_pair("map_"+oss.str()+"_keyframes",(double)pMap->KeyFramesInMap()));
+            vGauges.push_back(std::make_pair("map_"+oss.str()+"_map_points",(double)pMap->MapPointsInMap()));
+        }
+    }
+    if(mpLocalMapper && mpLoopCloser && mpMapMerger)
+    {
+        vGauges.push_back(std::make_pair(std::string("local_mapping_queue"),(double)mpLocalMapper->KeyframesInQueue()));
+        vGauges.push_back(std::make_pair(std::string("loop_closing_queue"),(double)mpLoopCloser->KeyframesInQueue()));
+        vGauges.push_back(std::make_pair(std::string("map_merging_queue"),(double)mpMapMerger->KeyframesInQueue()));
+    }
+
+    boost::uint64_t vCounters[Metrics::N_COUNTERS];
+    for(int i=0; i<Metrics::N_COUNTERS; i++)
+        vCounters[i] = Metrics::Global()->Get(i);
+
+    // statsd aggregates increments, so only what happened since the last push is sent
+    if(mpStatsd)
+    {
+        for(int i=0; i<Metrics::N_COUNTERS; i++)
+            if(vCounters[i]>mvLastCounters[i])
+                mpStatsd->Counter(Metrics::CounterName(i),vCounters[i]-mvLastCounters[i]);
+        for(size_t i=0; i<vGauges.size(); i++)
+            mpStatsd->Gauge(vGauges[i].first,vGauges[i].second);
+        mpStatsd->Flush();
+    }
+    for(int i=0; i<Metrics::N_COUNTERS; i++)
+        mvLastCounters[i] = vCounters[i];
+
+    // Prometheus scrapes totals, the file is replaced at once so the collector never reads it half written
+    if(!mstrPrometheusFile.empty())
+    {
+        const std::string tmp = mstrPrometheusFile+".tmp";
+        {
+            std::ofstream f(tmp.c_str());
+            for(int i=0; i<Metrics::N_COUNTERS; i++)
+            {
+                const std::string name = std::string("orb_slam_")+Metrics::CounterName(i)+"_total";
+                f << "# TYPE " << name << " counter\n" << name << " " << vCounters[i] << "\n";
+            }
+            for(size_t i=0; i<vGauges.size(); i++)
+            {
+                const std::string name = "orb_slam_"+vGauges[i].first;
+                f << "# TYPE " << name << " gauge\n" << name << " " << vGauges[i].second << "\n";
+            }
+            if(!f)
+            {
+                ROS_WARN("ORB-SLAM - Unable to write %s", tmp.c_str());
+                return;
+            }
+        }
+        if(std::rename(tmp.c_str(),mstrPrometheusFile.c_str())!=0)
+            ROS_WARN("ORB-SLAM - Unable to replace %s", mstrPrometheusFile.c_str());
+    }
+}
+
+static void AddMemoryValues(diagnostic_msgs::DiagnosticStatus &status, const MemoryStats &stats)
+{
+    for(int i=0; i<MemoryStats::N_CATEGORIES; i++)
+        status.values.push_back(MakeKeyValue(std::string(MemoryStats::CategoryName(i))+"_mb",stats.Get(i)/(1024.0*1024.0)));
+    status.values.push_back(MakeKeyValue("total_mb",stats.Total()/(1024.0*1024.0)));
+    status.values.push_back(MakeKeyValue("keyframes",stats.mnKeyFrames));
+    status.values.push_back(MakeKeyValue("map_points",stats.mnMapPoints));
+    status.values.push_back(MakeKeyValue("bad_map_points",stats.mnBadMapPoints));
+    status.values.push_back(MakeKeyValue("bad_map_points_mb",stats.mnBadMapPointBytes/(1024.0*1024.0)));
+}
+
+void StatsPublisher::PublishMemory(std::string &report)
+{
+    std::vector<std::pair<long unsigned int,MemoryStats> > vMapStats;
+    MemoryStats total;
+    mpMapDB->accountMemory(vMapStats,total);
+    if(mpLocalMapper)
+        total.Add(MemoryStats::LOCAL_BA,mpLocalMapper->LocalBAMemoryBytes());
+
+    // Points alive outside of every map are either retired and waiting for the grace period, or leaked
+    const size_t nPooled = ObjectPool<MapPoint>::Global()->InUse();
+    const size_t nUnmapped = nPooled>total.mnMapPoints ? nPooled-total.mnMapPoints : 0;
+    const size_t nRetired = EpochReclaimer::Global()->Pending();
+
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time::now();
+
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = "ORB_SLAM/Memory";
+    status.hardware_id = "orb_slam";
+    if(nUnmapped>nRetired)
+    {
+        status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+        status.message = "Map points outside of the maps and not retired";
+    }
+    else
+    {
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.message = "OK";
+    }
+    AddMemoryValues(status,total);
+    status.values.push_back(MakeKeyValue("maps",vMapStats.size()));
+    status.values.push_back(MakeKeyValue("unmapped_map_points",nUnmapped));
+    status.values.push_back(MakeKeyValue("retired_pending",nRetired));
+    status.values.push_back(MakeKeyValue("map_point_pool_capacity",ObjectPool<MapPoint>::Global()->Capacity()));
+    msg.status.push_back(status);
+
+    std::ostringstream oss;
+    oss << total.ToString() << std::endl;
+    oss << "unmapped map points: " << nUnmapped << ", retired pending: " << nRetired << std::endl;
+
+    for(size_t i=0; i<vMapStats.size(); i++)
+    {
+        const MemoryStats &stats = vMapStats[i].second;
+        std::ostringstream name;
+        name << "ORB_SLAM/Memory/Map_" << vMapStats[i].first;
+
+        diagnostic_msgs::DiagnosticStatus mapStatus;
+        mapStatus.name = name.str();
+        mapStatus.hardware_id = "orb_slam";
+        mapStatus.level = diagnostic_msgs::DiagnosticStatus::OK;
+        mapStatus.message = "OK";
+        AddMemoryValues(mapStatus,stats);
+        msg.status.push_back(mapStatus);
+
+        oss << "map " << vMapStats[i].first << ": " << stats.Total()/(1024.0*1024.0) << " MB, "
+            << stats.mnKeyFrames << " keyframes, " << stats.mnMapPoints << " map points" << std::endl;
+    }
+
+    mDiagnosticsPub.publish(msg);
+    report = oss.str();
+}
+
+bool StatsPublisher::MemoryReportService(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res)
+{
+    // The maps are walked from the service thread, nothing it reads is reclaimed meanwhile
+    const int nEpochId = EpochReclaimer::Global()->Register();
+    PublishMemory(res.message);
+    EpochReclaimer::Global()->Unregister(nEpochId);
+
+    res.success = true;
+    ROS_INFO("ORB-SLAM - Memory report\n%s", res.message.c_str());
+    return true;
+}
+
+bool StatsPublisher::DumpTraceService(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res)
+{
+    res.success = Tracer::Global()->SaveChromeJSON(mstrTraceFile);
+    res.message = res.success ? mstrTraceFile : "Unable to write "+mstrTraceFile;
+    ROS_INFO("ORB-SLAM - Trace: %s", res.message.c_str());
+    return true;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,353 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Back-end alone on a keyframe stream recorded by the system (System.KeyFrameStream, see KeyFrameRecorder)
+// Local Mapping, Loop Closing and Map Merging run as in the system, with no Tracking nor Relocalization, fed the
+// recorded keyframes either at the rate they were recorded or as fast as Local Mapping takes them.
+// Every second the keyframes fed and processed and the queue of each thread are sampled to Replay.csv,
+// Replay.gp plots them with gnuplot. The summary gives the throughput and the queue depths
+
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <algorithm>
+#include <ros/ros.h>
+#include <ros/package.h>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+#include <opencv2/core/core.hpp>
+
+#include "types/Map.h"
+#include "types/MapDatabase.h"
+#include "types/ORBVocabulary.h"
+#include "types/KeyFrame.h"
+
+#include "threads/LocalMapping.h"
+#include "threads/LoopClosing.h"
+#include "threads/MapMerging.h"
+
+#include "util/EpochReclaimer.h"
+#include "util/KeyFrameRecorder.h"
+#include "util/Metrics.h"
+#include "util/TaskPool.h"
+
+
+using namespace std;
+
+// At the maximum rate a keyframe is fed once Local Mapping has fewer queued, as Tracking waits for it to accept one
+static const int MAX_QUEUED = 1;
+
+// Seconds the queues stay empty before the back-end is taken as done
+static const double MAX_IDLE = 2.0;
+
+// Absolute paths are used as they are, relative paths are relative to the package directory
+static string ResolvePath(const string &path)
+{
+    if(!path.empty() && path[0]=='/')
+        return path;
+    return ros::package::getPath("orb_slam")+"/"+path;
+}
+
+// Queue depths of the back-end threads at one instant
+struct Sample
+{
+    double time;
+    unsigned long nFed;
+    unsigned long nMapped;
+    int nLocalMapping;
+    int nLoopClosing;
+    int nMapMerging;
+};
+
+class Sampler
+{
+public:
+    Sampler(ORB_SLAM::LocalMapping* pLocalMapper, ORB_SLAM::LoopClosing* pLoopCloser, ORB_SLAM::MapMerging* pMapMerger,
+            ofstream &f) :
+        mpLocalMapper(pLocalMapper), mpLoopCloser(pLoopCloser), mpMapMerger(pMapMerger), mf(f),
+        mStart(ros::WallTime::now()), mNext(mStart), mnSamples(0), mnMaxLocal(0), mnMaxLoop(0), mnMaxMerge(0),
+        mSumLocal(0), mSumLoop(0), mSumMerge(0)
+    {
+        mf << "time_s,fed,mapped,local_mapping_queue,loop_closing_queue,map_merging_queue,loop_processed,merge_processed" << endl;
+    }
+
+    // Samples once a second
+    void Update(unsigned long nFed)
+    {
+        const ros::WallTime now = ros::WallTime::now();
+        if(now<mNext)
+            return;
+        mNext += ros::WallDuration(1.0);
+
+        Sample s;
+        s.time = (now-mStart).toSec();
+        s.nFed = nFed;
+        s.nMapped = ORB_SLAM::Metrics::Global()->Get(ORB_SLAM::Metrics::KEYFRAMES_MAPPED);
+        s.nLocalMapping = mpLocalMapper->KeyframesInQueue();
+        s.nLoopClosing = mpLoopCloser->KeyframesInQueue();
+        s.nMapMerging = mpMapMerger->KeyframesInQueue();
+
+        // Mapped keyframes are queued to both Loop Closing and Map Merging
+        mf << s.time << "," << s.nFed << "," << s.nMapped << "," << s.nLocalMapping << "," << s.nLoopClosing << ","
+           << s.nMapMerging << "," << (long)s.nMapped-s.nLoopClosing << "," << (long)s.nMapped-s.nMapMerging << endl;
+
+        mnSamples++;
+        mnMaxLocal = max(mnMaxLocal,s.nLocalMapping);
+        mnMaxLoop = max(mnMaxLoop,s.nLoopClosing);
+        mnMaxMerge = max(mnMaxMerge,s.nMapMerging);
+        mSumLocal += s.nLocalMapping;
+        mSumLoop += s.nLoopClosing;
+        mSumMerge += s.nMapMerging;
+    }
+
+    void Print()
+    {
+        const double n = max(mnSamples,1);
+        cout << "  Queue depth (max / mean): local mapping " << mnMaxLocal << " / " << mSumLocal/n
+             << ", loop closing " << mnMaxLoop << " / " << mSumLoop/n
+             << ", map merging " << mnMaxMerge << " / " << mSumMerge/n << endl;
+    }
+
+    double Elapsed() const {return (ros::WallTime::now()-mStart).toSec();}
+
+protected:
+    ORB_SLAM::LocalMapping* mpLocalMapper;
+    ORB_SLAM::LoopClosing* mpLoopCloser;
+    ORB_SLAM::MapMerging* mpMapMerger;
+    ofstream &mf;
+
+    ros::WallTime mStart;
+    ros::WallTime mNext;
+
+    int mnSamples;
+    int mnMaxLocal, mnMaxLoop, mnMaxMerge;
+    double mSumLocal, mSumLoop, mSumMerge;
+};
+
+// Gnuplot script of Replay.csv
+static void SaveGnuplot(const string &strOutput)
+{
+    ofstream f((strOutput+"/Replay.gp").c_str());
+    f << "# gnuplot Replay.gp, writes Replay.png" << endl;
+    f << "set terminal pngcairo size 1200,900" << endl;
+    f << "set output 'Replay.png'" << endl;
+    f << "set datafile separator ','" << endl;
+    f << "set key autotitle columnhead left top" << endl;
+    f << "set xlabel 's'" << endl;
+    f << "set grid" << endl;
+    f << "set multiplot layout 2,1" << endl;
+    f << "set ylabel 'keyframes'" << endl;
+    f << "set title 'Throughput'" << endl;
+    f << "plot 'Replay.csv' using 1:2 with lines, '' using 1:3 with lines, '' using 1:7 with lines, '' using 1:8 with lines" << endl;
+    f << "set title 'Queues'" << endl;
+    f << "plot 'Replay.csv' using 1:4 with lines, '' using 1:5 with lines, '' using 1:6 with lines" << endl;
+    f << "unset multiplot" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "ORB_SLAM_Replay");
+    ros::start();
+
+    if(argc < 4)
+    {
+        ROS_ERROR("Usage: rosrun orb_slam orb_slam_replay path_to_vocabulary path_to_settings path_to_keyframe_stream"
+                  " [rate (0: as fast as possible, 1: as recorded)] [output_directory]");
+        ros::shutdown();
+        return 1;
+    }
+
+    const double fRate = argc>4 ? atof(argv[4]) : 0;
+    const string strOutput = ResolvePath(argc>5 ? argv[5] : "generated/replay");
+
+    // Load Settings and Check
+    string strSettingsFile = ResolvePath(argv[2]);
+    cv::FileStorage fsSettings(strSettingsFile.c_str(), cv::FileStorage::READ);
+    if(!fsSettings.isOpened())
+    {
+        ROS_ERROR("Wrong path to settings.");
+        ros::shutdown();
+        return 1;
+    }
+
+    //Load ORB Vocabulary
+    string strVocFile = ResolvePath(argv[1]);
+    cout << endl << "Loading ORB Vocabulary. This could take a while." << endl;
+    cv::FileStorage fsVoc(strVocFile.c_str(), cv::FileStorage::READ);
+    if(!fsVoc.isOpened())
+    {
+        ROS_ERROR("Wrong path to vocabulary.");
+        ros::shutdown();
+        return 1;
+    }
+    ORB_SLAM::ORBVocabulary Vocabulary;
+    Vocabulary.load(fsVoc);
+    ROS_INFO("Vocabulary loaded!");
+
+    ORB_SLAM::MapDatabase* pMapDB = new ORB_SLAM::MapDatabase(&Vocabulary);
+    int nShortlist = fsSettings["MapDatabase.Shortlist"];
+    if(nShortlist>0)
+    {
+        int nShortlistLevelsUp = fsSettings["MapDatabase.ShortlistLevelsUp"];
+        pMapDB->setShortlist(nShortlist, nShortlistLevelsUp>0 ? nShortlistLevelsUp : 2);
+    }
+    pMapDB->setPriorRadius(fsSettings["PositionPrior.Radius"]);
+
+    ORB_SLAM::KeyFrameReplayer replayer(pMapDB);
+    const string strStream = ResolvePath(argv[3]);
+    if(!replayer.Open(strStream))
+    {
+        ROS_ERROR("Wrong keyframe stream (or recorded with another vocabulary): %s", strStream.c_str());
+        ros::shutdown();
+        return 1;
+    }
+
+    // The back-end threads as the system configures them
+    int nLoopThreads = fsSettings["LoopClosing.nThreads"];
+    int nMappingThreads = fsSettings["LocalMapping.nThreads"];
+    int nConcurrentLoopCorrection = fsSettings["LoopClosing.Concurrent"];
+    ORB_SLAM::TaskPool::Global()->SetThreads(fsSettings["System.nPoolThreads"]);
+
+    ORB_SLAM::LocalMapping* pLocalMapper = new ORB_SLAM::LocalMapping(pMapDB, max(nMappingThreads,1),
+                                                                      fsSettings["LocalMapping.nMaxBatch"],
+                                                                      fsSettings["LocalMapping.StageBudget"]);
+    pLocalMapper->SetSparsification(fsSettings["LocalMapping.SparsifyCellSize"], fsSettings["LocalMapping.SparsifyMaxKeyFrames"],
+                                    fsSettings["LocalMapping.SparsifyMaxPoints"]);
+    ORB_SLAM::LoopClosing* pLoopCloser = new ORB_SLAM::LoopClosing(pMapDB, max(nLoopThreads,1), nConcurrentLoopCorrection!=0,
+                                                                   fsSettings["LoopClosing.GlobalBAIterations"]);
+    ORB_SLAM::MapMerging* pMapMerger = new ORB_SLAM::MapMerging(pMapDB, max(nLoopThreads,1));
+    pLoopCloser->SetScheduling(fsSettings["LoopClosing.MaxLatency"], fsSettings["LoopClosing.MaxDuty"]);
+
+    // No Tracking nor Relocalization, the threads check for them
+    pLocalMapper->SetThreads(pLocalMapper, pLoopCloser, pMapMerger, NULL, NULL);
+    pLoopCloser->SetThreads(pLocalMapper, pLoopCloser, pMapMerger, NULL, NULL);
+    pMapMerger->SetThreads(pLocalMapper, pLoopCloser, pMapMerger, NULL, NULL);
+
+    vector<boost::thread*> vpThreads;
+    vpThreads.push_back(new boost::thread(&ORB_SLAM::LocalMapping::Run,pLocalMapper));
+    vpThreads.push_back(new boost::thread(&ORB_SLAM::LoopClosing::Run,pLoopCloser));
+    vpThreads.push_back(new boost::thread(&ORB_SLAM::MapMerging::Run,pMapMerger));
+    pLocalMapper->Release();
+    pLoopCloser->Release();
+    pMapMerger->Release();
+
+    // The replayer keeps the points it created until the end, so the feeding thread is only quiescent once done:
+    // nothing retired meanwhile is reclaimed
+    ORB_SLAM::EpochReclaimer* pReclaimer = ORB_SLAM::EpochReclaimer::Global();
+    const int nEpochId = pReclaimer->Register();
+
+    boost::filesystem::create_directories(strOutput);
+    ofstream f((strOutput+"/Replay.csv").c_str());
+    Sampler sampler(pLocalMapper,pLoopCloser,pMapMerger,f);
+
+    if(fRate>0)
+        cout << endl << "- Replay of " << strStream << " at " << fRate << "x the recorded rate:" << endl;
+    else
+        cout << endl << "- Replay of " << strStream << " as fast as Local Mapping takes the keyframes:" << endl;
+
+    const unsigned long nMapped0 = ORB_SLAM::Metrics::Global()->Get(ORB_SLAM::Metrics::KEYFRAMES_MAPPED);
+    unsigned long nFed = 0;
+    double recordedTime = 0;
+    const ros::WallTime tStart = ros::WallTime::now();
+    while(ros::ok())
+    {
+        ORB_SLAM::KeyFrame* pKF = replayer.Next(recordedTime);
+        if(!pKF)
+            break;
+
+        if(fRate>0)
+        {
+            const ros::WallTime tDue = tStart+ros::WallDuration(recordedTime/fRate);
+            while(ros::ok() && ros::WallTime::now()<tDue)
+            {
+                sampler.Update(nFed);
+                ros::WallDuration(0.001).sleep();
+            }
+        }
+        else
+        {
+            while(ros::ok() && pLocalMapper->KeyframesInQueue()>=MAX_QUEUED)
+            {
+                sampler.Update(nFed);
+                ros::WallDuration(0.001).sleep();
+            }
+        }
+
+        pLocalMapper->InsertKeyFrame(pKF);
+        nFed++;
+        sampler.Update(nFed);
+    }
+    const double tFed = (ros::WallTime::now()-tStart).toSec();
+
+    // Until the back-end is done with the keyframes fed. A keyframe Local Mapping discards is never counted
+    // as mapped, so the queues staying empty for a while also ends the wait
+    ros::WallTime tIdle = ros::WallTime::now();
+    while(ros::ok())
+    {
+        const bool bQueued = pLocalMapper->KeyframesInQueue()>0 || pLoopCloser->KeyframesInQueue()>0 ||
+                             pMapMerger->KeyframesInQueue()>0;
+        const ros::WallTime now = ros::WallTime::now();
+        if(bQueued)
+            tIdle = now;
+        else if(ORB_SLAM::Metrics::Global()->Get(ORB_SLAM::Metrics::KEYFRAMES_MAPPED)-nMapped0>=nFed ||
+                (now-tIdle).toSec()>MAX_IDLE)
+            break;
+        sampler.Update(nFed);
+        ros::WallDuration(0.01).sleep();
+    }
+    const double tDone = (ros::WallTime::now()-tStart).toSec();
+    sampler.Update(nFed);
+
+    pLocalMapper->RequestFinish();
+    pLoopCloser->RequestFinish();
+    pMapMerger->RequestFinish();
+    for(size_t i=0; i<vpThreads.size(); i++)
+    {
+        vpThreads[i]->join();
+        delete vpThreads[i];
+    }
+    pReclaimer->Quiescent(nEpochId);
+    pReclaimer->Unregister(nEpochId);
+
+    const unsigned long nMapped = ORB_SLAM::Metrics::Global()->Get(ORB_SLAM::Metrics::KEYFRAMES_MAPPED)-nMapped0;
+    cout << "  " << nFed << " keyframes fed in " << tFed << " s (recorded over " << recordedTime << " s), " << nMapped
+         << " mapped, back-end done in " << tDone << " s: " << nMapped/max(tDone,1e-9) << " keyframes/s" << endl;
+    sampler.Print();
+
+    vector<ORB_SLAM::Map*> vpMaps = pMapDB->getAll();
+    size_t nKFs = 0, nMPs = 0;
+    for(size_t i=0; i<vpMaps.size(); i++)
+    {
+        nKFs += vpMaps[i]->KeyFramesInMap();
+        nMPs += vpMaps[i]->MapPointsInMap();
+    }
+    cout << "  " << vpMaps.size() << " maps, " << nKFs << " keyframes, " << nMPs << " points" << endl;
+    cout << "  Loops detected " << ORB_SLAM::Metrics::Global()->Get(ORB_SLAM::Metrics::LOOPS_DETECTED)
+         << ", merges detected " << ORB_SLAM::Metrics::Global()->Get(ORB_SLAM::Metrics::MERGES_DETECTED) << endl;
+
+    SaveGnuplot(strOutput);
+    cout << "- Output: " << strOutput << endl;
+
+    ros::shutdown();
+
+    return 0;
+}
@@ -21,113 +21,495 @@
 #include "threads/LocalMapping.h"
 #include "threads/LoopClosing.h"
 
+#include "util/Converter.h"
+#include "util/MapLink.h"
+#include "util/KeyFrameRecorder.h"
+#include "util/MapJournal.h"
 #include "util/ORBmatcher.h"
-#include "util/Optimizer.h"
+#include "util/TaskPool.h"
+#include "util/Trace.h"
+#include "util/AllocationStats.h"
+#include "util/LockProfiler.h"
+#include "util/Metrics.h"
 
 #include <ros/ros.h>
+#include <Eigen/Dense>
+#include <boost/bind.hpp>
+#include <algorithm>
 
 namespace ORB_SLAM
 {
 
-LocalMapping::LocalMapping(MapDatabase *pMap):
-    OrbThread(pMap), mbAbortBA(false), mbAcceptKeyFrames(true)
+// Linear triangulation, the homogeneous coordinate fixed to one
+// A*[x 1]'=0 is solved by least squares with the 3x3 normal equations, in closed form
+// Points with a too small parallax are rejected before, so the point is never at infinity
+static bool Triangulate(const Eigen::Vector3f &xn1, const Eigen::Matrix<float,3,4> &Tcw1,
+                        const Eigen::Vector3f &xn2, const Eigen::Matrix<float,3,4> &Tcw2, Eigen::Vector3f &x3D)
 {
+    Eigen::Matrix4d A;
+    A.row(0) = (xn1(0)*Tcw1.row(2)-Tcw1.row(0)).cast<double>();
+    A.row(1) = (xn1(1)*Tcw1.row(2)-Tcw1.row(1)).cast<double>();
+    A.row(2) = (xn2(0)*Tcw2.row(2)-Tcw2.row(0)).cast<double>();
+    A.row(3) = (xn2(1)*Tcw2.row(2)-Tcw2.row(1)).cast<double>();
+
+    const Eigen::Matrix<double,4,3> A3 = A.leftCols<3>();
+    const Eigen::Matrix3d AtA = A3.transpose()*A3;
+
+    Eigen::Matrix3d AtAinv;
+    bool bInvertible;
+    AtA.computeInverseWithCheck(AtAinv,bInvertible);
+    if(!bInvertible)
+        return false;
+
+    x3D = (-AtAinv*(A3.transpose()*A.col(3))).cast<float>();
+    return true;
+}
+
+LocalMapping::LocalMapping(MapDatabase *pMap, int nThreads, int nMaxBatch, float fStageBudget):
+    OrbThread(pMap), mqNewKeyFrames(64), mnThreads(max(nThreads,1)), mpvpNeighKFs(NULL), mpvpFuseCandidates(NULL), mnNextNeighbor(0),
+    mnMaxBatch(max(nMaxBatch,0)), mnBatched(0), mbForcedBA(false), mfStageBudget(max(fStageBudget,0.0f)),
+    mbAbortBA(false), mStage(IDLE), mfProcessTime(-1), mfBATime(-1), mnSinceSparsify(0), mbAcceptKeyFrames(true), mpMapLink(NULL),
+    mpKeyFrameRecorder(NULL), mpDeferredKF(NULL)
+{
+}
+
+LocalMapping::~LocalMapping()
+{
+    for(size_t i=0; i<mvpWorkers.size(); i++)
+        delete mvpWorkers[i];
+}
+
+const int LocalMapping::SPARSIFY_PERIOD = 10;
+
+// Weight of the last keyframe in the smoothed stage times
+const float LocalMapping::TIME_SMOOTHING = 0.3f;
+
+void LocalMapping::SetSparsification(float fCellSize, int nMaxKeyFrames, int nMaxPoints)
+{
+    mSparsifier = MapSparsifier(fCellSize,nMaxKeyFrames,nMaxPoints);
+}
+
+void LocalMapping::SetLocalBAFullPeriod(int nPeriod)
+{
+    mLocalBA.SetFullPeriod(nPeriod);
+    for(size_t i=0; i<mvpWorkers.size(); i++)
+        mvpWorkers[i]->SetLocalBAFullPeriod(nPeriod);
+}
+
+void LocalMapping::SetMapLink(MapLink* pMapLink)
+{
+    mpMapLink = pMapLink;
+}
+
+void LocalMapping::SetKeyFrameRecorder(KeyFrameRecorder* pRecorder)
+{
+    mpKeyFrameRecorder = pRecorder;
+}
+
+void LocalMapping::SetWorkers(int nWorkers)
+{
+    for(size_t i=0; i<mvpWorkers.size(); i++)
+        delete mvpWorkers[i];
+    mvpWorkers.clear();
+    for(int i=1; i<nWorkers; i++)
+    {
+        mvpWorkers.push_back(new LocalMapping(mapDB, mnThreads, 0, mfStageBudget));
+        mvpWorkers.back()->SetLocalBAFullPeriod(mLocalBA.GetFullPeriod());
+    }
+}
+
+LocalMapping* LocalMapping::GetWorker(Map* pMap)
+{
+    if(mvpWorkers.empty() || !pMap)
+        return this;
+    const size_t idx = pMap->mnId%(mvpWorkers.size()+1);
+    return idx==0 ? this : mvpWorkers[idx-1];
 }
 
 void LocalMapping::Run()
 {
-    ros::Rate r(600);
-    while(ros::ok())
+    while(isRunning())
     {
-        // Reset if needed
-        ResetIfRequested();
+        Step();
 
-        // Check if there are keyframes in the queue
-        if(CheckNewKeyFrames())
+        // Safe area to stop
+        if(stopRequested())
         {
-            // Check that we have a map initialized
-            if(mapDB->getCurrent() != NULL)
-            {
-                // Tracking will see that Local Mapping is busy
-                SetAcceptKeyFrames(false);
+            Stop();
+            WaitWhileStopped();
+            Released();
+        }
 
-                // BoW conversion and insertion in Map
-                ProcessNewKeyFrame();
+        // Sleep until there is something to do
+        // Keyframes stay queued while there is no map
+        if((!CheckNewKeyFrames() && !mpDeferredKF && !(mpMapLink && mpMapLink->HasPending())) || mapDB->getCurrent() == NULL)
+            WaitForWork();
+    }
+}
 
-                // Check recent MapPoints
-                MapPointCulling();
+bool LocalMapping::Step()
+{
+    // Reset if needed
+    ResetIfRequested();
 
-                // Triangulate new MapPoints
-                CreateNewMapPoints();
+    // Let the map objects culled meanwhile be reclaimed
+    Quiescent();
 
-                // Find more matches in neighbor keyframes and fuse point duplications
-                SearchInNeighbors();
+    bool bProcessed = false;
 
-                mbAbortBA = false;
+    // The robot applies the updates of the server, the server takes the next keyframe of the robot
+    if(mpMapLink)
+    {
+        if(mpMapLink->GetRole()==MapLink::ROBOT)
+            mpMapLink->ApplyUpdates();
+        else if(!CheckNewKeyFrames() && mapDB->isVocabLoaded())
+        {
+            // The received keyframes are converted to BoW
+            if(mvpWorkers.empty())
+            {
+                KeyFrame* pKF = mpMapLink->ReceiveKeyFrame();
+                if(pKF)
+                    mqNewKeyFrames.Push(pKF);
+            }
+            else
+                ReceiveKeyFrames();
+            if(mpDeferredKF || !CheckNewKeyFrames())
+                return true;
+        }
+    }
 
-                if(!CheckNewKeyFrames() && !stopRequested())
-                {
-                    // Local BA
-                    Optimizer::LocalBundleAdjustment(mpCurrentKeyFrame,&mbAbortBA);
+    // Check if there are keyframes in the queue
+    if(CheckNewKeyFrames())
+    {
+        // Check that we have a map initialized
+        if(mapDB->getCurrent() != NULL && mqNewKeyFrames.Pop(mpCurrentKeyFrame))
+        {
+            // A keyframe queued before a map switch is still mapped in its own map, unless that map was erased
+            // Its map is kept in memory meanwhile, as only the current one is safe from paging
+            Map* pMap = mpCurrentKeyFrame->getMap();
+            if(pMap->getErased())
+                return true;
+            const bool bPinned = pMap!=mapDB->getCurrent();
+            if(bPinned)
+                pMap->Pin();
+
+            // Tracking will see that Local Mapping is busy
+            SetAcceptKeyFrames(false);
+            SetStage(PROCESSING);
+
+            // BoW conversion and insertion in Map
+            ProcessNewKeyFrame();
+            Metrics::Global()->Add(Metrics::KEYFRAMES_MAPPED);
+
+            // On the robot the server maps it, its window comes back with an update
+            if(mpMapLink && mpMapLink->GetRole()==MapLink::ROBOT)
+            {
+                mpMapLink->SendKeyFrame(mpCurrentKeyFrame);
+                if(!CheckNewKeyFrames())
+                    SetAcceptKeyFrames(true);
+                SetStage(IDLE);
+                if(bPinned)
+                    pMap->Unpin();
+                return true;
+            }
 
-                    // Check redundant local Keyframes
-                    KeyFrameCulling();
+            // Check recent MapPoints
+            MapPointCulling();
 
-                    mapDB->getCurrent()->SetFlagAfterBA();
+            // Triangulate new MapPoints
+            CreateNewMapPoints();
 
-                    // Tracking will see Local Mapping idle
-                    if(!CheckNewKeyFrames())
-                        SetAcceptKeyFrames(true);
-                }
+            // Find more matches in neighbor keyframes and fuse point duplications
+            SearchInNeighbors();
 
-                // Insert frames into our loop and map closing threads
-                mpLoopCloser->InsertKeyFrame(mpCurrentKeyFrame);
-                mpMapMerger->InsertKeyFrame(mpCurrentKeyFrame);
+            mnBatched++;
+            mnSinceSparsify++;
+            mbForcedBA = mnMaxBatch>0 && mnBatched>=mnMaxBatch;
+            mbAbortBA = false;
+
+            if((!CheckNewKeyFrames() || mbForcedBA) && !stopRequested())
+            {
+                // With batching, keyframes inserted during the BA are processed after it
+                // A forced BA covers the keyframes batched since the last one, it is not interrupted
+                if(mnMaxBatch>0)
+                    SetAcceptKeyFrames(true);
+
+                // Local BA
+                SetStage(OPTIMIZING);
+                mLocalBA.Optimize(mpCurrentKeyFrame,&mbAbortBA);
+                mnBatched = 0;
+                if(mbAbortBA)
+                    Metrics::Global()->Add(Metrics::LOCAL_BA_INTERRUPTED);
+
+                // Check redundant local Keyframes
+                KeyFrameCulling();
+
+                mpCurrentKeyFrame->getMap()->SetFlagAfterBA();
+
+                // Tracking will see Local Mapping idle
+                if(!CheckNewKeyFrames())
+                    SetAcceptKeyFrames(true);
             }
+            mbForcedBA = false;
+            SetStage(IDLE);
+
+            // Insert frames into our loop closing thread, its query also finds the merge candidates
+            mpLoopCloser->InsertKeyFrame(mpCurrentKeyFrame);
+
+            // Logged with the poses of its window, in case the run stops before the maps are saved
+            mapDB->getJournal()->KeyFrameMapped(mpCurrentKeyFrame);
+
+            // The server sends the window of the keyframe back to the robot
+            if(mpMapLink)
+                mpMapLink->SendUpdate(mpCurrentKeyFrame);
+            if(bPinned)
+                pMap->Unpin();
+            bProcessed = true;
         }
+    }
 
-        // Safe area to stop
-        if(stopRequested())
+    // Keep the map within its budget while there is nothing else to do
+    Sparsify();
+
+    return bProcessed;
+}
+
+void LocalMapping::ReceiveKeyFrames()
+{
+    std::vector<KeyFrame*> vpKFs;
+    std::vector<LocalMapping*> vpBusy;
+    if(mpDeferredKF)
+    {
+        vpKFs.push_back(mpDeferredKF);
+        vpBusy.push_back(GetWorker(mpDeferredKF->getMap()));
+        mpDeferredKF = NULL;
+    }
+
+    while(vpKFs.size()<=mvpWorkers.size())
+    {
+        KeyFrame* pKF = mpMapLink->ReceiveKeyFrame();
+        if(!pKF)
+            break;
+        LocalMapping* pWorker = GetWorker(pKF->getMap());
+        if(std::find(vpBusy.begin(),vpBusy.end(),pWorker)!=vpBusy.end())
         {
-            Stop();
-            ros::Rate r2(200);
-            while(isStopped() && ros::ok())
-            {
-                r2.sleep();
-            }
-            SetAcceptKeyFrames(true);
+            mpDeferredKF = pKF;
+            break;
+        }
+        vpKFs.push_back(pKF);
+        vpBusy.push_back(pWorker);
+    }
+
+    if(vpKFs.size()==1)
+        mqNewKeyFrames.Push(vpKFs[0]);
+    else if(vpKFs.size()>1)
+        MapConcurrently(vpKFs);
+}
+
+void LocalMapping::MapConcurrently(const std::vector<KeyFrame*> &vpKFs)
+{
+    SetAcceptKeyFrames(false);
+    SetStage(PROCESSING);
+    {
+        TaskGroup workers(TaskPool::LOCAL_MAPPING);
+        for(size_t i=1; i<vpKFs.size(); i++)
+            workers.Run(boost::bind(&LocalMapping::MapKeyFrame,GetWorker(vpKFs[i]->getMap()),vpKFs[i]));
+        GetWorker(vpKFs[0]->getMap())->MapKeyFrame(vpKFs[0]);
+        workers.Wait();
+    }
+    SetStage(IDLE);
+    SetAcceptKeyFrames(true);
+
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        Metrics::Global()->Add(Metrics::KEYFRAMES_MAPPED);
+        mpLoopCloser->InsertKeyFrame(vpKFs[i]);
+        mapDB->getJournal()->KeyFrameMapped(vpKFs[i]);
+        mpMapLink->SendUpdate(vpKFs[i]);
+    }
+    mnSinceSparsify += vpKFs.size();
+}
+
+void LocalMapping::MapKeyFrame(KeyFrame* pKF)
+{
+    mpCurrentKeyFrame = pKF;
+
+    ProcessNewKeyFrame();
+    MapPointCulling();
+    CreateNewMapPoints();
+    SearchInNeighbors();
+
+    // Keyframes are not inserted meanwhile, the BA only stops at shutdown
+    mbAbortBA = false;
+    mLocalBA.Optimize(mpCurrentKeyFrame,&mbAbortBA);
+    if(mbAbortBA)
+        Metrics::Global()->Add(Metrics::LOCAL_BA_INTERRUPTED);
+
+    KeyFrameCulling();
+
+    pKF->getMap()->SetFlagAfterBA();
+}
+
+void LocalMapping::Released()
+{
+    SetAcceptKeyFrames(true);
+
+    if(mvpWorkers.empty())
+        return;
+
+    // Maps may have been merged while stopped, a worker keeps nothing of the maps it does not own any more
+    std::vector<LocalMapping*> vpWorkers = mvpWorkers;
+    vpWorkers.push_back(this);
+    for(size_t i=0; i<vpWorkers.size(); i++)
+    {
+        LocalMapping* pWorker = vpWorkers[i];
+        list<MapPoint*>::iterator lit = pWorker->mlpRecentAddedMapPoints.begin();
+        while(lit!=pWorker->mlpRecentAddedMapPoints.end())
+        {
+            if((*lit)->isBad() || GetWorker((*lit)->getMap())!=pWorker)
+                lit = pWorker->mlpRecentAddedMapPoints.erase(lit);
+            else
+                lit++;
         }
+        pWorker->mLocalBA.Reset();
+    }
+}
+
+void LocalMapping::PurgeBadPointers()
+{
+    list<MapPoint*>::iterator lit = mlpRecentAddedMapPoints.begin();
+    while(lit!=mlpRecentAddedMapPoints.end())
+    {
+        if((*lit)->isBad())
+            lit = mlpRecentAddedMapPoints.erase(lit);
+        else
+            lit++;
+    }
+
+    mLocalBA.DiscardBad();
 
-        // Sleep
-        r.sleep();
+    // The observations of a queued keyframe are only added when it is processed, until then nothing keeps
+    // its points from being culled or fused away, so their matches are dropped before they can be freed
+    vector<KeyFrame*> vpQueued;
+    mqNewKeyFrames.GetQueued(vpQueued);
+    if(mpDeferredKF)
+        vpQueued.push_back(mpDeferredKF);
+    for(size_t i=0; i<vpQueued.size(); i++)
+    {
+        vector<pair<size_t,MapPoint*> > vBad;
+        vector<MapPoint*> vpMatches;
+        vpQueued[i]->GetMapPointMatches(vpMatches);
+        for(size_t j=0; j<vpMatches.size(); j++)
+            if(vpMatches[j] && vpMatches[j]->isBad())
+                vBad.push_back(make_pair(j,vpMatches[j]));
+        if(!vBad.empty())
+            vpQueued[i]->EraseMapPointMatches(vBad);
     }
+
+    if(mpMapLink)
+        mpMapLink->PurgeBadPointers();
+
+    // The workers are idle whenever this thread is quiescent
+    for(size_t i=0; i<mvpWorkers.size(); i++)
+        mvpWorkers[i]->Quiescent();
 }
 
 void LocalMapping::InsertKeyFrame(KeyFrame *pKF)
 {
-    boost::mutex::scoped_lock lock(mMutexNewKFs);
-    mlNewKeyFrames.push_back(pKF);
-    mbAbortBA=true;
+    if(mpKeyFrameRecorder)
+        mpKeyFrameRecorder->Record(pKF);
+
+    // Tracking does not insert keyframes while we are busy, so the queue is never full for long
+    while(!mqNewKeyFrames.Push(pKF) && isRunning())
+        boost::this_thread::yield();
+    InterruptBA();
     SetAcceptKeyFrames(false);
+    Wake();
 }
 
 bool LocalMapping::CheckNewKeyFrames()
 {
-    boost::mutex::scoped_lock lock(mMutexNewKFs);
-    return(!mlNewKeyFrames.empty());
+    return(!mqNewKeyFrames.Empty());
 }
 
-void LocalMapping::ProcessNewKeyFrame()
+int LocalMapping::KeyframesInQueue()
+{
+    return mqNewKeyFrames.Size();
+}
+
+int LocalMapping::KeyframeQueueHighWater()
 {
+    return mqNewKeyFrames.HighWater();
+}
+
+void LocalMapping::SetStage(eStage stage)
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexStage);
+    const ros::WallTime now = ros::WallTime::now();
+    const float elapsed = (now-mStageStart).toSec();
+
+    if(mStage==PROCESSING)
+        mfProcessTime = mfProcessTime<0 ? elapsed : TIME_SMOOTHING*elapsed + (1-TIME_SMOOTHING)*mfProcessTime;
+    else if(mStage==OPTIMIZING && !mbAbortBA)
+        mfBATime = mfBATime<0 ? elapsed : TIME_SMOOTHING*elapsed + (1-TIME_SMOOTHING)*mfBATime;
+
+    mStage = stage;
+    mStageStart = now;
+}
+
+float LocalMapping::PredictIdleTime()
+{
+    const int nQueued = KeyframesInQueue();
+
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexStage);
+    if(mStage==IDLE && nQueued==0)
+        return 0;
+    if(mfProcessTime<0 || mfBATime<0)
+        return -1;
+
+    // The BA runs once the queue is empty
+    float remaining = nQueued>0 ? nQueued*mfProcessTime+mfBATime : 0;
+    if(mStage!=IDLE)
     {
-        boost::mutex::scoped_lock lock(mMutexNewKFs);
-        mpCurrentKeyFrame = mlNewKeyFrames.front();
-        mlNewKeyFrames.pop_front();
+        const float elapsed = (ros::WallTime::now()-mStageStart).toSec();
+        const float left = mStage==PROCESSING ? mfProcessTime+mfBATime-elapsed : mfBATime-elapsed;
+        // Taking longer than ever predicted
+        if(left<0)
+            return -1;
+        remaining += nQueued>0 && mStage==PROCESSING ? max(left-mfBATime,0.0f) : left;
     }
+    return remaining;
+}
+
+float LocalMapping::PredictKeyFrameTime()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexStage);
+    if(mfProcessTime<0 || mfBATime<0)
+        return -1;
+    return mfProcessTime+mfBATime;
+}
+
+size_t LocalMapping::LocalBAMemoryBytes()
+{
+    return mLocalBA.MemoryBytes();
+}
+
+void LocalMapping::ProcessNewKeyFrame()
+{
+    TRACE_SCOPE("LocalMapping::ProcessNewKeyFrame");
+    ALLOC_SCOPE(PROCESS_NEW_KEYFRAME);
+
+    // mpCurrentKeyFrame has been taken from the queue by Run
+
+    // Only blocks with a vocabulary loaded in the background, the first keyframes already waited for it
+    mapDB->waitForVocab();
 
     // Compute Bags of Words structures
     mpCurrentKeyFrame->ComputeBoW();
 
+    // Keep the image as the policy says, off the tracking thread
+    mpCurrentKeyFrame->CompressImage();
+
     if(mpCurrentKeyFrame->mnId==0)
         return;
 
@@ -165,13 +547,17 @@ void LocalMapping::ProcessNewKeyFrame()
     // Update links in the Covisibility Graph
     mpCurrentKeyFrame->UpdateConnections();
 
-    // Insert Keyframe in Map
-    if(mapDB->getCurrent() != NULL)
-        mapDB->getCurrent()->AddKeyFrame(mpCurrentKeyFrame);
+    // Insert Keyframe in its Map, the server maps keyframes of maps that are not current
+    Map* pMap = mpCurrentKeyFrame->getMap() ? mpCurrentKeyFrame->getMap() : mapDB->getCurrent();
+    if(pMap != NULL)
+        pMap->AddKeyFrame(mpCurrentKeyFrame);
 }
 
 void LocalMapping::MapPointCulling()
 {
+    TRACE_SCOPE("LocalMapping::MapPointCulling");
+    ALLOC_SCOPE(MAP_POINT_CULLING);
+
     // Check Recent Added MapPoints
     list<MapPoint*>::iterator lit = mlpRecentAddedMapPoints.begin();
     const unsigned long int nCurrentKFid = mpCurrentKeyFrame->mnId;
@@ -202,172 +588,232 @@ void LocalMapping::MapPointCulling()
 
 void LocalMapping::CreateNewMapPoints()
 {
+    TRACE_SCOPE("LocalMapping::CreateNewMapPoints");
+    ALLOC_SCOPE(CREATE_NEW_MAP_POINTS);
+
     // Take neighbor keyframes in covisibility graph
     vector<KeyFrame*> vpNeighKFs = mpCurrentKeyFrame->GetBestCovisibilityKeyFrames(20);
 
-    ORBmatcher matcher(0.6,false);
-
-    cv::Mat Rcw1 = mpCurrentKeyFrame->GetRotation();
-    cv::Mat Rwc1 = Rcw1.t();
-    cv::Mat tcw1 = mpCurrentKeyFrame->GetTranslation();
-    cv::Mat Tcw1(3,4,CV_32F);
-    Rcw1.copyTo(Tcw1.colRange(0,3));
-    tcw1.copyTo(Tcw1.col(3));
-    cv::Mat Ow1 = mpCurrentKeyFrame->GetCameraCenter();
-
-    const float fx1 = mpCurrentKeyFrame->fx;
-    const float fy1 = mpCurrentKeyFrame->fy;
-    const float cx1 = mpCurrentKeyFrame->cx;
-    const float cy1 = mpCurrentKeyFrame->cy;
-    const float invfx1 = 1.0f/fx1;
-    const float invfy1 = 1.0f/fy1;
+    // The best covisible neighbors come first, the rest are skipped once the budget is spent
+    StartStage();
 
-    const float ratioFactor = 1.5f*mpCurrentKeyFrame->GetScaleFactor();
+    const int nWorkers = min(mnThreads,(int)vpNeighKFs.size());
+    if(nWorkers>1)
+    {
+        // Matching and triangulation only read the keyframes, each neighbor on a worker
+        mpvpNeighKFs = &vpNeighKFs;
+        mvvTriangulated.assign(vpNeighKFs.size(),vector<TriangulatedPoint>());
+        mnNextNeighbor = 0;
+
+        TaskGroup workers(TaskPool::LOCAL_MAPPING);
+        for(int i=0; i<nWorkers-1; i++)
+            workers.Run(boost::bind(&LocalMapping::TriangulateNeighbors,this));
+        // The calling thread also takes its share of neighbors
+        TriangulateNeighbors();
+        workers.Wait();
+
+        // Points are created by covisibility rank, as sequentially
+        // A keypoint of the current keyframe triangulated with several neighbors keeps the point of the best one
+        for(size_t i=0; i<vpNeighKFs.size(); i++)
+            AddTriangulatedPoints(vpNeighKFs[i],mvvTriangulated[i]);
+
+        mvvTriangulated.clear();
+        mpvpNeighKFs = NULL;
+    }
+    else
+    {
+        // Each neighbor is matched with the points of the previous ones already created
+        vector<TriangulatedPoint> vPoints;
+        for(size_t i=0; i<vpNeighKFs.size() && !StageExpired(); i++)
+        {
+            TriangulateNeighbor(vpNeighKFs[i],vPoints);
+            AddTriangulatedPoints(vpNeighKFs[i],vPoints);
+        }
+    }
+}
 
-    // Search matches with epipolar restriction and triangulate
-    for(size_t i=0; i<vpNeighKFs.size(); i++)
+void LocalMapping::TriangulateNeighbors()
+{
+    while(true)
     {
-        KeyFrame* pKF2 = vpNeighKFs[i];
+        int nNeighbor;
+        {
+            PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexNeighbor);
+            nNeighbor = mnNextNeighbor++;
+        }
 
-        // Check first that baseline is not too short
-        // Small translation errors for short baseline keyframes make scale to diverge
-        cv::Mat Ow2 = pKF2->GetCameraCenter();
-        cv::Mat vBaseline = Ow2-Ow1;
-        const float baseline = cv::norm(vBaseline);
-        const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2);
-        const float ratioBaselineDepth = baseline/medianDepthKF2;
+        if(nNeighbor>=(int)mpvpNeighKFs->size() || StageExpired())
+            break;
 
-        if(ratioBaselineDepth<0.01)
-            continue;
+        TriangulateNeighbor((*mpvpNeighKFs)[nNeighbor],mvvTriangulated[nNeighbor]);
+    }
+}
 
-        // Compute Fundamental Matrix
-        cv::Mat F12 = ComputeF12(mpCurrentKeyFrame,pKF2);
-
-        // Search matches that fulfill epipolar constraint
-        vector<cv::KeyPoint> vMatchedKeysUn1;
-        vector<cv::KeyPoint> vMatchedKeysUn2;
-        vector<pair<size_t,size_t> > vMatchedIndices;
-        matcher.SearchForTriangulation(mpCurrentKeyFrame,pKF2,F12,vMatchedKeysUn1,vMatchedKeysUn2,vMatchedIndices);
-
-        cv::Mat Rcw2 = pKF2->GetRotation();
-        cv::Mat Rwc2 = Rcw2.t();
-        cv::Mat tcw2 = pKF2->GetTranslation();
-        cv::Mat Tcw2(3,4,CV_32F);
-        Rcw2.copyTo(Tcw2.colRange(0,3));
-        tcw2.copyTo(Tcw2.col(3));
-
-        const float fx2 = pKF2->fx;
-        const float fy2 = pKF2->fy;
-        const float cx2 = pKF2->cx;
-        const float cy2 = pKF2->cy;
-        const float invfx2 = 1.0f/fx2;
-        const float invfy2 = 1.0f/fy2;
-
-        // Triangulate each match
-        for(size_t ikp=0, iendkp=vMatchedKeysUn1.size(); ikp<iendkp; ikp++)
-        {
-            const int idx1 = vMatchedIndices[ikp].first;
-            const int idx2 = vMatchedIndices[ikp].second;
+void LocalMapping::TriangulateNeighbor(KeyFrame *pKF2, vector<TriangulatedPoint> &vPoints)
+{
+    vPoints.clear();
+
+    KeyFrame* pKF1 = mpCurrentKeyFrame;
+
+    PoseSnapshot pose1, pose2;
+    pKF1->GetPoseSnapshot(pose1);
+    pKF2->GetPoseSnapshot(pose2);
+
+    const Eigen::Matrix3f Rcw1 = pose1.Rcw();
+    const Eigen::Vector3f tcw1 = pose1.tcw();
+    const Eigen::Matrix3f Rwc1 = Rcw1.transpose();
+    const Eigen::Vector3f Ow1 = pose1.Center();
+    Eigen::Matrix<float,3,4> Tcw1;
+    Tcw1 << Rcw1, tcw1;
+
+    const Eigen::Matrix3f Rcw2 = pose2.Rcw();
+    const Eigen::Vector3f tcw2 = pose2.tcw();
+    const Eigen::Matrix3f Rwc2 = Rcw2.transpose();
+    const Eigen::Vector3f Ow2 = pose2.Center();
+    Eigen::Matrix<float,3,4> Tcw2;
+    Tcw2 << Rcw2, tcw2;
+
+    // Check first that baseline is not too short
+    // Small translation errors for short baseline keyframes make scale to diverge
+    const float baseline = (Ow2-Ow1).norm();
+    const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2);
+    const float ratioBaselineDepth = baseline/medianDepthKF2;
+
+    if(ratioBaselineDepth<0.01)
+        return;
 
-            const cv::KeyPoint &kp1 = vMatchedKeysUn1[ikp];
-            const cv::KeyPoint &kp2 = vMatchedKeysUn2[ikp];
+    // Compute Fundamental Matrix
+    cv::Mat F12 = ComputeF12(pKF1,pKF2);
 
-            // Check parallax between rays
-            cv::Mat xn1 = (cv::Mat_<float>(3,1) << (kp1.pt.x-cx1)*invfx1, (kp1.pt.y-cy1)*invfy1, 1.0 );
-            cv::Mat ray1 = Rwc1*xn1;
-            cv::Mat xn2 = (cv::Mat_<float>(3,1) << (kp2.pt.x-cx2)*invfx2, (kp2.pt.y-cy2)*invfy2, 1.0 );
-            cv::Mat ray2 = Rwc2*xn2;
-            const float cosParallaxRays = ray1.dot(ray2)/(cv::norm(ray1)*cv::norm(ray2));
+    // Search matches that fulfill epipolar constraint
+    ORBmatcher matcher(0.6,false);
+    vector<cv::KeyPoint> vMatchedKeysUn1;
+    vector<cv::KeyPoint> vMatchedKeysUn2;
+    vector<pair<size_t,size_t> > vMatchedIndices;
+    matcher.SearchForTriangulation(pKF1,pKF2,F12,vMatchedKeysUn1,vMatchedKeysUn2,vMatchedIndices);
+
+    const float fx1 = pKF1->fx;
+    const float fy1 = pKF1->fy;
+    const float cx1 = pKF1->cx;
+    const float cy1 = pKF1->cy;
+    const float invfx1 = 1.0f/fx1;
+    const float invfy1 = 1.0f/fy1;
 
-            if(cosParallaxRays<0 || cosParallaxRays>0.9998)
-                continue;
+    const float fx2 = pKF2->fx;
+    const float fy2 = pKF2->fy;
+    const float cx2 = pKF2->cx;
+    const float cy2 = pKF2->cy;
+    const float invfx2 = 1.0f/fx2;
+    const float invfy2 = 1.0f/fy2;
 
-            // Linear Triangulation Method
-            cv::Mat A(4,4,CV_32F);
-            A.row(0) = xn1.at<float>(0)*Tcw1.row(2)-Tcw1.row(0);
-            A.row(1) = xn1.at<float>(1)*Tcw1.row(2)-Tcw1.row(1);
-            A.row(2) = xn2.at<float>(0)*Tcw2.row(2)-Tcw2.row(0);
-            A.row(3) = xn2.at<float>(1)*Tcw2.row(2)-Tcw2.row(1);
+    const float ratioFactor = 1.5f*pKF1->GetScaleFactor();
 
-            cv::Mat w,u,vt;
-            cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV);
+    vPoints.reserve(vMatchedKeysUn1.size());
 
-            cv::Mat x3D = vt.row(3).t();
+    // Triangulate each match
+    for(size_t ikp=0, iendkp=vMatchedKeysUn1.size(); ikp<iendkp; ikp++)
+    {
+        const cv::KeyPoint &kp1 = vMatchedKeysUn1[ikp];
+        const cv::KeyPoint &kp2 = vMatchedKeysUn2[ikp];
 
-            if(x3D.at<float>(3)==0)
-                continue;
+        // Check parallax between rays
+        const Eigen::Vector3f xn1((kp1.pt.x-cx1)*invfx1, (kp1.pt.y-cy1)*invfy1, 1.0f);
+        const Eigen::Vector3f ray1 = Rwc1*xn1;
+        const Eigen::Vector3f xn2((kp2.pt.x-cx2)*invfx2, (kp2.pt.y-cy2)*invfy2, 1.0f);
+        const Eigen::Vector3f ray2 = Rwc2*xn2;
+        const float cosParallaxRays = ray1.dot(ray2)/(ray1.norm()*ray2.norm());
+
+        if(cosParallaxRays<0 || cosParallaxRays>0.9998)
+            continue;
 
-            // Euclidean coordinates
-            x3D = x3D.rowRange(0,3)/x3D.at<float>(3);
-            cv::Mat x3Dt = x3D.t();
+        // Linear Triangulation Method
+        Eigen::Vector3f x3D;
+        if(!Triangulate(xn1,Tcw1,xn2,Tcw2,x3D))
+            continue;
 
-            //Check triangulation in front of cameras
-            float z1 = Rcw1.row(2).dot(x3Dt)+tcw1.at<float>(2);
-            if(z1<=0)
-                continue;
+        //Check triangulation in front of cameras
+        const Eigen::Vector3f x3Dc1 = Rcw1*x3D+tcw1;
+        const float z1 = x3Dc1(2);
+        if(z1<=0)
+            continue;
 
-            float z2 = Rcw2.row(2).dot(x3Dt)+tcw2.at<float>(2);
-            if(z2<=0)
-                continue;
+        const Eigen::Vector3f x3Dc2 = Rcw2*x3D+tcw2;
+        const float z2 = x3Dc2(2);
+        if(z2<=0)
+            continue;
 
-            //Check reprojection error in first keyframe
-            float sigmaSquare1 = mpCurrentKeyFrame->GetSigma2(kp1.octave);
-            float x1 = Rcw1.row(0).dot(x3Dt)+tcw1.at<float>(0);
-            float y1 = Rcw1.row(1).dot(x3Dt)+tcw1.at<float>(1);
-            float invz1 = 1.0/z1;
-            float u1 = fx1*x1*invz1+cx1;
-            float v1 = fy1*y1*invz1+cy1;
-            float errX1 = u1 - kp1.pt.x;
-            float errY1 = v1 - kp1.pt.y;
-            if((errX1*errX1+errY1*errY1)>5.991*sigmaSquare1)
-                continue;
+        //Check reprojection error in first keyframe
+        const float sigmaSquare1 = pKF1->GetSigma2(kp1.octave);
+        const float invz1 = 1.0/z1;
+        const float u1 = fx1*x3Dc1(0)*invz1+cx1;
+        const float v1 = fy1*x3Dc1(1)*invz1+cy1;
+        const float errX1 = u1 - kp1.pt.x;
+        const float errY1 = v1 - kp1.pt.y;
+        if((errX1*errX1+errY1*errY1)>5.991*sigmaSquare1)
+            continue;
 
-            //Check reprojection error in second keyframe
-            float sigmaSquare2 = pKF2->GetSigma2(kp2.octave);
-            float x2 = Rcw2.row(0).dot(x3Dt)+tcw2.at<float>(0);
-            float y2 = Rcw2.row(1).dot(x3Dt)+tcw2.at<float>(1);
-            float invz2 = 1.0/z2;
-            float u2 = fx2*x2*invz2+cx2;
-            float v2 = fy2*y2*invz2+cy2;
-            float errX2 = u2 - kp2.pt.x;
-            float errY2 = v2 - kp2.pt.y;
-            if((errX2*errX2+errY2*errY2)>5.991*sigmaSquare2)
-                continue;
+        //Check reprojection error in second keyframe
+        const float sigmaSquare2 = pKF2->GetSigma2(kp2.octave);
+        const float invz2 = 1.0/z2;
+        const float u2 = fx2*x3Dc2(0)*invz2+cx2;
+        const float v2 = fy2*x3Dc2(1)*invz2+cy2;
+        const float errX2 = u2 - kp2.pt.x;
+        const float errY2 = v2 - kp2.pt.y;
+        if((errX2*errX2+errY2*errY2)>5.991*sigmaSquare2)
+            continue;
 
-            //Check scale consistency
-            cv::Mat normal1 = x3D-Ow1;
-            float dist1 = cv::norm(normal1);
+        //Check scale consistency
+        const float dist1 = (x3D-Ow1).norm();
+        const float dist2 = (x3D-Ow2).norm();
 
-            cv::Mat normal2 = x3D-Ow2;
-            float dist2 = cv::norm(normal2);
+        if(dist1==0 || dist2==0)
+            continue;
 
-            if(dist1==0 || dist2==0)
-                continue;
+        const float ratioDist = dist1/dist2;
+        const float ratioOctave = pKF1->GetScaleFactor(kp1.octave)/pKF2->GetScaleFactor(kp2.octave);
+        if(ratioDist*ratioFactor<ratioOctave || ratioDist>ratioOctave*ratioFactor)
+            continue;
 
-            float ratioDist = dist1/dist2;
-            float ratioOctave = mpCurrentKeyFrame->GetScaleFactor(kp1.octave)/pKF2->GetScaleFactor(kp2.octave);
-            if(ratioDist*ratioFactor<ratioOctave || ratioDist>ratioOctave*ratioFactor)
-                continue;
+        // Triangulation is successful
+        TriangulatedPoint point;
+        point.idx1 = vMatchedIndices[ikp].first;
+        point.idx2 = vMatchedIndices[ikp].second;
+        point.x3D = x3D;
+        vPoints.push_back(point);
+    }
+}
+
+void LocalMapping::AddTriangulatedPoints(KeyFrame *pKF2, const vector<TriangulatedPoint> &vPoints)
+{
+    Map* pMap = mpCurrentKeyFrame->getMap() ? mpCurrentKeyFrame->getMap() : mapDB->getCurrent();
+    for(size_t i=0; i<vPoints.size(); i++)
+    {
+        const TriangulatedPoint &point = vPoints[i];
 
-            // Triangulation is successful
-            MapPoint* pMP = new MapPoint(x3D,mpCurrentKeyFrame,mapDB->getCurrent());
+        // Already triangulated with a better neighbor, or fused meanwhile
+        if(mpCurrentKeyFrame->GetMapPoint(point.idx1) || pKF2->GetMapPoint(point.idx2))
+            continue;
 
-            pMP->AddObservation(pKF2,idx2);
-            pMP->AddObservation(mpCurrentKeyFrame,idx1);
+        MapPoint* pMP = new MapPoint(Converter::toCvMat(point.x3D),mpCurrentKeyFrame,pMap);
 
-            mpCurrentKeyFrame->AddMapPoint(pMP,idx1);
-            pKF2->AddMapPoint(pMP,idx2);
+        pMP->AddObservation(pKF2,point.idx2);
+        pMP->AddObservation(mpCurrentKeyFrame,point.idx1);
 
-            pMP->ComputeDistinctiveDescriptors();
-            pMP->UpdateNormalAndDepth();
-            mapDB->getCurrent()->AddMapPoint(pMP);
-            mlpRecentAddedMapPoints.push_back(pMP);
-        }
+        mpCurrentKeyFrame->AddMapPoint(pMP,point.idx1);
+        pKF2->AddMapPoint(pMP,point.idx2);
+
+        pMP->ComputeDistinctiveDescriptors();
+        pMP->UpdateNormalAndDepth();
+        pMap->AddMapPoint(pMP);
+        mlpRecentAddedMapPoints.push_back(pMP);
     }
 }
 
 void LocalMapping::SearchInNeighbors()
 {
+    TRACE_SCOPE("LocalMapping::SearchInNeighbors");
+    ALLOC_SCOPE(SEARCH_IN_NEIGHBORS);
+
     // Retrieve neighbor keyframes
     vector<KeyFrame*> vpNeighKFs = mpCurrentKeyFrame->GetBestCovisibilityKeyFrames(20);
     vector<KeyFrame*> vpTargetKFs;
@@ -380,10 +826,10 @@ void LocalMapping::SearchInNeighbors()
         pKFi->mnFuseTargetForKF = mpCurrentKeyFrame->mnId;
 
         // Extend to some second neighbors
-        vector<KeyFrame*> vpSecondNeighKFs = pKFi->GetBestCovisibilityKeyFrames(5);
-        for(vector<KeyFrame*>::iterator vit2=vpSecondNeighKFs.begin(), vend2=vpSecondNeighKFs.end(); vit2!=vend2; vit2++)
+        KeyFrame::KeyFrameList pSecondNeighKFs = pKFi->GetCovisibleList();
+        for(size_t j=0, jend=min<size_t>(5,pSecondNeighKFs->size()); j<jend; j++)
         {
-            KeyFrame* pKFi2 = *vit2;
+            KeyFrame* pKFi2 = (*pSecondNeighKFs)[j];
             if(pKFi2->isBad() || pKFi2->mnFuseTargetForKF==mpCurrentKeyFrame->mnId || pKFi2->mnId==mpCurrentKeyFrame->mnId)
                 continue;
             vpTargetKFs.push_back(pKFi2);
@@ -392,13 +838,45 @@ void LocalMapping::SearchInNeighbors()
 
 
     // Search matches by projection from current KF in target KFs
+    // The targets are taken by covisibility rank until the budget is spent
+    StartStage();
     ORBmatcher matcher(0.6);
     vector<MapPoint*> vpMapPointMatches = mpCurrentKeyFrame->GetMapPointMatches();
-    for(vector<KeyFrame*>::iterator vit=vpTargetKFs.begin(), vend=vpTargetKFs.end(); vit!=vend; vit++)
+    const int nWorkers = min(mnThreads,(int)vpTargetKFs.size());
+    if(nWorkers>1)
     {
-        KeyFrame* pKFi = *vit;
+        // The projections only read the map, each target keyframe on a worker
+        mpvpNeighKFs = &vpTargetKFs;
+        mpvpFuseCandidates = &vpMapPointMatches;
+        mvvFuseMatches.assign(vpTargetKFs.size(),vector<MapPoint*>());
+        mnNextNeighbor = 0;
+
+        TaskGroup workers(TaskPool::LOCAL_MAPPING);
+        for(int i=0; i<nWorkers-1; i++)
+            workers.Run(boost::bind(&LocalMapping::SearchFuseTargets,this));
+        // The calling thread also takes its share of keyframes
+        SearchFuseTargets();
+        workers.Wait();
+
+        // The matches are applied in the order of the targets, as sequentially
+        // Covisibility counts and descriptors are updated once for all the targets
+        MapPointFusion fusion;
+        for(size_t i=0; i<vpTargetKFs.size(); i++)
+            ApplyFuseMatches(vpTargetKFs[i],mvvFuseMatches[i],fusion);
+        fusion.Commit();
+
+        mvvFuseMatches.clear();
+        mpvpFuseCandidates = NULL;
+        mpvpNeighKFs = NULL;
+    }
+    else
+    {
+        for(vector<KeyFrame*>::iterator vit=vpTargetKFs.begin(), vend=vpTargetKFs.end(); vit!=vend && !StageExpired(); vit++)
+        {
+            KeyFrame* pKFi = *vit;
 
-        matcher.Fuse(pKFi,vpMapPointMatches);
+            matcher.Fuse(pKFi,vpMapPointMatches);
+        }
     }
 
     // Search matches by projection from target KFs in current KF
@@ -409,9 +887,9 @@ void LocalMapping::SearchInNeighbors()
     {
         KeyFrame* pKFi = *vitKF;
 
-        vector<MapPoint*> vpMapPointsKFi = pKFi->GetMapPointMatches();
+        KeyFrame::MapPointList pMapPointsKFi = pKFi->GetMapPointMatchList();
 
-        for(vector<MapPoint*>::iterator vitMP=vpMapPointsKFi.begin(), vendMP=vpMapPointsKFi.end(); vitMP!=vendMP; vitMP++)
+        for(vector<MapPoint*>::const_iterator vitMP=pMapPointsKFi->begin(), vendMP=pMapPointsKFi->end(); vitMP!=vendMP; vitMP++)
         {
             MapPoint* pMP = *vitMP;
             if(!pMP)
@@ -445,6 +923,49 @@ void LocalMapping::SearchInNeighbors()
     mpCurrentKeyFrame->UpdateConnections();
 }
 
+void LocalMapping::SearchFuseTargets()
+{
+    ORBmatcher matcher(0.6);
+
+    while(true)
+    {
+        int nTarget;
+        {
+            PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexNeighbor);
+            nTarget = mnNextNeighbor++;
+        }
+
+        if(nTarget>=(int)mpvpNeighKFs->size() || StageExpired())
+            break;
+
+        matcher.Fuse((*mpvpNeighKFs)[nTarget],*mpvpFuseCandidates,2.5,mvvFuseMatches[nTarget]);
+    }
+}
+
+void LocalMapping::ApplyFuseMatches(KeyFrame *pKF, const vector<MapPoint*> &vpMatched, MapPointFusion &fusion)
+{
+    for(size_t idx=0, iend=vpMatched.size(); idx<iend; idx++)
+    {
+        MapPoint* pMP = vpMatched[idx];
+        if(!pMP)
+            continue;
+
+        // Replaced by a previous target, or already fused in this one
+        if(pMP->isBad() || pMP->IsInKeyFrame(pKF))
+            continue;
+
+        // If there is already a MapPoint replace otherwise add new measurement
+        MapPoint* pMPinKF = pKF->GetMapPoint(idx);
+        if(pMPinKF)
+        {
+            if(!pMPinKF->isBad())
+                fusion.Replace(pMP,pMPinKF);
+        }
+        else
+            fusion.Add(pMP,pKF,idx);
+    }
+}
+
 cv::Mat LocalMapping::ComputeF12(KeyFrame *&pKF1, KeyFrame *&pKF2)
 {
     cv::Mat R1w = pKF1->GetRotation();
@@ -466,47 +987,63 @@ cv::Mat LocalMapping::ComputeF12(KeyFrame *&pKF1, KeyFrame *&pKF2)
 
 void LocalMapping::Release()
 {
+    Wake();
     boost::mutex::scoped_lock lock(mMutexStop);
-    boost::mutex::scoped_lock lock2(mMutexNewKFs);
     mbStopped = false;
     mbStopRequested = false;
+    mCondStop.notify_all();
     // We do not need to delete keyframes any more because they are linked to maps
-    //    for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
-    //        delete *lit;
-    mlNewKeyFrames.clear();
+    mqNewKeyFrames.DiscardQueued();
 }
 
 bool LocalMapping::AcceptKeyFrames()
 {
-    boost::mutex::scoped_lock lock(mMutexAccept);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexAccept);
     return mbAcceptKeyFrames;
 }
 
 void LocalMapping::SetAcceptKeyFrames(bool flag)
 {
-    boost::mutex::scoped_lock lock(mMutexAccept);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexAccept);
     mbAcceptKeyFrames=flag;
 }
 
 void LocalMapping::InterruptBA()
 {
-    mbAbortBA = true;
+    if(!mbForcedBA)
+        mbAbortBA = true;
+    for(size_t i=0; i<mvpWorkers.size(); i++)
+        mvpWorkers[i]->InterruptBA();
+}
+
+void LocalMapping::StartStage()
+{
+    mStageDeadline = ros::WallTime::now()+ros::WallDuration(mfStageBudget);
+}
+
+bool LocalMapping::StageExpired()
+{
+    return mfStageBudget>0 && CheckNewKeyFrames() && ros::WallTime::now()>mStageDeadline;
 }
 
 
 void LocalMapping::KeyFrameCulling()
 {
+    TRACE_SCOPE("LocalMapping::KeyFrameCulling");
+    ALLOC_SCOPE(KEYFRAME_CULLING);
+
     // Check redundant keyframes (only local keyframes)
     // A keyframe is considered redundant if the 90% of the MapPoints it sees, are seen
     // in at least other 3 keyframes (in the same or finer scale)
-    vector<KeyFrame*> vpLocalKeyFrames = mpCurrentKeyFrame->GetVectorCovisibleKeyFrames();
+    KeyFrame::KeyFrameList pLocalKeyFrames = mpCurrentKeyFrame->GetCovisibleList();
 
-    for(vector<KeyFrame*>::iterator vit=vpLocalKeyFrames.begin(), vend=vpLocalKeyFrames.end(); vit!=vend; vit++)
+    for(vector<KeyFrame*>::const_iterator vit=pLocalKeyFrames->begin(), vend=pLocalKeyFrames->end(); vit!=vend; vit++)
     {
         KeyFrame* pKF = *vit;
         if(pKF->mnId==0)
             continue;
-        vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
+        KeyFrame::MapPointList pMapPoints = pKF->GetMapPointMatchList();
+        const vector<MapPoint*> &vpMapPoints = *pMapPoints;
 
         int nRedundantObservations=0;
         int nMPs=0;
@@ -520,22 +1057,9 @@ void LocalMapping::KeyFrameCulling()
                     nMPs++;
                     if(pMP->Observations()>3)
                     {
-                        int scaleLevel = pKF->GetKeyPointUn(i).octave;
-                        map<KeyFrame*, size_t> observations = pMP->GetObservations();
-                        int nObs=0;
-                        for(map<KeyFrame*, size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-                        {
-                            KeyFrame* pKFi = mit->first;
-                            if(pKFi==pKF)
-                                continue;
-                            int scaleLeveli = pKFi->GetKeyPointUn(mit->second).octave;
-                            if(scaleLeveli<=scaleLevel+1)
-                            {
-                                nObs++;
-                                if(nObs>=3)
-                                    break;
-                            }
-                        }
+                        // The keyframe itself is counted, its level is always within
+                        const int scaleLevel = pKF->GetKeyPointScaleLevel(i);
+                        const int nObs = pMP->ObservationsUpToLevel(scaleLevel+1)-1;
                         if(nObs>=3)
                         {
                             nRedundantObservations++;
@@ -550,6 +1074,27 @@ void LocalMapping::KeyFrameCulling()
     }
 }
 
+void LocalMapping::Sparsify()
+{
+    TRACE_SCOPE("LocalMapping::Sparsify");
+
+    if(!mSparsifier.isEnabled() || mnSinceSparsify<SPARSIFY_PERIOD || stopRequested())
+        return;
+
+    Map* pMap = mapDB->getCurrent();
+    if(!pMap)
+        return;
+
+    // Cleared before looking at the queue, a keyframe inserted afterwards sets it again
+    mbAbortBA = false;
+    if(CheckNewKeyFrames())
+        return;
+
+    mSparsifier.Run(pMap,&mbAbortBA);
+    if(!mbAbortBA)
+        mnSinceSparsify = 0;
+}
+
 cv::Mat LocalMapping::SkewSymmetricMatrix(const cv::Mat &v)
 {
     return (cv::Mat_<float>(3,3) <<             0, -v.at<float>(2), v.at<float>(1),
@@ -559,14 +1104,32 @@ cv::Mat LocalMapping::SkewSymmetricMatrix(const cv::Mat &v)
 
 void LocalMapping::ResetIfRequested()
 {
-    boost::mutex::scoped_lock lock(mMutexReset);
-    boost::mutex::scoped_lock lock2(mMutexNewKFs);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexReset);
     if(mbResetRequested)
     {
-        mlNewKeyFrames.clear();
+        mqNewKeyFrames.DiscardQueued();
         mlpRecentAddedMapPoints.clear();
+        mLocalBA.Reset();
+        mnBatched=0;
+        mnSinceSparsify=0;
+        mpDeferredKF=NULL;
+        for(size_t i=0; i<mvpWorkers.size(); i++)
+        {
+            mvpWorkers[i]->RequestReset();
+            mvpWorkers[i]->ResetIfRequested();
+        }
         mbResetRequested=false;
     }
+    else if(mbMapSwitchRequested)
+        SwitchMap();
+    mbMapSwitchRequested=false;
+}
+
+void LocalMapping::SwitchMap()
+{
+    // The queued keyframes are kept, only the window of the previous map is dropped
+    // The workers each own their maps, a switch leaves them alone
+    mLocalBA.Reset();
 }
 
 } //namespace ORB_SLAM
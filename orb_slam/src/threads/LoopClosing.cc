@@ -20,19 +20,34 @@
 
 #include "threads/LoopClosing.h"
 
-#include "util/Sim3Solver.h"
+#include "util/Sim3Verifier.h"
 #include "util/Converter.h"
 #include "util/Optimizer.h"
 #include "util/ORBmatcher.h"
+#include "util/EpochReclaimer.h"
+#include "util/MapJournal.h"
+#include "util/Trace.h"
+#include "util/LockProfiler.h"
+#include "util/Metrics.h"
+#include "util/TaskPool.h"
 
 #include <ros/ros.h>
 #include <g2o/types/sim3/types_seven_dof_expmap.h>
+#include <boost/bind.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace ORB_SLAM
 {
 
-LoopClosing::LoopClosing(MapDatabase *pMap):
-    OrbThread(pMap), mLastLoopKFid(0)
+LoopClosing::LoopClosing(MapDatabase *pMap, int nThreads, bool bConcurrentCorrection, int nGlobalBAIterations):
+    OrbThread(pMap), mqLoopKeyFrameQueue(1024), mSim3Verifier(nThreads), mScheduler(pMap),
+    mnThreads(max(nThreads,1)), mpCorrectedSim3(NULL), mpNonCorrectedSim3(NULL),
+    mbConcurrentCorrection(bConcurrentCorrection), mnGlobalBAIterations(max(nGlobalBAIterations,0)),
+    mpThreadGBA(NULL), mbStopGBA(false)
 {
     mnCovisibilityConsistencyTh = 3;
     mpMatchedKF = NULL;
@@ -40,111 +55,187 @@ LoopClosing::LoopClosing(MapDatabase *pMap):
 
 void LoopClosing::Run()
 {
-    ros::Rate r(500);
-    while(ros::ok())
+    while(isRunning())
     {
-        // Reset if needed
-        ResetIfRequested();
+        Step();
 
-        // Check if there are keyframes in the queue
-        if(CheckNewKeyFrames())
-        {
-            {
-                boost::mutex::scoped_lock lock(mMutexLoopQueue);
-                mpCurrentKF = mlpLoopKeyFrameQueue.front();
-                mlpLoopKeyFrameQueue.pop_front();
-                // Avoid that a keyframe can be erased while it is being process by this thread
-                mpCurrentKF->SetNotErase();
-            }
-            // Check that we have a map initialized
-            if(mapDB->getCurrent() != NULL)
-            {
-                // Detect loop candidates and check covisibility consistency
-                if(DetectLoop())
-                {
-                   // Compute similarity transformation [sR|t]
-                   if(ComputeSim3())
-                   {
-                       // Perform loop fusion and pose graph optimization
-                       ROS_INFO("ORB-SLAM - Loop Close Detected");
-                       CorrectLoop();
-                       ROS_INFO("ORB-SLAM - Loop Closed");
-                   }
-                }
-            }
-            // If the map is null, we can't handle this keyframe
-            else
-            {
-                // Allow the current keyframe to be deleted now    
-                mpCurrentKF->SetErase();
-            }
-        }
-        
         // Safe area to stop
         if(stopRequested())
         {
             Stop();
-            ros::Rate r2(200);
-            while(isStopped() && ros::ok())
-            {
-                r2.sleep();
-            }
+            WaitWhileStopped();
+        }
+        // Sleep until there is something to do
+        if(!CheckNewKeyFrames())
+            WaitForWork();
+    }
+
+    StopGlobalBA();
+}
+
+bool LoopClosing::Step()
+{
+    // Reset if needed
+    ResetIfRequested();
+
+    // Let the map objects culled meanwhile be reclaimed
+    Quiescent();
+
+    // Check if there is a keyframe to query, the current keyframe is kept from being erased
+    if(!NextKeyFrame())
+        return false;
+
+    // A keyframe queued before a map switch is only indexed in its own map, loops are closed in the current one
+    Map* pMap = mpCurrentKF->getMap();
+    if(mapDB->getCurrent() != NULL && pMap != mapDB->getCurrent() && !pMap->getErased())
+    {
+        mScheduler.Done();
+        SkipKeyFrame(mpCurrentKF);
+    }
+    // Check that we have a map initialized
+    else if(mapDB->getCurrent() != NULL)
+    {
+        // Detect loop candidates and check covisibility consistency
+        // Compute similarity transformation [sR|t]
+        const bool bLoop = DetectLoop() && ComputeSim3();
+        mScheduler.Done();
+        if(bLoop)
+        {
+           // Perform loop fusion and pose graph optimization
+           ROS_INFO("ORB-SLAM - Loop Close Detected");
+           Metrics::Global()->Add(Metrics::LOOPS_DETECTED);
+           CorrectLoop();
+           Metrics::Global()->Add(Metrics::LOOPS_CORRECTED);
+           ROS_INFO("ORB-SLAM - Loop Closed");
         }
-        // Sleep
-        r.sleep();
     }
+    // If the map is null, we can't handle this keyframe
+    else
+    {
+        // Allow the current keyframe to be deleted now    
+        mpCurrentKF->SetErase();
+    }
+    return true;
+}
+
+void LoopClosing::PurgeBadPointers()
+{
+    mvpCurrentMatchedPoints.clear();
+    mvpLoopMapPoints.clear();
 }
 
 void LoopClosing::InsertKeyFrame(KeyFrame *pKF)
 {
-    boost::mutex::scoped_lock lock(mMutexLoopQueue);
-    if(pKF->mnId!=0)
-        mlpLoopKeyFrameQueue.push_back(pKF);
+    if(pKF->mnId==0)
+        return;
+    // Loop detection can fall behind while a loop is corrected, skip the keyframe rather than block Local Mapping
+    if(!mqLoopKeyFrameQueue.Push(pKF))
+    {
+        ROS_WARN("ORB-SLAM - Loop closing queue full, keyframe %d skipped.", (int)pKF->mnId);
+        return;
+    }
+    Wake();
+}
+
+int LoopClosing::KeyframesInQueue()
+{
+    return mqLoopKeyFrameQueue.Size();
+}
+
+int LoopClosing::KeyframeQueueHighWater()
+{
+    return mqLoopKeyFrameQueue.HighWater();
 }
 
 bool LoopClosing::CheckNewKeyFrames()
 {
-    boost::mutex::scoped_lock lock(mMutexLoopQueue);
-    return(!mlpLoopKeyFrameQueue.empty());
+    return(!mqLoopKeyFrameQueue.Empty());
 }
 
-bool LoopClosing::DetectLoop()
+void LoopClosing::SetScheduling(float fMaxLatency, float fMaxDuty)
 {
-    //If the map contains less than 10 KF or less than 10KF have passed from last loop detection
-    if(mpCurrentKF->mnId<mLastLoopKFid+10)
+    mScheduler.SetLimits(fMaxLatency,fMaxDuty);
+}
+
+bool LoopClosing::NextKeyFrame()
+{
+    // Synchronous runs query every keyframe, the scheduling depends on the timing
+    if(!mScheduler.isEnabled() || isSynchronous())
     {
-        mapDB->getCurrent()->GetKeyFrameDatabase()->add(mpCurrentKF);
-        mpCurrentKF->SetErase();
-        return false;
+        if(!mqLoopKeyFrameQueue.Pop(mpCurrentKF))
+            return false;
+        // Avoid that a keyframe can be erased while it is being process by this thread
+        mpCurrentKF->SetNotErase();
+        return true;
     }
 
+    // Every queued keyframe is decided now, only the most distinctive one waits for its query
+    KeyFrame* pKF;
+    while(mqLoopKeyFrameQueue.Pop(pKF))
+    {
+        KeyFrame* pSkipped = mScheduler.Add(pKF);
+        if(pSkipped)
+            SkipKeyFrame(pSkipped);
+    }
+
+    mpCurrentKF = mScheduler.Next();
+    return mpCurrentKF!=NULL;
+}
+
+void LoopClosing::SkipKeyFrame(KeyFrame *pKF)
+{
+    Metrics::Global()->Add(Metrics::LOOP_QUERIES_SKIPPED);
+    Map* pMap = pKF->getMap();
+    if(pMap && !pMap->getErased() && !pKF->isBad())
+        pMap->GetKeyFrameDatabase()->add(pKF);
+    pKF->SetErase();
+}
+
+bool LoopClosing::DetectLoop()
+{
+    TRACE_SCOPE("LoopClosing::DetectLoop");
+
+    // Consistency of the candidates of this map, parked while another map was current
+    mParkedStates.Select(mpCurrentKF->getMap(), mDetectorState);
+
     // Compute reference BoW similarity score
     // This is the lowest score to a connected keyframe in the covisibility graph
     // We will impose loop candidates to have a higher similarity than this
     vector<KeyFrame*> vpConnectedKeyFrames = mpCurrentKF->GetVectorCovisibleKeyFrames();
-    DBoW2::BowVector CurrentBowVec = mpCurrentKF->GetBowVector();
+    DBoW2::FlatBowVector CurrentBowVec;
+    mpCurrentKF->GetFlatBowVector(CurrentBowVec);
     float minScore = 1;
     for(size_t i=0; i<vpConnectedKeyFrames.size(); i++)
     {
         KeyFrame* pKF = vpConnectedKeyFrames[i];
         if(pKF->isBad())
             continue;
-        DBoW2::BowVector BowVec = pKF->GetBowVector();
-
-        float score = mapDB->getVocab()->score(CurrentBowVec, BowVec);
+        float score = mapDB->Score(mpCurrentKF, CurrentBowVec, pKF);
 
         if(score<minScore)
             minScore = score;
     }
 
-    // Query the database imposing the minimum score
-    vector<KeyFrame*> vpCandidateKFs = mapDB->getCurrent()->GetKeyFrameDatabase()->DetectLoopCandidates(mpCurrentKF, minScore);
+    // Query the database of all maps imposing the minimum score, once for loops and merges
+    // The candidates in the other maps are checked by the map merger
+    vector<KeyFrame*> vpCandidateKFs, vpMergeCandidateKFs;
+    mapDB->DetectLoopCandidates(mpCurrentKF, minScore, mapDB->getCurrent(), vpCandidateKFs, vpMergeCandidateKFs);
+    if(mpMapMerger)
+        mpMapMerger->InsertCandidates(mpCurrentKF, vpMergeCandidateKFs);
+
+    //If the map contains less than 10 KF or less than 10KF have passed from last loop detection
+    if(mpCurrentKF->mnId<mDetectorState.nLastLoopKFid+10)
+    {
+        mapDB->getCurrent()->GetKeyFrameDatabase()->add(mpCurrentKF);
+        mpCurrentKF->SetErase();
+        return false;
+    }
 
     // If there are no loop candidates, just add new keyframe and return false
     if(vpCandidateKFs.empty())
     {
         mapDB->getCurrent()->GetKeyFrameDatabase()->add(mpCurrentKF);
-        mvConsistentGroups.clear();
+        mDetectorState.vConsistentGroups.clear();
         mpCurrentKF->SetErase();
         return false;
     }
@@ -156,34 +247,24 @@ bool LoopClosing::DetectLoop()
     mvpEnoughConsistentCandidates.clear();
 
     vector<ConsistentGroup> vCurrentConsistentGroups;
-    vector<bool> vbConsistentGroup(mvConsistentGroups.size(),false);
+    vector<bool> vbConsistentGroup(mDetectorState.vConsistentGroups.size(),false);
     for(size_t i=0, iend=vpCandidateKFs.size(); i<iend; i++)
     {
         KeyFrame* pCandidateKF = vpCandidateKFs[i];
         
-        set<KeyFrame*> spCandidateGroup = pCandidateKF->GetConnectedKeyFrames();
-        spCandidateGroup.insert(pCandidateKF);
+        CovisibilityGroup spCandidateGroup(pCandidateKF);
 
         bool bEnoughConsistent = false;
         bool bConsistentForSomeGroup = false;
-        for(size_t iG=0, iendG=mvConsistentGroups.size(); iG<iendG; iG++)
+        for(size_t iG=0, iendG=mDetectorState.vConsistentGroups.size(); iG<iendG; iG++)
         {
-            set<KeyFrame*> sPreviousGroup = mvConsistentGroups[iG].first;
-
-            bool bConsistent = false;
-            for(set<KeyFrame*>::iterator sit=spCandidateGroup.begin(), send=spCandidateGroup.end(); sit!=send;sit++)
-            {
-                if(sPreviousGroup.count(*sit))
-                {
-                    bConsistent=true;
-                    bConsistentForSomeGroup=true;
-                    break;
-                }
-            }
+            bool bConsistent = spCandidateGroup.Intersects(mDetectorState.vConsistentGroups[iG].first);
+            if(bConsistent)
+                bConsistentForSomeGroup=true;
 
             if(bConsistent)
             {
-                int nPreviousConsistency = mvConsistentGroups[iG].second;
+                int nPreviousConsistency = mDetectorState.vConsistentGroups[iG].second;
                 int nCurrentConsistency = nPreviousConsistency + 1;
                 if(!vbConsistentGroup[iG])
                 {
@@ -208,7 +289,7 @@ bool LoopClosing::DetectLoop()
     }
 
     // Update Covisibility Consistent Groups
-    mvConsistentGroups = vCurrentConsistentGroups;
+    mDetectorState.vConsistentGroups.swap(vCurrentConsistentGroups);
 
 
     // Add Current Keyframe to database
@@ -229,126 +310,37 @@ bool LoopClosing::DetectLoop()
 
 bool LoopClosing::ComputeSim3()
 {
-    // For each consistent loop candidate we try to compute a Sim3
+    TRACE_SCOPE("LoopClosing::ComputeSim3");
 
+    // For each consistent loop candidate we try to compute a Sim3
     const int nInitialCandidates = mvpEnoughConsistentCandidates.size();
 
-    // We compute first ORB matches for each candidate
-    // If enough matches are found, we setup a Sim3Solver
-    ORBmatcher matcher(0.75,true);
-
-    vector<Sim3Solver*> vpSim3Solvers;
-    vpSim3Solvers.resize(nInitialCandidates);
-
-    vector<vector<MapPoint*> > vvpMapPointMatches;
-    vvpMapPointMatches.resize(nInitialCandidates);
-
-    vector<bool> vbDiscarded;
-    vbDiscarded.resize(nInitialCandidates);
-
-    int nCandidates=0; //candidates with enough matches
-
+    // avoid that local mapping erase them while they are being processed in this thread
     for(int i=0; i<nInitialCandidates; i++)
-    {
-        KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
-
-        // avoid that local mapping erase it while it is being processed in this thread
-        pKF->SetNotErase();
-
-        if(pKF->isBad())
-        {
-            vbDiscarded[i] = true;
-            continue;
-        }
-
-        int nmatches = matcher.SearchByBoW(mpCurrentKF,pKF,vvpMapPointMatches[i]);
-
-        if(nmatches<20)
-        {
-            vbDiscarded[i] = true;
-            continue;
-        }
-        else
-        {
-            Sim3Solver* pSolver = new Sim3Solver(mpCurrentKF,pKF,vvpMapPointMatches[i]);
-            pSolver->SetRansacParameters(0.99,20,300);
-            vpSim3Solvers[i] = pSolver;
-        }
-
-        nCandidates++;
-    }
-
-    bool bMatch = false;
-
-    // Perform alternatively RANSAC iterations for each candidate
-    // until one is successful or all fail
-    while(nCandidates>0 && !bMatch)
-    {
-        for(int i=0; i<nInitialCandidates; i++)
-        {
-            if(vbDiscarded[i])
-                continue;
-
-            KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
-
-            // Perform 5 Ransac Iterations
-            vector<bool> vbInliers;
-            int nInliers;
-            bool bNoMore;
-
-            Sim3Solver* pSolver = vpSim3Solvers[i];
-            cv::Mat Scm  = pSolver->iterate(5,bNoMore,vbInliers,nInliers);
-
-            // If Ransac reaches max. iterations discard keyframe
-            if(bNoMore)
-            {
-                vbDiscarded[i]=true;
-                nCandidates--;
-            }
-
-            // If RANSAC returns a Sim3, perform a guided matching and optimize with all correspondences
-            if(!Scm.empty())
-            {
-                vector<MapPoint*> vpMapPointMatches(vvpMapPointMatches[i].size(), static_cast<MapPoint*>(NULL));
-                for(size_t j=0, jend=vbInliers.size(); j<jend; j++)
-                {
-                    if(vbInliers[j])
-                       vpMapPointMatches[j]=vvpMapPointMatches[i][j];
-                }
-
-                cv::Mat R = pSolver->GetEstimatedRotation();
-                cv::Mat t = pSolver->GetEstimatedTranslation();
-                const float s = pSolver->GetEstimatedScale();
-                matcher.SearchBySim3(mpCurrentKF,pKF,vpMapPointMatches,s,R,t,7.5);
+        mvpEnoughConsistentCandidates[i]->SetNotErase();
 
-
-                g2o::Sim3 gScm(Converter::toMatrix3d(R),Converter::toVector3d(t),s);
-                const int nInliers = Optimizer::OptimizeSim3(mpCurrentKF, pKF, vpMapPointMatches, gScm, 10);
-
-                // If optimization is successful stop ransacs and continue
-                if(nInliers>=20)
-                {
-                    bMatch = true;
-                    mpMatchedKF = pKF;
-                    g2o::Sim3 gSmw(Converter::toMatrix3d(pKF->GetRotation()),Converter::toVector3d(pKF->GetTranslation()),1.0);
-                    mg2oScw = gScm*gSmw;
-                    mScw = Converter::toCvMat(mg2oScw);
-
-                    mvpCurrentMatchedPoints = vpMapPointMatches;
-                    break;
-                }
-            }
-        }
-    }
+    // Match and run RANSAC on the candidates until one is successful or all fail
+    g2o::Sim3 gScm;
+    const int nMatch = mSim3Verifier.Verify(mpCurrentKF,mvpEnoughConsistentCandidates,gScm,mvpCurrentMatchedPoints);
 
     // If we do not have a match, allow all our candidates and the current KF to be erased
-    if(!bMatch)
+    if(nMatch<0)
     {
         for(int i=0; i<nInitialCandidates; i++)
              mvpEnoughConsistentCandidates[i]->SetErase();
         mpCurrentKF->SetErase();
         return false;
     }
+    else
+    {
+        mpMatchedKF = mvpEnoughConsistentCandidates[nMatch];
+        g2o::Sim3 gSmw(Converter::toMatrix3d(mpMatchedKF->GetRotation()),Converter::toVector3d(mpMatchedKF->GetTranslation()),1.0);
+        mg2oScw = gScm*gSmw;
+        mScw = Converter::toCvMat(mg2oScw);
+    }
+
+    // Guided matching and Sim3 projection
+    ORBmatcher matcher(0.75,true);
 
     // Retrieve MapPoints seen in Loop Keyframe and neighbors
     vector<KeyFrame*> vpLoopConnectedKFs = mpMatchedKF->GetVectorCovisibleKeyFrames();
@@ -357,10 +349,10 @@ bool LoopClosing::ComputeSim3()
     for(vector<KeyFrame*>::iterator vit=vpLoopConnectedKFs.begin(); vit!=vpLoopConnectedKFs.end(); vit++)
     {
         KeyFrame* pKF = *vit;
-        vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
-        for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
+        KeyFrame::MapPointList pMapPoints = pKF->GetMapPointMatchList();
+        for(size_t i=0, iend=pMapPoints->size(); i<iend; i++)
         {
-            MapPoint* pMP = vpMapPoints[i];
+            MapPoint* pMP = (*pMapPoints)[i];
             if(pMP)
             {
                 if(!pMP->isBad() && pMP->mnLoopPointForKF!=mpCurrentKF->mnId)
@@ -403,6 +395,11 @@ bool LoopClosing::ComputeSim3()
 
 void LoopClosing::CorrectLoop()
 {
+    TRACE_SCOPE("LoopClosing::CorrectLoop");
+
+    // The global BA of a previous loop would undo this correction
+    StopGlobalBA();
+
     // Send a stop signal to Local Mapping
     // Avoid new keyframes are inserted while correcting the loop
     // Avoid this map getting combined with another one
@@ -410,12 +407,13 @@ void LoopClosing::CorrectLoop()
     mpMapMerger->RequestStop();
 
     // Wait until Local Mapping has effectively stopped
-    ros::Rate r(1e4);
-    while(ros::ok() && (!mpLocalMapper->isStopped() || !mpMapMerger->isStopped()))
-    {
-        r.sleep();
-    }
+    mpLocalMapper->WaitUntilStopped();
+    mpMapMerger->WaitUntilStopped();
     
+    // Readers keep the snapshot from before the correction until it is done
+    Map* pMap = mpCurrentKF->getMap();
+    pMap->BeginUpdate();
+
     // Ensure current keyframe is updated
     mpCurrentKF->UpdateConnections();
 
@@ -453,18 +451,24 @@ void LoopClosing::CorrectLoop()
     }
 
     // Correct all MapPoints observed by current keyframe and neighbors, so that they align with the other side of the loop
+    // Each point is corrected by the first keyframe that sees it, as sequentially. The corrections only depend
+    // on the poses computed above, so the keyframe poses are set first and the points are corrected in parallel
+    mvpCorrectedKFs.clear();
+    mvvpCorrectedPoints.clear();
+    mvvpCorrectedPoints.resize(CorrectedSim3.size());
     for(KeyFrameAndPose::iterator mit=CorrectedSim3.begin(), mend=CorrectedSim3.end(); mit!=mend; mit++)
     {
         KeyFrame* pKFi = mit->first;
         g2o::Sim3 g2oCorrectedSiw = mit->second;
-        g2o::Sim3 g2oCorrectedSwi = g2oCorrectedSiw.inverse();
 
-        g2o::Sim3 g2oSiw =NonCorrectedSim3[pKFi];
+        vector<MapPoint*> &vpCorrected = mvvpCorrectedPoints[mvpCorrectedKFs.size()];
+        mvpCorrectedKFs.push_back(pKFi);
 
-        vector<MapPoint*> vpMPsi = pKFi->GetMapPointMatches();
-        for(size_t iMP=0, endMPi = vpMPsi.size(); iMP<endMPi; iMP++)
+        KeyFrame::MapPointList pMPsi = pKFi->GetMapPointMatchList();
+        vpCorrected.reserve(pMPsi->size());
+        for(size_t iMP=0, endMPi = pMPsi->size(); iMP<endMPi; iMP++)
         {
-            MapPoint* pMPi = vpMPsi[iMP];
+            MapPoint* pMPi = (*pMPsi)[iMP];
             if(!pMPi)
                 continue;
             if(pMPi->isBad())
@@ -472,16 +476,9 @@ void LoopClosing::CorrectLoop()
             if(pMPi->mnCorrectedByKF==mpCurrentKF->mnId)
                 continue;
 
-            // Project with non-corrected pose and project back with corrected pose
-            cv::Mat P3Dw = pMPi->GetWorldPos();
-            Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
-            Eigen::Matrix<double,3,1> eigCorrectedP3Dw = g2oCorrectedSwi.map(g2oSiw.map(eigP3Dw));
-
-            cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
-            pMPi->SetWorldPos(cvCorrectedP3Dw);
             pMPi->mnCorrectedByKF = mpCurrentKF->mnId;
             pMPi->mnCorrectedReference = pKFi->mnId;
-            pMPi->UpdateNormalAndDepth();
+            vpCorrected.push_back(pMPi);
         }
 
         // Update keyframe pose with corrected Sim3. First transform Sim3 to SE3 (scale translation)
@@ -494,28 +491,47 @@ void LoopClosing::CorrectLoop()
         cv::Mat correctedTiw = Converter::toCvSE3(eigR,eigt);
 
         pKFi->SetPose(correctedTiw);
+    }
 
-        // Make sure connections are updated
-        pKFi->UpdateConnections();
-    }    
+    mpCorrectedSim3 = &CorrectedSim3;
+    mpNonCorrectedSim3 = &NonCorrectedSim3;
+    const int nCorrectionWorkers = min(mnThreads,(int)mvpCorrectedKFs.size());
+    {
+        TaskGroup workers(TaskPool::LOOP_CLOSING);
+        for(int i=1; i<nCorrectionWorkers; i++)
+            workers.Run(boost::bind(&LoopClosing::CorrectMapPoints,this,i,nCorrectionWorkers));
+        // The calling thread also takes its share of keyframes
+        CorrectMapPoints(0,nCorrectionWorkers);
+        workers.Wait();
+    }
+    mpCorrectedSim3 = NULL;
+    mpNonCorrectedSim3 = NULL;
+    mvvpCorrectedPoints.clear();
+
+    // Make sure connections are updated
+    for(size_t i=0; i<mvpCorrectedKFs.size(); i++)
+        mvpCorrectedKFs[i]->UpdateConnections();
 
     // Start Loop Fusion
     // Update matched map points and replace if duplicated
-    for(size_t i=0; i<mvpCurrentMatchedPoints.size(); i++)
     {
-        if(mvpCurrentMatchedPoints[i])
+        MapPointFusion fusion;
+        for(size_t i=0; i<mvpCurrentMatchedPoints.size(); i++)
         {
-            MapPoint* pLoopMP = mvpCurrentMatchedPoints[i];
-            MapPoint* pCurMP = mpCurrentKF->GetMapPoint(i);
-            if(pCurMP)
-                pCurMP->Replace(pLoopMP);
-            else
+            if(mvpCurrentMatchedPoints[i])
             {
-                mpCurrentKF->AddMapPoint(pLoopMP,i);
-                pLoopMP->AddObservation(mpCurrentKF,i);
-                pLoopMP->ComputeDistinctiveDescriptors();
+                MapPoint* pLoopMP = mvpCurrentMatchedPoints[i];
+                MapPoint* pCurMP = mpCurrentKF->GetMapPoint(i);
+                if(pCurMP)
+                    fusion.Replace(pCurMP,pLoopMP);
+                else
+                {
+                    fusion.Add(pLoopMP,mpCurrentKF,i);
+                    pLoopMP->ComputeDistinctiveDescriptors();
+                }
             }
         }
+        fusion.Commit();
     }
 
     // Project MapPoints observed in the neighborhood of the loop keyframe
@@ -546,63 +562,345 @@ void LoopClosing::CorrectLoop()
     }
 
     // We are going to optimize over the essential pose graph with the sim3s we have computed beforehand
-    Optimizer::OptimizeEssentialGraph(mpCurrentKF->getMap(), mpMatchedKF, mpCurrentKF,  mg2oScw, NonCorrectedSim3, CorrectedSim3, LoopConnections);
+    if(mbConcurrentCorrection)
+    {
+        // Local Mapping goes on with the keyframes queued meanwhile, the correction is applied
+        // to what it changes, and its new keyframes follow their parents in the spanning tree
+        // Readers keep the snapshot from before the loop until the correction is applied
+        mpLocalMapper->Release();
+
+        EssentialGraphCorrection correction;
+        Optimizer::OptimizeEssentialGraph(pMap, mpMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, correction);
+
+        mpLocalMapper->RequestStop();
+        mpLocalMapper->WaitUntilStopped();
+
+        Optimizer::ApplyEssentialGraph(pMap, mpCurrentKF, correction);
+    }
+    else
+        Optimizer::OptimizeEssentialGraph(pMap, mpMatchedKF, mpCurrentKF,  mg2oScw, NonCorrectedSim3, CorrectedSim3, LoopConnections);
 
     //Add edge
     mpMatchedKF->AddLoopEdge(mpCurrentKF);
     mpCurrentKF->AddLoopEdge(mpMatchedKF);
 
+    pMap->EndUpdate();
+    mapDB->getJournal()->MapAdjusted(pMap);
+
     // Loop closed. Release Local Mapping.
     mpLocalMapper->Release();
     mpMapMerger->Release();
 
     // We optimized the essential graph, so we don't need to do BA
-    mpCurrentKF->getMap()->SetFlagAfterBA();
+    pMap->SetFlagAfterBA();
 
     // Update the local last loop id var
-    mLastLoopKFid = mpCurrentKF->mnId;
+    mDetectorState.nLastLoopKFid = mpCurrentKF->mnId;
+
+    // Force the tracker to relocalize in the new map, there is none in a replay of the keyframes
+    if(mpTracker)
+        mpTracker->ForceInlineRelocalisation();
+
+    if(mnGlobalBAIterations>0)
+        StartGlobalBA(pMap);
+}
+
+void LoopClosing::StartGlobalBA(Map* pMap)
+{
+    mbStopGBA = false;
+    // Synchronous, it is applied before the next keyframe, so at the same point of every run
+    if(isSynchronous())
+    {
+        RunGlobalBA(pMap);
+        return;
+    }
+    mpThreadGBA = new boost::thread(&LoopClosing::RunGlobalBA,this,pMap);
+}
+
+void LoopClosing::StopGlobalBA()
+{
+    if(!mpThreadGBA)
+        return;
+
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexGBA);
+        mbStopGBA = true;
+    }
+    mpThreadGBA->join();
+    delete mpThreadGBA;
+    mpThreadGBA = NULL;
+}
+
+void LoopClosing::RunGlobalBA(Map* pMap)
+{
+    TRACE_SCOPE("LoopClosing::RunGlobalBA");
+
+#ifdef __linux__
+    if(!isSynchronous())
+    {
+        // Below the tracking threads, the BA only takes CPU time nobody else wants
+        sched_param param;
+        param.sched_priority = 0;
+        pthread_setschedparam(pthread_self(),SCHED_IDLE,&param);
+    }
+#endif
+
+    // Nothing culled meanwhile is reclaimed, this thread never goes quiescent
+    EpochReclaimer* pReclaimer = EpochReclaimer::Global();
+    const int nEpochId = pReclaimer->Register();
+
+    ROS_INFO("ORB-SLAM - Global BA started");
+
+    vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+    vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
+    BundleAdjustmentResult result;
+    Optimizer::BundleAdjustment(vpKFs,vpMPs,result,mnGlobalBAIterations,&mbStopGBA,Optimizer::UseIterative(vpKFs.size()));
+
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexGBA);
+        if(mbStopGBA || pMap->getErased())
+        {
+            ROS_INFO("ORB-SLAM - Global BA interrupted");
+            pReclaimer->Unregister(nEpochId);
+            return;
+        }
+
+        ApplyGlobalBA(pMap,result);
+    }
+
+    ROS_INFO("ORB-SLAM - Global BA applied");
+    pReclaimer->Unregister(nEpochId);
+}
+
+void LoopClosing::ApplyGlobalBA(Map* pMap, BundleAdjustmentResult &result)
+{
+    // Tracking goes on, only the threads changing the map wait
+    // Map Merging first, a merge in progress releases Local Mapping when it ends
+    const bool bStopMerger = !mpMapMerger->stopRequested();
+    const bool bStopMapper = !mpLocalMapper->stopRequested();
+    if(bStopMerger)
+        mpMapMerger->RequestStop();
+    mpMapMerger->WaitUntilStopped();
+    if(bStopMapper)
+        mpLocalMapper->RequestStop();
+    mpLocalMapper->WaitUntilStopped();
+
+    pMap->BeginUpdate();
+
+    // Poses are taken before any is changed
+    vpKFs = pMap->GetAllKeyFrames();
+    map<KeyFrame*,cv::Mat> mTcwBefore;
+    map<KeyFrame*,cv::Mat> &mTcwAfter = result.mKeyFramePoses;
+    list<KeyFrame*> lpPending;
+    for(vector<KeyFrame*>::iterator vit=vpKFs.begin(), vend=vpKFs.end(); vit!=vend; vit++)
+    {
+        KeyFrame* pKF = *vit;
+        if(pKF->isBad())
+            continue;
+        mTcwBefore[pKF] = pKF->GetPose();
+        if(!mTcwAfter.count(pKF))
+            lpPending.push_back(pKF);
+    }
+
+    // Each keyframe out of the BA is moved as its parent was, once the parent is
+    bool bProgress = true;
+    while(bProgress && !lpPending.empty())
+    {
+        bProgress = false;
+        for(list<KeyFrame*>::iterator lit=lpPending.begin(); lit!=lpPending.end(); )
+        {
+            KeyFrame* pKF = *lit;
+            KeyFrame* pParent = pKF->GetParent();
+            if(!pParent || !mTcwAfter.count(pParent) || !mTcwBefore.count(pParent))
+            {
+                lit++;
+                continue;
+            }
+
+            // Tchild_after = Tchild_before*Tparent_before^-1*Tparent_after
+            mTcwAfter[pKF] = mTcwBefore[pKF]*mTcwBefore[pParent].inv()*mTcwAfter[pParent];
+            lit = lpPending.erase(lit);
+            bProgress = true;
+        }
+    }
+
+    for(map<KeyFrame*,cv::Mat>::iterator mit=mTcwAfter.begin(), mend=mTcwAfter.end(); mit!=mend; mit++)
+    {
+        if(!mit->first->isBad())
+            mit->first->SetPose(mit->second);
+    }
+
+    // Points out of the BA are moved as their reference keyframe
+    vpMPs = pMap->GetAllMapPoints();
+    for(vector<MapPoint*>::iterator vit=vpMPs.begin(), vend=vpMPs.end(); vit!=vend; vit++)
+    {
+        MapPoint* pMP = *vit;
+        if(pMP->isBad())
+            continue;
+
+        map<MapPoint*,cv::Mat>::iterator pit = result.mPointPositions.find(pMP);
+        if(pit!=result.mPointPositions.end())
+        {
+            pMP->SetWorldPos(pit->second);
+        }
+        else
+        {
+            KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
+            if(!pRefKF || !mTcwBefore.count(pRefKF) || !mTcwAfter.count(pRefKF))
+                continue;
+
+            const cv::Mat &Tcw = mTcwBefore[pRefKF];
+            cv::Mat Xc = Tcw.rowRange(0,3).colRange(0,3)*pMP->GetWorldPos()+Tcw.rowRange(0,3).col(3);
+            const cv::Mat Twc = mTcwAfter[pRefKF].inv();
+            pMP->SetWorldPos(Twc.rowRange(0,3).colRange(0,3)*Xc+Twc.rowRange(0,3).col(3));
+        }
+        pMP->UpdateNormalAndDepth();
+    }
+
+    pMap->EndUpdate();
+    mapDB->getJournal()->MapAdjusted(pMap);
+
+    if(bStopMapper)
+        mpLocalMapper->Release();
+    if(bStopMerger)
+        mpMapMerger->Release();
+}
+
+bool LoopClosing::CommitGlobalBA(Map* pMap, BundleAdjustmentResult &result)
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexGBA);
+    if(pMap->getErased() || pMap==mapDB->getCurrent())
+        return false;
+    ApplyGlobalBA(pMap,result);
+    return true;
+}
+
+void LoopClosing::CorrectMapPoints(int nWorker, int nWorkers)
+{
+    for(size_t i=nWorker; i<mvpCorrectedKFs.size(); i+=nWorkers)
+    {
+        KeyFrame* pKFi = mvpCorrectedKFs[i];
+        g2o::Sim3 g2oCorrectedSwi = mpCorrectedSim3->find(pKFi)->second.inverse();
+        g2o::Sim3 g2oSiw = mpNonCorrectedSim3->find(pKFi)->second;
+
+        const vector<MapPoint*> &vpCorrected = mvvpCorrectedPoints[i];
+        for(size_t iMP=0, endMPi=vpCorrected.size(); iMP<endMPi; iMP++)
+        {
+            MapPoint* pMPi = vpCorrected[iMP];
+
+            // Project with non-corrected pose and project back with corrected pose
+            cv::Mat P3Dw = pMPi->GetWorldPos();
+            Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
+            Eigen::Matrix<double,3,1> eigCorrectedP3Dw = g2oCorrectedSwi.map(g2oSiw.map(eigP3Dw));
 
-    // Force the tracker to relocalize in the new map
-    mpTracker->ForceInlineRelocalisation();
+            cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
+            pMPi->SetWorldPos(cvCorrectedP3Dw);
+            pMPi->UpdateNormalAndDepth();
+        }
+    }
 }
 
 void LoopClosing::SearchAndFuse(KeyFrameAndPose &CorrectedPosesMap)
+{
+    mvpCorrectedKFs.clear();
+    for(KeyFrameAndPose::iterator mit=CorrectedPosesMap.begin(), mend=CorrectedPosesMap.end(); mit!=mend;mit++)
+        mvpCorrectedKFs.push_back(mit->first);
+
+    // Each keyframe is searched on a worker, the loop points are not modified until all of them are done
+    mpCorrectedSim3 = &CorrectedPosesMap;
+    mvvFuseMatches.assign(mvpCorrectedKFs.size(),vector<MapPoint*>());
+    const int nWorkers = min(mnThreads,(int)mvpCorrectedKFs.size());
+    {
+        TaskGroup workers(TaskPool::LOOP_CLOSING);
+        for(int i=1; i<nWorkers; i++)
+            workers.Run(boost::bind(&LoopClosing::SearchFuseTargets,this,i,nWorkers));
+        SearchFuseTargets(0,nWorkers);
+        workers.Wait();
+    }
+    mpCorrectedSim3 = NULL;
+
+    // The matches are applied in the order of the keyframes, as sequentially
+    MapPointFusion fusion;
+    for(size_t i=0; i<mvpCorrectedKFs.size(); i++)
+        ApplyFuseMatches(mvpCorrectedKFs[i],mvvFuseMatches[i],fusion);
+    fusion.Commit();
+
+    mvvFuseMatches.clear();
+}
+
+void LoopClosing::SearchFuseTargets(int nWorker, int nWorkers)
 {
     ORBmatcher matcher(0.8);
 
-    for(KeyFrameAndPose::iterator mit=CorrectedPosesMap.begin(), mend=CorrectedPosesMap.end(); mit!=mend;mit++)
+    for(size_t i=nWorker; i<mvpCorrectedKFs.size(); i+=nWorkers)
     {
-        KeyFrame* pKF = mit->first;
+        KeyFrame* pKF = mvpCorrectedKFs[i];
 
-        g2o::Sim3 g2oScw = mit->second;
+        g2o::Sim3 g2oScw = mpCorrectedSim3->find(pKF)->second;
         cv::Mat cvScw = Converter::toCvMat(g2oScw);
 
-        matcher.Fuse(pKF,cvScw,mvpLoopMapPoints,4);
+        matcher.Fuse(pKF,cvScw,mvpLoopMapPoints,4,mvvFuseMatches[i]);
+    }
+}
+
+void LoopClosing::ApplyFuseMatches(KeyFrame *pKF, const vector<MapPoint*> &vpMatched, MapPointFusion &fusion)
+{
+    for(size_t idx=0, iend=vpMatched.size(); idx<iend; idx++)
+    {
+        MapPoint* pLoopMP = vpMatched[idx];
+        if(!pLoopMP)
+            continue;
+
+        // Replaced at a previous keyframe, or brought into this one by a replacement
+        if(pLoopMP->isBad() || pLoopMP->IsInKeyFrame(pKF))
+            continue;
+
+        // If there is already a MapPoint replace otherwise add new measurement
+        MapPoint* pMPinKF = pKF->GetMapPoint(idx);
+        if(pMPinKF)
+        {
+            if(!pMPinKF->isBad())
+                fusion.Replace(pMPinKF,pLoopMP);
+        }
+        else
+            fusion.Add(pLoopMP,pKF,idx);
     }
 }
 
 void LoopClosing::Release()
 {
+    Wake();
     boost::mutex::scoped_lock lock(mMutexStop);
-    boost::mutex::scoped_lock lock2(mMutexLoopQueue);
     mbStopped = false;
     mbStopRequested = false;
+    mCondStop.notify_all();
     // We do not need to delete keyframes any more because they are linked to maps
-    //    for(list<KeyFrame*>::iterator lit = mlpLoopKeyFrameQueue.begin(), lend=mlpLoopKeyFrameQueue.end(); lit!=lend; lit++)
-    //        delete *lit;
-    mlpLoopKeyFrameQueue.clear();
+    mqLoopKeyFrameQueue.DiscardQueued();
 }
 
 void LoopClosing::ResetIfRequested()
 {
-    boost::mutex::scoped_lock lock(mMutexReset);
-    boost::mutex::scoped_lock lock2(mMutexLoopQueue);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexReset);
     if(mbResetRequested)
     {
-        mlpLoopKeyFrameQueue.clear();
-        mLastLoopKFid=0;
+        StopGlobalBA();
+        mqLoopKeyFrameQueue.DiscardQueued();
+        KeyFrame* pPendingKF = mScheduler.Clear();
+        if(pPendingKF)
+            pPendingKF->SetErase();
+        LoopDetectorState().swap(mDetectorState);
+        mParkedStates.Clear();
         mbResetRequested=false;
     }
+    else if(mbMapSwitchRequested)
+        SwitchMap();
+    mbMapSwitchRequested=false;
+}
+
+void LoopClosing::SwitchMap()
+{
+    // The state of the previous map is parked on the next query, the global BA running in it is let finish
+    mParkedStates.Prune(mapDB);
 }
 
 } //namespace ORB_SLAM
@@ -17,123 +17,181 @@
 
 #include "threads/MapMerging.h"
 
-#include "util/Sim3Solver.h"
+#include "types/MapPointFusion.h"
+#include "util/Sim3Verifier.h"
 #include "util/Converter.h"
-#include "util/Optimizer.h"
 #include "util/ORBmatcher.h"
+#include "util/MapJournal.h"
+#include "util/Trace.h"
+#include "util/LockProfiler.h"
+#include "util/Metrics.h"
+#include "util/TaskPool.h"
 
 #include <ros/ros.h>
 #include <g2o/types/sim3/types_seven_dof_expmap.h>
+#include <boost/bind.hpp>
 
 namespace ORB_SLAM
 {
 
-MapMerging::MapMerging(MapDatabase *pMap): OrbThread(pMap) {}
+MapMerging::MapMerging(MapDatabase *pMap, int nThreads):
+    OrbThread(pMap), mqLoopKeyFrameQueue(1024), mSim3Verifier(nThreads), mnThreads(max(nThreads,1)), mpMergeSource(NULL), mpMergeTarget(NULL) {}
 
 void MapMerging::Run()
 {
-    ros::Rate r(500);
-    while(ros::ok())
+    while(isRunning())
     {
-        // Reset if needed
-        ResetIfRequested();
+        Step();
 
-        // Check if there are keyframes in the queue
-        if(CheckNewKeyFrames())
-        {
-            // Detect loop candidates
-            if(DetectLoop())
-            {
-                // Compute similarity transformation [sR|t]
-               if(ComputeSim3())
-               {
-                   ROS_INFO("ORB-SLAM - Map Merge Detected");
-                   CorrectLoop();
-                   ROS_INFO("ORB-SLAM - Done Merging Maps");
-               }
-            }
-        }
-        
         // Safe area to stop
         if(stopRequested())
         {
             Stop();
-            ros::Rate r2(200);
-            while(isStopped() && ros::ok())
-            {
-                r2.sleep();
-            }
+            WaitWhileStopped();
+        }
+
+        // Sleep until there is something to do
+        if(!CheckNewKeyFrames())
+            WaitForWork();
+    }
+}
+
+bool MapMerging::Step()
+{
+    // Reset if needed
+    ResetIfRequested();
+
+    // Let the map objects culled meanwhile be reclaimed
+    Quiescent();
+
+    // Check if there are keyframes in the queue
+    const bool bQueued = CheckNewKeyFrames();
+    if(bQueued)
+    {
+        // Detect loop candidates
+        const bool bDetected = DetectLoop();
+        // Compute similarity transformation [sR|t]
+        const bool bMerge = bDetected && ComputeSim3();
+        if(bDetected)
+        {
+           if(bMerge)
+           {
+               ROS_INFO("ORB-SLAM - Map Merge Detected");
+               Metrics::Global()->Add(Metrics::MERGES_DETECTED);
+               // Transform and search duplicates in the background, then apply it at once
+               if(PrepareMerge() && CommitMerge())
+               {
+                   Metrics::Global()->Add(Metrics::MERGES_DONE);
+                   mapDB->getJournal()->MapsMerged(mpMergeSource,mpMergeTarget);
+                   ROS_INFO("ORB-SLAM - Done Merging Maps");
+               }
+               else
+                   ROS_WARN("ORB-SLAM - Map merge dropped, the maps changed meanwhile");
+           }
+           mapDB->unpinMaps(mvpPinnedMaps);
         }
-        // Sleep
-        r.sleep();
     }
+
+    // Page out the inactive maps over the memory budget
+    mapDB->enforceMemoryBudget();
+
+    return bQueued;
+}
+
+void MapMerging::PurgeBadPointers()
+{
+    mvpCurrentMatchedPoints.clear();
+    mvpLoopMapPoints.clear();
+    mMergedPoses.clear();
+    mMergedPositions.clear();
+    mvFusedMatches.clear();
 }
 
-void MapMerging::InsertKeyFrame(KeyFrame *pKF)
+void MapMerging::InsertCandidates(KeyFrame *pKF, const std::vector<KeyFrame*> &vpCandidates)
 {
-    boost::mutex::scoped_lock lock(mMutexLoopQueue);
-    if(pKF->mnId!=0)
-        mlpLoopKeyFrameQueue.push_back(pKF);
+    MergeQuery query;
+    query.pKF = pKF;
+    query.vpCandidates = vpCandidates;
+    // Merging can fall behind while maps are merged, skip the keyframe rather than block Loop Closing
+    if(!mqLoopKeyFrameQueue.Push(query))
+    {
+        Metrics::Global()->Add(Metrics::MERGE_QUERIES_SKIPPED);
+        ROS_WARN("ORB-SLAM - Map merging queue full, keyframe %d skipped.", (int)pKF->mnId);
+        return;
+    }
+    Wake();
 }
 
 bool MapMerging::CheckNewKeyFrames()
 {
-    boost::mutex::scoped_lock lock(mMutexLoopQueue);
-    return(!mlpLoopKeyFrameQueue.empty());
+    return(!mqLoopKeyFrameQueue.Empty());
 }
 
-bool MapMerging::DetectLoop()
+bool MapMerging::NextKeyFrame()
 {
-    { 
-        boost::mutex::scoped_lock lock(mMutexLoopQueue);
-        mpCurrentKF = mlpLoopKeyFrameQueue.front();
-        mlpLoopKeyFrameQueue.pop_front();
+    // Loop Closing already scheduled the queries, every keyframe handed over is checked
+    MergeQuery query;
+    while(mqLoopKeyFrameQueue.Pop(query))
+    {
+        // Culled while it waited
+        if(query.pKF->isBad())
+            continue;
+        mpCurrentKF = query.pKF;
+        mvpQueryCandidates.swap(query.vpCandidates);
         // Avoid that a keyframe can be erased while it is being process by this thread
         mpCurrentKF->SetNotErase();
+        return true;
     }
+    return false;
+}
+
+int MapMerging::KeyframesInQueue()
+{
+    return mqLoopKeyFrameQueue.Size();
+}
+
+int MapMerging::KeyframeQueueHighWater()
+{
+    return mqLoopKeyFrameQueue.HighWater();
+}
+
+bool MapMerging::DetectLoop()
+{
+    TRACE_SCOPE("MapMerging::DetectLoop");
+
+    // The queue may have been discarded by a release since it was checked
+    // The current keyframe is kept from being erased while it is processed
+    if(!NextKeyFrame())
+        return false;
+
+    // Consistency of the candidates seen from this map, parked while another map was current
+    mParkedStates.Select(mpCurrentKF->getMap(), mDetectorState);
 
     //If the map contains less than 10 KF or less than 10KF have passed from last loop detection
-    if(mpCurrentKF->mnId<mLastLoopKFid+10)
+    if(mpCurrentKF->mnId<mDetectorState.nLastLoopKFid+10)
     {
         mpCurrentKF->SetErase();
         return false;
     }
    
-   // Compute reference BoW similarity score
-    // This is the lowest score to a connected keyframe in the covisibility graph
-    // We will impose loop candidates to have a higher similarity than this
-    vector<KeyFrame*> vpConnectedKeyFrames = mpCurrentKF->GetVectorCovisibleKeyFrames();
-    DBoW2::BowVector CurrentBowVec = mpCurrentKF->GetBowVector();
-    float minScore = 1;     
-    for(size_t i=0; i<vpConnectedKeyFrames.size(); i++)
-    {
-        KeyFrame* pKF = vpConnectedKeyFrames[i];
-        if(pKF->isBad())
-            continue;
-        DBoW2::BowVector BowVec = pKF->GetBowVector();
-
-        float score = mapDB->getVocab()->score(CurrentBowVec, BowVec);
-
-        if(score<minScore)
-            minScore = score;
-    }
-    
-    // Query the database imposing the minimum score
+    // Candidates of the query of Loop Closing in the other maps
+    // The maps may have been merged, erased or made current since
+    Map* pCurrentMap = mapDB->getCurrent();
     vector<KeyFrame*> vpCandidateKFs;
-    
-    // Loop through each map, and add candidates to the list
-    for(size_t i=0; i<mapDB->getAll().size(); i++) {
-        // Ignore keyframes from the current db, let the loop closer take care of that
-        if(mapDB->getAll().at(i) != mapDB->getCurrent()) {
-            vector<KeyFrame*> temp = mapDB->getAll().at(i)->GetKeyFrameDatabase()->DetectLoopCandidates(mpCurrentKF, minScore);
-            vpCandidateKFs.insert(vpCandidateKFs.end(), temp.begin(), temp.end());
-        }
+    vpCandidateKFs.reserve(mvpQueryCandidates.size());
+    for(size_t i=0; i<mvpQueryCandidates.size(); i++)
+    {
+        KeyFrame* pKFi = mvpQueryCandidates[i];
+        Map* pMap = pKFi->getMap();
+        if(!pKFi->isBad() && pMap && pMap!=pCurrentMap && !pMap->getErased())
+            vpCandidateKFs.push_back(pKFi);
     }
+    mvpQueryCandidates.clear();
 
     // If there are no loop candidates, just add new keyframe and return false
     if(vpCandidateKFs.empty())
     {
-        mvConsistentGroups.clear();
+        mDetectorState.vConsistentGroups.clear();
         mpCurrentKF->SetErase();
         return false;
     }
@@ -145,34 +203,24 @@ bool MapMerging::DetectLoop()
     mvpEnoughConsistentCandidates.clear();
 
     vector<ConsistentGroup> vCurrentConsistentGroups;
-    vector<bool> vbConsistentGroup(mvConsistentGroups.size(),false);
+    vector<bool> vbConsistentGroup(mDetectorState.vConsistentGroups.size(),false);
     for(size_t i=0, iend=vpCandidateKFs.size(); i<iend; i++)
     {
         KeyFrame* pCandidateKF = vpCandidateKFs[i];
 
-        set<KeyFrame*> spCandidateGroup = pCandidateKF->GetConnectedKeyFrames();
-        spCandidateGroup.insert(pCandidateKF);
+        CovisibilityGroup spCandidateGroup(pCandidateKF);
 
         bool bEnoughConsistent = false;
         bool bConsistentForSomeGroup = false;
-        for(size_t iG=0, iendG=mvConsistentGroups.size(); iG<iendG; iG++)
+        for(size_t iG=0, iendG=mDetectorState.vConsistentGroups.size(); iG<iendG; iG++)
         {
-            set<KeyFrame*> sPreviousGroup = mvConsistentGroups[iG].first;
-
-            bool bConsistent = false;
-            for(set<KeyFrame*>::iterator sit=spCandidateGroup.begin(), send=spCandidateGroup.end(); sit!=send;sit++)
-            {
-                if(sPreviousGroup.count(*sit))
-                {
-                    bConsistent=true;
-                    bConsistentForSomeGroup=true;
-                    break;
-                }
-            }
+            bool bConsistent = spCandidateGroup.Intersects(mDetectorState.vConsistentGroups[iG].first);
+            if(bConsistent)
+                bConsistentForSomeGroup=true;
 
             if(bConsistent)
             {
-                int nPreviousConsistency = mvConsistentGroups[iG].second;
+                int nPreviousConsistency = mDetectorState.vConsistentGroups[iG].second;
                 int nCurrentConsistency = nPreviousConsistency + 1;
                 if(!vbConsistentGroup[iG])
                 {
@@ -197,7 +245,7 @@ bool MapMerging::DetectLoop()
     }
 
     // Update Covisibility Consistent Groups
-    mvConsistentGroups = vCurrentConsistentGroups;
+    mDetectorState.vConsistentGroups.swap(vCurrentConsistentGroups);
 
     if(!mvpEnoughConsistentCandidates.empty())
         return true;
@@ -209,126 +257,41 @@ bool MapMerging::DetectLoop()
 
 bool MapMerging::ComputeSim3()
 {
+    TRACE_SCOPE("MapMerging::ComputeSim3");
+
     // For each consistent loop candidate we try to compute a Sim3
     const int nInitialCandidates = mvpEnoughConsistentCandidates.size();
 
-    // We compute first ORB matches for each candidate
-    // If enough matches are found, we setup a Sim3Solver
-    ORBmatcher matcher(0.75,true);
-
-    vector<Sim3Solver*> vpSim3Solvers;
-    vpSim3Solvers.resize(nInitialCandidates);
-
-    vector<vector<MapPoint*> > vvpMapPointMatches;
-    vvpMapPointMatches.resize(nInitialCandidates);
-
-    vector<bool> vbDiscarded;
-    vbDiscarded.resize(nInitialCandidates);
-
-    int nCandidates=0; //candidates with enough matches
-
+    // avoid that local mapping erase them while they are being processed in this thread
     for(int i=0; i<nInitialCandidates; i++)
-    {
-        KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
-
-        // avoid that local mapping erase it while it is being processed in this thread
-        pKF->SetNotErase();
-
-        if(pKF->isBad())
-        {
-            vbDiscarded[i] = true;
-            continue;
-        }
-
-        int nmatches = matcher.SearchByBoW(mpCurrentKF,pKF,vvpMapPointMatches[i]);
-
-        if(nmatches<20)
-        {
-            vbDiscarded[i] = true;
-            continue;
-        }
-        else
-        {
-            Sim3Solver* pSolver = new Sim3Solver(mpCurrentKF,pKF,vvpMapPointMatches[i]);
-            pSolver->SetRansacParameters(0.99,20,300);
-            vpSim3Solvers[i] = pSolver;
-        }
-
-        nCandidates++;
-    }
-
-    bool bMatch = false;
-
-    // Perform alternatively RANSAC iterations for each candidate
-    // until one is successful or all fail
-    while(nCandidates>0 && !bMatch)
-    {
-        for(int i=0; i<nInitialCandidates; i++)
-        {
-            if(vbDiscarded[i])
-                continue;
-
-            KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
-
-            // Perform 5 Ransac Iterations
-            vector<bool> vbInliers;
-            int nInliers;
-            bool bNoMore;
-
-            Sim3Solver* pSolver = vpSim3Solvers[i];
-            cv::Mat Scm  = pSolver->iterate(5,bNoMore,vbInliers,nInliers);
-
-            // If Ransac reaches max. iterations discard keyframe
-            if(bNoMore)
-            {
-                vbDiscarded[i]=true;
-                nCandidates--;
-            }
-
-            // If RANSAC returns a Sim3, perform a guided matching and optimize with all correspondences
-            if(!Scm.empty())
-            {
-                vector<MapPoint*> vpMapPointMatches(vvpMapPointMatches[i].size(), static_cast<MapPoint*>(NULL));
-                for(size_t j=0, jend=vbInliers.size(); j<jend; j++)
-                {
-                    if(vbInliers[j])
-                       vpMapPointMatches[j]=vvpMapPointMatches[i][j];
-                }
-
-                cv::Mat R = pSolver->GetEstimatedRotation();
-                cv::Mat t = pSolver->GetEstimatedTranslation();
-                const float s = pSolver->GetEstimatedScale();
+        mvpEnoughConsistentCandidates[i]->SetNotErase();
 
-                matcher.SearchBySim3(mpCurrentKF,pKF,vpMapPointMatches,s,R,t,7.5);
+    // The maps of the candidates stay resident while they are verified and merged, paged out ones are faulted in
+    mapDB->pinMaps(mvpEnoughConsistentCandidates, mvpPinnedMaps);
 
+    // Match and run RANSAC on the candidates until one is successful or all fail
+    g2o::Sim3 gScm;
+    const int nMatch = mSim3Verifier.Verify(mpCurrentKF,mvpEnoughConsistentCandidates,gScm,mvpCurrentMatchedPoints);
 
-                g2o::Sim3 gScm(Converter::toMatrix3d(R),Converter::toVector3d(t),s);
-                const int nInliers = Optimizer::OptimizeSim3(mpCurrentKF, pKF, vpMapPointMatches, gScm, 10);
-
-                // If optimization is successful stop ransacs and continue
-                if(nInliers>=20)
-                {
-                    bMatch = true;
-                    mpMatchedKF = pKF;
-                    g2o::Sim3 gSmw(Converter::toMatrix3d(pKF->GetRotation()),Converter::toVector3d(pKF->GetTranslation()),1.0);
-                    mg2oScw = gScm*gSmw;
-                    mpMatchedgScm = gScm;
-                    mScw = Converter::toCvMat(mg2oScw);
-
-                    mvpCurrentMatchedPoints = vpMapPointMatches;
-                    break;
-                }
-            }
-        }
-    }
-
-    if(!bMatch)
+    // If we do not have a match, allow all our candidates and the current KF to be erased
+    if(nMatch<0)
     {
         for(int i=0; i<nInitialCandidates; i++)
              mvpEnoughConsistentCandidates[i]->SetErase();
         mpCurrentKF->SetErase();
         return false;
     }
+    else
+    {
+        mpMatchedKF = mvpEnoughConsistentCandidates[nMatch];
+        g2o::Sim3 gSmw(Converter::toMatrix3d(mpMatchedKF->GetRotation()),Converter::toVector3d(mpMatchedKF->GetTranslation()),1.0);
+        mg2oScw = gScm*gSmw;
+        mpMatchedgScm = gScm;
+        mScw = Converter::toCvMat(mg2oScw);
+    }
+
+    // Guided matching and Sim3 projection
+    ORBmatcher matcher(0.75,true);
 
     // Retrieve MapPoints seen in Loop Keyframe and neighbors
     vector<KeyFrame*> vpLoopConnectedKFs = mpMatchedKF->GetVectorCovisibleKeyFrames();
@@ -380,100 +343,126 @@ bool MapMerging::ComputeSim3()
 
 }
 
-void MapMerging::CorrectLoop()
+// Sim3 of a keyframe pose, used to move poses between the map coordinates
+static g2o::Sim3 ToSim3(const cv::Mat &Tcw)
 {
-    // Send a stop signal to Local Mapping
-    // Avoid new keyframes are inserted while correcting the loop
-    mpLocalMapper->RequestStop();
-    mpLoopCloser->RequestStop();
-    mpRelocalizer->RequestStop();
-    
-    // Get the newest and oldest map ordering
-    Map* newest;
-    Map* oldest = mapDB->getOldest(mpMatchedKF->getMap(), mpCurrentKF->getMap());
-    
-    KeyFrameAndPose CorrectedSim3, NonCorrectedSim3;
-    cv::Mat Tw2a;
-    g2o::Sim3 g2oSab;
-    cv::Mat Tbw1;
-    
-    // Check to see if we have a valid map returned
-    if(oldest == NULL)
+    cv::Mat Rcw = Tcw.rowRange(0,3).colRange(0,3);
+    cv::Mat tcw = Tcw.rowRange(0,3).col(3);
+    return g2o::Sim3(Converter::toMatrix3d(Rcw),Converter::toVector3d(tcw),1.0);
+}
+
+// Keyframe pose of a corrected Sim3. First transform Sim3 to SE3 (scale translation)
+static cv::Mat ToCorrectedPose(const g2o::Sim3 &Siw)
+{
+    Eigen::Matrix3d eigR = Siw.rotation().toRotationMatrix();
+    Eigen::Vector3d eigt = Siw.translation();
+    double s = Siw.scale();
+    eigt *=(1./s); //[R t/s;0 1]
+    return Converter::toCvSE3(eigR,eigt);
+}
+
+bool MapMerging::PrepareMerge()
+{
+    TRACE_SCOPE("MapMerging::PrepareMerge");
+
+    // The matched map moves into the coordinates of the current one, so tracking keeps its pose
+    mpMergeSource = mpMatchedKF->getMap();
+    mpMergeTarget = mpCurrentKF->getMap();
+    if(mpMergeSource==NULL || mpMergeTarget==NULL || mpMergeSource==mpMergeTarget)
     {
         ROS_ERROR("ORB-SLAM - Invalid maps trying to merge");
-        return;
+        mpCurrentKF->SetErase();
+        mpMatchedKF->SetErase();
+        return false;
     }
-    // Figure out what the newest map is based on the returned old one
-    else if(oldest == mpMatchedKF->getMap())
+
+    // The merge searches all the features of the matched map, a compact one was only expanded for the query
+    if(!mpMergeSource->PageIn())
+        ROS_WARN("ORB-SLAM - Map %lu could not be paged in, its keyframes have no features", mpMergeSource->mnId);
+
+    // Sim3 from the matched map world (w2) to the current map world (w1), through the current keyframe
+    mg2oSw1w2 = ToSim3(mpCurrentKF->GetPose()).inverse()*mg2oScw;
+    const g2o::Sim3 g2oSw2w1 = mg2oSw1w2.inverse();
+
+    // Nothing is written yet, the other threads keep running on the current map
+    mMergedPoses.clear();
+    mMergedPositions.clear();
+    Map::KeyFrameSnapshot sourceKeyFrames = mpMergeSource->GetKeyFrameSnapshot();
+    for(Map::KeyFrameSnapshot::const_iterator kit=sourceKeyFrames.begin(), kend=sourceKeyFrames.end(); kit!=kend; kit++)
     {
-        // Update map varaibles
-        newest = mpCurrentKF->getMap();
-        // Different poses we have to convert to and from
-        Tw2a = mpCurrentKF->GetPoseInverse();
-        g2oSab = mpMatchedgScm;
-        Tbw1 = mpMatchedKF->GetPose();
+        KeyFrame* pKFi = *kit;
+        if(pKFi->isBad())
+            continue;
+        mMergedPoses[pKFi] = ToCorrectedPose(ToSim3(pKFi->GetPose())*g2oSw2w1);
+
+        vector<MapPoint*> vpMPsi = pKFi->GetMapPointMatches();
+        for(size_t iMP=0, endMPi = vpMPsi.size(); iMP<endMPi; iMP++)
+        {
+            MapPoint* pMPi = vpMPsi[iMP];
+            if(!pMPi || pMPi->isBad() || pMPi->getMap()==mpMergeTarget || mMergedPositions.count(pMPi))
+                continue;
+            Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(pMPi->GetWorldPos());
+            mMergedPositions[pMPi] = Converter::toCvMat(mg2oSw1w2.map(eigP3Dw));
+        }
     }
-    // Flip the measurments if we are going oldest->new
-    else
+
+    // Search the duplicated points, they are replaced when the merge is committed
+    SearchAndFuse();
+
+    return true;
+}
+
+bool MapMerging::CommitMerge()
+{
+    TRACE_SCOPE("MapMerging::CommitMerge");
+
+    // Local Mapping is the only thread editing the current map, wait until it has stopped
+    // Loop Closing waits for this thread before correcting, so it is only asked to hold
+    mpLocalMapper->RequestStop();
+    mpLoopCloser->RequestStop();
+    mpLocalMapper->WaitUntilStopped();
+
+    // Whoever stopped this thread meanwhile also stopped Local Mapping and will release it
+    const bool bRelease = !stopRequested();
+
+    // The prepared merge is dropped if the maps changed while it was prepared
+    if(mpMergeSource->getErased() || mpMergeTarget->getErased() || mapDB->getCurrent()==mpMergeSource ||
+       mpCurrentKF->isBad() || mpMatchedKF->isBad() ||
+       mpCurrentKF->getMap()!=mpMergeTarget || mpMatchedKF->getMap()!=mpMergeSource)
     {
-        // Update map varaibles
-        newest = mpMatchedKF->getMap();
-        // Different poses we have to convert to and from
-        Tw2a = mpMatchedKF->GetPoseInverse();
-        g2oSab = mpMatchedgScm.inverse();
-        Tbw1 = mpCurrentKF->GetPose();
+        if(bRelease)
+        {
+            mpLocalMapper->Release();
+            mpLoopCloser->Release();
+        }
+        mpCurrentKF->SetErase();
+        mpMatchedKF->SetErase();
+        mMergedPoses.clear();
+        mMergedPositions.clear();
+        mvFusedMatches.clear();
+        return false;
     }
-    
-    // Create sim3 of  the world 2 global to its connecting keyframe
-    cv::Mat Rw2a = Tw2a.rowRange(0,3).colRange(0,3);
-    cv::Mat tw2a = Tw2a.rowRange(0,3).col(3);
-    g2o::Sim3 g2oSw2a(Converter::toMatrix3d(Rw2a),Converter::toVector3d(tw2a),1.0);
-    // Create sim3 of the world 1 relative frame to its global
-    cv::Mat Rbw1 = Tbw1.rowRange(0,3).colRange(0,3);
-    cv::Mat tbw1 = Tbw1.rowRange(0,3).col(3);
-    g2o::Sim3 g2oSbw1(Converter::toMatrix3d(Rbw1),Converter::toVector3d(tbw1),1.0);
-
-    // Ensure current keyframe is updated
-    mpCurrentKF->UpdateConnections();
-    mpMatchedKF->UpdateConnections();
-    
-    // Print out the two poses
-    // std::cout << "C1 = "<< std::endl << " "  << mpCurrentKF->GetPose() << std::endl << std::endl;
-    // std::cout << "C2 = "<< std::endl << " "  << mpMatchedKF->GetPose() << std::endl << std::endl;
-    
-    // Loop through all keyframes
-    size_t num_keys = newest->GetAllKeyFrames().size();
-    for(size_t i=0; i<num_keys; i++)
+
+    // Readers keep the snapshots from before the merge until it is done
+    mpMergeTarget->BeginUpdate();
+    mpMergeSource->BeginUpdate();
+
+    const g2o::Sim3 g2oSw2w1 = mg2oSw1w2.inverse();
+
+    // Move every keyframe and point of the matched map, the ones added after the snapshot are transformed here
+    vector<MapPoint*> vpMovedMPs;
+    Map::KeyFrameSnapshot sourceKeyFrames = mpMergeSource->GetKeyFrameSnapshot();
+    for(Map::KeyFrameSnapshot::const_iterator kit=sourceKeyFrames.begin(), kend=sourceKeyFrames.end(); kit!=kend; kit++)
     {
-        // Get the keyframe
-        KeyFrame* pKFi = newest->GetAllKeyFrames().at(i);
-        cv::Mat Tiw2 = pKFi->GetPose();
-        // Ensure we have a valid key frame
-        if(!pKFi)
-            continue;
+        KeyFrame* pKFi = *kit;
         if(pKFi->isBad())
             continue;
-        // Get the sim3 of pose of the current keyframe
-        cv::Mat Riw2 = Tiw2.rowRange(0,3).colRange(0,3);
-        cv::Mat tiw2 = Tiw2.rowRange(0,3).col(3);
-        g2o::Sim3 g2oSiw2(Converter::toMatrix3d(Riw2),Converter::toVector3d(tiw2),1.0);
-        // Converting from the keyframe's referance to the other global
-        g2o::Sim3 g2oSiw1 = g2oSiw2* g2oSw2a*g2oSab*g2oSbw1;
-        // Update sim3 solvers with the new solution
-        CorrectedSim3[pKFi]=g2oSiw1;
-        NonCorrectedSim3[pKFi]=g2oSiw2;
-    }
-    
-    // Correct all MapPoints observed by current keyframe and neighbors, so that they align with the other side of the loop
-    for(KeyFrameAndPose::iterator mit=CorrectedSim3.begin(), mend=CorrectedSim3.end(); mit!=mend; mit++)
-    {
-        KeyFrame* pKFi = mit->first;
-        g2o::Sim3 g2oCorrectedSiw = mit->second;
-        
-        // Update refs
-        pKFi->setMap(oldest);
-        oldest->AddKeyFrame(pKFi);
-        oldest->GetKeyFrameDatabase()->add(pKFi);
+
+        // Update refs, the keyframe moves out of its map so that only one map owns it
+        mpMergeSource->DetachKeyFrame(pKFi);
+        pKFi->setMap(mpMergeTarget);
+        mpMergeTarget->AddKeyFrame(pKFi);
+        mpMergeTarget->GetKeyFrameDatabase()->add(pKFi);
 
         vector<MapPoint*> vpMPsi = pKFi->GetMapPointMatches();
         for(size_t iMP=0, endMPi = vpMPsi.size(); iMP<endMPi; iMP++)
@@ -483,127 +472,197 @@ void MapMerging::CorrectLoop()
                 continue;
             if(pMPi->isBad())
                 continue;
-            if(pMPi->mnCorrectedByKF==mpCurrentKF->mnId)
+            if(pMPi->mnCorrectedByKF==mpCurrentKF->mnId || pMPi->getMap()==mpMergeTarget)
                 continue;
             // Update refs
-            pMPi->setMap(oldest);
-            oldest->AddMapPoint(pMPi);
-            // Project with non-corrected pose and project back with corrected pose
-            cv::Mat P3Dw = pMPi->GetWorldPos();
-            Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
-            // Going from w2 to w1 and then maping the 3x1 vector ontop of it 
-            // https://github.com/RainerKuemmerle/g2o/blob/master/g2o/types/sim3/sim3.h#L136-L138
-            g2o::Sim3 g2oSw1w2 = g2oSbw1.inverse()*g2oSab.inverse()* g2oSw2a.inverse();
-            Eigen::Matrix<double,3,1> eigCorrectedP3Dw = g2oSw1w2.map(eigP3Dw);
+            pMPi->getMap()->DetachMapPoint(pMPi);
+            pMPi->setMap(mpMergeTarget);
+            mpMergeTarget->AddMapPoint(pMPi);
             // Update the mappoint with the corrected cords
-            cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
-            pMPi->SetWorldPos(cvCorrectedP3Dw);
+            std::map<MapPoint*,cv::Mat>::iterator pit = mMergedPositions.find(pMPi);
+            if(pit!=mMergedPositions.end())
+                pMPi->SetWorldPos(pit->second);
+            else
+                pMPi->SetWorldPos(Converter::toCvMat(mg2oSw1w2.map(Converter::toVector3d(pMPi->GetWorldPos()))));
             pMPi->mnCorrectedByKF = mpCurrentKF->mnId;
             pMPi->mnCorrectedReference = pKFi->mnId;
-            pMPi->UpdateNormalAndDepth();
+            vpMovedMPs.push_back(pMPi);
         }
 
-        // Update keyframe pose with corrected Sim3. First transform Sim3 to SE3 (scale translation)
-        Eigen::Matrix3d eigR = g2oCorrectedSiw.rotation().toRotationMatrix();
-        Eigen::Vector3d eigt = g2oCorrectedSiw.translation();
-        double s = g2oCorrectedSiw.scale();
-        
-        // Debug
-        //std::cout << "Trans is: " << eigt << std::endl;
-        //std::cout << "Rots is: " << eigR << std::endl;
-        //std::cout << "Scale is: " << s << std::endl;
-
-        eigt *=(1./s); //[R t/s;0 1]
-
         // Update key frame position
-        cv::Mat correctedTiw = Converter::toCvSE3(eigR,eigt);        
-        pKFi->SetPose(correctedTiw);
+        std::map<KeyFrame*,cv::Mat>::iterator kpit = mMergedPoses.find(pKFi);
+        if(kpit!=mMergedPoses.end())
+            pKFi->SetPose(kpit->second);
+        else
+            pKFi->SetPose(ToCorrectedPose(ToSim3(pKFi->GetPose())*g2oSw2w1));
+    }
+
+    // Normals and depths need the corrected poses of all the observers
+    for(size_t i=0; i<vpMovedMPs.size(); i++)
+        vpMovedMPs[i]->UpdateNormalAndDepth();
 
-        // Make sure connections are updated
-        pKFi->UpdateConnections();
-    } 
-    
     // Start Loop Fusion
     // Update matched map points and replace if duplicated
+    // Covisibility counts and descriptors are updated once, after all the replacements
+    MapPointFusion fusion;
     for(size_t i=0; i<mvpCurrentMatchedPoints.size(); i++)
     {
         if(mvpCurrentMatchedPoints[i])
         {
             MapPoint* pLoopMP = mvpCurrentMatchedPoints[i];
+            if(pLoopMP->isBad())
+                continue;
             MapPoint* pCurMP = mpCurrentKF->GetMapPoint(i);
             if(pCurMP)
-                pCurMP->Replace(pLoopMP);
+            {
+                if(pCurMP!=pLoopMP)
+                    fusion.Replace(pCurMP,pLoopMP);
+            }
             else
             {
-                mpCurrentKF->AddMapPoint(pLoopMP,i);
-                pLoopMP->AddObservation(mpCurrentKF,i);
+                fusion.Add(pLoopMP,mpCurrentKF,i);
                 pLoopMP->ComputeDistinctiveDescriptors();
             }
         }
     }
-    
-    // Project MapPoints observed in the neighborhood of the loop keyframe
-    // into the current keyframe and neighbors using corrected poses.
-    // Fuse duplications.
-    SearchAndFuse(CorrectedSim3);
+
+    // Replace the duplications found projecting the loop points into the current keyframe and neighbors
+    for(size_t i=0; i<mvFusedMatches.size(); i++)
+    {
+        KeyFrame* pKF = mvFusedMatches[i].first;
+        const vector<MapPoint*> &vpMatched = mvFusedMatches[i].second;
+        if(pKF->isBad())
+            continue;
+        for(size_t idx=0; idx<vpMatched.size(); idx++)
+        {
+            MapPoint* pLoopMP = vpMatched[idx];
+            if(!pLoopMP || pLoopMP->isBad())
+                continue;
+            MapPoint* pMPinKF = pKF->GetMapPoint(idx);
+            if(pMPinKF)
+            {
+                if(pMPinKF!=pLoopMP && !pMPinKF->isBad())
+                    fusion.Replace(pMPinKF,pLoopMP);
+            }
+            else
+                fusion.Add(pLoopMP,pKF,idx);
+        }
+    }
+    fusion.Commit();
+
+    // One update per fused keyframe, once all the counts are in
+    for(size_t i=0; i<mvFusedMatches.size(); i++)
+    {
+        if(!mvFusedMatches[i].first->isBad())
+            mvFusedMatches[i].first->UpdateConnections();
+    }
 
     //Add edge
     mpCurrentKF->AddLoopEdge(mpMatchedKF);
     mpMatchedKF->AddLoopEdge(mpCurrentKF);
+    mpCurrentKF->UpdateConnections();
+    mpMatchedKF->UpdateConnections();
 
-     // Update the current map
-    mapDB->setMap(oldest);
     // Remove the map from our list, but keep the data
-//    mapDB->removeMap(newest);
-    newest->setErased(true);
+    mpMergeSource->setErased(true);
 
-    // Force the tracker to relocalize the camera in the updated map
-    mpTracker->ForceInlineRelocalisation();
+    mpMergeSource->EndUpdate();
+    mpMergeTarget->EndUpdate();
 
+    // The current map kept its coordinates, tracking goes on without relocalizing
     // Loop closed. Release Local Mapping.
-    mpLocalMapper->Release();
-    mpLoopCloser->Release();
+    if(bRelease)
+    {
+        mpLocalMapper->Release();
+        mpLoopCloser->Release();
+    }
+
+    mMergedPoses.clear();
+    mMergedPositions.clear();
+    mvFusedMatches.clear();
 
     // Update the local last loop id var
-    mLastLoopKFid = mpCurrentKF->mnId;
+    mDetectorState.nLastLoopKFid = mpCurrentKF->mnId;
+    return true;
+}
+
+void MapMerging::SearchAndFuse()
+{
+    mvFusedMatches.clear();
+
+    // The loop points are still in the matched map coordinates, project with the current side poses expressed in them
+    mvpCurrentConnectedKFs = mpCurrentKF->GetVectorCovisibleKeyFrames();
+    mvpCurrentConnectedKFs.push_back(mpCurrentKF);
+
+    // Nothing is written to the maps here, each keyframe is searched on a worker
+    mvvFuseMatches.assign(mvpCurrentConnectedKFs.size(),vector<MapPoint*>());
+    const int nWorkers = min(mnThreads,(int)mvpCurrentConnectedKFs.size());
+    {
+        TaskGroup workers(TaskPool::LOOP_CLOSING);
+        for(int i=1; i<nWorkers; i++)
+            workers.Run(boost::bind(&MapMerging::SearchFuseTargets,this,i,nWorkers));
+        SearchFuseTargets(0,nWorkers);
+        workers.Wait();
+    }
+
+    // Kept in the order of the keyframes, as they are applied
+    for(size_t i=0; i<mvpCurrentConnectedKFs.size(); i++)
+    {
+        if(!mvvFuseMatches[i].empty())
+            mvFusedMatches.push_back(make_pair(mvpCurrentConnectedKFs[i],mvvFuseMatches[i]));
+    }
+    mvvFuseMatches.clear();
 }
 
-void MapMerging::SearchAndFuse(KeyFrameAndPose &CorrectedPosesMap)
+void MapMerging::SearchFuseTargets(int nWorker, int nWorkers)
 {
     ORBmatcher matcher(0.8);
 
-    for(KeyFrameAndPose::iterator mit=CorrectedPosesMap.begin(), mend=CorrectedPosesMap.end(); mit!=mend;mit++)
+    for(size_t i=nWorker; i<mvpCurrentConnectedKFs.size(); i+=nWorkers)
     {
-        KeyFrame* pKF = mit->first;
+        KeyFrame* pKF = mvpCurrentConnectedKFs[i];
+        if(pKF->isBad())
+            continue;
 
-        g2o::Sim3 g2oScw = mit->second;
+        g2o::Sim3 g2oScw = ToSim3(pKF->GetPose())*mg2oSw1w2;
         cv::Mat cvScw = Converter::toCvMat(g2oScw);
 
-        matcher.Fuse(pKF,cvScw,mvpLoopMapPoints,4);
+        vector<MapPoint*> vpMatched;
+        if(matcher.Fuse(pKF,cvScw,mvpLoopMapPoints,4,vpMatched)>0)
+            mvvFuseMatches[i].swap(vpMatched);
     }
 }
 
 void MapMerging::Release()
 {
+    Wake();
     boost::mutex::scoped_lock lock(mMutexStop);
-    boost::mutex::scoped_lock lock2(mMutexLoopQueue);
     mbStopped = false;
     mbStopRequested = false;
+    mCondStop.notify_all();
     // We do not need to delete keyframes any more because they are linked to maps
-    //    for(list<KeyFrame*>::iterator lit = mlpLoopKeyFrameQueue.begin(), lend=mlpLoopKeyFrameQueue.end(); lit!=lend; lit++)
-    //        delete *lit;
-    mlpLoopKeyFrameQueue.clear();
+    mqLoopKeyFrameQueue.DiscardQueued();
 }
 
 void MapMerging::ResetIfRequested()
 {
-    boost::mutex::scoped_lock lock(mMutexReset);
-    boost::mutex::scoped_lock lock2(mMutexLoopQueue);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexReset);
     if(mbResetRequested)
     {
-        mlpLoopKeyFrameQueue.clear();
-        mLastLoopKFid=0;
+        mqLoopKeyFrameQueue.DiscardQueued();
+        LoopDetectorState().swap(mDetectorState);
+        mParkedStates.Clear();
         mbResetRequested=false;
     }
+    else if(mbMapSwitchRequested)
+        SwitchMap();
+    mbMapSwitchRequested=false;
+}
+
+void MapMerging::SwitchMap()
+{
+    // The state of the previous map is parked on the next query, the maps merged since are forgotten
+    mParkedStates.Prune(mapDB);
 }
+
 } //namespace ORB_SLAM
\ No newline at end of file
@@ -0,0 +1,211 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "threads/MapRefiner.h"
+#include "threads/LoopClosing.h"
+#include "threads/Relocalization.h"
+#include "threads/Tracking.h"
+
+#include "types/Map.h"
+#include "types/MapDatabase.h"
+
+#include "util/Optimizer.h"
+#include "util/EpochReclaimer.h"
+#include "util/Trace.h"
+#include "util/LockProfiler.h"
+#include "util/Metrics.h"
+
+#include <boost/bind.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace ORB_SLAM
+{
+
+MapRefiner::MapRefiner(MapDatabase* pMap, int nThreads, int nIterations, bool bIdle):
+    OrbThread(pMap), mnThreads(max(nThreads,1)), mnIterations(max(nIterations,1)), mbIdle(bIdle),
+    mbRequested(false), mbStopBA(false)
+{
+}
+
+void MapRefiner::Run()
+{
+    while(isRunning())
+    {
+        Step();
+
+        // Safe area to stop
+        if(stopRequested())
+        {
+            Stop();
+            WaitWhileStopped();
+        }
+        // Woken by a request, the relocalization is polled at the timeout
+        WaitForWork();
+    }
+}
+
+void MapRefiner::RequestRefinement()
+{
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexRequest);
+        mbRequested = true;
+    }
+    Wake();
+}
+
+void MapRefiner::Advertise(ros::NodeHandle &nh)
+{
+    mRefineMapsSrv = nh.advertiseService("ORB_SLAM/RefineMaps", &MapRefiner::RefineMapsService, this);
+}
+
+bool MapRefiner::RefineMapsService(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res)
+{
+    RequestRefinement();
+    res.success = true;
+    res.message = "Dormant maps refined in the background";
+    ROS_INFO("ORB-SLAM - Map refinement requested.");
+    return true;
+}
+
+bool MapRefiner::Step()
+{
+    // Let the map objects culled meanwhile be reclaimed
+    Quiescent();
+
+    bool bRequested;
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexRequest);
+        bRequested = mbRequested;
+        mbRequested = false;
+    }
+
+    // The relocalization only runs while the tracking is lost
+    const bool bRelocalizing = mbIdle && !mpRelocalizer->stopRequested();
+    if(!bRequested && !bRelocalizing)
+        return false;
+
+    // Frozen maps are not changed
+    if(mpTracker->LocalizationOnly())
+    {
+        if(bRequested)
+            ROS_WARN("ORB-SLAM - Map refinement skipped, the maps are frozen in localization only mode.");
+        return false;
+    }
+
+    vector<Map*> vpMaps;
+    SelectMaps(vpMaps);
+    if(vpMaps.empty())
+        return false;
+
+    TRACE_SCOPE("MapRefiner::Step");
+    ROS_INFO("ORB-SLAM - Refining %d dormant maps", (int)vpMaps.size());
+    ros::WallTime tStart = ros::WallTime::now();
+
+    mbStopBA = false;
+    const int nWorkers = min<int>(mnThreads,vpMaps.size());
+    vector<boost::thread*> vpWorkers;
+    for(int i=0; i<nWorkers; i++)
+        vpWorkers.push_back(new boost::thread(&MapRefiner::RefineMaps,this,boost::cref(vpMaps),i,nWorkers));
+
+    // A finish interrupts the optimizations, their results are discarded
+    for(size_t i=0; i<vpWorkers.size(); i++)
+    {
+        while(!vpWorkers[i]->timed_join(boost::posix_time::milliseconds(100)))
+        {
+            if(!isRunning())
+                mbStopBA = true;
+        }
+        delete vpWorkers[i];
+    }
+
+    ROS_INFO("ORB-SLAM - Map refinement done in %.2f s", (ros::WallTime::now()-tStart).toSec());
+    return true;
+}
+
+void MapRefiner::SelectMaps(vector<Map*> &vpMaps)
+{
+    Map* pCurrentMap = mapDB->getCurrent();
+    MapDatabase::MapList pMaps = mapDB->getMaps();
+
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexVersions);
+    for(size_t i=0; i<pMaps->size(); i++)
+    {
+        Map* pMap = pMaps->at(i);
+        if(pMap==pCurrentMap || pMap->getErased() || pMap->KeyFramesInMap()<2)
+            continue;
+
+        map<long unsigned int,unsigned long>::const_iterator it = mRefinedVersions.find(pMap->mnId);
+        if(it!=mRefinedVersions.end() && it->second==pMap->GetVersion())
+            continue;
+
+        vpMaps.push_back(pMap);
+    }
+}
+
+void MapRefiner::RefineMaps(const vector<Map*> &vpMaps, int nWorker, int nWorkers)
+{
+#ifdef __linux__
+    // Below the tracking threads, the BA only takes CPU time nobody else wants
+    sched_param param;
+    param.sched_priority = 0;
+    pthread_setschedparam(pthread_self(),SCHED_IDLE,&param);
+#endif
+
+    // Nothing culled meanwhile is reclaimed, this thread never goes quiescent
+    EpochReclaimer* pReclaimer = EpochReclaimer::Global();
+    const int nEpochId = pReclaimer->Register();
+
+    for(size_t i=nWorker; i<vpMaps.size() && !mbStopBA; i+=nWorkers)
+    {
+        Map* pMap = vpMaps[i];
+
+        // Paged out keyframes are faulted in for the BA
+        pMap->Pin();
+
+        vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+        vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
+        BundleAdjustmentResult result;
+        Optimizer::BundleAdjustment(vpKFs,vpMPs,result,mnIterations,&mbStopBA,Optimizer::UseIterative(vpKFs.size()));
+
+        const bool bCommitted = !mbStopBA && mpLoopCloser->CommitGlobalBA(pMap,result);
+        if(bCommitted)
+        {
+            PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexVersions);
+            mRefinedVersions[pMap->mnId] = pMap->GetVersion();
+        }
+
+        pMap->Unpin();
+
+        if(bCommitted)
+        {
+            Metrics::Global()->Add(Metrics::MAPS_REFINED);
+            ROS_INFO("ORB-SLAM - Map %d refined, %d keyframes", (int)pMap->mnId, (int)vpKFs.size());
+        }
+    }
+
+    pReclaimer->Unregister(nEpochId);
+}
+
+} //namespace ORB_SLAM
@@ -17,6 +17,10 @@
 
 #include "threads/OrbThread.h"
 #include "types/MapDatabase.h"
+#include "threads/SharedWorkers.h"
+#include "util/EpochReclaimer.h"
+#include "util/Trace.h"
+#include "util/LockProfiler.h"
 
 #include <ros/ros.h>
 
@@ -27,8 +31,20 @@ namespace ORB_SLAM
     {
         mapDB = pMap;
         mbResetRequested = false;
+        mbMapSwitchRequested = false;
         mbStopped = false;
         mbStopRequested = true;
+        mbFinishRequested = false;
+        mbWakeRequested = false;
+        mbSynchronous = false;
+        mbSyncStopped = false;
+        mpSharedWorkers = NULL;
+        mnEpochId = EpochReclaimer::Global()->Register();
+    }
+
+    OrbThread::~OrbThread()
+    {
+        EpochReclaimer::Global()->Unregister(mnEpochId);
     }
     
     void OrbThread::SetThreads(LocalMapping* pLocalMapper, LoopClosing* pLoopCloser, MapMerging* pMapMerger, Relocalization* pRelocalizer, Tracking* pTracker)
@@ -42,27 +58,47 @@ namespace ORB_SLAM
     
     void OrbThread::RequestStop()
     {
-        boost::mutex::scoped_lock lock(mMutexStop);
-        mbStopRequested = true;
+        {
+            boost::mutex::scoped_lock lock(mMutexStop);
+            mbStopRequested = true;
+        }
+        Wake();
     }
 
     void OrbThread::RequestReset()
     {
-        boost::mutex::scoped_lock lock(mMutexReset);
-        mbResetRequested = true;
+        {
+            PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexReset);
+            mbResetRequested = true;
+        }
+        Wake();
+    }
+
+    void OrbThread::RequestMapSwitch()
+    {
+        {
+            PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexReset);
+            mbMapSwitchRequested = true;
+        }
+        Wake();
     }
 
     void OrbThread::Stop()
     {
         boost::mutex::scoped_lock lock(mMutexStop);
         mbStopped = true;
+        mCondStop.notify_all();
     }
 
     void OrbThread::Release()
     {
-        boost::mutex::scoped_lock lock(mMutexStop);
-        mbStopped = false;
-        mbStopRequested = false;
+        {
+            boost::mutex::scoped_lock lock(mMutexStop);
+            mbStopped = false;
+            mbStopRequested = false;
+            mCondStop.notify_all();
+        }
+        Wake();
     }
 
     bool OrbThread::isStopped()
@@ -77,11 +113,140 @@ namespace ORB_SLAM
         return mbStopRequested;
     }
     
+    void OrbThread::WaitUntilStopped()
+    {
+        boost::mutex::scoped_lock lock(mMutexStop);
+        if(mbSynchronous)
+        {
+            if(mbStopRequested)
+            {
+                mbStopped = true;
+                mbSyncStopped = true;
+            }
+            return;
+        }
+        while(!mbStopped && !mbFinishRequested && ros::ok())
+        {
+            // No worker may be running a shared thread, the caller then runs it up to its stop
+            if(mpSharedWorkers)
+            {
+                lock.unlock();
+                const bool bStepped = mpSharedWorkers->StepIfIdle(this);
+                lock.lock();
+                if(bStepped)
+                    continue;
+            }
+            mCondStop.timed_wait(lock, boost::posix_time::milliseconds(mpSharedWorkers ? 10 : 100));
+        }
+    }
+
+    void OrbThread::WaitWhileStopped()
+    {
+        TRACE_SCOPE("OrbThread::WaitWhileStopped");
+
+        while(isStopped() && isRunning())
+        {
+            // Purging may take the locks of the subclass, so not with mMutexStop held
+            Quiescent();
+            boost::mutex::scoped_lock lock(mMutexStop);
+            if(mbStopped)
+                mCondStop.timed_wait(lock, boost::posix_time::milliseconds(100));
+        }
+    }
+
+    void OrbThread::RequestFinish()
+    {
+        {
+            boost::mutex::scoped_lock lock(mMutexStop);
+            mbFinishRequested = true;
+            mCondStop.notify_all();
+        }
+        Wake();
+    }
+
+    bool OrbThread::isFinishRequested()
+    {
+        boost::mutex::scoped_lock lock(mMutexStop);
+        return mbFinishRequested;
+    }
+
+    bool OrbThread::isRunning()
+    {
+        return ros::ok() && !isFinishRequested();
+    }
+
+    void OrbThread::SetSynchronous(bool bSynchronous)
+    {
+        mbSynchronous = bSynchronous;
+    }
+
+    bool OrbThread::isSynchronous()
+    {
+        return mbSynchronous;
+    }
+
+    void OrbThread::SetSharedWorkers(SharedWorkers* pWorkers)
+    {
+        mpSharedWorkers = pWorkers;
+    }
+
+    bool OrbThread::RunStep()
+    {
+        // Same order as Run: the step, then the stop at the safe point, then the release
+        if(mbSyncStopped)
+        {
+            if(isStopped())
+            {
+                Quiescent();
+                return false;
+            }
+            mbSyncStopped = false;
+            Released();
+        }
+
+        const bool bWork = Step();
+
+        if(stopRequested())
+        {
+            Stop();
+            mbSyncStopped = true;
+        }
+        return bWork;
+    }
+
+    void OrbThread::Quiescent()
+    {
+        PurgeBadPointers();
+        EpochReclaimer::Global()->Quiescent(mnEpochId);
+    }
+
+    void OrbThread::Wake()
+    {
+        {
+            boost::mutex::scoped_lock lock(mMutexWake);
+            mbWakeRequested = true;
+            mCondWake.notify_all();
+        }
+        if(mpSharedWorkers)
+            mpSharedWorkers->Wake();
+    }
+
+    void OrbThread::WaitForWork()
+    {
+        boost::mutex::scoped_lock lock(mMutexWake);
+        if(!mbWakeRequested)
+            mCondWake.timed_wait(lock, boost::posix_time::milliseconds(100));
+        mbWakeRequested = false;
+    }
+    
     void OrbThread::ResetIfRequested()
     {
-        boost::mutex::scoped_lock lock(mMutexReset);
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexReset);
         if(mbResetRequested)
             mbResetRequested=false;
+        else if(mbMapSwitchRequested)
+            SwitchMap();
+        mbMapSwitchRequested=false;
     }
 
 }//namespace ORB_SLAM
\ No newline at end of file
@@ -22,301 +22,246 @@
 #include "types/KeyFrame.h"
 #include "types/MapDatabase.h"
 
-#include "util/ORBmatcher.h"
 #include "util/Converter.h"
 #include "util/Initializer.h"
-#include "util/Optimizer.h"
-#include "util/PnPsolver.h"
+#include "util/Trace.h"
+#include "util/LockProfiler.h"
+#include "util/Metrics.h"
 
 #include <ros/ros.h>
 
+#include <algorithm>
+
 namespace ORB_SLAM
 {
 
-Relocalization::Relocalization(MapDatabase *pMap):
-    OrbThread(pMap),  acceptingFrames(true), mCurrentFrame(NULL), isSuccessfull(false), mapMatch(NULL)
+// Frames a frame waits at most for a sharper one, and an attempt runs before a sharper frame cancels it
+static const unsigned int STALE_FRAMES = 5;
+
+Relocalization::Relocalization(MapDatabase *pMap, int nThreads):
+    OrbThread(pMap), mpNextFrame(NULL), mCurrentFrame(NULL), mbAttempting(false), mfBudget(0), mpLocalHint(NULL), mnLocalWindow(30),
+    mPnPVerifier(nThreads),
+    isSuccessfull(false), mapMatch(NULL)
 {
 }
     
 void Relocalization::Run()
 {
-    ros::Rate r(200);
-    while(ros::ok())
+    while(isRunning())
     {
-        // Reset if needed
-        ResetIfRequested();
-
-        bool should_proccess = false;
-        {
-            boost::mutex::scoped_lock lock(mMutexFrame);
-            should_proccess = (mCurrentFrame != NULL);
-        }
-        // Check if we have a new frame
-        if(should_proccess)
-        {
-            // Check if we have already been successfull
-            // If so then we do not want to overwrite those results
-            if(!isSuccess())
-            {
-                Relocalisation();
-            }
-        }
+        Step();
         
         // Safe area to stop
         if(stopRequested())
         {
             Stop();
-            ros::Rate r2(200);
-            while(isStopped() && ros::ok())
-            {
-                r2.sleep();
-            }
-            setAcceptingFrames(true);
+            WaitWhileStopped();
         }
-        // Sleep
-        r.sleep();
+        // Sleep until a new frame arrives
+        WaitForWork();
     }
 }
 
-void Relocalization::AddFrame(Frame* newFrame)
+bool Relocalization::Step()
 {
-    // Check if we are accepting keyframes, or have had a success
-    if(!isAcceptingFrames() || isSuccess()) {
-        delete newFrame;
-        return;
+    // Reset if needed
+    ResetIfRequested();
+
+    // Let the map objects culled meanwhile be reclaimed
+    Quiescent();
+
+    // Check if we have already been successfull
+    // If so then we do not want to overwrite those results
+    if(isSuccess())
+        return false;
+
+    // Check if we have a new frame, it is tried while the next one is submitted
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexFrame);
+        if(mpNextFrame == NULL)
+            return false;
+        delete mCurrentFrame;
+        mCurrentFrame = mpNextFrame;
+        mpNextFrame = NULL;
+        mbAttempting = true;
+        mPnPVerifier.Cancel(false);
     }
-    boost::mutex::scoped_lock lock(mMutexFrame);
-    // We are going to add a frame, so do not accept
-    setAcceptingFrames(false);
-    // Delete the old frame if not null
+
+    Relocalisation();
+
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexFrame);
+    mbAttempting = false;
+    return true;
+}
+
+void Relocalization::PurgeBadPointers()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexFrame);
     if(mCurrentFrame != NULL)
-        delete mCurrentFrame;
-    // Set the current frame to try to relocalize at
-    mCurrentFrame = newFrame;
+        mCurrentFrame->DiscardBadMapPoints();
+    if(mpNextFrame != NULL)
+        mpNextFrame->DiscardBadMapPoints();
+    if(mpLocalHint != NULL && mpLocalHint->isBad())
+        mpLocalHint = NULL;
 }
 
+void Relocalization::SetBudget(float fBudget)
+{
+    mfBudget = std::max(fBudget,0.f);
+}
 
-void Relocalization::Relocalisation()
+void Relocalization::SetLocalWindow(int nKeyFrames)
 {
-    // We are not accepting frames
-    // This allows the current frame to be thread safe
-    setAcceptingFrames(false);
+    mnLocalWindow = std::max(nKeyFrames,0);
+}
 
-    // Compute Bag of Words Vector
-    mCurrentFrame->ComputeBoW();
+void Relocalization::SetLocalHint(KeyFrame* pKF)
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexFrame);
+    mpLocalHint = pKF;
+}
 
-    // Relocalisation is performed when tracking is lost and forced at some stages during loop closing
-    // Track Lost: Query KeyFrame Database for keyframe candidates for relocalisation
-    vector<KeyFrame*> vpCandidateKFs;
+void Relocalization::LocalCandidates(vector<KeyFrame*> &vpCandidates)
+{
+    KeyFrame* pHint;
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexFrame);
+        pHint = mpLocalHint;
+    }
+    if(!pHint || mnLocalWindow==0 || pHint->isBad() || !pHint->getMap() || pHint->getMap()->getErased())
+        return;
 
-    int count =0;
-    // Add all keyframe candidates we have
-    // More recent maps are more likely, so we loop backwards
-    for(int i=mapDB->getAll().size()-1; i>=0; i--) {
-        // Ensure we are erased
-        if(mapDB->getAll().at(i)->getErased())
-            continue;
-        // Get all keyframes that match the current one
-        vector<KeyFrame*> temp = mapDB->getAll().at(i)->GetKeyFrameDatabase()->DetectRelocalisationCandidates(mCurrentFrame);
-        vpCandidateKFs.insert(vpCandidateKFs.end(), temp.begin(), temp.end());
-        // Increment out count
-        count++;
+    // Breadth first over the covisibility graph, the strongest links of each keyframe first
+    set<KeyFrame*> sIncluded;
+    vpCandidates.push_back(pHint);
+    sIncluded.insert(pHint);
+    for(size_t i=0; i<vpCandidates.size() && (int)vpCandidates.size()<mnLocalWindow; i++)
+    {
+        KeyFrame::KeyFrameList pNeighs = vpCandidates[i]->GetCovisibleList();
+        for(size_t iNeigh=0; iNeigh<pNeighs->size() && (int)vpCandidates.size()<mnLocalWindow; iNeigh++)
+        {
+            KeyFrame* pNeighKF = (*pNeighs)[iNeigh];
+            if(!pNeighKF->isBad() && sIncluded.insert(pNeighKF).second)
+                vpCandidates.push_back(pNeighKF);
+        }
     }
+}
 
-    // If we don't have any maps, we don't need to relocalize
-    if(count == 0) {
-        mpTracker->ResetRelocalisationRequested();
-        RequestStop();
-        setAcceptingFrames(true);
+void Relocalization::Submit(const Frame &F)
+{
+    // Keep the results of a success
+    if(isSuccess())
         return;
-    }
 
-    // Do not continue if we have no candidates
-    if(vpCandidateKFs.empty())
-    {
-        setAcceptingFrames(true);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexFrame);
+    // Without the quality gate the sharpness is 0, the newest frame is kept
+    if(mpNextFrame != NULL && F.mfSharpness<mpNextFrame->mfSharpness && F.mnId<=mpNextFrame->mnId+STALE_FRAMES)
         return;
-    }
 
-    const int nKFs = vpCandidateKFs.size();
+    delete mpNextFrame;
+    mpNextFrame = new Frame(F);
+
+    // The attempt would only find where the camera was
+    if(mbAttempting && mCurrentFrame != NULL && F.mfSharpness>=mCurrentFrame->mfSharpness &&
+       F.mnId>mCurrentFrame->mnId+STALE_FRAMES)
+        mPnPVerifier.Cancel();
+    Wake();
+}
 
-    // We perform first an ORB matching with each candidate
-    // If enough matches are found we setup a PnP solver
-    ORBmatcher matcher(0.75,true);
-    vector<PnPsolver*> vpPnPsolvers;
-    vpPnPsolvers.resize(nKFs);
+int Relocalization::Relocalize(Frame *pFrame, vector<KeyFrame*> &vpCandidates, PnPVerifier &verifier, float fBudget,
+                               vector<Map*> &vpPinnedMaps)
+{
+    // No candidates until the vocabulary is loaded
+    if(!mapDB->isVocabLoaded())
+        return -1;
 
-    vector<vector<MapPoint*> > vvpMapPointMatches;
-    vvpMapPointMatches.resize(nKFs);
-    vector<bool> vbDiscarded;
-    vbDiscarded.resize(nKFs);
+    // Compute Bag of Words Vector
+    pFrame->ComputeBoW();
 
-    int nCandidates=0;
-    for(size_t i=0; i<vpCandidateKFs.size(); i++)
+    mapDB->unpinMaps(vpPinnedMaps);
+    if(vpCandidates.empty())
     {
-        KeyFrame* pKF = vpCandidateKFs[i];
-        if(pKF->isBad())
-            vbDiscarded[i] = true;
-        else
-        {
-            int nmatches = matcher.SearchByBoW(pKF,*mCurrentFrame,vvpMapPointMatches[i]);
-            if(nmatches<15)
-            {
-                vbDiscarded[i] = true;
-                continue;
-            }
-            else
-            {
-                PnPsolver* pSolver = new PnPsolver(*mCurrentFrame,vvpMapPointMatches[i]);
-                pSolver->SetRansacParameters(0.99,10,300,4,0.5,5.991);
-                vpPnPsolvers[i] = pSolver;
-                nCandidates++;
-            }
-        }
+        // One query returns the ranked keyframe candidates of all the maps, erased ones are ignored
+        vpCandidates = mapDB->DetectRelocalisationCandidates(pFrame);
+        if(vpCandidates.empty())
+            return -1;
+
+        // The maps of the candidates stay resident while they are verified, paged out ones are faulted in
+        mapDB->pinMaps(vpCandidates, vpPinnedMaps);
     }
 
-    // Alternatively perform some iterations of P4P RANSAC
-    // Until we found a camera pose supported by enough inliers
-    bool bMatch = false;
-    ORBmatcher matcher2(0.9,true);
-    int match = -1;
-    
-    while(nCandidates>0 && !bMatch)
+    // Match and run RANSAC on the candidates, most similar first, until one is successful or all fail
+    Metrics::Global()->Add(Metrics::RELOCALIZATION_ATTEMPTS);
+    const int match = verifier.Verify(pFrame,vpCandidates,fBudget);
+    if(match<0)
     {
-        for(size_t i=0; i<vpCandidateKFs.size(); i++)
-        {
-            if(vbDiscarded[i])
-                continue;
-
-            // Perform 5 Ransac Iterations
-            vector<bool> vbInliers;
-            int nInliers;
-            bool bNoMore;
-
-            PnPsolver* pSolver = vpPnPsolvers[i];
-            cv::Mat Tcw = pSolver->iterate(5,bNoMore,vbInliers,nInliers);
-
-            // If Ransac reachs max. iterations discard keyframe
-            if(bNoMore)
-            {
-                vbDiscarded[i]=true;
-                nCandidates--;
-            }
-
-            // If a Camera Pose is computed, optimize
-            if(!Tcw.empty())
-            {
-                Tcw.copyTo(mCurrentFrame->mTcw);
-
-                set<MapPoint*> sFound;
-
-                for(size_t j=0; j<vbInliers.size(); j++)
-                {
-                    if(vbInliers[j])
-                    {
-                        mCurrentFrame->mvpMapPoints[j]=vvpMapPointMatches[i][j];
-                        sFound.insert(vvpMapPointMatches[i][j]);
-                    }
-                    else
-                        mCurrentFrame->mvpMapPoints[j]=NULL;
-                }
-
-                int nGood = Optimizer::PoseOptimization(mCurrentFrame);
-
-                if(nGood<10)
-                    continue;
-
-                for(size_t io =0, ioend=mCurrentFrame->mvbOutlier.size(); io<ioend; io++)
-                    if(mCurrentFrame->mvbOutlier[io])
-                        mCurrentFrame->mvpMapPoints[io]=NULL;
-
-                // If few inliers, search by projection in a coarse window and optimize again
-                if(nGood<50)
-                {
-                    int nadditional =matcher2.SearchByProjection(*mCurrentFrame,vpCandidateKFs[i],sFound,10,100);
-
-                    if(nadditional+nGood>=50)
-                    {
-                        nGood = Optimizer::PoseOptimization(mCurrentFrame);
-
-                        // If many inliers but still not enough, search by projection again in a narrower window
-                        // the camera has been already optimized with many points
-                        if(nGood>30 && nGood<50)
-                        {
-                            sFound.clear();
-                            for(size_t ip =0, ipend=mCurrentFrame->mvpMapPoints.size(); ip<ipend; ip++)
-                                if(mCurrentFrame->mvpMapPoints[ip])
-                                    sFound.insert(mCurrentFrame->mvpMapPoints[ip]);
-                            nadditional =matcher2.SearchByProjection(*mCurrentFrame,vpCandidateKFs[i],sFound,3,64);
-
-                            // Final optimization
-                            if(nGood+nadditional>=50)
-                            {
-                                nGood = Optimizer::PoseOptimization(mCurrentFrame);
-
-                                for(size_t io =0; io<mCurrentFrame->mvbOutlier.size(); io++)
-                                    if(mCurrentFrame->mvbOutlier[io])
-                                        mCurrentFrame->mvpMapPoints[io]=NULL;
-                            }
-                        }
-                    }
-                }
-
-                // If the pose is supported by enough inliers stop ransacs and continue
-                if(nGood>=50)
-                {
-                    bMatch = true;
-                    match = i;
-                    break;
-                }
-            }
-        }
+        mapDB->unpinMaps(vpPinnedMaps);
+        return -1;
     }
 
-    // If we do not have a match accept keyframes
-    if(!bMatch)
-    {
-        setAcceptingFrames(true);
+    Metrics::Global()->Add(Metrics::RELOCALIZATION_SUCCESSES);
+    return match;
+}
+
+void Relocalization::Relocalisation()
+{
+    TRACE_SCOPE("Relocalization::Relocalisation");
+
+    // Count the maps we can relocalize in
+    int count =0;
+    MapDatabase::MapList pMaps = mapDB->getMaps();
+    for(size_t i=0; i<pMaps->size(); i++) {
+        if(!pMaps->at(i)->getErased())
+            count++;
+    }
+
+    // If we don't have any maps, we don't need to relocalize
+    if(count == 0) {
+        mpTracker->ResetRelocalisationRequested();
+        RequestStop();
         return;
     }
-    // Success, store the keyframe and map
-    else
-    {         
-        // If we have a match id, get its map, and update the mapDB's current map
-        if(match != -1 && vpCandidateKFs[match]->getMap() != NULL)
-        {
-            ROS_INFO("ORB-SLAM - Relocalization Match Found");
-            {
-                boost::mutex::scoped_lock lock(mMutexSuccessCheck);
-                mapMatch = vpCandidateKFs[match]->getMap();
-                isSuccessfull = true;
-            }
-        }
+
+    // Local first: the neighborhood of the keyframe tracking was lost at is resident and small
+    vector<KeyFrame*> vpCandidateKFs;
+    LocalCandidates(vpCandidateKFs);
+    int match = -1;
+    if(!vpCandidateKFs.empty())
+    {
+        match = Relocalize(mCurrentFrame, vpCandidateKFs, mPnPVerifier, mfBudget, mvpPinnedMaps);
+        if(match>=0)
+            Metrics::Global()->Add(Metrics::RELOCALIZATION_LOCAL_SUCCESSES);
         else
-        {
-            RequestReset();
-            ROS_WARN("ORB-SLAM - Unable to find the map linked to relocalized keyframe.");
-        }
+            vpCandidateKFs.clear();
     }
 
-}
+    // Then the global cross-map index is queried, on success the matched map stays pinned until the relocalisation is reset
+    if(match<0)
+        match = Relocalize(mCurrentFrame, vpCandidateKFs, mPnPVerifier, mfBudget, mvpPinnedMaps);
 
+    // If we do not have a match the next frame is tried
+    if(match<0)
+        return;
 
-bool Relocalization::isAcceptingFrames()
-{
-    boost::mutex::scoped_lock lock(mMutexAcceptFrames);
-    return acceptingFrames;
-}
-        
-void Relocalization::setAcceptingFrames(bool val)
-{
-    boost::mutex::scoped_lock lock(mMutexAcceptFrames);
-    acceptingFrames = val;
+    // Success, store the keyframe and map
+    // If we have a match id, get its map, and update the mapDB's current map
+    if(vpCandidateKFs[match]->getMap() != NULL)
+    {
+        ROS_INFO("ORB-SLAM - Relocalization Match Found");
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexSuccessCheck);
+        mapMatch = vpCandidateKFs[match]->getMap();
+        isSuccessfull = true;
+    }
+    else
+    {
+        RequestReset();
+        ROS_WARN("ORB-SLAM - Unable to find the map linked to relocalized keyframe.");
+    }
 }
 
 bool Relocalization::isSuccess()
 {
-    boost::mutex::scoped_lock lock(mMutexSuccessCheck);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexSuccessCheck);
     return isSuccessfull;
 }
 
@@ -325,8 +270,8 @@ bool Relocalization::relocalizeIfSuccessfull()
         // Check if we have been succesfull
         if(!isSuccess())
             return false;
-        boost::mutex::scoped_lock lock(mMutexFrame);
-        boost::mutex::scoped_lock lock2(mMutexSuccessCheck);
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexFrame);
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock2, mMutexSuccessCheck);
         // Set the map
         // Set map handles making sure the map we want to set is not erased
         if(mapDB->setMap(mapMatch))
@@ -351,20 +296,20 @@ bool Relocalization::relocalizeIfSuccessfull()
 
 void Relocalization::ResetIfRequested()
 {
-    boost::mutex::scoped_lock lock(mMutexSuccessCheck);
-    boost::mutex::scoped_lock lock2(mMutexFrame);
-    boost::mutex::scoped_lock lock3(mMutexReset);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexSuccessCheck);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock2, mMutexFrame);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock3, mMutexReset);
     if(mbResetRequested)
     {
-        // If there is a frame delete it
-         if(mCurrentFrame != NULL)
-                delete mCurrentFrame;
+        // If there are frames delete them
+        delete mCurrentFrame;
+        delete mpNextFrame;
         // Reset vars
         mCurrentFrame = NULL;
+        mpNextFrame = NULL;
         isSuccessfull = false;
         mapMatch = NULL;
-        // Accept frames
-        setAcceptingFrames(true);
+        mapDB->unpinMaps(mvpPinnedMaps);
         // Reset reset var
         mbResetRequested=false;
     }
@@ -0,0 +1,176 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "threads/RigCamera.h"
+
+#include <cmath>
+#include <ros/ros.h>
+#include <cv_bridge/cv_bridge.h>
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+RigCamera::RigCamera(Camera* pCamera, ORBextractor* pExtractor, ORBVocabulary* pVocabulary, const string &strTopic, bool bRGB):
+    mpCamera(pCamera), mpORBextractor(pExtractor), mpORBVocabulary(pVocabulary), mstrTopic(strTopic), mbRGB(bRGB),
+    mpThread(NULL), mpFrame(NULL), mnFramesDropped(0), mbStop(false)
+{
+}
+
+RigCamera::~RigCamera()
+{
+    Unsubscribe();
+    delete mpFrame;
+    delete mpORBextractor;
+    delete mpCamera;
+}
+
+void RigCamera::Subscribe(image_transport::ImageTransport &it, const string &strTransport, int nQueueSize)
+{
+    mImageSub = it.subscribe(mstrTopic, nQueueSize, &RigCamera::GrabImage, this, image_transport::TransportHints(strTransport));
+
+    if(mpThread==NULL)
+    {
+        mbStop = false;
+        mpThread = new boost::thread(&RigCamera::Run, this);
+    }
+}
+
+void RigCamera::Unsubscribe()
+{
+    mImageSub.shutdown();
+
+    if(mpThread)
+    {
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            mbStop = true;
+        }
+        mCond.notify_all();
+        mpThread->join();
+        delete mpThread;
+        mpThread = NULL;
+    }
+}
+
+void RigCamera::GrabImage(const sensor_msgs::ImageConstPtr& msg)
+{
+    // Only the last image is kept, the extraction thread converts it
+    boost::mutex::scoped_lock lock(mMutex);
+    if(mpImage)
+        mnFramesDropped++;
+    mpImage = msg;
+    mCond.notify_all();
+}
+
+void RigCamera::Run()
+{
+    while(true)
+    {
+        sensor_msgs::ImageConstPtr msg;
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            while(!mpImage && !mbStop)
+                mCond.wait(lock);
+            if(mbStop)
+                break;
+            msg.swap(mpImage);
+        }
+
+        cv_bridge::CvImageConstPtr cv_ptr;
+        try
+        {
+            cv_ptr = cv_bridge::toCvShare(msg);
+        }
+        catch (cv_bridge::Exception& e)
+        {
+            ROS_ERROR("cv_bridge exception: %s", e.what());
+            continue;
+        }
+
+        AddImage(cv_ptr->image,cv_ptr->header.stamp.toSec());
+    }
+}
+
+void RigCamera::AddImage(const cv::Mat &image, const double &timeStamp)
+{
+    ROS_ASSERT(image.channels()==3 || image.channels()==1);
+
+    cv::Mat im;
+    if(image.channels()==3)
+    {
+        if(mbRGB)
+            cvtColor(image, im, CV_RGB2GRAY);
+        else
+            cvtColor(image, im, CV_BGR2GRAY);
+    }
+    else
+        image.copyTo(im);
+
+    Extract(im,timeStamp);
+}
+
+void RigCamera::Extract(cv::Mat &im, const double &timeStamp)
+{
+    mpCamera->SetImageSize(im.cols,im.rows);
+    Frame* pFrame = new Frame(im,timeStamp,mpORBextractor,mpORBVocabulary,mpCamera);
+
+    boost::mutex::scoped_lock lock(mMutex);
+    if(mpFrame)
+    {
+        delete mpFrame;
+        mnFramesDropped++;
+    }
+    mpFrame = pFrame;
+}
+
+Frame* RigCamera::TakeFrame(const double &timeStamp, const double &maxDelay)
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    if(!mpFrame)
+        return NULL;
+
+    // A newer frame may still go with a later frame of the first camera
+    if(fabs(mpFrame->mTimeStamp-timeStamp)>maxDelay)
+    {
+        if(mpFrame->mTimeStamp<timeStamp)
+        {
+            delete mpFrame;
+            mpFrame = NULL;
+            mnFramesDropped++;
+        }
+        return NULL;
+    }
+
+    Frame* pFrame = mpFrame;
+    mpFrame = NULL;
+    return pFrame;
+}
+
+unsigned int RigCamera::FramesDropped()
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    return mnFramesDropped;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,155 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "threads/SharedWorkers.h"
+#include "threads/OrbThread.h"
+#include "util/TaskPool.h"
+#include "util/Trace.h"
+
+#include <ros/ros.h>
+
+#include <algorithm>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+SharedWorkers::SharedWorkers():
+    mnNext(0), mbWakeRequested(false), mbFinishRequested(false)
+{
+}
+
+SharedWorkers::~SharedWorkers()
+{
+    Finish();
+}
+
+void SharedWorkers::Add(OrbThread* pThread, int nDemotion)
+{
+    pThread->SetSharedWorkers(this);
+
+    boost::mutex::scoped_lock lock(mMutex);
+    Entry entry;
+    entry.pThread = pThread;
+    entry.nDemotion = nDemotion;
+    entry.bBusy = false;
+    mvEntries.push_back(entry);
+}
+
+void SharedWorkers::Start(int nWorkers)
+{
+    nWorkers = max(nWorkers,1);
+    for(int i=0; i<nWorkers; i++)
+        mvpThreads.push_back(new boost::thread(&SharedWorkers::RunWorker,this));
+}
+
+void SharedWorkers::Finish()
+{
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mbFinishRequested = true;
+        mCondWake.notify_all();
+    }
+
+    for(size_t i=0; i<mvpThreads.size(); i++)
+    {
+        mvpThreads[i]->join();
+        delete mvpThreads[i];
+    }
+    mvpThreads.clear();
+}
+
+void SharedWorkers::Wake()
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    mbWakeRequested = true;
+    mCondWake.notify_all();
+}
+
+bool SharedWorkers::StepIfIdle(OrbThread* pThread)
+{
+    size_t i = 0;
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        while(i<mvEntries.size() && mvEntries[i].pThread!=pThread)
+            i++;
+        if(i==mvEntries.size() || mvEntries[i].bBusy || pThread->isFinishRequested())
+            return false;
+        mvEntries[i].bBusy = true;
+    }
+    Step(i);
+    return true;
+}
+
+bool SharedWorkers::Step(size_t i)
+{
+    const int nPrevDemotion = TaskPool::GetThreadDemotion();
+    TaskPool::SetThreadDemotion(mvEntries[i].nDemotion);
+    const bool bWork = mvEntries[i].pThread->RunStep();
+    TaskPool::SetThreadDemotion(nPrevDemotion);
+
+    boost::mutex::scoped_lock lock(mMutex);
+    mvEntries[i].bBusy = false;
+    return bWork;
+}
+
+void SharedWorkers::RunWorker()
+{
+    Tracer::Global()->SetThreadName("SharedWorkers");
+
+    // Steps without work in a row, a full round of them and the worker sleeps
+    size_t nIdle = 0;
+    while(ros::ok())
+    {
+        size_t i = 0;
+        bool bClaimed = false;
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            if(mbFinishRequested)
+                break;
+
+            // The next thread that is neither run by another worker nor finishing
+            for(size_t n=0; n<mvEntries.size() && !bClaimed; n++)
+            {
+                i = mnNext++%mvEntries.size();
+                bClaimed = !mvEntries[i].bBusy && !mvEntries[i].pThread->isFinishRequested();
+            }
+
+            if(!bClaimed || nIdle>=mvEntries.size())
+            {
+                nIdle = 0;
+                if(!mbWakeRequested)
+                    mCondWake.timed_wait(lock, boost::posix_time::milliseconds(100));
+                mbWakeRequested = false;
+                continue;
+            }
+            mvEntries[i].bBusy = true;
+        }
+
+        if(Step(i))
+            nIdle = 0;
+        else
+            nIdle++;
+    }
+}
+
+} //namespace ORB_SLAM
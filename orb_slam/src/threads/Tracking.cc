@@ -20,22 +20,34 @@
 
 #include "threads/Tracking.h"
 
+#ifndef ORB_SLAM_HEADLESS
 #include "publishers/FramePublisher.h"
 #include "publishers/MapPublisher.h"
+#endif
 
 #include "types/Map.h"
 #include "types/MapDatabase.h"
 
 #include "util/ORBmatcher.h"
 #include "util/Converter.h"
+#include "util/Trace.h"
 #include "util/Initializer.h"
 #include "util/Optimizer.h"
-#include "util/PnPsolver.h"
+#include "util/LatencyStats.h"
+#include "util/AllocationStats.h"
+#include "util/GpuORBextractor.h"
+#include "util/GpuORBmatcher.h"
+#include "threads/RigCamera.h"
+#include "util/LockProfiler.h"
+#include "util/Metrics.h"
 
 #include <iostream>
 #include <fstream>
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
+#include <ros/package.h>
 #include <cv_bridge/cv_bridge.h>
+#include <image_transport/image_transport.h>
 #include <opencv2/opencv.hpp>
 
 using namespace std;
@@ -43,53 +55,90 @@ using namespace std;
 namespace ORB_SLAM
 {
 
-
-Tracking::Tracking(FramePublisher *pFramePublisher, MapPublisher *pMapPublisher, MapDatabase *pMap,  FpsCounter* pfps, string strSettingPath):
+Tracking::Tracking(FramePublisher *pFramePublisher, MapPublisher *pMapPublisher, MapDatabase *pMap,  FpsCounter* pfps, string strSettingPath,
+                   const ros::NodeHandle &nh, const string &strFramePrefix):
     OrbThread(pMap), mState(NO_IMAGES_YET), mpInitializer(NULL), mpFramePublisher(pFramePublisher), mpMapPublisher(pMapPublisher),
-    localMap(NULL), mnLastRelocFrameId(0), mbPublisherStopped(false), mbReseting(false), mbForceRelocalisation(false), mbMotionModel(false)
+    mbGpuExtraction(false), mpFeatureBudget(NULL), mfExtractTime(0), mpLoadShedder(NULL), mpStationaryDetector(NULL), mfStationaryMaxMotion(0), mpKeyFramePolicy(NULL), mbKeepNextFrame(true), mpLocalMapOwner(NULL), mnLocalMapBuildFrameId(0), mnLocalMapLastFrameId(0),
+    localMap(NULL), mnLastRelocFrameId(0), mbPublisherStopped(false), mbReseting(false), mbForceRelocalisation(false),
+    mbLocalizationOnly(false), mbMappingStopped(false), mstrSettingPath(strSettingPath),
+    mbReloadRequested(false), mbMotionModel(false),
+    mnFrameQueueSize(0), mnDropPolicy(DROP_OLDEST), mbExtractWorking(false), mbZeroCopyInput(false),
+    mnTrackedSeq(0), mnFramesDropped(0), mnLastImageSeq(0), mbImageSeqValid(false), mpTrackingStage(NULL),
+    mbThreadConfigured(false), mpTrajectoryRecorder(NULL), mfRigMaxDelay(0), mnRigInliers(0),
+    mpImageAligner(NULL), mfDirectWindow(0), mpImuIntegrator(NULL), mfImuWindow(0), mpPosePredictor(NULL), mfPredictionRate(0), mnPredictedSeq(0), mpPositionPrior(NULL),
+    mpFlowTracker(NULL), mnFlowMaxFrames(0), mfFlowMinRatio(0), mnFlowMinInliers(0),
+    mbFlowFrame(false), mbFlowNext(false), mnFlowFrames(0), mnFlowStartInliers(0), mnDownscaleLevels(0), mbDownscaleNext(false),
+    mpImageQuality(NULL), mfRelocInlineBudget(0), mfDepthFactor(0), mfDepthMaxDelay(0), mnDepthMinPoints(0), mDepthTimeStamp(0)
 {
     // Load camera parameters from settings file
 
     cv::FileStorage fSettings(strSettingPath, cv::FileStorage::READ);
-    float fx = fSettings["Camera.fx"];
-    float fy = fSettings["Camera.fy"];
-    float cx = fSettings["Camera.cx"];
-    float cy = fSettings["Camera.cy"];
-
-    cv::Mat K = cv::Mat::eye(3,3,CV_32F);
-    K.at<float>(0,0) = fx;
-    K.at<float>(1,1) = fy;
-    K.at<float>(0,2) = cx;
-    K.at<float>(1,2) = cy;
-    K.copyTo(mK);
-
-    cv::Mat DistCoef(4,1,CV_32F);
-    DistCoef.at<float>(0) = fSettings["Camera.k1"];
-    DistCoef.at<float>(1) = fSettings["Camera.k2"];
-    DistCoef.at<float>(2) = fSettings["Camera.p1"];
-    DistCoef.at<float>(3) = fSettings["Camera.p2"];
-    DistCoef.copyTo(mDistCoef);
+    mpCamera = new Camera(fSettings,"Camera.",0);
+
+    mThreadConfig = ThreadConfig(fSettings,"Tracking");
 
     float fps = fSettings["Camera.fps"];
     if(fps==0)
         fps=30;
 
+    mNH = nh;
+    mstrWorldFrame = strFramePrefix+"ORB_SLAM/World";
+    mstrCameraFrame = strFramePrefix+"ORB_SLAM/Camera";
+    mPosePub = mNH.advertise<geometry_msgs::PoseStamped>("ORB_SLAM/Pose",10);
+    mTrackedPosePub = mNH.advertise<orb_slam::TrackedPose>("ORB_SLAM/TrackedPose",10);
+
     // Max/Min Frames to insert keyframes and to check relocalisation
     mMinFrames = 0;
     mMaxFrames = 18*fps/30;
 
 
     cout << "Camera Parameters: " << endl;
-    cout << "- fx: " << fx << endl;
-    cout << "- fy: " << fy << endl;
-    cout << "- cx: " << cx << endl;
-    cout << "- cy: " << cy << endl;
-    cout << "- k1: " << DistCoef.at<float>(0) << endl;
-    cout << "- k2: " << DistCoef.at<float>(1) << endl;
-    cout << "- p1: " << DistCoef.at<float>(2) << endl;
-    cout << "- p2: " << DistCoef.at<float>(3) << endl;
+    cout << "- fx: " << mpCamera->fx << endl;
+    cout << "- fy: " << mpCamera->fy << endl;
+    cout << "- cx: " << mpCamera->cx << endl;
+    cout << "- cy: " << mpCamera->cy << endl;
+    cout << "- k1: " << mpCamera->mDistCoef.at<float>(0) << endl;
+    cout << "- k2: " << mpCamera->mDistCoef.at<float>(1) << endl;
+    cout << "- p1: " << mpCamera->mDistCoef.at<float>(2) << endl;
+    cout << "- p2: " << mpCamera->mDistCoef.at<float>(3) << endl;
     cout << "- fps: " << fps << endl;
 
+    // Image input: topic, image_transport plugin (raw, compressed, theora) and subscriber queue
+    mstrImageTopic = (string)fSettings["Camera.Topic"];
+    if(mstrImageTopic.empty())
+        mstrImageTopic = "/camera/image_raw";
+    mstrImageTransport = (string)fSettings["Camera.Transport"];
+    if(mstrImageTransport.empty())
+        mstrImageTransport = "raw";
+    mnImageQueueSize = fSettings["Camera.QueueSize"];
+    if(mnImageQueueSize<1)
+        mnImageQueueSize = 1;
+
+    cout << "- input: " << mstrImageTopic << " (" << mstrImageTransport << ", queue " << mnImageQueueSize << ")" << endl;
+
+    // Depth input: maps are created from single frames instead of the monocular initialization
+    mstrDepthTopic = (string)fSettings["Camera.DepthTopic"];
+    if(!mstrDepthTopic.empty())
+    {
+        mfDepthFactor = fSettings["Camera.DepthFactor"];
+        if(mfDepthFactor<=0)
+            mfDepthFactor = 1000;
+        mfDepthMaxDelay = fSettings["Camera.DepthMaxDelay"];
+        if(mfDepthMaxDelay<=0)
+            mfDepthMaxDelay = 0.5f/fps;
+        mnDepthMinPoints = fSettings["Camera.DepthMinPoints"];
+        if(mnDepthMinPoints<=0)
+            mnDepthMinPoints = 100;
+
+        cout << "- depth input: " << mstrDepthTopic << " (factor " << mfDepthFactor << ", max delay "
+             << mfDepthMaxDelay*1000 << " ms, " << mnDepthMinPoints << " points to create a map)" << endl;
+    }
+
+    int nZeroCopy = fSettings["Camera.ZeroCopy"];
+    mbZeroCopyInput = nZeroCopy;
+
+    if(mbZeroCopyInput)
+        cout << "- zero copy input: enabled (grayscale images)" << endl;
 
     int nRGB = fSettings["Camera.RGB"];
     mbRGB = nRGB;
@@ -105,17 +154,21 @@ Tracking::Tracking(FramePublisher *pFramePublisher, MapPublisher *pMapPublisher,
     int nLevels = fSettings["ORBextractor.nLevels"];
     int fastTh = fSettings["ORBextractor.fastTh"];    
     int Score = fSettings["ORBextractor.nScoreType"];
+    int nThreads = fSettings["ORBextractor.nThreads"];
+    if(nThreads<1)
+        nThreads=1;
 
     assert(Score==1 || Score==0);
 
     // This is the core orb extracter for use while tracking
-    mpORBextractor = new ORBextractor(nFeatures,fScaleFactor,nLevels,Score,fastTh);
+    mpORBextractor = new ORBextractor(nFeatures,fScaleFactor,nLevels,Score,fastTh,nThreads);
 
     cout << endl  << "ORB Extractor Parameters: " << endl;
     cout << "- Number of Features: " << nFeatures << endl;
     cout << "- Scale Levels: " << nLevels << endl;
     cout << "- Scale Factor: " << fScaleFactor << endl;
     cout << "- Fast Threshold: " << fastTh << endl;
+    cout << "- Threads: " << nThreads << endl;
     if(Score==0)
         cout << "- Score: HARRIS" << endl;
     else
@@ -124,7 +177,198 @@ Tracking::Tracking(FramePublisher *pFramePublisher, MapPublisher *pMapPublisher,
 
     // ORB extractor for initialization
     // Initialization uses only points from the finest scale level
-    mpIniORBextractor = new ORBextractor(nFeatures*2,1.2,8,Score,fastTh);  
+    mpIniORBextractor = new ORBextractor(nFeatures*2,1.2,8,Score,fastTh,nThreads);  
+
+    // Keypoints distributed with a quadtree over a single FAST pass per level
+    int nQuadTree = fSettings["ORBextractor.QuadTree"];
+    mpORBextractor->SetQuadTree(nQuadTree);
+    mpIniORBextractor->SetQuadTree(nQuadTree);
+    if(nQuadTree)
+        cout << "- Distribution: Quadtree" << endl;
+
+    // Both extractors build their levels into the same buffers, once per image if their scales match
+    mpORBextractor->SetPyramid(&mPyramid);
+    mpIniORBextractor->SetPyramid(&mPyramid);
+
+    // Static mask of the image, relative to the package unless absolute
+    string strMask = (string)fSettings["ORBextractor.Mask"];
+    if(!strMask.empty())
+    {
+        if(strMask[0]!='/')
+            strMask = ros::package::getPath("orb_slam")+"/"+strMask;
+        cv::Mat mask = cv::imread(strMask, CV_LOAD_IMAGE_GRAYSCALE);
+        if(mask.empty())
+            ROS_WARN("ORB-SLAM - Could not read the mask %s, extracting on the whole image", strMask.c_str());
+        else
+        {
+            mpORBextractor->SetStaticMask(mask);
+            mpIniORBextractor->SetStaticMask(mask);
+            mStaticMask = mask;
+            cout << "- Mask: " << strMask << endl;
+        }
+    }
+
+    // Extraction on the GPU, the CPU extractors stay as fallback
+    // With a frame queue the next image is extracted while the previous one is tracked
+    int nGpu = fSettings["ORBextractor.Gpu"];
+    if(nGpu)
+    {
+        if(GpuORBextractor::Available())
+        {
+            mpORBextractor->SetBackend(new GpuORBextractor());
+            mpIniORBextractor->SetBackend(new GpuORBextractor());
+            mbGpuExtraction = true;
+            cout << "- Extraction: GPU" << endl;
+        }
+        else
+            ROS_WARN("ORB-SLAM - ORBextractor.Gpu is set but no CUDA device is usable (build with ORB_SLAM_GPU), extracting on the CPU");
+    }
+
+    // Windowed matching on the GPU (initialization and tracking from the previous frame)
+    // Small searches stay on the CPU, the transfers would cost more than the distances
+    int nGpuMatching = fSettings["ORBmatcher.Gpu"];
+    if(nGpuMatching)
+    {
+        if(GpuORBmatcher::Available())
+        {
+            int nMinCandidates = fSettings["ORBmatcher.GpuMinCandidates"];
+            if(nMinCandidates<=0)
+                nMinCandidates = 20000;
+            ORBmatcher::SetBackend(new GpuORBmatcher(),nMinCandidates);
+            cout << "- Matching: GPU (from " << nMinCandidates << " candidates)" << endl;
+        }
+        else
+            ROS_WARN("ORB-SLAM - ORBmatcher.Gpu is set but no CUDA device is usable (build with ORB_SLAM_GPU), matching on the CPU");
+    }
+
+    // Wide windowed searches through a multi-index hash of the descriptors
+    float fIndexWindow = fSettings["ORBmatcher.IndexWindow"];
+    if(fIndexWindow>0)
+    {
+        ORBmatcher::SetDescriptorIndex(fIndexWindow);
+        cout << "- Matching: descriptor index from windows of " << fIndexWindow << " pixels" << endl;
+    }
+
+    // Other cameras of a rig (Rig.Cameras, the first one is the camera above)
+    // Each one extracts its images in its own thread with the parameters of the tracking extractor
+    int nRigCameras = fSettings["Rig.Cameras"];
+    for(int i=1; i<nRigCameras; i++)
+    {
+        stringstream ss;
+        ss << "Rig.Camera" << i << ".";
+        const string prefix = ss.str();
+        string strTopic = (string)fSettings[prefix+"Topic"];
+        if(strTopic.empty())
+        {
+            ROS_WARN("ORB-SLAM - %sTopic is not set, the camera is left out of the rig",prefix.c_str());
+            continue;
+        }
+        Camera* pCamera = new Camera(fSettings,prefix,mvpRigCameras.size()+1);
+        ORBextractor* pExtractor = new ORBextractor(nFeatures,fScaleFactor,nLevels,Score,fastTh,nThreads);
+        pExtractor->SetQuadTree(mpORBextractor->GetQuadTree());
+        mvpRigCameras.push_back(new RigCamera(pCamera,pExtractor,mapDB->getVocab(),strTopic,mbRGB));
+    }
+
+    // Frames of the other cameras go with the frame of the first one taken at most this apart
+    mfRigMaxDelay = fSettings["Rig.MaxDelay"];
+    if(mfRigMaxDelay<=0)
+        mfRigMaxDelay = 0.5f/fps;
+
+    if(!mvpRigCameras.empty())
+    {
+        cout << "Camera Rig: " << mvpRigCameras.size()+1 << " cameras" << endl;
+        for(size_t i=0; i<mvpRigCameras.size(); i++)
+            cout << "- camera " << i+1 << ": " << mvpRigCameras[i]->GetTopic() << endl;
+        cout << "- max delay: " << mfRigMaxDelay*1000 << " ms" << endl;
+    }
+
+    // Adaptive feature budget for the tracking extractor
+    // The initialization extractor keeps its fixed budget, initialization needs many matches
+    int nAdaptive = fSettings["ORBextractor.Adaptive"];
+    if(nAdaptive)
+    {
+        float targetTime = fSettings["ORBextractor.TargetTime"];
+        if(targetTime<=0)
+            targetTime = 1.0f/fps;
+        int nMinFeatures = fSettings["ORBextractor.MinFeatures"];
+        if(nMinFeatures<=0)
+            nMinFeatures = nFeatures/5;
+        int nMaxFeatures = fSettings["ORBextractor.MaxFeatures"];
+        if(nMaxFeatures<=0)
+            nMaxFeatures = nFeatures;
+        int minFastTh = fSettings["ORBextractor.MinFastTh"];
+        if(minFastTh<=0)
+            minFastTh = max(fastTh/2,1);
+        int maxFastTh = fSettings["ORBextractor.MaxFastTh"];
+        if(maxFastTh<=0)
+            maxFastTh = 2*fastTh;
+        int nTargetInliers = fSettings["ORBextractor.TargetInliers"];
+        if(nTargetInliers<=0)
+            nTargetInliers = 100;
+        int nMaxMappingQueue = fSettings["ORBextractor.MaxMappingQueue"];
+        if(nMaxMappingQueue<=0)
+            nMaxMappingQueue = 3;
+
+        mpFeatureBudget = new FeatureBudget(nFeatures,fastTh,nMinFeatures,nMaxFeatures,minFastTh,maxFastTh,
+                                            targetTime,nTargetInliers,nMaxMappingQueue);
+
+        cout << "Adaptive Feature Budget: Enabled" << endl;
+        cout << "- Target Time: " << targetTime*1000 << " ms" << endl;
+        cout << "- Features: " << nMinFeatures << " - " << nMaxFeatures << endl;
+        cout << "- Fast Threshold: " << minFastTh << " - " << maxFastTh << endl;
+        cout << "- Target Inliers: " << nTargetInliers << endl;
+        cout << "- Max Local Mapping Queue: " << nMaxMappingQueue << endl;
+    }
+
+    int nShedding = fSettings["Tracking.LoadShedding"];
+    if(nShedding)
+    {
+        float fTargetLoad = fSettings["Tracking.ShedTargetLoad"];
+        if(fTargetLoad<=0)
+            fTargetLoad = 0.9;
+        int nMaxStride = fSettings["Tracking.ShedMaxStride"];
+        if(nMaxStride<=0)
+            nMaxStride = 3;
+        mpLoadShedder = new LoadShedder(fTargetLoad,nMaxStride);
+
+        cout << "Load Shedding: Enabled" << endl;
+        cout << "- Target Load: " << fTargetLoad*100 << "% of the frame period" << endl;
+        cout << "- Max Stride: 1 in " << nMaxStride << " frames" << endl << endl;
+    }
+
+    int nStationary = fSettings["Tracking.Stationary"];
+    if(nStationary)
+    {
+        float fMaxDifference = fSettings["Tracking.StationaryMaxDifference"];
+        if(fMaxDifference<=0)
+            fMaxDifference = 3;
+        mfStationaryMaxMotion = fSettings["Tracking.StationaryMaxMotion"];
+        if(mfStationaryMaxMotion<=0)
+            mfStationaryMaxMotion = 0.5;
+        int nMinFrames = fSettings["Tracking.StationaryFrames"];
+        if(nMinFrames<=0)
+            nMinFrames = 10;
+        float fVerifyPeriod = fSettings["Tracking.StationaryPeriod"];
+        if(fVerifyPeriod<=0)
+            fVerifyPeriod = 1;
+        mpStationaryDetector = new StationaryDetector(80,fMaxDifference,nMinFrames,fVerifyPeriod);
+
+        cout << "Stationary Camera: Enabled" << endl;
+        cout << "- Max Image Difference: " << fMaxDifference << ", Max Motion: " << mfStationaryMaxMotion << " px" << endl;
+        cout << "- Still Frames: " << nMinFrames << ", Verification Period: " << fVerifyPeriod << " s" << endl << endl;
+    }
+
+    int nPredictive = fSettings["Tracking.PredictiveKeyFrames"];
+    if(nPredictive)
+    {
+        float fMaxWait = fSettings["Tracking.KeyFrameMaxWait"];
+        if(fMaxWait<=0)
+            fMaxWait = 2;
+        mpKeyFramePolicy = new KeyFramePolicy(0.9f,fMaxWait);
+
+        cout << "Predictive KeyFrames: Enabled" << endl;
+        cout << "- Max Wait: " << fMaxWait << " frames" << endl << endl;
+    }
 
     int nMotion = fSettings["UseMotionModel"];
     mbMotionModel = nMotion;
@@ -137,25 +381,471 @@ Tracking::Tracking(FramePublisher *pFramePublisher, MapPublisher *pMapPublisher,
     else
         cout << endl << "Motion Model: Disabled (not recommended, change settings UseMotionModel: 1)" << endl << endl;
 
+    // Frames tracked from the motion model alone before giving up the map
+    mnCoastFrames = fSettings["Tracking.CoastFrames"];
+    mnCoastRetries = fSettings["Tracking.CoastRetries"];
+    if(mnCoastRetries<=0)
+        mnCoastRetries = 2;
+    mfCoastWindow = fSettings["Tracking.CoastWindow"];
+    if(mfCoastWindow<=0)
+        mfCoastWindow = 30;
+    mnCoastedFrames = 0;
+    if(mbMotionModel && mnCoastFrames>0)
+        cout << "- Coasting: " << mnCoastFrames << " frames" << endl << endl;
+
+    int nDirect = fSettings["Tracking.DirectAlignment"];
+    if(nDirect)
+    {
+        int nMaxLevel = fSettings["Tracking.DirectMaxLevel"];
+        if(nMaxLevel<=0)
+            nMaxLevel = 4;
+        int nMinLevel = fSettings["Tracking.DirectMinLevel"];
+        nMinLevel = max(nMinLevel,0);
+        int nIterations = fSettings["Tracking.DirectIterations"];
+        if(nIterations<=0)
+            nIterations = 10;
+        float fHuber = fSettings["Tracking.DirectHuber"];
+        if(fHuber<=0)
+            fHuber = 30;
+        mfDirectWindow = fSettings["Tracking.DirectWindow"];
+        if(mfDirectWindow<=0)
+            mfDirectWindow = 4;
+        mpImageAligner = new SparseImageAligner(nMaxLevel,nMinLevel,nIterations,fHuber);
+
+        cout << "Direct Alignment: Enabled" << endl;
+        cout << "- Levels: " << nMaxLevel << " - " << min(nMinLevel,nMaxLevel) << ", " << nIterations << " iterations" << endl;
+        cout << "- Search Window: " << mfDirectWindow << endl << endl;
+    }
+
+    int nQuality = fSettings["Tracking.QualityGate"];
+    if(nQuality)
+    {
+        int nWidth = fSettings["Tracking.QualityWidth"];
+        if(nWidth<=0)
+            nWidth = 160;
+        float fMinRatio = fSettings["Tracking.QualityMinRatio"];
+        if(fMinRatio<=0)
+            fMinRatio = 0.5;
+        float fMinBrightness = fSettings["Tracking.QualityMinBrightness"];
+        if(fMinBrightness<=0)
+            fMinBrightness = 20;
+        int nMaxSkipped = fSettings["Tracking.QualityMaxSkipped"];
+        if(nMaxSkipped<=0)
+            nMaxSkipped = 3;
+        mpImageQuality = new ImageQuality(nWidth,fMinRatio,fMinBrightness,nMaxSkipped);
+
+        cout << "Image Quality Gate: Enabled" << endl;
+        cout << "- Min Sharpness Ratio: " << fMinRatio << ", Min Brightness: " << fMinBrightness << endl;
+        cout << "- Max Skipped: " << nMaxSkipped << " frames" << endl << endl;
+    }
+
+    mstrImuTopic = (string)fSettings["Imu.Topic"];
+    if(!mstrImuTopic.empty())
+    {
+        // Camera from IMU, only its rotation is used
+        cv::Mat Tcb;
+        fSettings["Imu.Tcb"] >> Tcb;
+        Eigen::Matrix3d Rcb = Eigen::Matrix3d::Identity();
+        if(Tcb.rows==4 && Tcb.cols==4)
+        {
+            Tcb.convertTo(Tcb,CV_32F);
+            Rcb = Converter::toMatrix3d(Tcb.rowRange(0,3).colRange(0,3));
+        }
+        Eigen::Vector3d gyroBias((float)fSettings["Imu.GyroBiasX"],(float)fSettings["Imu.GyroBiasY"],(float)fSettings["Imu.GyroBiasZ"]);
+        float fMaxGap = fSettings["Imu.MaxGap"];
+        if(fMaxGap<=0)
+            fMaxGap = 0.02;
+        mfImuWindow = fSettings["Tracking.ImuWindow"];
+        if(mfImuWindow<=0)
+            mfImuWindow = 7;
+        mpImuIntegrator = new ImuIntegrator(Rcb,gyroBias,fMaxGap);
+
+        cout << "IMU Rotation Prior: Enabled" << endl;
+        cout << "- Topic: " << mstrImuTopic << endl;
+        cout << "- Gyroscope Bias: " << gyroBias.transpose() << endl;
+        cout << "- Search Window: " << mfImuWindow << endl << endl;
+    }
+
+    mfPredictionRate = fSettings["Prediction.Rate"];
+    if(mfPredictionRate>0)
+    {
+        float fMaxHorizon = fSettings["Prediction.MaxHorizon"];
+        if(fMaxHorizon<=0)
+            fMaxHorizon = 0.2f;
+        mpPosePredictor = new PosePredictor(fMaxHorizon,mpImuIntegrator);
+        mPredictedPosePub = mNH.advertise<geometry_msgs::PoseStamped>("ORB_SLAM/PredictedPose",10);
+
+        cout << "Pose Prediction: Enabled" << endl;
+        cout << "- Rate: " << mfPredictionRate << " Hz" << endl;
+        cout << "- Max Horizon: " << fMaxHorizon << " s" << (mpImuIntegrator ? ", gyroscope rotation" : "") << endl << endl;
+    }
+
+    mstrPositionPriorTopic = (string)fSettings["PositionPrior.Topic"];
+    if(!mstrPositionPriorTopic.empty())
+    {
+        float fMaxGap = fSettings["PositionPrior.MaxGap"];
+        if(fMaxGap<=0)
+            fMaxGap = 1;
+        mpPositionPrior = new PositionPrior(fMaxGap);
+
+        cout << "Position Prior: Enabled" << endl;
+        cout << "- Topic: " << mstrPositionPriorTopic << endl;
+        cout << "- Max Gap: " << fMaxGap << " s" << endl << endl;
+    }
+
+    int nFlow = fSettings["Tracking.Flow"];
+    if(nFlow)
+    {
+        int nFlowWindow = fSettings["Tracking.FlowWindow"];
+        if(nFlowWindow<=0)
+            nFlowWindow = 21;
+        int nFlowLevels = fSettings["Tracking.FlowLevels"];
+        if(nFlowLevels<=0)
+            nFlowLevels = 3;
+        float fFlowMaxError = fSettings["Tracking.FlowMaxError"];
+        if(fFlowMaxError<=0)
+            fFlowMaxError = 1.0f;
+        mnFlowMaxFrames = fSettings["Tracking.FlowMaxFrames"];
+        if(mnFlowMaxFrames<=0)
+            mnFlowMaxFrames = 3;
+        mfFlowMinRatio = fSettings["Tracking.FlowMinRatio"];
+        if(mfFlowMinRatio<=0)
+            mfFlowMinRatio = 0.7f;
+        mnFlowMinInliers = fSettings["Tracking.FlowMinInliers"];
+        if(mnFlowMinInliers<=0)
+            mnFlowMinInliers = 30;
+        mpFlowTracker = new FlowTracker(nFlowWindow,nFlowLevels,fFlowMaxError);
+
+        cout << "Optical Flow Tracking: Enabled" << endl;
+        cout << "- Max Flow Frames: " << mnFlowMaxFrames << endl;
+        cout << "- Min Inlier Ratio: " << mfFlowMinRatio << endl;
+        cout << "- Min Inliers: " << mnFlowMinInliers << endl;
+        cout << "- Window: " << nFlowWindow << ", levels: " << nFlowLevels << ", max error: " << fFlowMaxError << endl << endl;
+    }
+
+    mnDownscaleLevels = fSettings["Tracking.DownscaleLevels"];
+    if(mnDownscaleLevels>0)
+    {
+        mnDownscaleLevels = min(mnDownscaleLevels,mpORBextractor->GetLevels()-1);
+        cout << "Downscaled Tracking: Enabled" << endl;
+        cout << "- Scale: 1/" << pow((double)mpORBextractor->GetScaleFactor(),(double)mnDownscaleLevels) << " between keyframes" << endl << endl;
+    }
+
+    int nLocalizationOnly = fSettings["Tracking.LocalizationOnly"];
+    mbLocalizationOnly = nLocalizationOnly;
+    if(mbLocalizationOnly)
+        cout << "Localization Only: Enabled" << endl << endl;
+
+    // What keyframes keep of their image
+    int nImagePolicy = fSettings["KeyFrame.ImagePolicy"];
+    if(nImagePolicy<KeyFrame::IMAGE_KEEP || nImagePolicy>KeyFrame::IMAGE_JPEG)
+        nImagePolicy = KeyFrame::IMAGE_KEEP;
+    float fImageScale = fSettings["KeyFrame.ImageScale"];
+    int nImageQuality = fSettings["KeyFrame.ImageQuality"];
+    KeyFrame::SetImagePolicy(static_cast<KeyFrame::eImagePolicy>(nImagePolicy),fImageScale,nImageQuality);
+
+    // When the Levenberg iterations of every optimization stop early
+    LevenbergSettings levenberg;
+    double fMinDecrease = fSettings["Optimizer.MinDecrease"];
+    if(fMinDecrease>0)
+        levenberg.fMinDecrease = fMinDecrease;
+    int nStallIterations = fSettings["Optimizer.StallIterations"];
+    if(nStallIterations>0)
+        levenberg.nStallIterations = nStallIterations;
+    double fMinUpdate = fSettings["Optimizer.MinUpdate"];
+    levenberg.fMinUpdate = max(fMinUpdate,0.0);
+    int nStatistics = fSettings["Optimizer.Statistics"];
+    levenberg.bStatistics = nStatistics;
+    int nIterativeKeyFrames = fSettings["Optimizer.IterativeKeyFrames"];
+    levenberg.nIterativeKeyFrames = max(nIterativeKeyFrames,0);
+    int nSinglePrecision = fSettings["Optimizer.SinglePrecision"];
+    levenberg.bSinglePrecision = nSinglePrecision;
+    float fTileSize = fSettings["Optimizer.TileSize"];
+    levenberg.fTileSize = max(fTileSize,0.0f);
+    int nTiledKeyFrames = fSettings["Optimizer.TiledKeyFrames"];
+    levenberg.nTiledKeyFrames = max(nTiledKeyFrames,0);
+    Optimizer::SetLevenbergSettings(levenberg);
+
+    // RANSAC iterations of each model search of the monocular initialization
+    mnInitIterations = fSettings["Initializer.nIterations"];
+    if(mnInitIterations<=0)
+        mnInitIterations = 200;
+
+    // Incremental matching of the initialization
+    mfInitTrackWindow = fSettings["Initializer.TrackWindow"];
+    mnInitMaxLost = fSettings["Initializer.MaxLost"];
+    if(mnInitMaxLost<=0)
+        mnInitMaxLost = 5;
+    mnIniFrames = 0;
+    if(mfInitTrackWindow>0)
+    {
+        cout << "Incremental Initialization: Enabled" << endl;
+        cout << "- Track Window: " << mfInitTrackWindow << endl;
+        cout << "- Max Lost: " << mnInitMaxLost << endl;
+    }
+
+    // Threads used to verify the relocalisation candidates
+    mPnPVerifier.SetThreads(fSettings["Relocalization.nThreads"]);
+    mPnPVerifier.SetPriority(TaskPool::TRACKING);
+
+    // Seconds a forced relocalisation may hold the frame (0 - no limit)
+    mfRelocInlineBudget = fSettings["Relocalization.InlineBudget"];
+
+    // Frame queue between feature extraction and tracking (0 - disabled)
+    mnFrameQueueSize = fSettings["Tracking.FrameQueueSize"];
+    int nDropPolicy = fSettings["Tracking.FrameQueueDropPolicy"];
+    if(nDropPolicy==DROP_NEWEST || nDropPolicy==BLOCK)
+        mnDropPolicy = nDropPolicy;
+
+    if(mnFrameQueueSize>0)
+    {
+        cout << "Pipelined Tracking: Enabled" << endl;
+        cout << "- Frame Queue Size: " << mnFrameQueueSize << endl;
+        if(mnDropPolicy==DROP_OLDEST)
+            cout << "- Drop Policy: drop oldest" << endl << endl;
+        else if(mnDropPolicy==DROP_NEWEST)
+            cout << "- Drop Policy: drop newest" << endl << endl;
+        else
+            cout << "- Drop Policy: block" << endl << endl;
+    }
+
     fps_counter = pfps;
 
     tf::Transform tfT;
     tfT.setIdentity();
-    mTfBr.sendTransform(tf::StampedTransform(tfT,ros::Time::now(), "/ORB_SLAM/World", "/ORB_SLAM/Camera"));
+    mTfBr.sendTransform(tf::StampedTransform(tfT,ros::Time::now(), "/"+mstrWorldFrame, "/"+mstrCameraFrame));
 }
 
 void Tracking::Run()
 {
-    ros::NodeHandle nodeHandler;
-    ros::Subscriber sub = nodeHandler.subscribe("/camera/image_raw", 1, &Tracking::GrabImage, this);
+    Subscribe(mNH,false);
+
+    // As ros::spin on the image queue, but returns on RequestFinish
+    while(isRunning())
+        mImageQueue.callAvailable(ros::WallDuration(0.1));
+
+    Unsubscribe();
+}
+
+void Tracking::Subscribe(ros::NodeHandle &nh)
+{
+    Subscribe(nh,true);
+}
+
+void Tracking::Subscribe(ros::NodeHandle &nh, bool bImageSpinner)
+{
+    // Compressed transports are decoded by their plugin before GrabImage, raw images of a
+    // publisher in the same process are passed by pointer
+    ros::NodeHandle nhImages(nh);
+    nhImages.setCallbackQueue(&mImageQueue);
+    mpImageTransport.reset(new image_transport::ImageTransport(nhImages));
+    mImageSub = mpImageTransport->subscribe(mstrImageTopic, mnImageQueueSize, &Tracking::GrabImage, this,
+                                            image_transport::TransportHints(mstrImageTransport));
+
+    // The control callbacks only set requests under their own locks, they may run while a frame is tracked
+    ros::NodeHandle nhControl(nh);
+    nhControl.setCallbackQueue(&mControlQueue);
+    mLocalizationOnlySrv = nhControl.advertiseService("ORB_SLAM/LocalizationOnly", &Tracking::LocalizationOnlyService, this);
+    mReloadSettingsSrv = nhControl.advertiseService("ORB_SLAM/ReloadSettings", &Tracking::ReloadSettingsService, this);
+    mRoiSub = nhControl.subscribe("ORB_SLAM/Roi", 1, &Tracking::GrabRoi, this);
+
+    // The other cameras of the rig extract in their own threads
+    for(size_t i=0; i<mvpRigCameras.size(); i++)
+        mvpRigCameras[i]->Subscribe(*mpImageTransport, mstrImageTransport, mnImageQueueSize);
+
+    // The depth is raw, compressed depth needs its own plugin
+    if(!mstrDepthTopic.empty())
+        mDepthSub = mpImageTransport->subscribe(mstrDepthTopic, mnImageQueueSize, &Tracking::GrabDepth, this,
+                                                image_transport::TransportHints("raw"));
+
+    // The IMU is not spun by Run, its measurements would wait for the frame being tracked
+    if(mpImuIntegrator)
+    {
+        ros::NodeHandle nhImu(nh);
+        nhImu.setCallbackQueue(&mImuQueue);
+        mImuSub = nhImu.subscribe(mstrImuTopic, 1000, &Tracking::GrabImu, this, ros::TransportHints().tcpNoDelay());
+        mpImuSpinner.reset(new ros::AsyncSpinner(1, &mImuQueue));
+        mpImuSpinner->start();
+    }
+
+    if(mpPositionPrior)
+        mPositionPriorSub = nhControl.subscribe(mstrPositionPriorTopic, 100, &Tracking::GrabPositionPrior, this);
+
+    if(mpPosePredictor)
+        mPredictionTimer = nhControl.createTimer(ros::Duration(1.0/mfPredictionRate), &Tracking::PublishPrediction, this);
+
+    mpControlSpinner.reset(new ros::AsyncSpinner(1, &mControlQueue));
+    mpControlSpinner->start();
+    if(bImageSpinner)
+    {
+        mpImageSpinner.reset(new ros::AsyncSpinner(1, &mImageQueue));
+        mpImageSpinner->start();
+    }
+
+    // With a frame queue the callback only extracts features
+    // and the pose tracking runs in its own thread
+    if(mnFrameQueueSize>0 && mpTrackingStage==NULL)
+        mpTrackingStage = new boost::thread(&Tracking::RunTracking, this);
+}
+
+void Tracking::Unsubscribe()
+{
+    if(mpImageSpinner)
+    {
+        mpImageSpinner->stop();
+        mpImageSpinner.reset();
+    }
+    if(mpControlSpinner)
+    {
+        mpControlSpinner->stop();
+        mpControlSpinner.reset();
+    }
+
+    mImageSub.shutdown();
+    mDepthSub.shutdown();
+    mLocalizationOnlySrv.shutdown();
+    mReloadSettingsSrv.shutdown();
+    mRoiSub.shutdown();
+    mPositionPriorSub.shutdown();
+    mPredictionTimer.stop();
+    for(size_t i=0; i<mvpRigCameras.size(); i++)
+        mvpRigCameras[i]->Unsubscribe();
+    mpImageTransport.reset();
+    mImageQueue.clear();
+    mControlQueue.clear();
+
+    if(mpImuSpinner)
+    {
+        mpImuSpinner->stop();
+        mpImuSpinner.reset();
+    }
+    mImuSub.shutdown();
+
+    if(mpTrackingStage)
+    {
+        mCondFrameQueue.notify_all();
+        mpTrackingStage->join();
+        delete mpTrackingStage;
+        mpTrackingStage = NULL;
+    }
+}
+
+void Tracking::RunTracking()
+{
+    while(isRunning())
+    {
+        // Wait for the next extracted frame
+        Frame* pFrame = NextFrame();
+        if(pFrame == NULL)
+        {
+            Quiescent();
+            continue;
+        }
+
+        mCurrentFrame.swap(*pFrame);
+        delete pFrame;
 
-    ros::spin();
+        Track();
+        Quiescent();
+    }
+}
+
+void Tracking::AddFrame(Frame* pFrame)
+{
+    boost::mutex::scoped_lock lock(mMutexFrameQueue);
+
+    if((int)mlpFrameQueue.size()>=mnFrameQueueSize)
+    {
+        if(mnDropPolicy==DROP_NEWEST)
+        {
+            delete pFrame;
+            mnFramesDropped++;
+            Metrics::Global()->Add(Metrics::FRAMES_DROPPED);
+            return;
+        }
+        else if(mnDropPolicy==DROP_OLDEST)
+        {
+            delete mlpFrameQueue.front();
+            mlpFrameQueue.pop_front();
+            mnFramesDropped++;
+            Metrics::Global()->Add(Metrics::FRAMES_DROPPED);
+        }
+        else
+        {
+            // Block the callback until the tracking stage makes room
+            while((int)mlpFrameQueue.size()>=mnFrameQueueSize && isRunning())
+                mCondFrameQueue.timed_wait(lock, boost::posix_time::milliseconds(100));
+        }
+    }
+
+    mlpFrameQueue.push_back(pFrame);
+    mCondFrameQueue.notify_all();
+}
+
+int Tracking::FramesInQueue()
+{
+    boost::mutex::scoped_lock lock(mMutexFrameQueue);
+    return mlpFrameQueue.size();
+}
+
+bool Tracking::isPipelined()
+{
+    return mnFrameQueueSize>0;
+}
+
+void Tracking::SetSynchronous(bool bSynchronous)
+{
+    OrbThread::SetSynchronous(bSynchronous);
+    if(bSynchronous)
+    {
+        boost::mutex::scoped_lock lock(mMutexFrameQueue);
+        mnFrameQueueSize = 0;
+    }
+}
+
+cv::Mat Tracking::GetLastPose()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexLastPose);
+    return mLastPose.clone();
+}
+
+void Tracking::SetTrajectoryRecorder(TrajectoryRecorder* pRecorder)
+{
+    mpTrajectoryRecorder = pRecorder;
+}
+
+Frame* Tracking::NextFrame()
+{
+    boost::mutex::scoped_lock lock(mMutexFrameQueue);
+
+    // Timed so that shutdown is noticed
+    if(mlpFrameQueue.empty())
+        mCondFrameQueue.timed_wait(lock, boost::posix_time::milliseconds(100));
+
+    if(mlpFrameQueue.empty())
+        return NULL;
+
+    Frame* pFrame = mlpFrameQueue.front();
+    mlpFrameQueue.pop_front();
+    mCondFrameQueue.notify_all();
+    return pFrame;
 }
 
 void Tracking::GrabImage(const sensor_msgs::ImageConstPtr& msg)
 {
+    TRACE_SCOPE("Tracking::GrabImage");
+
+    // The subscriber queue drops the images we are too slow for, they show as gaps in the sequence
+    if(mbImageSeqValid && msg->header.seq>mnLastImageSeq+1)
+    {
+        mnFramesDropped += msg->header.seq-mnLastImageSeq-1;
+        Metrics::Global()->Add(Metrics::FRAMES_DROPPED,msg->header.seq-mnLastImageSeq-1);
+    }
+    mnLastImageSeq = msg->header.seq;
+    mbImageSeqValid = true;
 
     cv::Mat im;
+    boost::shared_ptr<const void> imageOwner;
 
     // Copy the ros image message to cv::Mat. Convert to grayscale if it is a color image.
     cv_bridge::CvImageConstPtr cv_ptr;
@@ -180,41 +870,257 @@ void Tracking::GrabImage(const sensor_msgs::ImageConstPtr& msg)
     }
     else if(cv_ptr->image.channels()==1)
     {
-        cv_ptr->image.copyTo(im);
+        // Zero copy: share the message buffer, the frames keep the message alive
+        // Keyframes and the frame publisher make their own copy if they need it
+        if(mbZeroCopyInput)
+        {
+            im = cv_ptr->image;
+            imageOwner = cv_ptr;
+        }
+        else
+            cv_ptr->image.copyTo(im);
     }
     
-    // If in the working state, use the main ORB extractor
-    if(mState==WORKING)
-        mCurrentFrame = Frame(im,cv_ptr->header.stamp.toSec(),mpORBextractor, mapDB->getVocab(),mK,mDistCoef);
+    GrabFrame(im,cv_ptr->header.stamp.toSec(),imageOwner);
+}
+
+void Tracking::GrabRoi(const sensor_msgs::RegionOfInterestConstPtr& msg)
+{
+    // A zero size is the whole image
+    const cv::Rect roi(msg->x_offset, msg->y_offset, msg->width, msg->height);
+    mpORBextractor->SetRoi(roi);
+    mpIniORBextractor->SetRoi(roi);
+}
+
+void Tracking::GrabDepth(const sensor_msgs::ImageConstPtr& msg)
+{
+    cv_bridge::CvImageConstPtr cv_ptr;
+    try
+    {
+        cv_ptr = cv_bridge::toCvShare(msg);
+    }
+    catch (cv_bridge::Exception& e)
+    {
+        ROS_ERROR("cv_bridge exception: %s", e.what());
+        return;
+    }
+
+    // Only needed to create a map, so it is converted when kept
+    cv::Mat depth;
+    if(cv_ptr->image.type()==CV_16UC1)
+        cv_ptr->image.convertTo(depth,CV_32F,1.0f/mfDepthFactor);
+    else if(cv_ptr->image.type()==CV_32FC1)
+        cv_ptr->image.copyTo(depth);
     else
-        mCurrentFrame = Frame(im,cv_ptr->header.stamp.toSec(),mpIniORBextractor, mapDB->getVocab(),mK,mDistCoef);
+    {
+        ROS_ERROR("ORB-SLAM - Unsupported depth encoding %s", msg->encoding.c_str());
+        return;
+    }
+
+    boost::mutex::scoped_lock lock(mMutexDepth);
+    mDepth = depth;
+    mDepthTimeStamp = msg->header.stamp.toSec();
+}
+
+void Tracking::TrackImage(const cv::Mat &image, const double &timeStamp)
+{
+    ROS_ASSERT(image.channels()==3 || image.channels()==1);
+
+    cv::Mat im;
+    if(image.channels()==3)
+    {
+        if(mbRGB)
+            cvtColor(image, im, CV_RGB2GRAY);
+        else
+            cvtColor(image, im, CV_BGR2GRAY);
+    }
+    else
+        im = image;
+
+    GrabFrame(im,timeStamp,boost::shared_ptr<const void>());
+}
+
+void Tracking::GrabFrame(cv::Mat &im, const double &timeStamp, const boost::shared_ptr<const void> &imageOwner)
+{
+    ros::WallTime tExtract = ros::WallTime::now();
+
+    mpCamera->SetImageSize(im.cols,im.rows);
+
+    // Blurred or dark images would only fail to track, a few in a row are skipped before extraction
+    float fSharpness = -1;
+    if(mpImageQuality && !mpImageQuality->Accept(im,fSharpness))
+    {
+        Metrics::Global()->Add(Metrics::FRAMES_REJECTED);
+        return;
+    }
+
+    // Under overload frames are skipped evenly, the synchronous benchmark tracks them all
+    const bool bKeep = mbKeepNextFrame.exchange(false);
+    if(mpLoadShedder && !isSynchronous() && mpLoadShedder->Shed(timeStamp,bKeep))
+    {
+        Metrics::Global()->Add(Metrics::FRAMES_SHED);
+        return;
+    }
+
+    // A parked camera only tracks a frame now and then, the last pose is published again meanwhile
+    if(mpStationaryDetector && !isSynchronous() && mpStationaryDetector->Skip(im,timeStamp,bKeep))
+    {
+        Metrics::Global()->Add(Metrics::FRAMES_STATIONARY);
+        const cv::Mat Tcw = GetLastPose();
+        if(!Tcw.empty())
+            PublishPose(Tcw);
+        return;
+    }
+
+    // Pipelined: extract here and let the tracking stage do the rest
+    // The extractor is chosen from the state of the last tracked frame
+    if(mnFrameQueueSize>0)
+    {
+        // The tracking stage replaces the tracking extractor under the same lock on a reload
+        ORBextractor* pExtractor;
+        {
+            boost::mutex::scoped_lock lock(mMutexFrameQueue);
+            pExtractor = (mbExtractWorking || !mstrDepthTopic.empty()) ? mpORBextractor : mpIniORBextractor;
+            mpORBextractor->SetFirstLevel(mbExtractWorking && mbDownscaleNext ? mnDownscaleLevels : 0);
+        }
+        Frame* pFrame;
+        {
+            ScopedTimer timer(LatencyStats::FRAME);
+            ALLOC_SCOPE(FRAME);
+            pFrame = new Frame(im,timeStamp,pExtractor, mapDB->getVocab(),mpCamera,imageOwner);
+        }
+        pFrame->mfSharpness = fSharpness;
+        {
+            boost::mutex::scoped_lock lock(mMutexFrameQueue);
+            mfExtractTime = (ros::WallTime::now()-tExtract).toSec();
+        }
+        AddFrame(pFrame);
+        return;
+    }
+
+    // If in the working state, use the main ORB extractor, as well as for maps created from depth
+    // Between keyframes the points of the last frame may be followed with optical flow instead
+    ORBextractor* pExtractor = (mState==WORKING || !mstrDepthTopic.empty()) ? mpORBextractor : mpIniORBextractor;
+    mpORBextractor->SetFirstLevel(mState==WORKING && mbDownscaleNext ? mnDownscaleLevels : 0);
+    mbFlowFrame = mbFlowNext && mState==WORKING;
+    {
+        ScopedTimer timer(LatencyStats::FRAME);
+        ALLOC_SCOPE(FRAME);
+        if(mbFlowFrame)
+        {
+            Frame frame(im,timeStamp,mLastFrame,mpFlowTracker,imageOwner);
+            mCurrentFrame.swap(frame);
+        }
+        else
+        {
+            Frame frame(im,timeStamp,pExtractor, mapDB->getVocab(),mpCamera,imageOwner);
+            mCurrentFrame.swap(frame);
+        }
+    }
+    mCurrentFrame.mfSharpness = fSharpness;
+    mfExtractTime = (ros::WallTime::now()-tExtract).toSec();
+
+    Track();
+    Quiescent();
+}
+
+void Tracking::PurgeBadPointers()
+{
+    mCurrentFrame.DiscardBadMapPoints();
+    mLastFrame.DiscardBadMapPoints();
+    for(size_t i=0; i<mvpRigFrames.size(); i++)
+        mvpRigFrames[i]->DiscardBadMapPoints();
+
+    // Culled points also left the match lists of their keyframes, the local map is gathered again on the next frame
+    size_t nGood = 0;
+    for(size_t i=0; i<mvpLocalMapPoints.size(); i++)
+        if(!mvpLocalMapPoints[i]->isBad())
+            mvpLocalMapPoints[nGood++] = mvpLocalMapPoints[i];
+    if(nGood<mvpLocalMapPoints.size())
+    {
+        mvpLocalMapPoints.resize(nGood);
+        mpLocalMapOwner = NULL;
+    }
+}
+
+void Tracking::GrabImu(const sensor_msgs::ImuConstPtr& msg)
+{
+    const Eigen::Vector3d gyro(msg->angular_velocity.x,msg->angular_velocity.y,msg->angular_velocity.z);
+    mpImuIntegrator->AddMeasurement(msg->header.stamp.toSec(),gyro);
+}
+
+void Tracking::GrabPositionPrior(const nav_msgs::OdometryConstPtr& msg)
+{
+    const geometry_msgs::Point &p = msg->pose.pose.position;
+    mpPositionPrior->AddPosition(msg->header.stamp.toSec(),cv::Point3f(p.x,p.y,p.z));
+}
+
+void Tracking::Track()
+{
+    TRACE_SCOPE("Tracking::Track");
+
+    if(!mbThreadConfigured)
+    {
+        mThreadConfig.Apply();
+        mbThreadConfigured = true;
+    }
+
+    ScopedTimer timer(LatencyStats::TRACK);
+    ALLOC_SCOPE(TRACK);
+    Metrics::Global()->Add(Metrics::FRAMES_TRACKED);
+
+    // Tagged before the frame is submitted to the relocalizer or becomes a keyframe
+    if(mpPositionPrior)
+        mCurrentFrame.mbPositionPrior = mpPositionPrior->GetPosition(mCurrentFrame.mTimeStamp,mCurrentFrame.mPositionPrior);
+
+    ros::WallTime tTrack = ros::WallTime::now();
+
+    // Decided again if this frame is tracked
+    mbFlowNext = false;
+    bool bDownscaleNext = false;
+
+    // Follow a mode change or settings reload requested since the last frame
+    ReloadSettings();
+    UpdateLocalizationOnly();
+    const bool bLocalizationOnly = mbMappingStopped;
 
     // If we need to relocalize, try to do so
     if(RelocalisationRequested())
     {        
-        // Add a new frame if we are accepting new frames
-        if(mpRelocalizer->isAcceptingFrames())
-            mpRelocalizer->AddFrame(new Frame(mCurrentFrame));
+        // Submit every frame, the relocalizer keeps the sharpest recent one and never makes us wait
+        mpRelocalizer->Submit(mCurrentFrame);
 
         // Check if we have had a successfull relocalization
         if(mpRelocalizer->relocalizeIfSuccessfull())
         {
             // Update working state
             mState = WORKING;
-            // Reset other threads
-            mpLocalMapper->RequestReset();
-            mpLoopCloser->RequestReset();
-            mpMapMerger->RequestReset();
-            // Ensure that our other threads are started
-            mpLocalMapper->Release();
-            mpLoopCloser->Release();
-            mpMapMerger->Release();
+            mnCoastedFrames = 0;
+            // Switch the other threads to the new map, the work queued for the previous one is finished there
+            mpLocalMapper->RequestMapSwitch();
+            mpLoopCloser->RequestMapSwitch();
+            mpMapMerger->RequestMapSwitch();
+            // Ensure that our other threads are started, unless the maps are frozen
+            if(!bLocalizationOnly)
+            {
+                mpLocalMapper->Release();
+                mpLoopCloser->Release();
+                mpMapMerger->Release();
+            }
             // Stop relocalizing
             mpRelocalizer->RequestStop();
             publishersRequest(false);
         }
     }
     
+    // Count the transitions since the last frame, leaving WORKING means tracking was lost
+    if(mState!=mLastProcessedState)
+    {
+        Metrics::Global()->Add(Metrics::TRACKING_STATE_CHANGES);
+        if(mLastProcessedState==WORKING)
+            Metrics::Global()->Add(Metrics::TRACKING_LOST);
+    }
+
     // Let the frame publisher know what state we are in
     mLastProcessedState=mState;
 
@@ -224,10 +1130,16 @@ void Tracking::GrabImage(const sensor_msgs::ImageConstPtr& msg)
     {
         mState = NOT_INITIALIZED;
     }
-    // Create a new map if needed
+    // Create a new map if needed, with frozen maps only the relocalizer can get us working again
     if(mState==NOT_INITIALIZED)
     {
-        FirstInitialization();
+        if(!bLocalizationOnly)
+        {
+            if(!mstrDepthTopic.empty())
+                InitializeFromDepth();
+            else
+                FirstInitialization();
+        }
     }
     // Try to inialized the map
     else if(mState==INITIALIZING)
@@ -247,9 +1159,34 @@ void Tracking::GrabImage(const sensor_msgs::ImageConstPtr& msg)
             return;
         }
 
+        // Coasting after a failure, the motion model predicts from the last tracked frame
+        // Tracking can lose the map for a few frames (occlusion, blur) without starting a new one
+        const bool bCoast = mbMotionModel && mnCoastFrames>0 && !mVelocity.empty() && !mLastFrame.mTcw.empty();
+
+        // Frame of optical flow, the pose from its points is all it gives
+        bool bFlowTracked = false;
+        if(mbFlowFrame)
+        {
+            bFlowTracked = TrackFlow();
+            if(!bFlowTracked)
+                ExtractFlowFrame();
+        }
+
         // Initial Camera Pose Estimation from Previous Frame (Motion Model or Coarse)
         // If we are not using the motion model, have less then 4 key frames in the map, have an empty velocity vector, or have just had a relocalisation in the past two frames.
-        if(!mbMotionModel || mapDB->getCurrent()->KeyFramesInMap()<4 || mVelocity.empty() || mCurrentFrame.mnId<mnLastRelocFrameId+2)
+        if(bFlowTracked)
+        {
+            bOK = true;
+        }
+        else if(mnCoastedFrames>0 && bCoast)
+        {
+            bOK = TrackCoasting();
+        }
+        else if(mpImageAligner && TrackWithDirectAlignment())
+        {
+            bOK = true;
+        }
+        else if(!mbMotionModel || mapDB->getCurrent()->KeyFramesInMap()<4 || mVelocity.empty() || mCurrentFrame.mnId<mnLastRelocFrameId+2)
         {
             bOK = TrackPreviousFrame();
         }
@@ -262,10 +1199,15 @@ void Tracking::GrabImage(const sensor_msgs::ImageConstPtr& msg)
             {
                 bOK = TrackPreviousFrame();
             }
+            // And then on wider windows
+            if(!bOK && bCoast)
+            {
+                bOK = TrackCoasting();
+            }
         }
 
         // If we have an initial estimation of the camera pose and matching. Track the local map.
-        if(bOK)
+        if(bOK && !bFlowTracked)
         {
             bOK = TrackLocalMap();
         }
@@ -273,9 +1215,22 @@ void Tracking::GrabImage(const sensor_msgs::ImageConstPtr& msg)
         // If tracking were good, check if we insert a keyframe
         if(bOK)
         {
+#ifndef ORB_SLAM_HEADLESS
             mpMapPublisher->SetCurrentCameraPose(mCurrentFrame.mTcw);
-            if(NeedNewKeyFrame())
-                CreateNewKeyFrame();
+#endif
+            bool bKeyFrameDeferred = false;
+            if(!bLocalizationOnly && !bFlowTracked && NeedNewKeyFrame())
+            {
+                // The finest levels of a downscaled frame are missing, the next frame is extracted in full for it
+                if(mCurrentFrame.mnFirstLevel>0)
+                    bKeyFrameDeferred = true;
+                else
+                {
+                    CreateNewKeyFrame();
+                    mbKeepNextFrame = true;
+                }
+            }
+            bDownscaleNext = mnDownscaleLevels>0 && !bKeyFrameDeferred && !KeyFrameLikely();
 
             // We allow points with high innovation (considererd outliers by the Huber Function)
             // pass to the new keyframe, so that bundle adjustment will finally decide
@@ -288,14 +1243,30 @@ void Tracking::GrabImage(const sensor_msgs::ImageConstPtr& msg)
             }
         }
 
+        // Frames coasted before this one, the velocity spans a single frame
+        const int nCoastedFrames = mnCoastedFrames;
+
         // If we have  successfully tracked, we are working
         if(bOK)
+        {
             mState = WORKING;
+            mnCoastedFrames = 0;
+        }
+        // Within the grace period, keep the map and the last tracked frame and predict again on the next frame
+        else if(bCoast && mnCoastedFrames<mnCoastFrames)
+        {
+            ClearRigFrames();
+            mnCoastedFrames++;
+            // Not tracked, no pose is published for this frame
+            mCurrentFrame.mTcw = cv::Mat();
+        }
         // If we have unsuccessfully tracked, we are lost
         // Next time we should try to do relocalisation, or re init
         else
         {
             ROS_INFO("ORB-SLAM - Lost tracking, forcing relocalisation and initialization.");
+            ClearRigFrames();
+            mnCoastedFrames = 0;
             // Set lost state
             mState = NOT_INITIALIZED;
             // Force relocalisation
@@ -305,7 +1276,7 @@ void Tracking::GrabImage(const sensor_msgs::ImageConstPtr& msg)
         // Reset if the camera get lost soon after initialization
         if(mState==NOT_INITIALIZED)
         {
-            if(mapDB->getCurrent()->KeyFramesInMap()<=5)
+            if(!bLocalizationOnly && mapDB->getCurrent()->KeyFramesInMap()<=5)
             {
                 ROS_INFO("ORB-SLAM - Erasing map, too few keyframes.");
                 Reset();
@@ -314,12 +1285,14 @@ void Tracking::GrabImage(const sensor_msgs::ImageConstPtr& msg)
             mpLocalMapper->RequestStop();
             mpLoopCloser->RequestStop();
             mpMapMerger->RequestStop();
-            // Start the relocalizer
+            // Start the relocalizer, around where we were first
+            mpRelocalizer->SetLocalHint(mpReferenceKF);
             mpRelocalizer->Release();
         }
 
-        // Update motion model
-        if(mbMotionModel)
+        // Update motion model, the velocity is kept while coasting and when tracking recovers from it
+        const bool bKeepVelocity = mnCoastedFrames>0 || (bOK && nCoastedFrames>0);
+        if(mbMotionModel && !bKeepVelocity)
         {
             if(bOK && !mLastFrame.mTcw.empty())
             {
@@ -334,6 +1307,7 @@ void Tracking::GrabImage(const sensor_msgs::ImageConstPtr& msg)
                 mVelocity = cv::Mat();
         }
 
+        mbFlowNext = bOK && FlowNextFrame(bFlowTracked);
      }
      // Else unknown state
      else {
@@ -352,14 +1326,61 @@ void Tracking::GrabImage(const sensor_msgs::ImageConstPtr& msg)
     // Publish our topics
     PublishTopics();
     
-    // Update our two frame queue with the now "old" frame
-    mLastFrame = Frame(mCurrentFrame);
-    
+#ifndef ORB_SLAM_HEADLESS
     // Update drawer
     mpFramePublisher->Update(this);
+#endif
+
+    // Adapt the feature budget to the time spent on this frame
+    const float trackTime = (ros::WallTime::now()-tTrack).toSec();
+    if(mpFeatureBudget && !isSynchronous() && !mbFlowFrame)
+        UpdateFeatureBudget(trackTime);
+
+    // Only frames tracked without moving keep the camera stationary
+    if(mpStationaryDetector)
+        mpStationaryDetector->Update(mState==WORKING && isStill());
+
+    // And the share of frames tracked, flow frames included as they lower the average cost
+    if(mpLoadShedder)
+        mpLoadShedder->Update(FrameTime(trackTime));
+    if((mpLoadShedder || mpStationaryDetector) && mState!=WORKING)
+        mbKeepNextFrame = true;
+
+    // Update our two frame queue with the now "old" frame
+    // The current frame is not used until the next one replaces it, so hand it on
+    // While coasting the last frame stays the last tracked one
+    if(mnCoastedFrames==0)
+        mLastFrame.swap(mCurrentFrame);
+
+    // The gyroscope is integrated from the last frame on
+    if(mpImuIntegrator)
+        mpImuIntegrator->Discard(mLastFrame.mTimeStamp);
 
+    // Tell the extraction stage which extractor the next frames need, and at which resolution
+    {
+        boost::mutex::scoped_lock lock(mMutexFrameQueue);
+        mbExtractWorking = (mState==WORKING);
+        mbDownscaleNext = bDownscaleNext;
+    }
+}
+
+
+float Tracking::FrameTime(float trackTime)
+{
+    // Pipelined, the stages overlap and the slowest one sets the rate
+    boost::mutex::scoped_lock lock(mMutexFrameQueue);
+    return (mnFrameQueueSize>0) ? max(mfExtractTime,trackTime) : mfExtractTime+trackTime;
 }
 
+void Tracking::UpdateFeatureBudget(float trackTime)
+{
+    // Only frames extracted and tracked by the tracking extractor say something about its budget
+    if(mState!=WORKING || mLastProcessedState!=WORKING)
+        return;
+
+    if(mpFeatureBudget->Update(FrameTime(trackTime),mCurrentFrame.N,mnMatchesInliers,mpLocalMapper->KeyframesInQueue()))
+        mpORBextractor->SetParameters(mpFeatureBudget->GetFeatures(),mpFeatureBudget->GetFastThreshold());
+}
 
 void Tracking::FirstInitialization()
 {
@@ -372,10 +1393,14 @@ void Tracking::FirstInitialization()
         for(size_t i=0; i<mCurrentFrame.mvKeysUn.size(); i++)
             mvbPrevMatched[i]=mCurrentFrame.mvKeysUn[i].pt;
 
+        // Nothing matched yet, the first search is wide for all the features
+        mvnIniLost.assign(mCurrentFrame.mvKeysUn.size(),1);
+        mnIniFrames = 0;
+
         if(mpInitializer != NULL)
             delete mpInitializer;
 
-        mpInitializer =  new Initializer(mCurrentFrame,1.0,200);
+        mpInitializer =  new Initializer(mCurrentFrame,1.0,mnInitIterations);
 
         mState = INITIALIZING;
     }
@@ -393,7 +1418,17 @@ void Tracking::Initialize()
 
     // Find correspondences
     ORBmatcher matcher(0.9,true);
-    int nmatches = matcher.SearchForInitialization(mInitialFrame,mCurrentFrame,mvbPrevMatched,mvIniMatches,100);
+    int nmatches;
+    if(mfInitTrackWindow>0)
+    {
+        InitializationWindows();
+        nmatches = matcher.SearchForInitialization(mInitialFrame,mCurrentFrame,mvbPrevMatched,mvIniMatches,mvIniWindowSizes);
+        for(size_t i=0, iend=mvIniMatches.size(); i<iend; i++)
+            mvnIniLost[i] = (mvIniMatches[i]>=0) ? 0 : mvnIniLost[i]+1;
+        mnIniFrames++;
+    }
+    else
+        nmatches = matcher.SearchForInitialization(mInitialFrame,mCurrentFrame,mvbPrevMatched,mvIniMatches,100);
 
     // Check if there are enough correspondences
     if(nmatches<100)
@@ -406,7 +1441,13 @@ void Tracking::Initialize()
     cv::Mat tcw; // Current Camera Translation
     vector<bool> vbTriangulated; // Triangulated Correspondences (mvIniMatches)
 
-    if(mpInitializer->Initialize(mCurrentFrame, mvIniMatches, Rcw, tcw, mvIniP3D, vbTriangulated))
+    const bool bInitialized = mpInitializer->Initialize(mCurrentFrame, mvIniMatches, Rcw, tcw, mvIniP3D, vbTriangulated);
+
+    ROS_DEBUG("ORB-SLAM - Initialization attempt: %d iterations, homography %.1f ms, fundamental %.1f ms, total %.1f ms",
+              mpInitializer->GetIterations(), 1000*mpInitializer->GetTimeHomography(),
+              1000*mpInitializer->GetTimeFundamental(), 1000*mpInitializer->GetTimeTotal());
+
+    if(bInitialized)
     {
         for(size_t i=0, iend=mvIniMatches.size(); i<iend;i++)
         {
@@ -422,13 +1463,31 @@ void Tracking::Initialize()
 
 }
 
+void Tracking::InitializationWindows()
+{
+    const int wideWindow = 100;
+
+    mvIniWindowSizes.resize(mvnIniLost.size());
+    for(size_t i=0, iend=mvnIniLost.size(); i<iend; i++)
+    {
+        if(mvnIniLost[i]==0)
+            mvIniWindowSizes[i] = mfInitTrackWindow;
+        else if(mvnIniLost[i]<=mnInitMaxLost || (mnIniFrames+i)%mnInitMaxLost==0)
+            mvIniWindowSizes[i] = wideWindow;
+        else
+            mvIniWindowSizes[i] = 0;
+    }
+}
+
 void Tracking::CreateInitialMap(cv::Mat &Rcw, cv::Mat &tcw)
 {
     // Create new map in database
     if(localMap != NULL)
         delete localMap;
     localMap = mapDB->getNewMap();
-    
+
+    // The keyframes are converted to BoW, with a vocabulary loaded in the background it may still be loading
+    mapDB->waitForVocab();
     
     // Set Frame Poses
     mInitialFrame.mTcw = cv::Mat::eye(4,4,CV_32F);
@@ -525,7 +1584,9 @@ void Tracking::CreateInitialMap(cv::Mat &Rcw, cv::Mat &tcw)
     mpReferenceKF = pKFcur;
 
     localMap->SetReferenceMapPoints(mvpLocalMapPoints);
+#ifndef ORB_SLAM_HEADLESS
     mpMapPublisher->SetCurrentCameraPose(pKFcur->GetPose());
+#endif
 
     // Add to db
     mapDB->addMap(localMap);
@@ -548,9 +1609,106 @@ void Tracking::CreateInitialMap(cv::Mat &Rcw, cv::Mat &tcw)
 
 }
 
+void Tracking::InitializeFromDepth()
+{
+    // The depth image taken with the frame, if it did not come yet the next frame tries again
+    cv::Mat depth;
+    {
+        boost::mutex::scoped_lock lock(mMutexDepth);
+        if(!mDepth.empty() && fabs(mDepthTimeStamp-mCurrentFrame.mTimeStamp)<=mfDepthMaxDelay)
+            depth = mDepth;
+    }
+    if(depth.empty())
+        return;
+
+    if(mCurrentFrame.AssignDepth(depth)<mnDepthMinPoints)
+        return;
+
+    CreateInitialMapFromDepth();
+}
+
+void Tracking::CreateInitialMapFromDepth()
+{
+    // Create new map in database
+    if(localMap != NULL)
+        delete localMap;
+    localMap = mapDB->getNewMap();
+
+    // The keyframe is converted to BoW, with a vocabulary loaded in the background it may still be loading
+    mapDB->waitForVocab();
+
+    // The frame is the origin, the depth gives the scale of the map
+    mCurrentFrame.mTcw = cv::Mat::eye(4,4,CV_32F);
+
+    KeyFrame* pKFini = new KeyFrame(mCurrentFrame,localMap,localMap->GetKeyFrameDatabase());
+    pKFini->ComputeBoW();
+    localMap->AddKeyFrame(pKFini);
+
+    // Create MapPoints from the undistorted keypoints with depth
+    const float invfx = 1.0f/mCurrentFrame.fx;
+    const float invfy = 1.0f/mCurrentFrame.fy;
+    for(int i=0; i<mCurrentFrame.N; i++)
+    {
+        const float z = mCurrentFrame.mvDepth[i];
+        if(z<=0)
+            continue;
+
+        const cv::Point2f &pt = mCurrentFrame.mvKeysUn[i].pt;
+        cv::Mat worldPos = (cv::Mat_<float>(3,1) << (pt.x-mCurrentFrame.cx)*z*invfx, (pt.y-mCurrentFrame.cy)*z*invfy, z);
+
+        MapPoint* pMP = new MapPoint(worldPos,pKFini,localMap);
+
+        pKFini->AddMapPoint(pMP,i);
+        pMP->AddObservation(pKFini,i);
+
+        pMP->ComputeDistinctiveDescriptors();
+        pMP->UpdateNormalAndDepth();
+
+        mCurrentFrame.mvpMapPoints[i] = pMP;
+        localMap->AddMapPoint(pMP);
+    }
+
+    pKFini->UpdateConnections();
+
+    ROS_INFO("ORB-SLAM - New Map created from depth with %d points", localMap->MapPointsInMap());
+
+    // If we were trying to relocalize, we are on a new map, let the map closer handle it
+    ResetRelocalisationRequested();
+
+    mnLastKeyFrameId=mCurrentFrame.mnId;
+    mpLastKeyFrame = pKFini;
+
+    mvpLocalKeyFrames.push_back(pKFini);
+    mvpLocalMapPoints=localMap->GetAllMapPoints();
+    mpReferenceKF = pKFini;
+
+    localMap->SetReferenceMapPoints(mvpLocalMapPoints);
+#ifndef ORB_SLAM_HEADLESS
+    mpMapPublisher->SetCurrentCameraPose(pKFini->GetPose());
+#endif
+
+    // Add to db
+    mapDB->addMap(localMap);
+
+    // Remove old map
+    localMap = NULL;
+    mState = WORKING;
+
+    // Ensure that our other threads are started
+    mpLocalMapper->Release();
+    mpLoopCloser->Release();
+    mpMapMerger->Release();
+
+    // We have a map, we don't need to relocalize
+    mpRelocalizer->RequestStop();
+
+    mpLocalMapper->InsertKeyFrame(pKFini);
+}
 
 bool Tracking::TrackPreviousFrame()
 {
+    ScopedTimer timer(LatencyStats::TRACK_PREVIOUS_FRAME);
+
     ORBmatcher matcher(0.9,true);
     vector<MapPoint*> vpMapPointMatches;
 
@@ -580,7 +1738,7 @@ bool Tracking::TrackPreviousFrame()
     if(nmatches>=10)
     {
         // Optimize pose with correspondences
-        Optimizer::PoseOptimization(&mCurrentFrame);
+        mPoseSolver.Optimize(&mCurrentFrame);
         for(size_t i =0; i<mCurrentFrame.mvbOutlier.size(); i++)
             if(mCurrentFrame.mvbOutlier[i])
             {
@@ -601,7 +1759,7 @@ bool Tracking::TrackPreviousFrame()
     if(nmatches<10)
         return false;
     // Optimize pose again with all correspondences
-    Optimizer::PoseOptimization(&mCurrentFrame);
+    mPoseSolver.Optimize(&mCurrentFrame);
 
     // Discard outliers
     for(size_t i =0; i<mCurrentFrame.mvbOutlier.size(); i++)
@@ -612,81 +1770,364 @@ bool Tracking::TrackPreviousFrame()
             nmatches--;
         }
 
-    return nmatches>=10;
-}
+    return nmatches>=10;
+}
+
+bool Tracking::TrackWithMotionModel()
+{
+    ScopedTimer timer(LatencyStats::TRACK_MOTION_MODEL);
+
+    ORBmatcher matcher(0.9,true);
+    vector<MapPoint*> vpMapPointMatches;
+
+    // Compute current pose by motion model, the measured rotation narrows the search
+    const bool bImu = PredictPose(mCurrentFrame.mTcw);
+
+    fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+
+    // Project points seen in previous frame
+    int nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,bImu ? mfImuWindow : 15);
+
+    if(nmatches<20)
+       return false;
+
+    // Optimize pose with all correspondences
+    mPoseSolver.Optimize(&mCurrentFrame);
+
+    // Discard outliers
+    for(size_t i =0; i<mCurrentFrame.mvpMapPoints.size(); i++)
+    {
+        if(mCurrentFrame.mvpMapPoints[i])
+        {
+            if(mCurrentFrame.mvbOutlier[i])
+            {
+                mCurrentFrame.mvpMapPoints[i]=NULL;
+                mCurrentFrame.mvbOutlier[i]=false;
+                nmatches--;
+            }
+        }
+    }
+
+    return nmatches>=10;
+}
+
+bool Tracking::PredictPose(cv::Mat &Tcw)
+{
+    // Motion of the camera from the last frame, none without a motion model
+    cv::Mat Tcl = (mbMotionModel && !mVelocity.empty()) ? mVelocity.clone() : cv::Mat::eye(4,4,CV_32F);
+
+    Eigen::Matrix3d Rcl;
+    const bool bImu = mpImuIntegrator && mpImuIntegrator->PredictRotation(mLastFrame.mTimeStamp,mCurrentFrame.mTimeStamp,Rcl);
+    if(bImu)
+        Converter::toCvMat(Rcl).copyTo(Tcl.rowRange(0,3).colRange(0,3));
+
+    Tcw = Tcl*mLastFrame.mTcw;
+    return bImu;
+}
+
+bool Tracking::TrackWithDirectAlignment()
+{
+    ScopedTimer timer(LatencyStats::TRACK_DIRECT_ALIGNMENT);
+
+    if(mLastFrame.mTcw.empty())
+        return false;
+
+    cv::Mat Tcw;
+    PredictPose(Tcw);
+    if(!mpImageAligner->Align(mLastFrame,mCurrentFrame,Tcw))
+        return false;
+
+    ORBmatcher matcher(0.9,true);
+    mCurrentFrame.mTcw = Tcw;
+    fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+
+    // The alignment leaves the projections within a few pixels
+    int nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,mfDirectWindow);
+    if(nmatches<20)
+        return false;
+
+    mPoseSolver.Optimize(&mCurrentFrame);
+
+    // Discard outliers
+    for(size_t i =0; i<mCurrentFrame.mvpMapPoints.size(); i++)
+    {
+        if(mCurrentFrame.mvpMapPoints[i] && mCurrentFrame.mvbOutlier[i])
+        {
+            mCurrentFrame.mvpMapPoints[i]=NULL;
+            mCurrentFrame.mvbOutlier[i]=false;
+            nmatches--;
+        }
+    }
+
+    return nmatches>=10;
+}
+
+bool Tracking::TrackCoasting()
+{
+    ScopedTimer timer(LatencyStats::TRACK_MOTION_MODEL);
+
+    ORBmatcher matcher(0.9,true);
+
+    // Constant velocity over the frames lost since the last tracked one
+    cv::Mat Tcw = mVelocity*mLastFrame.mTcw;
+    for(int i=0; i<mnCoastedFrames; i++)
+        Tcw = mVelocity*Tcw;
+
+    // The prediction drifts with each lost frame, each retry widens the window
+    for(int r=0; r<mnCoastRetries; r++)
+    {
+        Tcw.copyTo(mCurrentFrame.mTcw);
+        fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+
+        int nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,mfCoastWindow*(1<<r));
+        if(nmatches<20)
+            continue;
+
+        mPoseSolver.Optimize(&mCurrentFrame);
+
+        for(size_t i =0; i<mCurrentFrame.mvpMapPoints.size(); i++)
+        {
+            if(mCurrentFrame.mvpMapPoints[i] && mCurrentFrame.mvbOutlier[i])
+            {
+                mCurrentFrame.mvpMapPoints[i]=NULL;
+                mCurrentFrame.mvbOutlier[i]=false;
+                nmatches--;
+            }
+        }
+
+        if(nmatches>=10)
+            return true;
+    }
+
+    return false;
+}
+
+bool Tracking::TrackFlow()
+{
+    ScopedTimer timer(LatencyStats::TRACK_FLOW);
+
+    // The frames of the other cameras are only searched with the local map
+    ClearRigFrames();
+
+    if(mCurrentFrame.N<mnFlowMinInliers)
+        return false;
+
+    // The tracked points come with their map points, the pose is optimized from the prediction
+    if(mbMotionModel && !mVelocity.empty())
+        mCurrentFrame.mTcw = mVelocity*mLastFrame.mTcw;
+    else
+        mLastFrame.mTcw.copyTo(mCurrentFrame.mTcw);
+
+    {
+        ScopedTimer timerOptimization(LatencyStats::POSE_OPTIMIZATION);
+        mPoseSolver.Optimize(&mCurrentFrame);
+    }
+
+    // Discard outliers
+    mnMatchesInliers = 0;
+    for(int i=0; i<mCurrentFrame.N; i++)
+    {
+        if(!mCurrentFrame.mvpMapPoints[i])
+            continue;
+        if(mCurrentFrame.mvbOutlier[i])
+        {
+            mCurrentFrame.mvpMapPoints[i]=NULL;
+            mCurrentFrame.mvbOutlier[i]=false;
+        }
+        else
+            mnMatchesInliers++;
+    }
+
+    return mnMatchesInliers>=mnFlowMinInliers;
+}
+
+void Tracking::ExtractFlowFrame()
+{
+    // Keeps the id the frame was given
+    const long unsigned int nId = mCurrentFrame.mnId;
+    cv::Mat im = mCurrentFrame.im;
+    {
+        ScopedTimer timer(LatencyStats::FRAME);
+        ALLOC_SCOPE(FRAME);
+        mpORBextractor->SetFirstLevel(mbDownscaleNext ? mnDownscaleLevels : 0);
+        Frame frame(im,mCurrentFrame.mTimeStamp,mpORBextractor,mapDB->getVocab(),mpCamera,mCurrentFrame.mpImageOwner);
+        mCurrentFrame.swap(frame);
+    }
+    mCurrentFrame.mnId = nId;
+    mbFlowFrame = false;
+}
+
+bool Tracking::FlowNextFrame(bool bFlowTracked)
+{
+    if(mpFlowTracker==NULL || mnFrameQueueSize>0 || mnCoastedFrames>0)
+        return false;
+
+    // Counted from the last extracted frame
+    if(bFlowTracked)
+        mnFlowFrames++;
+    else
+    {
+        mnFlowFrames = 0;
+        mnFlowStartInliers = mnMatchesInliers;
+    }
+
+    // Cadence of the extracted frames
+    if(mnFlowFrames>=mnFlowMaxFrames)
+        return false;
 
-bool Tracking::TrackWithMotionModel()
-{
+    // Quality of the flow, the inliers left of those of the last extracted frame
+    if(mnMatchesInliers<mfFlowMinRatio*mnFlowStartInliers)
+        return false;
 
-    ORBmatcher matcher(0.9,true);
-    vector<MapPoint*> vpMapPointMatches;
+    // Right after a relocalisation the frames are tracked with the local map
+    if(mCurrentFrame.mnId<mnLastRelocFrameId+2 || mpReferenceKF==NULL)
+        return false;
 
-    // Compute current pose by motion model
-    mCurrentFrame.mTcw = mVelocity*mLastFrame.mTcw;
+    // A keyframe needs the extracted features
+    return !KeyFrameLikely();
+}
 
-    fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+bool Tracking::isStill()
+{
+    if(mnCoastedFrames>0 || mCurrentFrame.mTcw.empty() || mLastFrame.mTcw.empty() || !mpReferenceKF)
+        return false;
 
-    // Project points seen in previous frame
-    int nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,15);
+    // Motion since the last frame, Tcl = Tcw*Tlw^-1
+    const cv::Mat Rcw = mCurrentFrame.mTcw.rowRange(0,3).colRange(0,3);
+    const cv::Mat Rlw = mLastFrame.mTcw.rowRange(0,3).colRange(0,3);
+    const cv::Mat Rcl = Rcw*Rlw.t();
+    const cv::Mat tcl = mCurrentFrame.mTcw.rowRange(0,3).col(3)-Rcl*mLastFrame.mTcw.rowRange(0,3).col(3);
 
-    if(nmatches<20)
-       return false;
+    // A rotation moves the image by about its angle times the focal length
+    const float cosAngle = max(-1.0f,min(1.0f,(float)(cv::trace(Rcl)[0]-1)*0.5f));
+    if(acos(cosAngle)*mCurrentFrame.fx>mfStationaryMaxMotion)
+        return false;
 
-    // Optimize pose with all correspondences
-    Optimizer::PoseOptimization(&mCurrentFrame);
+    // A translation by its parallax at the median depth of the scene
+    const float depth = mpReferenceKF->ComputeSceneMedianDepth();
+    return depth>0 && cv::norm(tcl)*mCurrentFrame.fx/depth<=mfStationaryMaxMotion;
+}
 
-    // Discard outliers
-    for(size_t i =0; i<mCurrentFrame.mvpMapPoints.size(); i++)
-    {
-        if(mCurrentFrame.mvpMapPoints[i])
-        {
-            if(mCurrentFrame.mvbOutlier[i])
-            {
-                mCurrentFrame.mvpMapPoints[i]=NULL;
-                mCurrentFrame.mvbOutlier[i]=false;
-                nmatches--;
-            }
-        }
-    }
+bool Tracking::KeyFrameLikely()
+{
+    if(mpReferenceKF==NULL)
+        return true;
 
-    return nmatches>=10;
+    const long unsigned int nNextId = mCurrentFrame.mnId+1;
+    if(nNextId>=mnLastKeyFrameId+mMaxFrames)
+        return true;
+
+    // The inliers of a downscaled frame are compared with the points it could match
+    return nNextId>=mnLastKeyFrameId+mMinFrames && mpLocalMapper->AcceptKeyFrames() &&
+           mnMatchesInliers<mpReferenceKF->TrackedMapPoints(mCurrentFrame.mnFirstLevel)*0.9;
 }
 
 bool Tracking::TrackLocalMap()
 {
+    ScopedTimer timer(LatencyStats::TRACK_LOCAL_MAP);
+    ALLOC_SCOPE(TRACK_LOCAL_MAP);
+
     // Tracking from previous frame or relocalisation was successful and we have an estimation
     // of the camera pose and some map points tracked in the frame.
     // Update Local Map and Track
     UpdateReference();
 
     // Search Local MapPoints
-    SearchReferencePointsInFrustum();
+    {
+        ScopedTimer timerSearch(LatencyStats::SEARCH_LOCAL_POINTS);
+        SearchReferencePointsInFrustum();
+        SearchRigFrames();
+    }
 
-    // Optimize Pose
-    mnMatchesInliers = Optimizer::PoseOptimization(&mCurrentFrame);
+    // Optimize Pose, of the whole rig if the other cameras have frames
+    {
+        ScopedTimer timerOptimization(LatencyStats::POSE_OPTIMIZATION);
+        mPoseSolver.Optimize(&mCurrentFrame,mvpRigFrames);
+    }
 
     // Update MapPoints Statistics
+    mnMatchesInliers = 0;
     for(size_t i=0; i<mCurrentFrame.mvpMapPoints.size(); i++)
         if(mCurrentFrame.mvpMapPoints[i])
         {
             if(!mCurrentFrame.mvbOutlier[i])
+            {
                 mCurrentFrame.mvpMapPoints[i]->IncreaseFound();
+                mnMatchesInliers++;
+            }
         }
 
-    // Decide if the tracking was successful
+    mnRigInliers = 0;
+    for(size_t f=0; f<mvpRigFrames.size(); f++)
+    {
+        Frame* pF = mvpRigFrames[f];
+        for(size_t i=0; i<pF->mvpMapPoints.size(); i++)
+            if(pF->mvpMapPoints[i] && !pF->mvbOutlier[i])
+            {
+                pF->mvpMapPoints[i]->IncreaseFound();
+                mnRigInliers++;
+            }
+    }
+
+    // Decide if the tracking was successful, with the inliers of all the cameras
     // More restrictive if there was a relocalization recently
-    if(mCurrentFrame.mnId<mnLastRelocFrameId+mMaxFrames && mnMatchesInliers<50)
+    const int nInliers = mnMatchesInliers+mnRigInliers;
+    if(mCurrentFrame.mnId<mnLastRelocFrameId+mMaxFrames && nInliers<50)
         return false;
 
-    if(mnMatchesInliers<30)
+    if(nInliers<30)
         return false;
     else
         return true;
 }
 
+void Tracking::SearchRigFrames()
+{
+    ClearRigFrames();
+
+    for(size_t i=0; i<mvpRigCameras.size(); i++)
+    {
+        Frame* pF = mvpRigCameras[i]->TakeFrame(mCurrentFrame.mTimeStamp,mfRigMaxDelay);
+        if(!pF)
+            continue;
+        if(pF->N==0)
+        {
+            delete pF;
+            continue;
+        }
+
+        // Points matched in the first camera are not searched again
+        pF->mnId = mCurrentFrame.mnId;
+        pF->mpReferenceKF = mCurrentFrame.mpReferenceKF;
+        pF->mTcw = pF->mpCamera->mTcr*mCurrentFrame.mTcw;
+        pF->UpdatePoseMatrices();
+        mvpRigFrames.push_back(pF);
+
+        const int nToMatch = mFrustumCuller.Cull(*pF,mvpLocalMapPoints,mCurrentFrame.mvpMapPoints,0.5,mLocalMapProjection);
+        if(nToMatch>0)
+        {
+            ORBmatcher matcher(0.8);
+            int th = 1;
+            if(mCurrentFrame.mnId<mnLastRelocFrameId+2)
+                th=5;
+            matcher.SearchByProjection(*pF,mvpLocalMapPoints,mLocalMapProjection,th);
+        }
+    }
+}
+
+void Tracking::ClearRigFrames()
+{
+    for(size_t i=0; i<mvpRigFrames.size(); i++)
+        delete mvpRigFrames[i];
+    mvpRigFrames.clear();
+    mnRigInliers = 0;
+}
+
 
 bool Tracking::NeedNewKeyFrame()
 {
+    ScopedTimer timer(LatencyStats::NEED_NEW_KEYFRAME);
+
     // If Local Mapping is freezed by a Loop Closure do not insert keyframes
     if(mpLocalMapper->isStopped() || mpLocalMapper->stopRequested())
         return false;
@@ -696,7 +2137,8 @@ bool Tracking::NeedNewKeyFrame()
         return false;
 
     // Reference KeyFrame MapPoints
-    int nRefMatches = mpReferenceKF->TrackedMapPoints();
+    // Those of its keypoints a downscaled frame could match
+    int nRefMatches = mpReferenceKF->TrackedMapPoints(mCurrentFrame.mnFirstLevel);
 
     // Local Mapping accept keyframes?
     bool bLocalMappingIdle = mpLocalMapper->AcceptKeyFrames();
@@ -708,13 +2150,30 @@ bool Tracking::NeedNewKeyFrame()
     // Condition 2: Less than 90% of points than reference keyframe and enough inliers
     const bool c2 = mnMatchesInliers<nRefMatches*0.9 && mnMatchesInliers>15;
 
-    if((c1a||c1b)&&c2)
+    // Condition 3: Local Mapping is idle, and at the trend of the tracked ratio condition 2 holds
+    // before Local Mapping would be done with a keyframe inserted now
+    bool c3 = false;
+    if(mpKeyFramePolicy)
+    {
+        mpKeyFramePolicy->Update(mCurrentFrame.mTimeStamp,mpReferenceKF->mnId,nRefMatches>0 ? (float)mnMatchesInliers/nRefMatches : 0);
+        c3 = bLocalMappingIdle && mCurrentFrame.mnId>=mnLastKeyFrameId+mMinFrames && mnMatchesInliers>15 &&
+             mpKeyFramePolicy->Anticipate(mpLocalMapper->PredictKeyFrameTime());
+    }
+
+    if(((c1a||c1b)&&c2) || c3)
     {
         // If the mapping accepts keyframes insert, otherwise send a signal to interrupt BA, but not insert yet
         if(bLocalMappingIdle)
         {
+            if(!((c1a||c1b)&&c2))
+                Metrics::Global()->Add(Metrics::KEYFRAMES_ANTICIPATED);
             return true;
         }
+        // A BA predicted to finish within a few frames is not thrown away, the keyframe waits for it
+        else if(mpKeyFramePolicy && mpKeyFramePolicy->Wait(mpLocalMapper->PredictIdleTime()))
+        {
+            return false;
+        }
         else
         {
             mpLocalMapper->InterruptBA();
@@ -727,10 +2186,22 @@ bool Tracking::NeedNewKeyFrame()
 
 void Tracking::CreateNewKeyFrame()
 {
+    ScopedTimer timer(LatencyStats::CREATE_NEW_KEYFRAME);
+
     KeyFrame* pKF = new KeyFrame(mCurrentFrame,mapDB->getCurrent(),mapDB->getCurrent()->GetKeyFrameDatabase());
+    Metrics::Global()->Add(Metrics::KEYFRAMES_CREATED);
 
     mpLocalMapper->InsertKeyFrame(pKF);
 
+    // The other cameras of the rig add their view of the scene to the same map
+    for(size_t i=0; i<mvpRigFrames.size(); i++)
+    {
+        Frame* pF = mvpRigFrames[i];
+        if(pF->mTcw.empty())
+            continue;
+        mpLocalMapper->InsertKeyFrame(new KeyFrame(*pF,mapDB->getCurrent(),mapDB->getCurrent()->GetKeyFrameDatabase()));
+    }
+
     mnLastKeyFrameId = mCurrentFrame.mnId;
     mpLastKeyFrame = pKF;
 }
@@ -751,8 +2222,6 @@ void Tracking::SearchReferencePointsInFrustum()
             else
             {
                 pMP->IncreaseVisible();
-                pMP->mnLastFrameSeen = mCurrentFrame.mnId;
-                pMP->mbTrackInView = false;
             }
         }
     }
@@ -760,22 +2229,9 @@ void Tracking::SearchReferencePointsInFrustum()
     // Update the current pose matrices
     mCurrentFrame.UpdatePoseMatrices();
 
-    int nToMatch=0;
-    // Project points in frame and check its visibility
-    for(vector<MapPoint*>::iterator vit=mvpLocalMapPoints.begin(), vend=mvpLocalMapPoints.end(); vit!=vend; vit++)
-    {
-        MapPoint* pMP = *vit;
-        if(pMP->isBad())
-            continue;
-        if(pMP->mnLastFrameSeen == mCurrentFrame.mnId)
-            continue;
-        // Project (this fills MapPoint variables for matching)
-        if(mCurrentFrame.isInFrustum(pMP,0.5))
-        {
-            pMP->IncreaseVisible();
-            nToMatch++;
-        }
-    }    
+    // Project points in frame and check its visibility, all the local map at once
+    // (this fills the projection of the local map used for matching)
+    const int nToMatch = mFrustumCuller.Cull(mCurrentFrame,mvpLocalMapPoints,mCurrentFrame.mvpMapPoints,0.5,mLocalMapProjection);
 
     if(nToMatch>0)
     {
@@ -784,49 +2240,84 @@ void Tracking::SearchReferencePointsInFrustum()
         // If the camera has been relocalised recently, perform a coarser search
         if(mCurrentFrame.mnId<mnLastRelocFrameId+2)
             th=5;
-        matcher.SearchByProjection(mCurrentFrame,mvpLocalMapPoints,th);
+        const int nmatches = matcher.SearchByProjection(mCurrentFrame,mvpLocalMapPoints,mLocalMapProjection,th);
+
+        const ORBmatcher::ProjectionStats &stats = matcher.GetProjectionStats();
+        ROS_DEBUG("ORB-SLAM - Local map search: %d points, %d candidates, %d out of radius, %d prefiltered, %d compared, %d matches",
+                  stats.nPoints,stats.nCandidates,stats.nOutOfRadius,stats.nPrefiltered,stats.nCompared,nmatches);
     }
 }
 
 void Tracking::UpdateReference()
 {    
-    // This is for visualization
-    mapDB->getCurrent()->SetReferenceMapPoints(mvpLocalMapPoints);
+    // The keyframes are voted every frame, which also drops the bad matches of the frame
+    Map* pMap = mapDB->getCurrent();
+    KeyFrame* pLastReferenceKF = mpReferenceKF;
+    const bool bBadMatches = UpdateReferenceKeyFrames();
+
+    // The points of the local keyframes are gathered again unless the same keyframes are local, with the same
+    // match lists (a new list is made on each change of the matches), the reference did not change, no match
+    // of the frame went bad, and the points were not gathered before an interruption, a new keyframe of this
+    // thread, or MaxFrames ago
+    bool bCached = pMap==mpLocalMapOwner && mpReferenceKF==pLastReferenceKF && !bBadMatches &&
+                   mCurrentFrame.mnId==mnLocalMapLastFrameId+1 &&
+                   mnLastKeyFrameId<mnLocalMapBuildFrameId &&
+                   mCurrentFrame.mnId<mnLocalMapBuildFrameId+mMaxFrames &&
+                   mvpLocalKeyFrames==mvpLocalMapKeyFrames;
+    mnLocalMapLastFrameId = mCurrentFrame.mnId;
+
+    // The lists are read before gathering, a change meanwhile triggers another one
+    vector<KeyFrame::MapPointList> vpLists(mvpLocalKeyFrames.size());
+    for(size_t i=0; i<mvpLocalKeyFrames.size(); i++)
+    {
+        vpLists[i] = mvpLocalKeyFrames[i]->GetMapPointMatchList();
+        if(bCached && vpLists[i]!=mvpLocalMapLists[i])
+            bCached = false;
+    }
+    if(bCached)
+        return;
+
+    mpLocalMapOwner = pMap;
+    mnLocalMapBuildFrameId = mCurrentFrame.mnId;
+    mvpLocalMapKeyFrames = mvpLocalKeyFrames;
+    mvpLocalMapLists.swap(vpLists);
 
-    // Update
-    UpdateReferenceKeyFrames();
     UpdateReferencePoints();
+
+    // This is for visualization
+    pMap->SetReferenceMapPoints(mvpLocalMapPoints);
 }
 
 void Tracking::UpdateReferencePoints()
 {
     mvpLocalMapPoints.clear();
 
+    // Points already included, kept here rather than marked in the map points which other threads read
+    set<MapPoint*> sLocalMapPoints;
+
     for(vector<KeyFrame*>::iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
     {
         KeyFrame* pKF = *itKF;
-        vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+        KeyFrame::MapPointList pMPs = pKF->GetMapPointMatchList();
 
-        for(vector<MapPoint*>::iterator itMP=vpMPs.begin(), itEndMP=vpMPs.end(); itMP!=itEndMP; itMP++)
+        for(vector<MapPoint*>::const_iterator itMP=pMPs->begin(), itEndMP=pMPs->end(); itMP!=itEndMP; itMP++)
         {
             MapPoint* pMP = *itMP;
             if(!pMP)
                 continue;
-            if(pMP->mnTrackReferenceForFrame==mCurrentFrame.mnId)
+            if(pMP->isBad())
                 continue;
-            if(!pMP->isBad())
-            {
+            if(sLocalMapPoints.insert(pMP).second)
                 mvpLocalMapPoints.push_back(pMP);
-                pMP->mnTrackReferenceForFrame=mCurrentFrame.mnId;
-            }
         }
     }
 }
 
 
-void Tracking::UpdateReferenceKeyFrames()
+bool Tracking::UpdateReferenceKeyFrames()
 {
     // Each map point vote for the keyframes in which it has been observed
+    bool bBadMatches = false;
     map<KeyFrame*,int> keyframeCounter;
     for(size_t i=0, iend=mCurrentFrame.mvpMapPoints.size(); i<iend;i++)
     {
@@ -835,13 +2326,13 @@ void Tracking::UpdateReferenceKeyFrames()
             MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
             if(!pMP->isBad())
             {
-                map<KeyFrame*,size_t> observations = pMP->GetObservations();
-                for(map<KeyFrame*,size_t>::iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
-                    keyframeCounter[it->first]++;
+                MapPoint::KeyFrameCounter counter(keyframeCounter);
+                pMP->VisitObservations(counter);
             }
             else
             {
                 mCurrentFrame.mvpMapPoints[i]=NULL;
+                bBadMatches = true;
             }
         }
     }
@@ -867,8 +2358,8 @@ void Tracking::UpdateReferenceKeyFrames()
         }
 
         mvpLocalKeyFrames.push_back(it->first);
-        pKF->mnTrackReferenceForFrame = mCurrentFrame.mnId;
     }
+    set<KeyFrame*> sLocalKeyFrames(mvpLocalKeyFrames.begin(),mvpLocalKeyFrames.end());
 
 
     // Include also some not-already-included keyframes that are neighbors to already-included keyframes
@@ -880,17 +2371,17 @@ void Tracking::UpdateReferenceKeyFrames()
 
         KeyFrame* pKF = *itKF;
 
-        vector<KeyFrame*> vNeighs = pKF->GetBestCovisibilityKeyFrames(10);
+        // The 10 best covisibles
+        KeyFrame::KeyFrameList pNeighs = pKF->GetCovisibleList();
 
-        for(vector<KeyFrame*>::iterator itNeighKF=vNeighs.begin(), itEndNeighKF=vNeighs.end(); itNeighKF!=itEndNeighKF; itNeighKF++)
+        for(size_t iNeigh=0, nNeighs=min<size_t>(10,pNeighs->size()); iNeigh<nNeighs; iNeigh++)
         {
-            KeyFrame* pNeighKF = *itNeighKF;
+            KeyFrame* pNeighKF = (*pNeighs)[iNeigh];
             if(!pNeighKF->isBad())
             {
-                if(pNeighKF->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
+                if(sLocalKeyFrames.insert(pNeighKF).second)
                 {
                     mvpLocalKeyFrames.push_back(pNeighKF);
-                    pNeighKF->mnTrackReferenceForFrame=mCurrentFrame.mnId;
                     break;
                 }
             }
@@ -899,172 +2390,37 @@ void Tracking::UpdateReferenceKeyFrames()
     }
 
     mpReferenceKF = pKFmax;
+    return bBadMatches;
 }
 
 bool Tracking::RelocalisationInline()
 {
-    // Compute Bag of Words Vector
-    mCurrentFrame.ComputeBoW();
-
-    // Relocalisation is performed when tracking is lost and forced at some stages during loop closing
-    // Track Lost: Query KeyFrame Database for keyframe candidates for relocalisation
-    vector<KeyFrame*> vpCandidateKFs;
-    // Forced Relocalisation: Relocate against local window around last keyframe
-    {
-        boost::mutex::scoped_lock lock(mMutexForceRelocalisationInline);
-        mbForceRelocalisationInline = false;
-    }
-    // Get matching frames form the database
-    if(mapDB->getCurrent() != NULL)
-            vpCandidateKFs = mapDB->getCurrent()->GetKeyFrameDatabase()->DetectRelocalisationCandidates(&mCurrentFrame);
-    else
-        vpCandidateKFs.reserve(10);
-        vpCandidateKFs = mpLastKeyFrame->GetBestCovisibilityKeyFrames(9);
-        vpCandidateKFs.push_back(mpLastKeyFrame);
+    TRACE_SCOPE("Tracking::RelocalisationInline");
 
-    // Do not continue if we have no candidates
-    if(vpCandidateKFs.empty())
+    // No candidates until the vocabulary is loaded
+    if(!mapDB->isVocabLoaded())
         return false;
 
-    const int nKFs = vpCandidateKFs.size();
-
-    // We perform first an ORB matching with each candidate
-    // If enough matches are found we setup a PnP solver
-    ORBmatcher matcher(0.75,true);
-    vector<PnPsolver*> vpPnPsolvers;
-    vpPnPsolvers.resize(nKFs);
-
-    vector<vector<MapPoint*> > vvpMapPointMatches;
-    vvpMapPointMatches.resize(nKFs);
-    vector<bool> vbDiscarded;
-    vbDiscarded.resize(nKFs);
-
-    int nCandidates=0;
-    for(size_t i=0; i<vpCandidateKFs.size(); i++)
+    // Relocalisation is forced at some stages during loop closing
     {
-        KeyFrame* pKF = vpCandidateKFs[i];
-        if(pKF->isBad())
-            vbDiscarded[i] = true;
-        else
-        {
-            int nmatches = matcher.SearchByBoW(pKF,mCurrentFrame,vvpMapPointMatches[i]);
-            if(nmatches<15)
-            {
-                vbDiscarded[i] = true;
-                continue;
-            }
-            else
-            {
-                PnPsolver* pSolver = new PnPsolver(mCurrentFrame,vvpMapPointMatches[i]);
-                pSolver->SetRansacParameters(0.99,10,300,4,0.5,5.991);
-                vpPnPsolvers[i] = pSolver;
-                nCandidates++;
-            }
-        }        
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexForceRelocalisationInline);
+        mbForceRelocalisationInline = false;
     }
 
-    // Alternatively perform some iterations of P4P RANSAC
-    // Until we found a camera pose supported by enough inliers
-    bool bMatch = false;
-    ORBmatcher matcher2(0.9,true);
-    
-    while(nCandidates>0 && !bMatch)
-    {
-        for(size_t i=0; i<vpCandidateKFs.size(); i++)
-        {
-            if(vbDiscarded[i])
-                continue;
-
-            // Perform 5 Ransac Iterations
-            vector<bool> vbInliers;
-            int nInliers;
-            bool bNoMore;
-
-            PnPsolver* pSolver = vpPnPsolvers[i];
-            cv::Mat Tcw = pSolver->iterate(5,bNoMore,vbInliers,nInliers);
-
-            // If Ransac reachs max. iterations discard keyframe
-            if(bNoMore)
-            {
-                vbDiscarded[i]=true;
-                nCandidates--;
-            }
-
-            // If a Camera Pose is computed, optimize
-            if(!Tcw.empty())
-            {
-                Tcw.copyTo(mCurrentFrame.mTcw);
-
-                set<MapPoint*> sFound;
-
-                for(size_t j=0; j<vbInliers.size(); j++)
-                {
-                    if(vbInliers[j])
-                    {
-                        mCurrentFrame.mvpMapPoints[j]=vvpMapPointMatches[i][j];
-                        sFound.insert(vvpMapPointMatches[i][j]);
-                    }
-                    else
-                        mCurrentFrame.mvpMapPoints[j]=NULL;
-                }
-
-                int nGood = Optimizer::PoseOptimization(&mCurrentFrame);
-
-                if(nGood<10)
-                    continue;
-
-                for(size_t io =0, ioend=mCurrentFrame.mvbOutlier.size(); io<ioend; io++)
-                    if(mCurrentFrame.mvbOutlier[io])
-                        mCurrentFrame.mvpMapPoints[io]=NULL;
-
-                // If few inliers, search by projection in a coarse window and optimize again
-                if(nGood<50)
-                {
-                    int nadditional =matcher2.SearchByProjection(mCurrentFrame,vpCandidateKFs[i],sFound,10,100);
-
-                    if(nadditional+nGood>=50)
-                    {
-                        nGood = Optimizer::PoseOptimization(&mCurrentFrame);
-
-                        // If many inliers but still not enough, search by projection again in a narrower window
-                        // the camera has been already optimized with many points
-                        if(nGood>30 && nGood<50)
-                        {
-                            sFound.clear();
-                            for(size_t ip =0, ipend=mCurrentFrame.mvpMapPoints.size(); ip<ipend; ip++)
-                                if(mCurrentFrame.mvpMapPoints[ip])
-                                    sFound.insert(mCurrentFrame.mvpMapPoints[ip]);
-                            nadditional =matcher2.SearchByProjection(mCurrentFrame,vpCandidateKFs[i],sFound,3,64);
-
-                            // Final optimization
-                            if(nGood+nadditional>=50)
-                            {
-                                nGood = Optimizer::PoseOptimization(&mCurrentFrame);
-
-                                for(size_t io =0; io<mCurrentFrame.mvbOutlier.size(); io++)
-                                    if(mCurrentFrame.mvbOutlier[io])
-                                        mCurrentFrame.mvpMapPoints[io]=NULL;
-                            }
-                        }
-                    }
-                }
+    // Forced Relocalisation: Relocate against local window around last keyframe
+    vector<KeyFrame*> vpCandidateKFs = mpLastKeyFrame->GetBestCovisibilityKeyFrames(9);
+    vpCandidateKFs.push_back(mpLastKeyFrame);
 
-                // If the pose is supported by enough inliers stop ransacs and continue
-                if(nGood>=50)
-                {
-                    bMatch = true;
-                    break;
-                }
-            }
-        }
-    }
+    // Verified in this thread under the budget, the window is resident and nothing gets pinned
+    vector<Map*> vpPinnedMaps;
+    const bool bMatch = mpRelocalizer->Relocalize(&mCurrentFrame,vpCandidateKFs,mPnPVerifier,mfRelocInlineBudget,vpPinnedMaps)>=0;
 
     if(!bMatch)
         return false;
     else
     {  
         {
-            boost::mutex::scoped_lock lock2(mMutexRelocFrameId);
+            PROFILED_LOCK(boost::mutex::scoped_lock, lock2, mMutexRelocFrameId);
             mnLastRelocFrameId = mCurrentFrame.mnId;
         }
         ROS_INFO("ORB-SLAM - Successful relocalisation to old map. (inline)");
@@ -1072,14 +2428,18 @@ bool Tracking::RelocalisationInline()
         ResetRelocalisationRequested();
         // Update working state
         mState = WORKING;
-        // Reset other threads
-        mpLocalMapper->RequestReset();
-        mpLoopCloser->RequestReset();
-        mpMapMerger->RequestReset();
-        // Ensure that our other threads are started
-        mpLocalMapper->Release();
-        mpLoopCloser->Release();
-        mpMapMerger->Release();
+        mnCoastedFrames = 0;
+        // Switch the other threads to the new map, the work queued for the previous one is finished there
+        mpLocalMapper->RequestMapSwitch();
+        mpLoopCloser->RequestMapSwitch();
+        mpMapMerger->RequestMapSwitch();
+        // Ensure that our other threads are started, unless the maps are frozen
+        if(!mbMappingStopped)
+        {
+            mpLocalMapper->Release();
+            mpLoopCloser->Release();
+            mpMapMerger->Release();
+        }
         // Ensure the relocalizer is not running
         mpRelocalizer->RequestStop();
         return true;
@@ -1089,8 +2449,8 @@ bool Tracking::RelocalisationInline()
 
 void Tracking::ForceRelocalisation()
 {
-    boost::mutex::scoped_lock lock(mMutexForceRelocalisation);
-    boost::mutex::scoped_lock lock2(mMutexRelocFrameId);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexForceRelocalisation);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock2, mMutexRelocFrameId);
     mbForceRelocalisation = true;
     mnLastRelocFrameId = mCurrentFrame.mnId;
     
@@ -1098,36 +2458,167 @@ void Tracking::ForceRelocalisation()
 
 void Tracking::ForceInlineRelocalisation()
 {
-    boost::mutex::scoped_lock lock(mMutexForceRelocalisationInline);
-    boost::mutex::scoped_lock lock2(mMutexRelocFrameId);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexForceRelocalisationInline);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock2, mMutexRelocFrameId);
     mbForceRelocalisationInline = true;
     mnLastRelocFrameId = mCurrentFrame.mnId;
 }
 
+void Tracking::SetLocalizationOnly(bool bLocalizationOnly)
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexLocalizationOnly);
+    mbLocalizationOnly = bLocalizationOnly;
+}
+
+bool Tracking::LocalizationOnly()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexLocalizationOnly);
+    return mbLocalizationOnly;
+}
+
+bool Tracking::LocalizationOnlyService(std_srvs::SetBool::Request &req, std_srvs::SetBool::Response &res)
+{
+    SetLocalizationOnly(req.data);
+    res.success = true;
+    res.message = req.data ? "Localization only" : "Mapping";
+    ROS_INFO("ORB-SLAM - %s mode requested.", res.message.c_str());
+    return true;
+}
+
+bool Tracking::ReloadSettingsService(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res)
+{
+    {
+        boost::mutex::scoped_lock lock(mMutexReload);
+        mbReloadRequested = true;
+    }
+    res.success = true;
+    res.message = "Settings reloaded with the next frame";
+    ROS_INFO("ORB-SLAM - Settings reload requested.");
+    return true;
+}
+
+void Tracking::ReloadSettings()
+{
+    {
+        boost::mutex::scoped_lock lock(mMutexReload);
+        if(!mbReloadRequested)
+            return;
+        mbReloadRequested = false;
+    }
+
+    cv::FileStorage fSettings(mstrSettingPath, cv::FileStorage::READ);
+    if(!fSettings.isOpened())
+    {
+        ROS_WARN("ORB-SLAM - Could not reread %s, settings unchanged", mstrSettingPath.c_str());
+        return;
+    }
+
+    const int nFeatures = fSettings["ORBextractor.nFeatures"];
+    const float fScaleFactor = fSettings["ORBextractor.scaleFactor"];
+    const int nLevels = fSettings["ORBextractor.nLevels"];
+    const int fastTh = fSettings["ORBextractor.fastTh"];
+    const int Score = fSettings["ORBextractor.nScoreType"];
+    if(nFeatures<=0 || fScaleFactor<=1.0f || nLevels<=0 || fastTh<=0 || (Score!=0 && Score!=1))
+    {
+        ROS_WARN("ORB-SLAM - Invalid ORBextractor settings in %s, settings unchanged", mstrSettingPath.c_str());
+        return;
+    }
+
+    // Frames and keyframes keep the scales they were extracted with, so the new ones only apply to the next frames
+    // The replaced extractor stays alive, the last frame and the extraction stage may still use it
+    if(nLevels!=mpORBextractor->GetLevels() || fabs(fScaleFactor-mpORBextractor->GetScaleFactor())>1e-6f)
+    {
+        ORBextractor* pExtractor = new ORBextractor(nFeatures,fScaleFactor,nLevels,Score,fastTh,mpORBextractor->GetThreads());
+        pExtractor->SetPyramid(&mPyramid);
+        pExtractor->SetStaticMask(mStaticMask);
+        pExtractor->SetRoi(mpORBextractor->GetRoi());
+        pExtractor->SetQuadTree(mpORBextractor->GetQuadTree());
+        if(mbGpuExtraction)
+            pExtractor->SetBackend(new GpuORBextractor());
+        {
+            boost::mutex::scoped_lock lock(mMutexFrameQueue);
+            mvpRetiredExtractors.push_back(mpORBextractor);
+            mpORBextractor = pExtractor;
+        }
+    }
+    else
+        mpORBextractor->SetParameters(nFeatures,fastTh);
+    // The adaptive budget goes on from its own values
+    if(mpFeatureBudget)
+        mpORBextractor->SetParameters(mpFeatureBudget->GetFeatures(),mpFeatureBudget->GetFastThreshold());
+
+    // The velocity is estimated again from the next two frames
+    const bool bMotionModel = (int)fSettings["UseMotionModel"];
+    if(bMotionModel && !mbMotionModel)
+        mVelocity = cv::Mat();
+    mbMotionModel = bMotionModel;
+
+    float fps = fSettings["Camera.fps"];
+    if(fps==0)
+        fps=30;
+    mMaxFrames = 18*fps/30;
+
+    ROS_INFO("ORB-SLAM - Settings reloaded: %d features, %d levels, scale %.2f, FAST %d, motion model %s, %.1f fps",
+             nFeatures, nLevels, fScaleFactor, fastTh, mbMotionModel ? "on" : "off", fps);
+}
+
+void Tracking::UpdateLocalizationOnly()
+{
+    const bool bLocalizationOnly = LocalizationOnly();
+    const bool bChanged = bLocalizationOnly!=mbMappingStopped;
+    mbMappingStopped = bLocalizationOnly;
+
+    if(bLocalizationOnly)
+    {
+        // The mapping threads finish their current step and wait, without work they take no cpu
+        // Requested on every frame, a loop correction finishing meanwhile releases the local mapper
+        if(!mpLocalMapper->stopRequested() && !mpLocalMapper->isStopped())
+            mpLocalMapper->RequestStop();
+        if(!mpLoopCloser->stopRequested() && !mpLoopCloser->isStopped())
+            mpLoopCloser->RequestStop();
+        if(!mpMapMerger->stopRequested() && !mpMapMerger->isStopped())
+            mpMapMerger->RequestStop();
+        // Without a map to track against only a relocalisation can get us working
+        if(bChanged && mState!=WORKING)
+        {
+            ForceRelocalisation();
+            mpRelocalizer->Release();
+        }
+    }
+    else if(bChanged && mState==WORKING)
+    {
+        // Mapping resumes from the current keyframes
+        mpLocalMapper->Release();
+        mpLoopCloser->Release();
+        mpMapMerger->Release();
+    }
+}
+
 bool Tracking::RelocalisationRequested()
 {
-    boost::mutex::scoped_lock lock(mMutexForceRelocalisation);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexForceRelocalisation);
     return mbForceRelocalisation;
 }
 
 bool Tracking::RelocalisationInlineRequested()
 {
-    boost::mutex::scoped_lock lock(mMutexForceRelocalisationInline);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexForceRelocalisationInline);
     return mbForceRelocalisationInline;
 }
 
 void Tracking::ResetRelocalisationRequested() {
-    boost::mutex::scoped_lock lock(mMutexForceRelocalisation);
-    boost::mutex::scoped_lock lock2(mMutexForceRelocalisationInline);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexForceRelocalisation);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock2, mMutexForceRelocalisationInline);
     mbForceRelocalisation = false;
     mbForceRelocalisationInline = false;
 }
 
 void Tracking::SetRelocalisationFrame(Frame* frame)
 {
-    boost::mutex::scoped_lock lock(mMutexRelocFrameId);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexRelocFrameId);
     mnLastRelocFrameId = frame->mnId;
-    mLastFrame = Frame(*frame);
+    Frame relocFrame(*frame);
+    mLastFrame.swap(relocFrame);
 }
 
 void Tracking::Reset()
@@ -1160,8 +2651,12 @@ void Tracking::Reset()
         map_to_delete->setErased(true);
     }
     
+    mnCoastedFrames = 0;
+
     // We need to relocalize
     mpRelocalizer->Release();
+
+    ClearRigFrames();
     
     // Reset state
     mState = NOT_INITIALIZED;
@@ -1169,44 +2664,162 @@ void Tracking::Reset()
 
 void Tracking::publishersRequest(bool state)
 {
-    boost::mutex::scoped_lock lock(mMutexReset);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexReset);
     mbReseting = state;
 }
 
 bool Tracking::publishersStopRequested()
 {
-    boost::mutex::scoped_lock lock(mMutexReset);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexReset);
     return mbReseting;
 }
 
 void Tracking::publishersSetStop(bool state)
 {
-    boost::mutex::scoped_lock lock(mMutexReset);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexReset);
     mbPublisherStopped = state;
 }
 
 bool Tracking::publishersStopped()
 {
-    boost::mutex::scoped_lock lock(mMutexReset);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexReset);
     return mbPublisherStopped;
 }
 
 void Tracking::PublishTopics()
 {
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexLastPose);
+        if(mState==WORKING && !mCurrentFrame.mTcw.empty())
+            mCurrentFrame.mTcw.copyTo(mLastPose);
+        else
+            mLastPose.release();
+    }
+
+    // Coasted frames are predictions themselves, the predictor keeps extrapolating from the last tracked one
+    if(mpPosePredictor)
+    {
+        if(mState==WORKING && !mCurrentFrame.mTcw.empty())
+        {
+            if(mnCoastedFrames==0)
+                mpPosePredictor->Correct(mCurrentFrame.mTimeStamp,mCurrentFrame.mTcw);
+        }
+        else
+            mpPosePredictor->Reset();
+    }
+
+    // Queued for the writer thread, tracking never waits on the file
+    KeyFrame* pRefKF = mCurrentFrame.mpReferenceKF;
+    Map* pMap = mapDB->getCurrent();
+    if(mpTrajectoryRecorder && mState==WORKING && !mCurrentFrame.mTcw.empty() && pRefKF && pMap)
+    {
+        TrajectoryRecorder::FramePose pose;
+        pose.timeStamp = mCurrentFrame.mTimeStamp;
+        pose.nMapId = pMap->mnId;
+        pose.nRefKFId = pRefKF->mnId;
+
+        typedef Eigen::Map<Eigen::Matrix<float,3,3,Eigen::RowMajor> > MapMatrix3f;
+        typedef Eigen::Map<Eigen::Vector3f> MapVector3f;
+        MapMatrix3f Rcw(pose.Rcw), Rcr(pose.Rcr);
+        MapVector3f tcw(pose.tcw), tcr(pose.tcr);
+        Rcw = Converter::toMatrix3f(mCurrentFrame.mTcw.rowRange(0,3).colRange(0,3));
+        tcw = Converter::toVector3f(mCurrentFrame.mTcw.rowRange(0,3).col(3));
+
+        // Tcr = Tcw*Trw^-1
+        PoseSnapshot refPose;
+        pRefKF->GetPoseSnapshot(refPose);
+        Rcr = Rcw*refPose.Rcw().transpose();
+        tcr = tcw-Rcr*refPose.tcw();
+        mpTrajectoryRecorder->Record(pose);
+    }
+
+    const bool bTrackedPose = mTrackedPosePub.getNumSubscribers()>0;
+    orb_slam::TrackedPosePtr pTrackedPose;
+    if(bTrackedPose)
+    {
+        // Published as a shared pointer, intra-process subscribers get it without a copy
+        pTrackedPose.reset(new orb_slam::TrackedPose);
+        pTrackedPose->header.seq = mnTrackedSeq++;
+        pTrackedPose->header.stamp = ros::Time(mCurrentFrame.mTimeStamp);
+        pTrackedPose->header.frame_id = mstrWorldFrame;
+        pTrackedPose->pose.orientation.w = 1.0;
+        pTrackedPose->state = static_cast<int8_t>(mState);
+        pTrackedPose->frames_dropped = mnFramesDropped;
+        if(mpLoadShedder)
+        {
+            pTrackedPose->frames_shed = mpLoadShedder->GetShed();
+            pTrackedPose->tracked_ratio = mpLoadShedder->GetTrackedRatio();
+        }
+        else
+            pTrackedPose->tracked_ratio = 1.0;
+    }
+
     // Publish the current camera 
     if(!mCurrentFrame.mTcw.empty())
     {
-        cv::Mat Rwc = mCurrentFrame.mTcw.rowRange(0,3).colRange(0,3).t();
-        cv::Mat twc = -Rwc*mCurrentFrame.mTcw.rowRange(0,3).col(3);
-        tf::Matrix3x3 M(Rwc.at<float>(0,0),Rwc.at<float>(0,1),Rwc.at<float>(0,2),
-                        Rwc.at<float>(1,0),Rwc.at<float>(1,1),Rwc.at<float>(1,2),
-                        Rwc.at<float>(2,0),Rwc.at<float>(2,1),Rwc.at<float>(2,2));
-        tf::Vector3 V(twc.at<float>(0), twc.at<float>(1), twc.at<float>(2));
+        const tf::Transform tfTcw = PublishPose(mCurrentFrame.mTcw);
+        if(bTrackedPose && mState==WORKING)
+            tf::poseTFToMsg(tfTcw, pTrackedPose->pose);
+    }
+
+    if(bTrackedPose)
+    {
+        pTrackedPose->processed = ros::Time::now();
+        mTrackedPosePub.publish(pTrackedPose);
+    }
+}
+
+// Camera pose in the world of a Tcw
+static tf::Transform toTransform(const cv::Mat &Tcw)
+{
+    cv::Mat Rwc = Tcw.rowRange(0,3).colRange(0,3).t();
+    cv::Mat twc = -Rwc*Tcw.rowRange(0,3).col(3);
+    tf::Matrix3x3 M(Rwc.at<float>(0,0),Rwc.at<float>(0,1),Rwc.at<float>(0,2),
+                    Rwc.at<float>(1,0),Rwc.at<float>(1,1),Rwc.at<float>(1,2),
+                    Rwc.at<float>(2,0),Rwc.at<float>(2,1),Rwc.at<float>(2,2));
+    tf::Vector3 V(twc.at<float>(0), twc.at<float>(1), twc.at<float>(2));
+
+    return tf::Transform(M,V);
+}
+
+tf::Transform Tracking::PublishPose(const cv::Mat &Tcw)
+{
+    tf::Transform tfTcw = toTransform(Tcw);
 
-        tf::Transform tfTcw(M,V);
+    const ros::Time stamp = ros::Time::now();
+    mTfBr.sendTransform(tf::StampedTransform(tfTcw,stamp, mstrWorldFrame, mstrCameraFrame));
 
-        mTfBr.sendTransform(tf::StampedTransform(tfTcw,ros::Time::now(), "ORB_SLAM/World", "ORB_SLAM/Camera"));
+    // Same pose as a message, for consumers that do not listen to tf
+    if(mPosePub.getNumSubscribers()>0)
+    {
+        geometry_msgs::PoseStamped pose;
+        pose.header.stamp = stamp;
+        pose.header.frame_id = mstrWorldFrame;
+        tf::poseTFToMsg(tfTcw, pose.pose);
+        mPosePub.publish(pose);
     }
+
+    return tfTcw;
+}
+
+void Tracking::PublishPrediction(const ros::TimerEvent &event)
+{
+    if(mPredictedPosePub.getNumSubscribers()==0)
+        return;
+
+    // Stamped with the time it is predicted for, the image stamps and the clock share the time base
+    const ros::Time stamp = ros::Time::now();
+    cv::Mat Tcw;
+    double frameTimeStamp;
+    if(!mpPosePredictor->Predict(stamp.toSec(),Tcw,frameTimeStamp))
+        return;
+
+    geometry_msgs::PoseStamped pose;
+    pose.header.seq = mnPredictedSeq++;
+    pose.header.stamp = stamp;
+    pose.header.frame_id = mstrWorldFrame;
+    tf::poseTFToMsg(toTransform(Tcw), pose.pose);
+    mPredictedPosePub.publish(pose);
 }
 
 } //namespace ORB_SLAM
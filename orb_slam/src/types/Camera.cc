@@ -0,0 +1,125 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "types/Camera.h"
+#include "types/Frame.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ORB_SLAM
+{
+
+const int Camera::REFERENCE_FEATURES = 1000;
+const float Camera::MIN_CELL_SIZE = 4.0f;
+
+Camera::Camera(const cv::FileStorage &fSettings, const std::string &prefix, int nId):
+    mnId(nId), mnWidth(0), mnHeight(0), mnMinX(0), mnMaxX(0), mnMinY(0), mnMaxY(0),
+    mfGridElementWidthInv(0), mfGridElementHeightInv(0), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS)
+{
+    fx = fSettings[prefix+"fx"];
+    fy = fSettings[prefix+"fy"];
+    cx = fSettings[prefix+"cx"];
+    cy = fSettings[prefix+"cy"];
+
+    mK = cv::Mat::eye(3,3,CV_32F);
+    mK.at<float>(0,0) = fx;
+    mK.at<float>(1,1) = fy;
+    mK.at<float>(0,2) = cx;
+    mK.at<float>(1,2) = cy;
+
+    mDistCoef.create(4,1,CV_32F);
+    mDistCoef.at<float>(0) = fSettings[prefix+"k1"];
+    mDistCoef.at<float>(1) = fSettings[prefix+"k2"];
+    mDistCoef.at<float>(2) = fSettings[prefix+"p1"];
+    mDistCoef.at<float>(3) = fSettings[prefix+"p2"];
+
+    cv::Mat Tcr;
+    fSettings[prefix+"Tcr"] >> Tcr;
+    if(Tcr.rows==4 && Tcr.cols==4)
+        Tcr.convertTo(mTcr,CV_32F);
+    else
+        mTcr = cv::Mat::eye(4,4,CV_32F);
+
+    mnUndistortStep = fSettings[prefix+"UndistortStep"];
+    if(mnUndistortStep<=0)
+        mnUndistortStep = 4;
+
+    mnFeatures = fSettings["ORBextractor.nFeatures"];
+    if(mnFeatures<=0)
+        mnFeatures = REFERENCE_FEATURES;
+    mnFixedGridCols = fSettings[prefix+"GridCols"];
+    mnFixedGridRows = fSettings[prefix+"GridRows"];
+
+    // Without the image size in the settings the table is built on the first image
+    int nWidth = fSettings[prefix+"width"];
+    int nHeight = fSettings[prefix+"height"];
+    if(nWidth>0 && nHeight>0)
+        SetImageSize(nWidth,nHeight);
+}
+
+void Camera::SetImageSize(int width, int height)
+{
+    if(width==mnWidth && height==mnHeight)
+        return;
+
+    mnWidth = width;
+    mnHeight = height;
+
+    if(IsDistorted())
+    {
+        mUndistortionMap.Build(mK,mDistCoef,width,height,mnUndistortStep);
+        mnMinX = mUndistortionMap.GetMinX();
+        mnMaxX = mUndistortionMap.GetMaxX();
+        mnMinY = mUndistortionMap.GetMinY();
+        mnMaxY = mUndistortionMap.GetMaxY();
+    }
+    else
+    {
+        mnMinX = 0;
+        mnMaxX = width;
+        mnMinY = 0;
+        mnMaxY = height;
+    }
+
+    GridSize(width,height,mnGridCols,mnGridRows);
+    mfGridElementWidthInv=static_cast<float>(mnGridCols)/static_cast<float>(mnMaxX-mnMinX);
+    mfGridElementHeightInv=static_cast<float>(mnGridRows)/static_cast<float>(mnMaxY-mnMinY);
+}
+
+void Camera::GridSize(int width, int height, int &nCols, int &nRows) const
+{
+    if(mnFixedGridCols>0 && mnFixedGridRows>0)
+    {
+        nCols = mnFixedGridCols;
+        nRows = mnFixedGridRows;
+        return;
+    }
+
+    // The reference camera has 64x48 cells of 10 pixels, about 3 per feature
+    float nCells = static_cast<float>(FRAME_GRID_COLS*FRAME_GRID_ROWS)*mnFeatures/REFERENCE_FEATURES;
+    nCells = std::min(nCells,width*height/(MIN_CELL_SIZE*MIN_CELL_SIZE));
+
+    nCols = std::max(1,cvRound(std::sqrt(nCells*width/height)));
+    nRows = std::max(1,cvRound(nCells/nCols));
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,208 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "types/EssentialGraph.h"
+#include "types/KeyFrame.h"
+#include "util/LockProfiler.h"
+
+namespace ORB_SLAM
+{
+
+using namespace std;
+
+const int EssentialGraph::MIN_WEIGHT;
+
+EssentialGraph::EssentialGraph(): mbValid(true), mnChanges(0)
+{
+}
+
+void EssentialGraph::Invalidate()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutex);
+    mbValid = false;
+}
+
+void EssentialGraph::SetType(KeyFrame *pKF1, KeyFrame *pKF2, int nType, bool bSet)
+{
+    if(!pKF1 || !pKF2 || pKF1==pKF2)
+        return;
+
+    mnChanges++;
+    if(bSet)
+    {
+        mAdjacency[pKF1][pKF2] |= nType;
+        mAdjacency[pKF2][pKF1] |= nType;
+        return;
+    }
+
+    map<KeyFrame*,map<KeyFrame*,int> >::iterator mit1 = mAdjacency.find(pKF1);
+    map<KeyFrame*,map<KeyFrame*,int> >::iterator mit2 = mAdjacency.find(pKF2);
+    if(mit1==mAdjacency.end() || mit2==mAdjacency.end())
+        return;
+    map<KeyFrame*,int>::iterator eit1 = mit1->second.find(pKF2);
+    map<KeyFrame*,int>::iterator eit2 = mit2->second.find(pKF1);
+    if(eit1==mit1->second.end() || eit2==mit2->second.end())
+        return;
+
+    eit1->second &= ~nType;
+    eit2->second &= ~nType;
+    if(!eit1->second)
+    {
+        mit1->second.erase(eit1);
+        mit2->second.erase(eit2);
+        if(mit1->second.empty())
+            mAdjacency.erase(mit1);
+        if(mit2->second.empty())
+            mAdjacency.erase(mit2);
+    }
+}
+
+void EssentialGraph::SetWeight(KeyFrame *pKF1, KeyFrame *pKF2, int weight)
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutex);
+    SetType(pKF1,pKF2,COVISIBILITY,weight>=MIN_WEIGHT);
+}
+
+void EssentialGraph::SetParent(KeyFrame *pKF, KeyFrame *pOldParent, KeyFrame *pParent)
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutex);
+    if(pOldParent==pParent)
+        return;
+    SetType(pKF,pOldParent,SPANNING_TREE,false);
+    SetType(pKF,pParent,SPANNING_TREE,true);
+}
+
+void EssentialGraph::AddLoopEdge(KeyFrame *pKF1, KeyFrame *pKF2)
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutex);
+    SetType(pKF1,pKF2,LOOP,true);
+}
+
+void EssentialGraph::AddLinks(KeyFrame *pKF, KeyFrame *pParent, const vector<KeyFrame*> &vpLoopKFs,
+                              const vector<KeyFrame*> &vpCovisibleKFs)
+{
+    SetType(pKF,pParent,SPANNING_TREE,true);
+    for(size_t i=0; i<vpLoopKFs.size(); i++)
+        SetType(pKF,vpLoopKFs[i],LOOP,true);
+    for(size_t i=0; i<vpCovisibleKFs.size(); i++)
+        SetType(pKF,vpCovisibleKFs[i],COVISIBILITY,true);
+}
+
+void EssentialGraph::AddKeyFrame(KeyFrame *pKF)
+{
+    // The links are read before locking, keyframes notify the graph while holding their own locks
+    if(pKF->isBad())
+        return;
+    KeyFrame* pParent = pKF->GetParent();
+    set<KeyFrame*> sLoopKFs = pKF->GetLoopEdges();
+    vector<KeyFrame*> vpLoopKFs(sLoopKFs.begin(),sLoopKFs.end());
+    vector<KeyFrame*> vpCovisibleKFs = pKF->GetCovisiblesByWeight(MIN_WEIGHT);
+
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutex);
+    AddLinks(pKF,pParent,vpLoopKFs,vpCovisibleKFs);
+}
+
+void EssentialGraph::EraseKeyFrame(KeyFrame *pKF)
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutex);
+    map<KeyFrame*,map<KeyFrame*,int> >::iterator mit = mAdjacency.find(pKF);
+    if(mit==mAdjacency.end())
+        return;
+
+    mnChanges++;
+    for(map<KeyFrame*,int>::iterator eit=mit->second.begin(), eend=mit->second.end(); eit!=eend; eit++)
+    {
+        map<KeyFrame*,map<KeyFrame*,int> >::iterator mitn = mAdjacency.find(eit->first);
+        if(mitn==mAdjacency.end())
+            continue;
+        mitn->second.erase(pKF);
+        if(mitn->second.empty())
+            mAdjacency.erase(mitn);
+    }
+    mAdjacency.erase(pKF);
+}
+
+void EssentialGraph::GetEdges(const vector<KeyFrame*> &vpKFs, vector<Edge> &vEdges)
+{
+    // An invalidated graph is read back from the keyframes. The links are read without the lock,
+    // it is read again if they changed meanwhile, and taken as it is after a few tries
+    for(int nTry=0; ; nTry++)
+    {
+        unsigned long nChanges;
+        {
+            PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutex);
+            if(mbValid)
+                break;
+            nChanges = mnChanges;
+        }
+
+        vector<KeyFrame*> vpGoodKFs, vpParents;
+        vector<vector<KeyFrame*> > vvpLoopKFs, vvpCovisibleKFs;
+        vpGoodKFs.reserve(vpKFs.size());
+        for(size_t i=0; i<vpKFs.size(); i++)
+        {
+            KeyFrame* pKF = vpKFs[i];
+            if(pKF->isBad())
+                continue;
+            vpGoodKFs.push_back(pKF);
+            vpParents.push_back(pKF->GetParent());
+            set<KeyFrame*> sLoopKFs = pKF->GetLoopEdges();
+            vvpLoopKFs.push_back(vector<KeyFrame*>(sLoopKFs.begin(),sLoopKFs.end()));
+            vvpCovisibleKFs.push_back(pKF->GetCovisiblesByWeight(MIN_WEIGHT));
+        }
+
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutex);
+        if(mnChanges!=nChanges && nTry<2)
+            continue;
+        mAdjacency.clear();
+        for(size_t i=0; i<vpGoodKFs.size(); i++)
+            AddLinks(vpGoodKFs[i],vpParents[i],vvpLoopKFs[i],vvpCovisibleKFs[i]);
+        mbValid = true;
+        break;
+    }
+
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutex);
+    vEdges.clear();
+    for(map<KeyFrame*,map<KeyFrame*,int> >::const_iterator mit=mAdjacency.begin(), mend=mAdjacency.end(); mit!=mend; mit++)
+    {
+        KeyFrame* pKF1 = mit->first;
+        for(map<KeyFrame*,int>::const_iterator eit=mit->second.begin(), eend=mit->second.end(); eit!=eend; eit++)
+        {
+            // Each edge once, from its newest keyframe
+            if(eit->first->mnId>=pKF1->mnId)
+                continue;
+            Edge edge;
+            edge.pKF1 = pKF1;
+            edge.pKF2 = eit->first;
+            edge.nTypes = eit->second;
+            vEdges.push_back(edge);
+        }
+    }
+}
+
+void EssentialGraph::clear()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutex);
+    mAdjacency.clear();
+    mbValid = true;
+    mnChanges++;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,73 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "types/FeatureGrid.h"
+
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+FeatureGrid::FeatureGrid():
+    mnCols(0), mnRows(0)
+{}
+
+void FeatureGrid::Build(const int nCols, const int nRows, const std::vector<int> &vKeyCells)
+{
+    mnCols = nCols;
+    mnRows = nRows;
+
+    const int nCells = nCols*nRows;
+
+    // First pass: count the keypoints of each cell
+    mvCellStart.assign(nCells+1,0);
+    size_t nInGrid = 0;
+    for(size_t i=0, iend=vKeyCells.size(); i<iend; i++)
+    {
+        if(vKeyCells[i]<0)
+            continue;
+        mvCellStart[vKeyCells[i]+1]++;
+        nInGrid++;
+    }
+
+    // Offsets of each cell
+    for(int c=0; c<nCells; c++)
+        mvCellStart[c+1] += mvCellStart[c];
+
+    // Second pass: place each index at the next free position of its cell
+    mvIndices.resize(nInGrid);
+    std::vector<size_t> vNext(mvCellStart.begin(),mvCellStart.end()-1);
+    for(size_t i=0, iend=vKeyCells.size(); i<iend; i++)
+    {
+        if(vKeyCells[i]<0)
+            continue;
+        mvIndices[vNext[vKeyCells[i]]++] = i;
+    }
+}
+
+void FeatureGrid::swap(FeatureGrid &grid)
+{
+    std::swap(mnCols,grid.mnCols);
+    std::swap(mnRows,grid.mnRows);
+    mvCellStart.swap(grid.mvCellStart);
+    mvIndices.swap(grid.mvIndices);
+}
+
+} //namespace ORB_SLAM
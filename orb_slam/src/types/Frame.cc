@@ -19,44 +19,54 @@
 */
 
 #include "types/Frame.h"
+#include "util/AlignedAllocator.h"
 #include "util/Converter.h"
+#include "util/LatencyStats.h"
+#include "types/Camera.h"
+#include "util/FlowTracker.h"
+#include "util/DescriptorIndex.h"
+#include "util/PoolRunner.h"
 
 #include <ros/ros.h>
 
 namespace ORB_SLAM
 {
 long unsigned int Frame::nNextId=0;
-bool Frame::mbInitialComputations=true;
-float Frame::cx, Frame::cy, Frame::fx, Frame::fy;
-int Frame::mnMinX, Frame::mnMinY, Frame::mnMaxX, Frame::mnMaxY;
 
-Frame::Frame()
+Frame::Frame():
+    mpCamera(NULL), mnId(0), mnFirstLevel(0), mfSharpness(-1), mbPositionPrior(false)
 {}
 
 //Copy Constructor
+//The image, calibration and descriptors are never modified after construction, so they are shared
 Frame::Frame(const Frame &frame)
-    :mpORBvocabulary(frame.mpORBvocabulary), mpORBextractor(frame.mpORBextractor), im(frame.im.clone()), mTimeStamp(frame.mTimeStamp),
-     mK(frame.mK.clone()), mDistCoef(frame.mDistCoef.clone()), N(frame.N), mvKeys(frame.mvKeys), mvKeysUn(frame.mvKeysUn),
-     mBowVec(frame.mBowVec), mFeatVec(frame.mFeatVec), mDescriptors(frame.mDescriptors.clone()),
-     mvpMapPoints(frame.mvpMapPoints), mvbOutlier(frame.mvbOutlier),
-     mfGridElementWidthInv(frame.mfGridElementWidthInv), mfGridElementHeightInv(frame.mfGridElementHeightInv),mnId(frame.mnId),
-     mpReferenceKF(frame.mpReferenceKF), mnScaleLevels(frame.mnScaleLevels), mfScaleFactor(frame.mfScaleFactor),
-     mvScaleFactors(frame.mvScaleFactors), mvLevelSigma2(frame.mvLevelSigma2), mvInvLevelSigma2(frame.mvInvLevelSigma2)
+    :mpORBvocabulary(frame.mpORBvocabulary), mpORBextractor(frame.mpORBextractor), im(frame.im), mpImageOwner(frame.mpImageOwner), mTimeStamp(frame.mTimeStamp),
+     mpCamera(frame.mpCamera), mK(frame.mK), fx(frame.fx), fy(frame.fy), cx(frame.cx), cy(frame.cy), mDistCoef(frame.mDistCoef), N(frame.N), mvKeys(frame.mvKeys), mvKeysUn(frame.mvKeysUn),
+     mBowVec(frame.mBowVec), mFeatVec(frame.mFeatVec), mDescriptors(frame.mDescriptors),
+     mvpMapPoints(frame.mvpMapPoints), mvbOutlier(frame.mvbOutlier), mvDepth(frame.mvDepth),
+     mfGridElementWidthInv(frame.mfGridElementWidthInv), mfGridElementHeightInv(frame.mfGridElementHeightInv), mGrid(frame.mGrid), mnId(frame.mnId),
+     mpReferenceKF(frame.mpReferenceKF), mnScaleLevels(frame.mnScaleLevels), mnFirstLevel(frame.mnFirstLevel), mfScaleFactor(frame.mfScaleFactor),
+     mvScaleFactors(frame.mvScaleFactors), mvLevelSigma2(frame.mvLevelSigma2), mvInvLevelSigma2(frame.mvInvLevelSigma2),
+     mnMinX(frame.mnMinX), mnMaxX(frame.mnMaxX), mnMinY(frame.mnMinY), mnMaxY(frame.mnMaxY), mfSharpness(frame.mfSharpness),
+     mbPositionPrior(frame.mbPositionPrior), mPositionPrior(frame.mPositionPrior), mpDescriptorIndex(frame.mpDescriptorIndex),
+     mOw(frame.mOw), mRcw(frame.mRcw), mtcw(frame.mtcw)
 {
-    for(int i=0;i<FRAME_GRID_COLS;i++)
-        for(int j=0; j<FRAME_GRID_ROWS; j++)
-            mGrid[i][j]=frame.mGrid[i][j];
-
     if(!frame.mTcw.empty())
         mTcw = frame.mTcw.clone();
 }
 
 
-Frame::Frame(cv::Mat &im_, const double &timeStamp, ORBextractor* extractor, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef)
-    :mpORBvocabulary(voc),mpORBextractor(extractor), im(im_),mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone())
+Frame::Frame(cv::Mat &im_, const double &timeStamp, ORBextractor* extractor, ORBVocabulary* voc, const Camera* pCamera,
+             const boost::shared_ptr<const void> &imageOwner)
+    :mpORBvocabulary(voc),mpORBextractor(extractor), im(im_), mpImageOwner(imageOwner), mTimeStamp(timeStamp), mpCamera(pCamera),
+     mK(pCamera->mK), fx(pCamera->fx), fy(pCamera->fy), cx(pCamera->cx), cy(pCamera->cy), mDistCoef(pCamera->mDistCoef),
+     mfGridElementWidthInv(pCamera->mfGridElementWidthInv), mfGridElementHeightInv(pCamera->mfGridElementHeightInv),
+     mnMinX(pCamera->mnMinX), mnMaxX(pCamera->mnMaxX), mnMinY(pCamera->mnMinY), mnMaxY(pCamera->mnMaxY), mfSharpness(-1), mbPositionPrior(false)
 {
-    // Exctract ORB  
+    // Exctract ORB, the descriptors aligned for the matching kernels and shared with the keyframe
+    mDescriptors.allocator = AlignedAllocator::Get();
     (*mpORBextractor)(im,cv::Mat(),mvKeys,mDescriptors);
+    mnFirstLevel = mpORBextractor->GetFirstLevel();
 
     N = mvKeys.size();
 
@@ -65,26 +75,12 @@ Frame::Frame(cv::Mat &im_, const double &timeStamp, ORBextractor* extractor, ORB
 
     mvpMapPoints = vector<MapPoint*>(N,static_cast<MapPoint*>(NULL));
 
-    UndistortKeyPoints();
-
-    // This is done for the first created Frame
-    if(mbInitialComputations)
     {
-        ComputeImageBounds();
-
-        mfGridElementWidthInv=static_cast<float>(FRAME_GRID_COLS)/static_cast<float>(mnMaxX-mnMinX);
-        mfGridElementHeightInv=static_cast<float>(FRAME_GRID_ROWS)/static_cast<float>(mnMaxY-mnMinY);
-
-        fx = K.at<float>(0,0);
-        fy = K.at<float>(1,1);
-        cx = K.at<float>(0,2);
-        cy = K.at<float>(1,2);
-
-        mbInitialComputations=false;
+        ScopedTimer timer(LatencyStats::UNDISTORT_KEYPOINTS);
+        UndistortKeyPoints();
     }
 
-
-    mnId=nNextId++;
+    mnId = pCamera->mnId==0 ? nNextId++ : 0;
 
     //Scale Levels Info
     mnScaleLevels = mpORBextractor->GetLevels();
@@ -105,44 +101,128 @@ Frame::Frame(cv::Mat &im_, const double &timeStamp, ORBextractor* extractor, ORB
         mvInvLevelSigma2[i]=1/mvLevelSigma2[i];
 
     // Assign Features to Grid Cells
-    int nReserve = 0.5*N/(FRAME_GRID_COLS*FRAME_GRID_ROWS);
-    for(unsigned int i=0; i<FRAME_GRID_COLS;i++)
-        for (unsigned int j=0; j<FRAME_GRID_ROWS;j++)
-            mGrid[i][j].reserve(nReserve);
+    AssignFeaturesToGrid();
 
+    mvbOutlier = vector<bool>(N,false);
 
-    for(size_t i=0;i<mvKeysUn.size();i++)
+}
+
+Frame::Frame(cv::Mat &im_, const double &timeStamp, const Frame &previous, FlowTracker* pFlowTracker,
+             const boost::shared_ptr<const void> &imageOwner)
+    :mpORBvocabulary(previous.mpORBvocabulary),mpORBextractor(previous.mpORBextractor), im(im_), mpImageOwner(imageOwner), mTimeStamp(timeStamp),
+     mpCamera(previous.mpCamera), mK(previous.mK), fx(previous.fx), fy(previous.fy), cx(previous.cx), cy(previous.cy), mDistCoef(previous.mDistCoef),
+     mfGridElementWidthInv(previous.mfGridElementWidthInv), mfGridElementHeightInv(previous.mfGridElementHeightInv),
+     mpReferenceKF(previous.mpReferenceKF), mnScaleLevels(previous.mnScaleLevels), mnFirstLevel(previous.mnFirstLevel), mfScaleFactor(previous.mfScaleFactor),
+     mvScaleFactors(previous.mvScaleFactors), mvLevelSigma2(previous.mvLevelSigma2), mvInvLevelSigma2(previous.mvInvLevelSigma2),
+     mnMinX(previous.mnMinX), mnMaxX(previous.mnMaxX), mnMinY(previous.mnMinY), mnMaxY(previous.mnMaxY), mfSharpness(-1), mbPositionPrior(false)
+{
+    vector<int> vIndices;
+    pFlowTracker->Track(previous,im,timeStamp,mvKeys,vIndices);
+
+    N = mvKeys.size();
+
+    mnId = mpCamera->mnId==0 ? nNextId++ : 0;
+
+    // Each tracked keypoint keeps the match and descriptor it had
+    mvpMapPoints.resize(N);
+    mDescriptors.create(N,previous.mDescriptors.cols,previous.mDescriptors.type());
+    for(int i=0; i<N; i++)
     {
-        cv::KeyPoint &kp = mvKeysUn[i];
+        mvpMapPoints[i] = previous.mvpMapPoints[vIndices[i]];
+        previous.mDescriptors.row(vIndices[i]).copyTo(mDescriptors.row(i));
+    }
 
-        int nGridPosX, nGridPosY;
-        if(PosInGrid(kp,nGridPosX,nGridPosY))
-            mGrid[nGridPosX][nGridPosY].push_back(i);
+    if(N>0)
+    {
+        ScopedTimer timer(LatencyStats::UNDISTORT_KEYPOINTS);
+        UndistortKeyPoints();
     }
 
+    // Assign Features to Grid Cells
+    AssignFeaturesToGrid();
+
     mvbOutlier = vector<bool>(N,false);
+}
+
+void Frame::swap(Frame &frame)
+{
+    std::swap(mpORBvocabulary,frame.mpORBvocabulary);
+    std::swap(mpORBextractor,frame.mpORBextractor);
+    std::swap(im,frame.im);
+    mpImageOwner.swap(frame.mpImageOwner);
+    std::swap(mTimeStamp,frame.mTimeStamp);
+    std::swap(mpCamera,frame.mpCamera);
+    std::swap(mK,frame.mK);
+    std::swap(fx,frame.fx);
+    std::swap(fy,frame.fy);
+    std::swap(cx,frame.cx);
+    std::swap(cy,frame.cy);
+    std::swap(mDistCoef,frame.mDistCoef);
+    std::swap(N,frame.N);
+    mvKeys.swap(frame.mvKeys);
+    mvKeysUn.swap(frame.mvKeysUn);
+    mBowVec.swap(frame.mBowVec);
+    mFeatVec.swap(frame.mFeatVec);
+    std::swap(mDescriptors,frame.mDescriptors);
+    mvpMapPoints.swap(frame.mvpMapPoints);
+    mvbOutlier.swap(frame.mvbOutlier);
+    mvDepth.swap(frame.mvDepth);
+    std::swap(mfGridElementWidthInv,frame.mfGridElementWidthInv);
+    std::swap(mfGridElementHeightInv,frame.mfGridElementHeightInv);
+    mGrid.swap(frame.mGrid);
+    std::swap(mTcw,frame.mTcw);
+    std::swap(mnId,frame.mnId);
+    std::swap(mpReferenceKF,frame.mpReferenceKF);
+    std::swap(mnScaleLevels,frame.mnScaleLevels);
+    std::swap(mnFirstLevel,frame.mnFirstLevel);
+    std::swap(mfScaleFactor,frame.mfScaleFactor);
+    mvScaleFactors.swap(frame.mvScaleFactors);
+    mvLevelSigma2.swap(frame.mvLevelSigma2);
+    mvInvLevelSigma2.swap(frame.mvInvLevelSigma2);
+    std::swap(mnMinX,frame.mnMinX);
+    std::swap(mnMaxX,frame.mnMaxX);
+    std::swap(mnMinY,frame.mnMinY);
+    std::swap(mnMaxY,frame.mnMaxY);
+    std::swap(mfSharpness,frame.mfSharpness);
+    std::swap(mbPositionPrior,frame.mbPositionPrior);
+    std::swap(mPositionPrior,frame.mPositionPrior);
+    mpDescriptorIndex.swap(frame.mpDescriptorIndex);
+    std::swap(mOw,frame.mOw);
+    std::swap(mRcw,frame.mRcw);
+    std::swap(mtcw,frame.mtcw);
+}
+
+const DescriptorIndex& Frame::GetDescriptorIndex()
+{
+    if(!mpDescriptorIndex)
+        mpDescriptorIndex.reset(new DescriptorIndex(mDescriptors));
+    return *mpDescriptorIndex;
+}
 
+void Frame::DiscardBadMapPoints()
+{
+    for(size_t i=0; i<mvpMapPoints.size(); i++)
+        if(mvpMapPoints[i] && mvpMapPoints[i]->isBad())
+            mvpMapPoints[i]=static_cast<MapPoint*>(NULL);
 }
 
 void Frame::UpdatePoseMatrices()
 { 
-    mRcw = mTcw.rowRange(0,3).colRange(0,3);
-    mtcw = mTcw.rowRange(0,3).col(3);
-    mOw = -mRcw.t()*mtcw;
+    mRcw = Converter::toMatrix3f(mTcw.rowRange(0,3).colRange(0,3));
+    mtcw = Converter::toVector3f(mTcw.rowRange(0,3).col(3));
+    mOw = -mRcw.transpose()*mtcw;
 }
 
-bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
+bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit, float &u, float &v, int &nPredictedLevel, float &viewCos)
 {
-    pMP->mbTrackInView = false;
-
     // 3D in absolute coordinates
-    cv::Mat P = pMP->GetWorldPos(); 
+    const Eigen::Vector3f P = pMP->GetWorldPosEigen();
 
     // 3D in camera coordinates
-    const cv::Mat Pc = mRcw*P+mtcw;
-    const float PcX = Pc.at<float>(0);
-    const float PcY= Pc.at<float>(1);
-    const float PcZ = Pc.at<float>(2);
+    const Eigen::Vector3f Pc = mRcw*P+mtcw;
+    const float PcX = Pc(0);
+    const float PcY= Pc(1);
+    const float PcZ = Pc(2);
 
     // Check positive depth
     if(PcZ<0.0)
@@ -150,8 +230,8 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
 
     // Project in image and check it is not outside
     const float invz = 1.0/PcZ;
-    const float u=fx*PcX*invz+cx;
-    const float v=fy*PcY*invz+cy;
+    u=fx*PcX*invz+cx;
+    v=fy*PcY*invz+cy;
 
     if(u<mnMinX || u>mnMaxX)
         return false;
@@ -161,16 +241,16 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
     // Check distance is in the scale invariance region of the MapPoint
     const float maxDistance = pMP->GetMaxDistanceInvariance();
     const float minDistance = pMP->GetMinDistanceInvariance();
-    const cv::Mat PO = P-mOw;
-    const float dist = cv::norm(PO);
+    const Eigen::Vector3f PO = P-mOw;
+    const float dist = PO.norm();
 
     if(dist<minDistance || dist>maxDistance)
         return false;
 
    // Check viewing angle
-    cv::Mat Pn = pMP->GetNormal();
+    const Eigen::Vector3f Pn = pMP->GetNormalEigen();
 
-    float viewCos = PO.dot(Pn)/dist;
+    viewCos = PO.dot(Pn)/dist;
 
     if(viewCos<viewingCosLimit)
         return false;
@@ -179,18 +259,11 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
     float ratio = dist/minDistance;
 
     vector<float>::iterator it = lower_bound(mvScaleFactors.begin(), mvScaleFactors.end(), ratio);
-    int nPredictedLevel = it-mvScaleFactors.begin();
+    nPredictedLevel = it-mvScaleFactors.begin();
 
     if(nPredictedLevel>=mnScaleLevels)
         nPredictedLevel=mnScaleLevels-1;
 
-    // Data used by the tracking
-    pMP->mbTrackInView = true;
-    pMP->mTrackProjX = u;
-    pMP->mTrackProjY = v;
-    pMP->mnTrackScaleLevel= nPredictedLevel;
-    pMP->mTrackViewCos = viewCos;
-
     return true;
 }
 
@@ -198,26 +271,36 @@ vector<size_t> Frame::GetFeaturesInArea(const float &x, const float  &y, const f
 {
     vector<size_t> vIndices;
     vIndices.reserve(mvKeysUn.size());
+    GetFeaturesInArea(x,y,r,vIndices,minLevel,maxLevel);
+    return vIndices;
+}
+
+void Frame::GetFeaturesInArea(const float &x, const float  &y, const float  &r, vector<size_t> &vIndices, int minLevel, int maxLevel) const
+{
+    vIndices.clear();
+
+    const int nGridCols = mGrid.Cols();
+    const int nGridRows = mGrid.Rows();
 
     int nMinCellX = floor((x-mnMinX-r)*mfGridElementWidthInv);
     nMinCellX = max(0,nMinCellX);
-    if(nMinCellX>=FRAME_GRID_COLS)
-        return vIndices;
+    if(nMinCellX>=nGridCols)
+        return;
 
     int nMaxCellX = ceil((x-mnMinX+r)*mfGridElementWidthInv);
-    nMaxCellX = min(FRAME_GRID_COLS-1,nMaxCellX);
+    nMaxCellX = min(nGridCols-1,nMaxCellX);
     if(nMaxCellX<0)
-        return vIndices;
+        return;
 
     int nMinCellY = floor((y-mnMinY-r)*mfGridElementHeightInv);
     nMinCellY = max(0,nMinCellY);
-    if(nMinCellY>=FRAME_GRID_ROWS)
-        return vIndices;
+    if(nMinCellY>=nGridRows)
+        return;
 
     int nMaxCellY = ceil((y-mnMinY+r)*mfGridElementHeightInv);
-    nMaxCellY = min(FRAME_GRID_ROWS-1,nMaxCellY);
+    nMaxCellY = min(nGridRows-1,nMaxCellY);
     if(nMaxCellY<0)
-        return vIndices;
+        return;
 
     bool bCheckLevels=true;
     bool bSameLevel=false;
@@ -231,13 +314,9 @@ vector<size_t> Frame::GetFeaturesInArea(const float &x, const float  &y, const f
     {
         for(int iy = nMinCellY; iy<=nMaxCellY; iy++)
         {
-            vector<size_t> vCell = mGrid[ix][iy];
-            if(vCell.empty())
-                continue;
-
-            for(size_t j=0, jend=vCell.size(); j<jend; j++)
+            for(const size_t *pIdx = mGrid.CellBegin(ix,iy), *pEnd = mGrid.CellEnd(ix,iy); pIdx!=pEnd; pIdx++)
             {
-                const cv::KeyPoint &kpUn = mvKeysUn[vCell[j]];
+                const cv::KeyPoint &kpUn = mvKeysUn[*pIdx];
                 if(bCheckLevels && !bSameLevel)
                 {
                     if(kpUn.octave<minLevel || kpUn.octave>maxLevel)
@@ -252,13 +331,10 @@ vector<size_t> Frame::GetFeaturesInArea(const float &x, const float  &y, const f
                 if(abs(kpUn.pt.x-x)>r || abs(kpUn.pt.y-y)>r)
                     continue;
 
-                vIndices.push_back(vCell[j]);
+                vIndices.push_back(*pIdx);
             }
         }
     }
-
-    return vIndices;
-
 }
 
 bool Frame::PosInGrid(cv::KeyPoint &kp, int &posX, int &posY)
@@ -267,20 +343,61 @@ bool Frame::PosInGrid(cv::KeyPoint &kp, int &posX, int &posY)
     posY = round((kp.pt.y-mnMinY)*mfGridElementHeightInv);
 
     //Keypoint's coordinates are undistorted, which could cause to go out of the image
-    if(posX<0 || posX>=FRAME_GRID_COLS || posY<0 || posY>=FRAME_GRID_ROWS)
+    if(posX<0 || posX>=mpCamera->mnGridCols || posY<0 || posY>=mpCamera->mnGridRows)
         return false;
 
     return true;
 }
 
+void Frame::AssignFeaturesToGrid()
+{
+    const int nGridRows = mpCamera->mnGridRows;
+    vector<int> vKeyCells(mvKeysUn.size(),-1);
+    for(size_t i=0;i<mvKeysUn.size();i++)
+    {
+        int nGridPosX, nGridPosY;
+        if(PosInGrid(mvKeysUn[i],nGridPosX,nGridPosY))
+            vKeyCells[i] = nGridPosX*nGridRows+nGridPosY;
+    }
+    mGrid.Build(mpCamera->mnGridCols,nGridRows,vKeyCells);
+}
+
 
 void Frame::ComputeBoW()
 {
     if(mBowVec.empty())
     {
-        vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
-        mpORBvocabulary->transform(vCurrentDesc,mBowVec,mFeatVec,4);
+        mpORBvocabulary->transform(mDescriptors,mBowVec,mFeatVec,FeatureVectorLevelsUp(*mpORBvocabulary),
+                                   PoolRunner::Get(TaskPool::TRACKING));
+    }
+}
+
+int Frame::AssignDepth(const cv::Mat &depth)
+{
+    mvDepth.assign(N,-1.0f);
+    if(depth.empty() || im.empty())
+        return 0;
+
+    // The depth is registered to the raw image, so it is sampled at the distorted keypoints
+    const float sx = (float)depth.cols/im.cols;
+    const float sy = (float)depth.rows/im.rows;
+
+    int nDepth = 0;
+    for(int i=0; i<N; i++)
+    {
+        const int u = cvRound(mvKeys[i].pt.x*sx);
+        const int v = cvRound(mvKeys[i].pt.y*sy);
+        if(u<0 || v<0 || u>=depth.cols || v>=depth.rows)
+            continue;
+        const float d = depth.at<float>(v,u);
+        // Missing readings are zero or NaN
+        if(d>0)
+        {
+            mvDepth[i] = d;
+            nDepth++;
+        }
     }
+    return nDepth;
 }
 
 void Frame::UndistortKeyPoints()
@@ -291,6 +408,12 @@ void Frame::UndistortKeyPoints()
         return;
     }
 
+    if(mpCamera->mUndistortionMap.IsBuilt(im.cols,im.rows))
+    {
+        mpCamera->mUndistortionMap.Undistort(mvKeys,mvKeysUn);
+        return;
+    }
+
     // Fill matrix with points
     cv::Mat mat(mvKeys.size(),2,CV_32F);
     for(unsigned int i=0; i<mvKeys.size(); i++)
@@ -315,34 +438,4 @@ void Frame::UndistortKeyPoints()
     }
 }
 
-void Frame::ComputeImageBounds()
-{
-    if(mDistCoef.at<float>(0)!=0.0)
-    {
-        cv::Mat mat(4,2,CV_32F);
-        mat.at<float>(0,0)=0.0; mat.at<float>(0,1)=0.0;
-        mat.at<float>(1,0)=im.cols; mat.at<float>(1,1)=0.0;
-        mat.at<float>(2,0)=0.0; mat.at<float>(2,1)=im.rows;
-        mat.at<float>(3,0)=im.cols; mat.at<float>(3,1)=im.rows;
-
-        // Undistorted corners
-        mat=mat.reshape(2);
-        cv::undistortPoints(mat,mat,mK,mDistCoef,cv::Mat(),mK);
-        mat=mat.reshape(1);
-
-        mnMinX = min(floor(mat.at<float>(0,0)),floor(mat.at<float>(2,0)));
-        mnMaxX = max(ceil(mat.at<float>(1,0)),ceil(mat.at<float>(3,0)));
-        mnMinY = min(floor(mat.at<float>(0,1)),floor(mat.at<float>(1,1)));
-        mnMaxY = max(ceil(mat.at<float>(2,1)),ceil(mat.at<float>(3,1)));
-
-    }
-    else
-    {
-        mnMinX = 0;
-        mnMaxX = im.cols;
-        mnMinY = 0;
-        mnMaxY = im.rows;
-    }
-}
-
 } //namespace ORB_SLAM
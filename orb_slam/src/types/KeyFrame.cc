@@ -19,47 +19,83 @@
 */
 
 #include "types/KeyFrame.h"
+#include "types/Map.h"
+#include "types/EssentialGraph.h"
 #include "util/Converter.h"
+#include "util/AlignedAllocator.h"
+#include "util/BinaryIO.h"
+#include "util/LockProfiler.h"
+#include "util/ResidualCode.h"
+#include "util/PoolRunner.h"
 #include <ros/ros.h>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <queue>
 
 namespace ORB_SLAM
 {
 
+// Essential graph of the map of the keyframe, NULL while it has no map
+// Updated after releasing the keyframe locks
+static EssentialGraph* GetEssentialGraph(KeyFrame* pKF)
+{
+    Map* pMap = pKF->getMap();
+    return pMap ? pMap->GetEssentialGraph() : NULL;
+}
+
 long unsigned int KeyFrame::nNextId=0;
+KeyFrame::eImagePolicy KeyFrame::mImagePolicy=KeyFrame::IMAGE_KEEP;
+float KeyFrame::mfImageScale=2.0f;
+int KeyFrame::mnImageQuality=90;
 
 KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
-    mnFrameId(F.mnId),  mTimeStamp(F.mTimeStamp), mfGridElementWidthInv(F.mfGridElementWidthInv),
-    mfGridElementHeightInv(F.mfGridElementHeightInv), mnTrackReferenceForFrame(0),mnBALocalForKF(0), mnBAFixedForKF(0),
-    mnLoopQuery(0), mnRelocQuery(0),fx(F.fx), fy(F.fy), cx(F.cx), cy(F.cy), mBowVec(F.mBowVec),
-    im(F.im), mnMinX(F.mnMinX), mnMinY(F.mnMinY), mnMaxX(F.mnMaxX), mnMaxY(F.mnMaxY), mK(F.mK),
-    mvKeys(F.mvKeys), mvKeysUn(F.mvKeysUn), mDescriptors(F.mDescriptors.clone()),
+    mnFrameId(F.mnId),  mTimeStamp(F.mTimeStamp), mbPositionPrior(F.mbPositionPrior),
+    mPositionPrior(F.mPositionPrior), mfGridElementWidthInv(F.mfGridElementWidthInv),
+    mfGridElementHeightInv(F.mfGridElementHeightInv), mnBALocalForKF(0), mnBAFixedForKF(0),
+    fx(F.fx), fy(F.fy), cx(F.cx), cy(F.cy), mBowVec(F.mBowVec),
+    mnMinX(F.mnMinX), mnMinY(F.mnMinY), mnMaxX(F.mnMaxX), mnMaxY(F.mnMaxY), mK(F.mK),
+    mDescriptors(F.mDescriptors),
     mvpMapPoints(F.mvpMapPoints), mpKeyFrameDB(pKFDB), mpORBvocabulary(F.mpORBvocabulary), mFeatVec(F.mFeatVec),
-    mbFirstConnection(true), mpParent(NULL), mbNotErase(false), mbToBeErased(false), mbBad(false),
+    mbFirstConnection(true), mpParent(NULL), mnGraphRevision(0), mbNotErase(false), mbToBeErased(false), mbBad(false),
     mnScaleLevels(F.mnScaleLevels), mvScaleFactors(F.mvScaleFactors), mvLevelSigma2(F.mvLevelSigma2),
-    mvInvLevelSigma2(F.mvInvLevelSigma2), mpMap(pMap)
+    mvInvLevelSigma2(F.mvInvLevelSigma2), mpMap(pMap), mnDepthPoseVersion(0), mnDepthQuantile(0), mfSceneDepth(-1)
 {
     mnId=nNextId++;
 
-    mnGridCols=FRAME_GRID_COLS;
-    mnGridRows=FRAME_GRID_ROWS;
-    mGrid.resize(mnGridCols);
-    for(int i=0; i<mnGridCols;i++)
-    {
-        mGrid[i].resize(mnGridRows);
-        for(int j=0; j<mnGridRows; j++)
-            mGrid[i][j] = F.mGrid[i][j];
-    }
+    // Only what the image policy keeps. The frame image may be the buffer of a ROS message
+    if(mImagePolicy==IMAGE_DOWNSAMPLE)
+        cv::resize(F.im,im,cv::Size(),1.0/mfImageScale,1.0/mfImageScale,cv::INTER_AREA);
+    else if(mImagePolicy!=IMAGE_DROP)
+        im = F.mpImageOwner ? F.im.clone() : F.im;
+
+    mnGridCols=F.mGrid.Cols();
+    mnGridRows=F.mGrid.Rows();
+    mGrid = F.mGrid;
+
+    StoreKeyPoints(F.mvKeys,F.mvKeysUn);
 
     SetPose(F.mTcw);    
 }
 
+void KeyFrame::StoreKeyPoints(const vector<cv::KeyPoint> &vKeys, const vector<cv::KeyPoint> &vKeysUn)
+{
+    mKeys.Assign(vKeys,vKeysUn);
+}
+
+KeyFrame::KeyFrame():
+    mnId(0), mnFrameId(0), mTimeStamp(0), mbPositionPrior(false), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0),
+    mpKeyFrameDB(NULL), mpORBvocabulary(NULL), mbFirstConnection(true), mpParent(NULL), mnGraphRevision(0), mbNotErase(false),
+    mbToBeErased(false), mbBad(false), mnScaleLevels(0), mpMap(NULL), mnDepthPoseVersion(0), mnDepthQuantile(0), mfSceneDepth(-1)
+{
+}
+
  Map* KeyFrame::getMap() {
-    boost::mutex::scoped_lock lock(mMutexMap);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexMap);
      return mpMap;
  }
  
 void KeyFrame::setMap(Map* m) {
-    boost::mutex::scoped_lock lock(mMutexMap);
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexMap);
     mpMap = m;
 }
 
@@ -67,76 +103,109 @@ void KeyFrame::ComputeBoW()
 {
     if(mBowVec.empty() || mFeatVec.empty())
     {
-        vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
         // Feature vector associate features with nodes in the 4th level (from leaves up)
         // We assume the vocabulary tree has 6 levels, change the 4 otherwise
-        mpORBvocabulary->transform(vCurrentDesc,mBowVec,mFeatVec,4);
+        mpORBvocabulary->transform(mDescriptors,mBowVec,mFeatVec,FeatureVectorLevelsUp(*mpORBvocabulary),
+                                   PoolRunner::Get(TaskPool::LOCAL_MAPPING));
     }
 }
 
 void KeyFrame::SetPose(const cv::Mat &Rcw,const cv::Mat &tcw)
 {
-    boost::mutex::scoped_lock lock(mMutexPose);
-    Rcw.copyTo(Tcw.rowRange(0,3).colRange(0,3));
-    tcw.copyTo(Tcw.col(3).rowRange(0,3));
-
-    Ow=-Rcw.t()*tcw;
+    SetPose(Converter::toMatrix3f(Rcw),Converter::toVector3f(tcw));
 }
 
 void KeyFrame::SetPose(const cv::Mat &Tcw_)
 {
-    boost::mutex::scoped_lock lock(mMutexPose);
-    Tcw_.copyTo(Tcw);
-    cv::Mat Rcw = Tcw.rowRange(0,3).colRange(0,3);
-    cv::Mat tcw = Tcw.rowRange(0,3).col(3);
-    Ow = -Rcw.t()*tcw;
+    SetPose(Converter::toMatrix3f(Tcw_.rowRange(0,3).colRange(0,3)),Converter::toVector3f(Tcw_.rowRange(0,3).col(3)));
+}
+
+void KeyFrame::SetPose(const Eigen::Matrix3f &Rcw, const Eigen::Vector3f &tcw)
+{
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexPose);
+    mRcw = Rcw;
+    mtcw = tcw;
+    mOw = -mRcw.transpose()*mtcw;
+    PublishPose();
+}
+
+void KeyFrame::PublishPose()
+{
+    PoseSnapshot pose;
+    Eigen::Map<Eigen::Matrix<float,3,3,Eigen::RowMajor> >(pose.R) = mRcw;
+    Eigen::Map<Eigen::Vector3f>(pose.t) = mtcw;
+    Eigen::Map<Eigen::Vector3f>(pose.Ow) = mOw;
+    mPoseSnapshot.Store(pose);
+}
+
+unsigned long KeyFrame::GetPoseSnapshot(PoseSnapshot &pose) const
+{
+    return mPoseSnapshot.Load(pose);
 }
 
+unsigned long KeyFrame::GetPoseVersion() const
+{
+    return mPoseSnapshot.Version();
+}
+
+unsigned long KeyFrame::GetRevision() const
+{
+    return mPoseSnapshot.Version()+mnGraphRevision.load(boost::memory_order_relaxed);
+}
+
+// The cv::Mat getters read the snapshot too, so they never wait on a writer
+// and rotation and translation always come from the same pose
 cv::Mat KeyFrame::GetPose()
 {
-    boost::mutex::scoped_lock lock(mMutexPose);
-    return Tcw.clone();
+    PoseSnapshot pose;
+    mPoseSnapshot.Load(pose);
+    cv::Mat T = cv::Mat::eye(4,4,CV_32F);
+    cv::Mat(3,3,CV_32F,pose.R).copyTo(T.rowRange(0,3).colRange(0,3));
+    cv::Mat(3,1,CV_32F,pose.t).copyTo(T.rowRange(0,3).col(3));
+    return T;
 }
 
 cv::Mat KeyFrame::GetPoseInverse()
 {
-    boost::mutex::scoped_lock lock(mMutexPose);
-    cv::Mat Twc = cv::Mat::eye(4,4,Tcw.type());
-    cv::Mat Rwc = (Tcw.rowRange(0,3).colRange(0,3)).t();
-    cv::Mat twc = -Rwc*Tcw.rowRange(0,3).col(3);
+    PoseSnapshot pose;
+    mPoseSnapshot.Load(pose);
+    cv::Mat Twc = cv::Mat::eye(4,4,CV_32F);
+    cv::Mat Rwc = cv::Mat(3,3,CV_32F,pose.R).t();
     Rwc.copyTo(Twc.rowRange(0,3).colRange(0,3));
-    twc.copyTo(Twc.rowRange(0,3).col(3));
-    return Twc.clone();
+    cv::Mat(3,1,CV_32F,pose.Ow).copyTo(Twc.rowRange(0,3).col(3));
+    return Twc;
 }
 
 cv::Mat KeyFrame::GetProjectionMatrix()
 {
-    boost::mutex::scoped_lock lock(mMutexPose);
-    return mK*Tcw.rowRange(0,3);
+    return mK*GetPose().rowRange(0,3);
 }
 
 cv::Mat KeyFrame::GetCameraCenter()
 {
-    boost::mutex::scoped_lock lock(mMutexPose);
-    return Ow.clone();
+    PoseSnapshot pose;
+    mPoseSnapshot.Load(pose);
+    return cv::Mat(3,1,CV_32F,pose.Ow).clone();
 }
 
 cv::Mat KeyFrame::GetRotation()
 {
-    boost::mutex::scoped_lock lock(mMutexPose);
-    return Tcw.rowRange(0,3).colRange(0,3).clone();
+    PoseSnapshot pose;
+    mPoseSnapshot.Load(pose);
+    return cv::Mat(3,3,CV_32F,pose.R).clone();
 }
 
 cv::Mat KeyFrame::GetTranslation()
 {
-    boost::mutex::scoped_lock lock(mMutexPose);
-    return Tcw.rowRange(0,3).col(3).clone();
+    PoseSnapshot pose;
+    mPoseSnapshot.Load(pose);
+    return cv::Mat(3,1,CV_32F,pose.t).clone();
 }
 
 void KeyFrame::AddConnection(KeyFrame *pKF, const int &weight)
 {
     {
-        boost::mutex::scoped_lock lock(mMutexConnections);
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexConnections);
         if(!mConnectedKeyFrameWeights.count(pKF))
             mConnectedKeyFrameWeights[pKF]=weight;
         else if(mConnectedKeyFrameWeights[pKF]!=weight)
@@ -150,7 +219,8 @@ void KeyFrame::AddConnection(KeyFrame *pKF, const int &weight)
 
 void KeyFrame::UpdateBestCovisibles()
 {
-    boost::mutex::scoped_lock lock(mMutexConnections);
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexConnections);
+    mnGraphRevision.fetch_add(1,boost::memory_order_relaxed);
     vector<pair<int,KeyFrame*> > vPairs;
     vPairs.reserve(mConnectedKeyFrameWeights.size());
     for(map<KeyFrame*,int>::iterator mit=mConnectedKeyFrameWeights.begin(), mend=mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
@@ -167,11 +237,12 @@ void KeyFrame::UpdateBestCovisibles()
 
     mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
     mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());    
+    mpCovisibleList.reset();
 }
 
 set<KeyFrame*> KeyFrame::GetConnectedKeyFrames()
 {
-    boost::mutex::scoped_lock lock(mMutexConnections);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexConnections);
     set<KeyFrame*> s;
     for(map<KeyFrame*,int>::iterator mit=mConnectedKeyFrameWeights.begin();mit!=mConnectedKeyFrameWeights.end();mit++)
         s.insert(mit->first);
@@ -180,13 +251,22 @@ set<KeyFrame*> KeyFrame::GetConnectedKeyFrames()
 
 vector<KeyFrame*> KeyFrame::GetVectorCovisibleKeyFrames()
 {
-    boost::mutex::scoped_lock lock(mMutexConnections);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexConnections);
     return mvpOrderedConnectedKeyFrames;
 }
 
+KeyFrame::KeyFrameList KeyFrame::GetCovisibleList()
+{
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexConnections);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lockLists, mMutexLists);
+    if(!mpCovisibleList)
+        mpCovisibleList.reset(new vector<KeyFrame*>(mvpOrderedConnectedKeyFrames));
+    return mpCovisibleList;
+}
+
 vector<KeyFrame*> KeyFrame::GetBestCovisibilityKeyFrames(const int &N)
 {
-    boost::mutex::scoped_lock lock(mMutexConnections);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexConnections);
     if((int)mvpOrderedConnectedKeyFrames.size()<N)
         return mvpOrderedConnectedKeyFrames;
     else
@@ -196,7 +276,7 @@ vector<KeyFrame*> KeyFrame::GetBestCovisibilityKeyFrames(const int &N)
 
 vector<KeyFrame*> KeyFrame::GetCovisiblesByWeight(const int &w)
 {
-    boost::mutex::scoped_lock lock(mMutexConnections);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexConnections);
 
     if(mvpOrderedConnectedKeyFrames.empty())
         return vector<KeyFrame*>();
@@ -213,41 +293,58 @@ vector<KeyFrame*> KeyFrame::GetCovisiblesByWeight(const int &w)
 
 int KeyFrame::GetWeight(KeyFrame *pKF)
 {
-    boost::mutex::scoped_lock lock(mMutexConnections);
-    if(mConnectedKeyFrameWeights.count(pKF))
-        return mConnectedKeyFrameWeights[pKF];
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexConnections);
+    map<KeyFrame*,int>::const_iterator mit = mConnectedKeyFrameWeights.find(pKF);
+    if(mit!=mConnectedKeyFrameWeights.end())
+        return mit->second;
     else
         return 0;
 }
 
 void KeyFrame::AddMapPoint(MapPoint *pMP, const size_t &idx)
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexFeatures);
     mvpMapPoints[idx]=pMP;
+    mpMapPointMatchList.reset();
 }
 
 void KeyFrame::EraseMapPointMatch(const size_t &idx)
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexFeatures);
     mvpMapPoints[idx]=NULL;
+    mpMapPointMatchList.reset();
 }
 
 void KeyFrame::EraseMapPointMatch(MapPoint* pMP)
 {
     int idx = pMP->GetIndexInKeyFrame(this);
     if(idx>=0)
+    {
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexFeatures);
         mvpMapPoints[idx]=NULL;
+        mpMapPointMatchList.reset();
+    }
 }
 
+void KeyFrame::EraseMapPointMatches(const std::vector<std::pair<size_t,MapPoint*> > &vMatches)
+{
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    for(size_t i=0; i<vMatches.size(); i++)
+        if(vMatches[i].first<mvpMapPoints.size() && mvpMapPoints[vMatches[i].first]==vMatches[i].second)
+            mvpMapPoints[vMatches[i].first]=NULL;
+    mpMapPointMatchList.reset();
+}
 
 void KeyFrame::ReplaceMapPointMatch(const size_t &idx, MapPoint* pMP)
 {
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexFeatures);
     mvpMapPoints[idx]=pMP;
+    mpMapPointMatchList.reset();
 }
 
 set<MapPoint*> KeyFrame::GetMapPoints()
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
     set<MapPoint*> s;
     for(size_t i=0, iend=mvpMapPoints.size(); i<iend; i++)
     {
@@ -260,14 +357,14 @@ set<MapPoint*> KeyFrame::GetMapPoints()
     return s;
 }
 
-int KeyFrame::TrackedMapPoints()
+int KeyFrame::TrackedMapPoints(int nMinLevel)
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
 
     int nPoints=0;
     for(size_t i=0, iend=mvpMapPoints.size(); i<iend; i++)
     {
-        if(mvpMapPoints[i])
+        if(mvpMapPoints[i] && (nMinLevel==0 || mKeys.Octave(i)>=nMinLevel))
             nPoints++;
     }
 
@@ -276,44 +373,74 @@ int KeyFrame::TrackedMapPoints()
 
 vector<MapPoint*> KeyFrame::GetMapPointMatches()
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
     return mvpMapPoints;
 }
 
+void KeyFrame::GetMapPointMatches(vector<MapPoint*> &vpMatches)
+{
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    vpMatches.assign(mvpMapPoints.begin(),mvpMapPoints.end());
+}
+
+KeyFrame::MapPointList KeyFrame::GetMapPointMatchList()
+{
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lockLists, mMutexLists);
+    if(!mpMapPointMatchList)
+        mpMapPointMatchList.reset(new vector<MapPoint*>(mvpMapPoints));
+    return mpMapPointMatchList;
+}
+
 MapPoint* KeyFrame::GetMapPoint(const size_t &idx)
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
     return mvpMapPoints[idx];
 }
 
 cv::KeyPoint KeyFrame::GetKeyPointUn(const size_t &idx) const
 {
-    return mvKeysUn[idx];
+    return mKeys.KeyPointUn(idx,mvScaleFactors);
+}
+
+cv::Point2f KeyFrame::GetKeyPointPosUn(const size_t &idx) const
+{
+    return mKeys.Pt(idx);
+}
+
+float KeyFrame::GetKeyPointAngle(const size_t &idx) const
+{
+    return mKeys.Angle(idx);
 }
 
 int KeyFrame::GetKeyPointScaleLevel(const size_t &idx) const
 {
-    return mvKeysUn[idx].octave;
+    return mKeys.Octave(idx);
 }
 
-cv::Mat KeyFrame::GetDescriptor(const size_t &idx)
+const KeyPointArray& KeyFrame::GetKeyPointArray() const
 {
-    return mDescriptors.row(idx).clone();
+    return mKeys;
 }
 
 cv::Mat KeyFrame::GetDescriptors()
 {
-    return mDescriptors.clone();
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    return mDescriptors;
 }
 
 vector<cv::KeyPoint> KeyFrame::GetKeyPoints() const
 {
-    return mvKeys;
+    vector<cv::KeyPoint> vKeys;
+    mKeys.GetKeyPoints(vKeys,mvScaleFactors);
+    return vKeys;
 }
 
 vector<cv::KeyPoint> KeyFrame::GetKeyPointsUn() const
 {
-    return mvKeysUn;
+    vector<cv::KeyPoint> vKeysUn;
+    mKeys.GetKeyPointsUn(vKeysUn,mvScaleFactors);
+    return vKeysUn;
 }
 
 cv::Mat KeyFrame::GetCalibrationMatrix() const
@@ -321,55 +448,109 @@ cv::Mat KeyFrame::GetCalibrationMatrix() const
     return mK.clone();
 }
 
-DBoW2::FeatureVector KeyFrame::GetFeatureVector()
+DBoW2::FlatFeatureVector KeyFrame::GetFeatureVector()
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
     return mFeatVec;
 }
 
+void KeyFrame::GetFeatureVector(DBoW2::FlatFeatureVector &featVec)
+{
+    // Assignment reuses the buffers featVec already has
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    featVec = mFeatVec;
+}
+
 DBoW2::BowVector KeyFrame::GetBowVector()
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
     return mBowVec;
 }
 
+void KeyFrame::GetFlatBowVector(DBoW2::FlatBowVector &vFlatBow)
+{
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lockFlat, mMutexFlatBow);
+    if(mFlatBowVec.size()!=mBowVec.size())
+        mFlatBowVec.assign(mBowVec);
+    vFlatBow = mFlatBowVec;
+}
+
 cv::Mat KeyFrame::GetImage()
 {
-    boost::mutex::scoped_lock lock(mMutexImage);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexImage);
+    if(im.empty() && !mvImageJpeg.empty())
+        return cv::imdecode(mvImageJpeg,CV_LOAD_IMAGE_UNCHANGED);
     return im.clone();
 }
 
-void KeyFrame::UpdateConnections()
+void KeyFrame::SetImagePolicy(eImagePolicy policy, float fScale, int nQuality)
 {
-    map<KeyFrame*,int> KFcounter;
+    mImagePolicy = policy;
+    if(fScale>1.0f)
+        mfImageScale = fScale;
+    if(nQuality>0 && nQuality<=100)
+        mnImageQuality = nQuality;
+}
 
-    vector<MapPoint*> vpMP;
+void KeyFrame::CompressImage()
+{
+    if(mImagePolicy!=IMAGE_JPEG)
+        return;
 
+    cv::Mat image;
     {
-        boost::mutex::scoped_lock lockMPs(mMutexFeatures);
-        vpMP = mvpMapPoints;
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexImage);
+        image = im;
     }
+    if(image.empty())
+        return;
 
-    //For all map points in keyframe check in which other keyframes are they seen
-    //Increase counter for those keyframes
-    for(vector<MapPoint*>::iterator vit=vpMP.begin(), vend=vpMP.end(); vit!=vend; vit++)
-    {
-        MapPoint* pMP = *vit;
+    vector<int> vParams(2);
+    vParams[0] = CV_IMWRITE_JPEG_QUALITY;
+    vParams[1] = mnImageQuality;
+    vector<uchar> vJpeg;
+    if(!cv::imencode(".jpg",image,vJpeg,vParams))
+        return;
 
-        if(!pMP)
-            continue;
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexImage);
+    // Released meanwhile
+    if(im.data!=image.data)
+        return;
+    im.release();
+    mvImageJpeg.swap(vJpeg);
+}
 
-        if(pMP->isBad())
-            continue;
+void KeyFrame::ChangeCovisibility(KeyFrame* pKF, int delta)
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexCovisibility);
+    map<KeyFrame*,int>::iterator mit = mCovisibilityCounts.insert(make_pair(pKF,0)).first;
+    mit->second+=delta;
+    if(mit->second<=0)
+        mCovisibilityCounts.erase(mit);
+}
 
-        map<KeyFrame*,size_t> observations = pMP->GetObservations();
+void KeyFrame::ChangeCovisibility(const map<KeyFrame*,int> &deltas)
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexCovisibility);
+    for(map<KeyFrame*,int>::const_iterator dit=deltas.begin(), dend=deltas.end(); dit!=dend; dit++)
+    {
+        if(dit->second==0)
+            continue;
+        map<KeyFrame*,int>::iterator mit = mCovisibilityCounts.insert(make_pair(dit->first,0)).first;
+        mit->second+=dit->second;
+        if(mit->second<=0)
+            mCovisibilityCounts.erase(mit);
+    }
+}
 
-        for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-        {
-            if(mit->first->mnId==mnId)
-                continue;
-            KFcounter[mit->first]++;
-        }
+void KeyFrame::UpdateConnections()
+{
+    //The map points observed by this keyframe keep the number of them seen by each other keyframe
+    map<KeyFrame*,int> KFcounter;
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexCovisibility);
+        KFcounter = mCovisibilityCounts;
     }
 
     if(KFcounter.empty())
@@ -412,85 +593,119 @@ void KeyFrame::UpdateConnections()
         lWs.push_front(vPairs[i].first);
     }
 
+    map<KeyFrame*,int> previousWeights;
+    KeyFrame* pNewParent = NULL;
     {
-        boost::mutex::scoped_lock lockCon(mMutexConnections);
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lockCon, mMutexConnections);
 
         // mspConnectedKeyFrames = spConnectedKeyFrames;
+        previousWeights.swap(mConnectedKeyFrameWeights);
         mConnectedKeyFrameWeights = KFcounter;
         mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
         mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());
+        mpCovisibleList.reset();
+        mnGraphRevision.fetch_add(1,boost::memory_order_relaxed);
 
         if(mbFirstConnection && mnId!=0)
         {
             mpParent = mvpOrderedConnectedKeyFrames.front();
             mpParent->AddChild(this);
             mbFirstConnection = false;
+            pNewParent = mpParent;
         }
 
     }
+
+    EssentialGraph* pGraph = GetEssentialGraph(this);
+    if(pGraph)
+    {
+        for(map<KeyFrame*,int>::iterator mit=KFcounter.begin(), mend=KFcounter.end(); mit!=mend; mit++)
+            pGraph->SetWeight(this,mit->first,mit->second);
+        for(map<KeyFrame*,int>::iterator mit=previousWeights.begin(), mend=previousWeights.end(); mit!=mend; mit++)
+            if(!KFcounter.count(mit->first))
+                pGraph->SetWeight(this,mit->first,0);
+        if(pNewParent)
+            pGraph->SetParent(this,NULL,pNewParent);
+    }
 }
 
 void KeyFrame::AddChild(KeyFrame *pKF)
 {
-    boost::mutex::scoped_lock lockCon(mMutexConnections);
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lockCon, mMutexConnections);
     mspChildrens.insert(pKF);
 }
 
 void KeyFrame::EraseChild(KeyFrame *pKF)
 {
-    boost::mutex::scoped_lock lockCon(mMutexConnections);
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lockCon, mMutexConnections);
     mspChildrens.erase(pKF);
 }
 
 
 void KeyFrame::ChangeParent(KeyFrame *pKF)
 {
-    boost::mutex::scoped_lock lockCon(mMutexConnections);
-    mpParent = pKF;
-    pKF->AddChild(this);
+    KeyFrame* pOldParent;
+    {
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lockCon, mMutexConnections);
+        mnGraphRevision.fetch_add(1,boost::memory_order_relaxed);
+        pOldParent = mpParent;
+        mpParent = pKF;
+        pKF->AddChild(this);
+    }
+
+    EssentialGraph* pGraph = GetEssentialGraph(this);
+    if(pGraph)
+        pGraph->SetParent(this,pOldParent,pKF);
 }
 
 set<KeyFrame*> KeyFrame::GetChilds()
 {
-    boost::mutex::scoped_lock lockCon(mMutexConnections);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lockCon, mMutexConnections);
     return mspChildrens;
 }
 
 KeyFrame* KeyFrame::GetParent()
 {
-    boost::mutex::scoped_lock lockCon(mMutexConnections);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lockCon, mMutexConnections);
     return mpParent;
 }
 
 bool KeyFrame::hasChild(KeyFrame *pKF)
 {
-    boost::mutex::scoped_lock lockCon(mMutexConnections);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lockCon, mMutexConnections);
     return mspChildrens.count(pKF);
 }
 
 void KeyFrame::AddLoopEdge(KeyFrame *pKF)
 {
-    boost::mutex::scoped_lock lockCon(mMutexConnections);
-    mbNotErase = true;
-    mspLoopEdges.insert(pKF);
+    {
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lockCon, mMutexConnections);
+        mnGraphRevision.fetch_add(1,boost::memory_order_relaxed);
+        mbNotErase = true;
+        mspLoopEdges.insert(pKF);
+    }
+
+    EssentialGraph* pGraph = GetEssentialGraph(this);
+    if(pGraph)
+        pGraph->AddLoopEdge(this,pKF);
 }
 
 set<KeyFrame*> KeyFrame::GetLoopEdges()
 {
-    boost::mutex::scoped_lock lockCon(mMutexConnections);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lockCon, mMutexConnections);
     return mspLoopEdges;
 }
 
 void KeyFrame::SetNotErase()
 {
-    boost::mutex::scoped_lock lock(mMutexConnections);
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexConnections);
     mbNotErase = true;
 }
 
 void KeyFrame::SetErase()
 {
     {
-        boost::mutex::scoped_lock lock(mMutexConnections);
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexConnections);
         if(mspLoopEdges.empty())
         {
             mbNotErase = false;
@@ -507,7 +722,7 @@ void KeyFrame::SetErase()
 void KeyFrame::SetBadFlag()
 {   
     {
-        boost::mutex::scoped_lock lock(mMutexConnections);
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexConnections);
         if(mnId==0)
             return;
         else if(mbNotErase)
@@ -523,61 +738,79 @@ void KeyFrame::SetBadFlag()
     for(size_t i=0; i<mvpMapPoints.size(); i++)
         if(mvpMapPoints[i])
             mvpMapPoints[i]->EraseObservation(this);
+
+    // Shared points this keyframe does not list are dropped from the counts as well,
+    // so no other keyframe connects to it again
+    map<KeyFrame*,int> covisibility;
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexCovisibility);
+        covisibility.swap(mCovisibilityCounts);
+    }
+    for(map<KeyFrame*,int>::iterator mit=covisibility.begin(), mend=covisibility.end(); mit!=mend; mit++)
+        mit->first->ChangeCovisibility(this,-mit->second);
+
     {
-        boost::mutex::scoped_lock lock(mMutexConnections);
-        boost::mutex::scoped_lock lock1(mMutexFeatures);
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexConnections);
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock1, mMutexFeatures);
 
         mConnectedKeyFrameWeights.clear();
         mvpOrderedConnectedKeyFrames.clear();
+        mpCovisibleList.reset();
 
-        // Update Spanning Tree
-        set<KeyFrame*> sParentCandidates;
-        sParentCandidates.insert(mpParent);
+        // The points may be freed once they are culled, this keyframe no longer observes them
+        for(size_t i=0; i<mvpMapPoints.size(); i++)
+            mvpMapPoints[i]=static_cast<MapPoint*>(NULL);
+        mpMapPointMatchList.reset();
 
-        // Assign at each iteration one children with a parent (the pair with highest covisibility weight)
-        // Include that children as new parent candidate for the rest
-        while(!mspChildrens.empty())
+        // Update Spanning Tree
+        // Each child is linked, in order of weight, to its most covisible keyframe among the parent of this
+        // keyframe and the children linked so far (maximum spanning tree grown from the parent, as Prim's)
+        // The weights of each child are read once, the cost is O(E log E) in the links between them
+        typedef pair<KeyFrame*,int> WeightedLink;
+        map<KeyFrame*,vector<WeightedLink> > mLinkedChildren; // children by candidate parent, with their weight
+        for(set<KeyFrame*>::iterator sit=mspChildrens.begin(), send=mspChildrens.end(); sit!=send; sit++)
         {
-            bool bContinue = false;
-
-            int max = -1;
-            KeyFrame* pC;
-            KeyFrame* pP;
+            KeyFrame* pC = *sit;
+            if(pC->isBad())
+                continue;
 
-            for(set<KeyFrame*>::iterator sit=mspChildrens.begin(), send=mspChildrens.end(); sit!=send; sit++)
+            // The links of its covisible list only, the weak ones cut by UpdateConnections are no candidates
+            PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lockChild, pC->mMutexConnections);
+            for(size_t i=0, iend=pC->mvpOrderedConnectedKeyFrames.size(); i<iend; i++)
             {
-                KeyFrame* pKF = *sit;
-                if(pKF->isBad())
-                    continue;
+                KeyFrame* pP = pC->mvpOrderedConnectedKeyFrames[i];
+                if(pP==mpParent || (pP!=pC && mspChildrens.count(pP)))
+                    mLinkedChildren[pP].push_back(make_pair(pC,pC->mvOrderedWeights[i]));
+            }
+        }
 
-                // Check if a parent candidate is connected to the keyframe
-                vector<KeyFrame*> vpConnected = pKF->GetVectorCovisibleKeyFrames();
-                for(size_t i=0, iend=vpConnected.size(); i<iend; i++)
-                {
-                    for(set<KeyFrame*>::iterator spcit=sParentCandidates.begin(), spcend=sParentCandidates.end(); spcit!=spcend; spcit++)
-                    {
-                        if(vpConnected[i]->mnId == (*spcit)->mnId)
-                        {
-                            int w = pKF->GetWeight(vpConnected[i]);
-                            if(w>max)
-                            {
-                                pC = pKF;
-                                pP = vpConnected[i];
-                                max = w;
-                                bContinue = true;
-                            }
-                        }
-                    }
-                }
+        // Heap of (weight, (child, parent)) for the children linked to a candidate parent
+        priority_queue<pair<int,pair<KeyFrame*,KeyFrame*> > > qLinks;
+        KeyFrame* pCandidate = mpParent;
+        while(true)
+        {
+            map<KeyFrame*,vector<WeightedLink> >::iterator mit = mLinkedChildren.find(pCandidate);
+            if(mit!=mLinkedChildren.end())
+            {
+                for(size_t i=0, iend=mit->second.size(); i<iend; i++)
+                    if(mspChildrens.count(mit->second[i].first))
+                        qLinks.push(make_pair(mit->second[i].second,make_pair(mit->second[i].first,pCandidate)));
             }
 
-            if(bContinue)
+            // Best link of a child still to assign
+            pCandidate = NULL;
+            while(!qLinks.empty() && !pCandidate)
             {
+                KeyFrame* pC = qLinks.top().second.first;
+                KeyFrame* pP = qLinks.top().second.second;
+                qLinks.pop();
+                if(!mspChildrens.count(pC))
+                    continue;
                 pC->ChangeParent(pP);
-                sParentCandidates.insert(pC);
                 mspChildrens.erase(pC);
+                pCandidate = pC;
             }
-            else
+            if(!pCandidate)
                 break;
         }
 
@@ -597,9 +830,217 @@ void KeyFrame::SetBadFlag()
     mpKeyFrameDB->erase(this);
 }
 
+void KeyFrame::ReleaseData()
+{
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexImage);
+        im.release();
+        vector<uchar>().swap(mvImageJpeg);
+    }
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    mDescriptors.release();
+    mBowVec.clear();
+    mFeatVec.clear();
+    vector<CompactFeature>().swap(mvCompactFeatures);
+    vector<unsigned char>().swap(mvCompactCodes);
+}
+
+void KeyFrame::WritePayload(std::ostream &f)
+{
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexImage);
+        BinaryIO::Write(f,im);
+        BinaryIO::WritePodVector(f,mvImageJpeg);
+    }
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    vector<cv::KeyPoint> vKeys, vKeysUn;
+    mKeys.GetKeyPoints(vKeys,mvScaleFactors);
+    mKeys.GetKeyPointsUn(vKeysUn,mvScaleFactors);
+    BinaryIO::Write(f,vKeys);
+    BinaryIO::Write(f,vKeysUn);
+    BinaryIO::Write(f,mDescriptors);
+    BinaryIO::Write(f,mFeatVec);
+}
+
+bool KeyFrame::ReadPayload(std::istream &f)
+{
+    cv::Mat image;
+    vector<uchar> vImageJpeg;
+    cv::Mat descriptors;
+    descriptors.allocator = AlignedAllocator::Get();
+    vector<cv::KeyPoint> vKeys, vKeysUn;
+    DBoW2::FlatFeatureVector featVec;
+    if(!BinaryIO::Read(f,image) || !BinaryIO::ReadPodVector(f,vImageJpeg) || !BinaryIO::Read(f,vKeys) || !BinaryIO::Read(f,vKeysUn) ||
+       !BinaryIO::Read(f,descriptors) || !BinaryIO::Read(f,featVec))
+        return false;
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexImage);
+        im = image;
+        mvImageJpeg.swap(vImageJpeg);
+    }
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    StoreKeyPoints(vKeys,vKeysUn);
+    mDescriptors = descriptors;
+    mFeatVec.swap(featVec);
+    vector<CompactFeature>().swap(mvCompactFeatures);
+    vector<unsigned char>().swap(mvCompactCodes);
+    return true;
+}
+
+void KeyFrame::ReleasePayload()
+{
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexImage);
+        im.release();
+        vector<uchar>().swap(mvImageJpeg);
+    }
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    mKeys.ReleasePositions();
+    mDescriptors.release();
+    DBoW2::FlatFeatureVector().swap(mFeatVec);
+}
+
+// Descriptor of the word a compact feature is coded against, none without a vocabulary
+static const unsigned char* WordDescriptor(ORBVocabulary* pVocabulary, unsigned int word)
+{
+    static const unsigned char none[ResidualCode::L] = {0};
+    if(!pVocabulary || pVocabulary->empty())
+        return none;
+    return pVocabulary->getWord(word).ptr<unsigned char>();
+}
+
+void KeyFrame::CompactPayload()
+{
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexImage);
+        im.release();
+        vector<uchar>().swap(mvImageJpeg);
+    }
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexFeatures);
+
+    // The feature vector gives the node of each feature
+    vector<unsigned int> vNodes(mvpMapPoints.size(),0);
+    for(size_t i=0; i<mFeatVec.size(); i++)
+    {
+        const unsigned int* pFeatures = mFeatVec.featuresBegin(i);
+        for(unsigned int j=0, jend=mFeatVec.featureCount(i); j<jend; j++)
+            vNodes[pFeatures[j]] = mFeatVec.nodes[i];
+    }
+
+    // Each descriptor is coded against the word it falls in, from which it differs in a few bits
+    const bool bVocabulary = mpORBvocabulary && !mpORBvocabulary->empty();
+    vector<CompactFeature> vFeatures;
+    vector<unsigned char> vCodes;
+    for(size_t i=0; i<mvpMapPoints.size() && mKeys.HasPositions() && i<mKeys.size() && i<(size_t)mDescriptors.rows; i++)
+    {
+        if(!mvpMapPoints[i])
+            continue;
+        const cv::Mat descriptor = mDescriptors.row(i);
+        CompactFeature feature;
+        feature.idx = i;
+        feature.node = vNodes[i];
+        feature.word = bVocabulary ? mpORBvocabulary->transform(descriptor) : 0;
+        feature.x = mKeys.X(i);
+        feature.y = mKeys.Y(i);
+        feature.angle = mKeys.Angle(i);
+        vFeatures.push_back(feature);
+        ResidualCode::Encode(descriptor.ptr<unsigned char>(),WordDescriptor(mpORBvocabulary,feature.word),vCodes);
+    }
+
+    mvCompactFeatures.swap(vFeatures);
+    vector<unsigned char>(vCodes).swap(mvCompactCodes);
+
+    mKeys.ReleasePositions();
+    mDescriptors.release();
+    DBoW2::FlatFeatureVector().swap(mFeatVec);
+}
+
+void KeyFrame::ExpandPayload()
+{
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    if(mvCompactFeatures.empty() || mKeys.HasPositions())
+        return;
+
+    // Blank features are out of the image, never in an area searched
+    const size_t N = mvpMapPoints.size();
+    mKeys.AllocatePositions();
+
+    cv::Mat descriptors;
+    descriptors.allocator = AlignedAllocator::Get();
+    descriptors.create(N,ResidualCode::L,CV_8U);
+    descriptors.setTo(cv::Scalar(0));
+    vector<pair<DBoW2::NodeId,unsigned int> > vNodeFeatures;
+    vNodeFeatures.reserve(mvCompactFeatures.size());
+    const unsigned char* pCode = mvCompactCodes.empty() ? NULL : &mvCompactCodes[0];
+    for(size_t i=0; i<mvCompactFeatures.size(); i++)
+    {
+        const CompactFeature &feature = mvCompactFeatures[i];
+        mKeys.SetPosition(feature.idx,feature.x,feature.y,feature.angle);
+        pCode = ResidualCode::Decode(pCode,WordDescriptor(mpORBvocabulary,feature.word),descriptors.ptr<unsigned char>(feature.idx));
+        vNodeFeatures.push_back(make_pair(feature.node,feature.idx));
+    }
+
+    DBoW2::FlatFeatureVector featVec;
+    featVec.assign(vNodeFeatures);
+
+    // Only the undistorted keypoints are restored, the distorted ones are those of the image shown
+    mDescriptors = descriptors;
+    mFeatVec.swap(featVec);
+}
+
+size_t KeyFrame::PayloadBytes()
+{
+    size_t nBytes = 0;
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexImage);
+        nBytes += im.total()*im.elemSize();
+        nBytes += mvImageJpeg.capacity();
+    }
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    nBytes += mKeys.HeapBytes();
+    nBytes += mDescriptors.total()*mDescriptors.elemSize();
+    nBytes += MemoryStats::VectorBytes(mFeatVec.nodes)+MemoryStats::VectorBytes(mFeatVec.offsets)+
+              MemoryStats::VectorBytes(mFeatVec.features);
+    return nBytes;
+}
+
+void KeyFrame::AccountMemory(MemoryStats &stats)
+{
+    stats.mnKeyFrames++;
+    stats.Add(MemoryStats::KEYFRAME_OBJECTS,sizeof(KeyFrame)+MemoryStats::MatBytes(mK)+
+              3*mvScaleFactors.capacity()*sizeof(float));
+    stats.Add(MemoryStats::KEYFRAME_BOW,MemoryStats::TreeBytes(mBowVec));
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexFlatBow);
+        stats.Add(MemoryStats::KEYFRAME_BOW,MemoryStats::VectorBytes(mFlatBowVec.ids)+
+                  MemoryStats::VectorBytes(mFlatBowVec.values));
+    }
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexImage);
+        stats.Add(MemoryStats::KEYFRAME_IMAGES,MemoryStats::MatBytes(im)+MemoryStats::VectorBytes(mvImageJpeg));
+    }
+    {
+        PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
+        stats.Add(MemoryStats::KEYFRAME_KEYPOINTS,mKeys.HeapBytes()+mGrid.HeapBytes());
+        stats.Add(MemoryStats::KEYFRAME_KEYPOINTS,MemoryStats::VectorBytes(mvCompactFeatures));
+        stats.Add(MemoryStats::KEYFRAME_DESCRIPTORS,MemoryStats::MatBytes(mDescriptors)+MemoryStats::VectorBytes(mvCompactCodes));
+        stats.Add(MemoryStats::KEYFRAME_BOW,MemoryStats::VectorBytes(mFeatVec.nodes)+
+                  MemoryStats::VectorBytes(mFeatVec.offsets)+MemoryStats::VectorBytes(mFeatVec.features));
+        stats.Add(MemoryStats::KEYFRAME_GRAPH,MemoryStats::VectorBytes(mvpMapPoints));
+    }
+    {
+        PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexConnections);
+        stats.Add(MemoryStats::KEYFRAME_GRAPH,MemoryStats::TreeBytes(mConnectedKeyFrameWeights)+
+                  MemoryStats::VectorBytes(mvpOrderedConnectedKeyFrames)+MemoryStats::VectorBytes(mvOrderedWeights)+
+                  MemoryStats::TreeBytes(mspChildrens)+MemoryStats::TreeBytes(mspLoopEdges));
+    }
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexCovisibility);
+    stats.Add(MemoryStats::KEYFRAME_GRAPH,MemoryStats::TreeBytes(mCovisibilityCounts));
+}
+
 bool KeyFrame::isBad()
 {
-    boost::mutex::scoped_lock lock(mMutexConnections);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexConnections);
     return mbBad;
 }
 
@@ -607,7 +1048,7 @@ void KeyFrame::EraseConnection(KeyFrame* pKF)
 {
     bool bUpdate = false;
     {
-        boost::mutex::scoped_lock lock(mMutexConnections);
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexConnections);
         if(mConnectedKeyFrameWeights.count(pKF))
         {
             mConnectedKeyFrameWeights.erase(pKF);
@@ -616,49 +1057,58 @@ void KeyFrame::EraseConnection(KeyFrame* pKF)
     }
 
     if(bUpdate)
+    {
         UpdateBestCovisibles();
+
+        EssentialGraph* pGraph = GetEssentialGraph(this);
+        if(pGraph)
+            pGraph->SetWeight(this,pKF,0);
+    }
 }
 
 vector<size_t> KeyFrame::GetFeaturesInArea(const float &x, const float &y, const float &r) const
 {
     vector<size_t> vIndices;
-    vIndices.reserve(mvKeysUn.size());
+    vIndices.reserve(mKeys.size());
+    GetFeaturesInArea(x,y,r,vIndices);
+    return vIndices;
+}
+
+void KeyFrame::GetFeaturesInArea(const float &x, const float &y, const float &r, vector<size_t> &vIndices) const
+{
+    vIndices.clear();
 
     int nMinCellX = floor((x-mnMinX-r)*mfGridElementWidthInv);
     nMinCellX = max(0,nMinCellX);
     if(nMinCellX>=mnGridCols)
-        return vIndices;
+        return;
 
     int nMaxCellX = ceil((x-mnMinX+r)*mfGridElementWidthInv);
     nMaxCellX = min(mnGridCols-1,nMaxCellX);
     if(nMaxCellX<0)
-        return vIndices;
+        return;
 
     int nMinCellY = floor((y-mnMinY-r)*mfGridElementHeightInv);
     nMinCellY = max(0,nMinCellY);
     if(nMinCellY>=mnGridRows)
-        return vIndices;
+        return;
 
     int nMaxCellY = ceil((y-mnMinY+r)*mfGridElementHeightInv);
     nMaxCellY = min(mnGridRows-1,nMaxCellY);
     if(nMaxCellY<0)
-        return vIndices;
+        return;
 
     for(int ix = nMinCellX; ix<=nMaxCellX; ix++)
     {
         for(int iy = nMinCellY; iy<=nMaxCellY; iy++)
         {
-            vector<size_t> vCell = mGrid[ix][iy];
-            for(size_t j=0, jend=vCell.size(); j<jend; j++)
+            for(const size_t *pIdx = mGrid.CellBegin(ix,iy), *pEnd = mGrid.CellEnd(ix,iy); pIdx!=pEnd; pIdx++)
             {
-                const cv::KeyPoint &kpUn = mvKeysUn[vCell[j]];
-                if(abs(kpUn.pt.x-x)<=r && abs(kpUn.pt.y-y)<=r)
-                    vIndices.push_back(vCell[j]);
+                if(fabs(mKeys.X(*pIdx)-x)<=r && fabs(mKeys.Y(*pIdx)-y)<=r)
+                    vIndices.push_back(*pIdx);
             }
         }
     }
-
-    return vIndices;
 }
 
 bool KeyFrame::IsInImage(const float &x, const float &y) const
@@ -668,34 +1118,47 @@ bool KeyFrame::IsInImage(const float &x, const float &y) const
 
 float KeyFrame::ComputeSceneMedianDepth(int q)
 {
-    vector<MapPoint*> vpMapPoints;
-    cv::Mat Tcw_;
+    // Any change of the matches builds a new match list, so the list and the pose version tell whether the depths
+    // changed. The points are not watched, they are moved by the optimizations that move the keyframes observing them
+    MapPointList pMatches = GetMapPointMatchList();
+    PoseSnapshot pose;
+    const unsigned long nPoseVersion = mPoseSnapshot.Load(pose);
+
     {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
-    boost::mutex::scoped_lock lock2(mMutexPose);
-    vpMapPoints = mvpMapPoints;
-    Tcw_ = Tcw.clone();
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexSceneDepth);
+        if(mpDepthMatchList==pMatches && mnDepthPoseVersion==nPoseVersion && mnDepthQuantile==q)
+            return mfSceneDepth;
     }
 
+    const vector<MapPoint*> &vpMapPoints = *pMatches;
     vector<float> vDepths;
-    vDepths.reserve(mvpMapPoints.size());
-    cv::Mat Rcw2 = Tcw_.row(2).colRange(0,3);
-    Rcw2 = Rcw2.t();
-    float zcw = Tcw_.at<float>(2,3);
-    for(size_t i=0; i<mvpMapPoints.size(); i++)
+    vDepths.reserve(vpMapPoints.size());
+    const Eigen::Vector3f Rcw2 = pose.Rcw().row(2).transpose();
+    const float zcw = pose.t[2];
+    for(size_t i=0; i<vpMapPoints.size(); i++)
     {
-        if(mvpMapPoints[i])
+        if(vpMapPoints[i])
         {
-            MapPoint* pMP = mvpMapPoints[i];
-            cv::Mat x3Dw = pMP->GetWorldPos();
-            float z = Rcw2.dot(x3Dw)+zcw;
+            MapPoint* pMP = vpMapPoints[i];
+            const float z = Rcw2.dot(pMP->GetWorldPosEigen())+zcw;
             vDepths.push_back(z);
         }
     }
 
-    sort(vDepths.begin(),vDepths.end());
+    float depth = -1;
+    if(!vDepths.empty())
+    {
+        vector<float>::iterator nth = vDepths.begin()+(vDepths.size()-1)/q;
+        nth_element(vDepths.begin(),nth,vDepths.end());
+        depth = *nth;
+    }
 
-    return vDepths[(vDepths.size()-1)/q];
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexSceneDepth);
+    mpDepthMatchList = pMatches;
+    mnDepthPoseVersion = nPoseVersion;
+    mnDepthQuantile = q;
+    mfSceneDepth = depth;
+    return depth;
 }
 
 } //namespace ORB_SLAM
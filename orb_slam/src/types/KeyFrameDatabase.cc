@@ -20,117 +20,596 @@
 
 #include "types/KeyFrameDatabase.h"
 #include "types/KeyFrame.h"
+#include "types/Map.h"
 
 #include "dbow2/BowVector.h"
+#include "util/LockProfiler.h"
 #include <ros/ros.h>
+#include <cmath>
+#include <algorithm>
 
 using namespace std;
 
 namespace ORB_SLAM
 {
 
-KeyFrameDatabase::KeyFrameDatabase (const ORBVocabulary &voc):
-    mpVoc(&voc)
+// Compaction is triggered when this many slots are erased, and they are at least half of the slots
+static const unsigned int MIN_TOMBSTONES_COMPACT = 64;
+
+// The score cache is dropped when it grows above this many entries. The scores are mostly reused
+// while the same keyframe goes through loop closing and map merging, old pairs are rarely queried again
+static const size_t MAX_CACHED_SCORES = 200000;
+
+// Keyframes without a map are kept, as the database of a single map always did
+static bool IsIgnored(KeyFrame* pKF, Map* pIgnoreMap)
+{
+    Map* pMap = pKF->getMap();
+    if(!pMap)
+        return false;
+    return pMap==pIgnoreMap || pMap->getErased();
+}
+
+// Number of words two flat bags of words share
+static int CountSharedWords(const DBoW2::FlatBowVector &v1, const DBoW2::FlatBowVector &v2)
+{
+    int nShared = 0;
+    size_t i=0, j=0;
+    while(i<v1.ids.size() && j<v2.ids.size())
+    {
+        if(v1.ids[i]<v2.ids[j])
+            i++;
+        else if(v2.ids[j]<v1.ids[i])
+            j++;
+        else
+        {
+            nShared++;
+            i++;
+            j++;
+        }
+    }
+    return nShared;
+}
+
+// Orders the slots by decreasing coarse score
+struct CoarseScoreGreater
+{
+    const vector<float>* pvScores;
+    bool operator()(unsigned int a, unsigned int b) const { return (*pvScores)[a]>(*pvScores)[b]; }
+};
+
+KeyFrameDatabase::KeyFrameDatabase (const ORBVocabulary &voc, KeyFrameDatabase* pGlobalDB):
+    mpVoc(&voc), mpGlobalDB(pGlobalDB), mbSparse(pGlobalDB!=NULL), mnShortlist(0), mnCoarseLevelsUp(0),
+    mfPriorRadius(0), mnTombstones(0), mpPending(NULL)
 {
-    mvInvertedFile.resize(voc.size());
+    if(!mbSparse)
+        mvInvertedFile.resize(voc.size());
+}
+
+KeyFrameDatabase::~KeyFrameDatabase()
+{
+    PendingKeyFrame* pPending = mpPending.exchange(NULL);
+    while(pPending)
+    {
+        PendingKeyFrame* pNext = pPending->pNext;
+        delete pPending;
+        pPending = pNext;
+    }
 }
 
 void KeyFrameDatabase::add(KeyFrame *pKF)
 {
-    boost::mutex::scoped_lock lock(mMutex);
+    if(mpGlobalDB)
+        mpGlobalDB->add(pKF);
+
+    // Lock-free push, the index is updated by the next query or erase
+    PendingKeyFrame* pPending = new PendingKeyFrame;
+    pPending->pKF = pKF;
+    pPending->pNext = mpPending.load();
+    while(!mpPending.compare_exchange_weak(pPending->pNext,pPending))
+        ;
+}
+
+void KeyFrameDatabase::ApplyPending()
+{
+    PendingKeyFrame* pPending = mpPending.exchange(NULL);
+
+    // The keyframes are indexed in the order they were added
+    vector<KeyFrame*> vpKFs;
+    while(pPending)
+    {
+        PendingKeyFrame* pNext = pPending->pNext;
+        vpKFs.push_back(pPending->pKF);
+        delete pPending;
+        pPending = pNext;
+    }
+
+    for(vector<KeyFrame*>::reverse_iterator vit=vpKFs.rbegin(), vend=vpKFs.rend(); vit!=vend; vit++)
+        Insert(*vit);
+}
+
+void KeyFrameDatabase::Insert(KeyFrame *pKF)
+{
+    // A keyframe is only indexed once
+    if(mmSlots.count(pKF))
+        return;
+
+    const unsigned int slot = mvpSlotKeyFrames.size();
+    mvpSlotKeyFrames.push_back(pKF);
+    mmSlots[pKF] = slot;
 
     for(DBoW2::BowVector::const_iterator vit= pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
-        mvInvertedFile[vit->first].push_back(pKF);
+    {
+        Posting posting;
+        posting.slot = slot;
+        posting.weight = vit->second;
+        if(mbSparse)
+            mSparseInvertedFile[vit->first].push_back(posting);
+        else
+            mvInvertedFile[vit->first].push_back(posting);
+    }
+
+    if(mnShortlist>0)
+        InsertCoarse(slot,pKF);
 }
 
-void KeyFrameDatabase::erase(KeyFrame* pKF)
+void KeyFrameDatabase::CoarseBow(const DBoW2::BowVector &vBow, map<DBoW2::NodeId,DBoW2::WordValue> &mCoarseBow) const
+{
+    mCoarseBow.clear();
+    for(DBoW2::BowVector::const_iterator vit=vBow.begin(), vend=vBow.end(); vit!=vend; vit++)
+        mCoarseBow[mpVoc->getParentNode(vit->first,mnCoarseLevelsUp)] += vit->second;
+}
+
+void KeyFrameDatabase::InsertCoarse(unsigned int slot, KeyFrame *pKF)
 {
-    boost::mutex::scoped_lock lock(mMutex);
+    map<DBoW2::NodeId,DBoW2::WordValue> mCoarseBow;
+    CoarseBow(pKF->mBowVec,mCoarseBow);
 
-    // Erase elements in the Inverse File for the entry
-    for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
+    for(map<DBoW2::NodeId,DBoW2::WordValue>::const_iterator mit=mCoarseBow.begin(), mend=mCoarseBow.end(); mit!=mend; mit++)
     {
-        // List of keyframes that share the word
-        list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+        Posting posting;
+        posting.slot = slot;
+        posting.weight = mit->second;
+        mCoarseInvertedFile[mit->first].push_back(posting);
+    }
+}
 
-        for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+void KeyFrameDatabase::SetShortlist(int nShortlist, int nLevelsUp)
+{
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutex);
+
+    ApplyPending();
+
+    mnShortlist = max(nShortlist,0);
+    mnCoarseLevelsUp = max(nLevelsUp,0);
+    mCoarseInvertedFile.clear();
+    if(mnShortlist==0)
+        return;
+
+    for(unsigned int slot=0; slot<mvpSlotKeyFrames.size(); slot++)
+    {
+        if(mvpSlotKeyFrames[slot])
+            InsertCoarse(slot,mvpSlotKeyFrames[slot]);
+    }
+}
+
+void KeyFrameDatabase::SetPriorRadius(float fRadius)
+{
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutex);
+    mfPriorRadius = max(fRadius,0.f);
+}
+
+void KeyFrameDatabase::FarSlots(const cv::Point3f* pPrior, vector<unsigned char> &vbFar) const
+{
+    vbFar.clear();
+    if(!pPrior || mfPriorRadius<=0)
+        return;
+
+    // The position priors never change once the keyframe is created
+    const float r2 = mfPriorRadius*mfPriorRadius;
+    vbFar.resize(mvpSlotKeyFrames.size(),0);
+    for(size_t slot=0; slot<mvpSlotKeyFrames.size(); slot++)
+    {
+        KeyFrame* pKFi = mvpSlotKeyFrames[slot];
+        if(!pKFi || !pKFi->mbPositionPrior)
+            continue;
+        const cv::Point3f d = pKFi->mPositionPrior-*pPrior;
+        vbFar[slot] = d.dot(d)>r2;
+    }
+}
+
+void KeyFrameDatabase::Shortlist(const DBoW2::BowVector &vBow, const vector<unsigned char> &vbFar,
+                                 vector<unsigned int> &vSlots) const
+{
+    map<DBoW2::NodeId,DBoW2::WordValue> mCoarseBow;
+    CoarseBow(vBow,mCoarseBow);
+
+    // Histogram intersection of the bags of nodes, the L1 score of the normalized vectors
+    // Negative until the slot is found
+    vector<float> vSlotScores(mvpSlotKeyFrames.size(),-1.f);
+    vSlots.clear();
+    for(map<DBoW2::NodeId,DBoW2::WordValue>::const_iterator mit=mCoarseBow.begin(), mend=mCoarseBow.end(); mit!=mend; mit++)
+    {
+        boost::unordered_map<DBoW2::NodeId,vector<Posting> >::const_iterator it = mCoarseInvertedFile.find(mit->first);
+        if(it==mCoarseInvertedFile.end())
+            continue;
+        const vector<Posting> &vPostings = it->second;
+        const float vi = mit->second;
+
+        for(size_t i=0, iend=vPostings.size(); i<iend; i++)
         {
-            if(pKF==*lit)
+            const unsigned int slot = vPostings[i].slot;
+            if(!mvpSlotKeyFrames[slot] || (!vbFar.empty() && vbFar[slot]))
+                continue;
+            if(vSlotScores[slot]<0.f)
             {
-                lKFs.erase(lit);
-                break;
+                vSlots.push_back(slot);
+                vSlotScores[slot] = 0.f;
             }
+            vSlotScores[slot] += min(vi,(float)vPostings[i].weight);
         }
     }
+
+    if(vSlots.size()>(size_t)mnShortlist)
+    {
+        CoarseScoreGreater greater;
+        greater.pvScores = &vSlotScores;
+        nth_element(vSlots.begin(),vSlots.begin()+mnShortlist,vSlots.end(),greater);
+        vSlots.resize(mnShortlist);
+    }
+}
+
+const vector<KeyFrameDatabase::Posting>* KeyFrameDatabase::FindPostings(DBoW2::WordId wordId) const
+{
+    if(!mbSparse)
+        return &mvInvertedFile[wordId];
+    boost::unordered_map<DBoW2::WordId,vector<Posting> >::const_iterator it = mSparseInvertedFile.find(wordId);
+    return it==mSparseInvertedFile.end() ? NULL : &it->second;
+}
+
+void KeyFrameDatabase::erase(KeyFrame* pKF)
+{
+    if(mpGlobalDB)
+        mpGlobalDB->erase(pKF);
+    else
+        EraseScores(pKF);
+
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutex);
+
+    // The keyframe could still be pending
+    ApplyPending();
+
+    map<KeyFrame*,unsigned int>::iterator mit = mmSlots.find(pKF);
+    if(mit==mmSlots.end())
+        return;
+
+    // The postings stay until the next compaction, queries skip the erased slots
+    mvpSlotKeyFrames[mit->second] = NULL;
+    mmSlots.erase(mit);
+    mnTombstones++;
+
+    if(mnTombstones>=MIN_TOMBSTONES_COMPACT && 2*mnTombstones>=mvpSlotKeyFrames.size())
+        Compact();
+}
+
+void KeyFrameDatabase::AccountMemory(MemoryStats &stats)
+{
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutex);
+    size_t nBytes = MemoryStats::VectorBytes(mvInvertedFile)+MemoryStats::HashBytes(mSparseInvertedFile);
+    for(size_t i=0; i<mvInvertedFile.size(); i++)
+        nBytes += MemoryStats::VectorBytes(mvInvertedFile[i]);
+    for(boost::unordered_map<DBoW2::WordId,vector<Posting> >::const_iterator it=mSparseInvertedFile.begin(); it!=mSparseInvertedFile.end(); it++)
+        nBytes += MemoryStats::VectorBytes(it->second);
+    nBytes += MemoryStats::HashBytes(mCoarseInvertedFile);
+    for(boost::unordered_map<DBoW2::NodeId,vector<Posting> >::const_iterator it=mCoarseInvertedFile.begin(); it!=mCoarseInvertedFile.end(); it++)
+        nBytes += MemoryStats::VectorBytes(it->second);
+    nBytes += MemoryStats::VectorBytes(mvpSlotKeyFrames)+MemoryStats::TreeBytes(mmSlots);
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lockScores, mMutexScores);
+        nBytes += MemoryStats::TreeBytes(mmScores);
+    }
+    stats.Add(MemoryStats::KEYFRAME_DATABASE,nBytes);
 }
 
 void KeyFrameDatabase::clear()
 {
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutex);
+
+    ApplyPending();
+
+    if(mpGlobalDB)
+    {
+        for(map<KeyFrame*,unsigned int>::iterator mit=mmSlots.begin(), mend=mmSlots.end(); mit!=mend; mit++)
+            mpGlobalDB->erase(mit->first);
+    }
+
     mvInvertedFile.clear();
-    mvInvertedFile.resize(mpVoc->size());
+    if(!mbSparse)
+        mvInvertedFile.resize(mpVoc->size());
+    mSparseInvertedFile.clear();
+    mCoarseInvertedFile.clear();
+    mvpSlotKeyFrames.clear();
+    mmSlots.clear();
+    mnTombstones = 0;
+
+    PROFILED_LOCK(boost::mutex::scoped_lock, lockScores, mMutexScores);
+    mmScores.clear();
 }
 
+float KeyFrameDatabase::Score(KeyFrame* pKF1, const DBoW2::FlatBowVector &vBow1, KeyFrame* pKF2)
+{
+    if(mpGlobalDB)
+        return mpGlobalDB->Score(pKF1,vBow1,pKF2);
 
-vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float minScore)
+    const ScoreKey key(pKF1->mnId,pKF2->mnId);
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexScores);
+        map<ScoreKey,float>::const_iterator mit = mmScores.find(key);
+        if(mit!=mmScores.end())
+            return mit->second;
+    }
+
+    // Computed unlocked, two threads may both compute a missing score
+    DBoW2::FlatBowVector vBow2;
+    pKF2->GetFlatBowVector(vBow2);
+    const float score = mpVoc->score(vBow1,vBow2);
+
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexScores);
+    if(mmScores.size()>=MAX_CACHED_SCORES)
+        mmScores.clear();
+    mmScores[key] = score;
+    mmScores[ScoreKey(pKF2->mnId,pKF1->mnId)] = score;
+    return score;
+}
+
+void KeyFrameDatabase::EraseScores(KeyFrame* pKF)
 {
-    set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
-    list<KeyFrame*> lKFsSharingWords;
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexScores);
 
-    // Search all keyframes that share a word with current keyframes
-    // Discard keyframes connected to the query keyframe
+    // Pairs starting with the keyframe are contiguous, their reverse entries are erased one by one
+    const long unsigned int id = pKF->mnId;
+    map<ScoreKey,float>::iterator mit = mmScores.lower_bound(ScoreKey(id,0));
+    while(mit!=mmScores.end() && mit->first.first==id)
+    {
+        mmScores.erase(ScoreKey(mit->first.second,id));
+        mmScores.erase(mit++);
+    }
+}
+
+// Renumbers the postings of a word, dropping the erased slots
+template<class P>
+static void CompactPostings(vector<P> &vPostings, const vector<unsigned int> &vNewSlots, const unsigned int nErased)
+{
+    size_t j=0;
+    for(size_t i=0, iend=vPostings.size(); i<iend; i++)
     {
-        boost::mutex::scoped_lock lock(mMutex);
+        const unsigned int newSlot = vNewSlots[vPostings[i].slot];
+        if(newSlot==nErased)
+            continue;
+        vPostings[j].slot = newSlot;
+        vPostings[j].weight = vPostings[i].weight;
+        j++;
+    }
+    vPostings.resize(j);
+}
+
+void KeyFrameDatabase::Compact()
+{
+    // New slot of each old slot, the order of the keyframes is kept
+    const unsigned int nOldSlots = mvpSlotKeyFrames.size();
+    const unsigned int nErased = nOldSlots;
+    vector<unsigned int> vNewSlots(nOldSlots,nErased);
+    unsigned int nSlots = 0;
+    for(unsigned int i=0; i<nOldSlots; i++)
+    {
+        KeyFrame* pKFi = mvpSlotKeyFrames[i];
+        if(!pKFi)
+            continue;
+        vNewSlots[i] = nSlots;
+        mvpSlotKeyFrames[nSlots] = pKFi;
+        mmSlots[pKFi] = nSlots;
+        nSlots++;
+    }
+    mvpSlotKeyFrames.resize(nSlots);
 
-        for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit != vend; vit++)
+    for(size_t w=0, wend=mvInvertedFile.size(); w<wend; w++)
+        CompactPostings(mvInvertedFile[w],vNewSlots,nErased);
+
+    // Words left without postings are dropped from the sparse file
+    boost::unordered_map<DBoW2::WordId,vector<Posting> >::iterator it = mSparseInvertedFile.begin();
+    while(it!=mSparseInvertedFile.end())
+    {
+        CompactPostings(it->second,vNewSlots,nErased);
+        if(it->second.empty())
+            it = mSparseInvertedFile.erase(it);
+        else
+            it++;
+    }
+
+    boost::unordered_map<DBoW2::NodeId,vector<Posting> >::iterator cit = mCoarseInvertedFile.begin();
+    while(cit!=mCoarseInvertedFile.end())
+    {
+        CompactPostings(cit->second,vNewSlots,nErased);
+        if(cit->second.empty())
+            cit = mCoarseInvertedFile.erase(cit);
+        else
+            cit++;
+    }
+
+    mnTombstones = 0;
+}
+
+bool KeyFrameDatabase::Gather(const DBoW2::BowVector &vBow, const cv::Point3f* pPrior, vector<KeyFrame*> &vpKFs,
+                              vector<int> &vnWords, vector<float> &vScores)
+{
+    // With the L1 score the similarity only depends on the shared words, it is accumulated from the postings
+    // in the same order as ORBVocabulary::score. Other scores are computed from the bag of words afterwards
+    const bool bL1 = mpVoc->getScoringType()==DBoW2::L1_NORM;
+
+    // Keyframes added since the last query are indexed first
+    if(mpPending.load())
+    {
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutex);
+        ApplyPending();
+    }
+
+    bool bShortlisted = false;
+    {
+        PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutex);
+
+        const unsigned int nSlots = mvpSlotKeyFrames.size();
+
+        // Keyframes too far from the position prior of the query are skipped like the erased ones
+        vector<unsigned char> vbFar;
+        FarSlots(pPrior,vbFar);
+
+        // Large databases are ranked by the coarse index first, the shortlist is scored unlocked below
+        if(mnShortlist>0 && nSlots-mnTombstones>(unsigned int)mnShortlist)
         {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+            vector<unsigned int> vShortlist;
+            Shortlist(vBow,vbFar,vShortlist);
+            bShortlisted = true;
+            vpKFs.resize(vShortlist.size());
+            for(size_t i=0, iend=vShortlist.size(); i<iend; i++)
+                vpKFs[i] = mvpSlotKeyFrames[vShortlist[i]];
+        }
+        else
+        {
+            vector<int> vnSlotWords(nSlots,0);
+            vector<double> vSlotScores(nSlots,0.0);
+            vector<unsigned int> vTouched;
 
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+            for(DBoW2::BowVector::const_iterator vit=vBow.begin(), vend=vBow.end(); vit != vend; vit++)
             {
-                KeyFrame* pKFi=*lit;
-                if(pKFi->mnLoopQuery!=pKF->mnId)
+                const vector<Posting>* pPostings = FindPostings(vit->first);
+                if(!pPostings)
+                    continue;
+                const vector<Posting> &vPostings = *pPostings;
+                const double vi = vit->second;
+
+                for(size_t i=0, iend=vPostings.size(); i<iend; i++)
                 {
-                    pKFi->mnLoopWords=0;
-                    if(!spConnectedKeyFrames.count(pKFi))
-                    {
-                        pKFi->mnLoopQuery=pKF->mnId;
-                        lKFsSharingWords.push_back(pKFi);
-                    }
+                    const unsigned int slot = vPostings[i].slot;
+                    if(!mvpSlotKeyFrames[slot] || (!vbFar.empty() && vbFar[slot]))
+                        continue;
+                    if(vnSlotWords[slot]==0)
+                        vTouched.push_back(slot);
+                    vnSlotWords[slot]++;
+
+                    const double wi = vPostings[i].weight;
+                    vSlotScores[slot] += fabs(vi - wi) - fabs(vi) - fabs(wi);
                 }
-                pKFi->mnLoopWords++;
+            }
+
+            vpKFs.resize(vTouched.size());
+            vnWords.resize(vTouched.size());
+            vScores.resize(vTouched.size());
+            for(size_t i=0, iend=vTouched.size(); i<iend; i++)
+            {
+                const unsigned int slot = vTouched[i];
+                vpKFs[i] = mvpSlotKeyFrames[slot];
+                vnWords[i] = vnSlotWords[slot];
+                vScores[i] = -vSlotScores[slot]/2.0;
             }
         }
     }
 
-    if(lKFsSharingWords.empty())
-        return vector<KeyFrame*>();
+    if(!bShortlisted)
+        return bL1;
 
-    list<pair<float,KeyFrame*> > lScoreAndMatch;
+    // Keyframes are not deleted while the system runs, as for the candidates returned by the queries
+    DBoW2::FlatBowVector vFlatBow(vBow), vFlatBowi;
+    vnWords.resize(vpKFs.size());
+    vScores.resize(vpKFs.size());
+    for(size_t i=0, iend=vpKFs.size(); i<iend; i++)
+    {
+        vpKFs[i]->GetFlatBowVector(vFlatBowi);
+        vnWords[i] = CountSharedWords(vFlatBow,vFlatBowi);
+        vScores[i] = mpVoc->score(vFlatBow,vFlatBowi);
+    }
+    return true;
+}
 
-    // Only compare against those keyframes that share enough words
-    int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float minScore, Map* pIgnoreMap)
+{
+    set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
+
+    // Search all keyframes that share a word with current keyframes
+    vector<KeyFrame*> vpKFsSharingWords;
+    vector<int> vnCommonWords;
+    vector<float> vScores;
+    const bool bScored = Gather(pKF->mBowVec,pKF->mbPositionPrior ? &pKF->mPositionPrior : NULL,
+                                vpKFsSharingWords,vnCommonWords,vScores);
+
+    // Discard keyframes connected to the query keyframe
+    for(size_t i=0, iend=vpKFsSharingWords.size(); i<iend; i++)
+        if(spConnectedKeyFrames.count(vpKFsSharingWords[i]) || IsIgnored(vpKFsSharingWords[i],pIgnoreMap))
+            vpKFsSharingWords[i]=NULL;
+
+    return SelectLoopCandidates(pKF,minScore,vpKFsSharingWords,vnCommonWords,vScores,bScored);
+}
+
+void KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float minScore, Map* pLoopMap,
+                                            vector<KeyFrame*> &vpLoopCandidates, vector<KeyFrame*> &vpMergeCandidates)
+{
+    set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
+
+    // Search all keyframes that share a word with current keyframes, once for both
+    vector<KeyFrame*> vpKFsSharingWords;
+    vector<int> vnCommonWords;
+    vector<float> vScores;
+    const bool bScored = Gather(pKF->mBowVec,pKF->mbPositionPrior ? &pKF->mPositionPrior : NULL,
+                                vpKFsSharingWords,vnCommonWords,vScores);
+
+    // The keyframes of the loop map and of the other maps are ranked apart, as by two queries
+    vector<KeyFrame*> vpLoopKFs(vpKFsSharingWords.size(),static_cast<KeyFrame*>(NULL));
+    vector<KeyFrame*> vpMergeKFs(vpKFsSharingWords.size(),static_cast<KeyFrame*>(NULL));
+    for(size_t i=0, iend=vpKFsSharingWords.size(); i<iend; i++)
     {
-        if((*lit)->mnLoopWords>maxCommonWords)
-            maxCommonWords=(*lit)->mnLoopWords;
+        KeyFrame* pKFi = vpKFsSharingWords[i];
+        if(spConnectedKeyFrames.count(pKFi) || IsIgnored(pKFi,NULL))
+            continue;
+        if(pKFi->getMap()==pLoopMap)
+            vpLoopKFs[i] = pKFi;
+        else
+            vpMergeKFs[i] = pKFi;
     }
 
+    vpLoopCandidates = SelectLoopCandidates(pKF,minScore,vpLoopKFs,vnCommonWords,vScores,bScored);
+    vpMergeCandidates = SelectLoopCandidates(pKF,minScore,vpMergeKFs,vnCommonWords,vScores,bScored);
+}
+
+vector<KeyFrame*> KeyFrameDatabase::SelectLoopCandidates(KeyFrame* pKF, float minScore, const vector<KeyFrame*> &vpKFsSharingWords,
+                                                         const vector<int> &vnCommonWords, const vector<float> &vScores, bool bScored)
+{
+    // Only compare against those keyframes that share enough words
+    int maxCommonWords=0;
+    for(size_t i=0, iend=vpKFsSharingWords.size(); i<iend; i++)
+        if(vpKFsSharingWords[i] && vnCommonWords[i]>maxCommonWords)
+            maxCommonWords=vnCommonWords[i];
+
+    if(maxCommonWords==0)
+        return vector<KeyFrame*>();
+
     int minCommonWords = maxCommonWords*0.8f;
 
-    int nscores=0;
+    list<pair<float,KeyFrame*> > lScoreAndMatch;
+    map<KeyFrame*,float> mLoopScores;
+
+    // Without the L1 scores of the postings, the keyframes are scored with the flat bags of words
+    DBoW2::FlatBowVector vFlatBow;
+    if(!bScored)
+        pKF->GetFlatBowVector(vFlatBow);
 
     // Compute similarity score. Retain the matches whose score is higher than minScore
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(size_t i=0, iend=vpKFsSharingWords.size(); i<iend; i++)
     {
-        KeyFrame* pKFi = *lit;
+        KeyFrame* pKFi = vpKFsSharingWords[i];
 
-        if(pKFi->mnLoopWords>minCommonWords)
+        if(pKFi && vnCommonWords[i]>minCommonWords)
         {
-            nscores++;
-
-            float si = mpVoc->score(pKF->mBowVec,pKFi->mBowVec);
+            float si = bScored ? vScores[i] : Score(pKF,vFlatBow,pKFi);
 
-            pKFi->mLoopScore = si;
+            mLoopScores[pKFi] = si;
             if(si>=minScore)
                 lScoreAndMatch.push_back(make_pair(si,pKFi));
         }
@@ -153,14 +632,14 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
         KeyFrame* pBestKF = pKFi;
         for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
         {
-            KeyFrame* pKF2 = *vit;
-            if(pKF2->mnLoopQuery==pKF->mnId && pKF2->mnLoopWords>minCommonWords)
+            map<KeyFrame*,float>::const_iterator mit = mLoopScores.find(*vit);
+            if(mit!=mLoopScores.end())
             {
-                accScore+=pKF2->mLoopScore;
-                if(pKF2->mLoopScore>bestScore)
+                accScore+=mit->second;
+                if(mit->second>bestScore)
                 {
-                    pBestKF=pKF2;
-                    bestScore = pKF2->mLoopScore;
+                    pBestKF=mit->first;
+                    bestScore = mit->second;
                 }
             }
         }
@@ -194,57 +673,54 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
     return vpLoopCandidates;
 }
 
-vector<KeyFrame*> KeyFrameDatabase::DetectRelocalisationCandidates(Frame *F)
+vector<KeyFrame*> KeyFrameDatabase::DetectRelocalisationCandidates(Frame *F, Map* pIgnoreMap)
 {
-    list<KeyFrame*> lKFsSharingWords;
     // Search all keyframes that share a word with current frame
-    {
-        boost::mutex::scoped_lock lock(mMutex);
-
-        for(DBoW2::BowVector::const_iterator vit=F->mBowVec.begin(), vend=F->mBowVec.end(); vit != vend; vit++)
-        {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
-            {
-                KeyFrame* pKFi=*lit;
-                if(pKFi->mnRelocQuery!=F->mnId)
-                {
-                    pKFi->mnRelocWords=0;
-                    pKFi->mnRelocQuery=F->mnId;
-                    lKFsSharingWords.push_back(pKFi);
-                }
-                pKFi->mnRelocWords++;
-            }
-        }
-    }
-
-    if(lKFsSharingWords.empty())
-        return vector<KeyFrame*>();
+    vector<KeyFrame*> vpKFsSharingWords;
+    vector<int> vnCommonWords;
+    vector<float> vScores;
+    const bool bScored = Gather(F->mBowVec,F->mbPositionPrior ? &F->mPositionPrior : NULL,
+                                vpKFsSharingWords,vnCommonWords,vScores);
 
     // Only compare against those keyframes that share enough words
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(size_t i=0, iend=vnCommonWords.size(); i<iend; i++)
     {
-        if((*lit)->mnRelocWords>maxCommonWords)
-            maxCommonWords=(*lit)->mnRelocWords;
+        if(IsIgnored(vpKFsSharingWords[i],pIgnoreMap))
+            vpKFsSharingWords[i]=NULL;
+        else if(vnCommonWords[i]>maxCommonWords)
+            maxCommonWords=vnCommonWords[i];
     }
 
+    if(maxCommonWords==0)
+        return vector<KeyFrame*>();
+
     int minCommonWords = maxCommonWords*0.8f;
 
     list<pair<float,KeyFrame*> > lScoreAndMatch;
+    map<KeyFrame*,float> mRelocScores;
 
-    int nscores=0;
+    // Without the L1 scores of the postings, the keyframes are scored with the flat bags of words
+    DBoW2::FlatBowVector vFlatBow, vFlatBowi;
+    if(!bScored)
+        vFlatBow.assign(F->mBowVec);
 
     // Compute similarity score.
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(size_t i=0, iend=vpKFsSharingWords.size(); i<iend; i++)
     {
-        KeyFrame* pKFi = *lit;
+        KeyFrame* pKFi = vpKFsSharingWords[i];
 
-        if(pKFi->mnRelocWords>minCommonWords)
+        if(pKFi && vnCommonWords[i]>minCommonWords)
         {
-            nscores++;
-            float si = mpVoc->score(F->mBowVec,pKFi->mBowVec);
-            pKFi->mRelocScore=si;
+            float si;
+            if(bScored)
+                si = vScores[i];
+            else
+            {
+                pKFi->GetFlatBowVector(vFlatBowi);
+                si = mpVoc->score(vFlatBow,vFlatBowi);
+            }
+            mRelocScores[pKFi]=si;
             lScoreAndMatch.push_back(make_pair(si,pKFi));
         }
     }
@@ -256,6 +732,7 @@ vector<KeyFrame*> KeyFrameDatabase::DetectRelocalisationCandidates(Frame *F)
     float bestAccScore = 0;
 
     // Lets now accumulate score by covisibility
+    // Only the neighbours scored by this query contribute
     for(list<pair<float,KeyFrame*> >::iterator it=lScoreAndMatch.begin(), itend=lScoreAndMatch.end(); it!=itend; it++)
     {
         KeyFrame* pKFi = it->second;
@@ -266,15 +743,15 @@ vector<KeyFrame*> KeyFrameDatabase::DetectRelocalisationCandidates(Frame *F)
         KeyFrame* pBestKF = pKFi;
         for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
         {
-            KeyFrame* pKF2 = *vit;
-            if(pKF2->mnRelocQuery!=F->mnId)
+            map<KeyFrame*,float>::const_iterator mit = mRelocScores.find(*vit);
+            if(mit==mRelocScores.end())
                 continue;
 
-            accScore+=pKF2->mRelocScore;
-            if(pKF2->mRelocScore>bestScore)
+            accScore+=mit->second;
+            if(mit->second>bestScore)
             {
-                pBestKF=pKF2;
-                bestScore = pKF2->mRelocScore;
+                pBestKF=mit->first;
+                bestScore = mit->second;
             }
 
         }
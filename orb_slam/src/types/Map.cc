@@ -19,11 +19,40 @@
 */
 
 #include "types/Map.h"
+#include "util/Converter.h"
+#include "util/EpochReclaimer.h"
+#include "util/BinaryIO.h"
+#include "util/LockProfiler.h"
+#include "util/MapJournal.h"
+
+#include <fstream>
+#include <iomanip>
+#include <cstdio>
+#include <stdint.h>
 
 namespace ORB_SLAM
 {
 
-Map::Map()
+static void DeleteMapPoint(void* p)
+{
+    delete static_cast<MapPoint*>(p);
+}
+
+static void ReleaseKeyFrame(void* p)
+{
+    static_cast<KeyFrame*>(p)->ReleaseData();
+}
+
+long unsigned int Map::nNextId=0;
+boost::atomic<unsigned long> Map::nUseClock(0);
+
+// Page files start with this tag and format version
+static const uint32_t PAGE_TAG = 0x4f52424b;
+static const uint32_t PAGE_VERSION = 1;
+
+Map::Map():
+    mnId(nNextId++), mnVersion(0), mnUpdating(0), mnPins(0), mbPagedOut(false), mbCompact(false), mbExpanded(false), mnLastUsed(0),
+    mpJournal(MapJournal::Global())
 {
     mbMapUpdated= false;
     mnMaxKFid = 0;
@@ -32,145 +61,506 @@ Map::Map()
 
 Map::~Map()
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
-    boost::mutex::scoped_lock lock2(mMutexKeyFrameDB);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock2, mMutexKeyFrameDB);
     // We delete keyframes, and map points
     // Everything else is built ontop of those core data-sets, so do not try to delete anything else
-    for(set<KeyFrame*>::iterator sit=mspKeyFrames.begin(), send=mspKeyFrames.end(); sit!=send; sit++)
+    KeyFrameSnapshot keyFrames = mKeyFrames.GetSnapshot();
+    for(KeyFrameSnapshot::const_iterator sit=keyFrames.begin(), send=keyFrames.end(); sit!=send; sit++)
         delete *sit;
-    for(set<MapPoint*>::iterator sit=mspMapPoints.begin(), send=mspMapPoints.end(); sit!=send; sit++)
+    MapPointSnapshot mapPoints = mMapPoints.GetSnapshot();
+    for(MapPointSnapshot::const_iterator sit=mapPoints.begin(), send=mapPoints.end(); sit!=send; sit++)
         delete *sit;
 
     // Empty the lists
-    mvpReferenceMapPoints.clear();
-    mspMapPoints.clear();
-    mspKeyFrames.clear();
+    mvReferenceMapPoints.clear();
+    mMapPoints.Clear();
+    mKeyFrames.Clear();
+
+    if(!mPageFile.empty())
+        std::remove(mPageFile.c_str());
 }
 
 void Map::AddKeyFrame(KeyFrame *pKF)
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
-    mspKeyFrames.insert(pKF);
-    if(pKF->mnId>mnMaxKFid)
-        mnMaxKFid=pKF->mnId;
-    mbMapUpdated=true;
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+        mKeyFrames.Insert(pKF);
+        if(pKF->mnId>mnMaxKFid)
+            mnMaxKFid=pKF->mnId;
+        mbMapUpdated=true;
+        mnVersion++;
+    }
+    // New keyframes have no links yet, the ones moved from another map bring theirs
+    mEssentialGraph.AddKeyFrame(pKF);
 }
 
 void Map::AddMapPoint(MapPoint *pMP)
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
-    mspMapPoints.insert(pMP);
-    mbMapUpdated=true;
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+        mMapPoints.Insert(pMP);
+        mbMapUpdated=true;
+        mnVersion++;
+    }
+    mSpatialIndex.Insert(pMP,pMP->GetWorldPosEigen());
 }
 
 void Map::EraseMapPoint(MapPoint *pMP)
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
-    mspMapPoints.erase(pMP);
-    mbMapUpdated=true;
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+        mbMapUpdated=true;
+        // Only the owning map retires the point, and only once
+        if(!mMapPoints.Erase(pMP))
+            return;
+        mnVersion++;
+    }
+    mSpatialIndex.Erase(pMP);
+    mpJournal->MapPointErased(pMP);
+    EpochReclaimer::Global()->Retire(pMP,DeleteMapPoint);
+}
+
+void Map::EraseMapPoints(const vector<MapPoint*> &vpMPs)
+{
+    vector<MapPoint*> vpErased;
+    vpErased.reserve(vpMPs.size());
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+        mbMapUpdated=true;
+        for(size_t i=0; i<vpMPs.size(); i++)
+        {
+            if(mMapPoints.Erase(vpMPs[i]))
+                vpErased.push_back(vpMPs[i]);
+        }
+        if(!vpErased.empty())
+            mnVersion++;
+    }
+    mpJournal->MapPointsErased(vpErased);
+    for(size_t i=0; i<vpErased.size(); i++)
+    {
+        mSpatialIndex.Erase(vpErased[i]);
+        EpochReclaimer::Global()->Retire(vpErased[i],DeleteMapPoint);
+    }
 }
 
 void Map::EraseKeyFrame(KeyFrame *pKF)
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
-    mspKeyFrames.erase(pKF);
-    mbMapUpdated=true;
+    mEssentialGraph.EraseKeyFrame(pKF);
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+        mbMapUpdated=true;
+        if(!mKeyFrames.Erase(pKF))
+            return;
+        mnVersion++;
+    }
+    mpJournal->KeyFrameErased(pKF);
+    // Bad keyframes stay referenced as parents and reference keyframes, keep the shell
+    EpochReclaimer::Global()->Retire(pKF,ReleaseKeyFrame);
+}
+
+void Map::DetachMapPoint(MapPoint *pMP)
+{
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+        mMapPoints.Erase(pMP);
+        mbMapUpdated=true;
+        mnVersion++;
+    }
+    mSpatialIndex.Erase(pMP);
+}
+
+void Map::DetachKeyFrame(KeyFrame *pKF)
+{
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+        mKeyFrames.Erase(pKF);
+        mbMapUpdated=true;
+        mnVersion++;
+    }
+    mEssentialGraph.EraseKeyFrame(pKF);
 }
 
 void Map::SetReferenceMapPoints(const vector<MapPoint *> &vpMPs)
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
-    mvpReferenceMapPoints = vpMPs;
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+    mvReferenceMapPoints.clear();
+    mvReferenceMapPoints.reserve(vpMPs.size());
+    for(size_t i=0; i<vpMPs.size(); i++)
+        if(vpMPs[i])
+            mvReferenceMapPoints.push_back(PoolHandle<MapPoint>(vpMPs[i]));
     mbMapUpdated=true;
 }
 
 vector<KeyFrame*> Map::GetAllKeyFrames()
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
-    return vector<KeyFrame*>(mspKeyFrames.begin(),mspKeyFrames.end());
+    // Copied outside the lock
+    return GetKeyFrameSnapshot().ToVector();
 }
 
 vector<MapPoint*> Map::GetAllMapPoints()
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
-    return vector<MapPoint*>(mspMapPoints.begin(),mspMapPoints.end());
+    return GetMapPointSnapshot().ToVector();
+}
+
+Map::KeyFrameSnapshot Map::GetKeyFrameSnapshot()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+    return mKeyFrames.GetSnapshot();
+}
+
+Map::MapPointSnapshot Map::GetMapPointSnapshot()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+    return mMapPoints.GetSnapshot();
 }
 
 int Map::MapPointsInMap()
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
-    return mspMapPoints.size();
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+    return mMapPoints.Size();
 }
 
 int Map::KeyFramesInMap()
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
-    return mspKeyFrames.size();
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+    return mKeyFrames.Size();
 }
 
 vector<MapPoint*> Map::GetReferenceMapPoints()
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
-    return mvpReferenceMapPoints;
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+    // Points freed since they were set are skipped
+    vector<MapPoint*> vpMPs;
+    vpMPs.reserve(mvReferenceMapPoints.size());
+    for(size_t i=0; i<mvReferenceMapPoints.size(); i++)
+    {
+        MapPoint* pMP = mvReferenceMapPoints[i].Get();
+        if(pMP)
+            vpMPs.push_back(pMP);
+    }
+    return vpMPs;
 }
 
 bool Map::isMapUpdated()
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
     return mbMapUpdated;
 }
 
 void Map::SetFlagAfterBA()
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
     mbMapUpdated=true;
-
+    mnVersion++;
 }
 
 void Map::ResetUpdated()
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
     mbMapUpdated=false;
 }
 
+unsigned long Map::GetVersion() const
+{
+    return mnVersion;
+}
+
+void Map::BeginUpdate()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+    mnUpdating++;
+    mnVersion++;
+}
+
+void Map::EndUpdate()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+    mnUpdating--;
+    mnVersion++;
+}
+
+boost::shared_ptr<const MapSnapshot> Map::GetSnapshot()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lockSnapshot, mMutexSnapshot);
+
+    // A change while copying would leave a torn snapshot, so it is taken again
+    for(int i=0; i<3; i++)
+    {
+        unsigned long nVersion;
+        bool bUpdating;
+        {
+            PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+            nVersion = mnVersion;
+            bUpdating = mnUpdating>0;
+        }
+
+        if(mpSnapshot && (mpSnapshot->mnVersion==nVersion || bUpdating))
+            return mpSnapshot;
+
+        boost::shared_ptr<const MapSnapshot> pSnapshot(new MapSnapshot(this,nVersion));
+        if(!mpSnapshot || mnVersion==nVersion)
+            mpSnapshot = pSnapshot;
+        if(mnVersion==nVersion)
+            break;
+    }
+    return mpSnapshot;
+}
+
 unsigned int Map::GetMaxKFid()
 {
-    boost::mutex::scoped_lock lock(mMutexMap);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
     return mnMaxKFid;
 }
 
 void Map::clear()
 {
-    for(set<MapPoint*>::iterator sit=mspMapPoints.begin(), send=mspMapPoints.end(); sit!=send; sit++)
+    MapPointSnapshot mapPoints = mMapPoints.GetSnapshot();
+    for(MapPointSnapshot::const_iterator sit=mapPoints.begin(), send=mapPoints.end(); sit!=send; sit++)
         delete *sit;
 
-    for(set<KeyFrame*>::iterator sit=mspKeyFrames.begin(), send=mspKeyFrames.end(); sit!=send; sit++)
+    KeyFrameSnapshot keyFrames = mKeyFrames.GetSnapshot();
+    for(KeyFrameSnapshot::const_iterator sit=keyFrames.begin(), send=keyFrames.end(); sit!=send; sit++)
         delete *sit;
 
-    mspMapPoints.clear();
-    mspKeyFrames.clear();
+    mMapPoints.Clear();
+    mKeyFrames.Clear();
+    mSpatialIndex.Clear();
+    mEssentialGraph.clear();
     mnMaxKFid = 0;
-    mvpReferenceMapPoints.clear();
+    mvReferenceMapPoints.clear();
+    mnVersion++;
+
+    // The paged keyframes are gone, so is their page file
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexPaging);
+    mvpPagedKeyFrames.clear();
+    mbPagedOut = false;
+    mbCompact = false;
+    mbExpanded = false;
+    if(!mPageFile.empty())
+        std::remove(mPageFile.c_str());
+    mPageFile.clear();
+}
+
+void Map::Pin(bool bQuery)
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexPaging);
+    if(bQuery && mbPagedOut && mbCompact)
+    {
+        if(!mbExpanded)
+        {
+            for(size_t i=0; i<mvpPagedKeyFrames.size(); i++)
+                mvpPagedKeyFrames[i]->ExpandPayload();
+            mbExpanded = true;
+        }
+    }
+    else
+        FaultIn();
+    mnPins++;
+    mnLastUsed = ++nUseClock;
+}
+
+void Map::Unpin()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexPaging);
+    if(mnPins>0)
+        mnPins--;
+    mnLastUsed = ++nUseClock;
+}
+
+bool Map::PageOut(const std::string &filename, bool bCompact)
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexPaging);
+    if(mnPins>0)
+        return false;
+
+    // The page file is still there, the features expanded for the queries are released again
+    if(mbPagedOut)
+    {
+        if(!mbExpanded)
+            return false;
+        for(size_t i=0; i<mvpPagedKeyFrames.size(); i++)
+            mvpPagedKeyFrames[i]->ReleasePayload();
+        mbExpanded = false;
+        return true;
+    }
+
+    // Everything is written first, nothing is released if the file can not be written
+    vector<KeyFrame*> vpKFs;
+    std::ofstream f(filename.c_str(), std::ios::binary | std::ios::trunc);
+    if(!f.is_open())
+        return false;
+    KeyFrameSnapshot keyFrames = GetKeyFrameSnapshot();
+    const uint32_t nKFs = keyFrames.size();
+    BinaryIO::WritePod(f,PAGE_TAG);
+    BinaryIO::WritePod(f,PAGE_VERSION);
+    BinaryIO::WritePod(f,nKFs);
+    vpKFs.reserve(nKFs);
+    for(KeyFrameSnapshot::const_iterator sit=keyFrames.begin(), send=keyFrames.end(); sit!=send; sit++)
+    {
+        KeyFrame* pKF = *sit;
+        const uint64_t nId = pKF->mnId;
+        BinaryIO::WritePod(f,nId);
+        pKF->WritePayload(f);
+        vpKFs.push_back(pKF);
+    }
+    f.close();
+    if(f.fail() || vpKFs.size()!=nKFs)
+    {
+        std::remove(filename.c_str());
+        return false;
+    }
+
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        if(bCompact)
+            vpKFs[i]->CompactPayload();
+        else
+            vpKFs[i]->ReleasePayload();
+    }
+    mvpPagedKeyFrames.swap(vpKFs);
+    mPageFile = filename;
+    mbPagedOut = true;
+    mbCompact = bCompact;
+    mbExpanded = false;
+    return true;
+}
+
+bool Map::PageIn()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexPaging);
+    return FaultIn();
+}
+
+bool Map::FaultIn()
+{
+    if(!mbPagedOut)
+        return true;
+
+    bool bOK = true;
+    std::ifstream f(mPageFile.c_str(), std::ios::binary);
+    uint32_t nTag, nVersion, nKFs;
+    if(!BinaryIO::ReadPod(f,nTag) || !BinaryIO::ReadPod(f,nVersion) || !BinaryIO::ReadPod(f,nKFs) ||
+       nTag!=PAGE_TAG || nVersion!=PAGE_VERSION || nKFs!=mvpPagedKeyFrames.size())
+        bOK = false;
+    for(size_t i=0; bOK && i<mvpPagedKeyFrames.size(); i++)
+    {
+        uint64_t nId;
+        KeyFrame* pKF = mvpPagedKeyFrames[i];
+        bOK = BinaryIO::ReadPod(f,nId) && nId==pKF->mnId && pKF->ReadPayload(f);
+    }
+    f.close();
+
+    // A page file is read once, the payloads of a failed read are lost
+    std::remove(mPageFile.c_str());
+    mPageFile.clear();
+    mvpPagedKeyFrames.clear();
+    mbPagedOut = false;
+    mbCompact = false;
+    mbExpanded = false;
+    return bOK;
+}
+
+bool Map::isPagedOut()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexPaging);
+    return mbPagedOut;
+}
+
+size_t Map::PayloadBytes()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexPaging);
+    if(mbPagedOut && !mbExpanded)
+        return 0;
+    size_t nBytes = 0;
+    KeyFrameSnapshot keyFrames = GetKeyFrameSnapshot();
+    for(KeyFrameSnapshot::const_iterator sit=keyFrames.begin(), send=keyFrames.end(); sit!=send; sit++)
+        nBytes += (*sit)->PayloadBytes();
+    return nBytes;
+}
+
+void Map::AccountMemory(MemoryStats &stats)
+{
+    KeyFrameSnapshot keyFrames = GetKeyFrameSnapshot();
+    for(KeyFrameSnapshot::const_iterator sit=keyFrames.begin(), send=keyFrames.end(); sit!=send; sit++)
+        (*sit)->AccountMemory(stats);
+
+    MapPointSnapshot mapPoints = GetMapPointSnapshot();
+    for(MapPointSnapshot::const_iterator sit=mapPoints.begin(), send=mapPoints.end(); sit!=send; sit++)
+        (*sit)->AccountMemory(stats);
+    mSpatialIndex.AccountMemory(stats);
+
+    KeyFrameDatabase* pKFDB = GetKeyFrameDatabase();
+    if(pKFDB)
+        pKFDB->AccountMemory(stats);
+}
+
+unsigned long Map::LastUsed()
+{
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexPaging);
+    return mnLastUsed;
+}
+
+SpatialIndex* Map::GetSpatialIndex()
+{
+    return &mSpatialIndex;
+}
+
+EssentialGraph* Map::GetEssentialGraph()
+{
+    return &mEssentialGraph;
+}
+
+void Map::SetJournal(MapJournal* pJournal)
+{
+    mpJournal = pJournal;
 }
 
 void Map::SetKeyFrameDB(KeyFrameDatabase* mpKeyFrameDB) {
-    boost::mutex::scoped_lock lock(mMutexKeyFrameDB);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexKeyFrameDB);
     this->mpKeyFrameDB = mpKeyFrameDB;
 }
 
 KeyFrameDatabase* Map::GetKeyFrameDatabase() {
-    boost::mutex::scoped_lock lock(mMutexKeyFrameDB);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexKeyFrameDB);
     return mpKeyFrameDB;
 }
 
 bool Map::getErased() {
-    boost::mutex::scoped_lock lock(mMutexMap);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
     return isErased;
 }
 
 void Map::setErased(bool b) {
-    boost::mutex::scoped_lock lock(mMutexMap);
-    isErased = b;
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexMap);
+        isErased = b;
+    }
+    if(b)
+        mpJournal->MapErased(this);
+}
+
+bool Map::SaveKeyFrameTrajectory(const std::string &filename)
+{
+    std::ofstream f(filename.c_str(), std::ios::binary);
+    if(!f.is_open())
+        return false;
+
+    // One consistent version of all the poses, sorted by id
+    boost::shared_ptr<const MapSnapshot> pSnapshot = GetSnapshot();
+
+    // Formatted in memory and written at once
+    std::string buffer;
+    buffer.reserve(pSnapshot->mvKeyFrames.size()*96);
+    for(size_t i=0; i<pSnapshot->mvKeyFrames.size(); i++)
+    {
+        const MapSnapshot::KeyFrameState &kf = pSnapshot->mvKeyFrames[i];
+        Converter::appendTrajectoryLine(buffer, kf.timeStamp, kf.pose.Rcw().transpose(), kf.pose.Center());
+    }
+
+    f.write(buffer.data(), buffer.size());
+    f.close();
+    return !f.fail();
 }
 
 } //namespace ORB_SLAM
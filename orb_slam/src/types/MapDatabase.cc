@@ -16,61 +16,81 @@
 */
 
 #include "types/MapDatabase.h"
+#include "util/LockProfiler.h"
+#include "util/MapJournal.h"
 
 #include <ros/ros.h>
 #include <algorithm>
+#include <sstream>
 
 namespace ORB_SLAM
 {
 
-MapDatabase::MapDatabase(ORBVocabulary* vocab) {
+MapDatabase::MapDatabase(ORBVocabulary* vocab, bool bVocabLoaded):
+    mKeyFrameDB(*vocab) {
     // Init varibles
     this->vocab = vocab;
+    this->vocabState = bVocabLoaded ? VOCAB_LOADED : VOCAB_LOADING;
     this->currentMapID = 0;
-    this->maps = std::vector<Map*>();
+    this->maps = MapList(new std::vector<Map*>());
+    this->version = 0;
+    this->memoryBudget = 0;
+    this->compactPaging = false;
+    this->shortlist = 0;
+    this->shortlistLevelsUp = 0;
+    this->priorRadius = 0;
+    this->journal = MapJournal::Global();
 }
 
 Map* MapDatabase::getNewMap() {
-    boost::mutex::scoped_lock lock(vocMutex);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, vocMutex);
     // Create map and new db
     Map* temp = new Map;
-    KeyFrameDatabase* db = new KeyFrameDatabase(*vocab);
+    KeyFrameDatabase* db = new KeyFrameDatabase(*vocab, &mKeyFrameDB);
+    if(shortlist > 0)
+        db->SetShortlist(shortlist, shortlistLevelsUp);
+    if(priorRadius > 0)
+        db->SetPriorRadius(priorRadius);
     // Set the db, and return the new object
     temp->SetKeyFrameDB(db);
+    temp->SetJournal(journal);
     return temp;
 }
 
 void MapDatabase::addMap(Map* map) {
-    boost::mutex::scoped_lock lock(mapMutex);
+    // The current map is kept pinned, so that it is never paged out
+    map->Pin();
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mapMutex);
     // Reset flag on current map
-    if(currentMapID > 0 && currentMapID < maps.size()+1)
-        maps.at(currentMapID-1)->ResetUpdated();
-    // Add map
-    maps.push_back(map);
-    currentMapID = maps.size();
+    if(currentMapID > 0 && currentMapID < maps->size()+1) {
+        maps->at(currentMapID-1)->ResetUpdated();
+        maps->at(currentMapID-1)->Unpin();
+    }
+    // Add map to a new list, readers keep the old one
+    boost::shared_ptr<std::vector<Map*> > newMaps(new std::vector<Map*>(*maps));
+    newMaps->push_back(map);
+    maps = newMaps;
+    version++;
+    currentMapID = maps->size();
 }
 
 Map* MapDatabase::getMap(int loc) {
-    boost::mutex::scoped_lock lock(mapMutex);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mapMutex);
     // Check that we are in range
-    if(loc < 0 || loc >= (int)maps.size())
+    if(loc < 0 || loc >= (int)maps->size())
             return NULL;
     // Success
-    return maps.at(loc);
+    return maps->at(loc);
 }
 
 bool MapDatabase::eraseMap(Map* m){
-    boost::mutex::scoped_lock lock(mapMutex);
-    // Check to see if it is the current one
-    if(currentMapID > 0 && currentMapID < maps.size()+1 && m == maps.at(currentMapID-1))
-        currentMapID = 0;
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mapMutex);
     // Delete it
-    for (std::size_t i = 0; i != maps.size(); ++i) {
+    for (std::size_t i = 0; i != maps->size(); ++i) {
         // If a match is found delete it, and remove it from the  vector
-        if(maps[i] == m) {
-            Map* temp = maps[i];
-            maps.erase(maps.begin()+i);
-            delete temp;
+        if(maps->at(i) == m) {
+            removeAt(i);
+            delete m;
             return true;
         }
     }
@@ -78,79 +98,266 @@ bool MapDatabase::eraseMap(Map* m){
 }
 
 void MapDatabase::removeMap(Map* m){
-    boost::mutex::scoped_lock lock(mapMutex);
-    // Check to see if it is the current one
-    if(currentMapID > 0 && currentMapID < maps.size()+1 && m == maps.at(currentMapID-1))
-        currentMapID = 0;
-    // Delete it
-    for (std::size_t i = 0; i != maps.size(); ++i) {
-        // If a match is found delete it, and remove it from the  vector
-        if(maps[i] == m) {
-            maps.erase(maps.begin()+i);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mapMutex);
+    // Remove it
+    for (std::size_t i = 0; i != maps->size(); ++i) {
+        // If a match is found remove it from the  vector
+        if(maps->at(i) == m) {
+            removeAt(i);
             return;
         }
     }
 }
 
+void MapDatabase::removeAt(std::size_t i) {
+    // Check to see if it is the current one, the ids of the later maps move down by one
+    if(currentMapID == i+1) {
+        maps->at(i)->Unpin();
+        currentMapID = 0;
+    }
+    else if(currentMapID > i+1)
+        currentMapID--;
+    // New list without the map, readers keep the old one
+    boost::shared_ptr<std::vector<Map*> > newMaps(new std::vector<Map*>(*maps));
+    newMaps->erase(newMaps->begin()+i);
+    maps = newMaps;
+    version++;
+}
+
 bool MapDatabase::isContained(Map* m) {
-    boost::mutex::scoped_lock lock(mapMutex);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mapMutex);
     // Search for the map
-    if(std::find(maps.begin(), maps.end(), m) != maps.end())
+    if(std::find(maps->begin(), maps->end(), m) != maps->end())
         return true;
     return false;
 }
 
 bool MapDatabase::setMap(Map* m){
-    boost::mutex::scoped_lock lock(mapMutex);
-    unsigned int id_new = 0;
-    for (std::size_t i = 0; i != maps.size(); ++i) {
-        if(maps[i]->getErased())
-            continue;
-        if(maps[i] == m) {
-            id_new = i+1;
-            break;
-        }
-    }
-    if(id_new <= 0 || id_new > maps.size())
+    // Fault the map in before it becomes current, outside of the lock
+    if(m == NULL)
         return false;
-    else {
-        currentMapID = id_new;
-        return true;
+    m->Pin();
+    bool found = false;
+    Map* previous = NULL;
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mapMutex);
+        unsigned int id_new = 0;
+        for (std::size_t i = 0; i != maps->size(); ++i) {
+            if(maps->at(i)->getErased())
+                continue;
+            if(maps->at(i) == m) {
+                id_new = i+1;
+                break;
+            }
+        }
+        if(id_new > 0 && id_new <= maps->size()) {
+            if(currentMapID > 0 && currentMapID < maps->size()+1)
+                previous = maps->at(currentMapID-1);
+            currentMapID = id_new;
+            found = true;
+        }
     }
+    // Release the pin of the map that is no longer current, or ours if it was not set
+    if(!found)
+        m->Unpin();
+    else if(previous != NULL)
+        previous->Unpin();
+    return found;
 }
 
 Map* MapDatabase::getCurrent() {
-    boost::mutex::scoped_lock lock(mapMutex);
-    if(currentMapID > 0 && currentMapID < maps.size()+1)
-        return maps.at(currentMapID-1);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mapMutex);
+    if(currentMapID > 0 && currentMapID < maps->size()+1)
+        return maps->at(currentMapID-1);
     else
         return NULL;
 }
 
 int MapDatabase::getCurrentID() {
-    boost::mutex::scoped_lock lock(mapMutex);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mapMutex);
     return currentMapID;
 }
 
 std::vector<Map*> MapDatabase::getAll() {
-    boost::mutex::scoped_lock lock(mapMutex);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mapMutex);
+    return *maps;
+}
+
+MapDatabase::MapList MapDatabase::getMaps() {
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mapMutex);
     return maps;
 }
 
+unsigned long MapDatabase::getVersion() {
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mapMutex);
+    return version;
+}
+
 ORBVocabulary* MapDatabase::getVocab() {
-    boost::mutex::scoped_lock lock(vocMutex);
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, vocMutex);
     return vocab;
 }
 
+void MapDatabase::setVocabLoaded(bool bLoaded) {
+    // The shared inverted file was sized to the empty vocabulary, nothing was added to it yet
+    if(bLoaded)
+        mKeyFrameDB.clear();
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, vocMutex);
+    vocabState = bLoaded ? VOCAB_LOADED : VOCAB_FAILED;
+    vocabLoaded.notify_all();
+}
+
+bool MapDatabase::isVocabLoaded() {
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, vocMutex);
+    return vocabState==VOCAB_LOADED;
+}
+
+bool MapDatabase::waitForVocab() {
+    boost::mutex::scoped_lock lock(vocMutex);
+    if(vocabState==VOCAB_LOADING)
+        ROS_INFO("ORB-SLAM - Waiting for the vocabulary to load.");
+    while(vocabState==VOCAB_LOADING)
+        vocabLoaded.wait(lock);
+    return vocabState==VOCAB_LOADED;
+}
+
 Map* MapDatabase::getOldest(Map* m1, Map* m2) {
-    boost::mutex::scoped_lock lock(mapMutex);
-    for (std::size_t i = 0; i != maps.size(); ++i) {
-        if(maps[i] == m1)
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mapMutex);
+    for (std::size_t i = 0; i != maps->size(); ++i) {
+        if(maps->at(i) == m1)
             return m1;
-        if(maps[i] == m2)
+        if(maps->at(i) == m2)
             return m2;
     }
     return NULL;
 }
 
+void MapDatabase::setShortlist(int nShortlist, int nLevelsUp) {
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, vocMutex);
+    this->shortlist = nShortlist;
+    this->shortlistLevelsUp = nLevelsUp;
+    mKeyFrameDB.SetShortlist(nShortlist, nLevelsUp);
+}
+
+void MapDatabase::setPriorRadius(float fRadius) {
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, vocMutex);
+    this->priorRadius = fRadius;
+    mKeyFrameDB.SetPriorRadius(fRadius);
+}
+
+void MapDatabase::setJournal(MapJournal* pJournal) {
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, vocMutex);
+    this->journal = pJournal;
+}
+
+MapJournal* MapDatabase::getJournal() {
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, vocMutex);
+    return journal;
+}
+
+void MapDatabase::setMemoryBudget(std::size_t nBytes, const std::string &pageDir, bool bCompact) {
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, pagingMutex);
+    this->memoryBudget = nBytes;
+    this->pageDir = pageDir;
+    this->compactPaging = bCompact;
+}
+
+// Erased maps first, then the least recently used
+static bool EvictFirst(const std::pair<std::pair<bool,unsigned long>,Map*> &a, const std::pair<std::pair<bool,unsigned long>,Map*> &b) {
+    return a.first<b.first;
+}
+
+void MapDatabase::enforceMemoryBudget() {
+    // One pager at a time, the maps are paged out outside of the map list lock
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, pagingMutex);
+    if(memoryBudget == 0)
+        return;
+    MapList pMaps = getMaps();
+    Map* pCurrent = getCurrent();
+    std::size_t nResident = 0;
+    std::vector<std::pair<std::pair<bool,unsigned long>,Map*> > vCandidates;
+    std::vector<std::size_t> vBytes;
+    for(std::size_t i=0; i<pMaps->size(); i++) {
+        Map* pMap = pMaps->at(i);
+        const std::size_t nBytes = pMap->PayloadBytes();
+        nResident += nBytes;
+        if(pMap != pCurrent && nBytes > 0)
+            vCandidates.push_back(std::make_pair(std::make_pair(!pMap->getErased(),pMap->LastUsed()),pMap));
+    }
+    if(nResident <= memoryBudget)
+        return;
+    std::sort(vCandidates.begin(), vCandidates.end(), EvictFirst);
+    for(std::size_t i=0; i<vCandidates.size() && nResident>memoryBudget; i++) {
+        Map* pMap = vCandidates[i].second;
+        // The payload is measured again, the map may have changed since
+        const std::size_t nBytes = pMap->PayloadBytes();
+        std::ostringstream oss;
+        oss << pageDir << "/Map_" << pMap->mnId << ".bin";
+        // Pinned maps refuse to be paged out
+        if(pMap->PageOut(oss.str(), compactPaging)) {
+            nResident -= std::min(nResident,nBytes);
+            ROS_INFO("ORB-SLAM - Paged out map %lu, %.1f MB", pMap->mnId, nBytes/(1024.0*1024.0));
+        }
+    }
+    if(nResident > memoryBudget)
+        ROS_WARN_THROTTLE(10, "ORB-SLAM - Map memory budget exceeded, %.1f MB resident", nResident/(1024.0*1024.0));
+}
+
+void MapDatabase::pinMaps(const std::vector<KeyFrame*> &vpKFs, std::vector<Map*> &vpPinned) {
+    for(std::size_t i=0; i<vpKFs.size(); i++) {
+        Map* pMap = vpKFs[i]->getMap();
+        if(pMap == NULL || std::find(vpPinned.begin(), vpPinned.end(), pMap) != vpPinned.end())
+            continue;
+        // A matched map is faulted in, or expanded if compact, here before its keyframes are verified
+        if(pMap->isPagedOut())
+            ROS_INFO("ORB-SLAM - Paging in map %lu", pMap->mnId);
+        pMap->Pin(true);
+        vpPinned.push_back(pMap);
+    }
+}
+
+void MapDatabase::unpinMaps(std::vector<Map*> &vpPinned) {
+    for(std::size_t i=0; i<vpPinned.size(); i++)
+        vpPinned[i]->Unpin();
+    vpPinned.clear();
+}
+
+std::vector<KeyFrame*> MapDatabase::DetectLoopCandidates(KeyFrame* pKF, float minScore, Map* pIgnoreMap) {
+    return mKeyFrameDB.DetectLoopCandidates(pKF, minScore, pIgnoreMap);
+}
+
+void MapDatabase::DetectLoopCandidates(KeyFrame* pKF, float minScore, Map* pLoopMap,
+                                       std::vector<KeyFrame*> &vpLoopCandidates, std::vector<KeyFrame*> &vpMergeCandidates) {
+    mKeyFrameDB.DetectLoopCandidates(pKF, minScore, pLoopMap, vpLoopCandidates, vpMergeCandidates);
+}
+
+float MapDatabase::Score(KeyFrame* pKF1, const DBoW2::FlatBowVector &vBow1, KeyFrame* pKF2) {
+    return mKeyFrameDB.Score(pKF1, vBow1, pKF2);
+}
+
+std::vector<KeyFrame*> MapDatabase::DetectRelocalisationCandidates(Frame* F) {
+    return mKeyFrameDB.DetectRelocalisationCandidates(F);
+}
+
+void MapDatabase::accountMemory(std::vector<std::pair<long unsigned int,MemoryStats> > &vMapStats, MemoryStats &total) {
+    MapList pMaps = getMaps();
+    vMapStats.clear();
+    vMapStats.reserve(pMaps->size());
+    for(std::size_t i=0; i<pMaps->size(); i++) {
+        Map* pMap = pMaps->at(i);
+        vMapStats.push_back(std::make_pair(pMap->mnId,MemoryStats()));
+        pMap->AccountMemory(vMapStats.back().second);
+        total += vMapStats.back().second;
+    }
+    mKeyFrameDB.AccountMemory(total);
+    ORBVocabulary* pVoc = getVocab();
+    if(pVoc && isVocabLoaded())
+        total.Add(MemoryStats::VOCABULARY,pVoc->memoryBytes());
+}
+
+void MapDatabase::addMappedFile(const boost::shared_ptr<MappedFile> &pFile) {
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, vocMutex);
+    mappedFiles.push_back(pFile);
+}
+
 } //namespace ORB_SLAM
\ No newline at end of file
@@ -19,75 +19,136 @@
 */
 
 #include "types/MapPoint.h"
-#include "util/ORBmatcher.h"
+#include "types/MapPointFusion.h"
+#include "util/Converter.h"
+#include "util/ObjectPool.h"
+#include "util/LockProfiler.h"
 #include <ros/ros.h>
+#include <algorithm>
 
 namespace ORB_SLAM
 {
 
-long unsigned int MapPoint::nNextId=0;
+boost::atomic<long unsigned int> MapPoint::nNextId(0);
 
 
 MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
-    mnFirstKFid(pRefKF->mnId), mnTrackReferenceForFrame(0), mnLastFrameSeen(0), mnBALocalForKF(0),
+    mnFirstKFid(pRefKF->mnId), mnBALocalForKF(0),
     mnLoopPointForKF(0), mnCorrectedByKF(0),mnCorrectedReference(0), mpRefKF(pRefKF), mnVisible(1), mnFound(1),
-    mbBad(false), mfMinDistance(0), mfMaxDistance(0), mpMap(pMap)
+    mnRevision(0), mbBad(false), mfMinDistance(0), mfMaxDistance(0), mpMap(pMap)
 {
-    Pos.copyTo(mWorldPos);
+    mWorldPos = Converter::toVector3f(Pos);
     mnId=nNextId++;
-    mNormalVector = cv::Mat::zeros(3,1,CV_32F);
+    mNormalVector.setZero();
+    mDescriptor = DBoW2::Descriptor256();
+}
+
+void* MapPoint::operator new(size_t size)
+{
+    ROS_ASSERT(size==sizeof(MapPoint));
+    return ObjectPool<MapPoint>::Global()->Allocate();
+}
+
+void MapPoint::operator delete(void* p)
+{
+    ObjectPool<MapPoint>::Global()->Free(p);
 }
 
 void MapPoint::SetWorldPos(const cv::Mat &Pos)
 {
-    boost::mutex::scoped_lock lock(mMutexPos);
-    Pos.copyTo(mWorldPos);
+    SetWorldPos(Converter::toVector3f(Pos));
+}
+
+void MapPoint::SetWorldPos(const Eigen::Vector3f &Pos)
+{
+    {
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexPos);
+        mWorldPos = Pos;
+        mnRevision.fetch_add(1,boost::memory_order_relaxed);
+    }
+
+    Map* pMap = getMap();
+    if(pMap)
+        pMap->GetSpatialIndex()->Move(this,Pos);
+}
+
+unsigned long MapPoint::GetRevision() const
+{
+    return mnRevision.load(boost::memory_order_relaxed);
 }
 
 cv::Mat MapPoint::GetWorldPos()
 {
-    boost::mutex::scoped_lock lock(mMutexPos);
-    return mWorldPos.clone();
+    return Converter::toCvMat(GetWorldPosEigen());
+}
+
+Eigen::Vector3f MapPoint::GetWorldPosEigen()
+{
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexPos);
+    return mWorldPos;
 }
 
  Map* MapPoint::getMap() {
-     boost::mutex::scoped_lock lock(mMutexMap);
+     PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexMap);
      return mpMap;
  }
  
 void MapPoint::setMap(Map* m) {
-    boost::mutex::scoped_lock lock(mMutexMap);
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexMap);
     mpMap = m;
 }
 
 cv::Mat MapPoint::GetNormal()
 {
-    boost::mutex::scoped_lock lock(mMutexPos);
-    return mNormalVector.clone();
+    return Converter::toCvMat(GetNormalEigen());
+}
+
+Eigen::Vector3f MapPoint::GetNormalEigen()
+{
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexPos);
+    return mNormalVector;
 }
 
 KeyFrame* MapPoint::GetReferenceKeyFrame()
 {
-     boost::mutex::scoped_lock lock(mMutexFeatures);
+     PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
      return mpRefKF;
 }
 
 void MapPoint::AddObservation(KeyFrame* pKF, size_t idx)
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
-    mObservations[pKF]=idx;
+    PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    ObservationList::iterator mit = FindObservation(pKF);
+    if(mit!=mObservations.end())
+    {
+        mvnLevelObservations[pKF->GetKeyPointScaleLevel(mit->second)]--;
+        mit->second=idx;
+    }
+    else
+    {
+        ChangeCovisibility(mObservations,pKF,1);
+        mObservations.push_back(make_pair(pKF,idx));
+    }
+
+    const int level = pKF->GetKeyPointScaleLevel(idx);
+    if(level>=(int)mvnLevelObservations.size())
+        mvnLevelObservations.resize(level+1,0);
+    mvnLevelObservations[level]++;
 }
 
 void MapPoint::EraseObservation(KeyFrame* pKF)
 {
     bool bBad=false;
     {
-        boost::mutex::scoped_lock lock(mMutexFeatures);
-        if(mObservations.count(pKF))
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexFeatures);
+        ObservationList::iterator mit = FindObservation(pKF);
+        if(mit!=mObservations.end())
         {
-            mObservations.erase(pKF);
+            mvnLevelObservations[pKF->GetKeyPointScaleLevel(mit->second)]--;
+            mObservations.erase(mit);
+            ChangeCovisibility(mObservations,pKF,-1);
 
-            if(mpRefKF==pKF)
+            if(mpRefKF==pKF && !mObservations.empty())
                 mpRefKF=mObservations.begin()->first;
 
             // If only 2 observations or less, discard point
@@ -100,32 +161,122 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
         SetBadFlag();
 }
 
-map<KeyFrame*, size_t> MapPoint::GetObservations()
+void MapPoint::EraseObservations(const vector<KeyFrame*> &vpKFs)
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
+    bool bBad=false;
+    {
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexFeatures);
+        bool bErased=false;
+        for(size_t i=0; i<vpKFs.size(); i++)
+        {
+            KeyFrame* pKF = vpKFs[i];
+            ObservationList::iterator mit = FindObservation(pKF);
+            if(mit==mObservations.end())
+                continue;
+
+            mvnLevelObservations[pKF->GetKeyPointScaleLevel(mit->second)]--;
+            mObservations.erase(mit);
+            ChangeCovisibility(mObservations,pKF,-1);
+
+            if(mpRefKF==pKF && !mObservations.empty())
+                mpRefKF=mObservations.begin()->first;
+            bErased=true;
+        }
+
+        // If only 2 observations or less, discard point
+        if(bErased && mObservations.size()<=2)
+            bBad=true;
+    }
+
+    if(bBad)
+        SetBadFlag();
+}
+
+void MapPoint::ChangeCovisibility(const ObservationList &obs, KeyFrame* pKF, int delta)
+{
+    for(ObservationList::const_iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    {
+        if(mit->first==pKF)
+            continue;
+        mit->first->ChangeCovisibility(pKF,delta);
+        pKF->ChangeCovisibility(mit->first,delta);
+    }
+}
+
+void MapPoint::ClearCovisibility(const ObservationList &obs)
+{
+    for(ObservationList::const_iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    {
+        for(ObservationList::const_iterator mit2=obs.begin(); mit2!=mend; mit2++)
+        {
+            if(mit2!=mit)
+                mit->first->ChangeCovisibility(mit2->first,-1);
+        }
+    }
+}
+
+MapPoint::ObservationList MapPoint::GetObservations()
+{
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
     return mObservations;
 }
 
+MapPoint::ObservationList::iterator MapPoint::FindObservation(KeyFrame* pKF)
+{
+    ObservationList::iterator mit=mObservations.begin(), mend=mObservations.end();
+    while(mit!=mend && mit->first!=pKF)
+        mit++;
+    return mit;
+}
+
 int MapPoint::Observations()
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
     return mObservations.size();
 }
 
+int MapPoint::ObservationsUpToLevel(int nLevel)
+{
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    int nObs=0;
+    for(int i=0, iend=min(nLevel+1,(int)mvnLevelObservations.size()); i<iend; i++)
+        nObs+=mvnLevelObservations[i];
+    return nObs;
+}
+
+void MapPoint::CountLevelObservations()
+{
+    mvnLevelObservations.clear();
+    for(ObservationList::iterator mit=mObservations.begin(), mend=mObservations.end(); mit!=mend; mit++)
+    {
+        const int level = mit->first->GetKeyPointScaleLevel(mit->second);
+        if(level>=(int)mvnLevelObservations.size())
+            mvnLevelObservations.resize(level+1,0);
+        mvnLevelObservations[level]++;
+    }
+}
+
 void MapPoint::SetBadFlag()
 {
-    map<KeyFrame*,size_t> obs;
+    ObservationList obs;
     {
-        boost::mutex::scoped_lock lock1(mMutexFeatures);
-        boost::mutex::scoped_lock lock2(mMutexPos);
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock1, mMutexFeatures);
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock2, mMutexPos);
         obs = mObservations;
         mObservations.clear();
+        mvnLevelObservations.clear();
     }
     {
-        boost::mutex::scoped_lock lock3(mMutexIsBad);
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock3, mMutexIsBad);
         mbBad=true;
     }
-    for(map<KeyFrame*,size_t>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock4, mMutexDescriptorCache);
+        mDescriptorMedoid.Clear();
+        mDescriptorObservations.clear();
+    }
+    ClearCovisibility(obs);
+    for(ObservationList::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
         pKF->EraseMapPointMatch(mit->second);
@@ -136,211 +287,286 @@ void MapPoint::SetBadFlag()
 
 void MapPoint::Replace(MapPoint* pMP)
 {
-    if(pMP->mnId==this->mnId)
-        return;
+    MapPointFusion fusion;
+    fusion.Replace(this,pMP);
+    fusion.Commit();
+}
 
-    map<KeyFrame*,size_t> obs;
+bool MapPoint::isBad()
+{
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexIsBad);
+    return mbBad;
+}
+
+void MapPoint::AccountMemory(MemoryStats &stats)
+{
+    const size_t nObjectBytes = sizeof(MapPoint);
+    size_t nObservationBytes, nDescriptorBytes;
     {
-        boost::mutex::scoped_lock lock1(mMutexFeatures);
-        boost::mutex::scoped_lock lock2(mMutexPos);
-        obs=mObservations;
-        mObservations.clear();
+        PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
+        nObservationBytes = mObservations.HeapBytes()+MemoryStats::VectorBytes(mvnLevelObservations);
     }
     {
-        boost::mutex::scoped_lock lock3(mMutexIsBad);
-        mbBad=true;
+        // The distinctive descriptor is held in the object
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexDescriptorCache);
+        nDescriptorBytes = mDescriptorMedoid.HeapBytes()+mDescriptorObservations.HeapBytes();
     }
 
-    for(map<KeyFrame*,size_t>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    stats.mnMapPoints++;
+    stats.Add(MemoryStats::MAPPOINT_OBJECTS,nObjectBytes);
+    stats.Add(MemoryStats::MAPPOINT_OBSERVATIONS,nObservationBytes);
+    stats.Add(MemoryStats::MAPPOINT_DESCRIPTORS,nDescriptorBytes);
+    if(isBad())
     {
-        // Replace measurement in keyframe
-        KeyFrame* pKF = mit->first;
-
-        if(!pMP->IsInKeyFrame(pKF))
-        {
-            pKF->ReplaceMapPointMatch(mit->second, pMP);
-            pMP->AddObservation(pKF,mit->second);
-        }
-        else
-        {
-            pKF->EraseMapPointMatch(mit->second);
-        }
+        stats.mnBadMapPoints++;
+        stats.mnBadMapPointBytes += nObjectBytes+nObservationBytes+nDescriptorBytes;
     }
-
-    pMP->ComputeDistinctiveDescriptors();
-
-    mpMap->EraseMapPoint(this);
-
-}
-
-bool MapPoint::isBad()
-{
-    boost::mutex::scoped_lock lock(mMutexIsBad);
-    return mbBad;
 }
 
 void MapPoint::IncreaseVisible()
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
-    mnVisible++;
+    mnVisible.fetch_add(1,boost::memory_order_relaxed);
 }
 
 void MapPoint::IncreaseFound()
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
-    mnFound++;
+    mnFound.fetch_add(1,boost::memory_order_relaxed);
 }
 
 float MapPoint::GetFoundRatio()
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
-    return static_cast<float>(mnFound)/mnVisible;
+    return static_cast<float>(mnFound.load(boost::memory_order_relaxed))/mnVisible.load(boost::memory_order_relaxed);
 }
 
 void MapPoint::ComputeDistinctiveDescriptors()
 {
-    // Retrieve all observed descriptors
-    vector<cv::Mat> vDescriptors;
+    ObservationList observations;
 
-    map<KeyFrame*,size_t> observations;
-    
     // Check if bad
     if(isBad())
         return;
 
     {
-        boost::mutex::scoped_lock lock1(mMutexFeatures);
+        PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock1, mMutexFeatures);
         observations=mObservations;
     }
 
-    if(observations.empty())
-        return;
-
-    vDescriptors.reserve(observations.size());
-
-    for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    // Descriptors seen by bad keyframes are left out
+    ObservationList valid;
+    for(ObservationList::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
     {
-        KeyFrame* pKF = mit->first;
-
-        if(!pKF->isBad())
-            vDescriptors.push_back(pKF->GetDescriptor(mit->second));
+        if(!mit->first->isBad())
+            valid.push_back(*mit);
     }
 
-    if(vDescriptors.empty())
+    if(valid.empty())
         return;
 
-    // Compute distances between them
-    const size_t N = vDescriptors.size();
+    PROFILED_LOCK(boost::mutex::scoped_lock, lock, mMutexDescriptorCache);
 
-    float Distances[N][N];
-    for(size_t i=0;i<N;i++)
+    // Bring the cached descriptors up to date with the observations,
+    // only the changed ones compute their distances to the rest
+    for(size_t i=mDescriptorObservations.size(); i-->0; )
     {
-        Distances[i][i]=0;
-        for(size_t j=i+1;j<N;j++)
+        if(find(valid.begin(),valid.end(),mDescriptorObservations[i])==valid.end())
         {
-            int distij = ORBmatcher::DescriptorDistance(vDescriptors[i],vDescriptors[j]);
-            Distances[i][j]=distij;
-            Distances[j][i]=distij;
+            mDescriptorMedoid.Remove(i);
+            mDescriptorObservations.erase(mDescriptorObservations.begin()+i);
         }
     }
 
-    // Take the descriptor with least median distance to the rest
-    int BestMedian = INT_MAX;
-    int BestIdx = 0;
-    for(size_t i=0;i<N;i++)
+    for(ObservationList::iterator mit=valid.begin(), mend=valid.end(); mit!=mend; mit++)
     {
-        vector<int> vDists(Distances[i],Distances[i]+N);
-        sort(vDists.begin(),vDists.end());
-        int median = vDists[0.5*(N-1)];
-
-        if(median<BestMedian)
+        if(find(mDescriptorObservations.begin(),mDescriptorObservations.end(),*mit)==mDescriptorObservations.end())
         {
-            BestMedian = median;
-            BestIdx = i;
+            const cv::Mat descriptors = mit->first->GetDescriptors();
+            mDescriptorMedoid.Add(descriptors.ptr<uchar>(mit->second));
+            mDescriptorObservations.push_back(*mit);
         }
     }
 
+    // Take the descriptor with least median distance to the rest
+    const int BestIdx = mDescriptorMedoid.Best();
+    const DBoW2::Descriptor256 best = DBoW2::Descriptor256::fromBytes(mDescriptorMedoid.Descriptor(BestIdx));
+
     {
-        boost::mutex::scoped_lock lock(mMutexDescriptor);
-        mDescriptor = vDescriptors[BestIdx].clone();       
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexDescriptor);
+        mDescriptor = best;
     }
 }
 
-cv::Mat MapPoint::GetDescriptor()
+DBoW2::Descriptor256 MapPoint::GetDescriptor()
 {
-    boost::mutex::scoped_lock lock(mMutexDescriptor);
-    return mDescriptor.clone();
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexDescriptor);
+    return mDescriptor;
 }
 
 int MapPoint::GetIndexInKeyFrame(KeyFrame *pKF)
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
-    if(mObservations.count(pKF))
-        return mObservations[pKF];
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    ObservationList::iterator mit = FindObservation(pKF);
+    if(mit!=mObservations.end())
+        return mit->second;
     else
         return -1;
 }
 
 bool MapPoint::IsInKeyFrame(KeyFrame *pKF)
 {
-    boost::mutex::scoped_lock lock(mMutexFeatures);
-    return (mObservations.count(pKF));
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
+    return FindObservation(pKF)!=mObservations.end();
 }
 
 void MapPoint::UpdateNormalAndDepth()
 {
-    map<KeyFrame*,size_t> observations;
+    ObservationList observations;
     KeyFrame* pRefKF;
-    cv::Mat Pos;
+    Eigen::Vector3f Pos;
 
     // Check if bad
     if(isBad())
         return;
 
     {
-        boost::mutex::scoped_lock lock1(mMutexFeatures);
-        boost::mutex::scoped_lock lock2(mMutexPos);
+        PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock1, mMutexFeatures);
+        PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock2, mMutexPos);
+        observations=mObservations;
+        pRefKF=mpRefKF;
+        Pos = mWorldPos;
+    }
+
+    Eigen::Vector3f normal;
+    float fMinDistance, fMaxDistance;
+    ComputeNormalAndDepth(observations,pRefKF,Pos,NULL,normal,fMinDistance,fMaxDistance);
+
+    {
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock3, mMutexPos);
+        mfMinDistance = fMinDistance;
+        mfMaxDistance = fMaxDistance;
+        mNormalVector = normal;
+    }
+}
+
+static bool CompareCenterKeyFrames(const std::pair<KeyFrame*,Eigen::Vector3f> &a, const std::pair<KeyFrame*,Eigen::Vector3f> &b)
+{
+    return a.first<b.first;
+}
+
+void MapPoint::SnapshotCenters(const std::vector<KeyFrame*> &vpKFs, KeyFrameCenters &centers)
+{
+    centers.clear();
+    centers.reserve(vpKFs.size());
+    PoseSnapshot pose;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        vpKFs[i]->GetPoseSnapshot(pose);
+        centers.push_back(std::make_pair(vpKFs[i],Eigen::Vector3f(pose.Center())));
+    }
+    std::sort(centers.begin(),centers.end(),CompareCenterKeyFrames);
+}
+
+void MapPoint::SetWorldPosAndNormal(const Eigen::Vector3f &Pos, const KeyFrameCenters &centers)
+{
+    ObservationList observations;
+    KeyFrame* pRefKF;
+    {
+        PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexFeatures);
         observations=mObservations;
         pRefKF=mpRefKF;
-        Pos = mWorldPos.clone();
     }
 
-    cv::Mat normal = cv::Mat::zeros(3,1,CV_32F);
+    Eigen::Vector3f normal;
+    float fMinDistance, fMaxDistance;
+    const bool bObserved = !observations.empty();
+    if(bObserved)
+        ComputeNormalAndDepth(observations,pRefKF,Pos,&centers,normal,fMinDistance,fMaxDistance);
+
+    {
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, mMutexPos);
+        mWorldPos = Pos;
+        mnRevision.fetch_add(1,boost::memory_order_relaxed);
+        if(bObserved)
+        {
+            mfMinDistance = fMinDistance;
+            mfMaxDistance = fMaxDistance;
+            mNormalVector = normal;
+        }
+    }
+
+    Map* pMap = getMap();
+    if(pMap)
+        pMap->GetSpatialIndex()->Move(this,Pos);
+}
+
+void MapPoint::ComputeNormalAndDepth(const ObservationList &observations, KeyFrame* pRefKF, const Eigen::Vector3f &Pos,
+                                     const KeyFrameCenters* pCenters, Eigen::Vector3f &normal, float &fMinDistance, float &fMaxDistance)
+{
+    PoseSnapshot pose;
+    Eigen::Vector3f refCenter;
+    bool bRefObserved = false;
+    normal = Eigen::Vector3f::Zero();
     int n=0;
-    for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    size_t nRefIdx=0;
+    for(ObservationList::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
-        cv::Mat Owi = pKF->GetCameraCenter();
-        cv::Mat normali = mWorldPos - Owi;
-        normal = normal + normali/cv::norm(normali);
+        Eigen::Vector3f center;
+        KeyFrameCenters::const_iterator cit;
+        if(pCenters && (cit=std::lower_bound(pCenters->begin(),pCenters->end(),std::make_pair(pKF,Eigen::Vector3f()),
+                                             CompareCenterKeyFrames))!=pCenters->end() && cit->first==pKF)
+            center = cit->second;
+        else
+        {
+            pKF->GetPoseSnapshot(pose);
+            center = pose.Center();
+        }
+        if(pKF==pRefKF)
+        {
+            nRefIdx=mit->second;
+            refCenter=center;
+            bRefObserved=true;
+        }
+        const Eigen::Vector3f normali = Pos - center;
+        normal += normali/normali.norm();
         n++;
-    } 
+    }
+    normal /= n;
 
-    cv::Mat PC = Pos - pRefKF->GetCameraCenter();
-    const float dist = cv::norm(PC);
-    const int level = pRefKF->GetKeyPointScaleLevel(observations[pRefKF]);
+    // The reference keyframe may have left the observations meanwhile
+    if(!bRefObserved)
+    {
+        pRefKF->GetPoseSnapshot(pose);
+        refCenter = pose.Center();
+    }
+    const float dist = (Pos - refCenter).norm();
+    const int level = pRefKF->GetKeyPointScaleLevel(nRefIdx);
     const float scaleFactor = pRefKF->GetScaleFactor();
     const float levelScaleFactor =  pRefKF->GetScaleFactor(level);
     const int nLevels = pRefKF->GetScaleLevels();
 
-    {
-        boost::mutex::scoped_lock lock3(mMutexPos);
-        mfMinDistance = (1.0f/scaleFactor)*dist / levelScaleFactor;
-        mfMaxDistance = scaleFactor*dist * pRefKF->GetScaleFactor(nLevels-1-level);
-        mNormalVector = normal/n;
-    }
+    fMinDistance = (1.0f/scaleFactor)*dist / levelScaleFactor;
+    fMaxDistance = scaleFactor*dist * pRefKF->GetScaleFactor(nLevels-1-level);
 }
 
 float MapPoint::GetMinDistanceInvariance()
 {
-    boost::mutex::scoped_lock lock(mMutexPos);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexPos);
     return mfMinDistance;
 }
 
 float MapPoint::GetMaxDistanceInvariance()
 {
-    boost::mutex::scoped_lock lock(mMutexPos);
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexPos);
     return mfMaxDistance;
 }
 
+void MapPoint::GetFrustumData(Eigen::Vector3f &Pos, Eigen::Vector3f &Normal, float &minDist, float &maxDist)
+{
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, mMutexPos);
+    Pos = mWorldPos;
+    Normal = mNormalVector;
+    minDist = mfMinDistance;
+    maxDist = mfMaxDistance;
+}
+
 } //namespace ORB_SLAM
@@ -0,0 +1,163 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "types/MapPointFusion.h"
+#include "types/MapPoint.h"
+#include "types/KeyFrame.h"
+#include "types/Map.h"
+#include "util/LockProfiler.h"
+
+namespace ORB_SLAM
+{
+
+MapPointFusion::MapPointFusion(): mnReplaced(0)
+{
+}
+
+void MapPointFusion::ChangeCovisibility(KeyFrame* pKF1, KeyFrame* pKF2, int delta)
+{
+    mCovisibility[pKF1][pKF2]+=delta;
+    mCovisibility[pKF2][pKF1]+=delta;
+}
+
+void MapPointFusion::Replace(MapPoint* pOld, MapPoint* pNew)
+{
+    if(pOld->mnId==pNew->mnId)
+        return;
+
+    MapPoint::ObservationList obs;
+    {
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock1, pOld->mMutexFeatures);
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock2, pOld->mMutexPos);
+        obs=pOld->mObservations;
+        pOld->mObservations.clear();
+        pOld->mvnLevelObservations.clear();
+    }
+    {
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock3, pOld->mMutexIsBad);
+        pOld->mbBad=true;
+    }
+    {
+        PROFILED_LOCK(boost::mutex::scoped_lock, lock4, pOld->mMutexDescriptorCache);
+        pOld->mDescriptorMedoid.Clear();
+        pOld->mDescriptorObservations.clear();
+    }
+
+    // Each pair of keyframes of the old point loses one shared point
+    for(MapPoint::ObservationList::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    {
+        for(MapPoint::ObservationList::iterator mit2=mit+1; mit2!=mend; mit2++)
+            ChangeCovisibility(mit->first,mit2->first,-1);
+    }
+
+    // All the observations are moved under a single lock of the surviving point
+    std::vector<bool> vbMoved(obs.size(),false);
+    {
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, pNew->mMutexFeatures);
+        for(size_t i=0; i<obs.size(); i++)
+        {
+            KeyFrame* pKF = obs[i].first;
+            if(pNew->FindObservation(pKF)!=pNew->mObservations.end())
+                continue;
+
+            for(MapPoint::ObservationList::iterator mit=pNew->mObservations.begin(), mend=pNew->mObservations.end(); mit!=mend; mit++)
+                ChangeCovisibility(mit->first,pKF,1);
+            pNew->mObservations.push_back(obs[i]);
+
+            const int level = pKF->GetKeyPointScaleLevel(obs[i].second);
+            if(level>=(int)pNew->mvnLevelObservations.size())
+                pNew->mvnLevelObservations.resize(level+1,0);
+            pNew->mvnLevelObservations[level]++;
+            vbMoved[i]=true;
+        }
+    }
+
+    // Replace measurement in keyframe
+    for(size_t i=0; i<obs.size(); i++)
+    {
+        if(vbMoved[i])
+            obs[i].first->ReplaceMapPointMatch(obs[i].second,pNew);
+        else
+            obs[i].first->EraseMapPointMatch(obs[i].second);
+    }
+
+    mspSurvivors.insert(pNew);
+    mvpReplaced.push_back(pOld);
+    mnReplaced++;
+}
+
+void MapPointFusion::Add(MapPoint* pMP, KeyFrame* pKF, size_t idx)
+{
+    {
+        PROFILED_LOCK(boost::unique_lock<boost::shared_mutex>, lock, pMP->mMutexFeatures);
+        MapPoint::ObservationList::iterator mit = pMP->FindObservation(pKF);
+        if(mit!=pMP->mObservations.end())
+        {
+            pMP->mvnLevelObservations[pKF->GetKeyPointScaleLevel(mit->second)]--;
+            mit->second=idx;
+        }
+        else
+        {
+            for(MapPoint::ObservationList::iterator mit2=pMP->mObservations.begin(), mend=pMP->mObservations.end(); mit2!=mend; mit2++)
+                ChangeCovisibility(mit2->first,pKF,1);
+            pMP->mObservations.push_back(std::make_pair(pKF,idx));
+        }
+
+        const int level = pKF->GetKeyPointScaleLevel(idx);
+        if(level>=(int)pMP->mvnLevelObservations.size())
+            pMP->mvnLevelObservations.resize(level+1,0);
+        pMP->mvnLevelObservations[level]++;
+    }
+    pKF->AddMapPoint(pMP,idx);
+}
+
+void MapPointFusion::Commit()
+{
+    for(std::map<KeyFrame*,std::map<KeyFrame*,int> >::iterator mit=mCovisibility.begin(), mend=mCovisibility.end(); mit!=mend; mit++)
+        mit->first->ChangeCovisibility(mit->second);
+    mCovisibility.clear();
+
+    // A survivor replaced later in the batch is bad and skipped
+    for(std::set<MapPoint*>::iterator sit=mspSurvivors.begin(), send=mspSurvivors.end(); sit!=send; sit++)
+    {
+        if(!(*sit)->isBad())
+            (*sit)->ComputeDistinctiveDescriptors();
+    }
+    mspSurvivors.clear();
+
+    // Grouped by map, the points of a merge may still belong to both
+    std::map<Map*,std::vector<MapPoint*> > mapReplaced;
+    for(size_t i=0; i<mvpReplaced.size(); i++)
+        mapReplaced[mvpReplaced[i]->getMap()].push_back(mvpReplaced[i]);
+    for(std::map<Map*,std::vector<MapPoint*> >::iterator mit=mapReplaced.begin(), mend=mapReplaced.end(); mit!=mend; mit++)
+    {
+        if(mit->first)
+            mit->first->EraseMapPoints(mit->second);
+    }
+    mvpReplaced.clear();
+}
+
+int MapPointFusion::Replaced() const
+{
+    return mnReplaced;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,94 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "types/MapSnapshot.h"
+#include "types/Map.h"
+
+#include <set>
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+static bool lIdState(const MapSnapshot::KeyFrameState &state, long unsigned int nId)
+{
+    return state.nId<nId;
+}
+
+MapSnapshot::MapSnapshot(Map* pMap, unsigned long nVersion):
+    mnVersion(nVersion)
+{
+    Map::KeyFrameSnapshot keyFrames = pMap->GetKeyFrameSnapshot();
+    mvKeyFrames.reserve(keyFrames.size());
+    for(Map::KeyFrameSnapshot::const_iterator kit=keyFrames.begin(), kend=keyFrames.end(); kit!=kend; kit++)
+    {
+        KeyFrame* pKF = *kit;
+        if(pKF->isBad())
+            continue;
+
+        mvKeyFrames.push_back(KeyFrameState());
+        KeyFrameState &state = mvKeyFrames.back();
+        state.nId = pKF->mnId;
+        state.nRevision = pKF->GetRevision();
+        state.timeStamp = pKF->mTimeStamp;
+        pKF->GetPoseSnapshot(state.pose);
+
+        KeyFrame* pParent = pKF->GetParent();
+        state.nParentId = pParent ? pParent->mnId : pKF->mnId;
+
+        std::vector<KeyFrame*> vCovKFs = pKF->GetCovisiblesByWeight(100);
+        state.vCovisibleIds.reserve(vCovKFs.size());
+        for(size_t i=0; i<vCovKFs.size(); i++)
+            state.vCovisibleIds.push_back(vCovKFs[i]->mnId);
+
+        std::set<KeyFrame*> sLoopKFs = pKF->GetLoopEdges();
+        for(std::set<KeyFrame*>::iterator sit=sLoopKFs.begin(), send=sLoopKFs.end(); sit!=send; sit++)
+            state.vLoopEdgeIds.push_back((*sit)->mnId);
+    }
+
+    Map::MapPointSnapshot mapPoints = pMap->GetMapPointSnapshot();
+    mvMapPoints.reserve(mapPoints.size());
+    for(Map::MapPointSnapshot::const_iterator mit=mapPoints.begin(), mend=mapPoints.end(); mit!=mend; mit++)
+    {
+        MapPoint* pMP = *mit;
+        if(pMP->isBad())
+            continue;
+
+        MapPointState state;
+        state.nRevision = pMP->GetRevision();
+        const Eigen::Vector3f pos = pMP->GetWorldPosEigen();
+        state.nId = pMP->mnId;
+        state.pos[0] = pos(0);
+        state.pos[1] = pos(1);
+        state.pos[2] = pos(2);
+        state.nObs = pMP->Observations();
+        mvMapPoints.push_back(state);
+    }
+}
+
+const MapSnapshot::KeyFrameState* MapSnapshot::FindKeyFrame(long unsigned int nId) const
+{
+    std::vector<KeyFrameState>::const_iterator it = std::lower_bound(mvKeyFrames.begin(),mvKeyFrames.end(),nId,lIdState);
+    if(it==mvKeyFrames.end() || it->nId!=nId)
+        return NULL;
+    return &(*it);
+}
+
+} //namespace ORB_SLAM
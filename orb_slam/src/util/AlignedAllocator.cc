@@ -0,0 +1,167 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/AlignedAllocator.h"
+
+#include <cstdlib>
+#include <new>
+#include <sys/mman.h>
+
+namespace ORB_SLAM
+{
+
+AlignedAllocator* AlignedAllocator::Get()
+{
+    static AlignedAllocator allocator;
+    return &allocator;
+}
+
+// Each buffer is preceded by ALIGNMENT bytes holding the length of its mapping, 0 if it is from the heap
+void* AlignedAllocator::Allocate(size_t nBytes)
+{
+    const size_t nTotal = nBytes+ALIGNMENT;
+    unsigned char* pBlock = NULL;
+    size_t nMapped = 0;
+
+    if(nTotal>=HUGE_PAGE_SIZE)
+    {
+        // Mapped one huge page larger, the ends are trimmed so that the block starts on a huge page
+        nMapped = (nTotal+HUGE_PAGE_SIZE-1)/HUGE_PAGE_SIZE*HUGE_PAGE_SIZE;
+        const size_t nReserved = nMapped+HUGE_PAGE_SIZE;
+        void* p = mmap(NULL,nReserved,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+        if(p!=MAP_FAILED)
+        {
+            unsigned char* pStart = static_cast<unsigned char*>(p);
+            const size_t nHead = (HUGE_PAGE_SIZE-reinterpret_cast<size_t>(pStart)%HUGE_PAGE_SIZE)%HUGE_PAGE_SIZE;
+            if(nHead>0)
+                munmap(pStart,nHead);
+            if(nReserved-nHead>nMapped)
+                munmap(pStart+nHead+nMapped,nReserved-nHead-nMapped);
+            pBlock = pStart+nHead;
+#ifdef MADV_HUGEPAGE
+            madvise(pBlock,nMapped,MADV_HUGEPAGE);
+#endif
+        }
+        else
+            nMapped = 0;
+    }
+
+    if(pBlock==NULL)
+    {
+        void* p = NULL;
+        if(posix_memalign(&p,ALIGNMENT,nTotal)!=0)
+            throw std::bad_alloc();
+        pBlock = static_cast<unsigned char*>(p);
+    }
+
+    *reinterpret_cast<size_t*>(pBlock) = nMapped;
+    return pBlock+ALIGNMENT;
+}
+
+void AlignedAllocator::Free(void* pData)
+{
+    if(pData==NULL)
+        return;
+    unsigned char* pBlock = static_cast<unsigned char*>(pData)-ALIGNMENT;
+    const size_t nMapped = *reinterpret_cast<size_t*>(pBlock);
+    if(nMapped>0)
+        munmap(pBlock,nMapped);
+    else
+        free(pBlock);
+}
+
+#if CV_MAJOR_VERSION>=3
+
+cv::UMatData* AlignedAllocator::allocate(int dims, const int* sizes, int type, void* data0, size_t* step, int,
+                                         cv::UMatUsageFlags) const
+{
+    // Continuous, as the default allocator, unless the steps of the user data are given
+    size_t total = CV_ELEM_SIZE(type);
+    for(int i=dims-1; i>=0; i--)
+    {
+        if(step)
+        {
+            if(data0 && step[i]!=CV_AUTOSTEP)
+            {
+                CV_Assert(total<=step[i]);
+                total = step[i];
+            }
+            else
+                step[i] = total;
+        }
+        total *= sizes[i];
+    }
+
+    uchar* data = data0 ? static_cast<uchar*>(data0) : static_cast<uchar*>(Allocate(total));
+    cv::UMatData* u = new cv::UMatData(this);
+    u->data = u->origdata = data;
+    u->size = total;
+    if(data0)
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+    return u;
+}
+
+bool AlignedAllocator::allocate(cv::UMatData* u, int, cv::UMatUsageFlags) const
+{
+    return u!=NULL;
+}
+
+void AlignedAllocator::deallocate(cv::UMatData* u) const
+{
+    if(u==NULL)
+        return;
+    CV_Assert(u->urefcount==0);
+    CV_Assert(u->refcount==0);
+    if(!(u->flags & cv::UMatData::USER_ALLOCATED))
+    {
+        Free(u->origdata);
+        u->origdata = 0;
+    }
+    delete u;
+}
+
+#else
+
+void AlignedAllocator::allocate(int dims, const int* sizes, int type, int*& refcount, uchar*& datastart, uchar*& data,
+                                size_t* step)
+{
+    // Continuous, the reference count after the data as the default allocator does
+    size_t total = CV_ELEM_SIZE(type);
+    for(int i=dims-1; i>=0; i--)
+    {
+        step[i] = total;
+        total *= sizes[i];
+    }
+    total = cv::alignSize(total,(int)sizeof(*refcount));
+
+    data = datastart = static_cast<uchar*>(Allocate(total+sizeof(*refcount)));
+    refcount = reinterpret_cast<int*>(data+total);
+    *refcount = 1;
+}
+
+void AlignedAllocator::deallocate(int*, uchar* datastart, uchar*)
+{
+    Free(datastart);
+}
+
+#endif
+
+} //namespace ORB_SLAM
@@ -0,0 +1,216 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/AllocationStats.h"
+
+#include <fstream>
+
+#if defined(ORB_SLAM_ALLOC_STATS) && defined(__GLIBC__)
+#include <errno.h>
+#include <stddef.h>
+#endif
+
+namespace ORB_SLAM
+{
+
+// Counters and stage of the calling thread, plain thread locals so that the hook itself never allocates
+// The counters are set on the first stage entered, allocations before that are not counted
+static __thread AllocationStats::ThreadCounters* tlpCounters = 0;
+static __thread int tlnStage = -1;
+
+static inline void CountAllocation(size_t size)
+{
+    AllocationStats::ThreadCounters* pCounters = tlpCounters;
+    const int stage = tlnStage;
+    if(!pCounters || stage<0)
+        return;
+    // Only this thread writes them, the readers just need whole values
+    pCounters->nAllocations[stage].store(pCounters->nAllocations[stage].load(boost::memory_order_relaxed)+1,boost::memory_order_relaxed);
+    pCounters->nBytes[stage].store(pCounters->nBytes[stage].load(boost::memory_order_relaxed)+size,boost::memory_order_relaxed);
+}
+
+AllocationStats::AllocationStats()
+{
+}
+
+AllocationStats* AllocationStats::Global()
+{
+    static AllocationStats stats;
+    return &stats;
+}
+
+bool AllocationStats::isEnabled()
+{
+#ifdef ORB_SLAM_ALLOC_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char* AllocationStats::StageName(int stage)
+{
+    static const char* names[N_STAGES] = {
+        "Frame",
+        "Track",
+        "TrackLocalMap",
+        "ProcessNewKeyFrame",
+        "MapPointCulling",
+        "CreateNewMapPoints",
+        "SearchInNeighbors",
+        "KeyFrameCulling",
+        "PoseOptimization",
+        "LocalBundleAdjustment",
+        "BundleAdjustment",
+        "OptimizeEssentialGraph",
+        "OptimizeSim3"
+    };
+    if(stage<0 || stage>=N_STAGES)
+        return "Unknown";
+    return names[stage];
+}
+
+AllocationStats::ThreadCounters* AllocationStats::Register()
+{
+    ThreadCounters* pCounters = new ThreadCounters();
+    for(int i=0; i<N_STAGES; i++)
+    {
+        pCounters->nCalls[i] = 0;
+        pCounters->nAllocations[i] = 0;
+        pCounters->nBytes[i] = 0;
+    }
+    boost::mutex::scoped_lock lock(mMutexThreads);
+    mvpThreads.push_back(pCounters);
+    return pCounters;
+}
+
+int AllocationStats::Enter(int stage)
+{
+    const int previous = tlnStage;
+    if(stage<0 || stage>=N_STAGES)
+        return previous;
+
+    // Registered outside of any stage, its own allocation is not counted
+    if(!tlpCounters)
+    {
+        tlnStage = -1;
+        tlpCounters = Global()->Register();
+    }
+
+    tlpCounters->nCalls[stage].store(tlpCounters->nCalls[stage].load(boost::memory_order_relaxed)+1,boost::memory_order_relaxed);
+    tlnStage = stage;
+    return previous;
+}
+
+void AllocationStats::Leave(int previous)
+{
+    tlnStage = previous;
+}
+
+AllocationStats::Counts AllocationStats::GetTotal(int stage)
+{
+    Counts total;
+    if(stage<0 || stage>=N_STAGES)
+        return total;
+    boost::mutex::scoped_lock lock(mMutexThreads);
+    for(size_t i=0; i<mvpThreads.size(); i++)
+    {
+        total.nCalls += mvpThreads[i]->nCalls[stage].load(boost::memory_order_relaxed);
+        total.nAllocations += mvpThreads[i]->nAllocations[stage].load(boost::memory_order_relaxed);
+        total.nBytes += mvpThreads[i]->nBytes[stage].load(boost::memory_order_relaxed);
+    }
+    return total;
+}
+
+AllocationStats::Counts AllocationStats::TakeWindow(int stage)
+{
+    Counts window;
+    if(stage<0 || stage>=N_STAGES)
+        return window;
+    const Counts total = GetTotal(stage);
+    boost::mutex::scoped_lock lock(mMutexThreads);
+    Counts &start = mvWindowStart[stage];
+    window.nCalls = total.nCalls-start.nCalls;
+    window.nAllocations = total.nAllocations-start.nAllocations;
+    window.nBytes = total.nBytes-start.nBytes;
+    start = total;
+    return window;
+}
+
+bool AllocationStats::SaveCSV(const std::string &filename)
+{
+    std::ofstream f(filename.c_str());
+    if(!f.is_open())
+        return false;
+
+    f << "stage,calls,allocations,bytes,allocations_per_call,bytes_per_call" << std::endl;
+    for(int i=0; i<N_STAGES; i++)
+    {
+        const Counts total = GetTotal(i);
+        const double nCalls = total.nCalls>0 ? total.nCalls : 1;
+        f << StageName(i) << "," << total.nCalls << "," << total.nAllocations << "," << total.nBytes << ","
+          << total.nAllocations/nCalls << "," << total.nBytes/nCalls << std::endl;
+    }
+    f.close();
+    return true;
+}
+
+} //namespace ORB_SLAM
+
+#if defined(ORB_SLAM_ALLOC_STATS) && defined(__GLIBC__)
+
+// The allocator of glibc under its internal names, the interposed functions forward to it
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t n, size_t size);
+extern "C" void* __libc_realloc(void* p, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+
+extern "C" void* malloc(size_t size)
+{
+    ORB_SLAM::CountAllocation(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size)
+{
+    ORB_SLAM::CountAllocation(n*size);
+    return __libc_calloc(n,size);
+}
+
+extern "C" void* realloc(void* p, size_t size)
+{
+    ORB_SLAM::CountAllocation(size);
+    return __libc_realloc(p,size);
+}
+
+extern "C" int posix_memalign(void** pp, size_t alignment, size_t size)
+{
+    if(alignment%sizeof(void*)!=0 || (alignment&(alignment-1))!=0)
+        return EINVAL;
+    ORB_SLAM::CountAllocation(size);
+    void* p = __libc_memalign(alignment,size);
+    if(!p)
+        return ENOMEM;
+    *pp = p;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,320 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/BinaryIO.h"
+
+#include <stdint.h>
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+void BinaryIO::Write(std::ostream &f, const cv::Mat &m)
+{
+    const int32_t rows = m.rows, cols = m.cols, type = m.type();
+    WritePod(f,rows);
+    WritePod(f,cols);
+    WritePod(f,type);
+    // Row by row, the matrix may be a view into a larger one
+    const size_t nRowBytes = cols*m.elemSize();
+    for(int i=0; i<rows; i++)
+        f.write(reinterpret_cast<const char*>(m.ptr(i)),nRowBytes);
+}
+
+bool BinaryIO::Read(std::istream &f, cv::Mat &m)
+{
+    int32_t rows, cols, type;
+    if(!ReadPod(f,rows) || !ReadPod(f,cols) || !ReadPod(f,type) || rows<0 || cols<0)
+    {
+        m.release();
+        return false;
+    }
+    if(rows==0 || cols==0)
+    {
+        m.release();
+        return true;
+    }
+    // Never read into the data of a previous header, it may be a read-only mapping
+    m.release();
+    m.create(rows,cols,type);
+    f.read(reinterpret_cast<char*>(m.data),m.total()*m.elemSize());
+    if(!f.good())
+    {
+        m.release();
+        return false;
+    }
+    return true;
+}
+
+void BinaryIO::WriteAligned(std::ostream &f, const cv::Mat &m)
+{
+    const int32_t rows = m.rows, cols = m.cols, type = m.type();
+    WritePod(f,rows);
+    WritePod(f,cols);
+    WritePod(f,type);
+    const std::size_t nPos = f.tellp();
+    const std::size_t nPad = (ALIGNMENT-nPos%ALIGNMENT)%ALIGNMENT;
+    const char zeros[ALIGNMENT] = {0};
+    f.write(zeros,nPad);
+    const size_t nRowBytes = cols*m.elemSize();
+    for(int i=0; i<rows; i++)
+        f.write(reinterpret_cast<const char*>(m.ptr(i)),nRowBytes);
+}
+
+bool BinaryIO::ReadAligned(std::istream &f, cv::Mat &m, const char* pBase)
+{
+    int32_t rows, cols, type;
+    m.release();
+    if(!ReadPod(f,rows) || !ReadPod(f,cols) || !ReadPod(f,type) || rows<0 || cols<0)
+        return false;
+    const std::streamoff nPos = f.tellg();
+    if(nPos<0)
+        return false;
+    const std::size_t nPad = (ALIGNMENT-nPos%ALIGNMENT)%ALIGNMENT;
+    if(rows==0 || cols==0)
+    {
+        f.ignore(nPad);
+        return f.good();
+    }
+    if(pBase)
+    {
+        // Header over the mapped data, then skip it
+        cv::Mat header(rows,cols,type,const_cast<char*>(pBase+nPos+nPad));
+        f.seekg(nPos+nPad+header.total()*header.elemSize());
+        if(!f.good())
+            return false;
+        m = header;
+        return true;
+    }
+    f.ignore(nPad);
+    m.create(rows,cols,type);
+    f.read(reinterpret_cast<char*>(m.data),m.total()*m.elemSize());
+    if(!f.good())
+    {
+        m.release();
+        return false;
+    }
+    return true;
+}
+
+void BinaryIO::Write(std::ostream &f, const std::vector<cv::KeyPoint> &vKeys)
+{
+    const uint32_t n = vKeys.size();
+    WritePod(f,n);
+    if(n>0)
+        f.write(reinterpret_cast<const char*>(&vKeys[0]),n*sizeof(cv::KeyPoint));
+}
+
+bool BinaryIO::Read(std::istream &f, std::vector<cv::KeyPoint> &vKeys)
+{
+    uint32_t n;
+    vKeys.clear();
+    if(!ReadPod(f,n))
+        return false;
+    if(n==0)
+        return true;
+    vKeys.resize(n);
+    f.read(reinterpret_cast<char*>(&vKeys[0]),n*sizeof(cv::KeyPoint));
+    if(!f.good())
+    {
+        vKeys.clear();
+        return false;
+    }
+    return true;
+}
+
+void BinaryIO::WriteVarint(std::ostream &f, uint64_t v)
+{
+    while(v>=0x80)
+    {
+        WritePod(f,static_cast<uint8_t>(v|0x80));
+        v >>= 7;
+    }
+    WritePod(f,static_cast<uint8_t>(v));
+}
+
+bool BinaryIO::ReadVarint(std::istream &f, uint64_t &v)
+{
+    v = 0;
+    for(int shift=0; shift<64; shift+=7)
+    {
+        uint8_t byte;
+        if(!ReadPod(f,byte))
+            return false;
+        v |= static_cast<uint64_t>(byte&0x7f)<<shift;
+        if(!(byte&0x80))
+            return true;
+    }
+    return false;
+}
+
+// Subpixel steps of the quantized coordinates, and the angle of an unoriented keypoint
+static const float KEY_QUANTIZATION = 8.0f;
+static const uint16_t NO_ANGLE = 0xffff;
+
+void BinaryIO::WriteQuantized(std::ostream &f, const std::vector<cv::KeyPoint> &vKeys, float x0, float y0)
+{
+    const uint32_t n = vKeys.size();
+    uint8_t bFloat = 0;
+    for(size_t i=0; i<vKeys.size() && !bFloat; i++)
+    {
+        const float dx = (vKeys[i].pt.x-x0)*KEY_QUANTIZATION;
+        const float dy = (vKeys[i].pt.y-y0)*KEY_QUANTIZATION;
+        bFloat = dx<-32768.0f || dx>32767.0f || dy<-32768.0f || dy>32767.0f;
+    }
+    WritePod(f,n);
+    WritePod(f,bFloat);
+    for(size_t i=0; i<vKeys.size(); i++)
+    {
+        const cv::KeyPoint &kp = vKeys[i];
+        if(bFloat)
+        {
+            WritePod(f,kp.pt.x);
+            WritePod(f,kp.pt.y);
+        }
+        else
+        {
+            WritePod(f,static_cast<int16_t>(cvRound((kp.pt.x-x0)*KEY_QUANTIZATION)));
+            WritePod(f,static_cast<int16_t>(cvRound((kp.pt.y-y0)*KEY_QUANTIZATION)));
+        }
+        const uint16_t angle = kp.angle<0 ? NO_ANGLE : static_cast<uint16_t>(std::min(cvRound(kp.angle*(65536.0f/360.0f))&0xffff,NO_ANGLE-1));
+        WritePod(f,angle);
+        WritePod(f,static_cast<uint8_t>(kp.octave));
+    }
+}
+
+bool BinaryIO::ReadQuantized(std::istream &f, std::vector<cv::KeyPoint> &vKeys, float x0, float y0,
+                             const std::vector<float> &vScaleFactors)
+{
+    uint32_t n;
+    uint8_t bFloat;
+    vKeys.clear();
+    if(!ReadPod(f,n) || !ReadPod(f,bFloat))
+        return false;
+    vKeys.resize(n);
+    for(uint32_t i=0; i<n; i++)
+    {
+        cv::KeyPoint &kp = vKeys[i];
+        uint16_t angle;
+        uint8_t octave;
+        bool bOK;
+        if(bFloat)
+            bOK = ReadPod(f,kp.pt.x) && ReadPod(f,kp.pt.y);
+        else
+        {
+            int16_t x, y;
+            bOK = ReadPod(f,x) && ReadPod(f,y);
+            kp.pt.x = x0+x/KEY_QUANTIZATION;
+            kp.pt.y = y0+y/KEY_QUANTIZATION;
+        }
+        if(!bOK || !ReadPod(f,angle) || !ReadPod(f,octave))
+        {
+            vKeys.clear();
+            return false;
+        }
+        kp.angle = angle==NO_ANGLE ? -1.0f : angle*(360.0f/65536.0f);
+        kp.octave = octave;
+        // The patch size of the extractor at the level
+        kp.size = static_cast<int>(31*(octave<vScaleFactors.size() ? vScaleFactors[octave] : 1.0f));
+        kp.response = 0;
+    }
+    return true;
+}
+
+void BinaryIO::Write(std::ostream &f, const DBoW2::BowVector &v)
+{
+    const uint32_t n = v.size();
+    WritePod(f,n);
+    for(DBoW2::BowVector::const_iterator vit=v.begin(), vend=v.end(); vit!=vend; vit++)
+    {
+        WritePod(f,vit->first);
+        WritePod(f,vit->second);
+    }
+}
+
+bool BinaryIO::Read(std::istream &f, DBoW2::BowVector &v)
+{
+    uint32_t n;
+    v.clear();
+    if(!ReadPod(f,n))
+        return false;
+    for(uint32_t i=0; i<n; i++)
+    {
+        DBoW2::WordId id;
+        DBoW2::WordValue value;
+        if(!ReadPod(f,id) || !ReadPod(f,value))
+        {
+            v.clear();
+            return false;
+        }
+        // The words come sorted, hint the insertion at the end
+        v.insert(v.end(),std::make_pair(id,value));
+    }
+    return true;
+}
+
+void BinaryIO::Write(std::ostream &f, const DBoW2::FlatFeatureVector &v)
+{
+    const uint32_t n = v.size();
+    WritePod(f,n);
+    for(size_t i=0; i<v.size(); i++)
+    {
+        const uint32_t nFeatures = v.featureCount(i);
+        WritePod(f,v.nodes[i]);
+        WritePod(f,nFeatures);
+        if(nFeatures>0)
+            f.write(reinterpret_cast<const char*>(v.featuresBegin(i)),nFeatures*sizeof(unsigned int));
+    }
+}
+
+bool BinaryIO::Read(std::istream &f, DBoW2::FlatFeatureVector &v)
+{
+    uint32_t n;
+    v.clear();
+    if(!ReadPod(f,n))
+        return false;
+    v.nodes.reserve(n);
+    v.offsets.reserve(n+1);
+    v.offsets.push_back(0);
+    for(uint32_t i=0; i<n; i++)
+    {
+        DBoW2::NodeId id;
+        uint32_t nFeatures;
+        if(!ReadPod(f,id) || !ReadPod(f,nFeatures))
+        {
+            v.clear();
+            return false;
+        }
+        const size_t nStart = v.features.size();
+        v.nodes.push_back(id);
+        v.features.resize(nStart+nFeatures);
+        if(nFeatures>0)
+            f.read(reinterpret_cast<char*>(&v.features[nStart]),nFeatures*sizeof(unsigned int));
+        if(!f.good())
+        {
+            v.clear();
+            return false;
+        }
+        v.offsets.push_back(v.features.size());
+    }
+    return true;
+}
+
+} //namespace ORB_SLAM
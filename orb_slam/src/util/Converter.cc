@@ -22,6 +22,9 @@
 #include "util/Converter.h"
 #include <ros/ros.h>
 
+#include <cstdio>
+#include <algorithm>
+
 namespace ORB_SLAM
 {
 
@@ -35,6 +38,17 @@ std::vector<cv::Mat> Converter::toDescriptorVector(const cv::Mat &Descriptors)
     return vDesc;
 }
 
+DBoW2::Descriptor256 Converter::toDescriptor256(const cv::Mat &row)
+{
+    CV_Assert(row.type()==CV_8U && row.rows==1 && row.cols==DBoW2::Hamming::L);
+    return DBoW2::Descriptor256::fromBytes(row.ptr<uchar>());
+}
+
+cv::Mat Converter::toCvMat(const DBoW2::Descriptor256 &d)
+{
+    return cv::Mat(1,DBoW2::Hamming::L,CV_8U,const_cast<uchar*>(d.bytes())).clone();
+}
+
 g2o::SE3Quat Converter::toSE3Quat(const cv::Mat &cvT)
 {
     Eigen::Matrix<double,3,3> R;
@@ -108,6 +122,25 @@ cv::Mat Converter::toCvSE3(const Eigen::Matrix<double,3,3> &R, const Eigen::Matr
     return cvMat.clone();
 }
 
+cv::Mat Converter::toCvMat(const Eigen::Matrix3f &m)
+{
+    cv::Mat cvMat(3,3,CV_32F);
+    for(int i=0;i<3;i++)
+        for(int j=0; j<3; j++)
+            cvMat.at<float>(i,j)=m(i,j);
+
+    return cvMat;
+}
+
+cv::Mat Converter::toCvMat(const Eigen::Vector3f &m)
+{
+    cv::Mat cvMat(3,1,CV_32F);
+    for(int i=0;i<3;i++)
+            cvMat.at<float>(i)=m(i);
+
+    return cvMat;
+}
+
 Eigen::Matrix<double,3,1> Converter::toVector3d(const cv::Mat &cvVector)
 {
     Eigen::Matrix<double,3,1> v;
@@ -145,6 +178,22 @@ Eigen::Matrix<double,3,3> Converter::toMatrix3d(const cv::Mat &cvMat3)
     return M;
 }
 
+Eigen::Vector3f Converter::toVector3f(const cv::Mat &cvVector)
+{
+    return Eigen::Vector3f(cvVector.at<float>(0), cvVector.at<float>(1), cvVector.at<float>(2));
+}
+
+Eigen::Matrix3f Converter::toMatrix3f(const cv::Mat &cvMat3)
+{
+    Eigen::Matrix3f M;
+
+    M << cvMat3.at<float>(0,0), cvMat3.at<float>(0,1), cvMat3.at<float>(0,2),
+         cvMat3.at<float>(1,0), cvMat3.at<float>(1,1), cvMat3.at<float>(1,2),
+         cvMat3.at<float>(2,0), cvMat3.at<float>(2,1), cvMat3.at<float>(2,2);
+
+    return M;
+}
+
 std::vector<float> Converter::toQuaternion(const cv::Mat &M)
 {
     Eigen::Matrix<double,3,3> eigMat = toMatrix3d(M);
@@ -159,4 +208,14 @@ std::vector<float> Converter::toQuaternion(const cv::Mat &M)
     return v;
 }
 
+void Converter::appendTrajectoryLine(std::string &buffer, double timeStamp, const Eigen::Matrix3f &Rwc, const Eigen::Vector3f &twc)
+{
+    const Eigen::Quaternionf q(Rwc);
+    char line[192];
+    const int n = snprintf(line, sizeof(line), "%.6f %.7f %.7f %.7f %.7f %.7f %.7f %.7f\n",
+                           timeStamp, twc(0), twc(1), twc(2), q.x(), q.y(), q.z(), q.w());
+    if(n>0)
+        buffer.append(line, std::min<size_t>(n, sizeof(line)-1));
+}
+
 } //namespace ORB_SLAM
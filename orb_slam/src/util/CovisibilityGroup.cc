@@ -0,0 +1,89 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/CovisibilityGroup.h"
+#include "types/KeyFrame.h"
+
+#include <algorithm>
+#include <set>
+
+namespace ORB_SLAM
+{
+
+CovisibilityGroup::CovisibilityGroup()
+{
+}
+
+CovisibilityGroup::CovisibilityGroup(KeyFrame* pKF)
+{
+    // Every connection, the weak ones included, as the covisible list only keeps the links of weight 15 or more
+    // The set is already sorted by address, the candidate is inserted in place
+    std::set<KeyFrame*> spConnected = pKF->GetConnectedKeyFrames();
+    mvpKeyFrames.reserve(spConnected.size()+1);
+    mvpKeyFrames.assign(spConnected.begin(),spConnected.end());
+    std::vector<KeyFrame*>::iterator it = lower_bound(mvpKeyFrames.begin(),mvpKeyFrames.end(),pKF);
+    if(it==mvpKeyFrames.end() || *it!=pKF)
+        mvpKeyFrames.insert(it,pKF);
+}
+
+bool CovisibilityGroup::Intersects(const CovisibilityGroup &other) const
+{
+    const std::vector<KeyFrame*> &vA = mvpKeyFrames.size()<=other.mvpKeyFrames.size() ? mvpKeyFrames : other.mvpKeyFrames;
+    const std::vector<KeyFrame*> &vB = &vA==&mvpKeyFrames ? other.mvpKeyFrames : mvpKeyFrames;
+
+    // Disjoint ranges
+    if(vA.empty() || vA.back()<vB.front() || vB.back()<vA.front())
+        return false;
+
+    // A group much smaller than the other is searched by bisection of what is left of the larger one
+    if(vA.size()*8<vB.size())
+    {
+        std::vector<KeyFrame*>::const_iterator itB = vB.begin();
+        for(std::vector<KeyFrame*>::const_iterator itA=vA.begin(); itA!=vA.end(); itA++)
+        {
+            itB = lower_bound(itB,vB.end(),*itA);
+            if(itB==vB.end())
+                return false;
+            if(*itB==*itA)
+                return true;
+        }
+        return false;
+    }
+
+    std::vector<KeyFrame*>::const_iterator itA = vA.begin(), itB = vB.begin();
+    while(itA!=vA.end() && itB!=vB.end())
+    {
+        if(*itA<*itB)
+            itA++;
+        else if(*itB<*itA)
+            itB++;
+        else
+            return true;
+    }
+    return false;
+}
+
+bool CovisibilityGroup::count(KeyFrame* pKF) const
+{
+    return binary_search(mvpKeyFrames.begin(),mvpKeyFrames.end(),pKF);
+}
+
+} //namespace ORB_SLAM
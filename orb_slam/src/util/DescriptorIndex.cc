@@ -0,0 +1,95 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/DescriptorIndex.h"
+
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+DescriptorIndex::DescriptorIndex(const cv::Mat &Descriptors):
+    mN(Descriptors.rows)
+{
+    // About two buckets per feature, a power of two so the multiplicative hash keeps the high bits
+    int nBits = 1;
+    while(((size_t)1<<nBits)<2*mN && nBits<16)
+        nBits++;
+    mnShift = 32-nBits;
+    mnBuckets = (size_t)1<<nBits;
+
+    for(int s=0; s<SUBSTRINGS; s++)
+    {
+        std::vector<uint16_t> &vKeys = mvKeys[s];
+        std::vector<uint32_t> &vOffsets = mvOffsets[s];
+        std::vector<uint32_t> &vEntries = mvEntries[s];
+
+        vKeys.resize(mN);
+        vOffsets.assign(mnBuckets+1,0);
+        vEntries.resize(mN);
+
+        // Counting sort of the features by bucket
+        for(size_t i=0; i<mN; i++)
+        {
+            vKeys[i] = Substring(Descriptors.ptr<unsigned char>(i),s);
+            vOffsets[Bucket(vKeys[i])+1]++;
+        }
+        for(size_t b=0; b<mnBuckets; b++)
+            vOffsets[b+1] += vOffsets[b];
+        std::vector<uint32_t> vFill(vOffsets.begin(),vOffsets.end()-1);
+        for(size_t i=0; i<mN; i++)
+            vEntries[vFill[Bucket(vKeys[i])]++] = i;
+    }
+}
+
+void DescriptorIndex::Lookup(int s, uint16_t key, std::vector<size_t> &vIndices) const
+{
+    const size_t b = Bucket(key);
+    const std::vector<uint16_t> &vKeys = mvKeys[s];
+    const std::vector<uint32_t> &vEntries = mvEntries[s];
+    for(uint32_t k=mvOffsets[s][b], kend=mvOffsets[s][b+1]; k<kend; k++)
+    {
+        const uint32_t i = vEntries[k];
+        if(vKeys[i]==key)
+            vIndices.push_back(i);
+    }
+}
+
+void DescriptorIndex::Query(const unsigned char* d, std::vector<size_t> &vIndices) const
+{
+    vIndices.clear();
+    if(mN==0)
+        return;
+
+    for(int s=0; s<SUBSTRINGS; s++)
+    {
+        const uint16_t key = Substring(d,s);
+        Lookup(s,key,vIndices);
+        for(int bit=0; bit<16; bit++)
+            Lookup(s,key^(uint16_t)(1<<bit),vIndices);
+    }
+
+    // A feature close to the query shares several substrings with it
+    std::sort(vIndices.begin(),vIndices.end());
+    vIndices.erase(std::unique(vIndices.begin(),vIndices.end()),vIndices.end());
+}
+
+} //namespace ORB_SLAM
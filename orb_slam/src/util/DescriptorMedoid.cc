@@ -0,0 +1,99 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/DescriptorMedoid.h"
+
+#include "dbow2/Hamming.h"
+
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+void DescriptorMedoid::Add(const unsigned char* pDescriptor)
+{
+    const size_t N = size();
+    mvDescriptors.insert(mvDescriptors.end(),pDescriptor,pDescriptor+L);
+
+    mvNewDistances.resize(N+1);
+    DBoW2::Hamming::distances(pDescriptor,&mvDescriptors[0],N+1,&mvNewDistances[0]);
+
+    for(size_t i=0; i<N; i++)
+    {
+        std::vector<uint16_t> &row = mvDistances[i];
+        const uint16_t d = mvNewDistances[i];
+        row.insert(std::upper_bound(row.begin(),row.end(),d),d);
+    }
+
+    std::vector<uint16_t> row(mvNewDistances.begin(),mvNewDistances.end());
+    std::sort(row.begin(),row.end());
+    mvDistances.push_back(row);
+}
+
+void DescriptorMedoid::Remove(size_t i)
+{
+    const size_t N = size();
+    mvNewDistances.resize(N);
+    DBoW2::Hamming::distances(Descriptor(i),&mvDescriptors[0],N,&mvNewDistances[0]);
+
+    for(size_t j=0; j<N; j++)
+    {
+        if(j==i)
+            continue;
+        std::vector<uint16_t> &row = mvDistances[j];
+        row.erase(std::lower_bound(row.begin(),row.end(),static_cast<uint16_t>(mvNewDistances[j])));
+    }
+
+    mvDistances.erase(mvDistances.begin()+i);
+    mvDescriptors.erase(mvDescriptors.begin()+i*L,mvDescriptors.begin()+(i+1)*L);
+}
+
+void DescriptorMedoid::Clear()
+{
+    mvDescriptors.clear();
+    mvDistances.clear();
+}
+
+size_t DescriptorMedoid::HeapBytes() const
+{
+    size_t nBytes = mvDescriptors.capacity() + mvNewDistances.capacity()*sizeof(int) +
+                    mvDistances.capacity()*sizeof(std::vector<uint16_t>);
+    for(size_t i=0; i<mvDistances.size(); i++)
+        nBytes += mvDistances[i].capacity()*sizeof(uint16_t);
+    return nBytes;
+}
+
+int DescriptorMedoid::Best() const
+{
+    const size_t N = size();
+    if(N==0)
+        return -1;
+
+    const size_t median = (N-1)/2;
+    int bestIdx = 0;
+    for(size_t i=1; i<N; i++)
+    {
+        if(mvDistances[i][median]<mvDistances[bestIdx][median])
+            bestIdx = i;
+    }
+    return bestIdx;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,115 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/EpochReclaimer.h"
+
+namespace ORB_SLAM
+{
+
+EpochReclaimer::EpochReclaimer():
+    mnEpoch(0)
+{
+}
+
+EpochReclaimer* EpochReclaimer::Global()
+{
+    static EpochReclaimer reclaimer;
+    return &reclaimer;
+}
+
+int EpochReclaimer::Register()
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    for(size_t i=0; i<mvbRegistered.size(); i++)
+    {
+        if(!mvbRegistered[i])
+        {
+            mvbRegistered[i] = true;
+            mvnAnnounced[i] = mnEpoch;
+            return i;
+        }
+    }
+    mvbRegistered.push_back(true);
+    mvnAnnounced.push_back(mnEpoch);
+    return mvbRegistered.size()-1;
+}
+
+void EpochReclaimer::Unregister(int id)
+{
+    std::vector<Retired> vExpired;
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mvbRegistered[id] = false;
+        Advance(vExpired);
+    }
+    for(size_t i=0; i<vExpired.size(); i++)
+        vExpired[i].deleter(vExpired[i].p);
+}
+
+void EpochReclaimer::Quiescent(int id)
+{
+    std::vector<Retired> vExpired;
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mvnAnnounced[id] = mnEpoch;
+        Advance(vExpired);
+    }
+    // Deleters may take other locks, so they run outside ours
+    for(size_t i=0; i<vExpired.size(); i++)
+        vExpired[i].deleter(vExpired[i].p);
+}
+
+void EpochReclaimer::Retire(void* p, Deleter deleter)
+{
+    Retired r;
+    r.p = p;
+    r.deleter = deleter;
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        r.nEpoch = mnEpoch;
+        mdRetired.push_back(r);
+    }
+}
+
+size_t EpochReclaimer::Pending()
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    return mdRetired.size();
+}
+
+void EpochReclaimer::Advance(std::vector<Retired> &vExpired)
+{
+    // The epoch moves on once every registered thread has seen the current one
+    bool bAll = true;
+    for(size_t i=0; i<mvbRegistered.size() && bAll; i++)
+        if(mvbRegistered[i] && mvnAnnounced[i]!=mnEpoch)
+            bAll = false;
+    if(bAll)
+        mnEpoch++;
+
+    // Objects retired two epochs ago cannot be referenced anymore
+    while(!mdRetired.empty() && mdRetired.front().nEpoch+2<=mnEpoch)
+    {
+        vExpired.push_back(mdRetired.front());
+        mdRetired.pop_front();
+    }
+}
+
+} //namespace ORB_SLAM
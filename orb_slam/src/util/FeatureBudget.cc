@@ -0,0 +1,104 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/FeatureBudget.h"
+
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+// Weight of the last measurement in the smoothed tracking time
+const float FeatureBudget::TIME_SMOOTHING = 0.3f;
+
+FeatureBudget::FeatureBudget(int nFeatures, int fastTh, int nMinFeatures, int nMaxFeatures, int nMinFastTh, int nMaxFastTh,
+                             float targetTime, int nTargetInliers, int nMaxMappingQueue):
+    mnFeatures(nFeatures), mnFastTh(fastTh), mnNominalFastTh(fastTh),
+    mnMinFeatures(nMinFeatures), mnMaxFeatures(std::max(nMaxFeatures,nMinFeatures)),
+    mnMinFastTh(std::max(nMinFastTh,1)), mnMaxFastTh(std::max(nMaxFastTh,nMinFastTh)),
+    mfTargetTime(targetTime), mnTargetInliers(nTargetInliers), mnMaxMappingQueue(nMaxMappingQueue), mfTime(-1)
+{
+    mnFeatures = std::min(std::max(mnFeatures,mnMinFeatures),mnMaxFeatures);
+    mnFastTh = std::min(std::max(mnFastTh,mnMinFastTh),mnMaxFastTh);
+}
+
+bool FeatureBudget::Update(float time, int nKeys, int nInliers, int nMappingQueue)
+{
+    if(mfTime<0)
+        mfTime = time;
+    else
+        mfTime = TIME_SMOOTHING*time + (1-TIME_SMOOTHING)*mfTime;
+
+    const float load = mfTime/mfTargetTime;
+
+    // Over budget if tracking is too slow or local mapping cannot keep up
+    const bool bOverloaded = load>1.0f || nMappingQueue>mnMaxMappingQueue;
+    // Tracking quality
+    const bool bWeak = nInliers<mnTargetInliers;
+    const bool bStrong = nInliers>2*mnTargetInliers;
+
+    float factor = 1.0f;
+    if(bOverloaded)
+    {
+        // A weak track keeps its features unless we are far too slow
+        if(!bWeak || load>1.5f)
+            factor = std::max(0.8f, std::min(0.95f, 1.0f/load));
+    }
+    else if(bWeak)
+    {
+        // Grow with the available headroom
+        factor = std::max(1.0f, std::min(1.2f, 0.9f/load));
+    }
+    else if(bStrong)
+    {
+        // Slowly release features that tracking does not need
+        factor = 0.97f;
+    }
+
+    int nFeatures = mnFeatures;
+    if(factor!=1.0f)
+        nFeatures = std::min(std::max((int)(mnFeatures*factor),mnMinFeatures),mnMaxFeatures);
+
+    // The FAST threshold takes over when the feature count saturates
+    int fastTh = mnFastTh;
+    if(bWeak && nKeys<0.8f*mnFeatures)
+    {
+        // The detector cannot fill the budget, accept weaker corners
+        fastTh = std::max(mnFastTh-1,mnMinFastTh);
+    }
+    else if(bOverloaded && nFeatures==mnMinFeatures)
+    {
+        // Fewer corners to score and sort
+        fastTh = std::min(mnFastTh+1,mnMaxFastTh);
+    }
+    else if(!bWeak && nKeys>=mnFeatures && mnFastTh<mnNominalFastTh)
+    {
+        // Enough corners again, back to the configured threshold
+        fastTh = mnFastTh+1;
+    }
+
+    const bool bChanged = nFeatures!=mnFeatures || fastTh!=mnFastTh;
+    mnFeatures = nFeatures;
+    mnFastTh = fastTh;
+
+    return bChanged;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,88 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/FlowTracker.h"
+#include "types/Frame.h"
+
+#include <opencv2/video/tracking.hpp>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+FlowTracker::FlowTracker(int nWindow, int nLevels, float fMaxError):
+    mWindow(nWindow,nWindow), mnLevels(nLevels), mfMaxError(fMaxError), mPyramidTimeStamp(-1)
+{
+}
+
+void FlowTracker::Track(const Frame &previous, const cv::Mat &im, double timeStamp, vector<cv::KeyPoint> &vKeys, vector<int> &vIndices)
+{
+    vKeys.clear();
+    vIndices.clear();
+
+    // The pyramid of the previous image is the one kept from the last call, unless the flow was interrupted
+    if(mPyramidImage.data==previous.im.data && mPyramidTimeStamp==previous.mTimeStamp && !mvPyramid.empty())
+        mvPreviousPyramid.swap(mvPyramid);
+    else
+        cv::buildOpticalFlowPyramid(previous.im,mvPreviousPyramid,mWindow,mnLevels);
+    cv::buildOpticalFlowPyramid(im,mvPyramid,mWindow,mnLevels);
+    mPyramidImage = im;
+    mPyramidTimeStamp = timeStamp;
+
+    // Keypoints matched in the previous frame, in the image (distorted)
+    mvPoints.clear();
+    for(int i=0; i<previous.N; i++)
+    {
+        if(!previous.mvpMapPoints[i])
+            continue;
+        mvPoints.push_back(previous.mvKeys[i].pt);
+        vIndices.push_back(i);
+    }
+    if(mvPoints.empty())
+        return;
+
+    const cv::TermCriteria criteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS,30,0.01);
+    cv::calcOpticalFlowPyrLK(mvPreviousPyramid,mvPyramid,mvPoints,mvTracked,mvStatus,mvError,mWindow,mnLevels,criteria);
+    cv::calcOpticalFlowPyrLK(mvPyramid,mvPreviousPyramid,mvTracked,mvBack,mvBackStatus,mvError,mWindow,mnLevels,criteria);
+
+    const float maxError2 = mfMaxError*mfMaxError;
+    size_t nTracked = 0;
+    vKeys.reserve(mvPoints.size());
+    for(size_t i=0; i<mvPoints.size(); i++)
+    {
+        if(!mvStatus[i] || !mvBackStatus[i])
+            continue;
+        const cv::Point2f d = mvBack[i]-mvPoints[i];
+        if(d.x*d.x+d.y*d.y>maxError2)
+            continue;
+        const cv::Point2f &pt = mvTracked[i];
+        if(pt.x<0 || pt.y<0 || pt.x>=im.cols || pt.y>=im.rows)
+            continue;
+
+        cv::KeyPoint kp = previous.mvKeys[vIndices[i]];
+        kp.pt = pt;
+        vKeys.push_back(kp);
+        vIndices[nTracked++] = vIndices[i];
+    }
+    vIndices.resize(nTracked);
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,268 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/FrustumCuller.h"
+
+#include "types/Frame.h"
+#include "types/MapPoint.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Vectorized test is used when the target supports it, unless ORB_SLAM_NO_SIMD is defined
+// The scalar test is kept as reference and for the remaining points
+#if !defined(ORB_SLAM_NO_SIMD)
+#if defined(__SSE2__)
+#define ORB_SLAM_SIMD_SSE2
+#include <emmintrin.h>
+#elif (defined(__ARM_NEON__) || defined(__ARM_NEON)) && defined(__aarch64__)
+#define ORB_SLAM_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace ORB_SLAM
+{
+
+FrustumCuller::FrustumCuller()
+{}
+
+int FrustumCuller::Cull(const Frame &F, const std::vector<MapPoint*> &vpMapPoints, const std::vector<MapPoint*> &vpMatched,
+                        const float viewingCosLimit, LocalMapProjection &proj)
+{
+    Gather(vpMapPoints,vpMatched);
+    Test(F,viewingCosLimit);
+
+    const size_t nSlots = vpMapPoints.size();
+    proj.vbInView.assign(nSlots,0);
+    proj.vProjX.resize(nSlots);
+    proj.vProjY.resize(nSlots);
+    proj.vScaleLevel.resize(nSlots);
+    proj.vViewCos.resize(nSlots);
+
+    const int nMaxLevel = F.mnScaleLevels-1;
+
+    int nInView = 0;
+    for(size_t i=0, iend=mvpPoints.size(); i<iend; i++)
+    {
+        if(!mvbInView[i])
+            continue;
+
+        // Predict scale level according to the distance
+        const float ratio = mvDist[i]/mvMinDist[i];
+        std::vector<float>::const_iterator it = std::lower_bound(F.mvScaleFactors.begin(), F.mvScaleFactors.end(), ratio);
+        const int nPredictedLevel = std::min(static_cast<int>(it-F.mvScaleFactors.begin()),nMaxLevel);
+
+        // Data used by the tracking
+        const size_t slot = mvSlots[i];
+        proj.vbInView[slot] = 1;
+        proj.vProjX[slot] = mvU[i];
+        proj.vProjY[slot] = mvV[i];
+        proj.vScaleLevel[slot] = nPredictedLevel;
+        proj.vViewCos[slot] = mvViewCos[i];
+        mvpPoints[i]->IncreaseVisible();
+        nInView++;
+    }
+
+    return nInView;
+}
+
+void FrustumCuller::Gather(const std::vector<MapPoint*> &vpMapPoints, const std::vector<MapPoint*> &vpMatched)
+{
+    mvpMatched.assign(vpMatched.begin(),vpMatched.end());
+    std::sort(mvpMatched.begin(),mvpMatched.end());
+
+    mvpPoints.clear();
+    mvSlots.clear();
+    mvX.clear(); mvY.clear(); mvZ.clear();
+    mvNx.clear(); mvNy.clear(); mvNz.clear();
+    mvMinDist.clear(); mvMaxDist.clear();
+
+    Eigen::Vector3f Pos, Normal;
+    float minDist, maxDist;
+    for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
+    {
+        MapPoint* pMP = vpMapPoints[i];
+        if(pMP->isBad())
+            continue;
+        if(std::binary_search(mvpMatched.begin(),mvpMatched.end(),pMP))
+            continue;
+
+        pMP->GetFrustumData(Pos,Normal,minDist,maxDist);
+
+        mvpPoints.push_back(pMP);
+        mvSlots.push_back(i);
+        mvX.push_back(Pos(0)); mvY.push_back(Pos(1)); mvZ.push_back(Pos(2));
+        mvNx.push_back(Normal(0)); mvNy.push_back(Normal(1)); mvNz.push_back(Normal(2));
+        mvMinDist.push_back(minDist);
+        mvMaxDist.push_back(maxDist);
+    }
+
+    const size_t N = mvpPoints.size();
+    mvU.resize(N);
+    mvV.resize(N);
+    mvDist.resize(N);
+    mvViewCos.resize(N);
+    mvbInView.resize(N);
+}
+
+void FrustumCuller::Test(const Frame &F, const float viewingCosLimit)
+{
+    const Eigen::Matrix3f &R = F.GetRotation();
+    const Eigen::Vector3f &t = F.GetTranslation();
+    const Eigen::Vector3f &O = F.GetCameraCenter();
+
+    const float minX = F.mnMinX, maxX = F.mnMaxX;
+    const float minY = F.mnMinY, maxY = F.mnMaxY;
+
+    const size_t N = mvpPoints.size();
+    size_t i = 0;
+
+#if defined(ORB_SLAM_SIMD_SSE2)
+    const __m128 r00 = _mm_set1_ps(R(0,0)), r01 = _mm_set1_ps(R(0,1)), r02 = _mm_set1_ps(R(0,2));
+    const __m128 r10 = _mm_set1_ps(R(1,0)), r11 = _mm_set1_ps(R(1,1)), r12 = _mm_set1_ps(R(1,2));
+    const __m128 r20 = _mm_set1_ps(R(2,0)), r21 = _mm_set1_ps(R(2,1)), r22 = _mm_set1_ps(R(2,2));
+    const __m128 t0 = _mm_set1_ps(t(0)), t1 = _mm_set1_ps(t(1)), t2 = _mm_set1_ps(t(2));
+    const __m128 o0 = _mm_set1_ps(O(0)), o1 = _mm_set1_ps(O(1)), o2 = _mm_set1_ps(O(2));
+    const __m128 fx = _mm_set1_ps(F.fx), fy = _mm_set1_ps(F.fy), cx = _mm_set1_ps(F.cx), cy = _mm_set1_ps(F.cy);
+    const __m128 vMinX = _mm_set1_ps(minX), vMaxX = _mm_set1_ps(maxX);
+    const __m128 vMinY = _mm_set1_ps(minY), vMaxY = _mm_set1_ps(maxY);
+    const __m128 vCosLimit = _mm_set1_ps(viewingCosLimit);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    for(; i+4<=N; i+=4)
+    {
+        const __m128 x = _mm_loadu_ps(&mvX[i]), y = _mm_loadu_ps(&mvY[i]), z = _mm_loadu_ps(&mvZ[i]);
+
+        // 3D in camera coordinates, must have positive depth
+        const __m128 xc = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r00,x),_mm_mul_ps(r01,y)),_mm_mul_ps(r02,z)),t0);
+        const __m128 yc = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r10,x),_mm_mul_ps(r11,y)),_mm_mul_ps(r12,z)),t1);
+        const __m128 zc = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r20,x),_mm_mul_ps(r21,y)),_mm_mul_ps(r22,z)),t2);
+        __m128 mask = _mm_cmpge_ps(zc,zero);
+
+        // Project in image and check it is not outside
+        const __m128 invz = _mm_div_ps(one,zc);
+        const __m128 u = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(fx,xc),invz),cx);
+        const __m128 v = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(fy,yc),invz),cy);
+        mask = _mm_and_ps(mask,_mm_and_ps(_mm_cmpge_ps(u,vMinX),_mm_cmple_ps(u,vMaxX)));
+        mask = _mm_and_ps(mask,_mm_and_ps(_mm_cmpge_ps(v,vMinY),_mm_cmple_ps(v,vMaxY)));
+
+        // Distance must be in the scale invariance region
+        const __m128 dx = _mm_sub_ps(x,o0), dy = _mm_sub_ps(y,o1), dz = _mm_sub_ps(z,o2);
+        const __m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx,dx),_mm_mul_ps(dy,dy)),_mm_mul_ps(dz,dz)));
+        mask = _mm_and_ps(mask,_mm_cmpge_ps(dist,_mm_loadu_ps(&mvMinDist[i])));
+        mask = _mm_and_ps(mask,_mm_cmple_ps(dist,_mm_loadu_ps(&mvMaxDist[i])));
+
+        // Viewing angle
+        const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx,_mm_loadu_ps(&mvNx[i])),_mm_mul_ps(dy,_mm_loadu_ps(&mvNy[i]))),
+                                      _mm_mul_ps(dz,_mm_loadu_ps(&mvNz[i])));
+        const __m128 viewCos = _mm_div_ps(dot,dist);
+        mask = _mm_and_ps(mask,_mm_cmpge_ps(viewCos,vCosLimit));
+
+        _mm_storeu_ps(&mvU[i],u);
+        _mm_storeu_ps(&mvV[i],v);
+        _mm_storeu_ps(&mvDist[i],dist);
+        _mm_storeu_ps(&mvViewCos[i],viewCos);
+
+        const int bits = _mm_movemask_ps(mask);
+        mvbInView[i] = bits & 1;
+        mvbInView[i+1] = (bits>>1) & 1;
+        mvbInView[i+2] = (bits>>2) & 1;
+        mvbInView[i+3] = (bits>>3) & 1;
+    }
+#elif defined(ORB_SLAM_SIMD_NEON)
+    const float32x4_t t0 = vdupq_n_f32(t(0)), t1 = vdupq_n_f32(t(1)), t2 = vdupq_n_f32(t(2));
+    const float32x4_t o0 = vdupq_n_f32(O(0)), o1 = vdupq_n_f32(O(1)), o2 = vdupq_n_f32(O(2));
+    const float32x4_t cx = vdupq_n_f32(F.cx), cy = vdupq_n_f32(F.cy);
+    const float32x4_t vMinX = vdupq_n_f32(minX), vMaxX = vdupq_n_f32(maxX);
+    const float32x4_t vMinY = vdupq_n_f32(minY), vMaxY = vdupq_n_f32(maxY);
+    const float32x4_t vCosLimit = vdupq_n_f32(viewingCosLimit);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+
+    for(; i+4<=N; i+=4)
+    {
+        const float32x4_t x = vld1q_f32(&mvX[i]), y = vld1q_f32(&mvY[i]), z = vld1q_f32(&mvZ[i]);
+
+        // 3D in camera coordinates, must have positive depth
+        const float32x4_t xc = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x,R(0,0)),vmulq_n_f32(y,R(0,1))),vmulq_n_f32(z,R(0,2))),t0);
+        const float32x4_t yc = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x,R(1,0)),vmulq_n_f32(y,R(1,1))),vmulq_n_f32(z,R(1,2))),t1);
+        const float32x4_t zc = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x,R(2,0)),vmulq_n_f32(y,R(2,1))),vmulq_n_f32(z,R(2,2))),t2);
+        uint32x4_t mask = vcgeq_f32(zc,zero);
+
+        // Project in image and check it is not outside
+        const float32x4_t invz = vdivq_f32(one,zc);
+        const float32x4_t u = vaddq_f32(vmulq_f32(vmulq_n_f32(xc,F.fx),invz),cx);
+        const float32x4_t v = vaddq_f32(vmulq_f32(vmulq_n_f32(yc,F.fy),invz),cy);
+        mask = vandq_u32(mask,vandq_u32(vcgeq_f32(u,vMinX),vcleq_f32(u,vMaxX)));
+        mask = vandq_u32(mask,vandq_u32(vcgeq_f32(v,vMinY),vcleq_f32(v,vMaxY)));
+
+        // Distance must be in the scale invariance region
+        const float32x4_t dx = vsubq_f32(x,o0), dy = vsubq_f32(y,o1), dz = vsubq_f32(z,o2);
+        const float32x4_t dist = vsqrtq_f32(vaddq_f32(vaddq_f32(vmulq_f32(dx,dx),vmulq_f32(dy,dy)),vmulq_f32(dz,dz)));
+        mask = vandq_u32(mask,vcgeq_f32(dist,vld1q_f32(&mvMinDist[i])));
+        mask = vandq_u32(mask,vcleq_f32(dist,vld1q_f32(&mvMaxDist[i])));
+
+        // Viewing angle
+        const float32x4_t dot = vaddq_f32(vaddq_f32(vmulq_f32(dx,vld1q_f32(&mvNx[i])),vmulq_f32(dy,vld1q_f32(&mvNy[i]))),
+                                          vmulq_f32(dz,vld1q_f32(&mvNz[i])));
+        const float32x4_t viewCos = vdivq_f32(dot,dist);
+        mask = vandq_u32(mask,vcgeq_f32(viewCos,vCosLimit));
+
+        vst1q_f32(&mvU[i],u);
+        vst1q_f32(&mvV[i],v);
+        vst1q_f32(&mvDist[i],dist);
+        vst1q_f32(&mvViewCos[i],viewCos);
+
+        mvbInView[i] = vgetq_lane_u32(mask,0) & 1;
+        mvbInView[i+1] = vgetq_lane_u32(mask,1) & 1;
+        mvbInView[i+2] = vgetq_lane_u32(mask,2) & 1;
+        mvbInView[i+3] = vgetq_lane_u32(mask,3) & 1;
+    }
+#endif
+
+    // Remaining points, same operations in the same order
+    for(; i<N; i++)
+    {
+        const float x = mvX[i], y = mvY[i], z = mvZ[i];
+
+        const float xc = R(0,0)*x+R(0,1)*y+R(0,2)*z+t(0);
+        const float yc = R(1,0)*x+R(1,1)*y+R(1,2)*z+t(1);
+        const float zc = R(2,0)*x+R(2,1)*y+R(2,2)*z+t(2);
+
+        const float invz = 1.0f/zc;
+        const float u = F.fx*xc*invz+F.cx;
+        const float v = F.fy*yc*invz+F.cy;
+
+        const float dx = x-O(0), dy = y-O(1), dz = z-O(2);
+        const float dist = std::sqrt(dx*dx+dy*dy+dz*dz);
+        const float viewCos = (dx*mvNx[i]+dy*mvNy[i]+dz*mvNz[i])/dist;
+
+        mvU[i] = u;
+        mvV[i] = v;
+        mvDist[i] = dist;
+        mvViewCos[i] = viewCos;
+        mvbInView[i] = zc>=0.0f && u>=minX && u<=maxX && v>=minY && v<=maxY &&
+                       dist>=mvMinDist[i] && dist<=mvMaxDist[i] && viewCos>=viewingCosLimit;
+    }
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,66 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Hamming distances of the windowed searches of ORBmatcher, built with ORB_SLAM_GPU
+
+namespace ORB_SLAM
+{
+
+// Descriptors are rows of 8 words (256 bits)
+static const int DESCRIPTOR_WORDS = 8;
+static const int WINDOW_THREADS = 64;
+
+// One block per window, the threads of the block stride over its candidates.
+// pWindows holds the query rows of the nWindows windows, then their nWindows+1 offsets, then the candidate rows
+__global__ void WindowDistancesKernel(const unsigned int* pQueries, const unsigned int* pCandidates,
+                                      const unsigned int* pWindows, int nWindows, int* pDists)
+{
+    const int w = blockIdx.x;
+    if(w>=nWindows)
+        return;
+
+    const unsigned int* pOffsets = pWindows+nWindows;
+    const unsigned int* pRows = pOffsets+nWindows+1;
+
+    __shared__ unsigned int query[DESCRIPTOR_WORDS];
+    if(threadIdx.x<DESCRIPTOR_WORDS)
+        query[threadIdx.x] = pQueries[pWindows[w]*DESCRIPTOR_WORDS+threadIdx.x];
+    __syncthreads();
+
+    for(unsigned int k=pOffsets[w]+threadIdx.x, kend=pOffsets[w+1]; k<kend; k+=blockDim.x)
+    {
+        const unsigned int* pCandidate = pCandidates+pRows[k]*DESCRIPTOR_WORDS;
+        int dist = 0;
+        for(int i=0; i<DESCRIPTOR_WORDS; i++)
+            dist += __popc(query[i]^pCandidate[i]);
+        pDists[k] = dist;
+    }
+}
+
+void WindowDistancesGpu(const unsigned int* pQueries, const unsigned int* pCandidates, const unsigned int* pWindows,
+                        int nWindows, int* pDists)
+{
+    if(nWindows<=0)
+        return;
+    WindowDistancesKernel<<<nWindows,WINDOW_THREADS>>>(pQueries,pCandidates,pWindows,nWindows,pDists);
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,116 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/GpuORBextractor.h"
+
+#include <ros/ros.h>
+
+namespace ORB_SLAM
+{
+
+#ifdef ORB_SLAM_GPU
+
+GpuORBextractor::GpuORBextractor(): mpORB(NULL), mnFeatures(0), mfScaleFactor(0), mnLevels(0)
+{
+}
+
+GpuORBextractor::~GpuORBextractor()
+{
+    delete mpORB;
+}
+
+bool GpuORBextractor::Available()
+{
+    return cv::gpu::getCudaEnabledDeviceCount()>0;
+}
+
+bool GpuORBextractor::Extract(const cv::Mat &image, const cv::Mat &mask, int nfeatures, float scaleFactor, int nlevels, int fastTh,
+                              std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors)
+{
+    try
+    {
+        if(!mpORB || nfeatures!=mnFeatures || scaleFactor!=mfScaleFactor || nlevels!=mnLevels)
+        {
+            delete mpORB;
+            mpORB = new cv::gpu::ORB_GPU(nfeatures,scaleFactor,nlevels);
+            // ORBextractor computes the descriptors on the smoothed levels
+            mpORB->blurForDescriptor = true;
+            mnFeatures = nfeatures;
+            mfScaleFactor = scaleFactor;
+            mnLevels = nlevels;
+        }
+        mpORB->setFastParams(fastTh,true);
+
+        mPinnedImage.create(image.rows,image.cols,image.type());
+        cv::Mat pinnedImage = mPinnedImage.createMatHeader();
+        image.copyTo(pinnedImage);
+        mImage.upload(mPinnedImage);
+
+        if(mask.empty())
+            mMask.release();
+        else
+        {
+            mPinnedMask.create(mask.rows,mask.cols,mask.type());
+            cv::Mat pinnedMask = mPinnedMask.createMatHeader();
+            mask.copyTo(pinnedMask);
+            mMask.upload(mPinnedMask);
+        }
+
+        (*mpORB)(mImage,mMask,keypoints,mDescriptors);
+
+        if(keypoints.empty())
+            descriptors.release();
+        else
+            mDescriptors.download(descriptors);
+    }
+    catch(const cv::Exception &e)
+    {
+        ROS_WARN("ORB-SLAM - GPU extraction failed, using the CPU: %s",e.what());
+        keypoints.clear();
+        return false;
+    }
+
+    return true;
+}
+
+#else
+
+GpuORBextractor::GpuORBextractor()
+{
+}
+
+GpuORBextractor::~GpuORBextractor()
+{
+}
+
+bool GpuORBextractor::Available()
+{
+    return false;
+}
+
+bool GpuORBextractor::Extract(const cv::Mat &image, const cv::Mat &mask, int nfeatures, float scaleFactor, int nlevels, int fastTh,
+                              std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors)
+{
+    return false;
+}
+
+#endif
+
+} //namespace ORB_SLAM
@@ -0,0 +1,186 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/GpuORBmatcher.h"
+
+#include <ros/ros.h>
+
+#ifdef ORB_SLAM_GPU
+#include <cuda_runtime.h>
+#endif
+
+namespace ORB_SLAM
+{
+
+#ifdef ORB_SLAM_GPU
+
+// GpuHamming.cu
+void WindowDistancesGpu(const unsigned int* pQueries, const unsigned int* pCandidates, const unsigned int* pWindows,
+                        int nWindows, int* pDists);
+
+// Grows a device or page-locked buffer, the contents are not kept
+static bool Reserve(void** pp, size_t &capacity, size_t bytes, bool bHost)
+{
+    if(bytes<=capacity)
+        return true;
+    if(*pp)
+        bHost ? cudaFreeHost(*pp) : cudaFree(*pp);
+    *pp = NULL;
+    capacity = 0;
+    bytes += bytes/2;
+    if((bHost ? cudaMallocHost(pp,bytes) : cudaMalloc(pp,bytes))!=cudaSuccess)
+    {
+        *pp = NULL;
+        return false;
+    }
+    capacity = bytes;
+    return true;
+}
+
+GpuORBmatcher::GpuORBmatcher(): mpHostWindows(NULL), mpDeviceWindows(NULL), mnHostWindowsCapacity(0), mnDeviceWindowsCapacity(0),
+    mpHostDists(NULL), mpDeviceDists(NULL), mnHostDistsCapacity(0), mnDeviceDistsCapacity(0)
+{
+    for(int i=0; i<2; i++)
+    {
+        mCache[i].pDevice = NULL;
+        mCache[i].capacity = 0;
+    }
+}
+
+GpuORBmatcher::~GpuORBmatcher()
+{
+    for(int i=0; i<2; i++)
+        cudaFree(mCache[i].pDevice);
+    cudaFreeHost(mpHostWindows);
+    cudaFree(mpDeviceWindows);
+    cudaFreeHost(mpHostDists);
+    cudaFree(mpDeviceDists);
+}
+
+bool GpuORBmatcher::Available()
+{
+    int nDevices = 0;
+    return cudaGetDeviceCount(&nDevices)==cudaSuccess && nDevices>0;
+}
+
+bool GpuORBmatcher::Upload(const cv::Mat &Descriptors, DeviceDescriptors &cache)
+{
+    const size_t L = DBoW2::Hamming::L;
+    cache.Host.release();
+    if(!Reserve(reinterpret_cast<void**>(&cache.pDevice),cache.capacity,Descriptors.rows*L,false))
+        return false;
+    if(cudaMemcpy2D(cache.pDevice,L,Descriptors.data,Descriptors.step,L,Descriptors.rows,cudaMemcpyHostToDevice)!=cudaSuccess)
+        return false;
+    cache.Host = Descriptors;
+    return true;
+}
+
+bool GpuORBmatcher::Distances(const cv::Mat &Queries, const std::vector<int> &vQueries,
+                              const cv::Mat &Candidates, const std::vector<size_t> &vCandidates,
+                              const std::vector<size_t> &vOffsets, std::vector<int> &vDists)
+{
+    if(Queries.cols!=DBoW2::Hamming::L || Candidates.cols!=DBoW2::Hamming::L)
+        return false;
+
+    boost::mutex::scoped_lock lock(mMutex);
+
+    // Frames searched again are found by their descriptor data
+    int q = -1;
+    int c = -1;
+    for(int i=0; i<2; i++)
+    {
+        if(mCache[i].Host.data==Queries.data && mCache[i].Host.rows==Queries.rows)
+            q = i;
+        if(mCache[i].Host.data==Candidates.data && mCache[i].Host.rows==Candidates.rows)
+            c = i;
+    }
+    if(q<0)
+    {
+        q = c>=0 ? 1-c : 0;
+        if(!Upload(Queries,mCache[q]))
+            return false;
+    }
+    if(c<0)
+    {
+        c = 1-q;
+        if(!Upload(Candidates,mCache[c]))
+            return false;
+    }
+
+    // Windows in a single transfer: query rows, offsets and candidate rows
+    const size_t nWindows = vQueries.size();
+    const size_t nCandidates = vCandidates.size();
+    const size_t nWords = nWindows+(nWindows+1)+nCandidates;
+    if(!Reserve(reinterpret_cast<void**>(&mpHostWindows),mnHostWindowsCapacity,nWords*sizeof(unsigned int),true) ||
+       !Reserve(reinterpret_cast<void**>(&mpDeviceWindows),mnDeviceWindowsCapacity,nWords*sizeof(unsigned int),false) ||
+       !Reserve(reinterpret_cast<void**>(&mpHostDists),mnHostDistsCapacity,nCandidates*sizeof(int),true) ||
+       !Reserve(reinterpret_cast<void**>(&mpDeviceDists),mnDeviceDistsCapacity,nCandidates*sizeof(int),false))
+        return false;
+
+    unsigned int* pWords = mpHostWindows;
+    for(size_t w=0; w<nWindows; w++)
+        *pWords++ = vQueries[w];
+    for(size_t w=0; w<=nWindows; w++)
+        *pWords++ = vOffsets[w];
+    for(size_t k=0; k<nCandidates; k++)
+        *pWords++ = vCandidates[k];
+
+    if(cudaMemcpy(mpDeviceWindows,mpHostWindows,nWords*sizeof(unsigned int),cudaMemcpyHostToDevice)!=cudaSuccess)
+        return false;
+
+    WindowDistancesGpu(mCache[q].pDevice,mCache[c].pDevice,mpDeviceWindows,nWindows,mpDeviceDists);
+
+    cudaError_t error = cudaMemcpy(mpHostDists,mpDeviceDists,nCandidates*sizeof(int),cudaMemcpyDeviceToHost);
+    if(error!=cudaSuccess)
+    {
+        ROS_WARN("ORB-SLAM - GPU matching failed, using the CPU: %s",cudaGetErrorString(error));
+        return false;
+    }
+
+    vDists.assign(mpHostDists,mpHostDists+nCandidates);
+    return true;
+}
+
+#else
+
+GpuORBmatcher::GpuORBmatcher()
+{
+}
+
+GpuORBmatcher::~GpuORBmatcher()
+{
+}
+
+bool GpuORBmatcher::Available()
+{
+    return false;
+}
+
+bool GpuORBmatcher::Distances(const cv::Mat &Queries, const std::vector<int> &vQueries,
+                              const cv::Mat &Candidates, const std::vector<size_t> &vCandidates,
+                              const std::vector<size_t> &vOffsets, std::vector<int> &vDists)
+{
+    return false;
+}
+
+#endif
+
+} //namespace ORB_SLAM
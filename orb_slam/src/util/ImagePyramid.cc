@@ -0,0 +1,423 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/ImagePyramid.h"
+#include "util/AlignedAllocator.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+// Vectorized kernels are used when the target supports them, unless ORB_SLAM_NO_SIMD is defined
+// The scalar kernels are kept as reference, both produce exactly the same output
+#if !defined(ORB_SLAM_NO_SIMD)
+#if defined(__SSE2__)
+#define ORB_SLAM_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define ORB_SLAM_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace ORB_SLAM
+{
+
+// 7 tap Gaussian of sigma 2 in fixed point, from the center out, summing to 256
+static const int BLUR_RADIUS = 3;
+static const uint16_t BLUR_WEIGHTS[BLUR_RADIUS+1] = {54, 49, 34, 18};
+// Rows of the horizontal blur kept, a power of two above the 7 of the kernel
+static const int BLUR_ROWS = 8;
+
+// Whether the image holds a reference to its buffer, the address of a buffer it does not own may be reused
+static bool OwnsBuffer(const cv::Mat &image)
+{
+#if CV_MAJOR_VERSION>=3
+    return image.u!=NULL;
+#else
+    return image.refcount!=NULL;
+#endif
+}
+
+// Index of row or column i of an image of n, reflected as BORDER_REFLECT_101
+static inline int Reflect101(int i, int n)
+{
+    return i<0 ? -i : (i>=n ? 2*n-2-i : i);
+}
+
+// Horizontal blur of a row padded by BLUR_RADIUS on each side, in Q8 (at most 255*256)
+static void BlurRowH(const uchar* padded, int width, uint16_t* dst)
+{
+    const uchar* p = padded+BLUR_RADIUS;
+    int x = 0;
+
+#if defined(ORB_SLAM_SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w0 = _mm_set1_epi16(BLUR_WEIGHTS[0]), w1 = _mm_set1_epi16(BLUR_WEIGHTS[1]);
+    const __m128i w2 = _mm_set1_epi16(BLUR_WEIGHTS[2]), w3 = _mm_set1_epi16(BLUR_WEIGHTS[3]);
+    for(; x+8<=width; x+=8)
+    {
+        const uchar* q = p+x;
+#define LOAD8(ptr) _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(ptr)), zero)
+        __m128i acc = _mm_mullo_epi16(LOAD8(q), w0);
+        acc = _mm_add_epi16(acc, _mm_mullo_epi16(_mm_add_epi16(LOAD8(q-1), LOAD8(q+1)), w1));
+        acc = _mm_add_epi16(acc, _mm_mullo_epi16(_mm_add_epi16(LOAD8(q-2), LOAD8(q+2)), w2));
+        acc = _mm_add_epi16(acc, _mm_mullo_epi16(_mm_add_epi16(LOAD8(q-3), LOAD8(q+3)), w3));
+#undef LOAD8
+        _mm_storeu_si128((__m128i*)(dst+x), acc);
+    }
+#elif defined(ORB_SLAM_SIMD_NEON)
+    for(; x+8<=width; x+=8)
+    {
+        const uchar* q = p+x;
+        uint16x8_t acc = vmulq_n_u16(vmovl_u8(vld1_u8(q)), BLUR_WEIGHTS[0]);
+        acc = vmlaq_n_u16(acc, vaddl_u8(vld1_u8(q-1), vld1_u8(q+1)), BLUR_WEIGHTS[1]);
+        acc = vmlaq_n_u16(acc, vaddl_u8(vld1_u8(q-2), vld1_u8(q+2)), BLUR_WEIGHTS[2]);
+        acc = vmlaq_n_u16(acc, vaddl_u8(vld1_u8(q-3), vld1_u8(q+3)), BLUR_WEIGHTS[3]);
+        vst1q_u16(dst+x, acc);
+    }
+#endif
+
+    for(; x<width; x++)
+    {
+        const uchar* q = p+x;
+        dst[x] = (uint16_t)(q[0]*BLUR_WEIGHTS[0] + (q[-1]+q[1])*BLUR_WEIGHTS[1] +
+                            (q[-2]+q[2])*BLUR_WEIGHTS[2] + (q[-3]+q[3])*BLUR_WEIGHTS[3]);
+    }
+}
+
+// Vertical blur of 7 rows of the horizontal pass, rows[BLUR_RADIUS] is the center
+// Each term is rounded down to Q8 before the sum, which then fits in 16 bits
+static void BlurRowV(const uint16_t* const* rows, int width, uchar* dst)
+{
+    int x = 0;
+
+#if defined(ORB_SLAM_SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(128);
+    __m128i w[BLUR_RADIUS+1];
+    for(int k=0; k<=BLUR_RADIUS; k++)
+        w[k] = _mm_set1_epi16((short)(BLUR_WEIGHTS[k]<<8));
+    for(; x+8<=width; x+=8)
+    {
+        __m128i acc = _mm_mulhi_epu16(_mm_loadu_si128((const __m128i*)(rows[BLUR_RADIUS]+x)), w[0]);
+        for(int k=1; k<=BLUR_RADIUS; k++)
+        {
+            acc = _mm_add_epi16(acc, _mm_mulhi_epu16(_mm_loadu_si128((const __m128i*)(rows[BLUR_RADIUS-k]+x)), w[k]));
+            acc = _mm_add_epi16(acc, _mm_mulhi_epu16(_mm_loadu_si128((const __m128i*)(rows[BLUR_RADIUS+k]+x)), w[k]));
+        }
+        acc = _mm_srli_epi16(_mm_add_epi16(acc, half), 8);
+        _mm_storel_epi64((__m128i*)(dst+x), _mm_packus_epi16(acc, zero));
+    }
+#elif defined(ORB_SLAM_SIMD_NEON)
+    for(; x+8<=width; x+=8)
+    {
+        uint32x4_t lo = vdupq_n_u32(0), hi = vdupq_n_u32(0);
+        for(int r=0; r<2*BLUR_RADIUS+1; r++)
+        {
+            const uint16_t w = BLUR_WEIGHTS[std::abs(r-BLUR_RADIUS)];
+            const uint16x8_t h = vld1q_u16(rows[r]+x);
+            lo = vaddq_u32(lo, vshrq_n_u32(vmull_n_u16(vget_low_u16(h), w), 8));
+            hi = vaddq_u32(hi, vshrq_n_u32(vmull_n_u16(vget_high_u16(h), w), 8));
+        }
+        const uint16x8_t acc = vcombine_u16(vmovn_u32(lo), vmovn_u32(hi));
+        vst1_u8(dst+x, vmovn_u16(vshrq_n_u16(vaddq_u16(acc, vdupq_n_u16(128)), 8)));
+    }
+#endif
+
+    for(; x<width; x++)
+    {
+        unsigned int acc = 0;
+        for(int r=0; r<2*BLUR_RADIUS+1; r++)
+            acc += ((unsigned int)rows[r][x]*BLUR_WEIGHTS[std::abs(r-BLUR_RADIUS)])>>8;
+        dst[x] = (uchar)((acc+128)>>8);
+    }
+}
+
+// Vertical pass of the resize, two rows interpolated horizontally in Q8 with the weight of the second in Q8
+// Each term is rounded down to Q7 before the sum
+static void ResizeRowV(const uint16_t* row0, const uint16_t* row1, int ay, int width, uchar* dst)
+{
+    int x = 0;
+
+#if defined(ORB_SLAM_SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(64);
+    const __m128i w0 = _mm_set1_epi16((short)((256-ay)<<7));
+    const __m128i w1 = _mm_set1_epi16((short)(ay<<7));
+    for(; x+8<=width; x+=8)
+    {
+        __m128i acc = _mm_add_epi16(_mm_mulhi_epu16(_mm_loadu_si128((const __m128i*)(row0+x)), w0),
+                                    _mm_mulhi_epu16(_mm_loadu_si128((const __m128i*)(row1+x)), w1));
+        acc = _mm_srli_epi16(_mm_add_epi16(acc, half), 7);
+        _mm_storel_epi64((__m128i*)(dst+x), _mm_packus_epi16(acc, zero));
+    }
+#elif defined(ORB_SLAM_SIMD_NEON)
+    for(; x+8<=width; x+=8)
+    {
+        const uint16x8_t h0 = vld1q_u16(row0+x), h1 = vld1q_u16(row1+x);
+        const uint32x4_t lo = vaddq_u32(vshrq_n_u32(vmull_n_u16(vget_low_u16(h0), 256-ay), 9),
+                                        vshrq_n_u32(vmull_n_u16(vget_low_u16(h1), ay), 9));
+        const uint32x4_t hi = vaddq_u32(vshrq_n_u32(vmull_n_u16(vget_high_u16(h0), 256-ay), 9),
+                                        vshrq_n_u32(vmull_n_u16(vget_high_u16(h1), ay), 9));
+        const uint16x8_t acc = vcombine_u16(vmovn_u32(lo), vmovn_u32(hi));
+        vst1_u8(dst+x, vmovn_u16(vshrq_n_u16(vaddq_u16(acc, vdupq_n_u16(64)), 7)));
+    }
+#endif
+
+    for(; x<width; x++)
+    {
+        const unsigned int acc = (((unsigned int)row0[x]*(256-ay))>>9) + (((unsigned int)row1[x]*ay)>>9);
+        dst[x] = (uchar)((acc+64)>>7);
+    }
+}
+
+// Source index and weight in Q8 of the second source, of a bilinear resize as cv::INTER_LINEAR maps it
+static inline void ResizeMap(int i, double scale, int n, int &i0, int &a)
+{
+    const double s = (i+0.5)*scale-0.5;
+    i0 = (int)std::floor(s);
+    a = cvRound((s-i0)*256);
+    if(i0<0)
+    {
+        i0 = 0;
+        a = 0;
+    }
+    if(i0>=n-1)
+    {
+        i0 = n-1;
+        a = 0;
+    }
+}
+
+ImagePyramid::ImagePyramid():
+    mbCached(false), mnBorder(0), mbBlurred(false)
+{
+}
+
+bool ImagePyramid::Build(const cv::Mat &image, const cv::Mat &mask, const std::vector<float> &vInvScales, int border,
+                         bool bBlur)
+{
+    if(mbCached && mask.empty() && image.data==mSource.data && image.size()==mSource.size() &&
+       vInvScales==mvInvScales && border==mnBorder && (mbBlurred || !bBlur))
+        return false;
+
+    mbCached = mask.empty() && OwnsBuffer(image);
+    mSource = mbCached ? image : cv::Mat();
+    mvInvScales = vInvScales;
+    mnBorder = border;
+    mbBlurred = bBlur;
+
+    const int nLevels = vInvScales.size();
+    mvBuffers.resize(nLevels);
+    mvMaskBuffers.resize(nLevels);
+    mvLevels.resize(nLevels);
+    mvMasks.resize(nLevels);
+    mvBlurred.resize(nLevels);
+
+    // The levels are stacked, the block is as wide as the first level rounded to the alignment
+    int nRows = 0;
+    for(int level=0; level<nLevels; level++)
+        nRows += cvRound((float)image.rows*vInvScales[level])+border*2;
+    const int nCols = cv::alignSize(image.cols+border*2,(int)AlignedAllocator::ALIGNMENT);
+
+    // No allocation unless the size changed
+    mArena.allocator = AlignedAllocator::Get();
+    mArena.create(nRows, nCols, image.type());
+    if(!mask.empty())
+    {
+        mMaskArena.allocator = AlignedAllocator::Get();
+        mMaskArena.create(nRows, nCols, mask.type());
+    }
+    if(bBlur)
+    {
+        mBlurredArena.allocator = AlignedAllocator::Get();
+        mBlurredArena.create(nRows, nCols, image.type());
+    }
+
+    int nRow = 0;
+    for(int level=0; level<nLevels; level++)
+    {
+        const float scale = vInvScales[level];
+        cv::Size sz(cvRound((float)image.cols*scale), cvRound((float)image.rows*scale));
+        cv::Size wholeSize(sz.width+border*2, sz.height+border*2);
+        const cv::Rect roi(border, border, sz.width, sz.height);
+        const cv::Rect block(0, nRow, wholeSize.width, wholeSize.height);
+        nRow += wholeSize.height;
+
+        cv::Mat &buffer = mvBuffers[level];
+        buffer = mArena(block);
+        mvLevels[level] = buffer(roi);
+
+        if(!mask.empty())
+        {
+            mvMaskBuffers[level] = mMaskArena(block);
+            mvMasks[level] = mvMaskBuffers[level](roi);
+        }
+        else
+            mvMasks[level].release();
+
+        if(bBlur)
+            mvBlurred[level] = mBlurredArena(block)(roi);
+        else
+            mvBlurred[level].release();
+
+        if(level!=0)
+        {
+            BuildLevel(level, bBlur);
+            if(!mask.empty())
+                cv::resize(mvMasks[level-1], mvMasks[level], sz, 0, 0, cv::INTER_NEAREST);
+
+            cv::copyMakeBorder(mvLevels[level], buffer, border, border, border, border,
+                               cv::BORDER_REFLECT_101+cv::BORDER_ISOLATED);
+            if(!mask.empty())
+                cv::copyMakeBorder(mvMasks[level], mvMaskBuffers[level], border, border, border, border,
+                                   cv::BORDER_CONSTANT+cv::BORDER_ISOLATED);
+        }
+        else
+        {
+            cv::copyMakeBorder(image, buffer, border, border, border, border, cv::BORDER_REFLECT_101);
+            if(!mask.empty())
+                cv::copyMakeBorder(mask, mvMaskBuffers[level], border, border, border, border,
+                                   cv::BORDER_CONSTANT+cv::BORDER_ISOLATED);
+            BuildLevel(level, bBlur);
+        }
+    }
+
+    return true;
+}
+
+void ImagePyramid::ResizeRow(const cv::Mat &src, int y, uint16_t* dst)
+{
+    const uchar* p = src.ptr<uchar>(y);
+    const int width = mvXOffsets.size();
+    const int last = src.cols-1;
+    for(int x=0; x<width; x++)
+    {
+        const int x0 = mvXOffsets[x];
+        const int a = mvXWeights[x];
+        dst[x] = (uint16_t)(p[x0]*(256-a) + p[std::min(x0+1,last)]*a);
+    }
+}
+
+void ImagePyramid::BuildLevel(int level, bool bBlur)
+{
+    cv::Mat &dst = mvLevels[level];
+    const int width = dst.cols;
+    const int height = dst.rows;
+    const bool bResize = level!=0;
+
+    // Other image types and levels too small for the kernels go through OpenCV, as separate passes
+    if(dst.type()!=CV_8UC1 || width<=BLUR_RADIUS || height<=BLUR_RADIUS)
+    {
+        if(bResize)
+            cv::resize(mvLevels[level-1], dst, dst.size(), 0, 0, cv::INTER_LINEAR);
+        if(bBlur)
+            cv::GaussianBlur(dst, mvBlurred[level], cv::Size(7,7), 2, 2, cv::BORDER_REFLECT_101+cv::BORDER_ISOLATED);
+        return;
+    }
+
+    // No allocation unless the image grew
+    mvResizeRows.resize(2*width);
+    mvPaddedRow.resize(width+2*BLUR_RADIUS);
+    mvBlurRows.resize(BLUR_ROWS*width);
+
+    const cv::Mat &src = bResize ? mvLevels[level-1] : dst;
+    const double scaleX = (double)src.cols/width;
+    const double scaleY = (double)src.rows/height;
+    if(bResize)
+    {
+        mvXOffsets.resize(width);
+        mvXWeights.resize(width);
+        for(int x=0; x<width; x++)
+        {
+            int a;
+            ResizeMap(x, scaleX, src.cols, mvXOffsets[x], a);
+            mvXWeights[x] = (uint16_t)a;
+        }
+    }
+
+    // Source rows interpolated horizontally, by their index in the previous level
+    uint16_t* pResized[2] = {&mvResizeRows[0], &mvResizeRows[width]};
+    int nResized[2] = {-1, -1};
+
+    const uint16_t* pBlurRows[2*BLUR_RADIUS+1];
+    uchar* pPadded = &mvPaddedRow[0];
+
+    // The blur lags BLUR_RADIUS rows behind the resize
+    const int nSteps = bBlur ? height+BLUR_RADIUS : height;
+    for(int y=0; y<nSteps; y++)
+    {
+        // Produce row y of the level, and its horizontal blur
+        if(y<height)
+        {
+            uchar* pRow = dst.ptr<uchar>(y);
+            if(bResize)
+            {
+                int y0, ay;
+                ResizeMap(y, scaleY, src.rows, y0, ay);
+                const int y1 = std::min(y0+1, src.rows-1);
+                if(nResized[0]!=y0)
+                {
+                    if(nResized[1]==y0)
+                    {
+                        std::swap(pResized[0], pResized[1]);
+                        std::swap(nResized[0], nResized[1]);
+                    }
+                    else
+                    {
+                        ResizeRow(src, y0, pResized[0]);
+                        nResized[0] = y0;
+                    }
+                }
+                if(nResized[1]!=y1)
+                {
+                    ResizeRow(src, y1, pResized[1]);
+                    nResized[1] = y1;
+                }
+                ResizeRowV(pResized[0], pResized[1], ay, width, pRow);
+            }
+
+            if(!bBlur)
+                continue;
+
+            memcpy(pPadded+BLUR_RADIUS, pRow, width);
+            for(int k=1; k<=BLUR_RADIUS; k++)
+            {
+                pPadded[BLUR_RADIUS-k] = pRow[k];
+                pPadded[BLUR_RADIUS+width-1+k] = pRow[width-1-k];
+            }
+            BlurRowH(pPadded, width, &mvBlurRows[(y%BLUR_ROWS)*width]);
+        }
+
+        // Row y-BLUR_RADIUS has all its neighbours, reflected at the top and bottom
+        const int yOut = y-BLUR_RADIUS;
+        if(yOut<0)
+            continue;
+        for(int k=-BLUR_RADIUS; k<=BLUR_RADIUS; k++)
+            pBlurRows[k+BLUR_RADIUS] = &mvBlurRows[(Reflect101(yOut+k,height)%BLUR_ROWS)*width];
+        BlurRowV(pBlurRows, width, mvBlurred[level].ptr<uchar>(yOut));
+    }
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,80 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/ImageQuality.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace ORB_SLAM
+{
+
+// Weight of a new image in the average sharpness
+static const float AVERAGE_WEIGHT = 0.1f;
+
+ImageQuality::ImageQuality(int nWidth, float fMinRatio, float fMinBrightness, int nMaxSkipped):
+    mnWidth(nWidth), mfMinRatio(fMinRatio), mfMinBrightness(fMinBrightness), mnMaxSkipped(nMaxSkipped),
+    mfAverage(0), mnSkipped(0), mnSkippedTotal(0)
+{
+}
+
+float ImageQuality::Measure(const cv::Mat &im, float &brightness)
+{
+    // Motion blur removes the high frequencies, which survive the downscaling
+    if(im.cols>mnWidth)
+    {
+        const int height = cvRound((double)im.rows*mnWidth/im.cols);
+        cv::resize(im,mSmall,cv::Size(mnWidth,height),0,0,cv::INTER_AREA);
+    }
+    else
+        mSmall = im;
+
+    cv::Laplacian(mSmall,mLaplacian,CV_16S);
+
+    cv::Scalar mean, stddev;
+    cv::meanStdDev(mLaplacian,mean,stddev);
+    brightness = cv::mean(mSmall)[0];
+    return stddev[0]*stddev[0];
+}
+
+bool ImageQuality::Accept(const cv::Mat &im, float &sharpness)
+{
+    float brightness;
+    sharpness = Measure(im,brightness);
+
+    const bool bGood = brightness>=mfMinBrightness && (mfAverage<=0 || sharpness>=mfMinRatio*mfAverage);
+
+    // The average follows every image, a scene with less texture is not blur
+    if(mfAverage<=0)
+        mfAverage = sharpness;
+    else
+        mfAverage += AVERAGE_WEIGHT*(sharpness-mfAverage);
+
+    if(bGood || mnSkipped>=mnMaxSkipped)
+    {
+        mnSkipped = 0;
+        return true;
+    }
+
+    mnSkipped++;
+    mnSkippedTotal++;
+    return false;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,108 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/ImuIntegrator.h"
+
+#include <Eigen/Geometry>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+// Measurements older than this, relative to the newest one, are dropped even if no frame asked for them
+static const double MAX_HISTORY = 5.0;
+
+// Rotation of an angular velocity applied during dt
+static Eigen::Matrix3d ExpSO3(const Eigen::Vector3d &w, double dt)
+{
+    const Eigen::Vector3d phi = w*dt;
+    const double angle = phi.norm();
+    if(angle<1e-12)
+        return Eigen::Matrix3d::Identity();
+    return Eigen::AngleAxisd(angle,phi/angle).toRotationMatrix();
+}
+
+ImuIntegrator::ImuIntegrator(const Eigen::Matrix3d &Rcb, const Eigen::Vector3d &gyroBias, double maxGap):
+    mRcb(Rcb), mGyroBias(gyroBias), mfMaxGap(maxGap)
+{
+}
+
+void ImuIntegrator::AddMeasurement(double timestamp, const Eigen::Vector3d &gyro)
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    if(!mdMeasurements.empty() && timestamp<=mdMeasurements.back().t)
+        return;
+
+    Measurement m;
+    m.t = timestamp;
+    m.gyro = gyro-mGyroBias;
+    mdMeasurements.push_back(m);
+
+    while(mdMeasurements.front().t<timestamp-MAX_HISTORY)
+        mdMeasurements.pop_front();
+}
+
+bool ImuIntegrator::PredictRotation(double t0, double t1, Eigen::Matrix3d &Rc1c0)
+{
+    if(t1<=t0)
+        return false;
+
+    // Rotation of the IMU at t1 in the IMU at t0, the rate between two measurements is their mean
+    Eigen::Matrix3d Rb0b1 = Eigen::Matrix3d::Identity();
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        const size_t n = mdMeasurements.size();
+        if(n==0 || mdMeasurements.front().t>t0+mfMaxGap || mdMeasurements.back().t<t1-mfMaxGap)
+            return false;
+
+        for(size_t i=0; i<n; i++)
+        {
+            const Measurement &m = mdMeasurements[i];
+            // Segment up to the next measurement, the last one holds its rate up to t1
+            const double tEnd = (i+1<n) ? mdMeasurements[i+1].t : max(t1,m.t);
+            const double a = max(m.t,t0);
+            const double b = min(tEnd,t1);
+            if(b<=a)
+                continue;
+            const Eigen::Vector3d w = (i+1<n) ? 0.5*(m.gyro+mdMeasurements[i+1].gyro) : m.gyro;
+            Rb0b1 = Rb0b1*ExpSO3(w,b-a);
+        }
+
+        // Before the first measurement its rate is held
+        const Measurement &first = mdMeasurements.front();
+        if(first.t>t0)
+            Rb0b1 = ExpSO3(first.gyro,first.t-t0)*Rb0b1;
+    }
+
+    // Rc1c0 = Rcb*Rb1b0*Rbc
+    Rc1c0 = mRcb*Rb0b1.transpose()*mRcb.transpose();
+    return true;
+}
+
+void ImuIntegrator::Discard(double t)
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    // The measurement at or before t is kept, the next interval starts there
+    while(mdMeasurements.size()>=2 && mdMeasurements[1].t<=t)
+        mdMeasurements.pop_front();
+}
+
+} //namespace ORB_SLAM
@@ -18,31 +18,184 @@
 * along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include "dutils/Random.h"
-
 #include "util/Initializer.h"
 #include "util/Optimizer.h"
 #include "util/ORBmatcher.h"
-
-#include <boost/thread.hpp>
+#include "util/TaskPool.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <ros/ros.h>
+
+// Vectorized model scoring is used when the target supports it, unless ORB_SLAM_NO_SIMD is defined
+#if !defined(ORB_SLAM_NO_SIMD)
+#if defined(__SSE2__)
+#define ORB_SLAM_SIMD_SSE2
+#include <emmintrin.h>
+#elif (defined(__ARM_NEON__) || defined(__ARM_NEON)) && defined(__aarch64__)
+#define ORB_SLAM_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
 
 namespace ORB_SLAM
 {
 
-Initializer::Initializer(const Frame &ReferenceFrame, float sigma, int iterations)
+// Squared distances from the points b to the points a transferred by the homography h (row-major)
+static void TransferErrors(const float h[9], const float *ua, const float *va, const float *ub, const float *vb,
+                           float *err2, const int N)
+{
+    int i=0;
+
+#if defined(ORB_SLAM_SIMD_SSE2)
+    const __m128 h0 = _mm_set1_ps(h[0]), h1 = _mm_set1_ps(h[1]), h2 = _mm_set1_ps(h[2]);
+    const __m128 h3 = _mm_set1_ps(h[3]), h4 = _mm_set1_ps(h[4]), h5 = _mm_set1_ps(h[5]);
+    const __m128 h6 = _mm_set1_ps(h[6]), h7 = _mm_set1_ps(h[7]), h8 = _mm_set1_ps(h[8]);
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    for(; i+4<=N; i+=4)
+    {
+        const __m128 u = _mm_loadu_ps(ua+i), v = _mm_loadu_ps(va+i);
+
+        const __m128 winv = _mm_div_ps(one,_mm_add_ps(_mm_add_ps(_mm_mul_ps(h6,u),_mm_mul_ps(h7,v)),h8));
+        const __m128 ut = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(h0,u),_mm_mul_ps(h1,v)),h2),winv);
+        const __m128 vt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(h3,u),_mm_mul_ps(h4,v)),h5),winv);
+
+        const __m128 du = _mm_sub_ps(_mm_loadu_ps(ub+i),ut);
+        const __m128 dv = _mm_sub_ps(_mm_loadu_ps(vb+i),vt);
+
+        _mm_storeu_ps(err2+i,_mm_add_ps(_mm_mul_ps(du,du),_mm_mul_ps(dv,dv)));
+    }
+#elif defined(ORB_SLAM_SIMD_NEON)
+    const float32x4_t h2 = vdupq_n_f32(h[2]), h5 = vdupq_n_f32(h[5]), h8 = vdupq_n_f32(h[8]);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+
+    for(; i+4<=N; i+=4)
+    {
+        const float32x4_t u = vld1q_f32(ua+i), v = vld1q_f32(va+i);
+
+        const float32x4_t winv = vdivq_f32(one,vaddq_f32(vaddq_f32(vmulq_n_f32(u,h[6]),vmulq_n_f32(v,h[7])),h8));
+        const float32x4_t ut = vmulq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(u,h[0]),vmulq_n_f32(v,h[1])),h2),winv);
+        const float32x4_t vt = vmulq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(u,h[3]),vmulq_n_f32(v,h[4])),h5),winv);
+
+        const float32x4_t du = vsubq_f32(vld1q_f32(ub+i),ut);
+        const float32x4_t dv = vsubq_f32(vld1q_f32(vb+i),vt);
+
+        vst1q_f32(err2+i,vaddq_f32(vmulq_f32(du,du),vmulq_f32(dv,dv)));
+    }
+#endif
+
+    for(; i<N; i++)
+    {
+        const float winv = 1.0f/(h[6]*ua[i]+h[7]*va[i]+h[8]);
+        const float ut = (h[0]*ua[i]+h[1]*va[i]+h[2])*winv;
+        const float vt = (h[3]*ua[i]+h[4]*va[i]+h[5])*winv;
+
+        const float du = ub[i]-ut;
+        const float dv = vb[i]-vt;
+
+        err2[i] = du*du+dv*dv;
+    }
+}
+
+// Squared distances from the points b to the epipolar lines f*a (f row-major)
+static void EpipolarErrors(const float f[9], const float *ua, const float *va, const float *ub, const float *vb,
+                           float *err2, const int N)
+{
+    int i=0;
+
+#if defined(ORB_SLAM_SIMD_SSE2)
+    const __m128 f0 = _mm_set1_ps(f[0]), f1 = _mm_set1_ps(f[1]), f2 = _mm_set1_ps(f[2]);
+    const __m128 f3 = _mm_set1_ps(f[3]), f4 = _mm_set1_ps(f[4]), f5 = _mm_set1_ps(f[5]);
+    const __m128 f6 = _mm_set1_ps(f[6]), f7 = _mm_set1_ps(f[7]), f8 = _mm_set1_ps(f[8]);
+
+    for(; i+4<=N; i+=4)
+    {
+        const __m128 u = _mm_loadu_ps(ua+i), v = _mm_loadu_ps(va+i);
+
+        const __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(f0,u),_mm_mul_ps(f1,v)),f2);
+        const __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(f3,u),_mm_mul_ps(f4,v)),f5);
+        const __m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(f6,u),_mm_mul_ps(f7,v)),f8);
+
+        const __m128 num = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a,_mm_loadu_ps(ub+i)),_mm_mul_ps(b,_mm_loadu_ps(vb+i))),c);
+
+        _mm_storeu_ps(err2+i,_mm_div_ps(_mm_mul_ps(num,num),_mm_add_ps(_mm_mul_ps(a,a),_mm_mul_ps(b,b))));
+    }
+#elif defined(ORB_SLAM_SIMD_NEON)
+    const float32x4_t f2 = vdupq_n_f32(f[2]), f5 = vdupq_n_f32(f[5]), f8 = vdupq_n_f32(f[8]);
+
+    for(; i+4<=N; i+=4)
+    {
+        const float32x4_t u = vld1q_f32(ua+i), v = vld1q_f32(va+i);
+
+        const float32x4_t a = vaddq_f32(vaddq_f32(vmulq_n_f32(u,f[0]),vmulq_n_f32(v,f[1])),f2);
+        const float32x4_t b = vaddq_f32(vaddq_f32(vmulq_n_f32(u,f[3]),vmulq_n_f32(v,f[4])),f5);
+        const float32x4_t c = vaddq_f32(vaddq_f32(vmulq_n_f32(u,f[6]),vmulq_n_f32(v,f[7])),f8);
+
+        const float32x4_t num = vaddq_f32(vaddq_f32(vmulq_f32(a,vld1q_f32(ub+i)),vmulq_f32(b,vld1q_f32(vb+i))),c);
+
+        vst1q_f32(err2+i,vdivq_f32(vmulq_f32(num,num),vaddq_f32(vmulq_f32(a,a),vmulq_f32(b,b))));
+    }
+#endif
+
+    for(; i<N; i++)
+    {
+        const float a = f[0]*ua[i]+f[1]*va[i]+f[2];
+        const float b = f[3]*ua[i]+f[4]*va[i]+f[5];
+        const float c = f[6]*ua[i]+f[7]*va[i]+f[8];
+
+        const float num = a*ub[i]+b*vb[i]+c;
+
+        err2[i] = num*num/(a*a+b*b);
+    }
+}
+
+const float Initializer::DOMINANCE = 0.7f;
+const double Initializer::RANSAC_PROBABILITY = 0.99;
+
+// Matches checked between two looks at the leading hypothesis
+static const int CHECK_STEP = 64;
+
+Initializer::Initializer(const Frame &ReferenceFrame, float sigma, int iterations):
+    mvHypotheses(8), mnLeadingGood(0)
 {
     mK = ReferenceFrame.mK.clone();
 
     mvKeys1 = ReferenceFrame.mvKeysUn;
+    mDescriptors1 = ReferenceFrame.mDescriptors.clone();
 
     mSigma = sigma;
     mSigma2 = sigma*sigma;
     mMaxIterations = iterations;
+
+    mTimeH = mTimeF = mTimeTotal = 0;
+}
+
+int Initializer::GetIterations()
+{
+    return mMaxIterations;
+}
+
+double Initializer::GetTimeHomography()
+{
+    return mTimeH;
+}
+
+double Initializer::GetTimeFundamental()
+{
+    return mTimeF;
+}
+
+double Initializer::GetTimeTotal()
+{
+    return mTimeTotal;
 }
 
 bool Initializer::Initialize(const Frame &CurrentFrame, const vector<int> &vMatches12, cv::Mat &R21, cv::Mat &t21,
                              vector<cv::Point3f> &vP3D, vector<bool> &vbTriangulated)
 {
+    ros::WallTime tStart = ros::WallTime::now();
+
     // Fill structures with current keypoints and matches with reference frame
     // Reference Frame: 1, Current Frame: 2
     mvKeys2 = CurrentFrame.mvKeysUn;
@@ -63,63 +216,66 @@ bool Initializer::Initialize(const Frame &CurrentFrame, const vector<int> &vMatc
 
     const int N = mvMatches12.size();
 
-    // Indices for minimum set selection
-    vector<size_t> vAllIndices;
-    vAllIndices.reserve(N);
-    vector<size_t> vAvailableIndices;
-
+    // Matched coordinates and error buffers for the model scoring
+    mvU1.resize(N);
+    mvV1.resize(N);
+    mvU2.resize(N);
+    mvV2.resize(N);
     for(int i=0; i<N; i++)
     {
-        vAllIndices.push_back(i);
+        mvU1[i] = mvKeys1[mvMatches12[i].first].pt.x;
+        mvV1[i] = mvKeys1[mvMatches12[i].first].pt.y;
+        mvU2[i] = mvKeys2[mvMatches12[i].second].pt.x;
+        mvV2[i] = mvKeys2[mvMatches12[i].second].pt.y;
     }
+    mvErrH1.resize(N);
+    mvErrH2.resize(N);
+    mvErrF1.resize(N);
+    mvErrF2.resize(N);
+
+    // Descriptor distance of each match, the closest ones are drawn first
+    vector<int> vDistances(N);
+    for(int i=0; i<N; i++)
+        vDistances[i] = DBoW2::Hamming::distance(mDescriptors1.ptr<uchar>(mvMatches12[i].first),
+                                                 CurrentFrame.mDescriptors.ptr<uchar>(mvMatches12[i].second));
 
     // Generate sets of 8 points for each RANSAC iteration
     mvSets = vector< vector<size_t> >(mMaxIterations,vector<size_t>(8,0));
 
+    mSampler.Reset(vDistances,8,mMaxIterations);
     for(int it=0; it<mMaxIterations; it++)
-    {
-        vAvailableIndices = vAllIndices;
-
-        // Select a minimum set
-        for(size_t j=0; j<8; j++)
-        {
-            int randi = DUtils::Random::RandomInt(0,vAvailableIndices.size()-1);
-            int idx = vAvailableIndices[randi];
+        mSampler.Sample(mvSets[it]);
 
-            mvSets[it][j] = idx;
-
-            vAvailableIndices[randi] = vAvailableIndices.back();
-            vAvailableIndices.pop_back();
-        }
-    }
-
-    // Launch threads to compute in parallel a fundamental matrix and a homography
+    // Compute in parallel a fundamental matrix and a homography
     vector<bool> vbMatchesInliersH, vbMatchesInliersF;
     float SH, SF;
     cv::Mat H, F;
 
-    boost::thread threadH(&Initializer::FindHomography,this,boost::ref(vbMatchesInliersH), boost::ref(SH), boost::ref(H));
-    boost::thread threadF(&Initializer::FindFundamental,this,boost::ref(vbMatchesInliersF), boost::ref(SF), boost::ref(F));
-
-    // Wait until both threads have finished
-    threadH.join();
-    threadF.join();
+    TaskGroup workers(TaskPool::TRACKING);
+    workers.Run(boost::bind(&Initializer::FindHomography,this,boost::ref(vbMatchesInliersH),boost::ref(SH),boost::ref(H)));
+    FindFundamental(vbMatchesInliersF,SF,F);
+    workers.Wait();
 
     // Compute ratio of scores
     float RH = SH/(SH+SF);
 
     // Try to reconstruct from homography or fundamental depending on the ratio (0.40-0.45)
+    bool bInitialized;
     if(RH>0.40)
-        return ReconstructH(vbMatchesInliersH,H,mK,R21,t21,vP3D,vbTriangulated,1.0,50);
+        bInitialized = ReconstructH(vbMatchesInliersH,H,mK,R21,t21,vP3D,vbTriangulated,1.0,50);
     else //if(pF_HF>0.6)
-        return ReconstructF(vbMatchesInliersF,F,mK,R21,t21,vP3D,vbTriangulated,1.0,50);
+        bInitialized = ReconstructF(vbMatchesInliersF,F,mK,R21,t21,vP3D,vbTriangulated,1.0,50);
 
-    return false;
+    mTimeTotal = (ros::WallTime::now()-tStart).toSec();
+
+    return bInitialized;
 }
 
 
 void Initializer::FindHomography(vector<bool> &vbMatchesInliers, float &score, cv::Mat &H21)
 {
+    ros::WallTime tStart = ros::WallTime::now();
+
     // Number of putative matches
     const int N = mvMatches12.size();
 
@@ -141,8 +297,10 @@ void Initializer::FindHomography(vector<bool> &vbMatchesInliers, float &score, c
     vector<bool> vbCurrentInliers(N,false);
     float currentScore;
 
-    // Perform all RANSAC iterations and save the solution with highest score
-    for(int it=0; it<mMaxIterations; it++)
+    // Perform the RANSAC iterations and save the solution with highest score
+    // The inliers of the best one bound the iterations still needed
+    int nIterations = mMaxIterations;
+    for(int it=0; it<nIterations; it++)
     {
         // Select a minimum set
         for(size_t j=0; j<8; j++)
@@ -164,15 +322,22 @@ void Initializer::FindHomography(vector<bool> &vbMatchesInliers, float &score, c
             H21 = H21i.clone();
             vbMatchesInliers = vbCurrentInliers;
             score = currentScore;
+
+            const int nInliers = count(vbCurrentInliers.begin(),vbCurrentInliers.end(),true);
+            nIterations = max(it+1,ProsacSampler::RansacIterations(RANSAC_PROBABILITY,(double)nInliers/N,8,mMaxIterations));
         }
     }
+
+    mTimeH = (ros::WallTime::now()-tStart).toSec();
 }
 
 
 void Initializer::FindFundamental(vector<bool> &vbMatchesInliers, float &score, cv::Mat &F21)
 {
+    ros::WallTime tStart = ros::WallTime::now();
+
     // Number of putative matches
-    const int N = vbMatchesInliers.size();
+    const int N = mvMatches12.size();
 
     // Normalize coordinates
     vector<cv::Point2f> vPn1, vPn2;
@@ -192,8 +357,10 @@ void Initializer::FindFundamental(vector<bool> &vbMatchesInliers, float &score,
     vector<bool> vbCurrentInliers(N,false);
     float currentScore;
 
-    // Perform all RANSAC iterations and save the solution with highest score
-    for(int it=0; it<mMaxIterations; it++)
+    // Perform the RANSAC iterations and save the solution with highest score
+    // The inliers of the best one bound the iterations still needed
+    int nIterations = mMaxIterations;
+    for(int it=0; it<nIterations; it++)
     {
         // Select a minimum set
         for(int j=0; j<8; j++)
@@ -215,8 +382,13 @@ void Initializer::FindFundamental(vector<bool> &vbMatchesInliers, float &score,
             F21 = F21i.clone();
             vbMatchesInliers = vbCurrentInliers;
             score = currentScore;
+
+            const int nInliers = count(vbCurrentInliers.begin(),vbCurrentInliers.end(),true);
+            nIterations = max(it+1,ProsacSampler::RansacIterations(RANSAC_PROBABILITY,(double)nInliers/N,8,mMaxIterations));
         }
     }
+
+    mTimeF = (ros::WallTime::now()-tStart).toSec();
 }
 
 
@@ -303,25 +475,21 @@ float Initializer::CheckHomography(const cv::Mat &H21, const cv::Mat &H12, vecto
 {   
     const int N = mvMatches12.size();
 
-    const float h11 = H21.at<float>(0,0);
-    const float h12 = H21.at<float>(0,1);
-    const float h13 = H21.at<float>(0,2);
-    const float h21 = H21.at<float>(1,0);
-    const float h22 = H21.at<float>(1,1);
-    const float h23 = H21.at<float>(1,2);
-    const float h31 = H21.at<float>(2,0);
-    const float h32 = H21.at<float>(2,1);
-    const float h33 = H21.at<float>(2,2);
-
-    const float h11inv = H12.at<float>(0,0);
-    const float h12inv = H12.at<float>(0,1);
-    const float h13inv = H12.at<float>(0,2);
-    const float h21inv = H12.at<float>(1,0);
-    const float h22inv = H12.at<float>(1,1);
-    const float h23inv = H12.at<float>(1,2);
-    const float h31inv = H12.at<float>(2,0);
-    const float h32inv = H12.at<float>(2,1);
-    const float h33inv = H12.at<float>(2,2);
+    float h21[9], h12[9];
+    for(int i=0; i<3; i++)
+    {
+        for(int j=0; j<3; j++)
+        {
+            h21[3*i+j] = H21.at<float>(i,j);
+            h12[3*i+j] = H12.at<float>(i,j);
+        }
+    }
+
+    // Reprojection error in first image, x2in1 = H12*x2
+    TransferErrors(h12,&mvU2[0],&mvV2[0],&mvU1[0],&mvV1[0],&mvErrH1[0],N);
+
+    // Reprojection error in second image, x1in2 = H21*x1
+    TransferErrors(h21,&mvU1[0],&mvV1[0],&mvU2[0],&mvV2[0],&mvErrH2[0],N);
 
     vbMatchesInliers.resize(N);
 
@@ -335,40 +503,14 @@ float Initializer::CheckHomography(const cv::Mat &H21, const cv::Mat &H12, vecto
     {
         bool bIn = true;
 
-        const cv::KeyPoint &kp1 = mvKeys1[mvMatches12[i].first];
-        const cv::KeyPoint &kp2 = mvKeys2[mvMatches12[i].second];
-
-        const float u1 = kp1.pt.x;
-        const float v1 = kp1.pt.y;
-        const float u2 = kp2.pt.x;
-        const float v2 = kp2.pt.y;
-
-        // Reprojection error in first image
-        // x2in1 = H12*x2
-
-        const float w2in1inv = 1.0/(h31inv*u2+h32inv*v2+h33inv);
-        const float u2in1 = (h11inv*u2+h12inv*v2+h13inv)*w2in1inv;
-        const float v2in1 = (h21inv*u2+h22inv*v2+h23inv)*w2in1inv;
-
-        const float squareDist1 = (u1-u2in1)*(u1-u2in1)+(v1-v2in1)*(v1-v2in1);
-
-        const float chiSquare1 = squareDist1*invSigmaSquare;
+        const float chiSquare1 = mvErrH1[i]*invSigmaSquare;
 
         if(chiSquare1>th)
             bIn = false;
         else
             score += th - chiSquare1;
 
-        // Reprojection error in second image
-        // x1in2 = H21*x1
-
-        const float w1in2inv = 1.0/(h31*u1+h32*v1+h33);
-        const float u1in2 = (h11*u1+h12*v1+h13)*w1in2inv;
-        const float v1in2 = (h21*u1+h22*v1+h23)*w1in2inv;
-
-        const float squareDist2 = (u2-u1in2)*(u2-u1in2)+(v2-v1in2)*(v2-v1in2);
-
-        const float chiSquare2 = squareDist2*invSigmaSquare;
+        const float chiSquare2 = mvErrH2[i]*invSigmaSquare;
 
         if(chiSquare2>th)
             bIn = false;
@@ -388,15 +530,21 @@ float Initializer::CheckFundamental(const cv::Mat &F21, vector<bool> &vbMatchesI
 {
     const int N = mvMatches12.size();
 
-    const float f11 = F21.at<float>(0,0);
-    const float f12 = F21.at<float>(0,1);
-    const float f13 = F21.at<float>(0,2);
-    const float f21 = F21.at<float>(1,0);
-    const float f22 = F21.at<float>(1,1);
-    const float f23 = F21.at<float>(1,2);
-    const float f31 = F21.at<float>(2,0);
-    const float f32 = F21.at<float>(2,1);
-    const float f33 = F21.at<float>(2,2);
+    float f21[9], f21t[9];
+    for(int i=0; i<3; i++)
+    {
+        for(int j=0; j<3; j++)
+        {
+            f21[3*i+j] = F21.at<float>(i,j);
+            f21t[3*j+i] = F21.at<float>(i,j);
+        }
+    }
+
+    // Reprojection error in second image, l2=F21x1=(a2,b2,c2)
+    EpipolarErrors(f21,&mvU1[0],&mvV1[0],&mvU2[0],&mvV2[0],&mvErrF1[0],N);
+
+    // Reprojection error in first image, l1 =x2tF21=(a1,b1,c1)
+    EpipolarErrors(f21t,&mvU2[0],&mvV2[0],&mvU1[0],&mvV1[0],&mvErrF2[0],N);
 
     vbMatchesInliers.resize(N);
 
@@ -411,44 +559,14 @@ float Initializer::CheckFundamental(const cv::Mat &F21, vector<bool> &vbMatchesI
     {
         bool bIn = true;
 
-        const cv::KeyPoint &kp1 = mvKeys1[mvMatches12[i].first];
-        const cv::KeyPoint &kp2 = mvKeys2[mvMatches12[i].second];
-
-        const float u1 = kp1.pt.x;
-        const float v1 = kp1.pt.y;
-        const float u2 = kp2.pt.x;
-        const float v2 = kp2.pt.y;
-
-        // Reprojection error in second image
-        // l2=F21x1=(a2,b2,c2)
-
-        const float a2 = f11*u1+f12*v1+f13;
-        const float b2 = f21*u1+f22*v1+f23;
-        const float c2 = f31*u1+f32*v1+f33;
-
-        const float num2 = a2*u2+b2*v2+c2;
-
-        const float squareDist1 = num2*num2/(a2*a2+b2*b2);
-
-        const float chiSquare1 = squareDist1*invSigmaSquare;
+        const float chiSquare1 = mvErrF1[i]*invSigmaSquare;
 
         if(chiSquare1>th)
             bIn = false;
         else
             score += thScore - chiSquare1;
 
-        // Reprojection error in second image
-        // l1 =x2tF21=(a1,b1,c1)
-
-        const float a1 = f11*u2+f21*v2+f31;
-        const float b1 = f12*u2+f22*v2+f32;
-        const float c1 = f13*u2+f23*v2+f33;
-
-        const float num1 = a1*u1+b1*v1+c1;
-
-        const float squareDist2 = num1*num1/(a1*a1+b1*b1);
-
-        const float chiSquare2 = squareDist2*invSigmaSquare;
+        const float chiSquare2 = mvErrF2[i]*invSigmaSquare;
 
         if(chiSquare2>th)
             bIn = false;
@@ -484,16 +602,23 @@ bool Initializer::ReconstructF(vector<bool> &vbMatchesInliers, cv::Mat &F21, cv:
     cv::Mat t2=-t;
 
     // Reconstruct with the 4 hyphoteses and check
-    vector<cv::Point3f> vP3D1, vP3D2, vP3D3, vP3D4;
-    vector<bool> vbTriangulated1,vbTriangulated2,vbTriangulated3, vbTriangulated4;
-    float parallax1,parallax2, parallax3, parallax4;
-
-    int nGood1 = CheckRT(R1,t1,mvKeys1,mvKeys2,mvMatches12,vbMatchesInliers,K, vP3D1, 4.0*mSigma2, vbTriangulated1, parallax1);
-    int nGood2 = CheckRT(R2,t1,mvKeys1,mvKeys2,mvMatches12,vbMatchesInliers,K, vP3D2, 4.0*mSigma2, vbTriangulated2, parallax2);
-    int nGood3 = CheckRT(R1,t2,mvKeys1,mvKeys2,mvMatches12,vbMatchesInliers,K, vP3D3, 4.0*mSigma2, vbTriangulated3, parallax3);
-    int nGood4 = CheckRT(R2,t2,mvKeys1,mvKeys2,mvMatches12,vbMatchesInliers,K, vP3D4, 4.0*mSigma2, vbTriangulated4, parallax4);
-
-    int maxGood = max(nGood1,max(nGood2,max(nGood3,nGood4)));
+    mvHypotheses[0].R = R1; mvHypotheses[0].t = t1;
+    mvHypotheses[1].R = R2; mvHypotheses[1].t = t1;
+    mvHypotheses[2].R = R1; mvHypotheses[2].t = t2;
+    mvHypotheses[3].R = R2; mvHypotheses[3].t = t2;
+    CheckHypotheses(vbMatchesInliers,4,K);
+
+    // A dropped hypothesis has less than 0.7 of the points of the best one, its count does not matter
+    int maxGood = 0;
+    int bestIdx = -1;
+    for(int i=0; i<4; i++)
+    {
+        if(mvHypotheses[i].nGood>maxGood)
+        {
+            maxGood = mvHypotheses[i].nGood;
+            bestIdx = i;
+        }
+    }
 
     R21 = cv::Mat();
     t21 = cv::Mat();
@@ -501,66 +626,26 @@ bool Initializer::ReconstructF(vector<bool> &vbMatchesInliers, cv::Mat &F21, cv:
     int nMinGood = max(static_cast<int>(0.9*N),minTriangulated);
 
     int nsimilar = 0;
-    if(nGood1>0.7*maxGood)
-        nsimilar++;
-    if(nGood2>0.7*maxGood)
-        nsimilar++;
-    if(nGood3>0.7*maxGood)
-        nsimilar++;
-    if(nGood4>0.7*maxGood)
-        nsimilar++;
+    for(int i=0; i<4; i++)
+        if(mvHypotheses[i].nGood>0.7*maxGood)
+            nsimilar++;
 
     // If there is not a clear winner or not enough triangulated points reject initialization
-    if(maxGood<nMinGood || nsimilar>1)
+    if(bestIdx<0 || maxGood<nMinGood || nsimilar>1)
     {
         return false;
     }
 
     // If best reconstruction has enough parallax initialize
-    if(maxGood==nGood1)
-    {
-        if(parallax1>minParallax)
-        {
-            vP3D = vP3D1;
-            vbTriangulated = vbTriangulated1;
-
-            R1.copyTo(R21);
-            t1.copyTo(t21);
-            return true;
-        }
-    }else if(maxGood==nGood2)
-    {
-        if(parallax2>minParallax)
-        {
-            vP3D = vP3D2;
-            vbTriangulated = vbTriangulated2;
-
-            R2.copyTo(R21);
-            t1.copyTo(t21);
-            return true;
-        }
-    }else if(maxGood==nGood3)
+    const Hypothesis &best = mvHypotheses[bestIdx];
+    if(best.parallax>minParallax)
     {
-        if(parallax3>minParallax)
-        {
-            vP3D = vP3D3;
-            vbTriangulated = vbTriangulated3;
-
-            R1.copyTo(R21);
-            t2.copyTo(t21);
-            return true;
-        }
-    }else if(maxGood==nGood4)
-    {
-        if(parallax4>minParallax)
-        {
-            vP3D = vP3D4;
-            vbTriangulated = vbTriangulated4;
+        vP3D = best.vP3D;
+        vbTriangulated = best.vbGood;
 
-            R2.copyTo(R21);
-            t2.copyTo(t21);
-            return true;
-        }
+        best.R.copyTo(R21);
+        best.t.copyTo(t21);
+        return true;
     }
 
     return false;
@@ -686,27 +771,25 @@ bool Initializer::ReconstructH(vector<bool> &vbMatchesInliers, cv::Mat &H21, cv:
     int bestGood = 0;
     int secondBestGood = 0;    
     int bestSolutionIdx = -1;
-    float bestParallax = -1;
-    vector<cv::Point3f> bestP3D;
-    vector<bool> bestTriangulated;
 
     // Instead of applying the visibility constraints proposed in the Faugeras' paper (which could fail for points seen with low parallax)
     // We reconstruct all hypotheses and check in terms of triangulated points and parallax
     for(size_t i=0; i<8; i++)
     {
-        float parallaxi;
-        vector<cv::Point3f> vP3Di;
-        vector<bool> vbTriangulatedi;
-        int nGood = CheckRT(vR[i],vt[i],mvKeys1,mvKeys2,mvMatches12,vbMatchesInliers,K,vP3Di, 4.0*mSigma2, vbTriangulatedi, parallaxi);
+        mvHypotheses[i].R = vR[i];
+        mvHypotheses[i].t = vt[i];
+    }
+    CheckHypotheses(vbMatchesInliers,8,K);
 
+    // A dropped hypothesis has less than 0.7 of the points of the best one, as a second best it does not reach 0.75
+    for(size_t i=0; i<8; i++)
+    {
+        const int nGood = mvHypotheses[i].nGood;
         if(nGood>bestGood)
         {
             secondBestGood = bestGood;
             bestGood = nGood;
             bestSolutionIdx = i;
-            bestParallax = parallaxi;
-            bestP3D = vP3Di;
-            bestTriangulated = vbTriangulatedi;
         }
         else if(nGood>secondBestGood)
         {
@@ -714,13 +797,16 @@ bool Initializer::ReconstructH(vector<bool> &vbMatchesInliers, cv::Mat &H21, cv:
         }
     }
 
+    if(bestSolutionIdx<0)
+        return false;
 
-    if(secondBestGood<0.75*bestGood && bestParallax>=minParallax && bestGood>minTriangulated && bestGood>0.9*N)
+    const Hypothesis &best = mvHypotheses[bestSolutionIdx];
+    if(secondBestGood<0.75*bestGood && best.parallax>=minParallax && bestGood>minTriangulated && bestGood>0.9*N)
     {
-        vR[bestSolutionIdx].copyTo(R21);
-        vt[bestSolutionIdx].copyTo(t21);
-        vP3D = bestP3D;
-        vbTriangulated = bestTriangulated;
+        best.R.copyTo(R21);
+        best.t.copyTo(t21);
+        vP3D = best.vP3D;
+        vbTriangulated = best.vbGood;
 
         return true;
     }
@@ -728,21 +814,6 @@ bool Initializer::ReconstructH(vector<bool> &vbMatchesInliers, cv::Mat &H21, cv:
     return false;
 }
 
-void Initializer::Triangulate(const cv::KeyPoint &kp1, const cv::KeyPoint &kp2, const cv::Mat &P1, const cv::Mat &P2, cv::Mat &x3D)
-{
-    cv::Mat A(4,4,CV_32F);
-
-    A.row(0) = kp1.pt.x*P1.row(2)-P1.row(0);
-    A.row(1) = kp1.pt.y*P1.row(2)-P1.row(1);
-    A.row(2) = kp2.pt.x*P2.row(2)-P2.row(0);
-    A.row(3) = kp2.pt.y*P2.row(2)-P2.row(1);
-
-    cv::Mat u,w,vt;
-    cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV);
-    x3D = vt.row(3).t();
-    x3D = x3D.rowRange(0,3)/x3D.at<float>(3);
-}
-
 void Initializer::Normalize(const vector<cv::KeyPoint> &vKeys, vector<cv::Point2f> &vNormalizedPoints, cv::Mat &T)
 {
     float meanX = 0;
@@ -792,115 +863,185 @@ void Initializer::Normalize(const vector<cv::KeyPoint> &vKeys, vector<cv::Point2
 }
 
 
-int Initializer::CheckRT(const cv::Mat &R, const cv::Mat &t, const vector<cv::KeyPoint> &vKeys1, const vector<cv::KeyPoint> &vKeys2,
-                       const vector<Match> &vMatches12, vector<bool> &vbMatchesInliers,
-                       const cv::Mat &K, vector<cv::Point3f> &vP3D, float th2, vector<bool> &vbGood, float &parallax)
+// Linear triangulation of the normalized coordinates (x1,y1) in camera 1 and (x2,y2) in camera 2 = [R|t] (row major)
+// The four DLT equations are solved in least squares with the point inhomogeneous: the 3x3 normal equations
+// in closed form, instead of an SVD of the 4x4 system. False if they are singular (rays without parallax)
+static inline bool TriangulateNormalized(const float x1, const float y1, const float x2, const float y2,
+                                         const float* R, const float* t, float* x3D)
+{
+    // a*[X 1]' = 0, two rows per view
+    const float A[4][4] = {{-1.0f, 0.0f, x1, 0.0f},
+                           {0.0f, -1.0f, y1, 0.0f},
+                           {x2*R[6]-R[0], x2*R[7]-R[1], x2*R[8]-R[2], x2*t[2]-t[0]},
+                           {y2*R[6]-R[3], y2*R[7]-R[4], y2*R[8]-R[5], y2*t[2]-t[1]}};
+
+    // M X = b
+    float M[3][3] = {{0,0,0},{0,0,0},{0,0,0}};
+    float b[3] = {0,0,0};
+    for(int r=0; r<4; r++)
+    {
+        for(int i=0; i<3; i++)
+        {
+            b[i] -= A[r][i]*A[r][3];
+            for(int j=i; j<3; j++)
+                M[i][j] += A[r][i]*A[r][j];
+        }
+    }
+
+    // M is symmetric, so is its cofactor matrix
+    const float c00 = M[1][1]*M[2][2]-M[1][2]*M[1][2];
+    const float c01 = M[1][2]*M[0][2]-M[0][1]*M[2][2];
+    const float c02 = M[0][1]*M[1][2]-M[1][1]*M[0][2];
+    const float c11 = M[0][0]*M[2][2]-M[0][2]*M[0][2];
+    const float c12 = M[0][1]*M[0][2]-M[0][0]*M[1][2];
+    const float c22 = M[0][0]*M[1][1]-M[0][1]*M[0][1];
+
+    const float det = M[0][0]*c00+M[0][1]*c01+M[0][2]*c02;
+    if(det==0.0f)
+        return false;
+
+    const float invDet = 1.0f/det;
+    x3D[0] = (c00*b[0]+c01*b[1]+c02*b[2])*invDet;
+    x3D[1] = (c01*b[0]+c11*b[1]+c12*b[2])*invDet;
+    x3D[2] = (c02*b[0]+c12*b[1]+c22*b[2])*invDet;
+    return true;
+}
+
+void Initializer::CheckHypotheses(vector<bool> &vbMatchesInliers, int nHypotheses, const cv::Mat &K)
+{
+    mvInlierMatches.clear();
+    for(size_t i=0, iend=mvMatches12.size(); i<iend; i++)
+        if(vbMatchesInliers[i])
+            mvInlierMatches.push_back(mvMatches12[i]);
+
+    mnLeadingGood = 0;
+
+    // The outcome does not depend on the order the hypotheses end in, only those that cannot matter are dropped
+    const float th2 = 4.0f*mSigma2;
+    TaskGroup workers(TaskPool::TRACKING);
+    for(int i=1; i<nHypotheses; i++)
+        workers.Run(boost::bind(&Initializer::CheckRT,this,boost::ref(mvHypotheses[i]),boost::cref(K),th2));
+    CheckRT(mvHypotheses[0],K,th2);
+    workers.Wait();
+}
+
+void Initializer::CheckRT(Hypothesis &h, const cv::Mat &K, float th2)
 {
     // Calibration parameters
     const float fx = K.at<float>(0,0);
     const float fy = K.at<float>(1,1);
     const float cx = K.at<float>(0,2);
     const float cy = K.at<float>(1,2);
+    const float invfx = 1.0f/fx;
+    const float invfy = 1.0f/fy;
 
-    vbGood = vector<bool>(vKeys1.size(),false);
-    vP3D.resize(vKeys1.size());
-
-    vector<float> vCosParallax;
-    vCosParallax.reserve(vKeys1.size());
-
-    // Camera 1 Projection Matrix K[I|0]
-    cv::Mat P1(3,4,CV_32F,cv::Scalar(0));
-    K.copyTo(P1.rowRange(0,3).colRange(0,3));
-
-    cv::Mat O1 = cv::Mat::zeros(3,1,CV_32F);
+    float R[9], t[3];
+    for(int r=0; r<3; r++)
+    {
+        for(int c=0; c<3; c++)
+            R[3*r+c] = h.R.at<float>(r,c);
+        t[r] = h.t.at<float>(r);
+    }
 
-    // Camera 2 Projection Matrix K[R|t]
-    cv::Mat P2(3,4,CV_32F);
-    R.copyTo(P2.rowRange(0,3).colRange(0,3));
-    t.copyTo(P2.rowRange(0,3).col(3));
-    P2 = K*P2;
+    // Center of camera 2 in camera 1, -R'*t
+    const float O2[3] = {-(R[0]*t[0]+R[3]*t[1]+R[6]*t[2]),
+                         -(R[1]*t[0]+R[4]*t[1]+R[7]*t[2]),
+                         -(R[2]*t[0]+R[5]*t[1]+R[8]*t[2])};
 
-    cv::Mat O2 = -R.t()*t;
+    h.vbGood.assign(mvKeys1.size(),false);
+    h.vP3D.resize(mvKeys1.size());
+    h.vCosParallax.clear();
+    h.vCosParallax.reserve(mvInlierMatches.size());
+    h.bDropped = false;
 
     int nGood=0;
 
-    for(size_t i=0, iend=vMatches12.size();i<iend;i++)
+    const int nMatches = mvInlierMatches.size();
+    for(int i=0; i<nMatches; i++)
     {
-        if(!vbMatchesInliers[i])
-            continue;
+        // Even with all the matches left, the hypothesis would not reach DOMINANCE of the leading one
+        if(i%CHECK_STEP==0)
+        {
+            int nLeading = mnLeadingGood.load(boost::memory_order_relaxed);
+            if(nGood+(nMatches-i)<DOMINANCE*nLeading)
+            {
+                h.bDropped = true;
+                break;
+            }
+            while(nGood>nLeading && !mnLeadingGood.compare_exchange_weak(nLeading,nGood,boost::memory_order_relaxed));
+        }
 
-        const cv::KeyPoint &kp1 = vKeys1[vMatches12[i].first];
-        const cv::KeyPoint &kp2 = vKeys2[vMatches12[i].second];
-        cv::Mat p3dC1;
+        const Match &match = mvInlierMatches[i];
+        const cv::KeyPoint &kp1 = mvKeys1[match.first];
+        const cv::KeyPoint &kp2 = mvKeys2[match.second];
 
-        Triangulate(kp1,kp2,P1,P2,p3dC1);
+        float p3dC1[3];
+        if(!TriangulateNormalized((kp1.pt.x-cx)*invfx,(kp1.pt.y-cy)*invfy,(kp2.pt.x-cx)*invfx,(kp2.pt.y-cy)*invfy,R,t,p3dC1))
+            continue;
 
-        if(!isfinite(p3dC1.at<float>(0)) || !isfinite(p3dC1.at<float>(1)) || !isfinite(p3dC1.at<float>(2)))
-        {
-            vbGood[vMatches12[i].first]=false;
+        if(!isfinite(p3dC1[0]) || !isfinite(p3dC1[1]) || !isfinite(p3dC1[2]))
             continue;
-        }
 
         // Check parallax
-        cv::Mat normal1 = p3dC1 - O1;
-        float dist1 = cv::norm(normal1);
-
-        cv::Mat normal2 = p3dC1 - O2;
-        float dist2 = cv::norm(normal2);
+        const float n2x = p3dC1[0]-O2[0], n2y = p3dC1[1]-O2[1], n2z = p3dC1[2]-O2[2];
+        const float dist1 = sqrt(p3dC1[0]*p3dC1[0]+p3dC1[1]*p3dC1[1]+p3dC1[2]*p3dC1[2]);
+        const float dist2 = sqrt(n2x*n2x+n2y*n2y+n2z*n2z);
 
-        float cosParallax = normal1.dot(normal2)/(dist1*dist2);
+        const float cosParallax = (p3dC1[0]*n2x+p3dC1[1]*n2y+p3dC1[2]*n2z)/(dist1*dist2);
 
         // Check depth in front of first camera (only if enough parallax, as "infinite" points can easily go to negative depth)
-        if(p3dC1.at<float>(2)<=0 && cosParallax<0.99998)
+        if(p3dC1[2]<=0 && cosParallax<0.99998)
             continue;
 
         // Check depth in front of second camera (only if enough parallax, as "infinite" points can easily go to negative depth)
-        cv::Mat p3dC2 = R*p3dC1+t;
+        const float x2 = R[0]*p3dC1[0]+R[1]*p3dC1[1]+R[2]*p3dC1[2]+t[0];
+        const float y2 = R[3]*p3dC1[0]+R[4]*p3dC1[1]+R[5]*p3dC1[2]+t[1];
+        const float z2 = R[6]*p3dC1[0]+R[7]*p3dC1[1]+R[8]*p3dC1[2]+t[2];
 
-        if(p3dC2.at<float>(2)<=0 && cosParallax<0.99998)
+        if(z2<=0 && cosParallax<0.99998)
             continue;
 
         // Check reprojection error in first image
-        float im1x, im1y;
-        float invZ1 = 1.0/p3dC1.at<float>(2);
-        im1x = fx*p3dC1.at<float>(0)*invZ1+cx;
-        im1y = fy*p3dC1.at<float>(1)*invZ1+cy;
+        const float invZ1 = 1.0f/p3dC1[2];
+        const float im1x = fx*p3dC1[0]*invZ1+cx;
+        const float im1y = fy*p3dC1[1]*invZ1+cy;
 
-        float squareError1 = (im1x-kp1.pt.x)*(im1x-kp1.pt.x)+(im1y-kp1.pt.y)*(im1y-kp1.pt.y);
+        const float squareError1 = (im1x-kp1.pt.x)*(im1x-kp1.pt.x)+(im1y-kp1.pt.y)*(im1y-kp1.pt.y);
 
         if(squareError1>th2)
             continue;
 
         // Check reprojection error in second image
-        float im2x, im2y;
-        float invZ2 = 1.0/p3dC2.at<float>(2);
-        im2x = fx*p3dC2.at<float>(0)*invZ2+cx;
-        im2y = fy*p3dC2.at<float>(1)*invZ2+cy;
+        const float invZ2 = 1.0f/z2;
+        const float im2x = fx*x2*invZ2+cx;
+        const float im2y = fy*y2*invZ2+cy;
 
-        float squareError2 = (im2x-kp2.pt.x)*(im2x-kp2.pt.x)+(im2y-kp2.pt.y)*(im2y-kp2.pt.y);
+        const float squareError2 = (im2x-kp2.pt.x)*(im2x-kp2.pt.x)+(im2y-kp2.pt.y)*(im2y-kp2.pt.y);
 
         if(squareError2>th2)
             continue;
 
-        vCosParallax.push_back(cosParallax);
-        vP3D[vMatches12[i].first] = cv::Point3f(p3dC1.at<float>(0),p3dC1.at<float>(1),p3dC1.at<float>(2));
+        h.vCosParallax.push_back(cosParallax);
+        h.vP3D[match.first] = cv::Point3f(p3dC1[0],p3dC1[1],p3dC1[2]);
         nGood++;
 
         if(cosParallax<0.99998)
-            vbGood[vMatches12[i].first]=true;
+            h.vbGood[match.first]=true;
     }
 
-    if(nGood>0)
-    {
-        sort(vCosParallax.begin(),vCosParallax.end());
+    h.nGood = nGood;
+    int nLeading = mnLeadingGood.load(boost::memory_order_relaxed);
+    while(nGood>nLeading && !mnLeadingGood.compare_exchange_weak(nLeading,nGood,boost::memory_order_relaxed));
 
-        size_t idx = min(50,int(vCosParallax.size()-1));
-        parallax = acos(vCosParallax[idx])*180/CV_PI;
+    // The parallax of the 50th point with the most parallax, only its position in the order is needed
+    if(nGood>0 && !h.bDropped)
+    {
+        vector<float>::iterator nth = h.vCosParallax.begin()+min(50,nGood-1);
+        nth_element(h.vCosParallax.begin(),nth,h.vCosParallax.end());
+        h.parallax = acos(*nth)*180/CV_PI;
     }
     else
-        parallax=0;
-
-    return nGood;
+        h.parallax=0;
 }
 
 void Initializer::DecomposeE(const cv::Mat &E, cv::Mat &R1, cv::Mat &R2, cv::Mat &t)
@@ -0,0 +1,130 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/KernelBenchmark.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+KernelBenchmark::KernelBenchmark(double minTime):
+    mfMinTime(minTime), mnIterations(0), mnNextCheck(0), mfSink(0)
+{
+}
+
+void KernelBenchmark::Begin(const string &name)
+{
+    mCurrentName = name;
+    mnIterations = 0;
+    mnNextCheck = 1;
+    mStart = ros::WallTime::now();
+}
+
+bool KernelBenchmark::KeepRunning()
+{
+    if(mnIterations<mnNextCheck)
+    {
+        mnIterations++;
+        return true;
+    }
+
+    const double elapsed = (ros::WallTime::now()-mStart).toSec();
+    if(elapsed<mfMinTime)
+    {
+        mnNextCheck = 2*mnIterations;
+        mnIterations++;
+        return true;
+    }
+
+    Result result;
+    result.name = mCurrentName;
+    result.nIterations = mnIterations;
+    result.nsPerOp = elapsed*1e9/mnIterations;
+    mvResults.push_back(result);
+    return false;
+}
+
+void KernelBenchmark::SaveCSV(const string &filename) const
+{
+    ofstream f(filename.c_str());
+    f << "name,iterations,ns_per_op" << endl;
+    f << fixed << setprecision(1);
+    for(size_t i=0; i<mvResults.size(); i++)
+        f << mvResults[i].name << "," << mvResults[i].nIterations << "," << mvResults[i].nsPerOp << endl;
+}
+
+bool KernelBenchmark::LoadBaseline(const string &filename)
+{
+    ifstream f(filename.c_str());
+    if(!f.is_open())
+        return false;
+
+    mBaseline.clear();
+    string line;
+    getline(f,line); // header
+    while(getline(f,line))
+    {
+        // Names have no commas, the time is the last field
+        const size_t first = line.find(',');
+        const size_t last = line.rfind(',');
+        if(first==string::npos || last==first)
+            continue;
+        mBaseline[line.substr(0,first)] = atof(line.c_str()+last+1);
+    }
+    return !mBaseline.empty();
+}
+
+int KernelBenchmark::Report(double fTolerance) const
+{
+    int nSlower = 0;
+    for(size_t i=0; i<mvResults.size(); i++)
+    {
+        const Result &result = mvResults[i];
+        cout << "  " << left << setw(56) << result.name << right << setw(14) << fixed << setprecision(1)
+             << result.nsPerOp << " ns";
+
+        map<string,double>::const_iterator it = mBaseline.find(result.name);
+        if(it!=mBaseline.end() && it->second>0)
+        {
+            const double ratio = result.nsPerOp/it->second;
+            cout << "  x" << setprecision(2) << ratio;
+            if(ratio>1+fTolerance)
+            {
+                cout << "  SLOWER";
+                nSlower++;
+            }
+            else if(ratio<1-fTolerance)
+                cout << "  faster";
+        }
+        cout << endl;
+    }
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+    return nSlower;
+}
+
+} //namespace ORB_SLAM
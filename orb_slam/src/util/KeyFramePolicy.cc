@@ -0,0 +1,84 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/KeyFramePolicy.h"
+
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+// Weight of the last frame in the smoothed ratio, slope and period
+const float KeyFramePolicy::SMOOTHING = 0.3f;
+
+const int KeyFramePolicy::MIN_SAMPLES = 3;
+
+KeyFramePolicy::KeyFramePolicy(float fThreshold, float fMaxWait):
+    mfThreshold(fThreshold), mfMaxWait(std::max(fMaxWait,0.0f)), mfRatio(0), mfSlope(0), mnSamples(0), mnReferenceId(0),
+    mfPeriod(-1), mLastTimeStamp(-1)
+{
+}
+
+void KeyFramePolicy::Update(double timeStamp, long unsigned int nReferenceId, float fRatio)
+{
+    const float dt = mLastTimeStamp<0 ? 0 : timeStamp-mLastTimeStamp;
+    mLastTimeStamp = timeStamp;
+
+    if(dt>0)
+        mfPeriod = mfPeriod<0 ? dt : SMOOTHING*dt + (1-SMOOTHING)*mfPeriod;
+
+    // The ratio jumps with the reference, and a gap in the frames leaves no trend
+    if(mnSamples==0 || nReferenceId!=mnReferenceId || dt<=0 || dt>4*mfPeriod)
+    {
+        mnReferenceId = nReferenceId;
+        mfRatio = fRatio;
+        mfSlope = 0;
+        mnSamples = 1;
+        return;
+    }
+
+    const float ratio = SMOOTHING*fRatio + (1-SMOOTHING)*mfRatio;
+    mfSlope = SMOOTHING*(ratio-mfRatio)/dt + (1-SMOOTHING)*mfSlope;
+    mfRatio = ratio;
+    mnSamples++;
+}
+
+bool KeyFramePolicy::Anticipate(float fHorizon) const
+{
+    if(fHorizon<0 || mnSamples<MIN_SAMPLES || mfSlope>=0)
+        return false;
+
+    // Already under the threshold is the usual condition
+    if(mfRatio<=mfThreshold)
+        return false;
+
+    return (mfRatio-mfThreshold) <= -mfSlope*fHorizon;
+}
+
+bool KeyFramePolicy::Wait(float fMappingDelay) const
+{
+    if(fMappingDelay<0 || mfPeriod<0)
+        return false;
+
+    return fMappingDelay <= mfMaxWait*mfPeriod;
+}
+
+} //namespace ORB_SLAM
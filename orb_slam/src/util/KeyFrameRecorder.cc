@@ -0,0 +1,277 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/KeyFrameRecorder.h"
+#include "util/BinaryIO.h"
+
+#include "types/MapDatabase.h"
+#include "types/Map.h"
+#include "types/KeyFrame.h"
+#include "types/MapPoint.h"
+#include "types/Frame.h"
+
+#include <ros/ros.h>
+
+#include <sstream>
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+// Keyframe stream files start with this tag, the MapSerializer format version and the vocabulary size
+static const uint32_t STREAM_FILE_TAG = 0x4f4b4653;
+
+// How a match refers to its point: by the id it was recorded with, or by the id followed by the point
+static const uint8_t POINT_RECORDED = 0;
+static const uint8_t POINT_NEW = 1;
+
+KeyFrameRecorder::KeyFrameRecorder():
+    mnRecorded(0), mbClosing(false), mpWriter(NULL)
+{
+}
+
+KeyFrameRecorder::~KeyFrameRecorder()
+{
+    Close();
+}
+
+bool KeyFrameRecorder::Open(const std::string &filename, unsigned int nWords)
+{
+    Close();
+
+    mFile.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+    if(!mFile.is_open())
+        return false;
+    BinaryIO::WritePod(mFile,STREAM_FILE_TAG);
+    BinaryIO::WritePod(mFile,MapSerializer::FORMAT_VERSION);
+    BinaryIO::WritePod(mFile,static_cast<uint32_t>(nWords));
+
+    mStart = ros::WallTime::now();
+    msRecordedPoints.clear();
+    mnRecorded = 0;
+    mbClosing = false;
+    mpWriter = new boost::thread(&KeyFrameRecorder::RunWriter,this);
+    return true;
+}
+
+void KeyFrameRecorder::Record(KeyFrame* pKF)
+{
+    if(mpWriter==NULL)
+        return;
+
+    Map* pMap = pKF->getMap();
+    std::ostringstream f(std::ios::binary);
+    BinaryIO::WritePod(f,(ros::WallTime::now()-mStart).toSec());
+    BinaryIO::WritePod(f,static_cast<uint64_t>(pMap ? pMap->mnId : 0));
+    MapSerializer::WriteKeyFrame(f,pKF);
+
+    std::vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+    uint32_t nMatches = 0;
+    for(size_t i=0; i<vpMPs.size(); i++)
+        if(vpMPs[i] && !vpMPs[i]->isBad())
+            nMatches++;
+    BinaryIO::WritePod(f,nMatches);
+
+    boost::mutex::scoped_lock lock(mMutex);
+
+    // Each match as the step from the previous keypoint index, then the point id
+    size_t nPrev = 0;
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        if(!pMP || pMP->isBad())
+            continue;
+        BinaryIO::WriteVarint(f,i-nPrev);
+        nPrev = i;
+        if(msRecordedPoints.insert(pMP->mnId).second)
+        {
+            BinaryIO::WritePod(f,POINT_NEW);
+            BinaryIO::WriteVarint(f,pMP->mnId);
+            const Eigen::Vector3f Pos = pMP->GetWorldPosEigen();
+            for(int j=0; j<3; j++)
+                BinaryIO::WritePod(f,Pos(j));
+        }
+        else
+        {
+            BinaryIO::WritePod(f,POINT_RECORDED);
+            BinaryIO::WriteVarint(f,pMP->mnId);
+        }
+    }
+
+    mqRecords.push_back(f.str());
+    mnRecorded++;
+    mcvQueued.notify_one();
+}
+
+void KeyFrameRecorder::Close()
+{
+    if(mpWriter==NULL)
+        return;
+
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mbClosing = true;
+        mcvQueued.notify_one();
+    }
+    mpWriter->join();
+    delete mpWriter;
+    mpWriter = NULL;
+
+    mFile.close();
+}
+
+unsigned long KeyFrameRecorder::Recorded()
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    return mnRecorded;
+}
+
+void KeyFrameRecorder::RunWriter()
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    while(true)
+    {
+        while(mqRecords.empty() && !mbClosing)
+            mcvQueued.wait(lock);
+        if(mqRecords.empty())
+            break;
+
+        // Written unlocked, the records are self contained
+        std::string record;
+        record.swap(mqRecords.front());
+        mqRecords.pop_front();
+        lock.unlock();
+        BinaryIO::WritePod(mFile,static_cast<uint64_t>(record.size()));
+        mFile.write(record.data(),record.size());
+        lock.lock();
+    }
+    mFile.flush();
+}
+
+KeyFrameReplayer::KeyFrameReplayer(MapDatabase* pMapDB):
+    mpMapDB(pMapDB), mnVersion(0)
+{
+}
+
+bool KeyFrameReplayer::Open(const std::string &filename)
+{
+    mFile.open(filename.c_str(), std::ios::binary);
+    if(!mFile.is_open())
+        return false;
+
+    uint32_t nTag, nWords;
+    if(!BinaryIO::ReadPod(mFile,nTag) || !BinaryIO::ReadPod(mFile,mnVersion) || !BinaryIO::ReadPod(mFile,nWords))
+        return false;
+    return nTag==STREAM_FILE_TAG && mnVersion>=1 && mnVersion<=MapSerializer::FORMAT_VERSION &&
+            nWords==mpMapDB->getVocab()->size();
+}
+
+Map* KeyFrameReplayer::GetMap(unsigned long nRecordedMapId)
+{
+    std::map<unsigned long,Map*>::iterator mit = mMaps.find(nRecordedMapId);
+    if(mit!=mMaps.end() && !mit->second->getErased())
+    {
+        if(mpMapDB->getCurrent()!=mit->second)
+            mpMapDB->setMap(mit->second);
+        return mit->second;
+    }
+
+    // Merged maps are not returned to, the recording started a new one after the merge
+    Map* pMap = mpMapDB->getNewMap();
+    mpMapDB->addMap(pMap);
+    mMaps[nRecordedMapId] = pMap;
+    return pMap;
+}
+
+KeyFrame* KeyFrameReplayer::Next(double &time)
+{
+    uint64_t nSize, nMapId;
+    if(!BinaryIO::ReadPod(mFile,nSize) || !BinaryIO::ReadPod(mFile,time) || !BinaryIO::ReadPod(mFile,nMapId))
+        return NULL;
+
+    Map* pMap = GetMap(nMapId);
+    KeyFrame* pKF = MapSerializer::ReadKeyFrame(mFile,pMap,mpMapDB,mnVersion,NULL);
+    if(!pKF)
+        return NULL;
+    KeyFrame::nNextId = std::max(KeyFrame::nNextId,pKF->mnId+1);
+    Frame::nNextId = std::max(Frame::nNextId,pKF->mnFrameId+1);
+
+    // The first two keyframes are not associated by Local Mapping, Tracking does it at initialization
+    const bool bInitial = pKF->mnId<=1;
+
+    const size_t N = pKF->GetMapPointMatches().size();
+    uint32_t nMatches;
+    bool bOK = BinaryIO::ReadPod(mFile,nMatches);
+    uint64_t idx = 0;
+    for(uint32_t i=0; bOK && i<nMatches; i++)
+    {
+        uint64_t nStep, nId;
+        uint8_t type;
+        bOK = BinaryIO::ReadVarint(mFile,nStep) && BinaryIO::ReadPod(mFile,type) && BinaryIO::ReadVarint(mFile,nId);
+        if(!bOK)
+            break;
+        idx += nStep;
+
+        MapPoint* pMP = NULL;
+        bool bNew = false;
+        if(type==POINT_NEW)
+        {
+            float pos[3];
+            bOK = BinaryIO::ReadPod(mFile,pos[0]) && BinaryIO::ReadPod(mFile,pos[1]) && BinaryIO::ReadPod(mFile,pos[2]);
+            if(!bOK || idx>=N)
+                continue;
+            pMP = new MapPoint(cv::Mat(3,1,CV_32F,pos).clone(),pKF,pMap);
+            pMap->AddMapPoint(pMP);
+            mPoints[nId] = pMP;
+            bNew = true;
+        }
+        else
+        {
+            MapSerializer::MapPointIndex::iterator mit = mPoints.find(nId);
+            if(mit!=mPoints.end())
+                pMP = mit->second;
+        }
+
+        if(!pMP || pMP->isBad() || idx>=N)
+            continue;
+        pKF->AddMapPoint(pMP,idx);
+
+        // Nothing else sees a new point yet, it gets its observation, normal and descriptor as Tracking gives them
+        if(bNew || bInitial)
+        {
+            pMP->AddObservation(pKF,idx);
+            pMP->ComputeDistinctiveDescriptors();
+            pMP->UpdateNormalAndDepth();
+        }
+    }
+    if(!bOK)
+    {
+        ROS_WARN("ORB-SLAM - Keyframe %lu replayed with malformed matches", pKF->mnId);
+        return NULL;
+    }
+
+    if(bInitial)
+        pKF->UpdateConnections();
+    pMap->AddKeyFrame(pKF);
+    return pKF;
+}
+
+} //namespace ORB_SLAM
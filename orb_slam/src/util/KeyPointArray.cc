@@ -0,0 +1,185 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/KeyPointArray.h"
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+// Patch size of the ORB extractor at the finest level
+static const float PATCH_SIZE = 31.0f;
+
+template<typename T>
+static const T* Data(const vector<T> &v)
+{
+    return v.empty() ? NULL : &v[0];
+}
+
+KeyPointArray::KeyPointArray():
+    mN(0), mpX(NULL), mpY(NULL), mpAngle(NULL), mpOctave(NULL), mpRawX(NULL), mpRawY(NULL)
+{
+}
+
+void KeyPointArray::Assign(const vector<cv::KeyPoint> &vKeys, const vector<cv::KeyPoint> &vKeysUn)
+{
+    const size_t N = vKeysUn.size();
+    mvX.resize(N);
+    mvY.resize(N);
+    mvAngle.resize(N);
+    mvOctave.resize(N);
+
+    // The distorted positions are kept only for a full set that differs
+    const bool bRaw = vKeys.size()==N;
+    bool bDistorted = false;
+    for(size_t i=0; i<N; i++)
+    {
+        const cv::KeyPoint &kp = vKeysUn[i];
+        mvX[i] = kp.pt.x;
+        mvY[i] = kp.pt.y;
+        mvAngle[i] = kp.angle;
+        mvOctave[i] = kp.octave;
+        if(bRaw && !bDistorted)
+            bDistorted = vKeys[i].pt!=kp.pt;
+    }
+
+    vector<float>().swap(mvRawX);
+    vector<float>().swap(mvRawY);
+    if(bDistorted)
+    {
+        mvRawX.resize(N);
+        mvRawY.resize(N);
+        for(size_t i=0; i<N; i++)
+        {
+            mvRawX[i] = vKeys[i].pt.x;
+            mvRawY[i] = vKeys[i].pt.y;
+        }
+    }
+
+    mN = N;
+    mpX = Data(mvX);
+    mpY = Data(mvY);
+    mpAngle = Data(mvAngle);
+    mpOctave = Data(mvOctave);
+    mpRawX = Data(mvRawX);
+    mpRawY = Data(mvRawY);
+}
+
+void KeyPointArray::Assign(size_t N, const float* pX, const float* pY, const float* pAngle, const unsigned char* pOctave,
+                           const float* pRawX, const float* pRawY, bool bInPlace)
+{
+    mN = N;
+    if(bInPlace || N==0)
+    {
+        vector<float>().swap(mvX);
+        vector<float>().swap(mvY);
+        vector<float>().swap(mvAngle);
+        vector<unsigned char>().swap(mvOctave);
+        vector<float>().swap(mvRawX);
+        vector<float>().swap(mvRawY);
+        mpX = N ? pX : NULL;
+        mpY = N ? pY : NULL;
+        mpAngle = N ? pAngle : NULL;
+        mpOctave = N ? pOctave : NULL;
+        mpRawX = N ? pRawX : NULL;
+        mpRawY = N ? pRawY : NULL;
+        return;
+    }
+
+    mvX.assign(pX,pX+N);
+    mvY.assign(pY,pY+N);
+    mvAngle.assign(pAngle,pAngle+N);
+    mvOctave.assign(pOctave,pOctave+N);
+    if(pRawX && pRawY)
+    {
+        mvRawX.assign(pRawX,pRawX+N);
+        mvRawY.assign(pRawY,pRawY+N);
+    }
+    else
+    {
+        vector<float>().swap(mvRawX);
+        vector<float>().swap(mvRawY);
+    }
+    mpX = Data(mvX);
+    mpY = Data(mvY);
+    mpAngle = Data(mvAngle);
+    mpOctave = Data(mvOctave);
+    mpRawX = Data(mvRawX);
+    mpRawY = Data(mvRawY);
+}
+
+cv::KeyPoint KeyPointArray::KeyPointUn(size_t i, const vector<float> &vScaleFactors) const
+{
+    const int octave = mpOctave[i];
+    const float size = octave<(int)vScaleFactors.size() ? PATCH_SIZE*vScaleFactors[octave] : PATCH_SIZE;
+    return cv::KeyPoint(mpX[i],mpY[i],size,mpAngle[i],0,octave);
+}
+
+cv::KeyPoint KeyPointArray::KeyPointDistorted(size_t i, const vector<float> &vScaleFactors) const
+{
+    cv::KeyPoint kp = KeyPointUn(i,vScaleFactors);
+    kp.pt = RawPt(i);
+    return kp;
+}
+
+void KeyPointArray::GetKeyPointsUn(vector<cv::KeyPoint> &vKeysUn, const vector<float> &vScaleFactors) const
+{
+    vKeysUn.resize(HasPositions() ? mN : 0);
+    for(size_t i=0; i<vKeysUn.size(); i++)
+        vKeysUn[i] = KeyPointUn(i,vScaleFactors);
+}
+
+void KeyPointArray::GetKeyPoints(vector<cv::KeyPoint> &vKeys, const vector<float> &vScaleFactors) const
+{
+    vKeys.resize(HasPositions() ? mN : 0);
+    for(size_t i=0; i<vKeys.size(); i++)
+        vKeys[i] = KeyPointDistorted(i,vScaleFactors);
+}
+
+void KeyPointArray::AllocatePositions()
+{
+    // Blank keypoints are out of the image, never in an area searched
+    mvX.assign(mN,-1.0f);
+    mvY.assign(mN,-1.0f);
+    mvAngle.assign(mN,-1.0f);
+    mpX = Data(mvX);
+    mpY = Data(mvY);
+    mpAngle = Data(mvAngle);
+}
+
+void KeyPointArray::ReleasePositions()
+{
+    vector<float>().swap(mvX);
+    vector<float>().swap(mvY);
+    vector<float>().swap(mvAngle);
+    vector<float>().swap(mvRawX);
+    vector<float>().swap(mvRawY);
+    mpX = mpY = mpAngle = mpRawX = mpRawY = NULL;
+}
+
+size_t KeyPointArray::HeapBytes() const
+{
+    return (mvX.capacity()+mvY.capacity()+mvAngle.capacity()+mvRawX.capacity()+mvRawY.capacity())*sizeof(float)+
+            mvOctave.capacity();
+}
+
+} //namespace ORB_SLAM
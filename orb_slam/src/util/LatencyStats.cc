@@ -0,0 +1,157 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/LatencyStats.h"
+
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+// Histogram range and resolution
+static const double HIST_MIN = 1e-6;
+static const double HIST_GROWTH = 1.05;
+static const int HIST_BINS = 331;
+
+LatencyHistogram::LatencyHistogram():
+    mvBins(HIST_BINS,0), mnCount(0), mfSum(0), mfMax(0)
+{}
+
+void LatencyHistogram::Add(double seconds)
+{
+    int bin = 0;
+    if(seconds>HIST_MIN)
+        bin = std::min((int)(log(seconds/HIST_MIN)/log(HIST_GROWTH))+1,HIST_BINS-1);
+    mvBins[bin]++;
+    mnCount++;
+    mfSum += seconds;
+    mfMax = std::max(mfMax,seconds);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &other)
+{
+    for(int i=0; i<HIST_BINS; i++)
+        mvBins[i] += other.mvBins[i];
+    mnCount += other.mnCount;
+    mfSum += other.mfSum;
+    mfMax = std::max(mfMax,other.mfMax);
+}
+
+void LatencyHistogram::Clear()
+{
+    std::fill(mvBins.begin(),mvBins.end(),0);
+    mnCount = 0;
+    mfSum = 0;
+    mfMax = 0;
+}
+
+double LatencyHistogram::Percentile(double p) const
+{
+    if(mnCount==0)
+        return 0;
+
+    // Upper edge of the bin holding the p-th sample, never above the largest sample
+    const unsigned long nRank = std::max((unsigned long)ceil(p*mnCount),1ul);
+    unsigned long nSeen = 0;
+    for(int i=0; i<HIST_BINS; i++)
+    {
+        nSeen += mvBins[i];
+        if(nSeen>=nRank)
+            return std::min(HIST_MIN*pow(HIST_GROWTH,i),mfMax);
+    }
+    return mfMax;
+}
+
+LatencyStats::LatencyStats()
+{}
+
+LatencyStats* LatencyStats::Global()
+{
+    static LatencyStats stats;
+    return &stats;
+}
+
+const char* LatencyStats::StageName(int stage)
+{
+    static const char* names[N_STAGES] = {
+        "Frame",
+        "UndistortKeyPoints",
+        "Track",
+        "TrackWithMotionModel",
+        "TrackPreviousFrame",
+        "TrackLocalMap",
+        "SearchReferencePointsInFrustum",
+        "PoseOptimization",
+        "NeedNewKeyFrame",
+        "CreateNewKeyFrame",
+        "TrackFlow",
+        "TrackWithDirectAlignment"
+    };
+    if(stage<0 || stage>=N_STAGES)
+        return "Unknown";
+    return names[stage];
+}
+
+void LatencyStats::Add(int stage, double seconds)
+{
+    if(stage<0 || stage>=N_STAGES)
+        return;
+    boost::mutex::scoped_lock lock(mMutexStats);
+    mvWindow[stage].Add(seconds);
+}
+
+LatencyHistogram LatencyStats::TakeWindow(int stage)
+{
+    boost::mutex::scoped_lock lock(mMutexStats);
+    LatencyHistogram window = mvWindow[stage];
+    mvTotal[stage].Merge(window);
+    mvWindow[stage].Clear();
+    return window;
+}
+
+LatencyHistogram LatencyStats::GetTotal(int stage)
+{
+    boost::mutex::scoped_lock lock(mMutexStats);
+    LatencyHistogram total = mvTotal[stage];
+    total.Merge(mvWindow[stage]);
+    return total;
+}
+
+bool LatencyStats::SaveCSV(const std::string &filename)
+{
+    std::ofstream f(filename.c_str());
+    if(!f.is_open())
+        return false;
+
+    f << "stage,count,mean_ms,p50_ms,p95_ms,p99_ms,max_ms" << std::endl;
+    for(int i=0; i<N_STAGES; i++)
+    {
+        const LatencyHistogram total = GetTotal(i);
+        f << StageName(i) << "," << total.Count() << "," << total.Mean()*1000 << ","
+          << total.Percentile(0.5)*1000 << "," << total.Percentile(0.95)*1000 << ","
+          << total.Percentile(0.99)*1000 << "," << total.Max()*1000 << std::endl;
+    }
+    f.close();
+    return true;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,91 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/LoadShedder.h"
+
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+// Weight of the last measurement in the smoothed times
+const float LoadShedder::SMOOTHING = 0.1f;
+
+// Images further apart than this are a gap in the input, not its period
+static const double MAX_PERIOD = 1.0;
+
+LoadShedder::LoadShedder(float fTargetLoad, int nMaxStride):
+    mfTargetLoad(fTargetLoad), mfMinRatio(1.0f/std::max(nMaxStride,1)), mfTime(-1), mfPeriod(-1), mLastTimeStamp(-1),
+    mfRatio(1.0f), mfCredit(0), mnShed(0)
+{
+}
+
+bool LoadShedder::Shed(double timeStamp, bool bKeep)
+{
+    boost::mutex::scoped_lock lock(mMutex);
+
+    const double dt = timeStamp-mLastTimeStamp;
+    if(mLastTimeStamp>=0 && dt>0 && dt<MAX_PERIOD)
+        mfPeriod = (mfPeriod<0) ? dt : SMOOTHING*dt + (1-SMOOTHING)*mfPeriod;
+    mLastTimeStamp = timeStamp;
+
+    // Each image earns the tracked share, a whole one is tracked
+    mfCredit += mfRatio;
+    if(bKeep || mfCredit>=1.0f)
+    {
+        mfCredit = std::max(mfCredit-1.0f,0.0f);
+        return false;
+    }
+
+    mnShed++;
+    return true;
+}
+
+void LoadShedder::Update(float time)
+{
+    boost::mutex::scoped_lock lock(mMutex);
+
+    mfTime = (mfTime<0) ? time : SMOOTHING*time + (1-SMOOTHING)*mfTime;
+    if(mfPeriod<=0)
+        return;
+
+    // Tracking a share r of the images takes r*time/period of the camera time
+    const float load = mfTime/mfPeriod;
+    float ratio = std::min(std::max(mfTargetLoad/load,mfMinRatio),1.0f);
+
+    // More frames again only with some headroom, so the ratio does not oscillate around the target
+    if(ratio>mfRatio && ratio<1.0f && ratio<1.1f*mfRatio)
+        ratio = mfRatio;
+    mfRatio = ratio;
+}
+
+float LoadShedder::GetTrackedRatio()
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    return mfRatio;
+}
+
+unsigned int LoadShedder::GetShed()
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    return mnShed;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,558 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/LocalBundleAdjuster.h"
+
+#include "g2o/core/block_solver.h"
+#include "g2o/core/optimization_algorithm_levenberg.h"
+#include "g2o/solvers/cholmod/linear_solver_cholmod.h"
+#include "g2o/core/robust_kernel_impl.h"
+
+#include "types/KeyFrame.h"
+#include "types/MapPoint.h"
+#include "types/Map.h"
+#include "util/Converter.h"
+#include "util/MemoryStats.h"
+#include "util/Metrics.h"
+#include "util/Optimizer.h"
+#include "util/Trace.h"
+#include "util/AllocationStats.h"
+
+#include <list>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+// Keyframes and points share the vertex id space of the graph
+static int KeyFrameVertexId(KeyFrame* pKF)
+{
+    return 2*pKF->mnId;
+}
+
+static int MapPointVertexId(MapPoint* pMP)
+{
+    return 2*pMP->mnId+1;
+}
+
+// Norm of the relative motion in the tangent space
+static double PoseDistance(const g2o::SE3Quat &T1, const g2o::SE3Quat &T2)
+{
+    return (T1*T2.inverse()).log().norm();
+}
+
+LocalBundleAdjuster::LocalBundleAdjuster():
+    mpMap(NULL), mnRun(0), mnLastFullRun(0), mnFullPeriod(1), mRelinearizeThreshold(1e-3), mnMemoryBytes(0),
+    mbStructureValid(false)
+{
+    g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
+
+    linearSolver = new g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType>();
+
+    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
+
+    mpAlgorithm = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
+    mOptimizer.setAlgorithm(mpAlgorithm);
+}
+
+void LocalBundleAdjuster::Optimize(KeyFrame *pKF, bool* pbStopFlag)
+{
+    TRACE_SCOPE("LocalBundleAdjuster::Optimize");
+    ALLOC_SCOPE(LOCAL_BUNDLE_ADJUSTMENT);
+    MetricsTimer metricsTimer(Metrics::OPTIMIZER_MICROSECONDS);
+
+    Map* pMap = pKF->getMap();
+
+    // The graph belongs to one map
+    if(pMap!=mpMap)
+    {
+        Reset();
+        mpMap = pMap;
+    }
+    mnRun++;
+
+    // Local KeyFrames: First Breath Search from Current Keyframe
+    list<KeyFrame*> lLocalKeyFrames;
+
+    lLocalKeyFrames.push_back(pKF);
+    pKF->mnBALocalForKF = pKF->mnId;
+
+    KeyFrame::KeyFrameList pNeighKFs = pKF->GetCovisibleList();
+    for(int i=0, iend=pNeighKFs->size(); i<iend; i++)
+    {
+        KeyFrame* pKFi = (*pNeighKFs)[i];
+        pKFi->mnBALocalForKF = pKF->mnId;
+        if(!pKFi->isBad())
+            lLocalKeyFrames.push_back(pKFi);
+    }
+
+    // Local MapPoints seen in Local KeyFrames
+    list<MapPoint*> lLocalMapPoints;
+    for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin() , lend=lLocalKeyFrames.end(); lit!=lend; lit++)
+    {
+        KeyFrame::MapPointList pMPs = (*lit)->GetMapPointMatchList();
+        for(vector<MapPoint*>::const_iterator vit=pMPs->begin(), vend=pMPs->end(); vit!=vend; vit++)
+        {
+            MapPoint* pMP = *vit;
+            if(pMP)
+                if(!pMP->isBad())
+                    if(pMP->mnBALocalForKF!=pKF->mnId)
+                    {
+                        lLocalMapPoints.push_back(pMP);
+                        pMP->mnBALocalForKF=pKF->mnId;
+                    }
+        }
+    }
+
+    // Fixed Keyframes. Keyframes that see Local MapPoints but that are not Local Keyframes
+    list<KeyFrame*> lFixedCameras;
+    for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
+    {
+        MapPoint::ObservationList observations = (*lit)->GetObservations();
+        for(MapPoint::ObservationList::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        {
+            KeyFrame* pKFi = mit->first;
+
+            if(pKFi->mnBALocalForKF!=pKF->mnId && pKFi->mnBAFixedForKF!=pKF->mnId)
+            {
+                pKFi->mnBAFixedForKF=pKF->mnId;
+                if(!pKFi->isBad())
+                    lFixedCameras.push_back(pKFi);
+            }
+        }
+    }
+
+    // Bring the graph up to date with the window
+    // Touched vertices gained or lost observations, moved ones were changed outside of the local BA
+    VertexSet sLocal, sFixed, sTouched, sMoved;
+
+    for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
+    {
+        KeyFrame* pKFi = *lit;
+        g2o::VertexSE3Expmap* vSE3 = SyncKeyFrame(pKFi,sTouched,sMoved);
+        if(pKFi->mnId==0)
+            sFixed.insert(vSE3);
+        else
+            sLocal.insert(vSE3);
+    }
+
+    for(list<KeyFrame*>::iterator lit=lFixedCameras.begin(), lend=lFixedCameras.end(); lit!=lend; lit++)
+        sFixed.insert(SyncKeyFrame(*lit,sTouched,sMoved));
+
+    for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
+    {
+        MapPoint* pMP = *lit;
+        g2o::VertexSBAPointXYZ* vPoint = SyncMapPoint(pMP,sTouched,sMoved);
+        sLocal.insert(vPoint);
+
+        MapPoint::ObservationList observations = pMP->GetObservations();
+        for(MapPoint::ObservationList::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        {
+            KeyFrame* pKFi = mit->first;
+            if(pKFi->isBad())
+                continue;
+
+            ObservationMap::iterator oit = mmObservations.find(make_pair(pMP,pKFi));
+            if(oit!=mmObservations.end() && oit->second.nIndex!=mit->second)
+            {
+                RemoveObservation(oit);
+                oit = mmObservations.end();
+            }
+
+            if(oit==mmObservations.end())
+            {
+                Observation obs;
+                obs.pEdge = AddObservation(pMP,pKFi,mit->second);
+                obs.nIndex = mit->second;
+                obs.nRun = mnRun;
+                mmObservations.insert(make_pair(make_pair(pMP,pKFi),obs));
+
+                sTouched.insert(vPoint);
+                sTouched.insert(mmKeyFrames[pKFi]);
+            }
+            else
+            {
+                oit->second.nRun = mnRun;
+            }
+        }
+    }
+
+    // Observations not found in the window were erased (or left it with their point or keyframe)
+    for(ObservationMap::iterator oit=mmObservations.begin(); oit!=mmObservations.end(); )
+    {
+        if(oit->second.nRun==mnRun)
+        {
+            oit++;
+            continue;
+        }
+        sTouched.insert(static_cast<g2o::OptimizableGraph::Vertex*>(oit->second.pEdge->vertex(0)));
+        sTouched.insert(static_cast<g2o::OptimizableGraph::Vertex*>(oit->second.pEdge->vertex(1)));
+        RemoveObservation(oit++);
+    }
+
+    // The vertices out of the window have no edges left
+    for(map<KeyFrame*,g2o::VertexSE3Expmap*>::iterator it=mmKeyFrames.begin(); it!=mmKeyFrames.end(); )
+    {
+        if(sLocal.count(it->second) || sFixed.count(it->second))
+        {
+            it++;
+            continue;
+        }
+        mOptimizer.removeVertex(it->second);
+        mmKeyFrames.erase(it++);
+    }
+    for(map<MapPoint*,g2o::VertexSBAPointXYZ*>::iterator it=mmMapPoints.begin(); it!=mmMapPoints.end(); )
+    {
+        if(sLocal.count(it->second))
+        {
+            it++;
+            continue;
+        }
+        mOptimizer.removeVertex(it->second);
+        mmMapPoints.erase(it++);
+    }
+
+    // Variables to relinearize, the whole window unless partial runs are enabled
+    VertexSet sFree;
+    const bool bFull = mnFullPeriod<=1 || mnLastFullRun==0 || mnRun-mnLastFullRun>=(unsigned long)mnFullPeriod;
+    if(bFull)
+    {
+        sFree = sLocal;
+        mnLastFullRun = mnRun;
+    }
+    else
+    {
+        for(VertexSet::iterator vit=sLocal.begin(), vend=sLocal.end(); vit!=vend; vit++)
+            if(sTouched.count(*vit) || sMoved.count(*vit))
+                sFree.insert(*vit);
+        // The residuals of all the neighbours of a moved vertex changed
+        Spread(sMoved,sLocal,sFree);
+    }
+
+    if(sFree.empty())
+        return;
+
+    mOptimizer.setForceStopFlag(pbStopFlag);
+
+    Activate(sFree);
+    Run(5);
+
+    // Check inlier observations
+    RejectOutliers();
+
+    // The neighbours of the variables that moved are relinearized in the second optimization
+    VertexSet sMovedByBA;
+    if(!bFull)
+        Moved(sFree,sMovedByBA);
+
+    // Recover optimized data
+    Recover(sFree);
+
+    // Optimize again without the outliers
+    Spread(sMovedByBA,sLocal,sFree);
+    Activate(sFree);
+    Run(10);
+
+    // Check inlier observations
+    RejectOutliers();
+
+    // Recover optimized data
+    Recover(sFree);
+}
+
+void LocalBundleAdjuster::Reset()
+{
+    mOptimizer.clear();
+    mmKeyFrames.clear();
+    mmMapPoints.clear();
+    mmObservations.clear();
+    mpMap = NULL;
+    mnRun = 0;
+    mnLastFullRun = 0;
+    mvpStructure.clear();
+    mbStructureValid = false;
+    UpdateMemoryBytes();
+}
+
+void LocalBundleAdjuster::SetFullPeriod(int nPeriod)
+{
+    mnFullPeriod = max(nPeriod,1);
+}
+
+void LocalBundleAdjuster::DiscardBad()
+{
+    for(ObservationMap::iterator oit=mmObservations.begin(); oit!=mmObservations.end(); )
+    {
+        if(oit->first.first->isBad() || oit->first.second->isBad())
+            RemoveObservation(oit++);
+        else
+            oit++;
+    }
+
+    for(map<KeyFrame*,g2o::VertexSE3Expmap*>::iterator it=mmKeyFrames.begin(); it!=mmKeyFrames.end(); )
+    {
+        if(!it->first->isBad())
+        {
+            it++;
+            continue;
+        }
+        mOptimizer.removeVertex(it->second);
+        mmKeyFrames.erase(it++);
+    }
+    for(map<MapPoint*,g2o::VertexSBAPointXYZ*>::iterator it=mmMapPoints.begin(); it!=mmMapPoints.end(); )
+    {
+        if(!it->first->isBad())
+        {
+            it++;
+            continue;
+        }
+        mOptimizer.removeVertex(it->second);
+        mmMapPoints.erase(it++);
+    }
+
+    UpdateMemoryBytes();
+}
+
+void LocalBundleAdjuster::UpdateMemoryBytes()
+{
+    // Vertices and edges with their entries in our maps and in the graph, where each edge is also
+    // listed by both its vertices. The solver workspace is not counted
+    const size_t nEntry = 5*sizeof(void*);
+    size_t nBytes = MemoryStats::TreeBytes(mmKeyFrames)+mmKeyFrames.size()*(sizeof(g2o::VertexSE3Expmap)+nEntry);
+    nBytes += MemoryStats::TreeBytes(mmMapPoints)+mmMapPoints.size()*(sizeof(g2o::VertexSBAPointXYZ)+nEntry);
+    nBytes += MemoryStats::TreeBytes(mmObservations)+mmObservations.size()*(sizeof(g2o::EdgeSE3ProjectXYZ)+3*nEntry);
+    mnMemoryBytes.store(nBytes,boost::memory_order_relaxed);
+}
+
+g2o::VertexSE3Expmap* LocalBundleAdjuster::SyncKeyFrame(KeyFrame *pKF, VertexSet &sTouched, VertexSet &sMoved)
+{
+    const g2o::SE3Quat Tcw = Converter::toSE3Quat(pKF->GetPose());
+
+    map<KeyFrame*,g2o::VertexSE3Expmap*>::iterator it = mmKeyFrames.find(pKF);
+    if(it==mmKeyFrames.end())
+    {
+        g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
+        vSE3->setEstimate(Tcw);
+        vSE3->setId(KeyFrameVertexId(pKF));
+        mOptimizer.addVertex(vSE3);
+        mmKeyFrames[pKF] = vSE3;
+        mbStructureValid = false;
+        sTouched.insert(vSE3);
+        return vSE3;
+    }
+
+    g2o::VertexSE3Expmap * vSE3 = it->second;
+    if(PoseDistance(Tcw,vSE3->estimate())>mRelinearizeThreshold)
+        sMoved.insert(vSE3);
+    vSE3->setEstimate(Tcw);
+    return vSE3;
+}
+
+g2o::VertexSBAPointXYZ* LocalBundleAdjuster::SyncMapPoint(MapPoint *pMP, VertexSet &sTouched, VertexSet &sMoved)
+{
+    const Eigen::Vector3d Pos = pMP->GetWorldPosEigen().cast<double>();
+
+    map<MapPoint*,g2o::VertexSBAPointXYZ*>::iterator it = mmMapPoints.find(pMP);
+    if(it==mmMapPoints.end())
+    {
+        g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
+        vPoint->setEstimate(Pos);
+        vPoint->setId(MapPointVertexId(pMP));
+        vPoint->setMarginalized(true);
+        mOptimizer.addVertex(vPoint);
+        mmMapPoints[pMP] = vPoint;
+        mbStructureValid = false;
+        sTouched.insert(vPoint);
+        return vPoint;
+    }
+
+    g2o::VertexSBAPointXYZ* vPoint = it->second;
+    if((Pos-vPoint->estimate()).norm()>mRelinearizeThreshold)
+        sMoved.insert(vPoint);
+    vPoint->setEstimate(Pos);
+    return vPoint;
+}
+
+g2o::EdgeSE3ProjectXYZ* LocalBundleAdjuster::AddObservation(MapPoint *pMP, KeyFrame *pKF, size_t idx)
+{
+    const float thHuber = sqrt(5.991);
+
+    Eigen::Matrix<double,2,1> obs;
+    const cv::Point2f kpUn = pKF->GetKeyPointPosUn(idx);
+    const int kpUnLevel = pKF->GetKeyPointScaleLevel(idx);
+    obs << kpUn.x, kpUn.y;
+
+    g2o::EdgeSE3ProjectXYZ* e = new g2o::EdgeSE3ProjectXYZ();
+
+    e->setVertex(0, mmMapPoints[pMP]);
+    e->setVertex(1, mmKeyFrames[pKF]);
+    e->setMeasurement(obs);
+    float invSigma2 = pKF->GetInvSigma2(kpUnLevel);
+    e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
+
+    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+    e->setRobustKernel(rk);
+    rk->setDelta(thHuber);
+
+    e->fx = pKF->fx;
+    e->fy = pKF->fy;
+    e->cx = pKF->cx;
+    e->cy = pKF->cy;
+
+    mOptimizer.addEdge(e);
+    mbStructureValid = false;
+    return e;
+}
+
+void LocalBundleAdjuster::RemoveObservation(ObservationMap::iterator it)
+{
+    mOptimizer.removeEdge(it->second.pEdge);
+    mmObservations.erase(it);
+}
+
+bool LocalBundleAdjuster::Spread(const VertexSet &sFrom, const VertexSet &sLocal, VertexSet &sFree)
+{
+    bool bAdded = false;
+    for(VertexSet::const_iterator vit=sFrom.begin(), vend=sFrom.end(); vit!=vend; vit++)
+    {
+        const g2o::HyperGraph::EdgeSet &sEdges = (*vit)->edges();
+        for(g2o::HyperGraph::EdgeSet::const_iterator eit=sEdges.begin(), eend=sEdges.end(); eit!=eend; eit++)
+        {
+            g2o::HyperGraph::Vertex* pOther = (*eit)->vertex(0)==*vit ? (*eit)->vertex(1) : (*eit)->vertex(0);
+            g2o::OptimizableGraph::Vertex* vOther = static_cast<g2o::OptimizableGraph::Vertex*>(pOther);
+            if(sLocal.count(vOther) && sFree.insert(vOther).second)
+                bAdded = true;
+        }
+    }
+    return bAdded;
+}
+
+void LocalBundleAdjuster::Activate(const VertexSet &sFree)
+{
+    for(g2o::HyperGraph::VertexIDMap::iterator it=mOptimizer.vertices().begin(), iend=mOptimizer.vertices().end(); it!=iend; it++)
+    {
+        g2o::OptimizableGraph::Vertex* v = static_cast<g2o::OptimizableGraph::Vertex*>(it->second);
+        v->setFixed(!sFree.count(v));
+    }
+
+    g2o::HyperGraph::EdgeSet sActive;
+    for(VertexSet::const_iterator vit=sFree.begin(), vend=sFree.end(); vit!=vend; vit++)
+        sActive.insert((*vit)->edges().begin(),(*vit)->edges().end());
+
+    mOptimizer.initializeOptimization(sActive);
+}
+
+void LocalBundleAdjuster::Run(int nIterations)
+{
+    const g2o::SparseOptimizer::VertexContainer &vpIndexed = mOptimizer.indexMapping();
+    const bool bOnline = mbStructureValid && vpIndexed.size()==mvpStructure.size() &&
+                         equal(vpIndexed.begin(),vpIndexed.end(),mvpStructure.begin());
+
+    // The settings may have changed since the graph was created
+    Optimizer::Configure(mOptimizer,mpAlgorithm,TaskPool::LOCAL_MAPPING);
+    Optimizer::Report(mOptimizer,"Local BA",mOptimizer.optimize(nIterations,bOnline));
+
+    mvpStructure.assign(vpIndexed.begin(),vpIndexed.end());
+    mbStructureValid = true;
+}
+
+void LocalBundleAdjuster::RejectOutliers()
+{
+    // Only the edges of the free vertices were optimized, the others are left out of the screening
+    vector<g2o::EdgeSE3ProjectXYZ*> vpEdges;
+    vpEdges.reserve(mmObservations.size());
+    for(ObservationMap::iterator oit=mmObservations.begin(); oit!=mmObservations.end(); oit++)
+    {
+        g2o::EdgeSE3ProjectXYZ* e = oit->second.pEdge;
+        const bool bActive = !static_cast<g2o::OptimizableGraph::Vertex*>(e->vertex(0))->fixed() ||
+                             !static_cast<g2o::OptimizableGraph::Vertex*>(e->vertex(1))->fixed();
+        vpEdges.push_back(bActive ? e : NULL);
+    }
+
+    vector<unsigned char> vbOutlier;
+    Optimizer::ScreenEdges(vpEdges,vbOutlier,TaskPool::LOCAL_MAPPING);
+
+    vector<pair<KeyFrame*,MapPoint*> > vOutliers;
+    size_t i=0;
+    for(ObservationMap::iterator oit=mmObservations.begin(); oit!=mmObservations.end(); i++)
+    {
+        MapPoint* pMP = oit->first.first;
+        KeyFrame* pKFi = oit->first.second;
+
+        if(vbOutlier[i] && !pMP->isBad())
+        {
+            vOutliers.push_back(make_pair(pKFi,pMP));
+            RemoveObservation(oit++);
+        }
+        else
+        {
+            oit++;
+        }
+    }
+    Optimizer::EraseOutliers(vOutliers);
+}
+
+void LocalBundleAdjuster::Moved(const VertexSet &sFree, VertexSet &sMoved)
+{
+    for(map<KeyFrame*,g2o::VertexSE3Expmap*>::iterator it=mmKeyFrames.begin(), iend=mmKeyFrames.end(); it!=iend; it++)
+        if(sFree.count(it->second))
+            if(PoseDistance(it->second->estimate(),Converter::toSE3Quat(it->first->GetPose()))>mRelinearizeThreshold)
+                sMoved.insert(it->second);
+
+    for(map<MapPoint*,g2o::VertexSBAPointXYZ*>::iterator it=mmMapPoints.begin(), iend=mmMapPoints.end(); it!=iend; it++)
+        if(sFree.count(it->second))
+            if((it->second->estimate()-it->first->GetWorldPosEigen().cast<double>()).norm()>mRelinearizeThreshold)
+                sMoved.insert(it->second);
+}
+
+void LocalBundleAdjuster::Recover(const VertexSet &sFree)
+{
+    mpMap->BeginUpdate();
+
+    //Keyframes, all of the window observe the points
+    vector<KeyFrame*> vpKFs;
+    vpKFs.reserve(mmKeyFrames.size());
+    for(map<KeyFrame*,g2o::VertexSE3Expmap*>::iterator it=mmKeyFrames.begin(), iend=mmKeyFrames.end(); it!=iend; it++)
+    {
+        if(sFree.count(it->second))
+            it->first->SetPose(Converter::toCvMat(it->second->estimate()));
+        vpKFs.push_back(it->first);
+    }
+
+    //Points
+    vector<MapPoint*> vpMPs;
+    vector<Eigen::Vector3f> vPos;
+    for(map<MapPoint*,g2o::VertexSBAPointXYZ*>::iterator it=mmMapPoints.begin(), iend=mmMapPoints.end(); it!=iend; it++)
+    {
+        MapPoint* pMP = it->first;
+        if(!sFree.count(it->second) || pMP->isBad())
+            continue;
+        vpMPs.push_back(pMP);
+        vPos.push_back(it->second->estimate().cast<float>());
+    }
+    Optimizer::UpdateMapPoints(vpMPs,vPos,vpKFs,TaskPool::LOCAL_MAPPING);
+
+    mpMap->EndUpdate();
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,209 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/LockProfiler.h"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+static void AtomicMax(boost::atomic<unsigned long long> &value, unsigned long long x)
+{
+    unsigned long long current = value.load(boost::memory_order_relaxed);
+    while(x>current && !value.compare_exchange_weak(current,x,boost::memory_order_relaxed))
+        ;
+}
+
+void LockSite::Add(bool bContended, unsigned long long waitNs, unsigned long long holdNs)
+{
+    nAcquired.fetch_add(1,boost::memory_order_relaxed);
+    if(bContended)
+    {
+        nContended.fetch_add(1,boost::memory_order_relaxed);
+        nWaitNs.fetch_add(waitNs,boost::memory_order_relaxed);
+        AtomicMax(nMaxWaitNs,waitNs);
+    }
+    nHoldNs.fetch_add(holdNs,boost::memory_order_relaxed);
+    AtomicMax(nMaxHoldNs,holdNs);
+}
+
+LockProfiler::LockProfiler()
+{
+}
+
+LockProfiler::~LockProfiler()
+{
+    for(size_t i=0; i<mvpSites.size(); i++)
+        delete mvpSites[i];
+}
+
+LockProfiler* LockProfiler::Global()
+{
+    static LockProfiler profiler;
+    return &profiler;
+}
+
+bool LockProfiler::isEnabled()
+{
+#ifdef ORB_SLAM_LOCK_PROFILING
+    return true;
+#else
+    return false;
+#endif
+}
+
+LockSite* LockProfiler::Site(const char* file, int line, const char* function, const char* mutex)
+{
+    LockSite* pSite = new LockSite();
+    // Paths are kept from the package directories on
+    string path(file);
+    size_t pos = path.rfind("/src/");
+    if(pos==string::npos)
+        pos = path.rfind("/include/");
+    pSite->file = pos==string::npos ? path : path.substr(pos+1);
+    pSite->line = line;
+    pSite->function = function;
+    pSite->mutex = mutex;
+    pSite->nAcquired = 0;
+    pSite->nContended = 0;
+    pSite->nWaitNs = 0;
+    pSite->nMaxWaitNs = 0;
+    pSite->nHoldNs = 0;
+    pSite->nMaxHoldNs = 0;
+
+    boost::mutex::scoped_lock lock(mMutexSites);
+    mvpSites.push_back(pSite);
+    return pSite;
+}
+
+static bool LongerWait(const LockProfiler::Row &a, const LockProfiler::Row &b)
+{
+    return a.nWaitNs>b.nWaitNs;
+}
+
+void LockProfiler::GetRows(vector<Row> &vSites, vector<Row> &vMutexes)
+{
+    vSites.clear();
+    vMutexes.clear();
+    map<string,Row> mutexes;
+
+    boost::mutex::scoped_lock lock(mMutexSites);
+    for(size_t i=0; i<mvpSites.size(); i++)
+    {
+        const LockSite* pSite = mvpSites[i];
+        Row row;
+        stringstream ss;
+        ss << pSite->file << ":" << pSite->line << " " << pSite->function;
+        row.name = ss.str();
+        row.nAcquired = pSite->nAcquired;
+        row.nContended = pSite->nContended;
+        row.nWaitNs = pSite->nWaitNs;
+        row.nMaxWaitNs = pSite->nMaxWaitNs;
+        row.nHoldNs = pSite->nHoldNs;
+        row.nMaxHoldNs = pSite->nMaxHoldNs;
+        if(row.nAcquired==0)
+            continue;
+        vSites.push_back(row);
+
+        // Mutexes are told apart by the class of the file that locks them, pKF->mMutexPose and mMutexPose are the same one
+        string name = pSite->mutex;
+        size_t arrow = name.rfind("->");
+        if(arrow!=string::npos)
+            name = name.substr(arrow+2);
+        else
+        {
+            string file = pSite->file.substr(pSite->file.rfind('/')+1);
+            name = file.substr(0,file.find('.'))+"::"+name;
+        }
+
+        map<string,Row>::iterator mit = mutexes.find(name);
+        if(mit==mutexes.end())
+        {
+            row.name = name;
+            mutexes[name] = row;
+            continue;
+        }
+        Row &total = mit->second;
+        total.nAcquired += row.nAcquired;
+        total.nContended += row.nContended;
+        total.nWaitNs += row.nWaitNs;
+        total.nMaxWaitNs = max(total.nMaxWaitNs,row.nMaxWaitNs);
+        total.nHoldNs += row.nHoldNs;
+        total.nMaxHoldNs = max(total.nMaxHoldNs,row.nMaxHoldNs);
+    }
+
+    for(map<string,Row>::iterator mit=mutexes.begin(); mit!=mutexes.end(); mit++)
+        vMutexes.push_back(mit->second);
+
+    sort(vSites.begin(),vSites.end(),LongerWait);
+    sort(vMutexes.begin(),vMutexes.end(),LongerWait);
+}
+
+static void WriteRow(ofstream &f, const string &type, const LockProfiler::Row &row)
+{
+    f << type << ",\"" << row.name << "\"," << row.nAcquired << "," << row.nContended << ","
+      << row.nWaitNs/1000 << "," << row.nMaxWaitNs/1000 << ","
+      << row.nHoldNs/1000 << "," << row.nMaxHoldNs/1000 << endl;
+}
+
+bool LockProfiler::SaveCSV(const string &filename)
+{
+    vector<Row> vSites, vMutexes;
+    GetRows(vSites,vMutexes);
+
+    ofstream f(filename.c_str());
+    if(!f.is_open())
+        return false;
+
+    f << "type,name,acquired,contended,wait_us,max_wait_us,hold_us,max_hold_us" << endl;
+    for(size_t i=0; i<vSites.size(); i++)
+        WriteRow(f,"site",vSites[i]);
+    for(size_t i=0; i<vMutexes.size(); i++)
+        WriteRow(f,"mutex",vMutexes[i]);
+
+    return true;
+}
+
+string LockProfiler::Report(int nTop)
+{
+    vector<Row> vSites, vMutexes;
+    GetRows(vSites,vMutexes);
+
+    stringstream ss;
+    ss << "Lock contention, sites with the longest wait:";
+    for(int i=0; i<nTop && i<(int)vSites.size(); i++)
+    {
+        const Row &row = vSites[i];
+        if(row.nContended==0)
+            break;
+        ss << "\n  " << row.name << ": " << row.nContended << "/" << row.nAcquired << " contended, "
+           << row.nWaitNs/1000000.0 << " ms waited (max " << row.nMaxWaitNs/1000000.0 << " ms), "
+           << row.nHoldNs/1000000.0 << " ms held";
+    }
+    return ss.str();
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,136 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/LoopScheduler.h"
+#include "types/KeyFrame.h"
+#include "types/MapDatabase.h"
+
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+LoopScheduler::LoopScheduler(MapDatabase *pMapDB):
+    mpMapDB(pMapDB), mfMaxLatency(0), mfMaxDuty(0), mpPendingKF(NULL), mfPendingScore(0),
+    mbLastQueried(false), mfLastDepth(0), mbQuerying(false), mfQueryTime(0)
+{
+}
+
+void LoopScheduler::SetLimits(float fMaxLatency, float fMaxDuty)
+{
+    mfMaxLatency = std::max(fMaxLatency,0.f);
+    mfMaxDuty = (fMaxDuty>0 && fMaxDuty<1) ? fMaxDuty : 0;
+}
+
+bool LoopScheduler::isEnabled() const
+{
+    return mfMaxLatency>0;
+}
+
+float LoopScheduler::Distinctiveness(KeyFrame *pKF)
+{
+    if(!mbLastQueried)
+        return 0;
+
+    // Similar images are unlikely to find another loop than the last one
+    DBoW2::FlatBowVector vBow;
+    pKF->GetFlatBowVector(vBow);
+    float score = 1.f-mpMapDB->getVocab()->score(vBow,mLastBowVec);
+
+    // Baselines of the order of the scene depth see other places
+    if(mfLastDepth>0)
+        score += std::min(1.f,(float)cv::norm(pKF->GetCameraCenter()-mLastCenter)/mfLastDepth);
+    return score;
+}
+
+bool LoopScheduler::isPending() const
+{
+    return mpPendingKF!=NULL;
+}
+
+KeyFrame* LoopScheduler::Add(KeyFrame *pKF)
+{
+    if(!mpPendingKF)
+    {
+        pKF->SetNotErase();
+        mpPendingKF = pKF;
+        mPendingSince = ros::WallTime::now();
+        mfPendingScore = Distinctiveness(pKF);
+        return NULL;
+    }
+
+    // The new keyframe waits in its place, so the decision of the old one is not later than the bound
+    const float score = Distinctiveness(pKF);
+    if(score<=mfPendingScore && !mpPendingKF->isBad())
+        return pKF;
+
+    KeyFrame* pSkipped = mpPendingKF;
+    pKF->SetNotErase();
+    mpPendingKF = pKF;
+    mPendingSince = ros::WallTime::now();
+    mfPendingScore = score;
+    return pSkipped;
+}
+
+KeyFrame* LoopScheduler::Next()
+{
+    if(!mpPendingKF)
+        return NULL;
+
+    const ros::WallTime now = ros::WallTime::now();
+    if(mfMaxDuty>0 && (now-mPendingSince).toSec()<mfMaxLatency)
+    {
+        // Idle for (1-duty)/duty times the query time since the last one
+        const double interval = mfQueryTime*(1.0-mfMaxDuty)/mfMaxDuty;
+        if((now-mQueryEnd).toSec()<interval)
+            return NULL;
+    }
+
+    KeyFrame* pKF = mpPendingKF;
+    mpPendingKF = NULL;
+    mQueryStart = now;
+    mbQuerying = true;
+
+    mbLastQueried = true;
+    pKF->GetFlatBowVector(mLastBowVec);
+    mLastCenter = pKF->GetCameraCenter();
+    mfLastDepth = pKF->ComputeSceneMedianDepth();
+    return pKF;
+}
+
+void LoopScheduler::Done()
+{
+    if(!mbQuerying)
+        return;
+    mbQuerying = false;
+    mQueryEnd = ros::WallTime::now();
+    const double t = (mQueryEnd-mQueryStart).toSec();
+    mfQueryTime = mfQueryTime>0 ? 0.8*mfQueryTime+0.2*t : t;
+}
+
+KeyFrame* LoopScheduler::Clear()
+{
+    KeyFrame* pKF = mpPendingKF;
+    mpPendingKF = NULL;
+    mbLastQueried = false;
+    return pKF;
+}
+
+} //namespace ORB_SLAM
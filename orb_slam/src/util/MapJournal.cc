@@ -0,0 +1,811 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/MapJournal.h"
+#include "util/MapSerializer.h"
+#include "util/BinaryIO.h"
+#include "util/MappedFile.h"
+#include "util/EpochReclaimer.h"
+
+#include "types/MapDatabase.h"
+#include "types/Map.h"
+#include "types/KeyFrame.h"
+#include "types/MapPoint.h"
+#include "types/Frame.h"
+
+#include <ros/ros.h>
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace ORB_SLAM
+{
+
+// Logs start with this tag, the format version of the keyframes and points, and the map file they follow
+static const uint32_t JOURNAL_TAG = 0x4f524a4c;
+
+const uint8_t MapJournal::POINT_KNOWN = 0;
+const uint8_t MapJournal::POINT_NEW = 1;
+
+// Objects of the maps by id while a log is replayed, maps by their id in the logged run
+struct MapJournal::Replay
+{
+    std::map<unsigned long,KeyFrame*> keyFrames;
+    std::map<unsigned long,MapPoint*> mapPoints;
+    std::map<uint64_t,Map*> maps;
+    std::set<KeyFrame*> touchedKeyFrames;
+    std::set<MapPoint*> touchedPoints;
+    std::vector<KeyFrame*> vpNewKeyFrames;
+    Map* pLastMap;
+
+    Replay(): pLastMap(NULL) {}
+};
+
+// Keyframe ids are increasing with their creation, parents are updated before their children
+static bool CompareKeyFrameIds(KeyFrame* pKF1, KeyFrame* pKF2)
+{
+    return pKF1->mnId<pKF2->mnId;
+}
+
+// Writes all of it, retrying the partial writes
+static bool WriteAll(int fd, const char* pData, size_t nSize)
+{
+    while(nSize>0)
+    {
+        const ssize_t n = ::write(fd,pData,nSize);
+        if(n<0)
+        {
+            if(errno==EINTR)
+                continue;
+            return false;
+        }
+        pData += n;
+        nSize -= n;
+    }
+    return true;
+}
+
+static std::string MakeRecord(uint8_t type, const std::string &payload)
+{
+    std::ostringstream f(std::ios::binary);
+    BinaryIO::WritePod(f,type);
+    BinaryIO::WritePod(f,static_cast<uint32_t>(payload.size()));
+    f.write(payload.data(),payload.size());
+    return f.str();
+}
+
+MapJournal::MapJournal():
+    mpMapDB(NULL), mFd(-1), mfSyncPeriod(1), mfCompactPeriod(300), mbOpen(false), mbClosing(false),
+    mbCompactRequested(false), mnReplayed(0), mpWriter(NULL)
+{
+}
+
+MapJournal::~MapJournal()
+{
+    Close();
+}
+
+MapJournal* MapJournal::Global()
+{
+    static MapJournal journal;
+    return &journal;
+}
+
+bool MapJournal::Open(MapDatabase* pMapDB, const std::string &strMapFile, float fSyncPeriod, float fCompactPeriod)
+{
+    Close();
+
+    mpMapDB = pMapDB;
+    mstrMapFile = strMapFile;
+    mstrFilename = strMapFile+".journal";
+    mfSyncPeriod = fSyncPeriod>0 ? fSyncPeriod : 1;
+    mfCompactPeriod = fCompactPeriod;
+
+    // The replayed records are only safe once they are in the map file
+    mnReplayed = ReplayLog();
+    if(mnReplayed>0)
+    {
+        ROS_INFO("ORB-SLAM - Replayed %lu records of the map journal", mnReplayed);
+        if(!MapSerializer::Save(mpMapDB,mstrMapFile))
+        {
+            ROS_WARN("ORB-SLAM - Unable to save the replayed maps, the map journal is kept and not continued");
+            return false;
+        }
+    }
+
+    if(!StartLog())
+        return false;
+
+    mbClosing = false;
+    mbCompactRequested = false;
+    mbOpen = true;
+    mpWriter = new boost::thread(&MapJournal::RunWriter,this);
+    return true;
+}
+
+void MapJournal::Close()
+{
+    if(mpWriter==NULL)
+        return;
+
+    mbOpen = false;
+    {
+        boost::mutex::scoped_lock lock(mMutexQueue);
+        mbClosing = true;
+    }
+    mcvClose.notify_all();
+    mpWriter->join();
+    delete mpWriter;
+    mpWriter = NULL;
+
+    ::close(mFd);
+    mFd = -1;
+}
+
+bool MapJournal::isOpen() const
+{
+    return mbOpen;
+}
+
+unsigned long MapJournal::Replayed() const
+{
+    return mnReplayed;
+}
+
+void MapJournal::KeyFrameMapped(KeyFrame* pKF)
+{
+    if(!mbOpen || pKF->isBad())
+        return;
+
+    std::vector<KeyFrame*> vpWindow = pKF->GetVectorCovisibleKeyFrames();
+    vpWindow.push_back(pKF);
+    std::vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+    std::vector<MapPoint*> vpPoints;
+    vpPoints.reserve(vpMPs.size());
+
+    // Whether a point is logged and the record holding it are decided together, a new log starts without the points
+    boost::mutex::scoped_lock lock(mMutexQueue);
+    std::ostringstream f(std::ios::binary);
+    BinaryIO::WritePod(f,static_cast<uint64_t>(pKF->getMap()->mnId));
+    MapSerializer::WriteKeyFrame(f,pKF,false);
+
+    uint32_t nMatches = 0;
+    for(size_t i=0; i<vpMPs.size(); i++)
+        if(vpMPs[i] && !vpMPs[i]->isBad())
+            nMatches++;
+    BinaryIO::WritePod(f,nMatches);
+    // Each match as the step from the previous keypoint index, then the point id, as the map link sends them
+    size_t nPrev = 0;
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        if(!pMP || pMP->isBad())
+            continue;
+        BinaryIO::WriteVarint(f,i-nPrev);
+        nPrev = i;
+        vpPoints.push_back(pMP);
+        if(msLoggedPoints.insert(pMP->mnId).second)
+        {
+            BinaryIO::WritePod(f,POINT_NEW);
+            BinaryIO::WriteVarint(f,pMP->mnId);
+            MapSerializer::WriteMapPoint(f,pMP);
+        }
+        else
+        {
+            BinaryIO::WritePod(f,POINT_KNOWN);
+            BinaryIO::WriteVarint(f,pMP->mnId);
+        }
+    }
+
+    // The window of the local BA
+    WritePoses(f,vpWindow,vpPoints);
+
+    mvPending.push_back(MakeRecord(RECORD_KEYFRAME,f.str()));
+}
+
+void MapJournal::MapAdjusted(Map* pMap)
+{
+    if(!mbOpen)
+        return;
+
+    std::vector<KeyFrame*> vpKFs;
+    Map::KeyFrameSnapshot keyFrames = pMap->GetKeyFrameSnapshot();
+    for(Map::KeyFrameSnapshot::const_iterator sit=keyFrames.begin(), send=keyFrames.end(); sit!=send; sit++)
+        if(!(*sit)->isBad())
+            vpKFs.push_back(*sit);
+    std::vector<MapPoint*> vpMPs;
+    Map::MapPointSnapshot mapPoints = pMap->GetMapPointSnapshot();
+    for(Map::MapPointSnapshot::const_iterator sit=mapPoints.begin(), send=mapPoints.end(); sit!=send; sit++)
+        if(!(*sit)->isBad())
+            vpMPs.push_back(*sit);
+
+    std::ostringstream f(std::ios::binary);
+    BinaryIO::WritePod(f,static_cast<uint64_t>(pMap->mnId));
+    WritePoses(f,vpKFs,vpMPs);
+    Queue(RECORD_POSES,f.str());
+}
+
+void MapJournal::MapsMerged(Map* pSource, Map* pTarget)
+{
+    if(!mbOpen)
+        return;
+
+    std::ostringstream f(std::ios::binary);
+    BinaryIO::WritePod(f,static_cast<uint64_t>(pSource->mnId));
+    BinaryIO::WritePod(f,static_cast<uint64_t>(pTarget->mnId));
+    Queue(RECORD_MERGED,f.str());
+
+    // The fused points are only in the map file
+    MapAdjusted(pTarget);
+    boost::mutex::scoped_lock lock(mMutexQueue);
+    mbCompactRequested = true;
+}
+
+void MapJournal::KeyFrameErased(KeyFrame* pKF)
+{
+    if(!mbOpen)
+        return;
+    boost::mutex::scoped_lock lock(mMutexQueue);
+    mvErasedKeyFrames.push_back(pKF->mnId);
+}
+
+void MapJournal::MapPointErased(MapPoint* pMP)
+{
+    if(!mbOpen)
+        return;
+    boost::mutex::scoped_lock lock(mMutexQueue);
+    mvErasedMapPoints.push_back(pMP->mnId);
+}
+
+void MapJournal::MapPointsErased(const std::vector<MapPoint*> &vpMPs)
+{
+    if(!mbOpen || vpMPs.empty())
+        return;
+    boost::mutex::scoped_lock lock(mMutexQueue);
+    for(size_t i=0; i<vpMPs.size(); i++)
+        mvErasedMapPoints.push_back(vpMPs[i]->mnId);
+}
+
+void MapJournal::MapErased(Map* pMap)
+{
+    if(!mbOpen)
+        return;
+    std::ostringstream f(std::ios::binary);
+    BinaryIO::WritePod(f,static_cast<uint64_t>(pMap->mnId));
+    Queue(RECORD_MAP_ERASED,f.str());
+}
+
+void MapJournal::Queue(uint8_t type, const std::string &payload)
+{
+    const std::string record = MakeRecord(type,payload);
+    boost::mutex::scoped_lock lock(mMutexQueue);
+    mvPending.push_back(record);
+}
+
+void MapJournal::WritePoses(std::ostream &f, const std::vector<KeyFrame*> &vpKFs, const std::vector<MapPoint*> &vpMPs)
+{
+    BinaryIO::WritePod(f,static_cast<uint32_t>(vpKFs.size()));
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        PoseSnapshot pose;
+        vpKFs[i]->GetPoseSnapshot(pose);
+        BinaryIO::WriteVarint(f,vpKFs[i]->mnId);
+        f.write(reinterpret_cast<const char*>(pose.R),sizeof(pose.R));
+        f.write(reinterpret_cast<const char*>(pose.t),sizeof(pose.t));
+    }
+    BinaryIO::WritePod(f,static_cast<uint32_t>(vpMPs.size()));
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        const Eigen::Vector3f Pos = vpMPs[i]->GetWorldPosEigen();
+        BinaryIO::WriteVarint(f,vpMPs[i]->mnId);
+        for(int j=0; j<3; j++)
+            BinaryIO::WritePod(f,Pos(j));
+    }
+}
+
+void MapJournal::MapFileStamp(const std::string &filename, uint64_t &nSize, int64_t &nTime)
+{
+    boost::system::error_code ec;
+    nSize = boost::filesystem::file_size(filename,ec);
+    if(ec)
+    {
+        nSize = 0;
+        nTime = 0;
+        return;
+    }
+    nTime = boost::filesystem::last_write_time(filename,ec);
+    if(ec)
+        nTime = 0;
+}
+
+unsigned long MapJournal::ReplayLog()
+{
+    std::ifstream file(mstrFilename.c_str(), std::ios::binary);
+    if(!file.is_open())
+        return 0;
+    std::vector<char> vBuffer((std::istreambuf_iterator<char>(file)),std::istreambuf_iterator<char>());
+    MemoryStreamBuf buf(vBuffer.empty() ? NULL : &vBuffer[0],vBuffer.size());
+    std::istream f(&buf);
+
+    uint32_t nTag, nVersion, nWords;
+    uint64_t nSize, nLogSize;
+    int64_t nTime, nLogTime;
+    if(!BinaryIO::ReadPod(f,nTag) || !BinaryIO::ReadPod(f,nVersion) || !BinaryIO::ReadPod(f,nWords) ||
+       !BinaryIO::ReadPod(f,nLogSize) || !BinaryIO::ReadPod(f,nLogTime))
+        return 0;
+    MapFileStamp(mstrMapFile,nSize,nTime);
+    if(nTag!=JOURNAL_TAG || nVersion!=MapSerializer::FORMAT_VERSION || nWords!=mpMapDB->getVocab()->size())
+    {
+        ROS_WARN("ORB-SLAM - The map journal was written with another format or vocabulary, it is ignored");
+        return 0;
+    }
+    // The map file was saved after the log, it holds the records already
+    if(nLogSize!=nSize || nLogTime!=nTime)
+        return 0;
+
+    // Ids are unique over all the maps
+    Replay replay;
+    MapDatabase::MapList pMaps = mpMapDB->getMaps();
+    for(size_t i=0; i<pMaps->size(); i++)
+    {
+        Map::KeyFrameSnapshot keyFrames = pMaps->at(i)->GetKeyFrameSnapshot();
+        for(Map::KeyFrameSnapshot::const_iterator sit=keyFrames.begin(), send=keyFrames.end(); sit!=send; sit++)
+            replay.keyFrames[(*sit)->mnId] = *sit;
+        Map::MapPointSnapshot mapPoints = pMaps->at(i)->GetMapPointSnapshot();
+        for(Map::MapPointSnapshot::const_iterator sit=mapPoints.begin(), send=mapPoints.end(); sit!=send; sit++)
+            replay.mapPoints[(*sit)->mnId] = *sit;
+    }
+
+    // The tail of the log is torn if the run stopped while it was written
+    unsigned long nReplayed = 0;
+    size_t nPos = static_cast<size_t>(f.tellg());
+    while(nPos+sizeof(uint8_t)+sizeof(uint32_t)<=vBuffer.size())
+    {
+        uint8_t type;
+        uint32_t nRecordSize;
+        std::memcpy(&type,&vBuffer[nPos],sizeof(type));
+        std::memcpy(&nRecordSize,&vBuffer[nPos+sizeof(type)],sizeof(nRecordSize));
+        nPos += sizeof(type)+sizeof(nRecordSize);
+        if(nPos+nRecordSize>vBuffer.size())
+            break;
+        if(!ReplayRecord(replay,type,&vBuffer[0]+nPos,nRecordSize))
+        {
+            ROS_WARN("ORB-SLAM - Malformed record in the map journal, the rest of it is ignored");
+            break;
+        }
+        nPos += nRecordSize;
+        nReplayed++;
+    }
+
+    // Covisibility and spanning tree from the replayed matches
+    std::vector<KeyFrame*> vpTouched(replay.touchedKeyFrames.begin(),replay.touchedKeyFrames.end());
+    std::sort(vpTouched.begin(),vpTouched.end(),CompareKeyFrameIds);
+    std::set<Map*> sTouchedMaps;
+    for(size_t i=0; i<vpTouched.size(); i++)
+    {
+        if(vpTouched[i]->isBad())
+            continue;
+        vpTouched[i]->UpdateConnections();
+        sTouchedMaps.insert(vpTouched[i]->getMap());
+    }
+    for(size_t i=0; i<replay.vpNewKeyFrames.size(); i++)
+        if(!replay.vpNewKeyFrames[i]->isBad())
+            replay.vpNewKeyFrames[i]->getMap()->GetKeyFrameDatabase()->add(replay.vpNewKeyFrames[i]);
+    for(std::set<MapPoint*>::iterator sit=replay.touchedPoints.begin(), send=replay.touchedPoints.end(); sit!=send; sit++)
+        if(!(*sit)->isBad())
+            (*sit)->UpdateNormalAndDepth();
+    for(std::set<Map*>::iterator sit=sTouchedMaps.begin(), send=sTouchedMaps.end(); sit!=send; sit++)
+        (*sit)->GetEssentialGraph()->Invalidate();
+
+    // New objects get ids after the replayed ones
+    for(std::map<unsigned long,KeyFrame*>::iterator mit=replay.keyFrames.begin(), mend=replay.keyFrames.end(); mit!=mend; mit++)
+    {
+        KeyFrame::nNextId = std::max(KeyFrame::nNextId,mit->first+1);
+        Frame::nNextId = std::max(Frame::nNextId,mit->second->mnFrameId+1);
+    }
+    for(std::map<unsigned long,MapPoint*>::iterator mit=replay.mapPoints.begin(), mend=replay.mapPoints.end(); mit!=mend; mit++)
+        MapPoint::nNextId = std::max(MapPoint::nNextId.load(),mit->first+1);
+
+    if(replay.pLastMap && !replay.pLastMap->getErased())
+        mpMapDB->setMap(replay.pLastMap);
+
+    return nReplayed;
+}
+
+bool MapJournal::ReplayRecord(Replay &replay, uint8_t type, const char* pData, size_t nSize)
+{
+    MemoryStreamBuf buf(pData,nSize);
+    std::istream f(&buf);
+
+    if(type==RECORD_MAPS)
+    {
+        // Each map of the logged run by one of its keyframes
+        uint32_t nMaps;
+        bool bOK = BinaryIO::ReadPod(f,nMaps);
+        for(uint32_t i=0; bOK && i<nMaps; i++)
+        {
+            uint64_t nMapId, nKFid;
+            bOK = BinaryIO::ReadPod(f,nMapId) && BinaryIO::ReadPod(f,nKFid);
+            std::map<unsigned long,KeyFrame*>::iterator kit = replay.keyFrames.find(nKFid);
+            if(bOK && kit!=replay.keyFrames.end())
+                replay.maps[nMapId] = kit->second->getMap();
+        }
+        return bOK;
+    }
+    else if(type==RECORD_KEYFRAME)
+    {
+        uint64_t nMapId;
+        if(!BinaryIO::ReadPod(f,nMapId))
+            return false;
+        // Maps created after the log started
+        Map* &pMap = replay.maps[nMapId];
+        if(!pMap)
+        {
+            pMap = mpMapDB->getNewMap();
+            mpMapDB->addMap(pMap);
+        }
+        KeyFrame* pKF = MapSerializer::ReadKeyFrame(f,pMap,mpMapDB,MapSerializer::FORMAT_VERSION,NULL);
+        if(!pKF)
+            return false;
+        // Already in the map file
+        if(replay.keyFrames.count(pKF->mnId))
+        {
+            delete pKF;
+            return true;
+        }
+        pMap->AddKeyFrame(pKF);
+        replay.keyFrames[pKF->mnId] = pKF;
+        replay.touchedKeyFrames.insert(pKF);
+        replay.vpNewKeyFrames.push_back(pKF);
+        replay.pLastMap = pMap;
+
+        const size_t N = pKF->GetMapPointMatches().size();
+        uint32_t nMatches;
+        bool bOK = BinaryIO::ReadPod(f,nMatches);
+        uint64_t idx = 0;
+        for(uint32_t i=0; bOK && i<nMatches; i++)
+        {
+            uint64_t nStep, nId;
+            uint8_t pointType;
+            bOK = BinaryIO::ReadVarint(f,nStep) && BinaryIO::ReadPod(f,pointType) && BinaryIO::ReadVarint(f,nId);
+            if(!bOK)
+                break;
+            idx += nStep;
+
+            std::map<unsigned long,MapPoint*>::iterator mit = replay.mapPoints.find(nId);
+            MapPoint* pMP = mit!=replay.mapPoints.end() ? mit->second : NULL;
+            if(pointType==POINT_NEW)
+            {
+                MapPoint* pNew = NULL;
+                bOK = MapSerializer::ReadMapPoint(f,pMap,replay.keyFrames,pNew,MapSerializer::FORMAT_VERSION,NULL);
+                if(pNew && pMP)
+                    delete pNew;
+                else if(pNew)
+                {
+                    // The observations of the point were read on its side only
+                    pMap->AddMapPoint(pNew);
+                    replay.mapPoints[pNew->mnId] = pNew;
+                    replay.touchedPoints.insert(pNew);
+                    MapPoint::ObservationList observations = pNew->GetObservations();
+                    for(MapPoint::ObservationList::iterator oit=observations.begin(), oend=observations.end(); oit!=oend; oit++)
+                    {
+                        if(!oit->first->GetMapPoint(oit->second))
+                            oit->first->AddMapPoint(pNew,oit->second);
+                        replay.touchedKeyFrames.insert(oit->first);
+                    }
+                    continue;
+                }
+            }
+
+            if(pMP && !pMP->isBad() && idx<N)
+            {
+                pKF->AddMapPoint(pMP,idx);
+                pMP->AddObservation(pKF,idx);
+                replay.touchedPoints.insert(pMP);
+            }
+        }
+        return bOK && ReplayPoses(replay,f);
+    }
+    else if(type==RECORD_POSES)
+    {
+        uint64_t nMapId;
+        return BinaryIO::ReadPod(f,nMapId) && ReplayPoses(replay,f);
+    }
+    else if(type==RECORD_ERASED)
+    {
+        uint32_t nKFs, nMPs;
+        bool bOK = BinaryIO::ReadPod(f,nKFs);
+        for(uint32_t i=0; bOK && i<nKFs; i++)
+        {
+            uint64_t nId;
+            bOK = BinaryIO::ReadVarint(f,nId);
+            std::map<unsigned long,KeyFrame*>::iterator kit = replay.keyFrames.find(nId);
+            if(bOK && kit!=replay.keyFrames.end() && !kit->second->isBad())
+                kit->second->SetBadFlag();
+        }
+        bOK = bOK && BinaryIO::ReadPod(f,nMPs);
+        for(uint32_t i=0; bOK && i<nMPs; i++)
+        {
+            uint64_t nId;
+            bOK = BinaryIO::ReadVarint(f,nId);
+            std::map<unsigned long,MapPoint*>::iterator mit = replay.mapPoints.find(nId);
+            if(bOK && mit!=replay.mapPoints.end() && !mit->second->isBad())
+                mit->second->SetBadFlag();
+        }
+        return bOK;
+    }
+    else if(type==RECORD_MAP_ERASED)
+    {
+        uint64_t nMapId;
+        if(!BinaryIO::ReadPod(f,nMapId))
+            return false;
+        std::map<uint64_t,Map*>::iterator mit = replay.maps.find(nMapId);
+        if(mit!=replay.maps.end())
+            mit->second->setErased(true);
+        return true;
+    }
+    else if(type==RECORD_MERGED)
+    {
+        uint64_t nSourceId, nTargetId;
+        if(!BinaryIO::ReadPod(f,nSourceId) || !BinaryIO::ReadPod(f,nTargetId))
+            return false;
+        std::map<uint64_t,Map*>::iterator sit = replay.maps.find(nSourceId);
+        std::map<uint64_t,Map*>::iterator tit = replay.maps.find(nTargetId);
+        if(sit==replay.maps.end() || tit==replay.maps.end() || sit->second==tit->second)
+            return true;
+        Map* pSource = sit->second;
+        Map* pTarget = tit->second;
+
+        // The poses of the merged map follow in their own record
+        Map::KeyFrameSnapshot keyFrames = pSource->GetKeyFrameSnapshot();
+        for(Map::KeyFrameSnapshot::const_iterator kit=keyFrames.begin(), kend=keyFrames.end(); kit!=kend; kit++)
+        {
+            KeyFrame* pKFi = *kit;
+            pSource->DetachKeyFrame(pKFi);
+            pKFi->setMap(pTarget);
+            pTarget->AddKeyFrame(pKFi);
+            if(!pKFi->isBad())
+            {
+                pTarget->GetKeyFrameDatabase()->add(pKFi);
+                replay.touchedKeyFrames.insert(pKFi);
+            }
+        }
+        Map::MapPointSnapshot mapPoints = pSource->GetMapPointSnapshot();
+        for(Map::MapPointSnapshot::const_iterator mit=mapPoints.begin(), mend=mapPoints.end(); mit!=mend; mit++)
+        {
+            MapPoint* pMPi = *mit;
+            pSource->DetachMapPoint(pMPi);
+            pMPi->setMap(pTarget);
+            pTarget->AddMapPoint(pMPi);
+        }
+        pSource->setErased(true);
+        sit->second = pTarget;
+        replay.pLastMap = pTarget;
+        return true;
+    }
+
+    // Records of a later format
+    return true;
+}
+
+bool MapJournal::ReplayPoses(Replay &replay, std::istream &f)
+{
+    typedef Eigen::Map<const Eigen::Matrix<float,3,3,Eigen::RowMajor> > MapMatrix3f;
+
+    uint32_t nKFs, nMPs;
+    bool bOK = BinaryIO::ReadPod(f,nKFs);
+    for(uint32_t i=0; bOK && i<nKFs; i++)
+    {
+        uint64_t nId;
+        float R[9], t[3];
+        bOK = BinaryIO::ReadVarint(f,nId) && BinaryIO::ReadPod(f,R) && BinaryIO::ReadPod(f,t);
+        std::map<unsigned long,KeyFrame*>::iterator kit = replay.keyFrames.find(nId);
+        if(bOK && kit!=replay.keyFrames.end() && !kit->second->isBad())
+        {
+            kit->second->SetPose(Eigen::Matrix3f(MapMatrix3f(R)),Eigen::Vector3f(t[0],t[1],t[2]));
+            replay.touchedKeyFrames.insert(kit->second);
+        }
+    }
+    bOK = bOK && BinaryIO::ReadPod(f,nMPs);
+    for(uint32_t i=0; bOK && i<nMPs; i++)
+    {
+        uint64_t nId;
+        float pos[3];
+        bOK = BinaryIO::ReadVarint(f,nId) && BinaryIO::ReadPod(f,pos);
+        std::map<unsigned long,MapPoint*>::iterator mit = replay.mapPoints.find(nId);
+        if(bOK && mit!=replay.mapPoints.end() && !mit->second->isBad())
+        {
+            mit->second->SetWorldPos(Eigen::Vector3f(pos[0],pos[1],pos[2]));
+            replay.touchedPoints.insert(mit->second);
+        }
+    }
+    return bOK;
+}
+
+bool MapJournal::StartLog()
+{
+    uint64_t nSize;
+    int64_t nTime;
+    MapFileStamp(mstrMapFile,nSize,nTime);
+
+    std::ostringstream header(std::ios::binary);
+    BinaryIO::WritePod(header,JOURNAL_TAG);
+    BinaryIO::WritePod(header,MapSerializer::FORMAT_VERSION);
+    BinaryIO::WritePod(header,static_cast<uint32_t>(mpMapDB->getVocab()->size()));
+    BinaryIO::WritePod(header,nSize);
+    BinaryIO::WritePod(header,nTime);
+
+    // The maps are known by one of their keyframes, their ids change from run to run
+    std::ostringstream maps(std::ios::binary);
+    std::vector<std::pair<uint64_t,uint64_t> > vMaps;
+    MapDatabase::MapList pMaps = mpMapDB->getMaps();
+    for(size_t i=0; i<pMaps->size(); i++)
+    {
+        Map* pMap = pMaps->at(i);
+        if(pMap->getErased())
+            continue;
+        Map::KeyFrameSnapshot keyFrames = pMap->GetKeyFrameSnapshot();
+        for(Map::KeyFrameSnapshot::const_iterator sit=keyFrames.begin(), send=keyFrames.end(); sit!=send; sit++)
+        {
+            if(!(*sit)->isBad())
+            {
+                vMaps.push_back(std::make_pair(static_cast<uint64_t>(pMap->mnId),static_cast<uint64_t>((*sit)->mnId)));
+                break;
+            }
+        }
+    }
+    BinaryIO::WritePod(maps,static_cast<uint32_t>(vMaps.size()));
+    for(size_t i=0; i<vMaps.size(); i++)
+    {
+        BinaryIO::WritePod(maps,vMaps[i].first);
+        BinaryIO::WritePod(maps,vMaps[i].second);
+    }
+    const std::string data = header.str()+MakeRecord(RECORD_MAPS,maps.str());
+
+    // The previous log is only replaced once the new one is on disk
+    const std::string tmpname = mstrFilename+".tmp";
+    int fd = ::open(tmpname.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if(fd<0)
+    {
+        ROS_WARN("ORB-SLAM - Unable to create the map journal %s", mstrFilename.c_str());
+        return false;
+    }
+    bool bOK = WriteAll(fd,data.data(),data.size()) && ::fdatasync(fd)==0;
+    ::close(fd);
+    if(!bOK || std::rename(tmpname.c_str(),mstrFilename.c_str())!=0)
+    {
+        std::remove(tmpname.c_str());
+        ROS_WARN("ORB-SLAM - Unable to write the map journal %s", mstrFilename.c_str());
+        return false;
+    }
+
+    fd = ::open(mstrFilename.c_str(),O_WRONLY|O_APPEND);
+    if(fd<0)
+        return false;
+
+    // The points logged before are in the map file, the queued records go to the new log
+    {
+        boost::mutex::scoped_lock lock(mMutexQueue);
+        msLoggedPoints.clear();
+    }
+    if(mFd>=0)
+        ::close(mFd);
+    mFd = fd;
+    return true;
+}
+
+bool MapJournal::Compact()
+{
+    ros::WallTime tStart = ros::WallTime::now();
+    if(!MapSerializer::Save(mpMapDB,mstrMapFile))
+    {
+        ROS_WARN("ORB-SLAM - Unable to save the maps to %s, the map journal keeps growing", mstrMapFile.c_str());
+        return false;
+    }
+    if(!StartLog())
+        return false;
+    ROS_INFO("ORB-SLAM - Maps saved and map journal compacted in %.2f s", (ros::WallTime::now()-tStart).toSec());
+    return true;
+}
+
+void MapJournal::RunWriter()
+{
+    // The map file is saved from the maps in place
+    const int nReclaimerId = EpochReclaimer::Global()->Register();
+
+    ros::WallTime tCompact = ros::WallTime::now();
+    const boost::posix_time::time_duration period = boost::posix_time::milliseconds((long)(mfSyncPeriod*1000));
+    while(true)
+    {
+        bool bClosing, bCompact;
+        {
+            boost::mutex::scoped_lock lock(mMutexQueue);
+            if(!mbClosing)
+                mcvClose.timed_wait(lock,period);
+            bClosing = mbClosing;
+            bCompact = mbCompactRequested;
+            mbCompactRequested = false;
+        }
+
+        if(!Flush())
+            ROS_WARN("ORB-SLAM - Unable to append to the map journal %s", mstrFilename.c_str());
+
+        if(bClosing)
+            break;
+
+        if(bCompact || (mfCompactPeriod>0 && (ros::WallTime::now()-tCompact).toSec()>=mfCompactPeriod))
+        {
+            Compact();
+            tCompact = ros::WallTime::now();
+        }
+
+        EpochReclaimer::Global()->Quiescent(nReclaimerId);
+    }
+
+    EpochReclaimer::Global()->Unregister(nReclaimerId);
+}
+
+bool MapJournal::Flush()
+{
+    std::vector<std::string> vRecords;
+    std::vector<uint64_t> vErasedKFs, vErasedMPs;
+    {
+        boost::mutex::scoped_lock lock(mMutexQueue);
+        vRecords.swap(mvPending);
+        vErasedKFs.swap(mvErasedKeyFrames);
+        vErasedMPs.swap(mvErasedMapPoints);
+    }
+
+    // Objects culled before their keyframe record was queued are not in it, the ids go last
+    if(!vErasedKFs.empty() || !vErasedMPs.empty())
+    {
+        std::ostringstream f(std::ios::binary);
+        BinaryIO::WritePod(f,static_cast<uint32_t>(vErasedKFs.size()));
+        for(size_t i=0; i<vErasedKFs.size(); i++)
+            BinaryIO::WriteVarint(f,vErasedKFs[i]);
+        BinaryIO::WritePod(f,static_cast<uint32_t>(vErasedMPs.size()));
+        for(size_t i=0; i<vErasedMPs.size(); i++)
+            BinaryIO::WriteVarint(f,vErasedMPs[i]);
+        vRecords.push_back(MakeRecord(RECORD_ERASED,f.str()));
+    }
+    if(vRecords.empty())
+        return true;
+
+    // One write and one sync for the whole period
+    size_t nSize = 0;
+    for(size_t i=0; i<vRecords.size(); i++)
+        nSize += vRecords[i].size();
+    std::string data;
+    data.reserve(nSize);
+    for(size_t i=0; i<vRecords.size(); i++)
+        data += vRecords[i];
+    return mFd>=0 && WriteAll(mFd,data.data(),data.size()) && ::fdatasync(mFd)==0;
+}
+
+} //namespace ORB_SLAM
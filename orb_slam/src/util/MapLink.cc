@@ -0,0 +1,792 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/MapLink.h"
+#include "util/BinaryIO.h"
+#include "util/MappedFile.h"
+
+#include "threads/LocalMapping.h"
+
+#include "types/MapDatabase.h"
+#include "types/Map.h"
+#include "types/KeyFrame.h"
+#include "types/KeyFrameDatabase.h"
+#include "types/MapPoint.h"
+#include "types/Frame.h"
+
+#include <zlib.h>
+
+#include <sstream>
+#include <set>
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+// Id of a point the server did not receive from the robot
+static const uint64_t NO_ID = static_cast<uint64_t>(-1);
+
+// How a keyframe of the robot refers to a point: by its server id, by the robot id it was already sent with,
+// or by the robot id followed by the point
+static const uint8_t POINT_SERVER = 0;
+static const uint8_t POINT_ROBOT = 1;
+static const uint8_t POINT_NEW = 2;
+
+// Packets are never dropped by the topics, the keyframes must all reach the server
+static const uint32_t PACKET_QUEUE_SIZE = 1000;
+
+MapLink::MapLink(MapDatabase* pMapDB, eRole role, int nWindow, int nLocalKeyFrames, bool bCompression, bool bSendBoW,
+                 uint32_t nAgentId):
+    mpMapDB(pMapDB), mRole(role), mnWindow(std::max(nWindow,1)), mnLocalKeyFrames(std::max(nLocalKeyFrames,0)),
+    mbCompression(bCompression), mbSendBoW(bSendBoW), mnAgentId(nAgentId), mpLocalMapper(NULL), mnLastAgent(0),
+    mnAppliedVersion(0)
+{
+}
+
+MapLink::~MapLink()
+{
+    Stop();
+}
+
+MapLink::eRole MapLink::GetRole()
+{
+    return mRole;
+}
+
+void MapLink::SetLocalMapper(LocalMapping* pLocalMapper)
+{
+    mpLocalMapper = pLocalMapper;
+}
+
+std::string MapLink::UpdateTopic(uint32_t nAgentId)
+{
+    // The robot of a single robot deployment keeps the plain topic
+    if(nAgentId==0)
+        return "ORB_SLAM/MapUpdates";
+    std::ostringstream topic;
+    topic << "ORB_SLAM/MapUpdates_" << nAgentId;
+    return topic.str();
+}
+
+void MapLink::Start(ros::NodeHandle &nh)
+{
+    mNH = nh;
+    mNH.setCallbackQueue(&mQueue);
+    if(mRole==ROBOT)
+    {
+        mPub = mNH.advertise<orb_slam::MapPacket>("ORB_SLAM/KeyFrames", PACKET_QUEUE_SIZE);
+        mSub = mNH.subscribe(UpdateTopic(mnAgentId), PACKET_QUEUE_SIZE, &MapLink::GrabPacket, this);
+    }
+    else
+    {
+        // The update topics are advertised with the first keyframe of each agent
+        mSub = mNH.subscribe("ORB_SLAM/KeyFrames", PACKET_QUEUE_SIZE, &MapLink::GrabPacket, this);
+    }
+
+    // Nobody else spins the link, the packets are only queued for LocalMapping
+    mpSpinner.reset(new ros::AsyncSpinner(1, &mQueue));
+    mpSpinner->start();
+}
+
+void MapLink::Stop()
+{
+    if(mpSpinner)
+    {
+        mpSpinner->stop();
+        mpSpinner.reset();
+    }
+    mSub.shutdown();
+    mPub.shutdown();
+    for(std::map<uint32_t,Agent>::iterator ait=mAgents.begin(); ait!=mAgents.end(); ait++)
+        ait->second.pub.shutdown();
+}
+
+void MapLink::GrabPacket(const orb_slam::MapPacketConstPtr &msg)
+{
+    {
+        boost::mutex::scoped_lock lock(mMutexPackets);
+        if(mRole==SERVER)
+            mAgentPackets[msg->agent].push_back(msg);
+        else if(msg->agent==mnAgentId)
+            mqPackets.push_back(msg);
+    }
+    if(mpLocalMapper)
+        mpLocalMapper->Wake();
+}
+
+void MapLink::Publish(ros::Publisher &pub, const std::string &data, uint32_t nAgentId, uint64_t nVersion)
+{
+    orb_slam::MapPacketPtr msg(new orb_slam::MapPacket());
+    msg->agent = nAgentId;
+    msg->version = nVersion;
+    msg->encoding = orb_slam::MapPacket::RAW;
+    msg->raw_size = data.size();
+    if(mbCompression && !data.empty())
+    {
+        // The descriptors hardly compress, the keypoints, ids and BoW vectors do
+        uLongf nSize = compressBound(data.size());
+        msg->data.resize(nSize);
+        if(compress2(&msg->data[0],&nSize,reinterpret_cast<const Bytef*>(data.data()),data.size(),Z_BEST_SPEED)==Z_OK &&
+           nSize<data.size())
+        {
+            msg->data.resize(nSize);
+            msg->encoding = orb_slam::MapPacket::ZLIB;
+        }
+    }
+    if(msg->encoding==orb_slam::MapPacket::RAW)
+        msg->data.assign(data.begin(),data.end());
+    pub.publish(msg);
+}
+
+bool MapLink::Unpack(const orb_slam::MapPacket &msg, std::vector<uint8_t> &vBuffer, const char* &pData, size_t &nSize)
+{
+    if(msg.data.empty())
+        return false;
+    if(msg.encoding==orb_slam::MapPacket::RAW)
+    {
+        pData = reinterpret_cast<const char*>(&msg.data[0]);
+        nSize = msg.data.size();
+        return true;
+    }
+    if(msg.encoding!=orb_slam::MapPacket::ZLIB || msg.raw_size==0)
+        return false;
+    vBuffer.resize(msg.raw_size);
+    uLongf nRawSize = msg.raw_size;
+    if(uncompress(&vBuffer[0],&nRawSize,&msg.data[0],msg.data.size())!=Z_OK || nRawSize!=msg.raw_size)
+        return false;
+    pData = reinterpret_cast<const char*>(&vBuffer[0]);
+    nSize = vBuffer.size();
+    return true;
+}
+
+bool MapLink::HasPending()
+{
+    boost::mutex::scoped_lock lock(mMutexPackets);
+    if(!mqPackets.empty())
+        return true;
+    for(std::map<uint32_t,std::deque<orb_slam::MapPacketConstPtr> >::iterator qit=mAgentPackets.begin(); qit!=mAgentPackets.end(); qit++)
+        if(!qit->second.empty())
+            return true;
+    return false;
+}
+
+void MapLink::SendKeyFrame(KeyFrame* pKF)
+{
+    mKeyFrames[pKF->mnId] = pKF;
+    mlpSentKeyFrames.push_back(pKF);
+
+    // Loop Closing adds the keyframes to the database otherwise, the robot relocalizes in its local map
+    pKF->getMap()->GetKeyFrameDatabase()->add(pKF);
+
+    std::ostringstream f(std::ios::binary);
+    BinaryIO::WritePod(f,static_cast<uint64_t>(pKF->getMap()->mnId));
+    MapSerializer::WriteKeyFrame(f,pKF,mbSendBoW);
+
+    std::vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+    uint32_t nMatches = 0;
+    for(size_t i=0; i<vpMPs.size(); i++)
+        if(vpMPs[i] && !vpMPs[i]->isBad())
+            nMatches++;
+    BinaryIO::WritePod(f,nMatches);
+    // Each match as the step from the previous keypoint index, then the point id
+    size_t nPrev = 0;
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        if(!pMP || pMP->isBad())
+            continue;
+        BinaryIO::WriteVarint(f,i-nPrev);
+        nPrev = i;
+        std::map<MapPoint*,unsigned long>::iterator sit = mServerIds.find(pMP);
+        if(sit!=mServerIds.end())
+        {
+            BinaryIO::WritePod(f,POINT_SERVER);
+            BinaryIO::WriteVarint(f,sit->second);
+        }
+        else if(mSentPoints.count(pMP->mnId))
+        {
+            BinaryIO::WritePod(f,POINT_ROBOT);
+            BinaryIO::WriteVarint(f,pMP->mnId);
+        }
+        else
+        {
+            // Points made by the robot, from the initialization, until the server returns its id
+            BinaryIO::WritePod(f,POINT_NEW);
+            BinaryIO::WriteVarint(f,pMP->mnId);
+            MapSerializer::WriteMapPoint(f,pMP);
+            mSentPoints[pMP->mnId] = pMP;
+        }
+    }
+
+    Publish(mPub,f.str(),mnAgentId,0);
+
+    TrimLocalMap();
+}
+
+void MapLink::TrimLocalMap()
+{
+    if(mnLocalKeyFrames==0)
+        return;
+
+    // The server keeps them, they only come back through the window of an update
+    while((int)mlpSentKeyFrames.size()>mnLocalKeyFrames)
+    {
+        KeyFrame* pKF = mlpSentKeyFrames.front();
+        mlpSentKeyFrames.pop_front();
+        mKeyFrames.erase(pKF->mnId);
+        if(!pKF->isBad())
+            pKF->SetBadFlag();
+    }
+}
+
+void MapLink::ApplyUpdates()
+{
+    std::deque<orb_slam::MapPacketConstPtr> qPackets;
+    {
+        boost::mutex::scoped_lock lock(mMutexPackets);
+        qPackets.swap(mqPackets);
+    }
+
+    for(size_t i=0; i<qPackets.size(); i++)
+    {
+        // Repeated or late updates would bring back older poses
+        if(qPackets[i]->version<=mnAppliedVersion)
+            continue;
+        if(ApplyUpdate(*qPackets[i]))
+            mnAppliedVersion = qPackets[i]->version;
+        else
+            ROS_WARN("ORB-SLAM - Malformed map update %lu dropped", (unsigned long)qPackets[i]->version);
+    }
+}
+
+// Pose and matches of a keyframe of the window, the points by server id
+struct KeyFrameUpdate
+{
+    KeyFrame* pKF;
+    cv::Mat Tcw;
+    std::vector<std::pair<uint32_t,uint64_t> > vMatches;
+};
+
+bool MapLink::ApplyUpdate(const orb_slam::MapPacket &msg)
+{
+    std::vector<uint8_t> vBuffer;
+    const char* pData;
+    size_t nSize;
+    if(!Unpack(msg,vBuffer,pData,nSize))
+        return false;
+    MemoryStreamBuf buf(pData,nSize);
+    std::istream f(&buf);
+
+    // The whole update is read before the map is touched
+    uint64_t nAnchorId;
+    uint32_t nErased;
+    if(!BinaryIO::ReadPod(f,nAnchorId) || !BinaryIO::ReadPod(f,nErased))
+        return false;
+    std::vector<KeyFrame*> vpErased;
+    for(uint32_t i=0; i<nErased; i++)
+    {
+        uint64_t nId;
+        if(!BinaryIO::ReadPod(f,nId))
+            return false;
+        MapSerializer::KeyFrameIndex::iterator kit = mKeyFrames.find(nId);
+        if(kit!=mKeyFrames.end())
+            vpErased.push_back(kit->second);
+    }
+
+    // Points by server id, the ones the robot does not have yet are created when a keyframe matches them
+    std::map<uint64_t,std::pair<cv::Mat,MapPoint*> > points;
+    uint32_t nMPs;
+    if(!BinaryIO::ReadPod(f,nMPs))
+        return false;
+    for(uint32_t i=0; i<nMPs; i++)
+    {
+        uint64_t nServerId, nRobotId;
+        float pos[3];
+        if(!BinaryIO::ReadPod(f,nServerId) || !BinaryIO::ReadPod(f,nRobotId) ||
+           !BinaryIO::ReadPod(f,pos[0]) || !BinaryIO::ReadPod(f,pos[1]) || !BinaryIO::ReadPod(f,pos[2]))
+            return false;
+        MapPoint* pMP = NULL;
+        MapSerializer::MapPointIndex::iterator mit = mServerPoints.find(nServerId);
+        if(mit!=mServerPoints.end())
+            pMP = mit->second;
+        else if(nRobotId!=NO_ID)
+        {
+            MapSerializer::MapPointIndex::iterator rit = mSentPoints.find(nRobotId);
+            if(rit!=mSentPoints.end())
+            {
+                pMP = rit->second;
+                mServerPoints[nServerId] = pMP;
+                mServerIds[pMP] = nServerId;
+            }
+        }
+        points[nServerId] = std::make_pair(cv::Mat(3,1,CV_32F,pos).clone(),pMP);
+    }
+
+    std::vector<KeyFrameUpdate> vUpdates;
+    uint32_t nKFs;
+    if(!BinaryIO::ReadPod(f,nKFs))
+        return false;
+    for(uint32_t i=0; i<nKFs; i++)
+    {
+        KeyFrameUpdate update;
+        uint64_t nId;
+        uint32_t nMatches;
+        if(!BinaryIO::ReadPod(f,nId) || !BinaryIO::Read(f,update.Tcw) || !BinaryIO::ReadPod(f,nMatches) ||
+           update.Tcw.rows!=4 || update.Tcw.cols!=4)
+            return false;
+        update.vMatches.resize(nMatches);
+        uint64_t nIdx = 0;
+        for(uint32_t j=0; j<nMatches; j++)
+        {
+            uint64_t nStep;
+            if(!BinaryIO::ReadVarint(f,nStep) || !BinaryIO::ReadVarint(f,update.vMatches[j].second))
+                return false;
+            nIdx += nStep;
+            update.vMatches[j].first = static_cast<uint32_t>(nIdx);
+        }
+
+        // Keyframes culled or trimmed by the robot are skipped
+        MapSerializer::KeyFrameIndex::iterator kit = mKeyFrames.find(nId);
+        if(kit==mKeyFrames.end() || kit->second->isBad())
+            continue;
+        update.pKF = kit->second;
+        vUpdates.push_back(update);
+    }
+
+    MapSerializer::KeyFrameIndex::iterator ait = mKeyFrames.find(nAnchorId);
+    KeyFrame* pAnchor = ait!=mKeyFrames.end() && !ait->second->isBad() ? ait->second : NULL;
+    Map* pMap = pAnchor ? pAnchor->getMap() : mpMapDB->getCurrent();
+    if(!pMap)
+        return true;
+
+    pMap->BeginUpdate();
+
+    // The server poses replace ours, the keyframes sent after the anchor follow its correction
+    cv::Mat Tcorr;
+    for(size_t i=0; i<vUpdates.size(); i++)
+    {
+        KeyFrame* pKF = vUpdates[i].pKF;
+        if(pKF->getMap()!=pMap)
+            continue;
+        if(pKF==pAnchor)
+            Tcorr = pKF->GetPoseInverse()*vUpdates[i].Tcw;
+        pKF->SetPose(vUpdates[i].Tcw);
+    }
+    if(!Tcorr.empty())
+    {
+        for(std::deque<KeyFrame*>::iterator lit=mlpSentKeyFrames.begin(), lend=mlpSentKeyFrames.end(); lit!=lend; lit++)
+        {
+            KeyFrame* pKF = *lit;
+            if(pKF->mnId>nAnchorId && !pKF->isBad() && pKF->getMap()==pMap)
+                pKF->SetPose(pKF->GetPose()*Tcorr);
+        }
+    }
+
+    // Positions, then the matches of the window replace ours
+    std::set<MapPoint*> spChanged;
+    std::vector<MapPoint*> vpCreated;
+    for(std::map<uint64_t,std::pair<cv::Mat,MapPoint*> >::iterator mit=points.begin(), mend=points.end(); mit!=mend; mit++)
+    {
+        MapPoint* pMP = mit->second.second;
+        if(pMP && !pMP->isBad())
+        {
+            pMP->SetWorldPos(mit->second.first);
+            spChanged.insert(pMP);
+        }
+    }
+    for(size_t i=0; i<vUpdates.size(); i++)
+    {
+        KeyFrame* pKF = vUpdates[i].pKF;
+        if(pKF->getMap()!=pMap)
+            continue;
+
+        const std::vector<MapPoint*> vpOld = pKF->GetMapPointMatches();
+        std::vector<MapPoint*> vpNew(vpOld.size(),static_cast<MapPoint*>(NULL));
+        for(size_t j=0; j<vUpdates[i].vMatches.size(); j++)
+        {
+            const uint32_t idx = vUpdates[i].vMatches[j].first;
+            std::map<uint64_t,std::pair<cv::Mat,MapPoint*> >::iterator mit = points.find(vUpdates[i].vMatches[j].second);
+            if(idx>=vpNew.size() || mit==points.end())
+                continue;
+            MapPoint* &pMP = mit->second.second;
+            if(!pMP)
+            {
+                pMP = new MapPoint(mit->second.first,pKF,pMap);
+                pMap->AddMapPoint(pMP);
+                mServerPoints[mit->first] = pMP;
+                mServerIds[pMP] = mit->first;
+                vpCreated.push_back(pMP);
+            }
+            if(!pMP->isBad())
+                vpNew[idx] = pMP;
+        }
+
+        // A point moved to another keypoint keeps its observation
+        const std::set<MapPoint*> spNew(vpNew.begin(),vpNew.end());
+        for(size_t j=0; j<vpOld.size(); j++)
+        {
+            if(vpOld[j]==vpNew[j] || !vpOld[j])
+                continue;
+            pKF->EraseMapPointMatch(j);
+            if(!spNew.count(vpOld[j]))
+                vpOld[j]->EraseObservation(pKF);
+        }
+        for(size_t j=0; j<vpNew.size(); j++)
+        {
+            if(!vpNew[j] || vpNew[j]==vpOld[j] || vpNew[j]->isBad())
+                continue;
+            pKF->AddMapPoint(vpNew[j],j);
+            vpNew[j]->AddObservation(pKF,j);
+            spChanged.insert(vpNew[j]);
+        }
+        pKF->UpdateConnections();
+    }
+
+    for(size_t i=0; i<vpErased.size(); i++)
+        if(!vpErased[i]->isBad())
+            vpErased[i]->SetBadFlag();
+
+    for(std::set<MapPoint*>::iterator sit=spChanged.begin(), send=spChanged.end(); sit!=send; sit++)
+        if(!(*sit)->isBad())
+            (*sit)->UpdateNormalAndDepth();
+    for(size_t i=0; i<vpCreated.size(); i++)
+        if(!vpCreated[i]->isBad())
+            vpCreated[i]->ComputeDistinctiveDescriptors();
+
+    pMap->EndUpdate();
+    return true;
+}
+
+MapLink::Agent &MapLink::GetAgent(uint32_t nAgentId)
+{
+    std::map<uint32_t,Agent>::iterator ait = mAgents.find(nAgentId);
+    if(ait!=mAgents.end())
+        return ait->second;
+
+    Agent &agent = mAgents[nAgentId];
+    agent.pub = mNH.advertise<orb_slam::MapPacket>(UpdateTopic(nAgentId), PACKET_QUEUE_SIZE);
+    ROS_INFO("ORB-SLAM - Robot %u joined, updates sent on %s", nAgentId, UpdateTopic(nAgentId).c_str());
+    return agent;
+}
+
+Map* MapLink::GetServerMap(Agent &agent, uint32_t nAgentId, unsigned long nRobotMapId)
+{
+    std::map<unsigned long,Map*>::iterator mit = agent.maps.find(nRobotMapId);
+    if(mit!=agent.maps.end())
+    {
+        if(!mit->second->getErased())
+            return mit->second;
+
+        // Merged, the keyframes moved to the map of the last one received
+        std::map<unsigned long,KeyFrame*>::iterator kit = agent.lastKeyFrames.find(nRobotMapId);
+        if(kit!=agent.lastKeyFrames.end() && kit->second->getMap() && !kit->second->getMap()->getErased())
+        {
+            mit->second = kit->second->getMap();
+            return mit->second;
+        }
+    }
+
+    Map* pMap = mpMapDB->getNewMap();
+    mpMapDB->addMap(pMap);
+    agent.maps[nRobotMapId] = pMap;
+    ROS_INFO("ORB-SLAM - New map created for map %lu of robot %u", nRobotMapId, nAgentId);
+    return pMap;
+}
+
+KeyFrame* MapLink::ReceiveKeyFrame()
+{
+    // The agents after the last one served go first, so a busy robot does not starve the others
+    orb_slam::MapPacketConstPtr msg;
+    {
+        boost::mutex::scoped_lock lock(mMutexPackets);
+        if(mAgentPackets.empty())
+            return NULL;
+        std::map<uint32_t,std::deque<orb_slam::MapPacketConstPtr> >::iterator qit = mAgentPackets.upper_bound(mnLastAgent);
+        for(size_t i=0; i<mAgentPackets.size(); i++, qit++)
+        {
+            if(qit==mAgentPackets.end())
+                qit = mAgentPackets.begin();
+            if(!qit->second.empty())
+                break;
+        }
+        if(qit==mAgentPackets.end() || qit->second.empty())
+            return NULL;
+        msg = qit->second.front();
+        qit->second.pop_front();
+        mnLastAgent = qit->first;
+    }
+
+    const uint32_t nAgentId = msg->agent;
+    std::vector<uint8_t> vBuffer;
+    const char* pData;
+    size_t nSize;
+    if(!Unpack(*msg,vBuffer,pData,nSize))
+    {
+        ROS_WARN("ORB-SLAM - Malformed keyframe of robot %u dropped", nAgentId);
+        return NULL;
+    }
+    MemoryStreamBuf buf(pData,nSize);
+    std::istream f(&buf);
+
+    uint64_t nRobotMapId;
+    if(!BinaryIO::ReadPod(f,nRobotMapId))
+    {
+        ROS_WARN("ORB-SLAM - Malformed keyframe of robot %u dropped", nAgentId);
+        return NULL;
+    }
+    Agent &agent = GetAgent(nAgentId);
+    Map* pMap = GetServerMap(agent,nAgentId,nRobotMapId);
+    KeyFrame* pKF = MapSerializer::ReadKeyFrame(f,pMap,mpMapDB,MapSerializer::FORMAT_VERSION,NULL);
+    if(!pKF)
+    {
+        ROS_WARN("ORB-SLAM - Malformed keyframe of robot %u dropped", nAgentId);
+        return NULL;
+    }
+    const unsigned long nRobotId = pKF->mnId;
+    if(agent.keyFrames.count(nRobotId))
+    {
+        delete pKF;
+        return NULL;
+    }
+
+    // The ids of several robots would collide, keyframes get server ids in the order they are received
+    pKF->mnId = KeyFrame::nNextId++;
+    agent.keyFrames[nRobotId] = pKF;
+    agent.robotKeyFrameIds[pKF] = nRobotId;
+    agent.lastKeyFrames[nRobotMapId] = pKF;
+    agent.nReceived++;
+    mKeyFrameAgents[pKF] = nAgentId;
+    Frame::nNextId = std::max(Frame::nNextId,pKF->mnFrameId+1);
+
+    // Points sent in full get a server id, the robot ones would collide with the triangulated points
+    // Their observations refer to the robot ids of the keyframes
+    const size_t N = pKF->GetMapPointMatches().size();
+    uint32_t nMatches;
+    bool bOK = BinaryIO::ReadPod(f,nMatches);
+    uint64_t idx = 0;
+    for(uint32_t i=0; bOK && i<nMatches; i++)
+    {
+        uint64_t nStep;
+        uint8_t type;
+        uint64_t nId;
+        bOK = BinaryIO::ReadVarint(f,nStep) && BinaryIO::ReadPod(f,type) && BinaryIO::ReadVarint(f,nId);
+        if(!bOK)
+            break;
+        idx += nStep;
+
+        MapPoint* pMP = NULL;
+        if(type==POINT_SERVER)
+        {
+            MapSerializer::MapPointIndex::iterator mit = mUpdatedPoints.find(nId);
+            if(mit!=mUpdatedPoints.end())
+                pMP = mit->second;
+        }
+        else
+        {
+            MapSerializer::MapPointIndex::iterator mit = agent.robotPoints.find(nId);
+            if(mit!=agent.robotPoints.end())
+                pMP = mit->second;
+            if(type==POINT_NEW)
+            {
+                MapPoint* pNew = NULL;
+                bOK = MapSerializer::ReadMapPoint(f,pMap,agent.keyFrames,pNew,MapSerializer::FORMAT_VERSION,NULL);
+                if(pNew)
+                {
+                    pNew->mnId = MapPoint::nNextId++;
+                    pMap->AddMapPoint(pNew);
+                    agent.robotPoints[nId] = pNew;
+                    agent.robotPointIds[pNew] = nId;
+                    pMP = pNew;
+                }
+            }
+        }
+
+        if(pMP && !pMP->isBad() && idx<N)
+        {
+            pKF->AddMapPoint(pMP,idx);
+            pMP->AddObservation(pKF,idx);
+        }
+    }
+    if(!bOK)
+        ROS_WARN("ORB-SLAM - Keyframe %lu of robot %u received with malformed matches", nRobotId, nAgentId);
+
+    // LocalMapping skips the first keyframe of a map, Tracking adds it on the robot
+    pMap->AddKeyFrame(pKF);
+    if(mpMapDB->getCurrent()!=pMap)
+        mpMapDB->setMap(pMap);
+    return pKF;
+}
+
+void MapLink::SendUpdate(KeyFrame* pKF)
+{
+    if(!pKF || pKF->isBad())
+        return;
+    std::map<KeyFrame*,uint32_t>::iterator kait = mKeyFrameAgents.find(pKF);
+    if(kait==mKeyFrameAgents.end())
+        return;
+    const uint32_t nAgentId = kait->second;
+    Agent &agent = mAgents[nAgentId];
+
+    // After a merge the window may hold keyframes of other robots, whose robot does not know them
+    std::vector<KeyFrame*> vpKFs;
+    std::vector<unsigned long> vnRobotIds;
+    std::vector<KeyFrame*> vpCovisible = pKF->GetBestCovisibilityKeyFrames(mnWindow);
+    vpCovisible.push_back(pKF);
+    for(size_t i=0; i<vpCovisible.size(); i++)
+    {
+        std::map<KeyFrame*,unsigned long>::iterator rit = agent.robotKeyFrameIds.find(vpCovisible[i]);
+        if(rit==agent.robotKeyFrameIds.end())
+            continue;
+        vpKFs.push_back(vpCovisible[i]);
+        vnRobotIds.push_back(rit->second);
+    }
+
+    std::vector<MapPoint*> vpMPs;
+    std::set<MapPoint*> spMPs;
+    std::vector<std::vector<MapPoint*> > vvpMatches(vpKFs.size());
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        vvpMatches[i] = vpKFs[i]->GetMapPointMatches();
+        for(size_t j=0; j<vvpMatches[i].size(); j++)
+        {
+            MapPoint* pMP = vvpMatches[i][j];
+            if(!pMP || pMP->isBad())
+                vvpMatches[i][j] = NULL;
+            else if(spMPs.insert(pMP).second)
+                vpMPs.push_back(pMP);
+        }
+    }
+
+    // The keyframe itself is last in the window
+    std::ostringstream f(std::ios::binary);
+    BinaryIO::WritePod(f,static_cast<uint64_t>(vnRobotIds.back()));
+    BinaryIO::WritePod(f,static_cast<uint32_t>(agent.vErasedKeyFrames.size()));
+    for(size_t i=0; i<agent.vErasedKeyFrames.size(); i++)
+        BinaryIO::WritePod(f,static_cast<uint64_t>(agent.vErasedKeyFrames[i]));
+    agent.vErasedKeyFrames.clear();
+
+    // The robot recomputes the normals and descriptors from its own observations
+    BinaryIO::WritePod(f,static_cast<uint32_t>(vpMPs.size()));
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        std::map<MapPoint*,unsigned long>::iterator rit = agent.robotPointIds.find(pMP);
+        const Eigen::Vector3f Pos = pMP->GetWorldPosEigen();
+        BinaryIO::WritePod(f,static_cast<uint64_t>(pMP->mnId));
+        BinaryIO::WritePod(f,rit!=agent.robotPointIds.end() ? static_cast<uint64_t>(rit->second) : NO_ID);
+        for(int k=0; k<3; k++)
+            BinaryIO::WritePod(f,Pos(k));
+        mUpdatedPoints[pMP->mnId] = pMP;
+    }
+
+    BinaryIO::WritePod(f,static_cast<uint32_t>(vpKFs.size()));
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        const std::vector<MapPoint*> &vpMatches = vvpMatches[i];
+        BinaryIO::WritePod(f,static_cast<uint64_t>(vnRobotIds[i]));
+        BinaryIO::Write(f,vpKFs[i]->GetPose());
+        BinaryIO::WritePod(f,static_cast<uint32_t>(vpMatches.size()-std::count(vpMatches.begin(),vpMatches.end(),static_cast<MapPoint*>(NULL))));
+        size_t nPrev = 0;
+        for(size_t j=0; j<vpMatches.size(); j++)
+        {
+            if(!vpMatches[j])
+                continue;
+            BinaryIO::WriteVarint(f,j-nPrev);
+            BinaryIO::WriteVarint(f,vpMatches[j]->mnId);
+            nPrev = j;
+        }
+    }
+
+    Publish(agent.pub,f.str(),nAgentId,++agent.nVersion);
+}
+
+// Drops the entries of the culled points
+static void PurgePoints(MapSerializer::MapPointIndex &index)
+{
+    for(MapSerializer::MapPointIndex::iterator mit=index.begin(); mit!=index.end(); )
+    {
+        if(mit->second->isBad())
+            index.erase(mit++);
+        else
+            mit++;
+    }
+}
+
+static void PurgePoints(std::map<MapPoint*,unsigned long> &index)
+{
+    for(std::map<MapPoint*,unsigned long>::iterator mit=index.begin(); mit!=index.end(); )
+    {
+        if(mit->first->isBad())
+            index.erase(mit++);
+        else
+            mit++;
+    }
+}
+
+void MapLink::PurgeBadPointers()
+{
+    for(MapSerializer::KeyFrameIndex::iterator kit=mKeyFrames.begin(); kit!=mKeyFrames.end(); )
+    {
+        if(kit->second->isBad())
+            mKeyFrames.erase(kit++);
+        else
+            kit++;
+    }
+    for(std::deque<KeyFrame*>::iterator lit=mlpSentKeyFrames.begin(); lit!=mlpSentKeyFrames.end(); )
+    {
+        if((*lit)->isBad())
+            lit = mlpSentKeyFrames.erase(lit);
+        else
+            lit++;
+    }
+    PurgePoints(mServerPoints);
+    PurgePoints(mSentPoints);
+    PurgePoints(mServerIds);
+    PurgePoints(mUpdatedPoints);
+
+    for(std::map<uint32_t,Agent>::iterator ait=mAgents.begin(); ait!=mAgents.end(); ait++)
+    {
+        Agent &agent = ait->second;
+        for(MapSerializer::KeyFrameIndex::iterator kit=agent.keyFrames.begin(); kit!=agent.keyFrames.end(); )
+        {
+            if(kit->second->isBad())
+            {
+                // The robot culls them too
+                agent.vErasedKeyFrames.push_back(kit->first);
+                agent.robotKeyFrameIds.erase(kit->second);
+                mKeyFrameAgents.erase(kit->second);
+                agent.keyFrames.erase(kit++);
+            }
+            else
+                kit++;
+        }
+        for(std::map<unsigned long,KeyFrame*>::iterator kit=agent.lastKeyFrames.begin(); kit!=agent.lastKeyFrames.end(); )
+        {
+            if(kit->second->isBad())
+                agent.lastKeyFrames.erase(kit++);
+            else
+                kit++;
+        }
+        PurgePoints(agent.robotPoints);
+        PurgePoints(agent.robotPointIds);
+    }
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,672 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/MapSerializer.h"
+#include "util/BinaryIO.h"
+#include "util/MappedFile.h"
+
+#include "types/MapDatabase.h"
+#include "types/Map.h"
+#include "types/KeyFrame.h"
+#include "types/MapPoint.h"
+#include "types/Frame.h"
+#include "util/LockProfiler.h"
+#include "util/Converter.h"
+
+#include <fstream>
+#include <cstdio>
+#include <stdint.h>
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+// Map files start with this tag and format version
+// Version 5 tells the layout of the keypoints of each keyframe, version 4 adds the position priors of the keyframes,
+// version 3 quantizes the keypoints and rebuilds the grids, version 2 aligns the descriptors, older files are still read
+static const uint32_t MAP_FILE_TAG = 0x4f52424d;
+static const uint32_t MAP_FILE_VERSION = 5;
+const uint32_t MapSerializer::FORMAT_VERSION = MAP_FILE_VERSION;
+
+// Id of a missing keyframe or map point
+static const uint64_t NO_ID = static_cast<uint64_t>(-1);
+
+// Keypoints quantized for the packets and logs, or as aligned arrays in map files so they are used in place
+static const uint8_t KEYPOINTS_QUANTIZED = 0;
+static const uint8_t KEYPOINTS_ALIGNED = 1;
+
+bool MapSerializer::Save(MapDatabase* pMapDB, const std::string &filename)
+{
+    // Erased maps are not worth restoring
+    MapDatabase::MapList pMaps = pMapDB->getMaps();
+    Map* pCurrent = pMapDB->getCurrent();
+    std::vector<Map*> vpMaps;
+    int32_t nCurrent = -1;
+    for(size_t i=0; i<pMaps->size(); i++)
+    {
+        if(pMaps->at(i)->getErased())
+            continue;
+        if(pMaps->at(i)==pCurrent)
+            nCurrent = vpMaps.size();
+        vpMaps.push_back(pMaps->at(i));
+    }
+
+    // The paged out maps are faulted in while they are written
+    for(size_t i=0; i<vpMaps.size(); i++)
+        vpMaps[i]->Pin();
+
+    const std::string tmpname = filename+".tmp";
+    std::ofstream f(tmpname.c_str(), std::ios::binary | std::ios::trunc);
+    bool bOK = f.is_open();
+    if(bOK)
+    {
+        BinaryIO::WritePod(f,MAP_FILE_TAG);
+        BinaryIO::WritePod(f,MAP_FILE_VERSION);
+        // The BoW vectors are only valid with the same vocabulary
+        BinaryIO::WritePod(f,static_cast<uint32_t>(pMapDB->getVocab()->size()));
+        BinaryIO::WritePod(f,static_cast<uint32_t>(vpMaps.size()));
+        BinaryIO::WritePod(f,nCurrent);
+
+        for(size_t iMap=0; iMap<vpMaps.size(); iMap++)
+        {
+            Map* pMap = vpMaps[iMap];
+
+            std::vector<KeyFrame*> vpKFs;
+            Map::KeyFrameSnapshot keyFrames = pMap->GetKeyFrameSnapshot();
+            for(Map::KeyFrameSnapshot::const_iterator sit=keyFrames.begin(), send=keyFrames.end(); sit!=send; sit++)
+                if(!(*sit)->isBad())
+                    vpKFs.push_back(*sit);
+
+            std::vector<MapPoint*> vpMPs;
+            Map::MapPointSnapshot mapPoints = pMap->GetMapPointSnapshot();
+            for(Map::MapPointSnapshot::const_iterator sit=mapPoints.begin(), send=mapPoints.end(); sit!=send; sit++)
+                if(!(*sit)->isBad())
+                    vpMPs.push_back(*sit);
+
+            // Keyframes, then the points referencing them, then the links between both
+            BinaryIO::WritePod(f,static_cast<uint32_t>(vpKFs.size()));
+            for(size_t i=0; i<vpKFs.size(); i++)
+                WriteKeyFrame(f,vpKFs[i],true,true);
+            BinaryIO::WritePod(f,static_cast<uint32_t>(vpMPs.size()));
+            for(size_t i=0; i<vpMPs.size(); i++)
+                WriteMapPoint(f,vpMPs[i]);
+            for(size_t i=0; i<vpKFs.size(); i++)
+                WriteLinks(f,vpKFs[i]);
+        }
+        f.close();
+        bOK = !f.fail();
+    }
+
+    for(size_t i=0; i<vpMaps.size(); i++)
+        vpMaps[i]->Unpin();
+
+    if(!bOK)
+    {
+        std::remove(tmpname.c_str());
+        return false;
+    }
+    return std::rename(tmpname.c_str(),filename.c_str())==0;
+}
+
+bool MapSerializer::Load(MapDatabase* pMapDB, const std::string &filename)
+{
+    // Parse the mapping in place, the descriptors of the loaded objects point into it
+    boost::shared_ptr<MappedFile> pFile(new MappedFile());
+    const char* pBase = NULL;
+    std::ifstream file;
+    boost::shared_ptr<MemoryStreamBuf> pBuf;
+    if(pFile->Open(filename))
+    {
+        pBase = pFile->Data();
+        pBuf.reset(new MemoryStreamBuf(pFile->Data(),pFile->Size()));
+    }
+    else
+        file.open(filename.c_str(), std::ios::binary);
+    std::istream f(pBuf ? static_cast<std::streambuf*>(pBuf.get()) : file.rdbuf());
+
+    uint32_t nTag, nVersion, nWords, nMaps;
+    int32_t nCurrent;
+    if(!BinaryIO::ReadPod(f,nTag) || !BinaryIO::ReadPod(f,nVersion) || !BinaryIO::ReadPod(f,nWords) ||
+       !BinaryIO::ReadPod(f,nMaps) || !BinaryIO::ReadPod(f,nCurrent))
+        return false;
+    if(nTag!=MAP_FILE_TAG || nVersion<1 || nVersion>MAP_FILE_VERSION || nWords!=pMapDB->getVocab()->size())
+        return false;
+
+    // Ids are unique over all the maps of the file, the indices are keyed by the ids stored in it
+    // The loaded objects are numbered after the live ones, so the ids of several files never collide
+    // (an empty database keeps the stored ids)
+    KeyFrameIndex keyFrames;
+    MapPointIndex mapPoints;
+    const long unsigned int nKFOffset = KeyFrame::nNextId;
+    const long unsigned int nFrameOffset = Frame::nNextId;
+    const long unsigned int nMPOffset = MapPoint::nNextId.load();
+    std::vector<Map*> vpMaps;
+    std::vector<std::vector<KeyFrame*> > vvpKFs;
+    bool bOK = true;
+    for(uint32_t iMap=0; bOK && iMap<nMaps; iMap++)
+    {
+        Map* pMap = pMapDB->getNewMap();
+        vpMaps.push_back(pMap);
+        vvpKFs.push_back(std::vector<KeyFrame*>());
+        std::vector<KeyFrame*> &vpKFs = vvpKFs.back();
+
+        // Objects are added to the map as soon as they are read, so that deleting it frees them
+        uint32_t nKFs, nMPs;
+        bOK = BinaryIO::ReadPod(f,nKFs);
+        for(uint32_t i=0; bOK && i<nKFs; i++)
+        {
+            KeyFrame* pKF = ReadKeyFrame(f,pMap,pMapDB,nVersion,pBase);
+            bOK = pKF!=NULL;
+            if(bOK)
+            {
+                keyFrames[pKF->mnId] = pKF;
+                pKF->mnId += nKFOffset;
+                pKF->mnFrameId += nFrameOffset;
+                pMap->AddKeyFrame(pKF);
+                vpKFs.push_back(pKF);
+            }
+        }
+        bOK = bOK && BinaryIO::ReadPod(f,nMPs);
+        for(uint32_t i=0; bOK && i<nMPs; i++)
+        {
+            MapPoint* pMP = NULL;
+            bOK = ReadMapPoint(f,pMap,keyFrames,pMP,nVersion,pBase);
+            if(bOK && pMP)
+            {
+                mapPoints[pMP->mnId] = pMP;
+                pMP->mnId += nMPOffset;
+                if(pMP->mnFirstKFid>=0)
+                    pMP->mnFirstKFid += static_cast<long int>(nKFOffset);
+                pMap->AddMapPoint(pMP);
+            }
+        }
+        for(size_t i=0; bOK && i<vpKFs.size(); i++)
+            bOK = ReadLinks(f,vpKFs[i],keyFrames,mapPoints);
+        // The links were read without notifying the essential graph, it is read back when needed
+        pMap->GetEssentialGraph()->Invalidate();
+    }
+
+    if(!bOK)
+    {
+        for(size_t i=0; i<vpMaps.size(); i++)
+        {
+            delete vpMaps[i]->GetKeyFrameDatabase();
+            delete vpMaps[i];
+        }
+        return false;
+    }
+
+    // The mapping lives as long as the database, the objects may move to other maps
+    if(pBase)
+        pMapDB->addMappedFile(pFile);
+
+    // New objects get ids after the loaded ones
+    for(KeyFrameIndex::iterator mit=keyFrames.begin(), mend=keyFrames.end(); mit!=mend; mit++)
+    {
+        KeyFrame::nNextId = std::max(KeyFrame::nNextId,mit->second->mnId+1);
+        Frame::nNextId = std::max(Frame::nNextId,mit->second->mnFrameId+1);
+    }
+    for(MapPointIndex::iterator mit=mapPoints.begin(), mend=mapPoints.end(); mit!=mend; mit++)
+        MapPoint::nNextId = std::max(MapPoint::nNextId.load(),mit->second->mnId+1);
+
+    // Rebuild the keyframe databases, the maps are then visible to place recognition
+    for(size_t iMap=0; iMap<vpMaps.size(); iMap++)
+    {
+        for(size_t i=0; i<vvpKFs[iMap].size(); i++)
+            vpMaps[iMap]->GetKeyFrameDatabase()->add(vvpKFs[iMap][i]);
+        pMapDB->addMap(vpMaps[iMap]);
+    }
+    if(nCurrent>=0 && nCurrent<(int32_t)vpMaps.size())
+        pMapDB->setMap(vpMaps[nCurrent]);
+
+    return true;
+}
+
+void MapSerializer::WriteKeyFrame(std::ostream &f, KeyFrame* pKF, bool bBoW, bool bAligned)
+{
+    BinaryIO::WritePod(f,static_cast<uint64_t>(pKF->mnId));
+    BinaryIO::WritePod(f,static_cast<uint64_t>(pKF->mnFrameId));
+    BinaryIO::WritePod(f,pKF->mTimeStamp);
+
+    // Calibration, image bounds and grid, the calibration matrix is rebuilt
+    BinaryIO::WritePod(f,pKF->fx);
+    BinaryIO::WritePod(f,pKF->fy);
+    BinaryIO::WritePod(f,pKF->cx);
+    BinaryIO::WritePod(f,pKF->cy);
+    BinaryIO::WritePod(f,static_cast<int32_t>(pKF->mnMinX));
+    BinaryIO::WritePod(f,static_cast<int32_t>(pKF->mnMinY));
+    BinaryIO::WritePod(f,static_cast<int32_t>(pKF->mnMaxX));
+    BinaryIO::WritePod(f,static_cast<int32_t>(pKF->mnMaxY));
+    BinaryIO::WritePod(f,static_cast<int32_t>(pKF->mnGridCols));
+    BinaryIO::WritePod(f,static_cast<int32_t>(pKF->mnGridRows));
+    BinaryIO::WritePod(f,pKF->mfGridElementWidthInv);
+    BinaryIO::WritePod(f,pKF->mfGridElementHeightInv);
+
+    // Scale pyramid
+    BinaryIO::WritePod(f,static_cast<int32_t>(pKF->mnScaleLevels));
+    BinaryIO::WritePodVector(f,pKF->mvScaleFactors);
+    BinaryIO::WritePodVector(f,pKF->mvLevelSigma2);
+    BinaryIO::WritePodVector(f,pKF->mvInvLevelSigma2);
+
+    // Rotation row by row, then the translation
+    const cv::Mat Tcw = pKF->GetPose();
+    for(int i=0; i<3; i++)
+        for(int j=0; j<4; j++)
+            BinaryIO::WritePod(f,Tcw.at<float>(i,j));
+
+    // Features, the keypoints never change after construction and the grid is rebuilt from them
+    // The distorted keypoints are only stored if they differ
+    BinaryIO::WritePod(f,bAligned ? KEYPOINTS_ALIGNED : KEYPOINTS_QUANTIZED);
+    if(bAligned)
+        WriteKeyPointArrays(f,pKF->mKeys);
+    else
+    {
+        BinaryIO::WriteQuantized(f,pKF->GetKeyPointsUn(),pKF->mnMinX,pKF->mnMinY);
+        const bool bDistorted = pKF->mKeys.Distorted();
+        BinaryIO::WritePod(f,static_cast<uint8_t>(bDistorted));
+        if(bDistorted)
+            BinaryIO::WriteQuantized(f,pKF->GetKeyPoints(),pKF->mnMinX,pKF->mnMinY);
+    }
+    {
+        PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, pKF->mMutexFeatures);
+        BinaryIO::WriteAligned(f,pKF->mDescriptors);
+        bBoW = bBoW && !pKF->mBowVec.empty();
+        BinaryIO::WritePod(f,static_cast<uint8_t>(bBoW));
+        if(bBoW)
+        {
+            BinaryIO::Write(f,pKF->mBowVec);
+            BinaryIO::Write(f,pKF->mFeatVec);
+        }
+    }
+
+    BinaryIO::WritePod(f,static_cast<uint8_t>(pKF->mbPositionPrior));
+    if(pKF->mbPositionPrior)
+    {
+        BinaryIO::WritePod(f,pKF->mPositionPrior.x);
+        BinaryIO::WritePod(f,pKF->mPositionPrior.y);
+        BinaryIO::WritePod(f,pKF->mPositionPrior.z);
+    }
+}
+
+bool MapSerializer::ReadDescriptors(std::istream &f, cv::Mat &descriptors, uint32_t nVersion, const char* pBase)
+{
+    if(nVersion<2)
+        return BinaryIO::Read(f,descriptors);
+    return BinaryIO::ReadAligned(f,descriptors,pBase);
+}
+
+void MapSerializer::WriteKeyPointArrays(std::ostream &f, const KeyPointArray &keys)
+{
+    // Keyframes whose positions were released are written without keypoints, as by WriteQuantized
+    const int N = keys.HasPositions() ? keys.size() : 0;
+    const bool bDistorted = keys.Distorted();
+    cv::Mat x(1,N,CV_32F), y(1,N,CV_32F), angle(1,N,CV_32F), octave(1,N,CV_8U);
+    cv::Mat rawX(1,bDistorted ? N : 0,CV_32F), rawY(1,bDistorted ? N : 0,CV_32F);
+    for(int i=0; i<N; i++)
+    {
+        x.at<float>(i) = keys.X(i);
+        y.at<float>(i) = keys.Y(i);
+        angle.at<float>(i) = keys.Angle(i);
+        octave.at<unsigned char>(i) = keys.Octave(i);
+        if(bDistorted)
+        {
+            const cv::Point2f raw = keys.RawPt(i);
+            rawX.at<float>(i) = raw.x;
+            rawY.at<float>(i) = raw.y;
+        }
+    }
+
+    BinaryIO::WriteAligned(f,x);
+    BinaryIO::WriteAligned(f,y);
+    BinaryIO::WriteAligned(f,angle);
+    BinaryIO::WriteAligned(f,octave);
+    BinaryIO::WritePod(f,static_cast<uint8_t>(bDistorted));
+    if(bDistorted)
+    {
+        BinaryIO::WriteAligned(f,rawX);
+        BinaryIO::WriteAligned(f,rawY);
+    }
+}
+
+// One row of n elements of the type, or empty for none
+static bool IsArray(const cv::Mat &m, int n, int type)
+{
+    return n==0 ? m.empty() : m.rows==1 && m.cols==n && m.type()==type && m.isContinuous();
+}
+
+bool MapSerializer::ReadKeyPointArrays(std::istream &f, KeyPointArray &keys, const char* pBase)
+{
+    cv::Mat x, y, angle, octave, rawX, rawY;
+    uint8_t bDistorted;
+    if(!BinaryIO::ReadAligned(f,x,pBase) || !BinaryIO::ReadAligned(f,y,pBase) || !BinaryIO::ReadAligned(f,angle,pBase) ||
+       !BinaryIO::ReadAligned(f,octave,pBase) || !BinaryIO::ReadPod(f,bDistorted))
+        return false;
+    if(bDistorted && (!BinaryIO::ReadAligned(f,rawX,pBase) || !BinaryIO::ReadAligned(f,rawY,pBase)))
+        return false;
+
+    const int N = x.cols;
+    if(!IsArray(x,N,CV_32F) || !IsArray(y,N,CV_32F) || !IsArray(angle,N,CV_32F) || !IsArray(octave,N,CV_8U) ||
+       (bDistorted && (!IsArray(rawX,N,CV_32F) || !IsArray(rawY,N,CV_32F))))
+        return false;
+
+    // The matrices of a mapping point into it, the others are copied before they are freed
+    keys.Assign(N,x.ptr<float>(),y.ptr<float>(),angle.ptr<float>(),octave.ptr<unsigned char>(),
+                bDistorted ? rawX.ptr<float>() : NULL,bDistorted ? rawY.ptr<float>() : NULL,pBase!=NULL);
+    return true;
+}
+
+KeyFrame* MapSerializer::ReadKeyFrame(std::istream &f, Map* pMap, MapDatabase* pMapDB, uint32_t nVersion, const char* pBase)
+{
+    KeyFrame* pKF = new KeyFrame();
+    pKF->mpMap = pMap;
+    pKF->mpKeyFrameDB = pMap->GetKeyFrameDatabase();
+    pKF->mpORBvocabulary = pMapDB->getVocab();
+
+    uint64_t nId, nFrameId;
+    int32_t nMinX, nMinY, nMaxX, nMaxY, nGridCols, nGridRows, nScaleLevels, nCols, nRows;
+    cv::Mat Tcw;
+    std::vector<cv::KeyPoint> vKeys, vKeysUn;
+    bool bOK = BinaryIO::ReadPod(f,nId) && BinaryIO::ReadPod(f,nFrameId) && BinaryIO::ReadPod(f,pKF->mTimeStamp) &&
+            BinaryIO::ReadPod(f,pKF->fx) && BinaryIO::ReadPod(f,pKF->fy) && BinaryIO::ReadPod(f,pKF->cx) && BinaryIO::ReadPod(f,pKF->cy) &&
+            (nVersion>=3 || BinaryIO::Read(f,pKF->mK)) &&
+            BinaryIO::ReadPod(f,nMinX) && BinaryIO::ReadPod(f,nMinY) && BinaryIO::ReadPod(f,nMaxX) && BinaryIO::ReadPod(f,nMaxY) &&
+            BinaryIO::ReadPod(f,nGridCols) && BinaryIO::ReadPod(f,nGridRows) &&
+            BinaryIO::ReadPod(f,pKF->mfGridElementWidthInv) && BinaryIO::ReadPod(f,pKF->mfGridElementHeightInv) &&
+            BinaryIO::ReadPod(f,nScaleLevels) && BinaryIO::ReadPodVector(f,pKF->mvScaleFactors) &&
+            BinaryIO::ReadPodVector(f,pKF->mvLevelSigma2) && BinaryIO::ReadPodVector(f,pKF->mvInvLevelSigma2);
+    if(bOK && nVersion>=3)
+    {
+        // Quantized or aligned keypoints, the grid is rebuilt and the BoW vectors may be left to ComputeBoW
+        Tcw = cv::Mat::eye(4,4,CV_32F);
+        for(int i=0; bOK && i<3; i++)
+            for(int j=0; bOK && j<4; j++)
+                bOK = BinaryIO::ReadPod(f,Tcw.at<float>(i,j));
+        uint8_t nLayout = KEYPOINTS_QUANTIZED;
+        bOK = bOK && (nVersion<5 || BinaryIO::ReadPod(f,nLayout));
+        if(bOK && nLayout==KEYPOINTS_ALIGNED)
+            bOK = ReadKeyPointArrays(f,pKF->mKeys,pBase);
+        else if(bOK && nLayout==KEYPOINTS_QUANTIZED)
+        {
+            uint8_t bDistorted;
+            bOK = BinaryIO::ReadQuantized(f,vKeysUn,nMinX,nMinY,pKF->mvScaleFactors) && BinaryIO::ReadPod(f,bDistorted) &&
+                    (bDistorted ? BinaryIO::ReadQuantized(f,vKeys,nMinX,nMinY,pKF->mvScaleFactors) : true);
+            if(bOK && !bDistorted)
+                vKeys = vKeysUn;
+            bOK = bOK && vKeys.size()==vKeysUn.size();
+            if(bOK)
+                pKF->StoreKeyPoints(vKeys,vKeysUn);
+        }
+        else
+            bOK = false;
+        uint8_t bBoW;
+        bOK = bOK && ReadDescriptors(f,pKF->mDescriptors,nVersion,pBase) && BinaryIO::ReadPod(f,bBoW) &&
+                (bBoW ? BinaryIO::Read(f,pKF->mBowVec) && BinaryIO::Read(f,pKF->mFeatVec) : true);
+        if(bOK)
+        {
+            pKF->mK = cv::Mat::eye(3,3,CV_32F);
+            pKF->mK.at<float>(0,0) = pKF->fx;
+            pKF->mK.at<float>(1,1) = pKF->fy;
+            pKF->mK.at<float>(0,2) = pKF->cx;
+            pKF->mK.at<float>(1,2) = pKF->cy;
+
+            // Same cells as Frame::PosInGrid
+            const KeyPointArray &keys = pKF->mKeys;
+            std::vector<int> vKeyCells(keys.HasPositions() ? keys.size() : 0,-1);
+            for(size_t i=0; i<vKeyCells.size(); i++)
+            {
+                const int posX = cvRound((keys.X(i)-nMinX)*pKF->mfGridElementWidthInv);
+                const int posY = cvRound((keys.Y(i)-nMinY)*pKF->mfGridElementHeightInv);
+                if(posX>=0 && posX<nGridCols && posY>=0 && posY<nGridRows)
+                    vKeyCells[i] = posX*nGridRows+posY;
+            }
+            pKF->mGrid.Build(nGridCols,nGridRows,vKeyCells);
+            nCols = nGridCols;
+            nRows = nGridRows;
+        }
+    }
+    else if(bOK)
+    {
+        bOK = BinaryIO::Read(f,Tcw) &&
+                BinaryIO::Read(f,vKeys) && BinaryIO::Read(f,vKeysUn) &&
+                BinaryIO::ReadPod(f,nCols) && BinaryIO::ReadPod(f,nRows) &&
+                BinaryIO::ReadPodVector(f,pKF->mGrid.mvCellStart) && BinaryIO::ReadPodVector(f,pKF->mGrid.mvIndices) &&
+                ReadDescriptors(f,pKF->mDescriptors,nVersion,pBase) && BinaryIO::Read(f,pKF->mBowVec) && BinaryIO::Read(f,pKF->mFeatVec);
+        if(bOK)
+            pKF->StoreKeyPoints(vKeys,vKeysUn);
+    }
+    if(bOK && nVersion>=4)
+    {
+        uint8_t bPrior;
+        bOK = BinaryIO::ReadPod(f,bPrior) &&
+                (bPrior ? BinaryIO::ReadPod(f,pKF->mPositionPrior.x) && BinaryIO::ReadPod(f,pKF->mPositionPrior.y) &&
+                          BinaryIO::ReadPod(f,pKF->mPositionPrior.z) : true);
+        pKF->mbPositionPrior = bOK && bPrior;
+    }
+    if(!bOK || Tcw.rows!=4 || Tcw.cols!=4)
+    {
+        delete pKF;
+        return NULL;
+    }
+
+    pKF->mnId = nId;
+    pKF->mnFrameId = nFrameId;
+    pKF->mnMinX = nMinX;
+    pKF->mnMinY = nMinY;
+    pKF->mnMaxX = nMaxX;
+    pKF->mnMaxY = nMaxY;
+    pKF->mnGridCols = nGridCols;
+    pKF->mnGridRows = nGridRows;
+    pKF->mnScaleLevels = nScaleLevels;
+    pKF->mGrid.mnCols = nCols;
+    pKF->mGrid.mnRows = nRows;
+    pKF->mvpMapPoints = std::vector<MapPoint*>(pKF->mKeys.size(),static_cast<MapPoint*>(NULL));
+    pKF->SetPose(Tcw);
+    // Keyframes sent without their BoW vectors
+    pKF->ComputeBoW();
+    return pKF;
+}
+
+void MapSerializer::WriteMapPoint(std::ostream &f, MapPoint* pMP)
+{
+    const Eigen::Vector3f Pos = pMP->GetWorldPosEigen();
+    const Eigen::Vector3f Normal = pMP->GetNormalEigen();
+    KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
+    MapPoint::ObservationList observations = pMP->GetObservations();
+
+    BinaryIO::WritePod(f,static_cast<uint64_t>(pMP->mnId));
+    BinaryIO::WritePod(f,static_cast<int64_t>(pMP->mnFirstKFid));
+    for(int i=0; i<3; i++)
+        BinaryIO::WritePod(f,Pos(i));
+    for(int i=0; i<3; i++)
+        BinaryIO::WritePod(f,Normal(i));
+    BinaryIO::WriteAligned(f,Converter::toCvMat(pMP->GetDescriptor()));
+    BinaryIO::WritePod(f,pMP->GetMinDistanceInvariance());
+    BinaryIO::WritePod(f,pMP->GetMaxDistanceInvariance());
+    BinaryIO::WritePod(f,static_cast<int32_t>(pMP->mnVisible));
+    BinaryIO::WritePod(f,static_cast<int32_t>(pMP->mnFound));
+    BinaryIO::WritePod(f,pRefKF ? static_cast<uint64_t>(pRefKF->mnId) : NO_ID);
+
+    BinaryIO::WritePod(f,static_cast<uint32_t>(observations.size()));
+    for(MapPoint::ObservationList::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    {
+        BinaryIO::WritePod(f,static_cast<uint64_t>(mit->first->mnId));
+        BinaryIO::WritePod(f,static_cast<uint32_t>(mit->second));
+    }
+}
+
+bool MapSerializer::ReadMapPoint(std::istream &f, Map* pMap, const KeyFrameIndex &keyFrames, MapPoint* &pMP,
+                                 uint32_t nVersion, const char* pBase)
+{
+    uint64_t nId, nRefId;
+    int64_t nFirstKFid;
+    float pos[3], normal[3], fMinDistance, fMaxDistance;
+    int32_t nVisible, nFound;
+    uint32_t nObs;
+    cv::Mat descriptor;
+    pMP = NULL;
+    bool bOK = BinaryIO::ReadPod(f,nId) && BinaryIO::ReadPod(f,nFirstKFid);
+    for(int i=0; bOK && i<3; i++)
+        bOK = BinaryIO::ReadPod(f,pos[i]);
+    for(int i=0; bOK && i<3; i++)
+        bOK = BinaryIO::ReadPod(f,normal[i]);
+    bOK = bOK && ReadDescriptors(f,descriptor,nVersion,pBase) && BinaryIO::ReadPod(f,fMinDistance) && BinaryIO::ReadPod(f,fMaxDistance) &&
+            BinaryIO::ReadPod(f,nVisible) && BinaryIO::ReadPod(f,nFound) && BinaryIO::ReadPod(f,nRefId) &&
+            BinaryIO::ReadPod(f,nObs);
+    bOK = bOK && descriptor.type()==CV_8U && descriptor.rows==1 && descriptor.cols==DBoW2::Hamming::L;
+
+    // Observations of keyframes that were not stored are dropped
+    MapPoint::ObservationList observations;
+    for(uint32_t i=0; bOK && i<nObs; i++)
+    {
+        uint64_t nKFid;
+        uint32_t idx;
+        bOK = BinaryIO::ReadPod(f,nKFid) && BinaryIO::ReadPod(f,idx);
+        KeyFrameIndex::const_iterator kit = keyFrames.find(nKFid);
+        if(bOK && kit!=keyFrames.end() && idx<kit->second->mKeys.size())
+            observations.push_back(std::make_pair(kit->second,static_cast<size_t>(idx)));
+    }
+    if(!bOK)
+        return false;
+    if(observations.empty())
+        return true;
+
+    KeyFrameIndex::const_iterator rit = keyFrames.find(nRefId);
+    KeyFrame* pRefKF = rit!=keyFrames.end() ? rit->second : observations.begin()->first;
+
+    pMP = new MapPoint(cv::Mat(3,1,CV_32F,pos).clone(),pRefKF,pMap);
+    pMP->mnId = nId;
+    pMP->mnFirstKFid = nFirstKFid;
+    pMP->mNormalVector = Eigen::Vector3f(normal[0],normal[1],normal[2]);
+    pMP->mDescriptor = Converter::toDescriptor256(descriptor);
+    pMP->mfMinDistance = fMinDistance;
+    pMP->mfMaxDistance = fMaxDistance;
+    pMP->mnVisible = nVisible;
+    pMP->mnFound = nFound;
+    // Added one by one to count the keyframes they share
+    for(MapPoint::ObservationList::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    {
+        if(pMP->FindObservation(mit->first)!=pMP->mObservations.end())
+            continue;
+        MapPoint::ChangeCovisibility(pMP->mObservations,mit->first,1);
+        pMP->mObservations.push_back(*mit);
+    }
+    pMP->CountLevelObservations();
+    return true;
+}
+
+void MapSerializer::WriteLinks(std::ostream &f, KeyFrame* pKF)
+{
+    // Map point matches, by keypoint index
+    std::vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+    std::vector<std::pair<uint32_t,uint64_t> > vMatches;
+    for(size_t i=0; i<vpMPs.size(); i++)
+        if(vpMPs[i] && !vpMPs[i]->isBad())
+            vMatches.push_back(std::make_pair(static_cast<uint32_t>(i),static_cast<uint64_t>(vpMPs[i]->mnId)));
+    BinaryIO::WritePod(f,static_cast<uint32_t>(vMatches.size()));
+    for(size_t i=0; i<vMatches.size(); i++)
+    {
+        BinaryIO::WritePod(f,vMatches[i].first);
+        BinaryIO::WritePod(f,vMatches[i].second);
+    }
+
+    // Covisibility graph, spanning tree and loop edges
+    PROFILED_LOCK(boost::shared_lock<boost::shared_mutex>, lock, pKF->mMutexConnections);
+    BinaryIO::WritePod(f,static_cast<uint32_t>(pKF->mConnectedKeyFrameWeights.size()));
+    for(std::map<KeyFrame*,int>::iterator mit=pKF->mConnectedKeyFrameWeights.begin(), mend=pKF->mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
+    {
+        BinaryIO::WritePod(f,static_cast<uint64_t>(mit->first->mnId));
+        BinaryIO::WritePod(f,static_cast<int32_t>(mit->second));
+    }
+    BinaryIO::WritePod(f,static_cast<uint8_t>(pKF->mbFirstConnection));
+    BinaryIO::WritePod(f,pKF->mpParent ? static_cast<uint64_t>(pKF->mpParent->mnId) : NO_ID);
+    BinaryIO::WritePod(f,static_cast<uint32_t>(pKF->mspChildrens.size()));
+    for(std::set<KeyFrame*>::iterator sit=pKF->mspChildrens.begin(), send=pKF->mspChildrens.end(); sit!=send; sit++)
+        BinaryIO::WritePod(f,static_cast<uint64_t>((*sit)->mnId));
+    BinaryIO::WritePod(f,static_cast<uint32_t>(pKF->mspLoopEdges.size()));
+    for(std::set<KeyFrame*>::iterator sit=pKF->mspLoopEdges.begin(), send=pKF->mspLoopEdges.end(); sit!=send; sit++)
+        BinaryIO::WritePod(f,static_cast<uint64_t>((*sit)->mnId));
+}
+
+bool MapSerializer::ReadLinks(std::istream &f, KeyFrame* pKF, const KeyFrameIndex &keyFrames, const MapPointIndex &mapPoints)
+{
+    // Links to objects that were not stored are dropped
+    uint32_t nMatches;
+    if(!BinaryIO::ReadPod(f,nMatches))
+        return false;
+    for(uint32_t i=0; i<nMatches; i++)
+    {
+        uint32_t idx;
+        uint64_t nMPid;
+        if(!BinaryIO::ReadPod(f,idx) || !BinaryIO::ReadPod(f,nMPid))
+            return false;
+        MapPointIndex::const_iterator mit = mapPoints.find(nMPid);
+        if(mit!=mapPoints.end() && idx<pKF->mvpMapPoints.size())
+            pKF->mvpMapPoints[idx] = mit->second;
+    }
+
+    uint32_t nConnections;
+    if(!BinaryIO::ReadPod(f,nConnections))
+        return false;
+    for(uint32_t i=0; i<nConnections; i++)
+    {
+        uint64_t nKFid;
+        int32_t nWeight;
+        if(!BinaryIO::ReadPod(f,nKFid) || !BinaryIO::ReadPod(f,nWeight))
+            return false;
+        KeyFrameIndex::const_iterator kit = keyFrames.find(nKFid);
+        if(kit!=keyFrames.end())
+            pKF->mConnectedKeyFrameWeights[kit->second] = nWeight;
+    }
+
+    uint8_t bFirstConnection;
+    uint64_t nParentId;
+    uint32_t nChildren, nLoopEdges;
+    if(!BinaryIO::ReadPod(f,bFirstConnection) || !BinaryIO::ReadPod(f,nParentId) || !BinaryIO::ReadPod(f,nChildren))
+        return false;
+    pKF->mbFirstConnection = bFirstConnection!=0;
+    KeyFrameIndex::const_iterator pit = keyFrames.find(nParentId);
+    pKF->mpParent = pit!=keyFrames.end() ? pit->second : NULL;
+    for(uint32_t i=0; i<nChildren; i++)
+    {
+        uint64_t nKFid;
+        if(!BinaryIO::ReadPod(f,nKFid))
+            return false;
+        KeyFrameIndex::const_iterator kit = keyFrames.find(nKFid);
+        if(kit!=keyFrames.end())
+            pKF->mspChildrens.insert(kit->second);
+    }
+    if(!BinaryIO::ReadPod(f,nLoopEdges))
+        return false;
+    for(uint32_t i=0; i<nLoopEdges; i++)
+    {
+        uint64_t nKFid;
+        if(!BinaryIO::ReadPod(f,nKFid))
+            return false;
+        KeyFrameIndex::const_iterator kit = keyFrames.find(nKFid);
+        if(kit!=keyFrames.end())
+            pKF->mspLoopEdges.insert(kit->second);
+    }
+
+    // The ordered covisibility lists are derived from the weights
+    pKF->UpdateBestCovisibles();
+    return true;
+}
+
+} //namespace ORB_SLAM
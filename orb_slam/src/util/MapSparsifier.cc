@@ -0,0 +1,237 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/MapSparsifier.h"
+#include "types/Map.h"
+#include "types/KeyFrame.h"
+#include "types/MapPoint.h"
+
+#include <algorithm>
+#include <cmath>
+#include <boost/unordered_map.hpp>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+const int MapSparsifier::RECENT_KEYFRAMES = 20;
+
+// Orders the scores by increasing value
+struct LessValue
+{
+    template<class T>
+    bool operator()(const T &a, const T &b) const {return a.value<b.value;}
+};
+
+MapSparsifier::MapSparsifier(float fCellSize, int nMaxKeyFrames, int nMaxPoints):
+    mfCellSize(max(fCellSize,0.0f)), mnMaxKeyFrames(max(nMaxKeyFrames,0)), mnMaxPoints(max(nMaxPoints,0)),
+    mnMaxRetiredKFid(0), mnRetiredKeyFrames(0), mnRetiredPoints(0)
+{
+}
+
+long long MapSparsifier::CellKey(const float* pos) const
+{
+    // 21 bits per axis, as the voxels of SpatialIndex
+    const long long mask = (1LL<<21)-1;
+    long long key = 0;
+    for(int i=0; i<3; i++)
+    {
+        const long long c = (long long)floor(pos[i]/mfCellSize);
+        key = (key<<21) | (c & mask);
+    }
+    return key;
+}
+
+void MapSparsifier::Run(Map* pMap, bool* pbAbort)
+{
+    if(!pMap || !isEnabled())
+        return;
+
+    const unsigned int nMaxKFid = pMap->GetMaxKFid();
+    if(nMaxKFid<=(unsigned int)RECENT_KEYFRAMES)
+        return;
+    mnMaxRetiredKFid = nMaxKFid-RECENT_KEYFRAMES;
+
+    if(mnMaxKeyFrames>0)
+    {
+        // Keyframes by the cell of their camera center
+        boost::unordered_map<long long,vector<KeyFrame*> > cells;
+        Map::KeyFrameSnapshot keyFrames = pMap->GetKeyFrameSnapshot();
+        for(Map::KeyFrameSnapshot::const_iterator sit=keyFrames.begin(), send=keyFrames.end(); sit!=send; sit++)
+        {
+            KeyFrame* pKF = *sit;
+            if(pKF->isBad())
+                continue;
+            PoseSnapshot pose;
+            pKF->GetPoseSnapshot(pose);
+            cells[CellKey(pose.Ow)].push_back(pKF);
+        }
+
+        for(boost::unordered_map<long long,vector<KeyFrame*> >::iterator cit=cells.begin(), cend=cells.end(); cit!=cend; cit++)
+        {
+            if(pbAbort && *pbAbort)
+                return;
+            if(cit->second.size()>(size_t)mnMaxKeyFrames)
+                SparsifyKeyFrames(cit->second,pbAbort);
+        }
+    }
+
+    if(mnMaxPoints>0)
+    {
+        // Points by the cell of their position, after the keyframe pass culled some
+        boost::unordered_map<long long,vector<MapPoint*> > cells;
+        Map::MapPointSnapshot mapPoints = pMap->GetMapPointSnapshot();
+        for(Map::MapPointSnapshot::const_iterator sit=mapPoints.begin(), send=mapPoints.end(); sit!=send; sit++)
+        {
+            MapPoint* pMP = *sit;
+            if(pMP->isBad())
+                continue;
+            const Eigen::Vector3f pos = pMP->GetWorldPosEigen();
+            cells[CellKey(pos.data())].push_back(pMP);
+        }
+
+        for(boost::unordered_map<long long,vector<MapPoint*> >::iterator cit=cells.begin(), cend=cells.end(); cit!=cend; cit++)
+        {
+            if(pbAbort && *pbAbort)
+                return;
+            if(cit->second.size()>(size_t)mnMaxPoints)
+                SparsifyPoints(cit->second);
+        }
+    }
+}
+
+void MapSparsifier::SparsifyKeyFrames(vector<KeyFrame*> &vpCell, bool* pbAbort)
+{
+    vector<KeyFrameScore> vScores;
+    while(vpCell.size()>(size_t)mnMaxKeyFrames)
+    {
+        if(pbAbort && *pbAbort)
+            return;
+
+        // Retiring a keyframe changes the redundancy and the words of the others, score again each time
+        ScoreKeyFrames(vpCell,vScores);
+
+        int nWorst = -1;
+        for(size_t i=0; i<vScores.size(); i++)
+        {
+            KeyFrame* pKF = vScores[i].pKF;
+            if(pKF->mnId==0 || pKF->mnId>mnMaxRetiredKFid || !pKF->GetLoopEdges().empty())
+                continue;
+            if(nWorst<0 || vScores[i].value<vScores[nWorst].value)
+                nWorst = i;
+        }
+        if(nWorst<0)
+            return;
+
+        KeyFrame* pKF = vScores[nWorst].pKF;
+        pKF->SetBadFlag();
+        if(pKF->isBad())
+            mnRetiredKeyFrames++;
+
+        // A keyframe used by loop closing is erased later, when it is released
+        vpCell.erase(find(vpCell.begin(),vpCell.end(),pKF));
+    }
+}
+
+void MapSparsifier::ScoreKeyFrames(const vector<KeyFrame*> &vpCell, vector<KeyFrameScore> &vScores)
+{
+    const size_t N = vpCell.size();
+    vScores.resize(N);
+
+    vector<DBoW2::FlatBowVector> vBows(N);
+    boost::unordered_map<DBoW2::WordId,int> wordKeyFrames;
+    for(size_t i=0; i<N; i++)
+    {
+        vpCell[i]->GetFlatBowVector(vBows[i]);
+        const vector<DBoW2::WordId> &ids = vBows[i].ids;
+        for(size_t j=0; j<ids.size(); j++)
+            wordKeyFrames[ids[j]]++;
+    }
+
+    for(size_t i=0; i<N; i++)
+    {
+        KeyFrame* pKF = vpCell[i];
+        KeyFrame::MapPointList pMapPoints = pKF->GetMapPointMatchList();
+        const vector<MapPoint*> &vpMapPoints = *pMapPoints;
+
+        int nMPs=0, nUnique=0, nRedundant=0;
+        for(size_t j=0, jend=vpMapPoints.size(); j<jend; j++)
+        {
+            MapPoint* pMP = vpMapPoints[j];
+            if(!pMP || pMP->isBad())
+                continue;
+            nMPs++;
+            const int nObs = pMP->Observations();
+            if(nObs<=2)
+                nUnique++;
+            else if(nObs>3 && pMP->ObservationsUpToLevel(pKF->GetKeyPointScaleLevel(j)+1)-1>=3)
+                nRedundant++;
+        }
+
+        const vector<DBoW2::WordId> &ids = vBows[i].ids;
+        int nOwnWords=0;
+        for(size_t j=0; j<ids.size(); j++)
+            if(wordKeyFrames[ids[j]]==1)
+                nOwnWords++;
+
+        float value = 0;
+        if(nMPs>0)
+            value += float(nUnique)/nMPs + 1.0f-float(nRedundant)/nMPs;
+        if(!ids.empty())
+            value += float(nOwnWords)/ids.size();
+
+        vScores[i].pKF = pKF;
+        vScores[i].value = value;
+    }
+}
+
+void MapSparsifier::SparsifyPoints(vector<MapPoint*> &vpCell)
+{
+    vector<PointScore> vScores;
+    vScores.reserve(vpCell.size());
+    for(size_t i=0; i<vpCell.size(); i++)
+    {
+        MapPoint* pMP = vpCell[i];
+        if(pMP->mnFirstKFid<0 || (long unsigned int)pMP->mnFirstKFid>mnMaxRetiredKFid)
+            continue;
+        PointScore score;
+        score.pMP = pMP;
+        score.value = pMP->Observations()+pMP->GetFoundRatio();
+        vScores.push_back(score);
+    }
+
+    // The recent points count towards the budget but are not retired
+    const size_t nExcess = vpCell.size()-mnMaxPoints;
+    if(vScores.size()>nExcess)
+        nth_element(vScores.begin(),vScores.begin()+nExcess,vScores.end(),LessValue());
+    const size_t nRetire = min(nExcess,vScores.size());
+
+    for(size_t i=0; i<nRetire; i++)
+    {
+        MapPoint* pMP = vScores[i].pMP;
+        if(pMP->isBad())
+            continue;
+        pMP->SetBadFlag();
+        mnRetiredPoints++;
+    }
+}
+
+} //namespace ORB_SLAM
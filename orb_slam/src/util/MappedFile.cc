@@ -0,0 +1,95 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/MappedFile.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace ORB_SLAM
+{
+
+MappedFile::MappedFile(): mpData(NULL), mnSize(0) {}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const std::string &filename)
+{
+    Close();
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if(fd<0)
+        return false;
+    struct stat st;
+    if(fstat(fd,&st)!=0 || st.st_size<=0)
+    {
+        close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps its own reference to the file
+    close(fd);
+    if(p==MAP_FAILED)
+        return false;
+    mpData = static_cast<const char*>(p);
+    mnSize = st.st_size;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if(mpData)
+        munmap(const_cast<char*>(mpData), mnSize);
+    mpData = NULL;
+    mnSize = 0;
+}
+
+MemoryStreamBuf::MemoryStreamBuf(const char* pData, std::size_t nSize)
+{
+    char* p = const_cast<char*>(pData);
+    setg(p, p, p+nSize);
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+    if(!(which & std::ios_base::in))
+        return pos_type(off_type(-1));
+    off_type base = 0;
+    if(dir==std::ios_base::cur)
+        base = gptr()-eback();
+    else if(dir==std::ios_base::end)
+        base = egptr()-eback();
+    const off_type pos = base+off;
+    if(pos<0 || pos>egptr()-eback())
+        return pos_type(off_type(-1));
+    setg(eback(), eback()+pos, egptr());
+    return pos_type(pos);
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+} //namespace ORB_SLAM
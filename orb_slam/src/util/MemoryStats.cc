@@ -0,0 +1,90 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/MemoryStats.h"
+
+#include <sstream>
+#include <iomanip>
+
+namespace ORB_SLAM
+{
+
+MemoryStats::MemoryStats():
+    mnKeyFrames(0), mnMapPoints(0), mnBadMapPoints(0), mnBadMapPointBytes(0)
+{
+    for(int i=0; i<N_CATEGORIES; i++)
+        mvBytes[i] = 0;
+}
+
+const char* MemoryStats::CategoryName(int category)
+{
+    static const char* names[N_CATEGORIES] = {
+        "keyframe_objects",
+        "keyframe_images",
+        "keyframe_keypoints",
+        "keyframe_descriptors",
+        "keyframe_bow",
+        "keyframe_graph",
+        "mappoint_objects",
+        "mappoint_observations",
+        "mappoint_descriptors",
+        "keyframe_database",
+        "vocabulary",
+        "local_ba",
+        "mappoint_index"
+    };
+    if(category<0 || category>=N_CATEGORIES)
+        return "unknown";
+    return names[category];
+}
+
+size_t MemoryStats::Total() const
+{
+    size_t nTotal = 0;
+    for(int i=0; i<N_CATEGORIES; i++)
+        nTotal += mvBytes[i];
+    return nTotal;
+}
+
+MemoryStats& MemoryStats::operator+=(const MemoryStats &other)
+{
+    for(int i=0; i<N_CATEGORIES; i++)
+        mvBytes[i] += other.mvBytes[i];
+    mnKeyFrames += other.mnKeyFrames;
+    mnMapPoints += other.mnMapPoints;
+    mnBadMapPoints += other.mnBadMapPoints;
+    mnBadMapPointBytes += other.mnBadMapPointBytes;
+    return *this;
+}
+
+std::string MemoryStats::ToString() const
+{
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(2);
+    for(int i=0; i<N_CATEGORIES; i++)
+        oss << CategoryName(i) << ": " << mvBytes[i]/(1024.0*1024.0) << " MB" << std::endl;
+    oss << "total: " << Total()/(1024.0*1024.0) << " MB" << std::endl;
+    oss << "keyframes: " << mnKeyFrames << ", map points: " << mnMapPoints
+        << ", bad map points: " << mnBadMapPoints << " (" << mnBadMapPointBytes/(1024.0*1024.0) << " MB)";
+    return oss.str();
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,162 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/Metrics.h"
+
+#include <ros/time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <sstream>
+
+namespace ORB_SLAM
+{
+
+// Statsd datagrams stay below the ethernet MTU
+static const size_t STATSD_MAX_DATAGRAM = 1400;
+
+Metrics* Metrics::Global()
+{
+    static Metrics metrics;
+    return &metrics;
+}
+
+Metrics::Metrics()
+{
+    for(int i=0; i<N_COUNTERS; i++)
+        mvCounters[i].store(0);
+}
+
+const char* Metrics::CounterName(int counter)
+{
+    static const char* names[N_COUNTERS] = {
+        "frames_tracked",
+        "frames_dropped",
+        "frames_shed",
+        "frames_stationary",
+        "frames_rejected",
+        "tracking_state_changes",
+        "tracking_lost",
+        "keyframes_created",
+        "keyframes_anticipated",
+        "keyframes_mapped",
+        "local_ba_interrupted",
+        "loops_detected",
+        "loops_corrected",
+        "loop_queries_skipped",
+        "merges_detected",
+        "merges_done",
+        "merge_queries_skipped",
+        "maps_refined",
+        "relocalization_attempts",
+        "relocalization_successes",
+        "relocalization_local_successes",
+        "optimizations",
+        "optimizer_iterations",
+        "optimizer_microseconds"
+    };
+    return (counter>=0 && counter<N_COUNTERS) ? names[counter] : "unknown";
+}
+
+MetricsTimer::MetricsTimer(int counter):
+    mnCounter(counter), mnStart(ros::WallTime::now().toNSec())
+{
+}
+
+MetricsTimer::~MetricsTimer()
+{
+    Metrics::Global()->Add(mnCounter,(ros::WallTime::now().toNSec()-mnStart)/1000);
+}
+
+StatsdClient::StatsdClient(const std::string &host, int port, const std::string &prefix):
+    mnSocket(-1), mstrPrefix(prefix)
+{
+    if(!mstrPrefix.empty() && mstrPrefix[mstrPrefix.size()-1]!='.')
+        mstrPrefix += '.';
+
+    std::ostringstream service;
+    service << port;
+
+    struct addrinfo hints;
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo* pResult = NULL;
+    if(getaddrinfo(host.c_str(),service.str().c_str(),&hints,&pResult)!=0 || !pResult)
+        return;
+
+    // Connected, so each datagram is a plain send
+    for(struct addrinfo* pAddr=pResult; pAddr; pAddr=pAddr->ai_next)
+    {
+        mnSocket = socket(pAddr->ai_family,pAddr->ai_socktype|SOCK_NONBLOCK,pAddr->ai_protocol);
+        if(mnSocket<0)
+            continue;
+        if(connect(mnSocket,pAddr->ai_addr,pAddr->ai_addrlen)==0)
+            break;
+        close(mnSocket);
+        mnSocket = -1;
+    }
+    freeaddrinfo(pResult);
+}
+
+StatsdClient::~StatsdClient()
+{
+    if(mnSocket>=0)
+        close(mnSocket);
+}
+
+void StatsdClient::Counter(const std::string &name, boost::uint64_t delta)
+{
+    std::ostringstream line;
+    line << mstrPrefix << name << ":" << delta << "|c";
+    AddLine(line.str());
+}
+
+void StatsdClient::Gauge(const std::string &name, double value)
+{
+    std::ostringstream line;
+    line << mstrPrefix << name << ":" << value << "|g";
+    AddLine(line.str());
+}
+
+void StatsdClient::AddLine(const std::string &line)
+{
+    if(!mBuffer.empty() && mBuffer.size()+1+line.size()>STATSD_MAX_DATAGRAM)
+        Flush();
+    if(!mBuffer.empty())
+        mBuffer += '\n';
+    mBuffer += line;
+}
+
+void StatsdClient::Flush()
+{
+    if(mnSocket>=0 && !mBuffer.empty())
+    {
+        ssize_t nSent = send(mnSocket,mBuffer.data(),mBuffer.size(),0);
+        (void)nSent;
+    }
+    mBuffer.clear();
+}
+
+} //namespace ORB_SLAM
@@ -58,10 +58,26 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <vector>
+#include <algorithm>
 
 #include "util/ORBextractor.h"
+#include "util/TaskPool.h"
 
 #include <ros/ros.h>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+// Vectorized kernels are used when the target supports them, unless ORB_SLAM_NO_SIMD is defined
+// The scalar kernels are kept as reference, both produce exactly the same output
+#if !defined(ORB_SLAM_NO_SIMD)
+#if defined(__SSE2__)
+#define ORB_SLAM_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define ORB_SLAM_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
 
 
 using namespace cv;
@@ -76,6 +92,21 @@ const int PATCH_SIZE = 31;
 const int HALF_PATCH_SIZE = 15;
 const int EDGE_THRESHOLD = 16;
 
+// Checks once if the cpu running the program supports the vectorized kernels
+static bool CpuSupportsSimd()
+{
+#if defined(ORB_SLAM_SIMD_SSE2) && defined(__GNUC__) && !defined(__clang__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#elif defined(ORB_SLAM_SIMD_SSE2) || defined(ORB_SLAM_SIMD_NEON)
+    return true;
+#else
+    return false;
+#endif
+}
+
+static const bool gbUseSimd = CpuSupportsSimd();
+
 static void
 HarrisResponses(const Mat& img, vector<KeyPoint>& pts, int blockSize, float harris_k)
 {
@@ -151,6 +182,85 @@ static float IC_Angle(const Mat& image, Point2f pt,  const vector<int> & u_max)
 }
 
 
+#if defined(ORB_SLAM_SIMD_SSE2) || defined(ORB_SLAM_SIMD_NEON)
+
+// Accumulates sum(u*(plus[u]+minus[u])) and sum(plus[u]-minus[u]) for u in [-d,d]
+// 8 pixels are processed at a time, the remaining ones with the scalar code
+static inline void IC_AccumulateRow(const uchar* plus, const uchar* minus, int d, int& sum10, int& sumDiff)
+{
+    int u = -d;
+
+#if defined(ORB_SLAM_SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i ramp = _mm_setr_epi16(0,1,2,3,4,5,6,7);
+    __m128i acc10 = zero, accDiff = zero;
+    for(; u+7<=d; u+=8)
+    {
+        __m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(plus+u)), zero);
+        __m128i m = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(minus+u)), zero);
+        __m128i w = _mm_add_epi16(_mm_set1_epi16((short)u), ramp);
+        acc10 = _mm_add_epi32(acc10, _mm_madd_epi16(_mm_add_epi16(p,m), w));
+        accDiff = _mm_add_epi32(accDiff, _mm_madd_epi16(_mm_sub_epi16(p,m), ones));
+    }
+    int CV_DECL_ALIGNED(16) buf10[4], bufDiff[4];
+    _mm_store_si128((__m128i*)buf10, acc10);
+    _mm_store_si128((__m128i*)bufDiff, accDiff);
+    sum10 += buf10[0]+buf10[1]+buf10[2]+buf10[3];
+    sumDiff += bufDiff[0]+bufDiff[1]+bufDiff[2]+bufDiff[3];
+#else
+    const int16_t rampValues[8] = {0,1,2,3,4,5,6,7};
+    const int16x4_t rampLo = vld1_s16(rampValues);
+    const int16x4_t rampHi = vld1_s16(rampValues+4);
+    int32x4_t acc10 = vdupq_n_s32(0), accDiff = vdupq_n_s32(0);
+    for(; u+7<=d; u+=8)
+    {
+        int16x8_t p = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(plus+u)));
+        int16x8_t m = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(minus+u)));
+        int16x8_t s = vaddq_s16(p,m);
+        int16x4_t wu = vdup_n_s16((int16_t)u);
+        acc10 = vmlal_s16(acc10, vget_low_s16(s), vadd_s16(wu,rampLo));
+        acc10 = vmlal_s16(acc10, vget_high_s16(s), vadd_s16(wu,rampHi));
+        accDiff = vaddq_s32(accDiff, vpaddlq_s16(vsubq_s16(p,m)));
+    }
+    sum10 += vgetq_lane_s32(acc10,0)+vgetq_lane_s32(acc10,1)+vgetq_lane_s32(acc10,2)+vgetq_lane_s32(acc10,3);
+    sumDiff += vgetq_lane_s32(accDiff,0)+vgetq_lane_s32(accDiff,1)+vgetq_lane_s32(accDiff,2)+vgetq_lane_s32(accDiff,3);
+#endif
+
+    for(; u<=d; ++u)
+    {
+        int val_plus = plus[u], val_minus = minus[u];
+        sumDiff += (val_plus - val_minus);
+        sum10 += u * (val_plus + val_minus);
+    }
+}
+
+static float IC_AngleSimd(const Mat& image, Point2f pt,  const vector<int> & u_max)
+{
+    int m_01 = 0, m_10 = 0;
+
+    const uchar* center = &image.at<uchar> (cvRound(pt.y), cvRound(pt.x));
+
+    // Treat the center line differently, v=0
+    // Passing it as both lines counts every pixel twice, so halve the result
+    int centerDiff = 0;
+    IC_AccumulateRow(center, center, HALF_PATCH_SIZE, m_10, centerDiff);
+    m_10 /= 2;
+
+    // Go line by line in the circular patch
+    int step = (int)image.step1();
+    for (int v = 1; v <= HALF_PATCH_SIZE; ++v)
+    {
+        int v_sum = 0;
+        IC_AccumulateRow(center + v*step, center - v*step, u_max[v], m_10, v_sum);
+        m_01 += v * v_sum;
+    }
+
+    return fastAtan2((float)m_01, (float)m_10);
+}
+
+#endif
+
 const float factorPI = (float)(CV_PI/180.f);
 static void computeOrbDescriptor(const KeyPoint& kpt,
                                  const Mat& img, const Point* pattern,
@@ -194,6 +304,56 @@ static void computeOrbDescriptor(const KeyPoint& kpt,
 }
 
 
+#if defined(ORB_SLAM_SIMD_SSE2) || defined(ORB_SLAM_SIMD_NEON)
+static void computeOrbDescriptorSimd(const KeyPoint& kpt,
+                                     const Mat& img, const Point* pattern,
+                                     uchar* desc)
+{
+    float angle = (float)kpt.angle*factorPI;
+    float a = (float)cos(angle), b = (float)sin(angle);
+
+    const uchar* center = &img.at<uchar>(cvRound(kpt.pt.y), cvRound(kpt.pt.x));
+    const int step = (int)img.step;
+
+    // Sample the rotated pattern, first and second point of each pair are stored apart
+    // The rotation is the same expression as in the scalar code, so samples are identical
+    uchar CV_DECL_ALIGNED(16) t0[256];
+    uchar CV_DECL_ALIGNED(16) t1[256];
+    for (int i = 0; i < 256; ++i, pattern += 2)
+    {
+        t0[i] = center[cvRound(pattern[0].x*b + pattern[0].y*a)*step + cvRound(pattern[0].x*a - pattern[0].y*b)];
+        t1[i] = center[cvRound(pattern[1].x*b + pattern[1].y*a)*step + cvRound(pattern[1].x*a - pattern[1].y*b)];
+    }
+
+    // Compare 16 pairs at a time and pack the results in two descriptor bytes
+#if defined(ORB_SLAM_SIMD_SSE2)
+    // There is no unsigned byte comparison, flip the sign bit and compare as signed
+    const __m128i signBit = _mm_set1_epi8((char)0x80);
+    for (int i = 0; i < 256; i += 16)
+    {
+        __m128i v0 = _mm_xor_si128(_mm_load_si128((const __m128i*)(t0+i)), signBit);
+        __m128i v1 = _mm_xor_si128(_mm_load_si128((const __m128i*)(t1+i)), signBit);
+        int mask = _mm_movemask_epi8(_mm_cmplt_epi8(v0,v1));
+        desc[i/8] = (uchar)(mask & 0xff);
+        desc[i/8+1] = (uchar)(mask >> 8);
+    }
+#else
+    const uint8_t bitValues[16] = {1,2,4,8,16,32,64,128,1,2,4,8,16,32,64,128};
+    const uint8x16_t bits = vld1q_u8(bitValues);
+    for (int i = 0; i < 256; i += 16)
+    {
+        uint8x16_t lt = vandq_u8(vcltq_u8(vld1q_u8(t0+i), vld1q_u8(t1+i)), bits);
+        uint8x8_t packed = vpadd_u8(vget_low_u8(lt), vget_high_u8(lt));
+        packed = vpadd_u8(packed, packed);
+        packed = vpadd_u8(packed, packed);
+        desc[i/8] = vget_lane_u8(packed, 0);
+        desc[i/8+1] = vget_lane_u8(packed, 1);
+    }
+#endif
+}
+#endif
+
+
 static int bit_pattern_31_[256*4] =
 {
     8,-3, 9,5/*mean (0), correlation (0)*/,
@@ -455,9 +615,10 @@ static int bit_pattern_31_[256*4] =
 };
 
 ORBextractor::ORBextractor(int _nfeatures, float _scaleFactor, int _nlevels, int _scoreType,
-         int _fastTh):
+         int _fastTh, int _nThreads):
     nfeatures(_nfeatures), scaleFactor(_scaleFactor), nlevels(_nlevels),
-    scoreType(_scoreType), fastTh(_fastTh)
+    scoreType(_scoreType), fastTh(_fastTh), nThreads(std::max(_nThreads,1)), firstLevel(0), mbQuadTree(false),
+    mnRequestedFeatures(_nfeatures), mnRequestedFastTh(_fastTh), mbStaticMask(false), mpPyramid(&mPyramid), mpBackend(NULL)
 {
     mvScaleFactor.resize(nlevels);
     mvScaleFactor[0]=1;
@@ -470,21 +631,7 @@ ORBextractor::ORBextractor(int _nfeatures, float _scaleFactor, int _nlevels, int
     for(int i=1; i<nlevels; i++)
         mvInvScaleFactor[i]=mvInvScaleFactor[i-1]*invScaleFactor;
 
-    mvImagePyramid.resize(nlevels);
-    mvMaskPyramid.resize(nlevels);
-
-    mnFeaturesPerLevel.resize(nlevels);
-    float factor = (float)(1.0 / scaleFactor);
-    float nDesiredFeaturesPerScale = nfeatures*(1 - factor)/(1 - (float)pow((double)factor, (double)nlevels));
-
-    int sumFeatures = 0;
-    for( int level = 0; level < nlevels-1; level++ )
-    {
-        mnFeaturesPerLevel[level] = cvRound(nDesiredFeaturesPerScale);
-        sumFeatures += mnFeaturesPerLevel[level];
-        nDesiredFeaturesPerScale *= factor;
-    }
-    mnFeaturesPerLevel[nlevels-1] = std::max(nfeatures - sumFeatures, 0);
+    ComputeFeaturesPerLevel();
 
     const int npoints = 512;
     const Point* pattern0 = (const Point*)bit_pattern_31_;
@@ -515,194 +662,471 @@ static void computeOrientation(const Mat& image, vector<KeyPoint>& keypoints, co
     for (vector<KeyPoint>::iterator keypoint = keypoints.begin(),
          keypointEnd = keypoints.end(); keypoint != keypointEnd; ++keypoint)
     {
+#if defined(ORB_SLAM_SIMD_SSE2) || defined(ORB_SLAM_SIMD_NEON)
+        if(gbUseSimd)
+            keypoint->angle = IC_AngleSimd(image, keypoint->pt, umax);
+        else
+#endif
         keypoint->angle = IC_Angle(image, keypoint->pt, umax);
     }
 }
 
 void ORBextractor::ComputeKeyPoints(vector<vector<KeyPoint> >& allKeypoints)
 {
-
     allKeypoints.resize(nlevels);
 
-    float imageRatio = (float)mvImagePyramid[0].cols/mvImagePyramid[0].rows;
-
     for (int level = 0; level < nlevels; ++level)
+        ComputeKeyPointsLevel(level, allKeypoints[level]);
+}
+
+cv::Mat ORBextractor::ComputeLevelMask(int level)
+{
+    const Mat &imageMask = mpPyramid->GetMask(level);
+    if(imageMask.empty() && mRoi.area()==0)
+        return mbStaticMask ? mvStaticMask[level] : Mat();
+
+    const Size sz = mpPyramid->GetLevel(level).size();
+    Mat levelMask;
+    if(mbStaticMask)
+        levelMask = mvStaticMask[level].clone();
+    else
+        levelMask = Mat(sz, CV_8U, Scalar(255));
+
+    if(!imageMask.empty())
+        levelMask.setTo(Scalar(0), imageMask==0);
+
+    if(mRoi.area()>0)
     {
-        const int nDesiredFeatures = mnFeaturesPerLevel[level];
+        // The region shrinks by the patch radius, so that patches lie inside
+        const float scale = mvInvScaleFactor[level];
+        const int x0 = cvRound(mRoi.x*scale)+HALF_PATCH_SIZE;
+        const int y0 = cvRound(mRoi.y*scale)+HALF_PATCH_SIZE;
+        const int x1 = cvRound((mRoi.x+mRoi.width)*scale)-HALF_PATCH_SIZE;
+        const int y1 = cvRound((mRoi.y+mRoi.height)*scale)-HALF_PATCH_SIZE;
+        const Rect roi = Rect(x0, y0, max(x1-x0,0), max(y1-y0,0)) & Rect(0, 0, sz.width, sz.height);
+
+        Mat inside = Mat::zeros(sz, CV_8U);
+        if(roi.area()>0)
+            inside(roi).setTo(Scalar(255));
+        bitwise_and(levelMask, inside, levelMask);
+    }
 
-        const int levelCols = sqrt((float)nDesiredFeatures/(5*imageRatio));
-        const int levelRows = imageRatio*levelCols;
+    return levelMask;
+}
 
-        const int minBorderX = EDGE_THRESHOLD;
-        const int minBorderY = minBorderX;
-        const int maxBorderX = mvImagePyramid[level].cols-EDGE_THRESHOLD;
-        const int maxBorderY = mvImagePyramid[level].rows-EDGE_THRESHOLD;
+// Drops the keypoints of a cell on masked pixels
+static void FilterMasked(vector<KeyPoint> &keypoints, const Mat &cellMask)
+{
+    size_t n = 0;
+    for(size_t k=0; k<keypoints.size(); k++)
+    {
+        const KeyPoint &kp = keypoints[k];
+        if(cellMask.at<uchar>(cvRound(kp.pt.y),cvRound(kp.pt.x)))
+            keypoints[n++] = kp;
+    }
+    keypoints.resize(n);
+}
 
-        const int W = maxBorderX - minBorderX;
-        const int H = maxBorderY - minBorderY;
-        const int cellW = ceil((float)W/levelCols);
-        const int cellH = ceil((float)H/levelRows);
+void ORBextractor::ComputeKeyPointsLevel(int level, vector<KeyPoint>& keypoints)
+{
+    if(mbQuadTree)
+    {
+        ComputeKeyPointsQuadTree(level,keypoints);
+        return;
+    }
 
-        const int nCells = levelRows*levelCols;
-        const int nfeaturesCell = ceil((float)nDesiredFeatures/nCells);
+    // Pixels where keypoints may be, empty if all
+    const Mat levelMask = ComputeLevelMask(level);
 
-        vector<vector<vector<KeyPoint> > > cellKeyPoints(levelRows, vector<vector<KeyPoint> >(levelCols));
+    float imageRatio = (float)mpPyramid->GetLevel(0).cols/mpPyramid->GetLevel(0).rows;
 
-        vector<vector<int> > nToRetain(levelRows,vector<int>(levelCols));
-        vector<vector<int> > nTotal(levelRows,vector<int>(levelCols));
-        vector<vector<bool> > bNoMore(levelRows,vector<bool>(levelCols,false));
-        vector<int> iniXCol(levelCols);
-        vector<int> iniYRow(levelRows);
-        int nNoMore = 0;
-        int nToDistribute = 0;
+    const int nDesiredFeatures = mnFeaturesPerLevel[level];
 
+    const int levelCols = sqrt((float)nDesiredFeatures/(5*imageRatio));
+    const int levelRows = imageRatio*levelCols;
 
-        float hY = cellH + 6;
-        float hX = cellW + 6;
+    const int minBorderX = EDGE_THRESHOLD;
+    const int minBorderY = minBorderX;
+    const int maxBorderX = mpPyramid->GetLevel(level).cols-EDGE_THRESHOLD;
+    const int maxBorderY = mpPyramid->GetLevel(level).rows-EDGE_THRESHOLD;
 
-        for(int i=0; i<levelRows; i++)
+    const int W = maxBorderX - minBorderX;
+    const int H = maxBorderY - minBorderY;
+    const int cellW = ceil((float)W/levelCols);
+    const int cellH = ceil((float)H/levelRows);
+
+    const int nCells = levelRows*levelCols;
+    const int nfeaturesCell = ceil((float)nDesiredFeatures/nCells);
+
+    vector<vector<vector<KeyPoint> > > cellKeyPoints(levelRows, vector<vector<KeyPoint> >(levelCols));
+
+    vector<vector<int> > nToRetain(levelRows,vector<int>(levelCols));
+    vector<vector<int> > nTotal(levelRows,vector<int>(levelCols));
+    vector<vector<bool> > bNoMore(levelRows,vector<bool>(levelCols,false));
+    vector<int> iniXCol(levelCols);
+    vector<int> iniYRow(levelRows);
+    int nNoMore = 0;
+    int nToDistribute = 0;
+
+
+    float hY = cellH + 6;
+    float hX = cellW + 6;
+
+    for(int i=0; i<levelRows; i++)
+    {
+        const float iniY = minBorderY + i*cellH - 3;
+        iniYRow[i] = iniY;
+
+        if(i == levelRows-1)
+        {
+            hY = maxBorderY+3-iniY;
+            if(hY<=0)
+                continue;
+        }
+
+        for(int j=0; j<levelCols; j++)
         {
-            const float iniY = minBorderY + i*cellH - 3;
-            iniYRow[i] = iniY;
+            float iniX;
 
-            if(i == levelRows-1)
+            if(i==0)
             {
-                hY = maxBorderY+3-iniY;
-                if(hY<=0)
-                    continue;
+                iniX = minBorderX + j*cellW - 3;
+                iniXCol[j] = iniX;
             }
-
-            for(int j=0; j<levelCols; j++)
+            else
             {
-                float iniX;
-
-                if(i==0)
-                {
-                    iniX = minBorderX + j*cellW - 3;
-                    iniXCol[j] = iniX;
-                }
-                else
-                {
-                    iniX = iniXCol[j];
-                }
+                iniX = iniXCol[j];
+            }
 
 
-                if(j == levelCols-1)
-                {
-                    hX = maxBorderX+3-iniX;
-                    if(hX<=0)
-                        continue;
-                }
+            if(j == levelCols-1)
+            {
+                hX = maxBorderX+3-iniX;
+                if(hX<=0)
+                    continue;
+            }
 
 
-                Mat cellImage = mvImagePyramid[level].rowRange(iniY,iniY+hY).colRange(iniX,iniX+hX);
+            Mat cellImage = mpPyramid->GetLevel(level).rowRange(iniY,iniY+hY).colRange(iniX,iniX+hX);
 
-                Mat cellMask;
-                if(!mvMaskPyramid[level].empty())
-                    cellMask = cv::Mat(mvMaskPyramid[level],Rect(iniX,iniY,hX,hY));
+            // Fully masked cells are not searched, their features are distributed to the others
+            Mat cellMask;
+            if(!levelMask.empty())
+                cellMask = cv::Mat(levelMask,Rect(iniX,iniY,cellImage.cols,cellImage.rows));
+            const bool bMasked = !cellMask.empty() && countNonZero(cellMask)==0;
 
-                cellKeyPoints[i][j].reserve(nfeaturesCell*5);
+            cellKeyPoints[i][j].reserve(nfeaturesCell*5);
 
+            if(!bMasked)
+            {
                 FAST(cellImage,cellKeyPoints[i][j],fastTh,true);
+                if(!cellMask.empty())
+                    FilterMasked(cellKeyPoints[i][j],cellMask);
+            }
 
-                if(cellKeyPoints[i][j].size()<=3)
-                {
-                    cellKeyPoints[i][j].clear();
-
-                    FAST(cellImage,cellKeyPoints[i][j],7,true);
-                }
+            if(!bMasked && cellKeyPoints[i][j].size()<=3)
+            {
+                cellKeyPoints[i][j].clear();
 
-                if( scoreType == ORB::HARRIS_SCORE )
-                {
-                    // Compute the Harris cornerness
-                    HarrisResponses(cellImage,cellKeyPoints[i][j], 7, HARRIS_K);
-                }
+                FAST(cellImage,cellKeyPoints[i][j],7,true);
+                if(!cellMask.empty())
+                    FilterMasked(cellKeyPoints[i][j],cellMask);
+            }
 
-                const int nKeys = cellKeyPoints[i][j].size();
-                nTotal[i][j] = nKeys;
+            if( scoreType == ORB::HARRIS_SCORE )
+            {
+                // Compute the Harris cornerness
+                HarrisResponses(cellImage,cellKeyPoints[i][j], 7, HARRIS_K);
+            }
 
-                if(nKeys>nfeaturesCell)
-                {
-                    nToRetain[i][j] = nfeaturesCell;
-                    bNoMore[i][j] = false;
-                }
-                else
-                {
-                    nToRetain[i][j] = nKeys;
-                    nToDistribute += nfeaturesCell-nKeys;
-                    bNoMore[i][j] = true;
-                    nNoMore++;
-                }
+            const int nKeys = cellKeyPoints[i][j].size();
+            nTotal[i][j] = nKeys;
 
+            if(nKeys>nfeaturesCell)
+            {
+                nToRetain[i][j] = nfeaturesCell;
+                bNoMore[i][j] = false;
             }
+            else
+            {
+                nToRetain[i][j] = nKeys;
+                nToDistribute += nfeaturesCell-nKeys;
+                bNoMore[i][j] = true;
+                nNoMore++;
+            }
+
         }
+    }
 
 
-        // Retain by score
+    // Retain by score
 
-        while(nToDistribute>0 && nNoMore<nCells)
-        {
-            int nNewFeaturesCell = nfeaturesCell + ceil((float)nToDistribute/(nCells-nNoMore));
-            nToDistribute = 0;
+    while(nToDistribute>0 && nNoMore<nCells)
+    {
+        int nNewFeaturesCell = nfeaturesCell + ceil((float)nToDistribute/(nCells-nNoMore));
+        nToDistribute = 0;
 
-            for(int i=0; i<levelRows; i++)
+        for(int i=0; i<levelRows; i++)
+        {
+            for(int j=0; j<levelCols; j++)
             {
-                for(int j=0; j<levelCols; j++)
+                if(!bNoMore[i][j])
                 {
-                    if(!bNoMore[i][j])
+                    if(nTotal[i][j]>nNewFeaturesCell)
+                    {
+                        nToRetain[i][j] = nNewFeaturesCell;
+                        bNoMore[i][j] = false;
+                    }
+                    else
                     {
-                        if(nTotal[i][j]>nNewFeaturesCell)
-                        {
-                            nToRetain[i][j] = nNewFeaturesCell;
-                            bNoMore[i][j] = false;
-                        }
-                        else
-                        {
-                            nToRetain[i][j] = nTotal[i][j];
-                            nToDistribute += nNewFeaturesCell-nTotal[i][j];
-                            bNoMore[i][j] = true;
-                            nNoMore++;
-                        }
+                        nToRetain[i][j] = nTotal[i][j];
+                        nToDistribute += nNewFeaturesCell-nTotal[i][j];
+                        bNoMore[i][j] = true;
+                        nNoMore++;
                     }
                 }
             }
         }
+    }
 
-        vector<KeyPoint> & keypoints = allKeypoints[level];
-        keypoints.reserve(nDesiredFeatures*2);
+    keypoints.clear();
+    keypoints.reserve(nDesiredFeatures*2);
 
-        const int scaledPatchSize = PATCH_SIZE*mvScaleFactor[level];
+    const int scaledPatchSize = PATCH_SIZE*mvScaleFactor[level];
 
-        // Retain by score and transform coordinates
-        for(int i=0; i<levelRows; i++)
+    // Retain by score and transform coordinates
+    for(int i=0; i<levelRows; i++)
+    {
+        for(int j=0; j<levelCols; j++)
         {
-            for(int j=0; j<levelCols; j++)
+            vector<KeyPoint> &keysCell = cellKeyPoints[i][j];
+            KeyPointsFilter::retainBest(keysCell,nToRetain[i][j]);
+            if((int)keysCell.size()>nToRetain[i][j])
+                keysCell.resize(nToRetain[i][j]);
+
+            for(size_t k=0, kend=keysCell.size(); k<kend; k++)
             {
-                vector<KeyPoint> &keysCell = cellKeyPoints[i][j];
-                KeyPointsFilter::retainBest(keysCell,nToRetain[i][j]);
-                if((int)keysCell.size()>nToRetain[i][j])
-                    keysCell.resize(nToRetain[i][j]);
+                keysCell[k].pt.x+=iniXCol[j];
+                keysCell[k].pt.y+=iniYRow[i];
+                keysCell[k].octave=level;
+                keysCell[k].size = scaledPatchSize;
+                keypoints.push_back(keysCell[k]);
+            }
+        }
+    }
+    if((int)keypoints.size()>nDesiredFeatures)
+    {
+        KeyPointsFilter::retainBest(keypoints,nDesiredFeatures);
+        keypoints.resize(nDesiredFeatures);
+    }
 
-                for(size_t k=0, kend=keysCell.size(); k<kend; k++)
-                {
-                    keysCell[k].pt.x+=iniXCol[j];
-                    keysCell[k].pt.y+=iniYRow[i];
-                    keysCell[k].octave=level;
-                    keysCell[k].size = scaledPatchSize;
-                    keypoints.push_back(keysCell[k]);
-                }
+    // and compute orientations
+    computeOrientation(mpPyramid->GetLevel(level), keypoints, umax);
+}
+
+// Node of the quadtree distributing the keypoints of a level, with the keypoints inside its bounds
+struct ExtractorNode
+{
+    ExtractorNode(float _x0, float _y0, float _x1, float _y1): x0(_x0), y0(_y0), x1(_x1), y1(_y1) {}
+
+    // Splits the node in four, children without keypoints are left empty
+    void Split(ExtractorNode* pChildren) const
+    {
+        const float xm = 0.5f*(x0+x1);
+        const float ym = 0.5f*(y0+y1);
+        pChildren[0] = ExtractorNode(x0,y0,xm,ym);
+        pChildren[1] = ExtractorNode(xm,y0,x1,ym);
+        pChildren[2] = ExtractorNode(x0,ym,xm,y1);
+        pChildren[3] = ExtractorNode(xm,ym,x1,y1);
+        for(size_t k=0; k<vKeys.size(); k++)
+        {
+            const KeyPoint &kp = vKeys[k];
+            const int child = (kp.pt.x<xm ? 0 : 1) + (kp.pt.y<ym ? 0 : 2);
+            pChildren[child].vKeys.push_back(kp);
+        }
+    }
+
+    // A node is split while it holds more than one keypoint and is wider than a pixel
+    bool Divisible() const
+    {
+        return vKeys.size()>1 && x1-x0>1.0f && y1-y0>1.0f;
+    }
+
+    float x0, y0, x1, y1;
+    vector<KeyPoint> vKeys;
+};
+
+static bool CompareNodeSize(const list<ExtractorNode>::iterator &a, const list<ExtractorNode>::iterator &b)
+{
+    return a->vKeys.size()>b->vKeys.size();
+}
+
+// Splits the nodes of a quadtree until there are N of them or none can be split, and keeps the best keypoint of each
+// Keypoints of crowded regions compete with each other only, sparse regions keep theirs (ORB-SLAM2 distribution)
+static void DistributeQuadTree(vector<KeyPoint> &keypoints, float minX, float maxX, float minY, float maxY, int N)
+{
+    if(keypoints.empty() || N<=0)
+    {
+        keypoints.clear();
+        return;
+    }
+
+    // Square root nodes along the longest side
+    const int nIni = max(1,cvRound((maxX-minX)/(maxY-minY)));
+    const float hX = (maxX-minX)/nIni;
+
+    list<ExtractorNode> lNodes;
+    vector<list<ExtractorNode>::iterator> vIniNodes(nIni);
+    for(int i=0; i<nIni; i++)
+    {
+        lNodes.push_back(ExtractorNode(minX+hX*i,minY,minX+hX*(i+1),maxY));
+        vIniNodes[i] = --lNodes.end();
+    }
+    for(size_t k=0; k<keypoints.size(); k++)
+    {
+        const int i = min(max((int)((keypoints[k].pt.x-minX)/hX),0),nIni-1);
+        vIniNodes[i]->vKeys.push_back(keypoints[k]);
+    }
+    for(list<ExtractorNode>::iterator lit=lNodes.begin(); lit!=lNodes.end();)
+    {
+        if(lit->vKeys.empty())
+            lit = lNodes.erase(lit);
+        else
+            lit++;
+    }
+
+    ExtractorNode children[4] = {ExtractorNode(0,0,0,0), ExtractorNode(0,0,0,0), ExtractorNode(0,0,0,0), ExtractorNode(0,0,0,0)};
+    vector<list<ExtractorNode>::iterator> vExpandable;
+
+    while((int)lNodes.size()<N)
+    {
+        const size_t nPrevious = lNodes.size();
+
+        // Count the nodes a full round of splits would give
+        vExpandable.clear();
+        for(list<ExtractorNode>::iterator lit=lNodes.begin(); lit!=lNodes.end(); lit++)
+        {
+            if(lit->Divisible())
+                vExpandable.push_back(lit);
+        }
+        if(vExpandable.empty())
+            break;
+
+        // Close to N, the most crowded nodes are split first and the splits stop at N
+        const bool bLast = lNodes.size()+3*vExpandable.size()>=(size_t)N;
+        if(bLast)
+            stable_sort(vExpandable.begin(),vExpandable.end(),CompareNodeSize);
+
+        for(size_t n=0; n<vExpandable.size(); n++)
+        {
+            vExpandable[n]->Split(children);
+            for(int c=0; c<4; c++)
+            {
+                if(!children[c].vKeys.empty())
+                    lNodes.push_back(children[c]);
             }
+            lNodes.erase(vExpandable[n]);
+
+            if(bLast && (int)lNodes.size()>=N)
+                break;
         }
-        if((int)keypoints.size()>nDesiredFeatures)
+
+        if(lNodes.size()==nPrevious)
+            break;
+    }
+
+    // Best keypoint of each node
+    keypoints.clear();
+    keypoints.reserve(lNodes.size());
+    for(list<ExtractorNode>::iterator lit=lNodes.begin(); lit!=lNodes.end(); lit++)
+    {
+        const vector<KeyPoint> &vKeys = lit->vKeys;
+        size_t best = 0;
+        for(size_t k=1; k<vKeys.size(); k++)
         {
-            KeyPointsFilter::retainBest(keypoints,nDesiredFeatures);
-            keypoints.resize(nDesiredFeatures);
+            if(vKeys[k].response>vKeys[best].response)
+                best = k;
         }
+        keypoints.push_back(vKeys[best]);
+    }
+}
+
+void ORBextractor::ComputeKeyPointsQuadTree(int level, vector<KeyPoint>& keypoints)
+{
+    // Pixels where keypoints may be, empty if all
+    const Mat levelMask = ComputeLevelMask(level);
+    const Mat &image = mpPyramid->GetLevel(level);
+
+    const int nDesiredFeatures = mnFeaturesPerLevel[level];
+
+    const int minBorderX = EDGE_THRESHOLD-3;
+    const int minBorderY = minBorderX;
+    const int maxBorderX = image.cols-EDGE_THRESHOLD+3;
+    const int maxBorderY = image.rows-EDGE_THRESHOLD+3;
+
+    keypoints.clear();
+    if(maxBorderX-minBorderX<=6 || maxBorderY-minBorderY<=6 || nDesiredFeatures<=0)
+        return;
+
+    // A single FAST pass over the level at the lowest threshold: the response of each corner is its FAST score,
+    // the highest threshold at which it is still detected, so the corners at fastTh are a subset of these
+    const int minFastTh = min(fastTh,7);
+    const Mat levelImage = image.rowRange(minBorderY,maxBorderY).colRange(minBorderX,maxBorderX);
+    vector<KeyPoint> vToDistribute;
+    vToDistribute.reserve(nDesiredFeatures*10);
+    FAST(levelImage,vToDistribute,minFastTh,true);
+
+    for(size_t k=0; k<vToDistribute.size(); k++)
+    {
+        vToDistribute[k].pt.x+=minBorderX;
+        vToDistribute[k].pt.y+=minBorderY;
+    }
+    if(!levelMask.empty())
+        FilterMasked(vToDistribute,levelMask);
+
+    // As the cells of the grid extraction, weak corners are only used where a cell has few strong ones
+    if(minFastTh<fastTh)
+    {
+        const int cellSize = 30;
+        const int nCellCols = (image.cols+cellSize-1)/cellSize;
+        const int nCellRows = (image.rows+cellSize-1)/cellSize;
+        vector<int> vnStrong(nCellCols*nCellRows,0);
+        for(size_t k=0; k<vToDistribute.size(); k++)
+        {
+            if(vToDistribute[k].response>=fastTh)
+                vnStrong[(int)(vToDistribute[k].pt.y/cellSize)*nCellCols+(int)(vToDistribute[k].pt.x/cellSize)]++;
+        }
+        size_t n = 0;
+        for(size_t k=0; k<vToDistribute.size(); k++)
+        {
+            const KeyPoint &kp = vToDistribute[k];
+            if(kp.response>=fastTh || vnStrong[(int)(kp.pt.y/cellSize)*nCellCols+(int)(kp.pt.x/cellSize)]<=3)
+                vToDistribute[n++] = kp;
+        }
+        vToDistribute.resize(n);
+    }
+
+    if(scoreType == ORB::HARRIS_SCORE)
+        HarrisResponses(image, vToDistribute, 7, HARRIS_K);
+
+    keypoints.swap(vToDistribute);
+    DistributeQuadTree(keypoints,EDGE_THRESHOLD,image.cols-EDGE_THRESHOLD,EDGE_THRESHOLD,image.rows-EDGE_THRESHOLD,nDesiredFeatures);
+
+    if((int)keypoints.size()>nDesiredFeatures)
+    {
+        KeyPointsFilter::retainBest(keypoints,nDesiredFeatures);
+        keypoints.resize(nDesiredFeatures);
+    }
+
+    const int scaledPatchSize = PATCH_SIZE*mvScaleFactor[level];
+    for(size_t k=0, kend=keypoints.size(); k<kend; k++)
+    {
+        keypoints[k].octave=level;
+        keypoints[k].size = scaledPatchSize;
     }
 
     // and compute orientations
-    for (int level = 0; level < nlevels; ++level)
-        computeOrientation(mvImagePyramid[level], allKeypoints[level], umax);
+    computeOrientation(image, keypoints, umax);
 }
 
 static void computeDescriptors(const Mat& image, vector<KeyPoint>& keypoints, Mat& descriptors,
@@ -710,10 +1134,107 @@ static void computeDescriptors(const Mat& image, vector<KeyPoint>& keypoints, Ma
 {
     descriptors = Mat::zeros((int)keypoints.size(), 32, CV_8UC1);
 
+#if defined(ORB_SLAM_SIMD_SSE2) || defined(ORB_SLAM_SIMD_NEON)
+    if(gbUseSimd)
+    {
+        for (size_t i = 0; i < keypoints.size(); i++)
+            computeOrbDescriptorSimd(keypoints[i], image, &pattern[0], descriptors.ptr((int)i));
+        return;
+    }
+#endif
+
     for (size_t i = 0; i < keypoints.size(); i++)
         computeOrbDescriptor(keypoints[i], image, &pattern[0], descriptors.ptr((int)i));
 }
 
+void ORBextractor::ComputeFeaturesPerLevel()
+{
+    mnFeaturesPerLevel.resize(nlevels);
+    float factor = (float)(1.0 / scaleFactor);
+    float nDesiredFeaturesPerScale = nfeatures*(1 - factor)/(1 - (float)pow((double)factor, (double)nlevels));
+
+    int sumFeatures = 0;
+    for( int level = 0; level < nlevels-1; level++ )
+    {
+        mnFeaturesPerLevel[level] = cvRound(nDesiredFeaturesPerScale);
+        sumFeatures += mnFeaturesPerLevel[level];
+        nDesiredFeaturesPerScale *= factor;
+    }
+    mnFeaturesPerLevel[nlevels-1] = std::max(nfeatures - sumFeatures, 0);
+}
+
+void ORBextractor::SetParameters(int _nfeatures, int _fastTh)
+{
+    boost::mutex::scoped_lock lock(mMutexParameters);
+    mnRequestedFeatures = std::max(_nfeatures,0);
+    mnRequestedFastTh = std::max(_fastTh,1);
+}
+
+int ORBextractor::GetFeatures()
+{
+    boost::mutex::scoped_lock lock(mMutexParameters);
+    return mnRequestedFeatures;
+}
+
+int ORBextractor::GetFastThreshold()
+{
+    boost::mutex::scoped_lock lock(mMutexParameters);
+    return mnRequestedFastTh;
+}
+
+void ORBextractor::SetFirstLevel(int level)
+{
+    firstLevel = std::min(std::max(level,0),nlevels-1);
+}
+
+void ORBextractor::SetStaticMask(const cv::Mat &mask)
+{
+    mvStaticMask.clear();
+    if(mask.empty())
+        return;
+
+    // The patch of a keypoint spans the same number of pixels at every level
+    const Mat kernel = getStructuringElement(MORPH_ELLIPSE, Size(2*HALF_PATCH_SIZE+1, 2*HALF_PATCH_SIZE+1));
+
+    mvStaticMask.resize(nlevels);
+    for(int level=0; level<nlevels; level++)
+    {
+        // Same level sizes as the image pyramid
+        const float scale = mvInvScaleFactor[level];
+        Size sz(cvRound((float)mask.cols*scale), cvRound((float)mask.rows*scale));
+        Mat levelMask;
+        if(level==0)
+            levelMask = mask!=0;
+        else
+            resize(mask!=0, levelMask, sz, 0, 0, INTER_NEAREST);
+        erode(levelMask, mvStaticMask[level], kernel, Point(-1,-1), 1, BORDER_CONSTANT, Scalar(255));
+    }
+}
+
+void ORBextractor::SetRoi(const cv::Rect &roi)
+{
+    boost::mutex::scoped_lock lock(mMutexParameters);
+    mRequestedRoi = roi;
+}
+
+cv::Rect ORBextractor::GetRoi()
+{
+    boost::mutex::scoped_lock lock(mMutexParameters);
+    return mRequestedRoi;
+}
+
+void ORBextractor::ApplyParameters()
+{
+    boost::mutex::scoped_lock lock(mMutexParameters);
+    fastTh = mnRequestedFastTh;
+    mRoi = mRequestedRoi;
+    if(mnRequestedFeatures!=nfeatures)
+    {
+        nfeatures = mnRequestedFeatures;
+        ComputeFeaturesPerLevel();
+    }
+}
+
 void ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPoint>& _keypoints,
                       OutputArray _descriptors)
 { 
@@ -723,11 +1244,52 @@ void ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPo
     Mat image = _image.getMat(), mask = _mask.getMat();
     assert(image.type() == CV_8UC1 );
 
+    // Parameters changed since the last image
+    ApplyParameters();
+    mbStaticMask = !mvStaticMask.empty() && mvStaticMask[0].size()==image.size();
+
+    // The backend knows of the mask of the image only, and extracts every level
+    if(mpBackend && !mbStaticMask && mRoi.area()==0 && firstLevel==0)
+    {
+        vector<KeyPoint> keypoints;
+        Mat descriptors;
+        if(mpBackend->Extract(image,mask,nfeatures,scaleFactor,nlevels,fastTh,keypoints,descriptors))
+        {
+            _keypoints.swap(keypoints);
+            if(_keypoints.empty())
+                _descriptors.release();
+            else
+                descriptors.copyTo(_descriptors);
+            return;
+        }
+    }
+
     // Pre-compute the scale pyramids
+    // Each level is resized from the previous one, so this stays sequential
     ComputePyramid(image, mask);
 
-    vector < vector<KeyPoint> > allKeypoints;
-    ComputeKeyPoints(allKeypoints);
+    vector < vector<KeyPoint> > allKeypoints(nlevels);
+    vector<Mat> allDescriptors(nlevels);
+
+    // Levels are independent once the pyramid is built
+    // Each worker takes the next free level, results are stored per level
+    int nextLevel = firstLevel;
+    boost::mutex mutexLevel;
+    const int nWorkers = std::min(nThreads, nlevels-firstLevel);
+    if(nWorkers>1)
+    {
+        TaskGroup workers(TaskPool::TRACKING);
+        for(int i=0; i<nWorkers-1; i++)
+            workers.Run(boost::bind(&ORBextractor::ExtractLevels,this,&allKeypoints,&allDescriptors,&nextLevel,&mutexLevel));
+        // The calling thread also takes its share of levels
+        ExtractLevels(&allKeypoints,&allDescriptors,&nextLevel,&mutexLevel);
+        workers.Wait();
+    }
+    else
+    {
+        for (int level = firstLevel; level < nlevels; ++level)
+            ExtractLevel(level, allKeypoints[level], allDescriptors[level]);
+    }
 
     Mat descriptors;
 
@@ -745,6 +1307,7 @@ void ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPo
     _keypoints.clear();
     _keypoints.reserve(nkeypoints);
 
+    // Merge in level order, so the output does not depend on the number of threads
     int offset = 0;
     for (int level = 0; level < nlevels; ++level)
     {
@@ -754,70 +1317,57 @@ void ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPo
         if(nkeypointsLevel==0)
             continue;
 
-        // preprocess the resized image
-        Mat& workingMat = mvImagePyramid[level];
-        GaussianBlur(workingMat, workingMat, Size(7, 7), 2, 2, BORDER_REFLECT_101);
-
-        // Compute the descriptors
-        Mat desc = descriptors.rowRange(offset, offset + nkeypointsLevel);
-        computeDescriptors(workingMat, keypoints, desc, pattern);
-
+        allDescriptors[level].copyTo(descriptors.rowRange(offset, offset + nkeypointsLevel));
         offset += nkeypointsLevel;
 
-        // Scale keypoint coordinates
-        if (level != 0)
-        {
-            float scale = mvScaleFactor[level]; //getScale(level, firstLevel, scaleFactor);
-            for (vector<KeyPoint>::iterator keypoint = keypoints.begin(),
-                 keypointEnd = keypoints.end(); keypoint != keypointEnd; ++keypoint)
-                keypoint->pt *= scale;
-        }
         // And add the keypoints to the output
         _keypoints.insert(_keypoints.end(), keypoints.begin(), keypoints.end());
     }
 }
 
-void ORBextractor::ComputePyramid(cv::Mat image, cv::Mat Mask)
+void ORBextractor::ExtractLevels(vector<vector<KeyPoint> >* pAllKeypoints, vector<Mat>* pAllDescriptors,
+                                 int* pNextLevel, boost::mutex* pMutexLevel)
 {
-    for (int level = 0; level < nlevels; ++level)
+    while(true)
     {
-        float scale = mvInvScaleFactor[level];
-        Size sz(cvRound((float)image.cols*scale), cvRound((float)image.rows*scale));
-        Size wholeSize(sz.width + EDGE_THRESHOLD*2, sz.height + EDGE_THRESHOLD*2);
-        Mat temp(wholeSize, image.type()), masktemp;
-        mvImagePyramid[level] = temp(Rect(EDGE_THRESHOLD, EDGE_THRESHOLD, sz.width, sz.height));
-
-        if( !Mask.empty() )
+        int level;
         {
-            masktemp = Mat(wholeSize, Mask.type());
-            mvMaskPyramid[level] = masktemp(Rect(EDGE_THRESHOLD, EDGE_THRESHOLD, sz.width, sz.height));
+            boost::mutex::scoped_lock lock(*pMutexLevel);
+            level = (*pNextLevel)++;
         }
 
-        // Compute the resized image
-        if( level != 0 )
-        {
-            resize(mvImagePyramid[level-1], mvImagePyramid[level], sz, 0, 0, INTER_LINEAR);
-            if (!Mask.empty())
-            {
-                resize(mvMaskPyramid[level-1], mvMaskPyramid[level], sz, 0, 0, INTER_NEAREST);
-            }
+        if(level>=nlevels)
+            break;
 
-            copyMakeBorder(mvImagePyramid[level], temp, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD,
-                           BORDER_REFLECT_101+BORDER_ISOLATED);
-            if (!Mask.empty())
-                copyMakeBorder(mvMaskPyramid[level], masktemp, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD,
-                               BORDER_CONSTANT+BORDER_ISOLATED);
-        }
-        else
-        {
-            copyMakeBorder(image, temp, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD,
-                           BORDER_REFLECT_101);
-            if( !Mask.empty() )
-                copyMakeBorder(Mask, masktemp, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD,
-                               BORDER_CONSTANT+BORDER_ISOLATED);
-        }
+        ExtractLevel(level, (*pAllKeypoints)[level], (*pAllDescriptors)[level]);
     }
+}
+
+void ORBextractor::ExtractLevel(int level, vector<KeyPoint>& keypoints, Mat& descriptors)
+{
+    // Detect, distribute and orient the keypoints of this level
+    ComputeKeyPointsLevel(level, keypoints);
 
+    if(keypoints.empty())
+        return;
+
+    // Compute the descriptors on the blurred level, built with the pyramid
+    computeDescriptors(mpPyramid->GetBlurred(level), keypoints, descriptors, pattern);
+
+    // Scale keypoint coordinates
+    if (level != 0)
+    {
+        float scale = mvScaleFactor[level]; //getScale(level, firstLevel, scaleFactor);
+        for (vector<KeyPoint>::iterator keypoint = keypoints.begin(),
+             keypointEnd = keypoints.end(); keypoint != keypointEnd; ++keypoint)
+            keypoint->pt *= scale;
+    }
+}
+
+void ORBextractor::ComputePyramid(cv::Mat image, cv::Mat Mask)
+{
+    // Nothing to do if another extractor with the same scales already built it for this image
+    mpPyramid->Build(image, Mask, mvInvScaleFactor, EDGE_THRESHOLD, true);
 }
 
 } //namespace ORB_SLAM
@@ -20,8 +20,12 @@
 */
 
 #include "util/ORBmatcher.h"
+#include "util/Converter.h"
+#include "types/MapPointFusion.h"
+#include "util/DescriptorIndex.h"
 
 #include <limits.h>
+#include <algorithm>
 
 #include <ros/ros.h>
 #include <opencv2/core/core.hpp>
@@ -31,6 +35,8 @@
 
 #include<stdint-gcc.h>
 
+#include <boost/thread/tss.hpp>
+
 
 using namespace std;
 
@@ -39,43 +45,157 @@ namespace ORB_SLAM
 
 const int ORBmatcher::TH_HIGH = 100;
 const int ORBmatcher::TH_LOW = 50;
-const int ORBmatcher::HISTO_LENGTH = 30;
+const int ORBmatcher::HISTO_LENGTH;
+
+vector<int>* ORBmatcher::Workspace::ClearRotHist()
+{
+    for(int i=0;i<HISTO_LENGTH;i++)
+        vRotHist[i].clear();
+    return vRotHist;
+}
+
+void ORBmatcher::Workspace::ClearWindows()
+{
+    vWindowQueries.clear();
+    vWindowCandidates.clear();
+    vWindowOffsets.assign(1,0);
+}
 
+void ORBmatcher::Workspace::AddWindow(int query, const vector<size_t> &vCandidates)
+{
+    vWindowQueries.push_back(query);
+    vWindowCandidates.insert(vWindowCandidates.end(),vCandidates.begin(),vCandidates.end());
+    vWindowOffsets.push_back(vWindowCandidates.size());
+}
 
-ORBmatcher::ORBmatcher(float nnratio, bool checkOri): mfNNratio(nnratio), mbCheckOrientation(checkOri)
+ORBmatcher::Workspace& ORBmatcher::GetWorkspace()
 {
+    static boost::thread_specific_ptr<Workspace> workspace;
+    if(!workspace.get())
+        workspace.reset(new Workspace());
+    return *workspace;
 }
 
-int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoints, const float th)
+
+ORBmatcher::ORBmatcher(float nnratio, bool checkOri): mfNNratio(nnratio), mbCheckOrientation(checkOri), mpWorkspace(&GetWorkspace())
+{
+    memset(&mProjectionStats,0,sizeof(mProjectionStats));
+}
+
+static MatcherBackend* gpBackend = NULL;
+static size_t gnBackendMinCandidates = 0;
+
+void ORBmatcher::SetBackend(MatcherBackend* pBackend, size_t nMinCandidates)
+{
+    delete gpBackend;
+    gpBackend = pBackend;
+    gnBackendMinCandidates = nMinCandidates;
+}
+
+static float gfIndexMinWindow = 0;
+
+void ORBmatcher::SetDescriptorIndex(float fMinWindow)
+{
+    gfIndexMinWindow = fMinWindow;
+}
+
+void ORBmatcher::FeaturesInWindow(Frame &F, const uchar* d, float x, float y, float r, int minLevel, int maxLevel,
+                                  vector<size_t> &vIndices)
+{
+    if(gfIndexMinWindow<=0 || r<gfIndexMinWindow)
+    {
+        F.GetFeaturesInArea(x,y,r,vIndices,minLevel,maxLevel);
+        return;
+    }
+
+    F.GetDescriptorIndex().Query(d,vIndices);
+
+    // The near neighbors in descriptor space, filtered as the grid would
+    const bool bCheckLevels = minLevel!=-1 || maxLevel!=-1;
+    size_t nKept = 0;
+    for(size_t i=0, iend=vIndices.size(); i<iend; i++)
+    {
+        const cv::KeyPoint &kpUn = F.mvKeysUn[vIndices[i]];
+        if(bCheckLevels && (kpUn.octave<minLevel || kpUn.octave>maxLevel))
+            continue;
+        if(fabs(kpUn.pt.x-x)>r || fabs(kpUn.pt.y-y)>r)
+            continue;
+        vIndices[nKept++] = vIndices[i];
+    }
+    vIndices.resize(nKept);
+}
+
+const int* ORBmatcher::WindowDistances(const cv::Mat &Queries, const cv::Mat &Candidates)
+{
+    Workspace &ws = *mpWorkspace;
+    if(!gpBackend || ws.vWindowCandidates.empty() || ws.vWindowCandidates.size()<gnBackendMinCandidates)
+        return NULL;
+    if(!gpBackend->Distances(Queries,ws.vWindowQueries,Candidates,ws.vWindowCandidates,ws.vWindowOffsets,ws.vWindowDists))
+        return NULL;
+    return &ws.vWindowDists[0];
+}
+
+static void PackRows(const cv::Mat &Descriptors, const vector<unsigned int> &vRows, vector<uchar> &vPacked)
+{
+    const size_t L = DBoW2::Hamming::L;
+    vPacked.resize(vRows.size()*L);
+    for(size_t i=0, iend=vRows.size(); i<iend; i++)
+        memcpy(&vPacked[i*L],Descriptors.ptr<uchar>(vRows[i]),L);
+}
+
+void ORBmatcher::NodeDistances(const cv::Mat &Descriptors1, const vector<unsigned int> &vRows1,
+                               const cv::Mat &Descriptors2, const vector<unsigned int> &vRows2)
+{
+    Workspace &ws = *mpWorkspace;
+    ws.vNodeDists.resize(vRows1.size()*vRows2.size());
+    if(ws.vNodeDists.empty())
+        return;
+    PackRows(Descriptors1,vRows1,ws.vPacked1);
+    PackRows(Descriptors2,vRows2,ws.vPacked2);
+    DBoW2::Hamming::distanceMatrix(&ws.vPacked1[0],vRows1.size(),&ws.vPacked2[0],vRows2.size(),&ws.vNodeDists[0]);
+}
+
+int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoints, const LocalMapProjection &proj, const float th)
 {
     int nmatches=0;
 
     const bool bFactor = th!=1.0;
 
+    vector<size_t> &vNearIndices = mpWorkspace->vIndices;
+
+    ProjectionStats &stats = mProjectionStats;
+    memset(&stats,0,sizeof(stats));
+
     for(size_t iMP=0; iMP<vpMapPoints.size(); iMP++)
     {
-        MapPoint* pMP = vpMapPoints[iMP];
-        if(!pMP->mbTrackInView)
+        if(!proj.vbInView[iMP])
             continue;
 
+        MapPoint* pMP = vpMapPoints[iMP];
         if(pMP->isBad())
             continue;
 
-        const int &nPredictedLevel = pMP->mnTrackScaleLevel;    
+        const int nPredictedLevel = proj.vScaleLevel[iMP];
+        const float projX = proj.vProjX[iMP];
+        const float projY = proj.vProjY[iMP];
 
         // The size of the window will depend on the viewing direction
-        float r = RadiusByViewingCos(pMP->mTrackViewCos);
+        float r = RadiusByViewingCos(proj.vViewCos[iMP]);
 
         if(bFactor)
             r*=th;
 
-        vector<size_t> vNearIndices =
-                F.GetFeaturesInArea(pMP->mTrackProjX,pMP->mTrackProjY,r*F.mvScaleFactors[nPredictedLevel],nPredictedLevel-1,nPredictedLevel);
+        const float radius = r*F.mvScaleFactors[nPredictedLevel];
+        const float radius2 = radius*radius;
+
+        F.GetFeaturesInArea(projX,projY,radius,vNearIndices,nPredictedLevel-1,nPredictedLevel);
+
+        stats.nPoints++;
 
         if(vNearIndices.empty())
             continue;
 
-        cv::Mat MPdescriptor = pMP->GetDescriptor();
+        const DBoW2::Descriptor256 MPdescriptor = pMP->GetDescriptor();
 
         int bestDist=INT_MAX;
         int bestLevel= -1;
@@ -91,9 +211,28 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
             if(F.mvpMapPoints[idx])
                 continue;
 
-            cv::Mat d=F.mDescriptors.row(idx);
+            stats.nCandidates++;
+
+            // The grid returns a square window
+            const float dx = F.mvKeysUn[idx].pt.x-projX;
+            const float dy = F.mvKeysUn[idx].pt.y-projY;
+            if(dx*dx+dy*dy>radius2)
+            {
+                stats.nOutOfRadius++;
+                continue;
+            }
+
+            // The first 64 bits bound the distance from below, a candidate that cannot beat the second best changes nothing
+            const uchar* pd = F.mDescriptors.ptr<uchar>(idx);
+            const int bound = DBoW2::Hamming::distance64(MPdescriptor,pd);
+            if(bound>=bestDist2)
+            {
+                stats.nPrefiltered++;
+                continue;
+            }
 
-            const int dist = DescriptorDistance(MPdescriptor,d);
+            stats.nCompared++;
+            const int dist = DBoW2::Hamming::distance(MPdescriptor,pd);
 
             if(dist<bestDist)
             {
@@ -133,14 +272,14 @@ float ORBmatcher::RadiusByViewingCos(const float &viewCos)
 }
 
 
-bool ORBmatcher::CheckDistEpipolarLine(const cv::KeyPoint &kp1,const cv::KeyPoint &kp2,const cv::Mat &F12,const KeyFrame* pKF2)
+bool ORBmatcher::CheckDistEpipolarLine(const cv::Point2f &pt1, const cv::Point2f &pt2, int octave2, const cv::Mat &F12, const KeyFrame* pKF2)
 {
     // Epipolar line in second image l = x1'F12 = [a b c]
-    const float a = kp1.pt.x*F12.at<float>(0,0)+kp1.pt.y*F12.at<float>(1,0)+F12.at<float>(2,0);
-    const float b = kp1.pt.x*F12.at<float>(0,1)+kp1.pt.y*F12.at<float>(1,1)+F12.at<float>(2,1);
-    const float c = kp1.pt.x*F12.at<float>(0,2)+kp1.pt.y*F12.at<float>(1,2)+F12.at<float>(2,2);
+    const float a = pt1.x*F12.at<float>(0,0)+pt1.y*F12.at<float>(1,0)+F12.at<float>(2,0);
+    const float b = pt1.x*F12.at<float>(0,1)+pt1.y*F12.at<float>(1,1)+F12.at<float>(2,1);
+    const float c = pt1.x*F12.at<float>(0,2)+pt1.y*F12.at<float>(1,2)+F12.at<float>(2,2);
 
-    const float num = a*kp2.pt.x+b*kp2.pt.y+c;
+    const float num = a*pt2.x+b*pt2.y+c;
 
     const float den = a*a+b*b;
 
@@ -149,113 +288,103 @@ bool ORBmatcher::CheckDistEpipolarLine(const cv::KeyPoint &kp1,const cv::KeyPoin
 
     const float dsqr = num*num/den;
 
-    return dsqr<3.84*pKF2->GetSigma2(kp2.octave);
+    return dsqr<3.84*pKF2->GetSigma2(octave2);
 }
 
 int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPointMatches)
 {
-    vector<MapPoint*> vpMapPointsKF = pKF->GetMapPointMatches();
+    vector<MapPoint*> &vpMapPointsKF = mpWorkspace->vpMapPoints1;
+    pKF->GetMapPointMatches(vpMapPointsKF);
+    const cv::Mat DescriptorsKF = pKF->GetDescriptors();
 
-    vpMapPointMatches = vector<MapPoint*>(F.mvpMapPoints.size(),static_cast<MapPoint*>(NULL));
+    vpMapPointMatches.assign(F.mvpMapPoints.size(),static_cast<MapPoint*>(NULL));
 
-    DBoW2::FeatureVector vFeatVecKF = pKF->GetFeatureVector();
+    DBoW2::FlatFeatureVector &vFeatVecKF = mpWorkspace->featVec1;
+    pKF->GetFeatureVector(vFeatVecKF);
 
     int nmatches=0;
 
-    vector<int> rotHist[HISTO_LENGTH];
-    for(int i=0;i<HISTO_LENGTH;i++)
-        rotHist[i].reserve(500);
+    vector<int>* rotHist = mpWorkspace->ClearRotHist();
     const float factor = 1.0f/HISTO_LENGTH;
 
+    vector<unsigned int> &vRowsKF = mpWorkspace->vNodeRows1;
+    vector<unsigned int> &vIndicesF = mpWorkspace->vNodeRows2;
+    const vector<int> &vDists = mpWorkspace->vNodeDists;
+
     // We perform the matching over ORB that belong to the same vocabulary node (at a certain level)
-    DBoW2::FeatureVector::iterator KFit = vFeatVecKF.begin();
-    DBoW2::FeatureVector::iterator Fit = F.mFeatVec.begin();
-    DBoW2::FeatureVector::iterator KFend = vFeatVecKF.end();
-    DBoW2::FeatureVector::iterator Fend = F.mFeatVec.end();
+    DBoW2::CommonNodes nodes(vFeatVecKF,F.mFeatVec);
 
-    while(KFit != KFend && Fit != Fend)
+    while(nodes.next())
     {
-        if(KFit->first == Fit->first)
-        {
-            vector<unsigned int> vIndicesKF = KFit->second;
-            vector<unsigned int> vIndicesF = Fit->second;
+        vIndicesF.assign(nodes.features2(),nodes.features2()+nodes.size2());
 
-            for(size_t iKF=0, iendKF=vIndicesKF.size(); iKF<iendKF; iKF++)
-            {
-                const unsigned int realIdxKF = vIndicesKF[iKF];
+        // KeyFrame features with a MapPoint against all the Frame features of the node
+        vRowsKF.clear();
+        for(size_t iKF=0, iendKF=nodes.size1(); iKF<iendKF; iKF++)
+        {
+            const unsigned int realIdxKF = nodes.features1()[iKF];
+            MapPoint* pMP = vpMapPointsKF[realIdxKF];
+            if(pMP && !pMP->isBad())
+                vRowsKF.push_back(realIdxKF);
+        }
 
-                MapPoint* pMP = vpMapPointsKF[realIdxKF];
+        NodeDistances(DescriptorsKF,vRowsKF,F.mDescriptors,vIndicesF);
 
-                if(!pMP)
-                    continue;
+        const size_t nF = vIndicesF.size();
 
-                if(pMP->isBad())
-                    continue;
+        for(size_t iKF=0, iendKF=vRowsKF.size(); iKF<iendKF; iKF++)
+        {
+            const unsigned int realIdxKF = vRowsKF[iKF];
 
-                cv::Mat dKF= pKF->GetDescriptor(realIdxKF);
+            MapPoint* pMP = vpMapPointsKF[realIdxKF];
 
-                int bestDist1=INT_MAX;
-                int bestIdxF =-1 ;
-                int bestDist2=INT_MAX;
+            int bestDist1=INT_MAX;
+            int bestIdxF =-1 ;
+            int bestDist2=INT_MAX;
 
-                for(size_t iF=0, iendF=vIndicesF.size(); iF<iendF; iF++)
-                {
-                    const unsigned int realIdxF = vIndicesF[iF];
-
-                    if(vpMapPointMatches[realIdxF])
-                        continue;
+            for(size_t iF=0; iF<nF; iF++)
+            {
+                const unsigned int realIdxF = vIndicesF[iF];
 
-                    cv::Mat dF = F.mDescriptors.row(realIdxF).clone();
+                // Frame features taken by a previous KeyFrame feature of the node are skipped
+                if(vpMapPointMatches[realIdxF])
+                    continue;
 
-                    const int dist =  DescriptorDistance(dKF,dF);
+                const int dist = vDists[iKF*nF+iF];
 
-                    if(dist<bestDist1)
-                    {
-                        bestDist2=bestDist1;
-                        bestDist1=dist;
-                        bestIdxF=realIdxF;
-                    }
-                    else if(dist<bestDist2)
-                    {
-                        bestDist2=dist;
-                    }
+                if(dist<bestDist1)
+                {
+                    bestDist2=bestDist1;
+                    bestDist1=dist;
+                    bestIdxF=realIdxF;
+                }
+                else if(dist<bestDist2)
+                {
+                    bestDist2=dist;
                 }
+            }
 
-                if(bestDist1<=TH_LOW)
+            if(bestDist1<=TH_LOW)
+            {
+                if(static_cast<float>(bestDist1)<mfNNratio*static_cast<float>(bestDist2))
                 {
-                    if(static_cast<float>(bestDist1)<mfNNratio*static_cast<float>(bestDist2))
+                    vpMapPointMatches[bestIdxF]=pMP;
+
+                    if(mbCheckOrientation)
                     {
-                        vpMapPointMatches[bestIdxF]=pMP;
-
-                        cv::KeyPoint kp = pKF->GetKeyPointUn(realIdxKF);
-
-                        if(mbCheckOrientation)
-                        {
-                            float rot = kp.angle-F.mvKeys[bestIdxF].angle;
-                            if(rot<0.0)
-                                rot+=360.0f;
-                            int bin = round(rot*factor);
-                            if(bin==HISTO_LENGTH)
-                                bin=0;
-                            ROS_ASSERT(bin>=0 && bin<HISTO_LENGTH);
-                            rotHist[bin].push_back(bestIdxF);
-                        }
-                        nmatches++;
+                        float rot = pKF->GetKeyPointAngle(realIdxKF)-F.mvKeys[bestIdxF].angle;
+                        if(rot<0.0)
+                            rot+=360.0f;
+                        int bin = round(rot*factor);
+                        if(bin==HISTO_LENGTH)
+                            bin=0;
+                        ROS_ASSERT(bin>=0 && bin<HISTO_LENGTH);
+                        rotHist[bin].push_back(bestIdxF);
                     }
+                    nmatches++;
                 }
-
             }
 
-            KFit++;
-            Fit++;
-        }
-        else if(KFit->first < Fit->first)
-        {
-            KFit = vFeatVecKF.lower_bound(Fit->first);
-        }
-        else
-        {
-            Fit = F.mFeatVec.lower_bound(KFit->first);
         }
     }
 
@@ -293,6 +422,7 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
 
     const int nMaxLevel = pKF->GetScaleLevels()-1;
     vector<float> vfScaleFactors = pKF->GetScaleFactors();
+    const cv::Mat DescriptorsKF = pKF->GetDescriptors();
 
     // Decompose Scw
     cv::Mat sRcw = Scw.rowRange(0,3).colRange(0,3);
@@ -307,6 +437,8 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
 
     int nmatches=0;
 
+    vector<size_t> &vIndices = mpWorkspace->vIndices;
+
     // For each Candidate MapPoint Project and Match
     for(int iMP=0, iendMP=vpPoints.size(); iMP<iendMP; iMP++)
     {
@@ -362,13 +494,13 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
         // Search in a radius
         const float radius = th*pKF->GetScaleFactor(nPredictedLevel);
 
-        vector<size_t> vIndices = pKF->GetFeaturesInArea(u,v,radius);
+        pKF->GetFeaturesInArea(u,v,radius,vIndices);
 
         if(vIndices.empty())
             continue;
 
         // Match to the most similar keypoint in the radius
-        cv::Mat dMP = pMP->GetDescriptor();
+        const DBoW2::Descriptor256 dMP = pMP->GetDescriptor();
 
         int bestDist = INT_MAX;
         int bestIdx = -1;
@@ -383,7 +515,7 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
             if(kpLevel<nPredictedLevel-1 || kpLevel>nPredictedLevel)
                 continue;
 
-            cv::Mat dKF = pKF->GetDescriptor(idx);
+            const uchar* dKF = DescriptorsKF.ptr<uchar>(idx);
 
             const int dist = DescriptorDistance(dMP,dKF);
 
@@ -409,17 +541,22 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
 int ORBmatcher::WindowSearch(Frame &F1, Frame &F2, int windowSize, vector<MapPoint *> &vpMapPointMatches2, int minScaleLevel, int maxScaleLevel)
 {
     int nmatches=0;
-    vpMapPointMatches2 = vector<MapPoint*>(F2.mvpMapPoints.size(),static_cast<MapPoint*>(NULL));
-    vector<int> vnMatches21 = vector<int>(F2.mvKeysUn.size(),-1);
+    vpMapPointMatches2.assign(F2.mvpMapPoints.size(),static_cast<MapPoint*>(NULL));
+    vector<int> &vnMatches21 = mpWorkspace->vnMatches2;
+    vnMatches21.assign(F2.mvKeysUn.size(),-1);
 
-    vector<int> rotHist[HISTO_LENGTH];
-    for(int i=0;i<HISTO_LENGTH;i++)
-        rotHist[i].reserve(500);
+    vector<int>* rotHist = mpWorkspace->ClearRotHist();
     const float factor = 1.0f/HISTO_LENGTH;
 
     const bool bMinLevel = minScaleLevel>0;
     const bool bMaxLevel= maxScaleLevel<INT_MAX;
 
+    vector<size_t> &vIndices2 = mpWorkspace->vIndices;
+
+    // Windows of all the MapPoints first, so that their distances can be computed at once
+    Workspace &ws = *mpWorkspace;
+    ws.ClearWindows();
+
     for(size_t i1=0, iend1=F1.mvpMapPoints.size(); i1<iend1; i1++)
     {
         MapPoint* pMP1 = F1.mvpMapPoints[i1];
@@ -440,42 +577,53 @@ int ORBmatcher::WindowSearch(Frame &F1, Frame &F2, int windowSize, vector<MapPoi
             if(level1>maxScaleLevel)
                 continue;
 
-        vector<size_t> vIndices2 = F2.GetFeaturesInArea(kp1.pt.x,kp1.pt.y, windowSize, level1, level1);
+        FeaturesInWindow(F2,F1.mDescriptors.ptr<uchar>(i1),kp1.pt.x,kp1.pt.y,windowSize,level1,level1,vIndices2);
 
         if(vIndices2.empty())
             continue;
 
-        cv::Mat d1 = F1.mDescriptors.row(i1);
+        ws.AddWindow(i1,vIndices2);
+    }
+
+    const int* pDists = WindowDistances(F1.mDescriptors,F2.mDescriptors);
+
+    for(size_t w=0, wend=ws.vWindowQueries.size(); w<wend; w++)
+    {
+        const int i1 = ws.vWindowQueries[w];
+        const uchar* d1 = F1.mDescriptors.ptr<uchar>(i1);
 
         int bestDist = INT_MAX;
         int bestDist2 = INT_MAX;
         int bestIdx2 = -1;
 
-        for(vector<size_t>::iterator vit=vIndices2.begin(), vend=vIndices2.end(); vit!=vend; vit++)
+        for(size_t k=ws.vWindowOffsets[w], kend=ws.vWindowOffsets[w+1]; k<kend; k++)
         {
-            size_t i2 = *vit;
+            const size_t i2 = ws.vWindowCandidates[k];
 
+            // Keep only the candidates not matched yet
             if(vpMapPointMatches2[i2])
                 continue;
 
-            cv::Mat d2 = F2.mDescriptors.row(i2);
-
-            int dist = DescriptorDistance(d1,d2);
+            const int dist = pDists ? pDists[k] : DBoW2::Hamming::distance(d1,F2.mDescriptors.ptr<uchar>(i2));
 
             if(dist<bestDist)
             {
                 bestDist2=bestDist;
                 bestDist=dist;
                 bestIdx2=i2;
-            } else if(dist<bestDist2)
+            }
+            else if(dist<bestDist2)
             {
                 bestDist2=dist;
             }
         }
 
+        if(bestIdx2<0)
+            continue;
+
         if(bestDist<=bestDist2*mfNNratio && bestDist<=TH_HIGH)
         {
-            vpMapPointMatches2[bestIdx2]=pMP1;
+            vpMapPointMatches2[bestIdx2]=F1.mvpMapPoints[i1];
             vnMatches21[bestIdx2]=i1;
             nmatches++;
 
@@ -519,12 +667,20 @@ int ORBmatcher::WindowSearch(Frame &F1, Frame &F2, int windowSize, vector<MapPoi
 int ORBmatcher::SearchByProjection(Frame &F1, Frame &F2, int windowSize, vector<MapPoint *> &vpMapPointMatches2)
 {
     vpMapPointMatches2 = F2.mvpMapPoints;
-    set<MapPoint*> spMapPointsAlreadyFound(vpMapPointMatches2.begin(),vpMapPointMatches2.end());
+    vector<MapPoint*> &vpAlreadyFound = mpWorkspace->vpFound;
+    vpAlreadyFound.assign(vpMapPointMatches2.begin(),vpMapPointMatches2.end());
+    sort(vpAlreadyFound.begin(),vpAlreadyFound.end());
 
     int nmatches = 0;
 
-    const cv::Mat Rc2w = F2.mTcw.rowRange(0,3).colRange(0,3);
-    const cv::Mat tc2w = F2.mTcw.rowRange(0,3).col(3);
+    const Eigen::Matrix3f Rc2w = Converter::toMatrix3f(F2.mTcw.rowRange(0,3).colRange(0,3));
+    const Eigen::Vector3f tc2w = Converter::toVector3f(F2.mTcw.rowRange(0,3).col(3));
+
+    vector<size_t> &vIndices2 = mpWorkspace->vIndices;
+
+    // Windows of all the MapPoints first, so that their distances can be computed at once
+    Workspace &ws = *mpWorkspace;
+    ws.ClearWindows();
 
     for(size_t i1=0, iend1=F1.mvpMapPoints.size(); i1<iend1; i1++)
     {
@@ -532,59 +688,68 @@ int ORBmatcher::SearchByProjection(Frame &F1, Frame &F2, int windowSize, vector<
 
         if(!pMP1)
             continue;
-        if(pMP1->isBad() || spMapPointsAlreadyFound.count(pMP1))
+        if(pMP1->isBad() || binary_search(vpAlreadyFound.begin(),vpAlreadyFound.end(),pMP1))
             continue;
 
         cv::KeyPoint kp1 = F1.mvKeysUn[i1];
         int level1 = kp1.octave;
 
-        cv::Mat x3Dw = pMP1->GetWorldPos();
-        cv::Mat x3Dc2 = Rc2w*x3Dw+tc2w;
+        const Eigen::Vector3f x3Dc2 = Rc2w*pMP1->GetWorldPosEigen()+tc2w;
 
-        const float xc2 = x3Dc2.at<float>(0);
-        const float yc2 = x3Dc2.at<float>(1);
-        const float invzc2 = 1.0/x3Dc2.at<float>(2);
+        const float xc2 = x3Dc2(0);
+        const float yc2 = x3Dc2(1);
+        const float invzc2 = 1.0/x3Dc2(2);
 
         float u2 = F2.fx*xc2*invzc2+F2.cx;
         float v2 = F2.fy*yc2*invzc2+F2.cy;
 
-        vector<size_t> vIndices2 = F2.GetFeaturesInArea(u2,v2, windowSize, level1, level1);
+        F2.GetFeaturesInArea(u2,v2,windowSize,vIndices2,level1,level1);
 
         if(vIndices2.empty())
             continue;
 
-        cv::Mat d1 = F1.mDescriptors.row(i1);
+        ws.AddWindow(i1,vIndices2);
+    }
+
+    const int* pDists = WindowDistances(F1.mDescriptors,F2.mDescriptors);
+
+    for(size_t w=0, wend=ws.vWindowQueries.size(); w<wend; w++)
+    {
+        const int i1 = ws.vWindowQueries[w];
+        const uchar* d1 = F1.mDescriptors.ptr<uchar>(i1);
 
         int bestDist = INT_MAX;
         int bestDist2 = INT_MAX;
         int bestIdx2 = -1;
 
-
-        for(vector<size_t>::iterator vit=vIndices2.begin(), vend=vIndices2.end(); vit!=vend; vit++)
+        for(size_t k=ws.vWindowOffsets[w], kend=ws.vWindowOffsets[w+1]; k<kend; k++)
         {
-            size_t i2 = *vit;
+            const size_t i2 = ws.vWindowCandidates[k];
 
+            // Keep only the candidates not matched yet
             if(vpMapPointMatches2[i2])
                 continue;
 
-            cv::Mat d2 = F2.mDescriptors.row(i2);
-
-            int dist = DescriptorDistance(d1,d2);
+            const int dist = pDists ? pDists[k] : DBoW2::Hamming::distance(d1,F2.mDescriptors.ptr<uchar>(i2));
 
             if(dist<bestDist)
             {
                 bestDist2=bestDist;
                 bestDist=dist;
                 bestIdx2=i2;
-            } else if(dist<bestDist2)
+            }
+            else if(dist<bestDist2)
             {
                 bestDist2=dist;
             }
         }
 
+        if(bestIdx2<0)
+            continue;
+
         if(static_cast<float>(bestDist)<=static_cast<float>(bestDist2)*mfNNratio && bestDist<=TH_HIGH)
         {
-            vpMapPointMatches2[bestIdx2]=pMP1;
+            vpMapPointMatches2[bestIdx2]=F1.mvpMapPoints[i1];
             nmatches++;
         }
 
@@ -596,43 +761,64 @@ int ORBmatcher::SearchByProjection(Frame &F1, Frame &F2, int windowSize, vector<
 
 
 int ORBmatcher::SearchForInitialization(Frame &F1, Frame &F2, vector<cv::Point2f> &vbPrevMatched, vector<int> &vnMatches12, int windowSize)
+{
+    vector<float> &vWindowSizes = mpWorkspace->vWindowSizes;
+    vWindowSizes.assign(F1.mvKeysUn.size(),windowSize);
+    return SearchForInitialization(F1,F2,vbPrevMatched,vnMatches12,vWindowSizes);
+}
+
+int ORBmatcher::SearchForInitialization(Frame &F1, Frame &F2, vector<cv::Point2f> &vbPrevMatched, vector<int> &vnMatches12,
+                                        const vector<float> &vWindowSizes)
 {
     int nmatches=0;
-    vnMatches12 = vector<int>(F1.mvKeysUn.size(),-1);
+    vnMatches12.assign(F1.mvKeysUn.size(),-1);
 
-    vector<int> rotHist[HISTO_LENGTH];
-    for(int i=0;i<HISTO_LENGTH;i++)
-        rotHist[i].reserve(500);
+    vector<int>* rotHist = mpWorkspace->ClearRotHist();
     const float factor = 1.0f/HISTO_LENGTH;
 
-    vector<int> vMatchedDistance(F2.mvKeysUn.size(),INT_MAX);
-    vector<int> vnMatches21(F2.mvKeysUn.size(),-1);
+    vector<int> &vMatchedDistance = mpWorkspace->vnDist;
+    vMatchedDistance.assign(F2.mvKeysUn.size(),INT_MAX);
+    vector<int> &vnMatches21 = mpWorkspace->vnMatches2;
+    vnMatches21.assign(F2.mvKeysUn.size(),-1);
+
+    vector<size_t> &vIndices2 = mpWorkspace->vIndices;
+
+    // Windows of all the features first, so that their distances can be computed at once
+    Workspace &ws = *mpWorkspace;
+    ws.ClearWindows();
 
     for(size_t i1=0, iend1=F1.mvKeysUn.size(); i1<iend1; i1++)
     {
         cv::KeyPoint kp1 = F1.mvKeysUn[i1];
         int level1 = kp1.octave;
-        if(level1>0)
+        if(level1>0 || vWindowSizes[i1]<=0)
             continue;
 
-        vector<size_t> vIndices2 = F2.GetFeaturesInArea(vbPrevMatched[i1].x,vbPrevMatched[i1].y, windowSize,level1,level1);
+        FeaturesInWindow(F2,F1.mDescriptors.ptr<uchar>(i1),vbPrevMatched[i1].x,vbPrevMatched[i1].y,vWindowSizes[i1],
+                         level1,level1,vIndices2);
 
         if(vIndices2.empty())
             continue;
 
-        cv::Mat d1 = F1.mDescriptors.row(i1);
+        ws.AddWindow(i1,vIndices2);
+    }
+
+    const int* pDists = WindowDistances(F1.mDescriptors,F2.mDescriptors);
+
+    for(size_t w=0, wend=ws.vWindowQueries.size(); w<wend; w++)
+    {
+        const int i1 = ws.vWindowQueries[w];
+        const uchar* d1 = F1.mDescriptors.ptr<uchar>(i1);
 
         int bestDist = INT_MAX;
         int bestDist2 = INT_MAX;
         int bestIdx2 = -1;
 
-        for(vector<size_t>::iterator vit=vIndices2.begin(); vit!=vIndices2.end(); vit++)
+        for(size_t k=ws.vWindowOffsets[w], kend=ws.vWindowOffsets[w+1]; k<kend; k++)
         {
-            size_t i2 = *vit;
-
-            cv::Mat d2 = F2.mDescriptors.row(i2);
+            const size_t i2 = ws.vWindowCandidates[k];
 
-            int dist = DescriptorDistance(d1,d2);
+            int dist = pDists ? pDists[k] : DBoW2::Hamming::distance(d1,F2.mDescriptors.ptr<uchar>(i2));
 
             if(vMatchedDistance[i2]<=dist)
                 continue;
@@ -714,115 +900,110 @@ int ORBmatcher::SearchForInitialization(Frame &F1, Frame &F2, vector<cv::Point2f
 
 int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &vpMatches12)
 {
-    vector<cv::KeyPoint> vKeysUn1 = pKF1->GetKeyPointsUn();
-    DBoW2::FeatureVector vFeatVec1 = pKF1->GetFeatureVector();
-    vector<MapPoint*> vpMapPoints1 = pKF1->GetMapPointMatches();
+    DBoW2::FlatFeatureVector &vFeatVec1 = mpWorkspace->featVec1;
+    pKF1->GetFeatureVector(vFeatVec1);
+    vector<MapPoint*> &vpMapPoints1 = mpWorkspace->vpMapPoints1;
+    pKF1->GetMapPointMatches(vpMapPoints1);
     cv::Mat Descriptors1 = pKF1->GetDescriptors();
 
-    vector<cv::KeyPoint> vKeysUn2 = pKF2->GetKeyPointsUn();
-    DBoW2::FeatureVector vFeatVec2 = pKF2->GetFeatureVector();
-    vector<MapPoint*> vpMapPoints2 = pKF2->GetMapPointMatches();
+    DBoW2::FlatFeatureVector &vFeatVec2 = mpWorkspace->featVec2;
+    pKF2->GetFeatureVector(vFeatVec2);
+    vector<MapPoint*> &vpMapPoints2 = mpWorkspace->vpMapPoints2;
+    pKF2->GetMapPointMatches(vpMapPoints2);
     cv::Mat Descriptors2 = pKF2->GetDescriptors();
 
-    vpMatches12 = vector<MapPoint*>(vpMapPoints1.size(),static_cast<MapPoint*>(NULL));
-    vector<bool> vbMatched2(vpMapPoints2.size(),false);
+    vpMatches12.assign(vpMapPoints1.size(),static_cast<MapPoint*>(NULL));
+    vector<bool> &vbMatched2 = mpWorkspace->vbMatched2;
+    vbMatched2.assign(vpMapPoints2.size(),false);
 
-    vector<int> rotHist[HISTO_LENGTH];
-    for(int i=0;i<HISTO_LENGTH;i++)
-        rotHist[i].reserve(500);
+    vector<int>* rotHist = mpWorkspace->ClearRotHist();
 
     const float factor = 1.0f/HISTO_LENGTH;
 
+    vector<unsigned int> &vRows1 = mpWorkspace->vNodeRows1;
+    vector<unsigned int> &vRows2 = mpWorkspace->vNodeRows2;
+    const vector<int> &vDists = mpWorkspace->vNodeDists;
+
     int nmatches = 0;
 
-    DBoW2::FeatureVector::iterator f1it = vFeatVec1.begin();
-    DBoW2::FeatureVector::iterator f2it = vFeatVec2.begin();
-    DBoW2::FeatureVector::iterator f1end = vFeatVec1.end();
-    DBoW2::FeatureVector::iterator f2end = vFeatVec2.end();
+    DBoW2::CommonNodes nodes(vFeatVec1,vFeatVec2);
 
-    while(f1it != f1end && f2it != f2end)
+    while(nodes.next())
+    {
+        // Features with a MapPoint of both keyframes in the node, all the pairs at once
+        vRows1.clear();
+        for(size_t i1=0, iend1=nodes.size1(); i1<iend1; i1++)
         {
-            if(f1it->first == f2it->first)
-            {
-                for(size_t i1=0, iend1=f1it->second.size(); i1<iend1; i1++)
-                {
-                    size_t idx1 = f1it->second[i1];
-
-                    MapPoint* pMP1 = vpMapPoints1[idx1];
-                    if(!pMP1)
-                        continue;
-                    if(pMP1->isBad())
-                        continue;
+            const unsigned int idx1 = nodes.features1()[i1];
+            MapPoint* pMP1 = vpMapPoints1[idx1];
+            if(pMP1 && !pMP1->isBad())
+                vRows1.push_back(idx1);
+        }
+        vRows2.clear();
+        for(size_t i2=0, iend2=nodes.size2(); i2<iend2; i2++)
+        {
+            const unsigned int idx2 = nodes.features2()[i2];
+            MapPoint* pMP2 = vpMapPoints2[idx2];
+            if(pMP2 && !pMP2->isBad())
+                vRows2.push_back(idx2);
+        }
 
-                    cv::Mat d1 = Descriptors1.row(idx1);
+        NodeDistances(Descriptors1,vRows1,Descriptors2,vRows2);
 
-                    int bestDist1=INT_MAX;
-                    int bestIdx2 =-1 ;
-                    int bestDist2=INT_MAX;
+        const size_t n2 = vRows2.size();
 
-                    for(size_t i2=0, iend2=f2it->second.size(); i2<iend2; i2++)
-                    {
-                        size_t idx2 = f2it->second[i2];
+        for(size_t i1=0, iend1=vRows1.size(); i1<iend1; i1++)
+        {
+            size_t idx1 = vRows1[i1];
 
-                        MapPoint* pMP2 = vpMapPoints2[idx2];
+            int bestDist1=INT_MAX;
+            int bestIdx2 =-1 ;
+            int bestDist2=INT_MAX;
 
-                        if(vbMatched2[idx2] || !pMP2)
-                            continue;
+            for(size_t i2=0; i2<n2; i2++)
+            {
+                size_t idx2 = vRows2[i2];
 
-                        if(pMP2->isBad())
-                            continue;
+                if(vbMatched2[idx2])
+                    continue;
 
-                        cv::Mat d2 = Descriptors2.row(idx2);
+                int dist = vDists[i1*n2+i2];
 
-                        int dist = DescriptorDistance(d1,d2);
+                if(dist<bestDist1)
+                {
+                    bestDist2=bestDist1;
+                    bestDist1=dist;
+                    bestIdx2=idx2;
+                }
+                else if(dist<bestDist2)
+                {
+                    bestDist2=dist;
+                }
+            }
 
-                        if(dist<bestDist1)
-                        {
-                            bestDist2=bestDist1;
-                            bestDist1=dist;
-                            bestIdx2=idx2;
-                        }
-                        else if(dist<bestDist2)
-                        {
-                            bestDist2=dist;
-                        }
-                    }
+            if(bestDist1<TH_LOW)
+            {
+                if(static_cast<float>(bestDist1)<mfNNratio*static_cast<float>(bestDist2))
+                {
+                    vpMatches12[idx1]=vpMapPoints2[bestIdx2];
+                    vbMatched2[bestIdx2]=true;
 
-                    if(bestDist1<TH_LOW)
+                    if(mbCheckOrientation)
                     {
-                        if(static_cast<float>(bestDist1)<mfNNratio*static_cast<float>(bestDist2))
-                        {
-                            vpMatches12[idx1]=vpMapPoints2[bestIdx2];
-                            vbMatched2[bestIdx2]=true;
-
-                            if(mbCheckOrientation)
-                            {
-                                float rot = vKeysUn1[idx1].angle-vKeysUn2[bestIdx2].angle;
-                                if(rot<0.0)
-                                    rot+=360.0f;
-                                int bin = round(rot*factor);
-                                if(bin==HISTO_LENGTH)
-                                    bin=0;
-                                ROS_ASSERT(bin>=0 && bin<HISTO_LENGTH);
-                                rotHist[bin].push_back(idx1);
-                            }
-                            nmatches++;
-                        }
+                        float rot = pKF1->GetKeyPointAngle(idx1)-pKF2->GetKeyPointAngle(bestIdx2);
+                        if(rot<0.0)
+                            rot+=360.0f;
+                        int bin = round(rot*factor);
+                        if(bin==HISTO_LENGTH)
+                            bin=0;
+                        ROS_ASSERT(bin>=0 && bin<HISTO_LENGTH);
+                        rotHist[bin].push_back(idx1);
                     }
+                    nmatches++;
                 }
-
-                f1it++;
-                f2it++;
-            }
-            else if(f1it->first < f2it->first)
-            {
-                f1it = vFeatVec1.lower_bound(f2it->first);
-            }
-            else
-            {
-                f2it = vFeatVec2.lower_bound(f1it->first);
             }
         }
+    }
 
     if(mbCheckOrientation)
     {
@@ -852,123 +1033,109 @@ int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
 int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F12,
 vector<cv::KeyPoint> &vMatchedKeys1, vector<cv::KeyPoint> &vMatchedKeys2, vector<pair<size_t, size_t> > &vMatchedPairs)
 {
-    vector<MapPoint*> vpMapPoints1 = pKF1->GetMapPointMatches();
-    vector<cv::KeyPoint> vKeysUn1 = pKF1->GetKeyPointsUn();
+    vector<MapPoint*> &vpMapPoints1 = mpWorkspace->vpMapPoints1;
+    pKF1->GetMapPointMatches(vpMapPoints1);
+    const KeyPointArray &keys1 = pKF1->GetKeyPointArray();
     cv::Mat Descriptors1 = pKF1->GetDescriptors();
-    DBoW2::FeatureVector vFeatVec1 = pKF1->GetFeatureVector();
+    DBoW2::FlatFeatureVector &vFeatVec1 = mpWorkspace->featVec1;
+    pKF1->GetFeatureVector(vFeatVec1);
 
-    vector<MapPoint*> vpMapPoints2 = pKF2->GetMapPointMatches();
-    vector<cv::KeyPoint> vKeysUn2 = pKF2->GetKeyPointsUn();
+    vector<MapPoint*> &vpMapPoints2 = mpWorkspace->vpMapPoints2;
+    pKF2->GetMapPointMatches(vpMapPoints2);
+    const KeyPointArray &keys2 = pKF2->GetKeyPointArray();
     cv::Mat Descriptors2 = pKF2->GetDescriptors();
-    DBoW2::FeatureVector vFeatVec2 = pKF2->GetFeatureVector();
+    DBoW2::FlatFeatureVector &vFeatVec2 = mpWorkspace->featVec2;
+    pKF2->GetFeatureVector(vFeatVec2);
 
     // Find matches between not tracked keypoints
     // Matching speeded-up by ORB Vocabulary
     // Compare only ORB that share the same node
 
     int nmatches=0;
-    vector<bool> vbMatched2(vKeysUn2.size(),false);
-    vector<int> vMatches12(vKeysUn1.size(),-1);
+    vector<bool> &vbMatched2 = mpWorkspace->vbMatched2;
+    vbMatched2.assign(keys2.size(),false);
+    vector<int> &vMatches12 = mpWorkspace->vnMatches1;
+    vMatches12.assign(keys1.size(),-1);
 
-    vector<int> rotHist[HISTO_LENGTH];
-    for(int i=0;i<HISTO_LENGTH;i++)
-        rotHist[i].reserve(500);
+    vector<int>* rotHist = mpWorkspace->ClearRotHist();
 
     const float factor = 1.0f/HISTO_LENGTH;
 
-    DBoW2::FeatureVector::iterator f1it = vFeatVec1.begin();
-    DBoW2::FeatureVector::iterator f2it = vFeatVec2.begin();
-    DBoW2::FeatureVector::iterator f1end = vFeatVec1.end();
-    DBoW2::FeatureVector::iterator f2end = vFeatVec2.end();
+    DBoW2::CommonNodes nodes(vFeatVec1,vFeatVec2);
 
-    while(f1it!=f1end && f2it!=f2end)
+    while(nodes.next())
     {
-        if(f1it->first == f2it->first)
+        for(size_t i1=0, iend1=nodes.size1(); i1<iend1; i1++)
         {
-            for(size_t i1=0, iend1=f1it->second.size(); i1<iend1; i1++)
-            {
-                size_t idx1 = f1it->second[i1];
+            size_t idx1 = nodes.features1()[i1];
 
-                MapPoint* pMP1 = vpMapPoints1[idx1];
+            MapPoint* pMP1 = vpMapPoints1[idx1];
 
-                // If there is already a MapPoint skip
-                if(pMP1)
-                    continue;
+            // If there is already a MapPoint skip
+            if(pMP1)
+                continue;
 
-                const cv::KeyPoint &kp1 = vKeysUn1[idx1];
+            const cv::Point2f pt1 = keys1.Pt(idx1);
 
-                cv::Mat d1 = Descriptors1.row(idx1);
+            cv::Mat d1 = Descriptors1.row(idx1);
 
-                vector<pair<int,size_t> > vDistIndex;
+            vector<pair<int,size_t> > vDistIndex;
 
-                for(size_t i2=0, iend2=f2it->second.size(); i2<iend2; i2++)
-                {
-                    size_t idx2 = f2it->second[i2];
+            for(size_t i2=0, iend2=nodes.size2(); i2<iend2; i2++)
+            {
+                size_t idx2 = nodes.features2()[i2];
 
-                    MapPoint* pMP2 = vpMapPoints2[idx2];
+                MapPoint* pMP2 = vpMapPoints2[idx2];
 
-                    // If we have already matched or there is a MapPoint skip
-                    if(vbMatched2[idx2] || pMP2)
-                        continue;
+                // If we have already matched or there is a MapPoint skip
+                if(vbMatched2[idx2] || pMP2)
+                    continue;
 
-                    cv::Mat d2 = Descriptors2.row(idx2);
+                cv::Mat d2 = Descriptors2.row(idx2);
 
-                    const int dist = DescriptorDistance(d1,d2);
+                const int dist = DescriptorDistance(d1,d2);
 
-                    if(dist>TH_LOW)
-                        continue;
+                if(dist>TH_LOW)
+                    continue;
 
-                    vDistIndex.push_back(make_pair(dist,idx2));
-                }
+                vDistIndex.push_back(make_pair(dist,idx2));
+            }
 
-                if(vDistIndex.empty())
-                    continue;
+            if(vDistIndex.empty())
+                continue;
+
+            sort(vDistIndex.begin(),vDistIndex.end());
+            int BestDist = vDistIndex.front().first;
+            int DistTh = round(2*BestDist);
 
-                sort(vDistIndex.begin(),vDistIndex.end());
-                int BestDist = vDistIndex.front().first;
-                int DistTh = round(2*BestDist);
+            for(size_t id=0; id<vDistIndex.size(); id++)
+            {
+                if(vDistIndex[id].first>DistTh)
+                    break;
 
-                for(size_t id=0; id<vDistIndex.size(); id++)
+                int currentIdx2 = vDistIndex[id].second;
+                if(CheckDistEpipolarLine(pt1,keys2.Pt(currentIdx2),keys2.Octave(currentIdx2),F12,pKF2))
                 {
-                    if(vDistIndex[id].first>DistTh)
-                        break;
+                    vbMatched2[currentIdx2]=true;
+                    vMatches12[idx1]=currentIdx2;
+                    nmatches++;
 
-                    int currentIdx2 = vDistIndex[id].second;
-                    cv::KeyPoint &kp2 = vKeysUn2[currentIdx2];
-                    if(CheckDistEpipolarLine(kp1,kp2,F12,pKF2))
+                    if(mbCheckOrientation)
                     {
-                        vbMatched2[currentIdx2]=true;
-                        vMatches12[idx1]=currentIdx2;
-                        nmatches++;
-
-                        if(mbCheckOrientation)
-                        {
-                            float rot = kp1.angle-kp2.angle;
-                            if(rot<0.0)
-                                rot+=360.0f;
-                            int bin = round(rot*factor);
-                            if(bin==HISTO_LENGTH)
-                                bin=0;
-                            ROS_ASSERT(bin>=0 && bin<HISTO_LENGTH);
-                            rotHist[bin].push_back(idx1);
-                        }
-
-                        break;
+                        float rot = keys1.Angle(idx1)-keys2.Angle(currentIdx2);
+                        if(rot<0.0)
+                            rot+=360.0f;
+                        int bin = round(rot*factor);
+                        if(bin==HISTO_LENGTH)
+                            bin=0;
+                        ROS_ASSERT(bin>=0 && bin<HISTO_LENGTH);
+                        rotHist[bin].push_back(idx1);
                     }
 
+                    break;
                 }
-            }
 
-            f1it++;
-            f2it++;
-        }
-        else if(f1it->first < f2it->first)
-        {
-            f1it = vFeatVec1.lower_bound(f2it->first);
-        }
-        else
-        {
-            f2it = vFeatVec2.lower_bound(f1it->first);
+            }
         }
     }
 
@@ -1005,8 +1172,8 @@ vector<cv::KeyPoint> &vMatchedKeys1, vector<cv::KeyPoint> &vMatchedKeys2, vector
         if(vMatches12[i]<0)
             continue;
 
-        vMatchedKeys1.push_back(vKeysUn1[i]);
-        vMatchedKeys2.push_back(vKeysUn2[vMatches12[i]]);
+        vMatchedKeys1.push_back(pKF1->GetKeyPointUn(i));
+        vMatchedKeys2.push_back(pKF2->GetKeyPointUn(vMatches12[i]));
         vMatchedPairs.push_back(make_pair(i,vMatches12[i]));
     }
 
@@ -1015,21 +1182,68 @@ vector<cv::KeyPoint> &vMatchedKeys1, vector<cv::KeyPoint> &vMatchedKeys2, vector
 
 int ORBmatcher::Fuse(KeyFrame *pKF, vector<MapPoint *> &vpMapPoints, float th)
 {
-    cv::Mat Rcw = pKF->GetRotation();
-    cv::Mat tcw = pKF->GetTranslation();
+    // One consistent pose for all the points
+    PoseSnapshot pose;
+    pKF->GetPoseSnapshot(pose);
 
-    const float &fx = pKF->fx;
-    const float &fy = pKF->fy;
-    const float &cx = pKF->cx;
-    const float &cy = pKF->cy;
+    vector<float> vfScaleFactors = pKF->GetScaleFactors();
+    const cv::Mat DescriptorsKF = pKF->GetDescriptors();
+
+    int nFused=0;
+
+    vector<size_t> &vIndices = mpWorkspace->vIndices;
+    MapPointFusion fusion;
+
+    for(size_t i=0; i<vpMapPoints.size(); i++)
+    {
+        MapPoint* pMP = vpMapPoints[i];
+
+        if(!pMP)
+            continue;
+
+        if(pMP->isBad() || pMP->IsInKeyFrame(pKF))
+            continue;
+
+        int bestDist;
+        const int bestIdx = FuseSearch(pKF,pose,vfScaleFactors,DescriptorsKF,pMP,th,vIndices,bestDist);
+
+        // If there is already a MapPoint replace otherwise add new measurement
+        if(bestIdx>=0)
+        {
+            MapPoint* pMPinKF = pKF->GetMapPoint(bestIdx);
+            if(pMPinKF)
+            {
+                if(!pMPinKF->isBad())
+                    fusion.Replace(pMP,pMPinKF);
+            }
+            else
+                fusion.Add(pMP,pKF,bestIdx);
+            nFused++;
+        }
+    }
+    fusion.Commit();
+
+    return nFused;
+}
+
+int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, float th, vector<MapPoint *> &vpMatched)
+{
+    // One consistent pose for all the points
+    PoseSnapshot pose;
+    pKF->GetPoseSnapshot(pose);
 
-    const int nMaxLevel = pKF->GetScaleLevels()-1;
     vector<float> vfScaleFactors = pKF->GetScaleFactors();
+    const cv::Mat DescriptorsKF = pKF->GetDescriptors();
 
-    cv::Mat Ow = pKF->GetCameraCenter();
+    const size_t N = pKF->GetMapPointMatches().size();
+    vpMatched.assign(N,static_cast<MapPoint*>(NULL));
+    vector<int> &vMatchedDist = mpWorkspace->vnDist;
+    vMatchedDist.assign(N,INT_MAX);
 
     int nFused=0;
 
+    vector<size_t> &vIndices = mpWorkspace->vIndices;
+
     for(size_t i=0; i<vpMapPoints.size(); i++)
     {
         MapPoint* pMP = vpMapPoints[i];
@@ -1040,100 +1254,143 @@ int ORBmatcher::Fuse(KeyFrame *pKF, vector<MapPoint *> &vpMapPoints, float th)
         if(pMP->isBad() || pMP->IsInKeyFrame(pKF))
             continue;
 
-        cv::Mat p3Dw = pMP->GetWorldPos();
-        cv::Mat p3Dc = Rcw*p3Dw + tcw;
+        int bestDist;
+        const int bestIdx = FuseSearch(pKF,pose,vfScaleFactors,DescriptorsKF,pMP,th,vIndices,bestDist);
 
-        // Depth must be positive
-        if(p3Dc.at<float>(2)<0.0f)
-            continue;
+        // Only record the match, the most similar candidate of a keypoint wins
+        if(bestIdx>=0 && bestDist<vMatchedDist[bestIdx])
+        {
+            if(!vpMatched[bestIdx])
+                nFused++;
+            vpMatched[bestIdx] = pMP;
+            vMatchedDist[bestIdx] = bestDist;
+        }
+    }
 
-        const float invz = 1/p3Dc.at<float>(2);
-        const float x = p3Dc.at<float>(0)*invz;
-        const float y = p3Dc.at<float>(1)*invz;
+    return nFused;
+}
 
-        const float u = fx*x+cx;
-        const float v = fy*y+cy;
+int ORBmatcher::FuseSearch(KeyFrame *pKF, const PoseSnapshot &pose, const vector<float> &vfScaleFactors,
+                           const cv::Mat &DescriptorsKF, MapPoint *pMP, float th, vector<size_t> &vIndices, int &bestDist)
+{
+    const float &fx = pKF->fx;
+    const float &fy = pKF->fy;
+    const float &cx = pKF->cx;
+    const float &cy = pKF->cy;
 
-        // Point must be inside the image
-        if(!pKF->IsInImage(u,v))
-            continue;
+    const int nMaxLevel = pKF->GetScaleLevels()-1;
 
-        const float maxDistance = pMP->GetMaxDistanceInvariance();
-        const float minDistance = pMP->GetMinDistanceInvariance();
-        cv::Mat PO = p3Dw-Ow;
-        const float dist3D = cv::norm(PO);
+    const Eigen::Matrix3f Rcw = pose.Rcw();
+    const Eigen::Vector3f tcw = pose.tcw();
+    const Eigen::Vector3f Ow = pose.Center();
 
-        // Depth must be inside the scale pyramid of the image
-        if(dist3D<minDistance || dist3D>maxDistance )
-            continue;
+    bestDist = INT_MAX;
 
-        // Viewing angle must be less than 60 deg
-        cv::Mat Pn = pMP->GetNormal();
+    const Eigen::Vector3f p3Dw = pMP->GetWorldPosEigen();
+    const Eigen::Vector3f p3Dc = Rcw*p3Dw + tcw;
 
-        if(PO.dot(Pn)<0.5*dist3D)
-            continue;
+    // Depth must be positive
+    if(p3Dc(2)<0.0f)
+        return -1;
 
-        // Compute predicted scale level
-        const float ratio = dist3D/minDistance;
+    const float invz = 1/p3Dc(2);
+    const float x = p3Dc(0)*invz;
+    const float y = p3Dc(1)*invz;
 
-        vector<float>::iterator it = lower_bound(vfScaleFactors.begin(), vfScaleFactors.end(), ratio);
-        const int nPredictedLevel = min(static_cast<int>(it-vfScaleFactors.begin()),nMaxLevel);
+    const float u = fx*x+cx;
+    const float v = fy*y+cy;
 
-        // Search in a radius
-        const float radius = th*vfScaleFactors[nPredictedLevel];
+    // Point must be inside the image
+    if(!pKF->IsInImage(u,v))
+        return -1;
 
-        vector<size_t> vIndices = pKF->GetFeaturesInArea(u,v,radius);
+    const float maxDistance = pMP->GetMaxDistanceInvariance();
+    const float minDistance = pMP->GetMinDistanceInvariance();
+    const Eigen::Vector3f PO = p3Dw-Ow;
+    const float dist3D = PO.norm();
 
-        if(vIndices.empty())
-            continue;
+    // Depth must be inside the scale pyramid of the image
+    if(dist3D<minDistance || dist3D>maxDistance )
+        return -1;
 
-        // Match to the most similar keypoint in the radius
+    // Viewing angle must be less than 60 deg
+    const Eigen::Vector3f Pn = pMP->GetNormalEigen();
 
-        cv::Mat dMP = pMP->GetDescriptor();
+    if(PO.dot(Pn)<0.5*dist3D)
+        return -1;
 
-        int bestDist = INT_MAX;
-        int bestIdx = -1;
-        for(vector<size_t>::iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
-        {
-            const size_t idx = *vit;
-            const int kpLevel= pKF->GetKeyPointScaleLevel(idx);
+    // Compute predicted scale level
+    const float ratio = dist3D/minDistance;
 
-            if(kpLevel<nPredictedLevel-1 || kpLevel>nPredictedLevel)
-                continue;
+    vector<float>::const_iterator it = lower_bound(vfScaleFactors.begin(), vfScaleFactors.end(), ratio);
+    const int nPredictedLevel = min(static_cast<int>(it-vfScaleFactors.begin()),nMaxLevel);
 
-            cv::Mat dKF = pKF->GetDescriptor(idx);
+    // Search in a radius
+    const float radius = th*vfScaleFactors[nPredictedLevel];
 
-            const int dist = DescriptorDistance(dMP,dKF);
+    pKF->GetFeaturesInArea(u,v,radius,vIndices);
 
-            if(dist<bestDist)
-            {
-                bestDist = dist;
-                bestIdx = idx;
-            }
+    if(vIndices.empty())
+        return -1;
+
+    // Match to the most similar keypoint in the radius
+
+    const DBoW2::Descriptor256 dMP = pMP->GetDescriptor();
+
+    int bestIdx = -1;
+    for(vector<size_t>::iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
+    {
+        const size_t idx = *vit;
+        const int kpLevel= pKF->GetKeyPointScaleLevel(idx);
+
+        if(kpLevel<nPredictedLevel-1 || kpLevel>nPredictedLevel)
+            continue;
+
+        const uchar* dKF = DescriptorsKF.ptr<uchar>(idx);
+
+        const int dist = DescriptorDistance(dMP,dKF);
+
+        if(dist<bestDist)
+        {
+            bestDist = dist;
+            bestIdx = idx;
         }
+    }
 
-        // If there is already a MapPoint replace otherwise add new measurement
-        if(bestDist<=TH_LOW)
+    if(bestDist>TH_LOW)
+        return -1;
+
+    return bestIdx;
+}
+
+int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoints, float th)
+{
+    vector<MapPoint*> vpMatched;
+    const int nFused = Fuse(pKF,Scw,vpPoints,th,vpMatched);
+
+    // If there is already a MapPoint replace otherwise add new measurement
+    MapPointFusion fusion;
+    for(size_t idx=0, iend=vpMatched.size(); idx<iend; idx++)
+    {
+        MapPoint* pMP = vpMatched[idx];
+        if(!pMP)
+            continue;
+        MapPoint* pMPinKF = pKF->GetMapPoint(idx);
+        if(pMPinKF)
         {
-            MapPoint* pMPinKF = pKF->GetMapPoint(bestIdx);
-            if(pMPinKF)
-            {
-                if(!pMPinKF->isBad())
-                    pMP->Replace(pMPinKF);                
-            }
-            else
-            {
-                pMP->AddObservation(pKF,bestIdx);
-                pKF->AddMapPoint(pMP,bestIdx);
-            }
-            nFused++;
+            if(!pMPinKF->isBad())
+                fusion.Replace(pMPinKF,pMP);
         }
+        else
+            fusion.Add(pMP,pKF,idx);
     }
+    fusion.Commit();
 
     return nFused;
+
 }
 
-int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoints, float th)
+int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoints, float th, vector<MapPoint*> &vpMatched)
 {
     // Get Calibration Parameters for later projection
     const float &fx = pKF->fx;
@@ -1153,8 +1410,12 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
 
     const int nMaxLevel = pKF->GetScaleLevels()-1;
     vector<float> vfScaleFactors = pKF->GetScaleFactors();
+    const cv::Mat DescriptorsKF = pKF->GetDescriptors();
 
     int nFused=0;
+    vpMatched.assign(pKF->GetMapPointMatches().size(),static_cast<MapPoint*>(NULL));
+
+    vector<size_t> &vIndices = mpWorkspace->vIndices;
 
     // For each candidate MapPoint project and match
     for(size_t iMP=0, iendMP=vpPoints.size(); iMP<iendMP; iMP++)
@@ -1211,14 +1472,14 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
         // Search in a radius of 2.5*sigma(ScaleLevel)
         const float radius = th*pKF->GetScaleFactor(nPredictedLevel);
 
-        vector<size_t> vIndices = pKF->GetFeaturesInArea(u,v,radius);
+        pKF->GetFeaturesInArea(u,v,radius,vIndices);
 
         if(vIndices.empty())
             continue;
 
         // Match to the most similar keypoint in the radius
 
-        cv::Mat dMP = pMP->GetDescriptor();
+        const DBoW2::Descriptor256 dMP = pMP->GetDescriptor();
 
         int bestDist = INT_MAX;
         int bestIdx = -1;
@@ -1230,7 +1491,7 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
             if(kpLevel<nPredictedLevel-1 || kpLevel>nPredictedLevel)
                 continue;
 
-            cv::Mat dKF = pKF->GetDescriptor(idx);
+            const uchar* dKF = DescriptorsKF.ptr<uchar>(idx);
 
             int dist = DescriptorDistance(dMP,dKF);
 
@@ -1241,20 +1502,10 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
             }
         }
 
-        // If there is already a MapPoint replace otherwise add new measurement
-        if(bestDist<=TH_LOW)
+        // Only record the match, the first candidate of a keypoint wins
+        if(bestDist<=TH_LOW && !vpMatched[bestIdx])
         {
-            MapPoint* pMPinKF = pKF->GetMapPoint(bestIdx);
-            if(pMPinKF)
-            {
-                if(!pMPinKF->isBad())
-                    pMPinKF->Replace(pMP);
-            }
-            else
-            {
-                pMP->AddObservation(pKF,bestIdx);
-                pKF->AddMapPoint(pMP,bestIdx);
-            }
+            vpMatched[bestIdx] = pMP;
             nFused++;
         }
 
@@ -1287,18 +1538,22 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
 
     const int nMaxLevel1 = pKF1->GetScaleLevels()-1;
     vector<float> vfScaleFactors1 = pKF1->GetScaleFactors();
+    const cv::Mat Descriptors1 = pKF1->GetDescriptors();
 
     vector<MapPoint*> vpMapPoints1 = pKF1->GetMapPointMatches();
     const int N1 = vpMapPoints1.size();
 
     const int nMaxLevel2 = pKF2->GetScaleLevels()-1;
     vector<float> vfScaleFactors2 = pKF2->GetScaleFactors();
+    const cv::Mat Descriptors2 = pKF2->GetDescriptors();
 
     vector<MapPoint*> vpMapPoints2 = pKF2->GetMapPointMatches();
     const int N2 = vpMapPoints2.size();
 
-    vector<bool> vbAlreadyMatched1(N1,false);
-    vector<bool> vbAlreadyMatched2(N2,false);
+    vector<bool> &vbAlreadyMatched1 = mpWorkspace->vbMatched1;
+    vbAlreadyMatched1.assign(N1,false);
+    vector<bool> &vbAlreadyMatched2 = mpWorkspace->vbMatched2;
+    vbAlreadyMatched2.assign(N2,false);
 
     for(int i=0; i<N1; i++)
     {
@@ -1312,8 +1567,12 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
         }
     }
 
-    vector<int> vnMatch1(N1,-1);
-    vector<int> vnMatch2(N2,-1);
+    vector<int> &vnMatch1 = mpWorkspace->vnMatches1;
+    vnMatch1.assign(N1,-1);
+    vector<int> &vnMatch2 = mpWorkspace->vnMatches2;
+    vnMatch2.assign(N2,-1);
+
+    vector<size_t> &vIndices = mpWorkspace->vIndices;
 
     // Transform from KF1 to KF2 and search
     for(int i1=0; i1<N1; i1++)
@@ -1362,13 +1621,13 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
         // Search in a radius
         float radius = th*vfScaleFactors2[nPredictedLevel];
 
-        vector<size_t> vIndices = pKF2->GetFeaturesInArea(u,v,radius);
+        pKF2->GetFeaturesInArea(u,v,radius,vIndices);
 
         if(vIndices.empty())
             continue;
 
         // Match to the most similar keypoint in the radius
-        cv::Mat dMP = pMP->GetDescriptor();
+        const DBoW2::Descriptor256 dMP = pMP->GetDescriptor();
 
         int bestDist = INT_MAX;
         int bestIdx = -1;
@@ -1376,12 +1635,12 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
         {
             size_t idx = *vit;
 
-            cv::KeyPoint kp = pKF2->GetKeyPointUn(idx);
+            const int kpLevel = pKF2->GetKeyPointScaleLevel(idx);
 
-            if(kp.octave<nPredictedLevel-1 || kp.octave>nPredictedLevel)
+            if(kpLevel<nPredictedLevel-1 || kpLevel>nPredictedLevel)
                 continue;
 
-            cv::Mat dKF = pKF2->GetDescriptor(idx);
+            const uchar* dKF = Descriptors2.ptr<uchar>(idx);
 
             int dist = DescriptorDistance(dMP,dKF);
 
@@ -1447,13 +1706,13 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
         // Search in a radius of 2.5*sigma(ScaleLevel)
         float radius = th*vfScaleFactors1[nPredictedLevel];
 
-        vector<size_t> vIndices = pKF1->GetFeaturesInArea(u,v,radius);
+        pKF1->GetFeaturesInArea(u,v,radius,vIndices);
 
         if(vIndices.empty())
             continue;
 
         // Match to the most similar keypoint in the radius
-        cv::Mat dMP = pMP->GetDescriptor();
+        const DBoW2::Descriptor256 dMP = pMP->GetDescriptor();
 
         int bestDist = INT_MAX;
         int bestIdx = -1;
@@ -1461,12 +1720,12 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
         {
             size_t idx = *vit;
 
-            cv::KeyPoint kp = pKF1->GetKeyPointUn(idx);
+            const int kpLevel = pKF1->GetKeyPointScaleLevel(idx);
 
-            if(kp.octave<nPredictedLevel-1 || kp.octave>nPredictedLevel)
+            if(kpLevel<nPredictedLevel-1 || kpLevel>nPredictedLevel)
                 continue;
 
-            cv::Mat dKF = pKF1->GetDescriptor(idx);
+            const uchar* dKF = Descriptors1.ptr<uchar>(idx);
 
             int dist = DescriptorDistance(dMP,dKF);
 
@@ -1509,13 +1768,13 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
     int nmatches = 0;
 
     // Rotation Histogram (to check rotation consistency)
-    vector<int> rotHist[HISTO_LENGTH];
-    for(int i=0;i<HISTO_LENGTH;i++)
-        rotHist[i].reserve(500);
+    vector<int>* rotHist = mpWorkspace->ClearRotHist();
     const float factor = 1.0f/HISTO_LENGTH;
 
-    const cv::Mat Rcw = CurrentFrame.mTcw.rowRange(0,3).colRange(0,3);
-    const cv::Mat tcw = CurrentFrame.mTcw.rowRange(0,3).col(3);
+    const Eigen::Matrix3f Rcw = Converter::toMatrix3f(CurrentFrame.mTcw.rowRange(0,3).colRange(0,3));
+    const Eigen::Vector3f tcw = Converter::toVector3f(CurrentFrame.mTcw.rowRange(0,3).col(3));
+
+    vector<size_t> &vIndices2 = mpWorkspace->vIndices;
 
     for(size_t i=0, iend=LastFrame.mvpMapPoints.size(); i<iend; i++)
     {
@@ -1526,12 +1785,12 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
             if(!LastFrame.mvbOutlier[i])
             {
                 // Project
-                cv::Mat x3Dw = pMP->GetWorldPos();
-                cv::Mat x3Dc = Rcw*x3Dw+tcw;
+                const Eigen::Vector3f x3Dw = pMP->GetWorldPosEigen();
+                const Eigen::Vector3f x3Dc = Rcw*x3Dw+tcw;
 
-                const float xc = x3Dc.at<float>(0);
-                const float yc = x3Dc.at<float>(1);
-                const float invzc = 1.0/x3Dc.at<float>(2);
+                const float xc = x3Dc(0);
+                const float yc = x3Dc(1);
+                const float invzc = 1.0/x3Dc(2);
 
                 float u = CurrentFrame.fx*xc*invzc+CurrentFrame.cx;
                 float v = CurrentFrame.fy*yc*invzc+CurrentFrame.cy;
@@ -1546,12 +1805,12 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
                 // Search in a window. Size depends on scale
                 float radius = th*CurrentFrame.mvScaleFactors[nPredictedOctave];
 
-                vector<size_t> vIndices2 = CurrentFrame.GetFeaturesInArea(u,v, radius, nPredictedOctave-1, nPredictedOctave+1);
+                CurrentFrame.GetFeaturesInArea(u,v,radius,vIndices2,nPredictedOctave-1,nPredictedOctave+1);
 
                 if(vIndices2.empty())
                     continue;
 
-                cv::Mat dMP = LastFrame.mDescriptors.row(i);
+                const uchar* dMP = LastFrame.mDescriptors.ptr<uchar>(i);
 
                 int bestDist = INT_MAX;
                 int bestIdx2 = -1;
@@ -1562,7 +1821,7 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
                     if(CurrentFrame.mvpMapPoints[i2])
                         continue;
 
-                    cv::Mat d = CurrentFrame.mDescriptors.row(i2);
+                    const uchar* d = CurrentFrame.mDescriptors.ptr<uchar>(i2);
 
                     int dist = DescriptorDistance(dMP,d);
 
@@ -1623,17 +1882,18 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
 {
     int nmatches = 0;
 
-    const cv::Mat Rcw = CurrentFrame.mTcw.rowRange(0,3).colRange(0,3);
-    const cv::Mat tcw = CurrentFrame.mTcw.rowRange(0,3).col(3);
-    const cv::Mat Ow = -Rcw.t()*tcw;
+    const Eigen::Matrix3f Rcw = Converter::toMatrix3f(CurrentFrame.mTcw.rowRange(0,3).colRange(0,3));
+    const Eigen::Vector3f tcw = Converter::toVector3f(CurrentFrame.mTcw.rowRange(0,3).col(3));
+    const Eigen::Vector3f Ow = -Rcw.transpose()*tcw;
 
     // Rotation Histogram (to check rotation consistency)
-    vector<int> rotHist[HISTO_LENGTH];
-    for(int i=0;i<HISTO_LENGTH;i++)
-        rotHist[i].reserve(500);
+    vector<int>* rotHist = mpWorkspace->ClearRotHist();
     const float factor = 1.0f/HISTO_LENGTH;
 
-    vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+    vector<MapPoint*> &vpMPs = mpWorkspace->vpMapPoints1;
+    pKF->GetMapPointMatches(vpMPs);
+
+    vector<size_t> &vIndices2 = mpWorkspace->vIndices;
 
     for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
     {
@@ -1644,12 +1904,12 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
             if(!pMP->isBad() && !sAlreadyFound.count(pMP))
             {
                 //Project
-                cv::Mat x3Dw = pMP->GetWorldPos();
-                cv::Mat x3Dc = Rcw*x3Dw+tcw;
+                const Eigen::Vector3f x3Dw = pMP->GetWorldPosEigen();
+                const Eigen::Vector3f x3Dc = Rcw*x3Dw+tcw;
 
-                const float xc = x3Dc.at<float>(0);
-                const float yc = x3Dc.at<float>(1);
-                const float invzc = 1.0/x3Dc.at<float>(2);
+                const float xc = x3Dc(0);
+                const float yc = x3Dc(1);
+                const float invzc = 1.0/x3Dc(2);
 
                 float u = CurrentFrame.fx*xc*invzc+CurrentFrame.cx;
                 float v = CurrentFrame.fy*yc*invzc+CurrentFrame.cy;
@@ -1661,8 +1921,7 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
 
                 // Compute predicted scale level
                 float minDistance = pMP->GetMinDistanceInvariance();
-                cv::Mat PO = x3Dw-Ow;
-                float dist3D = cv::norm(PO);
+                float dist3D = (x3Dw-Ow).norm();
                 float ratio = dist3D/minDistance;
 
                 vector<float>::iterator it = lower_bound(CurrentFrame.mvScaleFactors.begin(), CurrentFrame.mvScaleFactors.end(), ratio);
@@ -1671,12 +1930,12 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
                 // Search in a window
                 float radius = th*CurrentFrame.mvScaleFactors[nPredictedLevel];
 
-                vector<size_t> vIndices2 = CurrentFrame.GetFeaturesInArea(u, v, radius, nPredictedLevel-1, nPredictedLevel+1);
+                CurrentFrame.GetFeaturesInArea(u,v,radius,vIndices2,nPredictedLevel-1,nPredictedLevel+1);
 
                 if(vIndices2.empty())
                     continue;
 
-                cv::Mat dMP = pMP->GetDescriptor();
+                const DBoW2::Descriptor256 dMP = pMP->GetDescriptor();
 
                 int bestDist = INT_MAX;
                 int bestIdx2 = -1;
@@ -1687,7 +1946,7 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
                     if(CurrentFrame.mvpMapPoints[i2])
                         continue;
 
-                    cv::Mat d = CurrentFrame.mDescriptors.row(i2);
+                    const uchar* d = CurrentFrame.mDescriptors.ptr<uchar>(i2);
 
                     int dist = DescriptorDistance(dMP,d);
 
@@ -1705,7 +1964,7 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
 
                     if(mbCheckOrientation)
                     {
-                        float rot = pKF->GetKeyPointUn(i).angle-CurrentFrame.mvKeysUn[bestIdx2].angle;
+                        float rot = pKF->GetKeyPointAngle(i)-CurrentFrame.mvKeysUn[bestIdx2].angle;
                         if(rot<0.0)
                             rot+=360.0f;
                         int bin = round(rot*factor);
@@ -1788,25 +2047,4 @@ void ORBmatcher::ComputeThreeMaxima(vector<int>* histo, const int L, int &ind1,
     }
 }
 
-
-// Bit set count operation from
-// http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetParallel
-int ORBmatcher::DescriptorDistance(const cv::Mat &a, const cv::Mat &b)
-{
-    const int *pa = a.ptr<int32_t>();
-    const int *pb = b.ptr<int32_t>();
-
-    int dist=0;
-
-    for(int i=0; i<8; i++, pa++, pb++)
-    {
-        unsigned  int v = *pa ^ *pb;
-        v = v - ((v >> 1) & 0x55555555);
-        v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
-        dist += (((v + (v >> 4)) & 0xF0F0F0F) * 0x1010101) >> 24;
-    }
-
-    return dist;
-}
-
 } //namespace ORB_SLAM
@@ -30,30 +30,241 @@
 
 #include <Eigen/StdVector>
 
+#include <cmath>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+#include <ros/ros.h>
+
 #include "util/Converter.h"
+#include "util/Trace.h"
+#include "util/AllocationStats.h"
+#include "util/Metrics.h"
+#include "util/PoolRunner.h"
 
 namespace ORB_SLAM
 {
 
-void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopFlag)
+static LevenbergSettings gLevenbergSettings;
+
+void Optimizer::SetLevenbergSettings(const LevenbergSettings &settings)
+{
+    gLevenbergSettings = settings;
+}
+
+const LevenbergSettings& Optimizer::GetLevenbergSettings()
+{
+    return gLevenbergSettings;
+}
+
+void Optimizer::Configure(g2o::SparseOptimizer &optimizer, g2o::OptimizationAlgorithmLevenberg* pAlgorithm,
+                          TaskPool::Priority priority)
+{
+    pAlgorithm->setMinRelativeDecrease(gLevenbergSettings.fMinDecrease);
+    pAlgorithm->setMaxStallIterations(gLevenbergSettings.nStallIterations);
+    pAlgorithm->setMinUpdate(gLevenbergSettings.fMinUpdate);
+    optimizer.setComputeBatchStatistics(gLevenbergSettings.bStatistics);
+    optimizer.setParallelRunner(PoolRunner::Get(priority));
+}
+
+bool Optimizer::UseIterative(size_t nKFs)
+{
+    return gLevenbergSettings.nIterativeKeyFrames>0 && nKFs>=(size_t)gLevenbergSettings.nIterativeKeyFrames;
+}
+
+void Optimizer::Report(const g2o::SparseOptimizer &optimizer, const char* name, int nIterations)
+{
+    Metrics::Global()->Add(Metrics::OPTIMIZATIONS);
+    if(nIterations>0)
+        Metrics::Global()->Add(Metrics::OPTIMIZER_ITERATIONS,nIterations);
+
+    const g2o::BatchStatisticsContainer &vStats = optimizer.batchStatistics();
+    if(!gLevenbergSettings.bStatistics || nIterations<=0 || vStats.size()<(size_t)nIterations)
+        return;
+
+    double time = 0;
+    int nSteps = 0;
+    int nLinearIterations = 0;
+    for(int i=0; i<nIterations; i++)
+    {
+        time += vStats[i].timeIteration;
+        nSteps += vStats[i].levenbergIterations;
+        nLinearIterations += vStats[i].iterationsLinearSolver;
+    }
+    ROS_DEBUG("ORB-SLAM - %s: %d edges, %d iterations, %d Levenberg steps, %d PCG iterations, chi2 %.3f -> %.3f, %.2f ms",
+              name, vStats[0].numEdges, nIterations, nSteps, nLinearIterations, vStats[0].chi2, vStats[nIterations-1].chi2,
+              time*1000);
+}
+
+// Points written back by each task
+static const size_t UPDATE_CHUNK = 256;
+
+static void UpdateMapPointRange(const vector<MapPoint*>* pvpMPs, const vector<Eigen::Vector3f>* pvPos,
+                                const MapPoint::KeyFrameCenters* pCenters, size_t nBegin, size_t nEnd)
+{
+    for(size_t i=nBegin; i<nEnd; i++)
+    {
+        MapPoint* pMP = (*pvpMPs)[i];
+        if(!pMP->isBad())
+            pMP->SetWorldPosAndNormal((*pvPos)[i],*pCenters);
+    }
+}
+
+void Optimizer::UpdateMapPoints(const vector<MapPoint*> &vpMPs, const vector<Eigen::Vector3f> &vPos,
+                                const vector<KeyFrame*> &vpKFs, TaskPool::Priority priority)
+{
+    MapPoint::KeyFrameCenters centers;
+    MapPoint::SnapshotCenters(vpKFs,centers);
+
+    const size_t N = vpMPs.size();
+    TaskGroup workers(priority);
+    for(size_t i=UPDATE_CHUNK; i<N; i+=UPDATE_CHUNK)
+        workers.Run(boost::bind(&UpdateMapPointRange,&vpMPs,&vPos,&centers,i,min(N,i+UPDATE_CHUNK)));
+    // The calling thread takes the first chunk
+    UpdateMapPointRange(&vpMPs,&vPos,&centers,0,min(N,UPDATE_CHUNK));
+    workers.Wait();
+}
+
+static const size_t SCREEN_CHUNK = 512;
+
+static void ScreenEdgeRange(const vector<g2o::EdgeSE3ProjectXYZ*>* pvpEdges, vector<unsigned char>* pvbOutlier,
+                            size_t begin, size_t end)
+{
+    for(size_t i=begin; i<end; i++)
+    {
+        g2o::EdgeSE3ProjectXYZ* e = (*pvpEdges)[i];
+        (*pvbOutlier)[i] = e && (e->chi2()>5.991 || !e->isDepthPositive());
+    }
+}
+
+void Optimizer::ScreenEdges(const vector<g2o::EdgeSE3ProjectXYZ*> &vpEdges, vector<unsigned char> &vbOutlier,
+                            TaskPool::Priority priority)
+{
+    const size_t N = vpEdges.size();
+    vbOutlier.assign(N,0);
+    TaskGroup workers(priority);
+    for(size_t i=SCREEN_CHUNK; i<N; i+=SCREEN_CHUNK)
+        workers.Run(boost::bind(&ScreenEdgeRange,&vpEdges,&vbOutlier,i,min(N,i+SCREEN_CHUNK)));
+    ScreenEdgeRange(&vpEdges,&vbOutlier,0,min(N,SCREEN_CHUNK));
+    workers.Wait();
+}
+
+static bool CompareOutlierKeyFrames(const pair<KeyFrame*,MapPoint*> &a, const pair<KeyFrame*,MapPoint*> &b)
+{
+    return a.first<b.first;
+}
+
+static bool CompareOutlierPoints(const pair<KeyFrame*,MapPoint*> &a, const pair<KeyFrame*,MapPoint*> &b)
+{
+    return a.second<b.second;
+}
+
+void Optimizer::EraseOutliers(vector<pair<KeyFrame*,MapPoint*> > &vOutliers)
+{
+    sort(vOutliers.begin(),vOutliers.end(),CompareOutlierKeyFrames);
+
+    vector<pair<size_t,MapPoint*> > vMatches;
+    for(size_t i=0; i<vOutliers.size(); )
+    {
+        KeyFrame* pKF = vOutliers[i].first;
+        size_t j = i;
+        vMatches.clear();
+        for(; j<vOutliers.size() && vOutliers[j].first==pKF; j++)
+        {
+            MapPoint* pMP = vOutliers[j].second;
+            const int idx = pMP->GetIndexInKeyFrame(pKF);
+            if(idx>=0)
+                vMatches.push_back(make_pair(static_cast<size_t>(idx),pMP));
+        }
+        pKF->EraseMapPointMatches(vMatches);
+        i = j;
+    }
+
+    sort(vOutliers.begin(),vOutliers.end(),CompareOutlierPoints);
+
+    vector<KeyFrame*> vpKFs;
+    for(size_t i=0; i<vOutliers.size(); )
+    {
+        MapPoint* pMP = vOutliers[i].second;
+        vpKFs.clear();
+        for(; i<vOutliers.size() && vOutliers[i].second==pMP; i++)
+            vpKFs.push_back(vOutliers[i].first);
+        pMP->EraseObservations(vpKFs);
+    }
+}
+
+void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopFlag, bool bIterative)
 {
+    TRACE_SCOPE("Optimizer::GlobalBundleAdjustment");
+
     vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
     vector<MapPoint*> vpMP = pMap->GetAllMapPoints();
-    BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag);
+    pMap->BeginUpdate();
+    BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag,bIterative);
+    pMap->EndUpdate();
 }
 
 
-void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP, int nIterations, bool* pbStopFlag)
+void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP, int nIterations, bool* pbStopFlag,
+                                 bool bIterative)
+{
+    BundleAdjustmentResult result;
+    BundleAdjustment(vpKFs,vpMP,result,nIterations,pbStopFlag,bIterative);
+
+    //Keyframes
+    vector<KeyFrame*> vpOptimizedKFs;
+    vpOptimizedKFs.reserve(result.mKeyFramePoses.size());
+    for(map<KeyFrame*,cv::Mat>::iterator mit=result.mKeyFramePoses.begin(), mend=result.mKeyFramePoses.end(); mit!=mend; mit++)
+    {
+        mit->first->SetPose(mit->second);
+        vpOptimizedKFs.push_back(mit->first);
+    }
+
+    //Points
+    vector<MapPoint*> vpOptimizedMPs;
+    vector<Eigen::Vector3f> vPos;
+    vpOptimizedMPs.reserve(result.mPointPositions.size());
+    vPos.reserve(result.mPointPositions.size());
+    for(map<MapPoint*,cv::Mat>::iterator mit=result.mPointPositions.begin(), mend=result.mPointPositions.end(); mit!=mend; mit++)
+    {
+        vpOptimizedMPs.push_back(mit->first);
+        vPos.push_back(Converter::toVector3f(mit->second));
+    }
+    UpdateMapPoints(vpOptimizedMPs,vPos,vpOptimizedKFs,TaskPool::LOOP_CLOSING);
+}
+
+void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP, BundleAdjustmentResult &result,
+                                 int nIterations, bool* pbStopFlag, bool bIterative)
 {
+    TRACE_SCOPE("Optimizer::BundleAdjustment");
+    ALLOC_SCOPE(BUNDLE_ADJUSTMENT);
+    MetricsTimer metricsTimer(Metrics::OPTIMIZER_MICROSECONDS);
+
     g2o::SparseOptimizer optimizer;
-    g2o::BlockSolverX::LinearSolverType * linearSolver;
+    g2o::BlockSolver_6_3 * solver_ptr;
 
-    linearSolver = new g2o::LinearSolverCholmod<g2o::BlockSolverX::PoseMatrixType>();
+    if(bIterative)
+    {
+        // The linear solver is not used, the reduced camera system is solved by PCG without being formed
+        // Levenberg takes inexact steps, a loose tolerance saves most of the iterations
+        solver_ptr = new g2o::BlockSolver_6_3(new g2o::LinearSolverDense<g2o::BlockSolver_6_3::PoseMatrixType>());
+        solver_ptr->setImplicitSchur(true,200,1e-3);
+    }
+    else
+    {
+        g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType> * linearSolver;
 
-    g2o::BlockSolverX * solver_ptr = new g2o::BlockSolverX(linearSolver);
+        linearSolver = new g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType>();
+        // The whole map gives a large reduced camera system, factorize it with dense kernels
+        linearSolver->setSupernodal(CHOLMOD_SUPERNODAL);
+
+        solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
+    }
 
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
     optimizer.setAlgorithm(solver);
+    Configure(optimizer,solver,TaskPool::LOOP_CLOSING);
 
     if(pbStopFlag)
         optimizer.setForceStopFlag(pbStopFlag);
@@ -91,24 +302,25 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         vPoint->setMarginalized(true);
         optimizer.addVertex(vPoint);
 
-        map<KeyFrame*,size_t> observations = pMP->GetObservations();
+        MapPoint::ObservationList observations = pMP->GetObservations();
 
         //SET EDGES
-        for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        for(MapPoint::ObservationList::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
             KeyFrame* pKF = mit->first;
             if(pKF->isBad())
                 continue;
             Eigen::Matrix<double,2,1> obs;
-            cv::KeyPoint kpUn = pKF->GetKeyPointUn(mit->second);
-            obs << kpUn.pt.x, kpUn.pt.y;
+            const cv::Point2f kpUn = pKF->GetKeyPointPosUn(mit->second);
+            const int kpUnLevel = pKF->GetKeyPointScaleLevel(mit->second);
+            obs << kpUn.x, kpUn.y;
 
             g2o::EdgeSE3ProjectXYZ* e = new g2o::EdgeSE3ProjectXYZ();
 
             e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
             e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKF->mnId)));
             e->setMeasurement(obs);
-            float invSigma2 = pKF->GetInvSigma2(kpUn.octave);
+            float invSigma2 = pKF->GetInvSigma2(kpUnLevel);
             e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
 
             g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
@@ -127,17 +339,20 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
     // Optimize!
 
     optimizer.initializeOptimization();
-    optimizer.optimize(nIterations);
+    const int nDone = optimizer.optimize(nIterations);
+    Report(optimizer,"Bundle adjustment",nDone);
 
-    // Recover optimized data
+    // Recover optimized data, of the keyframes and points that had a vertex
 
     //Keyframes
     for(size_t i=0, iend=vpKFs.size(); i<iend; i++)
     {
         KeyFrame* pKF = vpKFs[i];
         g2o::VertexSE3Expmap* vSE3 = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(pKF->mnId));
+        if(!vSE3)
+            continue;
         g2o::SE3Quat SE3quat = vSE3->estimate();
-        pKF->SetPose(Converter::toCvMat(SE3quat));
+        result.mKeyFramePoses[pKF] = Converter::toCvMat(SE3quat);
     }
 
     //Points
@@ -145,23 +360,27 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
     {
         MapPoint* pMP = vpMP[i];
         g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(pMP->mnId+maxKFid+1));
-        pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
-        pMP->UpdateNormalAndDepth();
+        if(!vPoint)
+            continue;
+        result.mPointPositions[pMP] = Converter::toCvMat(vPoint->estimate());
     }
-
 }
 
 int Optimizer::PoseOptimization(Frame *pFrame)
-{    
+{
+    TRACE_SCOPE("Optimizer::PoseOptimization");
+    ALLOC_SCOPE(POSE_OPTIMIZATION);
+
     g2o::SparseOptimizer optimizer;
-    g2o::BlockSolverX::LinearSolverType * linearSolver;
+    g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
 
-    linearSolver = new g2o::LinearSolverDense<g2o::BlockSolverX::PoseMatrixType>();
+    linearSolver = new g2o::LinearSolverDense<g2o::BlockSolver_6_3::PoseMatrixType>();
 
-    g2o::BlockSolverX * solver_ptr = new g2o::BlockSolverX(linearSolver);
+    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
 
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
     optimizer.setAlgorithm(solver);
+    Configure(optimizer,solver,TaskPool::TRACKING);
 
     optimizer.setVerbose(false);
 
@@ -244,7 +463,7 @@ int Optimizer::PoseOptimization(Frame *pFrame)
     for(size_t it=0; it<4; it++)
     {
         optimizer.initializeOptimization();
-        optimizer.optimize(its[it]);
+        Report(optimizer,"Pose optimization",optimizer.optimize(its[it]));
 
         nBad=0;
         for(size_t i=0, iend=vpEdges.size(); i<iend; i++)
@@ -285,17 +504,23 @@ int Optimizer::PoseOptimization(Frame *pFrame)
 }
 
 void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag)
-{    
+{
+    TRACE_SCOPE("Optimizer::LocalBundleAdjustment");
+    ALLOC_SCOPE(LOCAL_BUNDLE_ADJUSTMENT);
+    MetricsTimer metricsTimer(Metrics::OPTIMIZER_MICROSECONDS);
+
+    Map* pMap = pKF->getMap();
+
     // Local KeyFrames: First Breath Search from Current Keyframe
     list<KeyFrame*> lLocalKeyFrames;
 
     lLocalKeyFrames.push_back(pKF);
     pKF->mnBALocalForKF = pKF->mnId;
 
-    vector<KeyFrame*> vNeighKFs = pKF->GetVectorCovisibleKeyFrames();
-    for(int i=0, iend=vNeighKFs.size(); i<iend; i++)
+    KeyFrame::KeyFrameList pNeighKFs = pKF->GetCovisibleList();
+    for(int i=0, iend=pNeighKFs->size(); i<iend; i++)
     {
-        KeyFrame* pKFi = vNeighKFs[i];
+        KeyFrame* pKFi = (*pNeighKFs)[i];
         pKFi->mnBALocalForKF = pKF->mnId;
         if(!pKFi->isBad())
             lLocalKeyFrames.push_back(pKFi);
@@ -305,8 +530,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag)
     list<MapPoint*> lLocalMapPoints;
     for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin() , lend=lLocalKeyFrames.end(); lit!=lend; lit++)
     {
-        vector<MapPoint*> vpMPs = (*lit)->GetMapPointMatches();
-        for(vector<MapPoint*>::iterator vit=vpMPs.begin(), vend=vpMPs.end(); vit!=vend; vit++)
+        KeyFrame::MapPointList pMPs = (*lit)->GetMapPointMatchList();
+        for(vector<MapPoint*>::const_iterator vit=pMPs->begin(), vend=pMPs->end(); vit!=vend; vit++)
         {
             MapPoint* pMP = *vit;
             if(pMP)
@@ -323,8 +548,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag)
     list<KeyFrame*> lFixedCameras;
     for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
     {
-        map<KeyFrame*,size_t> observations = (*lit)->GetObservations();
-        for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        MapPoint::ObservationList observations = (*lit)->GetObservations();
+        for(MapPoint::ObservationList::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
             KeyFrame* pKFi = mit->first;
 
@@ -339,14 +564,15 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag)
 
     // Setup optimizer
     g2o::SparseOptimizer optimizer;
-    g2o::BlockSolverX::LinearSolverType * linearSolver;
+    g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
 
-    linearSolver = new g2o::LinearSolverCholmod<g2o::BlockSolverX::PoseMatrixType>();
+    linearSolver = new g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType>();
 
-    g2o::BlockSolverX * solver_ptr = new g2o::BlockSolverX(linearSolver);
+    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
 
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
     optimizer.setAlgorithm(solver);
+    Configure(optimizer,solver,TaskPool::LOCAL_MAPPING);
 
     if(pbStopFlag)
         optimizer.setForceStopFlag(pbStopFlag);
@@ -406,26 +632,27 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag)
         vPoint->setMarginalized(true);
         optimizer.addVertex(vPoint);
 
-        map<KeyFrame*,size_t> observations = pMP->GetObservations();
+        MapPoint::ObservationList observations = pMP->GetObservations();
 
         //SET EDGES
-        for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        for(MapPoint::ObservationList::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
             KeyFrame* pKFi = mit->first;
 
             if(!pKFi->isBad())
             {
                 Eigen::Matrix<double,2,1> obs;
-                cv::KeyPoint kpUn = pKFi->GetKeyPointUn(mit->second);
-                obs << kpUn.pt.x, kpUn.pt.y;
+                const cv::Point2f kpUn = pKFi->GetKeyPointPosUn(mit->second);
+                const int kpUnLevel = pKFi->GetKeyPointScaleLevel(mit->second);
+                obs << kpUn.x, kpUn.y;
 
                 g2o::EdgeSE3ProjectXYZ* e = new g2o::EdgeSE3ProjectXYZ();
 
                 e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
                 e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
                 e->setMeasurement(obs);
-                float sigma2 = pKFi->GetSigma2(kpUn.octave);
-                float invSigma2 = pKFi->GetInvSigma2(kpUn.octave);
+                float sigma2 = pKFi->GetSigma2(kpUnLevel);
+                float invSigma2 = pKFi->GetInvSigma2(kpUnLevel);
                 e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
 
                 g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
@@ -447,29 +674,34 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag)
     }
 
     optimizer.initializeOptimization();
-    optimizer.optimize(5);
+    Report(optimizer,"Local BA",optimizer.optimize(5));
 
     // Check inlier observations
+    vector<unsigned char> vbOutlier;
+    ScreenEdges(vpEdges,vbOutlier,TaskPool::LOCAL_MAPPING);
+
+    vector<pair<KeyFrame*,MapPoint*> > vOutliers;
     for(size_t i=0, iend=vpEdges.size(); i<iend;i++)
     {
-        g2o::EdgeSE3ProjectXYZ* e = vpEdges[i];
         MapPoint* pMP = vpMapPointEdge[i];
 
-        if(pMP->isBad())
+        if(!vbOutlier[i] || pMP->isBad())
             continue;
 
-        if(e->chi2()>5.991 || !e->isDepthPositive())
-        {
-            KeyFrame* pKFi = vpEdgeKF[i];
-            pKFi->EraseMapPointMatch(pMP);
-            pMP->EraseObservation(pKFi);
-
-            optimizer.removeEdge(e);
-            vpEdges[i]=NULL;
-        }
+        vOutliers.push_back(make_pair(vpEdgeKF[i],pMP));
+        optimizer.removeEdge(vpEdges[i]);
+        vpEdges[i]=NULL;
     }
+    EraseOutliers(vOutliers);
+
+    // The observers of the local points whose centers are read once for the write-back
+    vector<KeyFrame*> vpWindowKFs(lLocalKeyFrames.begin(),lLocalKeyFrames.end());
+    vpWindowKFs.insert(vpWindowKFs.end(),lFixedCameras.begin(),lFixedCameras.end());
+    vector<MapPoint*> vpLocalMPs(lLocalMapPoints.begin(),lLocalMapPoints.end());
+    vector<Eigen::Vector3f> vPos(vpLocalMPs.size());
 
     // Recover optimized data
+    pMap->BeginUpdate();
 
     //Keyframes
     for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
@@ -480,41 +712,34 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag)
         pKF->SetPose(Converter::toCvMat(SE3quat));
     }
     //Points
-    for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
+    for(size_t i=0; i<vpLocalMPs.size(); i++)
     {
-        MapPoint* pMP = *lit;
-        g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(pMP->mnId+maxKFid+1));
-        pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
-        pMP->UpdateNormalAndDepth();
+        g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(vpLocalMPs[i]->mnId+maxKFid+1));
+        vPos[i] = vPoint->estimate().cast<float>();
     }
+    UpdateMapPoints(vpLocalMPs,vPos,vpWindowKFs,TaskPool::LOCAL_MAPPING);
+    pMap->EndUpdate();
 
     // Optimize again without the outliers
 
     optimizer.initializeOptimization();
-    optimizer.optimize(10);
+    Report(optimizer,"Local BA without outliers",optimizer.optimize(10));
 
     // Check inlier observations
+    ScreenEdges(vpEdges,vbOutlier,TaskPool::LOCAL_MAPPING);
+
+    vOutliers.clear();
     for(size_t i=0, iend=vpEdges.size(); i<iend;i++)
     {
-        g2o::EdgeSE3ProjectXYZ* e = vpEdges[i];
-
-        if(!e)
-            continue;
-
         MapPoint* pMP = vpMapPointEdge[i];
 
-        if(pMP->isBad())
-            continue;
-
-        if(e->chi2()>5.991 || !e->isDepthPositive())
-        {
-            KeyFrame* pKF = vpEdgeKF[i];
-            pKF->EraseMapPointMatch(pMP->GetIndexInKeyFrame(pKF));
-            pMP->EraseObservation(pKF);
-        }
+        if(vbOutlier[i] && !pMP->isBad())
+            vOutliers.push_back(make_pair(vpEdgeKF[i],pMP));
     }
+    EraseOutliers(vOutliers);
 
     // Recover optimized data
+    pMap->BeginUpdate();
 
     //Keyframes
     for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
@@ -526,13 +751,13 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag)
     }
 
     //Points
-    for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
+    for(size_t i=0; i<vpLocalMPs.size(); i++)
     {
-        MapPoint* pMP = *lit;
-        g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(pMP->mnId+maxKFid+1));
-        pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
-        pMP->UpdateNormalAndDepth();
+        g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(vpLocalMPs[i]->mnId+maxKFid+1));
+        vPos[i] = vPoint->estimate().cast<float>();
     }
+    UpdateMapPoints(vpLocalMPs,vPos,vpWindowKFs,TaskPool::LOCAL_MAPPING);
+    pMap->EndUpdate();
 }
 
 
@@ -542,28 +767,56 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
                                        LoopClosing::KeyFrameAndPose &CorrectedSim3,
                                        map<KeyFrame *, set<KeyFrame *> > &LoopConnections)
 {
+    EssentialGraphCorrection correction;
+    OptimizeEssentialGraph(pMap,pLoopKF,pCurKF,NonCorrectedSim3,CorrectedSim3,LoopConnections,correction);
+    ApplyEssentialGraph(pMap,pCurKF,correction);
+}
+
+void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
+                                       LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
+                                       LoopClosing::KeyFrameAndPose &CorrectedSim3,
+                                       map<KeyFrame *, set<KeyFrame *> > &LoopConnections,
+                                       EssentialGraphCorrection &correction)
+{
+    TRACE_SCOPE("Optimizer::OptimizeEssentialGraph");
+    ALLOC_SCOPE(ESSENTIAL_GRAPH);
+    MetricsTimer metricsTimer(Metrics::OPTIMIZER_MICROSECONDS);
+
     // Setup optimizer
     g2o::SparseOptimizer optimizer;
     optimizer.setVerbose(false);
-    g2o::BlockSolver_7_3::LinearSolverType * linearSolver =
+    g2o::LinearSolverCholmod<g2o::BlockSolver_7_3::PoseMatrixType> * linearSolver =
            new g2o::LinearSolverCholmod<g2o::BlockSolver_7_3::PoseMatrixType>();
+    // All vertices are Sim3, order the 7x7 blocks instead of the scalar matrix and factorize with dense kernels
+    linearSolver->setBlockOrdering(true);
+    linearSolver->setSupernodal(CHOLMOD_SUPERNODAL);
     g2o::BlockSolver_7_3 * solver_ptr= new g2o::BlockSolver_7_3(linearSolver);
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
 
     solver->setUserLambdaInit(1e-16);
     optimizer.setAlgorithm(solver);
+    Configure(optimizer,solver,TaskPool::LOOP_CLOSING);
 
+    // The maximum id is read last, so it covers every keyframe taken
     vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
-    vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
 
-    unsigned int nMaxKFid = pMap->GetMaxKFid();
+    const unsigned int nMaxKFid = pMap->GetMaxKFid();
 
+    vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > &vScw = correction.vScw;
+    vScw.assign(nMaxKFid+1,g2o::Sim3());
+    correction.vCorrectedScw.assign(nMaxKFid+1,g2o::Sim3());
+    correction.vbOptimized.assign(nMaxKFid+1,false);
+    vector<g2o::VertexSim3Expmap*> vpVertices(nMaxKFid+1,static_cast<g2o::VertexSim3Expmap*>(NULL));
 
-    vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vScw(nMaxKFid+1);
-    vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vCorrectedSwc(nMaxKFid+1);
-    vector<g2o::VertexSim3Expmap*> vpVertices(nMaxKFid+1);
+    const int minFeat = EssentialGraph::MIN_WEIGHT;
 
-    const int minFeat = 100;
+    // Large maps only optimize the tiles of the loop, the keyframes linked to them from other tiles are fixed
+    const bool bTiled = gLevenbergSettings.nTiledKeyFrames>0 && gLevenbergSettings.fTileSize>0 &&
+            vpKFs.size()>=(size_t)gLevenbergSettings.nTiledKeyFrames;
+    vector<bool> vbRegion(nMaxKFid+1,!bTiled);
+    vector<bool> vbSeparator(nMaxKFid+1,false);
+    if(bTiled)
+        TiledRegion(vpKFs,pLoopKF,pCurKF,CorrectedSim3,gLevenbergSettings.fTileSize,minFeat,vbRegion,vbSeparator);
 
     // SET KEYFRAME VERTICES
     for(size_t i=0, iend=vpKFs.size(); i<iend;i++)
@@ -571,25 +824,30 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         KeyFrame* pKF = vpKFs[i];
         if(pKF->isBad())
             continue;
-        g2o::VertexSim3Expmap* VSim3 = new g2o::VertexSim3Expmap();
 
         int nIDi = pKF->mnId;      
 
         if(CorrectedSim3.count(pKF))
-        {
             vScw[nIDi] = CorrectedSim3[pKF];
-            VSim3->setEstimate(CorrectedSim3[pKF]);
-        }
         else
         {
             Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKF->GetRotation());
             Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKF->GetTranslation());
-            g2o::Sim3 Siw(Rcw,tcw,1.0);
-            vScw[nIDi] = Siw;
-            VSim3->setEstimate(Siw);
+            vScw[nIDi] = g2o::Sim3(Rcw,tcw,1.0);
+        }
+
+        // Keyframes out of the tiles stay where they are
+        if(!vbRegion[nIDi] && !vbSeparator[nIDi])
+        {
+            correction.vCorrectedScw[nIDi] = vScw[nIDi];
+            correction.vbOptimized[nIDi] = true;
+            continue;
         }
 
-        if(pKF==pLoopKF)
+        g2o::VertexSim3Expmap* VSim3 = new g2o::VertexSim3Expmap();
+        VSim3->setEstimate(vScw[nIDi]);
+
+        if(pKF==pLoopKF || vbSeparator[nIDi])
             VSim3->setFixed(true);
 
         VSim3->setId(nIDi);
@@ -610,6 +868,8 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
     {
         KeyFrame* pKF = mit->first;
         const long unsigned int nIDi = pKF->mnId;
+        if(nIDi>nMaxKFid || !vpVertices[nIDi])
+            continue;
         set<KeyFrame*> &spConnections = mit->second;
         g2o::Sim3 Siw = vScw[nIDi];
         g2o::Sim3 Swi = Siw.inverse();
@@ -617,6 +877,8 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         for(set<KeyFrame*>::iterator sit=spConnections.begin(), send=spConnections.end(); sit!=send; sit++)
         {
             const long unsigned int nIDj = (*sit)->mnId;
+            if(nIDj>nMaxKFid || !vpVertices[nIDj])
+                continue;
             if((nIDi!=pCurKF->mnId || nIDj!=pLoopKF->mnId) && pKF->GetWeight(*sit)<minFeat)
                 continue;
 
@@ -637,112 +899,156 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
     }
 
     // SET NORMAL EDGES
-    for(size_t i=0, iend=vpKFs.size(); i<iend; i++)
+    // The spanning tree, loop and covisibility edges are kept by the map as the keyframes link, they are only read here
+    // Keyframes are only linked to vertices, the graph may have gained keyframes while it is read
+    vector<EssentialGraph::Edge> vEdges;
+    pMap->GetEssentialGraph()->GetEdges(vpKFs,vEdges);
+    for(size_t i=0, iend=vEdges.size(); i<iend; i++)
     {
-        KeyFrame* pKF = vpKFs[i];
+        const EssentialGraph::Edge &edge = vEdges[i];
+        KeyFrame* pKFi = edge.pKF1;
+        KeyFrame* pKFj = edge.pKF2;
+
+        const long unsigned int nIDi = pKFi->mnId;
+        const long unsigned int nIDj = pKFj->mnId;
+        if(nIDi>nMaxKFid || nIDj>nMaxKFid || !vpVertices[nIDi] || !vpVertices[nIDj])
+            continue;
 
-        const int nIDi = pKF->mnId;
+        // Covisibility edges already added as new loop links
+        if(edge.nTypes==EssentialGraph::COVISIBILITY && sInsertedEdges.count(make_pair(nIDj,nIDi)))
+            continue;
 
         g2o::Sim3 Swi;
-        if(NonCorrectedSim3.count(pKF))
-            Swi = NonCorrectedSim3[pKF].inverse();
+        if(NonCorrectedSim3.count(pKFi))
+            Swi = NonCorrectedSim3[pKFi].inverse();
         else
             Swi = vScw[nIDi].inverse();
 
-        KeyFrame* pParentKF = pKF->GetParent();
+        g2o::Sim3 Sjw;
+        if(NonCorrectedSim3.count(pKFj))
+            Sjw = NonCorrectedSim3[pKFj];
+        else
+            Sjw = vScw[nIDj];
 
-        // Spanning tree edge
-        if(pParentKF)
-        {
-            int nIDj = pParentKF->mnId;
+        g2o::Sim3 Sji = Sjw * Swi;
 
-            g2o::Sim3 Sjw;
+        g2o::EdgeSim3* e = new g2o::EdgeSim3();
+        e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDj)));
+        e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
+        e->setMeasurement(Sji);
 
-            if(NonCorrectedSim3.count(pParentKF))
-                Sjw = NonCorrectedSim3[pParentKF];
-            else
-                Sjw = vScw[nIDj];
+        e->information() = matLambda;
+        optimizer.addEdge(e);
+    }
 
-            g2o::Sim3 Sji = Sjw * Swi;
+    // OPTIMIZE
 
-            g2o::EdgeSim3* e = new g2o::EdgeSim3();
-            e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDj)));
-            e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
-            e->setMeasurement(Sji);
+    optimizer.initializeOptimization();
+    Report(optimizer,"Essential graph",optimizer.optimize(20));
+    if(bTiled)
+        ROS_DEBUG("ORB-SLAM - Tiled essential graph: %lu of %lu keyframes optimized", optimizer.vertices().size(), vpKFs.size());
 
-            e->information() = matLambda;
-            optimizer.addEdge(e);
-        }
+    for(size_t i=0; i<=nMaxKFid; i++)
+    {
+        if(!vpVertices[i])
+            continue;
+        correction.vCorrectedScw[i] = vpVertices[i]->estimate();
+        correction.vbOptimized[i] = true;
+    }
+}
 
-        // Loop edges
-        set<KeyFrame*> sLoopEdges = pKF->GetLoopEdges();
-        for(set<KeyFrame*>::iterator sit=sLoopEdges.begin(), send=sLoopEdges.end(); sit!=send; sit++)
-        {
-            KeyFrame* pLKF = *sit;
-            if(pLKF->mnId<pKF->mnId)
-            {
-                g2o::Sim3 Slw;
-                if(NonCorrectedSim3.count(pLKF))
-                    Slw = NonCorrectedSim3[pLKF];
-                else
-                    Slw = vScw[pLKF->mnId];
-
-                g2o::Sim3 Sli = Slw * Swi;
-                g2o::EdgeSim3* el = new g2o::EdgeSim3();
-                el->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pLKF->mnId)));
-                el->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
-                el->setMeasurement(Sli);
-                el->information() = matLambda;
-                optimizer.addEdge(el);
-            }
-        }
+// Tile of a camera center
+static long long TileKey(const cv::Mat &Ow, float fTileSize)
+{
+    const long long x = static_cast<long long>(std::floor(Ow.at<float>(0)/fTileSize));
+    const long long y = static_cast<long long>(std::floor(Ow.at<float>(1)/fTileSize));
+    const long long z = static_cast<long long>(std::floor(Ow.at<float>(2)/fTileSize));
+    return ((x&0x1fffff)<<42) | ((y&0x1fffff)<<21) | (z&0x1fffff);
+}
+
+// Keyframes of the tiles the loop runs through (vbRegion), and those linked to them from other tiles (vbSeparator)
+// The loop runs through the keyframes it corrects and the ones made between its two ends
+static void TiledRegion(const vector<KeyFrame*> &vpKFs, KeyFrame* pLoopKF, KeyFrame* pCurKF,
+                        const LoopClosing::KeyFrameAndPose &CorrectedSim3, float fTileSize, int minFeat,
+                        vector<bool> &vbRegion, vector<bool> &vbSeparator)
+{
+    const unsigned long nFirstId = min(pLoopKF->mnId,pCurKF->mnId);
+    const unsigned long nLastId = max(pLoopKF->mnId,pCurKF->mnId);
+
+    vector<long long> vTiles(vpKFs.size());
+    set<long long> sLoopTiles;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(pKF->isBad())
+            continue;
+        vTiles[i] = TileKey(pKF->GetCameraCenter(),fTileSize);
+        if((pKF->mnId>=nFirstId && pKF->mnId<=nLastId) || CorrectedSim3.count(pKF))
+            sLoopTiles.insert(vTiles[i]);
+    }
+
+    vector<KeyFrame*> vpRegion;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        if(vpKFs[i]->isBad() || !sLoopTiles.count(vTiles[i]))
+            continue;
+        vbRegion[vpKFs[i]->mnId] = true;
+        vpRegion.push_back(vpKFs[i]);
+    }
 
-        // Covisibility graph edges
-        vector<KeyFrame*> vpConnectedKFs = pKF->GetCovisiblesByWeight(minFeat);
-        for(vector<KeyFrame*>::iterator vit=vpConnectedKFs.begin(); vit!=vpConnectedKFs.end(); vit++)
+    // Every keyframe an edge of the region may reach
+    for(size_t i=0; i<vpRegion.size(); i++)
+    {
+        KeyFrame* pKF = vpRegion[i];
+        vector<KeyFrame*> vpLinked = pKF->GetCovisiblesByWeight(minFeat);
+        const set<KeyFrame*> sChilds = pKF->GetChilds();
+        const set<KeyFrame*> sLoopEdges = pKF->GetLoopEdges();
+        vpLinked.insert(vpLinked.end(),sChilds.begin(),sChilds.end());
+        vpLinked.insert(vpLinked.end(),sLoopEdges.begin(),sLoopEdges.end());
+        vpLinked.push_back(pKF->GetParent());
+        for(size_t j=0; j<vpLinked.size(); j++)
         {
-            KeyFrame* pKFn = *vit;
-            if(pKFn && pKFn!=pParentKF && !pKF->hasChild(pKFn) && !sLoopEdges.count(pKFn))
-            {
-                if(!pKFn->isBad() && pKFn->mnId<pKF->mnId)
-                {
-                    if(sInsertedEdges.count(make_pair(min(pKF->mnId,pKFn->mnId),max(pKF->mnId,pKFn->mnId))))
-                        continue;
-
-                    g2o::Sim3 Snw;
-                    if(NonCorrectedSim3.count(pKFn))
-                        Snw = NonCorrectedSim3[pKFn];
-                    else
-                        Snw = vScw[pKFn->mnId];
-
-                    g2o::Sim3 Sni = Snw * Swi;
-
-                    g2o::EdgeSim3* en = new g2o::EdgeSim3();
-                    en->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFn->mnId)));
-                    en->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
-                    en->setMeasurement(Sni);
-                    en->information() = matLambda;
-                    optimizer.addEdge(en);
-                }
-            }
+            KeyFrame* pKFj = vpLinked[j];
+            if(pKFj && !pKFj->isBad() && pKFj->mnId<vbRegion.size() && !vbRegion[pKFj->mnId])
+                vbSeparator[pKFj->mnId] = true;
         }
     }
+}
 
-    // OPTIMIZE
+// Keyframe whose correction moves pKF, itself if it was optimized or its closest optimized ancestor
+static KeyFrame* CorrectingKeyFrame(KeyFrame* pKF, const EssentialGraphCorrection &correction)
+{
+    while(pKF && (pKF->mnId>=correction.vbOptimized.size() || !correction.vbOptimized[pKF->mnId]))
+        pKF = pKF->GetParent();
+    return pKF;
+}
 
-    optimizer.initializeOptimization();
-    optimizer.optimize(20);
+void Optimizer::ApplyEssentialGraph(Map* pMap, KeyFrame* pCurKF, const EssentialGraphCorrection &correction)
+{
+    TRACE_SCOPE("Optimizer::ApplyEssentialGraph");
+
+    const vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > &vScw = correction.vScw;
+    const vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > &vCorrectedScw = correction.vCorrectedScw;
+
+    vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+    vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
 
     // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
+    // The pose the keyframe has now is moved as its optimized pose was, which is the optimized pose if it did not change
     for(size_t i=0;i<vpKFs.size();i++)
     {
         KeyFrame* pKFi = vpKFs[i];
 
-        const int nIDi = pKFi->mnId;
+        KeyFrame* pKFc = CorrectingKeyFrame(pKFi,correction);
+        if(!pKFc)
+            continue;
+        const int nIDc = pKFc->mnId;
+
+        Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKFi->GetRotation());
+        Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKFi->GetTranslation());
+        g2o::Sim3 Siw(Rcw,tcw,1.0);
 
-        g2o::VertexSim3Expmap* VSim3 = static_cast<g2o::VertexSim3Expmap*>(optimizer.vertex(nIDi));
-        g2o::Sim3 CorrectedSiw =  VSim3->estimate();
-        vCorrectedSwc[nIDi]=CorrectedSiw.inverse();
+        g2o::Sim3 CorrectedSiw = Siw*vScw[nIDc].inverse()*vCorrectedScw[nIDc];
         Eigen::Matrix3d eigR = CorrectedSiw.rotation().toRotationMatrix();
         Eigen::Vector3d eigt = CorrectedSiw.translation();
         double s = CorrectedSiw.scale();
@@ -763,19 +1069,21 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
             continue;
 
         int nIDr;
-        if(pMP->mnCorrectedByKF==pCurKF->mnId)
+        if(pMP->mnCorrectedByKF==pCurKF->mnId && correction.vbOptimized[pMP->mnCorrectedReference])
         {
             nIDr = pMP->mnCorrectedReference;
         }
         else
         {
-            KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
+            KeyFrame* pRefKF = CorrectingKeyFrame(pMP->GetReferenceKeyFrame(),correction);
+            if(!pRefKF)
+                continue;
             nIDr = pRefKF->mnId;
         }
 
 
         g2o::Sim3 Srw = vScw[nIDr];
-        g2o::Sim3 correctedSwr = vCorrectedSwc[nIDr];
+        g2o::Sim3 correctedSwr = vCorrectedScw[nIDr].inverse();
 
         cv::Mat P3Dw = pMP->GetWorldPos();
         Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
@@ -790,15 +1098,20 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
 
 int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &vpMatches1, g2o::Sim3 &g2oS12, float th2)
 {
+    TRACE_SCOPE("Optimizer::OptimizeSim3");
+    ALLOC_SCOPE(OPTIMIZE_SIM3);
+    MetricsTimer metricsTimer(Metrics::OPTIMIZER_MICROSECONDS);
+
     g2o::SparseOptimizer optimizer;
-    g2o::BlockSolverX::LinearSolverType * linearSolver;
+    g2o::BlockSolver_7_3::LinearSolverType * linearSolver;
 
-    linearSolver = new g2o::LinearSolverDense<g2o::BlockSolverX::PoseMatrixType>();
+    linearSolver = new g2o::LinearSolverDense<g2o::BlockSolver_7_3::PoseMatrixType>();
 
-    g2o::BlockSolverX * solver_ptr = new g2o::BlockSolverX(linearSolver);
+    g2o::BlockSolver_7_3 * solver_ptr = new g2o::BlockSolver_7_3(linearSolver);
 
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
     optimizer.setAlgorithm(solver);
+    Configure(optimizer,solver,TaskPool::LOOP_CLOSING);
 
     // Calibration
     cv::Mat K1 = pKF1->GetCalibrationMatrix();
@@ -884,14 +1197,15 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
 
         // SET EDGE x1 = S12*X2
         Eigen::Matrix<double,2,1> obs1;
-        cv::KeyPoint kpUn1 = pKF1->GetKeyPointUn(i);
-        obs1 << kpUn1.pt.x, kpUn1.pt.y;
+        const cv::Point2f kpUn1 = pKF1->GetKeyPointPosUn(i);
+        const int kpUn1Level = pKF1->GetKeyPointScaleLevel(i);
+        obs1 << kpUn1.x, kpUn1.y;
 
         g2o::EdgeSim3ProjectXYZ* e12 = new g2o::EdgeSim3ProjectXYZ();
         e12->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id2)));
         e12->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(0)));
         e12->setMeasurement(obs1);
-        float invSigmaSquare1 = pKF1->GetInvSigma2(kpUn1.octave);
+        float invSigmaSquare1 = pKF1->GetInvSigma2(kpUn1Level);
         e12->setInformation(Eigen::Matrix2d::Identity()*invSigmaSquare1);
 
         g2o::RobustKernelHuber* rk1 = new g2o::RobustKernelHuber;
@@ -901,15 +1215,16 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
 
         // SET EDGE x2 = S21*X1
         Eigen::Matrix<double,2,1> obs2;
-        cv::KeyPoint kpUn2 = pKF2->GetKeyPointUn(i2);
-        obs2 << kpUn2.pt.x, kpUn2.pt.y;
+        const cv::Point2f kpUn2 = pKF2->GetKeyPointPosUn(i2);
+        const int kpUn2Level = pKF2->GetKeyPointScaleLevel(i2);
+        obs2 << kpUn2.x, kpUn2.y;
 
         g2o::EdgeInverseSim3ProjectXYZ* e21 = new g2o::EdgeInverseSim3ProjectXYZ();
 
         e21->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id1)));
         e21->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(0)));
         e21->setMeasurement(obs2);
-        float invSigmaSquare2 = pKF2->GetSigma2(kpUn2.octave);
+        float invSigmaSquare2 = pKF2->GetSigma2(kpUn2Level);
         e21->setInformation(Eigen::Matrix2d::Identity()*invSigmaSquare2);
 
         g2o::RobustKernelHuber* rk2 = new g2o::RobustKernelHuber;
@@ -925,7 +1240,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
     // Optimize
 
     optimizer.initializeOptimization();
-    optimizer.optimize(5);
+    Report(optimizer,"Sim3",optimizer.optimize(5));
 
     // Check inliers
     int nBad=0;
@@ -960,7 +1275,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
     // Optimize again only with inliers
 
     optimizer.initializeOptimization();
-    optimizer.optimize(nMoreIterations);
+    Report(optimizer,"Sim3 without outliers",optimizer.optimize(nMoreIterations));
 
     int nIn = 0;
     for(size_t i=0; i<vpEdges12.size();i++)
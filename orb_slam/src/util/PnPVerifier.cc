@@ -0,0 +1,339 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/PnPVerifier.h"
+
+#include "types/Frame.h"
+#include "types/KeyFrame.h"
+#include "types/MapPoint.h"
+#include "util/PnPsolver.h"
+#include "util/ORBmatcher.h"
+#include "util/TaskPool.h"
+
+#include <ros/ros.h>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <set>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+static bool ScoreGreater(const pair<float,KeyFrame*> &a, const pair<float,KeyFrame*> &b)
+{
+    return a.first>b.first;
+}
+
+PnPVerifier::PnPVerifier(int nThreads, TaskPool::Priority priority):
+    mnThreads(max(nThreads,1)), mPriority(priority), mpFrame(NULL), mpvpCandidates(NULL), mnNextCandidate(0), mbCancelled(false), mfDeadline(0),
+    mnAccepted(-1)
+{}
+
+void PnPVerifier::SetThreads(int nThreads)
+{
+    mnThreads = max(nThreads,1);
+}
+
+void PnPVerifier::SetPriority(TaskPool::Priority priority)
+{
+    mPriority = priority;
+}
+
+void PnPVerifier::Cancel(bool bCancel)
+{
+    mbCancelled = bCancel;
+}
+
+int PnPVerifier::Verify(Frame *pFrame, vector<KeyFrame*> &vpCandidates, float fBudget)
+{
+    mfDeadline = fBudget>0 ? ros::WallTime::now().toSec()+fBudget : 0;
+
+    Rank(pFrame,vpCandidates);
+
+    mpFrame = pFrame;
+    mpvpCandidates = &vpCandidates;
+    mnNextCandidate = 0;
+    mnAccepted = -1;
+
+    const int nWorkers = min(mnThreads,(int)vpCandidates.size());
+    if(nWorkers>1)
+    {
+        TaskGroup workers(mPriority);
+        for(int i=0; i<nWorkers-1; i++)
+            workers.Run(boost::bind(&PnPVerifier::VerifyCandidates,this));
+        // The calling thread also takes its share of candidates
+        VerifyCandidates();
+        workers.Wait();
+
+        // The workers read the frame until they finish
+        if(mnAccepted>=0)
+        {
+            mTcw.copyTo(pFrame->mTcw);
+            pFrame->mvpMapPoints = mvpMapPoints;
+            pFrame->mvbOutlier = mvbOutlier;
+        }
+    }
+    else
+    {
+        VerifySequential();
+    }
+
+    return mnAccepted;
+}
+
+void PnPVerifier::Rank(Frame *pFrame, vector<KeyFrame*> &vpCandidates)
+{
+    vector<pair<float,KeyFrame*> > vScores;
+    vScores.reserve(vpCandidates.size());
+    const DBoW2::FlatBowVector vFlatBow(pFrame->mBowVec);
+    DBoW2::FlatBowVector vFlatBowi;
+    for(size_t i=0; i<vpCandidates.size(); i++)
+    {
+        vpCandidates[i]->GetFlatBowVector(vFlatBowi);
+        vScores.push_back(make_pair(pFrame->mpORBvocabulary->score(vFlatBow,vFlatBowi),vpCandidates[i]));
+    }
+
+    stable_sort(vScores.begin(),vScores.end(),ScoreGreater);
+
+    for(size_t i=0; i<vScores.size(); i++)
+        vpCandidates[i] = vScores[i].second;
+}
+
+int PnPVerifier::VerifySequential()
+{
+    Frame &F = *mpFrame;
+    const int nKFs = mpvpCandidates->size();
+
+    // We perform first an ORB matching with each candidate
+    // If enough matches are found we setup a PnP solver
+    ORBmatcher matcher(0.75,true);
+    vector<PnPsolver*> vpPnPsolvers(nKFs,static_cast<PnPsolver*>(NULL));
+    vector<vector<MapPoint*> > vvpMapPointMatches(nKFs);
+    vector<bool> vbDiscarded(nKFs,false);
+
+    int nCandidates=0;
+    for(int i=0; i<nKFs; i++)
+    {
+        KeyFrame* pKF = (*mpvpCandidates)[i];
+        if(pKF->isBad())
+        {
+            vbDiscarded[i] = true;
+            continue;
+        }
+
+        int nmatches = matcher.SearchByBoW(pKF,F,vvpMapPointMatches[i]);
+        if(nmatches<15)
+        {
+            vbDiscarded[i] = true;
+            continue;
+        }
+
+        PnPsolver* pSolver = new PnPsolver(F,vvpMapPointMatches[i]);
+        pSolver->SetRansacParameters(0.99,10,300,4,0.5,5.991);
+        pSolver->SetSPRT(true);
+        vpPnPsolvers[i] = pSolver;
+        nCandidates++;
+    }
+
+    // Alternatively perform some iterations of P4P RANSAC
+    // Until we found a camera pose supported by enough inliers
+    while(nCandidates>0 && !Finished())
+    {
+        for(int i=0; i<nKFs; i++)
+        {
+            if(vbDiscarded[i])
+                continue;
+
+            // Perform 5 Ransac Iterations
+            vector<bool> vbInliers;
+            int nInliers;
+            bool bNoMore;
+
+            PnPsolver* pSolver = vpPnPsolvers[i];
+            cv::Mat Tcw = pSolver->iterate(5,bNoMore,vbInliers,nInliers);
+
+            // If Ransac reachs max. iterations discard keyframe
+            if(bNoMore)
+            {
+                vbDiscarded[i]=true;
+                nCandidates--;
+            }
+
+            // If a Camera Pose is computed, optimize
+            if(!Tcw.empty() && Refine(F,(*mpvpCandidates)[i],vvpMapPointMatches[i],vbInliers,Tcw,mPoseSolver))
+            {
+                // The frame already holds the result
+                mnAccepted = i;
+                break;
+            }
+        }
+    }
+
+    for(int i=0; i<nKFs; i++)
+        delete vpPnPsolvers[i];
+
+    return mnAccepted;
+}
+
+void PnPVerifier::VerifyCandidates()
+{
+    // Each worker refines the hypotheses on its own frame
+    Frame F(*mpFrame);
+    PoseSolver solver;
+
+    while(!Finished())
+    {
+        int nCandidate;
+        {
+            boost::mutex::scoped_lock lock(mMutexCandidate);
+            nCandidate = mnNextCandidate++;
+        }
+
+        if(nCandidate>=(int)mpvpCandidates->size())
+            break;
+
+        VerifyCandidate(nCandidate,F,solver);
+    }
+}
+
+void PnPVerifier::VerifyCandidate(int nCandidate, Frame &F, PoseSolver &solver)
+{
+    KeyFrame* pKF = (*mpvpCandidates)[nCandidate];
+    if(pKF->isBad())
+        return;
+
+    ORBmatcher matcher(0.75,true);
+    vector<MapPoint*> vpMapPointMatches;
+    if(matcher.SearchByBoW(pKF,F,vpMapPointMatches)<15)
+        return;
+
+    PnPsolver pnp(F,vpMapPointMatches);
+    pnp.SetRansacParameters(0.99,10,300,4,0.5,5.991);
+    pnp.SetSPRT(true);
+
+    // Rounds of 5 RANSAC iterations, the other workers are checked in between
+    bool bNoMore = false;
+    while(!bNoMore && !Finished())
+    {
+        vector<bool> vbInliers;
+        int nInliers;
+
+        cv::Mat Tcw = pnp.iterate(5,bNoMore,vbInliers,nInliers);
+        if(Tcw.empty())
+            continue;
+
+        if(Refine(F,pKF,vpMapPointMatches,vbInliers,Tcw,solver))
+        {
+            Accept(nCandidate,F);
+            return;
+        }
+    }
+}
+
+bool PnPVerifier::Refine(Frame &F, KeyFrame *pKF, const vector<MapPoint*> &vpMatches, const vector<bool> &vbInliers,
+                         const cv::Mat &Tcw, PoseSolver &solver)
+{
+    Tcw.copyTo(F.mTcw);
+
+    set<MapPoint*> sFound;
+
+    for(size_t j=0; j<vbInliers.size(); j++)
+    {
+        if(vbInliers[j])
+        {
+            F.mvpMapPoints[j]=vpMatches[j];
+            sFound.insert(vpMatches[j]);
+        }
+        else
+            F.mvpMapPoints[j]=NULL;
+    }
+
+    int nGood = solver.Optimize(&F);
+
+    if(nGood<10)
+        return false;
+
+    for(size_t io =0, ioend=F.mvbOutlier.size(); io<ioend; io++)
+        if(F.mvbOutlier[io])
+            F.mvpMapPoints[io]=NULL;
+
+    // If few inliers, search by projection in a coarse window and optimize again
+    if(nGood<50)
+    {
+        ORBmatcher matcher2(0.9,true);
+        int nadditional =matcher2.SearchByProjection(F,pKF,sFound,10,100);
+
+        if(nadditional+nGood>=50)
+        {
+            nGood = solver.Optimize(&F);
+
+            // If many inliers but still not enough, search by projection again in a narrower window
+            // the camera has been already optimized with many points
+            if(nGood>30 && nGood<50)
+            {
+                sFound.clear();
+                for(size_t ip =0, ipend=F.mvpMapPoints.size(); ip<ipend; ip++)
+                    if(F.mvpMapPoints[ip])
+                        sFound.insert(F.mvpMapPoints[ip]);
+                nadditional =matcher2.SearchByProjection(F,pKF,sFound,3,64);
+
+                // Final optimization
+                if(nGood+nadditional>=50)
+                {
+                    nGood = solver.Optimize(&F);
+
+                    for(size_t io =0; io<F.mvbOutlier.size(); io++)
+                        if(F.mvbOutlier[io])
+                            F.mvpMapPoints[io]=NULL;
+                }
+            }
+        }
+    }
+
+    // If the pose is supported by enough inliers stop ransacs and continue
+    return nGood>=50;
+}
+
+void PnPVerifier::Accept(int nCandidate, const Frame &F)
+{
+    boost::mutex::scoped_lock lock(mMutexAccepted);
+    if(mnAccepted>=0)
+        return;
+    mnAccepted = nCandidate;
+    F.mTcw.copyTo(mTcw);
+    mvpMapPoints = F.mvpMapPoints;
+    mvbOutlier = F.mvbOutlier;
+}
+
+bool PnPVerifier::Accepted()
+{
+    boost::mutex::scoped_lock lock(mMutexAccepted);
+    return mnAccepted>=0;
+}
+
+bool PnPVerifier::Finished()
+{
+    if(mbCancelled || (mfDeadline>0 && ros::WallTime::now().toSec()>=mfDeadline))
+        return true;
+    return Accepted();
+}
+
+} //namespace ORB_SLAM
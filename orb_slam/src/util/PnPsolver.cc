@@ -25,53 +25,97 @@
 
 #include <vector>
 #include <cmath>
-#include <opencv/cv.h>
+#include <Eigen/Dense>
 #include "dutils/Random.h"
-#include <ros/ros.h>
 #include <algorithm>
 
+// Vectorized reprojection is used when the target supports it, unless ORB_SLAM_NO_SIMD is defined
+// The scalar reprojection is kept as reference and for the remaining correspondences
+#if !defined(ORB_SLAM_NO_SIMD)
+#if defined(__SSE2__)
+#define ORB_SLAM_SIMD_SSE2
+#include <emmintrin.h>
+#elif (defined(__ARM_NEON__) || defined(__ARM_NEON)) && defined(__aarch64__)
+#define ORB_SLAM_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
 using namespace std;
 
 namespace ORB_SLAM
 {
 
+// Correspondences checked between two tests of a preemptive check
+static const int CHECK_BLOCK = 16;
+
+// Cost of computing a hypothesis, in correspondence checks, used by the SPRT
+static const double SPRT_MODEL_COST = 200.0;
+
+static cv::Mat PoseMatrix(const double R[3][3], const double t[3])
+{
+    cv::Mat Tcw;
+    Tcw.create(4,4,CV_32F);
+    for(int i=0; i<3; i++)
+    {
+        for(int j=0; j<3; j++)
+            Tcw.at<float>(i,j) = R[i][j];
+        Tcw.at<float>(i,3) = t[i];
+        Tcw.at<float>(3,i) = 0;
+    }
+    Tcw.at<float>(3,3) = 1;
+    return Tcw;
+}
 
 PnPsolver::PnPsolver(const Frame &F, const vector<MapPoint*> &vpMapPointMatches):
     pws(0), us(0), alphas(0), pcs(0), maximum_number_of_correspondences(0), number_of_correspondences(0), mnInliersi(0),
-    mnIterations(0), mnBestInliers(0), N(0)
+    mnIterations(0), mnBestInliers(0), N(0), mbSPRT(false), mSPRTDelta(0.05)
 {
     mvpMapPointMatches = vpMapPointMatches;
-    mvP2D.reserve(F.mvpMapPoints.size());
-    mvSigma2.reserve(F.mvpMapPoints.size());
-    mvP3Dw.reserve(F.mvpMapPoints.size());
-    mvKeyPointIndices.reserve(F.mvpMapPoints.size());
-    mvAllIndices.reserve(F.mvpMapPoints.size());
 
-    int idx=0;
+    vector<size_t> vIndices;
+    vIndices.reserve(vpMapPointMatches.size());
     for(size_t i=0, iend=vpMapPointMatches.size(); i<iend; i++)
     {
         MapPoint* pMP = vpMapPointMatches[i];
+        if(pMP && !pMP->isBad())
+            vIndices.push_back(i);
+    }
 
-        if(pMP)
-        {
-            if(!pMP->isBad())
-            {
-                const cv::KeyPoint &kp = F.mvKeysUn[i];
-
-                mvP2D.push_back(kp.pt);
-                mvSigma2.push_back(F.mvLevelSigma2[kp.octave]);
+    // Random order, a hypothesis rejected by a partial check has seen a random subset
+    for(int i=(int)vIndices.size()-1; i>0; i--)
+        swap(vIndices[i],vIndices[DUtils::Random::RandomInt(0,i)]);
+
+    const size_t nMatches = vIndices.size();
+    mvU.reserve(nMatches);
+    mvV.reserve(nMatches);
+    mvSigma2.reserve(nMatches);
+    mvX.reserve(nMatches);
+    mvY.reserve(nMatches);
+    mvZ.reserve(nMatches);
+    mvKeyPointIndices.reserve(nMatches);
+    mvDistances.reserve(nMatches);
+
+    for(size_t idx=0; idx<nMatches; idx++)
+    {
+        const size_t i = vIndices[idx];
+        const cv::KeyPoint &kp = F.mvKeysUn[i];
 
-                cv::Mat Pos = pMP->GetWorldPos();
-                mvP3Dw.push_back(cv::Point3f(Pos.at<float>(0),Pos.at<float>(1), Pos.at<float>(2)));
+        mvU.push_back(kp.pt.x);
+        mvV.push_back(kp.pt.y);
+        mvSigma2.push_back(F.mvLevelSigma2[kp.octave]);
 
-                mvKeyPointIndices.push_back(i);
-                mvAllIndices.push_back(idx);               
+        const Eigen::Vector3f Pos = vpMapPointMatches[i]->GetWorldPosEigen();
+        mvX.push_back(Pos(0));
+        mvY.push_back(Pos(1));
+        mvZ.push_back(Pos(2));
 
-                idx++;
-            }
-        }
+        mvKeyPointIndices.push_back(i);
+        mvDistances.push_back(DBoW2::Hamming::distance(vpMapPointMatches[i]->GetDescriptor(),F.mDescriptors.ptr<uchar>(i)));
     }
 
+    mvError2.resize(nMatches);
+
     // Set camera calibration parameters
     fu = F.fx;
     fv = F.fy;
@@ -98,7 +142,7 @@ void PnPsolver::SetRansacParameters(double probability, int minInliers, int maxI
     mRansacEpsilon = epsilon;
     mRansacMinSet = minSet;
 
-    N = mvP2D.size(); // number of correspondences
+    N = mvU.size(); // number of correspondences
 
     mvbInliersi.resize(N);
 
@@ -126,6 +170,41 @@ void PnPsolver::SetRansacParameters(double probability, int minInliers, int maxI
     mvMaxError.resize(mvSigma2.size());
     for(size_t i=0; i<mvSigma2.size(); i++)
         mvMaxError[i] = mvSigma2[i]*th2;
+
+    mSampler.Reset(mvDistances,mRansacMinSet);
+
+    ComputeSPRTThreshold();
+}
+
+void PnPsolver::SetSPRT(bool bEnable)
+{
+    mbSPRT = bEnable;
+}
+
+void PnPsolver::ComputeSPRTThreshold()
+{
+    // An inlier of a good hypothesis appears with probability epsilon, of a bad one with probability delta
+    const double epsilon = min((double)mRansacEpsilon,0.99);
+    const double delta = mSPRTDelta;
+
+    mSPRTLogInlier = log(delta/epsilon);
+    mSPRTLogOutlier = log((1-delta)/(1-epsilon));
+
+    // The test can not separate good and bad hypotheses
+    if(epsilon<=delta)
+    {
+        mSPRTLogThreshold = -1;
+        return;
+    }
+
+    // Optimal threshold A = t_M*m_S/C + 1 + log(A), by fixed point iteration
+    const double C = (1-delta)*mSPRTLogOutlier + delta*mSPRTLogInlier;
+    const double A0 = SPRT_MODEL_COST/C + 1;
+    double A = A0;
+    for(int i=0; i<10; i++)
+        A = A0 + log(A);
+
+    mSPRTLogThreshold = log(A);
 }
 
 cv::Mat PnPsolver::find(vector<bool> &vbInliers, int &nInliers)
@@ -148,8 +227,6 @@ cv::Mat PnPsolver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInlie
         return cv::Mat();
     }
 
-    vector<size_t> vAvailableIndices;
-
     int nCurrentIterations = 0;
     while(mnIterations<mRansacMaxIts || nCurrentIterations<nIterations)
     {
@@ -157,42 +234,32 @@ cv::Mat PnPsolver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInlie
         mnIterations++;
         reset_correspondences();
 
-        vAvailableIndices = mvAllIndices;
-
-        // Get min set of points
+        // Get min set of points, the closest matches first
+        mSampler.Sample(mvSet);
         for(short i = 0; i < mRansacMinSet; ++i)
         {
-            int randi = DUtils::Random::RandomInt(0, vAvailableIndices.size()-1);
-
-            int idx = vAvailableIndices[randi];
-
-            add_correspondence(mvP3Dw[idx].x,mvP3Dw[idx].y,mvP3Dw[idx].z,mvP2D[idx].x,mvP2D[idx].y);
-
-            vAvailableIndices[idx] = vAvailableIndices.back();
-            vAvailableIndices.pop_back();
+            const size_t idx = mvSet[i];
+            add_correspondence(mvX[idx],mvY[idx],mvZ[idx],mvU[idx],mvV[idx]);
         }
 
         // Compute camera pose
         compute_pose(mRi, mti);
 
-        // Check inliers
-        CheckInliers();
+        // Check inliers, stopping as soon as the hypothesis can not be accepted
+        if(!CheckInliers(true))
+            continue;
 
         if(mnInliersi>=mRansacMinInliers)
         {
             // If it is the best solution so far, save it
+            // Its inlier ratio bounds the iterations still needed to find a better one
             if(mnInliersi>mnBestInliers)
             {
                 mvbBestInliers = mvbInliersi;
                 mnBestInliers = mnInliersi;
-
-                cv::Mat Rcw(3,3,CV_64F,mRi);
-                cv::Mat tcw(3,1,CV_64F,mti);
-                Rcw.convertTo(Rcw,CV_32F);
-                tcw.convertTo(tcw,CV_32F);
-                mBestTcw = cv::Mat::eye(4,4,CV_32F);
-                Rcw.copyTo(mBestTcw.rowRange(0,3).colRange(0,3));
-                tcw.copyTo(mBestTcw.rowRange(0,3).col(3));
+                mBestTcw = PoseMatrix(mRi,mti);
+                const int nBound = ProsacSampler::RansacIterations(mRansacProb,(double)mnBestInliers/N,mRansacMinSet,mRansacMaxIts);
+                mRansacMaxIts = max(mnIterations,nBound);
             }
 
             if(Refine())
@@ -249,27 +316,21 @@ bool PnPsolver::Refine()
     for(size_t i=0; i<vIndices.size(); i++)
     {
         int idx = vIndices[i];
-        add_correspondence(mvP3Dw[idx].x,mvP3Dw[idx].y,mvP3Dw[idx].z,mvP2D[idx].x,mvP2D[idx].y);
+        add_correspondence(mvX[idx],mvY[idx],mvZ[idx],mvU[idx],mvV[idx]);
     }
 
     // Compute camera pose
     compute_pose(mRi, mti);
 
     // Check inliers
-    CheckInliers();
+    CheckInliers(false);
 
     mnRefinedInliers =mnInliersi;
     mvbRefinedInliers = mvbInliersi;
 
     if(mnInliersi>mRansacMinInliers)
     {
-        cv::Mat Rcw(3,3,CV_64F,mRi);
-        cv::Mat tcw(3,1,CV_64F,mti);
-        Rcw.convertTo(Rcw,CV_32F);
-        tcw.convertTo(tcw,CV_32F);
-        mRefinedTcw = cv::Mat::eye(4,4,CV_32F);
-        Rcw.copyTo(mRefinedTcw.rowRange(0,3).colRange(0,3));
-        tcw.copyTo(mRefinedTcw.rowRange(0,3).col(3));
+        mRefinedTcw = PoseMatrix(mRi,mti);
         return true;
     }
 
@@ -277,37 +338,113 @@ bool PnPsolver::Refine()
 }
 
 
-void PnPsolver::CheckInliers()
+bool PnPsolver::CheckInliers(bool bPreemptive)
 {
     mnInliersi=0;
 
-    for(int i=0; i<N; i++)
-    {
-        cv::Point3f P3Dw = mvP3Dw[i];
-        cv::Point2f P2D = mvP2D[i];
-
-        float Xc = mRi[0][0]*P3Dw.x+mRi[0][1]*P3Dw.y+mRi[0][2]*P3Dw.z+mti[0];
-        float Yc = mRi[1][0]*P3Dw.x+mRi[1][1]*P3Dw.y+mRi[1][2]*P3Dw.z+mti[1];
-        float invZc = 1/(mRi[2][0]*P3Dw.x+mRi[2][1]*P3Dw.y+mRi[2][2]*P3Dw.z+mti[2]);
-
-        double ue = uc + fu * Xc * invZc;
-        double ve = vc + fv * Yc * invZc;
+    // Once this many outliers are found the minimum number of inliers can not be reached
+    const int nMaxOutliers = N-mRansacMinInliers;
+    const bool bSPRT = bPreemptive && mbSPRT && mSPRTLogThreshold>0;
 
-        float distX = P2D.x-ue;
-        float distY = P2D.y-ve;
+    int nOutliers=0;
+    double logLambda=0;
 
-        float error2 = distX*distX+distY*distY;
+    for(int i=0; i<N; i+=CHECK_BLOCK)
+    {
+        const int iend = min(i+CHECK_BLOCK,N);
+        ComputeErrors(i,iend);
 
-        if(error2<mvMaxError[i])
+        int nBlockInliers=0;
+        for(int j=i; j<iend; j++)
         {
-            mvbInliersi[i]=true;
-            mnInliersi++;
+            const bool bInlier = mvError2[j]<mvMaxError[j];
+            mvbInliersi[j]=bInlier;
+            nBlockInliers += bInlier;
         }
-        else
+        mnInliersi += nBlockInliers;
+        nOutliers += iend-i-nBlockInliers;
+
+        if(!bPreemptive)
+            continue;
+
+        if(nOutliers>nMaxOutliers)
+            return false;
+
+        if(bSPRT)
         {
-            mvbInliersi[i]=false;
+            logLambda += nBlockInliers*mSPRTLogInlier + (iend-i-nBlockInliers)*mSPRTLogOutlier;
+            if(logLambda>mSPRTLogThreshold)
+                return false;
         }
     }
+
+    return true;
+}
+
+void PnPsolver::ComputeErrors(int i, const int iend)
+{
+    const float r00 = mRi[0][0], r01 = mRi[0][1], r02 = mRi[0][2], t0 = mti[0];
+    const float r10 = mRi[1][0], r11 = mRi[1][1], r12 = mRi[1][2], t1 = mti[1];
+    const float r20 = mRi[2][0], r21 = mRi[2][1], r22 = mRi[2][2], t2 = mti[2];
+    const float fx = fu, fy = fv, cx = uc, cy = vc;
+
+#if defined(ORB_SLAM_SIMD_SSE2)
+    const __m128 vr00 = _mm_set1_ps(r00), vr01 = _mm_set1_ps(r01), vr02 = _mm_set1_ps(r02), vt0 = _mm_set1_ps(t0);
+    const __m128 vr10 = _mm_set1_ps(r10), vr11 = _mm_set1_ps(r11), vr12 = _mm_set1_ps(r12), vt1 = _mm_set1_ps(t1);
+    const __m128 vr20 = _mm_set1_ps(r20), vr21 = _mm_set1_ps(r21), vr22 = _mm_set1_ps(r22), vt2 = _mm_set1_ps(t2);
+    const __m128 vfx = _mm_set1_ps(fx), vfy = _mm_set1_ps(fy), vcx = _mm_set1_ps(cx), vcy = _mm_set1_ps(cy);
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    for(; i+4<=iend; i+=4)
+    {
+        const __m128 x = _mm_loadu_ps(&mvX[i]), y = _mm_loadu_ps(&mvY[i]), z = _mm_loadu_ps(&mvZ[i]);
+
+        const __m128 xc = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vr00,x),_mm_mul_ps(vr01,y)),_mm_mul_ps(vr02,z)),vt0);
+        const __m128 yc = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vr10,x),_mm_mul_ps(vr11,y)),_mm_mul_ps(vr12,z)),vt1);
+        const __m128 zc = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vr20,x),_mm_mul_ps(vr21,y)),_mm_mul_ps(vr22,z)),vt2);
+
+        const __m128 invz = _mm_div_ps(one,zc);
+        const __m128 du = _mm_sub_ps(_mm_loadu_ps(&mvU[i]),_mm_add_ps(_mm_mul_ps(_mm_mul_ps(vfx,xc),invz),vcx));
+        const __m128 dv = _mm_sub_ps(_mm_loadu_ps(&mvV[i]),_mm_add_ps(_mm_mul_ps(_mm_mul_ps(vfy,yc),invz),vcy));
+
+        _mm_storeu_ps(&mvError2[i],_mm_add_ps(_mm_mul_ps(du,du),_mm_mul_ps(dv,dv)));
+    }
+#elif defined(ORB_SLAM_SIMD_NEON)
+    const float32x4_t vt0 = vdupq_n_f32(t0), vt1 = vdupq_n_f32(t1), vt2 = vdupq_n_f32(t2);
+    const float32x4_t vcx = vdupq_n_f32(cx), vcy = vdupq_n_f32(cy);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+
+    for(; i+4<=iend; i+=4)
+    {
+        const float32x4_t x = vld1q_f32(&mvX[i]), y = vld1q_f32(&mvY[i]), z = vld1q_f32(&mvZ[i]);
+
+        const float32x4_t xc = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x,r00),vmulq_n_f32(y,r01)),vmulq_n_f32(z,r02)),vt0);
+        const float32x4_t yc = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x,r10),vmulq_n_f32(y,r11)),vmulq_n_f32(z,r12)),vt1);
+        const float32x4_t zc = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x,r20),vmulq_n_f32(y,r21)),vmulq_n_f32(z,r22)),vt2);
+
+        const float32x4_t invz = vdivq_f32(one,zc);
+        const float32x4_t du = vsubq_f32(vld1q_f32(&mvU[i]),vaddq_f32(vmulq_f32(vmulq_n_f32(xc,fx),invz),vcx));
+        const float32x4_t dv = vsubq_f32(vld1q_f32(&mvV[i]),vaddq_f32(vmulq_f32(vmulq_n_f32(yc,fy),invz),vcy));
+
+        vst1q_f32(&mvError2[i],vaddq_f32(vmulq_f32(du,du),vmulq_f32(dv,dv)));
+    }
+#endif
+
+    // Remaining correspondences, same operations in the same order
+    for(; i<iend; i++)
+    {
+        const float x = mvX[i], y = mvY[i], z = mvZ[i];
+
+        const float xc = r00*x+r01*y+r02*z+t0;
+        const float yc = r10*x+r11*y+r12*z+t1;
+        const float zc = r20*x+r21*y+r22*z+t2;
+
+        const float invz = 1.0f/zc;
+        const float du = mvU[i]-(fx*xc*invz+cx);
+        const float dv = mvV[i]-(fy*yc*invz+cy);
+
+        mvError2[i] = du*du+dv*dv;
+    }
 }
 
 
@@ -357,81 +494,62 @@ void PnPsolver::choose_control_points(void)
 
 
   // Take C1, C2, and C3 from PCA on the reference points:
-  CvMat * PW0 = cvCreateMat(number_of_correspondences, 3, CV_64F);
-
-  double pw0tpw0[3 * 3], dc[3], uct[3 * 3];
-  CvMat PW0tPW0 = cvMat(3, 3, CV_64F, pw0tpw0);
-  CvMat DC      = cvMat(3, 1, CV_64F, dc);
-  CvMat UCt     = cvMat(3, 3, CV_64F, uct);
-
-  for(int i = 0; i < number_of_correspondences; i++)
-    for(int j = 0; j < 3; j++)
-      PW0->data.db[3 * i + j] = pws[3 * i + j] - cws[0][j];
-
-  cvMulTransposed(PW0, &PW0tPW0, 1);
-  cvSVD(&PW0tPW0, &DC, &UCt, 0, CV_SVD_MODIFY_A | CV_SVD_U_T);
+  Eigen::Matrix3d PW0tPW0 = Eigen::Matrix3d::Zero();
+  for(int i = 0; i < number_of_correspondences; i++) {
+    const Eigen::Vector3d pw0(pws[3 * i] - cws[0][0], pws[3 * i + 1] - cws[0][1], pws[3 * i + 2] - cws[0][2]);
+    PW0tPW0.noalias() += pw0 * pw0.transpose();
+  }
 
-  cvReleaseMat(&PW0);
+  // Eigenvalues in increasing order, the principal directions are taken from the largest
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> es(PW0tPW0);
+  const Eigen::Vector3d dc = es.eigenvalues();
+  const Eigen::Matrix3d uc_ = es.eigenvectors();
 
   for(int i = 1; i < 4; i++) {
-    double k = sqrt(dc[i - 1] / number_of_correspondences);
+    double k = sqrt(max(dc(3 - i), 0.0) / number_of_correspondences);
     for(int j = 0; j < 3; j++)
-      cws[i][j] = cws[0][j] + k * uct[3 * (i - 1) + j];
+      cws[i][j] = cws[0][j] + k * uc_(j, 3 - i);
   }
 }
 
 void PnPsolver::compute_barycentric_coordinates(void)
 {
-  double cc[3 * 3], cc_inv[3 * 3];
-  CvMat CC     = cvMat(3, 3, CV_64F, cc);
-  CvMat CC_inv = cvMat(3, 3, CV_64F, cc_inv);
+  Eigen::Matrix3d CC;
 
   for(int i = 0; i < 3; i++)
     for(int j = 1; j < 4; j++)
-      cc[3 * i + j - 1] = cws[j][i] - cws[0][i];
+      CC(i, j - 1) = cws[j][i] - cws[0][i];
+
+  // Pseudo-inverse, the control points are degenerate for planar configurations
+  Eigen::JacobiSVD<Eigen::Matrix3d> svd(CC, Eigen::ComputeFullU | Eigen::ComputeFullV);
+  const Eigen::Vector3d s = svd.singularValues();
+  Eigen::Vector3d s_inv;
+  for(int i = 0; i < 3; i++)
+    s_inv(i) = s(i) > s(0) * Eigen::NumTraits<double>::epsilon() ? 1.0 / s(i) : 0.0;
+  const Eigen::Matrix3d CC_inv = svd.matrixV() * s_inv.asDiagonal() * svd.matrixU().transpose();
 
-  cvInvert(&CC, &CC_inv, CV_SVD);
-  double * ci = cc_inv;
   for(int i = 0; i < number_of_correspondences; i++) {
     double * pi = pws + 3 * i;
     double * a = alphas + 4 * i;
 
     for(int j = 0; j < 3; j++)
       a[1 + j] =
-	ci[3 * j    ] * (pi[0] - cws[0][0]) +
-	ci[3 * j + 1] * (pi[1] - cws[0][1]) +
-	ci[3 * j + 2] * (pi[2] - cws[0][2]);
+	CC_inv(j, 0) * (pi[0] - cws[0][0]) +
+	CC_inv(j, 1) * (pi[1] - cws[0][1]) +
+	CC_inv(j, 2) * (pi[2] - cws[0][2]);
     a[0] = 1.0f - a[1] - a[2] - a[3];
   }
 }
 
-void PnPsolver::fill_M(CvMat * M,
-		  const int row, const double * as, const double u, const double v)
-{
-  double * M1 = M->data.db + row * 12;
-  double * M2 = M1 + 12;
-
-  for(int i = 0; i < 4; i++) {
-    M1[3 * i    ] = as[i] * fu;
-    M1[3 * i + 1] = 0.0;
-    M1[3 * i + 2] = as[i] * (uc - u);
-
-    M2[3 * i    ] = 0.0;
-    M2[3 * i + 1] = as[i] * fv;
-    M2[3 * i + 2] = as[i] * (vc - v);
-  }
-}
-
-void PnPsolver::compute_ccs(const double * betas, const double * ut)
+void PnPsolver::compute_ccs(const double * betas, const Eigen::Matrix<double,12,4> &V)
 {
   for(int i = 0; i < 4; i++)
     ccs[i][0] = ccs[i][1] = ccs[i][2] = 0.0f;
 
   for(int i = 0; i < 4; i++) {
-    const double * v = ut + 12 * (11 - i);
     for(int j = 0; j < 4; j++)
       for(int k = 0; k < 3; k++)
-	ccs[j][k] += betas[i] * v[3 * j + k];
+	ccs[j][k] += betas[i] * V(3 * j + k, i);
   }
 }
 
@@ -451,41 +569,52 @@ double PnPsolver::compute_pose(double R[3][3], double t[3])
   choose_control_points();
   compute_barycentric_coordinates();
 
-  CvMat * M = cvCreateMat(2 * number_of_correspondences, 12, CV_64F);
+  // M^t M is accumulated from the two rows of M of each correspondence, M is never built
+  Eigen::Matrix<double,12,12> MtM = Eigen::Matrix<double,12,12>::Zero();
+  Eigen::Matrix<double,12,1> M1, M2;
 
-  for(int i = 0; i < number_of_correspondences; i++)
-    fill_M(M, 2 * i, alphas + 4 * i, us[2 * i], us[2 * i + 1]);
+  for(int i = 0; i < number_of_correspondences; i++) {
+    const double * as = alphas + 4 * i;
+    const double u = us[2 * i], v = us[2 * i + 1];
 
-  double mtm[12 * 12], d[12], ut[12 * 12];
-  CvMat MtM = cvMat(12, 12, CV_64F, mtm);
-  CvMat D   = cvMat(12,  1, CV_64F, d);
-  CvMat Ut  = cvMat(12, 12, CV_64F, ut);
+    for(int j = 0; j < 4; j++) {
+      M1(3 * j    ) = as[j] * fu;
+      M1(3 * j + 1) = 0.0;
+      M1(3 * j + 2) = as[j] * (uc - u);
 
-  cvMulTransposed(M, &MtM, 1);
-  cvSVD(&MtM, &D, &Ut, 0, CV_SVD_MODIFY_A | CV_SVD_U_T);
-  cvReleaseMat(&M);
+      M2(3 * j    ) = 0.0;
+      M2(3 * j + 1) = as[j] * fv;
+      M2(3 * j + 2) = as[j] * (vc - v);
+    }
 
-  double l_6x10[6 * 10], rho[6];
-  CvMat L_6x10 = cvMat(6, 10, CV_64F, l_6x10);
-  CvMat Rho    = cvMat(6,  1, CV_64F, rho);
+    MtM.selfadjointView<Eigen::Lower>().rankUpdate(M1);
+    MtM.selfadjointView<Eigen::Lower>().rankUpdate(M2);
+  }
+
+  // The solution lies in the span of the eigenvectors of the four smallest eigenvalues
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double,12,12> > es(MtM);
+  const Eigen::Matrix<double,12,4> V = es.eigenvectors().leftCols<4>();
 
-  compute_L_6x10(ut, l_6x10);
-  compute_rho(rho);
+  Eigen::Matrix<double,6,10> L_6x10;
+  Eigen::Matrix<double,6,1> Rho;
+
+  compute_L_6x10(V, L_6x10);
+  compute_rho(Rho);
 
   double Betas[4][4], rep_errors[4];
   double Rs[4][3][3], ts[4][3];
 
-  find_betas_approx_1(&L_6x10, &Rho, Betas[1]);
-  gauss_newton(&L_6x10, &Rho, Betas[1]);
-  rep_errors[1] = compute_R_and_t(ut, Betas[1], Rs[1], ts[1]);
+  find_betas_approx_1(L_6x10, Rho, Betas[1]);
+  gauss_newton(L_6x10, Rho, Betas[1]);
+  rep_errors[1] = compute_R_and_t(V, Betas[1], Rs[1], ts[1]);
 
-  find_betas_approx_2(&L_6x10, &Rho, Betas[2]);
-  gauss_newton(&L_6x10, &Rho, Betas[2]);
-  rep_errors[2] = compute_R_and_t(ut, Betas[2], Rs[2], ts[2]);
+  find_betas_approx_2(L_6x10, Rho, Betas[2]);
+  gauss_newton(L_6x10, Rho, Betas[2]);
+  rep_errors[2] = compute_R_and_t(V, Betas[2], Rs[2], ts[2]);
 
-  find_betas_approx_3(&L_6x10, &Rho, Betas[3]);
-  gauss_newton(&L_6x10, &Rho, Betas[3]);
-  rep_errors[3] = compute_R_and_t(ut, Betas[3], Rs[3], ts[3]);
+  find_betas_approx_3(L_6x10, Rho, Betas[3]);
+  gauss_newton(L_6x10, Rho, Betas[3]);
+  rep_errors[3] = compute_R_and_t(V, Betas[3], Rs[3], ts[3]);
 
   int N = 1;
   if (rep_errors[2] < rep_errors[1]) N = 2;
@@ -559,29 +688,24 @@ void PnPsolver::estimate_R_and_t(double R[3][3], double t[3])
     pw0[j] /= number_of_correspondences;
   }
 
-  double abt[3 * 3], abt_d[3], abt_u[3 * 3], abt_v[3 * 3];
-  CvMat ABt   = cvMat(3, 3, CV_64F, abt);
-  CvMat ABt_D = cvMat(3, 1, CV_64F, abt_d);
-  CvMat ABt_U = cvMat(3, 3, CV_64F, abt_u);
-  CvMat ABt_V = cvMat(3, 3, CV_64F, abt_v);
-
-  cvSetZero(&ABt);
+  Eigen::Matrix3d ABt = Eigen::Matrix3d::Zero();
   for(int i = 0; i < number_of_correspondences; i++) {
     double * pc = pcs + 3 * i;
     double * pw = pws + 3 * i;
 
     for(int j = 0; j < 3; j++) {
-      abt[3 * j    ] += (pc[j] - pc0[j]) * (pw[0] - pw0[0]);
-      abt[3 * j + 1] += (pc[j] - pc0[j]) * (pw[1] - pw0[1]);
-      abt[3 * j + 2] += (pc[j] - pc0[j]) * (pw[2] - pw0[2]);
+      ABt(j, 0) += (pc[j] - pc0[j]) * (pw[0] - pw0[0]);
+      ABt(j, 1) += (pc[j] - pc0[j]) * (pw[1] - pw0[1]);
+      ABt(j, 2) += (pc[j] - pc0[j]) * (pw[2] - pw0[2]);
     }
   }
 
-  cvSVD(&ABt, &ABt_D, &ABt_U, &ABt_V, CV_SVD_MODIFY_A);
+  Eigen::JacobiSVD<Eigen::Matrix3d> svd(ABt, Eigen::ComputeFullU | Eigen::ComputeFullV);
+  const Eigen::Matrix3d Rm = svd.matrixU() * svd.matrixV().transpose();
 
   for(int i = 0; i < 3; i++)
     for(int j = 0; j < 3; j++)
-      R[i][j] = dot(abt_u + 3 * i, abt_v + 3 * j);
+      R[i][j] = Rm(i, j);
 
   const double det =
     R[0][0] * R[1][1] * R[2][2] + R[0][1] * R[1][2] * R[2][0] + R[0][2] * R[1][0] * R[2][1] -
@@ -598,13 +722,6 @@ void PnPsolver::estimate_R_and_t(double R[3][3], double t[3])
   t[2] = pc0[2] - dot(R[2], pw0);
 }
 
-void PnPsolver::print_pose(const double R[3][3], const double t[3])
-{
-  cout << R[0][0] << " " << R[0][1] << " " << R[0][2] << " " << t[0] << endl;
-  cout << R[1][0] << " " << R[1][1] << " " << R[1][2] << " " << t[1] << endl;
-  cout << R[2][0] << " " << R[2][1] << " " << R[2][2] << " " << t[2] << endl;
-}
-
 void PnPsolver::solve_for_sign(void)
 {
   if (pcs[2] < 0.0) {
@@ -620,10 +737,10 @@ void PnPsolver::solve_for_sign(void)
   }
 }
 
-double PnPsolver::compute_R_and_t(const double * ut, const double * betas,
+double PnPsolver::compute_R_and_t(const Eigen::Matrix<double,12,4> &V, const double * betas,
 			     double R[3][3], double t[3])
 {
-  compute_ccs(betas, ut);
+  compute_ccs(betas, V);
   compute_pcs();
 
   solve_for_sign();
@@ -636,21 +753,17 @@ double PnPsolver::compute_R_and_t(const double * ut, const double * betas,
 // betas10        = [B11 B12 B22 B13 B23 B33 B14 B24 B34 B44]
 // betas_approx_1 = [B11 B12     B13         B14]
 
-void PnPsolver::find_betas_approx_1(const CvMat * L_6x10, const CvMat * Rho,
+void PnPsolver::find_betas_approx_1(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho,
 			       double * betas)
 {
-  double l_6x4[6 * 4], b4[4];
-  CvMat L_6x4 = cvMat(6, 4, CV_64F, l_6x4);
-  CvMat B4    = cvMat(4, 1, CV_64F, b4);
+  Eigen::Matrix<double,6,4> L_6x4;
 
-  for(int i = 0; i < 6; i++) {
-    cvmSet(&L_6x4, i, 0, cvmGet(L_6x10, i, 0));
-    cvmSet(&L_6x4, i, 1, cvmGet(L_6x10, i, 1));
-    cvmSet(&L_6x4, i, 2, cvmGet(L_6x10, i, 3));
-    cvmSet(&L_6x4, i, 3, cvmGet(L_6x10, i, 6));
-  }
+  L_6x4.col(0) = L_6x10.col(0);
+  L_6x4.col(1) = L_6x10.col(1);
+  L_6x4.col(2) = L_6x10.col(3);
+  L_6x4.col(3) = L_6x10.col(6);
 
-  cvSolve(&L_6x4, Rho, &B4, CV_SVD);
+  const Eigen::Matrix<double,4,1> b4 = L_6x4.jacobiSvd(Eigen::ComputeFullU | Eigen::ComputeFullV).solve(Rho);
 
   if (b4[0] < 0) {
     betas[0] = sqrt(-b4[0]);
@@ -668,20 +781,12 @@ void PnPsolver::find_betas_approx_1(const CvMat * L_6x10, const CvMat * Rho,
 // betas10        = [B11 B12 B22 B13 B23 B33 B14 B24 B34 B44]
 // betas_approx_2 = [B11 B12 B22                            ]
 
-void PnPsolver::find_betas_approx_2(const CvMat * L_6x10, const CvMat * Rho,
+void PnPsolver::find_betas_approx_2(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho,
 			       double * betas)
 {
-  double l_6x3[6 * 3], b3[3];
-  CvMat L_6x3  = cvMat(6, 3, CV_64F, l_6x3);
-  CvMat B3     = cvMat(3, 1, CV_64F, b3);
+  const Eigen::Matrix<double,6,3> L_6x3 = L_6x10.leftCols<3>();
 
-  for(int i = 0; i < 6; i++) {
-    cvmSet(&L_6x3, i, 0, cvmGet(L_6x10, i, 0));
-    cvmSet(&L_6x3, i, 1, cvmGet(L_6x10, i, 1));
-    cvmSet(&L_6x3, i, 2, cvmGet(L_6x10, i, 2));
-  }
-
-  cvSolve(&L_6x3, Rho, &B3, CV_SVD);
+  const Eigen::Matrix<double,3,1> b3 = L_6x3.jacobiSvd(Eigen::ComputeFullU | Eigen::ComputeFullV).solve(Rho);
 
   if (b3[0] < 0) {
     betas[0] = sqrt(-b3[0]);
@@ -700,22 +805,12 @@ void PnPsolver::find_betas_approx_2(const CvMat * L_6x10, const CvMat * Rho,
 // betas10        = [B11 B12 B22 B13 B23 B33 B14 B24 B34 B44]
 // betas_approx_3 = [B11 B12 B22 B13 B23                    ]
 
-void PnPsolver::find_betas_approx_3(const CvMat * L_6x10, const CvMat * Rho,
+void PnPsolver::find_betas_approx_3(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho,
 			       double * betas)
 {
-  double l_6x5[6 * 5], b5[5];
-  CvMat L_6x5 = cvMat(6, 5, CV_64F, l_6x5);
-  CvMat B5    = cvMat(5, 1, CV_64F, b5);
-
-  for(int i = 0; i < 6; i++) {
-    cvmSet(&L_6x5, i, 0, cvmGet(L_6x10, i, 0));
-    cvmSet(&L_6x5, i, 1, cvmGet(L_6x10, i, 1));
-    cvmSet(&L_6x5, i, 2, cvmGet(L_6x10, i, 2));
-    cvmSet(&L_6x5, i, 3, cvmGet(L_6x10, i, 3));
-    cvmSet(&L_6x5, i, 4, cvmGet(L_6x10, i, 4));
-  }
+  const Eigen::Matrix<double,6,5> L_6x5 = L_6x10.leftCols<5>();
 
-  cvSolve(&L_6x5, Rho, &B5, CV_SVD);
+  const Eigen::Matrix<double,5,1> b5 = L_6x5.jacobiSvd(Eigen::ComputeFullU | Eigen::ComputeFullV).solve(Rho);
 
   if (b5[0] < 0) {
     betas[0] = sqrt(-b5[0]);
@@ -729,23 +824,16 @@ void PnPsolver::find_betas_approx_3(const CvMat * L_6x10, const CvMat * Rho,
   betas[3] = 0.0;
 }
 
-void PnPsolver::compute_L_6x10(const double * ut, double * l_6x10)
+void PnPsolver::compute_L_6x10(const Eigen::Matrix<double,12,4> &V, Eigen::Matrix<double,6,10> &L_6x10)
 {
-  const double * v[4];
-
-  v[0] = ut + 12 * 11;
-  v[1] = ut + 12 * 10;
-  v[2] = ut + 12 *  9;
-  v[3] = ut + 12 *  8;
-
   double dv[4][6][3];
 
   for(int i = 0; i < 4; i++) {
     int a = 0, b = 1;
     for(int j = 0; j < 6; j++) {
-      dv[i][j][0] = v[i][3 * a    ] - v[i][3 * b];
-      dv[i][j][1] = v[i][3 * a + 1] - v[i][3 * b + 1];
-      dv[i][j][2] = v[i][3 * a + 2] - v[i][3 * b + 2];
+      dv[i][j][0] = V(3 * a    , i) - V(3 * b    , i);
+      dv[i][j][1] = V(3 * a + 1, i) - V(3 * b + 1, i);
+      dv[i][j][2] = V(3 * a + 2, i) - V(3 * b + 2, i);
 
       b++;
       if (b > 3) {
@@ -756,44 +844,42 @@ void PnPsolver::compute_L_6x10(const double * ut, double * l_6x10)
   }
 
   for(int i = 0; i < 6; i++) {
-    double * row = l_6x10 + 10 * i;
-
-    row[0] =        dot(dv[0][i], dv[0][i]);
-    row[1] = 2.0f * dot(dv[0][i], dv[1][i]);
-    row[2] =        dot(dv[1][i], dv[1][i]);
-    row[3] = 2.0f * dot(dv[0][i], dv[2][i]);
-    row[4] = 2.0f * dot(dv[1][i], dv[2][i]);
-    row[5] =        dot(dv[2][i], dv[2][i]);
-    row[6] = 2.0f * dot(dv[0][i], dv[3][i]);
-    row[7] = 2.0f * dot(dv[1][i], dv[3][i]);
-    row[8] = 2.0f * dot(dv[2][i], dv[3][i]);
-    row[9] =        dot(dv[3][i], dv[3][i]);
+    L_6x10(i, 0) =        dot(dv[0][i], dv[0][i]);
+    L_6x10(i, 1) = 2.0f * dot(dv[0][i], dv[1][i]);
+    L_6x10(i, 2) =        dot(dv[1][i], dv[1][i]);
+    L_6x10(i, 3) = 2.0f * dot(dv[0][i], dv[2][i]);
+    L_6x10(i, 4) = 2.0f * dot(dv[1][i], dv[2][i]);
+    L_6x10(i, 5) =        dot(dv[2][i], dv[2][i]);
+    L_6x10(i, 6) = 2.0f * dot(dv[0][i], dv[3][i]);
+    L_6x10(i, 7) = 2.0f * dot(dv[1][i], dv[3][i]);
+    L_6x10(i, 8) = 2.0f * dot(dv[2][i], dv[3][i]);
+    L_6x10(i, 9) =        dot(dv[3][i], dv[3][i]);
   }
 }
 
-void PnPsolver::compute_rho(double * rho)
+void PnPsolver::compute_rho(Eigen::Matrix<double,6,1> &rho)
 {
-  rho[0] = dist2(cws[0], cws[1]);
-  rho[1] = dist2(cws[0], cws[2]);
-  rho[2] = dist2(cws[0], cws[3]);
-  rho[3] = dist2(cws[1], cws[2]);
-  rho[4] = dist2(cws[1], cws[3]);
-  rho[5] = dist2(cws[2], cws[3]);
+  rho(0) = dist2(cws[0], cws[1]);
+  rho(1) = dist2(cws[0], cws[2]);
+  rho(2) = dist2(cws[0], cws[3]);
+  rho(3) = dist2(cws[1], cws[2]);
+  rho(4) = dist2(cws[1], cws[3]);
+  rho(5) = dist2(cws[2], cws[3]);
 }
 
-void PnPsolver::compute_A_and_b_gauss_newton(const double * l_6x10, const double * rho,
-					double betas[4], CvMat * A, CvMat * b)
+void PnPsolver::compute_A_and_b_gauss_newton(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho,
+					const double betas[4], Eigen::Matrix<double,6,4> &A, Eigen::Matrix<double,6,1> &b)
 {
   for(int i = 0; i < 6; i++) {
-    const double * rowL = l_6x10 + i * 10;
-    double * rowA = A->data.db + i * 4;
+    const double rowL[10] = {L_6x10(i, 0), L_6x10(i, 1), L_6x10(i, 2), L_6x10(i, 3), L_6x10(i, 4),
+                             L_6x10(i, 5), L_6x10(i, 6), L_6x10(i, 7), L_6x10(i, 8), L_6x10(i, 9)};
 
-    rowA[0] = 2 * rowL[0] * betas[0] +     rowL[1] * betas[1] +     rowL[3] * betas[2] +     rowL[6] * betas[3];
-    rowA[1] =     rowL[1] * betas[0] + 2 * rowL[2] * betas[1] +     rowL[4] * betas[2] +     rowL[7] * betas[3];
-    rowA[2] =     rowL[3] * betas[0] +     rowL[4] * betas[1] + 2 * rowL[5] * betas[2] +     rowL[8] * betas[3];
-    rowA[3] =     rowL[6] * betas[0] +     rowL[7] * betas[1] +     rowL[8] * betas[2] + 2 * rowL[9] * betas[3];
+    A(i, 0) = 2 * rowL[0] * betas[0] +     rowL[1] * betas[1] +     rowL[3] * betas[2] +     rowL[6] * betas[3];
+    A(i, 1) =     rowL[1] * betas[0] + 2 * rowL[2] * betas[1] +     rowL[4] * betas[2] +     rowL[7] * betas[3];
+    A(i, 2) =     rowL[3] * betas[0] +     rowL[4] * betas[1] + 2 * rowL[5] * betas[2] +     rowL[8] * betas[3];
+    A(i, 3) =     rowL[6] * betas[0] +     rowL[7] * betas[1] +     rowL[8] * betas[2] + 2 * rowL[9] * betas[3];
 
-    cvmSet(b, i, 0, rho[i] -
+    b(i) = Rho(i) -
 	   (
 	    rowL[0] * betas[0] * betas[0] +
 	    rowL[1] * betas[0] * betas[1] +
@@ -805,190 +891,27 @@ void PnPsolver::compute_A_and_b_gauss_newton(const double * l_6x10, const double
 	    rowL[7] * betas[1] * betas[3] +
 	    rowL[8] * betas[2] * betas[3] +
 	    rowL[9] * betas[3] * betas[3]
-	    ));
+	    );
   }
 }
 
-void PnPsolver::gauss_newton(const CvMat * L_6x10, const CvMat * Rho,
+void PnPsolver::gauss_newton(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho,
 			double betas[4])
 {
   const int iterations_number = 5;
 
-  double a[6*4], b[6], x[4];
-  CvMat A = cvMat(6, 4, CV_64F, a);
-  CvMat B = cvMat(6, 1, CV_64F, b);
-  CvMat X = cvMat(4, 1, CV_64F, x);
+  Eigen::Matrix<double,6,4> A;
+  Eigen::Matrix<double,6,1> B;
 
   for(int k = 0; k < iterations_number; k++) {
-    compute_A_and_b_gauss_newton(L_6x10->data.db, Rho->data.db,
-				 betas, &A, &B);
-    qr_solve(&A, &B, &X);
+    compute_A_and_b_gauss_newton(L_6x10, Rho, betas, A, B);
 
-    for(int i = 0; i < 4; i++)
-      betas[i] += x[i];
-  }
-}
-
-void PnPsolver::qr_solve(CvMat * A, CvMat * b, CvMat * X)
-{
-  static int max_nr = 0;
-  static double * A1, * A2;
+    // Least squares step by Householder QR, as the original qr_solve
+    const Eigen::Matrix<double,4,1> X = A.householderQr().solve(B);
 
-  const int nr = A->rows;
-  const int nc = A->cols;
-
-  if (max_nr != 0 && max_nr < nr) {
-    delete [] A1;
-    delete [] A2;
-  }
-  if (max_nr < nr) {
-    max_nr = nr;
-    A1 = new double[nr];
-    A2 = new double[nr];
-  }
-
-  double * pA = A->data.db, * ppAkk = pA;
-  for(int k = 0; k < nc; k++) {
-    double * ppAik = ppAkk, eta = fabs(*ppAik);
-    for(int i = k + 1; i < nr; i++) {
-      double elt = fabs(*ppAik);
-      if (eta < elt) eta = elt;
-      ppAik += nc;
-    }
-
-    if (eta == 0) {
-      A1[k] = A2[k] = 0.0;
-      cerr << "God damnit, A is singular, this shouldn't happen." << endl;
-      return;
-    } else {
-      double * ppAik = ppAkk, sum = 0.0, inv_eta = 1. / eta;
-      for(int i = k; i < nr; i++) {
-	*ppAik *= inv_eta;
-	sum += *ppAik * *ppAik;
-	ppAik += nc;
-      }
-      double sigma = sqrt(sum);
-      if (*ppAkk < 0)
-	sigma = -sigma;
-      *ppAkk += sigma;
-      A1[k] = sigma * *ppAkk;
-      A2[k] = -eta * sigma;
-      for(int j = k + 1; j < nc; j++) {
-	double * ppAik = ppAkk, sum = 0;
-	for(int i = k; i < nr; i++) {
-	  sum += *ppAik * ppAik[j - k];
-	  ppAik += nc;
-	}
-	double tau = sum / A1[k];
-	ppAik = ppAkk;
-	for(int i = k; i < nr; i++) {
-	  ppAik[j - k] -= tau * *ppAik;
-	  ppAik += nc;
-	}
-      }
-    }
-    ppAkk += nc + 1;
-  }
-
-  // b <- Qt b
-  double * ppAjj = pA, * pb = b->data.db;
-  for(int j = 0; j < nc; j++) {
-    double * ppAij = ppAjj, tau = 0;
-    for(int i = j; i < nr; i++)	{
-      tau += *ppAij * pb[i];
-      ppAij += nc;
-    }
-    tau /= A1[j];
-    ppAij = ppAjj;
-    for(int i = j; i < nr; i++) {
-      pb[i] -= tau * *ppAij;
-      ppAij += nc;
-    }
-    ppAjj += nc + 1;
-  }
-
-  // X = R-1 b
-  double * pX = X->data.db;
-  pX[nc - 1] = pb[nc - 1] / A2[nc - 1];
-  for(int i = nc - 2; i >= 0; i--) {
-    double * ppAij = pA + i * nc + (i + 1), sum = 0;
-
-    for(int j = i + 1; j < nc; j++) {
-      sum += *ppAij * pX[j];
-      ppAij++;
-    }
-    pX[i] = (pb[i] - sum) / A2[i];
-  }
-}
-
-
-
-void PnPsolver::relative_error(double & rot_err, double & transl_err,
-			  const double Rtrue[3][3], const double ttrue[3],
-			  const double Rest[3][3],  const double test[3])
-{
-  double qtrue[4], qest[4];
-
-  mat_to_quat(Rtrue, qtrue);
-  mat_to_quat(Rest, qest);
-
-  double rot_err1 = sqrt((qtrue[0] - qest[0]) * (qtrue[0] - qest[0]) +
-			 (qtrue[1] - qest[1]) * (qtrue[1] - qest[1]) +
-			 (qtrue[2] - qest[2]) * (qtrue[2] - qest[2]) +
-			 (qtrue[3] - qest[3]) * (qtrue[3] - qest[3]) ) /
-    sqrt(qtrue[0] * qtrue[0] + qtrue[1] * qtrue[1] + qtrue[2] * qtrue[2] + qtrue[3] * qtrue[3]);
-
-  double rot_err2 = sqrt((qtrue[0] + qest[0]) * (qtrue[0] + qest[0]) +
-			 (qtrue[1] + qest[1]) * (qtrue[1] + qest[1]) +
-			 (qtrue[2] + qest[2]) * (qtrue[2] + qest[2]) +
-			 (qtrue[3] + qest[3]) * (qtrue[3] + qest[3]) ) /
-    sqrt(qtrue[0] * qtrue[0] + qtrue[1] * qtrue[1] + qtrue[2] * qtrue[2] + qtrue[3] * qtrue[3]);
-
-  rot_err = min(rot_err1, rot_err2);
-
-  transl_err =
-    sqrt((ttrue[0] - test[0]) * (ttrue[0] - test[0]) +
-	 (ttrue[1] - test[1]) * (ttrue[1] - test[1]) +
-	 (ttrue[2] - test[2]) * (ttrue[2] - test[2])) /
-    sqrt(ttrue[0] * ttrue[0] + ttrue[1] * ttrue[1] + ttrue[2] * ttrue[2]);
-}
-
-void PnPsolver::mat_to_quat(const double R[3][3], double q[4])
-{
-  double tr = R[0][0] + R[1][1] + R[2][2];
-  double n4;
-
-  if (tr > 0.0f) {
-    q[0] = R[1][2] - R[2][1];
-    q[1] = R[2][0] - R[0][2];
-    q[2] = R[0][1] - R[1][0];
-    q[3] = tr + 1.0f;
-    n4 = q[3];
-  } else if ( (R[0][0] > R[1][1]) && (R[0][0] > R[2][2]) ) {
-    q[0] = 1.0f + R[0][0] - R[1][1] - R[2][2];
-    q[1] = R[1][0] + R[0][1];
-    q[2] = R[2][0] + R[0][2];
-    q[3] = R[1][2] - R[2][1];
-    n4 = q[0];
-  } else if (R[1][1] > R[2][2]) {
-    q[0] = R[1][0] + R[0][1];
-    q[1] = 1.0f + R[1][1] - R[0][0] - R[2][2];
-    q[2] = R[2][1] + R[1][2];
-    q[3] = R[2][0] - R[0][2];
-    n4 = q[1];
-  } else {
-    q[0] = R[2][0] + R[0][2];
-    q[1] = R[2][1] + R[1][2];
-    q[2] = 1.0f + R[2][2] - R[0][0] - R[1][1];
-    q[3] = R[0][1] - R[1][0];
-    n4 = q[2];
+    for(int i = 0; i < 4; i++)
+      betas[i] += X(i);
   }
-  double scale = 0.5f / double(sqrt(n4));
-
-  q[0] *= scale;
-  q[1] *= scale;
-  q[2] *= scale;
-  q[3] *= scale;
 }
 
 } //namespace ORB_SLAM
@@ -0,0 +1,89 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/PoolRunner.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+PoolRunner::PoolRunner(TaskPool::Priority priority): mPriority(priority)
+{
+}
+
+PoolRunner* PoolRunner::Get(TaskPool::Priority priority)
+{
+    static PoolRunner* runners[TaskPool::N_PRIORITIES] = {
+        new PoolRunner(TaskPool::TRACKING), new PoolRunner(TaskPool::LOCAL_MAPPING),
+        new PoolRunner(TaskPool::LOOP_CLOSING), new PoolRunner(TaskPool::RELOCALIZATION),
+        new PoolRunner(TaskPool::VISUALIZATION)};
+    return runners[priority];
+}
+
+int PoolRunner::slots() const
+{
+    return TaskPool::Global()->GetThreads();
+}
+
+// Each task takes the next grain until none is left, so the slower tasks take fewer grains
+static void RunGrains(const g2o::ParallelRunner::Body* pBody, int n, int grain, int slot, boost::atomic<int>* pNext)
+{
+    for(int begin=pNext->fetch_add(grain); begin<n; begin=pNext->fetch_add(grain))
+        (*pBody)(begin,min(begin+grain,n),slot);
+}
+
+void PoolRunner::run(int n, int grain, const g2o::ParallelRunner::Body &body)
+{
+    if(n<=0)
+        return;
+    grain = max(grain,1);
+
+    const int nTasks = min(slots(),(n+grain-1)/grain);
+    boost::atomic<int> next(0);
+
+    TaskGroup tasks(mPriority);
+    for(int i=1; i<nTasks; i++)
+        tasks.Run(boost::bind(&RunGrains,&body,n,grain,i,&next));
+    RunGrains(&body,n,grain,0,&next);
+    tasks.Wait();
+}
+
+static void RunRows(const DBoW2::TransformRunner::Rows* pRows, int begin, int end)
+{
+    (*pRows)(begin,end);
+}
+
+void PoolRunner::run(int n, int nTasks, const DBoW2::TransformRunner::Rows &rows)
+{
+    nTasks = max(min(nTasks,n),1);
+
+    TaskGroup tasks(mPriority);
+    for(int i=1; i<nTasks; i++)
+        tasks.Run(boost::bind(&RunRows,&rows,i*n/nTasks,(i+1)*n/nTasks));
+    rows(0,n/nTasks);
+    tasks.Wait();
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,89 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/PosePredictor.h"
+#include "util/ImuIntegrator.h"
+#include "util/Converter.h"
+
+#include <algorithm>
+
+namespace ORB_SLAM
+{
+
+PosePredictor::PosePredictor(float fMaxHorizon, ImuIntegrator* pImu):
+    mfMaxHorizon(fMaxHorizon), mpImu(pImu), mbValid(false), mTimeStamp(0)
+{
+    mTwist.setZero();
+}
+
+void PosePredictor::Correct(double timestamp, const cv::Mat &Tcw)
+{
+    const g2o::SE3Quat T = Converter::toSE3Quat(Tcw);
+
+    boost::mutex::scoped_lock lock(mMutex);
+    const double dt = timestamp-mTimeStamp;
+    if(mbValid && dt>0 && dt<=mfMaxHorizon)
+    {
+        // Tcl = Tcw*Tlw^-1, as the velocity of the motion model
+        mTwist = (T*mTcw.inverse()).log()/dt;
+    }
+    else
+        mTwist.setZero();
+
+    mTcw = T;
+    mTimeStamp = timestamp;
+    mbValid = true;
+}
+
+void PosePredictor::Reset()
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    mbValid = false;
+    mTwist.setZero();
+}
+
+bool PosePredictor::Predict(double t, cv::Mat &Tcw, double &timestamp)
+{
+    g2o::SE3Quat T;
+    g2o::Vector6d twist;
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        if(!mbValid || t-mTimeStamp>mfMaxHorizon)
+            return false;
+        T = mTcw;
+        twist = mTwist;
+        timestamp = mTimeStamp;
+    }
+
+    // A clock behind the last frame gives the frame itself
+    const double tau = std::max(t-timestamp,0.0);
+    g2o::SE3Quat Tck = g2o::SE3Quat::exp(twist*tau);
+
+    // The gyroscope measured the rotation since the frame, the translation stays with the velocity
+    Eigen::Matrix3d Rck;
+    if(mpImu && tau>0 && mpImu->PredictRotation(timestamp,t,Rck))
+        Tck = g2o::SE3Quat(Rck,Tck.translation());
+
+    Tcw = Converter::toCvMat(Tck*T);
+    return true;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,468 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/PoseSolver.h"
+
+#include "types/Frame.h"
+#include "types/Camera.h"
+#include "types/MapPoint.h"
+#include "util/Converter.h"
+#include "util/Optimizer.h"
+
+#include <Eigen/Cholesky>
+#include <algorithm>
+#include <cmath>
+
+// Vectorized evaluation is used when the target supports it, unless ORB_SLAM_NO_SIMD is defined
+// The scalar evaluation is kept as reference and for the remaining observations
+#if !defined(ORB_SLAM_NO_SIMD)
+#if defined(__SSE2__)
+#define ORB_SLAM_SIMD_SSE2
+#include <emmintrin.h>
+#elif (defined(__ARM_NEON__) || defined(__ARM_NEON)) && defined(__aarch64__)
+#define ORB_SLAM_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace ORB_SLAM
+{
+
+PoseSolver::PoseSolver():
+    mfx(0), mfy(0), mfcx(0), mfcy(0)
+{}
+
+int PoseSolver::Optimize(Frame *pFrame)
+{
+    return Optimize(pFrame,std::vector<Frame*>());
+}
+
+int PoseSolver::Optimize(Frame *pFrame, const std::vector<Frame*> &vpRigFrames)
+{
+    mvpFrames.assign(1,pFrame);
+    mvpFrames.insert(mvpFrames.end(),vpRigFrames.begin(),vpRigFrames.end());
+
+    mvnFrame.clear();
+    mvnIndex.clear();
+    mvX.clear(); mvY.clear(); mvZ.clear();
+    mvObsU.clear(); mvObsV.clear();
+    mvInvSigma2.clear(); mvInformation.clear();
+    mvFx.clear(); mvFy.clear(); mvCx.clear(); mvCy.clear();
+    mvRcr.clear(); mvtcr.clear();
+
+    for(size_t f=0; f<mvpFrames.size(); f++)
+        Gather(mvpFrames[f],f);
+
+    const size_t M = mvnIndex.size();
+    mvXc.resize(M); mvYc.resize(M); mvZc.resize(M);
+    mvErrU.resize(M); mvErrV.resize(M); mvChi2.resize(M);
+
+    const int nInitialCorrespondences = mvnIndex.size();
+    if(nInitialCorrespondences==0)
+        return 0;
+
+    g2o::SE3Quat Tcw = Converter::toSE3Quat(pFrame->mTcw);
+
+    // We perform 4 optimizations, decreasing the inlier region
+    // From second to final optimization the outliers keep a negligible information
+    // At the end of each optimization we check which points are inliers
+    const float chi2[4]={9.210,7.378,5.991,5.991};
+    const int its[4]={10,10,7,5};
+
+    int nBad=0;
+    for(size_t it=0; it<4; it++)
+    {
+        const bool bConverged = Levenberg(Tcw,its[it]);
+
+        // Outliers are tested again with their whole information
+        for(size_t k=0; k<M; k++)
+            if(mvpFrames[mvnFrame[k]]->mvbOutlier[mvnIndex[k]])
+                mvInformation[k] = mvInvSigma2[k];
+        Evaluate(Tcw);
+
+        nBad=0;
+        int nChanged=0;
+        for(size_t k=0; k<M; k++)
+        {
+            const size_t idx = mvnIndex[k];
+            Frame* pF = mvpFrames[mvnFrame[k]];
+            const bool bOutlier = mvChi2[k]>chi2[it];
+            if(bOutlier!=pF->mvbOutlier[idx])
+                nChanged++;
+            if(bOutlier)
+            {
+                pF->mvbOutlier[idx]=true;
+                mvInformation[k] = 1e-10;
+                nBad++;
+            }
+            else
+            {
+                pF->mvbOutlier[idx]=false;
+            }
+        }
+
+        if(nInitialCorrespondences<10)
+            break;
+
+        // The next round would solve the same problem from its solution
+        if(bConverged && nChanged==0 && it+1<4 && chi2[it+1]==chi2[it])
+            break;
+    }
+
+    // Recover optimized pose, written in place as Mat::copyTo would do
+    const Eigen::Matrix<double,4,4> T = Tcw.to_homogeneous_matrix();
+    pFrame->mTcw.create(4,4,CV_32F);
+    for(int i=0; i<4; i++)
+        for(int j=0; j<4; j++)
+            pFrame->mTcw.at<float>(i,j) = T(i,j);
+
+    for(size_t f=0; f<vpRigFrames.size(); f++)
+        vpRigFrames[f]->mTcw = vpRigFrames[f]->mpCamera->mTcr*pFrame->mTcw;
+
+    return nInitialCorrespondences-nBad;
+}
+
+void PoseSolver::Gather(Frame *pFrame, const int nFrame)
+{
+    if(nFrame==0)
+    {
+        mfx = pFrame->fx;
+        mfy = pFrame->fy;
+        mfcx = pFrame->cx;
+        mfcy = pFrame->cy;
+        mvRcr.push_back(Eigen::Matrix3f::Identity());
+        mvtcr.push_back(Eigen::Vector3f::Zero());
+    }
+    else
+    {
+        const cv::Mat &Tcr = pFrame->mpCamera->mTcr;
+        mvRcr.push_back(Converter::toMatrix3f(Tcr.rowRange(0,3).colRange(0,3)));
+        mvtcr.push_back(Converter::toVector3f(Tcr.rowRange(0,3).col(3)));
+    }
+    mvFx.push_back(pFrame->fx);
+    mvFy.push_back(pFrame->fy);
+    mvCx.push_back(pFrame->cx);
+    mvCy.push_back(pFrame->cy);
+
+    const size_t N = pFrame->mvpMapPoints.size();
+    for(size_t i=0; i<N; i++)
+    {
+        MapPoint* pMP = pFrame->mvpMapPoints[i];
+        if(!pMP)
+            continue;
+
+        pFrame->mvbOutlier[i] = false;
+
+        const Eigen::Vector3f Pos = pMP->GetWorldPosEigen();
+        const cv::KeyPoint &kpUn = pFrame->mvKeysUn[i];
+        const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
+
+        mvnFrame.push_back(nFrame);
+        mvnIndex.push_back(i);
+        mvX.push_back(Pos(0)); mvY.push_back(Pos(1)); mvZ.push_back(Pos(2));
+        mvObsU.push_back(kpUn.pt.x); mvObsV.push_back(kpUn.pt.y);
+        mvInvSigma2.push_back(invSigma2);
+        mvInformation.push_back(invSigma2);
+    }
+
+    if(nFrame==0)
+        mnFirstFrame = mvnIndex.size();
+}
+
+double PoseSolver::Evaluate(const g2o::SE3Quat &Tcw)
+{
+    const Eigen::Matrix3f R = Tcw.rotation().toRotationMatrix().cast<float>();
+    const Eigen::Vector3f t = Tcw.translation().cast<float>();
+
+    const size_t N = mvnIndex.size();
+    const size_t N0 = mnFirstFrame;
+    size_t i = 0;
+
+#if defined(ORB_SLAM_SIMD_SSE2)
+    const __m128 r00 = _mm_set1_ps(R(0,0)), r01 = _mm_set1_ps(R(0,1)), r02 = _mm_set1_ps(R(0,2));
+    const __m128 r10 = _mm_set1_ps(R(1,0)), r11 = _mm_set1_ps(R(1,1)), r12 = _mm_set1_ps(R(1,2));
+    const __m128 r20 = _mm_set1_ps(R(2,0)), r21 = _mm_set1_ps(R(2,1)), r22 = _mm_set1_ps(R(2,2));
+    const __m128 t0 = _mm_set1_ps(t(0)), t1 = _mm_set1_ps(t(1)), t2 = _mm_set1_ps(t(2));
+    const __m128 fx = _mm_set1_ps(mfx), fy = _mm_set1_ps(mfy), cx = _mm_set1_ps(mfcx), cy = _mm_set1_ps(mfcy);
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    for(; i+4<=N0; i+=4)
+    {
+        const __m128 x = _mm_loadu_ps(&mvX[i]), y = _mm_loadu_ps(&mvY[i]), z = _mm_loadu_ps(&mvZ[i]);
+
+        // 3D in camera coordinates
+        const __m128 xc = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r00,x),_mm_mul_ps(r01,y)),_mm_mul_ps(r02,z)),t0);
+        const __m128 yc = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r10,x),_mm_mul_ps(r11,y)),_mm_mul_ps(r12,z)),t1);
+        const __m128 zc = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r20,x),_mm_mul_ps(r21,y)),_mm_mul_ps(r22,z)),t2);
+
+        // Reprojection error, observation minus projection as EdgeSE3ProjectXYZ
+        const __m128 invz = _mm_div_ps(one,zc);
+        const __m128 eu = _mm_sub_ps(_mm_loadu_ps(&mvObsU[i]),_mm_add_ps(_mm_mul_ps(_mm_mul_ps(fx,xc),invz),cx));
+        const __m128 ev = _mm_sub_ps(_mm_loadu_ps(&mvObsV[i]),_mm_add_ps(_mm_mul_ps(_mm_mul_ps(fy,yc),invz),cy));
+        const __m128 chi2 = _mm_mul_ps(_mm_loadu_ps(&mvInformation[i]),_mm_add_ps(_mm_mul_ps(eu,eu),_mm_mul_ps(ev,ev)));
+
+        _mm_storeu_ps(&mvXc[i],xc);
+        _mm_storeu_ps(&mvYc[i],yc);
+        _mm_storeu_ps(&mvZc[i],zc);
+        _mm_storeu_ps(&mvErrU[i],eu);
+        _mm_storeu_ps(&mvErrV[i],ev);
+        _mm_storeu_ps(&mvChi2[i],chi2);
+    }
+#elif defined(ORB_SLAM_SIMD_NEON)
+    const float32x4_t t0 = vdupq_n_f32(t(0)), t1 = vdupq_n_f32(t(1)), t2 = vdupq_n_f32(t(2));
+    const float32x4_t cx = vdupq_n_f32(mfcx), cy = vdupq_n_f32(mfcy);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+
+    for(; i+4<=N0; i+=4)
+    {
+        const float32x4_t x = vld1q_f32(&mvX[i]), y = vld1q_f32(&mvY[i]), z = vld1q_f32(&mvZ[i]);
+
+        // 3D in camera coordinates
+        const float32x4_t xc = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x,R(0,0)),vmulq_n_f32(y,R(0,1))),vmulq_n_f32(z,R(0,2))),t0);
+        const float32x4_t yc = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x,R(1,0)),vmulq_n_f32(y,R(1,1))),vmulq_n_f32(z,R(1,2))),t1);
+        const float32x4_t zc = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x,R(2,0)),vmulq_n_f32(y,R(2,1))),vmulq_n_f32(z,R(2,2))),t2);
+
+        // Reprojection error, observation minus projection as EdgeSE3ProjectXYZ
+        const float32x4_t invz = vdivq_f32(one,zc);
+        const float32x4_t eu = vsubq_f32(vld1q_f32(&mvObsU[i]),vaddq_f32(vmulq_f32(vmulq_n_f32(xc,mfx),invz),cx));
+        const float32x4_t ev = vsubq_f32(vld1q_f32(&mvObsV[i]),vaddq_f32(vmulq_f32(vmulq_n_f32(yc,mfy),invz),cy));
+        const float32x4_t chi2 = vmulq_f32(vld1q_f32(&mvInformation[i]),vaddq_f32(vmulq_f32(eu,eu),vmulq_f32(ev,ev)));
+
+        vst1q_f32(&mvXc[i],xc);
+        vst1q_f32(&mvYc[i],yc);
+        vst1q_f32(&mvZc[i],zc);
+        vst1q_f32(&mvErrU[i],eu);
+        vst1q_f32(&mvErrV[i],ev);
+        vst1q_f32(&mvChi2[i],chi2);
+    }
+#endif
+
+    // Remaining observations, same operations in the same order
+    for(; i<N0; i++)
+    {
+        const float x = mvX[i], y = mvY[i], z = mvZ[i];
+
+        const float xc = R(0,0)*x+R(0,1)*y+R(0,2)*z+t(0);
+        const float yc = R(1,0)*x+R(1,1)*y+R(1,2)*z+t(1);
+        const float zc = R(2,0)*x+R(2,1)*y+R(2,2)*z+t(2);
+
+        const float invz = 1.0f/zc;
+        const float eu = mvObsU[i]-(mfx*xc*invz+mfcx);
+        const float ev = mvObsV[i]-(mfy*yc*invz+mfcy);
+
+        mvXc[i] = xc;
+        mvYc[i] = yc;
+        mvZc[i] = zc;
+        mvErrU[i] = eu;
+        mvErrV[i] = ev;
+        mvChi2[i] = mvInformation[i]*(eu*eu+ev*ev);
+    }
+
+    // Observations of the other cameras of the rig, through their pose in the rig
+    for(; i<N; i++)
+    {
+        const int f = mvnFrame[i];
+        const Eigen::Vector3f Xr = mvRcr[f]*(R*Eigen::Vector3f(mvX[i],mvY[i],mvZ[i])+t)+mvtcr[f];
+
+        const float invz = 1.0f/Xr(2);
+        const float eu = mvObsU[i]-(mvFx[f]*Xr(0)*invz+mvCx[f]);
+        const float ev = mvObsV[i]-(mvFy[f]*Xr(1)*invz+mvCy[f]);
+
+        mvXc[i] = Xr(0);
+        mvYc[i] = Xr(1);
+        mvZc[i] = Xr(2);
+        mvErrU[i] = eu;
+        mvErrV[i] = ev;
+        mvChi2[i] = mvInformation[i]*(eu*eu+ev*ev);
+    }
+
+    // Huber kernel, as g2o::RobustKernelHuber
+    const float delta = sqrt(5.991);
+    const double deltaSqr = (double)delta*delta;
+    double robustChi2 = 0;
+    for(i=0; i<N; i++)
+    {
+        const double e = mvChi2[i];
+        if(e<=deltaSqr)
+            robustChi2 += e;
+        else
+            robustChi2 += 2*sqrt(e)*delta-deltaSqr;
+    }
+
+    return robustChi2;
+}
+
+template<typename T>
+void PoseSolver::Linearize(Eigen::Matrix<T,6,6> &H, Eigen::Matrix<T,6,1> &b)
+{
+    const float delta = sqrt(5.991);
+    const T deltaSqr = (T)delta*delta;
+
+    H.setZero();
+    b.setZero();
+
+    Eigen::Matrix<T,2,6> J;
+    for(size_t i=0, iend=mvnIndex.size(); i<iend; i++)
+    {
+        const T x = mvXc[i];
+        const T y = mvYc[i];
+        const T z = mvZc[i];
+        const T z_2 = z*z;
+
+        if(i<mnFirstFrame)
+        {
+            // Jacobian of the error wrt the pose, as EdgeSE3ProjectXYZ::linearizeOplus
+            J(0,0) =  x*y/z_2 *mfx;
+            J(0,1) = -(1+(x*x/z_2)) *mfx;
+            J(0,2) = y/z *mfx;
+            J(0,3) = -1/z *mfx;
+            J(0,4) = 0;
+            J(0,5) = x/z_2 *mfx;
+
+            J(1,0) = (1+y*y/z_2) *mfy;
+            J(1,1) = -x*y/z_2 *mfy;
+            J(1,2) = -x/z *mfy;
+            J(1,3) = 0;
+            J(1,4) = -1/z *mfy;
+            J(1,5) = y/z_2 *mfy;
+        }
+        // Other cameras of the rig: the pose moves the point in the first camera, seen through Rcr
+        else
+        {
+            const int f = mvnFrame[i];
+            const Eigen::Matrix<T,3,3> Rcr = mvRcr[f].cast<T>();
+            const Eigen::Matrix<T,3,1> Xc = Rcr.transpose()*(Eigen::Matrix<T,3,1>(x,y,z)-mvtcr[f].cast<T>());
+
+            Eigen::Matrix<T,2,3> Jp;
+            Jp << mvFx[f]/z, 0, -mvFx[f]*x/z_2,
+                  0, mvFy[f]/z, -mvFy[f]*y/z_2;
+            const Eigen::Matrix<T,2,3> A = Jp*Rcr;
+
+            Eigen::Matrix<T,3,3> Xcx;
+            Xcx << 0, -Xc(2), Xc(1),
+                   Xc(2), 0, -Xc(0),
+                   -Xc(1), Xc(0), 0;
+            J.template leftCols<3>() = A*Xcx;
+            J.template rightCols<3>() = -A;
+        }
+
+        // Information weighted by the kernel derivative
+        const T e = mvChi2[i];
+        T w = mvInformation[i];
+        if(e>deltaSqr)
+            w *= delta/sqrt(e);
+
+        const Eigen::Matrix<T,2,1> r(mvErrU[i],mvErrV[i]);
+        H.noalias() += w*J.transpose()*J;
+        b.noalias() -= w*J.transpose()*r;
+    }
+}
+
+bool PoseSolver::Levenberg(g2o::SE3Quat &Tcw, const int nIterations)
+{
+    const LevenbergSettings &settings = Optimizer::GetLevenbergSettings();
+
+    Eigen::Matrix<double,6,6> H;
+    Eigen::Matrix<double,6,1> b;
+    Eigen::Matrix<float,6,6> Hf;
+    Eigen::Matrix<float,6,1> bf;
+    double lambda = 0;
+    double ni = 2;
+    int nBad = 0;
+
+    for(int iter=0; iter<nIterations; iter++)
+    {
+        double currentChi = Evaluate(Tcw);
+        const double iniChi = currentChi;
+
+        if(settings.bSinglePrecision)
+        {
+            Linearize(Hf,bf);
+            H = Hf.cast<double>();
+            b = bf.cast<double>();
+        }
+        else
+        {
+            Linearize(H,b);
+        }
+
+        if(iter==0)
+            lambda = 1e-5*H.diagonal().cwiseAbs().maxCoeff();
+
+        double rho = 0;
+        double maxUpdate = 0;
+        int nTrials = 0;
+        do
+        {
+            Eigen::Matrix<double,6,6> Hl = H;
+            Hl.diagonal().array() += lambda;
+            Eigen::LDLT<Eigen::Matrix<double,6,6> > ldlt(Hl);
+
+            if(ldlt.isPositive())
+            {
+                const Eigen::Matrix<double,6,1> dx = ldlt.solve(b);
+                const g2o::SE3Quat Tnew = g2o::SE3Quat::exp(dx)*Tcw;
+                const double tempChi = Evaluate(Tnew);
+                rho = (currentChi-tempChi)/(dx.dot(lambda*dx+b)+1e-3);
+
+                if(rho>0)
+                {
+                    // Last step was good
+                    const double alpha = std::min(1.-pow(2*rho-1,3),2./3.);
+                    lambda *= std::max(1./3.,alpha);
+                    ni = 2;
+                    currentChi = tempChi;
+                    Tcw = Tnew;
+                    maxUpdate = dx.cwiseAbs().maxCoeff();
+                }
+            }
+            else
+            {
+                rho = -1;
+            }
+
+            if(rho<=0)
+            {
+                lambda *= ni;
+                ni *= 2;
+            }
+            nTrials++;
+        }
+        while(rho<0 && nTrials<10);
+
+        if(nTrials==10 || rho==0)
+            return true;
+
+        // Stop when the error does not decrease or the pose does not move, as in g2o
+        if((iniChi-currentChi)<settings.fMinDecrease*iniChi)
+            nBad++;
+        else
+            nBad=0;
+
+        if(nBad>=settings.nStallIterations)
+            return true;
+
+        if(settings.fMinUpdate>0 && maxUpdate<settings.fMinUpdate)
+            return true;
+    }
+    return false;
+}
+
+} //namespace ORB_SLAM
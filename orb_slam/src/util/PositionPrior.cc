@@ -0,0 +1,89 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/PositionPrior.h"
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+// Positions older than this, relative to the newest one, are dropped. Frames are tagged well within it
+static const double MAX_HISTORY = 10.0;
+
+PositionPrior::PositionPrior(double maxGap):
+    mfMaxGap(maxGap)
+{
+}
+
+void PositionPrior::AddPosition(double timestamp, const cv::Point3f &position)
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    if(!mdSamples.empty() && timestamp<=mdSamples.back().t)
+        return;
+
+    Sample s;
+    s.t = timestamp;
+    s.position = position;
+    mdSamples.push_back(s);
+
+    while(mdSamples.front().t<timestamp-MAX_HISTORY)
+        mdSamples.pop_front();
+}
+
+bool PositionPrior::GetPosition(double t, cv::Point3f &position)
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    if(mdSamples.empty())
+        return false;
+
+    // First sample not older than t
+    size_t i=0;
+    while(i<mdSamples.size() && mdSamples[i].t<t)
+        i++;
+
+    // Newer than every sample, the last position is held, as when its message is still queued
+    if(i==mdSamples.size())
+    {
+        if(t-mdSamples.back().t>mfMaxGap)
+            return false;
+        position = mdSamples.back().position;
+        return true;
+    }
+
+    const Sample &next = mdSamples[i];
+    if(i==0)
+    {
+        if(next.t-t>mfMaxGap)
+            return false;
+        position = next.position;
+        return true;
+    }
+
+    const Sample &prev = mdSamples[i-1];
+    if(next.t-prev.t>mfMaxGap)
+        return false;
+    const float a = (t-prev.t)/(next.t-prev.t);
+    position = prev.position+a*(next.position-prev.position);
+    return true;
+}
+
+} //namespace ORB_SLAM
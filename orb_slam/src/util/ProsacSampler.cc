@@ -0,0 +1,115 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/ProsacSampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "dutils/Random.h"
+
+namespace ORB_SLAM
+{
+
+// Ranks by quality, the order of equal ones is kept
+struct CompareQuality
+{
+    const std::vector<int>* pvQuality;
+    bool operator()(size_t a, size_t b) const {return (*pvQuality)[a]<(*pvQuality)[b];}
+};
+
+ProsacSampler::ProsacSampler():
+    mN(0), mm(0), mt(0), mn(0), mTn(0), mTnPrime(1)
+{
+}
+
+void ProsacSampler::Reset(const std::vector<int> &vQuality, int m, int nGrowthMax)
+{
+    mN = vQuality.size();
+    mm = m;
+
+    mvOrder.resize(mN);
+    mvPositions.resize(mN);
+    for(int i=0; i<mN; i++)
+    {
+        mvOrder[i] = i;
+        mvPositions[i] = i;
+    }
+    CompareQuality compare;
+    compare.pvQuality = &vQuality;
+    std::stable_sort(mvOrder.begin(),mvOrder.end(),compare);
+
+    // Average number of the sets of nGrowthMax uniform ones drawn only from the first m
+    mt = 0;
+    mn = std::min(m,mN);
+    mTn = nGrowthMax;
+    for(int i=0; i<m && i<mN; i++)
+        mTn *= (double)(m-i)/(mN-i);
+    mTnPrime = 1;
+}
+
+void ProsacSampler::Sample(std::vector<size_t> &vSet)
+{
+    vSet.resize(mm);
+    Sample(&vSet[0]);
+}
+
+void ProsacSampler::Sample(size_t* pSet)
+{
+    mt++;
+
+    // The prefix grows when uniform sampling would have drawn its next correspondence
+    if(mt>mTnPrime && mn<mN)
+    {
+        const double Tn1 = mTn*(mn+1)/(mn+1-mm);
+        mTnPrime += (int)std::ceil(Tn1-mTn);
+        mTn = Tn1;
+        mn++;
+    }
+
+    // The newest correspondence of the prefix and the rest from before it, or all from the prefix
+    // once it has fallen behind
+    const bool bNewest = mTnPrime>=mt;
+    const int nDrawn = bNewest ? mm-1 : mm;
+    const int nFrom = bNewest ? mn-1 : mn;
+
+    // Partial shuffle of the positions of the prefix, they stay within it
+    for(int i=0; i<nDrawn; i++)
+    {
+        const int r = DUtils::Random::RandomInt(i,nFrom-1);
+        std::swap(mvPositions[i],mvPositions[r]);
+        pSet[i] = mvOrder[mvPositions[i]];
+    }
+    if(bNewest)
+        pSet[mm-1] = mvOrder[mn-1];
+}
+
+int ProsacSampler::RansacIterations(double probability, double epsilon, int m, int nMaxIterations)
+{
+    if(epsilon>=1)
+        return 1;
+    if(epsilon<=0)
+        return std::max(1,nMaxIterations);
+    const double nIterations = std::ceil(std::log(1-probability)/std::log(1-std::pow(epsilon,m)));
+    return std::max(1,(int)std::min((double)nMaxIterations,nIterations));
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,126 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/ResidualCode.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+namespace ResidualCode
+{
+
+// Count byte of a descriptor stored as is
+static const unsigned char RAW = 0xFF;
+
+// Rice parameter for n differing bits, the log of their mean gap
+static int RiceParameter(int n)
+{
+    int k = 0;
+    while(k<7 && (n<<(k+1))<=(int)(8*L))
+        k++;
+    return k;
+}
+
+void Encode(const unsigned char* pDescriptor, const unsigned char* pWord, vector<unsigned char> &vCode)
+{
+    int vPositions[8*L];
+    int n = 0;
+    for(size_t j=0; j<L; j++)
+    {
+        const unsigned char r = pDescriptor[j]^pWord[j];
+        for(int b=0; b<8; b++)
+            if(r&(1<<b))
+                vPositions[n++] = 8*j+b;
+    }
+
+    // Gaps in unary quotient and k bit remainder, least significant bit first
+    unsigned char code[L];
+    memset(code,0,L);
+    size_t nBits = 0;
+    bool bRaw = n>=RAW;
+    const int k = RiceParameter(n);
+    for(int i=0, last=-1; i<n && !bRaw; last=vPositions[i], i++)
+    {
+        const int gap = vPositions[i]-last-1;
+        const size_t nNext = nBits+(gap>>k)+1+k;
+        // Not shorter than the descriptor itself
+        if(nNext>8*(L-1))
+        {
+            bRaw = true;
+            break;
+        }
+        for(int q=gap>>k; q>0; q--, nBits++)
+            code[nBits/8] |= 1<<(nBits%8);
+        nBits++; // the stop bit is 0
+        for(int b=0; b<k; b++, nBits++)
+            if(gap&(1<<b))
+                code[nBits/8] |= 1<<(nBits%8);
+    }
+
+    if(bRaw)
+    {
+        vCode.push_back(RAW);
+        vCode.insert(vCode.end(),pDescriptor,pDescriptor+L);
+        return;
+    }
+
+    vCode.push_back(n);
+    vCode.insert(vCode.end(),code,code+(nBits+7)/8);
+}
+
+const unsigned char* Decode(const unsigned char* pCode, const unsigned char* pWord, unsigned char* pDescriptor)
+{
+    const int n = *pCode++;
+    if(n==RAW)
+    {
+        memcpy(pDescriptor,pCode,L);
+        return pCode+L;
+    }
+
+    memcpy(pDescriptor,pWord,L);
+    const int k = RiceParameter(n);
+    size_t nBit = 0;
+    for(int i=0, last=-1; i<n; i++)
+    {
+        int gap = 0;
+        while(pCode[nBit/8]&(1<<(nBit%8)))
+        {
+            gap += 1<<k;
+            nBit++;
+        }
+        nBit++;
+        for(int b=0; b<k; b++, nBit++)
+            if(pCode[nBit/8]&(1<<(nBit%8)))
+                gap |= 1<<b;
+
+        last += gap+1;
+        pDescriptor[last/8] ^= 1<<(last%8);
+    }
+    return pCode+(nBit+7)/8;
+}
+
+} //namespace ResidualCode
+
+} //namespace ORB_SLAM
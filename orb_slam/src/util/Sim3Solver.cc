@@ -22,14 +22,30 @@
 
 #include "util/Sim3Solver.h"
 #include "util/ORBmatcher.h"
+#include "util/Converter.h"
 
 #include <vector>
 #include <cmath>
 #include <opencv/cv.h>
 #include <ros/ros.h>
 
+#include <Eigen/Eigenvalues>
+#include <Eigen/Geometry>
+
 #include "dutils/Random.h"
 
+// Vectorized inlier check is used when the target supports it, unless ORB_SLAM_NO_SIMD is defined
+// The scalar check is kept as reference and for the remaining matches
+#if !defined(ORB_SLAM_NO_SIMD)
+#if defined(__SSE2__)
+#define ORB_SLAM_SIMD_SSE2
+#include <emmintrin.h>
+#elif (defined(__ARM_NEON__) || defined(__ARM_NEON)) && defined(__aarch64__)
+#define ORB_SLAM_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
 namespace ORB_SLAM
 {
 
@@ -48,17 +64,21 @@ Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const vector<MapPoint *>
     mvpMapPoints2.reserve(mN1);
     mvpMatches12 = vpMatched12;
     mvnIndices1.reserve(mN1);
-    mvX3Dc1.reserve(mN1);
-    mvX3Dc2.reserve(mN1);
 
-    cv::Mat Rcw1 = pKF1->GetRotation();
-    cv::Mat tcw1 = pKF1->GetTranslation();
-    cv::Mat Rcw2 = pKF2->GetRotation();
-    cv::Mat tcw2 = pKF2->GetTranslation();
+    const Eigen::Matrix3f Rcw1 = Converter::toMatrix3f(pKF1->GetRotation());
+    const Eigen::Vector3f tcw1 = Converter::toVector3f(pKF1->GetTranslation());
+    const Eigen::Matrix3f Rcw2 = Converter::toMatrix3f(pKF2->GetRotation());
+    const Eigen::Vector3f tcw2 = Converter::toVector3f(pKF2->GetTranslation());
+
+    const cv::Mat K1 = pKF1->GetCalibrationMatrix();
+    const cv::Mat K2 = pKF2->GetCalibrationMatrix();
+    fx1 = K1.at<float>(0,0); fy1 = K1.at<float>(1,1); cx1 = K1.at<float>(0,2); cy1 = K1.at<float>(1,2);
+    fx2 = K2.at<float>(0,0); fy2 = K2.at<float>(1,1); cx2 = K2.at<float>(0,2); cy2 = K2.at<float>(1,2);
 
-    mvAllIndices.reserve(mN1);
+    mvDistances.reserve(mN1);
+    const cv::Mat Descriptors1 = pKF1->GetDescriptors();
+    const cv::Mat Descriptors2 = pKF2->GetDescriptors();
 
-    size_t idx=0;
     for(int i1=0; i1<mN1; i1++)
     {
         if(vpMatched12[i1])
@@ -78,36 +98,30 @@ Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const vector<MapPoint *>
             if(indexKF1<0 || indexKF2<0)
                 continue;
 
-            const cv::KeyPoint &kp1 = pKF1->GetKeyPointUn(indexKF1);
-            const cv::KeyPoint &kp2 = pKF2->GetKeyPointUn(indexKF2);
+            const float sigmaSquare1 = pKF1->GetSigma2(pKF1->GetKeyPointScaleLevel(indexKF1));
+            const float sigmaSquare2 = pKF2->GetSigma2(pKF2->GetKeyPointScaleLevel(indexKF2));
 
-            const float sigmaSquare1 = pKF1->GetSigma2(kp1.octave);
-            const float sigmaSquare2 = pKF2->GetSigma2(kp2.octave);
-
-            mvnMaxError1.push_back(9.210*sigmaSquare1);
-            mvnMaxError2.push_back(9.210*sigmaSquare2);
+            mvMaxError1.push_back(9.210*sigmaSquare1);
+            mvMaxError2.push_back(9.210*sigmaSquare2);
 
             mvpMapPoints1.push_back(pMP1);
             mvpMapPoints2.push_back(pMP2);
             mvnIndices1.push_back(i1);
 
-            cv::Mat X3D1w = pMP1->GetWorldPos();
-            mvX3Dc1.push_back(Rcw1*X3D1w+tcw1);
+            const Eigen::Vector3f X3D1c = Rcw1*Converter::toVector3f(pMP1->GetWorldPos())+tcw1;
+            mvX1.push_back(X3D1c(0)); mvY1.push_back(X3D1c(1)); mvZ1.push_back(X3D1c(2));
+            mvU1.push_back(fx1*X3D1c(0)/X3D1c(2)+cx1);
+            mvV1.push_back(fy1*X3D1c(1)/X3D1c(2)+cy1);
 
-            cv::Mat X3D2w = pMP2->GetWorldPos();
-            mvX3Dc2.push_back(Rcw2*X3D2w+tcw2);
+            const Eigen::Vector3f X3D2c = Rcw2*Converter::toVector3f(pMP2->GetWorldPos())+tcw2;
+            mvX2.push_back(X3D2c(0)); mvY2.push_back(X3D2c(1)); mvZ2.push_back(X3D2c(2));
+            mvU2.push_back(fx2*X3D2c(0)/X3D2c(2)+cx2);
+            mvV2.push_back(fy2*X3D2c(1)/X3D2c(2)+cy2);
 
-            mvAllIndices.push_back(idx);
-            idx++;
+            mvDistances.push_back(DBoW2::Hamming::distance(Descriptors1.ptr<uchar>(indexKF1),Descriptors2.ptr<uchar>(indexKF2)));
         }
     }
 
-    mK1 = pKF1->GetCalibrationMatrix();
-    mK2 = pKF2->GetCalibrationMatrix();
-
-    FromCameraToImage(mvX3Dc1,mvP1im1,mK1);
-    FromCameraToImage(mvX3Dc2,mvP2im2,mK2);
-
     SetRansacParameters();
 }
 
@@ -135,6 +149,7 @@ void Sim3Solver::SetRansacParameters(double probability, int minInliers, int max
     mRansacMaxIts = max(1,min(nIterations,mRansacMaxIts));
 
     mnIterations = 0;
+    mSampler.Reset(mvDistances,3);
 }
 
 cv::Mat Sim3Solver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInliers, int &nInliers)
@@ -149,10 +164,8 @@ cv::Mat Sim3Solver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInli
         return cv::Mat();
     }
 
-    vector<size_t> vAvailableIndices;
-
-    cv::Mat P3Dc1i(3,3,CV_32F);
-    cv::Mat P3Dc2i(3,3,CV_32F);
+    Eigen::Matrix3f P3Dc1i;
+    Eigen::Matrix3f P3Dc2i;
 
     int nCurrentIterations = 0;
     while(mnIterations<mRansacMaxIts && nCurrentIterations<nIterations)
@@ -160,20 +173,15 @@ cv::Mat Sim3Solver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInli
         nCurrentIterations++;
         mnIterations++;
 
-        vAvailableIndices = mvAllIndices;
-
-        // Get min set of points
+        // Get min set of points, the closest matches first
+        size_t vSet[3];
+        mSampler.Sample(vSet);
         for(short i = 0; i < 3; ++i)
         {
-            int randi = DUtils::Random::RandomInt(0, vAvailableIndices.size()-1);
-
-            int idx = vAvailableIndices[randi];
+            const size_t idx = vSet[i];
 
-            mvX3Dc1[idx].copyTo(P3Dc1i.col(i));
-            mvX3Dc2[idx].copyTo(P3Dc2i.col(i));
-
-            vAvailableIndices[idx] = vAvailableIndices.back();
-            vAvailableIndices.pop_back();
+            P3Dc1i.col(i) << mvX1[idx], mvY1[idx], mvZ1[idx];
+            P3Dc2i.col(i) << mvX2[idx], mvY2[idx], mvZ2[idx];
         }
 
         computeT(P3Dc1i,P3Dc2i);
@@ -182,12 +190,19 @@ cv::Mat Sim3Solver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInli
 
         if(mnInliersi>=mnBestInliers)
         {
+            // Its inlier ratio bounds the iterations still needed to find a better one
+            if(mnInliersi>mnBestInliers)
+                mRansacMaxIts = max(mnIterations,ProsacSampler::RansacIterations(mRansacProb,(double)mnInliersi/N,3,mRansacMaxIts));
+
             mvbBestInliers = mvbInliersi;
             mnBestInliers = mnInliersi;
-            mBestT12 = mT12i.clone();
-            mBestRotation = mR12i.clone();
-            mBestTranslation = mt12i.clone();
+            mBestRotation = Converter::toCvMat(mR12i);
+            mBestTranslation = Converter::toCvMat(mt12i);
             mBestScale = ms12i;
+            mBestT12 = cv::Mat::eye(4,4,CV_32F);
+            mBestRotation.copyTo(mBestT12.rowRange(0,3).colRange(0,3));
+            mBestT12.rowRange(0,3).colRange(0,3) *= ms12i;
+            mBestTranslation.copyTo(mBestT12.rowRange(0,3).col(3));
 
             if(mnInliersi>mRansacMinInliers)
             {
@@ -212,149 +227,159 @@ cv::Mat Sim3Solver::find(vector<bool> &vbInliers12, int &nInliers)
     return iterate(mRansacMaxIts,bFlag,vbInliers12,nInliers);
 }
 
-void Sim3Solver::centroid(cv::Mat &P, cv::Mat &Pr, cv::Mat &C)
+void Sim3Solver::computeT(const Eigen::Matrix3f &P1, const Eigen::Matrix3f &P2)
 {
-    cv::reduce(P,C,1,CV_REDUCE_SUM);
-    C = C/P.cols;
-
-    for(int i=0; i<P.cols; i++)
-    {
-        Pr.col(i)=P.col(i)-C;
-    }
-}
-
-void Sim3Solver::computeT(cv::Mat &P1, cv::Mat &P2)
-{
-    // Custom implementation of:
-    // Horn 1987, Closed-form solution of absolute orientataion using unit quaternions
-
     // Step 1: Centroid and relative coordinates
 
-    cv::Mat Pr1(P1.size(),P1.type()); // Relative coordinates to centroid (set 1)
-    cv::Mat Pr2(P2.size(),P2.type()); // Relative coordinates to centroid (set 2)
-    cv::Mat O1(3,1,Pr1.type()); // Centroid of P1
-    cv::Mat O2(3,1,Pr2.type()); // Centroid of P2
-
-    centroid(P1,Pr1,O1);
-    centroid(P2,Pr2,O2);
+    const Eigen::Vector3f O1 = P1.rowwise().mean();
+    const Eigen::Vector3f O2 = P2.rowwise().mean();
+    const Eigen::Matrix3f Pr1 = P1.colwise()-O1;
+    const Eigen::Matrix3f Pr2 = P2.colwise()-O2;
 
     // Step 2: Compute M matrix
 
-    cv::Mat M = Pr2*Pr1.t();
+    const Eigen::Matrix3d M = (Pr2*Pr1.transpose()).cast<double>();
 
     // Step 3: Compute N matrix
 
-    double N11, N12, N13, N14, N22, N23, N24, N33, N34, N44;
-
-    cv::Mat N(4,4,P1.type());
-
-    N11 = M.at<float>(0,0)+M.at<float>(1,1)+M.at<float>(2,2);
-    N12 = M.at<float>(1,2)-M.at<float>(2,1);
-    N13 = M.at<float>(2,0)-M.at<float>(0,2);
-    N14 = M.at<float>(0,1)-M.at<float>(1,0);
-    N22 = M.at<float>(0,0)-M.at<float>(1,1)-M.at<float>(2,2);
-    N23 = M.at<float>(0,1)+M.at<float>(1,0);
-    N24 = M.at<float>(2,0)+M.at<float>(0,2);
-    N33 = -M.at<float>(0,0)+M.at<float>(1,1)-M.at<float>(2,2);
-    N34 = M.at<float>(1,2)+M.at<float>(2,1);
-    N44 = -M.at<float>(0,0)-M.at<float>(1,1)+M.at<float>(2,2);
-
-    N = (cv::Mat_<float>(4,4) << N11, N12, N13, N14,
-                                 N12, N22, N23, N24,
-                                 N13, N23, N33, N34,
-                                 N14, N24, N34, N44);
-
-
-    // Step 4: Eigenvector of the highest eigenvalue
-
-    cv::Mat eval, evec;
-
-    cv::eigen(N,eval,evec); //evec[0] is the quaternion of the desired rotation
-
-    cv::Mat vec(1,3,evec.type());
-    (evec.row(0).colRange(1,4)).copyTo(vec); //extract imaginary part of the quaternion (sin*axis)
+    Eigen::Matrix4d Nm;
+    Nm(0,0) = M(0,0)+M(1,1)+M(2,2);
+    Nm(0,1) = M(1,2)-M(2,1);
+    Nm(0,2) = M(2,0)-M(0,2);
+    Nm(0,3) = M(0,1)-M(1,0);
+    Nm(1,1) = M(0,0)-M(1,1)-M(2,2);
+    Nm(1,2) = M(0,1)+M(1,0);
+    Nm(1,3) = M(2,0)+M(0,2);
+    Nm(2,2) = -M(0,0)+M(1,1)-M(2,2);
+    Nm(2,3) = M(1,2)+M(2,1);
+    Nm(3,3) = -M(0,0)-M(1,1)+M(2,2);
+    Nm(1,0) = Nm(0,1); Nm(2,0) = Nm(0,2); Nm(3,0) = Nm(0,3);
+    Nm(2,1) = Nm(1,2); Nm(3,1) = Nm(1,3); Nm(3,2) = Nm(2,3);
 
-    // Rotation angle. sin is the norm of the imaginary part, cos is the real part
-    double ang=atan2(norm(vec),evec.at<float>(0,0));
+    // Step 4: Eigenvector of the highest eigenvalue, the quaternion of the rotation
+    // The eigenvalues are sorted in increasing order
 
-    vec = 2*ang*vec/norm(vec); //Angle-axis representation. quaternion angle is the half
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> solver(Nm);
+    const Eigen::Vector4d q = solver.eigenvectors().col(3);
 
-    mR12i.create(3,3,P1.type());
-
-    cv::Rodrigues(vec,mR12i); // computes the rotation matrix from angle-axis
+    mR12i = Eigen::Quaterniond(q(0),q(1),q(2),q(3)).normalized().toRotationMatrix().cast<float>();
 
     // Step 5: Rotate set 2
 
-    cv::Mat P3 = mR12i*Pr2;
+    const Eigen::Matrix3f P3 = mR12i*Pr2;
 
     // Step 6: Scale
 
-    double nom = Pr1.dot(P3);
-    cv::Mat aux_P3(P3.size(),P3.type());
-    aux_P3=P3;
-    cv::pow(P3,2,aux_P3);
-    double den = 0;
-
-    for(int i=0; i<aux_P3.rows; i++)
-    {
-        for(int j=0; j<aux_P3.cols; j++)
-        {
-            den+=aux_P3.at<float>(i,j);
-        }
-    }
-
-    ms12i = nom/den;
+    ms12i = Pr1.cwiseProduct(P3).sum()/P3.squaredNorm();
 
     // Step 7: Translation
 
-    mt12i.create(1,3,P1.type());
-    mt12i = O1 - ms12i*mR12i*O2;
-
-    // Step 8: Transformation
-
-    // Step 8.1 T12
-    mT12i = cv::Mat::eye(4,4,P1.type());
-
-    cv::Mat sR = ms12i*mR12i;
-
-    sR.copyTo(mT12i.rowRange(0,3).colRange(0,3));
-    mt12i.copyTo(mT12i.rowRange(0,3).col(3));
-
-    // Step 8.2 T21
-
-    mT21i = cv::Mat::eye(4,4,P1.type());
-
-    cv::Mat sRinv = (1.0/ms12i)*mR12i.t();
-
-    sRinv.copyTo(mT21i.rowRange(0,3).colRange(0,3));
-    cv::Mat tinv = -sRinv*mt12i;
-    tinv.copyTo(mT21i.rowRange(0,3).col(3));
+    mt12i = O1-ms12i*mR12i*O2;
 }
 
-
 void Sim3Solver::CheckInliers()
 {
-    vector<cv::Mat> vP1im2, vP2im1;
-    Project(mvX3Dc2,vP2im1,mT12i,mK1);
-    Project(mvX3Dc1,vP1im2,mT21i,mK2);
+    // Points of camera 2 in camera 1 and of camera 1 in camera 2
+    const Eigen::Matrix3f sR12 = ms12i*mR12i;
+    const Eigen::Vector3f &t12 = mt12i;
+    const Eigen::Matrix3f sR21 = (1.0f/ms12i)*mR12i.transpose();
+    const Eigen::Vector3f t21 = -sR21*mt12i;
 
     mnInliersi=0;
+    int i = 0;
+
+#if defined(ORB_SLAM_SIMD_SSE2)
+    const __m128 vfx1 = _mm_set1_ps(fx1), vfy1 = _mm_set1_ps(fy1), vcx1 = _mm_set1_ps(cx1), vcy1 = _mm_set1_ps(cy1);
+    const __m128 vfx2 = _mm_set1_ps(fx2), vfy2 = _mm_set1_ps(fy2), vcx2 = _mm_set1_ps(cx2), vcy2 = _mm_set1_ps(cy2);
 
-    for(size_t i=0; i<mvP1im1.size(); i++)
+    for(; i+4<=N; i+=4)
     {
-        cv::Mat dist1 = mvP1im1[i]-vP2im1[i];
-        cv::Mat dist2 = vP1im2[i]-mvP2im2[i];
+        // Match i of camera 2 projected in camera 1
+        const __m128 x2 = _mm_loadu_ps(&mvX2[i]), y2 = _mm_loadu_ps(&mvY2[i]), z2 = _mm_loadu_ps(&mvZ2[i]);
+        const __m128 xc1 = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(sR12(0,0)),x2),_mm_mul_ps(_mm_set1_ps(sR12(0,1)),y2)),
+                                                 _mm_mul_ps(_mm_set1_ps(sR12(0,2)),z2)),_mm_set1_ps(t12(0)));
+        const __m128 yc1 = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(sR12(1,0)),x2),_mm_mul_ps(_mm_set1_ps(sR12(1,1)),y2)),
+                                                 _mm_mul_ps(_mm_set1_ps(sR12(1,2)),z2)),_mm_set1_ps(t12(1)));
+        const __m128 zc1 = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(sR12(2,0)),x2),_mm_mul_ps(_mm_set1_ps(sR12(2,1)),y2)),
+                                                 _mm_mul_ps(_mm_set1_ps(sR12(2,2)),z2)),_mm_set1_ps(t12(2)));
+        const __m128 invz1 = _mm_div_ps(_mm_set1_ps(1.0f),zc1);
+        const __m128 du1 = _mm_sub_ps(_mm_loadu_ps(&mvU1[i]),_mm_add_ps(_mm_mul_ps(_mm_mul_ps(vfx1,xc1),invz1),vcx1));
+        const __m128 dv1 = _mm_sub_ps(_mm_loadu_ps(&mvV1[i]),_mm_add_ps(_mm_mul_ps(_mm_mul_ps(vfy1,yc1),invz1),vcy1));
+        const __m128 err1 = _mm_add_ps(_mm_mul_ps(du1,du1),_mm_mul_ps(dv1,dv1));
+
+        // Match i of camera 1 projected in camera 2
+        const __m128 x1 = _mm_loadu_ps(&mvX1[i]), y1 = _mm_loadu_ps(&mvY1[i]), z1 = _mm_loadu_ps(&mvZ1[i]);
+        const __m128 xc2 = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(sR21(0,0)),x1),_mm_mul_ps(_mm_set1_ps(sR21(0,1)),y1)),
+                                                 _mm_mul_ps(_mm_set1_ps(sR21(0,2)),z1)),_mm_set1_ps(t21(0)));
+        const __m128 yc2 = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(sR21(1,0)),x1),_mm_mul_ps(_mm_set1_ps(sR21(1,1)),y1)),
+                                                 _mm_mul_ps(_mm_set1_ps(sR21(1,2)),z1)),_mm_set1_ps(t21(1)));
+        const __m128 zc2 = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(sR21(2,0)),x1),_mm_mul_ps(_mm_set1_ps(sR21(2,1)),y1)),
+                                                 _mm_mul_ps(_mm_set1_ps(sR21(2,2)),z1)),_mm_set1_ps(t21(2)));
+        const __m128 invz2 = _mm_div_ps(_mm_set1_ps(1.0f),zc2);
+        const __m128 du2 = _mm_sub_ps(_mm_loadu_ps(&mvU2[i]),_mm_add_ps(_mm_mul_ps(_mm_mul_ps(vfx2,xc2),invz2),vcx2));
+        const __m128 dv2 = _mm_sub_ps(_mm_loadu_ps(&mvV2[i]),_mm_add_ps(_mm_mul_ps(_mm_mul_ps(vfy2,yc2),invz2),vcy2));
+        const __m128 err2 = _mm_add_ps(_mm_mul_ps(du2,du2),_mm_mul_ps(dv2,dv2));
+
+        const __m128 mask = _mm_and_ps(_mm_cmplt_ps(err1,_mm_loadu_ps(&mvMaxError1[i])),
+                                       _mm_cmplt_ps(err2,_mm_loadu_ps(&mvMaxError2[i])));
+        const int bits = _mm_movemask_ps(mask);
+        mvbInliersi[i] = bits & 1;
+        mvbInliersi[i+1] = (bits>>1) & 1;
+        mvbInliersi[i+2] = (bits>>2) & 1;
+        mvbInliersi[i+3] = (bits>>3) & 1;
+        mnInliersi += mvbInliersi[i]+mvbInliersi[i+1]+mvbInliersi[i+2]+mvbInliersi[i+3];
+    }
+#elif defined(ORB_SLAM_SIMD_NEON)
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t vcx1 = vdupq_n_f32(cx1), vcy1 = vdupq_n_f32(cy1);
+    const float32x4_t vcx2 = vdupq_n_f32(cx2), vcy2 = vdupq_n_f32(cy2);
 
-        float err1 = dist1.dot(dist1);
-        float err2 = dist2.dot(dist2);
+    for(; i+4<=N; i+=4)
+    {
+        // Match i of camera 2 projected in camera 1
+        const float32x4_t x2 = vld1q_f32(&mvX2[i]), y2 = vld1q_f32(&mvY2[i]), z2 = vld1q_f32(&mvZ2[i]);
+        const float32x4_t xc1 = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x2,sR12(0,0)),vmulq_n_f32(y2,sR12(0,1))),vmulq_n_f32(z2,sR12(0,2))),vdupq_n_f32(t12(0)));
+        const float32x4_t yc1 = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x2,sR12(1,0)),vmulq_n_f32(y2,sR12(1,1))),vmulq_n_f32(z2,sR12(1,2))),vdupq_n_f32(t12(1)));
+        const float32x4_t zc1 = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x2,sR12(2,0)),vmulq_n_f32(y2,sR12(2,1))),vmulq_n_f32(z2,sR12(2,2))),vdupq_n_f32(t12(2)));
+        const float32x4_t invz1 = vdivq_f32(one,zc1);
+        const float32x4_t du1 = vsubq_f32(vld1q_f32(&mvU1[i]),vaddq_f32(vmulq_f32(vmulq_n_f32(xc1,fx1),invz1),vcx1));
+        const float32x4_t dv1 = vsubq_f32(vld1q_f32(&mvV1[i]),vaddq_f32(vmulq_f32(vmulq_n_f32(yc1,fy1),invz1),vcy1));
+        const float32x4_t err1 = vaddq_f32(vmulq_f32(du1,du1),vmulq_f32(dv1,dv1));
+
+        // Match i of camera 1 projected in camera 2
+        const float32x4_t x1 = vld1q_f32(&mvX1[i]), y1 = vld1q_f32(&mvY1[i]), z1 = vld1q_f32(&mvZ1[i]);
+        const float32x4_t xc2 = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x1,sR21(0,0)),vmulq_n_f32(y1,sR21(0,1))),vmulq_n_f32(z1,sR21(0,2))),vdupq_n_f32(t21(0)));
+        const float32x4_t yc2 = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x1,sR21(1,0)),vmulq_n_f32(y1,sR21(1,1))),vmulq_n_f32(z1,sR21(1,2))),vdupq_n_f32(t21(1)));
+        const float32x4_t zc2 = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x1,sR21(2,0)),vmulq_n_f32(y1,sR21(2,1))),vmulq_n_f32(z1,sR21(2,2))),vdupq_n_f32(t21(2)));
+        const float32x4_t invz2 = vdivq_f32(one,zc2);
+        const float32x4_t du2 = vsubq_f32(vld1q_f32(&mvU2[i]),vaddq_f32(vmulq_f32(vmulq_n_f32(xc2,fx2),invz2),vcx2));
+        const float32x4_t dv2 = vsubq_f32(vld1q_f32(&mvV2[i]),vaddq_f32(vmulq_f32(vmulq_n_f32(yc2,fy2),invz2),vcy2));
+        const float32x4_t err2 = vaddq_f32(vmulq_f32(du2,du2),vmulq_f32(dv2,dv2));
+
+        const uint32x4_t mask = vandq_u32(vcltq_f32(err1,vld1q_f32(&mvMaxError1[i])),vcltq_f32(err2,vld1q_f32(&mvMaxError2[i])));
+        mvbInliersi[i] = vgetq_lane_u32(mask,0) & 1;
+        mvbInliersi[i+1] = vgetq_lane_u32(mask,1) & 1;
+        mvbInliersi[i+2] = vgetq_lane_u32(mask,2) & 1;
+        mvbInliersi[i+3] = vgetq_lane_u32(mask,3) & 1;
+        mnInliersi += mvbInliersi[i]+mvbInliersi[i+1]+mvbInliersi[i+2]+mvbInliersi[i+3];
+    }
+#endif
 
-        if(err1<mvnMaxError1[i] && err2<mvnMaxError2[i])
-        {
-            mvbInliersi[i]=true;
-            mnInliersi++;
-        }
-        else
-            mvbInliersi[i]=false;
+    for(; i<N; i++)
+    {
+        const Eigen::Vector3f X2in1 = sR12*Eigen::Vector3f(mvX2[i],mvY2[i],mvZ2[i])+t12;
+        const float du1 = mvU1[i]-(fx1*X2in1(0)/X2in1(2)+cx1);
+        const float dv1 = mvV1[i]-(fy1*X2in1(1)/X2in1(2)+cy1);
+
+        const Eigen::Vector3f X1in2 = sR21*Eigen::Vector3f(mvX1[i],mvY1[i],mvZ1[i])+t21;
+        const float du2 = mvU2[i]-(fx2*X1in2(0)/X1in2(2)+cx2);
+        const float dv2 = mvV2[i]-(fy2*X1in2(1)/X1in2(2)+cy2);
+
+        const float err1 = du1*du1+dv1*dv1;
+        const float err2 = du2*du2+dv2*dv2;
+
+        mvbInliersi[i] = err1<mvMaxError1[i] && err2<mvMaxError2[i];
+        mnInliersi += mvbInliersi[i];
     }
 }
 
@@ -374,47 +399,4 @@ float Sim3Solver::GetEstimatedScale()
     return mBestScale;
 }
 
-void Sim3Solver::Project(const vector<cv::Mat> &vP3Dw, vector<cv::Mat> &vP2D, cv::Mat Tcw, cv::Mat K)
-{
-    cv::Mat Rcw = Tcw.rowRange(0,3).colRange(0,3);
-    cv::Mat tcw = Tcw.rowRange(0,3).col(3);
-    float fx = K.at<float>(0,0);
-    float fy = K.at<float>(1,1);
-    float cx = K.at<float>(0,2);
-    float cy = K.at<float>(1,2);
-
-    vP2D.clear();
-    vP2D.reserve(vP3Dw.size());
-
-    for(size_t i=0, iend=vP3Dw.size(); i<iend; i++)
-    {
-        cv::Mat P3Dc = Rcw*vP3Dw[i]+tcw;
-        float invz = 1/(P3Dc.at<float>(2));
-        float x = P3Dc.at<float>(0)*invz;
-        float y = P3Dc.at<float>(1)*invz;
-
-        vP2D.push_back((cv::Mat_<float>(2,1) << fx*x+cx, fy*y+cy));
-    }
-}
-
-void Sim3Solver::FromCameraToImage(const vector<cv::Mat> &vP3Dc, vector<cv::Mat> &vP2D, cv::Mat K)
-{
-    float fx = K.at<float>(0,0);
-    float fy = K.at<float>(1,1);
-    float cx = K.at<float>(0,2);
-    float cy = K.at<float>(1,2);
-
-    vP2D.clear();
-    vP2D.reserve(vP3Dc.size());
-
-    for(size_t i=0, iend=vP3Dc.size(); i<iend; i++)
-    {
-        float invz = 1/(vP3Dc[i].at<float>(2));
-        float x = vP3Dc[i].at<float>(0)*invz;
-        float y = vP3Dc[i].at<float>(1)*invz;
-
-        vP2D.push_back((cv::Mat_<float>(2,1) << fx*x+cx, fy*y+cy));
-    }
-}
-
 } //namespace ORB_SLAM
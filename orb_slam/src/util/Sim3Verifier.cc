@@ -0,0 +1,246 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/Sim3Verifier.h"
+
+#include "types/KeyFrame.h"
+#include "types/MapPoint.h"
+#include "util/Sim3Solver.h"
+#include "util/ORBmatcher.h"
+#include "util/Optimizer.h"
+#include "util/Converter.h"
+#include "util/TaskPool.h"
+
+#include <boost/bind.hpp>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+Sim3Verifier::Sim3Verifier(int nThreads):
+    mnThreads(max(nThreads,1)), mpCurrentKF(NULL), mpvpCandidates(NULL), mnNextCandidate(0), mnAccepted(-1)
+{}
+
+int Sim3Verifier::Verify(KeyFrame *pCurrentKF, const vector<KeyFrame*> &vpCandidates,
+                         g2o::Sim3 &gScm, vector<MapPoint*> &vpMatchedPoints)
+{
+    mpCurrentKF = pCurrentKF;
+    mpvpCandidates = &vpCandidates;
+    mnNextCandidate = 0;
+    mnAccepted = -1;
+    mvpMatchedPoints.clear();
+
+    const int nWorkers = min(mnThreads,(int)vpCandidates.size());
+    if(nWorkers>1)
+    {
+        TaskGroup workers(TaskPool::LOOP_CLOSING);
+        for(int i=0; i<nWorkers-1; i++)
+            workers.Run(boost::bind(&Sim3Verifier::VerifyCandidates,this));
+        // The calling thread also takes its share of candidates
+        VerifyCandidates();
+        workers.Wait();
+    }
+    else
+    {
+        VerifySequential();
+    }
+
+    if(mnAccepted>=0)
+    {
+        gScm = mgScm;
+        vpMatchedPoints = mvpMatchedPoints;
+    }
+    return mnAccepted;
+}
+
+int Sim3Verifier::VerifySequential()
+{
+    const int nInitialCandidates = mpvpCandidates->size();
+
+    // We compute first ORB matches for each candidate
+    // If enough matches are found, we setup a Sim3Solver
+    ORBmatcher matcher(0.75,true);
+
+    vector<Sim3Solver*> vpSim3Solvers(nInitialCandidates,static_cast<Sim3Solver*>(NULL));
+    vector<vector<MapPoint*> > vvpMapPointMatches(nInitialCandidates);
+    vector<bool> vbDiscarded(nInitialCandidates,false);
+
+    int nCandidates=0; //candidates with enough matches
+
+    for(int i=0; i<nInitialCandidates; i++)
+    {
+        KeyFrame* pKF = (*mpvpCandidates)[i];
+
+        if(pKF->isBad())
+        {
+            vbDiscarded[i] = true;
+            continue;
+        }
+
+        int nmatches = matcher.SearchByBoW(mpCurrentKF,pKF,vvpMapPointMatches[i]);
+
+        if(nmatches<20)
+        {
+            vbDiscarded[i] = true;
+            continue;
+        }
+
+        Sim3Solver* pSolver = new Sim3Solver(mpCurrentKF,pKF,vvpMapPointMatches[i]);
+        pSolver->SetRansacParameters(0.99,20,300);
+        vpSim3Solvers[i] = pSolver;
+        nCandidates++;
+    }
+
+    // Perform alternatively RANSAC iterations for each candidate
+    // until one is successful or all fail
+    while(nCandidates>0 && mnAccepted<0)
+    {
+        for(int i=0; i<nInitialCandidates; i++)
+        {
+            if(vbDiscarded[i])
+                continue;
+
+            // Perform 5 Ransac Iterations
+            vector<bool> vbInliers;
+            int nInliers;
+            bool bNoMore;
+
+            Sim3Solver* pSolver = vpSim3Solvers[i];
+            cv::Mat Scm  = pSolver->iterate(5,bNoMore,vbInliers,nInliers);
+
+            // If Ransac reaches max. iterations discard keyframe
+            if(bNoMore)
+            {
+                vbDiscarded[i]=true;
+                nCandidates--;
+            }
+
+            // If RANSAC returns a Sim3, perform a guided matching and optimize with all correspondences
+            if(!Scm.empty())
+            {
+                g2o::Sim3 gScm;
+                vector<MapPoint*> vpRefined;
+                if(Refine((*mpvpCandidates)[i],vvpMapPointMatches[i],vbInliers,pSolver->GetEstimatedRotation(),
+                          pSolver->GetEstimatedTranslation(),pSolver->GetEstimatedScale(),gScm,vpRefined))
+                {
+                    Accept(i,gScm,vpRefined);
+                    break;
+                }
+            }
+        }
+    }
+
+    for(int i=0; i<nInitialCandidates; i++)
+        delete vpSim3Solvers[i];
+
+    return mnAccepted;
+}
+
+void Sim3Verifier::VerifyCandidates()
+{
+    while(!Accepted())
+    {
+        int nCandidate;
+        {
+            boost::mutex::scoped_lock lock(mMutexCandidate);
+            nCandidate = mnNextCandidate++;
+        }
+
+        if(nCandidate>=(int)mpvpCandidates->size())
+            break;
+
+        VerifyCandidate(nCandidate);
+    }
+}
+
+void Sim3Verifier::VerifyCandidate(int nCandidate)
+{
+    KeyFrame* pKF = (*mpvpCandidates)[nCandidate];
+    if(pKF->isBad())
+        return;
+
+    ORBmatcher matcher(0.75,true);
+    vector<MapPoint*> vpMapPointMatches;
+    if(matcher.SearchByBoW(mpCurrentKF,pKF,vpMapPointMatches)<20)
+        return;
+
+    Sim3Solver solver(mpCurrentKF,pKF,vpMapPointMatches);
+    solver.SetRansacParameters(0.99,20,300);
+
+    // Rounds of 5 RANSAC iterations, the other workers are checked in between
+    bool bNoMore = false;
+    while(!bNoMore && !Accepted())
+    {
+        vector<bool> vbInliers;
+        int nInliers;
+
+        cv::Mat Scm = solver.iterate(5,bNoMore,vbInliers,nInliers);
+        if(Scm.empty())
+            continue;
+
+        g2o::Sim3 gScm;
+        vector<MapPoint*> vpRefined;
+        if(Refine(pKF,vpMapPointMatches,vbInliers,solver.GetEstimatedRotation(),
+                  solver.GetEstimatedTranslation(),solver.GetEstimatedScale(),gScm,vpRefined))
+        {
+            Accept(nCandidate,gScm,vpRefined);
+            return;
+        }
+    }
+}
+
+bool Sim3Verifier::Refine(KeyFrame *pKF, const vector<MapPoint*> &vpMatches, const vector<bool> &vbInliers,
+                          const cv::Mat &R, const cv::Mat &t, const float s, g2o::Sim3 &gScm, vector<MapPoint*> &vpRefined)
+{
+    vpRefined.assign(vpMatches.size(),static_cast<MapPoint*>(NULL));
+    for(size_t j=0, jend=vbInliers.size(); j<jend; j++)
+    {
+        if(vbInliers[j])
+           vpRefined[j]=vpMatches[j];
+    }
+
+    ORBmatcher matcher(0.75,true);
+    matcher.SearchBySim3(mpCurrentKF,pKF,vpRefined,s,R,t,7.5);
+
+    gScm = g2o::Sim3(Converter::toMatrix3d(R),Converter::toVector3d(t),s);
+    const int nInliers = Optimizer::OptimizeSim3(mpCurrentKF, pKF, vpRefined, gScm, 10);
+
+    // If optimization is successful stop ransacs and continue
+    return nInliers>=20;
+}
+
+void Sim3Verifier::Accept(int nCandidate, const g2o::Sim3 &gScm, const vector<MapPoint*> &vpMatches)
+{
+    boost::mutex::scoped_lock lock(mMutexAccepted);
+    if(mnAccepted>=0)
+        return;
+    mnAccepted = nCandidate;
+    mgScm = gScm;
+    mvpMatchedPoints = vpMatches;
+}
+
+bool Sim3Verifier::Accepted()
+{
+    boost::mutex::scoped_lock lock(mMutexAccepted);
+    return mnAccepted>=0;
+}
+
+} //namespace ORB_SLAM
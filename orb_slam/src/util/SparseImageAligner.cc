@@ -0,0 +1,272 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/SparseImageAligner.h"
+#include "util/Converter.h"
+#include "types/Frame.h"
+#include "types/MapPoint.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <Eigen/Cholesky>
+#include <cmath>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+// Patches of 4x4 pixels, the centre is between the four central ones
+static const int PATCH_HALF = 2;
+static const int PATCH_SIZE = 2*PATCH_HALF;
+static const int PATCH_AREA = PATCH_SIZE*PATCH_SIZE;
+
+// Patches needed to trust the alignment
+static const int MIN_PATCHES = 20;
+
+static inline float Interpolate(const cv::Mat &im, float u, float v)
+{
+    const int x = floor(u);
+    const int y = floor(v);
+    const float dx = u-x;
+    const float dy = v-y;
+    const uchar* p = im.ptr<uchar>(y)+x;
+    const int step = im.step;
+    return (1-dx)*(1-dy)*p[0] + dx*(1-dy)*p[1] + (1-dx)*dy*p[step] + dx*dy*p[step+1];
+}
+
+SparseImageAligner::SparseImageAligner(int nMaxLevel, int nMinLevel, int nIterations, float fHuber):
+    mnMaxLevel(nMaxLevel), mnMinLevel(min(nMinLevel,nMaxLevel)), mnIterations(nIterations), mfHuber(fHuber), mPyramidTimeStamp(-1)
+{
+}
+
+void SparseImageAligner::BuildPyramid(const cv::Mat &im, vector<cv::Mat> &vPyramid)
+{
+    vPyramid.resize(mnMaxLevel+1);
+    vPyramid[0] = im;
+    for(int l=1; l<=mnMaxLevel; l++)
+        cv::pyrDown(vPyramid[l-1],vPyramid[l]);
+}
+
+Eigen::Vector2d SparseImageAligner::Project(const Eigen::Vector3d &Pc) const
+{
+    const double x = Pc(0)/Pc(2);
+    const double y = Pc(1)/Pc(2);
+    const double r2 = x*x+y*y;
+    const double radial = 1+k1*r2+k2*r2*r2;
+    const double xd = x*radial+2*p1*x*y+p2*(r2+2*x*x);
+    const double yd = y*radial+p1*(r2+2*y*y)+2*p2*x*y;
+    return Eigen::Vector2d(fx*xd+cx,fy*yd+cy);
+}
+
+bool SparseImageAligner::Align(const Frame &reference, const Frame &current, cv::Mat &Tcw)
+{
+    if(reference.im.empty() || current.im.empty() || reference.mTcw.empty())
+        return false;
+
+    fx = reference.fx;
+    fy = reference.fy;
+    cx = reference.cx;
+    cy = reference.cy;
+    k1 = reference.mDistCoef.at<float>(0);
+    k2 = reference.mDistCoef.at<float>(1);
+    p1 = reference.mDistCoef.at<float>(2);
+    p2 = reference.mDistCoef.at<float>(3);
+
+    // Reference points: the undistorted keypoint at the depth of its map point
+    const Eigen::Matrix3f Rrw = Converter::toMatrix3f(reference.mTcw.rowRange(0,3).colRange(0,3));
+    const Eigen::Vector3f trw = Converter::toVector3f(reference.mTcw.rowRange(0,3).col(3));
+    mvPoints.clear();
+    mvRefPixels.clear();
+    for(int i=0; i<reference.N; i++)
+    {
+        MapPoint* pMP = reference.mvpMapPoints[i];
+        if(!pMP || reference.mvbOutlier[i] || pMP->isBad())
+            continue;
+        const Eigen::Vector3f Pr = Rrw*pMP->GetWorldPosEigen()+trw;
+        if(Pr(2)<=0)
+            continue;
+        const cv::KeyPoint &kpUn = reference.mvKeysUn[i];
+        mvPoints.push_back(Eigen::Vector3d((kpUn.pt.x-cx)/fx*Pr(2),(kpUn.pt.y-cy)/fy*Pr(2),Pr(2)));
+        mvRefPixels.push_back(reference.mvKeys[i].pt);
+    }
+    if((int)mvPoints.size()<MIN_PATCHES)
+        return false;
+
+    // The reference pyramid is the one kept from the last call, unless some frame was not aligned
+    if(mPyramidImage.data==reference.im.data && mPyramidTimeStamp==reference.mTimeStamp && !mvPyramid.empty())
+        mvRefPyramid.swap(mvPyramid);
+    else
+        BuildPyramid(reference.im,mvRefPyramid);
+    BuildPyramid(current.im,mvPyramid);
+    mPyramidImage = current.im;
+    mPyramidTimeStamp = current.mTimeStamp;
+
+    // Pose of current relative to the reference
+    const Eigen::Matrix3d Rcw = Converter::toMatrix3d(Tcw.rowRange(0,3).colRange(0,3));
+    const Eigen::Vector3d tcw = Converter::toVector3d(Tcw.rowRange(0,3).col(3));
+    const Eigen::Matrix3d Rrwd = Rrw.cast<double>();
+    const Eigen::Vector3d trwd = trw.cast<double>();
+    Eigen::Matrix3d Rcr = Rcw*Rrwd.transpose();
+    Eigen::Vector3d tcr = tcw-Rcr*trwd;
+
+    int nValid = 0;
+    for(int level=mnMaxLevel; level>=mnMinLevel; level--)
+    {
+        PrecomputeReference(level);
+
+        Matrix6d H;
+        Vector6d b;
+        double chi2 = ComputeResiduals(Rcr,tcr,level,H,b,nValid);
+        for(int it=0; it<mnIterations && nValid>=MIN_PATCHES; it++)
+        {
+            // The inverse of the step found at the reference: Tcr <- Tcr*exp(-dx), rotation first as in g2o
+            const Vector6d dx = H.ldlt().solve(b);
+            if(!dx.allFinite())
+                break;
+            const g2o::SE3Quat step = g2o::SE3Quat::exp(-dx);
+            const Eigen::Matrix3d Rnew = Rcr*step.rotation().toRotationMatrix();
+            const Eigen::Vector3d tnew = Rcr*step.translation()+tcr;
+
+            Matrix6d Hnew;
+            Vector6d bnew;
+            int nValidNew = 0;
+            const double chi2new = ComputeResiduals(Rnew,tnew,level,Hnew,bnew,nValidNew);
+            if(nValidNew<MIN_PATCHES || chi2new>=chi2)
+                break;
+
+            Rcr = Rnew;
+            tcr = tnew;
+            chi2 = chi2new;
+            H = Hnew;
+            b = bnew;
+            nValid = nValidNew;
+
+            if(dx.norm()<1e-6)
+                break;
+        }
+
+        if(nValid<MIN_PATCHES)
+            return false;
+    }
+
+    // Back to the world
+    const Eigen::Matrix3d Rnew = Rcr*Rrwd;
+    const Eigen::Vector3d tnew = Rcr*trwd+tcr;
+    Converter::toCvSE3(Rnew,tnew).copyTo(Tcw);
+    return true;
+}
+
+void SparseImageAligner::PrecomputeReference(int level)
+{
+    const cv::Mat &im = mvRefPyramid[level];
+    const float scale = 1.0f/(1<<level);
+    const int N = mvPoints.size();
+
+    mvRefPatches.resize(N*PATCH_AREA);
+    mvJacobians.resize(N*PATCH_AREA);
+    mvbRefValid.assign(N,false);
+
+    // The patch and the pixels around it for the gradients
+    const float minU = PATCH_HALF+1;
+    const float maxU = im.cols-PATCH_HALF-2;
+    const float maxV = im.rows-PATCH_HALF-2;
+
+    for(int i=0; i<N; i++)
+    {
+        const float u = mvRefPixels[i].x*scale;
+        const float v = mvRefPixels[i].y*scale;
+        if(u<minU || v<minU || u>=maxU || v>=maxV)
+            continue;
+        mvbRefValid[i] = true;
+
+        // Derivatives of the pixel (level 0) with respect to a motion of the point in the reference, rotation first
+        const Eigen::Vector3d &P = mvPoints[i];
+        const double x = P(0), y = P(1), invz = 1.0/P(2);
+        const double invz2 = invz*invz;
+        Vector6d Ju, Jv;
+        Ju << -fx*x*y*invz2, fx*(1+x*x*invz2), -fx*y*invz, fx*invz, 0, -fx*x*invz2;
+        Jv << -fy*(1+y*y*invz2), fy*x*y*invz2, fy*x*invz, 0, fy*invz, -fy*y*invz2;
+
+        int k = i*PATCH_AREA;
+        for(int py=-PATCH_HALF; py<PATCH_HALF; py++)
+        {
+            for(int px=-PATCH_HALF; px<PATCH_HALF; px++, k++)
+            {
+                const float uk = u+px+0.5f;
+                const float vk = v+py+0.5f;
+                mvRefPatches[k] = Interpolate(im,uk,vk);
+                const double dIdu = 0.5*(Interpolate(im,uk+1,vk)-Interpolate(im,uk-1,vk));
+                const double dIdv = 0.5*(Interpolate(im,uk,vk+1)-Interpolate(im,uk,vk-1));
+                mvJacobians[k] = (dIdu*Ju+dIdv*Jv)*scale;
+            }
+        }
+    }
+}
+
+double SparseImageAligner::ComputeResiduals(const Eigen::Matrix3d &Rcr, const Eigen::Vector3d &tcr, int level, Matrix6d &H, Vector6d &b, int &nValid)
+{
+    const cv::Mat &im = mvPyramid[level];
+    const float scale = 1.0f/(1<<level);
+    const float minU = PATCH_HALF;
+    const float maxU = im.cols-PATCH_HALF-1;
+    const float maxV = im.rows-PATCH_HALF-1;
+
+    H.setZero();
+    b.setZero();
+    nValid = 0;
+    double chi2 = 0;
+    int nResiduals = 0;
+
+    for(size_t i=0; i<mvPoints.size(); i++)
+    {
+        if(!mvbRefValid[i])
+            continue;
+
+        const Eigen::Vector3d Pc = Rcr*mvPoints[i]+tcr;
+        if(Pc(2)<=0)
+            continue;
+        const Eigen::Vector2d uv = Project(Pc)*scale;
+        const float u = uv(0);
+        const float v = uv(1);
+        if(u<minU || v<minU || u>=maxU || v>=maxV)
+            continue;
+        nValid++;
+
+        int k = i*PATCH_AREA;
+        for(int py=-PATCH_HALF; py<PATCH_HALF; py++)
+        {
+            for(int px=-PATCH_HALF; px<PATCH_HALF; px++, k++)
+            {
+                const double r = Interpolate(im,u+px+0.5f,v+py+0.5f)-mvRefPatches[k];
+                const double absr = fabs(r);
+                const double w = absr<=mfHuber ? 1.0 : mfHuber/absr;
+                const Vector6d &J = mvJacobians[k];
+                H.noalias() += w*J*J.transpose();
+                b.noalias() += w*r*J;
+                chi2 += w*r*r;
+                nResiduals++;
+            }
+        }
+    }
+
+    return nResiduals>0 ? chi2/nResiduals : 0;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,298 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/SpatialIndex.h"
+#include "types/Camera.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+// Voxel coordinates take 21 bits per axis in the key, positions further away are clamped to the border voxels
+static const int CELL_BITS = 21;
+static const int CELL_LIMIT = (1<<(CELL_BITS-1))-1;
+
+SpatialIndex::SpatialIndex(float fVoxelSize):
+    mfVoxelSize(fVoxelSize), mfInvVoxelSize(1.0f/fVoxelSize)
+{
+}
+
+void SpatialIndex::Cell(const Eigen::Vector3f &pos, int &x, int &y, int &z) const
+{
+    const float limit = CELL_LIMIT;
+    x = (int)floor(max(-limit,min(limit,pos(0)*mfInvVoxelSize)));
+    y = (int)floor(max(-limit,min(limit,pos(1)*mfInvVoxelSize)));
+    z = (int)floor(max(-limit,min(limit,pos(2)*mfInvVoxelSize)));
+}
+
+SpatialIndex::VoxelKey SpatialIndex::Key(int x, int y, int z) const
+{
+    const VoxelKey mask = (1LL<<CELL_BITS)-1;
+    return (((VoxelKey)x & mask)<<(2*CELL_BITS)) | (((VoxelKey)y & mask)<<CELL_BITS) | ((VoxelKey)z & mask);
+}
+
+SpatialIndex::VoxelKey SpatialIndex::Key(const Eigen::Vector3f &pos) const
+{
+    int x, y, z;
+    Cell(pos,x,y,z);
+    return Key(x,y,z);
+}
+
+void SpatialIndex::Insert(MapPoint* pMP, const Eigen::Vector3f &pos)
+{
+    boost::unique_lock<boost::shared_mutex> lock(mMutex);
+
+    // A point is only indexed once, inserting it again moves it
+    boost::unordered_map<MapPoint*,VoxelKey>::iterator pit = mPointVoxels.find(pMP);
+    if(pit!=mPointVoxels.end())
+    {
+        Relocate(pit,pos);
+        return;
+    }
+
+    const VoxelKey key = Key(pos);
+    Entry entry;
+    entry.pMP = pMP;
+    entry.pos[0] = pos(0);
+    entry.pos[1] = pos(1);
+    entry.pos[2] = pos(2);
+    mVoxels[key].push_back(entry);
+    mPointVoxels[pMP] = key;
+}
+
+void SpatialIndex::Move(MapPoint* pMP, const Eigen::Vector3f &pos)
+{
+    boost::unique_lock<boost::shared_mutex> lock(mMutex);
+
+    boost::unordered_map<MapPoint*,VoxelKey>::iterator pit = mPointVoxels.find(pMP);
+    if(pit!=mPointVoxels.end())
+        Relocate(pit,pos);
+}
+
+void SpatialIndex::Relocate(boost::unordered_map<MapPoint*,VoxelKey>::iterator pit, const Eigen::Vector3f &pos)
+{
+    MapPoint* pMP = pit->first;
+    vector<Entry> &vEntries = mVoxels[pit->second];
+    size_t i=0;
+    while(i<vEntries.size() && vEntries[i].pMP!=pMP)
+        i++;
+    if(i==vEntries.size())
+        return;
+
+    Entry entry = vEntries[i];
+    entry.pos[0] = pos(0);
+    entry.pos[1] = pos(1);
+    entry.pos[2] = pos(2);
+
+    const VoxelKey key = Key(pos);
+    if(key==pit->second)
+    {
+        vEntries[i] = entry;
+        return;
+    }
+
+    vEntries[i] = vEntries.back();
+    vEntries.pop_back();
+    if(vEntries.empty())
+        mVoxels.erase(pit->second);
+
+    mVoxels[key].push_back(entry);
+    pit->second = key;
+}
+
+void SpatialIndex::Erase(MapPoint* pMP)
+{
+    boost::unique_lock<boost::shared_mutex> lock(mMutex);
+
+    boost::unordered_map<MapPoint*,VoxelKey>::iterator pit = mPointVoxels.find(pMP);
+    if(pit==mPointVoxels.end())
+        return;
+
+    boost::unordered_map<VoxelKey,vector<Entry> >::iterator vit = mVoxels.find(pit->second);
+    if(vit!=mVoxels.end())
+    {
+        vector<Entry> &vEntries = vit->second;
+        for(size_t i=0; i<vEntries.size(); i++)
+        {
+            if(vEntries[i].pMP==pMP)
+            {
+                vEntries[i] = vEntries.back();
+                vEntries.pop_back();
+                break;
+            }
+        }
+        if(vEntries.empty())
+            mVoxels.erase(vit);
+    }
+
+    mPointVoxels.erase(pit);
+}
+
+void SpatialIndex::Clear()
+{
+    boost::unique_lock<boost::shared_mutex> lock(mMutex);
+    mVoxels.clear();
+    mPointVoxels.clear();
+}
+
+size_t SpatialIndex::Size()
+{
+    boost::shared_lock<boost::shared_mutex> lock(mMutex);
+    return mPointVoxels.size();
+}
+
+void SpatialIndex::GatherBox(const Eigen::Vector3f &min, const Eigen::Vector3f &max, vector<Entry> &vEntries)
+{
+    vEntries.clear();
+
+    int x0, y0, z0, x1, y1, z1;
+    Cell(min,x0,y0,z0);
+    Cell(max,x1,y1,z1);
+    if(x1<x0 || y1<y0 || z1<z0)
+        return;
+
+    const double nCells = double(x1-x0+1)*double(y1-y0+1)*double(z1-z0+1);
+
+    // Large boxes cost the occupied voxels instead of the overlapped ones
+    if(nCells>mVoxels.size())
+    {
+        for(boost::unordered_map<VoxelKey,vector<Entry> >::const_iterator vit=mVoxels.begin(), vend=mVoxels.end(); vit!=vend; vit++)
+        {
+            const vector<Entry> &vVoxel = vit->second;
+            for(size_t i=0, iend=vVoxel.size(); i<iend; i++)
+            {
+                const float* p = vVoxel[i].pos;
+                if(p[0]>=min(0) && p[0]<=max(0) && p[1]>=min(1) && p[1]<=max(1) && p[2]>=min(2) && p[2]<=max(2))
+                    vEntries.push_back(vVoxel[i]);
+            }
+        }
+        return;
+    }
+
+    for(int x=x0; x<=x1; x++)
+        for(int y=y0; y<=y1; y++)
+            for(int z=z0; z<=z1; z++)
+            {
+                boost::unordered_map<VoxelKey,vector<Entry> >::const_iterator vit = mVoxels.find(Key(x,y,z));
+                if(vit==mVoxels.end())
+                    continue;
+                const vector<Entry> &vVoxel = vit->second;
+                for(size_t i=0, iend=vVoxel.size(); i<iend; i++)
+                {
+                    const float* p = vVoxel[i].pos;
+                    if(p[0]>=min(0) && p[0]<=max(0) && p[1]>=min(1) && p[1]<=max(1) && p[2]>=min(2) && p[2]<=max(2))
+                        vEntries.push_back(vVoxel[i]);
+                }
+            }
+}
+
+void SpatialIndex::QueryBox(const Eigen::Vector3f &min, const Eigen::Vector3f &max, vector<MapPoint*> &vpPoints)
+{
+    vector<Entry> vEntries;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mMutex);
+        GatherBox(min,max,vEntries);
+    }
+
+    vpPoints.resize(vEntries.size());
+    for(size_t i=0; i<vEntries.size(); i++)
+        vpPoints[i] = vEntries[i].pMP;
+}
+
+void SpatialIndex::QueryRadius(const Eigen::Vector3f &center, float radius, vector<MapPoint*> &vpPoints)
+{
+    const Eigen::Vector3f r(radius,radius,radius);
+    vector<Entry> vEntries;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mMutex);
+        GatherBox(center-r,center+r,vEntries);
+    }
+
+    vpPoints.clear();
+    const float r2 = radius*radius;
+    for(size_t i=0; i<vEntries.size(); i++)
+    {
+        const float dx = vEntries[i].pos[0]-center(0);
+        const float dy = vEntries[i].pos[1]-center(1);
+        const float dz = vEntries[i].pos[2]-center(2);
+        if(dx*dx+dy*dy+dz*dz<=r2)
+            vpPoints.push_back(vEntries[i].pMP);
+    }
+}
+
+void SpatialIndex::QueryFrustum(const Eigen::Matrix3f &Rcw, const Eigen::Vector3f &tcw, const Camera &camera, float maxDepth,
+                                vector<MapPoint*> &vpPoints)
+{
+    const float fx = camera.fx;
+    const float fy = camera.fy;
+    const float cx = camera.cx;
+    const float cy = camera.cy;
+
+    // The box around the camera center and the four corners of the image at maxDepth
+    const Eigen::Matrix3f Rwc = Rcw.transpose();
+    const Eigen::Vector3f Ow = -Rwc*tcw;
+    Eigen::Vector3f min = Ow, max = Ow;
+    const float us[2] = {(float)camera.mnMinX, (float)camera.mnMaxX};
+    const float vs[2] = {(float)camera.mnMinY, (float)camera.mnMaxY};
+    for(int i=0; i<2; i++)
+        for(int j=0; j<2; j++)
+        {
+            const Eigen::Vector3f Pc((us[i]-cx)/fx*maxDepth,(vs[j]-cy)/fy*maxDepth,maxDepth);
+            const Eigen::Vector3f Pw = Rwc*Pc+Ow;
+            min = min.cwiseMin(Pw);
+            max = max.cwiseMax(Pw);
+        }
+
+    vector<Entry> vEntries;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mMutex);
+        GatherBox(min,max,vEntries);
+    }
+
+    vpPoints.clear();
+    for(size_t i=0; i<vEntries.size(); i++)
+    {
+        const Eigen::Vector3f Pw(vEntries[i].pos[0],vEntries[i].pos[1],vEntries[i].pos[2]);
+        const Eigen::Vector3f Pc = Rcw*Pw+tcw;
+        if(Pc(2)<=0 || Pc(2)>maxDepth)
+            continue;
+        const float invz = 1.0f/Pc(2);
+        const float u = fx*Pc(0)*invz+cx;
+        const float v = fy*Pc(1)*invz+cy;
+        if(u<camera.mnMinX || u>camera.mnMaxX || v<camera.mnMinY || v>camera.mnMaxY)
+            continue;
+        vpPoints.push_back(vEntries[i].pMP);
+    }
+}
+
+void SpatialIndex::AccountMemory(MemoryStats &stats)
+{
+    boost::shared_lock<boost::shared_mutex> lock(mMutex);
+    size_t nBytes = MemoryStats::HashBytes(mVoxels)+MemoryStats::HashBytes(mPointVoxels);
+    for(boost::unordered_map<VoxelKey,vector<Entry> >::const_iterator vit=mVoxels.begin(), vend=mVoxels.end(); vit!=vend; vit++)
+        nBytes += MemoryStats::VectorBytes(vit->second);
+    stats.Add(MemoryStats::MAPPOINT_INDEX,nBytes);
+}
+
+} //namespace ORB_SLAM
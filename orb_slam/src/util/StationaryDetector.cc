@@ -0,0 +1,103 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/StationaryDetector.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <ros/ros.h>
+
+namespace ORB_SLAM
+{
+
+StationaryDetector::StationaryDetector(int nWidth, float fMaxDifference, int nMinFrames, float fVerifyPeriod):
+    mnWidth(nWidth), mfMaxDifference(fMaxDifference), mnMinFrames(nMinFrames), mfVerifyPeriod(fVerifyPeriod),
+    mReferenceTimeStamp(0), mbSame(false), mnStillFrames(0), mnSkipped(0)
+{
+}
+
+bool StationaryDetector::Skip(const cv::Mat &im, double timeStamp, bool bKeep)
+{
+    boost::mutex::scoped_lock lock(mMutex);
+
+    // Averaging over the pixels of a block removes most of the sensor noise
+    if(im.cols>mnWidth)
+    {
+        const int height = cvRound((double)im.rows*mnWidth/im.cols);
+        cv::resize(im,mSmall,cv::Size(mnWidth,height),0,0,cv::INTER_AREA);
+    }
+    else
+        im.copyTo(mSmall);
+
+    bool bSame = false;
+    if(!mReference.empty() && mReference.size()==mSmall.size())
+        bSame = cv::norm(mSmall,mReference,cv::NORM_L1)<=mfMaxDifference*mSmall.total();
+
+    const bool bStationary = mnStillFrames>=mnMinFrames;
+    if(bStationary && bSame && !bKeep && timeStamp<mReferenceTimeStamp+mfVerifyPeriod)
+    {
+        mnSkipped++;
+        return true;
+    }
+
+    if(bStationary && !bSame)
+    {
+        mnStillFrames = 0;
+        ROS_INFO("ORB-SLAM - Camera moving again, tracking every frame.");
+    }
+
+    // Tracked, the next images are compared with this one
+    cv::swap(mReference,mSmall);
+    mReferenceTimeStamp = timeStamp;
+    mbSame = bSame;
+    return false;
+}
+
+void StationaryDetector::Update(bool bStill)
+{
+    boost::mutex::scoped_lock lock(mMutex);
+
+    if(!bStill || !mbSame)
+    {
+        if(mnStillFrames>=mnMinFrames)
+            ROS_INFO("ORB-SLAM - Camera moving again, tracking every frame.");
+        mnStillFrames = 0;
+        return;
+    }
+
+    mnStillFrames++;
+    if(mnStillFrames==mnMinFrames)
+        ROS_INFO("ORB-SLAM - Camera stationary, tracking one frame every %.1f s.", mfVerifyPeriod);
+}
+
+bool StationaryDetector::isStationary()
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    return mnStillFrames>=mnMinFrames;
+}
+
+unsigned int StationaryDetector::GetSkipped()
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    return mnSkipped;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,343 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/SyntheticMap.h"
+#include "util/Converter.h"
+
+#include "types/Camera.h"
+#include "types/Frame.h"
+#include "types/KeyFrame.h"
+#include "types/KeyFrameDatabase.h"
+#include "types/Map.h"
+#include "types/MapDatabase.h"
+#include "types/MapPoint.h"
+
+#include <cmath>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+// Keyframe height over the plane of the ring, and the shift of each lap and session along it (in keyframes)
+static const float VIEW_HEIGHT = 0.05f;
+static const float LAP_SHIFT = 0.37f;
+static const float LAP_RADIUS_STEP = 0.02f;
+
+SyntheticMap::Parameters::Parameters():
+    nKeyFrames(500), nPointsPerKeyFrame(100), nFeatures(1000), nCovisible(8), nLoops(1), nMaps(1),
+    fRadius(10.0f), fMinDepth(2.0f), fMaxDepth(8.0f), fPixelNoise(0.5f), nFlippedBits(8), nSeed(1)
+{
+}
+
+SyntheticMap::SyntheticMap(ORBVocabulary* pVocabulary, const Camera* pCamera, int nLevels, float fScaleFactor, const Parameters &params):
+    mpVocabulary(pVocabulary), mpCamera(pCamera), mnLevels(nLevels), mfScaleFactor(fScaleFactor), mParams(params), mRng(params.nSeed)
+{
+    mvScaleFactors.resize(mnLevels);
+    mvLevelSigma2.resize(mnLevels);
+    mvInvLevelSigma2.resize(mnLevels);
+    mvScaleFactors[0]=1.0f;
+    for(int i=1; i<mnLevels; i++)
+        mvScaleFactors[i]=mvScaleFactors[i-1]*mfScaleFactor;
+    for(int i=0; i<mnLevels; i++)
+    {
+        mvLevelSigma2[i]=mvScaleFactors[i]*mvScaleFactors[i];
+        mvInvLevelSigma2[i]=1/mvLevelSigma2[i];
+    }
+
+    mParams.nKeyFrames = max(mParams.nKeyFrames,2);
+    mParams.nLoops = max(mParams.nLoops,0);
+    mParams.nMaps = max(mParams.nMaps,1);
+    mParams.nPointsPerKeyFrame = max(mParams.nPointsPerKeyFrame,1);
+    mnViewsPerLap = max((mParams.nKeyFrames+mParams.nLoops)/(mParams.nLoops+1),2);
+}
+
+void SyntheticMap::Generate(MapDatabase* pMapDB, vector<pair<KeyFrame*,KeyFrame*> > &vLoops)
+{
+    vLoops.clear();
+    GenerateLandmarks();
+
+    // Added as Tracking adds them, the last one is current
+    for(int m=0; m<mParams.nMaps; m++)
+        GenerateMap(pMapDB,m,vLoops);
+}
+
+void SyntheticMap::GenerateLandmarks()
+{
+    // The landmarks seen by the keyframes of the first lap, at the depths and scales of a real scene
+    vector<View> vViews;
+    PlaceViews(0,vViews);
+
+    const float fx = mpCamera->fx;
+    mvLandmarks.clear();
+    mvLandmarks.reserve(mnViewsPerLap*mParams.nPointsPerKeyFrame);
+    for(int i=0; i<mnViewsPerLap && i<(int)vViews.size(); i++)
+    {
+        const Eigen::Matrix3f Rwc = vViews[i].Rcw.transpose();
+        const Eigen::Vector3f Ow = -Rwc*vViews[i].tcw;
+        for(int j=0; j<mParams.nPointsPerKeyFrame; j++)
+        {
+            const float u = mRng.uniform((float)mpCamera->mnMinX,(float)mpCamera->mnMaxX);
+            const float v = mRng.uniform((float)mpCamera->mnMinY,(float)mpCamera->mnMaxY);
+            const float d = mRng.uniform(mParams.fMinDepth,mParams.fMaxDepth);
+            const Eigen::Vector3f Pc((u-mpCamera->cx)*d/fx, (v-mpCamera->cy)*d/mpCamera->fy, d);
+
+            Landmark landmark;
+            landmark.pos = Rwc*Pc+Ow;
+            landmark.fSize = d*31.0f*mvScaleFactors[mRng.uniform(0,mnLevels)]/fx;
+            landmark.descriptor.create(1,32,CV_8U);
+            mRng.fill(landmark.descriptor,cv::RNG::UNIFORM,0,256);
+            mvLandmarks.push_back(landmark);
+        }
+    }
+}
+
+void SyntheticMap::PlaceViews(int nMap, vector<View> &vViews)
+{
+    vViews.resize(mParams.nKeyFrames);
+    for(int k=0; k<mParams.nKeyFrames; k++)
+    {
+        const int nLap = k/mnViewsPerLap;
+        const int i = k%mnViewsPerLap;
+
+        // The first lap of the first session is the one the landmarks were made from
+        const float fShift = LAP_SHIFT*(nLap+nMap) - floor(LAP_SHIFT*(nLap+nMap));
+        const float theta = 2*M_PI*(i+fShift)/mnViewsPerLap;
+        const float r = mParams.fRadius + LAP_RADIUS_STEP*(nLap+nMap);
+        const float c = cos(theta), s = sin(theta);
+
+        // Looking outwards from the ring, y down
+        View &view = vViews[k];
+        view.Rcw << s, 0, -c,
+                    0, 1, 0,
+                    c, 0, s;
+        view.tcw = -view.Rcw*Eigen::Vector3f(r*c,VIEW_HEIGHT,r*s);
+        view.vSlots.clear();
+        view.vSlots.reserve(mParams.nFeatures);
+    }
+}
+
+bool SyntheticMap::Observe(View &view, int nLandmark)
+{
+    if((int)view.vSlots.size()>=mParams.nFeatures)
+        return false;
+
+    const Landmark &landmark = mvLandmarks[nLandmark];
+    const Eigen::Vector3f Pc = view.Rcw*landmark.pos+view.tcw;
+    if(Pc(2)<=0)
+        return false;
+
+    const float invz = 1.0f/Pc(2);
+    const float u = mpCamera->fx*Pc(0)*invz+mpCamera->cx;
+    const float v = mpCamera->fy*Pc(1)*invz+mpCamera->cy;
+    if(u<mpCamera->mnMinX || u>=mpCamera->mnMaxX || v<mpCamera->mnMinY || v>=mpCamera->mnMaxY)
+        return false;
+
+    // Scale level at which the extractor would find it from this distance
+    const float fRatio = mpCamera->fx*landmark.fSize*invz/31.0f;
+    int level = fRatio>1.0f ? cvRound(log(fRatio)/log(mfScaleFactor)) : 0;
+    level = min(level,mnLevels-1);
+
+    const float fNoise = mParams.fPixelNoise*mvScaleFactors[level];
+    Slot slot;
+    slot.nLandmark = nLandmark;
+    slot.u = min(max(u+(float)mRng.gaussian(fNoise),(float)mpCamera->mnMinX),mpCamera->mnMaxX-1.0f);
+    slot.v = min(max(v+(float)mRng.gaussian(fNoise),(float)mpCamera->mnMinY),mpCamera->mnMaxY-1.0f);
+    slot.level = level;
+    view.vSlots.push_back(slot);
+    return true;
+}
+
+Map* SyntheticMap::GenerateMap(MapDatabase* pMapDB, int nMap, vector<pair<KeyFrame*,KeyFrame*> > &vLoops)
+{
+    vector<View> vViews;
+    PlaceViews(nMap,vViews);
+
+    // Each landmark is seen in every lap by the closest keyframes of the lap that see it
+    const int nLaps = (mParams.nKeyFrames+mnViewsPerLap-1)/mnViewsPerLap;
+    // Never past half the lap, so no keyframe is tried twice
+    const int nWindow = min(mnViewsPerLap/4+1,(mnViewsPerLap-1)/2);
+    vector<int> vObserved;
+    for(size_t j=0; j<mvLandmarks.size(); j++)
+    {
+        const int i0 = j/mParams.nPointsPerKeyFrame;
+        vObserved.clear();
+        for(int nLap=0; nLap<nLaps; nLap++)
+        {
+            int nSeen = 0;
+            for(int o=0; o<=2*nWindow && nSeen<mParams.nCovisible; o++)
+            {
+                // Offsets 0, 1, -1, 2, -2...
+                const int offset = (o%2==1) ? (o+1)/2 : -o/2;
+                const int i = ((i0+offset)%mnViewsPerLap+mnViewsPerLap)%mnViewsPerLap;
+                const int k = nLap*mnViewsPerLap+i;
+                if(k>=mParams.nKeyFrames)
+                    continue;
+                if(Observe(vViews[k],j))
+                {
+                    vObserved.push_back(k);
+                    nSeen++;
+                }
+            }
+        }
+
+        // A map point needs two observations, the slots just added are the last of their keyframes
+        if(vObserved.size()<2)
+        {
+            for(size_t i=0; i<vObserved.size(); i++)
+                vViews[vObserved[i]].vSlots.pop_back();
+        }
+    }
+
+    Map* pMap = pMapDB->getNewMap();
+    KeyFrameDatabase* pKFDB = pMap->GetKeyFrameDatabase();
+
+    // Keyframes are created in order, as Local Mapping would process them. All the observations of a keyframe
+    // are of points hosted by it or by earlier keyframes, so its covisibility weights are final once it is
+    // connected, and the first keyframe is never given a parent
+    vector<MapPoint*> vpPoints(mvLandmarks.size(),static_cast<MapPoint*>(NULL));
+    vector<KeyFrame*> vpKFs(mParams.nKeyFrames,static_cast<KeyFrame*>(NULL));
+    for(int k=0; k<mParams.nKeyFrames; k++)
+    {
+        const View &view = vViews[k];
+        KeyFrame* pKF = CreateKeyFrame(view,pMap,0.1*k);
+        vpKFs[k] = pKF;
+        pMap->AddKeyFrame(pKF);
+
+        vector<MapPoint*> vpNew;
+        for(size_t i=0; i<view.vSlots.size(); i++)
+        {
+            const int j = view.vSlots[i].nLandmark;
+            MapPoint* pMP = vpPoints[j];
+            if(!pMP)
+            {
+                pMP = new MapPoint(Converter::toCvMat(mvLandmarks[j].pos),pKF,pMap);
+                vpPoints[j] = pMP;
+                vpNew.push_back(pMP);
+            }
+            pMP->AddObservation(pKF,i);
+            pKF->AddMapPoint(pMP,i);
+        }
+
+        // Descriptors and normals of all the points the keyframe sees, as after its triangulation and fusion
+        for(size_t i=0; i<view.vSlots.size(); i++)
+        {
+            MapPoint* pMP = vpPoints[view.vSlots[i].nLandmark];
+            pMP->ComputeDistinctiveDescriptors();
+            pMP->UpdateNormalAndDepth();
+        }
+        for(size_t i=0; i<vpNew.size(); i++)
+            pMap->AddMapPoint(vpNew[i]);
+
+        pKF->UpdateConnections();
+
+        // The first keyframe of a lap closes the loop with the first keyframe of the previous lap
+        if(k>=mnViewsPerLap && k%mnViewsPerLap==0)
+        {
+            KeyFrame* pLoopKF = vpKFs[k-mnViewsPerLap];
+            pKF->AddLoopEdge(pLoopKF);
+            pLoopKF->AddLoopEdge(pKF);
+            vLoops.push_back(make_pair(pKF,pLoopKF));
+        }
+
+        pKFDB->add(pKF);
+    }
+
+    pMapDB->addMap(pMap);
+    return pMap;
+}
+
+KeyFrame* SyntheticMap::CreateKeyFrame(const View &view, Map* pMap, double timestamp)
+{
+    Frame F;
+    F.mpORBvocabulary = mpVocabulary;
+    F.mpORBextractor = NULL;
+    F.mTimeStamp = timestamp;
+    F.mpCamera = mpCamera;
+    F.mK = mpCamera->mK;
+    F.fx = mpCamera->fx;
+    F.fy = mpCamera->fy;
+    F.cx = mpCamera->cx;
+    F.cy = mpCamera->cy;
+    F.mDistCoef = mpCamera->mDistCoef;
+    F.mnMinX = mpCamera->mnMinX;
+    F.mnMaxX = mpCamera->mnMaxX;
+    F.mnMinY = mpCamera->mnMinY;
+    F.mnMaxY = mpCamera->mnMaxY;
+    F.mfGridElementWidthInv = mpCamera->mfGridElementWidthInv;
+    F.mfGridElementHeightInv = mpCamera->mfGridElementHeightInv;
+
+    F.mnScaleLevels = mnLevels;
+    F.mfScaleFactor = mfScaleFactor;
+    F.mvScaleFactors = mvScaleFactors;
+    F.mvLevelSigma2 = mvLevelSigma2;
+    F.mvInvLevelSigma2 = mvInvLevelSigma2;
+
+    // The observations first, then clutter with its own descriptors
+    const int nSlots = view.vSlots.size();
+    F.N = max(mParams.nFeatures,nSlots);
+    F.mvKeysUn.resize(F.N);
+    F.mDescriptors.create(F.N,32,CV_8U);
+    for(int i=0; i<F.N; i++)
+    {
+        cv::KeyPoint &kp = F.mvKeysUn[i];
+        cv::Mat desc = F.mDescriptors.row(i);
+        if(i<nSlots)
+        {
+            const Slot &slot = view.vSlots[i];
+            kp.pt = cv::Point2f(slot.u,slot.v);
+            kp.octave = slot.level;
+            mvLandmarks[slot.nLandmark].descriptor.copyTo(desc);
+
+            const int nFlipped = mRng.uniform(0,mParams.nFlippedBits+1);
+            for(int b=0; b<nFlipped; b++)
+            {
+                const int bit = mRng.uniform(0,256);
+                desc.at<uchar>(bit/8) ^= (uchar)(1<<(bit%8));
+            }
+        }
+        else
+        {
+            kp.pt = cv::Point2f(mRng.uniform((float)F.mnMinX,(float)F.mnMaxX),mRng.uniform((float)F.mnMinY,(float)F.mnMaxY));
+            kp.octave = mRng.uniform(0,mnLevels);
+            mRng.fill(desc,cv::RNG::UNIFORM,0,256);
+        }
+        kp.size = 31.0f*mvScaleFactors[kp.octave];
+        kp.angle = mRng.uniform(0.0f,360.0f);
+        kp.response = 1.0f;
+    }
+    F.mvKeys = F.mvKeysUn;
+    F.mvpMapPoints = vector<MapPoint*>(F.N,static_cast<MapPoint*>(NULL));
+    F.mvbOutlier = vector<bool>(F.N,false);
+
+    F.AssignFeaturesToGrid();
+
+    F.mTcw = cv::Mat::eye(4,4,CV_32F);
+    Converter::toCvMat(view.Rcw).copyTo(F.mTcw.rowRange(0,3).colRange(0,3));
+    Converter::toCvMat(view.tcw).copyTo(F.mTcw.rowRange(0,3).col(3));
+    F.mnId = Frame::nNextId++;
+    F.mpReferenceKF = NULL;
+
+    KeyFrame* pKF = new KeyFrame(F,pMap,pMap->GetKeyFrameDatabase());
+    pKF->ComputeBoW();
+    return pKF;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,263 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/TaskPool.h"
+#include "util/Trace.h"
+
+#include <boost/bind.hpp>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+// Demotion of each thread, none unless set
+static boost::thread_specific_ptr<int> sThreadDemotion;
+
+TaskPool::TaskPool():
+    mnThreads(0), mbStarted(false), mbInline(false), mnNextWorker(0), mnQueued(0), mbStop(false)
+{
+}
+
+TaskPool::~TaskPool()
+{
+    {
+        boost::mutex::scoped_lock lock(mMutexSleep);
+        mbStop = true;
+        mWakeUp.notify_all();
+    }
+
+    for(size_t i=0; i<mvpWorkers.size(); i++)
+    {
+        mvpWorkers[i]->pThread->join();
+        delete mvpWorkers[i]->pThread;
+        delete mvpWorkers[i];
+    }
+}
+
+TaskPool* TaskPool::Global()
+{
+    static TaskPool pool;
+    return &pool;
+}
+
+void TaskPool::SetThreads(int nThreads)
+{
+    boost::mutex::scoped_lock lock(mMutexStart);
+    if(!mbStarted)
+        mnThreads = max(nThreads,0);
+}
+
+int TaskPool::GetThreads()
+{
+    boost::mutex::scoped_lock lock(mMutexStart);
+    if(mbStarted)
+        return mvpWorkers.size();
+    return mnThreads>0 ? mnThreads : max((int)boost::thread::hardware_concurrency(),1);
+}
+
+void TaskPool::SetInline(bool bInline)
+{
+    mbInline = bInline;
+}
+
+bool TaskPool::isInline()
+{
+    return mbInline;
+}
+
+void TaskPool::SetThreadDemotion(int nLevels)
+{
+    sThreadDemotion.reset(new int(max(nLevels,0)));
+}
+
+int TaskPool::GetThreadDemotion()
+{
+    int* pDemotion = sThreadDemotion.get();
+    return pDemotion ? *pDemotion : 0;
+}
+
+TaskPool::Priority TaskPool::Demote(Priority priority)
+{
+    return static_cast<Priority>(min((int)priority+GetThreadDemotion(),N_PRIORITIES-1));
+}
+
+void TaskPool::Start()
+{
+    boost::mutex::scoped_lock lock(mMutexStart);
+    if(mbStarted)
+        return;
+
+    int nThreads = mnThreads;
+    if(nThreads<=0)
+        nThreads = max((int)boost::thread::hardware_concurrency(),1);
+
+    // The workers are all created before any runs, they read the others' queues
+    mvpWorkers.resize(nThreads);
+    for(int i=0; i<nThreads; i++)
+        mvpWorkers[i] = new Worker();
+    for(int i=0; i<nThreads; i++)
+        mvpWorkers[i]->pThread = new boost::thread(&TaskPool::RunWorker,this,i);
+
+    mbStarted = true;
+}
+
+void TaskPool::Submit(const boost::shared_ptr<Task> &pTask, Priority priority)
+{
+    Start();
+
+    // A worker keeps its own tasks, other threads spread theirs over the workers
+    int* pId = mWorkerId.get();
+    const int id = pId ? *pId : mnNextWorker.fetch_add(1,boost::memory_order_relaxed)%mvpWorkers.size();
+
+    {
+        Worker* pWorker = mvpWorkers[id];
+        boost::mutex::scoped_lock lock(pWorker->mutex);
+        pWorker->queues[priority].push_back(pTask);
+    }
+
+    mnQueued++;
+    boost::mutex::scoped_lock lock(mMutexSleep);
+    mWakeUp.notify_one();
+}
+
+bool TaskPool::TakeTask(int id, boost::shared_ptr<Task> &pTask)
+{
+    const int N = mvpWorkers.size();
+    for(int p=0; p<N_PRIORITIES; p++)
+    {
+        // Own queue first, newest task
+        {
+            Worker* pWorker = mvpWorkers[id];
+            boost::mutex::scoped_lock lock(pWorker->mutex);
+            deque<boost::shared_ptr<Task> > &queue = pWorker->queues[p];
+            if(!queue.empty())
+            {
+                pTask = queue.back();
+                queue.pop_back();
+                mnQueued--;
+                return true;
+            }
+        }
+
+        // Then the oldest task of another worker
+        for(int i=1; i<N; i++)
+        {
+            Worker* pWorker = mvpWorkers[(id+i)%N];
+            boost::mutex::scoped_lock lock(pWorker->mutex);
+            deque<boost::shared_ptr<Task> > &queue = pWorker->queues[p];
+            if(!queue.empty())
+            {
+                pTask = queue.front();
+                queue.pop_front();
+                mnQueued--;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void TaskPool::Execute(const boost::shared_ptr<Task> &pTask)
+{
+    if(pTask->claimed.exchange(true))
+        return;
+    {
+        TRACE_SCOPE("TaskPool::Task");
+        const int nDemotion = GetThreadDemotion();
+        if(pTask->nDemotion!=nDemotion)
+            SetThreadDemotion(pTask->nDemotion);
+        pTask->function();
+        if(pTask->nDemotion!=nDemotion)
+            SetThreadDemotion(nDemotion);
+    }
+    pTask->pGroup->Finished();
+}
+
+void TaskPool::RunWorker(int id)
+{
+    mWorkerId.reset(new int(id));
+    Tracer::Global()->SetThreadName("TaskPool");
+
+    while(true)
+    {
+        boost::shared_ptr<Task> pTask;
+        if(TakeTask(id,pTask))
+        {
+            Execute(pTask);
+            continue;
+        }
+
+        boost::mutex::scoped_lock lock(mMutexSleep);
+        while(mnQueued==0 && !mbStop)
+            mWakeUp.wait(lock);
+        if(mbStop)
+            break;
+    }
+}
+
+TaskGroup::TaskGroup(TaskPool::Priority priority, TaskPool* pPool):
+    mpPool(pPool), mPriority(TaskPool::Demote(priority)), mnPending(0)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    Wait();
+}
+
+void TaskGroup::Run(const boost::function<void()> &function)
+{
+    boost::shared_ptr<TaskPool::Task> pTask(new TaskPool::Task());
+    pTask->function = function;
+    pTask->pGroup = this;
+    pTask->nDemotion = TaskPool::GetThreadDemotion();
+    pTask->claimed = false;
+
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mnPending++;
+    }
+    mvpTasks.push_back(pTask);
+    if(!mpPool->isInline())
+        mpPool->Submit(pTask,mPriority);
+}
+
+void TaskGroup::Wait()
+{
+    // Whatever no worker took yet runs here, the queues drop it once claimed
+    for(size_t i=0; i<mvpTasks.size(); i++)
+        TaskPool::Execute(mvpTasks[i]);
+    mvpTasks.clear();
+
+    boost::mutex::scoped_lock lock(mMutex);
+    while(mnPending>0)
+        mDone.wait(lock);
+}
+
+void TaskGroup::Finished()
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    mnPending--;
+    if(mnPending==0)
+        mDone.notify_all();
+}
+
+} //namespace ORB_SLAM
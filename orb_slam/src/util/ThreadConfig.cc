@@ -0,0 +1,211 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/ThreadConfig.h"
+#include "util/TaskPool.h"
+#include "util/Trace.h"
+
+#include <ros/ros.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+#include <algorithm>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+ThreadConfig::ThreadConfig():
+    mnRealTimePriority(0), mnNice(0), mbLockMemory(false), mnPoolDemotion(0)
+{
+}
+
+ThreadConfig::ThreadConfig(const cv::FileStorage &fSettings, const string &name):
+    mName(name), mnRealTimePriority(0), mnNice(0), mbLockMemory(false), mnPoolDemotion(0)
+{
+    const string strCores = (string)fSettings[name+".Cores"];
+    if(!ParseCores(strCores,mvCores))
+    {
+        ROS_WARN("%s.Cores: can not parse \"%s\", the thread may run on any core.",name.c_str(),strCores.c_str());
+        mvCores.clear();
+    }
+
+    mnRealTimePriority = fSettings[name+".RealTimePriority"];
+    mnNice = fSettings[name+".Nice"];
+    mbLockMemory = (int)fSettings[name+".LockMemory"]!=0;
+
+    int nSessionPriority = fSettings["Session.Priority"];
+    mnPoolDemotion = max(nSessionPriority,0);
+}
+
+bool ThreadConfig::ParseCores(const string &str, vector<int> &vCores)
+{
+    vCores.clear();
+    stringstream ss(str);
+    string item;
+    while(getline(ss,item,','))
+    {
+        if(item.find_first_not_of(" ")==string::npos)
+            continue;
+
+        int first, last;
+        char dash;
+        stringstream range(item);
+        if(!(range >> first))
+            return false;
+        if(range >> dash)
+        {
+            if(dash!='-' || !(range >> last))
+                return false;
+        }
+        else
+            last = first;
+        if(first<0 || last<first || last>=CPU_SETSIZE)
+            return false;
+
+        for(int c=first; c<=last; c++)
+            vCores.push_back(c);
+    }
+    return true;
+}
+
+bool ThreadConfig::isDefault() const
+{
+    return mvCores.empty() && mnRealTimePriority==0 && mnNice==0 && !mbLockMemory && mnPoolDemotion==0;
+}
+
+bool ThreadConfig::Apply() const
+{
+    if(!mName.empty())
+        Tracer::Global()->SetThreadName(mName);
+
+    bool bOk = true;
+
+    if(mnPoolDemotion>0)
+        TaskPool::SetThreadDemotion(mnPoolDemotion);
+
+    if(!mvCores.empty())
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for(size_t i=0; i<mvCores.size(); i++)
+            CPU_SET(mvCores[i],&cpuset);
+        const int err = pthread_setaffinity_np(pthread_self(),sizeof(cpuset),&cpuset);
+        if(err!=0)
+        {
+            ROS_WARN("%s thread: unable to set the cores (%s).",mName.c_str(),strerror(err));
+            bOk = false;
+        }
+    }
+
+    if(mnRealTimePriority>0)
+    {
+        sched_param param;
+        param.sched_priority = mnRealTimePriority;
+        const int err = pthread_setschedparam(pthread_self(),SCHED_FIFO,&param);
+        if(err!=0)
+        {
+            ROS_WARN("%s thread: unable to set SCHED_FIFO priority %d (%s), CAP_SYS_NICE or an rtprio limit is needed.",
+                     mName.c_str(),mnRealTimePriority,strerror(err));
+            bOk = false;
+        }
+    }
+    else if(mnNice!=0)
+    {
+        // Linux keeps a nice value per thread, set through its thread id
+        const pid_t tid = syscall(SYS_gettid);
+        if(setpriority(PRIO_PROCESS,tid,mnNice)!=0)
+        {
+            ROS_WARN("%s thread: unable to set nice %d (%s).",mName.c_str(),mnNice,strerror(errno));
+            bOk = false;
+        }
+    }
+
+    // Locks every thread's memory, not only this one's, there is no per thread locking
+    if(mbLockMemory && mlockall(MCL_CURRENT|MCL_FUTURE)!=0)
+    {
+        ROS_WARN("%s thread: unable to lock the memory (%s), CAP_IPC_LOCK or a memlock limit is needed.",
+                 mName.c_str(),strerror(errno));
+        bOk = false;
+    }
+
+    ROS_INFO("%s thread: %s%s",mName.c_str(),DescribeCurrent().c_str(),mbLockMemory && bOk ? ", memory locked" : "");
+    if(mnPoolDemotion>0)
+        ROS_INFO("%s thread: pool tasks demoted by %d",mName.c_str(),mnPoolDemotion);
+    return bOk;
+}
+
+void ThreadConfig::Run(const ThreadConfig &config, const boost::function<void()> &function)
+{
+    config.Apply();
+    function();
+}
+
+string ThreadConfig::DescribeCurrent()
+{
+    stringstream ss;
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    ss << "cores ";
+    if(pthread_getaffinity_np(pthread_self(),sizeof(cpuset),&cpuset)==0)
+    {
+        // Ranges of consecutive cores
+        bool bFirst = true;
+        for(int c=0; c<CPU_SETSIZE; c++)
+        {
+            if(!CPU_ISSET(c,&cpuset))
+                continue;
+            int last = c;
+            while(last+1<CPU_SETSIZE && CPU_ISSET(last+1,&cpuset))
+                last++;
+            ss << (bFirst ? "" : ",") << c;
+            if(last>c)
+                ss << "-" << last;
+            bFirst = false;
+            c = last;
+        }
+    }
+    else
+        ss << "?";
+
+    int policy;
+    sched_param param;
+    if(pthread_getschedparam(pthread_self(),&policy,&param)==0 && policy==SCHED_FIFO)
+        ss << ", SCHED_FIFO " << param.sched_priority;
+    else
+    {
+        errno = 0;
+        const int nice = getpriority(PRIO_PROCESS,syscall(SYS_gettid));
+        ss << ", nice " << (errno==0 ? nice : 0);
+    }
+
+    return ss.str();
+}
+
+} //namespace ORB_SLAM
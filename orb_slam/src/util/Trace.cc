@@ -0,0 +1,170 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/Trace.h"
+
+#include <fstream>
+#include <algorithm>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+boost::atomic<bool> Tracer::sbEnabled(false);
+
+void Tracer::KeepBuffer(ThreadBuffer*)
+{
+}
+
+Tracer::Tracer():
+    mnEvents(0), mBuffer(&Tracer::KeepBuffer)
+{
+}
+
+Tracer::~Tracer()
+{
+    sbEnabled = false;
+    for(size_t i=0; i<mvpBuffers.size(); i++)
+        delete mvpBuffers[i];
+}
+
+Tracer* Tracer::Global()
+{
+    static Tracer tracer;
+    return &tracer;
+}
+
+void Tracer::Enable(size_t nEvents)
+{
+    {
+        boost::mutex::scoped_lock lock(mMutexBuffers);
+        if(mnEvents==0)
+            mnEvents = max(nEvents,(size_t)1);
+    }
+    sbEnabled = true;
+}
+
+void Tracer::Disable()
+{
+    sbEnabled = false;
+}
+
+unsigned long long Tracer::Now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (unsigned long long)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+Tracer::ThreadBuffer* Tracer::GetBuffer()
+{
+    ThreadBuffer* pBuffer = mBuffer.get();
+    if(pBuffer)
+        return pBuffer;
+
+    pBuffer = new ThreadBuffer();
+    pBuffer->nWritten = 0;
+    {
+        boost::mutex::scoped_lock lock(mMutexBuffers);
+        pBuffer->id = mvpBuffers.size();
+        mvpBuffers.push_back(pBuffer);
+    }
+    mBuffer.reset(pBuffer);
+    return pBuffer;
+}
+
+void Tracer::Record(const char* name, unsigned long long begin, unsigned long long end)
+{
+    ThreadBuffer* pBuffer = GetBuffer();
+
+    // Allocated on the first span, named threads that never record take no room
+    if(pBuffer->vEvents.empty())
+    {
+        boost::mutex::scoped_lock lock(mMutexBuffers);
+        pBuffer->vEvents.resize(mnEvents);
+    }
+
+    const unsigned long n = pBuffer->nWritten.load(boost::memory_order_relaxed);
+    Event &event = pBuffer->vEvents[n%pBuffer->vEvents.size()];
+    event.name = name;
+    event.begin = begin;
+    event.end = end;
+    pBuffer->nWritten.store(n+1,boost::memory_order_release);
+}
+
+void Tracer::SetThreadName(const string &name)
+{
+    ThreadBuffer* pBuffer = GetBuffer();
+    boost::mutex::scoped_lock lock(mMutexBuffers);
+    pBuffer->name = name;
+}
+
+bool Tracer::SaveChromeJSON(const string &filename)
+{
+    ofstream f(filename.c_str());
+    if(!f.is_open())
+        return false;
+
+    const int pid = getpid();
+    f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << endl;
+    bool bFirst = true;
+
+    boost::mutex::scoped_lock lock(mMutexBuffers);
+    for(size_t b=0; b<mvpBuffers.size(); b++)
+    {
+        ThreadBuffer* pBuffer = mvpBuffers[b];
+        const int tid = pBuffer->id;
+
+        if(!pBuffer->name.empty())
+        {
+            f << (bFirst ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << tid
+              << ",\"args\":{\"name\":\"" << pBuffer->name << "\"}}";
+            bFirst = false;
+        }
+
+        const size_t N = pBuffer->vEvents.size();
+        if(N==0)
+            continue;
+
+        // Copy, then keep only the spans that were not overwritten while copying
+        // The slot of the span being written when the copy ended is excluded too
+        const unsigned long nBefore = pBuffer->nWritten.load(boost::memory_order_acquire);
+        const vector<Event> vEvents = pBuffer->vEvents;
+        const unsigned long nAfter = pBuffer->nWritten.load(boost::memory_order_acquire);
+        const unsigned long nFirst = nAfter>=N ? nAfter-N+1 : 0;
+
+        for(unsigned long i=nFirst; i<nBefore; i++)
+        {
+            const Event &event = vEvents[i%N];
+            f << (bFirst ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << tid
+              << ",\"ts\":" << event.begin/1000 << "." << (event.begin/100)%10
+              << ",\"dur\":" << (event.end-event.begin)/1000 << "." << ((event.end-event.begin)/100)%10 << "}";
+            bFirst = false;
+        }
+    }
+
+    f << "\n]}" << endl;
+    return f.good();
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,219 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/TrajectoryEvaluation.h"
+
+#include <Eigen/LU>
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace ORB_SLAM
+{
+
+static bool SortByTime(const TrajectoryEvaluation::StampedPose &a, const TrajectoryEvaluation::StampedPose &b)
+{
+    return a.timestamp<b.timestamp;
+}
+
+bool TrajectoryEvaluation::LoadTUM(const std::string &filename, Trajectory &trajectory)
+{
+    std::ifstream f(filename.c_str());
+    if(!f.is_open())
+        return false;
+    std::string line;
+    while(std::getline(f,line))
+    {
+        if(line.empty() || line[0]=='#')
+            continue;
+        std::stringstream ss(line);
+        StampedPose pose;
+        double qx, qy, qz, qw;
+        if(!(ss >> pose.timestamp >> pose.t.x() >> pose.t.y() >> pose.t.z() >> qx >> qy >> qz >> qw))
+            continue;
+        pose.q = Eigen::Quaterniond(qw,qx,qy,qz).normalized();
+        trajectory.push_back(pose);
+    }
+    std::sort(trajectory.begin(),trajectory.end(),SortByTime);
+    return !trajectory.empty();
+}
+
+bool TrajectoryEvaluation::LoadEuRoC(const std::string &filename, Trajectory &trajectory)
+{
+    std::ifstream f(filename.c_str());
+    if(!f.is_open())
+        return false;
+    std::string line;
+    while(std::getline(f,line))
+    {
+        if(line.empty() || line[0]=='#')
+            continue;
+        std::replace(line.begin(),line.end(),',',' ');
+        std::stringstream ss(line);
+        StampedPose pose;
+        double ns, qw, qx, qy, qz;
+        if(!(ss >> ns >> pose.t.x() >> pose.t.y() >> pose.t.z() >> qw >> qx >> qy >> qz))
+            continue;
+        pose.timestamp = ns*1e-9;
+        pose.q = Eigen::Quaterniond(qw,qx,qy,qz).normalized();
+        trajectory.push_back(pose);
+    }
+    std::sort(trajectory.begin(),trajectory.end(),SortByTime);
+    return !trajectory.empty();
+}
+
+bool TrajectoryEvaluation::LoadKITTI(const std::string &filename, const std::vector<double> &vTimestamps, Trajectory &trajectory)
+{
+    std::ifstream f(filename.c_str());
+    if(!f.is_open())
+        return false;
+    std::string line;
+    size_t i = 0;
+    while(std::getline(f,line) && i<vTimestamps.size())
+    {
+        if(line.empty())
+            continue;
+        std::stringstream ss(line);
+        Eigen::Matrix3d R;
+        StampedPose pose;
+        if(!(ss >> R(0,0) >> R(0,1) >> R(0,2) >> pose.t.x() >> R(1,0) >> R(1,1) >> R(1,2) >> pose.t.y()
+                >> R(2,0) >> R(2,1) >> R(2,2) >> pose.t.z()))
+            return false;
+        pose.timestamp = vTimestamps[i++];
+        pose.q = Eigen::Quaterniond(R).normalized();
+        trajectory.push_back(pose);
+    }
+    return !trajectory.empty();
+}
+
+// Index of the ground truth pose nearest in time, -1 if none within fMaxDifference
+static int Associate(const TrajectoryEvaluation::Trajectory &groundTruth, double timestamp, double fMaxDifference)
+{
+    TrajectoryEvaluation::StampedPose query;
+    query.timestamp = timestamp;
+    TrajectoryEvaluation::Trajectory::const_iterator it =
+            std::lower_bound(groundTruth.begin(),groundTruth.end(),query,SortByTime);
+
+    int best = -1;
+    double bestDiff = fMaxDifference;
+    if(it!=groundTruth.end() && it->timestamp-timestamp<=bestDiff)
+    {
+        best = it-groundTruth.begin();
+        bestDiff = it->timestamp-timestamp;
+    }
+    if(it!=groundTruth.begin() && timestamp-(it-1)->timestamp<=bestDiff)
+        best = (it-1)-groundTruth.begin();
+    return best;
+}
+
+static double RMSE(const std::vector<double> &vErrors)
+{
+    double sum = 0;
+    for(size_t i=0; i<vErrors.size(); i++)
+        sum += vErrors[i]*vErrors[i];
+    return vErrors.empty() ? 0 : std::sqrt(sum/vErrors.size());
+}
+
+bool TrajectoryEvaluation::Evaluate(const Trajectory &estimate, const Trajectory &groundTruth, Result &result,
+                                    double fMaxDifference, double fDelta)
+{
+    result = Result();
+
+    // Pairs of estimated and ground truth poses, in the time order of the estimate
+    Trajectory sortedEstimate(estimate);
+    std::sort(sortedEstimate.begin(),sortedEstimate.end(),SortByTime);
+    std::vector<int> vEstimate, vGroundTruth;
+    for(size_t i=0; i<sortedEstimate.size(); i++)
+    {
+        const int j = Associate(groundTruth,sortedEstimate[i].timestamp,fMaxDifference);
+        if(j<0 || (!vGroundTruth.empty() && vGroundTruth.back()==j))
+            continue;
+        vEstimate.push_back(i);
+        vGroundTruth.push_back(j);
+    }
+
+    const int N = vEstimate.size();
+    if(N<3)
+        return false;
+
+    Eigen::Matrix<double,3,Eigen::Dynamic> src(3,N), dst(3,N);
+    for(int i=0; i<N; i++)
+    {
+        src.col(i) = sortedEstimate[vEstimate[i]].t;
+        dst.col(i) = groundTruth[vGroundTruth[i]].t;
+    }
+
+    // Similarity taking the estimate to the ground truth
+    const Eigen::Matrix4d S = Eigen::umeyama(src,dst,true);
+    const Eigen::Matrix3d sR = S.topLeftCorner<3,3>();
+    const double s = std::pow(sR.determinant(),1.0/3.0);
+
+    result.nPoses = N;
+    result.scale = s;
+
+    std::vector<double> vAte(N);
+    for(int i=0; i<N; i++)
+        vAte[i] = (sR*src.col(i)+S.topRightCorner<3,1>()-dst.col(i)).norm();
+    result.ateRmse = RMSE(vAte);
+    double sum = 0;
+    for(int i=0; i<N; i++)
+        sum += vAte[i];
+    result.ateMean = sum/N;
+    result.ateMax = *std::max_element(vAte.begin(),vAte.end());
+    std::vector<double> vSorted(vAte);
+    std::nth_element(vSorted.begin(),vSorted.begin()+N/2,vSorted.end());
+    result.ateMedian = vSorted[N/2];
+
+    // Motion from each pose to the first one at least fDelta later, in the frame of the first
+    std::vector<double> vTrans, vRot;
+    int j = 0;
+    for(int i=0; i<N; i++)
+    {
+        const StampedPose &e1 = sortedEstimate[vEstimate[i]];
+        const StampedPose &g1 = groundTruth[vGroundTruth[i]];
+        j = std::max(j,i+1);
+        while(j<N && groundTruth[vGroundTruth[j]].timestamp-g1.timestamp<fDelta)
+            j++;
+        if(j>=N)
+            break;
+        const StampedPose &e2 = sortedEstimate[vEstimate[j]];
+        const StampedPose &g2 = groundTruth[vGroundTruth[j]];
+
+        const Eigen::Quaterniond qe = e1.q.conjugate()*e2.q;
+        const Eigen::Vector3d te = s*(e1.q.conjugate()*(e2.t-e1.t));
+        const Eigen::Quaterniond qg = g1.q.conjugate()*g2.q;
+        const Eigen::Vector3d tg = g1.q.conjugate()*(g2.t-g1.t);
+
+        // Error of the estimated motion with respect to the true one
+        const Eigen::Quaterniond qErr = qg.conjugate()*qe;
+        vTrans.push_back((qg.conjugate()*(te-tg)).norm());
+        vRot.push_back(Eigen::AngleAxisd(qErr.normalized()).angle()*180.0/M_PI);
+    }
+    result.nPairs = vTrans.size();
+    result.rpeTransRmse = RMSE(vTrans);
+    result.rpeRotRmse = RMSE(vRot);
+
+    return true;
+}
+
+} //namespace ORB_SLAM
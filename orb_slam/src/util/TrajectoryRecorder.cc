@@ -0,0 +1,122 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/TrajectoryRecorder.h"
+#include "util/BinaryIO.h"
+
+namespace ORB_SLAM
+{
+
+TrajectoryRecorder::TrajectoryRecorder(size_t capacity):
+    mqPoses(capacity), mnDropped(0), mbClosing(false), mpWriter(NULL)
+{
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+    Close();
+}
+
+bool TrajectoryRecorder::Open(const std::string &filename)
+{
+    Close();
+
+    // Large writes, the records are small
+    mvFileBuffer.resize(1<<16);
+    mFile.rdbuf()->pubsetbuf(&mvFileBuffer[0],mvFileBuffer.size());
+    mFile.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+    if(!mFile.is_open())
+        return false;
+
+    mstrFilename = filename;
+    mbClosing = false;
+    mpWriter = new boost::thread(&TrajectoryRecorder::RunWriter,this);
+    return true;
+}
+
+void TrajectoryRecorder::Record(const FramePose &pose)
+{
+    if(mpWriter==NULL)
+        return;
+    if(!mqPoses.Push(pose))
+        mnDropped++;
+}
+
+void TrajectoryRecorder::Close()
+{
+    if(mpWriter==NULL)
+        return;
+
+    mbClosing = true;
+    mpWriter->join();
+    delete mpWriter;
+    mpWriter = NULL;
+
+    mFile.close();
+}
+
+bool TrajectoryRecorder::ReadAll(std::vector<FramePose> &vPoses)
+{
+    vPoses.clear();
+    if(mstrFilename.empty())
+        return false;
+
+    std::ifstream f(mstrFilename.c_str(), std::ios::binary);
+    if(!f.is_open())
+        return false;
+
+    FramePose pose;
+    while(BinaryIO::ReadPod(f,pose))
+        vPoses.push_back(pose);
+    return true;
+}
+
+size_t TrajectoryRecorder::Dropped() const
+{
+    return mnDropped;
+}
+
+void TrajectoryRecorder::RunWriter()
+{
+    while(!mbClosing)
+    {
+        // Polled, the producer never takes a lock to signal
+        if(Drain()==0)
+            boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+    }
+
+    // Whatever was pushed before Close
+    Drain();
+    mFile.flush();
+}
+
+size_t TrajectoryRecorder::Drain()
+{
+    size_t n = 0;
+    FramePose pose;
+    while(mqPoses.Pop(pose))
+    {
+        BinaryIO::WritePod(mFile,pose);
+        n++;
+    }
+    return n;
+}
+
+} //namespace ORB_SLAM
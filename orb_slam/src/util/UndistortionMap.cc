@@ -0,0 +1,108 @@
+/**
+* This file is part of ORB-SLAM.
+*
+* Copyright (C) 2014 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <http://webdiis.unizar.es/~raulmur/orbslam/>
+*
+* ORB-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/UndistortionMap.h"
+
+#include <cmath>
+#include <algorithm>
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+
+namespace ORB_SLAM
+{
+
+UndistortionMap::UndistortionMap(): mnWidth(0), mnHeight(0), mfInvStep(0), mnCols(0), mnRows(0),
+    mnMinX(0), mnMaxX(0), mnMinY(0), mnMaxY(0)
+{
+}
+
+void UndistortionMap::Build(const cv::Mat &K, const cv::Mat &DistCoef, int width, int height, int step)
+{
+    mnWidth = width;
+    mnHeight = height;
+    mfInvStep = 1.0f/step;
+    mnCols = (width+step-1)/step+1;
+    mnRows = (height+step-1)/step+1;
+
+    cv::Mat mat(mnCols*mnRows,2,CV_32F);
+    for(int r=0; r<mnRows; r++)
+    {
+        for(int c=0; c<mnCols; c++)
+        {
+            mat.at<float>(r*mnCols+c,0)=c*step;
+            mat.at<float>(r*mnCols+c,1)=r*step;
+        }
+    }
+
+    mat=mat.reshape(2);
+    cv::undistortPoints(mat,mat,K,DistCoef,cv::Mat(),K);
+    mat=mat.reshape(1);
+
+    mvNodes.resize(mnCols*mnRows);
+    for(int i=0, iend=mvNodes.size(); i<iend; i++)
+        mvNodes[i] = cv::Point2f(mat.at<float>(i,0),mat.at<float>(i,1));
+
+    // Corners
+    cv::Mat corners(4,2,CV_32F);
+    corners.at<float>(0,0)=0.0; corners.at<float>(0,1)=0.0;
+    corners.at<float>(1,0)=width; corners.at<float>(1,1)=0.0;
+    corners.at<float>(2,0)=0.0; corners.at<float>(2,1)=height;
+    corners.at<float>(3,0)=width; corners.at<float>(3,1)=height;
+
+    corners=corners.reshape(2);
+    cv::undistortPoints(corners,corners,K,DistCoef,cv::Mat(),K);
+    corners=corners.reshape(1);
+
+    mnMinX = min(floor(corners.at<float>(0,0)),floor(corners.at<float>(2,0)));
+    mnMaxX = max(ceil(corners.at<float>(1,0)),ceil(corners.at<float>(3,0)));
+    mnMinY = min(floor(corners.at<float>(0,1)),floor(corners.at<float>(1,1)));
+    mnMaxY = max(ceil(corners.at<float>(2,1)),ceil(corners.at<float>(3,1)));
+}
+
+cv::Point2f UndistortionMap::Undistort(float x, float y) const
+{
+    const float fx = x*mfInvStep;
+    const float fy = y*mfInvStep;
+
+    // Points on or past the border use the last cell
+    const int c = max(0,min(static_cast<int>(fx),mnCols-2));
+    const int r = max(0,min(static_cast<int>(fy),mnRows-2));
+    const float a = fx-c;
+    const float b = fy-r;
+
+    const cv::Point2f* p = &mvNodes[r*mnCols+c];
+    const cv::Point2f top = p[0]+a*(p[1]-p[0]);
+    const cv::Point2f bottom = p[mnCols]+a*(p[mnCols+1]-p[mnCols]);
+    return top+b*(bottom-top);
+}
+
+void UndistortionMap::Undistort(const vector<cv::KeyPoint> &vKeys, vector<cv::KeyPoint> &vKeysUn) const
+{
+    vKeysUn.resize(vKeys.size());
+    for(size_t i=0, iend=vKeys.size(); i<iend; i++)
+    {
+        vKeysUn[i] = vKeys[i];
+        vKeysUn[i].pt = Undistort(vKeys[i].pt.x,vKeys[i].pt.y);
+    }
+}
+
+} //namespace ORB_SLAM